@@ -0,0 +1,335 @@
+#include <FML/ComputePowerSpectra/ComputePowerSpectrum.h>
+#include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/FriendsOfFriends/FoF.h>
+#include <FML/Global/Global.h>
+#include <FML/Interpolation/ParticleGridInterpolation.h>
+#include <FML/MPIParticles/MPIParticles.h>
+#include <FML/MultigridSolver/MultiGridSolver.h>
+#include <FML/PairCounting/PairCount.h>
+#include <FML/ParticlesInBoxes/ParticlesInBoxes.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//==================================================================
+//
+// Benchmark of the core kernels of the library. For each kernel we do one untimed
+// warm-up run followed by nrepeat timed runs. The time of a run is the max over tasks
+// (we have a barrier before and after) and we report the min, mean and max over the runs
+// together with the time per element (cell, particle or pair) and the machine setup
+// as JSON so the numbers can be tracked across releases. See run_scaling.sh for how to
+// do strong and weak scaling sweeps over threads and tasks.
+//
+// Usage: ./benchmark [Nmesh] [Npart_1D] [nrepeat] [outputfile] [kernels]
+//   kernels is a comma separated list of the kernels to run (fiducial: all), e.g. fft,fof
+//
+//==================================================================
+
+const int NDIM = 3;
+
+struct Particle {
+    double pos[NDIM];
+    double vel[NDIM];
+    constexpr int get_ndim() const { return NDIM; }
+    double * get_pos() { return pos; }
+    double * get_vel() { return vel; }
+};
+
+// A particle with only a position for the pair counting
+struct Point {
+    double pos[NDIM];
+    constexpr int get_ndim() const { return NDIM; }
+    double * get_pos() { return pos; }
+};
+
+struct BenchmarkResult {
+    std::string name;
+    std::string element;
+    double nelements;
+    std::vector<double> times;
+};
+
+//==================================================================
+// Time a kernel. setup is run (untimed) before every run of kernel
+//==================================================================
+BenchmarkResult time_kernel(std::string name,
+                            std::string element,
+                            double nelements,
+                            int nrepeat,
+                            std::function<void()> setup,
+                            std::function<void()> kernel) {
+    BenchmarkResult result{name, element, nelements, {}};
+    for (int i = 0; i <= nrepeat; i++) {
+        setup();
+#ifdef USE_MPI
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
+        auto start = std::chrono::steady_clock::now();
+        kernel();
+        double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        FML::MaxOverTasks(&time);
+
+        // The first run is a warm-up
+        if (i > 0)
+            result.times.push_back(time);
+    }
+    if (FML::ThisTask == 0) {
+        std::cout << "# " << std::setw(30) << std::left << name << " min " << std::setw(12)
+                  << *std::min_element(result.times.begin(), result.times.end()) << " sec\n";
+    }
+    return result;
+}
+
+//==================================================================
+// The results and the setup as JSON
+//==================================================================
+std::string to_json(const std::vector<BenchmarkResult> & results, int Nmesh, int Npart_1D, int nrepeat) {
+    std::stringstream s;
+    s << std::setprecision(8);
+    s << "{\n";
+    s << "  \"ntasks\": " << FML::NTasks << ",\n";
+    s << "  \"nthreads\": " << FML::NThreads << ",\n";
+    s << "  \"ncores\": " << FML::NTasks * FML::NThreads << ",\n";
+    s << "  \"nmesh\": " << Nmesh << ",\n";
+    s << "  \"npart_1D\": " << Npart_1D << ",\n";
+    s << "  \"nrepeat\": " << nrepeat << ",\n";
+    s << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    s << "  \"options\": [";
+    std::vector<std::string> options;
+#ifdef USE_MPI
+    options.push_back("USE_MPI");
+#endif
+#ifdef USE_OMP
+    options.push_back("USE_OMP");
+#endif
+#ifdef USE_FFTW_THREADS
+    options.push_back("USE_FFTW_THREADS");
+#endif
+#ifdef SINGLE_PRECISION_FFTW
+    options.push_back("SINGLE_PRECISION_FFTW");
+#endif
+#ifdef USE_LARGE_PAGES
+    options.push_back("USE_LARGE_PAGES");
+#endif
+    for (size_t i = 0; i < options.size(); i++)
+        s << (i > 0 ? ", " : "") << "\"" << options[i] << "\"";
+    s << "],\n";
+    s << "  \"kernels\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto & r = results[i];
+        const double tmin = *std::min_element(r.times.begin(), r.times.end());
+        const double tmax = *std::max_element(r.times.begin(), r.times.end());
+        double tmean = 0.0;
+        for (auto t : r.times)
+            tmean += t / double(r.times.size());
+        s << "    {\"name\": \"" << r.name << "\", ";
+        s << "\"element\": \"" << r.element << "\", ";
+        s << "\"nelements\": " << r.nelements << ", ";
+        s << "\"time_min\": " << tmin << ", ";
+        s << "\"time_mean\": " << tmean << ", ";
+        s << "\"time_max\": " << tmax << ", ";
+        s << "\"ns_per_element\": " << 1e9 * tmin / r.nelements << ", ";
+        s << "\"core_ns_per_element\": " << 1e9 * tmin * FML::NTasks * FML::NThreads / r.nelements << "}";
+        s << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    s << "  ]\n";
+    s << "}\n";
+    return s.str();
+}
+
+int main(int argc, char ** argv) {
+    const int Nmesh = argc > 1 ? std::stoi(argv[1]) : 128;
+    const int Npart_1D = argc > 2 ? std::stoi(argv[2]) : Nmesh;
+    const int nrepeat = argc > 3 ? std::stoi(argv[3]) : 5;
+    const std::string outputfile = argc > 4 ? argv[4] : "benchmark.json";
+    const std::string kernels = argc > 5 ? "," + std::string(argv[5]) + "," : ",all,";
+    auto do_kernel = [&](std::string name) {
+        return kernels.find(",all,") != std::string::npos or kernels.find("," + name + ",") != std::string::npos;
+    };
+    const double NpartTotal = std::pow(double(Npart_1D), NDIM);
+    const double NcellsTotal = std::pow(double(Nmesh), NDIM);
+    std::vector<BenchmarkResult> results;
+    auto nothing = []() {};
+
+    //==================================================================
+    // Particles: a grid with random displacements of up to half a cell
+    //==================================================================
+    FML::PARTICLE::MPIParticles<Particle> part;
+    part.create_particle_grid(Npart_1D, 1.5, FML::xmin_domain, FML::xmax_domain);
+    std::mt19937 rng(1234 + FML::ThisTask);
+    std::uniform_real_distribution<double> uniform(-0.5, 0.5);
+    for (auto & p : part) {
+        for (int idim = 0; idim < NDIM; idim++) {
+            p.pos[idim] += uniform(rng) / Npart_1D;
+            FML::PARTICLE::wrap_periodic(p.pos[idim]);
+            p.vel[idim] = 0.0;
+        }
+    }
+    part.communicate_particles();
+
+    //==================================================================
+    // FFTs
+    //==================================================================
+    if (do_kernel("fft")) {
+        FML::GRID::FFTWGrid<NDIM> grid(Nmesh);
+        grid.fill_real_grid(1.0);
+        results.push_back(time_kernel("fftw_r2c", "cell", NcellsTotal, nrepeat, nothing, [&]() { grid.fftw_r2c(); }));
+        results.push_back(time_kernel("fftw_c2r", "cell", NcellsTotal, nrepeat, nothing, [&]() { grid.fftw_c2r(); }));
+    }
+
+    //==================================================================
+    // Density assignment and interpolation for all the orders
+    //==================================================================
+    for (std::string method : {"NGP", "CIC", "TSC", "PCS", "PQS"}) {
+        const auto nleftright = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(method);
+        FML::GRID::FFTWGrid<NDIM> density(Nmesh, nleftright.first, nleftright.second);
+        if (do_kernel("particles_to_grid")) {
+            results.push_back(time_kernel("particles_to_grid_" + method, "particle", NpartTotal, nrepeat, nothing, [&]() {
+                FML::INTERPOLATION::particles_to_grid<NDIM, Particle>(
+                    part.get_particles_ptr(), part.get_npart(), part.get_npart_total(), density, method);
+            }));
+        }
+        if (do_kernel("interpolate")) {
+            density.fill_real_grid(1.0);
+            std::vector<FML::GRID::FloatType> values;
+            results.push_back(time_kernel("interpolate_grid_to_particle_positions_" + method,
+                                          "particle",
+                                          NpartTotal,
+                                          nrepeat,
+                                          nothing,
+                                          [&]() {
+                                              FML::INTERPOLATION::interpolate_grid_to_particle_positions<NDIM, Particle>(
+                                                  density, part.get_particles_ptr(), part.get_npart(), values, method);
+                                          }));
+        }
+    }
+
+    //==================================================================
+    // Communication. Every run we move all particles by half a cell in the x-direction
+    //==================================================================
+    if (do_kernel("communicate")) {
+        auto move_particles = [&]() {
+            for (auto & p : part) {
+                p.pos[0] += 0.5 / Npart_1D;
+                FML::PARTICLE::wrap_periodic(p.pos[0]);
+            }
+        };
+        results.push_back(time_kernel(
+            "communicate_particles", "particle", NpartTotal, nrepeat, move_particles, [&]() {
+                part.communicate_particles();
+            }));
+    }
+
+    //==================================================================
+    // Power spectrum
+    //==================================================================
+    if (do_kernel("pofk")) {
+        FML::CORRELATIONFUNCTIONS::PowerSpectrumBinning<NDIM> pofk(Nmesh / 2);
+        results.push_back(time_kernel("compute_power_spectrum_CIC", "particle", NpartTotal, nrepeat, nothing, [&]() {
+            FML::CORRELATIONFUNCTIONS::compute_power_spectrum<NDIM>(
+                Nmesh, part.get_particles_ptr(), part.get_npart(), part.get_npart_total(), pofk, "CIC", false);
+        }));
+    }
+
+    //==================================================================
+    // Friends of friends
+    //==================================================================
+    if (do_kernel("fof")) {
+        using FoFHalo = FML::FOF::FoFHalo<Particle, NDIM>;
+        std::vector<FoFHalo> LocalFoFGroups;
+        const double linking_length = 0.2;
+        const int nmin_FoF_group = 20;
+        const bool periodic_box = true;
+        const double Buffersize_over_Boxsize = 0.0;
+        results.push_back(time_kernel("FriendsOfFriends", "particle", NpartTotal, nrepeat, nothing, [&]() {
+            FML::FOF::FriendsOfFriends<Particle, NDIM>(part.get_particles_ptr(),
+                                                       part.get_npart(),
+                                                       linking_length,
+                                                       nmin_FoF_group,
+                                                       periodic_box,
+                                                       Buffersize_over_Boxsize,
+                                                       LocalFoFGroups);
+        }));
+    }
+
+    //==================================================================
+    // Pair counting of (the same) random points on all tasks out to 4 mean particle separations
+    //==================================================================
+    if (do_kernel("paircount")) {
+        const size_t npoints = std::min(size_t(NpartTotal), size_t(200000));
+        const double rmax = 4.0 * std::pow(double(npoints), -1.0 / NDIM);
+        const int nbins = 20;
+        std::vector<Point> points(npoints);
+        std::mt19937 rng_points(5678);
+        std::uniform_real_distribution<double> uniform_points(0.0, 1.0);
+        for (auto & p : points)
+            for (int idim = 0; idim < NDIM; idim++)
+                p.pos[idim] = uniform_points(rng_points);
+        FML::PARTICLE::ParticlesInBoxes<Point> boxes;
+        boxes.create(points.data(), points.size(), int(1.0 / rmax));
+
+        std::vector<std::vector<double>> count_threads(FML::NThreads, std::vector<double>(nbins, 0.0));
+        std::function<void(int, double *, Point &, Point &)> binning = [&](int thread_id, double * dist, Point &, Point &) {
+            double r2 = 0.0;
+            for (int idim = 0; idim < NDIM; idim++)
+                r2 += dist[idim] * dist[idim];
+            const int ibin = int(std::sqrt(r2) / rmax * nbins);
+            if (ibin < nbins)
+                count_threads[thread_id][ibin] += 1.0;
+        };
+        const double npairs = 0.5 * double(npoints) * double(npoints) * 4.0 / 3.0 * M_PI * std::pow(rmax, 3);
+        results.push_back(time_kernel("GeneralPairCounter", "pair", npairs, nrepeat, nothing, [&]() {
+            FML::CORRELATIONFUNCTIONS::PAIRCOUNTS::GeneralPairCounter<Point, Point>(
+                boxes, boxes, binning, true, rmax, true);
+        }));
+    }
+
+    //==================================================================
+    // One V-cycle of the multigrid solver for the Poisson equation. The solver needs a power of two
+    // gridsize so we use the largest power of two <= Nmesh (for the weak scaling runs Nmesh need not be one)
+    //==================================================================
+    if (do_kernel("multigrid")) {
+        using namespace FML::SOLVERS::MULTIGRIDSOLVER;
+        int Nmesh_multigrid = 1;
+        while (2 * Nmesh_multigrid <= Nmesh)
+            Nmesh_multigrid *= 2;
+        const int Nlevels = -1;
+        const bool verbose = false;
+        const bool periodic = true;
+        MultiGridSolver<NDIM, double> solver(Nmesh_multigrid, Nlevels, verbose, periodic, 1, 1);
+        MultiGridConvCrit one_cycle = [](double, double, int step_number) { return step_number >= 1; };
+        auto source = [](std::array<double, NDIM> & x) {
+            return std::sin(2.0 * M_PI * x[0]) * std::sin(2.0 * M_PI * x[1]) * std::sin(2.0 * M_PI * x[2]);
+        };
+        auto equation = [&](MultiGridSolver<NDIM, double> * sol, int level, IndexInt index) {
+            auto index_list = sol->get_neighbor_gridindex(level, index);
+            auto coordinate = sol->get_Coordinate(level, index);
+            auto L = sol->get_Laplacian(level, index_list) - source(coordinate);
+            auto dL = sol->get_derivLaplacian(level, index_list);
+            return std::pair<double, double>{L, dL};
+        };
+        results.push_back(time_kernel(
+            "MultiGridSolver_Vcycle",
+            "cell",
+            std::pow(double(Nmesh_multigrid), NDIM),
+            nrepeat,
+            [&]() { solver.set_initial_guess(0.0); },
+            [&]() { solver.solve(equation, one_cycle); }));
+    }
+
+    //==================================================================
+    // Output
+    //==================================================================
+    if (FML::ThisTask == 0) {
+        const std::string json = to_json(results, Nmesh, Npart_1D, nrepeat);
+        std::ofstream fp(outputfile);
+        fp << json;
+        std::cout << "# Results written to " << outputfile << "\n";
+    }
+}
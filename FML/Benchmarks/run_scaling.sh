@@ -0,0 +1,111 @@
+#!/bin/bash
+#======================================================================================
+# Strong and weak scaling sweeps of the kernel benchmark. See README.md in this folder
+#
+# Usage: ./run_scaling.sh [path to benchmark]
+#
+# Options (environment variables):
+#   SCALING_NTASKS    The number of MPI tasks to run with (1 2 4)
+#   SCALING_NTHREADS  The number of OpenMP threads per task to run with (1 2 4)
+#   SCALING_NMESH     Nmesh (and Npart_1D) for the strong scaling runs (128)
+#   SCALING_NMESH_1   Nmesh (and Npart_1D) for one core in the weak scaling runs (64)
+#   SCALING_NREPEAT   The number of timed runs of each kernel (5)
+#   SCALING_KERNELS   Comma separated list of kernels to run (all)
+#   SCALING_MPIRUN    The command to launch with n tasks, n is added at the end (mpirun -np)
+#   SCALING_OUTPUT    The folder we write the results to (scaling_output)
+#======================================================================================
+
+BENCHMARK=$(realpath "${1:-./benchmark}")
+NTASKS=${SCALING_NTASKS:-"1 2 4"}
+NTHREADS=${SCALING_NTHREADS:-"1 2 4"}
+NMESH=${SCALING_NMESH:-128}
+NMESH_1=${SCALING_NMESH_1:-64}
+NREPEAT=${SCALING_NREPEAT:-5}
+KERNELS=${SCALING_KERNELS:-all}
+MPIRUN=${SCALING_MPIRUN:-"mpirun -np"}
+OUTPUT=$(realpath -m "${SCALING_OUTPUT:-scaling_output}")
+RESULTS=$OUTPUT/scaling.json
+
+if [ ! -x "$BENCHMARK" ]; then
+  echo "Cannot find the benchmark executable [$BENCHMARK]. Run make first"
+  exit 1
+fi
+mkdir -p "$OUTPUT"
+
+#======================================================================================
+# Run the benchmark and append its JSON to the list in the file $5
+#======================================================================================
+run() {
+  local ntasks=$1 nthreads=$2 nmesh=$3 name=$4 list=$5
+  local json=$OUTPUT/$name.json
+  echo "Running $name"
+  OMP_NUM_THREADS=$nthreads $MPIRUN "$ntasks" "$BENCHMARK" "$nmesh" "$nmesh" "$NREPEAT" "$json" "$KERNELS" \
+    > "$OUTPUT/$name.log" 2>&1
+  if [ $? -ne 0 ] || [ ! -f "$json" ]; then
+    echo "  FAILED (see $OUTPUT/$name.log)"
+    nfailed=$((nfailed + 1))
+    return
+  fi
+  [ -s "$list" ] && echo "," >> "$list"
+  cat "$json" >> "$list"
+}
+
+#======================================================================================
+# Weak scaling: the number of cells (and particles) per core is fixed, so Nmesh grows as
+# ncores^(1/3). We round to an even number so the grid can be split over the tasks
+#======================================================================================
+weak_nmesh() {
+  awk -v n="$NMESH_1" -v c="$1" 'BEGIN { m = int(n * c^(1.0/3.0) / 2.0 + 0.5) * 2; print m }'
+}
+
+nfailed=0
+STRONG=$OUTPUT/strong.list
+WEAK=$OUTPUT/weak.list
+: > "$STRONG"
+: > "$WEAK"
+for ntasks in $NTASKS; do
+  for nthreads in $NTHREADS; do
+    run "$ntasks" "$nthreads" "$NMESH" "strong_np${ntasks}_nt${nthreads}" "$STRONG"
+    nmesh=$(weak_nmesh $((ntasks * nthreads)))
+    run "$ntasks" "$nthreads" "$nmesh" "weak_np${ntasks}_nt${nthreads}" "$WEAK"
+  done
+done
+
+{
+  echo "{"
+  echo "\"strong\": ["
+  cat "$STRONG"
+  echo "],"
+  echo "\"weak\": ["
+  cat "$WEAK"
+  echo "]"
+  echo "}"
+} > "$RESULTS"
+rm -f "$STRONG" "$WEAK"
+
+#======================================================================================
+# Summary: the time of each kernel in each run relative to the run on the fewest cores.
+# For strong scaling perfect scaling is a speedup equal to the number of cores, for weak
+# scaling it is a constant time
+#======================================================================================
+summary() {
+  local type=$1
+  echo ""
+  echo "$type scaling (time_min in seconds, the speedup relative to the first run in brackets)"
+  for json in "$OUTPUT"/${type}_np*.json; do
+    [ -f "$json" ] || continue
+    echo "$(basename "$json" .json) $(grep -o '"ncores": [0-9]*' "$json" | awk '{ print $2 }')" \
+      "$(grep -o '"name": "[^"]*", "element": "[^"]*", "nelements": [^,]*, "time_min": [^,]*' "$json" |
+         awk -F'"' '{ split($0, a, "time_min\": "); printf "%s=%s ", $4, a[2] }')"
+  done | sort -t' ' -k2 -n | awk '
+    NR == 1 { for (i = 3; i <= NF; i++) { split($i, a, "="); ref[a[1]] = a[2] } }
+    { printf "%-20s cores %-4s", $1, $2;
+      for (i = 3; i <= NF; i++) { split($i, a, "="); printf " %s %.3g (%.2f)", a[1], a[2], ref[a[1]] / a[2] }
+      printf "\n" }'
+}
+summary strong
+summary weak
+
+echo ""
+echo "The results are in $RESULTS ($nfailed failed)"
+[ $nfailed -eq 0 ]
@@ -1,11 +1,21 @@
 #ifndef CAMBREADER_HEADER
 #define CAMBREADER_HEADER
 
+#include <FML/FileUtils/FileUtils.h>
 #include <FML/Global/Global.h>
 #include <FML/Spline/Spline.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 namespace FML {
     namespace FILEUTILS {
@@ -150,6 +160,61 @@ namespace FML {
 
             std::string fileformat{"CAMB"};
 
+            // Folder for the binary cache of the tables read by read_transfer (empty = no cache)
+            std::string cache_folder{};
+
+            // The tables read by read_transfer in the order we store them in the cache
+            struct TransferTables {
+                DVector redshifts;
+                DVector k;
+                DVector2D cdm, baryon, photon, nu, mnu, total, nonu, totde, weyl, vcdm, vb, vbvc;
+                std::vector<DVector2D *> all() {
+                    return {&cdm, &baryon, &photon, &nu, &mnu, &total, &nonu, &totde, &weyl, &vcdm, &vb, &vbvc};
+                }
+            };
+            bool read_transfer_cache(const std::string & filename, const std::string & key, TransferTables & t) const;
+            void write_transfer_cache(const std::string & filename, const std::string & key, TransferTables & t) const;
+
+            // The transfer functions in the order of TransferTables::all
+            enum TransferField { CDM, BARYON, PHOTON, NU, MNU, TOTAL, NONU, TOTDE, WEYL, VCDM, VB, VBVC, NFIELDS };
+
+            // Lazy loading: the file for a redshift is only read and splined (in k) the first time it is needed
+            // and we interpolate in z using the (up to) 4 closest redshifts. Shared between copies of this class
+            struct LazyTransferTables {
+                struct RedshiftData {
+                    std::once_flag is_read;
+                    std::vector<Spline> splines;
+                };
+                std::vector<std::string> filenames;
+                DVector redshifts;
+                int ncol{};
+                int nskip{};
+                int col_k{};
+                std::array<int, NFIELDS> cols{};
+                std::vector<std::unique_ptr<RedshiftData>> data;
+
+                // Optional thread reading the files in the background
+                std::thread prefetch_thread;
+                std::atomic<bool> stop_prefetch{false};
+
+                ~LazyTransferTables() {
+                    stop_prefetch = true;
+                    if (prefetch_thread.joinable())
+                        prefetch_thread.join();
+                }
+                const RedshiftData & get(size_t i);
+                double eval(int field, double z, double logk, int nderiv_z);
+            };
+            bool lazy_loading{false};
+            bool lazy_prefetch{false};
+            std::shared_ptr<LazyTransferTables> lazy_tables;
+            void read_transfer_lazy(const std::vector<std::string> & fullfilenames,
+                                    const DVector & redshifts,
+                                    bool verbose);
+
+            // Evaluate a transfer function (or its z-derivative) from the 2D spline or the lazy tables
+            double eval_transfer(const Spline2D & spline, int field, double k, double a, int nderiv_z = 0) const;
+
           public:
             // Format of transfer file (if -1 then we ignore that field)
             int n_transfer_header_lines = 0; // Number of header lines
@@ -187,6 +252,18 @@ namespace FML {
             /// Read the infofile, read transferfiles listed in that and make splines of T(k,z)
             void read_transfer(std::string infofilename, bool verbose = false);
 
+            /// Store the tables read by read_transfer in a binary file in this folder and use it instead of the
+            /// ascii files the next time we read the same files (same paths, sizes and modification times)
+            void set_cache_folder(std::string folder) { cache_folder = folder; }
+
+            /// Only read and spline the file for a redshift when it is first needed instead of all of them in
+            /// read_transfer. With prefetch we read the rest of the files in a background thread (from high to low z).
+            /// Must be set before read_transfer. The binary cache is not used in this mode
+            void set_lazy_loading(bool lazy, bool prefetch = false) {
+                lazy_loading = lazy;
+                lazy_prefetch = prefetch;
+            }
+
             /// Read a single tranfer function
             DVector2D read_transfer_single(std::string filename) const;
 
@@ -306,6 +383,7 @@ namespace FML {
             vcdm_transfer_function_spline.free();
             vb_transfer_function_spline.free();
             vbvc_transfer_function_spline.free();
+            lazy_tables.reset();
             transfer_is_read = false;
         }
 
@@ -319,40 +397,12 @@ namespace FML {
             FML::assert_mpi(n_transfer_header_lines >= 0, "Fileformat is not correct");
             FML::assert_mpi(ncol_transfer_file > 0, "Fileformat is not correct");
 
-            // Open CAMB transfer function file for reading
-            std::ifstream fp(filename);
-            if (not fp) {
-                throw std::runtime_error("Error read_transfer_single: cannot open [" + filename + "]\n");
-            }
-
-            // Read the header lines
-            for (int i = 0; i < n_transfer_header_lines; i++) {
-                std::string line;
-                std::getline(fp, line);
-            }
-
-            // Read data row by row
-            DVector2D indata;
-            DVector tmp(ncol_transfer_file);
-            for (;;) {
-                fp >> tmp[0];
-                if (fp.eof())
-                    break;
-                for (int i = 1; i < ncol_transfer_file; i++) {
-                    fp >> tmp[i];
-                }
-                indata.push_back(tmp);
-            }
-
-            // Transpose the data
-            DVector2D data(ncol_transfer_file, DVector(indata.size()));
-            for (size_t i = 0; i < indata.size(); i++) {
-                for (size_t j = 0; j < indata[i].size(); j++) {
-                    data[j][i] = indata[i][j];
-                }
-            }
-
-            return data;
+            // Read all the columns of the CAMB transfer function file
+            std::vector<int> cols_to_keep(ncol_transfer_file);
+            for (int i = 0; i < ncol_transfer_file; i++)
+                cols_to_keep[i] = i;
+            return FML::FILEUTILS::read_regular_ascii_columns(
+                filename, ncol_transfer_file, cols_to_keep, n_transfer_header_lines);
         }
 
         //====================================================================
@@ -364,50 +414,224 @@ namespace FML {
             FML::assert_mpi(n_pofk_header_lines >= 0, "Fileformat is not correct");
             FML::assert_mpi(ncol_pofk_file > 0, "Fileformat is not correct");
 
-            // Open CAMB power function file for reading
-            std::ifstream fp(filename);
-            if (not fp) {
-                throw std::runtime_error("Error read_power_single: cannot open [" + filename + "]\n");
-            }
+            // Read the k and P(k) columns of the CAMB power-spectrum file
+            auto data = FML::FILEUTILS::read_regular_ascii_columns(
+                filename, ncol_pofk_file, {pofk_col_k, pofk_col_pofk}, n_pofk_header_lines);
+            return {data[0], data[1]};
+        }
+
+        /// The smallest redshift the splines reach
+        double LinearTransferData::get_zmin_splines() const { return zmin_splines; }
+        /// The largest redshift the splines reach
+        double LinearTransferData::get_zmax_splines() const { return zmax_splines; }
+        /// The smallest scale the splines reach
+        double LinearTransferData::get_kmin_hmpc_splines() const { return kmin_hmpc_splines; }
+        /// The largest redshift the splines reach
+        double LinearTransferData::get_kmax_hmpc_splines() const { return kmax_hmpc_splines; }
 
-            // Read the header lines
-            for (int i = 0; i < n_pofk_header_lines; i++) {
-                std::string line;
-                std::getline(fp, line);
+        //====================================================================
+        // Binary cache of the tables read by read_transfer. The file starts with the key (the files it was
+        // made from) so that a hash collision or a changed file is never used
+        //====================================================================
+        bool LinearTransferData::read_transfer_cache(const std::string & filename,
+                                                     const std::string & key,
+                                                     TransferTables & t) const {
+            std::ifstream fp(filename, std::ios::binary);
+            if (not fp)
+                return false;
+            auto read_vector = [&](DVector & v) {
+                size_t n = 0;
+                fp.read(reinterpret_cast<char *>(&n), sizeof(n));
+                if (not fp or n > (size_t(1) << 40))
+                    return false;
+                v.resize(n);
+                fp.read(reinterpret_cast<char *>(v.data()), n * sizeof(double));
+                return bool(fp);
+            };
+            size_t keysize = 0;
+            fp.read(reinterpret_cast<char *>(&keysize), sizeof(keysize));
+            if (not fp or keysize != key.size())
+                return false;
+            std::string filekey(keysize, ' ');
+            fp.read(filekey.data(), keysize);
+            if (not fp or filekey != key)
+                return false;
+
+            DVector redshifts;
+            if (not read_vector(redshifts) or not read_vector(t.k) or redshifts.size() != t.redshifts.size())
+                return false;
+            for (auto * table : t.all()) {
+                size_t nrows = 0;
+                fp.read(reinterpret_cast<char *>(&nrows), sizeof(nrows));
+                if (not fp or (nrows != 0 and nrows != t.redshifts.size()))
+                    return false;
+                table->resize(nrows);
+                for (auto & row : *table)
+                    if (not read_vector(row) or row.size() != t.k.size())
+                        return false;
             }
+            return true;
+        }
 
-            // Read data row by row
-            DVector2D indata;
-            DVector tmp(ncol_pofk_file);
-            for (;;) {
-                fp >> tmp[0];
-                if (fp.eof())
-                    break;
-                for (int i = 1; i < ncol_pofk_file; i++) {
-                    fp >> tmp[i];
+        void LinearTransferData::write_transfer_cache(const std::string & filename,
+                                                      const std::string & key,
+                                                      TransferTables & t) const {
+            // Write to a temporary file and rename so that others never see a partial file
+            const std::string tmpfilename = filename + ".tmp" + std::to_string(FML::ThisTask);
+            {
+                std::ofstream fp(tmpfilename, std::ios::binary);
+                if (not fp) {
+                    std::cout << "Warning read_transfer: cannot write cache [" << filename << "]\n";
+                    return;
+                }
+                auto write_vector = [&](const DVector & v) {
+                    const size_t n = v.size();
+                    fp.write(reinterpret_cast<const char *>(&n), sizeof(n));
+                    fp.write(reinterpret_cast<const char *>(v.data()), n * sizeof(double));
+                };
+                const size_t keysize = key.size();
+                fp.write(reinterpret_cast<const char *>(&keysize), sizeof(keysize));
+                fp.write(key.data(), keysize);
+                write_vector(t.redshifts);
+                write_vector(t.k);
+                for (auto * table : t.all()) {
+                    const size_t nrows = table->size();
+                    fp.write(reinterpret_cast<const char *>(&nrows), sizeof(nrows));
+                    for (auto & row : *table)
+                        write_vector(row);
                 }
-                indata.push_back(tmp);
             }
+            std::error_code ec;
+            std::filesystem::rename(tmpfilename, filename, ec);
+            if (ec)
+                std::filesystem::remove(tmpfilename, ec);
+        }
+
+        //====================================================================
+        // Lazy loading. The file for redshift i is read and splined (in log k) the first time it is needed
+        //====================================================================
+        const LinearTransferData::LazyTransferTables::RedshiftData &
+        LinearTransferData::LazyTransferTables::get(size_t i) {
+            auto & d = *data[i];
+            std::call_once(d.is_read, [&]() {
+                std::vector<int> cols_to_keep(ncol);
+                for (int j = 0; j < ncol; j++)
+                    cols_to_keep[j] = j;
+                auto filedata = FML::FILEUTILS::read_regular_ascii_columns(filenames[i], ncol, cols_to_keep, nskip);
+                auto logk = filedata[col_k];
+                for (auto & k : logk)
+                    k = std::log(k);
+                d.splines.resize(NFIELDS);
+                for (int field = 0; field < NFIELDS; field++)
+                    if (cols[field] >= 0)
+                        d.splines[field].create(logk, filedata[cols[field]], "T(k) " + filenames[i]);
+            });
+            return d;
+        }
 
-            // Transpose the data
-            DVector2D data(ncol_transfer_file, DVector(indata.size()));
-            for (size_t i = 0; i < indata.size(); i++) {
-                for (size_t j = 0; j < indata[i].size(); j++) {
-                    data[j][i] = indata[i][j];
+        // Cubic Lagrange interpolation in z (or its z-derivative) over the (up to) 4 closest redshifts
+        double LinearTransferData::LazyTransferTables::eval(int field, double z, double logk, int nderiv_z) {
+            const int n = int(redshifts.size());
+            z = std::clamp(z, redshifts.front(), redshifts.back());
+            const int i =
+                std::max(int(std::upper_bound(redshifts.begin(), redshifts.end(), z) - redshifts.begin()) - 1, 0);
+            if (nderiv_z == 0 and redshifts[i] == z)
+                return get(i).splines[field](logk);
+
+            const int m = std::min(4, n);
+            const int j0 = std::clamp(i - (m / 2 - 1), 0, n - m);
+            double value = 0.0;
+            for (int j = j0; j < j0 + m; j++) {
+                double L = 1.0;
+                double dL = 0.0;
+                for (int l = j0; l < j0 + m; l++) {
+                    if (l == j)
+                        continue;
+                    const double w = (z - redshifts[l]) / (redshifts[j] - redshifts[l]);
+                    dL = dL * w + L / (redshifts[j] - redshifts[l]);
+                    L *= w;
                 }
+                value += (nderiv_z == 0 ? L : dL) * get(j).splines[field](logk);
             }
+            return value;
+        }
 
-            return {data[pofk_col_k], data[pofk_col_pofk]};
+        void LinearTransferData::read_transfer_lazy(const std::vector<std::string> & fullfilenames,
+                                                    const DVector & redshifts,
+                                                    bool verbose) {
+            FML::assert_mpi(transfer_col_k >= 0, "Fileformat is not correct");
+            FML::assert_mpi(n_transfer_header_lines >= 0, "Fileformat is not correct");
+            FML::assert_mpi(ncol_transfer_file > 0, "Fileformat is not correct");
+            FML::assert_mpi(redshifts.size() > 0, "Error read_transfer: no transfer files");
+            for (size_t i = 1; i < redshifts.size(); i++)
+                FML::assert_mpi(redshifts[i] > redshifts[i - 1],
+                                "Error read_transfer: the redshifts must be ordered from low to high");
+
+            lazy_tables = std::make_shared<LazyTransferTables>();
+            auto & tables = *lazy_tables;
+            tables.filenames = fullfilenames;
+            tables.redshifts = redshifts;
+            tables.ncol = ncol_transfer_file;
+            tables.nskip = n_transfer_header_lines;
+            tables.col_k = transfer_col_k;
+            tables.cols = {transfer_col_cdm,
+                           transfer_col_baryon,
+                           transfer_col_photon,
+                           transfer_col_nu,
+                           transfer_col_mnu,
+                           transfer_col_total,
+                           transfer_col_nonu,
+                           transfer_col_totde,
+                           transfer_col_weyl,
+                           transfer_col_vcdm,
+                           transfer_col_vb,
+                           transfer_col_vbvc};
+            for (size_t i = 0; i < redshifts.size(); i++)
+                tables.data.emplace_back(std::make_unique<LazyTransferTables::RedshiftData>());
+
+            // The range of the splines (as for the full read). The k-range is taken from the first file
+            zmin_splines = 0.0;
+            zmax_splines = 0.0;
+            for (auto z : redshifts) {
+                zmin_splines = std::max(z, zmin_splines);
+                zmax_splines = std::max(z, zmax_splines);
+            }
+            auto kdata = FML::FILEUTILS::read_regular_ascii_columns(
+                fullfilenames[0], ncol_transfer_file, {transfer_col_k}, n_transfer_header_lines);
+            kmin_hmpc_splines = *std::min_element(kdata[0].begin(), kdata[0].end());
+            kmax_hmpc_splines = *std::max_element(kdata[0].begin(), kdata[0].end());
+
+            if (FML::ThisTask == 0 and verbose)
+                std::cout << "Lazy loading of [" << redshifts.size() << "] transfer files"
+                          << (lazy_prefetch ? " (prefetching in the background)" : "") << "\n";
+
+            // Read the files in the background starting from the highest redshift (where we make the IC).
+            // Errors are left for the first access on the main thread to report
+            if (lazy_prefetch) {
+                LazyTransferTables * t = lazy_tables.get();
+                t->prefetch_thread = std::thread([t]() {
+                    for (size_t i = t->redshifts.size(); i-- > 0 and not t->stop_prefetch;) {
+                        try {
+                            t->get(i);
+                        } catch (...) {
+                            break;
+                        }
+                    }
+                });
+            }
+            transfer_is_read = true;
         }
 
-        /// The smallest redshift the splines reach
-        double LinearTransferData::get_zmin_splines() const { return zmin_splines; }
-        /// The largest redshift the splines reach
-        double LinearTransferData::get_zmax_splines() const { return zmax_splines; }
-        /// The smallest scale the splines reach
-        double LinearTransferData::get_kmin_hmpc_splines() const { return kmin_hmpc_splines; }
-        /// The largest redshift the splines reach
-        double LinearTransferData::get_kmax_hmpc_splines() const { return kmax_hmpc_splines; }
+        //====================================================================
+        /// Evaluate the transfer function field (or its z-derivative for nderiv_z = 1) at (k, a)
+        //====================================================================
+        double LinearTransferData::eval_transfer(
+            const Spline2D & spline, int field, double k, double a, int nderiv_z) const {
+            const double z = 1.0 / a - 1.0;
+            if (lazy_tables)
+                return lazy_tables->eval(field, z, std::log(k), nderiv_z);
+            return nderiv_z == 0 ? spline(z, std::log(k)) : spline.deriv_x(z, std::log(k));
+        }
 
         //====================================================================
         /// Read an infofile with the format (folder num_redshift) and then each line contains (transferfile_i
@@ -416,20 +640,6 @@ namespace FML {
         //====================================================================
         void LinearTransferData::read_transfer(std::string infofile, bool verbose) {
 
-            DVector k;
-            DVector2D transfer_function_cdm;
-            DVector2D transfer_function_baryon;
-            DVector2D transfer_function_photon;
-            DVector2D transfer_function_nu;
-            DVector2D transfer_function_mnu;
-            DVector2D transfer_function_total;
-            DVector2D transfer_function_nonu;
-            DVector2D transfer_function_totde;
-            DVector2D transfer_function_weyl;
-            DVector2D transfer_function_vcdm;
-            DVector2D transfer_function_vb;
-            DVector2D transfer_function_vbvc;
-
             // Open fileinfo file
             int nredshift;
             std::string filepath;
@@ -446,84 +656,120 @@ namespace FML {
                           << "] redshift files\n";
             }
 
-            // Read all files
-            DVector redshifts(nredshift);
-            zmax_splines = 0.0;
+            // Read the filenames and redshifts
+            std::vector<std::string> fullfilenames(nredshift);
+            TransferTables t;
+            t.redshifts.resize(nredshift);
             for (int i = 0; i < nredshift; i++) {
-
-                // Read filename
                 std::string filename;
                 fp >> filename;
+                fp >> t.redshifts[i];
+                fullfilenames[i] = filepath + "/" + filename;
+            }
 
-                // Read redshift
-                double znow;
-                fp >> znow;
-                redshifts[i] = znow;
-                zmin_splines = std::max(redshifts[i], zmin_splines);
-                zmax_splines = std::max(redshifts[i], zmax_splines);
-
-                // Make filename and open file. Assumes all files have the same length
-                std::string fullfilename = filepath + "/" + filename;
-
-                // Read the transfer data
-                auto data = read_transfer_single(fullfilename);
-
-                // Fetch the data we want 
-                auto k_tmp = data[transfer_col_k];
-                if (i == 0) {
-                    k = k_tmp;
-                    kmin_hmpc_splines = *std::min_element(k_tmp.begin(), k_tmp.end());
-                    kmax_hmpc_splines = *std::max_element(k_tmp.begin(), k_tmp.end());
+            if (lazy_loading) {
+                read_transfer_lazy(fullfilenames, t.redshifts, verbose);
+                return;
+            }
+
+            // The cache is valid as long as the format and the files (path, size and modification time) are the same
+            std::string key, cachefilename;
+            if (not cache_folder.empty()) {
+                std::stringstream keystream;
+                keystream << fileformat << " " << n_transfer_header_lines << " " << ncol_transfer_file << "\n";
+                for (int i = 0; i < nredshift; i++) {
+                    std::error_code ec;
+                    auto size = std::filesystem::file_size(fullfilenames[i], ec);
+                    auto time = std::filesystem::last_write_time(fullfilenames[i], ec);
+                    keystream << std::setprecision(17) << t.redshifts[i] << " "
+                              << std::filesystem::absolute(fullfilenames[i]).string() << " " << size << " "
+                              << time.time_since_epoch().count() << "\n";
                 }
+                key = keystream.str();
+                std::stringstream hash;
+                hash << std::hex << std::hash<std::string>{}(key);
+                cachefilename = cache_folder + "/transferdata_" + hash.str() + ".bin";
+            }
 
-                if (transfer_col_cdm >= 0)
-                    transfer_function_cdm.push_back(data[transfer_col_cdm]);
-                if (transfer_col_baryon >= 0)
-                    transfer_function_baryon.push_back(data[transfer_col_baryon]);
-                if (transfer_col_photon >= 0)
-                    transfer_function_photon.push_back(data[transfer_col_photon]);
-                if (transfer_col_nu >= 0)
-                    transfer_function_nu.push_back(data[transfer_col_nu]);
-                if (transfer_col_mnu >= 0)
-                    transfer_function_mnu.push_back(data[transfer_col_mnu]);
-                if (transfer_col_total >= 0)
-                    transfer_function_total.push_back(data[transfer_col_total]);
-                if (transfer_col_nonu >= 0)
-                    transfer_function_nonu.push_back(data[transfer_col_nonu]);
-                if (transfer_col_totde >= 0)
-                    transfer_function_totde.push_back(data[transfer_col_totde]);
-                if (transfer_col_weyl >= 0)
-                    transfer_function_weyl.push_back(data[transfer_col_weyl]);
-                if (transfer_col_vcdm >= 0)
-                    transfer_function_vcdm.push_back(data[transfer_col_vcdm]);
-                if (transfer_col_vb >= 0)
-                    transfer_function_vb.push_back(data[transfer_col_vb]);
-                if (transfer_col_vbvc >= 0)
-                    transfer_function_vbvc.push_back(data[transfer_col_vbvc]);
-
-                if (k.size() != k_tmp.size())
-                    throw std::runtime_error(
-                        "Error in read_transfer: the number of k-values in the files are different");
-
-                // Check that k-array is the same in all files as this is assumed when splining below
-                if (i > 0) {
-                    for (size_t j = 0; j < k.size(); j++) {
-                        double err = std::fabs(k_tmp[j] - k[j]);
-                        if (err > 1e-3)
-                            throw std::runtime_error("Error in read_transfer: the k-array differs in the different "
-                                                     "files. Not built-in support for this");
+            if (not cache_folder.empty() and read_transfer_cache(cachefilename, key, t)) {
+                if (FML::ThisTask == 0 and verbose)
+                    std::cout << "Read transfer functions from cache [" << cachefilename << "]\n";
+            } else {
+                for (int i = 0; i < nredshift; i++) {
+
+                    // Read the transfer data. Assumes all files have the same length
+                    auto data = read_transfer_single(fullfilenames[i]);
+
+                    // Fetch the data we want
+                    auto k_tmp = data[transfer_col_k];
+                    if (i == 0)
+                        t.k = k_tmp;
+
+                    if (transfer_col_cdm >= 0)
+                        t.cdm.push_back(data[transfer_col_cdm]);
+                    if (transfer_col_baryon >= 0)
+                        t.baryon.push_back(data[transfer_col_baryon]);
+                    if (transfer_col_photon >= 0)
+                        t.photon.push_back(data[transfer_col_photon]);
+                    if (transfer_col_nu >= 0)
+                        t.nu.push_back(data[transfer_col_nu]);
+                    if (transfer_col_mnu >= 0)
+                        t.mnu.push_back(data[transfer_col_mnu]);
+                    if (transfer_col_total >= 0)
+                        t.total.push_back(data[transfer_col_total]);
+                    if (transfer_col_nonu >= 0)
+                        t.nonu.push_back(data[transfer_col_nonu]);
+                    if (transfer_col_totde >= 0)
+                        t.totde.push_back(data[transfer_col_totde]);
+                    if (transfer_col_weyl >= 0)
+                        t.weyl.push_back(data[transfer_col_weyl]);
+                    if (transfer_col_vcdm >= 0)
+                        t.vcdm.push_back(data[transfer_col_vcdm]);
+                    if (transfer_col_vb >= 0)
+                        t.vb.push_back(data[transfer_col_vb]);
+                    if (transfer_col_vbvc >= 0)
+                        t.vbvc.push_back(data[transfer_col_vbvc]);
+
+                    if (t.k.size() != k_tmp.size())
+                        throw std::runtime_error(
+                            "Error in read_transfer: the number of k-values in the files are different");
+
+                    // Check that k-array is the same in all files as this is assumed when splining below
+                    if (i > 0) {
+                        for (size_t j = 0; j < t.k.size(); j++) {
+                            double err = std::fabs(k_tmp[j] - t.k[j]);
+                            if (err > 1e-3)
+                                throw std::runtime_error("Error in read_transfer: the k-array differs in the "
+                                                         "different files. Not built-in support for this");
+                        }
                     }
-                }
 
-                if (FML::ThisTask == 0 and verbose) {
-                    std::cout << "Filename: [" << fullfilename << "]\n";
-                    std::cout << "z = [" << std::setw(10) << znow << "] | We have [" << std::setw(6) << k.size()
-                              << "] k-points\n";
+                    if (FML::ThisTask == 0 and verbose) {
+                        std::cout << "Filename: [" << fullfilenames[i] << "]\n";
+                        std::cout << "z = [" << std::setw(10) << t.redshifts[i] << "] | We have [" << std::setw(6)
+                                  << t.k.size() << "] k-points\n";
+                    }
                 }
+
+                // Only one task writes the cache
+                if (not cache_folder.empty() and FML::ThisTask == 0)
+                    write_transfer_cache(cachefilename, key, t);
             }
             if (FML::ThisTask == 0)
                 std::cout << "\n";
 
+            // The range of the splines
+            const DVector & redshifts = t.redshifts;
+            const DVector & k = t.k;
+            zmin_splines = 0.0;
+            zmax_splines = 0.0;
+            for (auto z : redshifts) {
+                zmin_splines = std::max(z, zmin_splines);
+                zmax_splines = std::max(z, zmax_splines);
+            }
+            kmin_hmpc_splines = *std::min_element(k.begin(), k.end());
+            kmax_hmpc_splines = *std::max_element(k.begin(), k.end());
+
             // Change to log
             auto logk = k;
             for (auto & k : logk)
@@ -531,49 +777,49 @@ namespace FML {
 
             // Create splines
             if (transfer_col_cdm >= 0)
-                cdm_transfer_function_spline.create(redshifts, logk, transfer_function_cdm);
+                cdm_transfer_function_spline.create(redshifts, logk, t.cdm);
             if (transfer_col_baryon >= 0)
-                baryon_transfer_function_spline.create(redshifts, logk, transfer_function_baryon);
+                baryon_transfer_function_spline.create(redshifts, logk, t.baryon);
             if (transfer_col_photon >= 0)
-                photon_transfer_function_spline.create(redshifts, logk, transfer_function_photon);
+                photon_transfer_function_spline.create(redshifts, logk, t.photon);
             if (transfer_col_nu >= 0)
-                nu_transfer_function_spline.create(redshifts, logk, transfer_function_nu);
+                nu_transfer_function_spline.create(redshifts, logk, t.nu);
             if (transfer_col_mnu >= 0)
-                mnu_transfer_function_spline.create(redshifts, logk, transfer_function_mnu);
+                mnu_transfer_function_spline.create(redshifts, logk, t.mnu);
             if (transfer_col_total >= 0)
-                total_transfer_function_spline.create(redshifts, logk, transfer_function_total);
+                total_transfer_function_spline.create(redshifts, logk, t.total);
             if (transfer_col_nonu >= 0)
-                nonu_transfer_function_spline.create(redshifts, logk, transfer_function_nonu);
+                nonu_transfer_function_spline.create(redshifts, logk, t.nonu);
             if (transfer_col_totde >= 0)
-                totde_transfer_function_spline.create(redshifts, logk, transfer_function_totde);
+                totde_transfer_function_spline.create(redshifts, logk, t.totde);
             if (transfer_col_weyl >= 0)
-                weyl_transfer_function_spline.create(redshifts, logk, transfer_function_weyl);
+                weyl_transfer_function_spline.create(redshifts, logk, t.weyl);
             if (transfer_col_vcdm >= 0)
-                vcdm_transfer_function_spline.create(redshifts, logk, transfer_function_vcdm);
+                vcdm_transfer_function_spline.create(redshifts, logk, t.vcdm);
             if (transfer_col_vb >= 0)
-                vb_transfer_function_spline.create(redshifts, logk, transfer_function_vb);
+                vb_transfer_function_spline.create(redshifts, logk, t.vb);
             if (transfer_col_vbvc >= 0)
-                vbvc_transfer_function_spline.create(redshifts, logk, transfer_function_vbvc);
+                vbvc_transfer_function_spline.create(redshifts, logk, t.vbvc);
 
             // Test spline
             if (FML::ThisTask == 0 and verbose) {
                 std::cout << "\nSample values massive neutrino transfer function:\n";
-                for (size_t i = 0; i < transfer_function_mnu.size(); i++) {
-                    for (size_t j = 0; j < transfer_function_mnu[i].size(); j++) {
+                for (size_t i = 0; i < t.mnu.size(); i++) {
+                    for (size_t j = 0; j < t.mnu[i].size(); j++) {
                         if (rand() % 1000 == 0) {
                             std::cout << "z: " << std::setw(10) << redshifts[i] << " k: " << std::setw(15)
                                       << std::exp(logk[j]) << " Tnu/Tnu0: " << std::setw(15)
-                                      << transfer_function_mnu[i][j] / (transfer_function_mnu[0][j] + 1e-20) << "\n";
+                                      << t.mnu[i][j] / (t.mnu[0][j] + 1e-20) << "\n";
                         }
                     }
                 }
                 std::cout << "\nSample values CDM transfer function:\n";
-                for (size_t i = 0; i < transfer_function_cdm.size(); i++) {
-                    for (size_t j = 0; j < transfer_function_cdm[i].size(); j++) {
+                for (size_t i = 0; i < t.cdm.size(); i++) {
+                    for (size_t j = 0; j < t.cdm[i].size(); j++) {
                         if (rand() % 1000 == 0) {
                             std::cout << "z: " << std::setw(10) << redshifts[i] << " k: " << std::setw(15)
                                       << std::exp(logk[j]) << " Tnu/Tnu0: " << std::setw(15)
-                                      << transfer_function_cdm[i][j] / (transfer_function_cdm[0][j] + 1e-20) << "\n";
+                                      << t.cdm[i][j] / (t.cdm[0][j] + 1e-20) << "\n";
                         }
                     }
                 }
@@ -587,8 +833,7 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_weyl_transfer_function(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return weyl_transfer_function_spline(z, std::log(k));
+            return eval_transfer(weyl_transfer_function_spline, WEYL, k, a);
         }
 
         //====================================================================
@@ -597,8 +842,7 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_photon_transfer_function(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return photon_transfer_function_spline(z, std::log(k));
+            return eval_transfer(photon_transfer_function_spline, PHOTON, k, a);
         }
 
         //====================================================================
@@ -607,8 +851,7 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_neutrino_transfer_function(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return nu_transfer_function_spline(z, std::log(k));
+            return eval_transfer(nu_transfer_function_spline, NU, k, a);
         }
 
         //====================================================================
@@ -617,8 +860,7 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_massive_neutrino_transfer_function(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return mnu_transfer_function_spline(z, std::log(k));
+            return eval_transfer(mnu_transfer_function_spline, MNU, k, a);
         }
 
         //====================================================================
@@ -627,11 +869,10 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_massive_neutrino_growth_rate(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            double Dnu = mnu_transfer_function_spline(z, std::log(k));
+            double Dnu = eval_transfer(mnu_transfer_function_spline, MNU, k, a);
             if (Dnu == 0.0)
                 return 0.0;
-            double dDnudloga = -mnu_transfer_function_spline.deriv_x(z, std::log(k)) / a;
+            double dDnudloga = -eval_transfer(mnu_transfer_function_spline, MNU, k, a, 1) / a;
             return dDnudloga / Dnu;
         }
 
@@ -641,8 +882,7 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_cdm_transfer_function(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return cdm_transfer_function_spline(z, std::log(k));
+            return eval_transfer(cdm_transfer_function_spline, CDM, k, a);
         }
 
         //====================================================================
@@ -651,9 +891,8 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_cdm_growth_rate(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return -cdm_transfer_function_spline.deriv_x(z, std::log(k)) /
-                   cdm_transfer_function_spline(z, std::log(k)) / a;
+            return -eval_transfer(cdm_transfer_function_spline, CDM, k, a, 1) /
+                   eval_transfer(cdm_transfer_function_spline, CDM, k, a) / a;
         }
 
         //====================================================================
@@ -662,8 +901,7 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_baryon_transfer_function(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return baryon_transfer_function_spline(z, std::log(k));
+            return eval_transfer(baryon_transfer_function_spline, BARYON, k, a);
         }
 
         //====================================================================
@@ -672,9 +910,8 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_baryon_growth_rate(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return -baryon_transfer_function_spline.deriv_x(z, std::log(k)) /
-                   baryon_transfer_function_spline(z, std::log(k)) / a;
+            return -eval_transfer(baryon_transfer_function_spline, BARYON, k, a, 1) /
+                   eval_transfer(baryon_transfer_function_spline, BARYON, k, a) / a;
         }
 
         //====================================================================
@@ -731,9 +968,8 @@ namespace FML {
         /// @param[in] a Scalefactor
         //====================================================================
         double LinearTransferData::get_total_growth_rate(double k, double a) const {
-            double z = 1.0 / a - 1.0;
-            return -total_transfer_function_spline.deriv_x(z, std::log(k)) /
-                   total_transfer_function_spline(z, std::log(k)) / a;
+            return -eval_transfer(total_transfer_function_spline, TOTAL, k, a, 1) /
+                   eval_transfer(total_transfer_function_spline, TOTAL, k, a) / a;
         }
 
         //====================================================================
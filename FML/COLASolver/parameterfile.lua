@@ -29,6 +29,32 @@ simulation_use_cola = true
 -- If gravity model has scaledependent growth. If this is false
 -- then we use the k=0 limit of the growth factors when doing COLA
 simulation_use_scaledependent_cola = false
+-- For scaledependent COLA: tabulate the growth factors for all LPT orders on one k-grid and
+-- compute the kick and drift with one k-space pass and one batched FFT (optional, default false:
+-- this keeps twice as many displacement grids allocated at the same time)
+simulation_fused_scaledependent_cola = false
+-- Keep the density and force grids (and the scaledependent COLA grids) between timesteps
+-- instead of reallocating them every step (optional, default false: the grids then stay
+-- allocated also during outputs and analysis)
+simulation_reuse_grids = false
+-- Sort the particles by the cell they are in every n steps (0 = never) for
+-- cache friendly density assignment and force interpolation
+simulation_sort_particles_every_nsteps = 0
+-- Do the analysis and output (P(k), FoF, bispectrum, particles) in a background thread on a copy of the
+-- particles while we continue time-stepping. Not availiable with MPI
+simulation_analyze_in_background = false
+-- Pure LPT without particles (needs timestep_nsteps = 0, ic_LPT_order <= 2). We keep the LPT potentials as
+-- grids and make the density field (P(k) and the density grid) by going over the Lagrangian lattice in
+-- chunks so the memory use is set by the grids and not by the particles. Particle output (GADGET or HDF5,
+-- one file per task, no subsampling) is written chunk by chunk with the LPT velocities. Bispectrum,
+-- multipoles, FoF and the lightcone need all the particles and are not availiable in this mode
+simulation_lpt_gridmode = false
+-- The number of chunks of lattice slices we go through (more chunks = less memory for the temporary particles)
+simulation_lpt_gridmode_nchunks = 16
+-- Keep the particles on the GPU from the density assignment to the drift (the kick, the drift and the
+-- scaleindependent COLA kick-drift run there) and only copy the grids for the FFTs done on the host.
+-- Needs USE_OMP_TARGET (optional, default false)
+simulation_offload_pm_step = false
 
 ------------------------------------------------------------
 -- Choose the cosmology 
@@ -93,6 +119,10 @@ end
 ------------------------------------------------------------
 -- Gravity model: GR, DGP, f(R), JBD, Symmetron, Geff, ... add your own ...
 gravity_model = "GR"
+-- For scaledependent growth (massive neutrinos or scaledependent models) store D(k,a) as a low-rank separable
+-- fit sum_r U_r(k) W_r(a) instead of 2D splines (optional, default false). Much less memory and cheaper lookups.
+-- We fall back to the 2D splines if the fit does not reach a relative accuracy of 1e-6
+gravity_model_growth_lowrank = false
 
 -- General Geff/G(a) models (mu-parametrization)
 if gravity_model == "Geff" then 
@@ -113,6 +143,10 @@ if gravity_model == "mbeta" then
   -- Screening efficiency (1.0 is standard)
   -- This can be used to increase or decrease the amount of screening if using gravity_model_screening
   gravity_model_screening_efficiency = 1.0
+  -- Smoothing of the Newtonian potential used to compute the screening factor
+  -- Filter (gaussian, tophat, sharpk) and smoothing scale R/boxsize (0 = no smoothing)
+  gravity_model_screening_smoothing_filter = "gaussian"
+  gravity_model_screening_smoothing_scale_over_boxsize = 0.0 / simulation_boxsize
   -- Combine screeneed solution with linear solution to enforce correct
   -- linear evolution on large scales
   gravity_model_screening_enforce_largescale_linear = true
@@ -136,6 +170,10 @@ if gravity_model == "f(R)" then
   -- Screening efficiency (1.0 is standard)
   -- This can be used to increase or decrease the amount of screening if using gravity_model_screening
   gravity_model_screening_efficiency = 1.0
+  -- Smoothing of the Newtonian potential used to compute the screening factor
+  -- Filter (gaussian, tophat, sharpk) and smoothing scale R/boxsize (0 = no smoothing)
+  gravity_model_screening_smoothing_filter = "gaussian"
+  gravity_model_screening_smoothing_scale_over_boxsize = 0.0 / simulation_boxsize
   -- Combine screeneed solution with linear solution to enforce correct
   -- linear evolution on large scales
   gravity_model_screening_enforce_largescale_linear = true
@@ -150,6 +188,18 @@ if gravity_model == "f(R)" then
   -- In some cases the multigrid solver fails if we are not close to the
   -- solution before starting multigrid. Increase this if so
   multigrid_nsweeps_first_step = 5
+  -- Use the solution from the previous step (rescaled to the new time) as the
+  -- initial guess. Usually saves quite a few V-cycles
+  multigrid_warm_start = true
+  -- The multigrid cycle to use (V, W or F). W and F-cycles do more work on the
+  -- coarse levels per cycle, but usually need fewer cycles for strongly nonlinear equations
+  multigrid_cycle_type = "V"
+  -- Make the initial guess by full multigrid (solve on the coarsest level and prolong
+  -- up level by level). This replaces the warm start guess so use one or the other
+  multigrid_fmg = false
+  -- Do the multigrid solve on the GPU: all levels stay in device memory and only the
+  -- ghost slices are copied for the MPI communication. Needs USE_OMP_TARGET (optional, default false)
+  multigrid_offload = false
 end
 
 -- Symmetron model
@@ -168,6 +218,10 @@ if gravity_model == "Symmetron" then
   -- Screening efficiency (1.0 is standard)
   -- This can be used to increase or decrease the amount of screening if using gravity_model_screening
   gravity_model_screening_efficiency = 1.0
+  -- Smoothing of the Newtonian potential used to compute the screening factor
+  -- Filter (gaussian, tophat, sharpk) and smoothing scale R/boxsize (0 = no smoothing)
+  gravity_model_screening_smoothing_filter = "gaussian"
+  gravity_model_screening_smoothing_scale_over_boxsize = 0.0 / simulation_boxsize
   -- Combine screeneed solution with linear solution to enforce correct
   -- linear evolution on large scales
   gravity_model_screening_enforce_largescale_linear = false
@@ -182,6 +236,18 @@ if gravity_model == "Symmetron" then
   -- In some cases the multigrid solver fails if we are not close to the
   -- solution before starting multigrid. Increase this if so
   multigrid_nsweeps_first_step = 5
+  -- Use the solution from the previous step (rescaled to the new time) as the
+  -- initial guess. Usually saves quite a few V-cycles
+  multigrid_warm_start = true
+  -- The multigrid cycle to use (V, W or F). W and F-cycles do more work on the
+  -- coarse levels per cycle, but usually need fewer cycles for strongly nonlinear equations
+  multigrid_cycle_type = "V"
+  -- Make the initial guess by full multigrid (solve on the coarsest level and prolong
+  -- up level by level). This replaces the warm start guess so use one or the other
+  multigrid_fmg = false
+  -- Do the multigrid solve on the GPU: all levels stay in device memory and only the
+  -- ghost slices are copied for the MPI communication. Needs USE_OMP_TARGET (optional, default false)
+  multigrid_offload = false
 end
 
 -- DGP model (pick LCDM as the cosmology to get the normal branch)
@@ -231,10 +297,37 @@ particle_allocation_factor = 1.25
 output_redshifts = {0.0}
 -- Output particles?
 output_particles = true
--- Fileformat: GADGET, FML
+-- Fileformat: GADGET, FML, COMPRESSED (positions relative to the Lagrangian grid and velocities
+-- quantized to output_compressed_nbits, see CompressedSnapshotHeader in AnalyzeOutput.h) or
+-- HDF5 (Gadget-4 style snapshot_z*.hdf5, needs USE_HDF5 in the Makefile)
 output_fileformat = "GADGET"
 -- Output folder
 output_folder = "output"
+-- Number of particle files (optional, default 0 = one per task). For GADGET the tasks are grouped and
+-- the first task in each group writes the file (e.g. one per node). For FML any value > 0 means one
+-- shared file (written by all tasks with MPI-IO). For HDF5 the tasks in a group take turn writing to the file
+output_nfiles = 0
+-- Write the GADGET files in a background thread so the time-stepping continues while we write
+-- (optional, default false; the particles are converted before we continue)
+output_write_in_background = false
+-- For GADGET with one file per task: convert the particles in chunks while a background I/O thread writes
+-- the previous chunk (optional, default false). The output is identical to the normal writer
+output_async_write = false
+-- Write a CSV file (output_folder/performance_simulation_name.csv) with one row per step with the time spent
+-- in the different parts of the code (min, max and mean over tasks), the particle load imbalance and the
+-- peak memory use (resident set size)
+output_performance_report = false
+-- Only output the particles whose ID hashes to a number < output_subsample_fraction (optional, default 1.0
+-- = all). The subsample is deterministic so the same particles are in every output and every run
+output_subsample_fraction = 1.0
+-- Output the density contrast and the mean velocity (km/s) on a grid with this Nmesh in every output
+-- (optional, default 0 = no). Written as one file per grid in snapshot_folder with dump_to_file_parallel
+output_grids_nmesh = 0
+output_grids_density_assignment_method = "CIC"
+-- Bits per coordinate for the COMPRESSED fileformat: 8 or 16 (optional, default 16)
+output_compressed_nbits = 16
+-- Deflate level 0-9 for the HDF5 fileformat, 0 means no compression (optional, default 4)
+output_hdf5_compression_level = 4
 
 ------------------------------------------------------------
 -- Time-stepping
@@ -260,12 +353,27 @@ end
 ------------------------------------------------------------
 -- The random seed
 ic_random_seed = 1234
--- The random generator (GSL or MT19937). Fiducial GSL is gsl_rng_ranlxd1 (as used in the 2LPTIC code for comparison)
+-- The random generator (GSL, MT19937 or PHILOX). Fiducial GSL is gsl_rng_ranlxd1 (as used in the 2LPTIC code for comparison)
+-- PHILOX is counter-based: for gaussian IC each mode's random numbers only depend on (seed, kx, ky, kz), so the same
+-- seed gives the same large scale modes for any ic_nmesh (resolution studies / zooms) and any number of tasks
 ic_random_generator = "GSL"
 -- Fix amplitude when generating the gaussian random field
 ic_fix_amplitude = true
 -- Mirror the phases (for amplitude-fixed simulations)
 ic_reverse_phases = false
+-- Run an ensemble: the seeds ic_random_seed, ..., ic_random_seed + ic_ensemble_nseeds - 1 one after another
+-- (optional, default 1). The power-spectrum, growth factors and transfer data are only computed once.
+-- The outputs get the name simulation_name_seed[seed]
+ic_ensemble_nseeds = 1
+-- Also run the reversed phase partner of every seed (outputs named simulation_name_seed[seed]_reversed)
+-- (optional, default false). Use with ic_fix_amplitude = true for paired-and-fixed ensembles
+ic_ensemble_paired = false
+-- Only make the initial conditions and write them to [output_folder]/ic_[simulation_name] (no time-stepping)
+-- (optional, default false). The particles are made and written ic_stream_nchunks slabs of the lattice at the
+-- time so we never have them all in memory. One file per task in the format output_fileformat (GADGET or HDF5)
+ic_stream_to_file = false
+-- The number of chunks of the lattice we go through at the time (optional, default 16)
+ic_stream_nchunks = 16
 -- Type of IC: gaussian, nongaussian, read_particles, read_phases
 -- read_particles   (read GADGET file and use that for sim - reconstruct LPT fields if COLA) 
 -- read_phases      (read GADGET file and use that to set the phases for the sim)
@@ -285,6 +393,15 @@ ic_type_of_input = "powerspectrum"
 ic_type_of_input_fileformat = "CAMB" -- Format for transferinfofile: CAMB, CLASS (run this with format=camb), AXIONCAMB. Easy to add more in CAMBReader.h
 -- Path to the input (NB: for using the example files update the path at the top of the file below)
 ic_input_filename = "input/example_power_spectrum_cb_z0.000.txt"
+-- For transferinfofile: folder where we store the parsed transfer files in a binary file that is used
+-- instead of parsing them again as long as the files are unchanged (optional, default "" = no cache)
+ic_transferdata_cache_folder = ""
+-- For transferinfofile: only read (and spline) the file for a redshift the first time it is needed
+-- instead of all files at startup. Values at the redshifts of the files are the same, in between we use
+-- cubic interpolation over the 4 closest files. The cache above is not used in this mode (optional, default false)
+ic_transferdata_lazy_loading = false
+-- With lazy loading: read the remaining files in a background thread (optional, default false)
+ic_transferdata_prefetch = false
 -- The redshift of the P(k), T(k) we give as input
 ic_input_redshift = 0.0
 -- The initial redshift of the simulation
@@ -346,10 +463,54 @@ force_linear_massive_neutrinos = true
 force_use_finite_difference_force = false
 force_finite_difference_stencil_order = 4
 
+-- Zoom: compute the short range part of the force on a second, finer grid covering a cubic
+-- region (plus force_zoom_cutoff_over_split * r_s on each side) and use it instead of the
+-- short range part of the force_nmesh force for the particles in the region. The split r_s
+-- is in units of the force_nmesh grid cell. The zoom grid should have a smaller cell than
+-- force_nmesh, i.e. force_zoom_nmesh > (size + 2 cutoff r_s) / boxsize * force_nmesh
+-- (optional, default false)
+force_zoom = false
+if force_zoom then
+  force_zoom_region_corner = {200.0, 200.0, 200.0}
+  force_zoom_region_size = 50.0
+  force_zoom_nmesh = 128
+  force_zoom_split_in_cells = 1.25
+  force_zoom_cutoff_over_split = 4.5
+end
+
 ------------------------------------------------------------
 -- On the fly analysis
 ------------------------------------------------------------
 
+------------------------------------------------------------
+-- Checkpointing
+------------------------------------------------------------
+-- Write the particles and the time-stepping state every n steps (0 = never)
+checkpoint_every_nsteps = 0
+-- Folder for the checkpoints ("" = output_folder/checkpoint_simulation_name)
+checkpoint_folder = ""
+-- Continue the run from the last checkpoint in checkpoint_folder instead of making IC
+restart_from_checkpoint = false
+
+------------------------------------------------------------
+-- Lightcone
+------------------------------------------------------------
+-- Make a lightcone on the fly (particles crossing the past lightcone of the observer(s))
+lightcone = false
+-- Position of the observer(s) in Mpc/h. For several observers just list them after each other
+lightcone_origin_mpch = {0.0, 0.0, 0.0}
+-- The redshift range of the lightcone
+lightcone_zmin = 0.0
+lightcone_zmax = 0.5
+-- Replicate the box periodically if the lightcone is deeper than the box
+lightcone_replicate = true
+-- An upper bound on how far a particle moves in one time-step in Mpc/h
+lightcone_buffer_mpch = 10.0
+-- Make a HEALPix map of the number of particles in every shell (0 = no maps)
+lightcone_healpix_nside = 0
+-- Output the particles on the lightcone?
+lightcone_output_particles = true
+
 ------------------------------------------------------------
 -- Halofinding
 ------------------------------------------------------------
@@ -364,6 +525,11 @@ fof_linking_length = 0.2
 fof_nmesh_max = 0
 -- The size of the buffer region larger than largest halo, 2-3Mpc/h should be fine)
 fof_buffer_length_mpch = 3.0
+-- Also do halofinding every n time-steps during the run (0 = only at outputs)
+-- The halos are appended to fof_onthefly_<simulation_name>.<task> (see compute_fof_halos_on_the_fly)
+fof_onthefly_every_nsteps = 0
+-- Store the ids of the member particles of these halos (needed to build merger trees)
+fof_onthefly_output_ids = true
 
 ------------------------------------------------------------
 -- Power-spectrum evaluation
@@ -409,6 +575,10 @@ bispectrum_nbins = 10
 bispectrum_interlacing = true
 -- Subtract shotnoise?
 bispectrum_subtract_shotnoise = false
+-- Maximum memory (in MB per task) for the nbins grids. If the grids
+-- don't fit we do the bins in blocks and recompute grids as needed
+-- (slower, but allows many more bins). 0 means no limit
+bispectrum_max_memory_in_mb = 0.0
 -- Density assignment method: NGP, CIC, TSC, PCS, PQS
 bispectrum_density_assignment_method = "PCS"
 
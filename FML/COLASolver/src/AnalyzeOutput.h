@@ -6,14 +6,19 @@
 #include <FML/FileUtils/FileUtils.h>
 #include <FML/FriendsOfFriends/FoF.h>
 #include <FML/GadgetUtils/GadgetUtils.h>
+#include <FML/GadgetUtils/GadgetHDF5.h>
 #include <FML/Global/Global.h>
 #include <FML/MPIParticles/MPIParticles.h>
 #include <FML/NBody/NBody.h>
 #include <FML/ParameterMap/ParameterMap.h>
 #include <FML/Spline/Spline.h>
 
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <vector>
 
@@ -125,6 +130,83 @@ void output_pofk_for_every_step(NBodySimulation<NDIM, T> & sim) {
     }
 }
 
+/// A deterministic pseudo-random number in [0,1) from the id of a particle (splitmix64 finalizer). A particle is
+/// in the subsample with fraction f if this is < f so we select the same particles in every output, every run and
+/// for any number of tasks
+inline double subsample_uniform_from_id(long long int id) {
+    uint64_t z = uint64_t(id) + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return double(z >> 11) / double(1ULL << 53);
+}
+
+/// Copy the particles that are in the ID based subsample with the given fraction
+template <class T>
+FML::Vector<T> subsample_particles(FML::PARTICLE::MPIParticles<T> & part, double fraction) {
+    FML::assert_mpi(FML::PARTICLE::has_get_id<T>(),
+                    "[subsample_particles] The particles must have an id to select a subsample\n");
+    FML::Vector<T> subsample;
+    subsample.reserve(size_t(double(part.get_npart()) * fraction * 1.1) + 16);
+    for (auto & p : part)
+        if (subsample_uniform_from_id(FML::PARTICLE::GetID(p)) < fraction)
+            subsample.push_back(p);
+    return subsample;
+}
+
+/// In the LPT gridmode we never have all the particles so we make them chunk by chunk (with the LPT velocity)
+/// and write each chunk to the file of the task (GADGET or HDF5, one file per task) as we go
+template <int NDIM, class T>
+void output_lpt_gridmode_particles(NBodySimulation<NDIM, T> & sim,
+                                   double scale_factor,
+                                   std::string filename,
+                                   [[maybe_unused]] std::string fileformat) {
+    const auto simulation_boxsize = sim.simulation_boxsize;
+    const auto & cosmo = sim.cosmo;
+    const double pos_norm = simulation_boxsize;
+    const double vel_norm = 100 * simulation_boxsize / std::pow(scale_factor, 1.5);
+    const size_t npart_total = size_t(FML::power(sim.particle_Npart_1D, NDIM));
+
+    FML::FILEUTILS::GADGET::GadgetWriter gw;
+#ifdef USE_HDF5
+    FML::FILEUTILS::GADGET::GadgetHDF5Writer hw;
+    hw.set_compression(sim.output_hdf5_compression_level);
+#endif
+    size_t offset = 0;
+    auto output_chunk = [&](FML::Vector<T> & chunk, size_t npart_local) {
+        if (fileformat == "GADGET") {
+            if (offset == 0)
+                gw.create_gadget_single<T>(filename,
+                                           npart_local,
+                                           npart_total,
+                                           FML::NTasks,
+                                           scale_factor,
+                                           simulation_boxsize,
+                                           cosmo->get_OmegaM(),
+                                           cosmo->get_OmegaLambda(),
+                                           cosmo->get_h());
+            gw.write_gadget_single_block(filename, chunk.data(), chunk.size(), offset, pos_norm, vel_norm);
+        }
+#ifdef USE_HDF5
+        if (fileformat == "HDF5") {
+            if (offset == 0)
+                hw.create_hdf5_single<T>(filename,
+                                         npart_local,
+                                         npart_total,
+                                         FML::NTasks,
+                                         scale_factor,
+                                         simulation_boxsize,
+                                         cosmo->get_OmegaM(),
+                                         cosmo->get_OmegaLambda(),
+                                         cosmo->get_h());
+            hw.write_hdf5_single_block(filename, chunk.data(), chunk.size(), offset, pos_norm, vel_norm);
+        }
+#endif
+        offset += chunk.size();
+    };
+    sim.for_each_lpt_gridmode_chunk(scale_factor, true, output_chunk);
+}
+
 template <int NDIM, class T>
 void output_fml(NBodySimulation<NDIM, T> & sim, double redshift, std::string snapshot_folder) {
 
@@ -134,8 +216,15 @@ void output_fml(NBodySimulation<NDIM, T> & sim, double redshift, std::string sna
 
     // Output particles in internal format
     std::string fileprefix = snapshot_folder + "/" + "fml_z" + redshiftstring;
-    auto & part = sim.part;
-    part.dump_to_file(fileprefix);
+    auto & part = sim.particles_to_analyze();
+    FML::PARTICLE::MPIParticles<T> subsample;
+    if (sim.output_subsample_fraction < 1.0)
+        subsample.move_from(subsample_particles(part, sim.output_subsample_fraction));
+    auto & part_to_output = sim.output_subsample_fraction < 1.0 ? subsample : part;
+    if (sim.output_nfiles > 0)
+        part_to_output.dump_to_shared_file(fileprefix);
+    else
+        part_to_output.dump_to_file(fileprefix);
 }
 
 template <int NDIM, class T>
@@ -150,10 +239,10 @@ void output_gadget(NBodySimulation<NDIM, T> & sim, double redshift, std::string
     //=============================================================
     const auto simulation_boxsize = sim.simulation_boxsize;
     const auto & cosmo = sim.cosmo;
-    auto & part = sim.part;
+    auto & part = sim.particles_to_analyze();
 
     const double scale_factor = 1.0 / (1.0 + redshift);
-    const int nfiles = FML::NTasks;
+    const int nfiles = sim.output_nfiles > 0 ? std::min(sim.output_nfiles, FML::NTasks) : FML::NTasks;
     const double pos_norm = simulation_boxsize;
     const double vel_norm = 100 * simulation_boxsize / std::pow(scale_factor, 1.5);
     const std::string fileprefix = snapshot_folder + "/" + "gadget_z" + redshiftstring;
@@ -166,11 +255,47 @@ void output_gadget(NBodySimulation<NDIM, T> & sim, double redshift, std::string
         std::cout << "#=====================================================\n";
     }
 
+    // No particles in the LPT gridmode so we make them as we write them
+    if (sim.simulation_lpt_gridmode) {
+        output_lpt_gridmode_particles(sim, scale_factor, fileprefix + "." + std::to_string(FML::ThisTask), "GADGET");
+        return;
+    }
+
+    // Only write the ID based subsample (the particle mass in the header is set from the number we write)
+    FML::Vector<T> subsample;
+    T * part_ptr = part.get_particles_ptr();
+    size_t npart = part.get_npart();
+    if (sim.output_subsample_fraction < 1.0) {
+        subsample = subsample_particles(part, sim.output_subsample_fraction);
+        part_ptr = subsample.data();
+        npart = subsample.size();
+    }
+    size_t npart_total = npart;
+    FML::SumOverTasks(&npart_total);
+
     FML::FILEUTILS::GADGET::GadgetWriter gw;
+    if (nfiles < FML::NTasks or sim.output_write_in_background) {
+        // Group the tasks so that nfiles tasks write a file each (possibly in the background). The particles
+        // are copied before this returns so the subsample can go out of scope
+        sim.output_thread = gw.write_gadget_grouped(fileprefix,
+                                                    part_ptr,
+                                                    npart,
+                                                    nfiles,
+                                                    sim.output_write_in_background,
+                                                    scale_factor,
+                                                    simulation_boxsize,
+                                                    cosmo->get_OmegaM(),
+                                                    cosmo->get_OmegaLambda(),
+                                                    cosmo->get_h(),
+                                                    pos_norm,
+                                                    vel_norm);
+        return;
+    }
+    gw.set_async_write(sim.output_async_write);
     gw.write_gadget_single(fileprefix + "." + std::to_string(FML::ThisTask),
-                           part.get_particles_ptr(),
-                           part.get_npart(),
-                           part.get_npart_total(),
+                           part_ptr,
+                           npart,
+                           npart_total,
                            nfiles,
                            scale_factor,
                            simulation_boxsize,
@@ -181,6 +306,277 @@ void output_gadget(NBodySimulation<NDIM, T> & sim, double redshift, std::string
                            vel_norm);
 }
 
+#ifdef USE_HDF5
+template <int NDIM, class T>
+void output_hdf5(NBodySimulation<NDIM, T> & sim, double redshift, std::string snapshot_folder) {
+
+    std::stringstream stream;
+    stream << std::fixed << std::setprecision(3) << redshift;
+    std::string redshiftstring = stream.str();
+
+    //=============================================================
+    // Fetch parameters
+    //=============================================================
+    const auto simulation_boxsize = sim.simulation_boxsize;
+    const auto & cosmo = sim.cosmo;
+    auto & part = sim.particles_to_analyze();
+
+    const double scale_factor = 1.0 / (1.0 + redshift);
+    const int nfiles = sim.output_nfiles > 0 ? std::min(sim.output_nfiles, FML::NTasks) : FML::NTasks;
+    const double pos_norm = simulation_boxsize;
+    const double vel_norm = 100 * simulation_boxsize / std::pow(scale_factor, 1.5);
+    const std::string fileprefix = snapshot_folder + "/" + "snapshot_z" + redshiftstring;
+
+    if (FML::ThisTask == 0) {
+        std::cout << "\n";
+        std::cout << "#=====================================================\n";
+        std::cout << "# Output in HDF5 format\n";
+        std::cout << "# fileprefix  : " << fileprefix << "\n";
+        std::cout << "#=====================================================\n";
+    }
+
+    // No particles in the LPT gridmode so we make them as we write them
+    if (sim.simulation_lpt_gridmode) {
+        // Same file names as write_hdf5
+        const std::string filename = FML::NTasks == 1 ? fileprefix + ".hdf5" :
+                                                        fileprefix + "." + std::to_string(FML::ThisTask) + ".hdf5";
+        output_lpt_gridmode_particles(sim, scale_factor, filename, "HDF5");
+        return;
+    }
+
+    // Only write the ID based subsample (the particle mass in the header is set from the number we write)
+    FML::Vector<T> subsample;
+    T * part_ptr = part.get_particles_ptr();
+    size_t npart = part.get_npart();
+    if (sim.output_subsample_fraction < 1.0) {
+        subsample = subsample_particles(part, sim.output_subsample_fraction);
+        part_ptr = subsample.data();
+        npart = subsample.size();
+    }
+
+    FML::FILEUTILS::GADGET::GadgetHDF5Writer hw;
+    hw.set_compression(sim.output_hdf5_compression_level);
+    hw.write_hdf5(fileprefix,
+                  part_ptr,
+                  npart,
+                  nfiles,
+                  scale_factor,
+                  simulation_boxsize,
+                  cosmo->get_OmegaM(),
+                  cosmo->get_OmegaLambda(),
+                  cosmo->get_h(),
+                  pos_norm,
+                  vel_norm);
+}
+#endif
+
+template <int NDIM, class T>
+void output_grids(NBodySimulation<NDIM, T> & sim, double redshift, std::string snapshot_folder) {
+
+    std::stringstream stream;
+    stream << std::fixed << std::setprecision(3) << redshift;
+    std::string redshiftstring = stream.str();
+
+    //=============================================================
+    // Fetch parameters
+    //=============================================================
+    const double simulation_boxsize = sim.simulation_boxsize;
+    const int output_grids_nmesh = sim.output_grids_nmesh;
+    const std::string output_grids_density_assignment_method = sim.output_grids_density_assignment_method;
+    auto & part = sim.particles_to_analyze();
+
+    const double a = 1.0 / (1.0 + redshift);
+    const double vel_to_kms = 100.0 * simulation_boxsize / a;
+    const std::string fileprefix = snapshot_folder + "/" + "grid_";
+    const std::string filesuffix = "_z" + redshiftstring + ".fftwgrid";
+
+    if (FML::ThisTask == 0) {
+        std::cout << "\n";
+        std::cout << "#=====================================================\n";
+        std::cout << "# Output density and velocity grids\n";
+        std::cout << "# output_grids_nmesh                     : " << output_grids_nmesh << "\n";
+        std::cout << "# output_grids_density_assignment_method : " << output_grids_density_assignment_method << "\n";
+        std::cout << "# fileprefix                             : " << fileprefix << "\n";
+        std::cout << "#=====================================================\n";
+    }
+
+    // No particles (and no velocities) in the LPT gridmode so we only have the density field
+    if (sim.simulation_lpt_gridmode) {
+        const auto nleftright =
+            FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(output_grids_density_assignment_method);
+        FML::GRID::FFTWGrid<NDIM> delta(output_grids_nmesh, nleftright.first, nleftright.second);
+        delta.add_memory_label("FFTWGrid::output_grids::density");
+        sim.compute_lpt_gridmode_density_field(delta, a, output_grids_density_assignment_method);
+        delta.dump_to_file_parallel(fileprefix + "delta" + filesuffix);
+        return;
+    }
+
+    // The number of particles and the momentum in each cell (all in one pass over the particles)
+    const auto nleftright =
+        FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(output_grids_density_assignment_method);
+    FML::GRID::FFTWGrid<NDIM> count(output_grids_nmesh, nleftright.first, nleftright.second);
+    std::array<FML::GRID::FFTWGrid<NDIM>, NDIM> velocity;
+    std::vector<FML::INTERPOLATION::GridAndWeight<NDIM, T>> grids{{&count, [](const T &) { return 1.0; }, false}};
+    for (int idim = 0; idim < NDIM; idim++) {
+        velocity[idim] = FML::GRID::FFTWGrid<NDIM>(output_grids_nmesh, nleftright.first, nleftright.second);
+        velocity[idim].add_memory_label("FFTWGrid::output_grids::velocity");
+        grids.push_back({&velocity[idim],
+                         [idim](const T & p) { return FML::PARTICLE::GetVel(const_cast<T &>(p))[idim]; },
+                         false});
+    }
+    count.add_memory_label("FFTWGrid::output_grids::density");
+    FML::INTERPOLATION::particles_to_grids<NDIM, T>(
+        part.get_particles_ptr(), part.get_npart(), grids, output_grids_density_assignment_method);
+
+    // The mean velocity in each cell (km/s peculiar, 0 in empty cells) and then delta = count / mean - 1 in place
+    const double mean_count = double(part.get_npart_total()) / FML::power(double(output_grids_nmesh), NDIM);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+    for (int islice = 0; islice < count.get_local_nx(); islice++) {
+        for (auto && real_index : count.get_real_range(islice, islice + 1)) {
+            const double n = count.get_real_from_index(real_index);
+            for (int idim = 0; idim < NDIM; idim++) {
+                const double v = n > 0.0 ? velocity[idim].get_real_from_index(real_index) / n * vel_to_kms : 0.0;
+                velocity[idim].set_real_from_index(real_index, v);
+            }
+            count.set_real_from_index(real_index, n / mean_count - 1.0);
+        }
+    }
+
+    count.dump_to_file_parallel(fileprefix + "delta" + filesuffix);
+    for (int idim = 0; idim < NDIM; idim++)
+        velocity[idim].dump_to_file_parallel(fileprefix + "vel" + std::to_string(idim) + filesuffix);
+}
+
+/// The header of the files written by output_compressed. Each task writes one file [snapshot_folder]/compressed_z
+/// [redshift].[ThisTask] with this header followed by the npart ids (int64), the npart * ndim quantized displacements
+/// and the npart * ndim quantized velocities (int8 or int16, for particle i the ndim components are together).
+/// A particle is at x = q(id) + displacement (mod 1), in units of the box, with q(id) the Lagrangian position of the
+/// id'th particle of a npart_1D^ndim grid (FML::PARTICLE::lagrangian_position_from_id) and
+/// displacement = quantized * max_displacement / (2^(nbits-1) - 1). Same for the velocity (in km/s peculiar)
+struct CompressedSnapshotHeader {
+    int magic{0x434f4c41}; // "COLA"
+    int ndim{0};
+    int nbits{0};
+    int npart_1D{0};
+    long long int npart{0};
+    long long int npart_total{0};
+    double boxsize{0.0};
+    double scale_factor{0.0};
+    double max_displacement{0.0};
+    double max_velocity{0.0};
+};
+
+template <int NDIM, class T>
+void output_compressed(NBodySimulation<NDIM, T> & sim, double redshift, std::string snapshot_folder) {
+
+    std::stringstream stream;
+    stream << std::fixed << std::setprecision(3) << redshift;
+    std::string redshiftstring = stream.str();
+
+    //=============================================================
+    // Fetch parameters
+    //=============================================================
+    const double simulation_boxsize = sim.simulation_boxsize;
+    const int particle_Npart_1D = sim.particle_Npart_1D;
+    const int output_compressed_nbits = sim.output_compressed_nbits;
+    const double output_subsample_fraction = sim.output_subsample_fraction;
+    auto & part = sim.particles_to_analyze();
+
+    FML::assert_mpi(FML::PARTICLE::has_get_id<T>(),
+                    "[output_compressed] The particles must have an id to be stored relative to the Lagrangian grid\n");
+    FML::assert_mpi(output_compressed_nbits == 8 or output_compressed_nbits == 16,
+                    "[output_compressed] output_compressed_nbits must be 8 or 16\n");
+
+    const double a = 1.0 / (1.0 + redshift);
+    const double vel_to_kms = 100.0 * simulation_boxsize / a;
+    const std::string filename =
+        snapshot_folder + "/" + "compressed_z" + redshiftstring + "." + std::to_string(FML::ThisTask);
+
+    if (FML::ThisTask == 0) {
+        std::cout << "\n";
+        std::cout << "#=====================================================\n";
+        std::cout << "# Output quantized particles\n";
+        std::cout << "# output_compressed_nbits   : " << output_compressed_nbits << "\n";
+        std::cout << "# output_subsample_fraction : " << output_subsample_fraction << "\n";
+        std::cout << "# filename                  : " << filename << "\n";
+        std::cout << "#=====================================================\n";
+    }
+
+    FML::Vector<T> subsample;
+    T * part_ptr = part.get_particles_ptr();
+    size_t npart = part.get_npart();
+    if (output_subsample_fraction < 1.0) {
+        subsample = subsample_particles(part, output_subsample_fraction);
+        part_ptr = subsample.data();
+        npart = subsample.size();
+    }
+
+    // Displacement from the Lagrangian position (wrapped to [-0.5,0.5)) and velocity in km/s
+    std::vector<long long int> ids(npart);
+    std::vector<float> displacement(npart * NDIM);
+    std::vector<float> velocity(npart * NDIM);
+    double max_displacement = 0.0;
+    double max_velocity = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_displacement, max_velocity)
+#endif
+    for (size_t i = 0; i < npart; i++) {
+        ids[i] = FML::PARTICLE::GetID(part_ptr[i]);
+        std::array<double, NDIM> q;
+        FML::PARTICLE::lagrangian_position_from_id<NDIM>(ids[i], particle_Npart_1D, q.data());
+        auto pos = FML::PARTICLE::GetPos(part_ptr[i]);
+        auto vel = FML::PARTICLE::GetVel(part_ptr[i]);
+        for (int idim = 0; idim < NDIM; idim++) {
+            double d = pos[idim] - q[idim];
+            d -= std::floor(d + 0.5);
+            displacement[i * NDIM + idim] = d;
+            velocity[i * NDIM + idim] = vel[idim] * vel_to_kms;
+            max_displacement = std::max(max_displacement, std::abs(d));
+            max_velocity = std::max(max_velocity, std::abs(vel[idim] * vel_to_kms));
+        }
+    }
+    FML::MaxOverTasks(&max_displacement);
+    FML::MaxOverTasks(&max_velocity);
+
+    CompressedSnapshotHeader header;
+    header.ndim = NDIM;
+    header.nbits = output_compressed_nbits;
+    header.npart_1D = particle_Npart_1D;
+    header.npart = npart;
+    header.npart_total = npart;
+    FML::SumOverTasks(&header.npart_total);
+    header.boxsize = simulation_boxsize;
+    header.scale_factor = a;
+    header.max_displacement = max_displacement;
+    header.max_velocity = max_velocity;
+
+    std::ofstream fp(filename.c_str(), std::ios::binary | std::ios::out);
+    if (not fp.is_open())
+        throw std::runtime_error("[output_compressed] Failed to open [" + filename + "]");
+    fp.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    fp.write(reinterpret_cast<const char *>(ids.data()), ids.size() * sizeof(long long int));
+
+    // Round to the nearest of the 2^(nbits-1)-1 levels on each side of zero
+    auto write_quantized = [&](const std::vector<float> & values, double max_value, auto type) {
+        using IntType = decltype(type);
+        const double levels = double(std::numeric_limits<IntType>::max());
+        const double norm = max_value > 0.0 ? levels / max_value : 0.0;
+        std::vector<IntType> quantized(values.size());
+        for (size_t i = 0; i < values.size(); i++)
+            quantized[i] = IntType(std::lround(values[i] * norm));
+        fp.write(reinterpret_cast<const char *>(quantized.data()), quantized.size() * sizeof(IntType));
+    };
+    if (output_compressed_nbits == 8) {
+        write_quantized(displacement, max_displacement, int8_t{});
+        write_quantized(velocity, max_velocity, int8_t{});
+    } else {
+        write_quantized(displacement, max_displacement, int16_t{});
+        write_quantized(velocity, max_velocity, int16_t{});
+    }
+}
+
 template <int NDIM, class T>
 void compute_bispectrum(NBodySimulation<NDIM, T> & sim, double redshift, std::string snapshot_folder) {
 
@@ -197,13 +593,14 @@ void compute_bispectrum(NBodySimulation<NDIM, T> & sim, double redshift, std::st
     const std::string bispectrum_density_assignment_method = sim.bispectrum_density_assignment_method;
     const bool bispectrum_interlacing = sim.bispectrum_interlacing;
     const bool bispectrum_subtract_shotnoise = sim.bispectrum_subtract_shotnoise;
-    auto & part = sim.part;
+    auto & part = sim.particles_to_analyze();
 
     const double kmin = 0.0;
     const double kmax = 2.0 * M_PI * bispectrum_nmesh / 2;
     const auto bin_type = FML::CORRELATIONFUNCTIONS::BispectrumBinning<NDIM>::LINEAR_SPACING;
     FML::CORRELATIONFUNCTIONS::BispectrumBinning<NDIM> bofk(kmin, kmax, bispectrum_nbins, bin_type);
     bofk.subtract_shotnoise = bispectrum_subtract_shotnoise;
+    bofk.max_memory_in_mb = sim.bispectrum_max_memory_in_mb;
 
     if (FML::ThisTask == 0) {
         std::cout << "\n";
@@ -284,7 +681,7 @@ void compute_power_spectrum_multipoles(NBodySimulation<NDIM, T> & sim, double re
     const auto & power_initial_spline = sim.power_initial_spline;
     const auto & grav = sim.grav;
     const auto & cosmo = sim.cosmo;
-    auto & part = sim.part;
+    auto & part = sim.particles_to_analyze();
 
     const double a = 1.0 / (1.0 + redshift);
     const double velocity_to_displacement = 1.0 / (a * a * cosmo->HoverH0_of_a(a));
@@ -383,7 +780,7 @@ void compute_power_spectrum(NBodySimulation<NDIM, T> & sim, double redshift, std
     const auto & power_initial_spline = sim.power_initial_spline;
     const auto & grav = sim.grav;
     const auto & cosmo = grav->get_cosmo();
-    auto & part = sim.part;
+    auto & part = sim.particles_to_analyze();
 
     if (FML::ThisTask == 0) {
         std::cout << "\n";
@@ -401,13 +798,29 @@ void compute_power_spectrum(NBodySimulation<NDIM, T> & sim, double redshift, std
     //=============================================================
     FML::CORRELATIONFUNCTIONS::PowerSpectrumBinning<NDIM> pofk_cb_binning(pofk_nmesh / 2);
     pofk_cb_binning.subtract_shotnoise = pofk_subtract_shotnoise;
-    FML::CORRELATIONFUNCTIONS::compute_power_spectrum<NDIM, T>(pofk_nmesh,
-                                                               part.get_particles_ptr(),
-                                                               part.get_npart(),
-                                                               part.get_npart_total(),
-                                                               pofk_cb_binning,
-                                                               pofk_density_assignment_method,
-                                                               pofk_interlacing);
+    if (sim.simulation_lpt_gridmode) {
+        // No particles so we make the density field from the LPT potentials (interlacing is not availiable)
+        const auto nleftright =
+            FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(pofk_density_assignment_method);
+        FML::GRID::FFTWGrid<NDIM> density_grid_fourier(pofk_nmesh, nleftright.first, nleftright.second);
+        density_grid_fourier.add_memory_label("FFTWGrid::compute_power_spectrum::density_grid_fourier");
+        sim.compute_lpt_gridmode_density_field(
+            density_grid_fourier, 1.0 / (1.0 + redshift), pofk_density_assignment_method);
+        density_grid_fourier.fftw_r2c();
+        FML::CORRELATIONFUNCTIONS::bin_up_deconvolved_power_spectrum(
+            density_grid_fourier, pofk_cb_binning, pofk_density_assignment_method);
+        if (pofk_subtract_shotnoise)
+            for (int i = 0; i < pofk_cb_binning.n; i++)
+                pofk_cb_binning.pofk[i] -= 1.0 / double(FML::power(sim.particle_Npart_1D, NDIM));
+    } else {
+        FML::CORRELATIONFUNCTIONS::compute_power_spectrum<NDIM, T>(pofk_nmesh,
+                                                                   part.get_particles_ptr(),
+                                                                   part.get_npart(),
+                                                                   part.get_npart_total(),
+                                                                   pofk_cb_binning,
+                                                                   pofk_density_assignment_method,
+                                                                   pofk_interlacing);
+    }
     pofk_cb_binning.scale(simulation_boxsize);
 
     /* ...or do it this way for which we can compute the total power-spectrum by adding on the neutrinos
@@ -493,7 +906,7 @@ void compute_fof_halos(NBodySimulation<NDIM, T> & sim, double redshift, std::str
     const int fof_nmesh_max = sim.fof_nmesh_max;
     const double fof_buffer_length_mpch = sim.fof_buffer_length_mpch;
     const auto & cosmo = sim.cosmo;
-    auto & part = sim.part;
+    auto & part = sim.particles_to_analyze();
 
     //=============================================================
     // Halo finding
@@ -614,4 +1027,105 @@ void compute_fof_halos(NBodySimulation<NDIM, T> & sim, double redshift, std::str
     }
 }
 
+/// Halofinding during the time-stepping (no snapshot needed). The catalog is appended to one binary file per task,
+/// fof_onthefly_<simulation_name>.<task>, and every epoch is a block of
+///   double a, uint64 nhalos, then for every halo:
+///   uint64 haloid, uint64 np, double mass (Msun/h), double pos[NDIM] (Mpc/h) [, int64 ids[np]]
+/// where the member ids are only written when fof_onthefly_output_ids is set. Task 0 also appends
+/// istep, a, z and the total number of halos to fof_onthefly_<simulation_name>.txt
+/// NB: the halo velocities are not written as during the time-stepping they are not at the same time as the positions
+/// (and for COLA they are not the full velocities). All particles must be in their local domain when we call this
+template <int NDIM, class T>
+void compute_fof_halos_on_the_fly(NBodySimulation<NDIM, T> & sim, double a, int istep_total) {
+
+    //=============================================================
+    // Fetch parameters
+    //=============================================================
+    const double H0_hmpc = sim.grav->H0_hmpc;
+    const double simulation_boxsize = sim.simulation_boxsize;
+    const double fof_linking_length = sim.fof_linking_length;
+    const int fof_nmin_per_halo = sim.fof_nmin_per_halo;
+    const int fof_nmesh_max = sim.fof_nmesh_max;
+    const double fof_buffer_length_mpch = sim.fof_buffer_length_mpch;
+    const bool output_ids = sim.fof_onthefly_output_ids and FML::PARTICLE::has_get_id<T>();
+    const auto & cosmo = sim.cosmo;
+    const auto output_folder = sim.output_folder;
+    const auto simulation_name = sim.simulation_name;
+    auto & part = sim.part;
+
+    //=============================================================
+    // Halofinding
+    //=============================================================
+    // The ids of the members of the halos (for merger trees) are recorded as the halos are gathered
+    using FoFHalo = FML::FOF::FoFHalo<T, NDIM>;
+    const bool periodic_box = true;
+    std::vector<FoFHalo> FoFGroups;
+    FML::FOF::FoFMembers FoFGroupMembers;
+    FML::FOF::FriendsOfFriends<T, NDIM, FoFHalo>(part.get_particles_ptr(),
+                                                 part.get_npart(),
+                                                 fof_linking_length,
+                                                 fof_nmin_per_halo,
+                                                 periodic_box,
+                                                 fof_buffer_length_mpch / simulation_boxsize,
+                                                 FoFGroups,
+                                                 fof_nmesh_max,
+                                                 output_ids ? &FoFGroupMembers : nullptr);
+
+    // Code masses -> Msun/h and code positions -> Mpc/h
+    const double MplMpl_over_H0Msunh = 2.49264e21;
+    const double mass_norm = 3.0 * cosmo->get_OmegaM() * MplMpl_over_H0Msunh *
+                             std::pow(simulation_boxsize * H0_hmpc, 3) / double(part.get_npart_total());
+    const double pos_norm = simulation_boxsize;
+
+    //=============================================================
+    // Append the halos to the catalog of this task
+    //=============================================================
+    const std::string prefix = output_folder + (output_folder == "" ? "" : "/") + "fof_onthefly_" + simulation_name;
+    const std::string filename = prefix + "." + std::to_string(FML::ThisTask);
+    // Start a new catalog the first time we get here (unless we continue a run from a checkpoint)
+    const bool new_catalog = sim.fof_onthefly_catalog != prefix and not sim.restart_from_checkpoint;
+    sim.fof_onthefly_catalog = prefix;
+    std::ofstream fp(filename.c_str(), std::ios::binary | (new_catalog ? std::ios::out : std::ios::app));
+    if (not fp.is_open())
+        throw std::runtime_error("Failed to open [" + filename + "] for on the fly halos");
+
+    std::uint64_t nhalos = 0;
+    for (auto & g : FoFGroups)
+        if (g.np > 0)
+            nhalos++;
+    fp.write(reinterpret_cast<const char *>(&a), sizeof(a));
+    fp.write(reinterpret_cast<const char *>(&nhalos), sizeof(nhalos));
+    for (size_t i = 0; i < FoFGroups.size(); i++) {
+        const auto & g = FoFGroups[i];
+        if (g.np == 0)
+            continue;
+        const std::uint64_t id = g.id;
+        const std::uint64_t np = g.np;
+        const double mass = g.mass * mass_norm;
+        std::array<double, NDIM> pos;
+        for (int idim = 0; idim < NDIM; idim++)
+            pos[idim] = g.pos[idim] * pos_norm;
+        fp.write(reinterpret_cast<const char *>(&id), sizeof(id));
+        fp.write(reinterpret_cast<const char *>(&np), sizeof(np));
+        fp.write(reinterpret_cast<const char *>(&mass), sizeof(mass));
+        fp.write(reinterpret_cast<const char *>(pos.data()), sizeof(double) * NDIM);
+        if (output_ids)
+            fp.write(reinterpret_cast<const char *>(FoFGroupMembers.group_begin(i)),
+                     sizeof(std::int64_t) * FoFGroupMembers.get_np(i));
+    }
+    if (not fp.good())
+        throw std::runtime_error("Failed writing on the fly halos to [" + filename + "]");
+    fp.close();
+
+    // Index of the epochs
+    FML::SumOverTasks(&nhalos);
+    if (FML::ThisTask == 0) {
+        std::ofstream fpinfo((prefix + ".txt").c_str(), new_catalog ? std::ios::out : std::ios::app);
+        if (new_catalog)
+            fpinfo << "# istep_total    a    z    nhalos (ids stored: " << output_ids << ")\n";
+        fpinfo << std::setw(6) << istep_total << " " << std::setw(15) << a << " " << std::setw(15) << 1.0 / a - 1.0
+               << " " << std::setw(15) << nhalos << "\n";
+    }
+}
+
 #endif
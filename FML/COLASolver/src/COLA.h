@@ -12,8 +12,11 @@
 
 #include "GravityModel.h"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <memory>
@@ -27,6 +30,101 @@ using Spline = FML::INTERPOLATION::SPLINE::Spline;
 // frame to the standard frame
 //========================================================================
 
+/// Grids the scaledependent COLA methods can keep between calls (two sets of displacement fields)
+template <int NDIM>
+using COLAWorkspace = std::array<std::array<FML::GRID::FFTWGrid<NDIM>, NDIM>, 2>;
+
+//========================================================================
+/// Compute NOUT displacement vector fields \f$ \Psi_o = \nabla \sum_p c_{op}(k) \phi_p \f$ at the particle
+/// positions from NPHI LPT potentials in a single pass: one k-space loop writing all NOUT * NDIM grids
+/// followed by one batched Fourier transform. The coefficient \f$ c_{op} \f$ is entry o * NPHI + p of the table.
+/// The grids are reused if they are already allocated (e.g. a workspace kept between steps).
+//========================================================================
+template <int NDIM, class T, size_t NOUT, size_t NPHI>
+void cola_scaledependent_displacements_fused(
+    FML::PARTICLE::MPIParticles<T> & part,
+    const std::array<const FML::GRID::FFTWGrid<NDIM> *, NPHI> & phi_fourier,
+    const UniformKTable<NOUT * NPHI> & growth_table,
+    std::array<std::array<FML::GRID::FFTWGrid<NDIM>, NDIM> *, NOUT> grids,
+    std::array<std::array<std::vector<FML::GRID::FloatType>, NDIM>, NOUT> & result,
+    std::string interpolation_method) {
+
+    const auto & phi = *phi_fourier[0];
+    const auto Nmesh = phi.get_nmesh();
+    const auto nleft = phi.get_n_extra_slices_left();
+    const auto nright = phi.get_n_extra_slices_right();
+    const auto Local_nx = phi.get_local_nx();
+    const auto Local_x_start = phi.get_local_x_start();
+
+    std::vector<FML::GRID::FFTWGrid<NDIM> *> grid_ptrs;
+    for (size_t o = 0; o < NOUT; o++) {
+        for (int idim = 0; idim < NDIM; idim++) {
+            auto & grid = (*grids[o])[idim];
+            if (grid.get_nmesh() != Nmesh or grid.get_n_extra_slices_left() != nleft or
+                grid.get_n_extra_slices_right() != nright) {
+                grid = FML::GRID::FFTWGrid<NDIM>(Nmesh, nleft, nright);
+                grid.add_memory_label("FFTWGrid::cola_scaledependent_displacements_fused::Psi_" +
+                                      std::to_string(o) + "_" + std::to_string(idim));
+            }
+            grid.set_grid_status_real(false);
+            grid.set_fourier_layout_transposed(phi.get_fourier_layout_transposed());
+            grid_ptrs.push_back(&grid);
+        }
+    }
+
+    // Psi_o = ik sum_p c_op(k) phi_p(k) for all o in one go
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+    for (int islice = 0; islice < Local_nx; islice++) {
+        double kmag;
+        std::array<double, NDIM> kvec;
+        const std::complex<FML::GRID::FloatType> I(0, 1);
+        for (auto && fourier_index : phi.get_fourier_range(islice, islice + 1)) {
+            phi.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+            const auto coeff = growth_table(kmag);
+            std::array<std::complex<FML::GRID::FloatType>, NPHI> phi_values;
+            for (size_t p = 0; p < NPHI; p++)
+                phi_values[p] = phi_fourier[p]->get_fourier_from_index(fourier_index);
+            for (size_t o = 0; o < NOUT; o++) {
+                std::complex<FML::GRID::FloatType> value = 0.0;
+                for (size_t p = 0; p < NPHI; p++)
+                    value += phi_values[p] * FML::GRID::FloatType(coeff[o * NPHI + p]);
+                value *= I;
+                for (int idim = 0; idim < NDIM; idim++)
+                    (*grids[o])[idim].set_fourier_from_index(fourier_index, value * FML::GRID::FloatType(kvec[idim]));
+            }
+        }
+    }
+
+    // Deal with DC mode
+    if (Local_x_start == 0)
+        for (auto * grid : grid_ptrs)
+            grid->set_fourier_from_index(0, 0.0);
+
+    FML::GRID::fftw_c2r_batched(grid_ptrs);
+    for (auto * grid : grid_ptrs)
+        grid->communicate_boundaries();
+
+    // Interpolate to the particles (the stencils are the same for all the grids)
+    FML::INTERPOLATION::ParticleInterpolationStencils<NDIM> stencils;
+    for (size_t o = 0; o < NOUT; o++) {
+        if constexpr (FML::PARTICLE::has_lagrangian_position_from_id<T>()) {
+            FML::INTERPOLATION::interpolate_grid_vector_to_lagrangian_positions<NDIM>(*grids[o],
+                                                                                     part.get_particles_ptr(),
+                                                                                     part.get_npart(),
+                                                                                     part.get_npart_1D(),
+                                                                                     result[o],
+                                                                                     interpolation_method);
+        } else {
+            auto & grid_vec = *grids[o];
+            if (not stencils.is_valid_for(grid_vec[0], part.get_npart(), interpolation_method))
+                stencils.compute(grid_vec[0], part.get_particles_ptr(), part.get_npart(), interpolation_method);
+            FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<NDIM>(grid_vec, stencils, result[o]);
+        }
+    }
+}
+
 template <int NDIM, class T>
 void cola_initialize_velocities(FML::PARTICLE::MPIParticles<T> & part) {
     auto np = part.get_npart();
@@ -58,7 +156,9 @@ void cola_add_on_LPT_velocity_scaledependent(FML::PARTICLE::MPIParticles<T> & pa
                                              double H0Box,
                                              double aini,
                                              double a,
-                                             double sign = 1.0);
+                                             double sign = 1.0,
+                                             bool fused_kernel = false,
+                                             COLAWorkspace<NDIM> * workspace = nullptr);
 
 template <int NDIM, class T>
 void cola_kick_drift_scaledependent(FML::PARTICLE::MPIParticles<T> & part,
@@ -72,7 +172,9 @@ void cola_kick_drift_scaledependent(FML::PARTICLE::MPIParticles<T> & part,
                                     double aold,
                                     double a,
                                     double delta_time_kick,
-                                    [[maybe_unused]] double delta_time_drift);
+                                    [[maybe_unused]] double delta_time_drift,
+                                    bool fused_kernel = false,
+                                    COLAWorkspace<NDIM> * workspace = nullptr);
 
 template <int NDIM, class T>
 void cola_kick_drift(FML::PARTICLE::MPIParticles<T> & part,
@@ -83,6 +185,21 @@ void cola_kick_drift(FML::PARTICLE::MPIParticles<T> & part,
                      double delta_time_kick,
                      [[maybe_unused]] double delta_time_drift);
 
+//========================================================================
+// The factors in the (scaleindependent) LPT velocity. For the displacement fields D1, D2, D3a and D3b
+// stored in the particles the LPT velocity at a is sum_n D_n * fac_vel[n]
+//========================================================================
+template <int NDIM>
+std::array<double, 4>
+cola_LPT_velocity_factors(std::shared_ptr<GravityModel<NDIM>> & grav, double aini, double a) {
+    auto cosmo = grav->get_cosmo();
+    const double vnorm = a * a * cosmo->HoverH0_of_a(a);
+    return {grav->get_D_1LPT(a) / grav->get_D_1LPT(aini) * grav->get_f_1LPT(a) * vnorm,
+            grav->get_D_2LPT(a) / grav->get_D_2LPT(aini) * grav->get_f_2LPT(a) * vnorm,
+            grav->get_D_3LPTa(a) / grav->get_D_3LPTa(aini) * grav->get_f_3LPTa(a) * vnorm,
+            grav->get_D_3LPTb(a) / grav->get_D_3LPTb(aini) * grav->get_f_3LPTb(a) * vnorm};
+}
+
 //========================================================================
 // Add on LPT velocity
 // In the COLA frame the initial velocity is zero, i.e. we have subtracted the
@@ -99,31 +216,11 @@ void cola_add_on_LPT_velocity(FML::PARTICLE::MPIParticles<T> & part,
         std::cout << "Adding on the LPT velocity to particles (COLA)\n";
     }
 
-    auto cosmo = grav->get_cosmo();
-
-    // 1LPT
-    const double D1 = grav->get_D_1LPT(a);
-    const double D1ini = grav->get_D_1LPT(aini);
-    const double f1 = grav->get_f_1LPT(a);
-    const double vfac_1LPT = sign * D1 / D1ini * f1 * a * a * cosmo->HoverH0_of_a(a);
-
-    // 2LPT
-    [[maybe_unused]] const double D2 = grav->get_D_2LPT(a);
-    [[maybe_unused]] const double D2ini = grav->get_D_2LPT(aini);
-    [[maybe_unused]] const double f2 = grav->get_f_2LPT(a);
-    [[maybe_unused]] const double vfac_2LPT = sign * D2 / D2ini * f2 * a * a * cosmo->HoverH0_of_a(a);
-
-    // 3LPTa
-    [[maybe_unused]] const double D3a = grav->get_D_3LPTa(a);
-    [[maybe_unused]] const double D3aini = grav->get_D_3LPTa(aini);
-    [[maybe_unused]] const double f3a = grav->get_f_3LPTa(a);
-    [[maybe_unused]] const double vfac_3LPTa = sign * D3a / D3aini * f3a * a * a * cosmo->HoverH0_of_a(a);
-
-    // 3LPTb
-    [[maybe_unused]] const double D3b = grav->get_D_3LPTb(a);
-    [[maybe_unused]] const double D3bini = grav->get_D_3LPTb(aini);
-    [[maybe_unused]] const double f3b = grav->get_f_3LPTb(a);
-    [[maybe_unused]] const double vfac_3LPTb = sign * D3b / D3bini * f3b * a * a * cosmo->HoverH0_of_a(a);
+    const auto fac_vel = cola_LPT_velocity_factors<NDIM>(grav, aini, a);
+    [[maybe_unused]] const double vfac_1LPT = sign * fac_vel[0];
+    [[maybe_unused]] const double vfac_2LPT = sign * fac_vel[1];
+    [[maybe_unused]] const double vfac_3LPTa = sign * fac_vel[2];
+    [[maybe_unused]] const double vfac_3LPTb = sign * fac_vel[3];
 
 #ifdef USE_OMP
 #pragma omp parallel for
@@ -162,6 +259,56 @@ void cola_add_on_LPT_velocity(FML::PARTICLE::MPIParticles<T> & part,
     }
 }
 
+// The highest LPT order of the displacement fields the particles store
+template <class T>
+constexpr int cola_lpt_order() {
+    return (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() and
+            FML::PARTICLE::has_get_D_3LPTa<T>() and FML::PARTICLE::has_get_D_3LPTb<T>()) ?
+               3 :
+               (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() ?
+                    2 :
+                    (FML::PARTICLE::has_get_D_1LPT<T>() ? 1 : 0));
+}
+
+// The factors in the (scaleindependent) COLA kick and drift. For the displacement fields D1, D2, D3a and D3b
+// stored in the particles the kick-drift is pos += D_n * fac_pos[n] and vel += D_n * fac_vel[n]
+template <int NDIM>
+std::pair<std::array<double, 4>, std::array<double, 4>>
+cola_kick_drift_factors(std::shared_ptr<GravityModel<NDIM>> & grav,
+                        double aini,
+                        double aold,
+                        double a,
+                        double delta_time_kick) {
+    auto cosmo = grav->get_cosmo();
+    const double norm_poisson = 1.5 * cosmo->get_OmegaM() * aold * grav->GeffOverG(aold);
+
+    const double D1 = grav->get_D_1LPT(a);
+    const double D1old = grav->get_D_1LPT(aold);
+    const double D1ini = grav->get_D_1LPT(aini);
+    const double fac1_pos = (D1 - D1old) / D1ini;
+    const double fac1_vel = -norm_poisson * D1old / D1ini * delta_time_kick;
+
+    const double D2 = grav->get_D_2LPT(a);
+    const double D2old = grav->get_D_2LPT(aold);
+    const double D2ini = grav->get_D_2LPT(aini);
+    const double fac2_pos = (D2 - D2old) / D2ini;
+    const double fac2_vel = -norm_poisson * (D2old - D1old * D1old) / D2ini * delta_time_kick;
+
+    const double D3a = grav->get_D_3LPTa(a);
+    const double D3aold = grav->get_D_3LPTa(aold);
+    const double D3aini = grav->get_D_3LPTa(aini);
+    const double fac3a_pos = (D3a - D3aold) / D3aini;
+    const double fac3a_vel = -norm_poisson * (D3aold - 2.0 * D1old * D1old * D1old) / D3aini * delta_time_kick;
+
+    const double D3b = grav->get_D_3LPTb(a);
+    const double D3bold = grav->get_D_3LPTb(aold);
+    const double D3bini = grav->get_D_3LPTb(aini);
+    const double fac3b_pos = (D3b - D3bold) / D3bini;
+    const double fac3b_vel = -norm_poisson * (D3bold + D1old * D1old * D1old - D1old * D2old) / D3bini * delta_time_kick;
+
+    return {{fac1_pos, fac2_pos, fac3a_pos, fac3b_pos}, {fac1_vel, fac2_vel, fac3a_vel, fac3b_vel}};
+}
+
 // This method moves the particles using the COLA forces
 // a is the scale factor for the new position
 // aold is the scale factor for the old position
@@ -175,45 +322,21 @@ void cola_kick_drift(FML::PARTICLE::MPIParticles<T> & part,
                      double delta_time_kick,
                      [[maybe_unused]] double delta_time_drift) {
 
-    constexpr int LPT_order = (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() and
-                               FML::PARTICLE::has_get_D_3LPTa<T>() and FML::PARTICLE::has_get_D_3LPTb<T>()) ?
-                                  3 :
-                                  (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() ?
-                                       2 :
-                                       (FML::PARTICLE::has_get_D_1LPT<T>() ? 1 : 0));
+    constexpr int LPT_order = cola_lpt_order<T>();
 
     if (FML::ThisTask == 0) {
         std::cout << "[Kick] + [Drift] COLA " << LPT_order << "LPT\n";
     }
 
-    auto cosmo = grav->get_cosmo();
-    const double norm_poisson = 1.5 * cosmo->get_OmegaM() * aold * grav->GeffOverG(aold);
-
-    const double D1 = grav->get_D_1LPT(a);
-    const double D1old = grav->get_D_1LPT(aold);
-    const double D1ini = grav->get_D_1LPT(aini);
-    const double fac1_pos = (D1 - D1old) / D1ini;
-    const double fac1_vel = -norm_poisson * D1old / D1ini * delta_time_kick;
-
-    [[maybe_unused]] const double D2 = grav->get_D_2LPT(a);
-    [[maybe_unused]] const double D2old = grav->get_D_2LPT(aold);
-    [[maybe_unused]] const double D2ini = grav->get_D_2LPT(aini);
-    [[maybe_unused]] const double fac2_pos = (D2 - D2old) / D2ini;
-    [[maybe_unused]] const double fac2_vel = -norm_poisson * (D2old - D1old * D1old) / D2ini * delta_time_kick;
-
-    [[maybe_unused]] const double D3a = grav->get_D_3LPTa(a);
-    [[maybe_unused]] const double D3aold = grav->get_D_3LPTa(aold);
-    [[maybe_unused]] const double D3aini = grav->get_D_3LPTa(aini);
-    [[maybe_unused]] const double fac3a_pos = (D3a - D3aold) / D3aini;
-    [[maybe_unused]] const double fac3a_vel =
-        -norm_poisson * (D3aold - 2.0 * D1old * D1old * D1old) / D3aini * delta_time_kick;
-
-    [[maybe_unused]] const double D3b = grav->get_D_3LPTb(a);
-    [[maybe_unused]] const double D3bold = grav->get_D_3LPTb(aold);
-    [[maybe_unused]] const double D3bini = grav->get_D_3LPTb(aini);
-    [[maybe_unused]] const double fac3b_pos = (D3b - D3bold) / D3bini;
-    [[maybe_unused]] const double fac3b_vel =
-        -norm_poisson * (D3bold + D1old * D1old * D1old - D1old * D2old) / D3bini * delta_time_kick;
+    const auto [fac_pos, fac_vel] = cola_kick_drift_factors<NDIM>(grav, aini, aold, a, delta_time_kick);
+    [[maybe_unused]] const double fac1_pos = fac_pos[0];
+    [[maybe_unused]] const double fac1_vel = fac_vel[0];
+    [[maybe_unused]] const double fac2_pos = fac_pos[1];
+    [[maybe_unused]] const double fac2_vel = fac_vel[1];
+    [[maybe_unused]] const double fac3a_pos = fac_pos[2];
+    [[maybe_unused]] const double fac3a_vel = fac_vel[2];
+    [[maybe_unused]] const double fac3b_pos = fac_pos[3];
+    [[maybe_unused]] const double fac3b_vel = fac_vel[3];
 
     // Loop over all active particles
     const size_t np = part.get_npart();
@@ -253,12 +376,8 @@ void cola_kick_drift(FML::PARTICLE::MPIParticles<T> & part,
         }
 
         // Periodic wrap
-        for (int idim = 0; idim < NDIM; idim++) {
-            if (pos[idim] >= 1.0)
-                pos[idim] -= 1.0;
-            if (pos[idim] < 0.0)
-                pos[idim] += 1.0;
-        }
+        for (int idim = 0; idim < NDIM; idim++)
+            FML::PARTICLE::wrap_periodic(pos[idim]);
     }
 }
 
@@ -281,18 +400,15 @@ void cola_kick_drift_scaledependent(FML::PARTICLE::MPIParticles<T> & part,
                                     double aold,
                                     double a,
                                     double delta_time_kick,
-                                    [[maybe_unused]] double delta_time_drift) {
+                                    [[maybe_unused]] double delta_time_drift,
+                                    bool fused_kernel,
+                                    COLAWorkspace<NDIM> * workspace) {
 
     constexpr bool print_timings = false;
     FML::UTILS::Timings timer;
     timer.StartTiming("Scaledependent COLA");
 
-    constexpr int LPT_order = (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() and
-                               FML::PARTICLE::has_get_D_3LPTa<T>() and FML::PARTICLE::has_get_D_3LPTb<T>()) ?
-                                  3 :
-                                  (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() ?
-                                       2 :
-                                       (FML::PARTICLE::has_get_D_1LPT<T>() ? 1 : 0));
+    constexpr int LPT_order = cola_lpt_order<T>();
 
     if (FML::ThisTask == 0) {
         std::cout << "[Kick] + [Drift] Scaledependent COLA " << LPT_order << "LPT\n";
@@ -328,13 +444,17 @@ void cola_kick_drift_scaledependent(FML::PARTICLE::MPIParticles<T> & part,
 
     //======================================================================================
     // Take the grid grid(kvec) and multiply it by func(k). FFT to get grid(x) and interpolate this to particle
-    // positions and returns this vector for all particles
+    // positions and returns this vector for all particles. The particles don't move between the calls so we
+    // compute the interpolation stencils once and reuse them. The grids are taken from the workspace if
+    // we are given one (so they are kept between timesteps) otherwise allocated here
     //======================================================================================
+    FML::INTERPOLATION::ParticleInterpolationStencils<NDIM> stencils;
+    std::array<FML::GRID::FFTWGrid<NDIM>, NDIM> local_grid_vector_real;
+    auto & grid_vector_real = workspace ? (*workspace)[0] : local_grid_vector_real;
     auto generate_displacements = [&](const FML::GRID::FFTWGrid<NDIM> & grid_fourier,
                                       std::array<std::vector<FML::GRID::FloatType>, NDIM> & result,
                                       std::function<double(double)> func) {
         timer.StartTiming("LPT potential -> Psi (FFTs)");
-        std::array<FML::GRID::FFTWGrid<NDIM>, NDIM> grid_vector_real;
         FML::COSMOLOGY::LPT::from_LPT_potential_to_displacement_vector_scaledependent<NDIM>(
             grid_fourier, grid_vector_real, func);
         for (int idim = 0; idim < NDIM; idim++) {
@@ -345,58 +465,82 @@ void cola_kick_drift_scaledependent(FML::PARTICLE::MPIParticles<T> & part,
         // Compute at particle positions (this would be faster if we could do direct assignment
         // which we can by using Lagrangian position (we know how this is generated...))
         timer.StartTiming("Interpolation");
-        FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<NDIM, T>(
-            grid_vector_real, part.get_particles_ptr(), part.get_npart(), result, interpolation_method);
+        if constexpr (FML::PARTICLE::has_lagrangian_position_from_id<T>()) {
+            FML::INTERPOLATION::interpolate_grid_vector_to_lagrangian_positions<NDIM>(grid_vector_real,
+                                                                                     part.get_particles_ptr(),
+                                                                                     part.get_npart(),
+                                                                                     part.get_npart_1D(),
+                                                                                     result,
+                                                                                     interpolation_method);
+        } else {
+            if (not stencils.is_valid_for(grid_vector_real[0], part.get_npart(), interpolation_method))
+                stencils.compute(
+                    grid_vector_real[0], part.get_particles_ptr(), part.get_npart(), interpolation_method);
+            FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<NDIM>(grid_vector_real, stencils, result);
+        }
         timer.EndTiming("Interpolation");
     };
 
+    // The growth factors at the three times we need as 1D functions of k (one lookup per k)
+    const auto D1_a = grav->get_D_1LPT_slice(a);
+    const auto D1_aold = grav->get_D_1LPT_slice(aold);
+    const auto D1_aini = grav->get_D_1LPT_slice(aini);
+    const auto D2_a = grav->get_D_2LPT_slice(a);
+    const auto D2_aold = grav->get_D_2LPT_slice(aold);
+    const auto D2_aini = grav->get_D_2LPT_slice(aini);
+    const auto D3a_a = grav->get_D_3LPTa_slice(a);
+    const auto D3a_aold = grav->get_D_3LPTa_slice(aold);
+    const auto D3a_aini = grav->get_D_3LPTa_slice(aini);
+    const auto D3b_a = grav->get_D_3LPTb_slice(a);
+    const auto D3b_aold = grav->get_D_3LPTb_slice(aold);
+    const auto D3b_aini = grav->get_D_3LPTb_slice(aini);
+
     // For 1LPT kick step: -1.5 * OmegaM * a * GeffG(k,a) * D1 / D1ini
     auto function_vel_1LPT = [&](double kBox) {
         double koverH0 = kBox / H0Box;
         double factor = -1.5 * OmegaM * aold * grav->GeffOverG(aold, koverH0) * delta_time_kick;
-        return factor * grav->source_factor_1LPT(aold, koverH0) * grav->get_D_1LPT(aold, koverH0) /
-               grav->get_D_1LPT(aini, koverH0);
+        return factor * grav->source_factor_1LPT(aold, koverH0) * D1_aold(koverH0) / D1_aini(koverH0);
     };
 
     // For 1LPT drift step: (D1 - D1old) / D1ini
     auto function_pos_1LPT = [&](double kBox) {
         double koverH0 = kBox / H0Box;
-        return (grav->get_D_1LPT(a, koverH0) - grav->get_D_1LPT(aold, koverH0)) / grav->get_D_1LPT(aini, koverH0);
+        return (D1_a(koverH0) - D1_aold(koverH0)) / D1_aini(koverH0);
     };
 
     // For 2LPT kick step: -1.5 * OmegaM * a * GeffG(k,a) * (D2 - D1 * D1) / D2ini * delta_time_kick
     [[maybe_unused]] auto function_vel_2LPT = [&](double kBox) {
         double koverH0 = kBox / H0Box;
         double factor = -1.5 * OmegaM * aold * grav->GeffOverG(aold, koverH0) * delta_time_kick;
-        double D_1LPT = grav->get_D_1LPT(aold, koverH0);
-        double D_2LPT = grav->get_D_2LPT(aold, koverH0);
-        double D_2LPT_ini = grav->get_D_2LPT(aini, koverH0);
+        double D_1LPT = D1_aold(koverH0);
+        double D_2LPT = D2_aold(koverH0);
+        double D_2LPT_ini = D2_aini(koverH0);
         return factor * grav->source_factor_2LPT(aold, koverH0) * (D_2LPT - D_1LPT * D_1LPT) / D_2LPT_ini;
     };
 
     // For 2LPT drift step: (D2 - D2old) / D2ini
     [[maybe_unused]] auto function_pos_2LPT = [&](double kBox) {
         double koverH0 = kBox / H0Box;
-        return (grav->get_D_2LPT(a, koverH0) - grav->get_D_2LPT(aold, koverH0)) / grav->get_D_2LPT(aini, koverH0);
+        return (D2_a(koverH0) - D2_aold(koverH0)) / D2_aini(koverH0);
     };
 
     // For 3LPT kick step
     [[maybe_unused]] auto function_vel_3LPTa = [&](double kBox) {
         double koverH0 = kBox / H0Box;
         double factor = -1.5 * OmegaM * aold * grav->GeffOverG(aold, koverH0) * delta_time_kick;
-        double D_1LPT = grav->get_D_1LPT(aold, koverH0);
-        double D_3LPTa = grav->get_D_3LPTa(aold, koverH0);
-        double D_3LPTa_ini = grav->get_D_3LPTa(aini, koverH0);
+        double D_1LPT = D1_aold(koverH0);
+        double D_3LPTa = D3a_aold(koverH0);
+        double D_3LPTa_ini = D3a_aini(koverH0);
         return factor * grav->source_factor_3LPTa(aold, koverH0) * (D_3LPTa - 2.0 * D_1LPT * D_1LPT * D_1LPT) /
                D_3LPTa_ini;
     };
     [[maybe_unused]] auto function_vel_3LPTb = [&](double kBox) {
         double koverH0 = kBox / H0Box;
         double factor = -1.5 * OmegaM * aold * grav->GeffOverG(aold, koverH0) * delta_time_kick;
-        double D_1LPT = grav->get_D_1LPT(aold, koverH0);
-        double D_2LPT = grav->get_D_2LPT(aold, koverH0);
-        double D_3LPTb = grav->get_D_3LPTb(aold, koverH0);
-        double D_3LPTb_ini = grav->get_D_3LPTb(aini, koverH0);
+        double D_1LPT = D1_aold(koverH0);
+        double D_2LPT = D2_aold(koverH0);
+        double D_3LPTb = D3b_aold(koverH0);
+        double D_3LPTb_ini = D3b_aini(koverH0);
         return factor * grav->source_factor_3LPTb(aold, koverH0) *
                (D_3LPTb + D_1LPT * D_1LPT * D_1LPT - D_1LPT * D_2LPT) / D_3LPTb_ini;
     };
@@ -404,160 +548,206 @@ void cola_kick_drift_scaledependent(FML::PARTICLE::MPIParticles<T> & part,
     // For 3LPT drift step
     [[maybe_unused]] auto function_pos_3LPTa = [&](double kBox) {
         double koverH0 = kBox / H0Box;
-        return (grav->get_D_3LPTa(a, koverH0) - grav->get_D_3LPTa(aold, koverH0)) / grav->get_D_3LPTa(aini, koverH0);
+        return (D3a_a(koverH0) - D3a_aold(koverH0)) / D3a_aini(koverH0);
     };
     [[maybe_unused]] auto function_pos_3LPTb = [&](double kBox) {
         double koverH0 = kBox / H0Box;
-        return (grav->get_D_3LPTb(a, koverH0) - grav->get_D_3LPTb(aold, koverH0)) / grav->get_D_3LPTb(aini, koverH0);
+        return (D3b_a(koverH0) - D3b_aold(koverH0)) / D3b_aini(koverH0);
     };
 
     //======================================================================================
-    // std::function is slow, make splines
+    // Store the drift in D_1LPT and the kick in dDdloga_1LPT (1LPT) or D_2LPT (2LPT and higher)
     //======================================================================================
+    auto store_drift = [&](std::array<std::vector<FML::GRID::FloatType>, NDIM> & displacements) {
+        auto np = part.get_npart();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+        for (size_t ind = 0; ind < np; ind++) {
+            auto * D_pos = FML::PARTICLE::GetD_1LPT(part[ind]);
+            for (int idim = 0; idim < NDIM; idim++)
+                D_pos[idim] = displacements[idim][ind];
+        }
+    };
+    auto store_kick = [&](std::array<std::vector<FML::GRID::FloatType>, NDIM> & displacements) {
+        auto np = part.get_npart();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+        for (size_t ind = 0; ind < np; ind++) {
+            if constexpr (LPT_order == 1) {
+                auto * D_vel = FML::PARTICLE::GetdDdloga_1LPT(part[ind]);
+                for (int idim = 0; idim < NDIM; idim++)
+                    D_vel[idim] = displacements[idim][ind];
+            }
+
+            if constexpr (LPT_order >= 2) {
+                auto * D_vel = FML::PARTICLE::GetD_2LPT(part[ind]);
+                for (int idim = 0; idim < NDIM; idim++)
+                    D_vel[idim] = displacements[idim][ind];
+            }
+        }
+    };
+
     const int Nmesh = phi_1LPT_ini_fourier.get_nmesh();
-    const int npts = 4 * Nmesh;
     const double kmin = M_PI;
     const double kmax = 2.0 * M_PI * Nmesh / 2.0 * std::sqrt(double(NDIM));
-    std::vector<double> k_vec(npts);
-    std::vector<double> vel1(npts), pos1(npts);
-    std::vector<double> vel2(npts), pos2(npts);
-    std::vector<double> vel3a(npts), pos3a(npts);
-    std::vector<double> vel3b(npts), pos3b(npts);
-
-    for (int i = 0; i < npts; i++) {
-        k_vec[i] = kmin + (kmax - kmin) * i / double(npts - 1);
+
+    if (fused_kernel) {
+        //======================================================================================
+        // Tabulate the drift and kick factors for all orders on one k-grid and get both
+        // displacement fields with a single k-space pass and one batched FFT
+        //======================================================================================
+        timer.StartTiming("LPT potential -> Psi (fused)");
+        constexpr size_t NPHI = LPT_order >= 3 ? 4 : std::max(LPT_order, 1);
+        std::array<const FML::GRID::FFTWGrid<NDIM> *, 4> phis{
+            &phi_1LPT_ini_fourier, &phi_2LPT_ini_fourier, &phi_3LPTa_ini_fourier, &phi_3LPTb_ini_fourier};
+        std::array<const FML::GRID::FFTWGrid<NDIM> *, NPHI> phi_fourier;
+        std::copy(phis.begin(), phis.begin() + NPHI, phi_fourier.begin());
+
+        const std::array<std::function<double(double)>, 4> pos{
+            function_pos_1LPT, function_pos_2LPT, function_pos_3LPTa, function_pos_3LPTb};
+        const std::array<std::function<double(double)>, 4> vel{
+            function_vel_1LPT, function_vel_2LPT, function_vel_3LPTa, function_vel_3LPTb};
+        auto growth_factors = [&](double kBox) {
+            std::array<double, 2 * NPHI> res;
+            for (size_t p = 0; p < NPHI; p++) {
+                res[p] = pos[p](kBox);
+                res[NPHI + p] = vel[p](kBox);
+            }
+            return res;
+        };
+        const UniformKTable<2 * NPHI> growth_table(kmin, kmax, 16 * Nmesh, growth_factors);
+
+        COLAWorkspace<NDIM> local_grids;
+        auto & grids = workspace ? *workspace : local_grids;
+        std::array<std::array<std::vector<FML::GRID::FloatType>, NDIM>, 2> result;
+        cola_scaledependent_displacements_fused<NDIM, T, 2, NPHI>(
+            part, phi_fourier, growth_table, {&grids[0], &grids[1]}, result, interpolation_method);
+        timer.EndTiming("LPT potential -> Psi (fused)");
+
+        store_drift(result[0]);
+        store_kick(result[1]);
+    } else {
+        //======================================================================================
+        // std::function is slow, make splines
+        //======================================================================================
+        const int npts = 4 * Nmesh;
+        std::vector<double> k_vec(npts);
+        std::vector<double> vel1(npts), pos1(npts);
+        std::vector<double> vel2(npts), pos2(npts);
+        std::vector<double> vel3a(npts), pos3a(npts);
+        std::vector<double> vel3b(npts), pos3b(npts);
+
+        for (int i = 0; i < npts; i++) {
+            k_vec[i] = kmin + (kmax - kmin) * i / double(npts - 1);
+            if constexpr (LPT_order >= 1) {
+                pos1[i] = function_pos_1LPT(k_vec[i]);
+                vel1[i] = function_vel_1LPT(k_vec[i]);
+            }
+            if constexpr (LPT_order >= 2) {
+                pos2[i] = function_pos_2LPT(k_vec[i]);
+                vel2[i] = function_vel_2LPT(k_vec[i]);
+            }
+            if constexpr (LPT_order >= 3) {
+                pos3a[i] = function_pos_3LPTa(k_vec[i]);
+                vel3a[i] = function_vel_3LPTa(k_vec[i]);
+                pos3b[i] = function_pos_3LPTb(k_vec[i]);
+                vel3b[i] = function_vel_3LPTb(k_vec[i]);
+            }
+        }
+
+        Spline function_pos_1LPT_spline;
+        Spline function_vel_1LPT_spline;
         if constexpr (LPT_order >= 1) {
-            pos1[i] = function_pos_1LPT(k_vec[i]);
-            vel1[i] = function_vel_1LPT(k_vec[i]);
+            function_pos_1LPT_spline.create(k_vec, pos1);
+            function_vel_1LPT_spline.create(k_vec, vel1);
         }
+
+        Spline function_pos_2LPT_spline;
+        Spline function_vel_2LPT_spline;
         if constexpr (LPT_order >= 2) {
-            pos2[i] = function_pos_2LPT(k_vec[i]);
-            vel2[i] = function_vel_2LPT(k_vec[i]);
+            function_pos_2LPT_spline.create(k_vec, pos2);
+            function_vel_2LPT_spline.create(k_vec, vel2);
         }
+
+        Spline function_pos_3LPTa_spline;
+        Spline function_pos_3LPTb_spline;
+        Spline function_vel_3LPTa_spline;
+        Spline function_vel_3LPTb_spline;
         if constexpr (LPT_order >= 3) {
-            pos3a[i] = function_pos_3LPTa(k_vec[i]);
-            vel3a[i] = function_vel_3LPTa(k_vec[i]);
-            pos3b[i] = function_pos_3LPTb(k_vec[i]);
-            vel3b[i] = function_vel_3LPTb(k_vec[i]);
+            function_pos_3LPTa_spline.create(k_vec, pos3a);
+            function_vel_3LPTa_spline.create(k_vec, vel3a);
+            function_pos_3LPTb_spline.create(k_vec, pos3b);
+            function_vel_3LPTb_spline.create(k_vec, vel3b);
         }
-    }
-
-    Spline function_pos_1LPT_spline;
-    Spline function_vel_1LPT_spline;
-    if constexpr (LPT_order >= 1) {
-        function_pos_1LPT_spline.create(k_vec, pos1);
-        function_vel_1LPT_spline.create(k_vec, vel1);
-    }
 
-    Spline function_pos_2LPT_spline;
-    Spline function_vel_2LPT_spline;
-    if constexpr (LPT_order >= 2) {
-        function_pos_2LPT_spline.create(k_vec, pos2);
-        function_vel_2LPT_spline.create(k_vec, vel2);
-    }
-
-    Spline function_pos_3LPTa_spline;
-    Spline function_pos_3LPTb_spline;
-    Spline function_vel_3LPTa_spline;
-    Spline function_vel_3LPTb_spline;
-    if constexpr (LPT_order >= 3) {
-        function_pos_3LPTa_spline.create(k_vec, pos3a);
-        function_vel_3LPTa_spline.create(k_vec, vel3a);
-        function_pos_3LPTb_spline.create(k_vec, pos3b);
-        function_vel_3LPTb_spline.create(k_vec, vel3b);
-    }
-
-    //======================================================================================
-    // Compute the full LPT force kick and velocity drift
-    // We use D_1LPT and dD_1LPT_dloga as temporary storage for the kicks in 1LPT
-    // We use D_1LPT and D_2LPT as temporary storage otherwise
-    //======================================================================================
+        //======================================================================================
+        // Compute the full LPT force kick and velocity drift
+        // We use D_1LPT and dD_1LPT_dloga as temporary storage for the kicks in 1LPT
+        // We use D_1LPT and D_2LPT as temporary storage otherwise
+        //======================================================================================
 
-    auto temp_grid = phi_1LPT_ini_fourier;
-    auto Local_nx = temp_grid.get_local_nx();
+        auto temp_grid = phi_1LPT_ini_fourier;
+        auto Local_nx = temp_grid.get_local_nx();
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-    for (int islice = 0; islice < Local_nx; islice++) {
-        double kmag;
-        std::array<double, NDIM> kvec;
-        for (auto && fourier_index : temp_grid.get_fourier_range(islice, islice + 1)) {
-            temp_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-            auto delta_ini = phi_1LPT_ini_fourier.get_fourier_from_index(fourier_index);
-            auto value = delta_ini * FML::GRID::FloatType(function_pos_1LPT_spline(kmag));
-            if constexpr (LPT_order >= 2) {
-                auto phi_2LPT = phi_2LPT_ini_fourier.get_fourier_from_index(fourier_index);
-                value += phi_2LPT * FML::GRID::FloatType(function_pos_2LPT_spline(kmag));
+        for (int islice = 0; islice < Local_nx; islice++) {
+            double kmag;
+            std::array<double, NDIM> kvec;
+            for (auto && fourier_index : temp_grid.get_fourier_range(islice, islice + 1)) {
+                temp_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+                auto delta_ini = phi_1LPT_ini_fourier.get_fourier_from_index(fourier_index);
+                auto value = delta_ini * FML::GRID::FloatType(function_pos_1LPT_spline(kmag));
+                if constexpr (LPT_order >= 2) {
+                    auto phi_2LPT = phi_2LPT_ini_fourier.get_fourier_from_index(fourier_index);
+                    value += phi_2LPT * FML::GRID::FloatType(function_pos_2LPT_spline(kmag));
+                }
+                if constexpr (LPT_order >= 3) {
+                    auto phi_3LPTa = phi_3LPTa_ini_fourier.get_fourier_from_index(fourier_index);
+                    auto phi_3LPTb = phi_3LPTb_ini_fourier.get_fourier_from_index(fourier_index);
+                    value += phi_3LPTa * FML::GRID::FloatType(function_pos_3LPTa_spline(kmag));
+                    value += phi_3LPTb * FML::GRID::FloatType(function_pos_3LPTb_spline(kmag));
+                }
+                temp_grid.set_fourier_from_index(fourier_index, value);
             }
-            if constexpr (LPT_order >= 3) {
-                auto phi_3LPTa = phi_3LPTa_ini_fourier.get_fourier_from_index(fourier_index);
-                auto phi_3LPTb = phi_3LPTb_ini_fourier.get_fourier_from_index(fourier_index);
-                value += phi_3LPTa * FML::GRID::FloatType(function_pos_3LPTa_spline(kmag));
-                value += phi_3LPTb * FML::GRID::FloatType(function_pos_3LPTb_spline(kmag));
-            }
-            temp_grid.set_fourier_from_index(fourier_index, value);
         }
-    }
 
-    std::array<std::vector<FML::GRID::FloatType>, NDIM> displacements;
-    auto multiply_by_one = []([[maybe_unused]] double kBox) { return 1.0; };
-    generate_displacements(temp_grid, displacements, multiply_by_one);
+        std::array<std::vector<FML::GRID::FloatType>, NDIM> displacements;
+        auto multiply_by_one = []([[maybe_unused]] double kBox) { return 1.0; };
+        generate_displacements(temp_grid, displacements, multiply_by_one);
 
-    // We store this in D_1LPT
-    auto np = part.get_npart();
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-    for (size_t ind = 0; ind < np; ind++) {
-        auto * D_pos = FML::PARTICLE::GetD_1LPT(part[ind]);
-        for (int idim = 0; idim < NDIM; idim++)
-            D_pos[idim] = displacements[idim][ind];
-    }
+        store_drift(displacements);
 
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-    for (int islice = 0; islice < Local_nx; islice++) {
-        double kmag;
-        std::array<double, NDIM> kvec;
-        for (auto && fourier_index : temp_grid.get_fourier_range(islice, islice + 1)) {
-            temp_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-            auto delta_ini = phi_1LPT_ini_fourier.get_fourier_from_index(fourier_index);
-            auto value = delta_ini * FML::GRID::FloatType(function_vel_1LPT_spline(kmag));
-            if constexpr (LPT_order >= 2) {
-                auto phi_2LPT = phi_2LPT_ini_fourier.get_fourier_from_index(fourier_index);
-                value += phi_2LPT * FML::GRID::FloatType(function_vel_2LPT_spline(kmag));
+        for (int islice = 0; islice < Local_nx; islice++) {
+            double kmag;
+            std::array<double, NDIM> kvec;
+            for (auto && fourier_index : temp_grid.get_fourier_range(islice, islice + 1)) {
+                temp_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+                auto delta_ini = phi_1LPT_ini_fourier.get_fourier_from_index(fourier_index);
+                auto value = delta_ini * FML::GRID::FloatType(function_vel_1LPT_spline(kmag));
+                if constexpr (LPT_order >= 2) {
+                    auto phi_2LPT = phi_2LPT_ini_fourier.get_fourier_from_index(fourier_index);
+                    value += phi_2LPT * FML::GRID::FloatType(function_vel_2LPT_spline(kmag));
+                }
+                if constexpr (LPT_order >= 3) {
+                    auto phi_3LPTa = phi_3LPTa_ini_fourier.get_fourier_from_index(fourier_index);
+                    auto phi_3LPTb = phi_3LPTb_ini_fourier.get_fourier_from_index(fourier_index);
+                    value += phi_3LPTa * FML::GRID::FloatType(function_vel_3LPTa_spline(kmag));
+                    value += phi_3LPTb * FML::GRID::FloatType(function_vel_3LPTb_spline(kmag));
+                }
+                temp_grid.set_fourier_from_index(fourier_index, value);
             }
-            if constexpr (LPT_order >= 3) {
-                auto phi_3LPTa = phi_3LPTa_ini_fourier.get_fourier_from_index(fourier_index);
-                auto phi_3LPTb = phi_3LPTb_ini_fourier.get_fourier_from_index(fourier_index);
-                value += phi_3LPTa * FML::GRID::FloatType(function_vel_3LPTa_spline(kmag));
-                value += phi_3LPTb * FML::GRID::FloatType(function_vel_3LPTb_spline(kmag));
-            }
-            temp_grid.set_fourier_from_index(fourier_index, value);
         }
-    }
-    generate_displacements(temp_grid, displacements, multiply_by_one);
-    temp_grid.free();
+        generate_displacements(temp_grid, displacements, multiply_by_one);
+        temp_grid.free();
+        stencils.clear();
 
-    // If we have only 1LPT then we need dD_1LPT_dloga as temp storage
-    // If we have 2LPT then we use D_2LPT as temp storage
-    np = part.get_npart();
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-    for (size_t ind = 0; ind < np; ind++) {
-        if constexpr (LPT_order == 1) {
-            auto * D_vel = FML::PARTICLE::GetdDdloga_1LPT(part[ind]);
-            for (int idim = 0; idim < NDIM; idim++)
-                D_vel[idim] = displacements[idim][ind];
-        }
-
-        if constexpr (LPT_order >= 2) {
-            auto * D_vel = FML::PARTICLE::GetD_2LPT(part[ind]);
-            for (int idim = 0; idim < NDIM; idim++)
-                D_vel[idim] = displacements[idim][ind];
-        }
+        store_kick(displacements);
     }
 
     // Swap positions back
@@ -569,7 +759,7 @@ void cola_kick_drift_scaledependent(FML::PARTICLE::MPIParticles<T> & part,
     //================================================================
     // Do the cola_kick_drift step
     //================================================================
-    np = part.get_npart();
+    auto np = part.get_npart();
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
@@ -599,12 +789,8 @@ void cola_kick_drift_scaledependent(FML::PARTICLE::MPIParticles<T> & part,
         }
 
         // Periodic wrap
-        for (int idim = 0; idim < NDIM; idim++) {
-            if (pos[idim] >= 1.0)
-                pos[idim] -= 1.0;
-            if (pos[idim] < 0.0)
-                pos[idim] += 1.0;
-        }
+        for (int idim = 0; idim < NDIM; idim++)
+            FML::PARTICLE::wrap_periodic(pos[idim]);
     }
 
     timer.EndTiming("Scaledependent COLA");
@@ -622,14 +808,11 @@ void cola_add_on_LPT_velocity_scaledependent(FML::PARTICLE::MPIParticles<T> & pa
                                              double H0Box,
                                              double aini,
                                              double a,
-                                             double sign) {
+                                             double sign,
+                                             bool fused_kernel,
+                                             COLAWorkspace<NDIM> * workspace) {
 
-    constexpr int LPT_order = (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() and
-                               FML::PARTICLE::has_get_D_3LPTa<T>() and FML::PARTICLE::has_get_D_3LPTb<T>()) ?
-                                  3 :
-                                  (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() ?
-                                       2 :
-                                       (FML::PARTICLE::has_get_D_1LPT<T>() ? 1 : 0));
+    constexpr int LPT_order = cola_lpt_order<T>();
 
     if (FML::ThisTask == 0) {
         std::cout << "Adding on the LPT velocity to particles (COLA " << LPT_order << "LPT scaledependent)\n";
@@ -662,112 +845,157 @@ void cola_add_on_LPT_velocity_scaledependent(FML::PARTICLE::MPIParticles<T> & pa
 
     //======================================================================================
     // Take the grid grid(kvec) and multiply it by func(k). FFT to get D grid(x) and interpolate this to
-    // particle positions and returns this vector for all particles
+    // particle positions and returns this vector for all particles (using the workspace grids if given)
     //======================================================================================
+    std::array<FML::GRID::FFTWGrid<NDIM>, NDIM> local_grid_vector_real;
+    auto & grid_vector_real = workspace ? (*workspace)[0] : local_grid_vector_real;
     auto generate_displacements = [&](const FML::GRID::FFTWGrid<NDIM> & grid_fourier,
                                       std::array<std::vector<FML::GRID::FloatType>, NDIM> & result,
                                       std::function<double(double)> func) {
-        std::array<FML::GRID::FFTWGrid<NDIM>, NDIM> grid_vector_real;
         FML::COSMOLOGY::LPT::from_LPT_potential_to_displacement_vector_scaledependent<NDIM>(
             grid_fourier, grid_vector_real, func);
         for (int idim = 0; idim < NDIM; idim++) {
             grid_vector_real[idim].communicate_boundaries();
         }
-        FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<NDIM, T>(
-            grid_vector_real, part.get_particles_ptr(), part.get_npart(), result, interpolation_method);
+        if constexpr (FML::PARTICLE::has_lagrangian_position_from_id<T>()) {
+            FML::INTERPOLATION::interpolate_grid_vector_to_lagrangian_positions<NDIM>(grid_vector_real,
+                                                                                     part.get_particles_ptr(),
+                                                                                     part.get_npart(),
+                                                                                     part.get_npart_1D(),
+                                                                                     result,
+                                                                                     interpolation_method);
+        } else {
+            FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<NDIM, T>(
+                grid_vector_real, part.get_particles_ptr(), part.get_npart(), result, interpolation_method);
+        }
     };
 
+    // f * D = dD/dlog(a) at a and D at aini as 1D functions of k (one lookup per k)
+    const auto dD1dloga_a = grav->get_D_1LPT_slice(a, 1);
+    const auto D1_aini = grav->get_D_1LPT_slice(aini);
+    const auto dD2dloga_a = grav->get_D_2LPT_slice(a, 1);
+    const auto D2_aini = grav->get_D_2LPT_slice(aini);
+    const auto dD3adloga_a = grav->get_D_3LPTa_slice(a, 1);
+    const auto D3a_aini = grav->get_D_3LPTa_slice(aini);
+    const auto dD3bdloga_a = grav->get_D_3LPTb_slice(a, 1);
+    const auto D3b_aini = grav->get_D_3LPTb_slice(aini);
+
     auto function_vel_1LPT = [&](double kBox) {
         const double koverH0 = kBox / H0Box;
-        return vfactor * grav->get_f_1LPT(a, koverH0) * grav->get_D_1LPT(a, koverH0) / grav->get_D_1LPT(aini, koverH0);
+        return vfactor * dD1dloga_a(koverH0) / D1_aini(koverH0);
     };
 
     [[maybe_unused]] auto function_vel_2LPT = [&](double kBox) {
         const double koverH0 = kBox / H0Box;
-        return vfactor * grav->get_f_2LPT(a, koverH0) * grav->get_D_2LPT(a, koverH0) / grav->get_D_2LPT(aini, koverH0);
+        return vfactor * dD2dloga_a(koverH0) / D2_aini(koverH0);
     };
 
     [[maybe_unused]] auto function_vel_3LPTa = [&](double kBox) {
         const double koverH0 = kBox / H0Box;
-        return vfactor * grav->get_f_3LPTa(a, koverH0) * grav->get_D_3LPTa(a, koverH0) /
-               grav->get_D_3LPTa(aini, koverH0);
+        return vfactor * dD3adloga_a(koverH0) / D3a_aini(koverH0);
     };
 
     [[maybe_unused]] auto function_vel_3LPTb = [&](double kBox) {
         const double koverH0 = kBox / H0Box;
-        return vfactor * grav->get_f_3LPTb(a, koverH0) * grav->get_D_3LPTb(a, koverH0) /
-               grav->get_D_3LPTb(aini, koverH0);
+        return vfactor * dD3bdloga_a(koverH0) / D3b_aini(koverH0);
     };
 
-    //======================================================================================
-    // std::function is slow, make splines
-    //======================================================================================
-
     const int Nmesh = phi_1LPT_ini_fourier.get_nmesh();
-    const int npts = 4 * Nmesh;
     const double kmin = M_PI;
     const double kmax = 2.0 * M_PI * Nmesh / 2.0 * std::sqrt(double(NDIM));
-    std::vector<double> k_vec(npts);
-    std::vector<double> vel1(npts), vel2(npts), vel3a(npts), vel3b(npts);
 
-    for (int i = 0; i < npts; i++) {
-        k_vec[i] = kmin + (kmax - kmin) * i / double(npts - 1);
-        vel1[i] = function_vel_1LPT(k_vec[i]);
+    std::array<std::vector<FML::GRID::FloatType>, NDIM> displacements;
+    if (fused_kernel) {
+        //======================================================================================
+        // Tabulate the velocity factors for all orders on one k-grid and get the velocity
+        // with a single k-space pass and one batched FFT
+        //======================================================================================
+        constexpr size_t NPHI = LPT_order >= 3 ? 4 : std::max(LPT_order, 1);
+        std::array<const FML::GRID::FFTWGrid<NDIM> *, 4> phis{
+            &phi_1LPT_ini_fourier, &phi_2LPT_ini_fourier, &phi_3LPTa_ini_fourier, &phi_3LPTb_ini_fourier};
+        std::array<const FML::GRID::FFTWGrid<NDIM> *, NPHI> phi_fourier;
+        std::copy(phis.begin(), phis.begin() + NPHI, phi_fourier.begin());
+
+        const std::array<std::function<double(double)>, 4> vel{
+            function_vel_1LPT, function_vel_2LPT, function_vel_3LPTa, function_vel_3LPTb};
+        auto growth_factors = [&](double kBox) {
+            std::array<double, NPHI> res;
+            for (size_t p = 0; p < NPHI; p++)
+                res[p] = vel[p](kBox);
+            return res;
+        };
+        const UniformKTable<NPHI> growth_table(kmin, kmax, 16 * Nmesh, growth_factors);
+
+        std::array<std::array<std::vector<FML::GRID::FloatType>, NDIM>, 1> result;
+        cola_scaledependent_displacements_fused<NDIM, T, 1, NPHI>(
+            part, phi_fourier, growth_table, {&grid_vector_real}, result, interpolation_method);
+        displacements = std::move(result[0]);
+    } else {
+        //======================================================================================
+        // std::function is slow, make splines
+        //======================================================================================
+        const int npts = 4 * Nmesh;
+        std::vector<double> k_vec(npts);
+        std::vector<double> vel1(npts), vel2(npts), vel3a(npts), vel3b(npts);
+
+        for (int i = 0; i < npts; i++) {
+            k_vec[i] = kmin + (kmax - kmin) * i / double(npts - 1);
+            vel1[i] = function_vel_1LPT(k_vec[i]);
+            if constexpr (LPT_order >= 2) {
+                vel2[i] = function_vel_2LPT(k_vec[i]);
+            }
+            if constexpr (LPT_order >= 3) {
+                vel3a[i] = function_vel_3LPTa(k_vec[i]);
+                vel3b[i] = function_vel_3LPTb(k_vec[i]);
+            }
+        }
+
+        Spline function_vel_1LPT_spline;
+        function_vel_1LPT_spline.create(k_vec, vel1);
+
+        Spline function_vel_2LPT_spline;
         if constexpr (LPT_order >= 2) {
-            vel2[i] = function_vel_2LPT(k_vec[i]);
+            function_vel_2LPT_spline.create(k_vec, vel2);
         }
+        Spline function_vel_3LPTa_spline;
+        Spline function_vel_3LPTb_spline;
         if constexpr (LPT_order >= 3) {
-            vel3a[i] = function_vel_3LPTa(k_vec[i]);
-            vel3b[i] = function_vel_3LPTb(k_vec[i]);
+            function_vel_3LPTa_spline.create(k_vec, vel3a);
+            function_vel_3LPTb_spline.create(k_vec, vel3b);
         }
-    }
-
-    Spline function_vel_1LPT_spline;
-    function_vel_1LPT_spline.create(k_vec, vel1);
 
-    Spline function_vel_2LPT_spline;
-    if constexpr (LPT_order >= 2) {
-        function_vel_2LPT_spline.create(k_vec, vel2);
-    }
-    Spline function_vel_3LPTa_spline;
-    Spline function_vel_3LPTb_spline;
-    if constexpr (LPT_order >= 3) {
-        function_vel_3LPTa_spline.create(k_vec, vel3a);
-        function_vel_3LPTb_spline.create(k_vec, vel3b);
-    }
-
-    //======================================================================================
-    // Compute the total LPT potential
-    //======================================================================================
-    auto temp_grid = phi_1LPT_ini_fourier;
-    auto Local_nx = temp_grid.get_local_nx();
+        //======================================================================================
+        // Compute the total LPT potential
+        //======================================================================================
+        auto temp_grid = phi_1LPT_ini_fourier;
+        auto Local_nx = temp_grid.get_local_nx();
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-    for (int islice = 0; islice < Local_nx; islice++) {
-        double kmag;
-        std::array<double, NDIM> kvec;
-        for (auto && fourier_index : temp_grid.get_fourier_range(islice, islice + 1)) {
-            temp_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-            auto phi_1LPT = phi_1LPT_ini_fourier.get_fourier_from_index(fourier_index);
-            auto value = phi_1LPT * FML::GRID::FloatType(function_vel_1LPT_spline(kmag));
-            if constexpr (LPT_order >= 2) {
-                auto phi_2LPT = phi_2LPT_ini_fourier.get_fourier_from_index(fourier_index);
-                value += phi_2LPT * FML::GRID::FloatType(function_vel_2LPT_spline(kmag));
+        for (int islice = 0; islice < Local_nx; islice++) {
+            double kmag;
+            std::array<double, NDIM> kvec;
+            for (auto && fourier_index : temp_grid.get_fourier_range(islice, islice + 1)) {
+                temp_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+                auto phi_1LPT = phi_1LPT_ini_fourier.get_fourier_from_index(fourier_index);
+                auto value = phi_1LPT * FML::GRID::FloatType(function_vel_1LPT_spline(kmag));
+                if constexpr (LPT_order >= 2) {
+                    auto phi_2LPT = phi_2LPT_ini_fourier.get_fourier_from_index(fourier_index);
+                    value += phi_2LPT * FML::GRID::FloatType(function_vel_2LPT_spline(kmag));
+                }
+                if constexpr (LPT_order >= 3) {
+                    auto phi_3LPTa = phi_3LPTa_ini_fourier.get_fourier_from_index(fourier_index);
+                    auto phi_3LPTb = phi_3LPTb_ini_fourier.get_fourier_from_index(fourier_index);
+                    value += phi_3LPTa * FML::GRID::FloatType(function_vel_3LPTa_spline(kmag));
+                    value += phi_3LPTb * FML::GRID::FloatType(function_vel_3LPTb_spline(kmag));
+                }
+                temp_grid.set_fourier_from_index(fourier_index, value);
             }
-            if constexpr (LPT_order >= 3) {
-                auto phi_3LPTa = phi_3LPTa_ini_fourier.get_fourier_from_index(fourier_index);
-                auto phi_3LPTb = phi_3LPTb_ini_fourier.get_fourier_from_index(fourier_index);
-                value += phi_3LPTa * FML::GRID::FloatType(function_vel_3LPTa_spline(kmag));
-                value += phi_3LPTb * FML::GRID::FloatType(function_vel_3LPTb_spline(kmag));
-            }
-            temp_grid.set_fourier_from_index(fourier_index, value);
         }
-    }
 
-    std::array<std::vector<FML::GRID::FloatType>, NDIM> displacements;
-    auto multiply_by_one = []([[maybe_unused]] double kBox) { return 1.0; };
-    generate_displacements(temp_grid, displacements, multiply_by_one);
+        auto multiply_by_one = []([[maybe_unused]] double kBox) { return 1.0; };
+        generate_displacements(temp_grid, displacements, multiply_by_one);
+    }
 
     // We store this in D_1LPT
     auto np = part.get_npart();
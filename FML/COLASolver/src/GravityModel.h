@@ -12,13 +12,310 @@
 #include <FML/Spline/Spline.h>
 #include <FML/Timing/Timings.h>
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <sstream>
+#include <tuple>
 #include <vector>
 
+//========================================================================
+/// NFUNC functions of k tabulated on the same uniform grid in k. A k-space kernel gets all of them
+/// with one linear lookup per mode instead of evaluating a spline (or a virtual method) for each of
+/// them (e.g. the growth-factor ratios for all the LPT orders in scaledependent COLA or GeffOverG).
+/// Tabulate it once per step.
+//========================================================================
+template <int NFUNC>
+class UniformKTable {
+  public:
+    UniformKTable() = default;
+    UniformKTable(double kmin, double kmax, int npts, std::function<std::array<double, NFUNC>(double)> func)
+        : kmin(kmin), dk((kmax - kmin) / double(npts - 1)), table(npts) {
+        for (int i = 0; i < npts; i++)
+            table[i] = func(kmin + dk * i);
+    }
+    /// From the values at k = kmin + (kmax - kmin) * i / (npts - 1) with npts = values.size()
+    UniformKTable(double kmin, double kmax, std::vector<std::array<double, NFUNC>> values)
+        : kmin(kmin), dk((kmax - kmin) / double(values.size() - 1)), table(std::move(values)) {}
+
+    /// All the functions at k (linear interpolation, constant outside the range)
+    std::array<double, NFUNC> operator()(double k) const {
+        const double x = std::max((k - kmin) / dk, 0.0);
+        const int i = std::min(int(x), int(table.size()) - 2);
+        const double w = std::min(x - i, 1.0);
+        std::array<double, NFUNC> res;
+        for (int j = 0; j < NFUNC; j++)
+            res[j] = table[i][j] + (table[i + 1][j] - table[i][j]) * w;
+        return res;
+    }
+
+  private:
+    double kmin{0.0};
+    double dk{1.0};
+    std::vector<std::array<double, NFUNC>> table;
+};
+
+//========================================================================
+/// A growth factor D(a,k) at a fixed a as a function of k/H0. For scaledependent growth this is a 1D slice of
+/// the (log(k/H0), log(a)) spline so each k is a 1D lookup instead of a 2D one. Make it once per step and use
+/// it in the k-space loops.
+//========================================================================
+class GrowthFactorSlice {
+  public:
+    using Spline2D = FML::INTERPOLATION::SPLINE::Spline2D;
+    using UniformGridSpline = FML::INTERPOLATION::SPLINE::UniformGridSpline;
+
+    /// Scaleindependent growth
+    GrowthFactorSlice(double value) : value(value) {}
+    /// Slice of D(log(k/H0), log(a)) (or dD/dlog(a) if nderiv_loga = 1) at fixed a. Uses the 2D spline if we
+    /// cannot make a slice of it
+    GrowthFactorSlice(const Spline2D & D_of_logkoverH0_loga, double a, double koverH0low, int nderiv_loga = 0)
+        : slice(D_of_logkoverH0_loga.get_x_slice(std::log(a), nderiv_loga)), spline2D(&D_of_logkoverH0_loga),
+          loga(std::log(a)), koverH0low(koverH0low), nderiv_loga(nderiv_loga) {
+        std::tie(logkmin, logkmax) = D_of_logkoverH0_loga.get_xrange();
+    }
+    /// A slice we already have as a function of log(k/H0) on [logkrange.first, logkrange.second]
+    GrowthFactorSlice(UniformGridSpline slice, std::pair<double, double> logkrange, double koverH0low)
+        : slice(std::move(slice)), koverH0low(koverH0low), logkmin(logkrange.first), logkmax(logkrange.second) {}
+
+    double operator()(double koverH0) const {
+        if (not spline2D and not slice)
+            return value;
+        const double logk = std::log(std::max(koverH0, koverH0low));
+        if (not slice)
+            return spline2D->eval_deriv(logk, loga, 0, nderiv_loga);
+        return slice.eval(std::min(std::max(logk, logkmin), logkmax));
+    }
+
+  private:
+    double value{};
+    UniformGridSpline slice{};
+    const Spline2D * spline2D{nullptr};
+    double loga{};
+    double koverH0low{};
+    int nderiv_loga{0};
+    double logkmin{};
+    double logkmax{};
+};
+
+//========================================================================
+/// A scaledependent growth factor D(log(k/H0), log(a)) as the separable sum
+/// D = sum_r U_r(log(k/H0)) W_r(log(a)) with W_r = D0 V_r where D0 is the k = 0 growth factor. U_r and V_r are
+/// the singular vectors of the table of D/D0 and we keep the terms we need to have |D/D0 - fit| < tolerance.
+/// This is rank * (nk + na) numbers instead of the 4 * nk * na of a Spline2D, a value is 2 * rank 1D lookups and
+/// a slice at fixed a is rank * nk FMAs.
+//========================================================================
+class GrowthFactorLowRank {
+  public:
+    using DVector = FML::INTERPOLATION::SPLINE::DVector;
+    using DVector2D = FML::INTERPOLATION::SPLINE::DVector2D;
+    using UniformGridSpline = FML::INTERPOLATION::SPLINE::UniformGridSpline;
+
+    GrowthFactorLowRank() = default;
+
+    /// D[i][j] is the growth factor at (logk[i], loga[j]) and D0[j] the one at k = 0 (both grids uniform).
+    /// Returns false (and is not created) if rank_max terms is not enough to get the tolerance
+    bool create(const DVector & logk,
+                const DVector & loga,
+                const DVector2D & D,
+                const DVector & D0,
+                double tolerance,
+                int rank_max) {
+        free();
+        const int nk = int(logk.size());
+        const int na = int(loga.size());
+        for (auto & d0 : D0)
+            if (d0 == 0.0)
+                return false;
+
+        // The residual E = D/D0 - fit (starts as D/D0) and its Gram matrix E E^T
+        std::vector<double> E(size_t(nk) * na);
+        for (int i = 0; i < nk; i++)
+            for (int j = 0; j < na; j++)
+                E[size_t(i) * na + j] = D[i][j] / D0[j];
+        std::vector<double> G(size_t(nk) * nk);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+        for (int i = 0; i < nk; i++) {
+            for (int k = 0; k <= i; k++) {
+                double sum = 0.0;
+                for (int j = 0; j < na; j++)
+                    sum += E[size_t(i) * na + j] * E[size_t(k) * na + j];
+                G[size_t(i) * nk + k] = G[size_t(k) * nk + i] = sum;
+            }
+        }
+
+        auto max_residual = [&]() {
+            double res = 0.0;
+            for (auto & e : E)
+                res = std::max(res, std::fabs(e));
+            return res;
+        };
+        // Remove the components along the singular vectors we have
+        std::vector<DVector> Us;
+        auto project_out = [&](DVector & u) {
+            for (auto & us : Us) {
+                double dot = 0.0;
+                for (int i = 0; i < nk; i++)
+                    dot += us[i] * u[i];
+                for (int i = 0; i < nk; i++)
+                    u[i] -= dot * us[i];
+            }
+        };
+        auto normalize = [&](DVector & u) {
+            double norm = 0.0;
+            for (auto & x : u)
+                norm += x * x;
+            norm = std::sqrt(norm);
+            if (norm > 0.0)
+                for (auto & x : u)
+                    x /= norm;
+            return norm;
+        };
+
+        // Add the leading left singular vector of the residual (power iteration on the deflated Gram matrix)
+        // until we have the tolerance
+        std::vector<DVector> Ws;
+        max_error = max_residual();
+        while (max_error > tolerance) {
+            if (int(Us.size()) == rank_max)
+                return false;
+
+            // Start with the column of the residual with the largest norm
+            int jmax = 0;
+            double colmax = -1.0;
+            for (int j = 0; j < na; j++) {
+                double col = 0.0;
+                for (int i = 0; i < nk; i++)
+                    col += E[size_t(i) * na + j] * E[size_t(i) * na + j];
+                if (col > colmax) {
+                    colmax = col;
+                    jmax = j;
+                }
+            }
+            DVector u(nk), w(nk);
+            for (int i = 0; i < nk; i++)
+                u[i] = E[size_t(i) * na + jmax];
+            project_out(u);
+            if (normalize(u) == 0.0)
+                return false;
+            for (int iter = 0; iter < 200; iter++) {
+                for (int i = 0; i < nk; i++) {
+                    double sum = 0.0;
+                    for (int k = 0; k < nk; k++)
+                        sum += G[size_t(i) * nk + k] * u[k];
+                    w[i] = sum;
+                }
+                project_out(w);
+                if (normalize(w) == 0.0)
+                    return false;
+                double change = 0.0;
+                for (int i = 0; i < nk; i++)
+                    change = std::max(change, std::fabs(w[i] - u[i]));
+                std::swap(u, w);
+                if (change < 1e-10)
+                    break;
+            }
+
+            // V = u^T E and then E -> E - u V. We keep W = D0 V
+            DVector v(na, 0.0);
+            for (int i = 0; i < nk; i++)
+                for (int j = 0; j < na; j++)
+                    v[j] += u[i] * E[size_t(i) * na + j];
+            for (int i = 0; i < nk; i++)
+                for (int j = 0; j < na; j++)
+                    E[size_t(i) * na + j] -= u[i] * v[j];
+            for (int j = 0; j < na; j++)
+                v[j] *= D0[j];
+            Us.push_back(u);
+            Ws.push_back(v);
+            max_error = max_residual();
+        }
+
+        // Spline them
+        rank = int(Us.size());
+        U.resize(rank);
+        W.resize(rank);
+        U_at_nodes.resize(size_t(nk) * rank);
+        for (int r = 0; r < rank; r++) {
+            if (not U[r].create(logk.data(), Us[r].data(), nk) or not W[r].create(loga.data(), Ws[r].data(), na)) {
+                free();
+                return false;
+            }
+            for (int i = 0; i < nk; i++)
+                U_at_nodes[size_t(i) * rank + r] = Us[r][i];
+        }
+        logk_nodes = logk;
+        logkrange = {logk.front(), logk.back()};
+        logarange = {loga.front(), loga.back()};
+        return true;
+    }
+
+    /// Is it created or not?
+    explicit operator bool() const { return rank > 0; }
+
+    /// The number of terms in the sum
+    int get_rank() const { return rank; }
+
+    /// The max error of D/D0 on the grid it was made from
+    double get_max_error() const { return max_error; }
+
+    /// The range in log(k/H0) it was made on
+    std::pair<double, double> get_xrange() const { return logkrange; }
+
+    /// D (or dD/dlog(a) if nderiv_loga = 1) at (log(k/H0), log(a)). Outside the range we use the closest value
+    double eval(double logk, double loga, int nderiv_loga = 0) const {
+        logk = std::min(std::max(logk, logkrange.first), logkrange.second);
+        loga = std::min(std::max(loga, logarange.first), logarange.second);
+        double res = 0.0;
+        for (int r = 0; r < rank; r++)
+            res += U[r].eval(logk) * W[r].eval_deriv(loga, nderiv_loga);
+        return res;
+    }
+
+    /// D (or dD/dlog(a) if nderiv_loga = 1) at fixed a as a function of log(k/H0)
+    UniformGridSpline get_x_slice(double loga, int nderiv_loga = 0) const {
+        loga = std::min(std::max(loga, logarange.first), logarange.second);
+        std::vector<double> coeff(rank);
+        for (int r = 0; r < rank; r++)
+            coeff[r] = W[r].eval_deriv(loga, nderiv_loga);
+        const int nk = int(logk_nodes.size());
+        std::vector<double> values(nk, 0.0);
+        for (int i = 0; i < nk; i++)
+            for (int r = 0; r < rank; r++)
+                values[i] += U_at_nodes[size_t(i) * rank + r] * coeff[r];
+        UniformGridSpline slice;
+        slice.create(logk_nodes.data(), values.data(), nk);
+        return slice;
+    }
+
+    /// Free up the memory
+    void free() {
+        rank = 0;
+        U.clear();
+        W.clear();
+        U_at_nodes.clear();
+        logk_nodes.clear();
+    }
+
+  private:
+    int rank{0};
+    double max_error{0.0};
+    std::vector<UniformGridSpline> U;
+    std::vector<UniformGridSpline> W;
+    std::vector<double> U_at_nodes;
+    DVector logk_nodes;
+    std::pair<double, double> logkrange{};
+    std::pair<double, double> logarange{};
+};
+
 /// Base class for gravity models
 template <int NDIM>
 class GravityModel {
@@ -50,32 +347,69 @@ class GravityModel {
     //========================================================================
     // Growth functions
     //========================================================================
+    // D(k,a) (or dD/dlog(a) if nderiv_loga = 1) from the low-rank fit if we have it, otherwise the 2D spline
+    double eval_scaledependent(const GrowthFactorLowRank & D_lowrank,
+                               const Spline2D & D_of_logkoverH0_loga,
+                               double a,
+                               double koverH0,
+                               int nderiv_loga = 0) const {
+        const double logk = std::log(std::max(koverH0, koverH0low));
+        if (D_lowrank)
+            return D_lowrank.eval(logk, std::log(a), nderiv_loga);
+        return nderiv_loga == 0 ? D_of_logkoverH0_loga(logk, std::log(a)) :
+                                  D_of_logkoverH0_loga.deriv_y(logk, std::log(a));
+    }
     double get_D_1LPT(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
         return not scaledependent_growth ? D_1LPT_of_loga(std::log(a)) :
-                                           D_1LPT_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+                                           eval_scaledependent(D_1LPT_lowrank, D_1LPT_of_logkoverH0_loga, a, koverH0);
     }
     double get_Dmnu_1LPT(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
-        return not scaledependent_growth ? Dmnu_1LPT_of_loga(std::log(a)) :
-                                           Dmnu_1LPT_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+        return not scaledependent_growth ?
+                   Dmnu_1LPT_of_loga(std::log(a)) :
+                   eval_scaledependent(Dmnu_1LPT_lowrank, Dmnu_1LPT_of_logkoverH0_loga, a, koverH0);
     }
     double get_D_2LPT(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
         return not scaledependent_growth ? D_2LPT_of_loga(std::log(a)) :
-                                           D_2LPT_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+                                           eval_scaledependent(D_2LPT_lowrank, D_2LPT_of_logkoverH0_loga, a, koverH0);
     }
     double get_D_3LPTa(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
         return not scaledependent_growth ? D_3LPTa_of_loga(std::log(a)) :
-                                           D_3LPTa_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+                                           eval_scaledependent(D_3LPTa_lowrank, D_3LPTa_of_logkoverH0_loga, a, koverH0);
     }
     double get_D_3LPTb(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
         return not scaledependent_growth ? D_3LPTb_of_loga(std::log(a)) :
-                                           D_3LPTb_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+                                           eval_scaledependent(D_3LPTb_lowrank, D_3LPTb_of_logkoverH0_loga, a, koverH0);
     }
-   
+
+    //========================================================================
+    // Growth functions at fixed a as functions of k (a 1D lookup per k)
+    //========================================================================
+    // The growth factor (or dD/dlog(a) if nderiv_loga = 1) at fixed a as a function of k/H0
+    GrowthFactorSlice get_D_1LPT_slice(double a, int nderiv_loga = 0) const {
+        return make_growth_slice(D_1LPT_of_loga, D_1LPT_of_logkoverH0_loga, D_1LPT_lowrank, a, nderiv_loga);
+    }
+    GrowthFactorSlice get_D_2LPT_slice(double a, int nderiv_loga = 0) const {
+        return make_growth_slice(D_2LPT_of_loga, D_2LPT_of_logkoverH0_loga, D_2LPT_lowrank, a, nderiv_loga);
+    }
+    GrowthFactorSlice get_D_3LPTa_slice(double a, int nderiv_loga = 0) const {
+        return make_growth_slice(D_3LPTa_of_loga, D_3LPTa_of_logkoverH0_loga, D_3LPTa_lowrank, a, nderiv_loga);
+    }
+    GrowthFactorSlice get_D_3LPTb_slice(double a, int nderiv_loga = 0) const {
+        return make_growth_slice(D_3LPTb_of_loga, D_3LPTb_of_logkoverH0_loga, D_3LPTb_lowrank, a, nderiv_loga);
+    }
+    GrowthFactorSlice make_growth_slice(const Spline & D_of_loga,
+                                        const Spline2D & D_of_logkoverH0_loga,
+                                        const GrowthFactorLowRank & D_lowrank,
+                                        double a,
+                                        int nderiv_loga) const {
+        if (scaledependent_growth and D_lowrank)
+            return GrowthFactorSlice(
+                D_lowrank.get_x_slice(std::log(a), nderiv_loga), D_lowrank.get_xrange(), koverH0low);
+        if (scaledependent_growth)
+            return GrowthFactorSlice(D_of_logkoverH0_loga, a, koverH0low, nderiv_loga);
+        return GrowthFactorSlice(nderiv_loga == 0 ? D_of_loga(std::log(a)) : D_of_loga.deriv_x(std::log(a)));
+    }
+
     //========================================================================
     // Is growth scaledpendent?
     //========================================================================
@@ -85,28 +419,28 @@ class GravityModel {
     // Growth rates
     //========================================================================
     double get_f_1LPT(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
-        return not scaledependent_growth ? D_1LPT_of_loga.deriv_x(std::log(a)) / D_1LPT_of_loga(std::log(a)) :
-                                           D_1LPT_of_logkoverH0_loga.deriv_y(std::log(koverH0), std::log(a)) /
-                                               D_1LPT_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+        return not scaledependent_growth ?
+                   D_1LPT_of_loga.deriv_x(std::log(a)) / D_1LPT_of_loga(std::log(a)) :
+                   eval_scaledependent(D_1LPT_lowrank, D_1LPT_of_logkoverH0_loga, a, koverH0, 1) /
+                       eval_scaledependent(D_1LPT_lowrank, D_1LPT_of_logkoverH0_loga, a, koverH0);
     }
     double get_f_2LPT(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
-        return not scaledependent_growth ? D_2LPT_of_loga.deriv_x(std::log(a)) / D_2LPT_of_loga(std::log(a)) :
-                                           D_2LPT_of_logkoverH0_loga.deriv_y(std::log(koverH0), std::log(a)) /
-                                               D_2LPT_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+        return not scaledependent_growth ?
+                   D_2LPT_of_loga.deriv_x(std::log(a)) / D_2LPT_of_loga(std::log(a)) :
+                   eval_scaledependent(D_2LPT_lowrank, D_2LPT_of_logkoverH0_loga, a, koverH0, 1) /
+                       eval_scaledependent(D_2LPT_lowrank, D_2LPT_of_logkoverH0_loga, a, koverH0);
     }
     double get_f_3LPTa(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
-        return not scaledependent_growth ? D_3LPTa_of_loga.deriv_x(std::log(a)) / D_3LPTa_of_loga(std::log(a)) :
-                                           D_3LPTa_of_logkoverH0_loga.deriv_y(std::log(koverH0), std::log(a)) /
-                                               D_3LPTa_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+        return not scaledependent_growth ?
+                   D_3LPTa_of_loga.deriv_x(std::log(a)) / D_3LPTa_of_loga(std::log(a)) :
+                   eval_scaledependent(D_3LPTa_lowrank, D_3LPTa_of_logkoverH0_loga, a, koverH0, 1) /
+                       eval_scaledependent(D_3LPTa_lowrank, D_3LPTa_of_logkoverH0_loga, a, koverH0);
     }
     double get_f_3LPTb(double a, double koverH0 = 0.0) const {
-        koverH0 = std::max(koverH0, koverH0low);
-        return not scaledependent_growth ? D_3LPTb_of_loga.deriv_x(std::log(a)) / D_3LPTb_of_loga(std::log(a)) :
-                                           D_3LPTb_of_logkoverH0_loga.deriv_y(std::log(koverH0), std::log(a)) /
-                                               D_3LPTb_of_logkoverH0_loga(std::log(koverH0), std::log(a));
+        return not scaledependent_growth ?
+                   D_3LPTb_of_loga.deriv_x(std::log(a)) / D_3LPTb_of_loga(std::log(a)) :
+                   eval_scaledependent(D_3LPTb_lowrank, D_3LPTb_of_logkoverH0_loga, a, koverH0, 1) /
+                       eval_scaledependent(D_3LPTb_lowrank, D_3LPTb_of_logkoverH0_loga, a, koverH0);
     }
     
     // Output an element (e.g. string/double) in a header/row with a desired alignment width
@@ -187,13 +521,36 @@ class GravityModel {
             std::cout << "# Growth factors unity at zini = " << 1.0 / aini - 1.0 << "\n";
             std::cout << "# Starting integrating growth factors from z = " << 1.0 / alow - 1.0 << "\n";
             std::cout << "# scaledependent_growth : " << scaledependent_growth << "\n";
+            if (scaledependent_growth and growth_lowrank) {
+                std::cout << "# Low-rank growth factors (rank, max error of D/D(k=0)):";
+                for (auto * lr :
+                     {&D_1LPT_lowrank, &D_2LPT_lowrank, &D_3LPTa_lowrank, &D_3LPTb_lowrank, &Dmnu_1LPT_lowrank})
+                    std::cout << " (" << lr->get_rank() << ", " << lr->get_max_error() << ")";
+                std::cout << "\n";
+            }
         }
     }
 
     //========================================================================
     // Read the transferinfo data from file
     //========================================================================
-    void init_transferdata(std::string transferinfofilename, std::string fileformat = "CAMB") {
+    void init_transferdata(std::string transferinfofilename,
+                           std::string fileformat = "CAMB",
+                           std::string cache_folder = "",
+                           bool lazy_loading = false,
+                           bool prefetch = false) {
+        // If we have read the same files for the same cosmology before (batch mode) then use a copy of that.
+        // We hand out copies as the simulation rescales As in the transfer data when normalizing to sigma8
+        std::stringstream key;
+        key << std::setprecision(17) << transferinfofilename << " " << fileformat << " " << cosmo->get_Omegab() << " "
+            << cosmo->get_OmegaCDM() << " " << cosmo->get_OmegaMNu() << " " << cosmo->get_kpivot_mpc() << " "
+            << cosmo->get_As() << " " << cosmo->get_ns() << " " << cosmo->get_h();
+        auto cached = transferdata_cache.find(key.str());
+        if (cached != transferdata_cache.end()) {
+            transferdata = std::make_shared<LinearTransferData>(*cached->second);
+            return;
+        }
+
         transferdata = std::make_shared<LinearTransferData>(cosmo->get_Omegab(),
                                                             cosmo->get_OmegaCDM(),
                                                             cosmo->get_OmegaMNu(),
@@ -203,7 +560,19 @@ class GravityModel {
                                                             cosmo->get_h(),
                                                             fileformat);
         const bool verbose = false; // For testing
+        transferdata->set_cache_folder(cache_folder);
+        transferdata->set_lazy_loading(lazy_loading, prefetch);
         transferdata->read_transfer(transferinfofilename, verbose);
+        if (reuse_transferdata)
+            transferdata_cache[key.str()] = std::make_shared<LinearTransferData>(*transferdata);
+    }
+
+    // Keep the transfer data we read so that later models (in the same job) with the same input use it
+    // instead of reading the files again. Turning it off frees the ones we have
+    static void set_reuse_transferdata(bool reuse) {
+        reuse_transferdata = reuse;
+        if (not reuse)
+            transferdata_cache.clear();
     }
     std::shared_ptr<LinearTransferData> get_transferdata() { return transferdata; }
     void set_transferdata(std::shared_ptr<LinearTransferData> _transferdata) { transferdata = _transferdata; }
@@ -215,13 +584,20 @@ class GravityModel {
     virtual void read_parameters(ParameterMap & param) {
         aini = 1.0 / (1.0 + param.get<double>("ic_initial_redshift"));
         if (param.get<std::string>("ic_type_of_input") == "transferinfofile") {
-            init_transferdata(param.get<std::string>("ic_input_filename"), param.get<std::string>("ic_type_of_input_fileformat", "CAMB"));
+            init_transferdata(param.get<std::string>("ic_input_filename"),
+                              param.get<std::string>("ic_type_of_input_fileformat", "CAMB"),
+                              param.get<std::string>("ic_transferdata_cache_folder", ""),
+                              param.get<bool>("ic_transferdata_lazy_loading", false),
+                              param.get<bool>("ic_transferdata_prefetch", false));
         }
         this->scaledependent_growth = this->cosmo->get_fMNu() > 0.0;
     
         // Experimental option with finite-difference forces (instead of fourier)
         force_use_finite_difference_force = param.get<bool>("force_use_finite_difference_force", false);
         force_finite_difference_stencil_order = param.get<int>("force_finite_difference_stencil_order", 4);
+
+        // Store the scaledependent growth factors as a low-rank separable fit instead of 2D splines
+        growth_lowrank = param.get<bool>("gravity_model_growth_lowrank", false);
     }
 
     //========================================================================
@@ -230,6 +606,29 @@ class GravityModel {
     //========================================================================
     virtual double GeffOverG([[maybe_unused]] double a, [[maybe_unused]] double koverH0 = 0) const = 0;
 
+    // GeffOverG for n values of k at once (one virtual call instead of one per k). Models with a closed form
+    // override this to compute the a-dependent part once and leave a loop over k the compiler can vectorize
+    virtual void GeffOverG_array(double a, const double * koverH0, double * result, size_t n) const {
+        for (size_t i = 0; i < n; i++)
+            result[i] = GeffOverG(a, koverH0[i]);
+    }
+
+    // GeffOverG(a,k) tabulated for kBox in [0, kBoxmax] to use inside k-space loops. The fiducial resolution
+    // is 16 points per fundamental mode 2pi (linear interpolation so we need more than the cubic splines)
+    UniformKTable<1> make_GeffOverG_table(double a, double H0Box, double kBoxmax, int npts = 0) const {
+        if (npts < 2)
+            npts = int(16.0 * kBoxmax / (2.0 * M_PI)) + 2;
+        std::vector<double> koverH0(npts);
+        std::vector<double> geff(npts);
+        for (int i = 0; i < npts; i++)
+            koverH0[i] = kBoxmax * i / double(npts - 1) / H0Box;
+        GeffOverG_array(a, koverH0.data(), geff.data(), npts);
+        std::vector<std::array<double, 1>> values(npts);
+        for (int i = 0; i < npts; i++)
+            values[i][0] = geff[i];
+        return UniformKTable<1>(0.0, kBoxmax, std::move(values));
+    }
+
     // Factors in the LPT equations
     virtual double source_factor_1LPT([[maybe_unused]] double a, [[maybe_unused]] double koverH0 = 0) const {
         double factor = 1.0;
@@ -300,7 +699,9 @@ class GravityModel {
         const bool solve_for_neutrinos = transferdata and scaledependent_growth and cosmo->get_fMNu() > 0.0;
 
         // A quite general set of LPT equations up to 3rd order
-        auto solve_growth_equations = [&](double koverH0) -> std::tuple<DVector, DVector, DVector, DVector, DVector> {
+        // The solver is passed in so that each thread can reuse its GSL workspace for all k
+        auto solve_growth_equations = [&](double koverH0, FML::SOLVERS::ODESOLVER::ODESolver & ode)
+            -> std::tuple<DVector, DVector, DVector, DVector, DVector> {
             const double OmegaM = cosmo->get_OmegaM();
             const double fnu = cosmo->get_fMNu();
             FML::SOLVERS::ODESOLVER::ODEFunction deriv = [&](double x, const double * y, double * dydx) {
@@ -387,7 +788,6 @@ class GravityModel {
                 D1_ini, dD1dx_ini, D2_ini, dD2dx_ini, D3a_ini, dD3adx_ini, D3b_ini, dD3bdx_ini, D1mnu_ini, dD1mnu_ini};
 
             // Solve the ODE
-            FML::SOLVERS::ODESOLVER::ODESolver ode;
             ode.solve(deriv, loga_arr, yini);
             auto D1 = ode.get_data_by_component(0);
             auto D2 = ode.get_data_by_component(2);
@@ -422,7 +822,8 @@ class GravityModel {
 
         // Compute scaleindependent growth-factors (for scaledependent growth
         // this corresponds to k = 0)
-        auto data = solve_growth_equations(0.0);
+        FML::SOLVERS::ODESOLVER::ODESolver ode;
+        auto data = solve_growth_equations(0.0, ode);
         D_1LPT_of_loga.create(loga_arr, std::get<0>(data), "D1LPT(log(a))");
         D_2LPT_of_loga.create(loga_arr, std::get<1>(data), "D2LPT(log(a))");
         D_3LPTa_of_loga.create(loga_arr, std::get<2>(data), "D3LPTa(log(a))");
@@ -432,27 +833,71 @@ class GravityModel {
         // Compute the full scaledependent D_iLPT(k,a)
         if (scaledependent_growth) {
 
-            DVector2D D1mnu(npts_logk, DVector(npts_loga));
-            DVector2D D1(npts_logk, DVector(npts_loga));
-            DVector2D D2(npts_logk, DVector(npts_loga));
-            DVector2D D3a(npts_logk, DVector(npts_loga));
-            DVector2D D3b(npts_logk, DVector(npts_loga));
+            // Each task solves every NTasks'th wavenumber (the cost grows with k so this balances better
+            // than contiguous blocks) and we sum the tables over tasks (the rows we did not solve are zero)
+            const int nfields = 5;
+            const size_t nrow = size_t(npts_loga);
+            std::vector<double> tables(nfields * npts_logk * nrow, 0.0);
+            auto table = [&](int field, int i) { return tables.data() + (field * npts_logk + i) * nrow; };
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+            {
+                FML::SOLVERS::ODESOLVER::ODESolver ode_thread;
 #ifdef USE_OMP
-#pragma omp parallel for
+#pragma omp for schedule(dynamic, 1)
 #endif
+                for (int i = FML::ThisTask; i < npts_logk; i += FML::NTasks) {
+                    auto data = solve_growth_equations(std::exp(logkoverH0_arr[i]), ode_thread);
+                    std::copy(std::get<0>(data).begin(), std::get<0>(data).end(), table(0, i));
+                    std::copy(std::get<1>(data).begin(), std::get<1>(data).end(), table(1, i));
+                    std::copy(std::get<2>(data).begin(), std::get<2>(data).end(), table(2, i));
+                    std::copy(std::get<3>(data).begin(), std::get<3>(data).end(), table(3, i));
+                    std::copy(std::get<4>(data).begin(), std::get<4>(data).end(), table(4, i));
+                }
+            }
+            FML::SumArrayOverTasks(tables.data(), int(tables.size()));
+
+            DVector2D D1(npts_logk), D2(npts_logk), D3a(npts_logk), D3b(npts_logk), D1mnu(npts_logk);
             for (int i = 0; i < npts_logk; i++) {
-                auto data = solve_growth_equations(std::exp(logkoverH0_arr[i]));
-                D1[i] = std::get<0>(data);
-                D2[i] = std::get<1>(data);
-                D3a[i] = std::get<2>(data);
-                D3b[i] = std::get<3>(data);
-                D1mnu[i] = std::get<4>(data);
+                D1[i].assign(table(0, i), table(0, i) + nrow);
+                D2[i].assign(table(1, i), table(1, i) + nrow);
+                D3a[i].assign(table(2, i), table(2, i) + nrow);
+                D3b[i].assign(table(3, i), table(3, i) + nrow);
+                D1mnu[i].assign(table(4, i), table(4, i) + nrow);
             }
-            D_1LPT_of_logkoverH0_loga.create(logkoverH0_arr, loga_arr, D1, "D1LPT(log(k/H0),log(a))");
-            D_2LPT_of_logkoverH0_loga.create(logkoverH0_arr, loga_arr, D2, "D2LPT(log(k/H0),log(a))");
-            D_3LPTa_of_logkoverH0_loga.create(logkoverH0_arr, loga_arr, D3a, "D3LPTa(log(k/H0),log(a))");
-            D_3LPTb_of_logkoverH0_loga.create(logkoverH0_arr, loga_arr, D3b, "D3LPTb(log(k/H0),log(a))");
-            Dmnu_1LPT_of_logkoverH0_loga.create(logkoverH0_arr, loga_arr, D1mnu, "D1mnuLPT(log(k/H0),log(a))");
+
+            // Use the low-rank fit if asked for and it gets the tolerance, otherwise the 2D spline
+            auto make_growth = [&](GrowthFactorLowRank & D_lowrank,
+                                   Spline2D & D_of_logkoverH0_loga,
+                                   const DVector2D & D,
+                                   const DVector & D0,
+                                   std::string splinename) {
+                D_lowrank.free();
+                D_of_logkoverH0_loga.free();
+                if (growth_lowrank and D_lowrank.create(logkoverH0_arr,
+                                                        loga_arr,
+                                                        D,
+                                                        D0,
+                                                        growth_lowrank_tolerance,
+                                                        growth_lowrank_rank_max))
+                    return;
+                if (growth_lowrank and FML::ThisTask == 0)
+                    std::cout << "Warning: the low-rank fit of " << splinename
+                              << " did not get the tolerance. Using a 2D spline\n";
+                D_of_logkoverH0_loga.create(logkoverH0_arr, loga_arr, D, splinename);
+            };
+            make_growth(D_1LPT_lowrank, D_1LPT_of_logkoverH0_loga, D1, std::get<0>(data), "D1LPT(log(k/H0),log(a))");
+            make_growth(D_2LPT_lowrank, D_2LPT_of_logkoverH0_loga, D2, std::get<1>(data), "D2LPT(log(k/H0),log(a))");
+            make_growth(
+                D_3LPTa_lowrank, D_3LPTa_of_logkoverH0_loga, D3a, std::get<2>(data), "D3LPTa(log(k/H0),log(a))");
+            make_growth(
+                D_3LPTb_lowrank, D_3LPTb_of_logkoverH0_loga, D3b, std::get<3>(data), "D3LPTb(log(k/H0),log(a))");
+            make_growth(Dmnu_1LPT_lowrank,
+                        Dmnu_1LPT_of_logkoverH0_loga,
+                        D1mnu,
+                        std::get<4>(data),
+                        "D1mnuLPT(log(k/H0),log(a))");
         }
     }
 
@@ -462,6 +907,10 @@ class GravityModel {
     
     // For massive neutrinos we need transfer functions
     std::shared_ptr<LinearTransferData> transferdata;
+
+    // The transfer data read by earlier models (if reuse_transferdata)
+    static inline bool reuse_transferdata{false};
+    static inline std::map<std::string, std::shared_ptr<LinearTransferData>> transferdata_cache{};
     
     // The background cosmology
     std::shared_ptr<Cosmology> cosmo;
@@ -494,6 +943,17 @@ class GravityModel {
 
     Spline Dmnu_1LPT_of_loga{"[Dmnu1LPT(log(a)) not yet created]"};
     Spline2D Dmnu_1LPT_of_logkoverH0_loga{"[Dmnu1LPT(log(k/H0),log(a)) not yet created]"};
+
+    // Scaledependent growth factors as low-rank fits (if growth_lowrank and the fit gets the tolerance the
+    // 2D splines above are not made)
+    bool growth_lowrank{false};
+    const double growth_lowrank_tolerance = 1e-6;
+    const int growth_lowrank_rank_max = 32;
+    GrowthFactorLowRank D_1LPT_lowrank;
+    GrowthFactorLowRank D_2LPT_lowrank;
+    GrowthFactorLowRank D_3LPTa_lowrank;
+    GrowthFactorLowRank D_3LPTb_lowrank;
+    GrowthFactorLowRank Dmnu_1LPT_lowrank;
     
     // Does it have scaledependent growth?
     bool scaledependent_growth{false};
@@ -101,7 +101,9 @@ class GravityModelDGP final : public GravityModel<NDIM> {
 
         // Compute fifth-force
         const double norm_poisson_equation = 1.5 * this->cosmo->get_OmegaM() * a;
-        auto coupling = [&]([[maybe_unused]] double kBox) { return GeffOverG(a, kBox / H0Box) - 1.0; };
+        // GeffOverG is scaleindependent so compute it once and not for every cell
+        const double coupling_dgp = GeffOverG(a) - 1.0;
+        auto coupling = [=]([[maybe_unused]] double kBox) { return coupling_dgp; };
         FFTWGrid<NDIM> density_fifth_force;
 
        if (solve_exact_equation) {
@@ -151,7 +153,7 @@ class GravityModelDGP final : public GravityModel<NDIM> {
             // Approximate screening method
             const double OmegaM = this->cosmo->get_OmegaM();
             auto screening_function_dgp = [=](double density_contrast) {
-                double fac = 8.0 * OmegaM * std::pow(rcH0_DGP * (GeffOverG(a) - 1.0), 2) * (density_contrast);
+                double fac = 8.0 * OmegaM * std::pow(rcH0_DGP * coupling_dgp, 2) * (density_contrast);
                 fac *= screening_efficiency;
                 return fac < 1e-5 ? 1.0 : 2.0 * (std::sqrt(1.0 + fac) - 1) / fac;
             };
@@ -199,7 +201,7 @@ class GravityModelDGP final : public GravityModel<NDIM> {
                         density_fourier.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
                         auto delta = density_fourier.get_fourier_from_index(fourier_index);
                         auto delta_fifth_force = density_fifth_force.get_fourier_from_index(fourier_index);
-                        auto delta_fifth_force_linear = delta * FML::GRID::FloatType(GeffOverG(a, kmag / H0Box) - 1.0);
+                        auto delta_fifth_force_linear = delta * FML::GRID::FloatType(coupling_dgp);
                         FML::GRID::FloatType filter = f_spline(kmag);
                         auto value = delta_fifth_force_linear * filter + delta_fifth_force * FML::GRID::FloatType(1.0 - filter);
                         density_fifth_force.set_fourier_from_index(fourier_index, value);
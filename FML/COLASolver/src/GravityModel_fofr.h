@@ -23,12 +23,22 @@ class GravityModelFofR final : public GravityModel<NDIM> {
     bool screening_enforce_largescale_linear{false};
     double screening_linear_scale_hmpc{0.0};
     double screening_efficiency{1.0};
+    std::string screening_smoothing_filter{"gaussian"};
+    double screening_smoothing_scale_over_boxsize{0.0};
 
     // For solving the exact equation
     bool solve_exact_equation{false};
     int multigrid_nsweeps_first_step{10};
     int multigrid_nsweeps{10};
     double multigrid_solver_residual_convergence{1e-7};
+    bool multigrid_warm_start{true};
+    std::string multigrid_cycle_type{"V"};
+    bool multigrid_fmg{false};
+    bool multigrid_offload{false};
+    // The solution from the last step used as the initial guess for the next one
+    // (compute_force is const so these are mutable)
+    mutable FML::GRID::MPIGrid<NDIM, double> multigrid_previous_solution;
+    mutable double multigrid_previous_a{-1.0};
 
   public:
     template <int N>
@@ -57,6 +67,8 @@ class GravityModelFofR final : public GravityModel<NDIM> {
                 std::cout << "# Enforce correct linear evolution : " << screening_enforce_largescale_linear << "\n";
                 std::cout << "# Scale for which we enforce this  : " << screening_linear_scale_hmpc << " h/Mpc\n";
                 std::cout << "# Screening efficiency             : " << screening_efficiency << "\n";
+                std::cout << "# Smoothing filter for Phi_N       : " << screening_smoothing_filter << "\n";
+                std::cout << "# Smoothing scale (R/boxsize)      : " << screening_smoothing_scale_over_boxsize << "\n";
             }
             std::cout << "#=====================================================\n";
             std::cout << "\n";
@@ -84,6 +96,13 @@ class GravityModelFofR final : public GravityModel<NDIM> {
         double koverH02 = koverH0 * koverH0;
         return 1.0 + (1.0 / 3.0) * koverH02 / (koverH02 + mass2a2);
     }
+    void GeffOverG_array(double a, const double * koverH0, double * result, size_t n) const override {
+        const double mass2a2 = a * a * mass_over_H0_squared(a);
+        for (size_t i = 0; i < n; i++) {
+            const double koverH02 = koverH0[i] * koverH0[i];
+            result[i] = 1.0 + (1.0 / 3.0) * koverH02 / (koverH02 + mass2a2);
+        }
+    }
 
     //========================================================================
     // Compute the force DPhi from the density field delta in fourier space
@@ -99,7 +118,10 @@ class GravityModelFofR final : public GravityModel<NDIM> {
 
         // Compute fifth-force
         const double norm_poisson_equation = 1.5 * this->cosmo->get_OmegaM() * a;
-        auto coupling = [&](double kBox) { return GeffOverG(a, kBox / H0Box) - 1.0; };
+        // GeffOverG tabulated once for this step so the k-space loops don't do a virtual call for every mode
+        const auto GeffOverG_table = this->make_GeffOverG_table(
+            a, H0Box, M_PI * std::sqrt(double(NDIM)) * density_fourier.get_nmesh());
+        auto coupling = [&](double kBox) { return GeffOverG_table(kBox)[0] - 1.0; };
         FFTWGrid<NDIM> density_fifth_force;
 
         if (solve_exact_equation) {
@@ -114,7 +136,15 @@ class GravityModelFofR final : public GravityModel<NDIM> {
             FofrSolverCosmology<NDIM, double> mgsolver(this->cosmo->get_OmegaM(), nfofr, fofr0, H0Box, verbose);
             mgsolver.set_ngs_steps(multigrid_nsweeps, multigrid_nsweeps, multigrid_nsweeps_first_step);
             mgsolver.set_epsilon(multigrid_solver_residual_convergence);
+            mgsolver.set_cycle(multigrid_cycle_type, multigrid_fmg);
+            mgsolver.set_offload(multigrid_offload);
+            if (multigrid_warm_start and multigrid_previous_a > 0.0)
+                mgsolver.set_initial_guess(multigrid_previous_solution, multigrid_previous_a);
             mgsolver.solve(a, density_real, density_fifth_force);
+            if (multigrid_warm_start) {
+                multigrid_previous_solution = std::move(mgsolver.get_solution());
+                multigrid_previous_a = a;
+            }
             // It returns it in real-space so go back to fourier space
             density_fifth_force.fftw_r2c();
 
@@ -160,7 +190,9 @@ class GravityModelFofR final : public GravityModel<NDIM> {
                                                                       density_fifth_force,
                                                                       coupling,
                                                                       screening_function_fofr,
-                                                                      norm_poisson_equation * std::pow(H0Box / a, 2));
+                                                                      norm_poisson_equation * std::pow(H0Box / a, 2),
+                                                                      screening_smoothing_scale_over_boxsize,
+                                                                      screening_smoothing_filter);
 
             // Ensure that the large scales are behaving correctly
             // We set delta_fifth_force => A * (1-f) + B * f
@@ -198,7 +230,7 @@ class GravityModelFofR final : public GravityModel<NDIM> {
                         density_fourier.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
                         auto delta = density_fourier.get_fourier_from_index(fourier_index);
                         auto delta_fifth_force = density_fifth_force.get_fourier_from_index(fourier_index);
-                        auto delta_fifth_force_linear = delta * FML::GRID::FloatType(GeffOverG(a, kmag / H0Box) - 1.0);
+                        auto delta_fifth_force_linear = delta * FML::GRID::FloatType(coupling(kmag));
                         FML::GRID::FloatType filter = f_spline(kmag);
                         auto value = delta_fifth_force_linear * filter + delta_fifth_force * FML::GRID::FloatType(1.0 - filter);
                         density_fifth_force.set_fourier_from_index(fourier_index, value);
@@ -264,12 +296,24 @@ class GravityModelFofR final : public GravityModel<NDIM> {
             screening_enforce_largescale_linear = param.get<bool>("gravity_model_screening_enforce_largescale_linear");
             screening_linear_scale_hmpc = param.get<double>("gravity_model_screening_linear_scale_hmpc");
             screening_efficiency = param.get<double>("gravity_model_screening_efficiency", 1.0);
+            screening_smoothing_filter = param.get<std::string>("gravity_model_screening_smoothing_filter", "gaussian");
+            screening_smoothing_scale_over_boxsize =
+                param.get<double>("gravity_model_screening_smoothing_scale_over_boxsize", 0.0);
         }
         solve_exact_equation = param.get<bool>("gravity_model_fofr_exact_solution");
         if (solve_exact_equation) {
             multigrid_nsweeps_first_step = param.get<int>("multigrid_nsweeps_first_step");
             multigrid_nsweeps = param.get<int>("multigrid_nsweeps");
             multigrid_solver_residual_convergence = param.get<double>("multigrid_solver_residual_convergence");
+            multigrid_warm_start = param.get<bool>("multigrid_warm_start", true);
+            multigrid_cycle_type = param.get<std::string>("multigrid_cycle_type", "V");
+            multigrid_fmg = param.get<bool>("multigrid_fmg", false);
+            multigrid_offload = param.get<bool>("multigrid_offload", false);
+#ifndef USE_OMP_TARGET
+            if (multigrid_offload and FML::ThisTask == 0)
+                std::cout << "Warning: multigrid_offload needs USE_OMP_TARGET. Turning it off\n";
+            multigrid_offload = false;
+#endif
         }
         this->scaledependent_growth = true;
     }
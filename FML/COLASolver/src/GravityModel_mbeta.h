@@ -21,6 +21,8 @@ class GravityModelmbeta : public GravityModel<NDIM> {
     bool screening_enforce_largescale_linear{false};
     double screening_linear_scale_hmpc{0.0};
     double screening_efficiency{1.0};
+    std::string screening_smoothing_filter{"gaussian"};
+    double screening_smoothing_scale_over_boxsize{0.0};
 
     // Spline for phi(a)/Mpl needed for screening method
     FML::INTERPOLATION::SPLINE::Spline phi_over_Mpl_of_a_spline;
@@ -52,6 +54,8 @@ class GravityModelmbeta : public GravityModel<NDIM> {
                 std::cout << "# Enforce correct linear evolution : " << screening_enforce_largescale_linear << "\n";
                 std::cout << "# Scale for which we enforce this  : " << screening_linear_scale_hmpc << " h/Mpc\n";
                 std::cout << "# Screening efficiency             : " << screening_efficiency << "\n";
+                std::cout << "# Smoothing filter for Phi_N       : " << screening_smoothing_filter << "\n";
+                std::cout << "# Smoothing scale (R/boxsize)      : " << screening_smoothing_scale_over_boxsize << "\n";
             }
             std::cout << "#=====================================================\n";
             std::cout << "\n";
@@ -94,6 +98,14 @@ class GravityModelmbeta : public GravityModel<NDIM> {
         double beta     = beta_of_a(a);
         return 1.0 + 2.0 * beta * beta * koverH02 / (koverH02 + mass2a2);
     }
+    void GeffOverG_array(double a, const double * koverH0, double * result, size_t n) const override {
+        const double mass2a2 = a * a * mass_over_H0_squared(a);
+        const double beta = beta_of_a(a);
+        for (size_t i = 0; i < n; i++) {
+            const double koverH02 = koverH0[i] * koverH0[i];
+            result[i] = 1.0 + 2.0 * beta * beta * koverH02 / (koverH02 + mass2a2);
+        }
+    }
 
     //========================================================================
     // Compute the force DPhi from the density field delta in fourier space
@@ -109,7 +121,10 @@ class GravityModelmbeta : public GravityModel<NDIM> {
 
         // Compute fifth-force
         const double norm_poisson_equation = 1.5 * this->cosmo->get_OmegaM() * a;
-        auto coupling = [&](double kBox) { return GeffOverG(a, kBox / H0Box) - 1.0; };
+        // GeffOverG tabulated once for this step so the k-space loops don't do a virtual call for every mode
+        const auto GeffOverG_table = this->make_GeffOverG_table(
+            a, H0Box, M_PI * std::sqrt(double(NDIM)) * density_fourier.get_nmesh());
+        auto coupling = [&](double kBox) { return GeffOverG_table(kBox)[0] - 1.0; };
         FFTWGrid<NDIM> density_fifth_force;
 
         if (use_screening_method) {
@@ -129,7 +144,9 @@ class GravityModelmbeta : public GravityModel<NDIM> {
                                                                       density_fifth_force,
                                                                       coupling,
                                                                       screening_function,
-                                                                      norm_poisson_equation * std::pow(H0Box / a, 2));
+                                                                      norm_poisson_equation * std::pow(H0Box / a, 2),
+                                                                      screening_smoothing_scale_over_boxsize,
+                                                                      screening_smoothing_filter);
 
             // Ensure that the large scales are behaving correctly
             // We set delta_fifth_force => A * (1-f) + B * f
@@ -167,7 +184,7 @@ class GravityModelmbeta : public GravityModel<NDIM> {
                         density_fourier.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
                         auto delta = density_fourier.get_fourier_from_index(fourier_index);
                         auto delta_fifth_force = density_fifth_force.get_fourier_from_index(fourier_index);
-                        auto delta_fifth_force_linear = delta * FML::GRID::FloatType(GeffOverG(a, kmag / H0Box) - 1.0);
+                        auto delta_fifth_force_linear = delta * FML::GRID::FloatType(coupling(kmag));
                         FML::GRID::FloatType filter = f_spline(kmag);
                         auto value = delta_fifth_force_linear * filter + delta_fifth_force * FML::GRID::FloatType(1.0 - filter);
                         density_fifth_force.set_fourier_from_index(fourier_index, value);
@@ -263,6 +280,9 @@ class GravityModelmbeta : public GravityModel<NDIM> {
             screening_enforce_largescale_linear = param.get<bool>("gravity_model_screening_enforce_largescale_linear");
             screening_linear_scale_hmpc = param.get<double>("gravity_model_screening_linear_scale_hmpc");
             screening_efficiency = param.get<double>("gravity_model_screening_efficiency", 1.0);
+            screening_smoothing_filter = param.get<std::string>("gravity_model_screening_smoothing_filter", "gaussian");
+            screening_smoothing_scale_over_boxsize =
+                param.get<double>("gravity_model_screening_smoothing_scale_over_boxsize", 0.0);
         }
         this->scaledependent_growth = true;
     }
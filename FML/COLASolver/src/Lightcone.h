@@ -0,0 +1,500 @@
+#ifndef LIGHTCONE_HEADER
+#define LIGHTCONE_HEADER
+
+#include <FML/Global/Global.h>
+#include <FML/MPIParticles/MPIParticles.h>
+#include <FML/ODESolver/ODESolver.h>
+#include <FML/ParameterMap/ParameterMap.h>
+#include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+#include <FML/Spline/Spline.h>
+#include <FML/Units/Units.h>
+
+#include "Cosmology.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+//=============================================================================
+///
+/// On the fly lightcone. Every drift we find the particles that cross the past lightcone of the
+/// observer(s), i.e. the ones that go from |x - xobs| < chi(a) to |x - xobs| > chi(a) during the step,
+/// and interpolate them (linearly in time over the step) to the crossing. The box is replicated
+/// periodically so the lightcone can be deeper than the box.
+///
+/// For every step (shell) and observer each task writes the particles it found to
+/// [output_folder]/lightcone_[simulation_name]/lightcone_obs[iobs]_step[istep].[ThisTask] as binary:
+///   int ndim, int nfloats (2*ndim+1), long long npart, double aold, double anew, double boxsize,
+///   int vel_in_cola_frame followed by npart records of float (pos[ndim] (Mpc/h rel. to observer),
+///   vel[ndim] (km/s), a_cross)
+/// If healpix_nside > 0 (3D only) task 0 also writes a HEALPix (RING ordering) map with the number
+/// of particles in the shell to healpix_obs[iobs]_step[istep] as binary:
+///   int nside, double aold, double anew, double chi_min, double chi_max (Mpc/h) followed by 12*nside^2 floats
+///
+/// We need the index of a particle to be the same before and after the drift (we store the positions
+/// before the drift of the particles close to the lightcone) so the particles cannot be communicated
+/// in between. This is not the case for scaledependent COLA so that is not supported.
+/// For COLA the particles carry the velocity in the COLA frame so we add on the LPT velocity at the
+/// crossing (from the displacement fields of the particles and the factors given by set_cola_lpt_velocity).
+/// If these factors are not set the velocities are left in the COLA frame: this is flagged by
+/// vel_in_cola_frame = 1 in the header and they are not the true velocities (e.g. for redshift-space).
+///
+//=============================================================================
+template <int NDIM, class T>
+class Lightcone {
+  public:
+    using Point = std::array<double, NDIM>;
+    using Replica = std::array<int, NDIM>;
+
+    /// Read the lightcone parameters (and the simulation parameters we need)
+    void read_parameters(FML::UTILS::ParameterMap & param);
+
+    /// Compute chi(a) and the replicas of the box we need. Call before the first drift
+    void init(std::shared_ptr<Cosmology> cosmo, double aini);
+
+    /// Call right before the positions are updated from aold to anew: find and store the candidates
+    void begin_drift(FML::PARTICLE::MPIParticles<T> & part, double aold, double anew);
+
+    /// Call right after the positions are updated: find the crossings and output them
+    void end_drift(FML::PARTICLE::MPIParticles<T> & part);
+
+    /// For COLA: the factors fac_vel(a) such that the LPT velocity is sum_n D_n * fac_vel[n] for the displacement
+    /// fields D1, D2, D3a and D3b of the particles. Call before init
+    void set_cola_lpt_velocity(std::function<std::array<double, 4>(double)> factors) {
+        cola_lpt_velocity_factors = factors;
+    }
+
+    bool is_enabled() const { return lightcone; }
+
+    /// The number of steps we have taken (used in the filenames). Set when we restart from a checkpoint
+    int get_step() const { return istep; }
+    void set_step(int step) { istep = step; }
+
+    /// The folder we store the output in (set from the simulation name in read_parameters)
+    void set_folder(std::string _folder) { folder = _folder; }
+
+  private:
+    bool lightcone{false};
+    std::vector<Point> origins;        // The observers (in units of the box)
+    double zmin{0.0};                  // The lightcone is from zmin to zmax
+    double zmax{1.0};
+    bool replicate{true};              // Replicate the box periodically?
+    double buffer{0.0};                // Max distance a particle moves in a step (in units of the box)
+    int healpix_nside{0};              // Make HEALPix maps of every shell (0 = no maps)
+    bool output_particles{true};       // Output the particles on the lightcone
+    double boxsize{1.0};               // Boxsize in Mpc/h
+    std::string folder;                // The folder we store the output in
+    bool cola{false};                  // The velocities of the particles are in the COLA frame
+
+    // For COLA: the factors to get the LPT velocity from the displacement fields at a given a
+    std::function<std::array<double, 4>(double)> cola_lpt_velocity_factors{};
+
+    // Comoving distance in units of the box
+    FML::INTERPOLATION::SPLINE::Spline chi_of_a_spline{"chi(a)"};
+    std::vector<Replica> replicas;
+
+    // The current step. The positions before the drift of the particles that might cross
+    int istep{0};
+    bool active{false};
+    double aold{0.0};
+    double anew{0.0};
+    std::vector<std::vector<Replica>> step_replicas;
+    std::vector<size_t> candidates;
+    std::vector<Point> candidates_pos;
+
+    double chi_of_a(double a) const { return chi_of_a_spline(a); }
+    double chi_min() const { return chi_of_a(1.0 / (1.0 + zmin)); }
+    double chi_max() const { return chi_of_a(1.0 / (1.0 + zmax)); }
+};
+
+/// The pixel (RING ordering) the vector v lies in for a HEALPix map with resolution nside
+inline long long healpix_vec2pix_ring(int nside, const double * v) {
+    const double twothird = 2.0 / 3.0;
+    const double r = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    const double z = r > 0.0 ? v[2] / r : 1.0;
+    const double za = std::fabs(z);
+    double phi = std::atan2(v[1], v[0]);
+    if (phi < 0.0)
+        phi += 2.0 * M_PI;
+    double tt = phi / (0.5 * M_PI);
+    if (tt >= 4.0)
+        tt -= 4.0;
+
+    const long long ns = nside;
+    if (za <= twothird) {
+        const double temp1 = ns * (0.5 + tt);
+        const double temp2 = ns * z * 0.75;
+        const long long jp = (long long)(temp1 - temp2);
+        const long long jm = (long long)(temp1 + temp2);
+        const long long ir = ns + 1 + jp - jm;
+        const long long kshift = 1 - (ir & 1);
+        const long long ip = ((jp + jm - ns + kshift + 1) / 2) % (4 * ns);
+        return 2 * ns * (ns - 1) + (ir - 1) * 4 * ns + ip;
+    }
+    const double tp = tt - (long long)(tt);
+    const double tmp = ns * std::sqrt(3.0 * (1.0 - za));
+    const long long jp = (long long)(tp * tmp);
+    const long long jm = (long long)((1.0 - tp) * tmp);
+    const long long ir = jp + jm + 1;
+    const long long ip = (long long)(tt * ir) % (4 * ir);
+    return z > 0.0 ? 2 * ir * (ir - 1) + ip : 12 * ns * ns - 2 * ir * (ir + 1) + ip;
+}
+
+template <int NDIM, class T>
+void Lightcone<NDIM, T>::read_parameters(FML::UTILS::ParameterMap & param) {
+    lightcone = param.get<bool>("lightcone", false);
+    if (not lightcone)
+        return;
+
+    boxsize = param.get<double>("simulation_boxsize");
+    cola = param.get<bool>("simulation_use_cola");
+    auto output_folder = param.get<std::string>("output_folder");
+    folder = output_folder + (output_folder == "" ? "" : "/") + "lightcone_" +
+             param.get<std::string>("simulation_name");
+
+    auto origins_mpch = param.get<std::vector<double>>("lightcone_origin_mpch");
+    FML::assert_mpi(origins_mpch.size() > 0 and origins_mpch.size() % NDIM == 0,
+                    "lightcone_origin_mpch must contain NDIM numbers per observer");
+    origins.clear();
+    for (size_t i = 0; i < origins_mpch.size(); i += NDIM) {
+        Point o;
+        for (int idim = 0; idim < NDIM; idim++)
+            o[idim] = origins_mpch[i + idim] / boxsize;
+        origins.push_back(o);
+    }
+    zmin = param.get<double>("lightcone_zmin");
+    zmax = param.get<double>("lightcone_zmax");
+    replicate = param.get<bool>("lightcone_replicate");
+    buffer = param.get<double>("lightcone_buffer_mpch") / boxsize;
+    healpix_nside = param.get<int>("lightcone_healpix_nside");
+    output_particles = param.get<bool>("lightcone_output_particles");
+    FML::assert_mpi(zmax > zmin, "lightcone_zmax must be larger than lightcone_zmin");
+    FML::assert_mpi(healpix_nside == 0 or NDIM == 3, "HEALPix maps of the lightcone is only availiable for NDIM = 3");
+
+    if (FML::ThisTask == 0) {
+        std::cout << "lightcone                                : " << lightcone << "\n";
+        std::cout << "lightcone_origin_mpch                    : ";
+        for (auto & x : origins_mpch)
+            std::cout << x << " ";
+        std::cout << "\n";
+        std::cout << "lightcone_zmin                           : " << zmin << "\n";
+        std::cout << "lightcone_zmax                           : " << zmax << "\n";
+        std::cout << "lightcone_replicate                      : " << replicate << "\n";
+        std::cout << "lightcone_buffer_mpch                    : " << buffer * boxsize << "\n";
+        std::cout << "lightcone_healpix_nside                  : " << healpix_nside << "\n";
+        std::cout << "lightcone_output_particles               : " << output_particles << "\n";
+    }
+}
+
+template <int NDIM, class T>
+void Lightcone<NDIM, T>::init(std::shared_ptr<Cosmology> cosmo, double aini) {
+    if (not lightcone)
+        return;
+
+    if (not FML::create_folder(folder)) {
+        throw std::runtime_error("Failed to create lightcone folder [" + folder + "]");
+    }
+
+    //=============================================================
+    // Comoving distance in units of the box: chi(a) = c/H0 int_a^1 da / (a^2 H/H0)
+    //=============================================================
+    FML::UTILS::ConstantsAndUnits u;
+    const double c_over_H0Box = u.c / u.H0_over_h / u.Mpc / boxsize;
+    const int npts = 1000;
+    const double amin = std::min(aini, 1.0 / (1.0 + zmax)) * 0.99;
+    FML::INTERPOLATION::SPLINE::DVector a_arr(npts);
+    for (int i = 0; i < npts; i++)
+        a_arr[i] = 1.0 - (1.0 - amin) * i / double(npts - 1);
+    FML::SOLVERS::ODESOLVER::ODEFunction deriv = [&](double a, [[maybe_unused]] const double * chi, double * dchida) {
+        dchida[0] = -c_over_H0Box / (a * a * cosmo->HoverH0_of_a(a));
+        return GSL_SUCCESS;
+    };
+    FML::INTERPOLATION::SPLINE::DVector chiini{0.0};
+    FML::SOLVERS::ODESOLVER::ODESolver ode;
+    ode.solve(deriv, a_arr, chiini);
+    auto chi_arr = ode.get_data_by_component(0);
+    std::reverse(a_arr.begin(), a_arr.end());
+    std::reverse(chi_arr.begin(), chi_arr.end());
+    chi_of_a_spline.create(a_arr, chi_arr, "chi(a)");
+
+    //=============================================================
+    // All the copies of the box that are (partly) within chi_max of an observer
+    //=============================================================
+    replicas.clear();
+    if (replicate) {
+        const int nrep = int(std::ceil(chi_max() + buffer)) + 1;
+        int ntot = 1;
+        for (int idim = 0; idim < NDIM; idim++)
+            ntot *= 2 * nrep + 1;
+        for (int i = 0; i < ntot; i++) {
+            Replica n;
+            for (int idim = 0, j = i; idim < NDIM; idim++, j /= (2 * nrep + 1))
+                n[idim] = j % (2 * nrep + 1) - nrep;
+            replicas.push_back(n);
+        }
+    } else {
+        replicas.push_back(Replica{});
+    }
+
+    if (FML::ThisTask == 0 and cola and not cola_lpt_velocity_factors) {
+        std::cout << "Warning: [Lightcone] simulation_use_cola = true, but we don't have the LPT velocity so the "
+                     "lightcone velocities are in the COLA frame (vel_in_cola_frame = 1 in the files) and are NOT the "
+                     "true velocities\n";
+    }
+
+    if (FML::ThisTask == 0) {
+        std::cout << "Lightcone from z = " << zmin << " (chi = " << chi_min() * boxsize << " Mpc/h) to z = " << zmax
+                  << " (chi = " << chi_max() * boxsize << " Mpc/h) with " << origins.size() << " observer(s)\n";
+    }
+}
+
+template <int NDIM, class T>
+void Lightcone<NDIM, T>::begin_drift(FML::PARTICLE::MPIParticles<T> & part, double _aold, double _anew) {
+    active = false;
+    candidates.clear();
+    candidates_pos.clear();
+    if (not lightcone or _anew <= _aold)
+        return;
+    aold = _aold;
+    anew = _anew;
+
+    istep++;
+
+    // The part of the lightcone we pass this step (plus the buffer)
+    double chi_hi = std::min(chi_of_a(aold), chi_max());
+    double chi_lo = std::max(chi_of_a(anew), chi_min());
+    if (chi_lo > chi_hi)
+        return;
+    chi_hi += buffer;
+    chi_lo = std::max(chi_lo - buffer, 0.0);
+    active = true;
+
+    // The replicas that overlap with the shell for each observer
+    step_replicas.assign(origins.size(), {});
+    for (size_t iobs = 0; iobs < origins.size(); iobs++) {
+        for (auto & n : replicas) {
+            double dmin2 = 0.0, dmax2 = 0.0;
+            for (int idim = 0; idim < NDIM; idim++) {
+                const double left = n[idim] - origins[iobs][idim];
+                const double right = left + 1.0;
+                const double dmin = std::max(0.0, std::max(left, -right));
+                const double dmax = std::max(std::fabs(left), std::fabs(right));
+                dmin2 += dmin * dmin;
+                dmax2 += dmax * dmax;
+            }
+            if (dmin2 <= chi_hi * chi_hi and dmax2 >= chi_lo * chi_lo)
+                step_replicas[iobs].push_back(n);
+        }
+    }
+
+    // Find the particles that are close to the shell and store their positions
+    auto is_candidate = [&](const Point & x) {
+        for (size_t iobs = 0; iobs < origins.size(); iobs++) {
+            for (auto & n : step_replicas[iobs]) {
+                double r2 = 0.0;
+                for (int idim = 0; idim < NDIM; idim++) {
+                    const double dx = x[idim] + n[idim] - origins[iobs][idim];
+                    r2 += dx * dx;
+                }
+                if (r2 >= chi_lo * chi_lo and r2 <= chi_hi * chi_hi)
+                    return true;
+            }
+        }
+        return false;
+    };
+
+    const size_t NumPart = part.get_npart();
+    const int nthreads = FML::NThreads;
+    std::vector<std::vector<size_t>> candidates_thread(nthreads);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int id = 0; id < nthreads; id++) {
+        const size_t istart = NumPart * id / nthreads;
+        const size_t iend = NumPart * (id + 1) / nthreads;
+        for (size_t i = istart; i < iend; i++) {
+            auto * pos = FML::PARTICLE::GetPos(part[i]);
+            Point x;
+            for (int idim = 0; idim < NDIM; idim++)
+                x[idim] = pos[idim];
+            if (is_candidate(x))
+                candidates_thread[id].push_back(i);
+        }
+    }
+    for (auto & c : candidates_thread)
+        candidates.insert(candidates.end(), c.begin(), c.end());
+
+    candidates_pos.resize(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        auto * pos = FML::PARTICLE::GetPos(part[candidates[i]]);
+        for (int idim = 0; idim < NDIM; idim++)
+            candidates_pos[i][idim] = pos[idim];
+    }
+}
+
+template <int NDIM, class T>
+void Lightcone<NDIM, T>::end_drift(FML::PARTICLE::MPIParticles<T> & part) {
+    if (not lightcone or not active)
+        return;
+
+    const double chiold = chi_of_a(aold);
+    const double chinew = chi_of_a(anew);
+    const double alc_min = 1.0 / (1.0 + zmax);
+    const double alc_max = 1.0 / (1.0 + zmin);
+    constexpr int nfloats = 2 * NDIM + 1;
+    const long long npix = 12 * (long long)(healpix_nside) * (long long)(healpix_nside);
+
+    // For COLA we add on the LPT velocity at the crossing. The factors are smooth in a so we interpolate them
+    // linearly over the step
+    const bool add_lpt_velocity = cola and bool(cola_lpt_velocity_factors);
+    const int vel_in_cola_frame = cola and not add_lpt_velocity ? 1 : 0;
+    std::array<double, 4> fac_vel_old{}, fac_vel_new{};
+    if (add_lpt_velocity) {
+        fac_vel_old = cola_lpt_velocity_factors(aold);
+        fac_vel_new = cola_lpt_velocity_factors(anew);
+    }
+    auto velocity_at_crossing = [&](T & p, double alpha) {
+        auto * vel = FML::PARTICLE::GetVel(p);
+        Point v;
+        for (int idim = 0; idim < NDIM; idim++)
+            v[idim] = vel[idim];
+        if (not add_lpt_velocity)
+            return v;
+        std::array<double, 4> fac;
+        for (int n = 0; n < 4; n++)
+            fac[n] = fac_vel_old[n] + alpha * (fac_vel_new[n] - fac_vel_old[n]);
+        auto add_on = [&](const auto * D, double f) {
+            for (int idim = 0; idim < NDIM; idim++)
+                v[idim] += D[idim] * f;
+        };
+        if constexpr (FML::PARTICLE::has_get_D_1LPT<T>())
+            add_on(FML::PARTICLE::GetD_1LPT(p), fac[0]);
+        if constexpr (FML::PARTICLE::has_get_D_2LPT<T>())
+            add_on(FML::PARTICLE::GetD_2LPT(p), fac[1]);
+        if constexpr (FML::PARTICLE::has_get_D_3LPTa<T>())
+            add_on(FML::PARTICLE::GetD_3LPTa(p), fac[2]);
+        if constexpr (FML::PARTICLE::has_get_D_3LPTb<T>())
+            add_on(FML::PARTICLE::GetD_3LPTb(p), fac[3]);
+        return v;
+    };
+
+    for (size_t iobs = 0; iobs < origins.size(); iobs++) {
+        const auto & o = origins[iobs];
+        std::vector<float> crossed;
+        std::vector<double> healpix_map(npix, 0.0);
+
+        for (size_t i = 0; i < candidates.size(); i++) {
+            auto & p = part[candidates[i]];
+            auto * pos = FML::PARTICLE::GetPos(p);
+
+            // The displacement this step (the particle might have been wrapped around the box)
+            const Point & xold = candidates_pos[i];
+            Point dx;
+            for (int idim = 0; idim < NDIM; idim++) {
+                dx[idim] = pos[idim] - xold[idim];
+                if (dx[idim] > 0.5)
+                    dx[idim] -= 1.0;
+                if (dx[idim] < -0.5)
+                    dx[idim] += 1.0;
+            }
+
+            for (auto & n : step_replicas[iobs]) {
+                double rold2 = 0.0, rnew2 = 0.0;
+                for (int idim = 0; idim < NDIM; idim++) {
+                    const double d = xold[idim] + n[idim] - o[idim];
+                    rold2 += d * d;
+                    rnew2 += (d + dx[idim]) * (d + dx[idim]);
+                }
+                const double fold = std::sqrt(rold2) - chiold;
+                const double fnew = std::sqrt(rnew2) - chinew;
+                if (not(fold < 0.0 and fnew >= 0.0))
+                    continue;
+
+                // Interpolate to the crossing
+                const double alpha = fold / (fold - fnew);
+                const double across = aold + alpha * (anew - aold);
+                if (across < alc_min or across > alc_max)
+                    continue;
+
+                Point r;
+                for (int idim = 0; idim < NDIM; idim++)
+                    r[idim] = xold[idim] + alpha * dx[idim] + n[idim] - o[idim];
+
+                if (output_particles) {
+                    const double vel_norm = 100.0 * boxsize / across;
+                    const Point v = velocity_at_crossing(p, alpha);
+                    for (int idim = 0; idim < NDIM; idim++)
+                        crossed.push_back(float(r[idim] * boxsize));
+                    for (int idim = 0; idim < NDIM; idim++)
+                        crossed.push_back(float(v[idim] * vel_norm));
+                    crossed.push_back(float(across));
+                }
+                if constexpr (NDIM == 3) {
+                    if (healpix_nside > 0)
+                        healpix_map[healpix_vec2pix_ring(healpix_nside, r.data())] += 1.0;
+                }
+            }
+        }
+
+        std::string stepobs = "obs" + std::to_string(iobs) + "_step" + std::to_string(istep);
+
+        // Output the particles
+        if (output_particles) {
+            std::string filename = folder + "/lightcone_" + stepobs + "." + std::to_string(FML::ThisTask);
+            std::ofstream fp(filename.c_str(), std::ios::binary | std::ios::out);
+            if (not fp.is_open())
+                throw std::runtime_error("[Lightcone::end_drift] Failed to open " + filename);
+            int ndim = NDIM;
+            int nfl = nfloats;
+            long long npart = crossed.size() / nfloats;
+            fp.write((char *)&ndim, sizeof(ndim));
+            fp.write((char *)&nfl, sizeof(nfl));
+            fp.write((char *)&npart, sizeof(npart));
+            fp.write((char *)&aold, sizeof(aold));
+            fp.write((char *)&anew, sizeof(anew));
+            fp.write((char *)&boxsize, sizeof(boxsize));
+            fp.write((char *)&vel_in_cola_frame, sizeof(vel_in_cola_frame));
+            fp.write((char *)crossed.data(), sizeof(float) * crossed.size());
+
+            FML::SumOverTasks(&npart);
+            if (FML::ThisTask == 0) {
+                std::cout << "Lightcone observer " << iobs << " found " << npart << " particles in the shell z = "
+                          << 1.0 / aold - 1.0 << " -> " << 1.0 / anew - 1.0 << "\n";
+            }
+        }
+
+        // Output the HEALPix map
+        if (healpix_nside > 0) {
+            FML::SumArrayOverTasks(healpix_map.data(), int(npix));
+            if (FML::ThisTask == 0) {
+                std::string filename = folder + "/healpix_" + stepobs;
+                std::ofstream fp(filename.c_str(), std::ios::binary | std::ios::out);
+                if (not fp.is_open())
+                    throw std::runtime_error("[Lightcone::end_drift] Failed to open " + filename);
+                const double chi_lo = std::max(chinew, chi_min()) * boxsize;
+                const double chi_hi = std::min(chiold, chi_max()) * boxsize;
+                std::vector<float> map(healpix_map.begin(), healpix_map.end());
+                fp.write((char *)&healpix_nside, sizeof(healpix_nside));
+                fp.write((char *)&aold, sizeof(aold));
+                fp.write((char *)&anew, sizeof(anew));
+                fp.write((char *)&chi_lo, sizeof(chi_lo));
+                fp.write((char *)&chi_hi, sizeof(chi_hi));
+                fp.write((char *)map.data(), sizeof(float) * map.size());
+            }
+        }
+    }
+
+    candidates.clear();
+    candidates.shrink_to_fit();
+    candidates_pos.clear();
+    candidates_pos.shrink_to_fit();
+    active = false;
+}
+
+#endif
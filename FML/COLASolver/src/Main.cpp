@@ -40,7 +40,8 @@ using ParameterMap = FML::UTILS::ParameterMap;
 // types so if you for example want to save memory you can change to floats
 // or comment out fields if you, say, don't want scaledependent COLA
 //
-// See src/ExampleParticles.h for more examples
+// See src/ExampleParticles.h for more examples (CompactParticleScaledependentCOLA_2LPT
+// is the one with the smallest memory footprint for big runs)
 // See FML/ParticleTypes/ReflectOnParticleMethods.h for standard methods
 //=============================================================
 
@@ -77,6 +78,9 @@ class Particle {
     //=============================================================
     double q[NDIM];
     double * get_q() { return q; }
+    // If we make the ICs ourselves then we can instead compute q from the ID
+    // (the index of the particle in the initial grid) and save the memory:
+    // long long int get_lagrangian_id() const { return id; }
 
     //=============================================================
     // 1LPT displacement field Psi (needed if you want >= 1LPT COLA)
@@ -99,22 +103,15 @@ class Particle {
     // float * get_D_3LPTb() { return Psi_3LPTb; }
 };
 
-int main(int argc, char ** argv) {
-    if (argc == 1) {
-        std::cout << "Missing parameterfile. Run as: ./code input.lua\n";
-        return 0;
-    }
-
-    //=============================================================
-    // Show info about the particle we are using
-    //=============================================================
-    FML::PARTICLE::info<Particle>();
+//=============================================================
+// Run the simulation described by one parameterfile
+//=============================================================
+void run_simulation(std::string filename) {
 
     //=============================================================
     // Parse the parameterfile
     //=============================================================
     ParameterMap param;
-    std::string filename = std::string(argv[1]);
     read_parameterfile(param, filename);
     if (FML::ThisTask == 0)
         param.info();
@@ -172,3 +169,34 @@ int main(int argc, char ** argv) {
     sim.run();
 }
 
+int main(int argc, char ** argv) {
+    if (argc == 1) {
+        std::cout << "Missing parameterfile. Run as: ./code input.lua [input2.lua ...]\n";
+        return 0;
+    }
+
+    //=============================================================
+    // Show info about the particle we are using
+    //=============================================================
+    FML::PARTICLE::info<Particle>();
+
+    //=============================================================
+    // Batch mode: with more than one parameterfile we run them one after another in the same job. A
+    // parameterfile can do dofile("base.lua") and then change the parameters it wants to vary.
+    // The runs share the MPI setup, the FFTW plans (and wisdom), the grids in the FFTWGridPool (if
+    // simulation_reuse_grids) and the transfer data if the same files and cosmology is used
+    //=============================================================
+    const int nruns = argc - 1;
+    GravityModel<NDIM>::set_reuse_transferdata(nruns > 1);
+    for (int irun = 0; irun < nruns; irun++) {
+        std::string filename = std::string(argv[irun + 1]);
+        if (FML::ThisTask == 0 and nruns > 1) {
+            std::cout << "\n";
+            std::cout << "#=====================================================\n";
+            std::cout << "# Batch run " << irun + 1 << " / " << nruns << " : " << filename << "\n";
+            std::cout << "#=====================================================\n";
+        }
+        run_simulation(filename);
+    }
+    GravityModel<NDIM>::set_reuse_transferdata(false);
+}
@@ -31,6 +31,15 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
     //=============================================================
     param["simulation_use_cola"] = lfp.read_bool("simulation_use_cola", false, OPTIONAL);
     param["simulation_use_scaledependent_cola"] = lfp.read_bool("simulation_use_scaledependent_cola", true, OPTIONAL);
+    param["simulation_fused_scaledependent_cola"] =
+        lfp.read_bool("simulation_fused_scaledependent_cola", false, OPTIONAL);
+    param["simulation_reuse_grids"] = lfp.read_bool("simulation_reuse_grids", false, OPTIONAL);
+    param["simulation_sort_particles_every_nsteps"] =
+        lfp.read_int("simulation_sort_particles_every_nsteps", 0, OPTIONAL);
+    param["simulation_analyze_in_background"] = lfp.read_bool("simulation_analyze_in_background", false, OPTIONAL);
+    param["simulation_lpt_gridmode"] = lfp.read_bool("simulation_lpt_gridmode", false, OPTIONAL);
+    param["simulation_lpt_gridmode_nchunks"] = lfp.read_int("simulation_lpt_gridmode_nchunks", 16, OPTIONAL);
+    param["simulation_offload_pm_step"] = lfp.read_bool("simulation_offload_pm_step", false, OPTIONAL);
 
     //=============================================================
     // Cosmology options
@@ -72,6 +81,7 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
     // Gravity model
     //=============================================================
     param["gravity_model"] = lfp.read_string("gravity_model", "GR", OPTIONAL);
+    param["gravity_model_growth_lowrank"] = lfp.read_bool("gravity_model_growth_lowrank", false, OPTIONAL);
 
     if (param.get<std::string>("gravity_model") != "GR") {
         
@@ -97,6 +107,10 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
                     lfp.read_double("gravity_model_screening_linear_scale_hmpc", 0.05, OPTIONAL);
                 param["gravity_model_screening_efficiency"] =
                     lfp.read_double("gravity_model_screening_efficiency", 1.0, OPTIONAL);
+                param["gravity_model_screening_smoothing_filter"] =
+                    lfp.read_string("gravity_model_screening_smoothing_filter", "gaussian", OPTIONAL);
+                param["gravity_model_screening_smoothing_scale_over_boxsize"] =
+                    lfp.read_double("gravity_model_screening_smoothing_scale_over_boxsize", 0.0, OPTIONAL);
             }
         }
 
@@ -116,6 +130,10 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
                     lfp.read_double("gravity_model_screening_linear_scale_hmpc", 0.05, OPTIONAL);
                 param["gravity_model_screening_efficiency"] =
                     lfp.read_double("gravity_model_screening_efficiency", 1.0, OPTIONAL);
+                param["gravity_model_screening_smoothing_filter"] =
+                    lfp.read_string("gravity_model_screening_smoothing_filter", "gaussian", OPTIONAL);
+                param["gravity_model_screening_smoothing_scale_over_boxsize"] =
+                    lfp.read_double("gravity_model_screening_smoothing_scale_over_boxsize", 0.0, OPTIONAL);
             }
 
             // Solving the exact equation
@@ -126,6 +144,10 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
                 param["multigrid_nsweeps_first_step"] = lfp.read_int("multigrid_nsweeps_first_step", 20, OPTIONAL);
                 param["multigrid_solver_residual_convergence"] =
                     lfp.read_double("multigrid_solver_residual_convergence", 1e-6, OPTIONAL);
+                param["multigrid_warm_start"] = lfp.read_bool("multigrid_warm_start", true, OPTIONAL);
+                param["multigrid_cycle_type"] = lfp.read_string("multigrid_cycle_type", "V", OPTIONAL);
+                param["multigrid_fmg"] = lfp.read_bool("multigrid_fmg", false, OPTIONAL);
+                param["multigrid_offload"] = lfp.read_bool("multigrid_offload", false, OPTIONAL);
             }
         }
 
@@ -145,6 +167,12 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
                     lfp.read_bool("gravity_model_screening_enforce_largescale_linear", false, OPTIONAL);
                 param["gravity_model_screening_linear_scale_hmpc"] =
                     lfp.read_double("gravity_model_screening_linear_scale_hmpc", 0.05, OPTIONAL);
+                param["gravity_model_screening_efficiency"] =
+                    lfp.read_double("gravity_model_screening_efficiency", 1.0, OPTIONAL);
+                param["gravity_model_screening_smoothing_filter"] =
+                    lfp.read_string("gravity_model_screening_smoothing_filter", "gaussian", OPTIONAL);
+                param["gravity_model_screening_smoothing_scale_over_boxsize"] =
+                    lfp.read_double("gravity_model_screening_smoothing_scale_over_boxsize", 0.0, OPTIONAL);
             }
 
             // Solving the exact equation
@@ -155,6 +183,10 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
                 param["multigrid_nsweeps_first_step"] = lfp.read_int("multigrid_nsweeps_first_step", 20, OPTIONAL);
                 param["multigrid_solver_residual_convergence"] =
                     lfp.read_double("multigrid_solver_residual_convergence", 1e-6, OPTIONAL);
+                param["multigrid_warm_start"] = lfp.read_bool("multigrid_warm_start", true, OPTIONAL);
+                param["multigrid_cycle_type"] = lfp.read_string("multigrid_cycle_type", "V", OPTIONAL);
+                param["multigrid_fmg"] = lfp.read_bool("multigrid_fmg", false, OPTIONAL);
+                param["multigrid_offload"] = lfp.read_bool("multigrid_offload", false, OPTIONAL);
             }
         }
 
@@ -224,9 +256,16 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
     param["ic_type_of_input"] = lfp.read_string("ic_type_of_input", "powerspectrum", REQUIRED);
     param["ic_type_of_input_fileformat"] = lfp.read_string("ic_type_of_input_fileformat", "CAMB", OPTIONAL);
     param["ic_input_filename"] = lfp.read_string("ic_input_filename", "", REQUIRED);
+    param["ic_transferdata_cache_folder"] = lfp.read_string("ic_transferdata_cache_folder", "", OPTIONAL);
+    param["ic_transferdata_lazy_loading"] = lfp.read_bool("ic_transferdata_lazy_loading", false, OPTIONAL);
+    param["ic_transferdata_prefetch"] = lfp.read_bool("ic_transferdata_prefetch", false, OPTIONAL);
     param["ic_input_redshift"] = lfp.read_double("ic_input_redshift", 0.0, REQUIRED);
     param["ic_fix_amplitude"] = lfp.read_bool("ic_fix_amplitude", true, OPTIONAL);
     param["ic_reverse_phases"] = lfp.read_bool("ic_reverse_phases", false, OPTIONAL);
+    param["ic_ensemble_nseeds"] = lfp.read_int("ic_ensemble_nseeds", 1, OPTIONAL);
+    param["ic_ensemble_paired"] = lfp.read_bool("ic_ensemble_paired", false, OPTIONAL);
+    param["ic_stream_to_file"] = lfp.read_bool("ic_stream_to_file", false, OPTIONAL);
+    param["ic_stream_nchunks"] = lfp.read_int("ic_stream_nchunks", 16, OPTIONAL);
     param["ic_random_field_type"] = lfp.read_string("ic_random_field_type", "gaussian", OPTIONAL);
     param["ic_LPT_order"] = lfp.read_int("ic_LPT_order", 2, OPTIONAL);
     param["ic_sigma8_normalization"] = lfp.read_bool("ic_sigma8_normalization", false, OPTIONAL);
@@ -264,6 +303,14 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
     param["force_greens_function_kernel"] = lfp.read_string("force_greens_function_kernel", "fiducial", OPTIONAL);
     param["force_gradient_kernel"] = lfp.read_string("force_gradient_kernel", "fiducial", OPTIONAL);
     param["force_linear_massive_neutrinos"] = lfp.read_bool("force_linear_massive_neutrinos", false, OPTIONAL);
+    param["force_zoom"] = lfp.read_bool("force_zoom", false, OPTIONAL);
+    if (param.get<bool>("force_zoom")) {
+        param["force_zoom_region_corner"] = lfp.read_number_array<double>("force_zoom_region_corner", {}, REQUIRED);
+        param["force_zoom_region_size"] = lfp.read_double("force_zoom_region_size", 0.0, REQUIRED);
+        param["force_zoom_nmesh"] = lfp.read_int("force_zoom_nmesh", 0, REQUIRED);
+        param["force_zoom_split_in_cells"] = lfp.read_double("force_zoom_split_in_cells", 1.25, OPTIONAL);
+        param["force_zoom_cutoff_over_split"] = lfp.read_double("force_zoom_cutoff_over_split", 4.5, OPTIONAL);
+    }
 
     // Experimental option
     param["force_use_finite_difference_force"] = lfp.read_bool("force_use_finite_difference_force", false, lfp.optional);
@@ -276,6 +323,38 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
     param["output_redshifts"] = lfp.read_number_array<double>("output_redshifts", {}, REQUIRED);
     param["output_particles"] = lfp.read_bool("output_particles", true, OPTIONAL);
     param["output_fileformat"] = lfp.read_string("output_fileformat", "GADGET", OPTIONAL);
+    param["output_nfiles"] = lfp.read_int("output_nfiles", 0, OPTIONAL);
+    param["output_write_in_background"] = lfp.read_bool("output_write_in_background", false, OPTIONAL);
+    param["output_async_write"] = lfp.read_bool("output_async_write", false, OPTIONAL);
+    param["output_performance_report"] = lfp.read_bool("output_performance_report", false, OPTIONAL);
+    param["output_subsample_fraction"] = lfp.read_double("output_subsample_fraction", 1.0, OPTIONAL);
+    param["output_grids_nmesh"] = lfp.read_int("output_grids_nmesh", 0, OPTIONAL);
+    if (param.get<int>("output_grids_nmesh") > 0)
+        param["output_grids_density_assignment_method"] =
+            lfp.read_string("output_grids_density_assignment_method", "CIC", OPTIONAL);
+    param["output_compressed_nbits"] = lfp.read_int("output_compressed_nbits", 16, OPTIONAL);
+    param["output_hdf5_compression_level"] = lfp.read_int("output_hdf5_compression_level", 4, OPTIONAL);
+
+    //=============================================================
+    // Checkpointing
+    //=============================================================
+    param["checkpoint_every_nsteps"] = lfp.read_int("checkpoint_every_nsteps", 0, OPTIONAL);
+    param["checkpoint_folder"] = lfp.read_string("checkpoint_folder", "", OPTIONAL);
+    param["restart_from_checkpoint"] = lfp.read_bool("restart_from_checkpoint", false, OPTIONAL);
+
+    //=============================================================
+    // Lightcone
+    //=============================================================
+    param["lightcone"] = lfp.read_bool("lightcone", false, OPTIONAL);
+    if (param.get<bool>("lightcone")) {
+        param["lightcone_origin_mpch"] = lfp.read_number_array<double>("lightcone_origin_mpch", {}, REQUIRED);
+        param["lightcone_zmin"] = lfp.read_double("lightcone_zmin", 0.0, OPTIONAL);
+        param["lightcone_zmax"] = lfp.read_double("lightcone_zmax", 0.0, REQUIRED);
+        param["lightcone_replicate"] = lfp.read_bool("lightcone_replicate", true, OPTIONAL);
+        param["lightcone_buffer_mpch"] = lfp.read_double("lightcone_buffer_mpch", 10.0, OPTIONAL);
+        param["lightcone_healpix_nside"] = lfp.read_int("lightcone_healpix_nside", 0, OPTIONAL);
+        param["lightcone_output_particles"] = lfp.read_bool("lightcone_output_particles", true, OPTIONAL);
+    }
 
     //=============================================================
     // Halofinding
@@ -286,6 +365,8 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
         param["fof_linking_length"] = lfp.read_double("fof_linking_length", 0.2, OPTIONAL);
         param["fof_nmesh_max"] = lfp.read_int("fof_nmesh_max", 0, OPTIONAL);
         param["fof_buffer_length_mpch"] = lfp.read_double("fof_buffer_length_mpch", 3.0, OPTIONAL);
+        param["fof_onthefly_every_nsteps"] = lfp.read_int("fof_onthefly_every_nsteps", 0, OPTIONAL);
+        param["fof_onthefly_output_ids"] = lfp.read_bool("fof_onthefly_output_ids", true, OPTIONAL);
     }
 
     //=============================================================
@@ -324,6 +405,7 @@ void read_parameterfile(ParameterMap & param, std::string filename) {
             lfp.read_string("bispectrum_density_assignment_method", "CIC", OPTIONAL);
         param["bispectrum_interlacing"] = lfp.read_bool("bispectrum_interlacing", true, OPTIONAL);
         param["bispectrum_subtract_shotnoise"] = lfp.read_bool("bispectrum_subtract_shotnoise", false, OPTIONAL);
+        param["bispectrum_max_memory_in_mb"] = lfp.read_double("bispectrum_max_memory_in_mb", 0.0, OPTIONAL);
     }
 }
 #endif
@@ -4,6 +4,7 @@
 #include <FML/CAMBUtils/CAMBReader.h>
 #include <FML/ComputePowerSpectra/ComputePowerSpectrum.h>
 #include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/FFTWGrid/FFTWGridPool.h>
 #include <FML/FileUtils/FileUtils.h>
 #include <FML/GadgetUtils/GadgetUtils.h>
 #include <FML/Global/Global.h>
@@ -21,13 +22,19 @@
 #include "COLA.h"
 #include "Cosmology.h"
 #include "GravityModel.h"
+#include "Lightcone.h"
 
 #include <array>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -36,6 +43,7 @@
 //=============================================================================
 using RandomGenerator = FML::RANDOM::RandomGenerator;
 using GSLRandomGenerator = FML::RANDOM::GSLRandomGenerator;
+using PhiloxRandomGenerator = FML::RANDOM::PhiloxRandomGenerator;
 using DVector = FML::INTERPOLATION::SPLINE::DVector;
 using Spline = FML::INTERPOLATION::SPLINE::Spline;
 using ODESolver = FML::SOLVERS::ODESOLVER::ODESolver;
@@ -49,6 +57,8 @@ using GadgetReader = FML::FILEUTILS::GADGET::GadgetReader;
 using LinearTransferData = FML::FILEUTILS::LinearTransferData;
 template <int N>
 using PowerSpectrumBinning = FML::CORRELATIONFUNCTIONS::PowerSpectrumBinning<N>;
+template <int N>
+using DensityFourierObserver = std::function<void(const FFTWGrid<N> & density_grid_fourier, double a)>;
 
 template <int NDIM, class T>
 class NBodySimulation {
@@ -88,6 +98,14 @@ class NBodySimulation {
     //=============================================================================
     FFTWGrid<NDIM> initial_density_field_fourier;
 
+    //=============================================================================
+    /// T_mnu(k,a) / T_cb(k,aini) tabulated in kBox for the scalefactor (and force grid) it was last
+    /// made for. Used to add linear massive neutrinos to the density field
+    //=============================================================================
+    UniformKTable<1> neutrino_transfer_ratio_table;
+    double neutrino_transfer_ratio_table_a{-1.0};
+    int neutrino_transfer_ratio_table_nmesh{0};
+
     //=============================================================================
     // LPT potentials NB: these grids will only get allocated if they are required!
     //=============================================================================
@@ -96,6 +114,27 @@ class NBodySimulation {
     FFTWGrid<NDIM> phi_3LPTa_ini_fourier;
     FFTWGrid<NDIM> phi_3LPTb_ini_fourier;
 
+    //=============================================================================
+    // Workspace grids kept between timesteps if simulation_reuse_grids = true so we only allocate
+    // (and first-touch) them once: the density field, the force and the displacement fields used in
+    // scaledependent COLA. If false these are allocated and freed every step
+    //=============================================================================
+    FFTWGrid<NDIM> density_grid_workspace;
+    std::array<FFTWGrid<NDIM>, NDIM> force_grid_workspace;
+    COLAWorkspace<NDIM> cola_grid_workspace;
+
+#ifdef USE_OMP_TARGET
+    //=============================================================================
+    // The particles on the device from the density assignment to the drift if simulation_offload_pm_step
+    //=============================================================================
+    FML::NBODY::DeviceParticles<NDIM> device_particles;
+#endif
+
+    //=============================================================================
+    /// On the fly lightcone (only does something if lightcone = true)
+    //=============================================================================
+    Lightcone<NDIM, T> lightcone;
+
     // Do timings of the code
     FML::UTILS::Timings timer;
 
@@ -108,28 +147,42 @@ class NBodySimulation {
     // Parameters of the simulation
     //=============================================================================
 
-    std::string simulation_name;             // The name of sim used for outputs
-    double simulation_boxsize;               // The boxsize in Mpc/h
-    bool simulation_use_cola;                // Use the cola method?
-    bool simulation_use_scaledependent_cola; // If cola, use cola with scaledependent growth?
+    std::string simulation_name;                // The name of sim used for outputs
+    double simulation_boxsize;                  // The boxsize in Mpc/h
+    bool simulation_use_cola;                   // Use the cola method?
+    bool simulation_use_scaledependent_cola;    // If cola, use cola with scaledependent growth?
+    bool simulation_fused_scaledependent_cola;  // Scaledependent COLA with tabulated growth and batched FFTs?
+    bool simulation_reuse_grids;                // Keep the density and force grids between steps?
+    int simulation_sort_particles_every_nsteps; // Sort particles by cell every n steps (0 = never)
+    bool simulation_analyze_in_background;      // Analyze outputs in a thread while we continue time-stepping?
+    bool simulation_lpt_gridmode;               // Pure LPT from the LPT potentials without storing particles?
+    bool simulation_offload_pm_step;            // Keep the particles on the GPU over the PM step (USE_OMP_TARGET)?
+    int simulation_lpt_gridmode_nchunks;        // The number of chunks of the lattice we go through at the time
 
     // Force and density assignment
     int force_nmesh;                             // The gridsize to bin particles to and compute PM forces
     std::string force_density_assignment_method; // Density assignment (NGP,CIC,TSC,PCS,PQS)
     bool force_linear_massive_neutrinos;         // Include the effects of massive neutrinos using linear theory
+    bool force_zoom;                             // Compute the short range force on a finer grid in a zoom region?
+    std::vector<double> force_zoom_region_corner; // The lower corner of the zoom region (Mpc/h)
+    double force_zoom_region_size;               // The size of the zoom region (Mpc/h)
+    int force_zoom_nmesh;                        // The gridsize of the zoom grid
 
     // Initial conditions
     std::string ic_random_field_type; // gaussian, nongaussian, reconstruct_from_particles, read_particles
     double ic_initial_redshift;       // The initial redshift of the sim
     int ic_nmesh;                     // The Nmesh used to generate the IC (use particle_Npart_1D)
     int ic_random_seed;               // The random seed
-    std::string ic_random_generator;  // The generator: GSL or MT19937 (fiducial)
+    std::string ic_random_generator;  // The generator: GSL, MT19937 (fiducial) or PHILOX
     int ic_LPT_order;                 // The LPT order to use to make IC (1,2,3)
 
     // Initial conditions: input file (power-spectrum / transfer functions)
     std::string ic_type_of_input;  // Type of input (powerspectrum, transferfuntion, transferinfofile)
     std::string ic_type_of_input_fileformat; // Format, CAMB, CLASS (with format=camb), ..., for transfer files 
     std::string ic_input_filename; // The filename
+    std::string ic_transferdata_cache_folder; // Binary cache of the transfer data (empty = no cache)
+    bool ic_transferdata_lazy_loading;        // Read the transfer files for a redshift when first needed
+    bool ic_transferdata_prefetch;            // ... and read the rest in a background thread
     double ic_input_redshift;      // The redshift of P(k,z) / T(k,z) that we read in
     bool ic_use_gravity_model_GR;  // Input power-spectrum is for LCDM so if MG use LCDM to set the IC
 
@@ -137,6 +190,17 @@ class NBodySimulation {
     bool ic_fix_amplitude;  // Fix amplitude of delta(k,zini) to that of P(k)
     bool ic_reverse_phases; // Set delta(k,zini) -> -delta(k,zini)
 
+    // Initial conditions: Ensemble of realizations run one after another
+    int ic_ensemble_nseeds;  // Run the seeds ic_random_seed, ic_random_seed + 1, ... (1 = just one run)
+    bool ic_ensemble_paired; // Also run the reversed phase partner of every seed
+    std::string ensemble_name;    // The simulation_name, ic_random_seed and ic_reverse_phases we were given
+    int ensemble_seed;            // (the members of an ensemble change these)
+    bool ensemble_reverse_phases;
+
+    // Initial conditions: Only make the IC and write them to file a chunk of the lattice at the time
+    bool ic_stream_to_file; // Write the IC to [output_folder]/ic_[simulation_name] and do no time-stepping
+    int ic_stream_nchunks;  // The number of chunks of the lattice we go through at the time
+
     // Initial conditions: Non-gaussianity (ic_random_field_type = nongaussian)
     std::string ic_fnl_type; // local, equilateral, orthogonal
     double ic_fnl;           // fNL
@@ -172,6 +236,9 @@ class NBodySimulation {
     int fof_nmesh_max;             // For speeding it up: the maximum gridsize to bin particle to
     double fof_linking_length;     // The linking length in units of the mean partice separation (i.e. ~0.2)
     double fof_buffer_length_mpch; // The buffer region (from nbor tasks) we use in the FoF finding
+    int fof_onthefly_every_nsteps; // Also locate halos every n time-steps (0 = only at outputs)
+    bool fof_onthefly_output_ids;  // Store the ids of the particles in the on the fly halos (for merger trees)
+    std::string fof_onthefly_catalog; // The on the fly catalog we have started writing to
 
     // Power-spectrum
     bool pofk;                                  // Compute power-spectrum when we output
@@ -195,12 +262,44 @@ class NBodySimulation {
     std::string bispectrum_density_assignment_method; // Density assignment method (NGP, CIC, ...)
     bool bispectrum_interlacing;                      // Use interlacing for alias reduction?
     bool bispectrum_subtract_shotnoise;               // Subtract shotnoise?
+    double bispectrum_max_memory_in_mb;               // Memory budget for the shell grids per task (0 = no limit)
 
     // Output
     std::vector<double> output_redshifts; // List of output redshift from large to small
     bool output_particles;                // Output particles?
-    std::string output_fileformat;        // Fileformat for particles (GADGET)
+    std::string output_fileformat;        // Fileformat for particles (GADGET, FML, COMPRESSED, HDF5)
     std::string output_folder;            // Folder to store output
+    int output_nfiles;                    // Number of particle files (0 = one per task)
+    bool output_write_in_background;      // Write the particle files in a background thread?
+    bool output_async_write;              // Convert and write the GADGET files in chunks with a background I/O thread?
+    bool output_performance_report;       // Write timings and load imbalance for every step to a CSV file?
+    double output_subsample_fraction;     // Only output the particles in this ID based subsample (1 = all)
+    int output_grids_nmesh;               // Output density and velocity grids with this Nmesh (0 = no)
+    std::string output_grids_density_assignment_method; // Density assignment method for the grids
+    int output_compressed_nbits;          // Bits per quantized coordinate for the COMPRESSED fileformat (8 or 16)
+    int output_hdf5_compression_level;    // Deflate level for the HDF5 fileformat (0 = no compression)
+
+    // Checkpointing
+    int checkpoint_every_nsteps;   // Write a checkpoint every n steps (0 = never)
+    std::string checkpoint_folder; // Folder to store the checkpoints in
+    bool restart_from_checkpoint;  // Start from the last checkpoint in checkpoint_folder instead of making IC
+
+    // Where the time-stepping starts (not at the beginning if we restart from a checkpoint)
+    int restart_ioutput{0};
+    int restart_istep{0};
+    int restart_istep_total{0};
+    int restart_nsteps{0};
+
+    // The analysis of the last output if it runs in the background and the copy of the particles it works on
+    std::thread analysis_thread;
+    std::shared_ptr<MPIParticles<T>> analysis_particles;
+
+    // The thread writing the last particle output (if output_write_in_background)
+    std::thread output_thread;
+
+    // The total timings and the time at the last row of the performance report
+    std::vector<double> performance_report_last_times;
+    std::chrono::steady_clock::time_point performance_report_last_wall;
 
     //=============================================================================
     // Some of the stuff we compute and output is small so we also keep it
@@ -214,6 +313,14 @@ class NBodySimulation {
     // A list of (z, P_ell(k)) for the particles that we compute every output if pofk_multipoles = true
     std::vector<std::pair<double, std::vector<PowerSpectrumBinning<NDIM>>>> pofk_multipoles_every_output;
 
+    //=============================================================================
+    /// Observers of the fourier-space density field of the particles (baryons+CDM) we make for the force every
+    /// step. They are called with the grid and the scalefactor right after the fourier transform (before we add
+    /// the neutrinos and the grid is used for the force) so things like P(k) can be computed without assigning
+    /// the particles again. The grid is not deconvolved (it was made with force_density_assignment_method)
+    //=============================================================================
+    std::vector<DensityFourierObserver<NDIM>> density_fourier_observers;
+
   public:
     NBodySimulation() = default;
     NBodySimulation(std::shared_ptr<Cosmology> cosmo, std::shared_ptr<GravityModel<NDIM>> grav)
@@ -240,15 +347,61 @@ class NBodySimulation {
     /// Initialize simulation. Create initial conditions. Make it ready to run
     void init();
 
+    /// Create the initial conditions for the current seed from the power-spectrum made in init
+    void make_initial_conditions();
+
+    /// Make the particles from delta(k,zini) ic_stream_nchunks slabs of the lattice at the time and write them
+    /// to [output_folder]/ic_[simulation_name] (one file per task) as we go (ic_stream_to_file)
+    void write_initial_conditions_streamed(const FFTWGrid<NDIM> & delta_ini_fourier);
+
     /// This method simply read particles and uses them for the simulation
     void read_ic();
     void read_phases(FFTWGrid<NDIM> & delta_fourier);
 
-    /// Run simulation
+    /// Run simulation (all the members one after another if we run an ensemble)
     void run();
 
-    /// From particles to density field
-    void compute_density_field_fourier(FFTWGrid<NDIM> & density_grid_fourier, double a);
+    /// The number of members of the ensemble (1 if we don't run an ensemble)
+    int get_ensemble_nmembers() const { return ic_ensemble_nseeds * (ic_ensemble_paired ? 2 : 1); }
+
+    /// Set the seed, the phase reversal and the name (simulation_name_seed[seed] with _reversed added for the
+    /// reversed partner) of member imember of the ensemble
+    void set_ensemble_member(int imember);
+
+    /// Run the time-stepping for the current initial conditions
+    void run_realization();
+
+    /// Copy the particles back from the device if they are there (simulation_offload_pm_step)
+    void particles_from_device();
+
+    /// From particles to density field. If communicate_particles then the particles have moved and we
+    /// communicate them while assigning the ones that stay on the task
+    void compute_density_field_fourier(FFTWGrid<NDIM> & density_grid_fourier,
+                                       double a,
+                                       bool communicate_particles = false);
+
+    /// Register a function to be called with the fourier-space density field every time we compute it (see
+    /// density_fourier_observers). The P(k) we output for every step is computed this way
+    void add_density_fourier_observer(DensityFourierObserver<NDIM> observer) {
+        density_fourier_observers.push_back(std::move(observer));
+    }
+
+    /// The ratio T_mnu(k,a) / T_cb(k,aini) as function of kBox (up to the corner of a grid with the given nmesh).
+    /// Made once per time-step and shared by the force calculation and the power-spectrum output
+    const UniformKTable<1> & get_neutrino_transfer_ratio_table(double a, int nmesh);
+
+    /// The LPT gridmode particles at the scalefactor a. We go through the Lagrangian lattice slices of this task
+    /// in simulation_lpt_gridmode_nchunks chunks and make the particles of the chunk from the LPT potentials (x = q +
+    /// D1/D1ini Psi1 + D2/D2ini Psi2 and if with_velocities also the LPT velocity). The particles are not
+    /// communicated. process_chunk(chunk, npart_local) is called for every chunk on all tasks where npart_local is
+    /// the number of particles the task makes in total. With velocities we keep 2 x NDIM grids instead of NDIM
+    void for_each_lpt_gridmode_chunk(double a,
+                                     bool with_velocities,
+                                     std::function<void(FML::Vector<T> & chunk, size_t npart_local)> process_chunk);
+
+    /// The LPT density field at the scalefactor a in the LPT gridmode. The particles of every chunk (see
+    /// for_each_lpt_gridmode_chunk) are communicated and added to the grid so we never have all the particles
+    void compute_lpt_gridmode_density_field(FFTWGrid<NDIM> & density, double a, std::string density_assignment_method);
 
     /// Compute stuff on the fly and output
     void analyze_and_output(int ioutput, double redshift);
@@ -261,6 +414,8 @@ class NBodySimulation {
     template <int _NDIM, class _T>
     friend void compute_fof_halos(NBodySimulation<_NDIM, _T> & sim, double redshift, std::string snapshot_folder);
     template <int _NDIM, class _T>
+    friend void compute_fof_halos_on_the_fly(NBodySimulation<_NDIM, _T> & sim, double a, int istep_total);
+    template <int _NDIM, class _T>
     friend void compute_power_spectrum(NBodySimulation<_NDIM, _T> & sim, double redshift, std::string snapshot_folder);
     template <int _NDIM, class _T>
     friend void
@@ -272,10 +427,49 @@ class NBodySimulation {
     template <int _NDIM, class _T>
     friend void output_fml(NBodySimulation<_NDIM, _T> & sim, double redshift, std::string snapshot_folder);
     template <int _NDIM, class _T>
+    friend void output_compressed(NBodySimulation<_NDIM, _T> & sim, double redshift, std::string snapshot_folder);
+    template <int _NDIM, class _T>
+    friend void output_hdf5(NBodySimulation<_NDIM, _T> & sim, double redshift, std::string snapshot_folder);
+    template <int _NDIM, class _T>
+    friend void output_lpt_gridmode_particles(NBodySimulation<_NDIM, _T> & sim,
+                                              double scale_factor,
+                                              std::string filename,
+                                              std::string fileformat);
+    template <int _NDIM, class _T>
+    friend void output_grids(NBodySimulation<_NDIM, _T> & sim, double redshift, std::string snapshot_folder);
+    template <int _NDIM, class _T>
     friend void output_pofk_for_every_step(NBodySimulation<_NDIM, _T> & sim);
 
+    /// Write a checkpoint: the particles and the state we need to continue the time-stepping from step istep
+    /// towards output ioutput. We always keep the last complete checkpoint so it is safe to die while writing
+    void write_checkpoint(int ioutput, int istep, int istep_total);
+
+    /// Read the last checkpoint in checkpoint_folder (instead of making initial conditions)
+    void read_checkpoint();
+
+    // The grids we store in a checkpoint (if they are allocated) and the names we use for the files
+    std::vector<std::pair<FFTWGrid<NDIM> *, std::string>> checkpoint_grids() {
+        return {{&initial_density_field_fourier, "density_ini"},
+                {&phi_1LPT_ini_fourier, "phi_1LPT"},
+                {&phi_2LPT_ini_fourier, "phi_2LPT"},
+                {&phi_3LPTa_ini_fourier, "phi_3LPTa"},
+                {&phi_3LPTb_ini_fourier, "phi_3LPTb"}};
+    }
+
+    /// The particles the analysis and output in AnalyzeOutput.h works on (a copy if done in the background)
+    MPIParticles<T> & particles_to_analyze() { return analysis_particles ? *analysis_particles : part; }
+
+    /// Wait for the analysis and the particle output running in the background (if any) to finish
+    void wait_for_analysis();
+
+    /// Add a row (phase = step or output) to the performance report with the time spent in the different parts
+    /// of the code since the last row (min, max and mean over tasks) and the particle load imbalance
+    void write_performance_report(std::string phase, int ioutput, int istep_total, double a);
+
     // Free all memory
     void free();
+
+    ~NBodySimulation() { wait_for_analysis(); }
 };
 
 template <int NDIM, class T>
@@ -481,12 +675,39 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
     simulation_boxsize = param.get<double>("simulation_boxsize");
     simulation_use_cola = param.get<bool>("simulation_use_cola");
     simulation_use_scaledependent_cola = param.get<bool>("simulation_use_scaledependent_cola");
+    simulation_fused_scaledependent_cola = param.get<bool>("simulation_fused_scaledependent_cola", false);
+    simulation_reuse_grids = param.get<bool>("simulation_reuse_grids", false);
+    simulation_sort_particles_every_nsteps = param.get<int>("simulation_sort_particles_every_nsteps", 0);
+    simulation_analyze_in_background = param.get<bool>("simulation_analyze_in_background", false);
+    simulation_lpt_gridmode = param.get<bool>("simulation_lpt_gridmode", false);
+    simulation_lpt_gridmode_nchunks = param.get<int>("simulation_lpt_gridmode_nchunks", 16);
+    simulation_offload_pm_step = param.get<bool>("simulation_offload_pm_step", false);
+#ifndef USE_OMP_TARGET
+    if (simulation_offload_pm_step and FML::ThisTask == 0)
+        std::cout << "Warning: simulation_offload_pm_step needs USE_OMP_TARGET. Turning it off\n";
+    simulation_offload_pm_step = false;
+#endif
+#ifdef USE_MPI
+    // The analysis does collective MPI calls on MPI_COMM_WORLD so it cannot run alongside the time-stepping
+    if (simulation_analyze_in_background and FML::ThisTask == 0)
+        std::cout << "Warning: simulation_analyze_in_background is not availiable with MPI. Turning it off\n";
+    simulation_analyze_in_background = false;
+#endif
+    FML::GRID::FFTWGridPool<NDIM>::get().set_enabled(simulation_reuse_grids);
 
     if (FML::ThisTask == 0) {
         std::cout << "simulation_name                          : " << simulation_name << "\n";
         std::cout << "simulation_boxsize                       : " << simulation_boxsize << "\n";
         std::cout << "simulation_use_cola                      : " << simulation_use_cola << "\n";
         std::cout << "simulation_use_scaledependent_cola       : " << simulation_use_scaledependent_cola << "\n";
+        std::cout << "simulation_fused_scaledependent_cola     : " << simulation_fused_scaledependent_cola << "\n";
+        std::cout << "simulation_reuse_grids                   : " << simulation_reuse_grids << "\n";
+        std::cout << "simulation_sort_particles_every_nsteps   : " << simulation_sort_particles_every_nsteps << "\n";
+        std::cout << "simulation_analyze_in_background         : " << simulation_analyze_in_background << "\n";
+        std::cout << "simulation_lpt_gridmode                  : " << simulation_lpt_gridmode << "\n";
+        if (simulation_lpt_gridmode)
+            std::cout << "simulation_lpt_gridmode_nchunks          : " << simulation_lpt_gridmode_nchunks << "\n";
+        std::cout << "simulation_offload_pm_step               : " << simulation_offload_pm_step << "\n";
 
         // We cannot use COLA if the particle type is not compatible with it
         if (simulation_use_cola and not FML::PARTICLE::has_get_D_1LPT<T>()) {
@@ -504,18 +725,49 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
     FML::NBODY::set_fiducial_greens_functions_kernel(force_greens_function_kernel);
     FML::NBODY::set_fiducial_gradient_kernel(force_gradient_kernel);
 
+    force_zoom = param.get<bool>("force_zoom", false);
+    if (force_zoom) {
+        force_zoom_region_corner = param.get<std::vector<double>>("force_zoom_region_corner");
+        force_zoom_region_size = param.get<double>("force_zoom_region_size");
+        force_zoom_nmesh = param.get<int>("force_zoom_nmesh");
+        auto force_zoom_split_in_cells = param.get<double>("force_zoom_split_in_cells", 1.25);
+        auto force_zoom_cutoff_over_split = param.get<double>("force_zoom_cutoff_over_split", 4.5);
+        if (force_zoom_region_corner.size() != NDIM)
+            throw std::runtime_error("force_zoom_region_corner must have NDIM values");
+        std::vector<double> corner;
+        for (auto x : force_zoom_region_corner)
+            corner.push_back(x / simulation_boxsize);
+        FML::NBODY::set_fiducial_zoom_region(corner,
+                                             force_zoom_region_size / simulation_boxsize,
+                                             force_zoom_nmesh,
+                                             force_zoom_split_in_cells,
+                                             force_zoom_cutoff_over_split);
+    }
+
     if (FML::ThisTask == 0) {
         std::cout << "force_nmesh                              : " << force_nmesh << "\n";
         std::cout << "force_greens_function_kernel             : " << force_greens_function_kernel << "\n";
         std::cout << "force_gradient_kernel                    : " << force_gradient_kernel << "\n";
         std::cout << "force_density_assignment_method          : " << force_density_assignment_method << "\n";
         std::cout << "force_linear_massive_neutrinos           : " << force_linear_massive_neutrinos << "\n";
+        std::cout << "force_zoom                               : " << force_zoom << "\n";
+        if (force_zoom) {
+            std::cout << "force_zoom_region_corner                 : ";
+            for (auto x : force_zoom_region_corner)
+                std::cout << x << " ";
+            std::cout << "(Mpc/h)\n";
+            std::cout << "force_zoom_region_size                   : " << force_zoom_region_size << " (Mpc/h)\n";
+            std::cout << "force_zoom_nmesh                         : " << force_zoom_nmesh << "\n";
+        }
     }
 
     // Initial conditions
     ic_type_of_input = param.get<std::string>("ic_type_of_input");
     ic_type_of_input_fileformat = param.get<std::string>("ic_type_of_input_fileformat", "CAMB");
     ic_input_filename = param.get<std::string>("ic_input_filename");
+    ic_transferdata_cache_folder = param.get<std::string>("ic_transferdata_cache_folder", "");
+    ic_transferdata_lazy_loading = param.get<bool>("ic_transferdata_lazy_loading", false);
+    ic_transferdata_prefetch = param.get<bool>("ic_transferdata_prefetch", false);
     ic_random_field_type = param.get<std::string>("ic_random_field_type");
     ic_input_redshift = param.get<double>("ic_input_redshift");
     ic_use_gravity_model_GR = param.get<bool>("ic_use_gravity_model_GR");
@@ -526,6 +778,13 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
     ic_LPT_order = param.get<int>("ic_LPT_order");
     ic_fix_amplitude = param.get<bool>("ic_fix_amplitude");
     ic_reverse_phases = param.get<bool>("ic_reverse_phases");
+    ic_ensemble_nseeds = param.get<int>("ic_ensemble_nseeds", 1);
+    ic_ensemble_paired = param.get<bool>("ic_ensemble_paired", false);
+    ensemble_name = simulation_name;
+    ensemble_seed = ic_random_seed;
+    ensemble_reverse_phases = ic_reverse_phases;
+    ic_stream_to_file = param.get<bool>("ic_stream_to_file", false);
+    ic_stream_nchunks = param.get<int>("ic_stream_nchunks", 16);
     if (ic_random_field_type == "nongaussian") {
         ic_fnl_type = param.get<std::string>("ic_fnl_type");
         ic_fnl = param.get<double>("ic_fnl");
@@ -548,6 +807,11 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
         std::cout << "ic_type_of_input                         : " << ic_type_of_input << "\n";
         std::cout << "ic_type_of_input_fileformat              : " << ic_type_of_input_fileformat << "\n";
         std::cout << "ic_input_filename                        : " << ic_input_filename << "\n";
+        if (ic_type_of_input == "transferinfofile") {
+            std::cout << "ic_transferdata_cache_folder             : " << ic_transferdata_cache_folder << "\n";
+            std::cout << "ic_transferdata_lazy_loading             : " << ic_transferdata_lazy_loading << "\n";
+            std::cout << "ic_transferdata_prefetch                 : " << ic_transferdata_prefetch << "\n";
+        }
         std::cout << "ic_random_field_type                     : " << ic_random_field_type << "\n";
         std::cout << "ic_input_redshift                        : " << ic_input_redshift << "\n";
         std::cout << "ic_nmesh                                 : " << ic_nmesh << "\n";
@@ -556,6 +820,11 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
         std::cout << "ic_LPT_order                             : " << ic_LPT_order << "\n";
         std::cout << "ic_fix_amplitude                         : " << ic_fix_amplitude << "\n";
         std::cout << "ic_reverse_phases                        : " << ic_reverse_phases << "\n";
+        std::cout << "ic_ensemble_nseeds                       : " << ic_ensemble_nseeds << "\n";
+        std::cout << "ic_ensemble_paired                       : " << ic_ensemble_paired << "\n";
+        std::cout << "ic_stream_to_file                        : " << ic_stream_to_file << "\n";
+        if (ic_stream_to_file)
+            std::cout << "ic_stream_nchunks                        : " << ic_stream_nchunks << "\n";
         if (ic_random_field_type == "nongaussian") {
             std::cout << "ic_fnl_type                              : " << ic_fnl_type << "\n";
             std::cout << "ic_fnl                                   : " << ic_fnl << "\n";
@@ -617,6 +886,8 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
         fof_linking_length = param.get<double>("fof_linking_length");
         fof_nmesh_max = param.get<int>("fof_nmesh_max");
         fof_buffer_length_mpch = param.get<double>("fof_buffer_length_mpch");
+        fof_onthefly_every_nsteps = param.get<int>("fof_onthefly_every_nsteps", 0);
+        fof_onthefly_output_ids = param.get<bool>("fof_onthefly_output_ids", true);
 
         if (FML::ThisTask == 0) {
             std::cout << "fof                                      : " << fof << "\n";
@@ -624,6 +895,9 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
             std::cout << "fof_linking_length                       : " << fof_linking_length << "\n";
             std::cout << "fof_nmesh_max                            : " << fof_nmesh_max << "\n";
             std::cout << "fof_buffer_length_mpch                   : " << fof_buffer_length_mpch << "\n";
+            std::cout << "fof_onthefly_every_nsteps                : " << fof_onthefly_every_nsteps << "\n";
+            if (fof_onthefly_every_nsteps > 0)
+                std::cout << "fof_onthefly_output_ids                  : " << fof_onthefly_output_ids << "\n";
         }
     }
 
@@ -672,6 +946,7 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
         bispectrum_density_assignment_method = param.get<std::string>("bispectrum_density_assignment_method");
         bispectrum_interlacing = param.get<bool>("bispectrum_interlacing");
         bispectrum_subtract_shotnoise = param.get<bool>("bispectrum_subtract_shotnoise");
+        bispectrum_max_memory_in_mb = param.get<double>("bispectrum_max_memory_in_mb", 0.0);
 
         if (FML::ThisTask == 0) {
             std::cout << "bispectrum                               : " << bispectrum << "\n";
@@ -680,6 +955,7 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
             std::cout << "bispectrum_density_assignment_method     : " << bispectrum_density_assignment_method << "\n";
             std::cout << "bispectrum_interlacing                   : " << bispectrum_interlacing << "\n";
             std::cout << "bispectrum_subtract_shotnoise            : " << bispectrum_subtract_shotnoise << "\n";
+            std::cout << "bispectrum_max_memory_in_mb              : " << bispectrum_max_memory_in_mb << "\n";
         }
     }
 
@@ -688,6 +964,18 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
     output_particles = param.get<bool>("output_particles");
     output_fileformat = param.get<std::string>("output_fileformat");
     output_folder = param.get<std::string>("output_folder");
+    output_nfiles = param.get<int>("output_nfiles", 0);
+    output_write_in_background = param.get<bool>("output_write_in_background", false);
+    output_async_write = param.get<bool>("output_async_write", false);
+    output_performance_report = param.get<bool>("output_performance_report", false);
+    output_subsample_fraction = param.get<double>("output_subsample_fraction", 1.0);
+    output_grids_nmesh = param.get<int>("output_grids_nmesh", 0);
+    output_grids_density_assignment_method = param.get<std::string>("output_grids_density_assignment_method", "CIC");
+    output_compressed_nbits = param.get<int>("output_compressed_nbits", 16);
+    output_hdf5_compression_level = param.get<int>("output_hdf5_compression_level", 4);
+#ifndef USE_HDF5
+    FML::assert_mpi(output_fileformat != "HDF5", "output_fileformat = HDF5 requires compiling with USE_HDF5");
+#endif
 
     if (FML::ThisTask == 0) {
         std::cout << "output_particles                         : " << output_particles << "\n";
@@ -697,6 +985,62 @@ void NBodySimulation<NDIM, T>::read_parameters(ParameterMap & param) {
         std::cout << "\n";
         std::cout << "output_fileformat                        : " << output_fileformat << "\n";
         std::cout << "output_folder                            : " << output_folder << "\n";
+        std::cout << "output_nfiles                            : " << output_nfiles << "\n";
+        std::cout << "output_write_in_background               : " << output_write_in_background << "\n";
+        if (output_fileformat == "GADGET")
+            std::cout << "output_async_write                       : " << output_async_write << "\n";
+        std::cout << "output_performance_report                : " << output_performance_report << "\n";
+        std::cout << "output_subsample_fraction                : " << output_subsample_fraction << "\n";
+        std::cout << "output_grids_nmesh                       : " << output_grids_nmesh << "\n";
+        if (output_grids_nmesh > 0)
+            std::cout << "output_grids_density_assignment_method   : " << output_grids_density_assignment_method
+                      << "\n";
+        if (output_fileformat == "COMPRESSED")
+            std::cout << "output_compressed_nbits                  : " << output_compressed_nbits << "\n";
+        if (output_fileformat == "HDF5")
+            std::cout << "output_hdf5_compression_level            : " << output_hdf5_compression_level << "\n";
+    }
+
+    // Checkpointing. Empty checkpoint_folder means [output_folder]/checkpoint_[simulation_name]
+    checkpoint_every_nsteps = param.get<int>("checkpoint_every_nsteps", 0);
+    checkpoint_folder = param.get<std::string>("checkpoint_folder", "");
+    restart_from_checkpoint = param.get<bool>("restart_from_checkpoint", false);
+    if (checkpoint_folder == "")
+        checkpoint_folder = output_folder + (output_folder == "" ? "" : "/") + "checkpoint_" + simulation_name;
+
+    if (FML::ThisTask == 0) {
+        std::cout << "checkpoint_every_nsteps                  : " << checkpoint_every_nsteps << "\n";
+        std::cout << "checkpoint_folder                        : " << checkpoint_folder << "\n";
+        std::cout << "restart_from_checkpoint                  : " << restart_from_checkpoint << "\n";
+    }
+
+    // Lightcone
+    lightcone.read_parameters(param);
+
+    // In the LPT gridmode we never have all the particles so only the analysis done from the density field and
+    // the particle output (chunk by chunk) is availiable
+    if (simulation_lpt_gridmode) {
+        FML::assert_mpi(ic_random_field_type != "read_particles" and ic_LPT_order <= 2,
+                        "simulation_lpt_gridmode needs random initial conditions and ic_LPT_order <= 2");
+        FML::assert_mpi(simulation_lpt_gridmode_nchunks >= 1, "simulation_lpt_gridmode_nchunks must be >= 1");
+        FML::assert_mpi(not fof and not pofk_multipole and not bispectrum,
+                        "fof, pofk_multipole and bispectrum are not availiable with simulation_lpt_gridmode");
+        FML::assert_mpi(not output_particles or output_fileformat == "GADGET" or output_fileformat == "HDF5",
+                        "output_particles with simulation_lpt_gridmode needs output_fileformat GADGET or HDF5");
+        FML::assert_mpi(not output_particles or output_subsample_fraction == 1.0,
+                        "output_subsample_fraction is not availiable with simulation_lpt_gridmode");
+        FML::assert_mpi(not lightcone.is_enabled() and checkpoint_every_nsteps == 0 and not restart_from_checkpoint,
+                        "The lightcone and checkpointing are not availiable with simulation_lpt_gridmode");
+    }
+
+    // When we stream the IC to file we never have the particles and stop after making them
+    if (ic_stream_to_file) {
+        FML::assert_mpi(ic_random_field_type != "read_particles" and not simulation_lpt_gridmode,
+                        "ic_stream_to_file needs random initial conditions and not simulation_lpt_gridmode");
+        FML::assert_mpi(ic_stream_nchunks >= 1, "ic_stream_nchunks must be >= 1");
+        FML::assert_mpi(output_fileformat == "GADGET" or output_fileformat == "HDF5",
+                        "ic_stream_to_file needs output_fileformat GADGET or HDF5");
+        FML::assert_mpi(not restart_from_checkpoint, "ic_stream_to_file cannot restart from a checkpoint");
     }
 }
 
@@ -710,12 +1054,30 @@ void NBodySimulation<NDIM, T>::init() {
         std::cout << "#=====================================================\n";
     }
 
+    //=============================================================
+    // Bin up the power-spectrum every time we compute the density field for the force
+    // NB: Subtracting shot-noise if the parameter is set
+    //=============================================================
+    add_density_fourier_observer([this](const FFTWGrid<NDIM> & density_grid_fourier, double a) {
+        PowerSpectrumBinning<NDIM> pofk_particles(density_grid_fourier.get_nmesh() / 2);
+        pofk_particles.subtract_shotnoise = pofk_subtract_shotnoise;
+        FML::CORRELATIONFUNCTIONS::bin_up_deconvolved_power_spectrum(
+            density_grid_fourier, pofk_particles, force_density_assignment_method);
+        pofk_particles.scale(simulation_boxsize);
+        pofk_cb_every_step.push_back({1.0 / a - 1.0, pofk_particles});
+    });
+
     // Empty output_folder means to output to current directory. Otherwise make folder
     if (output_folder != "") {
         if (not FML::create_folder(output_folder)) {
             throw std::runtime_error("Cannot create output directory [" + output_folder + "]");
         }
     }
+    if (checkpoint_every_nsteps > 0) {
+        if (not FML::create_folder(checkpoint_folder)) {
+            throw std::runtime_error("Cannot create checkpoint directory [" + checkpoint_folder + "]");
+        }
+    }
 
     //=============================================================
     // Output the cosmology and growth functions
@@ -765,25 +1127,26 @@ void NBodySimulation<NDIM, T>::init() {
         const int col_pofk = 1;
         std::vector<int> cols_to_keep{col_k, col_pofk};
         const int nheaderlines = 1;
-        auto pofkdata = FML::FILEUTILS::read_regular_ascii(ic_input_filename, ncols, cols_to_keep, nheaderlines);
+        auto pofkdata =
+            FML::FILEUTILS::read_regular_ascii_columns(ic_input_filename, ncols, cols_to_keep, nheaderlines);
 
-        karr.resize(pofkdata.size());
-        power.resize(pofkdata.size());
-        transfer.resize(pofkdata.size());
-        power_primordial.resize(pofkdata.size());
+        karr.resize(pofkdata[0].size());
+        power.resize(pofkdata[0].size());
+        transfer.resize(pofkdata[0].size());
+        power_primordial.resize(pofkdata[0].size());
 
         // Read in power-spectrum, compute transfer function
         // And use growth functions to translate it to initial redshift
         const double ainput = 1.0 / (1.0 + ic_input_redshift);
         const double aini = 1.0 / (1.0 + ic_initial_redshift);
         for (size_t i = 0; i < karr.size(); i++) {
-            karr[i] = pofkdata[i][0];
+            karr[i] = pofkdata[0][i];
             double k_hmpc = karr[i];
             double k_mpc = karr[i] * cosmo->get_h();
             double DinioverDinput = grav_ic->get_D_1LPT(aini, k_hmpc / grav_ic->H0_hmpc) /
                                     grav_ic->get_D_1LPT(ainput, k_hmpc / grav_ic->H0_hmpc);
             power_primordial[i] = cosmo->get_primordial_pofk(k_hmpc);
-            power[i] = DinioverDinput * DinioverDinput * pofkdata[i][1];
+            power[i] = DinioverDinput * DinioverDinput * pofkdata[1][i];
             transfer[i] = std::sqrt(power[i] / power_primordial[i]) / (k_mpc * k_mpc);
         }
 
@@ -812,25 +1175,26 @@ void NBodySimulation<NDIM, T>::init() {
         const int col_tofk = 1;
         std::vector<int> cols_to_keep{col_k, col_tofk};
         const int nheaderlines = 1;
-        auto tofkdata = FML::FILEUTILS::read_regular_ascii(ic_input_filename, ncols, cols_to_keep, nheaderlines);
+        auto tofkdata =
+            FML::FILEUTILS::read_regular_ascii_columns(ic_input_filename, ncols, cols_to_keep, nheaderlines);
 
-        karr.resize(tofkdata.size());
-        power.resize(tofkdata.size());
-        transfer.resize(tofkdata.size());
-        power_primordial.resize(tofkdata.size());
+        karr.resize(tofkdata[0].size());
+        power.resize(tofkdata[0].size());
+        transfer.resize(tofkdata[0].size());
+        power_primordial.resize(tofkdata[0].size());
 
         // Read in transfer function, compute power-spectrum
         // And use growth functions to translate it to initial redshift
         const double ainput = 1.0 / (1.0 + ic_input_redshift);
         const double aini = 1.0 / (1.0 + ic_initial_redshift);
         for (size_t i = 0; i < karr.size(); i++) {
-            karr[i] = tofkdata[i][0];
+            karr[i] = tofkdata[0][i];
             double k_hmpc = karr[i];
             double k_mpc = karr[i] * cosmo->get_h();
             double DinioverDinput = grav_ic->get_D_1LPT(aini, k_hmpc / grav_ic->H0_hmpc) /
                                     grav_ic->get_D_1LPT(ainput, k_hmpc / grav_ic->H0_hmpc);
             power_primordial[i] = cosmo->get_primordial_pofk(k_hmpc);
-            transfer[i] = DinioverDinput * tofkdata[i][1];
+            transfer[i] = DinioverDinput * tofkdata[1][i];
             power[i] = power_primordial[i] * std::pow(transfer[i] * k_mpc * k_mpc, 2);
         }
 
@@ -866,6 +1230,8 @@ void NBodySimulation<NDIM, T>::init() {
                                                                 cosmo->get_ns(),
                                                                 cosmo->get_h(),
                                                                 ic_type_of_input_fileformat);
+            transferdata->set_cache_folder(ic_transferdata_cache_folder);
+            transferdata->set_lazy_loading(ic_transferdata_lazy_loading, ic_transferdata_prefetch);
             transferdata->read_transfer(ic_input_filename);
 
             // Make sure the gravity model also gets a pointer to this
@@ -1008,6 +1374,33 @@ void NBodySimulation<NDIM, T>::init() {
         std::cout << "#=====================================================\n";
     }
 
+    //=============================================================
+    // If we restart then the particles (and LPT potentials) comes from the checkpoint
+    //=============================================================
+    if (restart_from_checkpoint) {
+        read_checkpoint();
+        return;
+    }
+
+    // The first member of an ensemble gets its IC here so it needs its name already (for ic_stream_to_file)
+    if (get_ensemble_nmembers() > 1)
+        set_ensemble_member(0);
+    make_initial_conditions();
+}
+
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::set_ensemble_member(int imember) {
+    ic_random_seed = ensemble_seed + imember / (ic_ensemble_paired ? 2 : 1);
+    ic_reverse_phases = ensemble_reverse_phases != (ic_ensemble_paired and imember % 2 == 1);
+    simulation_name =
+        ensemble_name + "_seed" + std::to_string(ic_random_seed) + (ic_reverse_phases ? "_reversed" : "");
+    lightcone.set_folder(output_folder + (output_folder == "" ? "" : "/") + "lightcone_" + simulation_name);
+    lightcone.set_step(0);
+}
+
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::make_initial_conditions() {
+
     //=============================================================
     // Generate initial conditions
     //=============================================================
@@ -1018,6 +1411,8 @@ void NBodySimulation<NDIM, T>::init() {
         rng = std::make_shared<GSLRandomGenerator>();
     else if (ic_random_generator == "MT19937")
         rng = std::make_shared<RandomGenerator>();
+    else if (ic_random_generator == "PHILOX")
+        rng = std::make_shared<PhiloxRandomGenerator>();
     else
         throw std::runtime_error("Unknown random generator " + ic_random_generator);
     rng->set_seed(ic_random_seed);
@@ -1040,8 +1435,13 @@ void NBodySimulation<NDIM, T>::init() {
         auto Pofk_of_kBox_over_volume = [&](double kBox) {
             return power_initial_spline(kBox / simulation_boxsize) / std::pow(simulation_boxsize, NDIM);
         };
-        FML::RANDOM::GAUSSIAN::generate_gaussian_random_field_fourier<NDIM>(
-            delta_ini_fourier, rng.get(), Pofk_of_kBox_over_volume, ic_fix_amplitude);
+        // With the counter-based generator every mode gets its random numbers from its wave-vector
+        if (ic_random_generator == "PHILOX")
+            FML::RANDOM::GAUSSIAN::generate_gaussian_random_field_fourier_mode_indexed<NDIM>(
+                delta_ini_fourier, ic_random_seed, Pofk_of_kBox_over_volume, ic_fix_amplitude);
+        else
+            FML::RANDOM::GAUSSIAN::generate_gaussian_random_field_fourier<NDIM>(
+                delta_ini_fourier, rng.get(), Pofk_of_kBox_over_volume, ic_fix_amplitude);
 
     } else if (ic_random_field_type == "nongaussian") {
 
@@ -1131,6 +1531,22 @@ void NBodySimulation<NDIM, T>::init() {
     // If we simply read IC from file (useful for testing)
     if (ic_random_field_type == "read_particles") {
         read_ic();
+    } else if (ic_stream_to_file) {
+        write_initial_conditions_streamed(delta_ini_fourier);
+        return;
+    } else if (simulation_lpt_gridmode) {
+
+        // We only keep the LPT potentials (at zini) and make the particles when we need them
+        timer.StartTiming("InitialConditions");
+        if (FML::ThisTask == 0)
+            std::cout << "Storing the initial LPT potentials for the LPT gridmode (no particles)\n";
+        FML::COSMOLOGY::LPT::compute_1LPT_potential_fourier(delta_ini_fourier, phi_1LPT_ini_fourier);
+        phi_1LPT_ini_fourier.add_memory_label("phi_1LPT(k,zini)");
+        if (ic_LPT_order == 2) {
+            FML::COSMOLOGY::LPT::compute_2LPT_potential_fourier(delta_ini_fourier, phi_2LPT_ini_fourier);
+            phi_2LPT_ini_fourier.add_memory_label("phi_2LPT(k,zini)");
+        }
+        timer.EndTiming("InitialConditions");
     } else {
 
         // Generate IC from a given fourier grid. The growth rate is used to generate the velocities
@@ -1211,19 +1627,170 @@ void NBodySimulation<NDIM, T>::init() {
     //============================================================
     // In the COLA frame v=0 so reset velocities
     //============================================================
-    if (simulation_use_cola) {
+    if (simulation_use_cola and not simulation_lpt_gridmode) {
         cola_initialize_velocities<NDIM, T>(part);
     }
 }
 
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::write_initial_conditions_streamed(const FFTWGrid<NDIM> & delta_ini_fourier) {
+    timer.StartTiming("InitialConditions");
+
+    const double aini = 1.0 / (1.0 + ic_initial_redshift);
+    const double fac = aini * aini * cosmo->HoverH0_of_a(aini);
+    std::vector<double> velocity_norms{fac * grav_ic->get_f_1LPT(aini),
+                                       fac * grav_ic->get_f_2LPT(aini),
+                                       fac * grav_ic->get_f_3LPTa(aini),
+                                       fac * grav_ic->get_f_3LPTb(aini)};
+
+    // Same units as the snapshots
+    const std::string icfolder = output_folder + (output_folder == "" ? "" : "/") + "ic_" + simulation_name;
+    if (not FML::create_folder(icfolder))
+        throw std::runtime_error("Cannot create folder [" + icfolder + "]");
+    const double pos_norm = simulation_boxsize;
+    const double vel_norm = 100 * simulation_boxsize / std::pow(aini, 1.5);
+    const std::string fileprefix = icfolder + "/" + "ic";
+    const std::string filename =
+        output_fileformat == "HDF5" ? fileprefix + "." + std::to_string(FML::ThisTask) + ".hdf5" :
+                                      fileprefix + "." + std::to_string(FML::ThisTask);
+    size_t NumPartTot = 1;
+    for (int idim = 0; idim < NDIM; idim++)
+        NumPartTot *= size_t(particle_Npart_1D);
+
+    if (FML::ThisTask == 0) {
+        std::cout << "\n";
+        std::cout << "#=====================================================\n";
+        std::cout << "# Writing the initial conditions in " << ic_stream_nchunks << " chunks\n";
+        std::cout << "# fileprefix  : " << fileprefix << "\n";
+        std::cout << "#=====================================================\n";
+    }
+
+    // Make the file the first time we get particles (then we know how many we have) and fill it as we go
+    FML::FILEUTILS::GADGET::GadgetWriter gw;
+#ifdef USE_HDF5
+    FML::FILEUTILS::GADGET::GadgetHDF5Writer hw;
+    hw.set_compression(output_hdf5_compression_level);
+#endif
+    size_t offset = 0;
+    auto output_chunk = [&](T * part_chunk, size_t npart_chunk, size_t npart_local) {
+        if (output_fileformat == "GADGET") {
+            if (offset == 0)
+                gw.create_gadget_single<T>(filename,
+                                           npart_local,
+                                           NumPartTot,
+                                           FML::NTasks,
+                                           aini,
+                                           simulation_boxsize,
+                                           cosmo->get_OmegaM(),
+                                           cosmo->get_OmegaLambda(),
+                                           cosmo->get_h());
+            gw.write_gadget_single_block(filename, part_chunk, npart_chunk, offset, pos_norm, vel_norm);
+        }
+#ifdef USE_HDF5
+        if (output_fileformat == "HDF5") {
+            if (offset == 0)
+                hw.create_hdf5_single<T>(filename,
+                                         npart_local,
+                                         NumPartTot,
+                                         FML::NTasks,
+                                         aini,
+                                         simulation_boxsize,
+                                         cosmo->get_OmegaM(),
+                                         cosmo->get_OmegaLambda(),
+                                         cosmo->get_h());
+            hw.write_hdf5_single_block(filename, part_chunk, npart_chunk, offset, pos_norm, vel_norm);
+        }
+#endif
+        offset += npart_chunk;
+    };
+
+    FML::NBODY::NBodyInitialConditionsStreamed<NDIM, T>(
+        particle_Npart_1D, delta_ini_fourier, ic_LPT_order, velocity_norms, ic_stream_nchunks, output_chunk);
+
+    timer.EndTiming("InitialConditions");
+}
+
 template <int NDIM, class T>
 void NBodySimulation<NDIM, T>::run() {
+
+    //=============================================================
+    // The members of an ensemble share everything made in init (the power-spectrum splines, the growth
+    // factors, the transfer data, ...) so every new member only costs making the IC and the time-stepping.
+    // Member i has the seed ic_random_seed + i (followed by its reversed partner if paired) and its outputs
+    // have the name simulation_name_seed[seed] (with _reversed added for the partner)
+    //=============================================================
+    const int nmembers = get_ensemble_nmembers();
+    FML::assert_mpi(nmembers >= 1, "ic_ensemble_nseeds must be >= 1");
+    if (nmembers > 1) {
+        FML::assert_mpi(ic_random_field_type == "gaussian" or ic_random_field_type == "nongaussian",
+                        "An ensemble needs random initial conditions (ic_random_field_type gaussian or nongaussian)");
+        FML::assert_mpi(not restart_from_checkpoint and checkpoint_every_nsteps == 0,
+                        "Checkpointing is not availiable for an ensemble");
+    }
+
+    for (int imember = 0; imember < nmembers; imember++) {
+        if (nmembers > 1) {
+            set_ensemble_member(imember);
+
+            if (FML::ThisTask == 0) {
+                std::cout << "\n";
+                std::cout << "#=====================================================\n";
+                std::cout << "# Ensemble member " << imember + 1 << " / " << nmembers << " : " << simulation_name
+                          << "\n";
+                std::cout << "#=====================================================\n";
+            }
+
+            // The first member got its IC in init
+            if (imember > 0) {
+                pofk_cb_every_step.clear();
+                pofk_total_every_step.clear();
+                pofk_multipoles_every_output.clear();
+                initial_density_field_fourier.free();
+                part.free();
+                make_initial_conditions();
+            }
+        }
+        // If we only make the IC they are already written
+        if (not ic_stream_to_file)
+            run_realization();
+    }
+
+    //=============================================================
+    // Print all timings
+    //=============================================================
+    timer.EndTiming("The whole simulation");
+    if (FML::ThisTask == 0) {
+        timer.PrintAllTimings();
+    }
+    FML::UTILS::PrintTimerRegions();
+
+#ifdef MEMORY_LOGGING
+    // Simulation is over, output the memory usage (of what we log)
+    FML::MemoryLog::get()->print();
+#endif
+}
+
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::run_realization() {
     timer.StartTiming("Timestepping");
 
     // Number of extra slices we need for density assignement
     const auto nleftright =
         FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(force_density_assignment_method);
 
+    //================================================================
+    // Allocate the grids we keep between steps (the COLA grids are allocated on first use as they have
+    // the shape of the LPT potentials). If we run an ensemble we have them from the last member
+    //================================================================
+    if (simulation_reuse_grids and density_grid_workspace.get_nmesh() != force_nmesh) {
+        density_grid_workspace = FFTWGrid<NDIM>(force_nmesh, nleftright.first, nleftright.second);
+        density_grid_workspace.add_memory_label("density_grid_workspace");
+        for (int idim = 0; idim < NDIM; idim++) {
+            force_grid_workspace[idim] = FFTWGrid<NDIM>(force_nmesh, nleftright.first, nleftright.second);
+            force_grid_workspace[idim].add_memory_label("force_grid_workspace_" + std::to_string(idim));
+        }
+    }
+
     //================================================================
     // Check that the first output redshift is not larger than the initial redshift
     //================================================================
@@ -1253,6 +1820,9 @@ void NBodySimulation<NDIM, T>::run() {
         }
         timestep_nsteps = nsteps_between_outputs;
     }
+    if (simulation_lpt_gridmode)
+        for (auto nsteps : timestep_nsteps)
+            FML::assert_mpi(nsteps == 0, "simulation_lpt_gridmode is pure LPT so it needs timestep_nsteps = 0");
 
     //================================================================
     // Print all the steps we will take
@@ -1279,6 +1849,22 @@ void NBodySimulation<NDIM, T>::run() {
         }
     }
 
+    //=============================================================
+    // Set up the lightcone. We need the particles to stay on the same index during the drift
+    // which is not the case for scaledependent COLA
+    //=============================================================
+    if (lightcone.is_enabled()) {
+        FML::assert_mpi(not(simulation_use_cola and simulation_use_scaledependent_cola and
+                            grav->is_growth_scaledependent()),
+                        "The lightcone is not availiable with scaledependent COLA");
+        if (simulation_use_cola) {
+            const double aini = 1.0 / (1.0 + ic_initial_redshift);
+            lightcone.set_cola_lpt_velocity(
+                [this, aini](double a) { return cola_LPT_velocity_factors<NDIM>(grav, aini, a); });
+        }
+        lightcone.init(cosmo, 1.0 / (1.0 + ic_initial_redshift));
+    }
+
     //=============================================================
     // Main time-stepping loop
     //=============================================================
@@ -1290,8 +1876,29 @@ void NBodySimulation<NDIM, T>::run() {
         std::cout << "#=====================================================\n\n";
     }
 
-    int istep_total = 0;
-    for (size_t ioutput = 0; ioutput < output_redshifts.size(); ioutput++) {
+    if (restart_from_checkpoint) {
+        FML::assert_mpi(restart_ioutput < int(output_redshifts.size()) and
+                            timestep_nsteps[restart_ioutput] == restart_nsteps,
+                        "The checkpoint does not match the time-steps in the parameterfile");
+    }
+
+    // Start the performance report (continue the old one if we restart)
+    performance_report_last_wall = std::chrono::steady_clock::now();
+    if (output_performance_report and FML::ThisTask == 0) {
+        const std::string filename =
+            output_folder + (output_folder == "" ? "" : "/") + "performance_" + simulation_name + ".csv";
+        if (not restart_from_checkpoint or not std::ifstream(filename).good()) {
+            std::ofstream fp(filename);
+            fp << "# phase, ioutput, istep_total, a, wall, ";
+            fp << "[min, max, mean over tasks for:] density, force, kick, drift, cola, communication, sort, ";
+            fp << "lightcone, checkpoint, analysis, [min, max, mean, max/mean for:] npart, ";
+            fp << "peak RSS (MB, max over tasks)\n";
+        }
+    }
+
+    int istep_total = restart_istep_total;
+    bool particles_need_communication = false;
+    for (size_t ioutput = restart_ioutput; ioutput < output_redshifts.size(); ioutput++) {
 
         // Fetch the list of steps to take
         const double amin =
@@ -1307,8 +1914,9 @@ void NBodySimulation<NDIM, T>::run() {
         //=============================================================
         // Time-step till the next output
         //=============================================================
+        const int istep_first = int(ioutput) == restart_ioutput ? restart_istep : 0;
         if (timestep_nsteps[ioutput] > 0)
-            for (int istep = 0; istep <= timestep_nsteps[ioutput]; istep++) {
+            for (int istep = istep_first; istep <= timestep_nsteps[ioutput]; istep++) {
 
                 const double apos = asteps.first[istep];
                 const double avel = asteps.second[istep];
@@ -1333,16 +1941,72 @@ void NBodySimulation<NDIM, T>::run() {
                 if (istep < timestep_nsteps[ioutput])
                     istep_total++;
 
+                // Sort the particles by cell every now and then to get cache friendly grid access
+                if (simulation_sort_particles_every_nsteps > 0 and
+                    istep_total % simulation_sort_particles_every_nsteps == 0) {
+                    timer.StartTiming("SortParticles");
+                    if (particles_need_communication) {
+                        part.communicate_particles();
+                        particles_need_communication = false;
+                    }
+                    part.sort_by_cell(force_nmesh);
+                    timer.EndTiming("SortParticles");
+                }
+
                 // Compute total density field
-                FFTWGrid<NDIM> density_grid_fourier(force_nmesh, nleftright.first, nleftright.second);
+                FFTWGrid<NDIM> density_grid_local;
+                std::array<FFTWGrid<NDIM>, NDIM> force_grid_local;
+                if (not simulation_reuse_grids) {
+                    density_grid_local = FFTWGrid<NDIM>(force_nmesh, nleftright.first, nleftright.second);
+                    density_grid_local.add_memory_label("density_grid_fourier");
+                }
+                auto & density_grid_fourier = simulation_reuse_grids ? density_grid_workspace : density_grid_local;
+                auto & force_real = simulation_reuse_grids ? force_grid_workspace : force_grid_local;
+                density_grid_fourier.set_grid_status_real(true);
+                density_grid_fourier.set_fourier_layout_transposed(false);
+#ifdef USE_OMP_TARGET
+                // Put the particles on the device. They stay there (density assignment, kick, COLA and drift)
+                // until after the drift and only the grids are copied in between
+                if (simulation_offload_pm_step and delta_time_kick != 0.0) {
+                    if (particles_need_communication) {
+                        timer.StartTiming("Communication");
+                        part.communicate_particles();
+                        particles_need_communication = false;
+                        timer.EndTiming("Communication");
+                    }
+                    const bool cola_on_device = simulation_use_cola and not(simulation_use_scaledependent_cola and
+                                                                            grav->is_growth_scaledependent());
+                    timer.StartTiming("DeviceTransfer");
+                    device_particles.upload(part.get_particles_ptr(),
+                                            part.get_npart(),
+                                            part.get_npart_total(),
+                                            cola_on_device ? cola_lpt_order<T>() : 0);
+                    timer.EndTiming("DeviceTransfer");
+                }
+#endif
                 if (delta_time_kick != 0.0) {
                     timer.StartTiming("ComputeDensityField");
-                    compute_density_field_fourier(density_grid_fourier, apos);
+                    compute_density_field_fourier(density_grid_fourier, apos, particles_need_communication);
+                    particles_need_communication = false;
                     timer.EndTiming("ComputeDensityField");
                 }
+                if (particles_need_communication) {
+                    timer.StartTiming("Communication");
+                    part.communicate_particles();
+                    particles_need_communication = false;
+                    timer.EndTiming("Communication");
+                }
+
+                // On the fly halofinding. All particles are in their domain and at apos here
+                // (no halos at the sync step before an output, we get them at the output or the next step)
+                if (fof and fof_onthefly_every_nsteps > 0 and istep < timestep_nsteps[ioutput] and
+                    istep_total % fof_onthefly_every_nsteps == 0) {
+                    timer.StartTiming("FoF");
+                    compute_fof_halos_on_the_fly(*this, apos, istep_total);
+                    timer.EndTiming("FoF");
+                }
 
                 // Compute forces
-                std::array<FFTWGrid<NDIM>, NDIM> force_real;
                 if (delta_time_kick != 0.0) {
                     timer.StartTiming("ComputeForce");
                     grav->compute_force(apos,
@@ -1356,10 +2020,39 @@ void NBodySimulation<NDIM, T>::run() {
                 // Kick particles (updates velocity)
                 if (delta_time_kick != 0.0) {
                     timer.StartTiming("Kick");
-                    FML::NBODY::KickParticles<NDIM>(force_real, part, delta_time_kick, force_density_assignment_method);
+#ifdef USE_OMP_TARGET
+                    if (device_particles.is_resident())
+                        device_particles.kick(force_real, delta_time_kick, force_density_assignment_method);
+                    else
+#endif
+                        FML::NBODY::KickParticles<NDIM>(
+                            force_real, part, delta_time_kick, force_density_assignment_method);
                     timer.EndTiming("Kick");
                 }
 
+                // Replace the short range (Newtonian) force in the zoom region by the one from the zoom grid
+                if (force_zoom and delta_time_kick != 0.0) {
+                    particles_from_device();
+                    timer.StartTiming("KickZoom");
+                    FML::NBODY::KickParticlesZoom<NDIM>(density_grid_fourier,
+                                                        part,
+                                                        delta_time_kick,
+                                                        force_density_assignment_method,
+                                                        1.5 * cosmo->get_OmegaM() * apos);
+                    timer.EndTiming("KickZoom");
+                }
+                density_grid_local.free();
+                for (auto & grid : force_grid_local)
+                    grid.free();
+
+                // Store the positions of the particles close to the lightcone before we move them
+                if (lightcone.is_enabled()) {
+                    particles_from_device();
+                    timer.StartTiming("Lightcone");
+                    lightcone.begin_drift(part, apos, apos_new);
+                    timer.EndTiming("Lightcone");
+                }
+
                 // For COLA we can do the kick and drift at the same time
                 if (simulation_use_cola) {
                     timer.StartTiming("COLA");
@@ -1367,6 +2060,7 @@ void NBodySimulation<NDIM, T>::run() {
                     // unless simulation_use_scaledependent_cola is set to false
                     const double aini = 1.0 / (1.0 + ic_initial_redshift);
                     if (simulation_use_scaledependent_cola and grav->is_growth_scaledependent()) {
+                        particles_from_device();
                         cola_kick_drift_scaledependent<NDIM, T>(part,
                                                                 grav,
                                                                 phi_1LPT_ini_fourier,
@@ -1378,50 +2072,107 @@ void NBodySimulation<NDIM, T>::run() {
                                                                 apos,
                                                                 apos_new,
                                                                 delta_time_kick,
-                                                                delta_time_drift);
+                                                                delta_time_drift,
+                                                                simulation_fused_scaledependent_cola,
+                                                                simulation_reuse_grids ? &cola_grid_workspace :
+                                                                                         nullptr);
                     } else {
-                        cola_kick_drift<NDIM, T>(part, grav, aini, apos, apos_new, delta_time_kick, delta_time_drift);
+#ifdef USE_OMP_TARGET
+                        if (device_particles.is_resident()) {
+                            const auto [fac_pos, fac_vel] =
+                                cola_kick_drift_factors<NDIM>(grav, aini, apos, apos_new, delta_time_kick);
+                            device_particles.cola_kick_drift(fac_pos, fac_vel);
+                        } else
+#endif
+                            cola_kick_drift<NDIM, T>(
+                                part, grav, aini, apos, apos_new, delta_time_kick, delta_time_drift);
                     }
                     timer.EndTiming("COLA");
                 }
 
-                // Drift particles (updates positions)
+                // Drift particles (updates positions). The particles are communicated in the next step while we
+                // assign the ones that stay on the task to the density grid
                 if (delta_time_drift != 0.0) {
                     timer.StartTiming("Drift");
-                    FML::NBODY::DriftParticles<NDIM, T>(part, delta_time_drift);
+#ifdef USE_OMP_TARGET
+                    if (device_particles.is_resident())
+                        device_particles.drift(delta_time_drift);
+                    else
+#endif
+                        FML::NBODY::DriftParticles<NDIM, T>(
+                            part.get_particles_ptr(), part.get_npart(), delta_time_drift);
+                    particles_need_communication = true;
                     timer.EndTiming("Drift");
                 }
 
+                // The particles are communicated (and maybe output) on the host
+                particles_from_device();
+
+                // Find the particles that crossed the lightcone and output them
+                if (lightcone.is_enabled()) {
+                    timer.StartTiming("Lightcone");
+                    lightcone.end_drift(part);
+                    timer.EndTiming("Lightcone");
+                }
+
+                // Write a checkpoint. We restart from the next step (no checkpoints at the sync step before an output)
+                if (checkpoint_every_nsteps > 0 and istep < timestep_nsteps[ioutput] and
+                    istep_total % checkpoint_every_nsteps == 0) {
+                    timer.StartTiming("Checkpoint");
+                    if (particles_need_communication) {
+                        part.communicate_particles();
+                        particles_need_communication = false;
+                    }
+                    write_checkpoint(ioutput, istep + 1, istep_total);
+                    timer.EndTiming("Checkpoint");
+                }
+
                 // Show info about particles
                 part.info();
 
                 // Show info about system memory use
                 FML::print_system_memory_use();
+#ifdef MEMORY_LOGGING
+                FML::MemoryLog::get()->mark_step("step " + std::to_string(istep_total) + " a = " +
+                                                 std::to_string(apos_new));
+#endif
+
+                write_performance_report("step", ioutput, istep_total, apos_new);
             }
 
         //=============================================================
         // Analyze data and output
         //=============================================================
+        if (particles_need_communication) {
+            timer.StartTiming("Communication");
+            part.communicate_particles();
+            particles_need_communication = false;
+            timer.EndTiming("Communication");
+        }
+        timer.StartTiming("Analyze and output");
         analyze_and_output(ioutput, output_redshifts[ioutput]);
+        timer.EndTiming("Analyze and output");
+        write_performance_report("output", ioutput, istep_total, 1.0 / (1.0 + output_redshifts[ioutput]));
     }
+    wait_for_analysis();
     timer.EndTiming("Timestepping");
+}
 
-    //=============================================================
-    // Print all timings
-    //=============================================================
-    timer.EndTiming("The whole simulation");
-    if (FML::ThisTask == 0) {
-        timer.PrintAllTimings();
-    }
-
-#ifdef MEMORY_LOGGING
-    // Simulation is over, output the memory usage (of what we log)
-    FML::MemoryLog::get()->print();
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::particles_from_device() {
+#ifdef USE_OMP_TARGET
+    if (not device_particles.is_resident())
+        return;
+    timer.StartTiming("DeviceTransfer");
+    device_particles.download(part.get_particles_ptr(), part.get_npart());
+    timer.EndTiming("DeviceTransfer");
 #endif
 }
 
 template <int NDIM, class T>
-void NBodySimulation<NDIM, T>::compute_density_field_fourier(FFTWGrid<NDIM> & density_grid_fourier, double a) {
+void NBodySimulation<NDIM, T>::compute_density_field_fourier(FFTWGrid<NDIM> & density_grid_fourier,
+                                                             double a,
+                                                             bool communicate_particles) {
 
     if (FML::ThisTask == 0) {
         std::cout << "Adding particles (baryons+CDM) to the densityfield\n";
@@ -1430,11 +2181,21 @@ void NBodySimulation<NDIM, T>::compute_density_field_fourier(FFTWGrid<NDIM> & de
     //=============================================================
     // Particles to grid
     //=============================================================
-    FML::INTERPOLATION::particles_to_grid(part.get_particles_ptr(),
-                                          part.get_npart(),
-                                          part.get_npart_total(),
-                                          density_grid_fourier,
-                                          force_density_assignment_method);
+#ifdef USE_OMP_TARGET
+    if (device_particles.is_resident()) {
+        device_particles.particles_to_grid(density_grid_fourier, force_density_assignment_method);
+    } else
+#endif
+    if (communicate_particles) {
+        FML::INTERPOLATION::particles_to_grid_communicate_particles(
+            part, density_grid_fourier, force_density_assignment_method);
+    } else {
+        FML::INTERPOLATION::particles_to_grid(part.get_particles_ptr(),
+                                              part.get_npart(),
+                                              part.get_npart_total(),
+                                              density_grid_fourier,
+                                              force_density_assignment_method);
+    }
 
     //=============================================================
     // Fourier transform
@@ -1442,16 +2203,11 @@ void NBodySimulation<NDIM, T>::compute_density_field_fourier(FFTWGrid<NDIM> & de
     density_grid_fourier.fftw_r2c();
 
     //=============================================================
-    // Bin up power-spectrum (its basically free as we have the density field)
-    // NB: Subtracting shot-noise if the parameter is set
+    // Let the observers analyze the density field (its basically free as we have it)
     //=============================================================
     const double redshift = 1.0 / a - 1.0;
-    PowerSpectrumBinning<NDIM> pofk_particles(density_grid_fourier.get_nmesh() / 2);
-    pofk_particles.subtract_shotnoise = pofk_subtract_shotnoise;
-    FML::CORRELATIONFUNCTIONS::bin_up_deconvolved_power_spectrum(
-        density_grid_fourier, pofk_particles, force_density_assignment_method);
-    pofk_particles.scale(simulation_boxsize);
-    pofk_cb_every_step.push_back({redshift, pofk_particles});
+    for (auto & observer : density_fourier_observers)
+        observer(density_grid_fourier, a);
 
     //=============================================================
     // Add on contribution from massive neutrinos, radiation etc.
@@ -1472,13 +2228,8 @@ void NBodySimulation<NDIM, T>::compute_density_field_fourier(FFTWGrid<NDIM> & de
         }
 
         // Function to translate delta_cb(zini,k) -> delta_nu(z,k) using transfer functions
-        const double aini = 1.0 / (1.0 + ic_initial_redshift);
-        const double koverkBox = 1.0 / simulation_boxsize;
-        auto norm = [&](double kBox) {
-            double T_mnu = transferdata->get_massive_neutrino_transfer_function(kBox * koverkBox, a);
-            double T_cb_ini = transferdata->get_cdm_baryon_transfer_function(kBox * koverkBox, aini);
-            return (T_mnu / T_cb_ini);
-        };
+        const auto & transfer_ratio = get_neutrino_transfer_ratio_table(a, density_grid_fourier.get_nmesh());
+        auto norm = [&](double kBox) { return transfer_ratio(kBox)[0]; };
 
         // We compute the total matter density-field deltaM = (OmegaCB deltaCB + OmegaMNu deltaMNu)/OmegaM
         const double fMNu = cosmo->get_fMNu();
@@ -1518,9 +2269,237 @@ void NBodySimulation<NDIM, T>::compute_density_field_fourier(FFTWGrid<NDIM> & de
     }
 }
 
+template <int NDIM, class T>
+const UniformKTable<1> & NBodySimulation<NDIM, T>::get_neutrino_transfer_ratio_table(double a, int nmesh) {
+    if (a == neutrino_transfer_ratio_table_a and nmesh == neutrino_transfer_ratio_table_nmesh)
+        return neutrino_transfer_ratio_table;
+    FML::assert_mpi(transferdata != nullptr, "Need transferdata to compute the neutrino transfer ratio\n");
+
+    // 16 points per fundamental mode from k = 2pi/B to the corner of the grid (constant below)
+    const double aini = 1.0 / (1.0 + ic_initial_redshift);
+    const double koverkBox = 1.0 / simulation_boxsize;
+    const double kBoxmin = 2.0 * M_PI;
+    const double kBoxmax = M_PI * std::sqrt(double(NDIM)) * nmesh;
+    const int npts = int(16.0 * (kBoxmax - kBoxmin) / (2.0 * M_PI)) + 2;
+    std::vector<std::array<double, 1>> values(npts);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < npts; i++) {
+        const double k = (kBoxmin + (kBoxmax - kBoxmin) * i / double(npts - 1)) * koverkBox;
+        const double T_mnu = transferdata->get_massive_neutrino_transfer_function(k, a);
+        const double T_cb_ini = transferdata->get_cdm_baryon_transfer_function(k, aini);
+        values[i][0] = T_mnu / T_cb_ini;
+    }
+    neutrino_transfer_ratio_table = UniformKTable<1>(kBoxmin, kBoxmax, std::move(values));
+    neutrino_transfer_ratio_table_a = a;
+    neutrino_transfer_ratio_table_nmesh = nmesh;
+    return neutrino_transfer_ratio_table;
+}
+
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::for_each_lpt_gridmode_chunk(
+    double a,
+    bool with_velocities,
+    std::function<void(FML::Vector<T> & chunk, size_t npart_local)> process_chunk) {
+
+    //=============================================================
+    // The LPT potential at a: phi = D1/D1ini phi_1LPT + D2/D2ini phi_2LPT with the growth
+    // factors tabulated in kBox (16 points per fundamental mode) to allow for scaledependent growth.
+    // The potential of the velocity (in code units) has an extra a^2 H/H0 f(a,k) in front of each term
+    //=============================================================
+    with_velocities = with_velocities and FML::PARTICLE::has_get_vel<T>();
+    const double aini = 1.0 / (1.0 + ic_initial_redshift);
+    const double H0Box = grav->H0_hmpc * simulation_boxsize;
+    const double vel_fac = a * a * cosmo->HoverH0_of_a(a);
+    const double kBoxmin = 2.0 * M_PI;
+    const double kBoxmax = M_PI * std::sqrt(double(NDIM)) * phi_1LPT_ini_fourier.get_nmesh();
+    const int npts = int(16.0 * (kBoxmax - kBoxmin) / (2.0 * M_PI)) + 2;
+    const UniformKTable<4> growth_ratios(kBoxmin, kBoxmax, npts, [&](double kBox) {
+        const double koverH0 = kBox / H0Box;
+        const double ratio_1LPT = grav->get_D_1LPT(a, koverH0) / grav->get_D_1LPT(aini, koverH0);
+        const double ratio_2LPT = grav->get_D_2LPT(a, koverH0) / grav->get_D_2LPT(aini, koverH0);
+        return std::array<double, 4>{ratio_1LPT,
+                                     ratio_2LPT,
+                                     vel_fac * grav->get_f_1LPT(a, koverH0) * ratio_1LPT,
+                                     vel_fac * grav->get_f_2LPT(a, koverH0) * ratio_2LPT};
+    });
+
+    FFTWGrid<NDIM> phi_LPT_fourier = phi_1LPT_ini_fourier;
+    phi_LPT_fourier.add_memory_label("phi_LPT(k,a)");
+    FFTWGrid<NDIM> phi_vel_fourier;
+    if (with_velocities) {
+        phi_vel_fourier = phi_1LPT_ini_fourier;
+        phi_vel_fourier.add_memory_label("phi_vel(k,a)");
+    }
+    const bool use_2LPT = phi_2LPT_ini_fourier.get_nmesh() > 0;
+    auto Local_nx = phi_LPT_fourier.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+    for (int islice = 0; islice < Local_nx; islice++) {
+        double kmag;
+        std::array<double, NDIM> kvec;
+        for (auto && fourier_index : phi_LPT_fourier.get_fourier_range(islice, islice + 1)) {
+            phi_LPT_fourier.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+            const auto ratios = growth_ratios(kmag);
+            const auto value_1LPT = phi_1LPT_ini_fourier.get_fourier_from_index(fourier_index);
+            const auto value_2LPT =
+                use_2LPT ? phi_2LPT_ini_fourier.get_fourier_from_index(fourier_index) : FML::GRID::ComplexType(0.0);
+            phi_LPT_fourier.set_fourier_from_index(fourier_index,
+                                                   value_1LPT * FML::GRID::FloatType(ratios[0]) +
+                                                       value_2LPT * FML::GRID::FloatType(ratios[1]));
+            if (with_velocities)
+                phi_vel_fourier.set_fourier_from_index(fourier_index,
+                                                       value_1LPT * FML::GRID::FloatType(ratios[2]) +
+                                                           value_2LPT * FML::GRID::FloatType(ratios[3]));
+        }
+    }
+
+    // The displacement field Psi = D phi and the velocity field (we interpolate them to q with CIC so we need
+    // the boundaries)
+    std::array<FFTWGrid<NDIM>, NDIM> Psi;
+    FML::COSMOLOGY::LPT::from_LPT_potential_to_displacement_vector<NDIM>(phi_LPT_fourier, Psi);
+    phi_LPT_fourier.free();
+    for (auto & grid : Psi)
+        grid.communicate_boundaries();
+    std::array<FFTWGrid<NDIM>, NDIM> Vel;
+    if (with_velocities) {
+        FML::COSMOLOGY::LPT::from_LPT_potential_to_displacement_vector<NDIM>(phi_vel_fourier, Vel);
+        phi_vel_fourier.free();
+        for (auto & grid : Vel)
+            grid.communicate_boundaries();
+    }
+
+    //=============================================================
+    // The lattice slices on this task are the ones create_particle_grid would have given us. We
+    // go through them in the same number of chunks on all tasks as process_chunk might communicate
+    //=============================================================
+    const int Npart_1D = particle_Npart_1D;
+    int imin = 0;
+    while (imin / double(Npart_1D) < FML::xmin_domain)
+        imin++;
+    int imax = imin;
+    while (imax / double(Npart_1D) < FML::xmax_domain)
+        imax++;
+    const size_t npart_per_slice = size_t(FML::power(Npart_1D, NDIM - 1));
+    const size_t npart_local = (imax - imin) * npart_per_slice;
+    const int nchunks = std::min(simulation_lpt_gridmode_nchunks, Npart_1D);
+    for (int ichunk = 0; ichunk < nchunks; ichunk++) {
+        const int ix_start = imin + (imax - imin) * ichunk / nchunks;
+        const int ix_end = imin + (imax - imin) * (ichunk + 1) / nchunks;
+        const size_t npart_chunk = (ix_end - ix_start) * npart_per_slice;
+
+        // The particles at q (with room for the ones that arrive if we communicate)
+        FML::Vector<T> chunk;
+        chunk.reserve(size_t(double(npart_chunk) * std::max(particle_allocation_factor, 1.0)) + 1);
+        chunk.resize(npart_chunk);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+        for (size_t i = 0; i < npart_chunk; i++) {
+            const size_t id = ix_start * npart_per_slice + i;
+            auto * pos = FML::PARTICLE::GetPos(chunk[i]);
+            FML::PARTICLE::lagrangian_position_from_id<NDIM>(id, Npart_1D, pos);
+            if constexpr (FML::PARTICLE::has_set_id<T>())
+                FML::PARTICLE::SetID(chunk[i], id);
+            if constexpr (FML::PARTICLE::has_set_mass<T>())
+                FML::PARTICLE::SetMass(chunk[i], 1.0);
+        }
+
+        // Set the velocity and move them to x = q + Psi(q)
+        std::array<std::vector<FML::GRID::FloatType>, NDIM> values;
+        if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+            if (with_velocities) {
+                FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<NDIM, T>(
+                    Vel, chunk.data(), npart_chunk, values, "CIC");
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < npart_chunk; i++) {
+                    auto * vel = FML::PARTICLE::GetVel(chunk[i]);
+                    for (int idim = 0; idim < NDIM; idim++)
+                        vel[idim] = values[idim][i];
+                }
+            }
+        }
+        FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<NDIM, T>(
+            Psi, chunk.data(), npart_chunk, values, "CIC");
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+        for (size_t i = 0; i < npart_chunk; i++) {
+            auto * pos = FML::PARTICLE::GetPos(chunk[i]);
+            for (int idim = 0; idim < NDIM; idim++) {
+                pos[idim] += values[idim][i];
+                FML::PARTICLE::wrap_periodic(pos[idim]);
+            }
+        }
+        for (auto & v : values) {
+            v.clear();
+            v.shrink_to_fit();
+        }
+
+        process_chunk(chunk, npart_local);
+    }
+}
+
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::compute_lpt_gridmode_density_field(FFTWGrid<NDIM> & density,
+                                                                  double a,
+                                                                  std::string density_assignment_method) {
+
+    // We add up 1 + delta of the chunks weighted by the fraction of all the particles that are in the chunk
+    const size_t npart_total = size_t(FML::power(particle_Npart_1D, NDIM));
+    FFTWGrid<NDIM> density_chunk(density.get_nmesh(),
+                                 density.get_n_extra_slices_left(),
+                                 density.get_n_extra_slices_right());
+    density_chunk.add_memory_label("density_chunk");
+    density.fill_real_grid(0.0);
+    auto add_chunk = [&](FML::Vector<T> & chunk, [[maybe_unused]] size_t npart_local) {
+        // Assign them to the task they are on now and add them to the grid
+        MPIParticles<T> chunk_particles;
+        chunk_particles.move_from(std::move(chunk));
+        chunk_particles.communicate_particles();
+        FML::INTERPOLATION::particles_to_grid<NDIM, T>(chunk_particles.get_particles_ptr(),
+                                                       chunk_particles.get_npart(),
+                                                       chunk_particles.get_npart_total(),
+                                                       density_chunk,
+                                                       density_assignment_method);
+        const double chunk_fraction = double(chunk_particles.get_npart_total()) / double(npart_total);
+        auto Local_nx_real = density.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+        for (int islice = 0; islice < Local_nx_real; islice++) {
+            for (auto && real_index : density.get_real_range(islice, islice + 1)) {
+                const auto value =
+                    density.get_real_from_index(real_index) +
+                    (density_chunk.get_real_from_index(real_index) + 1.0) * FML::GRID::FloatType(chunk_fraction);
+                density.set_real_from_index(real_index, value);
+            }
+        }
+    };
+    for_each_lpt_gridmode_chunk(a, false, add_chunk);
+
+    // From 1 + delta to delta
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+    for (int islice = 0; islice < density.get_local_nx(); islice++) {
+        for (auto && real_index : density.get_real_range(islice, islice + 1)) {
+            density.set_real_from_index(real_index,
+                                        density.get_real_from_index(real_index) - FML::GRID::FloatType(1.0));
+        }
+    }
+}
+
 template <int NDIM, class T>
 void NBodySimulation<NDIM, T>::analyze_and_output(int ioutput, double redshift) {
 
+    // We only analyze one output at the time
+    wait_for_analysis();
+
     std::stringstream stream;
     stream << std::fixed << std::setprecision(3) << redshift;
     std::string redshiftstring = stream.str();
@@ -1557,7 +2536,9 @@ void NBodySimulation<NDIM, T>::analyze_and_output(int ioutput, double redshift)
                                                              grav->H0_hmpc * simulation_boxsize,
                                                              aini,
                                                              a,
-                                                             addsubtract_sign);
+                                                             addsubtract_sign,
+                                                             simulation_fused_scaledependent_cola,
+                                                             simulation_reuse_grids ? &cola_grid_workspace : nullptr);
         } else {
             cola_add_on_LPT_velocity<NDIM, T>(part, grav, aini, a, addsubtract_sign);
         }
@@ -1568,7 +2549,7 @@ void NBodySimulation<NDIM, T>::analyze_and_output(int ioutput, double redshift)
     // In the COLA frame the initial velocity is zero, i.e. we have subtracted the
     // velocity predicted by LPT. Here we add on the LPT velocity to the particles
     //=============================================================
-    if (simulation_use_cola) {
+    if (simulation_use_cola and not simulation_lpt_gridmode) {
         timer.StartTiming("COLA output");
         add_on_LPT_velocity(+1.0);
         timer.EndTiming("COLA output");
@@ -1583,72 +2564,265 @@ void NBodySimulation<NDIM, T>::analyze_and_output(int ioutput, double redshift)
     }
 
     //=============================================================
-    // Power-spectrum
+    // The analysis and output of the particles. In the background this works on a copy of the
+    // particles (with the true velocities) so that we can continue time-stepping
     //=============================================================
-    if (pofk) {
-        timer.StartTiming("Power-spectrum");
-        compute_power_spectrum(*this, redshift, snapshot_folder);
-        timer.EndTiming("Power-spectrum");
-    }
+    auto analyze = [this, redshift, snapshot_folder]() {
+        //=============================================================
+        // Power-spectrum
+        //=============================================================
+        if (pofk) {
+            timer.StartTiming("Power-spectrum");
+            compute_power_spectrum(*this, redshift, snapshot_folder);
+            timer.EndTiming("Power-spectrum");
+        }
 
-    //=============================================================
-    // Power-spectrum multipoles
-    //=============================================================
-    if (pofk_multipole) {
-        timer.StartTiming("Power-spectrum multipoles");
-        compute_power_spectrum_multipoles(*this, redshift, snapshot_folder);
-        timer.EndTiming("Power-spectrum multipoles");
-    }
+        //=============================================================
+        // Power-spectrum multipoles
+        //=============================================================
+        if (pofk_multipole) {
+            timer.StartTiming("Power-spectrum multipoles");
+            compute_power_spectrum_multipoles(*this, redshift, snapshot_folder);
+            timer.EndTiming("Power-spectrum multipoles");
+        }
 
-    //=============================================================
-    // Halo finding
-    //=============================================================
-    if (fof) {
-        timer.StartTiming("FOF");
-        compute_fof_halos(*this, redshift, snapshot_folder);
-        timer.EndTiming("FOF");
-    }
+        //=============================================================
+        // Halo finding
+        //=============================================================
+        if (fof) {
+            timer.StartTiming("FOF");
+            compute_fof_halos(*this, redshift, snapshot_folder);
+            timer.EndTiming("FOF");
+        }
 
-    //=============================================================
-    // Bispectrum
-    //=============================================================
-    if (bispectrum) {
-        timer.StartTiming("Bispectrum");
-        compute_bispectrum(*this, redshift, snapshot_folder);
-        timer.EndTiming("Bispectrum");
-    }
+        //=============================================================
+        // Bispectrum
+        //=============================================================
+        if (bispectrum) {
+            timer.StartTiming("Bispectrum");
+            compute_bispectrum(*this, redshift, snapshot_folder);
+            timer.EndTiming("Bispectrum");
+        }
 
-    //=============================================================
-    // Write particles to file
-    //=============================================================
-    if (output_particles) {
-        timer.StartTiming("Output particles");
-        if (output_fileformat == "GADGET")
-            output_gadget(*this, redshift, snapshot_folder);
-        if (output_fileformat == "FML") {
-            output_fml(*this, redshift, snapshot_folder);
+        //=============================================================
+        // Write particles to file
+        //=============================================================
+        if (output_particles) {
+            timer.StartTiming("Output particles");
+            if (output_fileformat == "GADGET")
+                output_gadget(*this, redshift, snapshot_folder);
+            if (output_fileformat == "FML") {
+                output_fml(*this, redshift, snapshot_folder);
+            }
+            if (output_fileformat == "COMPRESSED")
+                output_compressed(*this, redshift, snapshot_folder);
+#ifdef USE_HDF5
+            if (output_fileformat == "HDF5")
+                output_hdf5(*this, redshift, snapshot_folder);
+#endif
+            timer.EndTiming("Output particles");
+        }
+
+        //=============================================================
+        // Write density and velocity grids to file
+        //=============================================================
+        if (output_grids_nmesh > 0) {
+            timer.StartTiming("Output grids");
+            output_grids(*this, redshift, snapshot_folder);
+            timer.EndTiming("Output grids");
         }
-        timer.EndTiming("Output particles");
+    };
+    if (simulation_analyze_in_background) {
+        timer.StartTiming("Copy particles for analysis");
+        analysis_particles = std::make_shared<MPIParticles<T>>(part);
+        timer.EndTiming("Copy particles for analysis");
+        analysis_thread = std::thread([analyze]() {
+            // The splines (in the cosmology, gravity model, ...) are shared with the time-stepping
+            FML::INTERPOLATION::SPLINE::SplineAcceleratorsOff no_spline_accelerators;
+            analyze();
+        });
+    } else {
+        analyze();
     }
 
     //=============================================================
     // Change velocities back to true COLA velocities
     //=============================================================
-    if (simulation_use_cola) {
+    if (simulation_use_cola and not simulation_lpt_gridmode) {
         timer.StartTiming("COLA output");
         add_on_LPT_velocity(-1.0);
         timer.EndTiming("COLA output");
     }
 }
 
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::write_checkpoint(int ioutput, int istep, int istep_total) {
+
+    // We alternate between two sets of files and only point to the new ones when they are written
+    const int slot = (istep_total / checkpoint_every_nsteps) % 2;
+    const std::string prefix = checkpoint_folder + "/checkpoint" + std::to_string(slot) + "_";
+    if (FML::ThisTask == 0) {
+        std::cout << "\n";
+        std::cout << "#=====================================================\n";
+        std::cout << "# Writing checkpoint " << prefix << "*\n";
+        std::cout << "#=====================================================\n";
+    }
+
+    // The particles and the grids we have computed from the initial conditions (if allocated)
+    part.dump_to_shared_file(prefix + "particles");
+    auto grids = checkpoint_grids();
+    std::vector<int> grid_is_allocated;
+    for (auto & grid : grids) {
+        grid_is_allocated.push_back(bool(*grid.first));
+        if (*grid.first)
+            grid.first->dump_to_file_parallel(prefix + grid.second);
+    }
+#ifdef USE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+
+    // Info about where we are in the time-stepping. Written last (and renamed) so it always points to
+    // a complete checkpoint
+    if (FML::ThisTask == 0) {
+        const std::string filename = checkpoint_folder + "/checkpoint.txt";
+        std::ofstream fp(filename + ".tmp");
+        fp << "# slot  ioutput  istep  istep_total  timestep_nsteps[ioutput]  lightcone_step  grids_allocated\n";
+        fp << slot << " " << ioutput << " " << istep << " " << istep_total << " " << timestep_nsteps[ioutput] << " "
+           << lightcone.get_step();
+        for (auto allocated : grid_is_allocated)
+            fp << " " << allocated;
+        fp << "\n";
+        fp.close();
+        FML::assert_mpi(fp.good() and std::rename((filename + ".tmp").c_str(), filename.c_str()) == 0,
+                        ("Failed to write checkpoint file " + filename).c_str());
+    }
+#ifdef USE_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+}
+
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::read_checkpoint() {
+
+    const std::string filename = checkpoint_folder + "/checkpoint.txt";
+    std::ifstream fp(filename);
+    FML::assert_mpi(fp.good(), ("Cannot open checkpoint file " + filename).c_str());
+    std::string header;
+    std::getline(fp, header);
+    int slot, lightcone_step;
+    fp >> slot >> restart_ioutput >> restart_istep >> restart_istep_total >> restart_nsteps >> lightcone_step;
+    auto grids = checkpoint_grids();
+    std::vector<int> grid_is_allocated(grids.size());
+    for (auto & allocated : grid_is_allocated)
+        fp >> allocated;
+    FML::assert_mpi(not fp.fail(), ("Failed to read checkpoint file " + filename).c_str());
+
+    const std::string prefix = checkpoint_folder + "/checkpoint" + std::to_string(slot) + "_";
+    if (FML::ThisTask == 0) {
+        std::cout << "\n";
+        std::cout << "#=====================================================\n";
+        std::cout << "# Restarting from checkpoint " << prefix << "*\n";
+        std::cout << "# Output: " << restart_ioutput << " Step: " << restart_istep << " / " << restart_nsteps
+                  << " Total steps taken: " << restart_istep_total << "\n";
+        std::cout << "#=====================================================\n";
+    }
+
+    timer.StartTiming("ReadCheckpoint");
+    part.load_from_shared_file(prefix + "particles", particle_allocation_factor);
+    for (size_t i = 0; i < grids.size(); i++) {
+        if (grid_is_allocated[i]) {
+            grids[i].first->load_from_file_parallel(prefix + grids[i].second);
+            grids[i].first->add_memory_label(grids[i].second + "(k,zini)");
+        }
+    }
+    lightcone.set_step(lightcone_step);
+    timer.EndTiming("ReadCheckpoint");
+}
+
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::wait_for_analysis() {
+    if (analysis_thread.joinable()) {
+        timer.StartTiming("Wait for analysis");
+        analysis_thread.join();
+        timer.EndTiming("Wait for analysis");
+    }
+    analysis_particles.reset();
+    if (output_thread.joinable()) {
+        timer.StartTiming("Wait for output");
+        output_thread.join();
+        timer.EndTiming("Wait for output");
+    }
+}
+
+template <int NDIM, class T>
+void NBodySimulation<NDIM, T>::write_performance_report(std::string phase, int ioutput, int istep_total, double a) {
+    if (not output_performance_report)
+        return;
+
+    // The timings we report. The density field includes the (overlapped) particle communication and the
+    // Fourier transform, the force includes the transform back and the kick the force interpolation
+    const std::vector<std::string> timings{"ComputeDensityField",
+                                           "ComputeForce",
+                                           "Kick",
+                                           "Drift",
+                                           "COLA",
+                                           "Communication",
+                                           "SortParticles",
+                                           "Lightcone",
+                                           "Checkpoint",
+                                           "Analyze and output"};
+    performance_report_last_times.resize(timings.size(), 0.0);
+
+    auto now = std::chrono::steady_clock::now();
+    const double wall = std::chrono::duration<double>(now - performance_report_last_wall).count();
+    performance_report_last_wall = now;
+
+    std::stringstream row;
+    row << phase << ", " << ioutput << ", " << istep_total << ", " << a << ", " << wall;
+    auto add_min_max_mean = [&](double value) {
+        double min = value, max = value, mean = value;
+        FML::MinOverTasks(&min);
+        FML::MaxOverTasks(&max);
+        FML::SumOverTasks(&mean);
+        mean /= double(FML::NTasks);
+        row << ", " << min << ", " << max << ", " << mean;
+        return std::make_pair(max, mean);
+    };
+    for (size_t i = 0; i < timings.size(); i++) {
+        const double total = timer.GetTotalTime(timings[i]);
+        add_min_max_mean(total - performance_report_last_times[i]);
+        performance_report_last_times[i] = total;
+    }
+    auto npart = add_min_max_mean(double(part.get_npart()));
+    row << ", " << (npart.second > 0.0 ? npart.first / npart.second : 0.0);
+    double peak_rss = FML::get_system_memory_use().second / 1e6;
+    FML::MaxOverTasks(&peak_rss);
+    row << ", " << peak_rss << "\n";
+
+    if (FML::ThisTask == 0) {
+        const std::string filename =
+            output_folder + (output_folder == "" ? "" : "/") + "performance_" + simulation_name + ".csv";
+        std::ofstream fp(filename, std::ios::app);
+        fp << row.str();
+    }
+}
+
 template <int NDIM, class T>
 void NBodySimulation<NDIM, T>::free() {
+    wait_for_analysis();
     part.free();
     initial_density_field_fourier.free();
     phi_1LPT_ini_fourier.free();
     phi_2LPT_ini_fourier.free();
     phi_3LPTa_ini_fourier.free();
     phi_3LPTb_ini_fourier.free();
+    density_grid_workspace.free();
+    for (int idim = 0; idim < NDIM; idim++) {
+        force_grid_workspace[idim].free();
+        cola_grid_workspace[0][idim].free();
+        cola_grid_workspace[1][idim].free();
+    }
+    FML::GRID::FFTWGridPool<NDIM>::get().clear();
 }
 
 template <int NDIM, class T>
@@ -0,0 +1,166 @@
+#!/bin/bash
+#======================================================================================
+# Performance and regression benchmark of the COLASolver. See README.md in this folder
+#
+# Usage (from the COLASolver folder): ./tests/benchmark/run_benchmark.sh [path to nbody]
+#
+# Options (environment variables):
+#   BENCHMARK_CONFIGS      The configurations to run (lcdm_cola fofr scaledependent neutrinos)
+#   BENCHMARK_SIZES        The particle_Npart_1D values to run (64 128)
+#   BENCHMARK_NTASKS       The number of MPI tasks to run with (1 2)
+#   BENCHMARK_MPIRUN       The command to launch with n tasks, n is added at the end (mpirun -np)
+#   BENCHMARK_OUTPUT       The folder we run in and write the results to (benchmark_output)
+#   BENCHMARK_REFERENCE    The BENCHMARK_OUTPUT of an earlier version to compare P(k) to (none)
+#   BENCHMARK_PK_TOLERANCE The maximum relative difference in P(k) we accept (0.01)
+#
+# The number of threads is OMP_NUM_THREADS as usual
+#======================================================================================
+
+NBODY=$(realpath "${1:-./nbody}")
+CONFIGS=${BENCHMARK_CONFIGS:-"lcdm_cola fofr scaledependent neutrinos"}
+SIZES=${BENCHMARK_SIZES:-"64 128"}
+NTASKS=${BENCHMARK_NTASKS:-"1 2"}
+MPIRUN=${BENCHMARK_MPIRUN:-"mpirun -np"}
+OUTPUT=$(realpath -m "${BENCHMARK_OUTPUT:-benchmark_output}")
+REFERENCE=${BENCHMARK_REFERENCE:-""}
+TOLERANCE=${BENCHMARK_PK_TOLERANCE:-0.01}
+COLASOLVER=$(realpath "$(dirname "$0")/../..")
+RESULTS=$OUTPUT/benchmark_results.csv
+
+if [ ! -x "$NBODY" ]; then
+  echo "Cannot find the nbody executable [$NBODY]. Run make first"
+  exit 1
+fi
+mkdir -p "$OUTPUT"
+
+#======================================================================================
+# Set a parameter in a parameterfile: replace the line where it is set (so that the if-blocks
+# that depend on it still work) or add it at the end if it is not in the file
+#======================================================================================
+set_param() {
+  local file=$1 name=$2 value=$3
+  if grep -q "^$name *=" "$file"; then
+    sed -i "s|^$name *=.*|$name = $value|" "$file"
+  else
+    echo "$name = $value" >> "$file"
+  fi
+}
+
+#======================================================================================
+# Make the parameterfile for a configuration. The settings shared by all runs: only P(k) as
+# output (no particles or halos) and the performance report
+#======================================================================================
+make_paramfile() {
+  local config=$1 npart=$2 name=$3 folder=$4 file=$4/parameterfile.lua
+  if [ "$config" == "neutrinos" ]; then
+    # The transfer infofile has the path to the transfer functions on the first line
+    sed "1s|^[^ ]*|$COLASOLVER/input/camb_data_lcdm_nu0.2|" \
+      "$COLASOLVER/input/transfer_infofile_lcdm_nu0.2.txt" > "$folder/transfer_infofile.txt"
+    cp "$COLASOLVER/example_parameterfile_neutrinos.lua" "$file"
+    set_param "$file" ic_input_filename "\"$folder/transfer_infofile.txt\""
+  else
+    cp "$COLASOLVER/parameterfile.lua" "$file"
+    set_param "$file" ic_input_filename "\"$COLASOLVER/input/example_power_spectrum_cb_z0.000.txt\""
+  fi
+  case $config in
+    fofr)           set_param "$file" gravity_model "\"f(R)\"" ;;
+    scaledependent) set_param "$file" gravity_model "\"f(R)\""
+                    set_param "$file" simulation_use_scaledependent_cola true ;;
+  esac
+  set_param "$file" simulation_name "\"$name\""
+  set_param "$file" particle_Npart_1D "$npart"
+  set_param "$file" ic_nmesh "$npart"
+  set_param "$file" force_nmesh "$npart"
+  set_param "$file" pofk_nmesh "$npart"
+  set_param "$file" output_folder "\"$folder\""
+  set_param "$file" output_particles false
+  set_param "$file" output_performance_report true
+  set_param "$file" fof false
+  set_param "$file" pofk true
+}
+
+#======================================================================================
+# The maximum relative difference in the P(k) column of two P(k) files (empty if we have no file)
+#======================================================================================
+pofk_max_rel_diff() {
+  [ -f "$1" ] && [ -f "$2" ] || return
+  paste <(grep -v "^#" "$1") <(grep -v "^#" "$2") | awk -v n="$(grep -v "^#" "$1" | head -1 | wc -w)" '
+    { d = ($(n + 2) - $2) / $(n + 2); if (d < 0) d = -d; if (d > max) max = d }
+    END { printf "%.3e", max }'
+}
+
+#======================================================================================
+# Sum the columns of the performance report over all the rows. We use the max over tasks of the
+# time in each phase (the columns 7, 10, ..., 34) and the last value of the peak RSS (column 40)
+#======================================================================================
+summarize_report() {
+  grep -v "^#" "$1" | awk -F', ' '
+    { wall += $5; for (i = 0; i < 10; i++) t[i] += $(7 + 3 * i); rss = $40 }
+    END { printf "%.3f", wall; for (i = 0; i < 10; i++) printf ", %.3f", t[i]; printf ", %.1f", rss }'
+}
+
+echo -n "config, npart_1D, ntasks, nthreads, wall, density, force, kick, drift, cola, communication, " > "$RESULTS"
+echo "sort, lightcone, checkpoint, analysis, peak_RSS_MB, pofk_max_rel_diff, status" >> "$RESULTS"
+nfailed=0
+
+#======================================================================================
+# The regression test: the reference MG-PICOLA comparison in tests/ (with its own settings)
+#======================================================================================
+TEST=$COLASOLVER/tests/LCDM_COLA_NormalIC_TimesteppingQuinn
+for ntasks in $NTASKS; do
+  name=regression_np$ntasks
+  folder=$OUTPUT/$name
+  mkdir -p "$folder"
+  cp "$TEST/parameterfile.lua" "$folder"
+  file=$folder/parameterfile.lua
+  set_param "$file" ic_input_filename "\"$TEST/input_power_spectrum.dat\""
+  set_param "$file" output_folder "\"$folder\""
+  set_param "$file" output_particles false
+  set_param "$file" output_performance_report true
+  echo "Running $name"
+  (cd "$folder" && $MPIRUN "$ntasks" "$NBODY" parameterfile.lua > log.txt 2>&1)
+  status=$?
+  diff=$(pofk_max_rel_diff "$TEST/pofk_TestSim_cb_z0.000.txt" "$folder/pofk_TestSim_cb_z0.000.txt")
+  if [ $status -ne 0 ] || [ -z "$diff" ] || awk "BEGIN { exit !($diff > $TOLERANCE) }"; then
+    result=FAILED; nfailed=$((nfailed + 1))
+  else
+    result=OK
+  fi
+  report=$(summarize_report "$folder/performance_TestSim.csv")
+  echo "regression, 128, $ntasks, ${OMP_NUM_THREADS:-0}, $report, $diff, $result" >> "$RESULTS"
+done
+
+#======================================================================================
+# The performance runs. We compare to the same run in BENCHMARK_REFERENCE if its given
+#======================================================================================
+for config in $CONFIGS; do
+  for npart in $SIZES; do
+    for ntasks in $NTASKS; do
+      name=${config}_n${npart}_np$ntasks
+      folder=$OUTPUT/$name
+      mkdir -p "$folder"
+      make_paramfile "$config" "$npart" "$name" "$folder"
+      echo "Running $name"
+      (cd "$folder" && $MPIRUN "$ntasks" "$NBODY" parameterfile.lua > log.txt 2>&1)
+      status=$?
+      pofkfile=$(cd "$folder" && ls snapshot_*/pofk_z*.txt 2>/dev/null | tail -1)
+      diff=""
+      if [ -n "$REFERENCE" ] && [ -n "$pofkfile" ]; then
+        diff=$(pofk_max_rel_diff "$REFERENCE/$name/$pofkfile" "$folder/$pofkfile")
+      fi
+      if [ $status -ne 0 ] || { [ -n "$diff" ] && awk "BEGIN { exit !($diff > $TOLERANCE) }"; }; then
+        result=FAILED; nfailed=$((nfailed + 1))
+      else
+        result=OK
+      fi
+      report=$(summarize_report "$folder/performance_$name.csv")
+      echo "$config, $npart, $ntasks, ${OMP_NUM_THREADS:-0}, $report, $diff, $result" >> "$RESULTS"
+    done
+  done
+done
+
+echo ""
+column -t -s, "$RESULTS" 2>/dev/null || cat "$RESULTS"
+echo ""
+echo "The results are in $RESULTS ($nfailed failed)"
+[ $nfailed -eq 0 ]
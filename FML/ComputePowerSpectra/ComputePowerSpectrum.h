@@ -1,8 +1,10 @@
 #ifndef COMPUTEPOWERSPECTRUM_HEADER
 #define COMPUTEPOWERSPECTRUM_HEADER
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <functional>
 #include <iostream>
 #include <vector>
 
@@ -15,6 +17,7 @@
 #endif
 
 #include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/FFTWGrid/FFTWGridPool.h>
 #include <FML/Global/Global.h>
 #include <FML/Interpolation/ParticleGridInterpolation.h>
 #include <FML/LPT/Reconstruction.h>        // For particles->redshiftspace
@@ -94,6 +97,68 @@ namespace FML {
                                     std::string density_assignment_method,
                                     bool interlacing);
 
+        //================================================================================
+        /// @brief As compute_power_spectrum, but the particles are read in chunks (e.g. one file of a snapshot at a
+        /// time) and each chunk is assigned to the grid right away so we never need to have all the particles in
+        /// memory, see FML::INTERPOLATION::particles_to_grid_streaming.
+        ///
+        /// @tparam N The dimension of the particles.
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] Ngrid Size of the grid to use.
+        /// @param[in] read_chunk Puts the next chunk of particles (in the local domain) in the (empty) vector it gets
+        /// and returns false when there are no more particles.
+        /// @param[out] pofk The binned power-spectrum. We required it to be initialized with the number of bins, kmin
+        /// and kmax.
+        /// @param[in] density_assignment_method The density assignment method (NGP, CIC, TSC, PCS or PQS)
+        /// @param[in] interlacing Use interlaced grids for alias reduction.
+        ///
+        //================================================================================
+        template <int N, class T>
+        void compute_power_spectrum_streaming(int Ngrid,
+                                              const std::function<bool(std::vector<T> &)> & read_chunk,
+                                              PowerSpectrumBinning<N> & pofk,
+                                              std::string density_assignment_method,
+                                              bool interlacing);
+
+        //================================================================================
+        /// @brief Compute the power-spectrum to higher k than the Nyquist frequency of the grid with the folding method
+        /// (Jenkins et al. 1998). The positions are folded into a box that is \f$ 2^l \f$ times smaller, \f$ x \to 2^l
+        /// x \f$ mod 1, for \f$ l = 1, \ldots, {\rm nfold} \f$. The density field of the folded box at k is the density
+        /// field of the full box at \f$ 2^l k \f$ (for the modes that are multiples of \f$ 2^l \f$) so with the same
+        /// grid the folded spectra reaches \f$ 2^{\rm nfold} \f$ times higher k. The spectra are stitched together bin
+        /// by bin: we use the unfolded spectrum up to kswitch_over_knyquist times the Nyquist frequency of the grid and
+        /// then the spectrum folded l times up to \f$ 2^l \f$ times that. The folded spectra have fewer modes per bin
+        /// so they are noisier, which only matters at low k where we don't use them. Costs nfold + 1 power-spectrum
+        /// computations with a grid of size Ngrid instead of one with a grid of size \f$ 2^{\rm nfold} \f$ Ngrid.
+        ///
+        /// @tparam N The dimension of the particles.
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] Ngrid Size of the grid to use.
+        /// @param[in] part Pointer to the first particle.
+        /// @param[in] NumPart Number of particles on the local task.
+        /// @param[in] NumPartTotal Total number of particles on all tasks.
+        /// @param[out] pofk The binned power-spectrum. We required it to be initialized with the number of bins, kmin
+        /// and kmax. kmax can be up to \f$ 2^{\rm nfold} \f$ times the Nyquist frequency of the grid.
+        /// @param[in] density_assignment_method The density assignment method (NGP, CIC, TSC, PCS or PQS)
+        /// @param[in] interlacing Use interlaced grids for alias reduction.
+        /// @param[in] nfold The number of times we fold the box (each time by a factor of 2).
+        /// @param[in] kswitch_over_knyquist We switch to the next folded spectrum at this fraction of the Nyquist
+        /// frequency of the grid (where aliasing and the window function starts to matter).
+        ///
+        //================================================================================
+        template <int N, class T>
+        void compute_power_spectrum_folded(int Ngrid,
+                                           T * part,
+                                           size_t NumPart,
+                                           size_t NumPartTotal,
+                                           PowerSpectrumBinning<N> & pofk,
+                                           std::string density_assignment_method,
+                                           bool interlacing,
+                                           int nfold,
+                                           double kswitch_over_knyquist = 0.5);
+
         //================================================================================
         /// @brief Brute force (but aliasing free) computation of the power spectrum.
         /// Loop over all grid-cells and all particles and add up contribution and subtracts shot-noise term.
@@ -119,6 +184,35 @@ namespace FML {
                                                      size_t NumPart,
                                                      PowerSpectrumBinning<N> & pofk);
 
+        //================================================================================
+        /// @brief Aliasing free computation of the power spectrum with a non-uniform FFT (type 1). This gives the same
+        /// as compute_power_spectrum_direct_summation (to the given accuracy) at the cost of a density assignment and
+        /// a FFT. The particles are spread to a grid twice as large with an "exponential of semicircle" kernel
+        /// \f$ \phi(z) = e^{\beta(\sqrt{1 - (2z/w)^2} - 1)} \f$ of width w cells, Fourier transformed and the modes
+        /// corresponding to a grid of size Ngrid are deconvolved with the Fourier transform of the kernel and binned up.
+        /// Works with MPI (as for the other methods the particles must be in the local domain).
+        ///
+        /// @tparam N The dimension of the particles.
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] Ngrid Size of the grid to use (the modes we get are the same as for the direct summation).
+        /// @param[in] part Pointer to the first particle.
+        /// @param[in] NumPart Number of particles on the local task.
+        /// @param[in] NumPartTot Number of particles over all tasks.
+        /// @param[out] pofk The binned power-spectrum. We required it to be initialized with the number of bins, kmin
+        /// and kmax.
+        /// @param[in] accuracy The relative accuracy of the Fourier modes (sets the width of the kernel, 1e-6 gives
+        /// w = 7). The smallest accuracy we allow is 1e-15 (w = 16).
+        ///
+        //================================================================================
+        template <int N, class T>
+        void compute_power_spectrum_nufft(int Ngrid,
+                                          const T * part,
+                                          size_t NumPart,
+                                          size_t NumPartTot,
+                                          PowerSpectrumBinning<N> & pofk,
+                                          double accuracy = 1e-6);
+
         //==========================================================================================
         /// @brief Compute the power-spectrum of a fourier grid. The result has no scales. Get
         /// scales by calling pofk.scale(boxsize) which does \f$ k \to k/B \f$ and
@@ -173,6 +267,32 @@ namespace FML {
                                          const FFTWGrid<N> & fourier_grid_2,
                                          PowerSpectrumBinning<N> & pofk);
 
+        //==========================================================================================
+        /// @brief Compute the correlation function \f$ \xi(r) \f$ of a fourier grid as the inverse fourier
+        /// transform of \f$ |\delta(k)|^2 \f$ (minus the shotnoise) averaged over the cells in bins of \f$ r \f$.
+        /// The result has no scales: r is in units of the boxsize. Only accurate for separations larger than a few
+        /// cells. The cheap alternative to pair counts for large separations.
+        ///
+        /// @tparam N Dimension of the grid
+        ///
+        /// @param[in] fourier_grid Grid in fourier space (with the window function deconvolved if you want that)
+        /// @param[in] rmin The smallest separation
+        /// @param[in] rmax The largest separation (at most 0.5 as the box is periodic)
+        /// @param[in] nbins The number of linear bins in r
+        /// @param[out] r_array The bin centers
+        /// @param[out] xi_array The correlation function
+        /// @param[in] shotnoise The shotnoise we subtract from every mode (1 / NumPartTotal for particles)
+        ///
+        //==========================================================================================
+        template <int N>
+        void compute_correlation_function_fourier(const FFTWGrid<N> & fourier_grid,
+                                                  double rmin,
+                                                  double rmax,
+                                                  int nbins,
+                                                  std::vector<double> & r_array,
+                                                  std::vector<double> & xi_array,
+                                                  double shotnoise = 0.0);
+
         //================================================================================
         /// @brief Compute power-spectrum multipoles from a Fourier grid
         /// where we have a fixed line_of_sight_direction (typical coordinate axes like \f$ (0,0,1) \f$).
@@ -222,6 +342,142 @@ namespace FML {
                                                std::string density_assignment_method,
                                                bool interlacing);
 
+        //================================================================================
+        /// @brief The index of the spectrum of tracer i and j in the list of all the \f$ M(M+1)/2 \f$ auto and cross
+        /// spectra of M tracers used by the multi-tracer methods. The order is (0,0), (0,1), ..., (0,M-1), (1,1),
+        /// (1,2), ..., (M-1,M-1).
+        ///
+        /// @param[in] i The first tracer.
+        /// @param[in] j The second tracer.
+        /// @param[in] ntracers The number of tracers M.
+        ///
+        /// @return The index of the spectrum (the same for (i,j) and (j,i)).
+        ///
+        //================================================================================
+        inline int get_multitracer_index(int i, int j, int ntracers);
+
+        //================================================================================
+        /// @brief Bin up all the \f$ M(M+1)/2 \f$ auto and cross power-spectra of M fourier grids in one loop over
+        /// the modes. The cross spectra are the real part of \f$ f_i(k)f_j^*(k) \f$ as in bin_up_cross_power_spectrum.
+        /// No deconvolution or shot-noise subtraction is done here.
+        ///
+        /// @tparam N Dimension of the grid
+        ///
+        /// @param[in] fourier_grids The M grids in fourier space (all with the same Nmesh).
+        /// @param[out] pofk The \f$ M(M+1)/2 \f$ binnings. The spectrum of (i,j) is pofk[get_multitracer_index(i, j,
+        /// M)]. All binnings has to have nbins, kmin and kmax set.
+        ///
+        //================================================================================
+        template <int N>
+        void bin_up_multitracer_power_spectrum(const std::vector<FFTWGrid<N>> & fourier_grids,
+                                               std::vector<PowerSpectrumBinning<N>> & pofk);
+
+        //================================================================================
+        /// @brief As compute_power_spectrum_multipoles_fourier, but for all the \f$ M(M+1)/2 \f$ auto and cross
+        /// spectra of M fourier grids in one loop over the modes.
+        ///
+        /// @tparam N Dimension of the grid
+        ///
+        /// @param[in] fourier_grids The M grids in fourier space (all with the same Nmesh).
+        /// @param[out] Pell The multipoles Pell[get_multitracer_index(i, j, M)][ell] of the spectrum of (i,j). All
+        /// vectors must have the same size (the maximum ell to compute) and all binnings has to have nbins, kmin and
+        /// kmax set.
+        /// @param[in] line_of_sight_direction The line of sight direction, e.g. \f$ (0,0,1) \f$ for the z-axis.
+        ///
+        //================================================================================
+        template <int N>
+        void compute_multitracer_power_spectrum_multipoles_fourier(
+            const std::vector<FFTWGrid<N>> & fourier_grids,
+            std::vector<std::vector<PowerSpectrumBinning<N>>> & Pell,
+            std::vector<double> line_of_sight_direction);
+
+        //================================================================================
+        /// @brief Multi-tracer power-spectrum estimator. Assigns all the M tracers to grids, deconvolves the window
+        /// function and bins up all the \f$ M(M+1)/2 \f$ auto and cross power-spectra in one go. The shot-noise
+        /// (1/NumPartTotal of the tracer) is subtracted for the auto spectra only.
+        ///
+        /// @tparam N The dimension of the particles.
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] Ngrid Size of the grid to use.
+        /// @param[in] tracers The M tracers.
+        /// @param[out] pofk The \f$ M(M+1)/2 \f$ binnings. The spectrum of (i,j) is pofk[get_multitracer_index(i, j,
+        /// M)]. All binnings has to have nbins, kmin and kmax set.
+        /// @param[in] density_assignment_method The density assignment method (NGP, CIC, TSC, PCS or PQS) to use.
+        /// @param[in] interlacing Use interlaced grids for alias reduction when computing the density field
+        ///
+        //================================================================================
+        template <int N, class T>
+        void compute_multitracer_power_spectrum(int Ngrid,
+                                                std::vector<FML::PARTICLE::MPIParticles<T>> & tracers,
+                                                std::vector<PowerSpectrumBinning<N>> & pofk,
+                                                std::string density_assignment_method,
+                                                bool interlacing);
+
+        //================================================================================
+        /// @brief As compute_power_spectrum_multipoles, but for all the \f$ M(M+1)/2 \f$ auto and cross spectra of M
+        /// tracers. For each coordinate axis all the tracers are put into redshift-space and assigned to grids before
+        /// we bin up. The shot-noise is subtracted for the monopole of the auto spectra only.
+        ///
+        /// @tparam N The dimension of the particles.
+        /// @tparam T The particle class. Must have a get_pos() and a get_vel() method.
+        ///
+        /// @param[in] Ngrid Size of the grid to use.
+        /// @param[in] tracers The M tracers.
+        /// @param[in] velocity_to_displacement Factor to convert a velocity to a displacement (see
+        /// compute_power_spectrum_multipoles).
+        /// @param[out] Pell The multipoles Pell[get_multitracer_index(i, j, M)][ell] of the spectrum of (i,j). All
+        /// vectors must have the same size (the maximum ell to compute) and all binnings has to have nbins, kmin and
+        /// kmax set.
+        /// @param[in] density_assignment_method The density assignment method (NGP, CIC, TSC, PCS or PQS) to use.
+        /// @param[in] interlacing Use interlaced grids for alias reduction when computing the density field
+        ///
+        //================================================================================
+        template <int N, class T>
+        void compute_multitracer_power_spectrum_multipoles(int Ngrid,
+                                                           std::vector<FML::PARTICLE::MPIParticles<T>> & tracers,
+                                                           double velocity_to_displacement,
+                                                           std::vector<std::vector<PowerSpectrumBinning<N>>> & Pell,
+                                                           std::string density_assignment_method,
+                                                           bool interlacing);
+
+        //================================================================================
+        /// @brief Power-spectrum multipoles for a survey with a local line of sight (the Yamamoto estimator computed
+        /// with FFTs as in Bianchi et al. 2015, Scoccimarro 2015). We assign \f$ F(x) = w(x)[n_g(x) - \alpha n_r(x)]
+        /// \f$ to a grid and compute \f$ A_\ell(k) = \sum \hat{k}_i\hat{k}_j\cdots Q_{ij\cdots}(k) \f$ where \f$
+        /// Q_{ij\cdots}(x) = \hat{x}_i\hat{x}_j\cdots F(x) \f$ with \f$ \hat{x} \f$ the direction from the observer
+        /// to the cell. This needs the \f$ N(N+1)/2 \f$ grids \f$ Q_{ij} \f$ for the quadrupole (and 15 more for the
+        /// hexadecapole in 3D), but we only keep one of them at the time. The galaxies and randoms are typically the
+        /// output of FML::SURVEY::GalaxiesRandomsToBox (with positions scaled to [0,1)). The weights are taken from
+        /// get_weight (e.g. the FKP weights) if the particles has it. The normalization is \f$ \alpha \sum_{\rm
+        /// randoms} \bar{n} w^2 \f$ if the randoms has a get_nbar method (\f$ \bar{n} \f$ in units of the box
+        /// volume) and otherwise estimated from the randoms on the grid. Shot-noise is subtracted for the monopole.
+        ///
+        /// @tparam N The dimension of the particles.
+        /// @tparam T The galaxy class. Must have a get_pos() method.
+        /// @tparam U The random class. Must have a get_pos() method.
+        ///
+        /// @param[in] Ngrid Size of the grid to use.
+        /// @param[in] galaxies Pointer to the first galaxy. All particles must be in the local domain of the task.
+        /// @param[in] ngalaxies Number of galaxies on the local task.
+        /// @param[in] randoms Pointer to the first random.
+        /// @param[in] nrandoms Number of randoms on the local task.
+        /// @param[in] observer_position The position of the observer in the same units as the positions.
+        /// @param[out] Pell Vector of power-spectrum binnings. The size of Pell is the maximum ell to compute (we can
+        /// do up to ell = 4, odd multipoles are zero). All binnings has to have nbins, kmin and kmax set.
+        /// @param[in] density_assignment_method The density assignment method (NGP, CIC, TSC, PCS or PQS) to use.
+        ///
+        //================================================================================
+        template <int N, class T, class U>
+        void compute_power_spectrum_multipoles_survey(int Ngrid,
+                                                      const T * galaxies,
+                                                      size_t ngalaxies,
+                                                      const U * randoms,
+                                                      size_t nrandoms,
+                                                      std::vector<double> observer_position,
+                                                      std::vector<PowerSpectrumBinning<N>> & Pell,
+                                                      std::string density_assignment_method);
+
         //================================================================================
         /// @brief Computes the polyspectrum \f$ P(k_1,k_2,\ldots,k_{\rm ORDER}) = \left<\delta(k_1)\cdots\delta(k_{\rm
         /// ORDER})\right> \f$ from particles. Note that with interlacing we change the particle positions, but when
@@ -260,7 +516,9 @@ namespace FML {
         /// nbins FFTWGrids at the same time and performs \f$ 2{\rm nbins} \f$ fourier transforms and does \f$ {\rm
         /// nbins}^{\rm ORDER} \f$ integrals. If one is to compute many spectra with the same Ngrid and binning then one
         /// can precompute N123 in polyofk and set it using polyofk.set_bincount(N123). This speeds up the polyspectrum
-        /// estimation by a factor of 2 by avoiding half of the fourier transforms.
+        /// estimation by a factor of 2 by avoiding half of the fourier transforms. If
+        /// polyofk.max_memory_in_mb is set we only keep as many grids as fits in this budget at once (we then do the
+        /// bins in blocks and recompute the grids as needed)
         ///
         /// @tparam N The dimension of the particles.
         /// @tparam ORDER The order. 2 is the power-spectrum, 3 is the bispectrum, 4 is the trispectrum.
@@ -272,6 +530,80 @@ namespace FML {
         template <int N, int ORDER>
         void compute_polyspectrum(const FFTWGrid<N> & fourier_grid, PolyspectrumBinning<N, ORDER> & polyofk);
 
+        //================================================================================
+        /// @brief The parts of the polyspectrum estimator that only depend on the grid and the binning: the bin count
+        /// N123 (which costs \f$ {\rm nbins} \f$ fourier transforms and \f$ {\rm nbins}^{\rm ORDER} \f$ integrals),
+        /// the number of modes and the mean k in each bin and (if store_mode_bins) the bin each fourier mode on the
+        /// local task is in. A plan is made the first time it is used with compute_polyspectrum (and remade if the
+        /// grid or the binning changes) so keep it around when computing spectra of many grids with the same setup
+        /// (e.g. every snapshot of a simulation). compute_polyspectrum without a plan keeps the last plan it made
+        /// (without the mode bins) so also there the bin count is only computed once for the same setup.
+        ///
+        /// @tparam N The dimension of the grid.
+        /// @tparam ORDER The order. 2 is the power-spectrum, 3 is the bispectrum, 4 is the trispectrum.
+        ///
+        //================================================================================
+        template <int N, int ORDER>
+        class PolyspectrumPlan {
+          public:
+            PolyspectrumPlan() = default;
+            /// Compute the bin count (or take it from the binning if it has been set with set_bincount)
+            PolyspectrumPlan(int Nmesh, const PolyspectrumBinning<N, ORDER> & binning, bool store_mode_bins = true);
+
+            /// Is the plan made for this grid size and binning?
+            bool matches(int Nmesh, const PolyspectrumBinning<N, ORDER> & binning) const;
+
+            /// Find the bin of the fourier modes of the grid (only done the first time for a given layout)
+            void set_modes(const FFTWGrid<N> & fourier_grid);
+
+            /// The bin the local fourier mode is in (-1 if not in any bin). Only availiable if store_mode_bins
+            int get_mode_bin(ptrdiff_t fourier_index) const { return mode_bin[fourier_index]; }
+            bool has_mode_bins() const { return store_mode_bins and mode_bin.size() > 0; }
+
+            /// The bin count N123, the number of modes and the mean k in each bin
+            const std::vector<double> & get_bincount() const { return N123; }
+            const std::vector<double> & get_nmodes() const { return nmodes; }
+            const std::vector<double> & get_kmean() const { return kmean; }
+
+            /// Free up all the memory
+            void free();
+
+          private:
+            int Nmesh{0};
+            bool store_mode_bins{true};
+            std::vector<double> klow;
+            std::vector<double> khigh;
+            std::vector<double> N123;
+            std::vector<double> nmodes;
+            std::vector<double> kmean;
+
+            // The layout of the grid the modes are for and the bin of all the local modes
+            bool modes_are_set{false};
+            bool fourier_layout_transposed{false};
+            ptrdiff_t ntot_fourier{0};
+            std::vector<short> mode_bin;
+        };
+
+        template <int N>
+        using BispectrumPlan = PolyspectrumPlan<N, 3>;
+
+        //================================================================================
+        /// @brief As compute_polyspectrum for a fourier grid, but with a plan that holds everything that only depends
+        /// on the grid and the binning. The plan is made if it does not match the grid and binning.
+        ///
+        /// @tparam N The dimension of the particles.
+        /// @tparam ORDER The order. 2 is the power-spectrum, 3 is the bispectrum, 4 is the trispectrum.
+        ///
+        /// @param[in] fourier_grid Grid in fourier space
+        /// @param[out] polyofk The binned polyspectrum.
+        /// @param[in,out] plan The plan to use (and keep for the next call).
+        ///
+        //================================================================================
+        template <int N, int ORDER>
+        void compute_polyspectrum(const FFTWGrid<N> & fourier_grid,
+                                  PolyspectrumBinning<N, ORDER> & polyofk,
+                                  PolyspectrumPlan<N, ORDER> & plan);
+
         //================================================================================
         /// @brief Computes the monospectrum \f$ P(k_1,k_2) = \left<\delta(k_1)\delta(k_2)\right> \f$ from a fourier
         /// grid. This method allocates nbins FFTWGrids at the same time and performs \f$ 2{\rm nbins} \f$ fourier
@@ -414,12 +746,142 @@ namespace FML {
         //=====================================================================
         //=====================================================================
 
+        //==========================================================================================
+        // Bin up one or more power-spectra from the modes of a fourier grid in one pass over the grid. For every
+        // mode (except the DC mode) values_of_mode(fourier_index, kvec, kmag, values) sets values[i], the value to
+        // add to binnings[i]. The binnings must all have the same bins. Modes with 0 < k_N < Nmesh/2 get weight 2
+        // (their complex conjugate is not stored). We go through the grid row by row: |k| and the bin index is
+        // computed for the whole row in tight loops from the wave-vector of the row and each thread sums up in its
+        // own arrays that are added to the binnings once at the end. The binnings are not reset nor normalized here
+        //==========================================================================================
+        template <int N, class ValuesOfMode>
+        void bin_up_fourier_modes(const FFTWGrid<N> & fourier_grid,
+                                  std::vector<PowerSpectrumBinning<N> *> binnings,
+                                  ValuesOfMode && values_of_mode) {
+
+            const int nbinnings = int(binnings.size());
+            assert_mpi(nbinnings > 0, "[bin_up_fourier_modes] Need at least one binning\n");
+            PowerSpectrumBinning<N> & pofk = *binnings[0];
+            for (auto * p : binnings)
+                assert_mpi(p->n == pofk.n and p->kmin == pofk.kmin and p->kmax == pofk.kmax and
+                               p->bin_type == pofk.bin_type,
+                           "[bin_up_fourier_modes] All the binnings must have the same bins\n");
+
+            const int nbins = pofk.n;
+            const auto Nmesh = fourier_grid.get_nmesh();
+            const auto Local_nx = fourier_grid.get_local_nx();
+
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+            {
+                std::vector<double> count(nbins, 0.0);
+                std::vector<double> kbin(nbins, 0.0);
+                std::vector<std::vector<double>> power(nbinnings, std::vector<double>(nbins, 0.0));
+                std::vector<double> values(nbinnings);
+
+                // Add a mode to our sums (the DC mode and modes outside the bins are skipped)
+                auto add_mode = [&](IndexIntType fourier_index,
+                                    const std::array<double, N> & kvec,
+                                    double kmag,
+                                    int index,
+                                    double weight) {
+                    if (kmag == 0.0 or index < 0 or index >= nbins)
+                        return;
+                    values_of_mode(fourier_index, kvec, kmag, values.data());
+                    count[index] += weight;
+                    kbin[index] += kmag * weight;
+                    for (int i = 0; i < nbinnings; i++)
+                        power[i][index] += values[i] * weight;
+                };
+
+                if constexpr (N == 1) {
+#ifdef USE_OMP
+#pragma omp for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        double kmag;
+                        std::array<double, N> kvec;
+                        for (auto && fourier_index : fourier_grid.get_fourier_range(islice, islice + 1)) {
+                            fourier_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+                            const int index = pofk.get_bin_index(kmag, pofk.kmin, pofk.kmax, nbins, pofk.bin_type);
+                            const auto last_coord = fourier_index % (Nmesh / 2 + 1);
+                            const double weight = last_coord > 0 and last_coord < Nmesh / 2 ? 2.0 : 1.0;
+                            add_mode(fourier_index, kvec, kmag, index, weight);
+                        }
+                    }
+                } else {
+                    const auto kz = fourier_grid.get_fourier_row_wavenumbers();
+                    std::vector<double> kmag_row(kz.size());
+                    std::vector<int> index_row(kz.size());
+#ifdef USE_OMP
+#pragma omp for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        for (auto && row : fourier_grid.get_fourier_row_range(islice, islice + 1)) {
+                            for (int iz = 0; iz < row.n; iz++)
+                                kmag_row[iz] = std::sqrt(row.kmag2 + kz[iz] * kz[iz]);
+                            for (int iz = 0; iz < row.n; iz++)
+                                index_row[iz] =
+                                    pofk.get_bin_index(kmag_row[iz], pofk.kmin, pofk.kmax, nbins, pofk.bin_type);
+
+                            std::array<double, N> kvec = row.kvec;
+                            for (int iz = 0; iz < row.n; iz++) {
+                                kvec[N - 1] = kz[iz];
+                                const double weight = iz > 0 and iz < Nmesh / 2 ? 2.0 : 1.0;
+                                add_mode(row.index + iz, kvec, kmag_row[iz], index_row[iz], weight);
+                            }
+                        }
+                    }
+                }
+
+                for (int i = 0; i < nbinnings; i++)
+                    binnings[i]->add_to_bins(count, power[i], kbin);
+            }
+        }
+
         //==========================================================================================
         // Compute the power-spectrum multipoles of a fourier grid assuming a fixed line of sight
         // direction (typically coordinate axes). Provide Pell with [ell+1] initialized binnings to compute
         // the first \f$ 0,1,\ldots,\ell \f$ multipoles The result has no scales. Get scales by scaling
         // PowerSpectrumBinning using scale(kscale, pofkscale) with kscale = 1/Boxsize
         // and pofkscale = Boxsize^N once spectrum has been computed
+        // Go from the binned moments <mu^k |delta|^2> in Pell[k] to the multipoles (2ell+1) <L_ell(mu) |delta|^2>
+        template <int N>
+        void from_mu_moments_to_legendre_multipoles(std::vector<PowerSpectrumBinning<N>> & Pell) {
+
+            // Binomial coefficient
+            auto binomial = [](int n, int k) -> double {
+                double res = 1.0;
+                for (int i = 0; i < k; i++) {
+                    res *= double(n - i) / double(k - i);
+                }
+                return res;
+            };
+
+            // P_ell(x) = Sum_{k=0}^{ell/2} summand_legendre_polynomial * x^(ell - 2k)
+            auto summand_legendre_polynomial = [&](int k, int ell) -> double {
+                double sign = (k % 2) == 0 ? 1.0 : -1.0;
+                return sign * binomial(ell, k) * binomial(2 * ell - 2 * k, ell) / std::pow(2.0, ell);
+            };
+
+            std::vector<std::vector<double>> temp;
+            for (int ell = 0; ell < int(Pell.size()); ell++) {
+                std::vector<double> sum(Pell[0].pofk.size(), 0.0);
+                for (int k = 0; k <= ell / 2; k++) {
+                    std::vector<double> & mu_power = Pell[ell - 2 * k].pofk;
+                    for (size_t i = 0; i < sum.size(); i++)
+                        sum[i] += mu_power[i] * summand_legendre_polynomial(k, ell) * double(2 * ell + 1);
+                }
+                temp.push_back(sum);
+            }
+
+            // Copy over data. We now have P0,P1,... in Pell
+            for (size_t ell = 0; ell < Pell.size(); ell++) {
+                Pell[ell].pofk = temp[ell];
+            }
+        }
+
         //==========================================================================================
         template <int N>
         void compute_power_spectrum_multipoles_fourier(const FFTWGrid<N> & fourier_grid,
@@ -433,10 +895,6 @@ namespace FML {
             assert_mpi(fourier_grid.get_nmesh() > 0,
                        "[compute_power_spectrum_multipoles_fourier] grid must have Nmesh > 0\n");
 
-            int Nmesh = fourier_grid.get_nmesh();
-            auto Local_nx = fourier_grid.get_local_nx();
-            auto Local_x_start = fourier_grid.get_local_x_start();
-
             // Norm of LOS vector
             double rmag = 0.0;
             for (int idim = 0; idim < N; idim++)
@@ -449,25 +907,15 @@ namespace FML {
             for (size_t ell = 0; ell < Pell.size(); ell++)
                 Pell[ell].reset();
 
-                // Bin up mu^k |delta|^2
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (int islice = 0; islice < Local_nx; islice++) {
-                [[maybe_unused]] double kmag;
-                [[maybe_unused]] std::array<double, N> kvec;
-                for (auto && fourier_index : fourier_grid.get_fourier_range(islice, islice + 1)) {
-                    if (Local_x_start == 0 and fourier_index == 0)
-                        continue; // DC mode( k=0)
-
-                    // Special treatment of k = 0 plane
-                    auto last_coord = fourier_index % (Nmesh / 2 + 1);
-                    double weight = last_coord > 0 and last_coord < Nmesh / 2 ? 2.0 : 1.0;
-
-                    // Compute kvec, |kvec| and |delta|^2
-                    fourier_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-                    auto delta = fourier_grid.get_fourier_from_index(fourier_index);
-                    double power = std::norm(delta);
+            // Bin up |delta|^2, |delta|^2mu^2, |delta^2|mu^4, ...
+            std::vector<PowerSpectrumBinning<N> *> binnings;
+            for (size_t ell = 0; ell < Pell.size(); ell += 2)
+                binnings.push_back(&Pell[ell]);
+            bin_up_fourier_modes<N>(
+                fourier_grid,
+                binnings,
+                [&](IndexIntType fourier_index, const std::array<double, N> & kvec, double kmag, double * values) {
+                    const double power = std::norm(fourier_grid.get_fourier_from_index(fourier_index));
 
                     // Compute mu = k_vec*r_vec
                     double mu2 = 0.0;
@@ -476,58 +924,19 @@ namespace FML {
                     mu2 /= (kmag * rmag);
                     mu2 = mu2 * mu2;
 
-                    // Add to bin |delta|^2, |delta|^2mu^2, |delta^2|mu^4, ...
                     double mutotwoell = 1.0;
-                    for (size_t ell = 0; ell < Pell.size(); ell += 2) {
-                        Pell[ell].add_to_bin(kmag, power * mutotwoell, weight);
+                    for (size_t i = 0; i < binnings.size(); i++) {
+                        values[i] = power * mutotwoell;
                         mutotwoell *= mu2;
                     }
-                }
-            }
+                });
 
-#ifdef USE_MPI
-            for (size_t ell = 0; ell < Pell.size(); ell++) {
-                MPI_Allreduce(MPI_IN_PLACE, Pell[ell].pofk.data(), Pell[ell].n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce(MPI_IN_PLACE, Pell[ell].count.data(), Pell[ell].n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-                MPI_Allreduce(MPI_IN_PLACE, Pell[ell].kbin.data(), Pell[ell].n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            }
-#endif
-
-            // Normalize
+            // Normalize (this communicates over tasks)
             for (size_t ell = 0; ell < Pell.size(); ell++)
                 Pell[ell].normalize();
 
-            // Binomial coefficient
-            auto binomial = [](int n, int k) -> double {
-                double res = 1.0;
-                for (int i = 0; i < k; i++) {
-                    res *= double(n - i) / double(k - i);
-                }
-                return res;
-            };
-
-            // P_ell(x) = Sum_{k=0}^{ell/2} summand_legendre_polynomial * x^(ell - 2k)
-            auto summand_legendre_polynomial = [&](int k, int ell) -> double {
-                double sign = (k % 2) == 0 ? 1.0 : -1.0;
-                return sign * binomial(ell, k) * binomial(2 * ell - 2 * k, ell) / std::pow(2.0, ell);
-            };
-
             // Go from <mu^k |delta|^2> to (2ell+1) <L_ell(mu) |delta|^2>
-            std::vector<std::vector<double>> temp;
-            for (int ell = 0; ell < int(Pell.size()); ell++) {
-                std::vector<double> sum(Pell[0].pofk.size(), 0.0);
-                for (int k = 0; k <= ell / 2; k++) {
-                    std::vector<double> & mu_power = Pell[ell - 2 * k].pofk;
-                    for (size_t i = 0; i < sum.size(); i++)
-                        sum[i] += mu_power[i] * summand_legendre_polynomial(k, ell) * double(2 * ell + 1);
-                }
-                temp.push_back(sum);
-            }
-
-            // Copy over data. We now have P0,P1,... in Pell
-            for (size_t ell = 0; ell < Pell.size(); ell++) {
-                Pell[ell].pofk = temp[ell];
-            }
+            from_mu_moments_to_legendre_multipoles(Pell);
         }
 
         template <int N>
@@ -539,42 +948,23 @@ namespace FML {
             assert_mpi(pofk.n > 0 && pofk.kmax > pofk.kmin && pofk.kmin >= 0.0,
                        "[bin_up_deconvolved_power_spectrum] Binning has inconsistent parameters\n");
 
+            // The window function is separable so we only need it for the integer wave-numbers in 1D
             const auto Nmesh = fourier_grid.get_nmesh();
-            const auto Local_nx = fourier_grid.get_local_nx();
-            const auto Local_x_start = fourier_grid.get_local_x_start();
-            const auto window_function = FML::INTERPOLATION::get_window_function<N>(density_assignment_method, Nmesh);
+            const auto window_table = FML::INTERPOLATION::get_window_function_table(density_assignment_method, Nmesh);
 
             // Initialize binning just in case
             pofk.reset();
 
             // Bin up P(k)
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (int islice = 0; islice < Local_nx; islice++) {
-                [[maybe_unused]] double kmag;
-                [[maybe_unused]] std::array<double, N> kvec;
-                for (auto && fourier_index : fourier_grid.get_fourier_range(islice, islice + 1)) {
-                    if (Local_x_start == 0 and fourier_index == 0)
-                        continue; // DC mode( k=0)
-
-                    // Special treatment of k = 0 plane (Safer way: fetch coord)
-                    // auto coord = fourier_grid.get_fourier_coord_from_index(fourier_index);
-                    // int last_coord = coord[N-1];
-                    auto last_coord = fourier_index % (Nmesh / 2 + 1);
-                    double weight = last_coord > 0 && last_coord < Nmesh / 2 ? 2.0 : 1.0;
-
-                    fourier_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-
-                    auto delta = fourier_grid.get_fourier_from_index(fourier_index);
-                    auto delta_norm = std::norm(delta);
-                    auto window = window_function(kvec);
-                    delta_norm /= (window * window);
-
-                    // Add norm to bin
-                    pofk.add_to_bin(kmag, delta_norm, weight);
-                }
-            }
+            bin_up_fourier_modes<N>(
+                fourier_grid,
+                {&pofk},
+                [&](IndexIntType fourier_index, const std::array<double, N> & kvec, double, double * values) {
+                    double window = 1.0;
+                    for (int idim = 0; idim < N; idim++)
+                        window *= window_table[Nmesh / 2 + int(std::round(kvec[idim] / (2.0 * M_PI)))];
+                    values[0] = std::norm(fourier_grid.get_fourier_from_index(fourier_index)) / (window * window);
+                });
 
             // Normalize to get P(k) (this communicates over tasks)
             pofk.normalize();
@@ -588,42 +978,20 @@ namespace FML {
             assert_mpi(pofk.n > 0 && pofk.kmax > pofk.kmin && pofk.kmin >= 0.0,
                        "[bin_up_power_spectrum] Binning has inconsistent parameters\n");
 
-            const auto Nmesh = fourier_grid.get_nmesh();
-            const auto Local_nx = fourier_grid.get_local_nx();
-            const auto Local_x_start = fourier_grid.get_local_x_start();
-
             // Initialize binning just in case
             pofk.reset();
 
             // Bin up P(k)
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (int islice = 0; islice < Local_nx; islice++) {
-                [[maybe_unused]] double kmag;
-                [[maybe_unused]] std::array<double, N> kvec;
-                for (auto && fourier_index : fourier_grid.get_fourier_range(islice, islice + 1)) {
-                    if (Local_x_start == 0 and fourier_index == 0)
-                        continue; // DC mode( k=0)
+            bin_up_fourier_modes<N>(
+                fourier_grid,
+                {&pofk},
+                [&](IndexIntType fourier_index, const std::array<double, N> &, double, double * values) {
+                    values[0] = std::norm(fourier_grid.get_fourier_from_index(fourier_index));
+                });
 
-                    // Special treatment of k = 0 plane (Safer way: fetch coord)
-                    // auto coord = fourier_grid.get_fourier_coord_from_index(fourier_index);
-                    // int last_coord = coord[N-1];
-                    auto last_coord = fourier_index % (Nmesh / 2 + 1);
-                    double weight = last_coord > 0 && last_coord < Nmesh / 2 ? 2.0 : 1.0;
-
-                    auto delta = fourier_grid.get_fourier_from_index(fourier_index);
-                    auto delta_norm = std::norm(delta);
-
-                    // Add norm to bin
-                    fourier_grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-                    pofk.add_to_bin(kmag, delta_norm, weight);
-                }
-            }
-
-            // Normalize to get P(k) (this communicates over tasks)
-            pofk.normalize();
-        }
+            // Normalize to get P(k) (this communicates over tasks)
+            pofk.normalize();
+        }
 
         // Bin up the cross power-spectrum of a given fourier grids
         template <int N>
@@ -637,10 +1005,6 @@ namespace FML {
             assert_mpi(pofk.n > 0 && pofk.kmax > pofk.kmin && pofk.kmin >= 0.0,
                        "[bin_up_cross_power_spectrum] Binning has inconsistent parameters\n");
 
-            const auto Nmesh = fourier_grid_1.get_nmesh();
-            const auto Local_nx = fourier_grid_1.get_local_nx();
-            const auto Local_x_start = fourier_grid_1.get_local_x_start();
-
             // Initialize binning just in case
             pofk.reset();
 
@@ -649,33 +1013,15 @@ namespace FML {
             pofk_imag.reset();
 
             // Bin up P(k)
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (int islice = 0; islice < Local_nx; islice++) {
-                [[maybe_unused]] double kmag;
-                [[maybe_unused]] std::array<double, N> kvec;
-                for (auto && fourier_index : fourier_grid_1.get_fourier_range(islice, islice + 1)) {
-                    if (Local_x_start == 0 and fourier_index == 0)
-                        continue; // DC mode( k=0)
-
-                    // Special treatment of k = 0 plane (Safer way: fetch coord)
-                    // auto coord = fourier_grid.get_fourier_coord_from_index(fourier_index);
-                    // int last_coord = coord[N-1];
-                    auto last_coord = fourier_index % (Nmesh / 2 + 1);
-                    double weight = last_coord > 0 && last_coord < Nmesh / 2 ? 2.0 : 1.0;
-
+            bin_up_fourier_modes<N>(
+                fourier_grid_1,
+                {&pofk, &pofk_imag},
+                [&](IndexIntType fourier_index, const std::array<double, N> &, double, double * values) {
                     auto delta_1 = fourier_grid_1.get_fourier_from_index(fourier_index);
                     auto delta_2 = fourier_grid_2.get_fourier_from_index(fourier_index);
-                    auto delta12_real = delta_1.real() * delta_2.real() + delta_1.imag() * delta_2.imag();
-                    auto delta12_imag = -delta_1.real() * delta_2.imag() + delta_1.imag() * delta_2.real();
-
-                    // Add norm to bin
-                    fourier_grid_1.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-                    pofk.add_to_bin(kmag, delta12_real, weight);
-                    pofk_imag.add_to_bin(kmag, delta12_imag, weight);
-                }
-            }
+                    values[0] = delta_1.real() * delta_2.real() + delta_1.imag() * delta_2.imag();
+                    values[1] = -delta_1.real() * delta_2.imag() + delta_1.imag() * delta_2.real();
+                });
 
             // Normalize to get P(k) (this communicates over tasks)
             pofk.normalize();
@@ -697,6 +1043,75 @@ namespace FML {
             }
         }
 
+        template <int N>
+        void compute_correlation_function_fourier(const FFTWGrid<N> & fourier_grid,
+                                                  double rmin,
+                                                  double rmax,
+                                                  int nbins,
+                                                  std::vector<double> & r_array,
+                                                  std::vector<double> & xi_array,
+                                                  double shotnoise) {
+
+            const int Nmesh = fourier_grid.get_nmesh();
+            assert_mpi(Nmesh > 0, "[compute_correlation_function_fourier] grid must have Nmesh > 0\n");
+            assert_mpi(nbins > 0 and rmax > rmin and rmin >= 0.0,
+                       "[compute_correlation_function_fourier] Binning has inconsistent parameters\n");
+
+            // The power-spectrum in every cell
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            FFTWGrid<N> xi_grid = pool.checkout(Nmesh, 0, 0, "FFTWGrid::compute_correlation_function_fourier::xi");
+            xi_grid.set_grid_status_real(false);
+            const auto Local_nx = fourier_grid.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                for (auto && fourier_index : fourier_grid.get_fourier_range(islice, islice + 1)) {
+                    const double power = std::norm(fourier_grid.get_fourier_from_index(fourier_index)) - shotnoise;
+                    xi_grid.set_fourier_from_index(fourier_index, power);
+                }
+            }
+            // The mean is zero
+            if (FML::ThisTask == 0)
+                xi_grid.set_fourier_from_index(0, 0.0);
+            xi_grid.fftw_c2r();
+
+            // Bin up xi in the cells (the separation is the distance to the closest periodic copy of the origin)
+            const auto Local_x_start = xi_grid.get_local_x_start();
+            std::vector<double> xi_sum(nbins, 0.0);
+            std::vector<double> count(nbins, 0.0);
+            for (int islice = 0; islice < Local_nx; islice++) {
+                for (auto && real_index : xi_grid.get_real_range(islice, islice + 1)) {
+                    auto coord = xi_grid.get_coord_from_index(real_index);
+                    coord[0] += Local_x_start;
+                    double r2 = 0.0;
+                    for (int idim = 0; idim < N; idim++) {
+                        const int i = coord[idim] <= Nmesh / 2 ? coord[idim] : coord[idim] - Nmesh;
+                        r2 += double(i) * double(i);
+                    }
+                    const double r = std::sqrt(r2) / double(Nmesh);
+                    const int ibin = int((r - rmin) / (rmax - rmin) * nbins);
+                    if (r < rmin or ibin >= nbins)
+                        continue;
+                    xi_sum[ibin] += xi_grid.get_real_from_index(real_index);
+                    count[ibin] += 1.0;
+                }
+            }
+            pool.give_back(std::move(xi_grid));
+            auto xi_sum_over_tasks = FML::SumArrayOverTasksAsync(xi_sum.data(), nbins);
+            auto count_over_tasks = FML::SumArrayOverTasksAsync(count.data(), nbins);
+            xi_sum_over_tasks.wait();
+            count_over_tasks.wait();
+
+            r_array = std::vector<double>(nbins);
+            xi_array = std::vector<double>(nbins, 0.0);
+            for (int i = 0; i < nbins; i++) {
+                r_array[i] = rmin + (rmax - rmin) * (i + 0.5) / double(nbins);
+                if (count[i] > 0.0)
+                    xi_array[i] = xi_sum[i] / count[i];
+            }
+        }
+
         // Brute force. Add particles to the grid using direct summation
         // This gives alias free P(k), but scales as O(Npart)*O(Nmesh^N)
         template <int N, class T>
@@ -710,13 +1125,13 @@ namespace FML {
             // Very simple check to see if all tasks do have the same particles
             if (FML::NTasks > 1) {
                 long long int tmp1 = NumPart;
-                FML::MinOverTasks(&tmp1);
                 long long int tmp2 = NumPart;
-                FML::MaxOverTasks(&tmp2);
                 double x = FML::PARTICLE::GetPos(part[0])[0];
                 double y = x;
-                FML::MaxOverTasks(&x);
-                FML::MinOverTasks(&y);
+                auto min_over_tasks = FML::MinOverTasksAsync(&tmp1, &y);
+                auto max_over_tasks = FML::MaxOverTasksAsync(&tmp2, &x);
+                min_over_tasks.wait();
+                max_over_tasks.wait();
                 assert_mpi(tmp1 == tmp2 and std::abs(x - y) < 1e-10,
                            "[direct_summation_power_spectrum] All tasks must have the same particles for this method "
                            "to work\n");
@@ -767,6 +1182,161 @@ namespace FML {
                     pofk.pofk[i] -= 1.0 / double(NumPart);
         }
 
+        // Type 1 non-uniform FFT with the "exponential of semicircle" kernel (Barnett, Magland & af Klinteberg 2019)
+        // and an upsampling factor of 2. Gives the same as the direct summation to the given accuracy
+        template <int N, class T>
+        void compute_power_spectrum_nufft(int Ngrid,
+                                          const T * part,
+                                          size_t NumPart,
+                                          size_t NumPartTot,
+                                          PowerSpectrumBinning<N> & pofk,
+                                          double accuracy) {
+
+            static_assert(FML::PARTICLE::has_get_pos<T>(),
+                          "[compute_power_spectrum_nufft] Particle class needs to have positions to use this method");
+            assert_mpi(Ngrid > 0, "[compute_power_spectrum_nufft] Ngrid > 0 required\n");
+            assert_mpi(accuracy > 0.0 and accuracy < 1.0, "[compute_power_spectrum_nufft] Accuracy must be in (0,1)\n");
+
+            // The kernel. The tiles used when threading the spreading are wide enough for a width of max_width
+            constexpr int max_width = 16;
+            const int width = std::min(max_width, std::max(2, int(std::ceil(-std::log10(accuracy))) + 1));
+            const double beta = 2.30 * width;
+            const double half_width = 0.5 * width;
+            auto phi = [=](double z) {
+                const double t = z / half_width;
+                return std::abs(t) < 1.0 ? std::exp(beta * (std::sqrt(1.0 - t * t) - 1.0)) : 0.0;
+            };
+
+            // The fine grid we spread the particles to
+            const int Nfine = 2 * Ngrid;
+            const int nleft = width / 2;
+            const int nright = width / 2 + 1;
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            FFTWGrid<N> density_k = pool.checkout(Nfine, nleft, nright, "FFTWGrid::compute_power_spectrum_nufft::density_k");
+            assert_mpi(density_k.get_local_nx() >= nright,
+                       "[compute_power_spectrum_nufft] Too few slices per task for the kernel width\n");
+            const auto Local_x_start = density_k.get_local_x_start();
+            density_k.fill_real_grid(0.0);
+
+            // Spread the particles
+            auto spread_particle = [&](size_t ipart) {
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ipart]);
+                std::array<std::array<double, max_width>, N> weight;
+                std::array<std::array<int, max_width>, N> index;
+                for (int idim = 0; idim < N; idim++) {
+                    const double x = pos[idim] * Nfine;
+                    const int i0 = int(std::ceil(x - half_width));
+                    for (int k = 0; k < width; k++) {
+                        int i = i0 + k;
+                        weight[idim][k] = phi(i - x);
+                        if (idim == 0)
+                            i -= int(Local_x_start);
+                        if (idim > 0 or FML::NTasks == 1) {
+                            if (i >= Nfine)
+                                i -= Nfine;
+                            if (i < 0)
+                                i += Nfine;
+                        }
+                        index[idim][k] = i;
+                    }
+                }
+
+                std::array<int, N> icoord;
+                std::array<int, N> k{};
+                for (;;) {
+                    double w = 1.0;
+                    for (int idim = 0; idim < N; idim++) {
+                        icoord[idim] = index[idim][k[idim]];
+                        w *= weight[idim][k[idim]];
+                    }
+                    density_k.add_real(icoord, w);
+
+                    int idim = N - 1;
+                    while (idim >= 0 and ++k[idim] == width)
+                        k[idim--] = 0;
+                    if (idim < 0)
+                        break;
+                }
+            };
+#if defined(USE_OMP) && !defined(SERIAL_DENSITY_ASSIGNMENT)
+            FML::INTERPOLATION::for_each_particle_by_tile<N, max_width>(part, NumPart, density_k, spread_particle);
+#else
+            for (size_t i = 0; i < NumPart; i++)
+                spread_particle(i);
+#endif
+
+            // Extra slices only relevant if we have more than 1 task. The extra slices are added assuming the grid starts
+            // at -1 so we shift them first
+            if (FML::NTasks > 1) {
+                const size_t num_cells_slice = density_k.get_ntot_real_slice_alloc();
+                FloatType * left = density_k.get_real_grid_left();
+                FloatType * right = density_k.get_real_grid_right();
+                for (size_t i = 0; i < num_cells_slice * nleft; i++)
+                    left[i] -= 1.0;
+                for (size_t i = 0; i < num_cells_slice * nright; i++)
+                    right[i] -= 1.0;
+                add_contribution_from_extra_slices<N>(density_k);
+            }
+
+            density_k.fftw_r2c();
+
+            // The Fourier transform of the kernel for the wave-numbers 0, 1, ..., Ngrid/2 (Simpson's rule on the
+            // even kernel, the kernel is smooth and tiny at the edges)
+            const int nquad = 200 * width;
+            const double dz = half_width / nquad;
+            std::vector<double> phi_fourier(Ngrid / 2 + 1, 0.0);
+            for (int n = 0; n <= Ngrid / 2; n++) {
+                const double k = 2.0 * M_PI * n / double(Nfine);
+                double sum = 0.0;
+                for (int j = 0; j <= nquad; j++) {
+                    const double z = j * dz;
+                    const double f = phi(z) * std::cos(k * z);
+                    sum += f * (j == 0 or j == nquad ? 1.0 : (j % 2 == 1 ? 4.0 : 2.0));
+                }
+                phi_fourier[n] = 2.0 * sum * dz / 3.0;
+            }
+
+            // Bin up the modes that a grid of size Ngrid has: -Ngrid/2 < n <= Ngrid/2 and 0 <= n <= Ngrid/2 in the
+            // last dimension
+            // (the FFT is normalized by 1/Nfine^N)
+            pofk.reset();
+            const double norm = std::pow(double(Nfine), N) / double(NumPartTot);
+            const auto Local_nx = density_k.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                [[maybe_unused]] double kmag;
+                [[maybe_unused]] std::array<double, N> kvec;
+                for (auto && fourier_index : density_k.get_fourier_range(islice, islice + 1)) {
+                    density_k.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+
+                    double deconvolution = 1.0;
+                    bool inside = true;
+                    std::array<int, N> n;
+                    for (int idim = 0; idim < N; idim++) {
+                        n[idim] = int(std::round(kvec[idim] / (2.0 * M_PI)));
+                        inside = inside and n[idim] > -Ngrid / 2 and n[idim] <= Ngrid / 2;
+                        if (inside)
+                            deconvolution *= phi_fourier[std::abs(n[idim])];
+                    }
+                    if (not inside)
+                        continue;
+
+                    const double weight = n[N - 1] > 0 && n[N - 1] < Ngrid / 2 ? 2.0 : 1.0;
+                    const auto delta = density_k.get_fourier_from_index(fourier_index);
+                    pofk.add_to_bin(kmag, std::norm(delta) * std::pow(norm / deconvolution, 2), weight);
+                }
+            }
+            pofk.normalize();
+            pool.give_back(std::move(density_k));
+
+            // Subtract shot-noise
+            if (pofk.subtract_shotnoise)
+                for (int i = 0; i < pofk.n; i++)
+                    pofk.pofk[i] -= 1.0 / double(NumPartTot);
+        }
+
         // Simple method to estimate multipoles from simulation data
         // Take particles in realspace and use their velocity to put them into
         // redshift space. Fourier transform and compute multipoles from this like in the method above.
@@ -806,8 +1376,9 @@ namespace FML {
             }
 
             // Allocate density grid
-            FFTWGrid<N> density_k(Ngrid, nleft, nright);
-            density_k.add_memory_label("FFTWGrid::compute_power_spectrum_multipoles::density_k");
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            FFTWGrid<N> density_k =
+                pool.checkout(Ngrid, nleft, nright, "FFTWGrid::compute_power_spectrum_multipoles::density_k");
 
             // Loop over all the N axes we are going to put the particles
             // into redshift space
@@ -859,6 +1430,7 @@ namespace FML {
                 // Ideally we should have taken a copy, but this is fine
                 FML::COSMOLOGY::particles_to_redshiftspace(part, line_of_sight_direction, -velocity_to_displacement);
             }
+            pool.give_back(std::move(density_k));
 
             // Normalize
             for (size_t ell = 0; ell < Pell.size(); ell++) {
@@ -902,8 +1474,8 @@ namespace FML {
             const int nright = nleftright.second + (interlacing ? 1 : 0);
 
             // Bin particles to grid
-            FFTWGrid<N> density_k(Ngrid, nleft, nright);
-            density_k.add_memory_label("FFTWGrid::compute_power_spectrum::density_k");
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            FFTWGrid<N> density_k = pool.checkout(Ngrid, nleft, nright, "FFTWGrid::compute_power_spectrum::density_k");
 
             if (interlacing) {
 
@@ -922,6 +1494,7 @@ namespace FML {
 
             // Bin up power-spectrum
             bin_up_power_spectrum<N>(density_k, pofk);
+            pool.give_back(std::move(density_k));
 
             // Subtract shotnoise
             if (pofk.subtract_shotnoise)
@@ -930,100 +1503,659 @@ namespace FML {
                 }
         }
 
-        // https://arxiv.org/pdf/1506.02729.pdf
-        // The general quadrupole estimator Eq. 20
-        // P(k) = <delta0(k)delta2^*(k>>
-        // We compute delta0 and delta2
-        // template<int N>
-        //  void quadrupole_estimator_3D(FFTWGrid<N> & density_real)
-        //  {
-
-        //    FFTWGrid<N> Q_xx, Q_yy, Q_zz, Q_xy, Q_yz, Q_zx;
-
-        //    compute_multipole_Q_term(density_real, Q_xx, {0,0}, origin);
-        //    compute_multipole_Q_term(density_real, Q_xy, {0,1}, origin);
-        //    compute_multipole_Q_term(density_real, Q_yy, {1,1}, origin);
-        //    Q_xx.fftw_r2c();
-        //    Q_xy.fftw_r2c();
-        //    Q_yy.fftw_r2c();
-        //    if constexpr (N > 2){
-        //      compute_multipole_Q_term(density_real, Q_yz, {1,2}, origin);
-        //      compute_multipole_Q_term(density_real, Q_zx, {2,0}, origin);
-        //      compute_multipole_Q_term(density_real, Q_zz, {2,2}, origin);
-        //      Q_yz.fftw_r2c();
-        //      Q_zx.fftw_r2c();
-        //      Q_zz.fftw_r2c();
-        //    }
-
-        //    // Density to fourier space
-        //    density_real.fftw_r2c();
-
-        //    FFTWGrid<N> delta2 =  density_real;
-
-        //    double kmag;
-        //    std::array<double,N> kvec;
-        //    for(auto & fourier_index : density_real.get_fourier_range()){
-        //      density_real.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag2);
-
-        //      // Unit kvector
-        //      if(kmag > 0.0)
-        //        for(auto & k : kvec)
-        //          k /= kmag;
-
-        //      auto Q_xx_of_k = Q_xx.get_fourier_from_index(fourier_index);
-        //      auto Q_xy_of_k = Q_xy.get_fourier_from_index(fourier_index);
-        //      auto Q_yy_of_k = Q_yy.get_fourier_from_index(fourier_index);
-
-        //      auto Q_yz_of_k = Q_yz.get_fourier_from_index(fourier_index);
-        //      auto Q_zx_of_k = Q_zx.get_fourier_from_index(fourier_index);
-        //      auto Q_zz_of_k = Q_zz.get_fourier_from_index(fourier_index);
-        //      auto delta0    = density_real.get_fourier_from_index(fourier_index);
-
-        //      auto res = Q_xx_of_k * kvec[0] * kvec[0] + Q_yy_of_k * kvec[1] * kvec[1] +  2.0 * (Q_xy_of_k *
-        //      kvec[0] * kvec[1])
-        //        if constexpr (N > 2) res += Q_zz_of_k * kvec[2] * kvec[2] + 2.0 * (Q_yz_of_k * kvec[1] *
-        //        kvec[2] + Q_zx_of_k * kvec[2] * kvec[0]);
-        //      res = 1.5 * res - 0.5 * delta0;
-
-        //      delta2.set_real_from_fourier(fourier_index, res);
-        //    }
-        //  }
-
-        // Compute delta(x) -> delta(x) * xi * xj * xk * .... (i,j,k,... in Qindex)
+        template <int N, class T>
+        void compute_power_spectrum_streaming(int Ngrid,
+                                              const std::function<bool(std::vector<T> &)> & read_chunk,
+                                              PowerSpectrumBinning<N> & pofk,
+                                              std::string density_assignment_method,
+                                              bool interlacing) {
+
+            // Set how many extra slices we need for the density assignment to go smoothly
+            const auto nleftright = get_extra_slices_needed_for_density_assignment(density_assignment_method);
+            const int nleft = nleftright.first;
+            const int nright = nleftright.second + (interlacing ? 1 : 0);
+
+            // Bin particles to grid chunk by chunk (and to the interlaced grid)
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            FFTWGrid<N> density_k =
+                pool.checkout(Ngrid, nleft, nright, "FFTWGrid::compute_power_spectrum_streaming::density_k");
+            size_t NumPartTotal = 0;
+            if (interlacing) {
+                FFTWGrid<N> density_k_shifted = pool.checkout(
+                    Ngrid, nleft, nright, "FFTWGrid::compute_power_spectrum_streaming::density_k_shifted");
+                NumPartTotal = FML::INTERPOLATION::particles_to_grid_streaming<N, T>(
+                    read_chunk, density_k, density_assignment_method, &density_k_shifted);
+                FML::INTERPOLATION::combine_interlaced_grids<N>(density_k, density_k_shifted);
+                pool.give_back(std::move(density_k_shifted));
+            } else {
+                NumPartTotal = FML::INTERPOLATION::particles_to_grid_streaming<N, T>(
+                    read_chunk, density_k, density_assignment_method);
+                density_k.fftw_r2c();
+            }
+            deconvolve_window_function_fourier<N>(density_k, density_assignment_method);
+
+            // Bin up power-spectrum
+            bin_up_power_spectrum<N>(density_k, pofk);
+            pool.give_back(std::move(density_k));
+
+            // Subtract shotnoise
+            if (pofk.subtract_shotnoise)
+                for (int i = 0; i < pofk.n; i++) {
+                    pofk.pofk[i] -= 1.0 / double(NumPartTotal);
+                }
+        }
+
+        //================================================================================
+        // The folded positions (and the mass) of a particle for compute_power_spectrum_folded
+        //================================================================================
+        template <int N>
+        struct FoldedParticle {
+            double pos[N];
+            double mass{1.0};
+            constexpr int get_ndim() const { return N; }
+            double * get_pos() { return pos; }
+            double get_mass() const { return mass; }
+        };
+
+        template <int N, class T>
+        void compute_power_spectrum_folded(int Ngrid,
+                                           T * part,
+                                           size_t NumPart,
+                                           size_t NumPartTotal,
+                                           PowerSpectrumBinning<N> & pofk,
+                                           std::string density_assignment_method,
+                                           bool interlacing,
+                                           int nfold,
+                                           double kswitch_over_knyquist) {
+
+            assert_mpi(nfold >= 0, "[compute_power_spectrum_folded] nfold cannot be negative\n");
+            assert_mpi(kswitch_over_knyquist > 0.0 and kswitch_over_knyquist <= 1.0,
+                       "[compute_power_spectrum_folded] kswitch_over_knyquist must be in (0,1]\n");
+
+            // The unfolded spectrum
+            compute_power_spectrum<N, T>(
+                Ngrid, part, NumPart, NumPartTotal, pofk, density_assignment_method, interlacing);
+
+            const double knyquist = M_PI * Ngrid;
+            for (int ifold = 1; ifold <= nfold; ifold++) {
+                const double fold = double(1 << ifold);
+
+                // Fold the positions. The folded particles are spread over all tasks so we must communicate them
+                std::vector<FoldedParticle<N>> folded;
+                folded.reserve(size_t(1.25 * double(NumPart)) + 1);
+                for (size_t i = 0; i < NumPart; i++) {
+                    FoldedParticle<N> p;
+                    const auto * pos = FML::PARTICLE::GetPos(part[i]);
+                    for (int idim = 0; idim < N; idim++) {
+                        p.pos[idim] = pos[idim] * fold;
+                        p.pos[idim] -= std::floor(p.pos[idim]);
+                        if (p.pos[idim] >= 1.0)
+                            p.pos[idim] -= 1.0;
+                    }
+                    if constexpr (FML::PARTICLE::has_get_mass<T>())
+                        p.mass = FML::PARTICLE::GetMass(part[i]);
+                    folded.push_back(p);
+                }
+                FML::PARTICLE::MPIParticles<FoldedParticle<N>> folded_part;
+                folded_part.move_from(std::move(folded));
+                folded_part.communicate_particles();
+
+                // The spectrum of the folded box. In units of the folded box the k-bins are 2^ifold times smaller
+                PowerSpectrumBinning<N> pofk_folded(pofk.kmin / fold, pofk.kmax / fold, pofk.n, pofk.bin_type);
+                pofk_folded.subtract_shotnoise = pofk.subtract_shotnoise;
+                compute_power_spectrum<N>(Ngrid,
+                                          folded_part.get_particles_ptr(),
+                                          folded_part.get_npart(),
+                                          folded_part.get_npart_total(),
+                                          pofk_folded,
+                                          density_assignment_method,
+                                          interlacing);
+
+                // Use the folded spectrum from where the spectrum folded one time less stops
+                const double kswitch = kswitch_over_knyquist * knyquist * fold / 2.0;
+                for (int i = 0; i < pofk.n; i++) {
+                    if (pofk.k[i] < kswitch)
+                        continue;
+                    pofk.pofk[i] = pofk_folded.pofk[i];
+                    pofk.kbin[i] = pofk_folded.kbin[i] * fold;
+                    pofk.count[i] = pofk_folded.count[i];
+                }
+            }
+        }
+
+        inline int get_multitracer_index(int i, int j, int ntracers) {
+            if (i > j)
+                std::swap(i, j);
+            return i * ntracers - (i * (i - 1)) / 2 + (j - i);
+        }
+
+        template <int N>
+        void bin_up_multitracer_power_spectrum(const std::vector<FFTWGrid<N>> & fourier_grids,
+                                               std::vector<PowerSpectrumBinning<N>> & pofk) {
+
+            const int ntracers = int(fourier_grids.size());
+            assert_mpi(ntracers > 0, "[bin_up_multitracer_power_spectrum] Need at least one grid\n");
+            assert_mpi(pofk.size() == size_t(ntracers * (ntracers + 1) / 2),
+                       "[bin_up_multitracer_power_spectrum] Need M(M+1)/2 binnings for M grids\n");
+            for (auto & grid : fourier_grids)
+                assert_mpi(grid.get_nmesh() > 0 and grid.get_nmesh() == fourier_grids[0].get_nmesh(),
+                           "[bin_up_multitracer_power_spectrum] Grids must have the same gridsize > 0\n");
+            for (auto & p : pofk)
+                assert_mpi(p.n > 0 && p.kmax > p.kmin && p.kmin >= 0.0,
+                           "[bin_up_multitracer_power_spectrum] Binning has inconsistent parameters\n");
+
+            // Initialize binning just in case
+            for (auto & p : pofk)
+                p.reset();
+
+            // Bin up the real part of delta_i delta_j^* for all the P_ij(k)
+            std::vector<PowerSpectrumBinning<N> *> binnings;
+            for (auto & p : pofk)
+                binnings.push_back(&p);
+            bin_up_fourier_modes<N>(
+                fourier_grids[0],
+                binnings,
+                [&](IndexIntType fourier_index, const std::array<double, N> &, double, double * values) {
+                    for (int i = 0, index = 0; i < ntracers; i++) {
+                        const auto delta_i = fourier_grids[i].get_fourier_from_index(fourier_index);
+                        for (int j = i; j < ntracers; j++, index++) {
+                            const auto delta_j = fourier_grids[j].get_fourier_from_index(fourier_index);
+                            values[index] = delta_i.real() * delta_j.real() + delta_i.imag() * delta_j.imag();
+                        }
+                    }
+                });
+
+            // Normalize to get P(k) (this communicates over tasks)
+            for (auto & p : pofk)
+                p.normalize();
+        }
+
+        template <int N>
+        void compute_multitracer_power_spectrum_multipoles_fourier(
+            const std::vector<FFTWGrid<N>> & fourier_grids,
+            std::vector<std::vector<PowerSpectrumBinning<N>>> & Pell,
+            std::vector<double> line_of_sight_direction) {
+
+            const int ntracers = int(fourier_grids.size());
+            assert_mpi(ntracers > 0,
+                       "[compute_multitracer_power_spectrum_multipoles_fourier] Need at least one grid\n");
+            assert_mpi(Pell.size() == size_t(ntracers * (ntracers + 1) / 2),
+                       "[compute_multitracer_power_spectrum_multipoles_fourier] Need M(M+1)/2 Pell for M grids\n");
+            assert_mpi(line_of_sight_direction.size() == N,
+                       "[compute_multitracer_power_spectrum_multipoles_fourier] Line of sight direction has wrong "
+                       "number of dimensions\n");
+            for (auto & grid : fourier_grids)
+                assert_mpi(grid.get_nmesh() > 0 and grid.get_nmesh() == fourier_grids[0].get_nmesh(),
+                           "[compute_multitracer_power_spectrum_multipoles_fourier] Grids must have the same gridsize "
+                           "> 0\n");
+            const size_t nell = Pell[0].size();
+            for (auto & P : Pell)
+                assert_mpi(P.size() == nell and nell > 0,
+                           "[compute_multitracer_power_spectrum_multipoles_fourier] All Pell must have the same size "
+                           "> 0\n");
+
+            // Norm of LOS vector
+            double rmag = 0.0;
+            for (int idim = 0; idim < N; idim++)
+                rmag += line_of_sight_direction[idim] * line_of_sight_direction[idim];
+            rmag = std::sqrt(rmag);
+            assert_mpi(rmag > 0.0,
+                       "[compute_multitracer_power_spectrum_multipoles_fourier] Line of sight vector has zero "
+                       "length\n");
+
+            // Initialize binning just in case
+            for (auto & P : Pell)
+                for (auto & p : P)
+                    p.reset();
+
+            // Bin up P_ij, P_ij mu^2, P_ij mu^4, ... with P_ij = Re(delta_i delta_j^*)
+            std::vector<PowerSpectrumBinning<N> *> binnings;
+            for (auto & P : Pell)
+                for (size_t ell = 0; ell < nell; ell += 2)
+                    binnings.push_back(&P[ell]);
+            bin_up_fourier_modes<N>(
+                fourier_grids[0],
+                binnings,
+                [&](IndexIntType fourier_index, const std::array<double, N> & kvec, double kmag, double * values) {
+                    // Compute mu = k_vec*r_vec
+                    double mu2 = 0.0;
+                    for (int idim = 0; idim < N; idim++)
+                        mu2 += kvec[idim] * line_of_sight_direction[idim];
+                    mu2 /= (kmag * rmag);
+                    mu2 = mu2 * mu2;
+
+                    for (int i = 0; i < ntracers; i++) {
+                        const auto delta_i = fourier_grids[i].get_fourier_from_index(fourier_index);
+                        for (int j = i; j < ntracers; j++) {
+                            const auto delta_j = fourier_grids[j].get_fourier_from_index(fourier_index);
+                            const double delta_ij_real =
+                                delta_i.real() * delta_j.real() + delta_i.imag() * delta_j.imag();
+                            double mutotwoell = 1.0;
+                            for (size_t ell = 0; ell < nell; ell += 2) {
+                                *values++ = delta_ij_real * mutotwoell;
+                                mutotwoell *= mu2;
+                            }
+                        }
+                    }
+                });
+
+            // Normalize (this communicates over tasks) and go from <mu^k P_ij> to (2ell+1) <L_ell(mu) P_ij>
+            for (auto & P : Pell) {
+                for (auto & p : P)
+                    p.normalize();
+                from_mu_moments_to_legendre_multipoles(P);
+            }
+        }
+
+        template <int N, class T>
+        void compute_multitracer_power_spectrum(int Ngrid,
+                                                std::vector<FML::PARTICLE::MPIParticles<T>> & tracers,
+                                                std::vector<PowerSpectrumBinning<N>> & pofk,
+                                                std::string density_assignment_method,
+                                                bool interlacing) {
+
+            static_assert(FML::PARTICLE::has_get_pos<T>(),
+                          "[compute_multitracer_power_spectrum] Particle class needs to have positions to use "
+                          "this method");
+            const int ntracers = int(tracers.size());
+            assert_mpi(ntracers > 0, "[compute_multitracer_power_spectrum] Need at least one tracer\n");
+
+            // Set how many extra slices we need for the density assignment to go smoothly
+            const auto nleftright = get_extra_slices_needed_for_density_assignment(density_assignment_method);
+            const int nleft = nleftright.first;
+            const int nright = nleftright.second + (interlacing ? 1 : 0);
+
+            // Assign all the tracers to grids and deconvolve the window function
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            std::vector<FFTWGrid<N>> density_k(ntracers);
+            for (int i = 0; i < ntracers; i++) {
+                density_k[i] = pool.checkout(Ngrid,
+                                             nleft,
+                                             nright,
+                                             "FFTWGrid::compute_multitracer_power_spectrum::density_k_" +
+                                                 std::to_string(i));
+                auto & part = tracers[i];
+                if (interlacing) {
+                    FML::INTERPOLATION::particles_to_fourier_grid_interlacing(part.get_particles_ptr(),
+                                                                              part.get_npart(),
+                                                                              part.get_npart_total(),
+                                                                              density_k[i],
+                                                                              density_assignment_method);
+                } else {
+                    particles_to_grid<N, T>(part.get_particles_ptr(),
+                                            part.get_npart(),
+                                            part.get_npart_total(),
+                                            density_k[i],
+                                            density_assignment_method);
+                    density_k[i].fftw_r2c();
+                }
+                deconvolve_window_function_fourier<N>(density_k[i], density_assignment_method);
+            }
+
+            // Bin up all the auto and cross spectra
+            bin_up_multitracer_power_spectrum<N>(density_k, pofk);
+            for (auto & grid : density_k)
+                pool.give_back(std::move(grid));
+
+            // Subtract shotnoise (only for the auto spectra)
+            for (int i = 0; i < ntracers; i++) {
+                auto & p = pofk[get_multitracer_index(i, i, ntracers)];
+                if (p.subtract_shotnoise)
+                    for (int k = 0; k < p.n; k++)
+                        p.pofk[k] -= 1.0 / double(tracers[i].get_npart_total());
+            }
+        }
+
+        template <int N, class T>
+        void compute_multitracer_power_spectrum_multipoles(int Ngrid,
+                                                           std::vector<FML::PARTICLE::MPIParticles<T>> & tracers,
+                                                           double velocity_to_displacement,
+                                                           std::vector<std::vector<PowerSpectrumBinning<N>>> & Pell,
+                                                           std::string density_assignment_method,
+                                                           bool interlacing) {
+
+            static_assert(FML::PARTICLE::has_get_pos<T>(),
+                          "[compute_multitracer_power_spectrum_multipoles] Particle class needs to have positions to "
+                          "use this method");
+            static_assert(FML::PARTICLE::has_get_vel<T>(),
+                          "[compute_multitracer_power_spectrum_multipoles] Particle class needs to have velocity to "
+                          "use this method");
+            const int ntracers = int(tracers.size());
+            assert_mpi(ntracers > 0, "[compute_multitracer_power_spectrum_multipoles] Need at least one tracer\n");
+
+            // Set how many extra slices we need for the density assignment to go smoothly
+            const auto nleftright = get_extra_slices_needed_for_density_assignment(density_assignment_method);
+            const int nleft = nleftright.first;
+            const int nright = nleftright.second + (interlacing ? 1 : 0);
+
+            // Initialize binning just in case
+            for (auto & P : Pell)
+                for (auto & p : P)
+                    p.reset();
+            auto Pell_current = Pell;
+
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            std::vector<FFTWGrid<N>> density_k(ntracers);
+            for (int i = 0; i < ntracers; i++)
+                density_k[i] = pool.checkout(Ngrid,
+                                             nleft,
+                                             nright,
+                                             "FFTWGrid::compute_multitracer_power_spectrum_multipoles::density_k_" +
+                                                 std::to_string(i));
+
+            // Loop over all the N axes we are going to put the particles into redshift space
+            for (int idim = 0; idim < N; idim++) {
+
+                // Make line of sight direction unit vector
+                std::vector<double> line_of_sight_direction(N, 0.0);
+                line_of_sight_direction[idim] = 1.0;
+
+                // Transform all tracers to redshift-space, bin to grid and deconvolve window function
+                for (int i = 0; i < ntracers; i++) {
+                    auto & part = tracers[i];
+                    FML::COSMOLOGY::particles_to_redshiftspace(part, line_of_sight_direction, velocity_to_displacement);
+                    density_k[i].set_grid_status_real(true);
+                    if (interlacing) {
+                        FML::INTERPOLATION::particles_to_fourier_grid_interlacing(part.get_particles_ptr(),
+                                                                                  part.get_npart(),
+                                                                                  part.get_npart_total(),
+                                                                                  density_k[i],
+                                                                                  density_assignment_method);
+                    } else {
+                        particles_to_grid<N, T>(part.get_particles_ptr(),
+                                                part.get_npart(),
+                                                part.get_npart_total(),
+                                                density_k[i],
+                                                density_assignment_method);
+                        density_k[i].fftw_r2c();
+                    }
+                    deconvolve_window_function_fourier<N>(density_k[i], density_assignment_method);
+
+                    // Transform particles back to real-space (we don't want to ruin the particles)
+                    FML::COSMOLOGY::particles_to_redshiftspace(
+                        part, line_of_sight_direction, -velocity_to_displacement);
+                }
+
+                // Compute all the multipoles and add them up
+                compute_multitracer_power_spectrum_multipoles_fourier<N>(
+                    density_k, Pell_current, line_of_sight_direction);
+                for (size_t index = 0; index < Pell.size(); index++)
+                    for (size_t ell = 0; ell < Pell[index].size(); ell++)
+                        Pell[index][ell] += Pell_current[index][ell];
+            }
+            for (auto & grid : density_k)
+                pool.give_back(std::move(grid));
+
+            // Take the mean over the axes
+            for (auto & P : Pell) {
+                for (auto & p : P) {
+                    for (int i = 0; i < p.n; i++) {
+                        p.pofk[i] /= double(N);
+                        p.count[i] /= double(N);
+                        p.kbin[i] /= double(N);
+                    }
+                }
+            }
+
+            // Subtract shotnoise for monopole (only for the auto spectra)
+            for (int i = 0; i < ntracers; i++) {
+                auto & p = Pell[get_multitracer_index(i, i, ntracers)][0];
+                if (p.subtract_shotnoise)
+                    for (int k = 0; k < p.n; k++)
+                        p.pofk[k] -= 1.0 / double(tracers[i].get_npart_total());
+            }
+        }
+
+        //================================================================================
+        // Compute Q(x) = delta(x) * xi * xj * xk * .... (i,j,k,... in Qindex)
         // where xi's being the i'th component of the unit norm line of sight direction
         // For the quadrupole we put Qindex = {ii,jj} and we need the 6 combinations xx,yy,zz,xy,yz,zx
         // For the hexadecapole we need {ii,jj,kk,ll} for 15 different combinations
-        // xxxx + cyc (3), xxxy + cyc, xxyy + cyc and xxyz + cyc
-        // template<int N>
-        //  void compute_multipole_Q_term(
-        //      FFTWGrid<N> & density_real,
-        //      FFTWGrid<N> & Q_real,
-        //      std::vector<int> Qindex,
-        //      std::vector<double> origin)
-        //  {
-        //    assert(Qindex.size() > 0);
-        //    assert(origin.size() == N);
-
-        //    for(auto && real_index : density_real.get_real_range()){
-        //      auto coord = density_real.get_coord_from_index(real_index);
-        //      auto pos = density_real.get_real_position(coord);
-
-        //      double norm = 0.0;
-        //      for(int idim = 0; idim < N; idim++){
-        //        pos[idim] -= origin[idim];
-        //        norm += pos[idim]*pos[idim];
-        //      }
-        //      norm = std::sqrt(norm);
-        //      for(int idim = 0; idim < N; idim++){
-        //        pos[idim] /= norm;
-        //      }
-        //      auto value = density_real.get_real_from_index(real_index);
-        //      for(auto ii: Qindex)
-        //        value *= pos[ii];
-
-        //      Q_real.set_real_from_index(real_index, value);
-        //    }
-        //  }
+        // xxxx + cyc (3), xxxy + cyc (6), xxyy + cyc (3) and xxyz + cyc (3)
+        //================================================================================
+        template <int N>
+        void compute_multipole_Q_term(const FFTWGrid<N> & density_real,
+                                      FFTWGrid<N> & Q_real,
+                                      const std::vector<int> & Qindex,
+                                      const std::vector<double> & origin) {
+            assert_mpi(Qindex.size() > 0, "[compute_multipole_Q_term] Qindex cannot be empty\n");
+            assert_mpi(origin.size() == N, "[compute_multipole_Q_term] Origin has wrong number of dimensions\n");
+            assert_mpi(Q_real.get_nmesh() == density_real.get_nmesh(),
+                       "[compute_multipole_Q_term] The grids must have the same size\n");
+
+            Q_real.set_grid_status_real(true);
+            const auto Local_nx = density_real.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                for (auto && real_index : density_real.get_real_range(islice, islice + 1)) {
+                    auto coord = density_real.get_coord_from_index(real_index);
+                    auto pos = density_real.get_real_position(coord);
+
+                    double norm = 0.0;
+                    for (int idim = 0; idim < N; idim++) {
+                        pos[idim] -= origin[idim];
+                        norm += pos[idim] * pos[idim];
+                    }
+                    norm = std::sqrt(norm);
+
+                    // The cell the observer is in has no direction so we just put it to zero
+                    double value = 0.0;
+                    if (norm > 0.0) {
+                        value = density_real.get_real_from_index(real_index);
+                        for (auto ii : Qindex)
+                            value *= pos[ii] / norm;
+                    }
+                    Q_real.set_real_from_index(real_index, value);
+                }
+            }
+        }
+
+        template <int N, class T, class U>
+        void compute_power_spectrum_multipoles_survey(int Ngrid,
+                                                      const T * galaxies,
+                                                      size_t ngalaxies,
+                                                      const U * randoms,
+                                                      size_t nrandoms,
+                                                      std::vector<double> observer_position,
+                                                      std::vector<PowerSpectrumBinning<N>> & Pell,
+                                                      std::string density_assignment_method) {
+
+            static_assert(FML::PARTICLE::has_get_pos<T>() and FML::PARTICLE::has_get_pos<U>(),
+                          "[compute_power_spectrum_multipoles_survey] Particle class needs to have positions to use "
+                          "this method");
+            assert_mpi(Pell.size() > 0 and Pell.size() <= 5,
+                       "[compute_power_spectrum_multipoles_survey] We can only compute ell = 0, 2 and 4 so Pell must "
+                       "have size 1-5\n");
+            assert_mpi(observer_position.size() == N,
+                       "[compute_power_spectrum_multipoles_survey] Observer position has wrong number of dimensions\n");
+            const int ellmax = int(Pell.size()) - 1;
+
+            // The weights
+            auto galaxy_weight = [](const T & p) { return double(FML::PARTICLE::GetWeight(const_cast<T &>(p))); };
+            auto random_weight = [](const U & p) { return double(FML::PARTICLE::GetWeight(const_cast<U &>(p))); };
+
+            // Sum up the weights to get alpha and the shot-noise. If the randoms has nbar then we use this for the
+            // normalization I = Int nbar^2 w^2 d^Nx = alpha Sum_randoms nbar w^2
+            double sum_w_galaxies = 0.0, sum_w2_galaxies = 0.0;
+            double sum_w_randoms = 0.0, sum_w2_randoms = 0.0, sum_nbar_w2_randoms = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : sum_w_galaxies, sum_w2_galaxies)
+#endif
+            for (size_t i = 0; i < ngalaxies; i++) {
+                const double w = galaxy_weight(galaxies[i]);
+                sum_w_galaxies += w;
+                sum_w2_galaxies += w * w;
+            }
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : sum_w_randoms, sum_w2_randoms, sum_nbar_w2_randoms)
+#endif
+            for (size_t i = 0; i < nrandoms; i++) {
+                const double w = random_weight(randoms[i]);
+                sum_w_randoms += w;
+                sum_w2_randoms += w * w;
+                if constexpr (FML::PARTICLE::has_get_nbar<U>())
+                    sum_nbar_w2_randoms += FML::PARTICLE::GetNbar(const_cast<U &>(randoms[i])) * w * w;
+            }
+            FML::SumOverTasks(&sum_w_galaxies, &sum_w2_galaxies, &sum_w_randoms, &sum_w2_randoms, &sum_nbar_w2_randoms);
+            assert_mpi(sum_w_galaxies > 0.0 and sum_w_randoms > 0.0,
+                       "[compute_power_spectrum_multipoles_survey] The weights of the galaxies and randoms must sum "
+                       "to > 0\n");
+            const double alpha = sum_w_galaxies / sum_w_randoms;
+
+            // Set how many extra slices we need for the density assignment to go smoothly
+            const auto nleftright = get_extra_slices_needed_for_density_assignment(density_assignment_method);
+            const int nleft = nleftright.first;
+            const int nright = nleftright.second;
+
+            // Assign the weighted galaxies and randoms to grids
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            FFTWGrid<N> F_real =
+                pool.checkout(Ngrid, nleft, nright, "FFTWGrid::compute_power_spectrum_multipoles_survey::F_real");
+            FFTWGrid<N> Q_real =
+                pool.checkout(Ngrid, nleft, nright, "FFTWGrid::compute_power_spectrum_multipoles_survey::Q_real");
+            std::vector<GridAndWeight<N, T>> galaxy_grids{{&F_real, galaxy_weight, false}};
+            std::vector<GridAndWeight<N, U>> random_grids{{&Q_real, random_weight, false}};
+            particles_to_grids<N, T>(galaxies, ngalaxies, galaxy_grids, density_assignment_method);
+            particles_to_grids<N, U>(randoms, nrandoms, random_grids, density_assignment_method);
+
+            // Make F(x) = w(x)[n_g(x) - alpha n_r(x)] and compute the normalization from the randoms on the grid
+            // if we don't have nbar (Int (alpha n_r w)^2 d^Nx, this is biased high if we have few randoms per cell)
+            const double Ncells = std::pow(double(Ngrid), N);
+            double sum_nr2 = 0.0;
+            const auto Local_nx = F_real.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : sum_nr2)
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                for (auto && real_index : F_real.get_real_range(islice, islice + 1)) {
+                    const double nr = Q_real.get_real_from_index(real_index);
+                    const double ng = F_real.get_real_from_index(real_index);
+                    F_real.set_real_from_index(real_index, Ncells * (ng - alpha * nr));
+                    sum_nr2 += nr * nr;
+                }
+            }
+            FML::SumOverTasks(&sum_nr2);
+            const double normalization =
+                FML::PARTICLE::has_get_nbar<U>() ? alpha * sum_nbar_w2_randoms : alpha * alpha * Ncells * sum_nr2;
+            const double shotnoise = (sum_w2_galaxies + alpha * alpha * sum_w2_randoms) / normalization;
+            assert_mpi(normalization > 0.0, "[compute_power_spectrum_multipoles_survey] The normalization is zero\n");
+
+            // A_0(k) = F(k)
+            FFTWGrid<N> A0 = pool.checkout(Ngrid, 0, 0, "FFTWGrid::compute_power_spectrum_multipoles_survey::A0");
+            A0.set_grid_status_real(true);
+            for (int islice = 0; islice < Local_nx; islice++)
+                for (auto && real_index : F_real.get_real_range(islice, islice + 1))
+                    A0.set_real_from_index(real_index, F_real.get_real_from_index(real_index));
+            A0.fftw_r2c();
+
+            // A_ell(k) = Sum khat_i khat_j ... Q_ij...(k) over all the ell-tuples (i <= j <= ...) times the
+            // number of permutations of the tuple
+            auto compute_A_ell = [&](int ell, FFTWGrid<N> & A_ell) {
+                A_ell.set_grid_status_real(false);
+                A_ell.fill_fourier_grid(0.0);
+                std::vector<int> Qindex(ell, 0);
+                for (;;) {
+                    // The number of distinct permutations of Qindex: ell! / (n_0! n_1! ...)
+                    double npermutations = std::tgamma(ell + 1.0);
+                    for (int idim = 0; idim < N; idim++)
+                        npermutations /= std::tgamma(1.0 + std::count(Qindex.begin(), Qindex.end(), idim));
+
+                    compute_multipole_Q_term(F_real, Q_real, Qindex, observer_position);
+                    Q_real.fftw_r2c();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        double kmag;
+                        std::array<double, N> kvec;
+                        for (auto && fourier_index : A_ell.get_fourier_range(islice, islice + 1)) {
+                            A_ell.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+                            if (kmag == 0.0)
+                                continue;
+                            double khat_product = npermutations;
+                            for (auto ii : Qindex)
+                                khat_product *= kvec[ii] / kmag;
+                            A_ell.set_fourier_from_index(fourier_index,
+                                                         A_ell.get_fourier_from_index(fourier_index) +
+                                                             Q_real.get_fourier_from_index(fourier_index) *
+                                                                 khat_product);
+                        }
+                    }
+
+                    // Next tuple i <= j <= ...
+                    int ii = ell - 1;
+                    while (ii >= 0 and Qindex[ii] == N - 1)
+                        ii--;
+                    if (ii < 0)
+                        break;
+                    Qindex[ii]++;
+                    for (int jj = ii + 1; jj < ell; jj++)
+                        Qindex[jj] = Qindex[ii];
+                }
+            };
+            FFTWGrid<N> A2, A4;
+            if (ellmax >= 2) {
+                A2 = pool.checkout(Ngrid, 0, 0, "FFTWGrid::compute_power_spectrum_multipoles_survey::A2");
+                compute_A_ell(2, A2);
+            }
+            if (ellmax >= 4) {
+                A4 = pool.checkout(Ngrid, 0, 0, "FFTWGrid::compute_power_spectrum_multipoles_survey::A4");
+                compute_A_ell(4, A4);
+            }
+            pool.give_back(std::move(F_real));
+            pool.give_back(std::move(Q_real));
+
+            // Deconvolve the window function
+            deconvolve_window_function_fourier<N>(A0, density_assignment_method);
+            if (ellmax >= 2)
+                deconvolve_window_function_fourier<N>(A2, density_assignment_method);
+            if (ellmax >= 4)
+                deconvolve_window_function_fourier<N>(A4, density_assignment_method);
+
+            // Initialize binning just in case
+            for (size_t ell = 0; ell < Pell.size(); ell++)
+                Pell[ell].reset();
+
+            // Bin up P0 = <|A0|^2>, P2 = 5/2 <A0(3A2^* - A0^*)> and P4 = 9/8 <A0(35A4^* - 30A2^* + 3A0^*)>
+            std::vector<PowerSpectrumBinning<N> *> binnings;
+            for (int ell = 0; ell <= ellmax; ell += 2)
+                binnings.push_back(&Pell[ell]);
+            bin_up_fourier_modes<N>(
+                A0,
+                binnings,
+                [&](IndexIntType fourier_index, const std::array<double, N> &, double, double * values) {
+                    const auto a0 = A0.get_fourier_from_index(fourier_index);
+                    const double a0a0 = std::norm(a0);
+                    values[0] = a0a0;
+                    if (ellmax >= 2) {
+                        const double a0a2 = std::real(a0 * std::conj(A2.get_fourier_from_index(fourier_index)));
+                        values[1] = 2.5 * (3.0 * a0a2 - a0a0);
+                        if (ellmax >= 4) {
+                            const double a0a4 = std::real(a0 * std::conj(A4.get_fourier_from_index(fourier_index)));
+                            values[2] = 9.0 / 8.0 * (35.0 * a0a4 - 30.0 * a0a2 + 3.0 * a0a0);
+                        }
+                    }
+                });
+            pool.give_back(std::move(A0));
+            if (ellmax >= 2)
+                pool.give_back(std::move(A2));
+            if (ellmax >= 4)
+                pool.give_back(std::move(A4));
+
+            // Normalize (this communicates over tasks)
+            for (size_t ell = 0; ell < Pell.size(); ell++) {
+                Pell[ell].normalize();
+                for (int i = 0; i < Pell[ell].n; i++)
+                    Pell[ell].pofk[i] /= normalization;
+            }
+
+            // Subtract shotnoise for monopole
+            if (Pell[0].subtract_shotnoise)
+                for (int i = 0; i < Pell[0].n; i++)
+                    Pell[0].pofk[i] -= shotnoise;
+        }
 
         template <int N, class T>
         void compute_monospectrum(int Ngrid,
@@ -1080,8 +2212,8 @@ namespace FML {
             const int nleft = nleftright.first;
             const int nright = nleftright.second + 1;
 
-            FFTWGrid<N> density_k(Ngrid, nleft, nright);
-            density_k.add_memory_label("FFTWGrid::compute_polyspectrum::density_k");
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            FFTWGrid<N> density_k = pool.checkout(Ngrid, nleft, nright, "FFTWGrid::compute_polyspectrum::density_k");
 
             if (interlacing) {
 
@@ -1100,6 +2232,7 @@ namespace FML {
 
             // Compute polyspectrum
             compute_polyspectrum<N, ORDER>(density_k, polyofk);
+            pool.give_back(std::move(density_k));
 
             // Subtract shotnoise if ORDER = 2 or 3
             if constexpr (ORDER == 2) {
@@ -1128,6 +2261,169 @@ namespace FML {
             }
         }
 
+        //================================================================================
+        /// @brief This method is used by compute_polyspectrum and compute_polyspectrum_bincount. The number of shell
+        /// grids we can keep in memory given the memory budget polyofk.max_memory_in_mb (all nbins if there is no
+        /// budget).
+        ///
+        /// @param[in] polyofk The binning.
+        /// @param[in] bytes_per_grid The memory of one shell grid on the local task.
+        ///
+        //================================================================================
+        template <int N, int ORDER>
+        int get_polyspectrum_nbins_in_memory(const PolyspectrumBinning<N, ORDER> & polyofk, double bytes_per_grid) {
+            if (polyofk.max_memory_in_mb <= 0.0)
+                return polyofk.n;
+            double nbins_in_memory = polyofk.max_memory_in_mb * 1e6 / bytes_per_grid;
+            FML::MinOverTasks(&nbins_in_memory);
+            return int(std::min(nbins_in_memory, double(polyofk.n)));
+        }
+
+        //================================================================================
+        /// @brief This method is used by compute_polyspectrum and compute_polyspectrum_bincount. It computes the
+        /// integrals \f$ \int \frac{d^Nx}{(2\pi)^N} F_{k_1}(x) \cdots F_{k_{\rm ORDER}}(x) \f$ over the shell grids
+        /// for all the configurations we need (the rest is set to 0). If we cannot have all the nbins shell grids in
+        /// memory at once the bins are split into blocks of nbins_in_memory / ORDER bins. We loop over all the
+        /// combinations of ORDER blocks, keep the shells of these blocks and recompute the shells we don't have. This
+        /// costs more fourier transforms, but the memory is bounded by nbins_in_memory grids.
+        ///
+        /// @tparam N The dimension we work in
+        /// @tparam ORDER The order (mono = 2, bi = 3, tri = 4)
+        /// @tparam ShellFunction Callable as make_shell(int i, FFTWGrid<N> & grid) that makes shell grid i in real
+        /// space.
+        ///
+        /// @param[in] polyofk The binning.
+        /// @param[in] nbins_in_memory The maximum number of shell grids to have in memory at once.
+        /// @param[in] make_shell The function that makes the shell grids.
+        /// @param[out] F123 The integrals.
+        ///
+        //================================================================================
+        template <int N, int ORDER, class ShellFunction>
+        void integrate_polyspectrum_shells(PolyspectrumBinning<N, ORDER> & polyofk,
+                                           int nbins_in_memory,
+                                           ShellFunction && make_shell,
+                                           std::vector<double> & F123) {
+
+            const int nbins = polyofk.n;
+            const int blocksize = (nbins_in_memory >= nbins) ? nbins : nbins_in_memory / ORDER;
+            assert_mpi(blocksize > 0,
+                       "[integrate_polyspectrum_shells] The memory budget is too small. We need to have at least ORDER "
+                       "shell grids in memory\n");
+            const int nblocks = (nbins + blocksize - 1) / blocksize;
+
+#ifdef DEBUG_POLYSPECTRUM
+            if (FML::ThisTask == 0 and nblocks > 1)
+                std::cout << "Computing polyspectrum<" << ORDER << "> in " << nblocks << " blocks of " << blocksize
+                          << " bins\n";
+#endif
+
+            std::vector<FFTWGrid<N>> F_k(nbins);
+            std::vector<bool> shell_is_made(nbins, false);
+            std::fill(F123.begin(), F123.end(), 0.0);
+
+            // Loop over all the combinations of blocks with iblock[0] <= iblock[1] <= ...
+            std::array<int, ORDER> iblock;
+            iblock.fill(0);
+            for (;;) {
+
+                // Free the shells we don't need and make the ones we are missing
+                std::vector<bool> shell_is_needed(nbins, false);
+                for (int ii = 0; ii < ORDER; ii++)
+                    for (int j = iblock[ii] * blocksize; j < std::min(nbins, (iblock[ii] + 1) * blocksize); j++)
+                        shell_is_needed[j] = true;
+                for (int j = 0; j < nbins; j++) {
+                    if (shell_is_made[j] and not shell_is_needed[j]) {
+                        F_k[j].free();
+                        shell_is_made[j] = false;
+                    }
+                }
+                for (int j = 0; j < nbins; j++) {
+                    if (shell_is_needed[j] and not shell_is_made[j]) {
+                        make_shell(j, F_k[j]);
+                        shell_is_made[j] = true;
+                    }
+                }
+
+                // The symmetry-unique configurations ik1 <= ik2 <= ... in the current blocks (skipping the ones that
+                // don't satisfy the triangle inequality). Since iblock is sorted, filling in each ik from the previous
+                // one always gives a valid configuration so we can step through them like an odometer
+                std::array<int, ORDER> ik_begin, ik_end, ik;
+                for (int ii = 0; ii < ORDER; ii++) {
+                    ik_begin[ii] = iblock[ii] * blocksize;
+                    ik_end[ii] = std::min(nbins, (iblock[ii] + 1) * blocksize);
+                }
+                auto fill_from = [&](int ii_from) {
+                    for (int ii = ii_from; ii < ORDER; ii++)
+                        ik[ii] = (ii == 0) ? ik_begin[0] : std::max(ik_begin[ii], ik[ii - 1]);
+                };
+                std::vector<std::array<int, ORDER>> configurations;
+                fill_from(0);
+                for (;;) {
+                    if (polyofk.compute_this_configuration(ik))
+                        configurations.push_back(ik);
+                    int ii = ORDER - 1;
+                    while (ii >= 0 and ik[ii] + 1 >= ik_end[ii])
+                        ii--;
+                    if (ii < 0)
+                        break;
+                    ik[ii]++;
+                    fill_from(ii + 1);
+                }
+
+                // Compute the sum over triangles by evaluating the integral Int dx^N/(2pi)^N
+                // F_k1(x)F_k2(x)...F_kORDER(x). Every configuration costs the same so if we have enough of them the
+                // threads take whole configurations, otherwise they share the slices of each one. The sums over tasks
+                // are done for all the configurations at once
+                const auto Local_nx = F_k[configurations.empty() ? 0 : configurations[0][0]].get_local_nx();
+                std::vector<double> F123_block(configurations.size(), 0.0);
+#ifdef USE_OMP
+                const bool threads_over_configurations = configurations.size() >= size_t(4 * FML::NThreads);
+#pragma omp parallel for schedule(dynamic) if (threads_over_configurations)
+#endif
+                for (size_t c = 0; c < configurations.size(); c++) {
+                    std::array<const FML::GRID::FloatType *, ORDER> F;
+                    for (int ii = 0; ii < ORDER; ii++)
+                        F[ii] = F_k[configurations[c][ii]].get_real_grid();
+                    const auto & grid = F_k[configurations[c][0]];
+
+                    double F123_current = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : F123_current) if (not threads_over_configurations)
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        for (auto && real_index : grid.get_real_range(islice, islice + 1)) {
+                            double Fproduct = 1.0;
+                            for (int ii = 0; ii < ORDER; ii++)
+                                Fproduct *= F[ii][real_index];
+                            F123_current += Fproduct;
+                        }
+                    }
+                    F123_block[c] = F123_current;
+                }
+#ifdef USE_MPI
+                MPI_Allreduce(
+                    MPI_IN_PLACE, F123_block.data(), int(F123_block.size()), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+
+                // Normalize by the integration measure dx^N / (2pi)^N
+                for (size_t c = 0; c < configurations.size(); c++) {
+                    const int Nmesh = F_k[configurations[c][0]].get_nmesh();
+                    F123[polyofk.get_index_from_coord(configurations[c])] =
+                        F123_block[c] * std::pow(1.0 / double(Nmesh) / (2.0 * M_PI), N);
+                }
+
+                // Go to the next combination of blocks
+                int ii = ORDER - 1;
+                while (ii >= 0 and iblock[ii] == nblocks - 1)
+                    ii--;
+                if (ii < 0)
+                    break;
+                iblock[ii]++;
+                for (int jj = ii + 1; jj < ORDER; jj++)
+                    iblock[jj] = iblock[ii];
+            }
+        }
+
         //================================================================================
         /// @brief This method is used by compute_polyspectrum. It computes the number of
         /// generalized triangles of the bins needed to normalize the polyspectra up to symmetry (i.e. we only compute
@@ -1146,93 +2442,49 @@ namespace FML {
         template <int N, int ORDER>
         void compute_polyspectrum_bincount(int Nmesh, PolyspectrumBinning<N, ORDER> & polyofk) {
 
-            const auto nbins = polyofk.n;
             const auto klow = polyofk.klow;
             const auto khigh = polyofk.khigh;
-            const auto kbin = polyofk.kbin;
             auto & N123 = polyofk.N123;
             const size_t nbins_tot = N123.size();
 
-            // Allocate grids
-            std::vector<FFTWGrid<N>> N_k(nbins);
-            for (int i = 0; i < nbins; i++) {
-                N_k[i] = FFTWGrid<N>(Nmesh);
-                N_k[i].add_memory_label("FFTWGrid::compute_polyspectrum_bincount::N_" + std::to_string(i));
-                N_k[i].set_grid_status_real(false);
-                N_k[i].fill_fourier_grid(0.0);
+            // The memory of one shell grid
+            double bytes_per_grid;
+            {
+                FFTWGrid<N> grid(Nmesh);
+                bytes_per_grid = double(grid.get_ntot_fourier_alloc() * sizeof(typename FFTWGrid<N>::ComplexType));
             }
+            const int nbins_in_memory = get_polyspectrum_nbins_in_memory(polyofk, bytes_per_grid);
+
+            // Make the grid N_k which is 1 in the bin and 0 otherwise in real space
+            auto make_shell = [&](int i, FFTWGrid<N> & grid) {
+                grid = FFTWGrid<N>(Nmesh);
+                grid.add_memory_label("FFTWGrid::compute_polyspectrum_bincount::N_" + std::to_string(i));
+                grid.set_grid_status_real(false);
+                grid.fill_fourier_grid(0.0);
 
-            // Set the grids
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (int i = 0; i < nbins; i++) {
-                FFTWGrid<N> & grid = N_k[i];
                 const double kmag2_max = khigh[i] * khigh[i];
                 const double kmag2_min = klow[i] * klow[i];
-                double kmag2;
-                std::array<double, N> kvec;
-                for (auto && fourier_index : grid.get_fourier_range()) {
-                    grid.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
-                    if (not(kmag2 > kmag2_max or kmag2 < kmag2_min)) {
-                        grid.set_fourier_from_index(fourier_index, 1.0);
-                    }
-                }
-            }
-
-            // Transform to real space
-            for (int i = 0; i < nbins; i++) {
-                N_k[i].fftw_c2r();
-            }
-
-            // We now have N_k for all bins, integrate up
-            for (size_t i = 0; i < nbins_tot; i++) {
-
-                // Current values of ik1,ik2,ik3,...
-                std::array<int, ORDER> ik = polyofk.get_coord_from_index(i);
-
-                // Symmetry: only do ik1 <= ik2 <= ...
-                if (not polyofk.compute_this_configuration(ik)) {
-                    N123[i] = 0.0;
-                    continue;
-                }
-
-                // Compute number of triangles in current bin
-                // Norm represents integration measure dx^N / (2pi)^N
-                double N123_current = 0.0;
-                const double norm = std::pow(1.0 / double(Nmesh) / (2.0 * M_PI), N);
-                const auto Local_nx = N_k[0].get_local_nx();
+                const auto Local_nx = grid.get_local_nx();
 #ifdef USE_OMP
-#pragma omp parallel for reduction(+ : N123_current)
+#pragma omp parallel for
 #endif
                 for (int islice = 0; islice < Local_nx; islice++) {
-                    for (auto && real_index : N_k[0].get_real_range(islice, islice + 1)) {
-                        if constexpr (ORDER == 2) {
-                            double N1 = N_k[ik[0]].get_real_from_index(real_index);
-                            double N2 = N_k[ik[1]].get_real_from_index(real_index);
-                            N123_current += N1 * N2;
-                        } else if constexpr (ORDER == 3) {
-                            double N1 = N_k[ik[0]].get_real_from_index(real_index);
-                            double N2 = N_k[ik[1]].get_real_from_index(real_index);
-                            double N3 = N_k[ik[2]].get_real_from_index(real_index);
-                            N123_current += N1 * N2 * N3;
-                        } else if constexpr (ORDER == 4) {
-                            double N1 = N_k[ik[0]].get_real_from_index(real_index);
-                            double N2 = N_k[ik[1]].get_real_from_index(real_index);
-                            double N3 = N_k[ik[2]].get_real_from_index(real_index);
-                            double N4 = N_k[ik[3]].get_real_from_index(real_index);
-                            N123_current += N1 * N2 * N3 * N4;
-                        } else {
-                            double Nproduct = 1.0;
-                            for (int ii = 0; ii < ORDER; ii++)
-                                Nproduct *= N_k[ik[ii]].get_real_from_index(real_index);
-                            N123_current += Nproduct;
+                    double kmag2;
+                    std::array<double, N> kvec;
+                    for (auto && fourier_index : grid.get_fourier_range(islice, islice + 1)) {
+                        grid.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
+                        if (not(kmag2 > kmag2_max or kmag2 < kmag2_min)) {
+                            grid.set_fourier_from_index(fourier_index, 1.0);
                         }
                     }
                 }
-                FML::SumOverTasks(&N123_current);
-                N123[i] = N123_current * norm;
+                grid.fftw_c2r();
+            };
+
+            // Compute number of triangles in each bin
+            integrate_polyspectrum_shells<N, ORDER>(polyofk, nbins_in_memory, make_shell, N123);
 
+            for (size_t i = 0; i < nbins_tot; i++) {
                 // We cannot have less than 1 generalized triangle so put to zero if small
                 // due to numerical noise
                 if (N123[i] < 1.0)
@@ -1276,11 +2528,89 @@ namespace FML {
             compute_polyspectrum<N, 4>(fourier_grid, tofk);
         }
 
+        template <int N, int ORDER>
+        PolyspectrumPlan<N, ORDER>::PolyspectrumPlan(int Nmesh,
+                                                     const PolyspectrumBinning<N, ORDER> & binning,
+                                                     bool store_mode_bins)
+            : Nmesh(Nmesh), store_mode_bins(store_mode_bins), klow(binning.klow), khigh(binning.khigh) {
+            assert_mpi(binning.n < 32768, "[PolyspectrumPlan] Too many bins\n");
+            if (binning.bincount_is_set) {
+                N123 = binning.N123;
+            } else {
+                PolyspectrumBinning<N, ORDER> binning_copy = binning;
+                compute_polyspectrum_bincount<N, ORDER>(Nmesh, binning_copy);
+                N123 = std::move(binning_copy.N123);
+            }
+        }
+
+        template <int N, int ORDER>
+        bool PolyspectrumPlan<N, ORDER>::matches(int Nmesh, const PolyspectrumBinning<N, ORDER> & binning) const {
+            return this->Nmesh == Nmesh and klow == binning.klow and khigh == binning.khigh;
+        }
+
+        template <int N, int ORDER>
+        void PolyspectrumPlan<N, ORDER>::set_modes(const FFTWGrid<N> & fourier_grid) {
+            if (modes_are_set and fourier_layout_transposed == fourier_grid.get_fourier_layout_transposed() and
+                ntot_fourier == fourier_grid.get_ntot_fourier())
+                return;
+            fourier_layout_transposed = fourier_grid.get_fourier_layout_transposed();
+            ntot_fourier = fourier_grid.get_ntot_fourier();
+
+            // The bin of every mode (the bins are contiguous so the first bin with khigh > k if k >= klow)
+            const int nbins = int(klow.size());
+            std::vector<double> kmag2_min(nbins), kmag2_max(nbins);
+            for (int i = 0; i < nbins; i++) {
+                kmag2_min[i] = klow[i] * klow[i];
+                kmag2_max[i] = khigh[i] * khigh[i];
+            }
+            nmodes = std::vector<double>(nbins, 0.0);
+            kmean = std::vector<double>(nbins, 0.0);
+            if (store_mode_bins)
+                mode_bin.resize(ntot_fourier);
+            double kmag2;
+            std::array<double, N> kvec;
+            for (auto && fourier_index : fourier_grid.get_fourier_range()) {
+                fourier_grid.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
+                int bin = int(std::upper_bound(kmag2_max.begin(), kmag2_max.end(), kmag2) - kmag2_max.begin());
+                if (bin == nbins or kmag2 < kmag2_min[bin])
+                    bin = -1;
+                if (store_mode_bins)
+                    mode_bin[fourier_index] = short(bin);
+                if (bin >= 0) {
+                    nmodes[bin] += 1.0;
+                    kmean[bin] += std::sqrt(kmag2);
+                }
+            }
+            auto nmodes_over_tasks = FML::SumArrayOverTasksAsync(nmodes.data(), nbins);
+            auto kmean_over_tasks = FML::SumArrayOverTasksAsync(kmean.data(), nbins);
+            nmodes_over_tasks.wait();
+            kmean_over_tasks.wait();
+            for (int i = 0; i < nbins; i++)
+                kmean[i] = nmodes[i] == 0.0 ? 0.5 * (klow[i] + khigh[i]) : kmean[i] / nmodes[i];
+            modes_are_set = true;
+        }
+
+        template <int N, int ORDER>
+        void PolyspectrumPlan<N, ORDER>::free() {
+            *this = PolyspectrumPlan<N, ORDER>();
+        }
+
         template <int N, int ORDER>
         void compute_polyspectrum(const FFTWGrid<N> & fourier_grid, PolyspectrumBinning<N, ORDER> & polyofk) {
+            // We keep the last plan so the bin count is only computed once for the same grid and binning
+            static PolyspectrumPlan<N, ORDER> plan;
+            const bool store_mode_bins = false;
+            if (not plan.matches(fourier_grid.get_nmesh(), polyofk))
+                plan = PolyspectrumPlan<N, ORDER>(fourier_grid.get_nmesh(), polyofk, store_mode_bins);
+            compute_polyspectrum<N, ORDER>(fourier_grid, polyofk, plan);
+        }
+
+        template <int N, int ORDER>
+        void compute_polyspectrum(const FFTWGrid<N> & fourier_grid,
+                                  PolyspectrumBinning<N, ORDER> & polyofk,
+                                  PolyspectrumPlan<N, ORDER> & plan) {
 
             const auto Nmesh = fourier_grid.get_nmesh();
-            const auto Local_nx = fourier_grid.get_local_nx();
             const auto nbins = polyofk.n;
 
             assert_mpi(nbins > 0, "[compute_polyspectrum] nbins has to be >=0\n");
@@ -1303,58 +2633,58 @@ namespace FML {
             const std::vector<double> & klow = polyofk.klow;
             const std::vector<double> & khigh = polyofk.khigh;
 
-            // Compute the bincount N123 if it does not already exist
+            // Make the plan if we don't have it and take the bin count from it (if it does not already exist)
+            if (not plan.matches(Nmesh, polyofk))
+                plan = PolyspectrumPlan<N, ORDER>(Nmesh, polyofk);
+            plan.set_modes(fourier_grid);
             if (not polyofk.bincount_is_set)
-                compute_polyspectrum_bincount<N, ORDER>(Nmesh, polyofk);
+                N123 = plan.get_bincount();
+            const auto & nmodes = plan.get_nmodes();
 
-            // Allocate grids
-            std::vector<FFTWGrid<N>> F_k(nbins);
-            for (int i = 0; i < nbins; i++) {
-                F_k[i] = fourier_grid;
-                F_k[i].add_memory_label("FFTWGrid::compute_polyspectrum::F_" + std::to_string(i));
-            }
+            // The number of shell grids we can have in memory at once
+            const double bytes_per_grid =
+                double(fourier_grid.get_ntot_fourier_alloc() * sizeof(typename FFTWGrid<N>::ComplexType));
+            const int nbins_in_memory = get_polyspectrum_nbins_in_memory(polyofk, bytes_per_grid);
 
-            for (int i = 0; i < nbins; i++) {
+            // Make the grid F_k which is delta(k) in the bin and 0 otherwise in real space. If we have to
+            // recompute a shell (blocked mode) we just compute the same P(k) again
+            auto make_shell = [&](int i, FFTWGrid<N> & grid) {
 #ifdef DEBUG_POLYSPECTRUM
                 if (FML::ThisTask == 0)
                     std::cout << "Computing polyspectrum<" << ORDER << "> " << i + 1 << " / " << nbins
                               << " kbin: " << klow[i] / (2.0 * M_PI) << " -> " << khigh[i] / (2.0 * M_PI) << "\n";
 #endif
 
-                FFTWGrid<N> & grid = F_k[i];
+                grid = fourier_grid;
+                grid.add_memory_label("FFTWGrid::compute_polyspectrum::F_" + std::to_string(i));
 
                 // For each bin get klow, khigh
                 const double kmag2_max = khigh[i] * khigh[i];
                 const double kmag2_min = klow[i] * klow[i];
 
-                // Loop over all cells
-                double kmean_bin = 0.0;
-                double nk = 0;
+                // Loop over all cells and set to zero outside the bin
                 double kmag2;
                 pofk_bin[i] = 0.0;
                 std::array<double, N> kvec;
                 for (auto && fourier_index : grid.get_fourier_range()) {
-                    grid.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
-
-                    // Set to zero outside the bin
-                    if (kmag2 >= kmag2_max or kmag2 < kmag2_min) {
-                        grid.set_fourier_from_index(fourier_index, 0.0);
+                    bool in_bin;
+                    if (plan.has_mode_bins()) {
+                        in_bin = plan.get_mode_bin(fourier_index) == i;
                     } else {
-                        // Compute mean k in the bin
-                        kmean_bin += std::sqrt(kmag2);
+                        grid.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
+                        in_bin = not(kmag2 >= kmag2_max or kmag2 < kmag2_min);
+                    }
+                    if (in_bin) {
                         pofk_bin[i] += std::norm(grid.get_fourier_from_index(fourier_index));
-                        nk += 1.0;
+                    } else {
+                        grid.set_fourier_from_index(fourier_index, 0.0);
                     }
                 }
-                FML::SumOverTasks(&kmean_bin);
-                FML::SumOverTasks(&pofk_bin[i]);
-                FML::SumOverTasks(&nk);
+                // Sum the power over tasks while we transform to real space
+                auto pofk_over_tasks = FML::SumOverTasksAsync(&pofk_bin[i]);
 
                 // The mean k in the bin
-                kmean[i] = (nk == 0) ? kbin[i] : kmean_bin / double(nk);
-
-                // Power spectrum in the bin
-                pofk_bin[i] = (nk == 0) ? 0.0 : pofk_bin[i] / double(nk);
+                kmean[i] = (nmodes[i] == 0) ? kbin[i] : plan.get_kmean()[i];
 
 #ifdef DEBUG_POLYSPECTRUM
                 if (FML::ThisTask == 0)
@@ -1363,49 +2693,17 @@ namespace FML {
 
                 // Transform to real space
                 grid.fftw_c2r();
-            }
 
-            // We now have F_k and N_k for all bins
-            for (size_t i = 0; i < nbins_tot; i++) {
-#ifdef DEBUG_POLYSPECTRUM
-                if (FML::ThisTask == 0)
-                    if ((i * 10) / nbins_tot != ((i + 1) * 10) / nbins_tot)
-                        std::cout << "Integrating up " << 100 * (i + 1) / nbins_tot << " %\n";
-                ;
-#endif
-
-                // Current values of ik1,ik2,ik3,...
-                const auto ik = polyofk.get_coord_from_index(i);
-
-                // Symmetry: only do ik1 <= ik2 <= ... and don't need to do configurations that don't satisfy the
-                // triangle inequality
-                if (not polyofk.compute_this_configuration(ik)) {
-                    P123[i] = 0.0;
-                    continue;
-                }
-
-                // Compute the sum over triangles by evaluating the integral Int dx^N/(2pi)^N
-                // delta_k1(x)delta_k2(x)...delta_kORDER(x)
-                double F123_current = 0.0;
-#ifdef USE_OMP
-#pragma omp parallel for reduction(+ : F123_current)
-#endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    for (auto && real_index : F_k[0].get_real_range(islice, islice + 1)) {
-                        double Fproduct = 1.0;
-                        for (int ii = 0; ii < ORDER; ii++)
-                            Fproduct *= F_k[ik[ii]].get_real_from_index(real_index);
-                        F123_current += Fproduct;
-                    }
-                }
-                FML::SumOverTasks(&F123_current);
-
-                // Normalize by the integration measure dx^N / (2pi)^N
-                F123_current *= std::pow(1.0 / double(Nmesh) / (2.0 * M_PI), N);
+                // Power spectrum in the bin
+                pofk_over_tasks.wait();
+                pofk_bin[i] = (nmodes[i] == 0) ? 0.0 : pofk_bin[i] / nmodes[i];
+            };
 
-                // Set the result
+            // Compute the integrals over the shells: F123
+            integrate_polyspectrum_shells<N, ORDER>(polyofk, nbins_in_memory, make_shell, P123);
+            for (size_t i = 0; i < nbins_tot; i++) {
                 const double N123_current = N123[i];
-                P123[i] = (N123_current > 0.0) ? F123_current / N123_current : 0.0;
+                P123[i] = (N123_current > 0.0) ? P123[i] / N123_current : 0.0;
             }
 
             // Set stuff not computed above which follows from symmetry
@@ -45,6 +45,11 @@ namespace FML {
             /// If we have precomputed the volume factor (N123) or not and have it availiable for algorithms to use
             bool bincount_is_set{false};
 
+            /// The maximum memory (in MB per task) to use for the shell grids in compute_polyspectrum. If 0 we keep
+            /// all the n shell grids in memory. Otherwise we compute the spectra in blocks of bins and recompute the
+            /// shells as needed (more fourier transforms, but we can do many more bins)
+            double max_memory_in_mb{0.0};
+
             PolyspectrumBinning() = default;
             PolyspectrumBinning(double _kmin, double _kmax, int nbins, int bin_type = LINEAR_SPACING);
             PolyspectrumBinning(int nbins, int Nmesh, int bin_type = LINEAR_SPACING);
@@ -65,6 +65,12 @@ namespace FML {
             /// Add a new point to a bin
             void add_to_bin(double kvalue, double power, double weight = 1.0);
 
+            /// Add the sums of the weights, weight * power and weight * k in each bin (e.g. binned up by a thread in
+            /// its own arrays). Can be called by all threads at the same time
+            void add_to_bins(const std::vector<double> & count_partial,
+                             const std::vector<double> & pofk_partial,
+                             const std::vector<double> & kbin_partial);
+
             /// Normalize (i.e. find mean in each bin) Do summation over MPI tasks
             void normalize();
 
@@ -171,6 +177,30 @@ namespace FML {
 #endif
         }
 
+        template <int N>
+        void PowerSpectrumBinning<N>::add_to_bins(const std::vector<double> & count_partial,
+                                                  const std::vector<double> & pofk_partial,
+                                                  const std::vector<double> & kbin_partial) {
+            assert_mpi(count_partial.size() == size_t(n) and pofk_partial.size() == size_t(n) and
+                           kbin_partial.size() == size_t(n),
+                       "[PowerSpectrumBinning::add_to_bins] The partial sums have the wrong size\n");
+#ifdef USE_OMP
+            const int myid = NThreads == 1 ? 0 : omp_get_thread_num();
+            auto & count_sum = count_thread[myid];
+            auto & pofk_sum = pofk_thread[myid];
+            auto & kbin_sum = kbin_thread[myid];
+#else
+            auto & count_sum = count;
+            auto & pofk_sum = pofk;
+            auto & kbin_sum = kbin;
+#endif
+            for (int i = 0; i < n; i++) {
+                count_sum[i] += count_partial[i];
+                pofk_sum[i] += pofk_partial[i];
+                kbin_sum[i] += kbin_partial[i];
+            }
+        }
+
         template <int N>
         void PowerSpectrumBinning<N>::reset() {
             for (int i = 0; i < n; i++) {
@@ -200,11 +230,13 @@ namespace FML {
             }
 #endif
 
-#ifdef USE_MPI
-            MPI_Allreduce(MPI_IN_PLACE, pofk.data(), n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            MPI_Allreduce(MPI_IN_PLACE, count.data(), n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            MPI_Allreduce(MPI_IN_PLACE, kbin.data(), n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-#endif
+            // Sum over tasks (the three reductions are in flight at the same time)
+            auto pofk_over_tasks = FML::SumArrayOverTasksAsync(pofk.data(), n);
+            auto count_over_tasks = FML::SumArrayOverTasksAsync(count.data(), n);
+            auto kbin_over_tasks = FML::SumArrayOverTasksAsync(kbin.data(), n);
+            pofk_over_tasks.wait();
+            count_over_tasks.wait();
+            kbin_over_tasks.wait();
 
             for (int i = 0; i < n; i++) {
                 if (count[i] > 0) {
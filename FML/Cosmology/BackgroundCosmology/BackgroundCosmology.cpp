@@ -115,69 +115,121 @@ namespace FML {
             std::cout << "\n";
         }
 
+        BackgroundCosmology::BackgroundGrids BackgroundCosmology::make_grids() const {
+            BackgroundGrids grids;
+
+            // Make a array of log(a) from the very early Univers till a bit into the
+            // future
+            grids.x_array = FML::MATH::linspace(x_min_background, x_max_background, n_pts_splines);
+
+            // Comoving distance (only to the present time and not too far back)
+            grids.x_array_chi = FML::MATH::linspace(std::max(x_min_background, -15.0), 0.0, n_pts_splines);
+
+            // The growth factors for CDM starts out deep in the matter era
+            if (cdm_growth_factors)
+                grids.x_array_growth = FML::MATH::linspace(-std::log(1000.0), x_max_background, n_pts_splines);
+            else
+                grids.x_array_growth = grids.x_array;
+
+            return grids;
+        }
+
         void BackgroundCosmology::solve() {
+            BackgroundGrids grids = make_grids();
+            ODESolver eta_ode(
+                FIDUCIAL_COSMO_HSTART_ODE_ETA, FIDUCIAL_COSMO_HSTART_ODE_ETA, FIDUCIAL_COSMO_RELERR_ODE_ETA);
+            ODESolver growth_ode(1e-3, 1e-12, 1e-12);
+            solve(grids, eta_ode, growth_ode);
+        }
+
+        void BackgroundCosmology::solve(BackgroundGrids & grids, ODESolver & eta_ode, ODESolver & growth_ode) {
 
             // Solve the background and make splines for Hubble functions
-            compute_background();
+            compute_background(grids.x_array);
 
             // Compute conformal time + cosmic time + ...
-            compute_conformal_time();
+            compute_conformal_time(grids.x_array, grids.x_array_chi, eta_ode);
 
             // Compute growth factors
-            compute_growth_factors();
+            compute_growth_factors(grids.x_array_growth, growth_ode);
         }
 
-        void BackgroundCosmology::compute_background() {
-
-            // Make a array of log(a) from the very early Univers till a bit into the
-            // future
-            DVector x_array = FML::MATH::linspace(x_min_background, x_max_background, n_pts_splines);
-
-            // Define the Hubble functions we are to spline
-            auto H_function = [&](double x) {
-                return H0 * std::sqrt(OmegaLambda + OmegaK * std::exp(-2 * x) + OmegaM * std::exp(-3 * x) +
-                                      OmegaRtot * std::exp(-4 * x));
-            };
-            auto Hp_function = [&](double x) { return std::exp(x) * H_function(x); };
-            auto dHdx_function = [&](double x) {
-                return 1.0 / (2.0 * H_function(x)) * H0 * H0 *
-                       (-2 * OmegaK * std::exp(-2 * x) - 3 * OmegaM * std::exp(-3 * x) -
-                        4 * OmegaRtot * std::exp(-4 * x));
-            };
-            auto dHpdx_function = [&](double x) {
-                return 1.0 / (2.0 * Hp_function(x)) * H0 * H0 *
-                       (2 * OmegaLambda * std::exp(2 * x) - OmegaM * std::exp(-x) - 2 * OmegaRtot * std::exp(-2 * x));
-            };
-            auto w_function = [&](double x) {
-                return (OmegaRtot * std::exp(-4 * x) / 3.0 - OmegaLambda - OmegaK * std::exp(-2 * x) / 3.0) /
-                       std::pow(H_function(x) / H0, 2);
-            };
+        std::vector<std::shared_ptr<BackgroundCosmology>>
+        BackgroundCosmology::solve_many(const std::vector<ParameterMap> & params) {
+            const int n = int(params.size());
+            std::vector<std::shared_ptr<BackgroundCosmology>> result(n);
+            if (n == 0)
+                return result;
+
+            // The grids only depend on settings that are the same for all cosmologies
+            BackgroundGrids grids = BackgroundCosmology().make_grids();
+
+            // An exception cannot leave the parallel region so we keep the first one and rethrow it after
+            std::exception_ptr error{nullptr};
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+            {
+                // One set of ODE workspaces per thread
+                ODESolver eta_ode(
+                    FIDUCIAL_COSMO_HSTART_ODE_ETA, FIDUCIAL_COSMO_HSTART_ODE_ETA, FIDUCIAL_COSMO_RELERR_ODE_ETA);
+                ODESolver growth_ode(1e-3, 1e-12, 1e-12);
+#ifdef USE_OMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+                for (int i = 0; i < n; i++) {
+                    try {
+                        auto cosmo = std::make_shared<BackgroundCosmology>(params[i]);
+                        cosmo->solve(grids, eta_ode, growth_ode);
+                        result[i] = cosmo;
+                    } catch (...) {
+#ifdef USE_OMP
+#pragma omp critical
+#endif
+                        if (not error)
+                            error = std::current_exception();
+                    }
+                }
+            }
+            if (error)
+                std::rethrow_exception(error);
+            return result;
+        }
 
-            // Spline the Hubble function and derivatives
-            DVector H_array(x_array);
-            DVector Hp_array(x_array);
-            DVector dHdx_array(x_array);
-            DVector dHpdx_array(x_array);
-            DVector w_array(x_array);
-            for (auto & x : H_array) {
-                double xs = x;
-                x = H_function(x);
-                if (x != x) {
-                    throw std::runtime_error("Compute background. H(x) crossing 0.0 at x = " + std::to_string(xs) +
+        void BackgroundCosmology::compute_background(const DVector & x_array) {
+
+            // Spline the Hubble function and derivatives. We use a = exp(x) and its powers directly to avoid
+            // evaluating the same exponentials for each of the functions
+            const int npts = int(x_array.size());
+            DVector H_array(npts);
+            DVector Hp_array(npts);
+            DVector dHdx_array(npts);
+            DVector dHpdx_array(npts);
+            DVector w_array(npts);
+            for (int i = 0; i < npts; i++) {
+                const double x = x_array[i];
+                const double a = std::exp(x);
+                const double ainv = 1.0 / a;
+                const double ainv2 = ainv * ainv;
+                const double ainv3 = ainv2 * ainv;
+                const double ainv4 = ainv2 * ainv2;
+
+                // E = H/H0
+                const double E2 = OmegaLambda + OmegaK * ainv2 + OmegaM * ainv3 + OmegaRtot * ainv4;
+                const double H = H0 * std::sqrt(E2);
+                if (H != H) {
+                    throw std::runtime_error("Compute background. H(x) crossing 0.0 at x = " + std::to_string(x) +
                                              "\n");
                 }
-            }
-            for (auto & x : Hp_array) {
-                x = Hp_function(x);
-            }
-            for (auto & x : dHdx_array) {
-                x = dHdx_function(x);
-            }
-            for (auto & x : dHpdx_array) {
-                x = dHpdx_function(x);
-            }
-            for (auto & x : w_array) {
-                x = w_function(x);
+                const double Hp = a * H;
+
+                H_array[i] = H;
+                Hp_array[i] = Hp;
+                dHdx_array[i] =
+                    1.0 / (2.0 * H) * H0 * H0 * (-2 * OmegaK * ainv2 - 3 * OmegaM * ainv3 - 4 * OmegaRtot * ainv4);
+                dHpdx_array[i] =
+                    1.0 / (2.0 * Hp) * H0 * H0 * (2 * OmegaLambda * a * a - OmegaM * ainv - 2 * OmegaRtot * ainv2);
+                w_array[i] = (OmegaRtot * ainv4 / 3.0 - OmegaLambda - OmegaK * ainv2 / 3.0) / E2;
             }
             H_spline.create(x_array, H_array, "H_of_x");
             Hp_spline.create(x_array, Hp_array, "Hp_of_x");
@@ -186,11 +238,9 @@ namespace FML {
             w_spline.create(x_array, w_array, "w_of_x");
         }
 
-        void BackgroundCosmology::compute_conformal_time() {
-
-            // Make a array of log(a) from the very early Univers till a bit into the
-            // future
-            DVector x_array = FML::MATH::linspace(x_min_background, x_max_background, n_pts_splines);
+        void BackgroundCosmology::compute_conformal_time(DVector & x_array,
+                                                         const DVector & x_array_chi,
+                                                         ODESolver & eta_ode) {
 
             // The ODE system deta/dx = c/Hp and dt/dx = c/H
             ODEFunction deriv = [&](double x, [[maybe_unused]] const double * y, double * dydx) {
@@ -211,8 +261,6 @@ namespace FML {
                                std::exp(2.0 * x_array[0]) / 2.0 / std::sqrt(OmegaRtot)};
 
             // Solve the ODE
-            ODESolver eta_ode(
-                FIDUCIAL_COSMO_HSTART_ODE_ETA, FIDUCIAL_COSMO_HSTART_ODE_ETA, FIDUCIAL_COSMO_RELERR_ODE_ETA);
             eta_ode.solve(deriv, x_array, eta_initial);
 
             // Fetch the result and get eta and t. Divide by H0 as we solved in units of
@@ -234,25 +282,18 @@ namespace FML {
             eta0 = eta_of_x_spline(0.0);
 
             // Comoving distance (only to the present time and not too far back)
-            DVector chi_array(eta);
-            DVector x_array_chi = FML::MATH::linspace(std::max(x_min_background, -15.0), 0.0, n_pts_splines);
-            for (int i = 0; i < n_pts_splines; i++) {
+            DVector chi_array(x_array_chi.size());
+            for (size_t i = 0; i < x_array_chi.size(); i++) {
                 chi_array[i] = (eta0 - eta_of_x_spline(x_array_chi[i]));
             }
             chi_of_x_spline.create(x_array_chi, chi_array);
             x_of_chi_spline.create(chi_array, x_array_chi);
         }
 
-        void BackgroundCosmology::compute_growth_factors() {
+        void BackgroundCosmology::compute_growth_factors(DVector & x_array, ODESolver & growth_ode) {
             // This is the growth factor for DeltaM, the total comoving matter perturbationvwhich includes radiation
-            // If the flag below is true its the usual one
-            const bool cdm_growth_fac = true;
-
-            DVector x_array;
-            if (cdm_growth_fac)
-                x_array = FML::MATH::linspace(-std::log(1000.0), x_max_background, n_pts_splines);
-            else
-                x_array = FML::MATH::linspace(x_min_background, x_max_background, n_pts_splines);
+            // If cdm_growth_factors is true its the usual one
+            const bool cdm_growth_fac = cdm_growth_factors;
 
             // Growth factors (1LPT and 2LPT)
             ODEFunction deriv_growth = [&](double x, const double * y, double * dydx) {
@@ -285,7 +326,6 @@ namespace FML {
 
             // Solve the ODE
             DVector D_ini{D1ini, V1ini, D2ini, V2ini};
-            ODESolver growth_ode(1e-3, 1e-12, 1e-12);
             growth_ode.solve(deriv_growth, x_array, D_ini);
 
             // Fetch solution
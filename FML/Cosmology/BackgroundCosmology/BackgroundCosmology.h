@@ -2,9 +2,12 @@
 #define _BACKGROUNDCOSMOLOGY_HEADER
 #include <algorithm>
 #include <chrono>
+#include <exception>
 #include <fstream>
 #include <functional>
+#include <memory>
 #include <utility>
+#include <vector>
 
 #include <FML/Math/Math.h>
 #include <FML/ODESolver/ODESolver.h>
@@ -87,10 +90,24 @@ namespace FML {
             double x_min_background{FIDUCIAL_COSMO_X_START};
             double x_max_background{FIDUCIAL_COSMO_X_END};
 
+            // If true the growth factors are for CDM+baryons, otherwise for the total comoving matter
+            // perturbation which includes radiation
+            static constexpr bool cdm_growth_factors = true;
+
+            // The x = log(a) grids we solve on. These only depend on the range and number of points
+            // so they can be shared between many cosmologies (see solve_many)
+            struct BackgroundGrids {
+                DVector x_array;
+                DVector x_array_chi;
+                DVector x_array_growth;
+            };
+            BackgroundGrids make_grids() const;
+
             // Internal solve methods
-            void compute_growth_factors();
-            void compute_conformal_time();
-            void compute_background();
+            void solve(BackgroundGrids & grids, ODESolver & eta_ode, ODESolver & growth_ode);
+            void compute_growth_factors(DVector & x_array, ODESolver & growth_ode);
+            void compute_conformal_time(DVector & x_array, const DVector & x_array_chi, ODESolver & eta_ode);
+            void compute_background(const DVector & x_array);
 
           public:
             BackgroundCosmology(){};
@@ -103,6 +120,10 @@ namespace FML {
 
             /// Solve everything for the background
             void solve();
+            /// Create and solve the background for many parameter sets in parallel (OpenMP). For parameter scans.
+            /// The x-grids are made once and shared and each thread reuses its ODE workspaces between cosmologies
+            static std::vector<std::shared_ptr<BackgroundCosmology>>
+            solve_many(const std::vector<ParameterMap> & params);
             /// Show some info
             void info() const;
             /// Output some data related to the background
@@ -119,6 +119,7 @@ void read_parameters(FML::UTILS::ParameterMap & p) {
     // Add recombination parameters
     pmap["userecfast"] = false;         // Use recfast? (Must be compiled and linked to work)
     pmap["RecFudgeFactor"] = 1.14;      // Fudgefactor in Peebles equation in Recfast
+    pmap["tabulated_recombination_rates"] = false; // Use tabulated rates in the Peebles equation (faster)
     pmap["Yp"] = 0.24;                  // Helium abundance
     pmap["reionization"] = true;        // Include reionization?
     pmap["z_reion"] = 11.0;             // Reionization redshift
@@ -152,12 +153,17 @@ void read_parameters(FML::UTILS::ParameterMap & p) {
     // Accuracy settings (NB: keta_max and n_ell's also impact the accuracy)
     pmap["pert_integration_nk_per_logint"] = 25;  // Number of k's per logarithmic interval, 100 for high accuracy
     pmap["pert_spline_all_ells"] = false;         // Spline all the Theta_ell(k,x) etc. multipoles otherwise just 0,1,2
+    pmap["pert_implicit_tight_coupling"] = false; // Use an implicit stepper with a Jacobian in the tight coupling regime
+    pmap["pert_adaptive_k_sampling"] = true;      // Only integrate the k-modes needed to interpolate the rest
+    pmap["pert_adaptive_k_tolerance"] = 1e-3;     // Max relative interpolation error allowed with adaptive k-sampling
     pmap["pert_x_initial"] = -15.0;               // When to start the integration x = log(aini)
     pmap["pert_delta_x"] = 0.05;                  // Sampling in x for splines of perturbation
     pmap["bessel_nsamples_per_osc"] = 16;         // Sampling of bessel functions
     pmap["los_integration_nsamples_per_osc"] = 8; // Sampling of line of sight integrals
     pmap["los_integration_loga_nsamples"] = 300;  // Samping of line of sight integrals
     pmap["cell_nsamples_per_osc"] = 32;           // Sampling of Cell integration
+    pmap["ell_limber"] = 0;                       // Use the Limber approximation for the lensing Cell above this ell (0: never)
+    pmap["bessel_cache_folder"] = std::string(""); // Folder to cache the bessel function tables in ("": no cache)
 
     // Show all that we have in the map
     if (FML::ThisTask == 0)
@@ -29,6 +29,14 @@ namespace FML {
             // Store all the ell's when we integrate or just 0,1,2
             pert_spline_all_ells = p.get<bool>("pert_spline_all_ells");
 
+            // Use an implicit stepper with a Jacobian in the (stiff) tight coupling regime
+            pert_implicit_tight_coupling = p.get<bool>("pert_implicit_tight_coupling", false);
+
+            // Only integrate the k-modes needed to interpolate the rest to within a given tolerance
+            pert_adaptive_k_sampling = p.get<bool>("pert_adaptive_k_sampling", false);
+            pert_adaptive_k_tolerance = p.get<double>("pert_adaptive_k_tolerance", pert_adaptive_k_tolerance);
+            pert_adaptive_k_stride = std::max(1, p.get<int>("pert_adaptive_k_stride", pert_adaptive_k_stride));
+
             // Set up k-range and sample frequency
             const double delta_log_k = std::log(10.0) / n_per_logint;
             k_min = keta_min / cosmo->eta_of_x(0.0);
@@ -484,6 +492,131 @@ namespace FML {
             compute_source_functions();
         }
 
+        void Perturbations::integrate_perturbations_adaptive(
+            std::function<void(const std::vector<int> &)> integrate_k_modes,
+            DVector2D & results) {
+
+            // Start by integrating every pert_adaptive_k_stride'th mode (and the last one). Then repeatedly
+            // integrate the midpoint of every gap between integrated modes and compare it to the cubic
+            // interpolation in log(k) from the integrated neighbours. Gaps where these agree to within
+            // pert_adaptive_k_tolerance are filled in by interpolation, the rest are split in two and refined
+            std::vector<bool> integrated(n_k_total, false);
+
+            // Lagrange interpolation of all quantities at mode ik using (up to) two integrated modes on each side.
+            // The k-array is log-spaced so the index is a linear coordinate in log(k)
+            auto interpolate_mode = [&](int ik, int iq) {
+                std::vector<int> nodes;
+                for (int i = ik - 1, n = 0; i >= 0 and n < 2; i--)
+                    if (integrated[i]) {
+                        nodes.push_back(i);
+                        n++;
+                    }
+                for (int i = ik + 1, n = 0; i < n_k_total and n < 2; i++)
+                    if (integrated[i]) {
+                        nodes.push_back(i);
+                        n++;
+                    }
+                DVector y(n_x_total, 0.0);
+                for (size_t i = 0; i < nodes.size(); i++) {
+                    double w = 1.0;
+                    for (size_t j = 0; j < nodes.size(); j++)
+                        if (j != i)
+                            w *= double(ik - nodes[j]) / double(nodes[i] - nodes[j]);
+                    for (int ix = 0; ix < n_x_total; ix++)
+                        y[ix] += w * results[iq][ix + n_x_total * nodes[i]];
+                }
+                return y;
+            };
+
+            // The quantities we use to measure the interpolation error: the scalars and the
+            // multipoles that enter the source functions
+            std::vector<int> iq_check{
+                psinfo.index_delta_cdm, psinfo.index_delta_b, psinfo.index_v_cdm, psinfo.index_v_b, psinfo.index_Phi};
+            for (int ell = 0; ell < std::min(3, psinfo.n_ell_theta); ell++)
+                iq_check.push_back(psinfo.index_theta_start + ell);
+            for (int ell = 0; ell < std::min(3, psinfo.n_ell_theta_p); ell++)
+                iq_check.push_back(psinfo.index_theta_p_start + ell);
+            for (int ell = 0; ell < std::min(3, psinfo.n_ell_nu); ell++)
+                iq_check.push_back(psinfo.index_nu_start + ell);
+
+            // Maximum relative error (relative to the max over x) when interpolating to mode ik
+            auto interpolation_error = [&](int ik) {
+                double maxerr = 0.0;
+                for (auto iq : iq_check) {
+                    auto y = interpolate_mode(ik, iq);
+                    double maxdiff = 0.0, maxabs = 0.0;
+                    for (int ix = 0; ix < n_x_total; ix++) {
+                        const double value = results[iq][ix + n_x_total * ik];
+                        maxdiff = std::max(maxdiff, std::abs(y[ix] - value));
+                        maxabs = std::max(maxabs, std::abs(value));
+                    }
+                    if (maxabs > 0.0)
+                        maxerr = std::max(maxerr, maxdiff / maxabs);
+                }
+                return maxerr;
+            };
+
+            // The coarse grid
+            std::vector<int> ik_todo;
+            for (int ik = 0; ik < n_k_total; ik += pert_adaptive_k_stride)
+                ik_todo.push_back(ik);
+            if (ik_todo.back() != n_k_total - 1)
+                ik_todo.push_back(n_k_total - 1);
+            integrate_k_modes(ik_todo);
+            for (auto ik : ik_todo)
+                integrated[ik] = true;
+            int n_integrated = int(ik_todo.size());
+
+            std::vector<std::pair<int, int>> gaps;
+            for (size_t i = 1; i < ik_todo.size(); i++)
+                if (ik_todo[i] - ik_todo[i - 1] > 1)
+                    gaps.push_back({ik_todo[i - 1], ik_todo[i]});
+
+            // Refine
+            while (gaps.size() > 0) {
+                ik_todo.clear();
+                for (auto & gap : gaps)
+                    ik_todo.push_back((gap.first + gap.second) / 2);
+                integrate_k_modes(ik_todo);
+                n_integrated += int(ik_todo.size());
+
+                // Compute all the errors before marking the new modes as integrated so that
+                // each mode is only compared to the modes from earlier passes
+                std::vector<double> errors(gaps.size());
+                for (size_t i = 0; i < gaps.size(); i++)
+                    errors[i] = interpolation_error(ik_todo[i]);
+                for (auto ik : ik_todo)
+                    integrated[ik] = true;
+
+                std::vector<std::pair<int, int>> new_gaps;
+                for (size_t i = 0; i < gaps.size(); i++) {
+                    if (errors[i] < pert_adaptive_k_tolerance)
+                        continue;
+                    const int mid = ik_todo[i];
+                    if (mid - gaps[i].first > 1)
+                        new_gaps.push_back({gaps[i].first, mid});
+                    if (gaps[i].second - mid > 1)
+                        new_gaps.push_back({mid, gaps[i].second});
+                }
+                gaps = new_gaps;
+            }
+
+            // Fill in the remaining modes by interpolation
+            for (int ik = 0; ik < n_k_total; ik++) {
+                if (integrated[ik])
+                    continue;
+                for (int iq = 0; iq < psinfo.n_tot; iq++) {
+                    auto y = interpolate_mode(ik, iq);
+                    for (int ix = 0; ix < n_x_total; ix++)
+                        results[iq][ix + n_x_total * ik] = y[ix];
+                }
+            }
+
+            if (FML::ThisTask == 0)
+                std::cout << "Adaptive k-sampling: integrated " << n_integrated << " of " << n_k_total
+                          << " wavenumbers\n";
+        }
+
         void Perturbations::integrate_perturbations() {
             // Scalar-DVector-Tensor
             int m_type = 0;
@@ -519,143 +652,210 @@ namespace FML {
             // Loop over all wavenumbers
             timer.StartTiming("PERT::integrating perturbations");
 
-            // The k-values we loop over (doing it like this to ease the
-            // parallelization)
-            std::vector<int> ik_list(n_k_total);
-            std::iota(ik_list.begin(), ik_list.end(), 0);
-#ifdef USE_MPI
-            // Compute what k's to deal with on the local task
-            if (FML::NTasks > 1) {
-                ik_list.clear();
-                for (int i = 0; i < n_k_total; i++) {
-                    if (i % FML::NTasks == FML::ThisTask) {
-                        ik_list.push_back(i);
-                    }
+            // Integrate the modes ik_todo and store them in results. With MPI the modes are split
+            // between the tasks and the results are communicated to all tasks at the end
+            auto integrate_k_modes = [&](const std::vector<int> & ik_todo) {
+                // The cost of a mode grows with the number of oscillations k*eta0 it goes through.
+                // We sort the modes by cost (most expensive first, which also helps the dynamic
+                // OpenMP scheduling) and assign each one to the task with the least total cost so far.
+                // This is done the same way on all tasks so everyone knows who computes what
+                const double eta0 = cosmo->eta_of_x(0.0);
+                std::vector<int> ik_sorted = ik_todo;
+                std::sort(ik_sorted.begin(), ik_sorted.end(), [&](int a, int b) { return k_array[a] > k_array[b]; });
+                std::vector<std::vector<int>> ik_list_of_task(FML::NTasks);
+                DVector cost_of_task(FML::NTasks, 0.0);
+                for (auto ik : ik_sorted) {
+                    const int task =
+                        int(std::min_element(cost_of_task.begin(), cost_of_task.end()) - cost_of_task.begin());
+                    ik_list_of_task[task].push_back(ik);
+                    cost_of_task[task] += 10.0 + k_array[ik] * eta0;
                 }
-            }
+                const std::vector<int> & ik_list = ik_list_of_task[FML::ThisTask];
+
+#ifdef USE_OMP
+#pragma omp parallel
 #endif
+                {
+                    // One solver per thread for each regime so the GSL workspace is reused for all k
+                    ODESolver tight_coupling_ode(
+                        FIDUCIAL_HSTART_ODE_TIGHT, FIDUCIAL_ABSERR_ODE_TIGHT, FIDUCIAL_RELERR_ODE_TIGHT);
+                    ODESolver full_ode(FIDUCIAL_HSTART_ODE_FULL, FIDUCIAL_ABSERR_ODE_FULL, FIDUCIAL_RELERR_ODE_FULL);
 
 #ifdef USE_OMP
-#pragma omp parallel for schedule(dynamic, 1)
+#pragma omp for schedule(dynamic, 1)
 #endif
-            for (size_t ii = 0; ii < ik_list.size(); ii++) {
-                const int ik = ik_list[ii];
-
-                // Progress bar (each thread has unique value of ik so no race)
-                if (FML::ThisTask == 0)
-                    if ((10 * ii) / ik_list.size() != (10 * ii + 10) / ik_list.size()) {
-                        std::cout << (100 * ii + 100) / ik_list.size() << "% " << std::flush;
-                        if (ii == ik_list.size() - 1) {
-                            std::cout << std::endl;
+                    for (size_t ii = 0; ii < ik_list.size(); ii++) {
+                        const int ik = ik_list[ii];
+
+                        // Progress bar (each thread has unique value of ik so no race)
+                        if (FML::ThisTask == 0)
+                            if ((10 * ii) / ik_list.size() != (10 * ii + 10) / ik_list.size()) {
+                                std::cout << (100 * ii + 100) / ik_list.size() << "% " << std::flush;
+                                if (ii == ik_list.size() - 1) {
+                                    std::cout << std::endl;
+                                }
+                            }
+
+                        // Current value of k
+                        const double k = k_array[ik];
+
+                        // Find value to integrate to (check that x_end_tight is not before x_start)
+                        const double x_end_tight = get_tight_coupling_time(k);
+
+                        DVector x_array_tight, x_array_full;
+                        int lastindex = 0;
+                        for (size_t i = 0; i < x_array.size(); i++) {
+                            if (x_array[i] < x_end_tight) {
+                                x_array_tight.push_back(x_array[i]);
+                                lastindex = i;
+                            }
                         }
-                    }
-
-                // Current value of k
-                const double k = k_array[ik];
-
-                // Find value to integrate to (check that x_end_tight is not before x_start)
-                const double x_end_tight = get_tight_coupling_time(k);
-
-                DVector x_array_tight, x_array_full;
-                int lastindex = 0;
-                for (size_t i = 0; i < x_array.size(); i++) {
-                    if (x_array[i] < x_end_tight) {
-                        x_array_tight.push_back(x_array[i]);
-                        lastindex = i;
-                    }
-                }
-                for (size_t i = lastindex; i < x_array.size(); i++) {
-                    x_array_full.push_back(x_array[i]);
-                }
-                const int n_x_tight = x_array_tight.size();
-
-                //===================================================================
-                // Tight coupling integration
-                //===================================================================
-
-                // Set up initial conditions for the tight coupling regime
-                auto y_pert_tight_coupling = set_ic(x_start, k);
-
-                // The tight coupling ODE system
-                ODEFunction deriv_tight_coupling = [&](double x, const double * y, double * dydx) {
-                    return rhs_tight_coupling_ode(x, k, y, dydx);
-                };
-
-                // Integrate to the end of tight coupling
-                ODESolver tight_coupling_ode(
-                    FIDUCIAL_HSTART_ODE_TIGHT, FIDUCIAL_ABSERR_ODE_TIGHT, FIDUCIAL_RELERR_ODE_TIGHT);
-
-                timer.StartTiming("PERT::integrate_tight (all threads)");
-                tight_coupling_ode.solve(deriv_tight_coupling, x_array_tight, y_pert_tight_coupling);
-                timer.EndTiming("PERT::integrate_tight (all threads)");
-
-                //===================================================================
-                // Full equation integration
-                //===================================================================
+                        for (size_t i = lastindex; i < x_array.size(); i++) {
+                            x_array_full.push_back(x_array[i]);
+                        }
+                        const int n_x_tight = x_array_tight.size();
+
+                        //===================================================================
+                        // Tight coupling integration
+                        //===================================================================
+
+                        // Set up initial conditions for the tight coupling regime
+                        auto y_pert_tight_coupling = set_ic(x_start, k);
+
+                        // The tight coupling ODE system
+                        ODEFunction deriv_tight_coupling = [&](double x, const double * y, double * dydx) {
+                            return rhs_tight_coupling_ode(x, k, y, dydx);
+                        };
+
+                        // Integrate to the end of tight coupling
+                        timer.StartTiming("PERT::integrate_tight (all threads)");
+                        if (pert_implicit_tight_coupling) {
+                            ODEFunctionJacobian jacobian_tight_coupling =
+                                [&](double x, const double * y, double * dfdy, double * dfdt) {
+                                    return rhs_jacobian_tight_coupling(x, k, y, dfdy, dfdt);
+                                };
+                            tight_coupling_ode.solve(deriv_tight_coupling,
+                                                     x_array_tight,
+                                                     y_pert_tight_coupling,
+                                                     gsl_odeiv2_step_msbdf,
+                                                     jacobian_tight_coupling);
+                        } else {
+                            tight_coupling_ode.solve(deriv_tight_coupling, x_array_tight, y_pert_tight_coupling);
+                        }
+                        timer.EndTiming("PERT::integrate_tight (all threads)");
 
-                // Set up initial conditions
-                y_pert_tight_coupling = tight_coupling_ode.get_final_data();
-                auto y_pert_full = set_ic_after_tight_coupling(y_pert_tight_coupling, x_end_tight, k);
+                        //===================================================================
+                        // Full equation integration
+                        //===================================================================
 
-                // The full ODE system
-                ODEFunction deriv_full = [&](double x, const double * y, double * dydx) {
-                    return rhs_full_ode(x, k, y, dydx);
-                };
+                        // Set up initial conditions
+                        y_pert_tight_coupling = tight_coupling_ode.get_final_data();
+                        auto y_pert_full = set_ic_after_tight_coupling(y_pert_tight_coupling, x_end_tight, k);
 
-                ODESolver full_ode(FIDUCIAL_HSTART_ODE_FULL, FIDUCIAL_ABSERR_ODE_FULL, FIDUCIAL_RELERR_ODE_FULL);
+                        // The full ODE system
+                        ODEFunction deriv_full = [&](double x, const double * y, double * dydx) {
+                            return rhs_full_ode(x, k, y, dydx);
+                        };
 
-                // Integrate till the present time. If a Jacobian is availiable use that for
-                // the largest k-modes as this is much faster
-                timer.StartTiming("PERT::integrate_full (all threads)");
+                        // Integrate till the present time. If a Jacobian is availiable use that for
+                        // the largest k-modes as this is much faster
+                        timer.StartTiming("PERT::integrate_full (all threads)");
 #define USE_JACOBIAN
 #ifndef USE_JACOBIAN
-                full_ode.solve(deriv_full, x_array_full, y_pert_full);
+                        full_ode.solve(deriv_full, x_array_full, y_pert_full);
 #else
-                ODEFunctionJacobian jacobian_full = [&](double x, const double * y, double * dfdy, double * dfdt) {
-                    return rhs_jacobian_full(x, k, y, dfdy, dfdt);
-                };
-
-                if (k * Constants.Mpc > 0.15) {
-                    full_ode.solve(deriv_full, x_array_full, y_pert_full, gsl_odeiv2_step_msbdf, jacobian_full);
-                } else {
-                    full_ode.solve(deriv_full, x_array_full, y_pert_full);
-                }
+                        ODEFunctionJacobian jacobian_full = [&](double x, const double * y, double * dfdy, double * dfdt) {
+                            return rhs_jacobian_full(x, k, y, dfdy, dfdt);
+                        };
+
+                        if (k * Constants.Mpc > 0.15) {
+                            full_ode.solve(deriv_full, x_array_full, y_pert_full, gsl_odeiv2_step_msbdf, jacobian_full);
+                        } else {
+                            full_ode.solve(deriv_full, x_array_full, y_pert_full);
+                        }
 #endif
-                timer.EndTiming("PERT::integrate_full (all threads)");
-
-                //===================================================================
-                // Store the data
-                //===================================================================
-
-                timer.StartTiming("PERT::store data");
-
-                auto data_tight = tight_coupling_ode.get_data();
-                auto data_full = full_ode.get_data();
-
-                // Process the data from the tight regime into the same form as the full
-                // regime and fill inn missing values
-                DVector2D data_tight_full;
-                const int n_eq_tight = psinfo_tight_coupling.n_tot;
-                const int n_eq_full = psinfo.n_tot;
-                for (int ix = 0; ix < n_x_tight; ix++) {
-                    auto y_current = DVector(n_eq_tight);
-                    for (int iq = 0; iq < n_eq_tight; iq++) {
-                        y_current[iq] = data_tight[ix][iq];
+                        timer.EndTiming("PERT::integrate_full (all threads)");
+
+                        //===================================================================
+                        // Store the data
+                        //===================================================================
+
+                        timer.StartTiming("PERT::store data");
+
+                        auto data_tight = tight_coupling_ode.get_data();
+                        auto data_full = full_ode.get_data();
+
+                        // Process the data from the tight regime into the same form as the full
+                        // regime and fill inn missing values
+                        DVector2D data_tight_full;
+                        const int n_eq_tight = psinfo_tight_coupling.n_tot;
+                        const int n_eq_full = psinfo.n_tot;
+                        for (int ix = 0; ix < n_x_tight; ix++) {
+                            auto y_current = DVector(n_eq_tight);
+                            for (int iq = 0; iq < n_eq_tight; iq++) {
+                                y_current[iq] = data_tight[ix][iq];
+                            }
+                            auto tmp = set_all_perturbations_in_tight_coupling(y_current, x_array_tight[ix], k);
+                            data_tight_full.push_back(tmp);
+                        }
+                        data_tight_full.insert(data_tight_full.end(), data_full.begin() + 1, data_full.end());
+
+                        // Store the data (this works with OpenMP without atomic as each thread
+                        // writes to different places in the array)
+                        for (int ix = 0; ix < n_x_total; ix++) {
+                            for (int iq = 0; iq < n_eq_full; iq++) {
+                                results[iq][ix + n_x_total * ik] = data_tight_full[ix][iq];
+                            }
+                        }
+
+                        timer.EndTiming("PERT::store data");
                     }
-                    auto tmp = set_all_perturbations_in_tight_coupling(y_current, x_array_tight[ix], k);
-                    data_tight_full.push_back(tmp);
                 }
-                data_tight_full.insert(data_tight_full.end(), data_full.begin() + 1, data_full.end());
 
-                // Store the data (this works with OpenMP without atomic as each thread
-                // writes to different places in the array)
-                for (int ix = 0; ix < n_x_total; ix++) {
-                    for (int iq = 0; iq < n_eq_full; iq++) {
-                        results[iq][ix + n_x_total * ik] = data_tight_full[ix][iq];
+#ifdef USE_MPI
+                // Gather the results for these modes on all tasks with a single collective
+                if (FML::NTasks > 1) {
+                    const int n_eq_full = psinfo.n_tot;
+                    const int blocksize = n_eq_full * n_x_total;
+                    std::vector<int> counts(FML::NTasks), displs(FML::NTasks, 0);
+                    for (int task = 0; task < FML::NTasks; task++) {
+                        counts[task] = int(ik_list_of_task[task].size()) * blocksize;
+                        if (task > 0)
+                            displs[task] = displs[task - 1] + counts[task - 1];
                     }
+                    DVector sendbuffer(counts[FML::ThisTask]);
+                    for (size_t i = 0; i < ik_list.size(); i++)
+                        for (int iq = 0; iq < n_eq_full; iq++)
+                            for (int ix = 0; ix < n_x_total; ix++)
+                                sendbuffer[ix + n_x_total * (iq + n_eq_full * i)] =
+                                    results[iq][ix + n_x_total * ik_list[i]];
+                    DVector recvbuffer(displs[FML::NTasks - 1] + counts[FML::NTasks - 1]);
+                    MPI_Allgatherv(sendbuffer.data(),
+                                   counts[FML::ThisTask],
+                                   MPI_DOUBLE,
+                                   recvbuffer.data(),
+                                   counts.data(),
+                                   displs.data(),
+                                   MPI_DOUBLE,
+                                   MPI_COMM_WORLD);
+                    for (int task = 0; task < FML::NTasks; task++)
+                        for (size_t i = 0; i < ik_list_of_task[task].size(); i++)
+                            for (int iq = 0; iq < n_eq_full; iq++)
+                                for (int ix = 0; ix < n_x_total; ix++)
+                                    results[iq][ix + n_x_total * ik_list_of_task[task][i]] =
+                                        recvbuffer[displs[task] + ix + n_x_total * (iq + n_eq_full * i)];
                 }
+#endif
+            };
 
-                timer.EndTiming("PERT::store data");
+            if (not pert_adaptive_k_sampling) {
+                // The k-values we loop over (doing it like this to ease the
+                // parallelization)
+                std::vector<int> ik_list(n_k_total);
+                std::iota(ik_list.begin(), ik_list.end(), 0);
+                integrate_k_modes(ik_list);
+            } else {
+                integrate_perturbations_adaptive(integrate_k_modes, results);
             }
             timer.EndTiming("PERT::integrating perturbations");
             if (FML::ThisTask == 0)
@@ -665,11 +865,6 @@ namespace FML {
             MPI_Barrier(MPI_COMM_WORLD);
             if (FML::ThisTask == 0 and FML::NTasks > 1)
                 std::cout << "All tasks done!\n";
-            // Its not that much data so we simply send all the data from all to  all tasks and add up
-            for (size_t iq = 0; iq < results.size(); iq++) {
-                MPI_Allreduce(
-                    MPI_IN_PLACE, results[iq].data(), results[iq].size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            }
 #endif
 
             if (FML::ThisTask == 0)
@@ -1163,6 +1358,39 @@ namespace FML {
             return GSL_SUCCESS;
         }
 
+        int Perturbations::rhs_jacobian_tight_coupling(
+            double x, double k, const double * y, double * dfdy, double * dfdt) {
+            timer.StartTiming("PERT::jacobian");
+
+            // The tight coupling system is linear in y (all the coefficients only depend on x and k)
+            // so the i'th column of the Jacobian is just the right hand side evaluated at the unit
+            // vector e_i. The explicit x-derivative is computed with a central difference
+            const int n = psinfo_tight_coupling.n_tot;
+            DVector e(n, 0.0);
+            DVector column(n);
+            for (int j = 0; j < n; j++) {
+                e[j] = 1.0;
+                rhs_tight_coupling_ode(x, k, e.data(), column.data());
+                for (int i = 0; i < n; i++) {
+                    dfdy[i * n + j] = column[i];
+                }
+                e[j] = 0.0;
+            }
+
+            const double deltax = 1e-6;
+            DVector f_plus(n);
+            DVector f_minus(n);
+            rhs_tight_coupling_ode(x + deltax, k, y, f_plus.data());
+            rhs_tight_coupling_ode(x - deltax, k, y, f_minus.data());
+            for (int i = 0; i < n; i++) {
+                dfdt[i] = (f_plus[i] - f_minus[i]) / (2.0 * deltax);
+            }
+
+            timer.EndTiming("PERT::jacobian");
+
+            return GSL_SUCCESS;
+        }
+
         int Perturbations::rhs_jacobian_full(double x, double k, const double * y, double * dfdy, double * dfdt) {
             timer.StartTiming("PERT::jacobian");
 
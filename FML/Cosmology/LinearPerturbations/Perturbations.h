@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -116,6 +117,15 @@ namespace FML {
             // Spline ell=0,1,2 only or everything when we integrate perturbations
             bool pert_spline_all_ells{false};
 
+            // Integrate the tight coupling regime with an implicit stepper (msbdf) using the Jacobian
+            bool pert_implicit_tight_coupling{false};
+
+            // Adaptive k-sampling: integrate a coarse set of modes (every stride'th) and refine only where
+            // cubic interpolation in log(k) is worse than the tolerance. The rest is filled in by interpolation
+            bool pert_adaptive_k_sampling{false};
+            double pert_adaptive_k_tolerance{1e-3};
+            int pert_adaptive_k_stride{8};
+
             // Splines of scalar perturbations quantities
             Spline2D delta_cdm_spline{"delta_cdm_spline"};
             Spline2D delta_b_spline{"delta_b_spline"};
@@ -158,10 +168,13 @@ namespace FML {
 
             int rhs_tight_coupling_ode(double x, double k, const double * y, double * dydx);
             int rhs_full_ode(double x, double k, const double * y, double * dydx);
+            int rhs_jacobian_tight_coupling(double x, double k, const double * y, double * dfdy, double * dfdt);
             int rhs_jacobian_full(double x, double k, const double * y, double * dfdy, double * dfdt);
 
             // Steps computed in solve()
             void integrate_perturbations();
+            void integrate_perturbations_adaptive(std::function<void(const std::vector<int> &)> integrate_k_modes,
+                                                  DVector2D & results);
             void compute_source_functions();
 
             // For keeping timings
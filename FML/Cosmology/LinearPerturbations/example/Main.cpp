@@ -41,6 +41,9 @@ int main(){
   // Accuracy settings
   param_map["pert_integration_nk_per_logint"] = 25;  // Number of k-points per logarithmic interval, 100 for high accuracy
   param_map["pert_spline_all_ells"]  = false;        // Spline all the Theta_ell(k,x), Nu_ell(k,x), etc. multipoles or just the first 0,1,2
+  param_map["pert_implicit_tight_coupling"] = false; // Use an implicit stepper with a Jacobian in the tight coupling regime
+  param_map["pert_adaptive_k_sampling"] = false;    // Only integrate the k-modes needed to interpolate the rest
+  param_map["pert_adaptive_k_tolerance"] = 1e-3;    // Max relative interpolation error allowed with adaptive k-sampling
   param_map["pert_x_initial"]        = -15.0;        // When to start the integration x = log(aini)
   param_map["pert_delta_x"]          = 0.05;         // How many points to store in the integration till today, every deltax = deltalog(a)
   p.info();
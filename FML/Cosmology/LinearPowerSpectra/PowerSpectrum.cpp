@@ -29,6 +29,8 @@ namespace FML {
             los_integration_loga_nsamples = p.get<int>("los_integration_loga_nsamples");
             los_integration_nsamples_per_osc = p.get<int>("los_integration_nsamples_per_osc");
             cell_nsamples_per_osc = p.get<int>("cell_nsamples_per_osc");
+            ell_limber = p.get<int>("ell_limber", 0);
+            bessel_cache_folder = p.get<std::string>("bessel_cache_folder", "");
             kmax = p.get<double>("keta_max") / cosmo->eta_of_x(0.0);
 
             // eta and tau at the output redshift
@@ -189,6 +191,62 @@ namespace FML {
             return 2.0 * M_PI * M_PI / (k * k * k) * primordial_power_spectrum_dimless(k);
         }
 
+        //====================================================================
+        // Binary cache of the tabulated bessel functions. The file starts with the key (the ells and the
+        // sampling) so that a hash collision or different settings is never used
+        //====================================================================
+        bool PowerSpectrum::read_bessel_cache(const std::string & filename,
+                                              const std::string & key,
+                                              DVector2D & tables) const {
+            std::ifstream fp(filename, std::ios::binary);
+            if (not fp)
+                return false;
+            size_t keysize = 0;
+            fp.read(reinterpret_cast<char *>(&keysize), sizeof(keysize));
+            if (not fp or keysize != key.size())
+                return false;
+            std::string filekey(keysize, ' ');
+            fp.read(filekey.data(), keysize);
+            if (not fp or filekey != key)
+                return false;
+            for (auto & table : tables) {
+                size_t n = 0;
+                fp.read(reinterpret_cast<char *>(&n), sizeof(n));
+                if (not fp or n != table.size())
+                    return false;
+                fp.read(reinterpret_cast<char *>(table.data()), n * sizeof(double));
+                if (not fp)
+                    return false;
+            }
+            return true;
+        }
+
+        void PowerSpectrum::write_bessel_cache(const std::string & filename,
+                                               const std::string & key,
+                                               const DVector2D & tables) const {
+            // Write to a temporary file and rename so that others never see a partial file
+            const std::string tmpfilename = filename + ".tmp" + std::to_string(FML::ThisTask);
+            {
+                std::ofstream fp(tmpfilename, std::ios::binary);
+                if (not fp) {
+                    std::cout << "Warning generate_bessel_function_splines: cannot write cache [" << filename << "]\n";
+                    return;
+                }
+                const size_t keysize = key.size();
+                fp.write(reinterpret_cast<const char *>(&keysize), sizeof(keysize));
+                fp.write(key.data(), keysize);
+                for (auto & table : tables) {
+                    const size_t n = table.size();
+                    fp.write(reinterpret_cast<const char *>(&n), sizeof(n));
+                    fp.write(reinterpret_cast<const char *>(table.data()), n * sizeof(double));
+                }
+            }
+            std::error_code ec;
+            std::filesystem::rename(tmpfilename, filename, ec);
+            if (ec)
+                std::filesystem::remove(tmpfilename, ec);
+        }
+
         void PowerSpectrum::generate_bessel_function_splines(double xmax, int nsamples_per_osc) {
             timer.StartTiming("POW::making bessel splines");
             if (FML::ThisTask == 0)
@@ -199,37 +257,58 @@ namespace FML {
             const int npts = int(xmax / deltax);
             DVector x_array = FML::MATH::linspace(0.0, xmax, npts);
 
-            // Compute j_ell(x) for all x and ell
-            const int ellmax = ells[ells.size() - 1];
-            DVector2D results(ells.size(), DVector(npts));
+            // Higher resolution for ell=2
+            int npts2 = int(1000 * 32 / 2.0 / M_PI);
+            DVector x_array2 = FML::MATH::linspace(0, 1000.0, npts2);
+
+            // The tables: j_ell(x) for all ells followed by the high resolution ell=2
+            DVector2D results(ells.size() + 1, DVector(npts));
+            results[ells.size()] = DVector(npts2, 0.0);
+            DVector & jell2 = results[ells.size()];
+
+            // The cache is valid as long as the ells and the sampling are the same
+            std::string key, cachefilename;
+            if (not bessel_cache_folder.empty()) {
+                std::stringstream keystream;
+                keystream << std::setprecision(17) << xmax << " " << nsamples_per_osc << " " << npts << " " << npts2
+                          << "\n";
+                for (auto ell : ells)
+                    keystream << ell << " ";
+                key = keystream.str();
+                std::stringstream hash;
+                hash << std::hex << std::hash<std::string>{}(key);
+                cachefilename = bessel_cache_folder + "/besselsplines_" + hash.str() + ".bin";
+            }
+
+            if (not bessel_cache_folder.empty() and read_bessel_cache(cachefilename, key, results)) {
+                if (FML::ThisTask == 0)
+                    std::cout << "Read bessel functions from cache [" << cachefilename << "]\n";
+            } else {
+                // Compute j_ell(x) for all x and the ells we need
+                std::vector<int> ells_int(ells.begin(), ells.end());
+                auto data = FML::MATH::j_ell_array(ells_int, x_array);
+                for (size_t j = 0; j < ells.size(); j++)
+                    results[j] = std::move(data[j]);
+
 #ifdef USE_OMP
 #pragma omp parallel for schedule(dynamic, 1)
 #endif
-            for (int i = 0; i < npts; i++) {
-                auto data = FML::MATH::j_ell_array(ellmax, x_array[i]);
-                // Store the data we need
-                for (size_t j = 0; j < ells.size(); j++)
-                    results[j][i] = data[int(ells[j])];
+                for (int i = 1; i < npts2; i++) {
+                    double x = x_array2[i];
+                    double s = std::sin(x);
+                    double c = std::cos(x);
+                    jell2[i] = ((3.0 - x * x) * s - 3.0 * x * c) / (x * x * x);
+                }
+
+                // Only one task writes the cache
+                if (not bessel_cache_folder.empty() and FML::ThisTask == 0)
+                    write_bessel_cache(cachefilename, key, results);
             }
 
             // Make splines
             j_ell_splines = std::vector<Spline>(ells.size());
             for (size_t j = 1; j < ells.size(); j++)
                 j_ell_splines[j].create(x_array, results[j]);
-
-            // Higher resolution for ell=2
-            int npts2 = int(1000 * 32 / 2.0 / M_PI);
-            DVector x_array2 = FML::MATH::linspace(0, 1000.0, npts2);
-            DVector jell2(npts2, 0.0);
-#ifdef USE_OMP
-#pragma omp parallel for schedule(dynamic, 1)
-#endif
-            for (int i = 1; i < npts2; i++) {
-                double x = x_array2[i];
-                double s = std::sin(x);
-                double c = std::cos(x);
-                jell2[i] = ((3.0 - x * x) * s - 3.0 * x * c) / (x * x * x);
-            }
             j_ell_splines[0].create(x_array2, jell2);
 
             // For using the splines in general: allows for direct index
@@ -245,7 +324,8 @@ namespace FML {
             DVector & x_array,
             DVector & k_array,
             std::function<double(double, double)> & source_function,
-            [[maybe_unused]] std::function<double(double, double)> & aux_norm) {
+            [[maybe_unused]] std::function<double(double, double)> & aux_norm,
+            double ell_max_los) {
             timer.StartTiming("POW::LOS integration");
 
             const int nells = ells.size();
@@ -336,7 +416,7 @@ namespace FML {
                     const double sourcedx = source_function(x_array[ix], k) * dx;
 
                     for (int i = 0; i < nells; i++) {
-                        if (k < kcut[i])
+                        if (k < kcut[i] or ells[i] >= ell_max_los)
                             continue;
                         if (ells[i] > 30.0 and g_relevant[ix] == 0)
                             continue;
@@ -362,6 +442,41 @@ namespace FML {
             return result;
         }
 
+        DVector PowerSpectrum::limber_integration_single(DVector & x_array,
+                                                         std::function<double(double, double)> & source_function,
+                                                         double ell_min) {
+            timer.StartTiming("POW::Limber integration");
+
+            // With Int k^2 dk j_ell(k chi) j_ell(k chi') ~ pi/(2chi^2) delta(chi-chi') and nu = ell + 1/2
+            // Cell = 2pi^2 Int dx chi/nu^3 Delta(k) S(x,k)^2 / (dchi/dx) with k = nu/chi
+            const int nells = ells.size();
+            DVector data(nells, 0.0);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+            for (int i = 0; i < nells; i++) {
+                if (ells[i] < ell_min)
+                    continue;
+                const double nu = ells[i] + 0.5;
+                for (size_t ix = 1; ix < x_array.size(); ix++) {
+                    const double x = x_array[ix];
+                    const double dx = x_array[ix] - x_array[ix - 1];
+                    const double chi = eta0 - cosmo->eta_of_x(x);
+                    if (chi <= 0.0)
+                        continue;
+                    const double k = nu / chi;
+                    if (k < kmin or k > kmax)
+                        continue;
+                    const double source = source_function(x, k);
+                    data[i] += 2.0 * M_PI * M_PI * chi / (nu * nu * nu) * primordial_power_spectrum_dimless(k) *
+                               source * source / cosmo->detadx_of_x(x) * dx;
+                }
+            }
+
+            timer.EndTiming("POW::Limber integration");
+            return data;
+        }
+
         void PowerSpectrum::line_of_sight_integration(DVector & k_array) {
             const int nells = ells.size();
             const int n_k_total = k_array.size();
@@ -436,8 +551,12 @@ namespace FML {
                 std::function<double(double, double)> solve_lens_norm = []([[maybe_unused]] double k, double ell) {
                     return (ell / 100.0) * (ell / 100.0);
                 };
-                DVector2D lens_ell_of_k =
-                    line_of_sight_integration_single(x_array, k_array, source_function_L, solve_lens_norm);
+                // With Limber we can skip the large ells, but not if we need the lensing F_ell(k) for the TL cross
+                // spectrum (no Limber version of that here)
+                const bool skip_large_ells = ell_limber > 0 and not compute_temperature_cells;
+                const double ell_max_los = skip_large_ells ? ell_limber : std::numeric_limits<double>::max();
+                DVector2D lens_ell_of_k = line_of_sight_integration_single(
+                    x_array, k_array, source_function_L, solve_lens_norm, ell_max_los);
                 lens_ell_of_k_spline.create(k_array, ells, lens_ell_of_k, "lens_ell_of_k_spline");
                 timer.EndTiming("POW::LOS integration Phi_lens");
             }
@@ -713,6 +832,20 @@ namespace FML {
                     return 4.0 * M_PI * pofk * lens_pot_ell * lens_pot_ell * normalization;
                 };
                 auto cell_LL = solve_for_cell_single(log_k_array, D_ell_LL_integrand, 1.0);
+
+                // Use the Limber approximation for large ell (the lensing kernel is broad so this is very accurate)
+                if (ell_limber > 0) {
+                    auto x_array =
+                        FML::MATH::linspace(rec->get_x_start_rec_array(), x_cell, los_integration_loga_nsamples);
+                    std::function<double(double, double)> source_function_L = [&](double x, double k) {
+                        return 2.0 * pert->get_Psi(x, k) * lensing_source(x, x_cell);
+                    };
+                    auto cell_LL_limber = limber_integration_single(x_array, source_function_L, ell_limber);
+                    for (size_t i = 0; i < ells.size(); i++)
+                        if (ells[i] >= ell_limber)
+                            cell_LL[i] = cell_LL_limber[i];
+                }
+
                 for (size_t i = 0; i < ells.size(); i++)
                     cell_LL[i] *= ells[i] * (ells[i] + 1) * ells[i] * (ells[i] + 1);
                 cell_LL_spline.create(ells, cell_LL, "Cell_LL_of_ell");
@@ -5,9 +5,12 @@
 #endif
 #include <algorithm>
 #include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <functional>
+#include <limits>
 #include <numeric>
+#include <sstream>
 #include <utility>
 #ifdef USE_FFTW
 #include <fftw3.h>
@@ -84,6 +87,15 @@ namespace FML {
             int los_integration_loga_nsamples{300};
             int cell_nsamples_per_osc{16};
 
+            // Use the Limber approximation for the lensing potential Cell for ell >= ell_limber (0 means never).
+            // Unless we also compute the temperature Cell (the TL cross spectrum needs the exact lensing
+            // F_ell(k) for all ells) the line of sight integrals for the lensing potential are then only
+            // done for ell < ell_limber
+            int ell_limber{0};
+
+            // Folder for an on-disk cache of the tabulated bessel functions (empty = no cache)
+            std::string bessel_cache_folder{};
+
             // The ells's we compute Theta_ell and Cell for
             // We will shrink this to ell_max
             int ell_max{2000};
@@ -143,6 +155,11 @@ namespace FML {
             /// Make bessel-function splines that we need
             void generate_bessel_function_splines(double xmax, int nsamples_per_osc);
 
+            /// Read/write the tabulated j_ell(x) used to make the splines. Returns false if no valid cache was found
+            bool read_bessel_cache(const std::string & filename, const std::string & key, DVector2D & tables) const;
+            void
+            write_bessel_cache(const std::string & filename, const std::string & key, const DVector2D & tables) const;
+
             /// Do all the LOS integrals we need
             void line_of_sight_integration(DVector & k_array);
 
@@ -150,7 +167,14 @@ namespace FML {
             DVector2D line_of_sight_integration_single(DVector & x_array,
                                                        DVector & k_array,
                                                        std::function<double(double, double)> & source_function,
-                                                       std::function<double(double, double)> & aux_norm);
+                                                       std::function<double(double, double)> & aux_norm,
+                                                       double ell_max_los = std::numeric_limits<double>::max());
+
+            /// Compute Cell = 4pi Int dlogk Delta(k) F_ell(k)^2 for F_ell(k) = Int dx S(x,k) j_ell(k(eta0-eta(x)))
+            /// in the Limber approximation for all ells >= ell_min (the rest are set to zero)
+            DVector limber_integration_single(DVector & x_array,
+                                              std::function<double(double, double)> & source_function,
+                                              double ell_min);
 
             /// Compute Cell for any given quantity
             DVector solve_for_cell_single(DVector & log_k_array,
@@ -13,6 +13,7 @@ namespace FML {
             reionization = p.get<bool>("reionization");
             userecfast = p.get<bool>("userecfast");
             rec_fudge_factor = p.get<double>("RecFudgeFactor");
+            tabulated_recombination_rates = p.get<bool>("tabulated_recombination_rates", false);
             x_start_rec_array = std::min(p.get<double>("pert_x_initial"), -20.0);
 
             if (reionization) {
@@ -30,6 +31,24 @@ namespace FML {
         // Class methods
         //====================================================
 
+        std::vector<std::shared_ptr<RecombinationHistory>>
+        RecombinationHistory::solve_many(std::vector<std::shared_ptr<BackgroundCosmology>> & cosmos,
+                                         std::vector<ParameterMap> & params) {
+            if (cosmos.size() != params.size())
+                throw std::runtime_error("RecombinationHistory::solve_many: need one ParameterMap per cosmology");
+
+            const int n = int(cosmos.size());
+            std::vector<std::shared_ptr<RecombinationHistory>> result(n);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+            for (int i = 0; i < n; i++) {
+                result[i] = std::make_shared<RecombinationHistory>(cosmos[i], params[i]);
+                result[i]->solve();
+            }
+            return result;
+        }
+
         void RecombinationHistory::info() const {
             if (FML::ThisTask > 0)
                 return;
@@ -309,6 +328,8 @@ namespace FML {
 
                     // The Peebles ODE equation
                     ODEFunction deriv = [&](double x, const double * y, double * dydx) {
+                        if (tabulated_recombination_rates)
+                            return rhs_peebles_ode_tabulated(x, y, dydx);
                         return rhs_peebles_ode(x, y, dydx);
                     };
 
@@ -442,6 +463,83 @@ namespace FML {
             return GSL_SUCCESS;
         }
 
+        //====================================================
+        // The recombination rate alpha_2 only depends on the baryon temperature so we tabulate
+        // log(alpha_2) on a uniform grid in log(Tb) once (shared by all instances, so the units
+        // in Constants should not be changed after the first use)
+        //====================================================
+        namespace {
+            struct PeeblesRateTable {
+                FML::INTERPOLATION::SPLINE::UniformGridSpline log_alpha_2_of_logTb;
+                double logTb_min{};
+                double logTb_max{};
+
+                PeeblesRateTable() {
+                    logTb_min = std::log(1e-4 * Constants.K);
+                    logTb_max = std::log(1e5 * Constants.K);
+                    const int npts = 4000;
+                    DVector logTb = FML::MATH::linspace(logTb_min, logTb_max, npts);
+                    DVector log_alpha_2(npts);
+                    for (int i = 0; i < npts; i++) {
+                        const double eps_over_kT = Constants.epsilon_0 / (Constants.k_b * std::exp(logTb[i]));
+                        const double phi_2 = 0.448 * std::log(eps_over_kT);
+                        const double alpha_2 = phi_2 * (8.0 / sqrt(3.0 * M_PI)) * Constants.sigma_T * sqrt(eps_over_kT);
+                        log_alpha_2[i] = std::log(alpha_2);
+                    }
+                    log_alpha_2_of_logTb.create(logTb.data(), log_alpha_2.data(), npts);
+                }
+            };
+
+            const PeeblesRateTable & get_peebles_rate_table() {
+                static const PeeblesRateTable table;
+                return table;
+            }
+        } // namespace
+
+        // The same as rhs_peebles_ode, but with alpha_2 from the table and beta, beta_2 written in
+        // terms of it so that we only need two exponentials per call
+        int RecombinationHistory::rhs_peebles_ode_tabulated(double x, const double * y, double * dydx) {
+            const auto & table = get_peebles_rate_table();
+            const double OmegaB = cosmo->get_OmegaB();
+            const double TCMB_of_x = cosmo->get_TCMB(x);
+            const double Tb = TCMB_of_x * (1.0 + y[1]);
+            const double logTb = std::log(Tb);
+            if (OmegaB == 0.0 or logTb < table.logTb_min or logTb > table.logTb_max)
+                return rhs_peebles_ode(x, y, dydx);
+
+            const double X_e = y[0];
+            const double a = std::exp(x);
+            const double c = Constants.c;
+            const double H0 = cosmo->get_H0();
+            const double H = cosmo->H_of_x(x);
+
+            // Baryon number density
+            const double n_b = (3.0 * OmegaB * H0 * H0) / (8 * M_PI * Constants.G * Constants.m_H * a * a * a);
+            const double n_H = (1.0 - get_Yp()) * n_b;
+
+            // Rates. beta = alpha_2 c (m_e kT/2pi hbar^2)^1.5 exp(-eps/kT) and beta_2 = beta exp(3eps/4kT)
+            const double eps_over_kT = std::min(Constants.epsilon_0 / (Constants.k_b * Tb), 200.0);
+            const double log_alpha_2 = table.log_alpha_2_of_logTb.eval(logTb);
+            const double hbar = Constants.hbar;
+            const double log_beta_prefactor =
+                std::log(c) + 1.5 * (std::log(Constants.m_e * Constants.k_b / (2.0 * M_PI * hbar * hbar)) + logTb);
+            const double alpha_2 = std::exp(log_alpha_2);
+            const double beta_2 = std::exp(log_alpha_2 + log_beta_prefactor - 0.25 * eps_over_kT);
+            const double beta = beta_2 * std::exp(-0.75 * eps_over_kT);
+            const double n1s = (1.0 - X_e) * n_H;
+            const double lambda_a = H * std::pow(3.0 * Constants.epsilon_0 / (hbar * c), 3) / (64.0 * M_PI * M_PI * n1s);
+            const double C_r = (Constants.lambda_2s1s + lambda_a) / (Constants.lambda_2s1s + lambda_a + beta_2);
+
+            dydx[0] = C_r / H * (beta * (1.0 - X_e) - c * n_H * alpha_2 * X_e * X_e);
+
+            // Baryon temperature ODE
+            const double R = 4.0 / 3.0 * cosmo->get_OmegaR() / OmegaB / a;
+            const double dtaudx = c * Constants.sigma_T / H * n_b * X_e;
+            dydx[1] = -y[1] - 1.0 - 2.0 * (Constants.m_H / Constants.m_e) * R * dtaudx * y[1];
+
+            return GSL_SUCCESS;
+        }
+
         void RecombinationHistory::output(const std::string filename) const {
             std::ofstream fp(filename.c_str());
             if (not fp.is_open())
@@ -58,6 +58,9 @@ namespace FML {
             // This is the same factor as used in Recfast
             double rec_fudge_factor{1.14};
 
+            // Use tabulated recombination rates (alpha_2(Tb)) and a leaner Peebles equation
+            bool tabulated_recombination_rates{false};
+
             // Reinonization parameters
             bool reionization{true};
             double z_reion{11.0};
@@ -122,6 +125,7 @@ namespace FML {
             std::pair<double, double> electron_fraction_from_saha_equation_with_helium(double x) const;
             std::pair<double, double> electron_fraction_from_saha_equation_without_helium(double x) const;
             int rhs_peebles_ode(double x, const double * y, double * dydx);
+            int rhs_peebles_ode_tabulated(double x, const double * y, double * dydx);
             double Xe_reionization_factor_of_x(double x) const;
 
             // The steps in solve
@@ -140,6 +144,11 @@ namespace FML {
 
             /// Do all the recombination solving
             void solve();
+
+            /// Make and solve the recombination history for many cosmologies (with the parameters in the
+            /// corresponding ParameterMap) in parallel with OpenMP. Useful for parameter scans
+            static std::vector<std::shared_ptr<RecombinationHistory>>
+            solve_many(std::vector<std::shared_ptr<BackgroundCosmology>> & cosmos, std::vector<ParameterMap> & params);
             /// Show some info
             void info() const;
             /// Output selected recombination quantities
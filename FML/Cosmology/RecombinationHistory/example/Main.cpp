@@ -21,6 +21,7 @@ int main(){
   // Add recombination parameters
   param_map["userecfast"]           = false;
   param_map["RecFudgeFactor"]       = 1.14;
+  param_map["tabulated_recombination_rates"] = false;
   param_map["Yp"]                   = 0.24;
   param_map["reionization"]         = true;
   param_map["helium_reionization"]  = true;
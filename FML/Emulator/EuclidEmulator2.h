@@ -10,9 +10,13 @@
 #include <gsl/gsl_spline.h>
 #include <gsl/gsl_spline2d.h>
 #include <iomanip>
+#include <exception>
 #include <iostream>
 #include <limits.h>
+#include <map>
 #include <math.h>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <stdio.h>
 #include <stdlib.h>
@@ -316,89 +320,65 @@ namespace FML {
                 }
             }
 
-            class EuclidEmulator {
-              private:
-                const int nz = 101;
-                const int nk = 613;
+            /// The data of the emulator read from the EE2 datafile (principal components, PCE coefficients and
+            /// multi-indices) and the splines of the principal components. This never changes once made so
+            /// one copy is shared by all EuclidEmulator instances (see get_ee2_data) and only the accelerators
+            /// are per instance
+            class EuclidEmulatorData {
+              public:
+                static const int nz = 101;
+                static const int nk = 613;
                 const int n_coeffs[14] = {53, 53, 117, 117, 53, 117, 117, 117, 117, 521, 117, 1539, 173, 457};
-                const int lmax = 16;
-                gsl_interp_accel * logk2pc_acc[15];
-                gsl_interp_accel * logz2pc_acc[15];
-                gsl_spline2d * logklogz2pc_spline[15];
+                double kvec[nk];
+                double logkvec[nk];
                 double * pc[15];
-                double pc_weights[14];
                 double * pce_coeffs[14];
                 double * pce_multiindex[14];
-                std::array<std::vector<double>, 8> univ_legendre;
-                double * pce_basisfuncs;
-                void read_in_ee2_data_file();
-                void pc_2d_interp();
-                Cosmology csm{};
+                gsl_spline2d * logklogz2pc_spline[15];
 
-              public:
-                double kvec[613];
-                double Bvec[101][613];
-                EuclidEmulator(Cosmology csm);
-                EuclidEmulator(double OmegaB,
-                               double OmegaM,
-                               double Sum_m_nu,
-                               double n_s,
-                               double h,
-                               double w_0,
-                               double w_a,
-                               double A_s);
-                ~EuclidEmulator();
-                void compute_boost(std::vector<double> redshift, int n_redshift);
-                std::pair<std::vector<double>, std::vector<double>> compute_boost(double redshift);
-                std::pair<std::vector<double>, std::vector<double>> get_boost(int iz);
+                EuclidEmulatorData(std::string filename);
+                EuclidEmulatorData(const EuclidEmulatorData &) = delete;
+                EuclidEmulatorData & operator=(const EuclidEmulatorData &) = delete;
+                ~EuclidEmulatorData();
+
+              private:
+                double * data{nullptr};
+                size_t size{0};
+                void read_in_ee2_data_file(std::string filename);
+                void pc_2d_interp();
             };
 
-            EuclidEmulator::EuclidEmulator(Cosmology cosmo) : csm(cosmo) {
-                read_in_ee2_data_file();
+            EuclidEmulatorData::EuclidEmulatorData(std::string filename) {
+                read_in_ee2_data_file(filename);
                 pc_2d_interp();
-                if (not csm.good_parameter_ranges()) {
-                    throw std::runtime_error("Cosmological parameter(s) is out of bounds for EuclidEmulator2");
-                }
             }
 
-            EuclidEmulator::EuclidEmulator(double OmegaB,
-                                           double OmegaM,
-                                           double Sum_m_nu,
-                                           double n_s,
-                                           double h,
-                                           double w_0,
-                                           double w_a,
-                                           double A_s)
-                : EuclidEmulator(Cosmology(OmegaB, OmegaM, Sum_m_nu, n_s, h, w_0, w_a, A_s)) {}
-
-            EuclidEmulator::~EuclidEmulator() {
+            EuclidEmulatorData::~EuclidEmulatorData() {
                 for (int i = 0; i < 15; i++) {
                     gsl_spline2d_free(logklogz2pc_spline[i]);
                 }
+                munmap(data, size);
             }
 
-            void EuclidEmulator::read_in_ee2_data_file() {
-                off_t size;
+            void EuclidEmulatorData::read_in_ee2_data_file(std::string filename) {
                 struct stat s;
-                double * data;
                 double * kptr;
                 int idx = 0;
 
-                for (int iz = 0; iz < nz; iz++) {
-                    for (int ik = 0; ik < nk; ik++) {
-                        Bvec[iz][ik] = 0.0;
-                    }
-                }
-
-                int fp = open(path_to_ee2_datafile.c_str(), O_RDONLY);
-                if (!fp) {
-                    std::cerr << "Unable to open " << path_to_ee2_datafile << "\n";
+                int fp = open(filename.c_str(), O_RDONLY);
+                if (fp < 0) {
+                    std::cerr << "Unable to open " << filename << "\n";
                     throw std::runtime_error("Error: the EuclidEmulator2 file (EuclidEmulator2.dat) can not be found. "
                                              "Use set_path_to_ee2_data to set this path\n");
                 }
                 [[maybe_unused]] auto status = fstat(fp, &s);
                 size = s.st_size;
-                data = (double *)mmap(0, size, PROT_READ, MAP_PRIVATE, fp, 0);
+                void * ptr = mmap(0, size, PROT_READ, MAP_PRIVATE, fp, 0);
+                close(fp);
+                if (ptr == MAP_FAILED) {
+                    throw std::runtime_error("Error: the EuclidEmulator2 file " + filename + " could not be mapped\n");
+                }
+                data = (double *)ptr;
                 for (int i = 0; i < 15; i++) {
                     pc[i] = &data[idx];
                     idx += nk * nz;
@@ -414,23 +394,97 @@ namespace FML {
                 kptr = &data[idx];
                 for (int i = 0; i < nk; i++) {
                     kvec[i] = kptr[i];
+                    logkvec[i] = std::log(kvec[i]);
                 }
                 idx += nk;
                 assert(idx == int(size / sizeof(double)));
             }
 
-            void EuclidEmulator::pc_2d_interp() {
-                double logk[nk];
+            void EuclidEmulatorData::pc_2d_interp() {
                 double stp[nz];
-                for (int i = 0; i < nk; i++)
-                    logk[i] = std::log(kvec[i]);
                 for (int i = nz - 1; i >= 0; i--)
                     stp[i] = i;
+                for (int i = 0; i < 15; i++) {
+                    logklogz2pc_spline[i] = gsl_spline2d_alloc(gsl_interp2d_bicubic, nk, nz);
+                    gsl_spline2d_init(logklogz2pc_spline[i], logkvec, stp, pc[i], nk, nz);
+                }
+            }
+
+            /// Get the emulator data for the current datafile (path_to_ee2_datafile). It is read and splined
+            /// the first time it is asked for and then kept for the rest of the run
+            std::shared_ptr<const EuclidEmulatorData> get_ee2_data() {
+                static std::mutex mutex;
+                static std::map<std::string, std::shared_ptr<const EuclidEmulatorData>> cache;
+                std::lock_guard<std::mutex> lock(mutex);
+                auto & data = cache[path_to_ee2_datafile];
+                if (not data)
+                    data = std::make_shared<const EuclidEmulatorData>(path_to_ee2_datafile);
+                return data;
+            }
+
+            class EuclidEmulator {
+              private:
+                static const int nz = EuclidEmulatorData::nz;
+                static const int nk = EuclidEmulatorData::nk;
+                const int lmax = 16;
+                std::shared_ptr<const EuclidEmulatorData> ee2data;
+                gsl_interp_accel * logk2pc_acc[15];
+                gsl_interp_accel * logz2pc_acc[15];
+                std::array<std::vector<double>, 8> univ_legendre;
+                Cosmology csm{};
+
+              public:
+                double kvec[613];
+                double Bvec[101][613];
+                EuclidEmulator(Cosmology csm);
+                EuclidEmulator(double OmegaB,
+                               double OmegaM,
+                               double Sum_m_nu,
+                               double n_s,
+                               double h,
+                               double w_0,
+                               double w_a,
+                               double A_s);
+                EuclidEmulator(const EuclidEmulator &) = delete;
+                EuclidEmulator & operator=(const EuclidEmulator &) = delete;
+                ~EuclidEmulator();
+                void compute_boost(std::vector<double> redshift, int n_redshift);
+                std::pair<std::vector<double>, std::vector<double>> compute_boost(double redshift);
+                std::pair<std::vector<double>, std::vector<double>> get_boost(int iz);
+            };
+
+            EuclidEmulator::EuclidEmulator(Cosmology cosmo) : ee2data(get_ee2_data()), csm(cosmo) {
+                for (int iz = 0; iz < nz; iz++) {
+                    for (int ik = 0; ik < nk; ik++) {
+                        Bvec[iz][ik] = 0.0;
+                    }
+                }
+                for (int ik = 0; ik < nk; ik++) {
+                    kvec[ik] = ee2data->kvec[ik];
+                }
                 for (int i = 0; i < 15; i++) {
                     logk2pc_acc[i] = gsl_interp_accel_alloc();
                     logz2pc_acc[i] = gsl_interp_accel_alloc();
-                    logklogz2pc_spline[i] = gsl_spline2d_alloc(gsl_interp2d_bicubic, nk, nz);
-                    gsl_spline2d_init(logklogz2pc_spline[i], logk, stp, pc[i], nk, nz);
+                }
+                if (not csm.good_parameter_ranges()) {
+                    throw std::runtime_error("Cosmological parameter(s) is out of bounds for EuclidEmulator2");
+                }
+            }
+
+            EuclidEmulator::EuclidEmulator(double OmegaB,
+                                           double OmegaM,
+                                           double Sum_m_nu,
+                                           double n_s,
+                                           double h,
+                                           double w_0,
+                                           double w_a,
+                                           double A_s)
+                : EuclidEmulator(Cosmology(OmegaB, OmegaM, Sum_m_nu, n_s, h, w_0, w_a, A_s)) {}
+
+            EuclidEmulator::~EuclidEmulator() {
+                for (int i = 0; i < 15; i++) {
+                    gsl_interp_accel_free(logk2pc_acc[i]);
+                    gsl_interp_accel_free(logz2pc_acc[i]);
                 }
             }
 
@@ -440,6 +494,11 @@ namespace FML {
                 return get_boost(0);
             }
             void EuclidEmulator::compute_boost(std::vector<double> redshift, int n_redshift) {
+                if (n_redshift > nz) {
+                    throw std::runtime_error("EuclidEmulator2 can only compute the boost for " + std::to_string(nz) +
+                                             " redshifts at the time");
+                }
+                const EuclidEmulatorData & d = *ee2data;
                 double pc_weight;
                 double basisfunc;
                 double stp_no[n_redshift];
@@ -463,22 +522,22 @@ namespace FML {
                 for (int iz = 0; iz < n_redshift; iz++) {
                     for (int ik = 0; ik < nk; ik++) {
                         Bvec[iz][ik] = gsl_spline2d_eval(
-                            logklogz2pc_spline[0], std::log(kvec[ik]), stp_no[iz], logk2pc_acc[0], logz2pc_acc[0]);
+                            d.logklogz2pc_spline[0], d.logkvec[ik], stp_no[iz], logk2pc_acc[0], logz2pc_acc[0]);
                     }
                 }
                 for (int ipc = 1; ipc < 15; ipc++) {
                     pc_weight = 0.0;
-                    for (int ic = 0; ic < n_coeffs[ipc - 1]; ic++) {
+                    for (int ic = 0; ic < d.n_coeffs[ipc - 1]; ic++) {
                         basisfunc = 1.0;
                         for (int ipar = 0; ipar < 8; ipar++) {
-                            basisfunc *= univ_legendre[ipar][int(pce_multiindex[ipc - 1][ic * 8 + ipar])];
+                            basisfunc *= univ_legendre[ipar][int(d.pce_multiindex[ipc - 1][ic * 8 + ipar])];
                         }
-                        pc_weight += pce_coeffs[ipc - 1][ic] * basisfunc;
+                        pc_weight += d.pce_coeffs[ipc - 1][ic] * basisfunc;
                     }
                     for (int iz = 0; iz < n_redshift; iz++) {
                         for (int ik = 0; ik < nk; ik++) {
-                            Bvec[iz][ik] += (pc_weight * gsl_spline2d_eval(logklogz2pc_spline[ipc],
-                                                                           std::log(kvec[ik]),
+                            Bvec[iz][ik] += (pc_weight * gsl_spline2d_eval(d.logklogz2pc_spline[ipc],
+                                                                           d.logkvec[ik],
                                                                            stp_no[iz],
                                                                            logk2pc_acc[ipc],
                                                                            logz2pc_acc[ipc]));
@@ -495,6 +554,55 @@ namespace FML {
                 }
                 return {k, boost};
             }
+
+            /// Compute the boost B(k,z) = P_nonlinear / P_linear for many cosmologies and redshifts, e.g. for use in
+            /// likelihood codes. The parameters of each cosmology are given in the same order as for Cosmology,
+            /// i.e. {OmegaB, OmegaM, Sum_m_nu, n_s, h, w_0, w_a, A_s}. The cosmologies are distributed over OpenMP
+            /// threads and all share the same emulator data. Returns k and boosts[icosmo][iz] = B(k, redshifts[iz])
+            std::pair<std::vector<double>, std::vector<std::vector<std::vector<double>>>>
+            compute_boosts(const std::vector<std::array<double, 8>> & parameters,
+                           const std::vector<double> & redshifts) {
+                const int ncosmo = int(parameters.size());
+                const int nredshift = int(redshifts.size());
+                const int nz = EuclidEmulatorData::nz;
+
+                // Read the data (if not already done) before we go parallel
+                auto ee2data = get_ee2_data();
+                std::vector<double> k(ee2data->kvec, ee2data->kvec + EuclidEmulatorData::nk);
+
+                // An exception cannot leave the parallel region so we keep the first one and rethrow it after
+                std::vector<std::vector<std::vector<double>>> boosts(ncosmo);
+                std::exception_ptr error{nullptr};
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+                for (int i = 0; i < ncosmo; i++) {
+                    try {
+                        const auto & p = parameters[i];
+                        auto ee2 = std::make_unique<EuclidEmulator>(
+                            Cosmology(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]));
+                        boosts[i].resize(nredshift);
+
+                        // The emulator holds at most nz redshifts at the time
+                        for (int izstart = 0; izstart < nredshift; izstart += nz) {
+                            const int nchunk = std::min(nz, nredshift - izstart);
+                            std::vector<double> z(redshifts.begin() + izstart, redshifts.begin() + izstart + nchunk);
+                            ee2->compute_boost(z, nchunk);
+                            for (int iz = 0; iz < nchunk; iz++)
+                                boosts[i][izstart + iz] = ee2->get_boost(iz).second;
+                        }
+                    } catch (...) {
+#ifdef USE_OMP
+#pragma omp critical
+#endif
+                        if (not error)
+                            error = std::current_exception();
+                    }
+                }
+                if (error)
+                    std::rethrow_exception(error);
+                return {k, boosts};
+            }
 #endif
         } // namespace EUCLIDEMULATOR2
     }     // namespace EMULATOR
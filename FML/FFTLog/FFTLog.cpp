@@ -97,6 +97,86 @@ namespace FML {
                 return u;
             }
 
+            FFTLogPlan::FFTLogPlan(int N, double mu, double q, double L, double kcrc, bool noring)
+                : N(N), mu(mu), q(q), L(L), kcrc(noring ? goodkr(N, mu, q, L, kcrc) : kcrc) {
+                u = ComputeCoefficients(N, mu, q, L, this->kcrc);
+
+                // Make the plans on temporary arrays. FFTW_UNALIGNED lets us execute them on any arrays
+                // later on (forward out-of-place and backward in-place as planned)
+                fftw_complex * grid_in = fftw_alloc_complex(N);
+                fftw_complex * grid_out = fftw_alloc_complex(N);
+                forward_plan = fftw_plan_dft_1d(N, grid_in, grid_out, FFTW_FORWARD, FFTW_ESTIMATE | FFTW_UNALIGNED);
+                reverse_plan = fftw_plan_dft_1d(N, grid_out, grid_out, FFTW_BACKWARD, FFTW_ESTIMATE | FFTW_UNALIGNED);
+                fftw_free(grid_in);
+                fftw_free(grid_out);
+            }
+
+            FFTLogPlan::~FFTLogPlan() {
+                fftw_destroy_plan(forward_plan);
+                fftw_destroy_plan(reverse_plan);
+            }
+
+            CVector FFTLogPlan::transform(const CVector & a) const {
+                assert(int(a.size()) == N);
+                CVector b(N);
+
+                // Compute the convolution b = a*u using FFTs
+                // For out-of-place complex transforms FFTW does not overwrite the input
+                fftw_complex * grid_in = reinterpret_cast<fftw_complex *>(const_cast<CDouble *>(a.data()));
+                fftw_complex * grid_out = reinterpret_cast<fftw_complex *>(b.data());
+                fftw_execute_dft(forward_plan, grid_in, grid_out);
+
+                // Multiply by u
+                const double fftw_norm = 1.0 / double(N);
+                for (int m = 0; m < N; m++) {
+                    b[m] *= u[m] * fftw_norm;
+                }
+
+                // Transform back
+                fftw_execute_dft(reverse_plan, grid_out, grid_out);
+
+                // Reverse b array
+                for (int n = 0; n < N / 2; n++) {
+                    const auto tmp = b[n];
+                    b[n] = b[N - n - 1];
+                    b[N - n - 1] = tmp;
+                }
+                return b;
+            }
+
+            std::vector<CVector> FFTLogPlan::transform(const std::vector<CVector> & a) const {
+                std::vector<CVector> b(a.size());
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+                for (size_t i = 0; i < a.size(); i++) {
+                    b[i] = transform(a[i]);
+                }
+                return b;
+            }
+
+            DVector FFTLogPlan::get_dual_points(double r0) const {
+                const double k0r0 = kcrc * std::exp(-L);
+                DVector k(N);
+                k[0] = k0r0 / r0;
+                for (int n = 1; n < N; n++) {
+                    k[n] = k[0] * std::exp(n * L / N);
+                }
+                return k;
+            }
+
+            std::shared_ptr<const FFTLogPlan> get_plan(int N, double mu, double q, double L, double kcrc, bool noring) {
+                // The FFTW planner is not thread safe so we make the plans under the lock
+                static std::mutex mutex;
+                static std::map<std::tuple<int, double, double, double, double, bool>, std::shared_ptr<const FFTLogPlan>>
+                    plans;
+                std::lock_guard<std::mutex> lock(mutex);
+                auto & plan = plans[{N, mu, q, L, kcrc, noring}];
+                if (not plan)
+                    plan = std::make_shared<const FFTLogPlan>(N, mu, q, L, kcrc, noring);
+                return plan;
+            }
+
             std::pair<DVector, CVector> DiscreteHankelTransform(const DVector & r,
                                                                 const CVector & a,
                                                                 double mu,
@@ -106,15 +186,13 @@ namespace FML {
                                                                 CDouble * u) {
                 const int N = int(r.size());
                 const double L = std::log(r[N - 1] / r[0]) * N / (N - 1.);
-                CVector b(N);
-                CVector ulocal;
+
+                // Without given coefficients we use a cached plan
                 if (u == nullptr) {
-                    if (noring) {
-                        kcrc = goodkr(N, mu, q, L, kcrc);
-                    }
-                    ulocal = ComputeCoefficients(N, mu, q, L, kcrc);
-                    u = ulocal.data();
+                    auto plan = get_plan(N, mu, q, L, kcrc, noring);
+                    return {plan->get_dual_points(r[0]), plan->transform(a)};
                 }
+                CVector b(N);
 
                 // Compute the convolution b = a*u using FFTs
                 // NB: don't use FFTW_MEASURE as it will overwrite the a-array. To use this we must
@@ -178,6 +256,39 @@ namespace FML {
                 return {r, xi};
             }
 
+            std::pair<DVector, std::vector<DVector>>
+            ComputeXiLM(int ell, int m, const DVector & k, const std::vector<DVector> & pk) {
+                const int N = int(k.size());
+                const double L = std::log(k[N - 1] / k[0]) * N / (N - 1.);
+                auto plan = get_plan(N, ell + 0.5, 0, L, 1, true);
+                const DVector r = plan->get_dual_points(k[0]);
+
+                std::vector<DVector> xi(pk.size());
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+                for (size_t j = 0; j < pk.size(); j++) {
+                    assert(k.size() == pk[j].size());
+
+                    // Set the integrand
+                    CVector a(N);
+                    for (int i = 0; i < N; i++) {
+                        a[i] = std::pow(k[i], m - 0.5) * pk[j][i];
+                    }
+
+                    // Transform
+                    const auto b = plan->transform(a);
+
+                    // Set output and normalize
+                    xi[j] = DVector(N);
+                    for (int i = 0; i < N; i++) {
+                        xi[j][i] = std::pow(2 * M_PI * r[i], -1.5) * b[i].real();
+                    }
+                }
+
+                return {r, xi};
+            }
+
             std::pair<DVector, DVector> ComputeCorrelationFunction(const DVector & k, const DVector & pk) {
                 return ComputeXiLM(0, 2, k, pk);
             }
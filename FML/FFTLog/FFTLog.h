@@ -6,6 +6,10 @@
 #include <complex>
 #include <cstring>
 #include <fftw3.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
 #include <vector>
 
 namespace FML {
@@ -56,6 +60,14 @@ namespace FML {
             //==========================================================================
             std::pair<DVector, DVector> ComputeXiLM(int ell, int m, const DVector & k, const DVector & pk);
 
+            //==========================================================================
+            /// @brief As above, but for many power spectra P(k) sampled at the same k's. The
+            /// transforms share one cached FFTLogPlan and are done in parallel (OpenMP).
+            /// Returns r and \f$ \xi_l^m(r) \f$ for each of the input arrays
+            //==========================================================================
+            std::pair<DVector, std::vector<DVector>>
+            ComputeXiLM(int ell, int m, const DVector & k, const std::vector<DVector> & pk);
+
             //==========================================================================
             /// @brief Compute the discrete Hankel transform of the function a(r). See the FFTLog
             /// documentation for a description of exactly what this function computes.
@@ -79,6 +91,52 @@ namespace FML {
             ///   \f$ L = N * log(r[N-1]/r[0])/(N-1) \f$
             //==========================================================================
             CVector ComputeCoefficients(int N, double mu, double q, double L, double kcrc);
+
+            //==========================================================================
+            /// @brief A reusable FFTLog transform for input arrays of size N spanning a
+            /// logarithmic range L (as defined for ComputeCoefficients) with fixed (mu, q, kcrc).
+            /// Keeps the u coefficients and the FFTW plans so that a transform only costs
+            /// two FFTs. Transforms can be done from several threads at the same time.
+            /// Use get_plan to get a cached plan instead of making new ones.
+            //==========================================================================
+            class FFTLogPlan {
+              private:
+                int N{};
+                double mu{};
+                double q{};
+                double L{};
+                double kcrc{};
+                CVector u{};
+                fftw_plan forward_plan{};
+                fftw_plan reverse_plan{};
+
+              public:
+                /// If noring is true then kcrc is adjusted to a "good" value close to the one given
+                FFTLogPlan(int N, double mu, double q, double L, double kcrc, bool noring = true);
+                FFTLogPlan(const FFTLogPlan &) = delete;
+                FFTLogPlan & operator=(const FFTLogPlan &) = delete;
+                ~FFTLogPlan();
+
+                /// The discrete Hankel transform b of a (same output as DiscreteHankelTransform)
+                CVector transform(const CVector & a) const;
+
+                /// Transform many arrays in parallel (OpenMP)
+                std::vector<CVector> transform(const std::vector<CVector> & a) const;
+
+                /// The output points dual to input points starting at r0, i.e. k[0] = kcrc exp(-L) / r0
+                DVector get_dual_points(double r0) const;
+
+                int get_N() const { return N; }
+                double get_kcrc() const { return kcrc; }
+            };
+
+            //==========================================================================
+            /// @brief Get a plan for the given parameters. Plans are made the first time
+            /// they are asked for and then kept (keyed on N, mu, q, L, kcrc and noring)
+            /// for the rest of the run. Thread safe.
+            //==========================================================================
+            std::shared_ptr<const FFTLogPlan>
+            get_plan(int N, double mu, double q, double L, double kcrc = 1, bool noring = true);
         } // namespace FFTLog
     }     // namespace SOLVERS
 } // namespace FML
@@ -2,6 +2,8 @@
 #define FFTWGLOBAL_HEADER
 
 #include <complex>
+#include <mutex>
+#include <vector>
 
 #ifdef USE_FFTW
 #include <fftw3.h>
@@ -40,57 +42,258 @@ using ComplexType = std::complex<FloatType>;
 #ifdef SINGLE_PRECISION_FFTW
 using my_fftw_complex = fftwf_complex;
 using my_fftw_plan = fftwf_plan;
-#define SET_FFTW_NTHREADS fftwf_plan_with_nthreads
-#define INIT_FFTW_THREADS fftwf_init_threads
+using my_fftw_iodim = fftwf_iodim;
 #ifdef USE_MPI
-#define INIT_FFTW_MPI fftwf_mpi_init
-#define CLEANUP_FFTW_MPI fftwf_mpi_cleanup
 #define MAKE_PLAN_R2C fftwf_mpi_plan_dft_r2c
 #define MAKE_PLAN_C2R fftwf_mpi_plan_dft_c2r
 #define MPI_FFTW_LOCAL_SIZE fftwf_mpi_local_size
+#define MPI_FFTW_LOCAL_SIZE_MANY fftwf_mpi_local_size_many
+#define MAKE_PLAN_MANY_R2C fftwf_mpi_plan_many_dft_r2c
+#define MAKE_PLAN_MANY_C2R fftwf_mpi_plan_many_dft_c2r
+#define EXECUTE_FFT_R2C_NEWARRAY fftwf_mpi_execute_dft_r2c
+#define EXECUTE_FFT_C2R_NEWARRAY fftwf_mpi_execute_dft_c2r
 #else
 #define MAKE_PLAN_R2C fftwf_plan_dft_r2c
 #define MAKE_PLAN_C2R fftwf_plan_dft_c2r
+#define MAKE_PLAN_MANY_R2C fftwf_plan_many_dft_r2c
+#define MAKE_PLAN_MANY_C2R fftwf_plan_many_dft_c2r
+#define EXECUTE_FFT_R2C_NEWARRAY fftwf_execute_dft_r2c
+#define EXECUTE_FFT_C2R_NEWARRAY fftwf_execute_dft_c2r
 #endif
 #define EXECUTE_FFT fftwf_execute
+#define FFTW_ALIGNMENT_OF fftwf_alignment_of
 #define DESTROY_PLAN fftwf_destroy_plan
+#define MAKE_PLAN_GURU_R2C fftwf_plan_guru_dft_r2c
+#define MAKE_PLAN_GURU_C2R fftwf_plan_guru_dft_c2r
+#define MAKE_PLAN_GURU_DFT fftwf_plan_guru_dft
 #else // Single precision
 #ifdef LONG_DOUBLE_PRECISION_FFTW
 using my_fftw_complex = fftwl_complex;
 using my_fftw_plan = fftwl_plan;
-#define SET_FFTW_NTHREADS fftwl_plan_with_nthreads
-#define INIT_FFTW_THREADS fftwl_init_threads
+using my_fftw_iodim = fftwl_iodim;
 #ifdef USE_MPI
-#define INIT_FFTW_MPI fftwl_mpi_init
-#define CLEANUP_FFTW_MPI fftwl_mpi_cleanup
 #define MAKE_PLAN_R2C fftwl_mpi_plan_dft_r2c
 #define MAKE_PLAN_C2R fftwl_mpi_plan_dft_c2r
 #define MPI_FFTW_LOCAL_SIZE fftwl_mpi_local_size
+#define MPI_FFTW_LOCAL_SIZE_MANY fftwl_mpi_local_size_many
+#define MAKE_PLAN_MANY_R2C fftwl_mpi_plan_many_dft_r2c
+#define MAKE_PLAN_MANY_C2R fftwl_mpi_plan_many_dft_c2r
+#define EXECUTE_FFT_R2C_NEWARRAY fftwl_mpi_execute_dft_r2c
+#define EXECUTE_FFT_C2R_NEWARRAY fftwl_mpi_execute_dft_c2r
 #else
 #define MAKE_PLAN_R2C fftwl_plan_dft_r2c
 #define MAKE_PLAN_C2R fftwl_plan_dft_c2r
+#define MAKE_PLAN_MANY_R2C fftwl_plan_many_dft_r2c
+#define MAKE_PLAN_MANY_C2R fftwl_plan_many_dft_c2r
+#define EXECUTE_FFT_R2C_NEWARRAY fftwl_execute_dft_r2c
+#define EXECUTE_FFT_C2R_NEWARRAY fftwl_execute_dft_c2r
 #endif
 #define EXECUTE_FFT fftwl_execute
+#define FFTW_ALIGNMENT_OF fftwl_alignment_of
 #define DESTROY_PLAN fftwl_destroy_plan
+#define MAKE_PLAN_GURU_R2C fftwl_plan_guru_dft_r2c
+#define MAKE_PLAN_GURU_C2R fftwl_plan_guru_dft_c2r
+#define MAKE_PLAN_GURU_DFT fftwl_plan_guru_dft
 #else // Long double precision
 using my_fftw_complex = fftw_complex;
 using my_fftw_plan = fftw_plan;
-#define SET_FFTW_NTHREADS fftw_plan_with_nthreads
-#define INIT_FFTW_THREADS fftw_init_threads
+using my_fftw_iodim = fftw_iodim;
 #ifdef USE_MPI
-#define INIT_FFTW_MPI fftw_mpi_init
-#define CLEANUP_FFTW_MPI fftw_mpi_cleanup
 #define MAKE_PLAN_R2C fftw_mpi_plan_dft_r2c
 #define MAKE_PLAN_C2R fftw_mpi_plan_dft_c2r
 #define MPI_FFTW_LOCAL_SIZE fftw_mpi_local_size
+#define MPI_FFTW_LOCAL_SIZE_MANY fftw_mpi_local_size_many
+#define MAKE_PLAN_MANY_R2C fftw_mpi_plan_many_dft_r2c
+#define MAKE_PLAN_MANY_C2R fftw_mpi_plan_many_dft_c2r
+#define EXECUTE_FFT_R2C_NEWARRAY fftw_mpi_execute_dft_r2c
+#define EXECUTE_FFT_C2R_NEWARRAY fftw_mpi_execute_dft_c2r
 #else
 #define MAKE_PLAN_R2C fftw_plan_dft_r2c
 #define MAKE_PLAN_C2R fftw_plan_dft_c2r
+#define MAKE_PLAN_MANY_R2C fftw_plan_many_dft_r2c
+#define MAKE_PLAN_MANY_C2R fftw_plan_many_dft_c2r
+#define EXECUTE_FFT_R2C_NEWARRAY fftw_execute_dft_r2c
+#define EXECUTE_FFT_C2R_NEWARRAY fftw_execute_dft_c2r
 #endif
 #define EXECUTE_FFT fftw_execute
+#define FFTW_ALIGNMENT_OF fftw_alignment_of
 #define DESTROY_PLAN fftw_destroy_plan
+#define MAKE_PLAN_GURU_R2C fftw_plan_guru_dft_r2c
+#define MAKE_PLAN_GURU_C2R fftw_plan_guru_dft_c2r
+#define MAKE_PLAN_GURU_DFT fftw_plan_guru_dft
 #endif // Double precision
 #endif
 #endif
 
+//==========================================================================
+// The same as above, but as a traits class templated on the floating point
+// type. This is used by FFTWGrid<N, T> so that grids with different precision
+// can live in the same binary. Only the FFTW library for the precisions that
+// are actually used needs to be linked in.
+//==========================================================================
+#ifdef USE_FFTW
+// The FFTW planner is not thread safe so we hold this lock when making and destroying plans. This allows
+// transforms to be done from several threads at the same time (e.g. analysis in a background thread)
+inline std::recursive_mutex & FFTWPlannerMutex() {
+    static std::recursive_mutex planner_mutex;
+    return planner_mutex;
+}
+
+template <class T>
+struct FFTWTraits;
+
+// Each precision is a separate FFTW library that must be initialized (MPI, threads) before it is used and cleaned
+// up at the end. FloatType is initialized by init_fftw and the other precisions the first time FFTWTraits<T> makes
+// a plan, so we only need to link the libraries we use. This is the list of the ones initialized so far.
+struct FFTWLibrary {
+    void (*set_nthreads)(int);
+    void (*cleanup)();
+};
+inline std::vector<FFTWLibrary> & FFTWInitializedLibraries() {
+    static std::vector<FFTWLibrary> libraries;
+    return libraries;
+}
+
+#ifdef USE_FFTW_THREADS
+#define FML_FFTW_TRAITS_INIT_THREADS(X)                                                                                \
+    if (FML::MPIThreadsOK and X##_init_threads()) {                                                                    \
+        ok = true;                                                                                                     \
+        X##_plan_with_nthreads(FML::FFTWNThreads);                                                                     \
+    }
+#define FML_FFTW_TRAITS_SET_NTHREADS(X) X##_plan_with_nthreads(nthreads);
+#else
+#define FML_FFTW_TRAITS_INIT_THREADS(X)
+#define FML_FFTW_TRAITS_SET_NTHREADS(X)
+#endif
+#ifdef USE_MPI
+#define FML_FFTW_TRAITS_INIT_MPI(X) X##_mpi_init();
+#define FML_FFTW_TRAITS_CLEANUP_MPI(X) X##_mpi_cleanup();
+#else
+#define FML_FFTW_TRAITS_INIT_MPI(X)
+#define FML_FFTW_TRAITS_CLEANUP_MPI(X)
+#endif
+
+#ifdef USE_MPI
+#define FML_FFTW_TRAITS_MPI(X)                                                                                         \
+    template <class... Args>                                                                                           \
+    static plan plan_r2c(Args... args) {                                                                               \
+        init();                                                                                                        \
+        std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                               \
+        return X##_mpi_plan_dft_r2c(args...);                                                                          \
+    }                                                                                                                  \
+    template <class... Args>                                                                                           \
+    static plan plan_c2r(Args... args) {                                                                               \
+        init();                                                                                                        \
+        std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                               \
+        return X##_mpi_plan_dft_c2r(args...);                                                                          \
+    }                                                                                                                  \
+    template <class... Args>                                                                                           \
+    static plan plan_many_r2c(Args... args) {                                                                          \
+        init();                                                                                                        \
+        std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                               \
+        return X##_mpi_plan_many_dft_r2c(args...);                                                                     \
+    }                                                                                                                  \
+    template <class... Args>                                                                                           \
+    static plan plan_many_c2r(Args... args) {                                                                          \
+        init();                                                                                                        \
+        std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                               \
+        return X##_mpi_plan_many_dft_c2r(args...);                                                                     \
+    }                                                                                                                  \
+    template <class... Args>                                                                                           \
+    static ptrdiff_t local_size(Args... args) {                                                                        \
+        init();                                                                                                        \
+        return X##_mpi_local_size(args...);                                                                            \
+    }                                                                                                                  \
+    template <class... Args>                                                                                           \
+    static ptrdiff_t local_size_many(Args... args) {                                                                   \
+        init();                                                                                                        \
+        return X##_mpi_local_size_many(args...);                                                                       \
+    }                                                                                                                  \
+    static void execute_r2c(plan p, real * in, complex * out) { X##_mpi_execute_dft_r2c(p, in, out); }                 \
+    static void execute_c2r(plan p, complex * in, real * out) { X##_mpi_execute_dft_c2r(p, in, out); }                 \
+    static void broadcast_wisdom() {                                                                                   \
+        init();                                                                                                        \
+        X##_mpi_broadcast_wisdom(MPI_COMM_WORLD);                                                                      \
+    }                                                                                                                  \
+    static void gather_wisdom() {                                                                                      \
+        init();                                                                                                        \
+        X##_mpi_gather_wisdom(MPI_COMM_WORLD);                                                                         \
+    }
+#else
+#define FML_FFTW_TRAITS_MPI(X)                                                                                         \
+    template <class... Args>                                                                                           \
+    static plan plan_r2c(Args... args) {                                                                               \
+        init();                                                                                                        \
+        std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                               \
+        return X##_plan_dft_r2c(args...);                                                                              \
+    }                                                                                                                  \
+    template <class... Args>                                                                                           \
+    static plan plan_c2r(Args... args) {                                                                               \
+        init();                                                                                                        \
+        std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                               \
+        return X##_plan_dft_c2r(args...);                                                                              \
+    }                                                                                                                  \
+    template <class... Args>                                                                                           \
+    static plan plan_many_r2c(Args... args) {                                                                          \
+        init();                                                                                                        \
+        std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                               \
+        return X##_plan_many_dft_r2c(args...);                                                                         \
+    }                                                                                                                  \
+    template <class... Args>                                                                                           \
+    static plan plan_many_c2r(Args... args) {                                                                          \
+        init();                                                                                                        \
+        std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                               \
+        return X##_plan_many_dft_c2r(args...);                                                                         \
+    }                                                                                                                  \
+    static void execute_r2c(plan p, real * in, complex * out) { X##_execute_dft_r2c(p, in, out); }                     \
+    static void execute_c2r(plan p, complex * in, real * out) { X##_execute_dft_c2r(p, in, out); }                     \
+    static void broadcast_wisdom() {}                                                                                  \
+    static void gather_wisdom() {}
+#endif
+
+#define FML_FFTW_TRAITS(TYPE, X)                                                                                       \
+    template <>                                                                                                        \
+    struct FFTWTraits<TYPE> {                                                                                          \
+        using real = TYPE;                                                                                             \
+        using complex = X##_complex;                                                                                   \
+        using plan = X##_plan;                                                                                         \
+        /* Initialize this precision (once). Returns true if FFTW can use threads */                                  \
+        static bool init() {                                                                                           \
+            static bool threads_ok = [] {                                                                              \
+                bool ok = false;                                                                                       \
+                FML_FFTW_TRAITS_INIT_THREADS(X)                                                                        \
+                FML_FFTW_TRAITS_INIT_MPI(X)                                                                            \
+                FFTWInitializedLibraries().push_back({ok ? &set_nthreads : nullptr, &cleanup});                        \
+                return ok;                                                                                             \
+            }();                                                                                                       \
+            return threads_ok;                                                                                         \
+        }                                                                                                              \
+        static void set_nthreads([[maybe_unused]] int nthreads) { FML_FFTW_TRAITS_SET_NTHREADS(X) }                    \
+        static void cleanup() { FML_FFTW_TRAITS_CLEANUP_MPI(X) }                                                       \
+        FML_FFTW_TRAITS_MPI(X)                                                                                         \
+        static void execute(plan p) { X##_execute(p); }                                                                \
+        static void destroy_plan(plan p) {                                                                             \
+            std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());                                           \
+            X##_destroy_plan(p);                                                                                       \
+        }                                                                                                              \
+        static int alignment_of(real * p) { return X##_alignment_of(p); }                                              \
+        static int import_wisdom_from_filename(const char * filename) {                                                \
+            return X##_import_wisdom_from_filename(filename);                                                          \
+        }                                                                                                              \
+        static int export_wisdom_to_filename(const char * filename) {                                                  \
+            return X##_export_wisdom_to_filename(filename);                                                            \
+        }                                                                                                              \
+    };
+
+FML_FFTW_TRAITS(float, fftwf)
+FML_FFTW_TRAITS(double, fftw)
+FML_FFTW_TRAITS(long double, fftwl)
+#undef FML_FFTW_TRAITS
+#undef FML_FFTW_TRAITS_MPI
+#undef FML_FFTW_TRAITS_INIT_THREADS
+#undef FML_FFTW_TRAITS_SET_NTHREADS
+#undef FML_FFTW_TRAITS_INIT_MPI
+#undef FML_FFTW_TRAITS_CLEANUP_MPI
+#endif
+
 #endif
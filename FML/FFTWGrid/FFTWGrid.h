@@ -20,7 +20,11 @@
 #ifdef USE_GSL
 #include <FML/Spline/Spline.h>
 #endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 
+#include <FML/FFTWGrid/FFTWPlanCache.h>
 #include <FML/Global/Global.h>
 
 namespace FML {
@@ -34,6 +38,84 @@ namespace FML {
         // Forward declaration of range classes
         class FourierRange;
         class RealRange;
+        class RealRowRange;
+        template <int N>
+        class FourierRowRange;
+
+        //==========================================================================
+        ///
+        /// Handle for a non-blocking communication of slices between tasks, e.g. from
+        /// FFTWGrid::communicate_boundaries_async. Do work that does not need the slices
+        /// in flight and then call wait() before using them (we also wait when the handle is destroyed).
+        /// Neither the slices we send nor the ones we receive into can be changed before we have waited.
+        ///
+        /// An action to run when the communication is done (e.g. to add up the received data)
+        /// can be set with set_on_completion
+        ///
+        //==========================================================================
+        class FFTWGridHaloExchange {
+          private:
+#ifdef USE_MPI
+            std::vector<MPI_Request> requests{};
+#endif
+            std::function<void()> on_completion{};
+
+          public:
+            FFTWGridHaloExchange() = default;
+            FFTWGridHaloExchange(const FFTWGridHaloExchange &) = delete;
+            FFTWGridHaloExchange & operator=(const FFTWGridHaloExchange &) = delete;
+            FFTWGridHaloExchange(FFTWGridHaloExchange && rhs) { *this = std::move(rhs); }
+            FFTWGridHaloExchange & operator=(FFTWGridHaloExchange && rhs) {
+                if (this != &rhs) {
+                    wait();
+#ifdef USE_MPI
+                    requests = std::move(rhs.requests);
+                    rhs.requests.clear();
+#endif
+                    on_completion = std::move(rhs.on_completion);
+                    rhs.on_completion = nullptr;
+                }
+                return *this;
+            }
+            ~FFTWGridHaloExchange() { wait(); }
+
+#ifdef USE_MPI
+            /// Add a request to wait for
+            void add_request(MPI_Request request) { requests.push_back(request); }
+#endif
+            /// Set what to do (once) when all the communication is done
+            void set_on_completion(std::function<void()> func) { on_completion = std::move(func); }
+
+            /// Wait for the communication to finish
+            void wait() {
+#ifdef USE_MPI
+                if (requests.size() > 0) {
+                    MPI_Waitall(int(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+                    requests.clear();
+                }
+#endif
+                if (on_completion) {
+                    auto func = std::move(on_completion);
+                    on_completion = nullptr;
+                    func();
+                }
+            }
+
+            /// Check if the communication is done (and if so finish it as wait does)
+            bool test() {
+#ifdef USE_MPI
+                if (requests.size() > 0) {
+                    int done = 0;
+                    MPI_Testall(int(requests.size()), requests.data(), &done, MPI_STATUSES_IGNORE);
+                    if (not done)
+                        return false;
+                    requests.clear();
+                }
+#endif
+                wait();
+                return true;
+            }
+        };
 
         //==========================================================================
         ///
@@ -44,10 +126,21 @@ namespace FML {
         /// and all transforms are done in-place. Keeps track of the status of the grid, i.e.
         /// if its in real-space or fourier-space (set with set_grid_status_real)
         ///
+        /// With MPI (and N >= 3) the Fourier grid can be stored transposed, i.e. as [ky][kx][kz...] with the
+        /// local slices being ky-slices (set with set_fourier_layout_transposed). This saves a global transpose
+        /// on each r2c and c2r so is useful when we only do pointwise operations in k-space. All the index based
+        /// methods (get_fourier_range, get_fourier_wavevector_from_index, ...) take this into account, but code that
+        /// computes kx from the slice number and Local_x_start directly does not.
+        ///
         /// The default constructor arguments in (Nmesh, n_extra_left, n_extra_right) is:
         ///
         ///   N                : Dimension of the grid
         ///
+        ///   T                : The floating point type (float, double or long double). Defaults to FloatType
+        ///                      (set by SINGLE_PRECISION_FFTW / LONG_DOUBLE_PRECISION_FFTW). Grids with different
+        ///                      T can be used in the same program, but one must link with the FFTW library for
+        ///                      each precision in use (-lfftw3f, -lfftw3, -lfftw3l)
+        ///
         ///   Nmesh            : Number of grid-nodes per dimension (assuming the same)
         ///
         ///   n_extra          : Alloc extra slices of the grid in the x-dimension (left and/or right)
@@ -56,12 +149,21 @@ namespace FML {
         ///
         ///   BOUNDSCHECK_FFTWGRID       : bound checks when setting and getting values
         ///
-        ///   SINGLE_PRECISION_FFTW      : use float instead of double
+        ///   SINGLE_PRECISION_FFTW      : use float instead of double (as the default T)
         ///
-        ///   LONG_DOUBLE_PRECISION_FFTW : use load double instead of double
+        ///   LONG_DOUBLE_PRECISION_FFTW : use load double instead of double (as the default T)
         ///
         ///   DEBUG_FFTWGRID             : Show some info while running
         ///
+        ///   NO_FFTW_PLAN_CACHE         : Make a new FFTW_ESTIMATE plan for every transform instead of reusing the
+        ///                                plans in FFTWPlanCache
+        ///
+        ///   NO_BATCHED_FFTW            : Always do the batched transforms (fftw_r2c_batched / fftw_c2r_batched) one
+        ///                                grid at a time, even if FFTWBatchBuffer is enabled
+        ///
+        ///   NO_MPI_SHARED_MEMORY       : Send the boundary slices to neighbours on the same node with MPI messages
+        ///                                instead of through a shared memory window (see communicate_boundaries)
+        ///
         ///   USE_FFTW_THREADS           : Use threads if possible. With this we assume the maximum number of threads
         ///                                If you want to use fewer then you can call create_wisdom(..., nthreads) to
         ///                                change this
@@ -84,15 +186,25 @@ namespace FML {
         ///
         //==========================================================================
 
-        template <int N>
+        template <int N, class T = FloatType>
         class FFTWGrid {
+          public:
+            /// The floating point type of the grid (and the corresponding complex type)
+            using FloatType = T;
+            using ComplexType = std::complex<T>;
+#ifdef USE_FFTW
+            using my_fftw_complex = typename FFTWTraits<T>::complex;
+            using my_fftw_plan = typename FFTWTraits<T>::plan;
+#endif
+
           private:
             // Index for local cells. Using long long int as standard
             using IndexIntType = FML::IndexIntType;
 
             // The raw data vectors. These have the format [extra slices left][main grid][extra slices right]
-            // Vector = std::vector<ComplexType> with possible custom allocator
-            Vector<ComplexType> fourier_grid_raw{};
+            // UninitializedVector = std::vector<ComplexType> with possible custom allocator that does not zero
+            // the memory on resize so that we can first-touch it in parallel (see parallel_fill)
+            UninitializedLargeVector<ComplexType> fourier_grid_raw{};
 
             // Mesh size and the dimension of the grid
             int Nmesh{0};
@@ -124,8 +236,23 @@ namespace FML {
             // If you want to keep track of the field is in real space or in Fourier space
             bool grid_is_in_real_space{true};
 
+            // If the Fourier grid is stored with the first two dimensions swapped (FFTW_MPI_TRANSPOSED_OUT)
+            bool fourier_layout_transposed{false};
+
             std::string name{""};
 
+            // Set all the allocated cells to val. The main grid is done slice by slice with the same OpenMP schedule
+            // as the loops over get_real_range / get_fourier_range so that each page is first-touched (and placed on
+            // the NUMA node of) the thread that later works on it
+            void parallel_fill(const ComplexType val);
+
+#ifdef USE_FFTW
+            // Make a plan for the r2c (forward) or c2r transform of this grid on the given arrays
+            my_fftw_plan make_plan(bool forward, unsigned int planner_flag, FloatType * real, my_fftw_complex * fourier);
+            // Fetch the plan for this grid from the plan cache (making it if needed)
+            my_fftw_plan get_cached_plan(bool forward);
+#endif
+
           public:
             FFTWGrid() = default;
 
@@ -143,6 +270,8 @@ namespace FML {
             // Copying and assignment from grids with the same dimension only is allowed
             FFTWGrid(const FFTWGrid & rhs) = default;
             FFTWGrid & operator=(const FFTWGrid & rhs) = default;
+            FFTWGrid(FFTWGrid && rhs) = default;
+            FFTWGrid & operator=(FFTWGrid && rhs) = default;
 
             // Pointers to various parts of the grid
             FloatType * get_real_grid_left(); /// The left most slice (slice ix = -nleft_extra,...,-2,-1)
@@ -152,6 +281,8 @@ namespace FML {
             FloatType *
             get_real_grid_by_slice(int slice); /// Get the ix'th slice (i.e. -nleft_extra <= ix < NLocal_x+nright_extra)
             ComplexType * get_fourier_grid();  /// The Fourier grid (aligns with the main real grid)
+            const FloatType * get_real_grid() const;
+            const ComplexType * get_fourier_grid() const;
 #ifdef USE_FFTW
             my_fftw_complex * get_fftw_grid(); /// The fftw_complex cast of get_fourier_gride
 #endif
@@ -256,9 +387,25 @@ namespace FML {
             /// Range iterator for going through all active cells in the main fourier grid by index
             /// [ e.g. for(auto and real_index: grid.real_range()) ]
             /// If you add the slice numbers we only loop over the given slice range
-            /// For the Fourier range islice denotes the ikx value
+            /// For the Fourier range islice denotes the ikx value (the iky value in the transposed layout)
             FourierRange get_fourier_range(int islice_begin = 0, int islice_end = 0) const;
 
+            /// Row based iteration for SIMD friendly kernels. A row is the contiguous run of cells
+            /// in the last dimension for fixed values of the other coordinates. The range gives the index of the first
+            /// cell in each row (in the given slice range) and the inner loop is over 0 <= iz < Nmesh:
+            /// [ e.g. for(auto && row_index : grid.get_real_row_range(islice, islice + 1))
+            ///            for(int iz = 0; iz < Nmesh; iz++) real_grid[row_index + iz] ... ]
+            RealRowRange get_real_row_range(int islice_begin = 0, int islice_end = 0) const;
+            /// Row based iteration over the fourier grid. Each row (FourierRow) has the index of the first cell and the
+            /// wave-vector of the first N-1 dimensions so the inner loop over 0 <= iz < Nmesh/2+1 is contiguous and
+            /// only needs the last component (from get_fourier_row_wavenumbers):
+            /// [ e.g. for(auto && row : grid.get_fourier_row_range(islice, islice + 1))
+            ///            for(int iz = 0; iz < row.n; iz++) kmag2 = row.kmag2 + kz[iz] * kz[iz] ... ]
+            /// Takes the transposed layout into account. Requires N >= 2
+            FourierRowRange<N> get_fourier_row_range(int islice_begin = 0, int islice_end = 0) const;
+            /// The wave-numbers in the last dimension 2 pi * iz for iz = 0, ..., Nmesh/2 (for use with the rows above)
+            std::vector<double> get_fourier_row_wavenumbers() const;
+
             /// The number of cells per slice that we alloc. Useful to jump from slice to slice
             ptrdiff_t get_ntot_real_slice_alloc() const;
 
@@ -267,10 +414,15 @@ namespace FML {
 
             /// Send slices to the neighboring CPUs which stores them in the left and right extra slice storage
             void communicate_boundaries();
+            /// Non-blocking version of communicate_boundaries. Call wait() on the handle before using the extra
+            /// slices (work on slices that does not need the neighbors can be done while we wait)
+            FFTWGridHaloExchange communicate_boundaries_async();
 
-            /// This creates FFTW wisdom (but overwrites the arrays so must be done before setting the arrays)
+            /// This creates FFTW wisdom and sets the planner flag used for all later transforms.
+            /// The plans are kept in the plan cache (FFTWPlanCache) and made on scratch arrays so the grid is not
+            /// touched
             void create_wisdow(int planner_flag, int numthreads = FML::NThreads);
-            /// Load FFTW wisdom
+            /// Load FFTW wisdom (and clears the plan cache so that new plans use it)
             void load_wisdow(std::string filename) const;
             /// Save FFTW wisdom
             void save_wisdow(std::string filename) const;
@@ -283,6 +435,12 @@ namespace FML {
             /// Set the status of the grid: is it currently a real grid or a fourier grid?
             void set_grid_status_real(bool grid_is_a_real_grid);
 
+            /// Store the Fourier grid in the transposed layout [ky][kx][kz...] (distributed over ky) which saves
+            /// one global transpose per FFT with MPI. Only has an effect with MPI and N >= 3
+            void set_fourier_layout_transposed(bool transposed);
+            /// Is the Fourier grid stored in the transposed layout?
+            bool get_fourier_layout_transposed() const;
+
             /// For memory logging: add a label to the grid
             void add_memory_label(std::string label);
 
@@ -291,6 +449,26 @@ namespace FML {
             /// Load grid from file
             void load_from_file(std::string fileprefix);
 
+            /// Save to one file shared by all tasks (MPI-IO). Only the active cells (no padding or extra slices)
+            /// are stored as one global array after a small header so it can be read back with any number of tasks
+            void dump_to_file_parallel(std::string filename);
+            /// Load grid from a file made by dump_to_file_parallel (the number of tasks can differ from when it was
+            /// saved)
+            void load_from_file_parallel(std::string filename);
+
+            /// Save a real grid (e.g. a density contrast) to file (adds .X to fileprefix where X is ThisTask) with
+            /// each value quantized to 8 or 16 bits using a linear scale (offset and step) per x-slice. With
+            /// log_density we store log(max(1 + value, density_floor)) instead of the value itself which keeps the
+            /// relative accuracy in underdense regions. If compiled with USE_ZSTD the quantized data is compressed
+            /// with zstd at compression_level (0 means no compression)
+            void dump_to_file_quantized(std::string fileprefix,
+                                        int bits = 16,
+                                        bool log_density = false,
+                                        double density_floor = 1e-4,
+                                        int compression_level = 3);
+            /// Load grid from files made by dump_to_file_quantized (with the same number of tasks)
+            void load_from_file_quantized(std::string fileprefix);
+
             void reallocate(int Nmesh, int nleft, int nright) { FFTWGrid(Nmesh, nleft, nright); }
 
 #ifdef USE_GSL
@@ -310,13 +488,13 @@ namespace FML {
 #endif
         };
 
-        template <int N>
-        FFTWGrid<N>::operator bool() const {
+        template <int N, class T>
+        FFTWGrid<N, T>::operator bool() const {
             return fourier_grid_raw.size() > 0;
         }
 
-        template <int N>
-        void FFTWGrid<N>::add_memory_label([[maybe_unused]] std::string label) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::add_memory_label([[maybe_unused]] std::string label) {
             name = label;
 #ifdef MEMORY_LOGGING
             FML::MemoryLog::get()->add_label(
@@ -325,12 +503,28 @@ namespace FML {
         }
 
         // Perform a real-to-complex FFT from one grid to another
-        template <int N>
-        void fftw_r2c(FFTWGrid<N> & in_grid, FFTWGrid<N> & out_grid);
+        template <int N, class T>
+        void fftw_r2c(FFTWGrid<N, T> & in_grid, FFTWGrid<N, T> & out_grid);
 
         // Perform a complex-to-real FFT from one grid to another
-        template <int N>
-        void fftw_c2r(FFTWGrid<N> & in_grid, FFTWGrid<N> & out_grid);
+        template <int N, class T>
+        void fftw_c2r(FFTWGrid<N, T> & in_grid, FFTWGrid<N, T> & out_grid);
+
+        // Perform real-to-complex FFTs of several grids with the same shape in one batched transform
+        template <int N, class T>
+        void fftw_r2c_batched(std::vector<FFTWGrid<N, T> *> grids);
+        template <int N, class T, size_t M>
+        void fftw_r2c_batched(std::array<FFTWGrid<N, T>, M> & grids);
+        template <int N, class T>
+        void fftw_r2c_batched(std::vector<FFTWGrid<N, T>> & grids);
+
+        // Perform complex-to-real FFTs of several grids with the same shape in one batched transform
+        template <int N, class T>
+        void fftw_c2r_batched(std::vector<FFTWGrid<N, T> *> grids);
+        template <int N, class T, size_t M>
+        void fftw_c2r_batched(std::array<FFTWGrid<N, T>, M> & grids);
+        template <int N, class T>
+        void fftw_c2r_batched(std::vector<FFTWGrid<N, T>> & grids);
 
         //===================================================================================
         // For range based loop over the real grid
@@ -397,8 +591,159 @@ namespace FML {
             LoopIteratorFourier end() const { return {to}; }
         };
 
+        //===================================================================================
+        // For row based loops over the real and fourier grids. The inner loop over the last
+        // dimension is then over contiguous memory with no index computations so the compiler can
+        // vectorize it
+        //===================================================================================
+
+        /// An iterator that deal with looping through the rows of a real grid (gives the index of the first cell in
+        /// the row)
+        class LoopIteratorRealRow {
+          private:
+            IndexIntType index;
+            IndexIntType row_stride;
+
+          public:
+            LoopIteratorRealRow(IndexIntType _index, IndexIntType _row_stride)
+                : index(_index), row_stride(_row_stride) {}
+            bool operator!=(LoopIteratorRealRow const & other) const { return index != other.index; }
+            IndexIntType const & operator*() const { return index; }
+            LoopIteratorRealRow & operator++() {
+                index += row_stride;
+                return *this;
+            }
+        };
+
+        /// For range based for-loops over the rows of the real-grid
+        class RealRowRange {
+          private:
+            const IndexIntType row_from, row_to;
+            const IndexIntType row_stride;
+
+          public:
+            RealRowRange(IndexIntType _row_from, IndexIntType _row_to, IndexIntType _row_stride)
+                : row_from(_row_from), row_to(_row_to), row_stride(_row_stride) {}
+            LoopIteratorRealRow begin() const { return {row_from * row_stride, row_stride}; }
+            LoopIteratorRealRow end() const { return {row_to * row_stride, row_stride}; }
+        };
+
+        /// A row in the fourier grid, i.e. the n = Nmesh/2+1 cells index, index+1, ..., index + n - 1
+        /// that only differ in the last coordinate. The wave-vector of the cell index + iz is kvec
+        /// with kvec[N-1] = 2 pi * iz
+        template <int N>
+        struct FourierRow {
+            IndexIntType index{0};        // Index of the first cell in the row
+            int n{0};                     // Number of cells in the row
+            std::array<int, N> kint{};    // Integer wave-vector of the row (kint[N-1] = 0)
+            std::array<double, N> kvec{}; // Wave-vector of the row (kvec[N-1] = 0)
+            double kmag2{0.0};            // Square magnitude of kvec above (i.e. without the last dimension)
+        };
+
+        /// An iterator that deal with looping through the rows of a fourier grid
+        template <int N>
+        class LoopIteratorFourierRow {
+          private:
+            IndexIntType irow;
+            int Nmesh;
+            IndexIntType Local_x_start;
+            bool transposed;
+            FourierRow<N> row;
+
+            void compute_row() {
+                const int nover2 = Nmesh / 2;
+                row.n = nover2 + 1;
+                row.index = irow * row.n;
+                std::array<int, N> coord;
+                coord[N - 1] = 0;
+                IndexIntType rest = irow;
+                for (int idim = N - 2; idim >= 1; idim--) {
+                    coord[idim] = int(rest % Nmesh);
+                    rest /= Nmesh;
+                }
+                coord[0] = int(rest + Local_x_start);
+                if constexpr (N >= 3)
+                    if (transposed)
+                        std::swap(coord[0], coord[1]);
+                row.kmag2 = 0.0;
+                for (int idim = 0; idim < N; idim++) {
+                    row.kint[idim] = coord[idim] <= nover2 ? coord[idim] : coord[idim] - Nmesh;
+                    row.kvec[idim] = 2.0 * M_PI * row.kint[idim];
+                    row.kmag2 += row.kvec[idim] * row.kvec[idim];
+                }
+            }
+
+          public:
+            LoopIteratorFourierRow(IndexIntType _irow, int _Nmesh, IndexIntType _Local_x_start, bool _transposed)
+                : irow(_irow), Nmesh(_Nmesh), Local_x_start(_Local_x_start), transposed(_transposed) {}
+            bool operator!=(LoopIteratorFourierRow const & other) const { return irow != other.irow; }
+            FourierRow<N> const & operator*() {
+                compute_row();
+                return row;
+            }
+            LoopIteratorFourierRow & operator++() {
+                ++irow;
+                return *this;
+            }
+        };
+
+        /// For range based for-loops over the rows of the fourier-grid
         template <int N>
-        RealRange FFTWGrid<N>::get_real_range(int islice_begin, int islice_end) const {
+        class FourierRowRange {
+          private:
+            const IndexIntType row_from, row_to;
+            const int Nmesh;
+            const IndexIntType Local_x_start;
+            const bool transposed;
+
+          public:
+            FourierRowRange(
+                IndexIntType _row_from, IndexIntType _row_to, int _Nmesh, IndexIntType _Local_x_start, bool _transposed)
+                : row_from(_row_from), row_to(_row_to), Nmesh(_Nmesh), Local_x_start(_Local_x_start),
+                  transposed(_transposed) {}
+            LoopIteratorFourierRow<N> begin() const { return {row_from, Nmesh, Local_x_start, transposed}; }
+            LoopIteratorFourierRow<N> end() const { return {row_to, Nmesh, Local_x_start, transposed}; }
+        };
+
+        template <int N, class T>
+        RealRowRange FFTWGrid<N, T>::get_real_row_range(int islice_begin, int islice_end) const {
+            if (islice_begin == 0 and islice_end == 0)
+                islice_end = int(Local_nx);
+            static_assert(N >= 2, "[FFTWGrid::get_real_row_range] Requires N >= 2");
+            IndexIntType rowsperslice = FML::power(Nmesh, N - 2);
+            return RealRowRange(rowsperslice * islice_begin, rowsperslice * islice_end, 2 * (Nmesh / 2 + 1));
+        }
+
+        template <int N, class T>
+        FourierRowRange<N> FFTWGrid<N, T>::get_fourier_row_range(int islice_begin, int islice_end) const {
+            if (islice_begin == 0 and islice_end == 0)
+                islice_end = int(Local_nx);
+            static_assert(N >= 2, "[FFTWGrid::get_fourier_row_range] Requires N >= 2");
+#ifdef DEBUG_FFTWGRID
+            if (grid_is_in_real_space) {
+                if (FML::ThisTask == 0)
+                    std::cout << "Warning: [FFTWGrid::get_fourier_row_range] The grid status is [Realspace]. Label: " +
+                                     name + "\n";
+            }
+#endif
+            IndexIntType rowsperslice = FML::power(Nmesh, N - 2);
+            return FourierRowRange<N>(rowsperslice * islice_begin,
+                                      rowsperslice * islice_end,
+                                      Nmesh,
+                                      IndexIntType(Local_x_start),
+                                      fourier_layout_transposed);
+        }
+
+        template <int N, class T>
+        std::vector<double> FFTWGrid<N, T>::get_fourier_row_wavenumbers() const {
+            std::vector<double> kz(Nmesh / 2 + 1);
+            for (int iz = 0; iz <= Nmesh / 2; iz++)
+                kz[iz] = 2.0 * M_PI * iz;
+            return kz;
+        }
+
+        template <int N, class T>
+        RealRange FFTWGrid<N, T>::get_real_range(int islice_begin, int islice_end) const {
 
             // If fiducial parameters are used then we loop over all cells
             if (islice_begin == 0 and islice_end == 0)
@@ -416,8 +761,8 @@ namespace FML {
             return RealRange(cellsperslice * islice_begin, cellsperslice * islice_end, Nmesh);
         }
 
-        template <int N>
-        FourierRange FFTWGrid<N>::get_fourier_range(int islice_begin, int islice_end) const {
+        template <int N, class T>
+        FourierRange FFTWGrid<N, T>::get_fourier_range(int islice_begin, int islice_end) const {
 
             // If fiducial parameters are used then we loop over all cells
             if (islice_begin == 0 and islice_end == 0)
@@ -436,18 +781,18 @@ namespace FML {
             // return FourierRange(0, NmeshTotComplex);
         }
 
-        template <int N>
-        FloatType * FFTWGrid<N>::get_real_grid_left() {
+        template <int N, class T>
+        T * FFTWGrid<N, T>::get_real_grid_left() {
             return reinterpret_cast<FloatType *>(fourier_grid_raw.data());
         }
 
-        template <int N>
-        FloatType * FFTWGrid<N>::get_real_grid() {
+        template <int N, class T>
+        T * FFTWGrid<N, T>::get_real_grid() {
             return get_real_grid_left() + NmeshTotRealSlice * n_extra_x_slices_left;
         }
 
-        template <int N>
-        FloatType * FFTWGrid<N>::get_real_grid_by_slice(int slice) {
+        template <int N, class T>
+        T * FFTWGrid<N, T>::get_real_grid_by_slice(int slice) {
 #ifdef BOUNDSCHECK_FFTWGRID
             assert_mpi(-n_extra_x_slices_left <= slice and slice < Local_nx + n_extra_x_slices_right,
                        "[FFTWGrid::get_real_grid] Bounds check failed\n");
@@ -455,28 +800,51 @@ namespace FML {
             return get_real_grid_left() + NmeshTotRealSlice * (n_extra_x_slices_left + slice);
         }
 
-        template <int N>
-        FloatType * FFTWGrid<N>::get_real_grid_right() {
+        template <int N, class T>
+        T * FFTWGrid<N, T>::get_real_grid_right() {
             return get_real_grid_left() + NmeshTotRealSlice * (n_extra_x_slices_left + Local_nx);
         }
 
-        template <int N>
-        ComplexType * FFTWGrid<N>::get_fourier_grid() {
+        template <int N, class T>
+        std::complex<T> * FFTWGrid<N, T>::get_fourier_grid() {
             return fourier_grid_raw.data() + NmeshTotComplexSlice * n_extra_x_slices_left;
         }
 
-        template <int N>
-        void FFTWGrid<N>::set_grid_status_real(bool grid_is_a_real_grid) {
+        template <int N, class T>
+        const T * FFTWGrid<N, T>::get_real_grid() const {
+            return reinterpret_cast<const FloatType *>(fourier_grid_raw.data()) +
+                   NmeshTotRealSlice * n_extra_x_slices_left;
+        }
+
+        template <int N, class T>
+        const std::complex<T> * FFTWGrid<N, T>::get_fourier_grid() const {
+            return fourier_grid_raw.data() + NmeshTotComplexSlice * n_extra_x_slices_left;
+        }
+
+        template <int N, class T>
+        void FFTWGrid<N, T>::set_grid_status_real(bool grid_is_a_real_grid) {
             grid_is_in_real_space = grid_is_a_real_grid;
         }
 
-        template <int N>
-        bool FFTWGrid<N>::get_grid_status_real() {
+        template <int N, class T>
+        void FFTWGrid<N, T>::set_fourier_layout_transposed([[maybe_unused]] bool transposed) {
+#if defined(USE_MPI) && defined(USE_FFTW)
+            fourier_layout_transposed = transposed and N >= 3;
+#endif
+        }
+
+        template <int N, class T>
+        bool FFTWGrid<N, T>::get_fourier_layout_transposed() const {
+            return fourier_layout_transposed;
+        }
+
+        template <int N, class T>
+        bool FFTWGrid<N, T>::get_grid_status_real() {
             return grid_is_in_real_space;
         }
 
-        template <int N>
-        void FFTWGrid<N>::info() {
+        template <int N, class T>
+        void FFTWGrid<N, T>::info() {
             if (FML::ThisTask > 0)
                 return;
             std::string myfloattype = "[Unknown]";
@@ -513,6 +881,8 @@ namespace FML {
                 std::cout << "# NmeshTotRealAlloc      " << NmeshTotRealAlloc << "\n";
                 std::cout << "# NmeshTotReal           " << NmeshTotReal << "\n";
                 std::cout << "# NmeshTotRealSlice      " << NmeshTotRealSlice << "\n";
+                std::cout << "# Fourier layout         " << (fourier_layout_transposed ? "[Transposed]" : "[Normal]")
+                          << "\n";
                 std::cout << "#\n";
                 std::cout << "#=====================================================\n";
                 std::cout << "\n";
@@ -520,11 +890,9 @@ namespace FML {
         }
 
         // Make FFTW plans with FFTW_MEASURE, FFTW_PATIENT, FFTW_EXHAUSTIVE
-        template <int N>
-        void FFTWGrid<N>::create_wisdow([[maybe_unused]] int planner_flag, [[maybe_unused]] int nthreads) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::create_wisdow([[maybe_unused]] int planner_flag, [[maybe_unused]] int nthreads) {
 #ifdef USE_FFTW
-            if (planner_flag == FFTW_ESTIMATE)
-                return;
 #ifdef USE_FFTW_THREADS
             set_fftw_nthreads(nthreads);
 #endif
@@ -534,24 +902,100 @@ namespace FML {
             }
 #endif
 
+#ifdef NO_FFTW_PLAN_CACHE
+            if (planner_flag == FFTW_ESTIMATE)
+                return;
+            my_fftw_plan plan_r2c = make_plan(true, planner_flag, get_real_grid(), get_fftw_grid());
+            if (FML::ThisTask == 0)
+                std::cout << "[FFTWGrid::create_wisdow] Warning this will clear data in the grid. Label: " + name +
+                                 "\n";
+            FFTWTraits<T>::destroy_plan(plan_r2c);
+#else
+            FFTWPlanCache::get().set_planner_flag(planner_flag);
+            get_cached_plan(true);
+            get_cached_plan(false);
+#endif
+#endif
+        }
+
+#ifdef USE_FFTW
+        template <int N, class T>
+        typename FFTWGrid<N, T>::my_fftw_plan FFTWGrid<N, T>::make_plan(bool forward,
+                                                                        unsigned int planner_flag,
+                                                                        FloatType * real,
+                                                                        my_fftw_complex * fourier) {
 #ifdef USE_MPI
             std::vector<ptrdiff_t> NmeshPerDim(N, Nmesh);
-            my_fftw_plan plan_r2c =
-                MAKE_PLAN_R2C(N, NmeshPerDim.data(), get_real_grid(), get_fftw_grid(), MPI_COMM_WORLD, planner_flag);
+            if (forward) {
+                const unsigned int transposed_flag = fourier_layout_transposed ? FFTW_MPI_TRANSPOSED_OUT : 0;
+                return FFTWTraits<T>::plan_r2c(
+                    N, NmeshPerDim.data(), real, fourier, MPI_COMM_WORLD, planner_flag | transposed_flag);
+            } else {
+                const unsigned int transposed_flag = fourier_layout_transposed ? FFTW_MPI_TRANSPOSED_IN : 0;
+                return FFTWTraits<T>::plan_c2r(
+                    N, NmeshPerDim.data(), fourier, real, MPI_COMM_WORLD, planner_flag | transposed_flag);
+            }
 #else
             std::vector<int> NmeshPerDim(N, Nmesh);
-            my_fftw_plan plan_r2c =
-                MAKE_PLAN_R2C(N, NmeshPerDim.data(), get_real_grid(), get_fftw_grid(), planner_flag);
+            if (forward)
+                return FFTWTraits<T>::plan_r2c(N, NmeshPerDim.data(), real, fourier, planner_flag);
+            else
+                return FFTWTraits<T>::plan_c2r(N, NmeshPerDim.data(), fourier, real, planner_flag);
 #endif
-            if (FML::ThisTask == 0)
-                std::cout << "[FFTWGrid::create_wisdow] Warning this will clear data in the grid. Label: " + name +
-                                 "\n";
-            DESTROY_PLAN(plan_r2c);
+        }
+
+        template <int N, class T>
+        typename FFTWGrid<N, T>::my_fftw_plan FFTWGrid<N, T>::get_cached_plan(bool forward) {
+            // The cache (and the planner) can be used from several threads
+            std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());
+            auto & cache = FFTWPlanCache::get();
+            FFTWPlanKey key;
+            key.float_size = sizeof(T);
+            key.ndim = N;
+            key.nmesh = Nmesh;
+            key.forward = forward;
+            key.transposed = fourier_layout_transposed;
+            key.nthreads = FML::FFTWNThreads;
+            key.alignment = FFTWTraits<T>::alignment_of(get_real_grid());
+            key.planner_flag = cache.get_planner_flag();
+
+            // Planning is collective with MPI so if one task is missing the plan we all make it
+            my_fftw_plan plan = cache.find<T>(key);
+            int missing = plan == nullptr ? 1 : 0;
+            FML::MaxOverTasks(&missing);
+            if (missing == 0)
+                return plan;
+
+            if (key.planner_flag == FFTW_ESTIMATE) {
+                // This does not touch the arrays so we can plan directly on the grid
+                plan = make_plan(forward, key.planner_flag, get_real_grid(), get_fftw_grid());
+            } else {
+                // The other planner flags overwrite the arrays so plan on scratch arrays with the same alignment
+                // (a plan can only be executed on arrays with the same alignment as the ones it was made for)
+                const int max_offset = 16;
+                Vector<ComplexType> scratch(NmeshTotComplex + max_offset);
+                FloatType * real = reinterpret_cast<FloatType *>(scratch.data());
+                int offset = 0;
+                while (offset < max_offset and FFTWTraits<T>::alignment_of(real + offset) != key.alignment)
+                    offset++;
+                assert_mpi(offset < max_offset,
+                           "[FFTWGrid::get_cached_plan] Could not make scratch array with the right alignment\n");
+                real += offset;
+                plan = make_plan(forward, key.planner_flag, real, reinterpret_cast<my_fftw_complex *>(real));
+            }
+            cache.add<T>(key, plan);
+
+#ifdef DEBUG_FFTWGRID
+            if (FML::ThisTask == 0) {
+                std::cout << "[FFTWGrid::get_cached_plan] Made new plan. Label: " + name + "\n";
+            }
 #endif
+            return plan;
         }
+#endif
 
-        template <int N>
-        void FFTWGrid<N>::load_wisdow(std::string filename) const {
+        template <int N, class T>
+        void FFTWGrid<N, T>::load_wisdow(std::string filename) const {
 #ifdef USE_FFTW
 #ifdef DEBUG_FFTWGRID
             if (FML::ThisTask == 0) {
@@ -559,19 +1003,20 @@ namespace FML {
             }
 #endif
             if (FML::ThisTask == 0)
-                fftw_import_wisdom_from_filename(filename.c_str());
+                FFTWTraits<T>::import_wisdom_from_filename(filename.c_str());
 #ifdef USE_MPI
-            fftw_mpi_broadcast_wisdom(MPI_COMM_WORLD);
+            FFTWTraits<T>::broadcast_wisdom();
 #endif
+            FFTWPlanCache::get().clear();
         }
 
-        template <int N>
-        void FFTWGrid<N>::save_wisdow(std::string filename) const {
+        template <int N, class T>
+        void FFTWGrid<N, T>::save_wisdow(std::string filename) const {
 #ifdef USE_MPI
-            fftw_mpi_gather_wisdom(MPI_COMM_WORLD);
+            FFTWTraits<T>::gather_wisdom();
 #endif
             if (FML::ThisTask == 0)
-                fftw_export_wisdom_to_filename(filename.c_str());
+                FFTWTraits<T>::export_wisdom_to_filename(filename.c_str());
 #ifdef DEBUG_FFTWGRID
             if (FML::ThisTask == 0) {
                 std::cout << "[FFTWGrid::save_wisdow] Filename " << filename << ". Label: " + name + "\n";
@@ -580,13 +1025,13 @@ namespace FML {
 #endif
         }
 
-        template <int N>
-        ptrdiff_t FFTWGrid<N>::get_ntot_real_slice_alloc() const {
+        template <int N, class T>
+        ptrdiff_t FFTWGrid<N, T>::get_ntot_real_slice_alloc() const {
             return NmeshTotRealSlice;
         }
 
-        template <int N>
-        void FFTWGrid<N>::fill_real_grid(const FloatType val) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::fill_real_grid(const FloatType val) {
 #ifdef DEBUG_FFTWGRID
             if (not grid_is_in_real_space) {
                 if (FML::ThisTask == 0)
@@ -594,13 +1039,11 @@ namespace FML {
                                      name + "\n";
             }
 #endif
-            FloatType * begin = (FloatType *)fourier_grid_raw.data();
-            FloatType * end = begin + NmeshTotRealAlloc;
-            std::fill(begin, end, val);
+            parallel_fill(ComplexType(val, val));
         }
 
-        template <int N>
-        void FFTWGrid<N>::fill_real_grid(std::function<FloatType(std::array<double, N> &)> & func) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::fill_real_grid(std::function<FloatType(std::array<double, N> &)> & func) {
 #ifdef DEBUG_FFTWGRID
             if (not grid_is_in_real_space) {
                 if (FML::ThisTask == 0)
@@ -624,8 +1067,8 @@ namespace FML {
             communicate_boundaries();
         }
 
-        template <int N>
-        void FFTWGrid<N>::fill_fourier_grid(const ComplexType val) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::fill_fourier_grid(const ComplexType val) {
 #ifdef DEBUG_FFTWGRID
             if (grid_is_in_real_space) {
                 if (FML::ThisTask == 0)
@@ -633,11 +1076,34 @@ namespace FML {
                                      "\n";
             }
 #endif
-            std::fill(fourier_grid_raw.begin(), fourier_grid_raw.end(), val);
+            parallel_fill(val);
         }
 
-        template <int N>
-        void FFTWGrid<N>::fill_fourier_grid(std::function<ComplexType(std::array<double, N> &)> & func) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::parallel_fill(const ComplexType val) {
+            ComplexType * grid = fourier_grid_raw.data();
+            const ptrdiff_t nleft = NmeshTotComplexSlice * n_extra_x_slices_left;
+            const ptrdiff_t nmain = NmeshTotComplexSlice * Local_nx;
+            const ptrdiff_t ntot = ptrdiff_t(fourier_grid_raw.size());
+            if (ntot == 0)
+                return;
+
+            // The extra slices are small so we do them serially
+            std::fill(grid, grid + nleft, val);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                ComplexType * begin = grid + nleft + NmeshTotComplexSlice * islice;
+                std::fill(begin, begin + NmeshTotComplexSlice, val);
+            }
+            // The extra slices on the right (and any extra memory FFTW asked for)
+            if (nleft + nmain < ntot)
+                std::fill(grid + nleft + nmain, grid + ntot, val);
+        }
+
+        template <int N, class T>
+        void FFTWGrid<N, T>::fill_fourier_grid(std::function<ComplexType(std::array<double, N> &)> & func) {
 #ifdef DEBUG_FFTWGRID
             if (grid_is_in_real_space) {
                 if (FML::ThisTask == 0)
@@ -659,8 +1125,13 @@ namespace FML {
         }
 
         // We copy over slices
-        template <int N>
-        void FFTWGrid<N>::communicate_boundaries() {
+        template <int N, class T>
+        void FFTWGrid<N, T>::communicate_boundaries() {
+            communicate_boundaries_async().wait();
+        }
+
+        template <int N, class T>
+        FFTWGridHaloExchange FFTWGrid<N, T>::communicate_boundaries_async() {
             int n_to_recv_right = n_extra_x_slices_right;
             int n_to_recv_left = n_extra_x_slices_left;
             if (n_to_recv_right > Local_nx)
@@ -675,31 +1146,60 @@ namespace FML {
             }
 #endif
 
+            FFTWGridHaloExchange handle;
 #ifdef USE_MPI
             int rightcpu = (FML::ThisTask + 1) % FML::NTasks;
             int leftcpu = (FML::ThisTask - 1 + FML::NTasks) % FML::NTasks;
 #endif
             int bytes_slice = int(NmeshTotRealSlice * sizeof(FloatType));
 
+            // Neighbours on the same node exchange the slices through a shared memory window: we put the slices
+            // they need in our part of it and they copy them directly from there. Only the neighbours on other
+            // nodes get MPI messages below
+            [[maybe_unused]] bool right_on_node = false;
+            [[maybe_unused]] bool left_on_node = false;
+#if defined(USE_MPI) && !defined(NO_MPI_SHARED_MEMORY)
+            right_on_node = FML::NodeRankOfTask[rightcpu] >= 0;
+            left_on_node = FML::NodeRankOfTask[leftcpu] >= 0;
+            {
+                static FML::SharedMemoryWindow window;
+                const size_t bytes_to_left = size_t(n_to_recv_right) * bytes_slice;
+                window.ensure_capacity(bytes_to_left + size_t(n_to_recv_left) * bytes_slice);
+                char * mine = window.local();
+                if (left_on_node)
+                    std::memcpy(mine, get_real_grid(), bytes_to_left);
+                for (int i = 0; i < n_to_recv_left and right_on_node; i++)
+                    std::memcpy(mine + bytes_to_left + size_t(i) * bytes_slice,
+                                get_real_grid() + NmeshTotRealSlice * (Local_nx - 1 - i),
+                                bytes_slice);
+                window.sync();
+                if (right_on_node)
+                    std::memcpy(get_real_grid_right(), window.of_task(rightcpu), bytes_to_left);
+                for (int i = 0; i < n_to_recv_left and left_on_node; i++)
+                    std::memcpy(get_real_grid_left() + NmeshTotRealSlice * (n_extra_x_slices_left - 1 - i),
+                                window.of_task(leftcpu) + bytes_to_left + size_t(i) * bytes_slice,
+                                bytes_slice);
+                // Wait for the neighbours to be done reading before our part can be changed again
+                window.sync();
+            }
+#endif
+
+            // Different tags for the two directions as left and right is the same task if NTasks = 2
             for (int i = 0; i < n_to_recv_right; i++) {
                 FloatType * slice_left_tosend = get_real_grid() + NmeshTotRealSlice * (i);
                 FloatType * slice_right_torecv = get_real_grid_right() + NmeshTotRealSlice * (i);
                 char * sendbuf = reinterpret_cast<char *>(slice_left_tosend);
                 char * recvbuf = reinterpret_cast<char *>(slice_right_torecv);
 #ifdef USE_MPI
-                MPI_Status status;
-                MPI_Sendrecv(sendbuf,
-                             bytes_slice,
-                             MPI_CHAR,
-                             leftcpu,
-                             0,
-                             recvbuf,
-                             bytes_slice,
-                             MPI_CHAR,
-                             rightcpu,
-                             0,
-                             MPI_COMM_WORLD,
-                             &status);
+                MPI_Request request;
+                if (not right_on_node) {
+                    MPI_Irecv(recvbuf, bytes_slice, MPI_CHAR, rightcpu, 0, MPI_COMM_WORLD, &request);
+                    handle.add_request(request);
+                }
+                if (not left_on_node) {
+                    MPI_Isend(sendbuf, bytes_slice, MPI_CHAR, leftcpu, 0, MPI_COMM_WORLD, &request);
+                    handle.add_request(request);
+                }
 #else
                 std::memcpy(recvbuf, sendbuf, bytes_slice);
 #endif
@@ -711,29 +1211,26 @@ namespace FML {
                     get_real_grid_left() + NmeshTotRealSlice * (n_extra_x_slices_left - 1 - i);
                 char * sendbuf = reinterpret_cast<char *>(slice_right_tosend);
                 char * recvbuf = reinterpret_cast<char *>(slice_left_torecv);
-
 #ifdef USE_MPI
-                MPI_Status status;
-                MPI_Sendrecv(sendbuf,
-                             bytes_slice,
-                             MPI_CHAR,
-                             rightcpu,
-                             0,
-                             recvbuf,
-                             bytes_slice,
-                             MPI_CHAR,
-                             leftcpu,
-                             0,
-                             MPI_COMM_WORLD,
-                             &status);
+                MPI_Request request;
+                if (not left_on_node) {
+                    MPI_Irecv(recvbuf, bytes_slice, MPI_CHAR, leftcpu, 1, MPI_COMM_WORLD, &request);
+                    handle.add_request(request);
+                }
+                if (not right_on_node) {
+                    MPI_Isend(sendbuf, bytes_slice, MPI_CHAR, rightcpu, 1, MPI_COMM_WORLD, &request);
+                    handle.add_request(request);
+                }
 #else
                 std::memcpy(recvbuf, sendbuf, bytes_slice);
 #endif
             }
+
+            return handle;
         }
 
-        template <int N>
-        FFTWGrid<N>::FFTWGrid(int Nmesh, int n_extra_x_slices_left, int n_extra_x_slices_right)
+        template <int N, class T>
+        FFTWGrid<N, T>::FFTWGrid(int Nmesh, int n_extra_x_slices_left, int n_extra_x_slices_right)
             : Nmesh(Nmesh), Local_nx(Nmesh), n_extra_x_slices_left(n_extra_x_slices_left),
               n_extra_x_slices_right(n_extra_x_slices_right) {
 
@@ -751,7 +1248,7 @@ namespace FML {
 #ifdef USE_MPI
 #ifdef USE_FFTW
             NmeshTotComplex =
-                MPI_FFTW_LOCAL_SIZE(N, NmeshPerDimFourier.data(), MPI_COMM_WORLD, &Local_nx, &Local_x_start);
+                FFTWTraits<T>::local_size(N, NmeshPerDimFourier.data(), MPI_COMM_WORLD, &Local_nx, &Local_x_start);
 #else
             // If we don't have FFTW, but want to use this class
             Local_nx = Nmesh / FML::NTasks;
@@ -775,10 +1272,10 @@ namespace FML {
                 NmeshTotComplex + NmeshTotComplexSlice * (n_extra_x_slices_left + n_extra_x_slices_right);
             NmeshTotRealAlloc = 2 * NmeshTotComplexAlloc;
 
-            // Allocate memory and initialize to 0
+            // Allocate memory and initialize to 0 (this is the first touch of the memory)
             fourier_grid_raw.resize(NmeshTotComplexAlloc);
             add_memory_label("FFTWGrid");
-            std::fill(fourier_grid_raw.begin(), fourier_grid_raw.end(), 0.0);
+            parallel_fill(0.0);
 
             // Check alignment (relevant for SIMD instructions) since we don't use fftw_malloc
             // If you have SIMD and the alignment is off then changing to an allignment allocator
@@ -797,8 +1294,8 @@ namespace FML {
 #endif
         }
 
-        template <int N>
-        std::array<int, N> FFTWGrid<N>::get_coord_from_index(const IndexIntType index_real) const {
+        template <int N, class T>
+        std::array<int, N> FFTWGrid<N, T>::get_coord_from_index(const IndexIntType index_real) const {
 #ifdef BOUNDSCHECK_FFTWGRID
             assert_mpi(index_real >= -NmeshTotRealSlice * n_extra_x_slices_left and
                            index_real < NmeshTotRealSlice * (Local_nx + n_extra_x_slices_right),
@@ -825,8 +1322,8 @@ namespace FML {
             return coord;
         }
 
-        template <int N>
-        IndexIntType FFTWGrid<N>::get_index_real(const std::array<int, N> & coord) const {
+        template <int N, class T>
+        IndexIntType FFTWGrid<N, T>::get_index_real(const std::array<int, N> & coord) const {
 #ifdef BOUNDSCHECK_FFTWGRID
             assert_mpi(coord.size() == N, "[FFTWGrid::get_index_real] Coord has wrong size\n");
             assert_mpi(-n_extra_x_slices_left <= coord[0] and coord[0] < Local_nx + n_extra_x_slices_right,
@@ -853,8 +1350,8 @@ namespace FML {
             return 0;
         }
 
-        template <int N>
-        IndexIntType FFTWGrid<N>::get_index_fourier(const std::array<int, N> & coord) const {
+        template <int N, class T>
+        IndexIntType FFTWGrid<N, T>::get_index_fourier(const std::array<int, N> & coord) const {
 
 #ifdef BOUNDSCHECK_FFTWGRID
             assert_mpi(0 <= coord[0] and coord[0] < Local_nx, "[FFTWGrid::get_index_fourier] Bounds check failed\n");
@@ -864,6 +1361,18 @@ namespace FML {
             }
 #endif
 
+            if constexpr (N >= 3) {
+                if (fourier_layout_transposed) {
+                    std::array<int, N> coord_transposed = coord;
+                    std::swap(coord_transposed[0], coord_transposed[1]);
+                    IndexIntType index = coord_transposed[0];
+                    for (int idim = 1; idim < N - 1; idim++) {
+                        index = index * Nmesh + coord_transposed[idim];
+                    }
+                    return index * (Nmesh / 2 + 1) + coord_transposed[N - 1];
+                }
+            }
+
             if constexpr (N == 2) {
                 return coord[0] * (Nmesh / 2 + 1) + coord[1];
             } else if (N == 3) {
@@ -878,9 +1387,10 @@ namespace FML {
             }
         }
 
-        template <int N>
-        void FFTWGrid<N>::fftw_r2c() {
+        template <int N, class T>
+        void FFTWGrid<N, T>::fftw_r2c() {
 #ifdef USE_FFTW
+            FML_TIMER_REGION("FFTWGrid::fftw_r2c");
 
 #ifdef DEBUG_FFTWGRID
             if (FML::ThisTask == 0) {
@@ -905,21 +1415,18 @@ namespace FML {
                     right_copy[i] = real_grid_right[i];
             }
 
-#ifdef USE_MPI
-            std::vector<ptrdiff_t> NmeshPerDim(N, Nmesh);
-            my_fftw_plan plan_r2c =
-                MAKE_PLAN_R2C(N, NmeshPerDim.data(), get_real_grid(), get_fftw_grid(), MPI_COMM_WORLD, FFTW_ESTIMATE);
+#ifdef NO_FFTW_PLAN_CACHE
+            my_fftw_plan plan_r2c = make_plan(true, FFTW_ESTIMATE, get_real_grid(), get_fftw_grid());
+            FFTWTraits<T>::execute(plan_r2c);
+            FFTWTraits<T>::destroy_plan(plan_r2c);
 #else
-            std::vector<int> NmeshPerDim(N, Nmesh);
-            my_fftw_plan plan_r2c =
-                MAKE_PLAN_R2C(N, NmeshPerDim.data(), get_real_grid(), get_fftw_grid(), FFTW_ESTIMATE);
+            my_fftw_plan plan_r2c = get_cached_plan(true);
+            FFTWTraits<T>::execute_r2c(plan_r2c, get_real_grid(), get_fftw_grid());
 #endif
-
-            EXECUTE_FFT(plan_r2c);
             grid_is_in_real_space = false;
 
             // Normalize
-            const FML::GRID::FloatType norm = 1.0 / std::pow(double(Nmesh), N);
+            const FloatType norm = 1.0 / std::pow(double(Nmesh), N);
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
@@ -936,16 +1443,15 @@ namespace FML {
                 for (int i = 0; i < Nmesh / 2 + 1; i++)
                     real_grid_right[i] = right_copy[i];
             }
-
-            DESTROY_PLAN(plan_r2c);
 #else
             assert_mpi(false, "[FFTWGrid::fftw_r2c] Compiled without FFTW support so cannot take Fourier transforms\n");
 #endif
         }
 
-        template <int N>
-        void FFTWGrid<N>::fftw_c2r() {
+        template <int N, class T>
+        void FFTWGrid<N, T>::fftw_c2r() {
 #ifdef USE_FFTW
+            FML_TIMER_REGION("FFTWGrid::fftw_c2r");
 
 #ifdef DEBUG_FFTWGRID
             if (FML::ThisTask == 0) {
@@ -970,17 +1476,14 @@ namespace FML {
                     right_copy[i] = real_grid_right[i];
             }
 
-#ifdef USE_MPI
-            std::vector<ptrdiff_t> NmeshPerDim(N, Nmesh);
-            my_fftw_plan plan_c2r =
-                MAKE_PLAN_C2R(N, NmeshPerDim.data(), get_fftw_grid(), get_real_grid(), MPI_COMM_WORLD, FFTW_ESTIMATE);
+#ifdef NO_FFTW_PLAN_CACHE
+            my_fftw_plan plan_c2r = make_plan(false, FFTW_ESTIMATE, get_real_grid(), get_fftw_grid());
+            FFTWTraits<T>::execute(plan_c2r);
+            FFTWTraits<T>::destroy_plan(plan_c2r);
 #else
-            std::vector<int> NmeshPerDim(N, Nmesh);
-            my_fftw_plan plan_c2r =
-                MAKE_PLAN_C2R(N, NmeshPerDim.data(), get_fftw_grid(), get_real_grid(), FFTW_ESTIMATE);
+            my_fftw_plan plan_c2r = get_cached_plan(false);
+            FFTWTraits<T>::execute_c2r(plan_c2r, get_fftw_grid(), get_real_grid());
 #endif
-
-            EXECUTE_FFT(plan_c2r);
             grid_is_in_real_space = true;
 
             //=================================================================================
@@ -990,104 +1493,102 @@ namespace FML {
                 for (int i = 0; i < Nmesh / 2 + 1; i++)
                     real_grid_right[i] = right_copy[i];
             }
-
-            DESTROY_PLAN(plan_c2r);
 #else
             assert_mpi(false, "[FFTWGrid::fftw_c2r] Compiled without FFTW support so cannot take Fourier transforms\n");
 #endif
         }
 
-        template <int N>
-        FloatType FFTWGrid<N>::get_real(const std::array<int, N> & coord) const {
+        template <int N, class T>
+        T FFTWGrid<N, T>::get_real(const std::array<int, N> & coord) const {
             IndexIntType index = get_index_real(coord);
             const FloatType * grid = reinterpret_cast<const FloatType *>(fourier_grid_raw.data()) +
                                      NmeshTotRealSlice * n_extra_x_slices_left;
             return grid[index];
         }
 
-        template <int N>
-        void FFTWGrid<N>::set_real(const std::array<int, N> & coord, const FloatType value) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::set_real(const std::array<int, N> & coord, const FloatType value) {
             IndexIntType index = get_index_real(coord);
             get_real_grid()[index] = value;
         }
 
-        template <int N>
-        void FFTWGrid<N>::add_real(const std::array<int, N> & coord, const FloatType value) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::add_real(const std::array<int, N> & coord, const FloatType value) {
             IndexIntType index = get_index_real(coord);
             get_real_grid()[index] += value;
         }
 
-        template <int N>
-        void FFTWGrid<N>::set_real_from_index(const IndexIntType index, const FloatType value) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::set_real_from_index(const IndexIntType index, const FloatType value) {
             get_real_grid()[index] = value;
         }
 
-        template <int N>
-        ComplexType FFTWGrid<N>::get_fourier(const std::array<int, N> & coord) const {
+        template <int N, class T>
+        std::complex<T> FFTWGrid<N, T>::get_fourier(const std::array<int, N> & coord) const {
             IndexIntType index = get_index_fourier(coord);
             return fourier_grid_raw[NmeshTotComplexSlice * n_extra_x_slices_left + index];
         }
 
-        template <int N>
-        ComplexType FFTWGrid<N>::get_fourier_from_index(const IndexIntType index) const {
+        template <int N, class T>
+        std::complex<T> FFTWGrid<N, T>::get_fourier_from_index(const IndexIntType index) const {
             return fourier_grid_raw[NmeshTotComplexSlice * n_extra_x_slices_left + index];
         }
 
-        template <int N>
-        void FFTWGrid<N>::set_fourier_from_index(const IndexIntType index, const ComplexType value) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::set_fourier_from_index(const IndexIntType index, const ComplexType value) {
             get_fourier_grid()[index] = value;
         }
 
-        template <int N>
-        void FFTWGrid<N>::set_fourier(const std::array<int, N> & coord, const ComplexType value) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::set_fourier(const std::array<int, N> & coord, const ComplexType value) {
             IndexIntType index = get_index_fourier(coord);
             get_fourier_grid()[index] = value;
         }
 
 #ifdef USE_FFTW
-        template <int N>
-        my_fftw_complex * FFTWGrid<N>::get_fftw_grid() {
+        template <int N, class T>
+        typename FFTWGrid<N, T>::my_fftw_complex * FFTWGrid<N, T>::get_fftw_grid() {
             return reinterpret_cast<my_fftw_complex *>(get_fourier_grid());
         }
 #endif
 
-        template <int N>
-        int FFTWGrid<N>::get_nmesh() const {
+        template <int N, class T>
+        int FFTWGrid<N, T>::get_nmesh() const {
             return Nmesh;
         }
 
-        template <int N>
-        int FFTWGrid<N>::get_ndim() const {
+        template <int N, class T>
+        int FFTWGrid<N, T>::get_ndim() const {
             return N;
         }
 
-        template <int N>
-        ptrdiff_t FFTWGrid<N>::get_ntot_real() const {
+        template <int N, class T>
+        ptrdiff_t FFTWGrid<N, T>::get_ntot_real() const {
             return NmeshTotRealSlice * Local_nx;
         }
 
-        template <int N>
-        ptrdiff_t FFTWGrid<N>::get_ntot_fourier() const {
+        template <int N, class T>
+        ptrdiff_t FFTWGrid<N, T>::get_ntot_fourier() const {
             return NmeshTotComplexSlice * Local_nx;
         }
 
-        template <int N>
-        ptrdiff_t FFTWGrid<N>::get_ntot_fourier_alloc() const {
+        template <int N, class T>
+        ptrdiff_t FFTWGrid<N, T>::get_ntot_fourier_alloc() const {
             return NmeshTotComplexAlloc;
         }
 
-        template <int N>
-        ptrdiff_t FFTWGrid<N>::get_local_nx() const {
+        template <int N, class T>
+        ptrdiff_t FFTWGrid<N, T>::get_local_nx() const {
             return Local_nx;
         }
 
-        template <int N>
-        ptrdiff_t FFTWGrid<N>::get_local_x_start() const {
+        template <int N, class T>
+        ptrdiff_t FFTWGrid<N, T>::get_local_x_start() const {
             return Local_x_start;
         }
 
-        template <int N>
-        std::array<double, N> FFTWGrid<N>::get_real_position(const std::array<int, N> & coord) const {
+        template <int N, class T>
+        std::array<double, N> FFTWGrid<N, T>::get_real_position(const std::array<int, N> & coord) const {
             std::array<double, N> xcoord;
 #ifdef CELLCENTERSHIFTED
             const constexpr double shift = 0.5;
@@ -1100,29 +1601,32 @@ namespace FML {
             return xcoord;
         }
 
-        template <int N>
-        void FFTWGrid<N>::get_fourier_wavevector_and_norm_by_index(const IndexIntType index,
-                                                                   std::array<double, N> & kvec,
-                                                                   double & kmag) const {
+        template <int N, class T>
+        void FFTWGrid<N, T>::get_fourier_wavevector_and_norm_by_index(const IndexIntType index,
+                                                                      std::array<double, N> & kvec,
+                                                                      double & kmag) const {
             get_fourier_wavevector_and_norm2_by_index(index, kvec, kmag);
             kmag = std::sqrt(kmag);
         }
 
-        template <int N>
-        std::array<int, N> FFTWGrid<N>::get_fourier_coord_from_index(const IndexIntType index) const {
+        template <int N, class T>
+        std::array<int, N> FFTWGrid<N, T>::get_fourier_coord_from_index(const IndexIntType index) const {
             const int nover2plus1 = Nmesh / 2 + 1;
             std::array<int, N> coord;
             coord[N - 1] = index % nover2plus1;
             for (int idim = N - 2, n = nover2plus1; idim >= 0; idim--, n *= Nmesh) {
                 coord[idim] = (index / n) % Nmesh;
             }
+            if constexpr (N >= 3)
+                if (fourier_layout_transposed)
+                    std::swap(coord[0], coord[1]);
             return coord;
         }
 
-        template <int N>
-        void FFTWGrid<N>::get_fourier_wavevector_and_norm2_by_index(const IndexIntType index,
-                                                                    std::array<double, N> & kvec,
-                                                                    double & kmag2) const {
+        template <int N, class T>
+        void FFTWGrid<N, T>::get_fourier_wavevector_and_norm2_by_index(const IndexIntType index,
+                                                                       std::array<double, N> & kvec,
+                                                                       double & kmag2) const {
             const double twopi = 2.0 * M_PI;
             const int nover2plus1 = Nmesh / 2 + 1;
             [[maybe_unused]] const int nover2 = Nmesh / 2;
@@ -1164,21 +1668,28 @@ namespace FML {
                     kmag2 += kvec[idim] * kvec[idim];
                 }
             }
+
+            // In the transposed layout the first two dimensions in the index are (ky,kx)
+            if constexpr (N >= 3)
+                if (fourier_layout_transposed)
+                    std::swap(kvec[0], kvec[1]);
         }
 
-        template <int N>
-        std::array<double, N> FFTWGrid<N>::get_fourier_wavevector(const std::array<int, N> & coord) const {
+        template <int N, class T>
+        std::array<double, N> FFTWGrid<N, T>::get_fourier_wavevector(const std::array<int, N> & coord) const {
             const double twopi = 2.0 * M_PI;
+            // The local dimension is x, or y in the transposed layout
+            const int idim_local = fourier_layout_transposed ? 1 : 0;
             std::array<double, N> fcoord;
-            fcoord[0] = coord[0] + Local_x_start;
-            fcoord[0] = twopi * (fcoord[0] <= Nmesh / 2 ? fcoord[0] : fcoord[0] - Nmesh);
-            for (int idim = 1; idim < N; idim++)
-                fcoord[idim] = twopi * (coord[idim] <= Nmesh / 2 ? coord[idim] : coord[idim] - Nmesh);
+            for (int idim = 0; idim < N; idim++) {
+                fcoord[idim] = coord[idim] + (idim == idim_local ? Local_x_start : 0);
+                fcoord[idim] = twopi * (fcoord[idim] <= Nmesh / 2 ? fcoord[idim] : fcoord[idim] - Nmesh);
+            }
             return fcoord;
         }
 
-        template <int N>
-        std::array<double, N> FFTWGrid<N>::get_fourier_wavevector_from_index(const IndexIntType index) const {
+        template <int N, class T>
+        std::array<double, N> FFTWGrid<N, T>::get_fourier_wavevector_from_index(const IndexIntType index) const {
             const double twopi = 2.0 * M_PI;
             const int nover2plus1 = Nmesh / 2 + 1;
             const int nover2 = Nmesh / 2;
@@ -1210,11 +1721,14 @@ namespace FML {
                     fcoord[idim] = twopi * double(fcoord[idim] <= nover2 ? fcoord[idim] : fcoord[idim] - Nmesh);
                 }
             }
+            if constexpr (N >= 3)
+                if (fourier_layout_transposed)
+                    std::swap(fcoord[0], fcoord[1]);
             return fcoord;
         }
         
-        template <int N>
-        std::array<int, N> FFTWGrid<N>::get_fourier_integer_wavevector_from_index(const IndexIntType index) const {
+        template <int N, class T>
+        std::array<int, N> FFTWGrid<N, T>::get_fourier_integer_wavevector_from_index(const IndexIntType index) const {
             const int nover2plus1 = Nmesh / 2 + 1;
             const int nover2 = Nmesh / 2;
             std::array<int, N> fcoord;
@@ -1245,11 +1759,14 @@ namespace FML {
                     fcoord[idim] = (fcoord[idim] <= nover2 ? fcoord[idim] : fcoord[idim] - Nmesh);
                 }
             }
+            if constexpr (N >= 3)
+                if (fourier_layout_transposed)
+                    std::swap(fcoord[0], fcoord[1]);
             return fcoord;
         }
 
-        template <int N>
-        void fftw_c2r(FFTWGrid<N> & in_grid, FFTWGrid<N> & out_grid) {
+        template <int N, class T>
+        void fftw_c2r(FFTWGrid<N, T> & in_grid, FFTWGrid<N, T> & out_grid) {
 #ifdef DEBUG_FFTWGRID
             if (FML::ThisTask == 0) {
                 std::cout << "[fftw_c2r] Transforming grid to real space\n";
@@ -1259,8 +1776,8 @@ namespace FML {
             out_grid.fftw_c2r();
         }
 
-        template <int N>
-        void fftw_r2c(FFTWGrid<N> & in_grid, FFTWGrid<N> & out_grid) {
+        template <int N, class T>
+        void fftw_r2c(FFTWGrid<N, T> & in_grid, FFTWGrid<N, T> & out_grid) {
 #ifdef DEBUG_FFTWGRID
             if (FML::ThisTask == 0) {
                 std::cout << "[fftw_r2c] Transforming grid to real space\n";
@@ -1270,31 +1787,344 @@ namespace FML {
             out_grid.fftw_r2c();
         }
 
-        template <int N>
-        void FFTWGrid<N>::free() {
+        //===================================================================================
+        ///
+        /// The interleaved buffer used by the batched transforms (fftw_r2c_batched / fftw_c2r_batched).
+        /// Batching is opt-in: the buffer is as big as all the grids in the batch together, so with it off
+        /// (the default) the batched transforms just transform the grids one at a time and use no extra memory.
+        /// With it on the buffer is kept between calls (it only grows) so we don't allocate and first-touch it
+        /// for every transform. Turning it off (or calling free) releases the buffer.
+        ///
+        /// Example use:
+        ///
+        ///   FFTWBatchBuffer<FloatType>::get().set_enabled(true);
+        ///   fftw_c2r_batched(grids);
+        ///   FFTWBatchBuffer<FloatType>::get().set_enabled(false);
+        ///
+        //===================================================================================
+        template <class T>
+        class FFTWBatchBuffer {
+          public:
+            static FFTWBatchBuffer & get() {
+                static FFTWBatchBuffer instance;
+                return instance;
+            }
+
+            /// Turn batching on or off. Turning it off frees the buffer
+            void set_enabled(bool enable) {
+                enabled = enable;
+                if (not enabled)
+                    free();
+            }
+            bool is_enabled() const { return enabled; }
+
+            /// Get a buffer with room for (at least) n complex numbers
+            std::complex<T> * get_buffer(ptrdiff_t n) {
+                if (ptrdiff_t(buffer.size()) < n) {
+                    buffer.clear();
+                    buffer.shrink_to_fit();
+                    buffer.resize(n);
+                }
+                return buffer.data();
+            }
+
+            /// Free the buffer
+            void free() {
+                buffer.clear();
+                buffer.shrink_to_fit();
+            }
+
+          private:
+            FFTWBatchBuffer() = default;
+            FFTWBatchBuffer(const FFTWBatchBuffer &) = delete;
+            FFTWBatchBuffer & operator=(const FFTWBatchBuffer &) = delete;
+
+            bool enabled{false};
+            Vector<std::complex<T>> buffer{};
+        };
+
+        //===================================================================================
+        /// Transform several grids with the same shape using one FFTW "many" plan. The grids
+        /// are copied into one interleaved buffer [cell][field] so with MPI the data for all the
+        /// fields are sent in the same global transpose (i.e. one all-to-all instead of one per grid).
+        /// The plans are kept in FFTWPlanCache just as for single grids. The price is a buffer of the
+        /// same size as all the grids so this is only done if enabled with FFTWBatchBuffer (otherwise,
+        /// or if compiled with NO_BATCHED_FFTW, the grids are transformed one by one).
+        /// The extra slices of the grids are not touched.
+        ///
+        /// @param[in] grids The grids to transform. Must all have the same Nmesh.
+        /// @param[in] forward Real-to-complex (true) or complex-to-real (false)
+        ///
+        //===================================================================================
+        template <int N, class T>
+        void fftw_batched(std::vector<FFTWGrid<N, T> *> & grids, bool forward) {
+            const int M = int(grids.size());
+            if (M == 0)
+                return;
+            FML_TIMER_REGION("FFTWGrid::fftw_batched");
+
+#ifdef DEBUG_FFTWGRID
+            if (FML::ThisTask == 0) {
+                std::cout << "[fftw_batched] Transforming " << M << " grids to " << (forward ? "fourier" : "real")
+                          << " space\n";
+            }
+#endif
+
+            const int Nmesh = grids[0]->get_nmesh();
+            for (auto * g : grids) {
+                assert_mpi(g->get_nmesh() == Nmesh and g->get_local_nx() == grids[0]->get_local_nx(),
+                           "[fftw_batched] All grids must have the same size\n");
+                assert_mpi(g->get_fourier_layout_transposed() == grids[0]->get_fourier_layout_transposed(),
+                           "[fftw_batched] All grids must have the same Fourier layout\n");
+            }
+
+#if !defined(NO_BATCHED_FFTW) && defined(USE_FFTW)
+            if (M > 1 and FFTWBatchBuffer<T>::get().is_enabled()) {
+                using FloatType = T;
+                using ComplexType = std::complex<T>;
+                using my_fftw_complex = typename FFTWGrid<N, T>::my_fftw_complex;
+                using my_fftw_plan = typename FFTWGrid<N, T>::my_fftw_plan;
+
+                // Size of the local grid (this is also the size we use for the real grid including padding)
+                const ptrdiff_t ntot_fourier = grids[0]->get_ntot_fourier();
+                const ptrdiff_t ntot_real = 2 * ntot_fourier;
+#ifdef USE_MPI
+                const bool transposed = grids[0]->get_fourier_layout_transposed();
+                std::vector<ptrdiff_t> NmeshPerDim(N, Nmesh);
+                std::vector<ptrdiff_t> NmeshPerDimFourier(N, Nmesh);
+                NmeshPerDimFourier[N - 1] = Nmesh / 2 + 1;
+                ptrdiff_t Local_nx, Local_x_start;
+                ptrdiff_t nalloc = FFTWTraits<T>::local_size_many(N,
+                                                                  NmeshPerDimFourier.data(),
+                                                                  M,
+                                                                  FFTW_MPI_DEFAULT_BLOCK,
+                                                                  MPI_COMM_WORLD,
+                                                                  &Local_nx,
+                                                                  &Local_x_start);
+                nalloc = std::max(nalloc, M * ntot_fourier);
+#else
+                std::vector<int> NmeshPerDim(N, Nmesh);
+                std::vector<int> NmeshPerDimFourier(N, Nmesh);
+                NmeshPerDimFourier[N - 1] = Nmesh / 2 + 1;
+                std::vector<int> NmeshPerDimReal(N, Nmesh);
+                NmeshPerDimReal[N - 1] = 2 * (Nmesh / 2 + 1);
+                ptrdiff_t nalloc = M * ntot_fourier;
+#endif
+                ComplexType * buffer = FFTWBatchBuffer<T>::get().get_buffer(nalloc);
+                FloatType * buffer_real = reinterpret_cast<FloatType *>(buffer);
+                my_fftw_complex * buffer_fftw = reinterpret_cast<my_fftw_complex *>(buffer);
+
+                auto make_plan = [&](unsigned int planner_flag) -> my_fftw_plan {
+                    if (forward) {
+#ifdef USE_MPI
+                        return FFTWTraits<T>::plan_many_r2c(N,
+                                                            NmeshPerDim.data(),
+                                                            M,
+                                                            FFTW_MPI_DEFAULT_BLOCK,
+                                                            FFTW_MPI_DEFAULT_BLOCK,
+                                                            buffer_real,
+                                                            buffer_fftw,
+                                                            MPI_COMM_WORLD,
+                                                            planner_flag | (transposed ? FFTW_MPI_TRANSPOSED_OUT : 0));
+#else
+                        return FFTWTraits<T>::plan_many_r2c(N,
+                                                            NmeshPerDim.data(),
+                                                            M,
+                                                            buffer_real,
+                                                            NmeshPerDimReal.data(),
+                                                            M,
+                                                            1,
+                                                            buffer_fftw,
+                                                            NmeshPerDimFourier.data(),
+                                                            M,
+                                                            1,
+                                                            planner_flag);
+#endif
+                    } else {
+#ifdef USE_MPI
+                        return FFTWTraits<T>::plan_many_c2r(N,
+                                                            NmeshPerDim.data(),
+                                                            M,
+                                                            FFTW_MPI_DEFAULT_BLOCK,
+                                                            FFTW_MPI_DEFAULT_BLOCK,
+                                                            buffer_fftw,
+                                                            buffer_real,
+                                                            MPI_COMM_WORLD,
+                                                            planner_flag | (transposed ? FFTW_MPI_TRANSPOSED_IN : 0));
+#else
+                        return FFTWTraits<T>::plan_many_c2r(N,
+                                                            NmeshPerDim.data(),
+                                                            M,
+                                                            buffer_fftw,
+                                                            NmeshPerDimFourier.data(),
+                                                            M,
+                                                            1,
+                                                            buffer_real,
+                                                            NmeshPerDimReal.data(),
+                                                            M,
+                                                            1,
+                                                            planner_flag);
+#endif
+                    }
+                };
+
+                // Get the plan before we fill the buffer as planning with anything but FFTW_ESTIMATE
+                // overwrites the arrays
+#ifdef NO_FFTW_PLAN_CACHE
+                my_fftw_plan plan = make_plan(FFTW_ESTIMATE);
+#else
+                my_fftw_plan plan;
+                {
+                    std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());
+                    auto & cache = FFTWPlanCache::get();
+                    FFTWPlanKey key;
+                    key.float_size = sizeof(T);
+                    key.ndim = N;
+                    key.nmesh = Nmesh;
+                    key.forward = forward;
+                    key.transposed = grids[0]->get_fourier_layout_transposed();
+                    key.nthreads = FML::FFTWNThreads;
+                    key.alignment = FFTWTraits<T>::alignment_of(buffer_real);
+                    key.planner_flag = cache.get_planner_flag();
+                    key.howmany = M;
+
+                    // Planning is collective with MPI so if one task is missing the plan we all make it
+                    plan = cache.find<T>(key);
+                    int missing = plan == nullptr ? 1 : 0;
+                    FML::MaxOverTasks(&missing);
+                    if (missing == 1) {
+                        plan = make_plan(key.planner_flag);
+                        cache.add<T>(key, plan);
+                    }
+                }
+#endif
+
+                // Copy over the data to the interleaved buffer
+                for (int m = 0; m < M; m++) {
+                    if (forward) {
+                        const FloatType * grid = grids[m]->get_real_grid();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                        for (ptrdiff_t i = 0; i < ntot_real; i++)
+                            buffer_real[i * M + m] = grid[i];
+                    } else {
+                        const ComplexType * grid = grids[m]->get_fourier_grid();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                        for (ptrdiff_t i = 0; i < ntot_fourier; i++)
+                            buffer[i * M + m] = grid[i];
+                    }
+                }
+
+                if (forward)
+                    FFTWTraits<T>::execute_r2c(plan, buffer_real, buffer_fftw);
+                else
+                    FFTWTraits<T>::execute_c2r(plan, buffer_fftw, buffer_real);
+#ifdef NO_FFTW_PLAN_CACHE
+                FFTWTraits<T>::destroy_plan(plan);
+#endif
+
+                // Copy back the data to the grids (and normalize if r2c)
+                const FloatType norm = 1.0 / std::pow(double(Nmesh), N);
+                for (int m = 0; m < M; m++) {
+                    if (forward) {
+                        ComplexType * grid = grids[m]->get_fourier_grid();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                        for (ptrdiff_t i = 0; i < ntot_fourier; i++)
+                            grid[i] = buffer[i * M + m] * norm;
+                    } else {
+                        FloatType * grid = grids[m]->get_real_grid();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                        for (ptrdiff_t i = 0; i < ntot_real; i++)
+                            grid[i] = buffer_real[i * M + m];
+                    }
+                    grids[m]->set_grid_status_real(not forward);
+                }
+                return;
+            }
+#endif
+
+            for (auto * g : grids) {
+                if (forward)
+                    g->fftw_r2c();
+                else
+                    g->fftw_c2r();
+            }
+        }
+
+        template <int N, class T>
+        void fftw_r2c_batched(std::vector<FFTWGrid<N, T> *> grids) {
+            fftw_batched(grids, true);
+        }
+
+        template <int N, class T>
+        void fftw_c2r_batched(std::vector<FFTWGrid<N, T> *> grids) {
+            fftw_batched(grids, false);
+        }
+
+        template <int N, class T, size_t M>
+        void fftw_r2c_batched(std::array<FFTWGrid<N, T>, M> & grids) {
+            std::vector<FFTWGrid<N, T> *> grid_ptrs;
+            for (auto & g : grids)
+                grid_ptrs.push_back(&g);
+            fftw_batched(grid_ptrs, true);
+        }
+
+        template <int N, class T, size_t M>
+        void fftw_c2r_batched(std::array<FFTWGrid<N, T>, M> & grids) {
+            std::vector<FFTWGrid<N, T> *> grid_ptrs;
+            for (auto & g : grids)
+                grid_ptrs.push_back(&g);
+            fftw_batched(grid_ptrs, false);
+        }
+
+        template <int N, class T>
+        void fftw_r2c_batched(std::vector<FFTWGrid<N, T>> & grids) {
+            std::vector<FFTWGrid<N, T> *> grid_ptrs;
+            for (auto & g : grids)
+                grid_ptrs.push_back(&g);
+            fftw_batched(grid_ptrs, true);
+        }
+
+        template <int N, class T>
+        void fftw_c2r_batched(std::vector<FFTWGrid<N, T>> & grids) {
+            std::vector<FFTWGrid<N, T> *> grid_ptrs;
+            for (auto & g : grids)
+                grid_ptrs.push_back(&g);
+            fftw_batched(grid_ptrs, false);
+        }
+
+        template <int N, class T>
+        void FFTWGrid<N, T>::free() {
             fourier_grid_raw.clear();
             fourier_grid_raw.shrink_to_fit();
         }
 
-        template <int N>
-        FloatType FFTWGrid<N>::get_real_from_index(const IndexIntType index) const {
+        template <int N, class T>
+        T FFTWGrid<N, T>::get_real_from_index(const IndexIntType index) const {
             const FloatType * grid = reinterpret_cast<const FloatType *>(fourier_grid_raw.data()) +
                                      NmeshTotRealSlice * n_extra_x_slices_left;
             return grid[index];
         }
 
-        template <int N>
-        int FFTWGrid<N>::get_n_extra_slices_left() const {
+        template <int N, class T>
+        int FFTWGrid<N, T>::get_n_extra_slices_left() const {
             return n_extra_x_slices_left;
         }
 
-        template <int N>
-        int FFTWGrid<N>::get_n_extra_slices_right() const {
+        template <int N, class T>
+        int FFTWGrid<N, T>::get_n_extra_slices_right() const {
             return n_extra_x_slices_right;
         }
 
-        template <int N>
-        bool FFTWGrid<N>::nan_in_grids() const {
+        template <int N, class T>
+        bool FFTWGrid<N, T>::nan_in_grids() const {
             bool found = false;
             for (int i = 0; i < NmeshTotComplexAlloc; i++) {
                 if (fourier_grid_raw[i] != fourier_grid_raw[i]) {
@@ -1306,8 +2136,8 @@ namespace FML {
             return found;
         }
 
-        template <int N>
-        void FFTWGrid<N>::dump_to_file(std::string fileprefix) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::dump_to_file(std::string fileprefix) {
             std::ios_base::sync_with_stdio(false);
             std::string filename = fileprefix + "." + std::to_string(FML::ThisTask);
             auto myfile = std::fstream(filename, std::ios::out | std::ios::binary);
@@ -1342,8 +2172,8 @@ namespace FML {
             myfile.close();
         }
 
-        template <int N>
-        void FFTWGrid<N>::load_from_file(std::string fileprefix) {
+        template <int N, class T>
+        void FFTWGrid<N, T>::load_from_file(std::string fileprefix) {
             std::ios_base::sync_with_stdio(false);
             std::string filename = fileprefix + "." + std::to_string(FML::ThisTask);
             auto myfile = std::ifstream(filename, std::ios::binary);
@@ -1380,6 +2210,352 @@ namespace FML {
             myfile.close();
         }
 
+        // Header of the files made by dump_to_file_parallel
+        struct FFTWGridFileHeader {
+            int magic{0x46465447}; // "FFTG"
+            int ndim{0};
+            int nmesh{0};
+            int n_extra_x_slices_left{0};
+            int n_extra_x_slices_right{0};
+            int grid_is_in_real_space{1};
+            int fourier_layout_transposed{0};
+            int bytes_per_float{0};
+        };
+
+        template <int N, class T>
+        void FFTWGrid<N, T>::dump_to_file_parallel(std::string filename) {
+
+            FFTWGridFileHeader header;
+            header.ndim = N;
+            header.nmesh = Nmesh;
+            header.n_extra_x_slices_left = n_extra_x_slices_left;
+            header.n_extra_x_slices_right = n_extra_x_slices_right;
+            header.grid_is_in_real_space = grid_is_in_real_space;
+            header.fourier_layout_transposed = fourier_layout_transposed;
+            header.bytes_per_float = sizeof(FloatType);
+
+            // Pack the active cells of the local slices (i.e. remove the padding in the real grid)
+            const IndexIntType cells_per_row = grid_is_in_real_space ? Nmesh : Nmesh / 2 + 1;
+            const IndexIntType rows_per_slice = FML::power(Nmesh, N - 2);
+            const IndexIntType bytes_per_cell = grid_is_in_real_space ? sizeof(FloatType) : sizeof(ComplexType);
+            const IndexIntType bytes_per_row = cells_per_row * bytes_per_cell;
+            const IndexIntType bytes_per_slice = rows_per_slice * bytes_per_row;
+            std::vector<char> buffer(bytes_per_slice * Local_nx);
+            const char * grid = reinterpret_cast<const char *>(get_real_grid());
+            const IndexIntType bytes_per_row_alloc = (Nmesh / 2 + 1) * sizeof(ComplexType);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (IndexIntType irow = 0; irow < rows_per_slice * Local_nx; irow++)
+                std::memcpy(buffer.data() + irow * bytes_per_row, grid + irow * bytes_per_row_alloc, bytes_per_row);
+
+            // Where our data goes in the file. The file is one global array [Nmesh][...] after the header
+            const IndexIntType offset = sizeof(FFTWGridFileHeader) + bytes_per_slice * Local_x_start;
+
+#ifdef USE_MPI
+            MPI_File file;
+            int err = MPI_File_open(
+                MPI_COMM_WORLD, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+            assert_mpi(err == MPI_SUCCESS, ("[FFTWGrid::dump_to_file_parallel] Failed to open " + filename).c_str());
+            MPI_File_set_size(file, 0);
+            if (FML::ThisTask == 0)
+                MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+
+            // Collective writes in chunks (the count is an int) so all tasks must do the same number of calls
+            const IndexIntType max_chunk = IndexIntType(1) << 30;
+            IndexIntType nbytes = buffer.size();
+            IndexIntType nchunks = (nbytes + max_chunk - 1) / max_chunk;
+            FML::MaxOverTasks(&nchunks);
+            for (IndexIntType i = 0; i < nchunks; i++) {
+                IndexIntType start = std::min(i * max_chunk, nbytes);
+                int count = int(std::min(max_chunk, nbytes - start));
+                MPI_File_write_at_all(
+                    file, offset + start, buffer.data() + start, count, MPI_BYTE, MPI_STATUS_IGNORE);
+            }
+            MPI_File_close(&file);
+#else
+            auto myfile = std::fstream(filename, std::ios::out | std::ios::binary);
+            if (not myfile.good()) {
+                std::cout << "[FFTWGrid::dump_to_file_parallel] Failed to save the grid data to " + filename << "\n";
+                return;
+            }
+            myfile.write((char *)&header, sizeof(header));
+            myfile.seekp(offset);
+            myfile.write(buffer.data(), buffer.size());
+            myfile.close();
+#endif
+        }
+
+        template <int N, class T>
+        void FFTWGrid<N, T>::load_from_file_parallel(std::string filename) {
+
+            // Read the header
+            FFTWGridFileHeader header;
+#ifdef USE_MPI
+            MPI_File file;
+            int err = MPI_File_open(MPI_COMM_WORLD, filename.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+            assert_mpi(err == MPI_SUCCESS, ("[FFTWGrid::load_from_file_parallel] Failed to open " + filename).c_str());
+            MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+#else
+            auto myfile = std::ifstream(filename, std::ios::binary);
+            assert_mpi(myfile.good(), ("[FFTWGrid::load_from_file_parallel] Failed to open " + filename).c_str());
+            myfile.read((char *)&header, sizeof(header));
+#endif
+            assert_mpi(header.magic == FFTWGridFileHeader().magic,
+                       "[FFTWGrid::load_from_file_parallel] The file is not a FFTWGrid file\n");
+            assert_mpi(header.ndim == N,
+                       "[FFTWGrid::load_from_file_parallel] The dimension of the grid does not match what is in the "
+                       "file\n");
+            assert_mpi(header.bytes_per_float == sizeof(FloatType),
+                       "[FFTWGrid::load_from_file_parallel] The precision of the grid does not match what is in the "
+                       "file\n");
+
+            // Allocate the grid for the current number of tasks
+            *this = FFTWGrid<N, T>(header.nmesh, header.n_extra_x_slices_left, header.n_extra_x_slices_right);
+            grid_is_in_real_space = header.grid_is_in_real_space;
+            set_fourier_layout_transposed(header.fourier_layout_transposed);
+            assert_mpi(header.fourier_layout_transposed == fourier_layout_transposed,
+                       "[FFTWGrid::load_from_file_parallel] The file has a transposed Fourier grid which needs MPI\n");
+
+            const IndexIntType cells_per_row = grid_is_in_real_space ? Nmesh : Nmesh / 2 + 1;
+            const IndexIntType rows_per_slice = FML::power(Nmesh, N - 2);
+            const IndexIntType bytes_per_cell = grid_is_in_real_space ? sizeof(FloatType) : sizeof(ComplexType);
+            const IndexIntType bytes_per_row = cells_per_row * bytes_per_cell;
+            const IndexIntType bytes_per_slice = rows_per_slice * bytes_per_row;
+            const IndexIntType offset = sizeof(FFTWGridFileHeader) + bytes_per_slice * Local_x_start;
+            std::vector<char> buffer(bytes_per_slice * Local_nx);
+
+#ifdef USE_MPI
+            const IndexIntType max_chunk = IndexIntType(1) << 30;
+            IndexIntType nbytes = buffer.size();
+            IndexIntType nchunks = (nbytes + max_chunk - 1) / max_chunk;
+            FML::MaxOverTasks(&nchunks);
+            for (IndexIntType i = 0; i < nchunks; i++) {
+                IndexIntType start = std::min(i * max_chunk, nbytes);
+                int count = int(std::min(max_chunk, nbytes - start));
+                MPI_File_read_at_all(file, offset + start, buffer.data() + start, count, MPI_BYTE, MPI_STATUS_IGNORE);
+            }
+            MPI_File_close(&file);
+#else
+            myfile.seekg(offset);
+            myfile.read(buffer.data(), buffer.size());
+            myfile.close();
+#endif
+
+            // Unpack into the grid
+            char * grid = reinterpret_cast<char *>(get_real_grid());
+            const IndexIntType bytes_per_row_alloc = (Nmesh / 2 + 1) * sizeof(ComplexType);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (IndexIntType irow = 0; irow < rows_per_slice * Local_nx; irow++)
+                std::memcpy(grid + irow * bytes_per_row_alloc, buffer.data() + irow * bytes_per_row, bytes_per_row);
+        }
+
+        // Header of the files made by dump_to_file_quantized. After it comes the offset and step of each
+        // slice (2 * local_nx doubles) and then the (maybe compressed) quantized values
+        struct FFTWGridQuantizedFileHeader {
+            int magic{0x46465151}; // "QQFF"
+            int ndim{0};
+            int nmesh{0};
+            int n_extra_x_slices_left{0};
+            int n_extra_x_slices_right{0};
+            int local_nx{0};
+            int local_x_start{0};
+            int bits{16};
+            int log_density{0};
+            int compressed{0};
+            double density_floor{0.0};
+            long long int payload_bytes{0};
+        };
+
+        template <int N, class T>
+        void FFTWGrid<N, T>::dump_to_file_quantized(std::string fileprefix,
+                                                    int bits,
+                                                    bool log_density,
+                                                    double density_floor,
+                                                    int compression_level) {
+            assert_mpi(grid_is_in_real_space,
+                       "[FFTWGrid::dump_to_file_quantized] Only real space grids can be stored quantized\n");
+            assert_mpi(bits == 8 or bits == 16, "[FFTWGrid::dump_to_file_quantized] bits must be 8 or 16\n");
+            assert_mpi(not log_density or density_floor > 0.0,
+                       "[FFTWGrid::dump_to_file_quantized] density_floor must be positive\n");
+
+            FFTWGridQuantizedFileHeader header;
+            header.ndim = N;
+            header.nmesh = Nmesh;
+            header.n_extra_x_slices_left = n_extra_x_slices_left;
+            header.n_extra_x_slices_right = n_extra_x_slices_right;
+            header.local_nx = Local_nx;
+            header.local_x_start = Local_x_start;
+            header.bits = bits;
+            header.log_density = log_density;
+            header.density_floor = density_floor;
+
+            // The value we quantize
+            auto transform = [&](double value) {
+                return log_density ? std::log(std::max(1.0 + value, density_floor)) : value;
+            };
+
+            // Quantize slice by slice with the range of the values in the slice
+            const IndexIntType rows_per_slice = FML::power(Nmesh, N - 2);
+            const IndexIntType cells_per_slice = rows_per_slice * Nmesh;
+            const IndexIntType row_stride = 2 * (Nmesh / 2 + 1);
+            const IndexIntType bytes_per_value = bits / 8;
+            const double qmax = double((1 << bits) - 1);
+            std::vector<double> slice_scale(2 * Local_nx);
+            std::vector<char> payload(cells_per_slice * Local_nx * bytes_per_value);
+            const FloatType * grid = get_real_grid();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                const FloatType * slice = grid + islice * rows_per_slice * row_stride;
+                double vmin = std::numeric_limits<double>::max();
+                double vmax = -std::numeric_limits<double>::max();
+                for (IndexIntType irow = 0; irow < rows_per_slice; irow++) {
+                    for (int i = 0; i < Nmesh; i++) {
+                        const double v = transform(slice[irow * row_stride + i]);
+                        vmin = std::min(vmin, v);
+                        vmax = std::max(vmax, v);
+                    }
+                }
+                const double step = vmax > vmin ? (vmax - vmin) / qmax : 1.0;
+                slice_scale[2 * islice] = vmin;
+                slice_scale[2 * islice + 1] = step;
+
+                char * out = payload.data() + islice * cells_per_slice * bytes_per_value;
+                for (IndexIntType irow = 0; irow < rows_per_slice; irow++) {
+                    for (int i = 0; i < Nmesh; i++) {
+                        const double v = transform(slice[irow * row_stride + i]);
+                        const IndexIntType icell = irow * Nmesh + i;
+                        const double q = std::min(std::round((v - vmin) / step), qmax);
+                        if (bits == 8) {
+                            out[icell] = char(uint8_t(q));
+                        } else {
+                            const uint16_t q16 = uint16_t(q);
+                            std::memcpy(out + 2 * icell, &q16, 2);
+                        }
+                    }
+                }
+            }
+
+#ifdef USE_ZSTD
+            if (compression_level > 0) {
+                std::vector<char> compressed(ZSTD_compressBound(payload.size()));
+                const size_t nbytes = ZSTD_compress(
+                    compressed.data(), compressed.size(), payload.data(), payload.size(), compression_level);
+                assert_mpi(not ZSTD_isError(nbytes),
+                           ("[FFTWGrid::dump_to_file_quantized] zstd failed: " + std::string(ZSTD_getErrorName(nbytes)))
+                               .c_str());
+                compressed.resize(nbytes);
+                payload = std::move(compressed);
+                header.compressed = 1;
+            }
+#else
+            (void)compression_level;
+#endif
+            header.payload_bytes = payload.size();
+
+            std::string filename = fileprefix + "." + std::to_string(FML::ThisTask);
+            auto myfile = std::fstream(filename, std::ios::out | std::ios::binary);
+
+            // If we fail to write give a warning, but continue
+            if (not myfile.good()) {
+                std::string error = "[FFTWGrid::dump_to_file_quantized] Failed to save the grid data on task " +
+                                    std::to_string(FML::ThisTask) + " Filename: " + filename;
+                std::cout << error << "\n";
+                return;
+            }
+            myfile.write((char *)&header, sizeof(header));
+            myfile.write((char *)slice_scale.data(), sizeof(double) * slice_scale.size());
+            myfile.write(payload.data(), payload.size());
+            myfile.close();
+        }
+
+        template <int N, class T>
+        void FFTWGrid<N, T>::load_from_file_quantized(std::string fileprefix) {
+            std::string filename = fileprefix + "." + std::to_string(FML::ThisTask);
+            auto myfile = std::ifstream(filename, std::ios::binary);
+
+            // If we fail to load a file throw an error
+            if (not myfile.good()) {
+                std::string error = "[FFTWGrid::load_from_file_quantized] Failed to read the grid from file on task " +
+                                    std::to_string(FML::ThisTask) + " Filename: " + filename;
+                assert_mpi(false, error.c_str());
+            }
+
+            FFTWGridQuantizedFileHeader header;
+            myfile.read((char *)&header, sizeof(header));
+            assert_mpi(header.magic == FFTWGridQuantizedFileHeader().magic,
+                       "[FFTWGrid::load_from_file_quantized] The file is not a quantized FFTWGrid file\n");
+            assert_mpi(header.ndim == N,
+                       "[FFTWGrid::load_from_file_quantized] The dimension of the grid does not match what is in the "
+                       "file\n");
+#ifndef USE_ZSTD
+            assert_mpi(not header.compressed,
+                       "[FFTWGrid::load_from_file_quantized] The file is compressed with zstd. Compile with USE_ZSTD\n");
+#endif
+
+            // Allocate the grid and check that the domain decomposition is the same as when it was saved
+            *this = FFTWGrid<N, T>(header.nmesh, header.n_extra_x_slices_left, header.n_extra_x_slices_right);
+            assert_mpi(Local_nx == header.local_nx and Local_x_start == header.local_x_start,
+                       "[FFTWGrid::load_from_file_quantized] The domain decomposition differs from when the grid was "
+                       "saved. Use the same number of tasks\n");
+
+            const IndexIntType rows_per_slice = FML::power(Nmesh, N - 2);
+            const IndexIntType cells_per_slice = rows_per_slice * Nmesh;
+            const IndexIntType row_stride = 2 * (Nmesh / 2 + 1);
+            const IndexIntType bytes_per_value = header.bits / 8;
+            std::vector<double> slice_scale(2 * Local_nx);
+            std::vector<char> payload(header.payload_bytes);
+            myfile.read((char *)slice_scale.data(), sizeof(double) * slice_scale.size());
+            myfile.read(payload.data(), payload.size());
+            assert_mpi(myfile.good(), "[FFTWGrid::load_from_file_quantized] The file is truncated\n");
+            myfile.close();
+
+#ifdef USE_ZSTD
+            if (header.compressed) {
+                std::vector<char> decompressed(cells_per_slice * Local_nx * bytes_per_value);
+                const size_t nbytes =
+                    ZSTD_decompress(decompressed.data(), decompressed.size(), payload.data(), payload.size());
+                assert_mpi(not ZSTD_isError(nbytes) and nbytes == decompressed.size(),
+                           "[FFTWGrid::load_from_file_quantized] Failed to decompress the grid\n");
+                payload = std::move(decompressed);
+            }
+#endif
+            assert_mpi(IndexIntType(payload.size()) == cells_per_slice * Local_nx * bytes_per_value,
+                       "[FFTWGrid::load_from_file_quantized] The size of the data does not match the grid\n");
+
+            const bool log_density = header.log_density;
+            const int bits = header.bits;
+            FloatType * grid = get_real_grid();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                FloatType * slice = grid + islice * rows_per_slice * row_stride;
+                const double vmin = slice_scale[2 * islice];
+                const double step = slice_scale[2 * islice + 1];
+                const char * in = payload.data() + islice * cells_per_slice * bytes_per_value;
+                for (IndexIntType irow = 0; irow < rows_per_slice; irow++) {
+                    for (int i = 0; i < Nmesh; i++) {
+                        const IndexIntType icell = irow * Nmesh + i;
+                        double q;
+                        if (bits == 8) {
+                            q = double(uint8_t(in[icell]));
+                        } else {
+                            uint16_t q16;
+                            std::memcpy(&q16, in + 2 * icell, 2);
+                            q = double(q16);
+                        }
+                        const double v = vmin + q * step;
+                        slice[irow * row_stride + i] = FloatType(log_density ? std::exp(v) - 1.0 : v);
+                    }
+                }
+            }
+        }
+
 #ifdef USE_GSL
         /// std::function can be slow so for looping through a fourier grid and evaluating a function f(k)
         /// in every cell its faster to make a spline and use this instead. This method makes such a spline.
@@ -1388,11 +2564,11 @@ namespace FML {
         /// throw errors
         /// @param[in] sampling_factor How many points per integer wavenumber should we sample the function at when
         /// making the spline?
-        template <int N>
+        template <int N, class T>
         FML::INTERPOLATION::SPLINE::Spline
-        FFTWGrid<N>::make_fourier_spline(std::function<double(double)> function_of_kBox,
-                                         std::string label,
-                                         int sampling_factor) const {
+        FFTWGrid<N, T>::make_fourier_spline(std::function<double(double)> function_of_kBox,
+                                            std::string label,
+                                            int sampling_factor) const {
 
             FML::assert_mpi(Nmesh > 0, "FFTWGrid::make_fourier_spline Grid is not allocated");
 
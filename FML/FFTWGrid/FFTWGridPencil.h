@@ -0,0 +1,1150 @@
+#ifndef FFTWGRIDPENCIL_HEADER
+#define FFTWGRIDPENCIL_HEADER
+#include <array>
+#include <cassert>
+#include <complex>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#ifdef USE_FFTW
+#include <fftw3.h>
+#endif
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/Global/Global.h>
+
+namespace FML {
+    namespace GRID {
+
+        // Forward declaration of range classes
+        class RealRangePencil;
+
+        //==========================================================================
+        ///
+        /// Class for holding 3D grids using a pencil (2D) domain decomposition and
+        /// performing real-to-complex and complex-to-real FFTs. FFTWGrid uses the
+        /// FFTW-MPI slab decomposition which limits the number of tasks to Nmesh.
+        /// Here the tasks are arranged in a NTasks = P0 x P1 process grid and each
+        /// task owns a (Nmesh/P0) x (Nmesh/P1) x Nmesh pencil in real space so one
+        /// can use up to Nmesh^2 tasks.
+        ///
+        /// The transforms are done as three sets of local 1D transforms (done with the
+        /// serial FFTW guru interface) with two global transposes in between:
+        ///
+        ///   Real space    : [local_nx ][local_ny ][Nmesh    ] (z-pencils, x and y distributed)
+        ///   Fourier space : [local_nky][local_nkz][Nmesh    ] (x-pencils, ky and kz distributed)
+        ///
+        /// I.e. the Fourier grid is stored transposed with kx running fastest. All of this
+        /// is taken care of by the index methods so for range based loops over the grid
+        /// one can use get_real_range / get_fourier_range just as for FFTWGrid.
+        ///
+        /// Extra slices (n_extra_left, n_extra_right) are allocated in both the x and the y
+        /// direction and are filled by communicate_boundaries(). The content of these is
+        /// not preserved by the transforms so call communicate_boundaries() again after
+        /// going back to real space if you need them.
+        ///
+        /// The real grid is padded with 2 extra cells in the last dimension as for FFTWGrid.
+        /// Only implemented for N = 3. Requires Nmesh to be divisible by both P0 and P1.
+        ///
+        /// The plans for the local transforms are made on the first transform and reused after that
+        /// (unless NO_FFTW_PLAN_CACHE is defined). The buffers for the global transposes are also kept
+        /// between transforms so a grid uses up to twice its own size in extra memory after the first
+        /// transform. free() releases all of it.
+        ///
+        /// Scope: this is the grid and its transforms only. Nothing else in the library takes an
+        /// FFTWGridPencil: MPIParticles, particles_to_grid / interpolation, the force computations
+        /// in NBody, the power-spectrum estimators and the COLASolver all assume the slab
+        /// decomposition of FFTWGrid (the particles on a task must cover the x-slab of the grid).
+        /// Until the follow-up below is done it is only useful for purely grid based algorithms.
+        ///
+        /// TODO: pencil support in the rest of the library. In order:
+        ///   1. A 2D (x,y) domain decomposition in MPIParticles matching get_local_x_start / get_local_y_start
+        ///      (communicate_particles over comm_x and comm_y) and boundary particles in both directions.
+        ///   2. particles_to_grid / interpolate_grid_to_particle_positions for FFTWGridPencil (the kernels
+        ///      only need the extra slices in y that communicate_boundaries already fills).
+        ///   3. compute_force_from_density_fourier in NBody and the power-spectrum binning taking the
+        ///      transposed Fourier layout (kx fastest) of this grid.
+        ///   4. A switch in the COLASolver to run the PM steps on pencil grids.
+        ///
+        //==========================================================================
+
+        template <int N>
+        class FFTWGridPencil {
+            static_assert(N == 3, "FFTWGridPencil is only implemented for N = 3");
+
+          private:
+            using IndexIntType = FML::IndexIntType;
+
+            // The raw data. Holds the real grid (with extra slices), the intermediate
+            // y-pencils during the transforms and the Fourier grid
+            LargeVector<ComplexType> fourier_grid_raw{};
+
+            int Nmesh{0};
+
+            // The process grid and our coordinate in it
+            int nproc_x{1};
+            int nproc_y{1};
+            int iproc_x{0};
+            int iproc_y{0};
+
+            // Real space: what we own in x and y (we own all of z)
+            int Local_nx{0};
+            int Local_ny{0};
+            int Local_x_start{0};
+            int Local_y_start{0};
+
+            // Fourier space: what we own in ky and kz (we own all of kx)
+            int Local_nky{0};
+            int Local_nkz{0};
+            int Local_ky_start{0};
+            int Local_kz_start{0};
+
+            // Number of extra slices to the left and right in x and y
+            int n_extra_slices_left{0};
+            int n_extra_slices_right{0};
+
+            // Size of the real grid in each dimension including extra slices / padding
+            int Nx_alloc{0};
+            int Ny_alloc{0};
+            int Nz_alloc{0};
+
+            // Number of active cells
+            IndexIntType NmeshTotReal{0};
+            IndexIntType NmeshTotComplex{0};
+
+            bool grid_is_in_real_space{true};
+
+            std::string name{""};
+
+#ifdef USE_MPI
+            // Communicators for the tasks in the same x-row and y-row of the process grid
+            MPI_Comm comm_x{MPI_COMM_NULL};
+            MPI_Comm comm_y{MPI_COMM_NULL};
+#endif
+
+#ifdef USE_FFTW
+            // The guru plans for the local transforms. They are made the first time a transform is done and
+            // reused by all later ones. A plan is only valid for the array it was made for so the set is tied
+            // to the data pointer and remade if that changes (after a copy or a free)
+            enum class PlanType { r2c_z, c2r_z, dft_forward, dft_backward };
+            struct PencilPlans {
+                ComplexType * data{nullptr};
+                std::map<std::pair<PlanType, IndexIntType>, my_fftw_plan> plans{};
+                ~PencilPlans() {
+                    std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());
+                    for (auto & p : plans)
+                        DESTROY_PLAN(p.second);
+                }
+            };
+            std::shared_ptr<PencilPlans> local_plans{};
+            my_fftw_plan get_local_plan(PlanType type, IndexIntType howmany);
+#endif
+
+            // Buffers for the global transposes. Kept between transforms so we don't reallocate them every time
+            Vector<ComplexType> transpose_sendbuf{};
+            Vector<ComplexType> transpose_recvbuf{};
+
+            void transpose_z_y(bool forward);
+            void transpose_y_x(bool forward);
+            void fft_local_z(bool forward);
+            void fft_local_complex(bool forward, IndexIntType howmany);
+
+            // The range of kz owned by a given task in the y-row
+            int kz_start_of_task(int iproc) const { return (iproc * (Nmesh / 2 + 1)) / nproc_y; }
+            int nkz_of_task(int iproc) const { return kz_start_of_task(iproc + 1) - kz_start_of_task(iproc); }
+
+          public:
+            FFTWGridPencil() = default;
+
+            /// Has the grid been allocated
+            explicit operator bool() const { return fourier_grid_raw.size() > 0; }
+
+            /// Constructor
+            /// @param[in] Nmesh Total number of grid-cells per dimension
+            /// @param[in] n_extra_slices_left Number of extra slices to the left of the grid in x and y
+            /// @param[in] n_extra_slices_right Number of extra slices to the right of the grid in x and y
+            /// @param[in] nproc_x Number of tasks in the x-direction of the process grid. If 0 we pick it using
+            /// MPI_Dims_create
+            FFTWGridPencil(int Nmesh, int n_extra_slices_left = 0, int n_extra_slices_right = 0, int nproc_x = 0);
+
+            FFTWGridPencil(const FFTWGridPencil & rhs) = default;
+            FFTWGridPencil & operator=(const FFTWGridPencil & rhs) = default;
+
+            /// The main real grid (cell ix = 0, iy = 0, iz = 0)
+            FloatType * get_real_grid();
+            /// The Fourier grid
+            ComplexType * get_fourier_grid();
+
+            /// Free all the memory associated with the grid
+            void free();
+
+            /// Perform real-to-complex fourier transform
+            void fftw_r2c();
+            /// Perform complex-to-real fourier transform
+            void fftw_c2r();
+
+            /// Fill the whole real-grid with a constant value
+            void fill_real_grid(const FloatType val);
+            /// Fill the whole fourier-grid with a constant value
+            void fill_fourier_grid(const ComplexType val);
+            /// Fill the main grid from a function specifying the value at a given position
+            void fill_real_grid(std::function<FloatType(std::array<double, N> &)> & func);
+            /// Fill the main grid from a function specifying the value at a given fourier wave-vector
+            void fill_fourier_grid(std::function<ComplexType(std::array<double, N> &)> & func);
+
+            /// Get the (local) cell coordinates from a local index
+            std::array<int, N> get_coord_from_index(const IndexIntType index_real) const;
+            /// Get the (local) Fourier coordinates (ikx, iky, ikz) from a local index
+            std::array<int, N> get_fourier_coord_from_index(const IndexIntType index_fourier) const;
+
+            /// From (local) coordinate with -n_extra_left <= coord[0],coord[1] < Local_nx(y) + n_extra_right
+            /// to index in the grid
+            IndexIntType get_index_real(const std::array<int, N> & coord) const;
+            /// From (local) Fourier coordinate (ikx, iky, ikz) to index in the grid
+            IndexIntType get_index_fourier(const std::array<int, N> & coord) const;
+
+            /// Fetch value in grid by (local) integer coordinate
+            FloatType get_real(const std::array<int, N> & coord) const;
+            /// Fetch value in grid by (local) index
+            FloatType get_real_from_index(const IndexIntType index) const;
+            /// Fetch value in fourier grid by (local) integer coordinate
+            ComplexType get_fourier(const std::array<int, N> & coord) const;
+            /// Fetch value in fourier grid by (local) index
+            ComplexType get_fourier_from_index(const IndexIntType index) const;
+
+            /// Set value in grid from (local) integer coordinate
+            void set_real(const std::array<int, N> & coord, const FloatType value);
+            /// Set value in grid from (local) index
+            void set_real_from_index(const IndexIntType index, const FloatType value);
+            /// Add to value in grid
+            void add_real(const std::array<int, N> & coord, const FloatType value);
+            /// Set value of cell in fourier grid using (local) coordinate
+            void set_fourier(const std::array<int, N> & coord, const ComplexType value);
+            /// Set value of cell in fourier grid using (local) index
+            void set_fourier_from_index(const IndexIntType index, const ComplexType value);
+
+            /// The (global) position of a real grid-cell in [0,1)^Ndim
+            std::array<double, N> get_real_position(const std::array<int, N> & coord) const;
+            /// Get the wave-vector of a grid-cell in Fourier space (for physical [k] multiply by 1/Boxsize)
+            std::array<double, N> get_fourier_wavevector_from_index(const IndexIntType index) const;
+            /// From index in the grid get the k-vector and the magnitude of it
+            void get_fourier_wavevector_and_norm_by_index(const IndexIntType index,
+                                                          std::array<double, N> & kvec,
+                                                          double & kmag) const;
+            /// From index in the grid get the k-vector and the norm of it (square magnitude)
+            void get_fourier_wavevector_and_norm2_by_index(const IndexIntType index,
+                                                           std::array<double, N> & kvec,
+                                                           double & kmag2) const;
+
+            /// Range iterator for going through all active cells in the main real grid by index.
+            /// If you add the slice numbers we only loop over the given x-slice range
+            RealRangePencil get_real_range(int islice_begin = 0, int islice_end = 0) const;
+            /// Range iterator for going through all active cells in the main fourier grid by index.
+            /// If you add the slice numbers we only loop over the given slice range.
+            /// For the Fourier range islice denotes the (local) iky value
+            FourierRange get_fourier_range(int islice_begin = 0, int islice_end = 0) const;
+
+            /// Send slices to the neighboring tasks in x and y which stores them in the extra slices
+            void communicate_boundaries();
+
+            /// How many extra slices we have allocated to the left (in x and y)
+            int get_n_extra_slices_left() const { return n_extra_slices_left; }
+            /// How many extra slices we have allocated to the right (in x and y)
+            int get_n_extra_slices_right() const { return n_extra_slices_right; }
+            /// Number of grid-cells per dimension
+            int get_nmesh() const { return Nmesh; }
+            /// Dimension of the grid
+            int get_ndim() const { return N; }
+            /// Number of tasks in the x and y direction of the process grid
+            std::array<int, 2> get_process_grid() const { return {nproc_x, nproc_y}; }
+
+            /// Number of local x-slices in the real grid
+            int get_local_nx() const { return Local_nx; }
+            /// Number of local y-slices in the real grid
+            int get_local_ny() const { return Local_ny; }
+            /// The x-slice the first local slice has in the global grid
+            int get_local_x_start() const { return Local_x_start; }
+            /// The y-slice the first local slice has in the global grid
+            int get_local_y_start() const { return Local_y_start; }
+            /// Number of local ky-slices in the fourier grid
+            int get_local_nky() const { return Local_nky; }
+            /// Number of local kz-slices in the fourier grid
+            int get_local_nkz() const { return Local_nkz; }
+            /// The ky-slice the first local slice has in the global grid
+            int get_local_ky_start() const { return Local_ky_start; }
+            /// The kz-slice the first local slice has in the global grid
+            int get_local_kz_start() const { return Local_kz_start; }
+
+            /// The number of active real cells
+            IndexIntType get_ntot_real() const { return NmeshTotReal; }
+            /// The number of active fourier cells
+            IndexIntType get_ntot_fourier() const { return NmeshTotComplex; }
+
+            /// Check if we have NaN in any of the grids
+            bool nan_in_grids() const;
+
+            /// Print some info about the grid
+            void info();
+
+            /// Get the status of the grid: is it currently a real grid or a fourier grid?
+            bool get_grid_status_real() { return grid_is_in_real_space; }
+            /// Set the status of the grid: is it currently a real grid or a fourier grid?
+            void set_grid_status_real(bool grid_is_a_real_grid) { grid_is_in_real_space = grid_is_a_real_grid; }
+
+            /// For memory logging: add a label to the grid
+            void add_memory_label(std::string label);
+        };
+
+        //===================================================================================
+        /// An iterator that deal with looping through a pencil real grid. The real grid has
+        /// padding in z and extra slices in y so we need to skip cells when looping through it
+        //===================================================================================
+        class LoopIteratorRealPencil {
+          private:
+            IndexIntType count, real_index;
+            int iz{0}, iy{0};
+            int Nmesh, Local_ny;
+            IndexIntType row_skip, slice_skip;
+
+          public:
+            LoopIteratorRealPencil(IndexIntType _count,
+                                   IndexIntType _real_index,
+                                   int _Nmesh,
+                                   int _Local_ny,
+                                   IndexIntType _row_skip,
+                                   IndexIntType _slice_skip)
+                : count(_count), real_index(_real_index), Nmesh(_Nmesh), Local_ny(_Local_ny), row_skip(_row_skip),
+                  slice_skip(_slice_skip) {}
+            bool operator!=(LoopIteratorRealPencil const & other) const { return count != other.count; }
+            const IndexIntType & operator*() const { return real_index; }
+            LoopIteratorRealPencil & operator++() {
+                ++count;
+                ++real_index;
+                if (++iz == Nmesh) {
+                    iz = 0;
+                    real_index += row_skip;
+                    if (++iy == Local_ny) {
+                        iy = 0;
+                        real_index += slice_skip;
+                    }
+                }
+                return *this;
+            }
+        };
+
+        /// For range based for-loops over the pencil real-grid. Loop over all local cells.
+        class RealRangePencil {
+          private:
+            const IndexIntType from, to, index_from;
+            const int Nmesh, Local_ny;
+            const IndexIntType row_skip, slice_skip;
+
+          public:
+            RealRangePencil(IndexIntType _from,
+                            IndexIntType _to,
+                            IndexIntType _index_from,
+                            int _Nmesh,
+                            int _Local_ny,
+                            IndexIntType _row_skip,
+                            IndexIntType _slice_skip)
+                : from(_from), to(_to), index_from(_index_from), Nmesh(_Nmesh), Local_ny(_Local_ny),
+                  row_skip(_row_skip), slice_skip(_slice_skip) {}
+            LoopIteratorRealPencil begin() const {
+                return {from, index_from, Nmesh, Local_ny, row_skip, slice_skip};
+            }
+            LoopIteratorRealPencil end() const { return {to, 0, Nmesh, Local_ny, row_skip, slice_skip}; }
+        };
+
+#ifdef USE_MPI
+        // The row communicators for a given process grid. These are created once and kept
+        // for the lifetime of the program as they are shared by all grids with the same layout
+        inline std::pair<MPI_Comm, MPI_Comm> get_pencil_communicators(int nproc_x, int nproc_y) {
+            static std::map<std::pair<int, int>, std::pair<MPI_Comm, MPI_Comm>> comms;
+            auto key = std::make_pair(nproc_x, nproc_y);
+            auto it = comms.find(key);
+            if (it != comms.end())
+                return it->second;
+
+            MPI_Comm comm_cart;
+            int dims[2] = {nproc_x, nproc_y};
+            int periods[2] = {1, 1};
+            MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &comm_cart);
+            MPI_Comm comm_x, comm_y;
+            int remain_x[2] = {1, 0};
+            int remain_y[2] = {0, 1};
+            MPI_Cart_sub(comm_cart, remain_x, &comm_x);
+            MPI_Cart_sub(comm_cart, remain_y, &comm_y);
+            MPI_Comm_free(&comm_cart);
+            comms[key] = {comm_x, comm_y};
+            return comms[key];
+        }
+#endif
+
+        template <int N>
+        FFTWGridPencil<N>::FFTWGridPencil(int Nmesh, int n_extra_slices_left, int n_extra_slices_right, int nproc_x)
+            : Nmesh(Nmesh), n_extra_slices_left(n_extra_slices_left), n_extra_slices_right(n_extra_slices_right) {
+
+            // Set up the process grid
+#ifdef USE_MPI
+            int dims[2] = {nproc_x, 0};
+            MPI_Dims_create(FML::NTasks, 2, dims);
+            this->nproc_x = dims[0];
+            this->nproc_y = dims[1];
+            assert_mpi(this->nproc_x * this->nproc_y == FML::NTasks,
+                       "[FFTWGridPencil] The process grid does not match the number of tasks\n");
+            auto comms = get_pencil_communicators(this->nproc_x, this->nproc_y);
+            comm_x = comms.first;
+            comm_y = comms.second;
+            MPI_Comm_rank(comm_x, &iproc_x);
+            MPI_Comm_rank(comm_y, &iproc_y);
+#else
+            this->nproc_x = 1;
+            this->nproc_y = 1;
+            (void)nproc_x;
+#endif
+            assert_mpi(Nmesh % this->nproc_x == 0 and Nmesh % this->nproc_y == 0,
+                       "[FFTWGridPencil] The number of tasks in each direction of the process grid must divide Nmesh\n");
+
+            Local_nx = Nmesh / this->nproc_x;
+            Local_ny = Nmesh / this->nproc_y;
+            Local_x_start = iproc_x * Local_nx;
+            Local_y_start = iproc_y * Local_ny;
+            Local_nky = Nmesh / this->nproc_x;
+            Local_ky_start = iproc_x * Local_nky;
+            Local_nkz = nkz_of_task(iproc_y);
+            Local_kz_start = kz_start_of_task(iproc_y);
+
+            assert_mpi(n_extra_slices_left <= Local_nx and n_extra_slices_left <= Local_ny and
+                           n_extra_slices_right <= Local_nx and n_extra_slices_right <= Local_ny,
+                       "[FFTWGridPencil] Cannot have more extra slices than local slices\n");
+
+            Nx_alloc = n_extra_slices_left + Local_nx + n_extra_slices_right;
+            Ny_alloc = n_extra_slices_left + Local_ny + n_extra_slices_right;
+            Nz_alloc = 2 * (Nmesh / 2 + 1);
+
+            NmeshTotReal = IndexIntType(Local_nx) * IndexIntType(Local_ny) * Nmesh;
+            NmeshTotComplex = IndexIntType(Local_nky) * IndexIntType(Local_nkz) * Nmesh;
+
+            // We need room for the real grid, the intermediate y-pencils and the Fourier grid
+            IndexIntType nalloc = IndexIntType(Nx_alloc) * IndexIntType(Ny_alloc) * (Nz_alloc / 2);
+            nalloc = std::max(nalloc, IndexIntType(Local_nx) * IndexIntType(Local_nkz) * Nmesh);
+            nalloc = std::max(nalloc, NmeshTotComplex);
+
+            fourier_grid_raw.resize(nalloc);
+            add_memory_label("FFTWGridPencil");
+            std::fill(fourier_grid_raw.begin(), fourier_grid_raw.end(), 0.0);
+
+#ifdef DEBUG_FFTWGRID
+            if (FML::ThisTask == 0) {
+                std::cout << "[FFTWGridPencil] Creating grid Nmesh = " << Nmesh << " Process grid: " << this->nproc_x
+                          << " x " << this->nproc_y << " n_extra: (" << n_extra_slices_left << " + "
+                          << n_extra_slices_right << ")\n";
+            }
+#endif
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::add_memory_label([[maybe_unused]] std::string label) {
+            name = label;
+#ifdef MEMORY_LOGGING
+            FML::MemoryLog::get()->add_label(
+                fourier_grid_raw.data(), fourier_grid_raw.capacity() * sizeof(ComplexType), label);
+#endif
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::free() {
+            fourier_grid_raw.clear();
+            fourier_grid_raw.shrink_to_fit();
+            transpose_sendbuf.clear();
+            transpose_sendbuf.shrink_to_fit();
+            transpose_recvbuf.clear();
+            transpose_recvbuf.shrink_to_fit();
+#ifdef USE_FFTW
+            local_plans.reset();
+#endif
+        }
+
+        template <int N>
+        FloatType * FFTWGridPencil<N>::get_real_grid() {
+            return reinterpret_cast<FloatType *>(fourier_grid_raw.data()) +
+                   (IndexIntType(n_extra_slices_left) * Ny_alloc + n_extra_slices_left) * Nz_alloc;
+        }
+
+        template <int N>
+        ComplexType * FFTWGridPencil<N>::get_fourier_grid() {
+            return fourier_grid_raw.data();
+        }
+
+        template <int N>
+        RealRangePencil FFTWGridPencil<N>::get_real_range(int islice_begin, int islice_end) const {
+            if (islice_begin == 0 and islice_end == 0)
+                islice_end = Local_nx;
+
+#ifdef DEBUG_FFTWGRID
+            if (not grid_is_in_real_space) {
+                if (FML::ThisTask == 0)
+                    std::cout << "Warning: [FFTWGridPencil::get_real_range] The grid status is [Fourierspace]. Label: " +
+                                     name + "\n";
+            }
+#endif
+            const IndexIntType cellsperslice = IndexIntType(Local_ny) * Nmesh;
+            const IndexIntType row_skip = Nz_alloc - Nmesh;
+            const IndexIntType slice_skip = IndexIntType(Ny_alloc - Local_ny) * Nz_alloc;
+            return RealRangePencil(cellsperslice * islice_begin,
+                                   cellsperslice * islice_end,
+                                   IndexIntType(islice_begin) * Ny_alloc * Nz_alloc,
+                                   Nmesh,
+                                   Local_ny,
+                                   row_skip,
+                                   slice_skip);
+        }
+
+        template <int N>
+        FourierRange FFTWGridPencil<N>::get_fourier_range(int islice_begin, int islice_end) const {
+            if (islice_begin == 0 and islice_end == 0)
+                islice_end = Local_nky;
+
+#ifdef DEBUG_FFTWGRID
+            if (grid_is_in_real_space) {
+                if (FML::ThisTask == 0)
+                    std::cout << "Warning: [FFTWGridPencil::get_fourier_range] The grid status is [Realspace]. Label: " +
+                                     name + "\n";
+            }
+#endif
+            const IndexIntType cellsperslice = IndexIntType(Local_nkz) * Nmesh;
+            return FourierRange(cellsperslice * islice_begin, cellsperslice * islice_end);
+        }
+
+        template <int N>
+        IndexIntType FFTWGridPencil<N>::get_index_real(const std::array<int, N> & coord) const {
+#ifdef BOUNDSCHECK_FFTWGRID
+            assert_mpi(-n_extra_slices_left <= coord[0] and coord[0] < Local_nx + n_extra_slices_right and
+                           -n_extra_slices_left <= coord[1] and coord[1] < Local_ny + n_extra_slices_right and
+                           0 <= coord[2] and coord[2] < Nmesh,
+                       "[FFTWGridPencil::get_index_real] Bounds check failed\n");
+#endif
+            return (IndexIntType(coord[0]) * Ny_alloc + coord[1]) * Nz_alloc + coord[2];
+        }
+
+        template <int N>
+        std::array<int, N> FFTWGridPencil<N>::get_coord_from_index(const IndexIntType index_real) const {
+            // Shift the index so that its positive also for the extra slices
+            IndexIntType index =
+                index_real + (IndexIntType(n_extra_slices_left) * Ny_alloc + n_extra_slices_left) * Nz_alloc;
+            std::array<int, N> coord;
+            coord[2] = int(index % Nz_alloc);
+            index /= Nz_alloc;
+            coord[1] = int(index % Ny_alloc) - n_extra_slices_left;
+            coord[0] = int(index / Ny_alloc) - n_extra_slices_left;
+            return coord;
+        }
+
+        template <int N>
+        IndexIntType FFTWGridPencil<N>::get_index_fourier(const std::array<int, N> & coord) const {
+#ifdef BOUNDSCHECK_FFTWGRID
+            assert_mpi(0 <= coord[0] and coord[0] < Nmesh and 0 <= coord[1] and coord[1] < Local_nky and
+                           0 <= coord[2] and coord[2] < Local_nkz,
+                       "[FFTWGridPencil::get_index_fourier] Bounds check failed\n");
+#endif
+            return (IndexIntType(coord[1]) * Local_nkz + coord[2]) * Nmesh + coord[0];
+        }
+
+        template <int N>
+        std::array<int, N> FFTWGridPencil<N>::get_fourier_coord_from_index(const IndexIntType index) const {
+            std::array<int, N> coord;
+            coord[0] = int(index % Nmesh);
+            coord[2] = int((index / Nmesh) % Local_nkz);
+            coord[1] = int((index / Nmesh) / Local_nkz);
+            return coord;
+        }
+
+        template <int N>
+        FloatType FFTWGridPencil<N>::get_real(const std::array<int, N> & coord) const {
+            return get_real_from_index(get_index_real(coord));
+        }
+
+        template <int N>
+        FloatType FFTWGridPencil<N>::get_real_from_index(const IndexIntType index) const {
+            const FloatType * grid = reinterpret_cast<const FloatType *>(fourier_grid_raw.data()) +
+                                     (IndexIntType(n_extra_slices_left) * Ny_alloc + n_extra_slices_left) * Nz_alloc;
+            return grid[index];
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::set_real(const std::array<int, N> & coord, const FloatType value) {
+            get_real_grid()[get_index_real(coord)] = value;
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::set_real_from_index(const IndexIntType index, const FloatType value) {
+            get_real_grid()[index] = value;
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::add_real(const std::array<int, N> & coord, const FloatType value) {
+            get_real_grid()[get_index_real(coord)] += value;
+        }
+
+        template <int N>
+        ComplexType FFTWGridPencil<N>::get_fourier(const std::array<int, N> & coord) const {
+            return fourier_grid_raw[get_index_fourier(coord)];
+        }
+
+        template <int N>
+        ComplexType FFTWGridPencil<N>::get_fourier_from_index(const IndexIntType index) const {
+            return fourier_grid_raw[index];
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::set_fourier(const std::array<int, N> & coord, const ComplexType value) {
+            fourier_grid_raw[get_index_fourier(coord)] = value;
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::set_fourier_from_index(const IndexIntType index, const ComplexType value) {
+            fourier_grid_raw[index] = value;
+        }
+
+        template <int N>
+        std::array<double, N> FFTWGridPencil<N>::get_real_position(const std::array<int, N> & coord) const {
+#ifdef CELLCENTERSHIFTED
+            const constexpr double shift = 0.5;
+#else
+            const constexpr double shift = 0.0;
+#endif
+            std::array<double, N> xcoord;
+            xcoord[0] = (double(Local_x_start + coord[0]) + shift) / double(Nmesh);
+            xcoord[1] = (double(Local_y_start + coord[1]) + shift) / double(Nmesh);
+            xcoord[2] = (double(coord[2]) + shift) / double(Nmesh);
+            return xcoord;
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::get_fourier_wavevector_and_norm2_by_index(const IndexIntType index,
+                                                                          std::array<double, N> & kvec,
+                                                                          double & kmag2) const {
+            const double twopi = 2.0 * M_PI;
+            const int nover2 = Nmesh / 2;
+            auto ix = index % Nmesh;
+            auto iyz = index / Nmesh;
+            auto iz = (iyz % Local_nkz) + Local_kz_start;
+            auto iy = (iyz / Local_nkz) + Local_ky_start;
+            kvec[0] = twopi * double(ix <= nover2 ? ix : ix - Nmesh);
+            kvec[1] = twopi * double(iy <= nover2 ? iy : iy - Nmesh);
+            kvec[2] = twopi * double(iz <= nover2 ? iz : iz - Nmesh);
+            kmag2 = kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2];
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::get_fourier_wavevector_and_norm_by_index(const IndexIntType index,
+                                                                         std::array<double, N> & kvec,
+                                                                         double & kmag) const {
+            get_fourier_wavevector_and_norm2_by_index(index, kvec, kmag);
+            kmag = std::sqrt(kmag);
+        }
+
+        template <int N>
+        std::array<double, N> FFTWGridPencil<N>::get_fourier_wavevector_from_index(const IndexIntType index) const {
+            std::array<double, N> kvec;
+            double kmag2;
+            get_fourier_wavevector_and_norm2_by_index(index, kvec, kmag2);
+            return kvec;
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::fill_real_grid(const FloatType val) {
+            FloatType * begin = reinterpret_cast<FloatType *>(fourier_grid_raw.data());
+            FloatType * end = begin + IndexIntType(Nx_alloc) * Ny_alloc * Nz_alloc;
+            std::fill(begin, end, val);
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::fill_fourier_grid(const ComplexType val) {
+            std::fill(fourier_grid_raw.begin(), fourier_grid_raw.begin() + NmeshTotComplex, val);
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::fill_real_grid(std::function<FloatType(std::array<double, N> &)> & func) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                for (auto && real_index : get_real_range(islice, islice + 1)) {
+                    auto coord = get_coord_from_index(real_index);
+                    auto pos = get_real_position(coord);
+                    set_real_from_index(real_index, func(pos));
+                }
+            }
+            communicate_boundaries();
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::fill_fourier_grid(std::function<ComplexType(std::array<double, N> &)> & func) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nky; islice++) {
+                for (auto && fourier_index : get_fourier_range(islice, islice + 1)) {
+                    auto kvec = get_fourier_wavevector_from_index(fourier_index);
+                    set_fourier_from_index(fourier_index, func(kvec));
+                }
+            }
+        }
+
+#ifdef USE_FFTW
+        template <int N>
+        my_fftw_plan FFTWGridPencil<N>::get_local_plan(PlanType type, IndexIntType howmany) {
+            if (not local_plans or local_plans->data != fourier_grid_raw.data()) {
+                local_plans = std::make_shared<PencilPlans>();
+                local_plans->data = fourier_grid_raw.data();
+            }
+            auto key = std::make_pair(type, howmany);
+            auto it = local_plans->plans.find(key);
+            if (it != local_plans->plans.end())
+                return it->second;
+
+            std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());
+            my_fftw_iodim dim;
+            dim.n = Nmesh;
+            dim.is = 1;
+            dim.os = 1;
+            my_fftw_plan plan;
+            if (type == PlanType::r2c_z or type == PlanType::c2r_z) {
+                const bool forward = type == PlanType::r2c_z;
+                my_fftw_iodim howmanydim[2];
+                howmanydim[0].n = Local_nx;
+                howmanydim[1].n = Local_ny;
+                howmanydim[0].is = forward ? Ny_alloc * Nz_alloc : Ny_alloc * Nz_alloc / 2;
+                howmanydim[0].os = forward ? Ny_alloc * Nz_alloc / 2 : Ny_alloc * Nz_alloc;
+                howmanydim[1].is = forward ? Nz_alloc : Nz_alloc / 2;
+                howmanydim[1].os = forward ? Nz_alloc / 2 : Nz_alloc;
+                auto * real = get_real_grid();
+                auto * complex = reinterpret_cast<my_fftw_complex *>(real);
+                if (forward)
+                    plan = MAKE_PLAN_GURU_R2C(1, &dim, 2, howmanydim, real, complex, FFTW_ESTIMATE);
+                else
+                    plan = MAKE_PLAN_GURU_C2R(1, &dim, 2, howmanydim, complex, real, FFTW_ESTIMATE);
+            } else {
+                my_fftw_iodim howmanydim;
+                howmanydim.n = int(howmany);
+                howmanydim.is = Nmesh;
+                howmanydim.os = Nmesh;
+                auto * data = reinterpret_cast<my_fftw_complex *>(fourier_grid_raw.data());
+                const int sign = type == PlanType::dft_forward ? FFTW_FORWARD : FFTW_BACKWARD;
+                plan = MAKE_PLAN_GURU_DFT(1, &dim, 1, &howmanydim, data, data, sign, FFTW_ESTIMATE);
+            }
+#ifdef NO_FFTW_PLAN_CACHE
+            return plan;
+#else
+            local_plans->plans[key] = plan;
+            return plan;
+#endif
+        }
+#endif
+
+        //===================================================================================
+        // The local transforms. We use the guru interface to be able to do all the
+        // transforms in one go even with the extra slices in the real grid. With NO_FFTW_PLAN_CACHE
+        // the plans are made and destroyed for every transform, otherwise they are reused
+        //===================================================================================
+
+        template <int N>
+        void FFTWGridPencil<N>::fft_local_z([[maybe_unused]] bool forward) {
+#ifdef USE_FFTW
+            if (NmeshTotReal == 0)
+                return;
+            my_fftw_plan plan = get_local_plan(forward ? PlanType::r2c_z : PlanType::c2r_z, 0);
+            EXECUTE_FFT(plan);
+#ifdef NO_FFTW_PLAN_CACHE
+            std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());
+            DESTROY_PLAN(plan);
+#endif
+#endif
+        }
+
+        // 1D complex transforms over the last index of howmany contiguous pencils of length Nmesh
+        // stored at the start of the raw array
+        template <int N>
+        void FFTWGridPencil<N>::fft_local_complex([[maybe_unused]] bool forward,
+                                                  [[maybe_unused]] IndexIntType howmany) {
+#ifdef USE_FFTW
+            if (howmany == 0)
+                return;
+            my_fftw_plan plan = get_local_plan(forward ? PlanType::dft_forward : PlanType::dft_backward, howmany);
+            EXECUTE_FFT(plan);
+#ifdef NO_FFTW_PLAN_CACHE
+            std::lock_guard<std::recursive_mutex> guard(FFTWPlannerMutex());
+            DESTROY_PLAN(plan);
+#endif
+#endif
+        }
+
+        //===================================================================================
+        // The global transposes. Forward means going from real space to fourier space
+        //
+        // transpose_z_y: [lx][ly][Nkz] (z-pencils, stored with extra slices)
+        //            <-> [lx][lkz][Ny] (y-pencils, stored at the start of the raw array)
+        // Done between the tasks in the same y-row of the process grid
+        //
+        // transpose_y_x: [lx][lkz][Ny]  (y-pencils)
+        //            <-> [lky][lkz][Nx] (x-pencils, the Fourier grid)
+        // Done between the tasks in the same x-row of the process grid
+        //===================================================================================
+
+        template <int N>
+        void FFTWGridPencil<N>::transpose_z_y(bool forward) {
+            const IndexIntType zstride = Nz_alloc / 2;
+            ComplexType * zpencils = reinterpret_cast<ComplexType *>(get_real_grid());
+            ComplexType * ypencils = fourier_grid_raw.data();
+
+            // Number of cells in the block we exchange with each task
+            std::vector<IndexIntType> ncells_zpencil(nproc_y), ncells_ypencil(nproc_y);
+            std::vector<IndexIntType> offset_zpencil(nproc_y + 1, 0), offset_ypencil(nproc_y + 1, 0);
+            for (int q = 0; q < nproc_y; q++) {
+                ncells_zpencil[q] = IndexIntType(Local_nx) * Local_ny * nkz_of_task(q);
+                ncells_ypencil[q] = IndexIntType(Local_nx) * Local_ny * Local_nkz;
+                offset_zpencil[q + 1] = offset_zpencil[q] + ncells_zpencil[q];
+                offset_ypencil[q + 1] = offset_ypencil[q] + ncells_ypencil[q];
+            }
+            auto & sendbuf = transpose_sendbuf;
+            sendbuf.resize(forward ? offset_zpencil[nproc_y] : offset_ypencil[nproc_y]);
+
+            // Pack the data. Block q is stored as [lx][ly][nkz] in both cases
+            for (int q = 0; q < nproc_y; q++) {
+                if (forward) {
+                    const int nkz = nkz_of_task(q);
+                    const int kz0 = kz_start_of_task(q);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int ix = 0; ix < Local_nx; ix++)
+                        for (int iy = 0; iy < Local_ny; iy++)
+                            for (int iz = 0; iz < nkz; iz++)
+                                sendbuf[offset_zpencil[q] + (IndexIntType(ix) * Local_ny + iy) * nkz + iz] =
+                                    zpencils[(IndexIntType(ix) * Ny_alloc + iy) * zstride + kz0 + iz];
+                } else {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int ix = 0; ix < Local_nx; ix++)
+                        for (int iy = 0; iy < Local_ny; iy++)
+                            for (int iz = 0; iz < Local_nkz; iz++)
+                                sendbuf[offset_ypencil[q] + (IndexIntType(ix) * Local_ny + iy) * Local_nkz + iz] =
+                                    ypencils[(IndexIntType(ix) * Local_nkz + iz) * Nmesh + q * Local_ny + iy];
+                }
+            }
+
+            // Communicate
+#ifdef USE_MPI
+            auto & recvbuf = transpose_recvbuf;
+            recvbuf.resize(forward ? offset_ypencil[nproc_y] : offset_zpencil[nproc_y]);
+            std::vector<int> sendcount(nproc_y), recvcount(nproc_y), senddispl(nproc_y), recvdispl(nproc_y);
+            auto & nsend = forward ? ncells_zpencil : ncells_ypencil;
+            auto & nrecv = forward ? ncells_ypencil : ncells_zpencil;
+            auto & osend = forward ? offset_zpencil : offset_ypencil;
+            auto & orecv = forward ? offset_ypencil : offset_zpencil;
+            for (int q = 0; q < nproc_y; q++) {
+                sendcount[q] = int(nsend[q] * sizeof(ComplexType));
+                senddispl[q] = int(osend[q] * sizeof(ComplexType));
+                recvcount[q] = int(nrecv[q] * sizeof(ComplexType));
+                recvdispl[q] = int(orecv[q] * sizeof(ComplexType));
+            }
+            MPI_Alltoallv(sendbuf.data(),
+                          sendcount.data(),
+                          senddispl.data(),
+                          MPI_CHAR,
+                          recvbuf.data(),
+                          recvcount.data(),
+                          recvdispl.data(),
+                          MPI_CHAR,
+                          comm_y);
+#else
+            auto & recvbuf = sendbuf;
+#endif
+
+            // Unpack the data. The block from task q is stored as [lx][ly][nkz] where ly
+            // is the y-range of task q (forward) and nkz is the kz-range of task q (backward)
+            for (int q = 0; q < nproc_y; q++) {
+                if (forward) {
+                    const IndexIntType offset = offset_ypencil[q];
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int ix = 0; ix < Local_nx; ix++)
+                        for (int iy = 0; iy < Local_ny; iy++)
+                            for (int iz = 0; iz < Local_nkz; iz++)
+                                ypencils[(IndexIntType(ix) * Local_nkz + iz) * Nmesh + q * Local_ny + iy] =
+                                    recvbuf[offset + (IndexIntType(ix) * Local_ny + iy) * Local_nkz + iz];
+                } else {
+                    const int nkz = nkz_of_task(q);
+                    const int kz0 = kz_start_of_task(q);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int ix = 0; ix < Local_nx; ix++)
+                        for (int iy = 0; iy < Local_ny; iy++)
+                            for (int iz = 0; iz < nkz; iz++)
+                                zpencils[(IndexIntType(ix) * Ny_alloc + iy) * zstride + kz0 + iz] =
+                                    recvbuf[offset_zpencil[q] + (IndexIntType(ix) * Local_ny + iy) * nkz + iz];
+                }
+            }
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::transpose_y_x(bool forward) {
+            ComplexType * data = fourier_grid_raw.data();
+
+            // All blocks have the same size [lx][lkz][lky]
+            const IndexIntType ncells_block = IndexIntType(Local_nx) * Local_nkz * Local_nky;
+            auto & sendbuf = transpose_sendbuf;
+            sendbuf.resize(ncells_block * nproc_x);
+
+            // Pack the data
+            for (int q = 0; q < nproc_x; q++) {
+                const IndexIntType offset = q * ncells_block;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int ix = 0; ix < Local_nx; ix++)
+                    for (int iz = 0; iz < Local_nkz; iz++)
+                        for (int iy = 0; iy < Local_nky; iy++) {
+                            auto & cell = sendbuf[offset + (IndexIntType(ix) * Local_nkz + iz) * Local_nky + iy];
+                            if (forward)
+                                cell = data[(IndexIntType(ix) * Local_nkz + iz) * Nmesh + q * Local_nky + iy];
+                            else
+                                cell = data[(IndexIntType(iy) * Local_nkz + iz) * Nmesh + q * Local_nx + ix];
+                        }
+            }
+
+            // Communicate
+#ifdef USE_MPI
+            auto & recvbuf = transpose_recvbuf;
+            recvbuf.resize(ncells_block * nproc_x);
+            MPI_Alltoall(sendbuf.data(),
+                         int(ncells_block * sizeof(ComplexType)),
+                         MPI_CHAR,
+                         recvbuf.data(),
+                         int(ncells_block * sizeof(ComplexType)),
+                         MPI_CHAR,
+                         comm_x);
+#else
+            auto & recvbuf = sendbuf;
+#endif
+
+            // Unpack the data
+            for (int q = 0; q < nproc_x; q++) {
+                const IndexIntType offset = q * ncells_block;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int ix = 0; ix < Local_nx; ix++)
+                    for (int iz = 0; iz < Local_nkz; iz++)
+                        for (int iy = 0; iy < Local_nky; iy++) {
+                            auto & cell = recvbuf[offset + (IndexIntType(ix) * Local_nkz + iz) * Local_nky + iy];
+                            if (forward)
+                                data[(IndexIntType(iy) * Local_nkz + iz) * Nmesh + q * Local_nx + ix] = cell;
+                            else
+                                data[(IndexIntType(ix) * Local_nkz + iz) * Nmesh + q * Local_nky + iy] = cell;
+                        }
+            }
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::fftw_r2c() {
+#ifdef USE_FFTW
+
+#ifdef DEBUG_FFTWGRID
+            if (FML::ThisTask == 0) {
+                std::cout << "[FFTWGridPencil::fftw_r2c] Transforming grid to fourier space. Label: " + name + "\n";
+            }
+            if (not grid_is_in_real_space) {
+                if (FML::ThisTask == 0)
+                    std::cout << "Warning: [FFTWGridPencil::fftw_r2c] Transforming grid whose status is already "
+                                 "[Fourierspace]\n";
+            }
+#endif
+
+            fft_local_z(true);
+            transpose_z_y(true);
+            fft_local_complex(true, IndexIntType(Local_nx) * Local_nkz);
+            transpose_y_x(true);
+            fft_local_complex(true, IndexIntType(Local_nky) * Local_nkz);
+            grid_is_in_real_space = false;
+
+            // Normalize
+            const FloatType norm = 1.0 / std::pow(double(Nmesh), N);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nky; islice++) {
+                for (auto && fourier_index : get_fourier_range(islice, islice + 1)) {
+                    fourier_grid_raw[fourier_index] *= norm;
+                }
+            }
+#else
+            assert_mpi(false,
+                       "[FFTWGridPencil::fftw_r2c] Compiled without FFTW support so cannot take Fourier transforms\n");
+#endif
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::fftw_c2r() {
+#ifdef USE_FFTW
+
+#ifdef DEBUG_FFTWGRID
+            if (FML::ThisTask == 0) {
+                std::cout << "[FFTWGridPencil::fftw_c2r] Transforming grid to real space. Label: " + name + "\n";
+            }
+            if (grid_is_in_real_space) {
+                if (FML::ThisTask == 0)
+                    std::cout << "Warning: [FFTWGridPencil::fftw_c2r] Transforming grid whose status is already "
+                                 "[Realspace]\n";
+            }
+#endif
+
+            fft_local_complex(false, IndexIntType(Local_nky) * Local_nkz);
+            transpose_y_x(false);
+            fft_local_complex(false, IndexIntType(Local_nx) * Local_nkz);
+            transpose_z_y(false);
+            fft_local_z(false);
+            grid_is_in_real_space = true;
+#else
+            assert_mpi(false,
+                       "[FFTWGridPencil::fftw_c2r] Compiled without FFTW support so cannot take Fourier transforms\n");
+#endif
+        }
+
+        // We first send whole x-slices to the neighbors in x and then the y-slices (including
+        // the extra x-slices we just got) to the neighbors in y so that the corners also gets filled
+        template <int N>
+        void FFTWGridPencil<N>::communicate_boundaries() {
+            const int nleft = n_extra_slices_left;
+            const int nright = n_extra_slices_right;
+            if (nleft == 0 and nright == 0)
+                return;
+
+#ifdef DEBUG_FFTWGRID
+            if (FML::ThisTask == 0) {
+                std::cout << "[FFTWGridPencil::communicate_boundaries] Recieving " << nright << " slices from the right and "
+                          << nleft << " slices from the left in x and y. Label: " + name + "\n";
+            }
+#endif
+
+            FloatType * grid = get_real_grid();
+            const IndexIntType xslice = IndexIntType(Ny_alloc) * Nz_alloc;
+
+            // Exchange a buffer with the neighbors in a given row of the process grid
+            auto sendrecv = [&]([[maybe_unused]] std::vector<FloatType> & sendbuf,
+                                [[maybe_unused]] std::vector<FloatType> & recvbuf,
+                                [[maybe_unused]] bool send_to_left,
+                                [[maybe_unused]] bool x_direction) {
+#ifdef USE_MPI
+                MPI_Comm comm = x_direction ? comm_x : comm_y;
+                int nproc = x_direction ? nproc_x : nproc_y;
+                int iproc = x_direction ? iproc_x : iproc_y;
+                int left = (iproc - 1 + nproc) % nproc;
+                int right = (iproc + 1) % nproc;
+                MPI_Status status;
+                MPI_Sendrecv(sendbuf.data(),
+                             int(sendbuf.size() * sizeof(FloatType)),
+                             MPI_CHAR,
+                             send_to_left ? left : right,
+                             0,
+                             recvbuf.data(),
+                             int(recvbuf.size() * sizeof(FloatType)),
+                             MPI_CHAR,
+                             send_to_left ? right : left,
+                             0,
+                             comm,
+                             &status);
+#else
+                recvbuf = sendbuf;
+#endif
+            };
+
+            // The x-direction: whole slices (including the extra y-slices) are contiguous
+            FloatType * slices = grid - IndexIntType(nleft) * Nz_alloc;
+            for (int i = 0; i < nright; i++) {
+                std::vector<FloatType> sendbuf(slices + xslice * i, slices + xslice * (i + 1));
+                std::vector<FloatType> recvbuf(xslice);
+                sendrecv(sendbuf, recvbuf, true, true);
+                std::copy(recvbuf.begin(), recvbuf.end(), slices + xslice * (Local_nx + i));
+            }
+            for (int i = 0; i < nleft; i++) {
+                std::vector<FloatType> sendbuf(slices + xslice * (Local_nx - 1 - i), slices + xslice * (Local_nx - i));
+                std::vector<FloatType> recvbuf(xslice);
+                sendrecv(sendbuf, recvbuf, false, true);
+                std::copy(recvbuf.begin(), recvbuf.end(), slices + xslice * (-1 - i));
+            }
+
+            // The y-direction: pack the rows for all x-slices (including the extra ones)
+            auto pack_rows = [&](std::vector<FloatType> & buf, int iy, bool pack) {
+                for (int ix = -nleft; ix < Local_nx + nright; ix++) {
+                    FloatType * row = grid + xslice * ix + IndexIntType(iy) * Nz_alloc;
+                    FloatType * cell = buf.data() + IndexIntType(ix + nleft) * Nz_alloc;
+                    if (pack)
+                        std::copy(row, row + Nz_alloc, cell);
+                    else
+                        std::copy(cell, cell + Nz_alloc, row);
+                }
+            };
+            std::vector<FloatType> sendbuf(IndexIntType(Nx_alloc) * Nz_alloc);
+            std::vector<FloatType> recvbuf(IndexIntType(Nx_alloc) * Nz_alloc);
+            for (int i = 0; i < nright; i++) {
+                pack_rows(sendbuf, i, true);
+                sendrecv(sendbuf, recvbuf, true, false);
+                pack_rows(recvbuf, Local_ny + i, false);
+            }
+            for (int i = 0; i < nleft; i++) {
+                pack_rows(sendbuf, Local_ny - 1 - i, true);
+                sendrecv(sendbuf, recvbuf, false, false);
+                pack_rows(recvbuf, -1 - i, false);
+            }
+        }
+
+        template <int N>
+        bool FFTWGridPencil<N>::nan_in_grids() const {
+            for (size_t i = 0; i < fourier_grid_raw.size(); i++) {
+                if (fourier_grid_raw[i] != fourier_grid_raw[i]) {
+                    std::cout << "[FFTWGridPencil::nan_in_grids] Found NaN in grid. Index = " << i << "\n";
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        template <int N>
+        void FFTWGridPencil<N>::info() {
+            if (FML::ThisTask > 0)
+                return;
+            std::string status = grid_is_in_real_space ? "[Realspace]" : "[Fourierspace]";
+            double memory_in_mb = double(fourier_grid_raw.size() * sizeof(ComplexType)) / 1e6;
+            std::cout << "\n";
+            std::cout << "#=====================================================\n";
+            std::cout << "#\n";
+            std::cout << "# Info about FFTWGridPencil. Grid label: [" << name << "]\n";
+            std::cout << "# Status of grid: " << status << " NDIM: [" << N << "]\n";
+            std::cout << "# Grid has allocated " << memory_in_mb << " MB\n";
+            std::cout << "# Nmesh                  " << Nmesh << "\n";
+            std::cout << "# Process grid           " << nproc_x << " x " << nproc_y << "\n";
+            std::cout << "# Local_nx x Local_ny    " << Local_nx << " x " << Local_ny << "\n";
+            std::cout << "# Local_nky x Local_nkz  " << Local_nky << " x " << Local_nkz << "\n";
+            std::cout << "# n_extra_slices_left    " << n_extra_slices_left << "\n";
+            std::cout << "# n_extra_slices_right   " << n_extra_slices_right << "\n";
+            std::cout << "# NmeshTotReal           " << NmeshTotReal << "\n";
+            std::cout << "# NmeshTotComplex        " << NmeshTotComplex << "\n";
+            std::cout << "#\n";
+            std::cout << "#=====================================================\n";
+            std::cout << "\n";
+        }
+    } // namespace GRID
+} // namespace FML
+#endif
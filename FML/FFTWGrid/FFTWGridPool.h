@@ -0,0 +1,117 @@
+#ifndef FFTWGRIDPOOL_HEADER
+#define FFTWGRIDPOOL_HEADER
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/Global/Global.h>
+
+namespace FML {
+    namespace GRID {
+
+        //==========================================================================
+        ///
+        /// A pool of FFTWGrids for code that allocates and frees grids of the same shape over and
+        /// over again (e.g. computing power-spectra or density fields every timestep). Grids that
+        /// are given back to the pool are kept and handed out again on the next checkout of the
+        /// same shape (Nmesh, n_extra_x_slices_left, n_extra_x_slices_right) so we don't touch the
+        /// allocator or have to first-touch (page fault) the memory again.
+        ///
+        /// The pool is disabled by default, in which case checkout just makes a new grid and give_back
+        /// frees it so the memory footprint is the same as without the pool. Enable it with
+        /// FFTWGridPool<N>::get().set_enabled(true) for long runs where you can afford to keep the grids.
+        ///
+        /// NB: a grid from the pool contains whatever was in it when it was given back so you must
+        /// set all the cells you use (the status is reset to real space and the normal Fourier layout).
+        ///
+        /// Example use:
+        ///
+        ///   auto & pool = FFTWGridPool<N>::get();
+        ///   FFTWGrid<N> grid = pool.checkout(Nmesh, nleft, nright, "label");
+        ///   ...
+        ///   pool.give_back(std::move(grid));
+        ///
+        //==========================================================================
+        template <int N, class T = FloatType>
+        class FFTWGridPool {
+          public:
+            static FFTWGridPool & get() {
+                static FFTWGridPool instance;
+                return instance;
+            }
+
+            /// Get a grid (from the pool if we have one with the right shape, otherwise a new one)
+            FFTWGrid<N, T> checkout(int Nmesh,
+                                    int n_extra_x_slices_left = 0,
+                                    int n_extra_x_slices_right = 0,
+                                    std::string label = "") {
+                auto key = std::make_tuple(Nmesh, n_extra_x_slices_left, n_extra_x_slices_right);
+                auto it = grids.find(key);
+                if (it == grids.end() or it->second.empty()) {
+                    FFTWGrid<N, T> grid(Nmesh, n_extra_x_slices_left, n_extra_x_slices_right);
+                    grid.add_memory_label(label);
+                    return grid;
+                }
+                FFTWGrid<N, T> grid = std::move(it->second.back());
+                it->second.pop_back();
+                grid.set_grid_status_real(true);
+                grid.set_fourier_layout_transposed(false);
+                grid.add_memory_label(label);
+                return grid;
+            }
+
+            /// Give a grid back to the pool (or free it if the pool is disabled or full)
+            void give_back(FFTWGrid<N, T> && grid) {
+                if (not enabled or not grid) {
+                    grid.free();
+                    return;
+                }
+                auto key = std::make_tuple(
+                    grid.get_nmesh(), grid.get_n_extra_slices_left(), grid.get_n_extra_slices_right());
+                auto & pool = grids[key];
+                if (int(pool.size()) >= max_grids_per_shape) {
+                    grid.free();
+                    return;
+                }
+                grid.add_memory_label("FFTWGridPool::unused");
+                pool.push_back(std::move(grid));
+            }
+
+            /// Free all the grids in the pool
+            void clear() { grids.clear(); }
+
+            /// Turn the pool on or off. Turning it off frees the grids in the pool
+            void set_enabled(bool enable) {
+                enabled = enable;
+                if (not enabled)
+                    clear();
+            }
+            bool get_enabled() const { return enabled; }
+
+            /// The maximum number of unused grids we keep of each shape
+            void set_max_grids_per_shape(int max_grids) { max_grids_per_shape = max_grids; }
+
+            /// The number of unused grids in the pool
+            size_t size() const {
+                size_t n = 0;
+                for (auto & p : grids)
+                    n += p.second.size();
+                return n;
+            }
+
+          private:
+            FFTWGridPool() = default;
+            FFTWGridPool(const FFTWGridPool &) = delete;
+            FFTWGridPool & operator=(const FFTWGridPool &) = delete;
+
+            bool enabled{false};
+            int max_grids_per_shape{2};
+            std::map<std::tuple<int, int, int>, std::vector<FFTWGrid<N, T>>> grids{};
+        };
+
+    } // namespace GRID
+} // namespace FML
+#endif
@@ -0,0 +1,139 @@
+#ifndef FFTWPLANCACHE_HEADER
+#define FFTWPLANCACHE_HEADER
+#include <iostream>
+#include <map>
+#include <tuple>
+
+#include <FML/Global/Global.h>
+
+namespace FML {
+    namespace GRID {
+
+        // Include type definitions
+#include "FFTWGlobal.h"
+
+#ifdef USE_FFTW
+
+        //==========================================================================
+        /// The things that determine if a FFTW plan can be reused for a grid.
+        /// FFTWGrid only does in-place transforms with the fiducial padding 2*(Nmesh/2+1)
+        /// so the shape is given by (Ndim, Nmesh). A plan can only be executed on new arrays
+        /// with the same alignment as the arrays it was made for. The precision is given by
+        /// the size of the floating point type. Batched transforms (fftw_r2c_batched / fftw_c2r_batched)
+        /// transform howmany interleaved fields with one plan.
+        //==========================================================================
+        struct FFTWPlanKey {
+            int float_size{int(sizeof(FloatType))};
+            int ndim{0};
+            int nmesh{0};
+            bool forward{true};
+            bool transposed{false};
+            int nthreads{1};
+            int alignment{0};
+            unsigned int planner_flag{FFTW_ESTIMATE};
+            int howmany{1};
+
+            bool operator<(const FFTWPlanKey & rhs) const {
+                return std::tie(
+                           float_size, ndim, nmesh, forward, transposed, nthreads, alignment, planner_flag, howmany) <
+                       std::tie(rhs.float_size,
+                                rhs.ndim,
+                                rhs.nmesh,
+                                rhs.forward,
+                                rhs.transposed,
+                                rhs.nthreads,
+                                rhs.alignment,
+                                rhs.planner_flag,
+                                rhs.howmany);
+            }
+        };
+
+        //==========================================================================
+        ///
+        /// Process-wide cache of the FFTW plans made by FFTWGrid. The first transform of a given
+        /// shape makes the plan and all later transforms (of any grid with the same shape) reuse it
+        /// so we only pay for planning once. This is what makes FFTW_MEASURE (or better) affordable:
+        /// set the planner flag with set_planner_flag (or use FFTWGrid::create_wisdow) and load
+        /// wisdom at startup with FFTWGrid::load_wisdow to avoid even the first measurement.
+        ///
+        /// The plans are stored type-erased (together with how to destroy them) so the same cache holds plans of
+        /// all precisions. The plans are destroyed when FFTW is finalized at the end of the program or when clear
+        /// is called.
+        /// Not thread-safe (just as the FFTW planner) so don't transform from inside parallel regions.
+        ///
+        /// Compile-time defines:
+        ///
+        ///   NO_FFTW_PLAN_CACHE : Make and destroy a FFTW_ESTIMATE plan for every transform in FFTWGrid
+        ///
+        //==========================================================================
+        class FFTWPlanCache {
+          public:
+            static FFTWPlanCache & get() {
+                // Never destroyed: finalize_fftw (called from a static destructor) clears it at the end of the program
+                static FFTWPlanCache * instance = new FFTWPlanCache;
+                return *instance;
+            }
+
+            /// Look up a plan. Returns nullptr if we don't have it
+            template <class T>
+            typename FFTWTraits<T>::plan find(const FFTWPlanKey & key) const {
+                auto it = plans.find(key);
+                return it == plans.end() ? nullptr : static_cast<typename FFTWTraits<T>::plan>(it->second.plan);
+            }
+
+            /// Add a plan to the cache. The cache takes ownership of the plan
+            template <class T>
+            void add(const FFTWPlanKey & key, typename FFTWTraits<T>::plan plan) {
+                auto it = plans.find(key);
+                if (it != plans.end())
+                    it->second.destroy(it->second.plan);
+                auto destroy = [](void * p) {
+                    FFTWTraits<T>::destroy_plan(static_cast<typename FFTWTraits<T>::plan>(p));
+                };
+                plans[key] = {plan, destroy};
+            }
+
+            /// Destroy all the plans we have
+            void clear() {
+                for (auto & p : plans)
+                    p.second.destroy(p.second.plan);
+                plans.clear();
+            }
+
+            /// The planner flag used for new plans (FFTW_ESTIMATE, FFTW_MEASURE, FFTW_PATIENT, FFTW_EXHAUSTIVE)
+            void set_planner_flag(unsigned int flag) { planner_flag = flag; }
+            unsigned int get_planner_flag() const { return planner_flag; }
+
+            /// Number of plans in the cache
+            size_t size() const { return plans.size(); }
+
+            void info() const {
+                if (FML::ThisTask == 0) {
+                    std::cout << "# FFTWPlanCache has " << plans.size() << " plans. Planner flag: " << planner_flag
+                              << "\n";
+                    for (auto & p : plans) {
+                        std::cout << "#   Bytes per float: " << p.first.float_size << " Ndim: " << p.first.ndim
+                                  << " Nmesh: " << p.first.nmesh << (p.first.forward ? " r2c" : " c2r")
+                                  << (p.first.transposed ? " [Transposed]" : "") << " Nthreads: " << p.first.nthreads
+                                  << " Alignment: " << p.first.alignment << " Flag: " << p.first.planner_flag
+                                  << " Howmany: " << p.first.howmany << "\n";
+                    }
+                }
+            }
+
+          private:
+            FFTWPlanCache() = default;
+            FFTWPlanCache(const FFTWPlanCache &) = delete;
+            FFTWPlanCache & operator=(const FFTWPlanCache &) = delete;
+
+            struct CachedPlan {
+                void * plan;
+                void (*destroy)(void *);
+            };
+            std::map<FFTWPlanKey, CachedPlan> plans{};
+            unsigned int planner_flag{FFTW_ESTIMATE};
+        };
+#endif
+    } // namespace GRID
+} // namespace FML
+#endif
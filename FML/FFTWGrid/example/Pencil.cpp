@@ -0,0 +1,69 @@
+#include <FML/FFTWGrid/FFTWGridPencil.h>
+
+template <int N>
+using FFTWGridPencil = FML::GRID::FFTWGridPencil<N>;
+
+int main() {
+
+    //===================================================
+    //
+    // The grid is split among the tasks in both the
+    // x and the y direction (NTasks = P0 x P1) so we can
+    // use more tasks than Nmesh. Each task has a main
+    // pencil and extra slices in x and y that is used for
+    // having the boundary when doing operations. These
+    // cells are filled by running communicate_boundaries()
+    //
+    //===================================================
+
+    const int Ndim = 3;
+    const int Nmesh = 24;
+    const int nleft = 1;
+    const int nright = 1;
+    FFTWGridPencil<Ndim> grid(Nmesh, nleft, nright);
+    grid.info();
+
+    // The solution of D^2f = source with source given below
+    auto solution = [&](std::array<double, Ndim> & pos) -> double {
+        return std::sin(2.0 * M_PI * (pos[0] + 2.0 * pos[1])) + std::cos(2.0 * M_PI * (3.0 * pos[2] - pos[1]));
+    };
+    auto source = [&](std::array<double, Ndim> & pos) -> double {
+        const double twopi2 = 4.0 * M_PI * M_PI;
+        return -5.0 * twopi2 * std::sin(2.0 * M_PI * (pos[0] + 2.0 * pos[1])) -
+               10.0 * twopi2 * std::cos(2.0 * M_PI * (3.0 * pos[2] - pos[1]));
+    };
+
+    // Set the source
+    for (auto && index : grid.get_real_range()) {
+        auto coord = grid.get_coord_from_index(index);
+        auto pos = grid.get_real_position(coord);
+        grid.set_real_from_index(index, source(pos));
+    }
+
+    // Solve the Poisson equation in Fourier space
+    grid.fftw_r2c();
+    for (auto && index : grid.get_fourier_range()) {
+        std::array<double, Ndim> kvec;
+        double kmag2;
+        grid.get_fourier_wavevector_and_norm2_by_index(index, kvec, kmag2);
+        auto value = grid.get_fourier_from_index(index);
+        grid.set_fourier_from_index(index, kmag2 > 0.0 ? -value / FML::GRID::FloatType(kmag2) : 0.0);
+    }
+    grid.fftw_c2r();
+
+    // Fill the extra slices and compare with the analytical solution also there
+    grid.communicate_boundaries();
+    double maxerror = 0.0;
+    for (int ix = -nleft; ix < grid.get_local_nx() + nright; ix++) {
+        for (int iy = -nleft; iy < grid.get_local_ny() + nright; iy++) {
+            for (int iz = 0; iz < Nmesh; iz++) {
+                std::array<int, Ndim> coord{ix, iy, iz};
+                auto pos = grid.get_real_position(coord);
+                maxerror = std::max(maxerror, std::abs(grid.get_real(coord) - solution(pos)));
+            }
+        }
+    }
+    FML::MaxOverTasks(&maxerror);
+    if (FML::ThisTask == 0)
+        std::cout << "Max error compared to the analytical solution: " << maxerror << "\n";
+}
@@ -1,4 +1,5 @@
 #include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/FFTWGrid/FFTWGridPencil.h>
 #include <numeric>
 
 //===================================================
@@ -11,12 +12,32 @@ using FFTWGrid = FML::GRID::FFTWGrid<N>;
 template <int N>
 void RunTests();
 
+template <int N>
+void RunMixedPrecisionTests();
+
+template <int N>
+void RunBatchedTests();
+
+void RunPencilTests();
+
 int main() {
 
     // Run some unit tests
     RunTests<2>();
     RunTests<3>();
     RunTests<4>();
+
+    // Single precision grids next to the default precision ones. With MPI this
+    // checks that the float library has been initialized (fftwf_mpi_init)
+    RunMixedPrecisionTests<2>();
+    RunMixedPrecisionTests<3>();
+
+    // Batched transforms must agree with transforming the grids one by one
+    RunBatchedTests<2>();
+    RunBatchedTests<3>();
+
+    // Pencil grids reuse their plans and buffers between transforms
+    RunPencilTests();
     return 0;
 }
 
@@ -125,6 +146,17 @@ void RunTests() {
         assert(std::fabs(value1 - value2) < 1e-10);
     }
 
+    // Test dumping to file quantized (16 bits) and reading it back in
+    for (auto real_index : grid2.get_real_range())
+        grid2.set_real_from_index(real_index, std::sin(0.1 * real_index));
+    grid2.dump_to_file_quantized("output_grid_quantized", 16);
+    grid.load_from_file_quantized("output_grid_quantized");
+    for (auto real_index : grid.get_real_range()) {
+        auto value1 = grid.get_real_from_index(real_index);
+        auto value2 = grid2.get_real_from_index(real_index);
+        assert(std::fabs(value1 - value2) < 2.0 / 65535.0);
+    }
+
     // Test fourier transforms
     grid.fill_real_grid(0.0);
 
@@ -175,3 +207,132 @@ void RunTests() {
     if (FML::ThisTask == 0)
         std::cout << "Done\n" << std::flush;
 }
+
+template <int N>
+void RunMixedPrecisionTests() {
+
+    if (FML::ThisTask == 0)
+        std::cout << "Running mixed precision tests N = " << N << "\n";
+
+    const int Nmesh = FML::NTasks < 10 ? 4 * FML::NTasks : 2 * FML::NTasks;
+    FFTWGrid<N> grid(Nmesh);
+    FML::GRID::FFTWGrid<N, float> grid_float(Nmesh);
+    assert(grid_float.get_local_nx() == grid.get_local_nx());
+    assert(grid_float.get_local_x_start() == grid.get_local_x_start());
+
+    for (auto && index : grid.get_real_range()) {
+        auto coord = grid.get_coord_from_index(index);
+        auto value = 0.5 * FML::uniform_random() - 1.0;
+        grid.set_real(coord, value);
+        grid_float.set_real(coord, float(value));
+    }
+
+    // The forward transform must agree with the default precision one
+    grid.fftw_r2c();
+    grid_float.fftw_r2c();
+    for (auto && index : grid.get_fourier_range()) {
+        auto coord = grid.get_fourier_coord_from_index(index);
+        auto value = grid.get_fourier(coord);
+        auto value_float = grid_float.get_fourier(coord);
+        assert(std::abs(std::complex<double>(value_float) - std::complex<double>(value)) < 1e-5);
+    }
+
+    // ...and so must the transform back
+    grid.fftw_c2r();
+    grid_float.fftw_c2r();
+    for (auto && index : grid.get_real_range()) {
+        auto coord = grid.get_coord_from_index(index);
+        assert(std::fabs(grid_float.get_real(coord) - grid.get_real(coord)) < 1e-5);
+    }
+
+    if (FML::ThisTask == 0)
+        std::cout << "Done\n" << std::flush;
+}
+
+template <int N>
+void RunBatchedTests() {
+
+    if (FML::ThisTask == 0)
+        std::cout << "Running batched tests N = " << N << "\n";
+
+    const int Nmesh = FML::NTasks < 10 ? 4 * FML::NTasks : 2 * FML::NTasks;
+    const int ngrids = 3;
+    std::vector<FFTWGrid<N>> grids(ngrids, FFTWGrid<N>(Nmesh));
+    for (auto & grid : grids)
+        for (auto && index : grid.get_real_range())
+            grid.set_real_from_index(index, 0.5 * FML::uniform_random() - 1.0);
+    std::vector<FFTWGrid<N>> grids_one_by_one = grids;
+
+    auto & batch = FML::GRID::FFTWBatchBuffer<FML::GRID::FloatType>::get();
+    batch.set_enabled(true);
+
+    // Forward
+    FML::GRID::fftw_r2c_batched(grids);
+    for (auto & grid : grids_one_by_one)
+        grid.fftw_r2c();
+    for (int m = 0; m < ngrids; m++) {
+        assert(not grids[m].get_grid_status_real());
+        for (auto && index : grids[m].get_fourier_range())
+            assert(std::abs(grids[m].get_fourier_from_index(index) -
+                            grids_one_by_one[m].get_fourier_from_index(index)) < 1e-10);
+    }
+
+    // Backward. Doing it again should reuse the plans
+    FML::GRID::fftw_c2r_batched(grids);
+    const size_t nplans = FML::GRID::FFTWPlanCache::get().size();
+    FML::GRID::fftw_r2c_batched(grids);
+    FML::GRID::fftw_c2r_batched(grids);
+    assert(FML::GRID::FFTWPlanCache::get().size() == nplans);
+    for (auto & grid : grids_one_by_one)
+        grid.fftw_c2r();
+    for (int m = 0; m < ngrids; m++) {
+        assert(grids[m].get_grid_status_real());
+        for (auto && index : grids[m].get_real_range())
+            assert(std::fabs(grids[m].get_real_from_index(index) - grids_one_by_one[m].get_real_from_index(index)) <
+                   1e-10);
+    }
+    batch.set_enabled(false);
+
+    if (FML::ThisTask == 0)
+        std::cout << "Done\n" << std::flush;
+}
+
+void RunPencilTests() {
+
+    if (FML::ThisTask == 0)
+        std::cout << "Running pencil tests\n";
+
+    const int Nmesh = 4 * FML::NTasks;
+    FML::GRID::FFTWGridPencil<3> grid(Nmesh, 1, 1);
+    std::function<FML::GRID::FloatType(std::array<double, 3> &)> mode = [](std::array<double, 3> & pos) {
+        return std::cos(2.0 * M_PI * (pos[0] + pos[1] + pos[2]));
+    };
+    grid.fill_real_grid(mode);
+    auto original = grid;
+
+    // The same transforms several times (the second time with the plans and buffers from the first)
+    for (int i = 0; i < 2; i++) {
+        grid.fftw_r2c();
+        for (auto && index : grid.get_fourier_range()) {
+            auto kvec = grid.get_fourier_wavevector_from_index(index);
+            const bool is_mode = std::fabs(kvec[0] - 2.0 * M_PI) < 1e-6 and std::fabs(kvec[1] - 2.0 * M_PI) < 1e-6 and
+                                 std::fabs(kvec[2] - 2.0 * M_PI) < 1e-6;
+            assert(std::fabs(std::abs(grid.get_fourier_from_index(index)) - (is_mode ? 0.5 : 0.0)) < 1e-10);
+        }
+        grid.fftw_c2r();
+    }
+
+    // A copy has its own array so it cannot use the plans of the grid it was copied from
+    auto copy = grid;
+    copy.fftw_r2c();
+    copy.fftw_c2r();
+    grid.fftw_r2c();
+    grid.fftw_c2r();
+    for (auto && index : grid.get_real_range()) {
+        assert(std::fabs(grid.get_real_from_index(index) - original.get_real_from_index(index)) < 1e-10);
+        assert(std::fabs(copy.get_real_from_index(index) - original.get_real_from_index(index)) < 1e-10);
+    }
+
+    if (FML::ThisTask == 0)
+        std::cout << "Done\n" << std::flush;
+}
@@ -1,9 +1,24 @@
 #include "FileUtils.h"
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <fstream>
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <stdexcept>
+
+#ifdef USE_OMP
+#include <omp.h>
+#endif
+
+#if defined(__unix__) || defined(__unix) || defined(unix) || (defined(__APPLE__) && defined(__MACH__))
+#define FILEUTILS_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace FML {
     namespace FILEUTILS {
@@ -171,6 +186,185 @@ namespace FML {
             return result;
         }
 
+        // The content of a file in memory. Memory mapped if we can, otherwise read into a buffer
+        class FileContent {
+          private:
+            const char * data{nullptr};
+            size_t nbytes{0};
+            std::string buffer;
+#ifdef FILEUTILS_HAVE_MMAP
+            void * mapped{nullptr};
+#endif
+
+          public:
+            FileContent(const std::string & filename) {
+#ifdef FILEUTILS_HAVE_MMAP
+                int fd = ::open(filename.c_str(), O_RDONLY);
+                if (fd >= 0) {
+                    struct stat st;
+                    if (::fstat(fd, &st) == 0 and st.st_size > 0) {
+                        nbytes = size_t(st.st_size);
+                        mapped = ::mmap(nullptr, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+                        if (mapped == MAP_FAILED) {
+                            mapped = nullptr;
+                        } else {
+                            ::madvise(mapped, nbytes, MADV_SEQUENTIAL);
+                            data = static_cast<const char *>(mapped);
+                        }
+                    }
+                    ::close(fd);
+                    if (mapped or nbytes == 0)
+                        return;
+                }
+#endif
+                std::ifstream fp(filename.c_str(), std::ios::binary);
+                if (!fp) {
+                    throw std::runtime_error("[read_regular_ascii_columns] Failed to open [" + filename + "]\n");
+                }
+                buffer.assign(std::istreambuf_iterator<char>(fp), std::istreambuf_iterator<char>());
+                data = buffer.data();
+                nbytes = buffer.size();
+            }
+            FileContent(const FileContent &) = delete;
+            FileContent & operator=(const FileContent &) = delete;
+            ~FileContent() {
+#ifdef FILEUTILS_HAVE_MMAP
+                if (mapped)
+                    ::munmap(mapped, nbytes);
+#endif
+            }
+            const char * begin() const { return data; }
+            const char * end() const { return data + nbytes; }
+        };
+
+        DVector2D read_regular_ascii_columns(std::string filename,
+                                             int ncols,
+                                             std::vector<int> cols_to_keep,
+                                             int nskip) {
+
+            // Sanity check
+            if (cols_to_keep.size() == 0 or nskip < 0 or ncols <= 0)
+                throw std::runtime_error("[read_regular_ascii_columns] Invalid arguments\n");
+            for (auto & i : cols_to_keep)
+                if (i >= ncols or i < 0)
+                    throw std::runtime_error("[read_regular_ascii_columns] Column to keep is out of range\n");
+
+            // Where to store each column (-1 if we don't keep it)
+            const int ntokeep = int(cols_to_keep.size());
+            std::vector<int> store_in(ncols, -1);
+            for (int i = 0; i < ntokeep; i++)
+                store_in[cols_to_keep[i]] = i;
+
+            FileContent file(filename);
+            const char * begin = file.begin();
+            const char * end = file.end();
+
+            // Skip the header lines
+            for (int i = 0; i < nskip and begin < end; i++) {
+                begin = std::find(begin, end, '\n');
+                if (begin < end)
+                    begin++;
+            }
+
+            // Split the file into chunks that start at the beginning of a line
+#ifdef USE_OMP
+            const int nthreads = omp_get_max_threads();
+#else
+            const int nthreads = 1;
+#endif
+            const size_t nbytes = size_t(end - begin);
+            const int nchunks = int(std::max(size_t(1), std::min(size_t(4 * nthreads), nbytes / (1 << 16))));
+            std::vector<const char *> chunk_start(nchunks + 1, end);
+            chunk_start[0] = begin;
+            for (int i = 1; i < nchunks; i++) {
+                const char * p = std::max(begin + nbytes / nchunks * i, chunk_start[i - 1]);
+                p = std::find(p, end, '\n');
+                chunk_start[i] = p < end ? p + 1 : end;
+            }
+
+            // Parse each chunk into its own columns
+            auto is_space = [](char c) { return c == ' ' or c == '\t' or c == '\r' or c == ','; };
+            std::vector<DVector2D> chunk_data(nchunks, DVector2D(ntokeep));
+            std::vector<std::string> chunk_error(nchunks);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+            for (int ichunk = 0; ichunk < nchunks; ichunk++) {
+                auto & columns = chunk_data[ichunk];
+                const char * p = chunk_start[ichunk];
+                const char * chunk_end = chunk_start[ichunk + 1];
+                const size_t nestimate = size_t(chunk_end - p) / (8 * ncols + 1);
+                for (auto & col : columns)
+                    col.reserve(nestimate);
+
+                while (p < chunk_end) {
+                    const char * line_end = std::find(p, chunk_end, '\n');
+                    while (p < line_end and is_space(*p))
+                        p++;
+
+                    // Skip empty lines and comments
+                    if (p == line_end or *p == '#' or *p == '!' or *p == '/') {
+                        p = line_end + 1;
+                        continue;
+                    }
+
+                    int count = 0;
+                    while (p < line_end) {
+                        if (count == ncols) {
+                            count++;
+                            break;
+                        }
+                        const int icol = store_in[count];
+                        if (icol >= 0) {
+                            if (*p == '+')
+                                p++;
+                            double value;
+                            auto res = std::from_chars(p, line_end, value);
+                            if (res.ec != std::errc()) {
+                                chunk_error[ichunk] = "Failed to parse [" + std::string(p, line_end) + "]";
+                                break;
+                            }
+                            columns[icol].push_back(value);
+                            p = res.ptr;
+                        } else {
+                            while (p < line_end and not is_space(*p))
+                                p++;
+                        }
+                        count++;
+                        while (p < line_end and is_space(*p))
+                            p++;
+                    }
+                    if (not chunk_error[ichunk].empty())
+                        break;
+                    if (count != ncols) {
+                        chunk_error[ichunk] = "Found ncols " + std::to_string(count) +
+                                              " which differs from specified " + std::to_string(ncols);
+                        break;
+                    }
+                    p = line_end + 1;
+                }
+            }
+            for (auto & error : chunk_error)
+                if (not error.empty())
+                    throw std::runtime_error("[read_regular_ascii_columns] " + filename + ": " + error + "\n");
+
+            // Gather the chunks
+            std::vector<size_t> offset(nchunks + 1, 0);
+            for (int i = 0; i < nchunks; i++)
+                offset[i + 1] = offset[i] + chunk_data[i][0].size();
+            DVector2D result(ntokeep, DVector(offset[nchunks]));
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+            for (int i = 0; i < nchunks; i++) {
+                for (int icol = 0; icol < ntokeep; icol++) {
+                    std::copy(chunk_data[i][icol].begin(), chunk_data[i][icol].end(), result[icol].begin() + offset[i]);
+                    DVector().swap(chunk_data[i][icol]);
+                }
+            }
+            return result;
+        }
+
         /// Read a regular file and extract two columns (numbering starting with 0)
         std::pair<DVector, DVector> read_file_and_extract_two_columns(std::string filename, int col1, int col2) {
             auto data = loadtxt(filename);
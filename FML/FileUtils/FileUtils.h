@@ -33,6 +33,15 @@ namespace FML {
                                                 double fraction_to_read = 1.0,
                                                 unsigned int randomSeed = 1234);
 
+        /// Fast version of read_regular_ascii for large files. The file is memory mapped (if possible) and split
+        /// into chunks of lines that are parsed in parallel (OpenMP) with std::from_chars. Only the columns in
+        /// cols_to_keep are converted. Returns the data as columns, i.e. result[i][j] is column cols_to_keep[i] of
+        /// row j. Empty lines and lines starting with #, ! or / after the header are skipped
+        DVector2D read_regular_ascii_columns(std::string filename,
+                                             int ncols,
+                                             std::vector<int> cols_to_keep,
+                                             int nskip);
+
         /// Similar to pythons loadtxt
         DVector2D loadtxt(std::string filename, int nreserve_rows = 1, int nreserve_cols = 1);
 
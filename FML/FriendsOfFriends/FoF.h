@@ -2,12 +2,18 @@
 #define FOF_HEADER
 #include <FML/FriendsOfFriends/FoFBinning.h>
 #include <FML/Global/Global.h>
+#include <FML/MPIParticles/MPIParticles.h>
+#include <FML/ParticlesInBoxes/NeighborGrid.h>
 #include <FML/Timing/Timings.h>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <iostream>
 #include <iterator>
 #include <map>
+#include <numeric>
+#include <tuple>
 
 namespace FML {
 
@@ -16,9 +22,6 @@ namespace FML {
     //========================================================================================
     namespace FOF {
 
-        // Memory for particlegrid. Allocated in ParticlesToCells and freed in FriendsOfFriends
-        size_t * particlegriddata{nullptr};
-
         /// If a particle belongs to no FoF group it is given this FoF ID
         const constexpr size_t no_FoF_ID = std::numeric_limits<size_t>::max();
 
@@ -34,9 +37,103 @@ namespace FML {
         /// Records timings of the FoF search
         Timings foftimer;
 
+        //========================================================================================
+        ///
+        /// The ids (get_id) of the particles in the FoF groups, ordered by group: the particles in group i
+        /// (LocalFoFGroups[i]) have the ids ids[offsets[i]], ..., ids[offsets[i+1]-1] in the order they were
+        /// added to the group. This is filled in as the groups are gathered so we don't have to store the ids
+        /// in the halos (e.g. for merger trees).
+        ///
+        //========================================================================================
+        class FoFMembers {
+          public:
+            std::vector<std::int64_t> ids;
+            std::vector<size_t> offsets{0};
+
+            size_t get_ngroups() const { return offsets.size() - 1; }
+            size_t get_np(size_t i) const { return offsets[i + 1] - offsets[i]; }
+            const std::int64_t * group_begin(size_t i) const { return ids.data() + offsets[i]; }
+            const std::int64_t * group_end(size_t i) const { return ids.data() + offsets[i + 1]; }
+
+            /// Write the members of the groups on all tasks to one file (in parallel with MPI-IO). The file has
+            /// uint64 ngroups, uint64 nids, then (uint64 id, uint64 np) for every group and then the nids int64
+            /// particle ids. The groups are in the order of the tasks which is the order of the FoF ids
+            /// @param[in] filename The file to write to
+            /// @param[in] LocalFoFGroups The groups (we only need the id)
+            template <class FoFHaloClass>
+            void write_to_file(std::string filename, const std::vector<FoFHaloClass> & LocalFoFGroups) const;
+
+            void clear() {
+                ids = std::vector<std::int64_t>();
+                offsets = std::vector<size_t>{0};
+            }
+        };
+
+        template <class FoFHaloClass>
+        void FoFMembers::write_to_file(std::string filename, const std::vector<FoFHaloClass> & LocalFoFGroups) const {
+            assert_mpi(LocalFoFGroups.size() == get_ngroups(),
+                       "[FoFMembers::write_to_file] The number of groups do not match the members we have\n");
+
+            // Where in the file this task writes its groups and ids
+            std::uint64_t ngroups_local = get_ngroups();
+            std::uint64_t nids_local = ids.size();
+            auto ngroups_per_task = FML::GatherFromTasks(&ngroups_local);
+            auto nids_per_task = FML::GatherFromTasks(&nids_local);
+            std::uint64_t header[2] = {0, 0};
+            for (int i = 0; i < FML::NTasks; i++) {
+                header[0] += ngroups_per_task[i];
+                header[1] += nids_per_task[i];
+            }
+            size_t groups_offset = sizeof(header);
+            size_t ids_offset = sizeof(header) + 2 * sizeof(std::uint64_t) * header[0];
+            for (int i = 0; i < FML::ThisTask; i++) {
+                groups_offset += 2 * sizeof(std::uint64_t) * ngroups_per_task[i];
+                ids_offset += sizeof(std::int64_t) * nids_per_task[i];
+            }
+            std::vector<std::uint64_t> group_table(2 * ngroups_local);
+            for (size_t i = 0; i < ngroups_local; i++) {
+                group_table[2 * i] = LocalFoFGroups[i].id;
+                group_table[2 * i + 1] = get_np(i);
+            }
+
+#ifdef USE_MPI
+            MPI_File file;
+            int err = MPI_File_open(
+                MPI_COMM_WORLD, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+            assert_mpi(err == MPI_SUCCESS,
+                       ("[FoFMembers::write_to_file] Failed to open file " + filename + "\n").c_str());
+            MPI_File_set_size(file, 0);
+#else
+            auto file = std::fstream(filename, std::ios::out | std::ios::binary);
+            assert_mpi(file.good(), ("[FoFMembers::write_to_file] Failed to open file " + filename + "\n").c_str());
+#endif
+
+            if (FML::ThisTask == 0)
+                FML::PARTICLE::shared_file_write_at(file, 0, (char *)header, sizeof(header));
+            FML::PARTICLE::shared_file_write_at(
+                file, groups_offset, (char *)group_table.data(), sizeof(std::uint64_t) * group_table.size());
+            FML::PARTICLE::shared_file_write_at(
+                file, ids_offset, (char *)ids.data(), sizeof(std::int64_t) * ids.size());
+
+#ifdef USE_MPI
+            MPI_File_close(&file);
+#else
+            file.close();
+#endif
+        }
+
         //========================================================================================
         /// Locate friends of friends groups and bin what you want over these groups.
         ///
+        /// With OpenMP the linking is done by all threads: we first find the groups with a concurrent union-find
+        /// over the links and then every group is gathered (added to its FoFHaloClass) by one thread. The groups
+        /// and the order the particles are added in are the same as when using one thread.
+        ///
+        /// With MPI we get the particles within the linking distance of our domain from the neighboring tasks and
+        /// the groups that continue on other tasks are merged exactly (with a distributed union-find over the
+        /// boundary particles). Every group is stored on one task (the one with its particle with the lowest global
+        /// index), which is not necessarily the task whose domain has the center of the group.
+        ///
         /// @tparam T The particle class
         /// @tparam NDIM The number of dimensions
         /// @tparam FoFHaloClass The FoF group class, determined what to be binned up over the FoF group
@@ -48,14 +145,16 @@ namespace FML {
         /// link between two particles. Typical value is 0.2.
         /// @param[in] nmin_FoF_group Minimum number of particles in a FoF group to store it. Typical value is 20.
         /// @param[in] periodic Is the box periodic?
-        /// @param[in] Buffersize_over_Boxsize The buffer we communicate on both sides of the domain in units of the
-        /// boxsize. Typical value for N-body simulations is (3 Mpc/h) / boxsize.
+        /// @param[in] Buffersize_over_Boxsize Not used. The buffer we communicate on both sides of the domain is
+        /// the linking distance as the groups that continue on other tasks are merged (kept for compatibility).
         /// @param[out] LocalFoFGroups The results: list of FoF groups.
         /// @param[in] Ngrid (Optional) The maximum gridsize we use to bin the particles to in order to speed up the
         /// calculation. The default FoF_Ngrid_max is set in the header. Larger value means more memory needed.
+        /// @param[out] LocalFoFMembers (Optional) If not null we also return the ids of the particles in the groups
+        /// (the particles must have a get_id method).
         ///
         //========================================================================================
-        template <class T, int NDIM, class FoFHaloClass>
+        template <class T, int NDIM, class FoFHaloClass = FoFHalo<T, NDIM>>
         void FriendsOfFriends(T * part,
                               size_t NumPart,
                               double linking_length,
@@ -63,127 +162,39 @@ namespace FML {
                               bool periodic,
                               double Buffersize_over_Boxsize,
                               std::vector<FoFHaloClass> & LocalFoFGroups,
-                              int Ngrid = FoF_Ngrid_max);
-
-        //=========================================================================
-        /// A gridcell in a grid used for speeding up the linking of particles
-        /// The ID of the particles is their position in the particle list
-        //=========================================================================
-        class FoFCell {
-          public:
-            /// Number of particles in the cell
-            int np{0};
-            /// Number of boundary particles in the cell
-            int np_boundary{0};
-            /// List of indices of particles that are in the cell
-            size_t * ParticleIndex;
-            /// List of indices of particles that are in the cell
-            size_t * ParticleIndexBoundary;
-            /// List of indices of boundary particles that are in the cell
-            FoFCell() = default;
-        };
-
-        //=========================================================================
-        /// Internal method: bin particles to a grid.
-        /// NB: this method assumes the boundary particles are *unwrapped*
-        /// when we run with a periodic box.
-        /// i.e. on task 1 they should have x<0 (-0.1, not 0.9 if inside the box)
-        /// and on task N-1 they should have x>1 (1.1, not 0.1 if inside the box)
-        //=========================================================================
-        template <class T, int NDIM>
-        void ParticlesToCells(int Ngrid,
-                              int & Local_nx,
-                              double dx_boundary,
-                              T * part,
-                              size_t NumPart,
-                              T * part_boundary,
-                              size_t NumPart_boundary,
-                              std::vector<FoFCell> & PartCells) {
-
-            // Total length of domain
-            const double dx_cells = 1.0 / Ngrid;
-            const double xmin_box = FML::xmin_domain - dx_boundary;
-            const double xmax_box = FML::xmax_domain + dx_boundary;
-            const double dx_box_domain = xmax_box - xmin_box;
-
-            // Total number of local-cells
-            Local_nx = std::ceil(dx_box_domain / dx_cells);
-
-            // Total number of local cells to allocate
-            const size_t NgridTot = size_t(Local_nx) * FML::power(Ngrid, NDIM - 1);
-
-            // Make a grid containing particles
-            PartCells.resize(NgridTot);
-
-            // Get index of the cell the particle lives in
-            auto get_cell_index = [&](size_t ipart, std::vector<int> & coord, int type) {
-                decltype(part[0].get_pos()) pos;
-                if (type == BOUNDARY_PARTICLE)
-                    pos = FML::PARTICLE::GetPos(part_boundary[ipart]);
-                else if (type == REGULAR_PARTICLE)
-                    pos = FML::PARTICLE::GetPos(part[ipart]);
-                else {
-                    throw std::runtime_error("FoF::The particle is somehow marked as not being left/regular/right! "
-                                             "Should not happen ever!\n");
-                }
-
-                size_t index_cell = 0;
-                for (int idim = 0; idim < NDIM; idim++) {
-                    auto dx = (pos[idim] - xmin_box * (idim == 0 ? 1 : 0));
-                    coord[idim] = int(dx * Ngrid);
-                    index_cell = index_cell * Ngrid + coord[idim];
-                }
-                return index_cell;
-            };
-
-            // Count number of particles in cells
-            std::vector<int> coord(NDIM);
-            for (size_t i = 0; i < NumPart; i++) {
-                const size_t index_cell = get_cell_index(i, coord, REGULAR_PARTICLE);
-                PartCells[index_cell].np++;
-            }
-            for (size_t i = 0; i < NumPart_boundary; i++) {
-                const size_t index_cell = get_cell_index(i, coord, BOUNDARY_PARTICLE);
-                PartCells[index_cell].np_boundary++;
-            }
-
-            // Allocate all the data
-            particlegriddata = new size_t[NumPart_boundary + NumPart];
-            size_t * ptr = &particlegriddata[0];
-
-            // Allocate cells
-            int np_max = 0;
-            [[maybe_unused]] size_t np_total = 0;
-            [[maybe_unused]] size_t np_boundary_total = 0;
-            for (auto & cell : PartCells) {
-                cell.ParticleIndexBoundary = ptr;
-                ptr += cell.np_boundary;
-                cell.ParticleIndex = ptr;
-                ptr += cell.np;
-
-                np_max = std::max(np_max, cell.np);
-                np_total += cell.np;
-                np_boundary_total += cell.np_boundary;
-                cell.np = 0;
-                cell.np_boundary = 0;
-            }
-
-            // Fill up cells with info about particles
-            for (size_t i = 0; i < NumPart; i++) {
-                const size_t index_cell = get_cell_index(i, coord, 0);
-                auto & np = PartCells[index_cell].np;
-                PartCells[index_cell].ParticleIndex[np] = i;
-                np++;
-            }
-            for (size_t i = 0; i < NumPart_boundary; i++) {
-                const size_t index_cell = get_cell_index(i, coord, -1);
-                auto & np_boundary = PartCells[index_cell].np_boundary;
-                PartCells[index_cell].ParticleIndexBoundary[np_boundary] = i;
-                np_boundary++;
-            }
-        }
+                              int Ngrid = FoF_Ngrid_max,
+                              FoFMembers * LocalFoFMembers = nullptr);
 
+        //========================================================================================
+        /// Hierarchical FoF: locate the friends of friends groups for several linking lengths in one run.
+        ///
+        /// The particles are binned to the grid and linked once. All the links shorter than the largest linking
+        /// distance are sorted by their length (the ones shorter than the smallest are just linked right away)
+        /// and we get the groups for the next linking length by adding the next links to the groups we have
+        /// (i.e. the single-linkage hierarchy). A group for a linking length is therefore always fully inside one
+        /// group for a larger linking length. This is much faster than calling FriendsOfFriends for each of them.
+        /// The memory needed for the links grows quickly with the ratio of the largest to the smallest linking
+        /// length. See FriendsOfFriends for the rest.
+        ///
+        /// @param[in] linking_lengths The linking lengths in units of mean particle seperation
+        /// @param[out] LocalFoFGroups The FoF groups for each of the linking lengths (in the same order). If the
+        /// particles have a set_fofid method they get the FoFID for the largest linking length.
+        /// @param[out] LocalFoFMembers (Optional) If not null the ids of the particles in the groups for each of the
+        /// linking lengths.
+        ///
+        //========================================================================================
         template <class T, int NDIM, class FoFHaloClass = FoFHalo<T, NDIM>>
+        void HierarchicalFriendsOfFriends(T * part,
+                                          size_t NumPart,
+                                          const std::vector<double> & linking_lengths,
+                                          int nmin_FoF_group,
+                                          bool periodic,
+                                          double Buffersize_over_Boxsize,
+                                          std::vector<std::vector<FoFHaloClass>> & LocalFoFGroups,
+                                          int Ngrid = FoF_Ngrid_max,
+                                          std::vector<FoFMembers> * LocalFoFMembers = nullptr);
+
+        template <class T, int NDIM, class FoFHaloClass>
         void FriendsOfFriends(T * part,
                               size_t NumPart,
                               double linking_length,
@@ -191,9 +202,42 @@ namespace FML {
                               bool periodic,
                               double Buffersize_over_Boxsize,
                               std::vector<FoFHaloClass> & LocalFoFGroups,
-                              int Ngrid) {
+                              int Ngrid,
+                              FoFMembers * LocalFoFMembers) {
+            std::vector<std::vector<FoFHaloClass>> FoFGroups;
+            std::vector<FoFMembers> FoFGroupMembers;
+            HierarchicalFriendsOfFriends<T, NDIM, FoFHaloClass>(part,
+                                                                NumPart,
+                                                                {linking_length},
+                                                                nmin_FoF_group,
+                                                                periodic,
+                                                                Buffersize_over_Boxsize,
+                                                                FoFGroups,
+                                                                Ngrid,
+                                                                LocalFoFMembers ? &FoFGroupMembers : nullptr);
+            LocalFoFGroups = std::move(FoFGroups[0]);
+            if (LocalFoFMembers)
+                *LocalFoFMembers = std::move(FoFGroupMembers[0]);
+        }
 
-            LocalFoFGroups.clear();
+        template <class T, int NDIM, class FoFHaloClass>
+        void HierarchicalFriendsOfFriends(T * part,
+                                          size_t NumPart,
+                                          const std::vector<double> & linking_lengths,
+                                          int nmin_FoF_group,
+                                          bool periodic,
+                                          [[maybe_unused]] double Buffersize_over_Boxsize,
+                                          std::vector<std::vector<FoFHaloClass>> & LocalFoFGroups,
+                                          int Ngrid,
+                                          std::vector<FoFMembers> * LocalFoFMembers) {
+
+            const size_t nlevels = linking_lengths.size();
+            assert_mpi(nlevels > 0, "FriendsOfFriends::No linking length given\n");
+            assert_mpi(LocalFoFMembers == nullptr or FML::PARTICLE::has_get_id<T>(),
+                       "FriendsOfFriends::The particles must have a get_id method to get the members of the groups\n");
+            LocalFoFGroups.assign(nlevels, std::vector<FoFHaloClass>());
+            if (LocalFoFMembers)
+                LocalFoFMembers->assign(nlevels, FoFMembers());
             if (NumPart == 0)
                 return;
             [[maybe_unused]] const bool debug = false;
@@ -206,6 +250,14 @@ namespace FML {
             size_t NumPart_tot = NumPart;
             FML::SumOverTasks(&NumPart_tot);
             const double mean_particle_separation = 1.0 / std::pow(NumPart_tot, 1.0 / 3.0);
+
+            // The linking lengths from the smallest to the largest. The largest sets the grid and the boundary
+            std::vector<size_t> level_order(nlevels);
+            std::iota(level_order.begin(), level_order.end(), 0);
+            std::sort(level_order.begin(), level_order.end(), [&](size_t a, size_t b) {
+                return linking_lengths[a] < linking_lengths[b];
+            });
+            const double linking_length = linking_lengths[level_order.back()];
             const double fof_distance = linking_length * mean_particle_separation;
             const double fof_distance2 = fof_distance * fof_distance;
 
@@ -234,15 +286,16 @@ namespace FML {
             });
             foftimer.EndTiming("Sort particles");
 
-            // Compute ranges for which to copy over boundary partices
+            // Compute ranges for which to copy over boundary partices. We only need the particles that can link to
+            // the ones in our domain as the groups that continue on other tasks are merged afterwards
             const double xmin = FML::xmin_domain;
             const double xmax = FML::xmax_domain;
-            const double dx_boundary = FML::NTasks == 1 ? 0.0 : Buffersize_over_Boxsize;
+            const double dx_boundary = FML::NTasks == 1 ? 0.0 : fof_distance;
 
             // If the boundary we ask for is too large
             if (dx_boundary > xmax - xmin) {
-                throw std::runtime_error("FoF::The boundary asked for is larger than the neighbor task. Reduce "
-                                         "boundary (or the number of CPUs)\n");
+                throw std::runtime_error("FoF::The linking distance is larger than the domain of a task. Reduce the "
+                                         "number of CPUs\n");
             }
 
             //=========================================================================
@@ -251,6 +304,13 @@ namespace FML {
             //=========================================================================
             std::vector<T> boundary_particles{};
             const size_t bytes_per_particle = FML::PARTICLE::GetSize(part[0]);
+
+            // The index of the particles we sent to the left and right task (in the order we sent them) and the
+            // number of boundary particles we got from them (first the ones from the right)
+            std::vector<size_t> sent_left;
+            std::vector<size_t> sent_right;
+            [[maybe_unused]] size_t n_boundary_from_right = 0;
+            [[maybe_unused]] size_t n_boundary_from_left = 0;
 #ifdef USE_MPI
             foftimer.StartTiming("Communicate boundary");
             if (FML::NTasks > 1) {
@@ -351,6 +411,7 @@ namespace FML {
                         if (pos[0] < xmin + dx_boundary) {
                             FML::PARTICLE::AppendToBuffer(part[i], buffer);
                             buffer += bytes_per_particle;
+                            sent_left.push_back(i);
                         }
                     }
 
@@ -383,6 +444,7 @@ namespace FML {
                         if (pos[0] > xmax - dx_boundary) {
                             FML::PARTICLE::AppendToBuffer(part[i], buffer);
                             buffer += bytes_per_particle;
+                            sent_right.push_back(i);
                         }
                     }
 
@@ -410,6 +472,8 @@ namespace FML {
                 // Free up memory used for communication
                 CommBufferSend = std::vector<char>();
                 CommBufferRecv = std::vector<char>();
+                n_boundary_from_right = n_recv_right;
+                n_boundary_from_left = n_recv_left;
 
                 // Make sure the left particles are wrapped to the left of the box on first task
                 // If we don't do this then we need to modify dx[0] comp in get_cell_index in ParticlesInGrid
@@ -436,19 +500,25 @@ namespace FML {
             const auto NumPart_total = NumPart + NumPart_boundary;
 
             //=========================================================================
-            // Bin particles to a grid for faster linking
+            // Bin particles to a grid for faster linking. The grid covers the local domain plus the boundary
+            // and the particles are indexed by their global index below (boundary particles first).
+            // NB: this assumes the boundary particles are *unwrapped* when we run with a periodic box
+            // i.e. on task 1 they should have x<0 (-0.1, not 0.9 if inside the box)
+            // and on task N-1 they should have x>1 (1.1, not 0.1 if inside the box)
             //=========================================================================
-            std::vector<FoFCell> PartCells;
-            int Local_nx{};
+            FML::PARTICLE::NeighborGrid<NDIM> PartGrid;
             foftimer.StartTiming("ParticlesToCells");
-            ParticlesToCells<T, NDIM>(Ngrid,
-                                      Local_nx,
-                                      dx_boundary,
-                                      part,
-                                      NumPart,
-                                      boundary_particles.data(),
-                                      boundary_particles.size(),
-                                      PartCells);
+            PartGrid.create(
+                NumPart_total,
+                [&](size_t i) {
+                    return i < NumPart_boundary ? FML::PARTICLE::GetPos(boundary_particles[i]) :
+                                                  FML::PARTICLE::GetPos(part[i - NumPart_boundary]);
+                },
+                Ngrid,
+                periodic,
+                xmin - dx_boundary,
+                xmax + dx_boundary);
+            const int Local_nx = PartGrid.get_local_nx();
             foftimer.EndTiming("ParticlesToCells");
 
             //=========================================================================
@@ -467,16 +537,17 @@ namespace FML {
                 std::cout << "#\n";
                 std::cout << "# FriendsOfFriends linking\n";
                 std::cout << "# FoF Linking Length: " << linking_length << "\n";
+                if (nlevels > 1)
+                    std::cout << "# Hierarchical FoF with " << nlevels << " linking lengths (largest shown)\n";
                 std::cout << "# FoF Linking Distance: " << fof_distance << "\n";
-                std::cout << "# dx_boundary / Boxsize: " << Buffersize_over_Boxsize << "\n";
+                std::cout << "# dx_boundary / Boxsize: " << dx_boundary << "\n";
                 std::cout << "# Periodic box: " << std::boolalpha << periodic << "\n";
                 std::cout << "# FoF linking Gridsize = " << Ngrid << " Local_nx: " << Local_nx << "\n";
                 std::cout << "# Maximum possible FoF gridsize = " << int(0.5 / fof_distance) << "\n";
                 std::cout << "# Npart_boundary : " << NumPart_boundary << " ( "
                           << NumPart_boundary / std::pow(1024.0, 2) * bytes_per_particle << " MB )\n";
                 std::cout << "# Grid memory per task: "
-                          << (double(Local_nx) * FML::power(Ngrid, NDIM - 1) * sizeof(FoFCell) +
-                              NumPart_total * sizeof(size_t)) /
+                          << (double(PartGrid.get_ncells() + 1) + NumPart_total) * sizeof(size_t) /
                                  std::pow(1024.0, 2)
                           << " MB\n";
                 std::cout << "# ...compared to particle memory: " << NumPart * bytes_per_particle / std::pow(1024.0, 2)
@@ -518,24 +589,10 @@ namespace FML {
                 return &part[localindex];
             };
 
-            // Reserve space for 1000 particles in a FoF group
-            std::vector<size_t> friend_local_index_list;
-            std::vector<signed char> friend_type_list;
-            friend_local_index_list.reserve(1000);
-            friend_type_list.reserve(1000);
-
-            // Function to locate and tag all closest friends
-            // This is then used recursively in the next method we have
-            auto FindAllFriends = [&](T * curpart,
-                                      [[maybe_unused]] int type,
-                                      [[maybe_unused]] size_t localindex,
-                                      size_t globalindex,
-                                      size_t FoFID,
-                                      std::vector<size_t> & friend_local_index_list,
-                                      std::vector<signed char> & friend_type_list) {
-                // Get the particle
-                const auto * pos1 = FML::PARTICLE::GetPos(*curpart);
-
+            // Calls function(index_nbor_cell) for all the 2^NDIM nbor cells we must search for friends of a
+            // particle at pos1. We only go to the cells on the same side as the particle position.
+            // As long as the cell-size is larger than 2*fof_distance we don't need to visit the other cells
+            auto for_each_cell_to_search = [&](const auto * pos1, auto && function) {
                 // Compute coord of cell particle is in
                 std::array<int, NDIM> coord;
                 std::array<int, NDIM> di;
@@ -546,9 +603,6 @@ namespace FML {
                 }
 
                 // Loop through all 2^NDIM nbor cells
-                // We only go to the cells on the same side as the particle position
-                // As long as the cell-size is larger than 2*fof_distance we don't need
-                // to visit the other cells
                 std::array<int, NDIM> icoord;
                 for (int nbcell = 0; nbcell < twotondim; nbcell++) {
                     for (int idim = 0, n = 1; idim < NDIM; idim++, n *= 2) {
@@ -556,222 +610,640 @@ namespace FML {
                         icoord[idim] = coord[idim] + go_left_right_or_stay * di[idim];
                     }
 
-                    // For boundary cells in the x direction we don't have a left or a right nbor
-                    // unless we only have 1 task
-                    if (FML::NTasks > 1) {
-                        if (icoord[0] < 0 or icoord[0] >= Local_nx)
-                            continue;
-                    } else {
-                        if (icoord[0] < 0)
-                            icoord[0] += Ngrid;
-                        if (icoord[0] >= Ngrid)
-                            icoord[0] -= Ngrid;
-                    }
+                    // Compute cell-index of nbor cell (the grid takes care of the periodic wrap and tells us
+                    // if the cell does not exist, e.g. in the x direction with more than 1 task)
+                    size_t index_nbor_cell;
+                    if (PartGrid.get_cell_index(icoord, index_nbor_cell))
+                        function(index_nbor_cell);
+                }
+            };
+
+            // Squared distance between two particles
+            auto distance_squared = [&](const auto * pos1, const auto * pos2) {
+                std::array<double, NDIM> dx2;
+                for (int idim = 0; idim < NDIM; idim++) {
+                    dx2[idim] = std::abs(pos2[idim] - pos1[idim]);
+                    if (dx2[idim] > 0.5 and periodic)
+                        dx2[idim] -= 1.0;
+                }
+                double dist2 = 0.0;
+                for (int idim = 0; idim < NDIM; idim++)
+                    dist2 += dx2[idim] * dx2[idim];
+                return dist2;
+            };
+
+            //=========================================================================
+            // Find the groups with a concurrent union-find (disjoint set) over all the links. We always attach
+            // the root with the larger index to the one with the smaller so parent[i] <= i and the root
+            // of a group is its particle with the lowest index (the one the group is started from below)
+            //=========================================================================
+            foftimer.StartTiming("FoFLinking");
+            std::vector<std::atomic<size_t>> parent(NumPart_total);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < NumPart_total; i++)
+                parent[i].store(i, std::memory_order_relaxed);
+
+            // Find the root (with path halving)
+            auto find_root = [&](size_t i) {
+                size_t p = parent[i].load(std::memory_order_relaxed);
+                while (p != i) {
+                    size_t gp = parent[p].load(std::memory_order_relaxed);
+                    if (gp != p)
+                        parent[i].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+                    i = gp;
+                    p = parent[i].load(std::memory_order_relaxed);
+                }
+                return i;
+            };
+
+            // Merge the groups of i and j. The exchange only succeeds if the root is still a root
+            auto link = [&](size_t i, size_t j) {
+                for (;;) {
+                    size_t ri = find_root(i);
+                    size_t rj = find_root(j);
+                    if (ri == rj)
+                        return;
+                    if (ri < rj)
+                        std::swap(ri, rj);
+                    if (parent[ri].compare_exchange_strong(ri, rj, std::memory_order_relaxed))
+                        return;
+                }
+            };
+
+            // A copy of the positions in the order of the grid so that we read contiguous memory below
+            const auto & grid_indices = PartGrid.get_indices();
+            const auto & grid_offsets = PartGrid.get_offsets();
+            std::vector<double> pos_in_grid_order(NumPart_total * NDIM);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t k = 0; k < NumPart_total; k++) {
+                const size_t globalindex = grid_indices[k];
+                const auto * pos = FML::PARTICLE::GetPos(*particle_from_localindex_and_type(
+                    localindex_from_globalindex(globalindex), type_from_globalindex(globalindex)));
+                for (int idim = 0; idim < NDIM; idim++)
+                    pos_in_grid_order[k * NDIM + idim] = pos[idim];
+            }
 
-                    // Compute cell-index or nbor cell
-                    bool skip = false;
-                    size_t index_nbor_cell = icoord[0];
-                    for (int idim = 1; idim < NDIM; idim++) {
-                        // Periodic boundary conditions
-                        if (periodic) {
-                            if (icoord[idim] < 0)
-                                icoord[idim] += Ngrid;
-                            if (icoord[idim] >= Ngrid)
-                                icoord[idim] -= Ngrid;
-                        } else {
-                            if (icoord[idim] < 0 or icoord[idim] >= Ngrid){
-                                skip = true;
-                                break;
+            // Loop over all particles (cell by cell) and link it to all its friends with a larger index. We skip
+            // the distance computation if they are already known to be in the same group (common in halo cores).
+            // With more than one linking length we only link the particles closer than the smallest linking
+            // distance here and keep the other links (shorter than the largest) sorted by their length
+            const double first_distance = linking_lengths[level_order[0]] * mean_particle_separation;
+            const double first_distance2 = first_distance * first_distance;
+            struct Link {
+                double distance2;
+                size_t i;
+                size_t j;
+            };
+            std::vector<Link> links;
+            const size_t ncells = PartGrid.get_ncells();
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+            {
+                std::vector<Link> links_thread;
+#ifdef USE_OMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+                for (size_t icell = 0; icell < ncells; icell++) {
+                    for (size_t k = grid_offsets[icell]; k < grid_offsets[icell + 1]; k++) {
+                        const size_t globalindex = grid_indices[k];
+                        const double * pos1 = &pos_in_grid_order[k * NDIM];
+                        size_t root = find_root(globalindex);
+                        for_each_cell_to_search(pos1, [&](size_t index_nbor_cell) {
+                            for (size_t l = grid_offsets[index_nbor_cell]; l < grid_offsets[index_nbor_cell + 1];
+                                 l++) {
+                                const size_t nborglobalindex = grid_indices[l];
+                                if (nborglobalindex <= globalindex or find_root(nborglobalindex) == root)
+                                    continue;
+                                const double dist2 = distance_squared(pos1, &pos_in_grid_order[l * NDIM]);
+                                if (dist2 < first_distance2) {
+                                    link(globalindex, nborglobalindex);
+                                    root = find_root(globalindex);
+                                } else if (dist2 < fof_distance2) {
+                                    links_thread.push_back({dist2, globalindex, nborglobalindex});
+                                }
                             }
-                        }
-                        index_nbor_cell = index_nbor_cell * Ngrid + icoord[idim];
+                        });
                     }
+                }
+#ifdef USE_OMP
+#pragma omp critical
+#endif
+                links.insert(links.end(), links_thread.begin(), links_thread.end());
+            }
+            std::sort(links.begin(), links.end(), [](const Link & a, const Link & b) {
+                return std::tie(a.distance2, a.i, a.j) < std::tie(b.distance2, b.i, b.j);
+            });
+            pos_in_grid_order = std::vector<double>();
+            foftimer.EndTiming("FoFLinking");
 
-                    // Cell do not exist in this case
-                    if (skip)
-                        continue;
+            //=========================================================================
+            // Get the groups for each of the linking lengths from the smallest to the largest. The groups only
+            // grow with the linking length so we just add the links of the next linking length to the union-find
+            //=========================================================================
+            size_t next_link = 0;
+            for (size_t jlevel = 0; jlevel < nlevels; jlevel++) {
+                const size_t ilevel = level_order[jlevel];
+                const double level_distance = linking_lengths[ilevel] * mean_particle_separation;
+                const double level_distance2 = level_distance * level_distance;
+                std::fill(particle_id_FoF.begin(), particle_id_FoF.end(), no_FoF_ID);
+
+                foftimer.StartTiming("FoFLinking");
+                size_t end_link = next_link;
+                while (end_link < links.size() and links[end_link].distance2 < level_distance2)
+                    end_link++;
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+                for (size_t k = next_link; k < end_link; k++)
+                    link(links[k].i, links[k].j);
+                next_link = end_link;
+
+                // Point every particle directly to the root of its group and count the particles in the groups
+                std::vector<size_t> npart_in_group(NumPart_total, 0);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < NumPart_total; i++) {
+                    size_t root = find_root(i);
+                    parent[i].store(root, std::memory_order_relaxed);
+#ifdef USE_OMP
+#pragma omp atomic
+#endif
+                    npart_in_group[root]++;
+                }
+#ifdef USE_MPI
+                MPI_Barrier(MPI_COMM_WORLD);
+#endif
+                foftimer.EndTiming("FoFLinking");
+
+                //=========================================================================
+                // With more than one task a group can continue on the other tasks. Every group gets a label: the
+                // lowest global index (the index in the list of all particles on all tasks) of the particles in it.
+                // We find it by exchanging the labels of the groups of the boundary particles with the tasks that
+                // have them until nothing changes (a distributed union-find). The groups with boundary particles (the
+                // only ones that can continue on other tasks) are then assembled on the task that has the particle
+                // with the label.
+                //=========================================================================
+                foftimer.StartTiming("FoFMerging");
+                const std::vector<size_t> npart_on_task = FML::GatherFromTasks(&NumPart);
+                std::vector<size_t> global_index_offset(FML::NTasks + 1, 0);
+                for (int task = 0; task < FML::NTasks; task++)
+                    global_index_offset[task + 1] = global_index_offset[task] + npart_on_task[task];
+                auto task_of_label = [&](size_t label) {
+                    return int(std::upper_bound(global_index_offset.begin(), global_index_offset.end(), label) -
+                               global_index_offset.begin()) -
+                           1;
+                };
+
+                // The label of the groups (indexed by the root) and if they contain boundary particles
+                std::vector<size_t> group_label(NumPart_total, no_FoF_ID);
+                std::vector<char> group_on_boundary(NumPart_total, 0);
+                for (size_t i = 0; i < NumPart_total; i++) {
+                    const size_t root = parent[i].load(std::memory_order_relaxed);
+                    if (type_from_globalindex(i) == BOUNDARY_PARTICLE)
+                        group_on_boundary[root] = 1;
+                    else
+                        group_label[root] = std::min(
+                            group_label[root], global_index_offset[FML::ThisTask] + localindex_from_globalindex(i));
+                }
 
-                    // Get total number of particles in cell
-                    const size_t np_boundary = PartCells[index_nbor_cell].np_boundary;
-                    const size_t np = PartCells[index_nbor_cell].np;
-                    const size_t np_total = np + np_boundary;
-
-                    // Loop over all particles in nbor cell
-                    for (size_t ii = 0; ii < np_total; ii++) {
-                        T * nborpart{};
-                        int nbortype{};
-                        size_t nborglobalindex{};
-                        size_t nborlocalindex{};
-
-                        // Type of particle
-                        if (ii < np_boundary) {
-                            nborlocalindex = PartCells[index_nbor_cell].ParticleIndexBoundary[ii];
-                            nborglobalindex = nborlocalindex;
-                            nborpart = &boundary_particles[nborlocalindex];
-                            nbortype = BOUNDARY_PARTICLE;
-                        } else {
-                            nborlocalindex = PartCells[index_nbor_cell].ParticleIndex[ii - np_boundary];
-                            nborglobalindex = nborlocalindex + NumPart_boundary;
-                            nborpart = &part[nborlocalindex];
-                            nbortype = REGULAR_PARTICLE;
+#ifdef USE_MPI
+                if (FML::NTasks > 1) {
+                    const int RightTask = (FML::ThisTask + 1) % FML::NTasks;
+                    const int LeftTask = (FML::ThisTask - 1 + FML::NTasks) % FML::NTasks;
+
+                    // The groups of the particles we share with the task to the left (right): the ones we sent to it
+                    // and then the boundary particles we got from it. The other task has the same particles in the
+                    // opposite order
+                    std::vector<size_t> shared_left;
+                    std::vector<size_t> shared_right;
+                    for (auto i : sent_left)
+                        shared_left.push_back(globalindex_from_localindex_type(i, REGULAR_PARTICLE));
+                    for (size_t i = 0; i < n_boundary_from_left; i++)
+                        shared_left.push_back(n_boundary_from_right + i);
+                    for (auto i : sent_right)
+                        shared_right.push_back(globalindex_from_localindex_type(i, REGULAR_PARTICLE));
+                    for (size_t i = 0; i < n_boundary_from_right; i++)
+                        shared_right.push_back(i);
+
+                    // Send our labels of the shared particles to one task and get the labels of the other
+                    // task. Returns true if any of our labels changed
+                    auto exchange_labels = [&](const std::vector<size_t> & shared_send,
+                                               int send_task,
+                                               const std::vector<size_t> & shared_recv,
+                                               int recv_task,
+                                               size_t nrecv_first) {
+                        std::vector<size_t> labels_send(shared_send.size());
+                        std::vector<size_t> labels_recv(shared_recv.size());
+                        for (size_t k = 0; k < shared_send.size(); k++)
+                            labels_send[k] = group_label[parent[shared_send[k]].load(std::memory_order_relaxed)];
+                        MPI_Status status;
+                        MPI_Sendrecv(labels_send.data(),
+                                     labels_send.size() * sizeof(size_t),
+                                     MPI_BYTE,
+                                     send_task,
+                                     0,
+                                     labels_recv.data(),
+                                     labels_recv.size() * sizeof(size_t),
+                                     MPI_BYTE,
+                                     recv_task,
+                                     0,
+                                     MPI_COMM_WORLD,
+                                     &status);
+
+                        // The other task sent its (sent, received) particles which are our (received, sent)
+                        bool changed = false;
+                        const size_t nrecv_second = shared_recv.size() - nrecv_first;
+                        for (size_t k = 0; k < shared_recv.size(); k++) {
+                            const size_t index = k < nrecv_first ? shared_recv[nrecv_second + k] :
+                                                                   shared_recv[k - nrecv_first];
+                            const size_t root = parent[index].load(std::memory_order_relaxed);
+                            if (labels_recv[k] < group_label[root]) {
+                                group_label[root] = labels_recv[k];
+                                changed = true;
+                            }
                         }
+                        return changed;
+                    };
+
+                    // Propagate the labels until no label changes on any task
+                    int changed = 1;
+                    int niterations = 0;
+                    while (changed) {
+                        bool changed_left =
+                            exchange_labels(shared_left, LeftTask, shared_right, RightTask, n_boundary_from_right);
+                        bool changed_right =
+                            exchange_labels(shared_right, RightTask, shared_left, LeftTask, n_boundary_from_left);
+                        changed = changed_left or changed_right;
+                        MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+                        niterations++;
+                    }
+                    if (FML::ThisTask == 0)
+                        std::cout << "# Merged the groups over the boundaries in " << niterations << " iterations\n";
+                }
+#endif
 
-                        // If same particle or already processed so that it has an ID skip going further
-                        if (particle_id_FoF[nborglobalindex] != no_FoF_ID)
-                            continue;
-                        if (nborglobalindex == globalindex)
-                            continue;
-
-                        // Compute distance
-                        double dist2 = 0.0;
-                        const auto * pos2 = FML::PARTICLE::GetPos(*nborpart);
-                        std::array<double, NDIM> dx2;
-                        for (int idim = 0; idim < NDIM; idim++) {
-                            dx2[idim] = std::abs(pos2[idim] - pos1[idim]);
-                            if (dx2[idim] > 0.5 and periodic)
-                                dx2[idim] -= 1.0;
+                // Send the particles of the groups on the boundary to the task that has the label
+                std::vector<T> merged_particles;
+                std::vector<size_t> merged_labels;
+                std::vector<size_t> merged_sent_index;
+                std::vector<int> nsend(FML::NTasks, 0);
+                std::vector<int> nrecv(FML::NTasks, 0);
+                {
+                    std::vector<std::vector<size_t>> send_index(FML::NTasks);
+                    for (size_t i = NumPart_boundary; i < NumPart_total; i++) {
+                        const size_t root = parent[i].load(std::memory_order_relaxed);
+                        if (group_on_boundary[root])
+                            send_index[task_of_label(group_label[root])].push_back(i);
+                    }
+                    for (int task = 0; task < FML::NTasks; task++) {
+                        nsend[task] = int(send_index[task].size());
+                        merged_sent_index.insert(
+                            merged_sent_index.end(), send_index[task].begin(), send_index[task].end());
+                    }
+                }
+#ifdef USE_MPI
+                if (FML::NTasks > 1) {
+                    MPI_Alltoall(nsend.data(), 1, MPI_INT, nrecv.data(), 1, MPI_INT, MPI_COMM_WORLD);
+                    std::vector<int> nbytes_send(FML::NTasks), nbytes_recv(FML::NTasks), offset_send(FML::NTasks, 0),
+                        offset_recv(FML::NTasks, 0);
+                    int nrecv_total = 0;
+                    for (int task = 0; task < FML::NTasks; task++) {
+                        nbytes_send[task] = int(nsend[task] * bytes_per_particle);
+                        nbytes_recv[task] = int(nrecv[task] * bytes_per_particle);
+                        if (task > 0) {
+                            offset_send[task] = offset_send[task - 1] + nbytes_send[task - 1];
+                            offset_recv[task] = offset_recv[task - 1] + nbytes_recv[task - 1];
                         }
-                        for (int idim = 0; idim < NDIM; idim++)
-                            dist2 += dx2[idim] * dx2[idim];
-
-                        // Check if we have a link. Set the FoF ID in the particle list
-                        if (dist2 < fof_distance2) {
-                            particle_id_FoF[nborglobalindex] = FoFID;
-                            // Only need to set this one time so avoid a write by adding if test
-                            if (particle_id_FoF[globalindex] == no_FoF_ID)
-                                particle_id_FoF[globalindex] = FoFID;
-                            // Push partice info to FoF list
-                            friend_local_index_list.push_back(nborlocalindex);
-                            friend_type_list.push_back(nbortype);
+                        nrecv_total += nrecv[task];
+                    }
+
+                    // The particles
+                    std::vector<char> CommBufferSend(merged_sent_index.size() * bytes_per_particle);
+                    std::vector<char> CommBufferRecv(nrecv_total * bytes_per_particle);
+                    char * buffer = CommBufferSend.data();
+                    for (auto i : merged_sent_index) {
+                        FML::PARTICLE::AppendToBuffer(part[localindex_from_globalindex(i)], buffer);
+                        buffer += bytes_per_particle;
+                    }
+                    MPI_Alltoallv(CommBufferSend.data(),
+                                  nbytes_send.data(),
+                                  offset_send.data(),
+                                  MPI_BYTE,
+                                  CommBufferRecv.data(),
+                                  nbytes_recv.data(),
+                                  offset_recv.data(),
+                                  MPI_BYTE,
+                                  MPI_COMM_WORLD);
+                    CommBufferSend = std::vector<char>();
+                    merged_particles.resize(nrecv_total);
+                    buffer = CommBufferRecv.data();
+                    for (int k = 0; k < nrecv_total; k++) {
+                        FML::PARTICLE::AssignFromBuffer(merged_particles[k], buffer);
+                        buffer += bytes_per_particle;
+                    }
+                    CommBufferRecv = std::vector<char>();
+
+                    // Their labels
+                    std::vector<size_t> labels_send;
+                    for (auto i : merged_sent_index)
+                        labels_send.push_back(group_label[parent[i].load(std::memory_order_relaxed)]);
+                    merged_labels.resize(nrecv_total);
+                    for (int task = 0; task < FML::NTasks; task++) {
+                        nbytes_send[task] = int(nsend[task] * sizeof(size_t));
+                        nbytes_recv[task] = int(nrecv[task] * sizeof(size_t));
+                        if (task > 0) {
+                            offset_send[task] = offset_send[task - 1] + nbytes_send[task - 1];
+                            offset_recv[task] = offset_recv[task - 1] + nbytes_recv[task - 1];
                         }
                     }
+                    MPI_Alltoallv(labels_send.data(),
+                                  nbytes_send.data(),
+                                  offset_send.data(),
+                                  MPI_BYTE,
+                                  merged_labels.data(),
+                                  nbytes_recv.data(),
+                                  offset_recv.data(),
+                                  MPI_BYTE,
+                                  MPI_COMM_WORLD);
                 }
-            };
-
-            // ID of the FoF groups
-            unsigned int FoFID = 0;
-
-            // Recursively find all friends of friends
-            foftimer.StartTiming("FoFLinking");
-            for (size_t i = 0; i < NumPart_total; i++) {
-
-                // Show progress bar
-                if (FML::ThisTask == 0)
-                    if ((10 * i) / NumPart_total != (10 * i + 10) / NumPart_total or i == 0) {
-                        std::cout << (100 * i + 100) / NumPart_total << "% " << std::flush;
-                        if (i == NumPart_total - 1) {
-                            std::cout << std::endl;
+#endif
+                foftimer.EndTiming("FoFMerging");
+
+                // The merged particles sorted by label. As we got them ordered by task and then index
+                // the particles in a group are ordered by their global index
+                std::vector<size_t> merged_order(merged_particles.size());
+                std::iota(merged_order.begin(), merged_order.end(), 0);
+                std::stable_sort(merged_order.begin(), merged_order.end(), [&](size_t a, size_t b) {
+                    return merged_labels[a] < merged_labels[b];
+                });
+
+                //=========================================================================
+                // The groups we have: the local ones (given by their root) and the merged ones (given by the range in
+                // merged_order). We give the groups with 2 or more particles their ID in the order of their label
+                // (with one task this is the order of their root). The groups that are large enough to be stored are
+                // gathered below and the others just get their ID set here
+                //=========================================================================
+                struct Group {
+                    size_t label;
+                    size_t root_or_begin;
+                    size_t np;
+                    bool merged;
+                };
+                std::vector<Group> groups;
+                for (size_t i = NumPart_boundary; i < NumPart_total; i++) {
+                    if (parent[i].load(std::memory_order_relaxed) == i and not group_on_boundary[i] and
+                        npart_in_group[i] >= 2)
+                        groups.push_back({group_label[i], i, npart_in_group[i], false});
+                }
+                for (size_t k = 0; k < merged_order.size();) {
+                    size_t k_end = k;
+                    const size_t label = merged_labels[merged_order[k]];
+                    while (k_end < merged_order.size() and merged_labels[merged_order[k_end]] == label)
+                        k_end++;
+                    if (k_end - k >= 2)
+                        groups.push_back({label, k, k_end - k, true});
+                    k = k_end;
+                }
+                std::sort(
+                    groups.begin(), groups.end(), [](const Group & a, const Group & b) { return a.label < b.label; });
+
+                unsigned int FoFID = 0;
+                std::vector<std::pair<size_t, unsigned int>> groups_to_gather;
+                std::vector<size_t> merged_FoFID(merged_particles.size(), no_FoF_ID);
+                for (size_t igroup = 0; igroup < groups.size(); igroup++) {
+                    const auto & g = groups[igroup];
+                    if (int(g.np) >= nmin_FoF_group)
+                        groups_to_gather.push_back({igroup, FoFID});
+                    if (g.merged)
+                        for (size_t k = g.root_or_begin; k < g.root_or_begin + g.np; k++)
+                            merged_FoFID[merged_order[k]] = FoFID;
+                    else if (int(g.np) < nmin_FoF_group)
+                        particle_id_FoF[g.root_or_begin] = FoFID;
+                    FoFID++;
+                }
+                for (size_t i = NumPart_boundary; i < NumPart_total; i++) {
+                    const size_t root = parent[i].load(std::memory_order_relaxed);
+                    if (not group_on_boundary[root] and int(npart_in_group[root]) < nmin_FoF_group)
+                        particle_id_FoF[i] = particle_id_FoF[root];
+                }
+                npart_in_group = std::vector<size_t>();
+
+                // Function to locate and tag all closest friends in the group with the given root
+                // This is then used recursively in the next method we have
+                auto FindAllFriends = [&](T * curpart,
+                                          size_t globalindex,
+                                          size_t root,
+                                          size_t FoFID,
+                                          std::vector<size_t> & friend_local_index_list,
+                                          std::vector<signed char> & friend_type_list) {
+                    const auto * pos1 = FML::PARTICLE::GetPos(*curpart);
+                    for_each_cell_to_search(pos1, [&](size_t index_nbor_cell) {
+                        // Loop over all particles in nbor cell
+                        for (auto it = PartGrid.cell_begin(index_nbor_cell); it != PartGrid.cell_end(index_nbor_cell);
+                             ++it) {
+                            const size_t nborglobalindex = *it;
+
+                            // If in another group, same particle or already processed so that it has an ID skip going
+                            // further. Only the thread doing this group touches the IDs of its particles
+                            if (parent[nborglobalindex].load(std::memory_order_relaxed) != root)
+                                continue;
+                            if (particle_id_FoF[nborglobalindex] != no_FoF_ID)
+                                continue;
+                            if (nborglobalindex == globalindex)
+                                continue;
+
+                            const size_t nborlocalindex = localindex_from_globalindex(nborglobalindex);
+                            const int nbortype = type_from_globalindex(nborglobalindex);
+                            T * nborpart = particle_from_localindex_and_type(nborlocalindex, nbortype);
+
+                            // Check if we have a link. Set the FoF ID in the particle list
+                            if (distance_squared(pos1, FML::PARTICLE::GetPos(*nborpart)) < level_distance2) {
+                                particle_id_FoF[nborglobalindex] = FoFID;
+                                // Only need to set this one time so avoid a write by adding if test
+                                if (particle_id_FoF[globalindex] == no_FoF_ID)
+                                    particle_id_FoF[globalindex] = FoFID;
+                                // Push partice info to FoF list
+                                friend_local_index_list.push_back(nborlocalindex);
+                                friend_type_list.push_back(nbortype);
+                            }
                         }
+                    });
+                };
+
+                //=========================================================================
+                // Gather the groups. Every local group is done by one thread starting from its root and going
+                // through all friends and the friend of these friends until we have found all particles in the halo
+                // (so the particles are added to the halo in the same order as with a serial linking). The particles of
+                // the merged groups are added in the order of their global index
+                //=========================================================================
+                foftimer.StartTiming("FoFGroups");
+                std::vector<FoFHaloClass> halos(groups_to_gather.size());
+
+                // The ids of the members of the group are written in the order they are added to it
+                FoFMembers * members = LocalFoFMembers ? &(*LocalFoFMembers)[ilevel] : nullptr;
+                if (members) {
+                    members->offsets.assign(groups_to_gather.size() + 1, 0);
+                    for (size_t igather = 0; igather < groups_to_gather.size(); igather++)
+                        members->offsets[igather + 1] =
+                            members->offsets[igather] + groups[groups_to_gather[igather].first].np;
+                    members->ids.resize(members->offsets.back());
+                }
+
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+                for (size_t igather = 0; igather < groups_to_gather.size(); igather++) {
+                    const auto & group = groups[groups_to_gather[igather].first];
+                    const unsigned int ID = groups_to_gather[igather].second;
+
+                    FoFHaloClass newhalo(ID);
+                    std::int64_t * member_ids = members ? members->ids.data() + members->offsets[igather] : nullptr;
+                    auto add_to_halo = [&](T & particle) {
+                        newhalo.add(particle, periodic);
+                        if constexpr (FML::PARTICLE::has_get_id<T>())
+                            if (member_ids)
+                                *member_ids++ = std::int64_t(FML::PARTICLE::GetID(particle));
+                    };
+                    if (group.merged) {
+                        for (size_t k = group.root_or_begin; k < group.root_or_begin + group.np; k++)
+                            add_to_halo(merged_particles[merged_order[k]]);
+                        halos[igather] = std::move(newhalo);
+                        continue;
                     }
+                    const size_t root = group.root_or_begin;
 
-                // Fetch the particle
-                size_t globalindex = i;
-                size_t localindex = localindex_from_globalindex(globalindex);
-                int type = type_from_globalindex(globalindex);
-                T * curpart = particle_from_localindex_and_type(localindex, type);
+                    // Reserve space for 1000 particles in a FoF group
+                    std::vector<size_t> friend_local_index_list;
+                    std::vector<signed char> friend_type_list;
+                    friend_local_index_list.reserve(1000);
+                    friend_type_list.reserve(1000);
 
-                // Check if particle is not already processed
-                if (particle_id_FoF[i] == no_FoF_ID) {
-                    // Start new FoF group
-                    friend_local_index_list.clear();
-                    friend_type_list.clear();
+                    // Fetch the particle
+                    size_t globalindex = root;
+                    size_t localindex = localindex_from_globalindex(globalindex);
+                    int type = type_from_globalindex(globalindex);
+                    T * curpart = particle_from_localindex_and_type(localindex, type);
 
                     // Do linking
-                    FindAllFriends(
-                        curpart, type, localindex, globalindex, FoFID, friend_local_index_list, friend_type_list);
+                    FindAllFriends(curpart, globalindex, root, ID, friend_local_index_list, friend_type_list);
 
-                    if (friend_local_index_list.size() == 0)
-                        continue;
-
-                    // We are here if we found a group (2 or more particles)
-                    // Go through all friends and the friend of these friends
-                    // until we have found all particles in the halo
-                    FoFHalo<T, NDIM> newhalo(FoFID);
-                    newhalo.add(*curpart, periodic);
+                    add_to_halo(*curpart);
 
                     while (friend_local_index_list.size() > 0) {
                         // Fetch a particle
-                        auto localindex = friend_local_index_list.back();
+                        localindex = friend_local_index_list.back();
                         type = int(friend_type_list.back());
                         globalindex = globalindex_from_localindex_type(localindex, type);
                         curpart = particle_from_localindex_and_type(localindex, type);
 
                         // Fetch position relative to first particle
-                        newhalo.add(*curpart, periodic);
+                        add_to_halo(*curpart);
 
                         // Remove particle from list
                         friend_local_index_list.pop_back();
                         friend_type_list.pop_back();
 
                         // Do linking
-                        FindAllFriends(
-                            curpart, type, localindex, globalindex, FoFID, friend_local_index_list, friend_type_list);
+                        FindAllFriends(curpart, globalindex, root, ID, friend_local_index_list, friend_type_list);
                     }
+                    halos[igather] = std::move(newhalo);
+                }
+                merged_particles = std::vector<T>();
 
-                    // Save halo if it lies in the local domain and has more than nmin particles
-                    if (int(newhalo.np) >= nmin_FoF_group) {
-                        double xhalo = newhalo.get_pos()[0];
-                        if (periodic) // Periodic wrap
-                            xhalo += (xhalo < 0.0) ? 1.0 : ((xhalo >= 1.0) ? -1.0 : 0.0);
-                        if (xhalo >= FML::xmin_domain and xhalo < FML::xmax_domain) {
-                            LocalFoFGroups.push_back(newhalo);
-                        }
+                // Every group is only on one task so we keep them all (they all have more than nmin particles)
+                LocalFoFGroups[ilevel] = std::move(halos);
+#ifdef USE_MPI
+                MPI_Barrier(MPI_COMM_WORLD);
+#endif
+                foftimer.EndTiming("FoFGroups");
+
+                // Count how many halos we found (the sum over tasks completes while we fix the IDs below)
+                auto nhalos = LocalFoFGroups[ilevel].size();
+                auto nhalos_sum = FML::SumOverTasksAsync(&nhalos);
+
+                // We need to fix the FoFID of the halos as they start from 0 on each task
+                // so that all just have a unique ID
+                // We do this such that after mpi-sum we have the sum of the FoFIDs
+                std::vector<int> addfofid(FML::NTasks, 0);
+                for (int i = FML::ThisTask + 1; i < FML::NTasks; i++)
+                    addfofid[i] = FoFID;
+                FML::SumArrayOverTasks(addfofid.data(), FML::NTasks);
+
+                // Finalize computation of halos
+                auto add = addfofid[FML::ThisTask];
+                for (auto & h : LocalFoFGroups[ilevel]) {
+                    h.id += add;
+                    h.finalize(periodic);
+                }
+
+                // Print how many halos we found
+                nhalos_sum.wait();
+                if (FML::ThisTask == 0)
+                    std::cout << "# We found a total of " << nhalos << " (" << LocalFoFGroups[ilevel].size()
+                              << " on task 0) "
+                                 "\n";
+
+                // If particles have a set_fofid method then set the ID in the particles (for the largest linking
+                // length). This sets it to no_FoF_id if the particle is not part of a group
+                if (jlevel + 1 < nlevels)
+                    continue;
+                if constexpr (FML::PARTICLE::has_set_fofid<T>()) {
+                    for (size_t i = NumPart_boundary; i < NumPart_total; i++) {
+                        auto FoFID = particle_id_FoF[i];
+                        if (FoFID != no_FoF_ID)
+                            FoFID += addfofid[FML::ThisTask];
+                        FML::PARTICLE::SetFoFID(part[localindex_from_globalindex(i)], FoFID);
                     }
 
-                    // Increase the FoF ID
-                    FoFID++;
-                }
-            }
+                    // The particles in the merged groups gets the ID from the task the group was assembled on
+                    for (auto & id : merged_FoFID)
+                        if (id != no_FoF_ID)
+                            id += addfofid[FML::ThisTask];
+                    std::vector<size_t> merged_sent_FoFID(merged_sent_index.size(), no_FoF_ID);
 #ifdef USE_MPI
-            MPI_Barrier(MPI_COMM_WORLD);
+                    if (FML::NTasks > 1) {
+                        std::vector<int> nbytes_send(FML::NTasks), nbytes_recv(FML::NTasks),
+                            offset_send(FML::NTasks, 0), offset_recv(FML::NTasks, 0);
+                        for (int task = 0; task < FML::NTasks; task++) {
+                            nbytes_send[task] = int(nrecv[task] * sizeof(size_t));
+                            nbytes_recv[task] = int(nsend[task] * sizeof(size_t));
+                            if (task > 0) {
+                                offset_send[task] = offset_send[task - 1] + nbytes_send[task - 1];
+                                offset_recv[task] = offset_recv[task - 1] + nbytes_recv[task - 1];
+                            }
+                        }
+                        MPI_Alltoallv(merged_FoFID.data(),
+                                      nbytes_send.data(),
+                                      offset_send.data(),
+                                      MPI_BYTE,
+                                      merged_sent_FoFID.data(),
+                                      nbytes_recv.data(),
+                                      offset_recv.data(),
+                                      MPI_BYTE,
+                                      MPI_COMM_WORLD);
+                    }
 #endif
-            foftimer.EndTiming("FoFLinking");
+                    for (size_t k = 0; k < merged_sent_index.size(); k++)
+                        FML::PARTICLE::SetFoFID(part[localindex_from_globalindex(merged_sent_index[k])],
+                                                merged_sent_FoFID[k]);
+                }
+
+            }
+            parent = std::vector<std::atomic<size_t>>();
 
             // Grid no longer needed, free up memory
-            delete[] particlegriddata;
+            PartGrid.clear();
 
             // Show timings
             if (FML::ThisTask == 0)
                 foftimer.PrintAllTimings();
 
-            // Print how many particles we found
-            auto nhalos = LocalFoFGroups.size();
-            FML::SumOverTasks(&nhalos);
-            if (FML::ThisTask == 0)
-                std::cout << "# We found a total of " << nhalos << " (" << LocalFoFGroups.size()
-                          << " on task 0) "
-                             "\n";
-
-            // We need to fix the FoFID of the halos as they start from 0 on each task
-            // so that all just have a unique ID
-            // We do this such that after mpi-sum we have the sum of the FoFIDs
-            std::vector<int> addfofid(FML::NTasks, 0);
-            for (int i = FML::ThisTask + 1; i < FML::NTasks; i++)
-                addfofid[i] = FoFID;
-#ifdef USE_MPI
-            MPI_Allreduce(MPI_IN_PLACE, addfofid.data(), NTasks, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-#endif
-     
-            // Finalize computation of halos
-            auto add = addfofid[FML::ThisTask];
-            for (auto & h : LocalFoFGroups) {
-                h.id += add;
-                h.finalize(periodic);
-            }
-
-            // If particles have a set_fofid method then set the ID in the particles
-            // This sets it to no_FoF_id if the particle is not part of a group
-            if constexpr (FML::PARTICLE::has_set_fofid<T>()) {
-                for (size_t i = 0; i < NumPart_total; i++) {
-                    auto FoFID = particle_id_FoF[i] + addfofid[FML::ThisTask];
-                    if (type_from_globalindex(i) == BOUNDARY_PARTICLE)
-                        FML::PARTICLE::SetFoFID(boundary_particles[localindex_from_globalindex(i)], FoFID);
-                    else if (type_from_globalindex(i) == REGULAR_PARTICLE)
-                        FML::PARTICLE::SetFoFID(part[localindex_from_globalindex(i)], FoFID);
-                }
-                // TODO - id should be communicated back for the boundary particles
-            }
-
             // Boundary particles are finally freed here
         }
     } // namespace FOF
@@ -0,0 +1,388 @@
+#ifndef SPHERICALOVERDENSITY_HEADER
+#define SPHERICALOVERDENSITY_HEADER
+#include <FML/FriendsOfFriends/FoF.h>
+#include <FML/Global/Global.h>
+#include <FML/MPIParticles/MPIParticles.h>
+#include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+#include <FML/ParticlesInBoxes/NeighborGrid.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace FML {
+    namespace FOF {
+
+        /// The search radius around a halo is this times the radius the FoF mass would have at the smallest
+        /// overdensity we ask for (SO masses are rarely more than a few times the FoF mass)
+        inline double SO_search_radius_factor = 2.0;
+
+        /// We only look for the maximum circular velocity outside the radius enclosing this many particles
+        inline int SO_vmax_nmin_particles = 10;
+
+        //=========================================================================
+        ///
+        /// The spherical overdensity (SO) properties of a halo (see compute_spherical_overdensity). The masses are
+        /// in the units of the particle masses (get_mass) and radii in units of the boxsize
+        ///
+        //=========================================================================
+        class SphericalOverdensityHalo {
+          public:
+            /// The radius R where the mean density inside is overdensities[i] times the mean density of the box
+            std::vector<double> radius;
+            /// The mass inside radius[i]
+            std::vector<double> mass;
+            /// The NFW concentration R / r_s estimated from Vmax / V(R) (only in 3D, 0 otherwise)
+            std::vector<double> concentration;
+            /// The maximum of M(<r)/r inside the largest radius (Vmax^2 / G)
+            double vmax2_over_G{0.0};
+            /// The density in the radial bins over the mean density of the box
+            std::vector<double> density_profile;
+            /// False if the mean density is still larger than the smallest overdensity at the search radius
+            bool converged{true};
+        };
+
+        //=========================================================================
+        ///
+        /// NFW concentration c from the ratio Vmax^2 / V(R)^2 = 0.2162 c / f(c) where f(c) = ln(1+c) - c/(1+c).
+        /// If the ratio is 1 the maximum is at (or outside) R and c is at most 2.163 which is what we return.
+        ///
+        //=========================================================================
+        inline double NFW_concentration_from_vmax_ratio(double vmax2_over_v2) {
+            const double cmin = 2.16258;
+            const double cmax = 1000.0;
+            auto ratio = [](double c) { return 0.216217 * c / (std::log(1.0 + c) - c / (1.0 + c)); };
+            if (vmax2_over_v2 <= ratio(cmin))
+                return cmin;
+            if (vmax2_over_v2 >= ratio(cmax))
+                return cmax;
+            double logc_low = std::log(cmin);
+            double logc_high = std::log(cmax);
+            while (logc_high - logc_low > 1e-8) {
+                const double logc = 0.5 * (logc_low + logc_high);
+                if (ratio(std::exp(logc)) < vmax2_over_v2)
+                    logc_low = logc;
+                else
+                    logc_high = logc;
+            }
+            return std::exp(0.5 * (logc_low + logc_high));
+        }
+
+        //=========================================================================
+        ///
+        /// Compute spherical overdensity masses, radii, concentrations and radial density profiles for a set of
+        /// (FoF) halos. This is a post-stage to FriendsOfFriends: we put the particles on the same cell grid as
+        /// the FoF linking (NeighborGrid) and for every halo we sum up the particles in the cells around its
+        /// center, so it costs one sweep over the particles close to the halos instead of building a new tree
+        /// and doing separate profile passes. The center is the one of the halo (the FoF center of mass).
+        ///
+        /// SO: the radius R is where the mean density inside first drops below overdensity times the mean
+        /// density of the box going out from the center (solved exactly between two particles). For Delta_c
+        /// relative to the critical density use Delta_c / OmegaM(z), e.g. 200 / OmegaM(z) for M200c.
+        ///
+        /// The profiles are in logarithmic bins in [rmin,rmax). We search out to the largest of rmax and
+        /// SO_search_radius_factor times the radius the FoF mass would have at the smallest overdensity.
+        ///
+        /// With MPI the halos can be on any task. We send the center of the halo to the task whose domain it
+        /// is in, get the particles within the largest search radius of the domain from the other tasks and
+        /// send the result back, so so_halos[i] is for halos[i] on the task we called it on.
+        ///
+        /// @tparam T The particle class
+        /// @tparam NDIM The number of dimensions
+        /// @tparam FoFHaloClass The halo class. Must have get_pos and get_halo_mass methods (like FoFHalo)
+        ///
+        /// @param[in] part Pointer to the local particles
+        /// @param[in] NumPart Number of local particles
+        /// @param[in] halos The halos (the center and mass is used)
+        /// @param[in] overdensities The overdensities (relative to the mean density) we want SO radii and masses for
+        /// @param[in] rmin The smallest radius in the profiles (in units of the boxsize)
+        /// @param[in] rmax The largest radius in the profiles (in units of the boxsize)
+        /// @param[in] nbins Number of bins in the profiles
+        /// @param[in] periodic Is the box periodic?
+        /// @param[out] rbin_center The center of the radial bins (geometric mean of the edges)
+        /// @param[out] so_halos The results for each of the halos
+        /// @param[in] Ngrid (Optional) The maximum gridsize. The default FoF_Ngrid_max is set in FoF.h.
+        ///
+        //=========================================================================
+        template <class T, int NDIM, class FoFHaloClass>
+        void compute_spherical_overdensity(const T * part,
+                                           size_t NumPart,
+                                           std::vector<FoFHaloClass> & halos,
+                                           const std::vector<double> & overdensities,
+                                           double rmin,
+                                           double rmax,
+                                           int nbins,
+                                           bool periodic,
+                                           std::vector<double> & rbin_center,
+                                           std::vector<SphericalOverdensityHalo> & so_halos,
+                                           int Ngrid = FoF_Ngrid_max) {
+
+            assert_mpi(FML::PARTICLE::GetNDIM(T()) == NDIM,
+                       "compute_spherical_overdensity::The dimensions of particle and method do not match!\n");
+            assert_mpi(overdensities.size() > 0 and 0.0 < rmin and rmin < rmax and nbins > 0,
+                       "compute_spherical_overdensity::Need at least one overdensity and 0 < rmin < rmax\n");
+            const int ndelta = int(overdensities.size());
+            const double delta_min = *std::min_element(overdensities.begin(), overdensities.end());
+
+            // The volume of a sphere of radius r is volume_factor * r^NDIM
+            const double volume_factor = std::pow(M_PI, NDIM / 2.0) / std::tgamma(NDIM / 2.0 + 1.0);
+
+            // The mean density of the box (the volume is 1)
+            double mean_density = 0.0;
+            size_t NumPart_tot = NumPart;
+            for (size_t i = 0; i < NumPart; i++)
+                mean_density += FML::PARTICLE::GetMass(const_cast<T &>(part[i]));
+            FML::SumOverTasks(&mean_density, &NumPart_tot);
+
+            // The radial bins
+            const double dlogr = std::log(rmax / rmin) / nbins;
+            rbin_center.resize(nbins);
+            std::vector<double> shell_volume(nbins);
+            for (int i = 0; i < nbins; i++) {
+                rbin_center[i] = rmin * std::exp((i + 0.5) * dlogr);
+                const double r_left = rmin * std::exp(i * dlogr);
+                const double r_right = rmin * std::exp((i + 1) * dlogr);
+                shell_volume[i] = volume_factor * (std::pow(r_right, NDIM) - std::pow(r_left, NDIM));
+            }
+
+            // The number of values in the result for a halo
+            const size_t nvalues = 3 * ndelta + 2 + nbins;
+
+            //=========================================================================
+            // The centers and search radii of the halos we are to compute (NDIM + 1 values per halo)
+            // With MPI we send them to the task that has the center in its domain
+            //=========================================================================
+            std::vector<double> requests;
+            std::vector<size_t> halo_order(halos.size());
+            std::iota(halo_order.begin(), halo_order.end(), 0);
+            double rsearch_max = rmax;
+            auto search_radius = [&](FoFHaloClass & h) {
+                const double volume_fof = h.get_halo_mass() / (delta_min * mean_density);
+                const double r_fof = std::pow(volume_fof / volume_factor, 1.0 / NDIM);
+                return std::max(rmax, SO_search_radius_factor * r_fof);
+            };
+            for (auto & h : halos)
+                rsearch_max = std::max(rsearch_max, search_radius(h));
+            FML::MaxOverTasks(&rsearch_max);
+            if (periodic)
+                assert_mpi(2.0 * rsearch_max < 1.0,
+                           "compute_spherical_overdensity::The search radius is larger than half the box\n");
+
+#ifdef USE_MPI
+            std::vector<int> nsend(FML::NTasks, 0), nrecv(FML::NTasks, 0);
+            double xmin_local = FML::xmin_domain;
+            const auto xmin_per_task = FML::GatherFromTasks(&xmin_local);
+            std::vector<int> task_of_halo(halos.size());
+            for (size_t i = 0; i < halos.size(); i++) {
+                const double x = halos[i].get_pos()[0];
+                const auto it = std::upper_bound(xmin_per_task.begin(), xmin_per_task.end(), x);
+                task_of_halo[i] = std::max(int(it - xmin_per_task.begin()) - 1, 0);
+                nsend[task_of_halo[i]]++;
+            }
+            std::stable_sort(halo_order.begin(), halo_order.end(), [&](size_t a, size_t b) {
+                return task_of_halo[a] < task_of_halo[b];
+            });
+#endif
+            for (auto i : halo_order) {
+                const auto * pos = halos[i].get_pos();
+                requests.insert(requests.end(), pos, pos + NDIM);
+                requests.push_back(search_radius(halos[i]));
+            }
+
+#ifdef USE_MPI
+            // Send each request to the task that is to compute it. We count in bytes below
+            std::vector<int> nbytes_send(FML::NTasks), nbytes_recv(FML::NTasks), offset_send(FML::NTasks, 0),
+                offset_recv(FML::NTasks, 0);
+            MPI_Alltoall(nsend.data(), 1, MPI_INT, nrecv.data(), 1, MPI_INT, MPI_COMM_WORLD);
+            auto set_counts = [&](size_t values_send, size_t values_recv) {
+                for (int task = 0; task < FML::NTasks; task++) {
+                    nbytes_send[task] = int(nsend[task] * values_send * sizeof(double));
+                    nbytes_recv[task] = int(nrecv[task] * values_recv * sizeof(double));
+                    if (task > 0) {
+                        offset_send[task] = offset_send[task - 1] + nbytes_send[task - 1];
+                        offset_recv[task] = offset_recv[task - 1] + nbytes_recv[task - 1];
+                    }
+                }
+            };
+            set_counts(NDIM + 1, NDIM + 1);
+            std::vector<double> requests_recv(
+                (offset_recv[FML::NTasks - 1] + nbytes_recv[FML::NTasks - 1]) / sizeof(double));
+            MPI_Alltoallv(requests.data(),
+                          nbytes_send.data(),
+                          offset_send.data(),
+                          MPI_BYTE,
+                          requests_recv.data(),
+                          nbytes_recv.data(),
+                          offset_recv.data(),
+                          MPI_BYTE,
+                          MPI_COMM_WORLD);
+            requests = std::move(requests_recv);
+#endif
+            const size_t nrequests = requests.size() / (NDIM + 1);
+
+            //=========================================================================
+            // The local particles and the ones within the search radius of our domain.
+            // The ghosts are unwrapped in x such that the grid only covers [xmin-r, xmax+r)
+            //=========================================================================
+            auto part_with_ghosts = FML::PARTICLE::get_particles_with_ghosts(part, NumPart, rsearch_max, periodic);
+            double xmin_grid = 0.0;
+            double xmax_grid = 1.0;
+            if (FML::NTasks > 1) {
+                xmin_grid = FML::xmin_domain - rsearch_max;
+                xmax_grid = FML::xmax_domain + rsearch_max;
+                if (periodic)
+                    assert_mpi(xmax_grid - xmin_grid <= 1.0,
+                               "compute_spherical_overdensity::The search radius is too large for this many tasks\n");
+                for (size_t i = NumPart; i < part_with_ghosts.size(); i++) {
+                    auto * pos = FML::PARTICLE::GetPos(part_with_ghosts[i]);
+                    if (pos[0] < xmin_grid)
+                        pos[0] += 1.0;
+                    if (pos[0] >= xmax_grid)
+                        pos[0] -= 1.0;
+                }
+            }
+
+            // Cells with a few particles in them
+            const double npart_1D = std::pow(double(NumPart_tot), 1.0 / NDIM);
+            Ngrid = std::max(1, std::min(Ngrid == 0 ? FoF_Ngrid_max : Ngrid, int(npart_1D / 2)));
+            FML::PARTICLE::NeighborGrid<NDIM> PartGrid;
+            PartGrid.create(part_with_ghosts.data(), part_with_ghosts.size(), Ngrid, periodic, xmin_grid, xmax_grid);
+
+            //=========================================================================
+            // Compute the SO quantities. One halo at the time per thread
+            //=========================================================================
+            std::vector<double> results(nrequests * nvalues, 0.0);
+            size_t nnot_converged = 0;
+#ifdef USE_OMP
+#pragma omp parallel reduction(+ : nnot_converged)
+#endif
+            {
+                // The squared distance and mass of the particles close to the halo
+                std::vector<std::pair<double, double>> r2_and_mass;
+#ifdef USE_OMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+                for (size_t ihalo = 0; ihalo < nrequests; ihalo++) {
+                    const double * center = &requests[ihalo * (NDIM + 1)];
+                    const double rsearch = requests[ihalo * (NDIM + 1) + NDIM];
+                    double * result = &results[ihalo * nvalues];
+
+                    // Gather the particles inside the search radius
+                    r2_and_mass.clear();
+                    const auto coord = PartGrid.get_cell_coord(center);
+                    const int ncells = int(std::ceil(rsearch * Ngrid));
+                    PartGrid.for_each_cell_in_range(coord, ncells, [&](size_t index) {
+                        for (const size_t * it = PartGrid.cell_begin(index); it != PartGrid.cell_end(index); ++it) {
+                            auto & p = part_with_ghosts[*it];
+                            const auto * pos = FML::PARTICLE::GetPos(p);
+                            double dist2 = 0.0;
+                            for (int idim = 0; idim < NDIM; idim++) {
+                                double dx = pos[idim] - center[idim];
+                                if (periodic) {
+                                    if (dx < -0.5)
+                                        dx += 1.0;
+                                    if (dx >= 0.5)
+                                        dx -= 1.0;
+                                }
+                                dist2 += dx * dx;
+                            }
+                            if (dist2 < rsearch * rsearch)
+                                r2_and_mass.push_back({dist2, FML::PARTICLE::GetMass(p)});
+                        }
+                    });
+                    std::sort(r2_and_mass.begin(), r2_and_mass.end());
+
+                    // Go out from the center. The mass inside radius r in [r_{k-1}, r_k) is M_{k-1}
+                    std::vector<bool> found(ndelta, false);
+                    double mass_inside = 0.0;
+                    double vmax2_over_G = 0.0;
+                    std::vector<double> vmax2_at_R(ndelta, 0.0);
+                    for (size_t k = 0; k < r2_and_mass.size(); k++) {
+                        const double r = std::sqrt(r2_and_mass[k].first);
+                        for (int i = 0; i < ndelta; i++) {
+                            if (found[i] or k == 0)
+                                continue;
+                            const double density_threshold = overdensities[i] * mean_density;
+                            if ((mass_inside + r2_and_mass[k].second) / (volume_factor * std::pow(r, NDIM)) <
+                                density_threshold) {
+                                const double R =
+                                    std::pow(mass_inside / (volume_factor * density_threshold), 1.0 / NDIM);
+                                const double r_prev = std::sqrt(r2_and_mass[k - 1].first);
+                                result[i] = std::max(r_prev, std::min(R, r));
+                                result[ndelta + i] = mass_inside;
+                                vmax2_at_R[i] = vmax2_over_G;
+                                found[i] = true;
+                            }
+                        }
+                        mass_inside += r2_and_mass[k].second;
+                        if (int(k) + 1 >= SO_vmax_nmin_particles and r > 0.0 and
+                            std::find(found.begin(), found.end(), false) != found.end())
+                            vmax2_over_G = std::max(vmax2_over_G, mass_inside / r);
+
+                        // The profile
+                        if (r >= rmin and r < rmax) {
+                            const int index = int(std::log(r / rmin) / dlogr);
+                            result[3 * ndelta + 2 + std::min(index, nbins - 1)] += r2_and_mass[k].second;
+                        }
+                    }
+                    for (int i = 0; i < ndelta; i++) {
+                        if (not found[i]) {
+                            nnot_converged++;
+                            result[3 * ndelta + 1] = 1.0;
+                            result[i] = rsearch;
+                            result[ndelta + i] = mass_inside;
+                            vmax2_at_R[i] = vmax2_over_G;
+                        }
+                        if (NDIM == 3 and vmax2_at_R[i] > 0.0)
+                            result[2 * ndelta + i] =
+                                NFW_concentration_from_vmax_ratio(vmax2_at_R[i] / (result[ndelta + i] / result[i]));
+                    }
+                    result[3 * ndelta] = vmax2_over_G;
+                    for (int i = 0; i < nbins; i++)
+                        result[3 * ndelta + 2 + i] /= shell_volume[i] * mean_density;
+                }
+            }
+            PartGrid.clear();
+            part_with_ghosts = std::vector<T>();
+
+#ifdef USE_MPI
+            // Send the results back
+            std::swap(nsend, nrecv);
+            set_counts(nvalues, nvalues);
+            std::vector<double> results_recv(halos.size() * nvalues);
+            MPI_Alltoallv(results.data(),
+                          nbytes_send.data(),
+                          offset_send.data(),
+                          MPI_BYTE,
+                          results_recv.data(),
+                          nbytes_recv.data(),
+                          offset_recv.data(),
+                          MPI_BYTE,
+                          MPI_COMM_WORLD);
+            results = std::move(results_recv);
+#endif
+
+            so_halos.resize(halos.size());
+            for (size_t k = 0; k < halos.size(); k++) {
+                const double * result = &results[k * nvalues];
+                auto & so = so_halos[halo_order[k]];
+                so.radius.assign(result, result + ndelta);
+                so.mass.assign(result + ndelta, result + 2 * ndelta);
+                so.concentration.assign(result + 2 * ndelta, result + 3 * ndelta);
+                so.vmax2_over_G = result[3 * ndelta];
+                so.converged = result[3 * ndelta + 1] == 0.0;
+                so.density_profile.assign(result + 3 * ndelta + 2, result + nvalues);
+            }
+
+            FML::SumOverTasks(&nnot_converged);
+            if (FML::ThisTask == 0 and nnot_converged > 0)
+                std::cout << "# compute_spherical_overdensity: " << nnot_converged
+                          << " SO radii were not found inside the search radius (increase SO_search_radius_factor)\n";
+        }
+
+    } // namespace FOF
+} // namespace FML
+#endif
@@ -0,0 +1,890 @@
+#ifndef GADGETHDF5_HEADER
+#define GADGETHDF5_HEADER
+#ifdef USE_HDF5
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#include <hdf5.h>
+
+#include <FML/GadgetUtils/GadgetUtils.h>
+#include <FML/Global/Global.h>
+#include <FML/MPIParticles/MPIParticles.h>
+#include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+
+//====================================================================================
+//
+// Read and write Gadget-4 / SWIFT style HDF5 snapshots. A snapshot is either
+// fileprefix.hdf5 (one file) or fileprefix.0.hdf5, ..., fileprefix.[nfiles-1].hdf5
+// with the particles of type t in the group PartType[t] (datasets Coordinates,
+// Velocities and ParticleIDs) and the attributes in the group Header.
+//
+// Reading: the particles in all the files are seen as one long array which is split
+// evenly between the tasks. Each task only reads its own index range (as hyperslabs
+// of the datasets in the files it overlaps, in chunks to bound the memory) and the
+// particles are then sent to the task whose domain they fall in. Every file is thus
+// only read once in total.
+//
+// Writing: the tasks are grouped so that nfiles tasks share a file each. The first task
+// in a group creates the file with the full size of the datasets (chunked and with
+// deflate compression) and then the tasks take turn writing their own hyperslab. This
+// only needs a serial HDF5 library.
+//
+// As for the binary Gadget files we return positions in [0,1) and peculiar velocities
+// in km/s. For Gadget files the velocities in the file are assumed to be sqrt(a) dx/dt
+// and for SWIFT files (detected from the Cosmology group) to be peculiar.
+//
+// Compile time defines:
+// USE_HDF5 : Needed to use this file (link with -lhdf5)
+//
+//====================================================================================
+
+namespace FML {
+    namespace FILEUTILS {
+        namespace GADGET {
+
+            /// The header information we use from a HDF5 snapshot
+            struct GadgetHDF5Header {
+                std::array<long long, 6> npart_file{};
+                std::array<long long, 6> npart_total{};
+                std::array<double, 6> mass{};
+                double aexp{1.0};
+                double redshift{0.0};
+                double boxsize{0.0};
+                double OmegaM{0.0};
+                double OmegaLambda{0.0};
+                double HubbleParam{0.0};
+                int num_files{1};
+                bool is_swift{false};
+            };
+
+            void print_header_info(const GadgetHDF5Header & header);
+
+            /// Class for reading Gadget-4 / SWIFT HDF5 snapshots
+            class GadgetHDF5Reader {
+              private:
+                GadgetHDF5Header header;
+
+                // The particle types to read
+                std::vector<int> particle_types{1};
+
+                // Maximum number of particles we read from a dataset at once
+                size_t nmax_per_read{1 << 20};
+
+                void throw_error(std::string errormessage) const;
+
+              public:
+                GadgetHDF5Reader() = default;
+
+                /// Set the particle types to read (default only DM, i.e. {1}). If the particle has set_family
+                /// then this is set to the type
+                void set_particle_types(std::vector<int> types);
+
+                /// Set the maximum number of particles to read from a dataset at once
+                void set_max_particles_per_read(size_t n);
+
+                /// Get the filename of file ifile for a snapshot with the given prefix
+                std::string get_filename(std::string fileprefix, int ifile) const;
+
+                /// Read the header of a file (also stored in the class)
+                GadgetHDF5Header read_header(std::string filename);
+
+                /// Get the header (assumes it has been read)
+                GadgetHDF5Header get_header() const;
+
+                /// Read all the files and store the data in part. If only_keep_part_in_domain then each task reads
+                /// 1/NTasks of the particles and these are sent to the task that owns them, otherwise all tasks
+                /// read all particles. If buffer_factor is > 1 then we allocate corresponding extra storage in part
+                template <class T, class Alloc = std::allocator<T>>
+                void read_hdf5(std::string fileprefix,
+                               std::vector<T, Alloc> & part,
+                               double buffer_factor,
+                               bool only_keep_part_in_domain,
+                               bool verbose);
+            };
+
+            /// Class for writing Gadget-4 style HDF5 snapshots
+            class GadgetHDF5Writer {
+              private:
+                // Deflate level (0 means no compression) and the number of particles per chunk
+                int compression_level{4};
+                size_t nparticles_per_chunk{1 << 16};
+
+                void throw_error(std::string errormessage) const;
+
+              public:
+                GadgetHDF5Writer() = default;
+
+                /// Set the deflate level (0-9, 0 means no compression) and the number of particles per chunk
+                void set_compression(int level, size_t nparticles_per_chunk = 1 << 16);
+
+                /// Write the particles from all tasks to nfiles files (fileprefix.hdf5 if nfiles = 1 and
+                /// fileprefix.[ifile].hdf5 otherwise). pos_norm is to convert from user units to positions in [0, box)
+                /// vel_norm is to convert from user units to sqrt(a) dxdt in units of km/s. OmegaFamilyOverOmegaM
+                /// is used to set the mass, see GadgetWriter::write_gadget_single.
+                template <class T>
+                void write_hdf5(std::string fileprefix,
+                                T * part,
+                                size_t NumPart,
+                                int nfiles,
+                                double aexp,
+                                double Boxsize,
+                                double OmegaM,
+                                double OmegaLambda,
+                                double HubbleParam,
+                                double pos_norm,
+                                double vel_norm,
+                                std::vector<double> OmegaFamilyOverOmegaM = {0., 1., 0., 0., 0., 0.});
+
+                /// Make a file (DM only) with room for NumPart particles that we fill with write_hdf5_single_block.
+                /// For writing a file a chunk of particles at the time. Not collective.
+                template <class T>
+                void create_hdf5_single(std::string filename,
+                                        size_t NumPart,
+                                        size_t NumPartTot,
+                                        int nfiles,
+                                        double aexp,
+                                        double Boxsize,
+                                        double OmegaM,
+                                        double OmegaLambda,
+                                        double HubbleParam);
+
+                /// Write the particles [offset, offset + NumPart) of a file made by create_hdf5_single
+                template <class T>
+                void write_hdf5_single_block(std::string filename,
+                                             T * part,
+                                             size_t NumPart,
+                                             size_t offset,
+                                             double pos_norm,
+                                             double vel_norm);
+            };
+
+            //====================================================================================
+            // Small helpers for attributes. These read as many values as are stored (up to n)
+            //====================================================================================
+
+            inline bool hdf5_read_attribute(hid_t loc, const std::string & name, hid_t memtype, void * data, size_t n) {
+                if (H5Aexists(loc, name.c_str()) <= 0)
+                    return false;
+                hid_t attr = H5Aopen(loc, name.c_str(), H5P_DEFAULT);
+                hid_t space = H5Aget_space(attr);
+                const size_t nstored = size_t(H5Sget_simple_extent_npoints(space));
+                H5Sclose(space);
+                herr_t status = -1;
+                if (nstored <= n) {
+                    status = H5Aread(attr, memtype, data);
+                } else {
+                    const size_t elsize = H5Tget_size(memtype);
+                    std::vector<char> tmp(nstored * elsize);
+                    status = H5Aread(attr, memtype, tmp.data());
+                    std::copy(tmp.begin(), tmp.begin() + n * elsize, (char *)data);
+                }
+                H5Aclose(attr);
+                return status >= 0;
+            }
+
+            inline void
+            hdf5_write_attribute(hid_t loc, const std::string & name, hid_t filetype, hid_t memtype, const void * data, size_t n) {
+                hsize_t dims[1] = {hsize_t(n)};
+                hid_t space = n == 1 ? H5Screate(H5S_SCALAR) : H5Screate_simple(1, dims, nullptr);
+                hid_t attr = H5Acreate2(loc, name.c_str(), filetype, space, H5P_DEFAULT, H5P_DEFAULT);
+                H5Awrite(attr, memtype, data);
+                H5Aclose(attr);
+                H5Sclose(space);
+            }
+
+            inline void print_header_info(const GadgetHDF5Header & header) {
+                std::cout << "GadgetHDF5Header:\n";
+                for (int i = 0; i < 6; i++)
+                    std::cout << "PartType" << i << " npart_file: " << header.npart_file[i]
+                              << " npart_total: " << header.npart_total[i] << " mass: " << header.mass[i] << "\n";
+                std::cout << "aexp        " << header.aexp << "\n";
+                std::cout << "Redshift    " << header.redshift << "\n";
+                std::cout << "BoxSize     " << header.boxsize << "\n";
+                std::cout << "NumFiles    " << header.num_files << "\n";
+                std::cout << "OmegaM      " << header.OmegaM << "\n";
+                std::cout << "OmegaLambda " << header.OmegaLambda << "\n";
+                std::cout << "HubbleParam " << header.HubbleParam << "\n";
+                std::cout << "SWIFT file  " << std::boolalpha << header.is_swift << "\n";
+            }
+
+            //====================================================================================
+            // GadgetHDF5Reader
+            //====================================================================================
+
+            inline void GadgetHDF5Reader::throw_error(std::string errormessage) const {
+#ifdef USE_MPI
+                std::cout << errormessage << std::flush;
+                MPI_Abort(MPI_COMM_WORLD, 1);
+                abort();
+#else
+                throw std::runtime_error(errormessage);
+#endif
+            }
+
+            inline void GadgetHDF5Reader::set_particle_types(std::vector<int> types) {
+                for (auto type : types)
+                    if (type < 0 or type >= 6)
+                        throw_error("[GadgetHDF5Reader::set_particle_types] Particle type must be in 0,...,5\n");
+                particle_types = types;
+            }
+
+            inline void GadgetHDF5Reader::set_max_particles_per_read(size_t n) { nmax_per_read = std::max(n, size_t(1)); }
+
+            inline GadgetHDF5Header GadgetHDF5Reader::get_header() const { return header; }
+
+            inline std::string GadgetHDF5Reader::get_filename(std::string fileprefix, int ifile) const {
+                // A single file is called fileprefix.hdf5 (if it exists)
+                std::string filename = fileprefix + ".hdf5";
+                if (ifile == 0 and std::ifstream(filename).good())
+                    return filename;
+                return fileprefix + "." + std::to_string(ifile) + ".hdf5";
+            }
+
+            inline GadgetHDF5Header GadgetHDF5Reader::read_header(std::string filename) {
+                hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+                if (file < 0)
+                    throw_error("[GadgetHDF5Reader::read_header] Could not open file " + filename + "\n");
+                hid_t group = H5Gopen2(file, "Header", H5P_DEFAULT);
+                if (group < 0)
+                    throw_error("[GadgetHDF5Reader::read_header] No Header group in file " + filename + "\n");
+
+                header = GadgetHDF5Header{};
+                std::array<long long, 6> highword{};
+                hdf5_read_attribute(group, "NumPart_ThisFile", H5T_NATIVE_LLONG, header.npart_file.data(), 6);
+                hdf5_read_attribute(group, "NumPart_Total", H5T_NATIVE_LLONG, header.npart_total.data(), 6);
+                hdf5_read_attribute(group, "NumPart_Total_HighWord", H5T_NATIVE_LLONG, highword.data(), 6);
+                for (int i = 0; i < 6; i++)
+                    header.npart_total[i] += highword[i] << 32;
+                hdf5_read_attribute(group, "MassTable", H5T_NATIVE_DOUBLE, header.mass.data(), 6);
+                hdf5_read_attribute(group, "NumFilesPerSnapshot", H5T_NATIVE_INT, &header.num_files, 1);
+                hdf5_read_attribute(group, "BoxSize", H5T_NATIVE_DOUBLE, &header.boxsize, 1);
+                hdf5_read_attribute(group, "Redshift", H5T_NATIVE_DOUBLE, &header.redshift, 1);
+                header.aexp = 1.0 / (1.0 + header.redshift);
+                hdf5_read_attribute(group, "Time", H5T_NATIVE_DOUBLE, &header.aexp, 1);
+                hdf5_read_attribute(group, "Omega0", H5T_NATIVE_DOUBLE, &header.OmegaM, 1);
+                hdf5_read_attribute(group, "OmegaLambda", H5T_NATIVE_DOUBLE, &header.OmegaLambda, 1);
+                hdf5_read_attribute(group, "HubbleParam", H5T_NATIVE_DOUBLE, &header.HubbleParam, 1);
+                H5Gclose(group);
+
+                // SWIFT has the cosmology (and the scale factor, Time is cosmic time) in its own group
+                if (H5Lexists(file, "Cosmology", H5P_DEFAULT) > 0) {
+                    header.is_swift = true;
+                    group = H5Gopen2(file, "Cosmology", H5P_DEFAULT);
+                    hdf5_read_attribute(group, "Scale-factor", H5T_NATIVE_DOUBLE, &header.aexp, 1);
+                    hdf5_read_attribute(group, "Omega_m", H5T_NATIVE_DOUBLE, &header.OmegaM, 1);
+                    hdf5_read_attribute(group, "Omega_lambda", H5T_NATIVE_DOUBLE, &header.OmegaLambda, 1);
+                    hdf5_read_attribute(group, "h", H5T_NATIVE_DOUBLE, &header.HubbleParam, 1);
+                    H5Gclose(group);
+                }
+                H5Fclose(file);
+
+                if (header.boxsize <= 0.0)
+                    throw_error("[GadgetHDF5Reader::read_header] BoxSize is missing or not positive in " + filename +
+                                "\n");
+                return header;
+            }
+
+            template <class T, class Alloc>
+            void GadgetHDF5Reader::read_hdf5(std::string fileprefix,
+                                             std::vector<T, Alloc> & part,
+                                             double buffer_factor,
+                                             bool only_keep_part_in_domain,
+                                             bool verbose) {
+
+                const int NDIM = FML::PARTICLE::GetNDIM(T());
+                const bool verbose_task0 = verbose and FML::ThisTask == 0;
+
+                // Read the number of files from the first one
+                const GadgetHDF5Header header_first_file = read_header(get_filename(fileprefix, 0));
+                if (verbose_task0)
+                    print_header_info(header);
+                const int nfiles = header.num_files;
+                const double pos_norm = 1.0 / header.boxsize;
+                const double vel_norm = header.is_swift ? 1.0 : std::sqrt(header.aexp);
+
+                // Number of particles of each type in each file (each task reads some of the headers)
+                std::vector<long long> npart_in_file(size_t(nfiles) * 6, 0);
+                for (int i = FML::ThisTask; i < nfiles; i += FML::NTasks) {
+                    auto head = read_header(get_filename(fileprefix, i));
+                    for (int type = 0; type < 6; type++)
+                        npart_in_file[size_t(i) * 6 + type] = head.npart_file[type];
+                }
+#ifdef USE_MPI
+                MPI_Allreduce(
+                    MPI_IN_PLACE, npart_in_file.data(), int(npart_in_file.size()), MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+#endif
+                header = header_first_file;
+
+                // The particles we want, ordered by (file, type), seen as one array. Find the range we read
+                long long npart_total = 0;
+                for (int i = 0; i < nfiles; i++)
+                    for (auto type : particle_types)
+                        npart_total += npart_in_file[size_t(i) * 6 + type];
+                const long long index_start =
+                    only_keep_part_in_domain ? (npart_total * FML::ThisTask) / FML::NTasks : 0;
+                const long long index_end =
+                    only_keep_part_in_domain ? (npart_total * (FML::ThisTask + 1)) / FML::NTasks : npart_total;
+
+                // Allocate what we expect to end up with (the storage grows if needed)
+                const size_t nalloc = only_keep_part_in_domain ?
+                                          size_t(double(npart_total) * std::max(buffer_factor, 1.0)) / FML::NTasks :
+                                          size_t(double(npart_total) * std::max(buffer_factor, 1.0));
+                FML::Vector<T> local;
+                local.reserve(std::max(nalloc, size_t(index_end - index_start)));
+
+                std::vector<double> buffer;
+                std::vector<long long> id_buffer;
+                long long offset = 0;
+                for (int i = 0; i < nfiles; i++) {
+
+                    // Check if we need anything from this file
+                    long long npart_file = 0;
+                    for (auto type : particle_types)
+                        npart_file += npart_in_file[size_t(i) * 6 + type];
+                    if (offset + npart_file <= index_start or offset >= index_end) {
+                        offset += npart_file;
+                        continue;
+                    }
+
+                    const std::string filename = get_filename(fileprefix, i);
+                    if (verbose)
+                        std::cout << "Task " << FML::ThisTask << " reading from " << filename << "\n";
+                    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+                    if (file < 0)
+                        throw_error("[GadgetHDF5Reader::read_hdf5] Could not open file " + filename + "\n");
+
+                    for (auto type : particle_types) {
+                        const long long npart_type = npart_in_file[size_t(i) * 6 + type];
+
+                        // The range [first, last) of this dataset we are to read
+                        const long long first = std::max(index_start - offset, 0LL);
+                        const long long last = std::min(index_end - offset, npart_type);
+                        offset += npart_type;
+                        if (first >= last)
+                            continue;
+
+                        const std::string groupname = "PartType" + std::to_string(type);
+                        hid_t group = H5Gopen2(file, groupname.c_str(), H5P_DEFAULT);
+                        if (group < 0)
+                            throw_error("[GadgetHDF5Reader::read_hdf5] Missing group " + groupname + " in " + filename +
+                                        "\n");
+
+                        // Read a block [start, start + n) of a dataset with ncomp components into buffer
+                        auto read_block = [&](const char * name, hid_t memtype, void * data, long long start,
+                                              long long n, int ncomp) -> bool {
+                            if (H5Lexists(group, name, H5P_DEFAULT) <= 0)
+                                return false;
+                            hid_t dataset = H5Dopen2(group, name, H5P_DEFAULT);
+                            hid_t filespace = H5Dget_space(dataset);
+                            const int rank = H5Sget_simple_extent_ndims(filespace);
+                            hsize_t dims[2] = {0, 1};
+                            H5Sget_simple_extent_dims(filespace, dims, nullptr);
+                            if ((rank == 1 ? 1 : int(dims[1])) != ncomp)
+                                throw_error("[GadgetHDF5Reader::read_hdf5] Dataset " + std::string(name) +
+                                            " has the wrong number of components\n");
+                            hsize_t fstart[2] = {hsize_t(start), 0};
+                            hsize_t fcount[2] = {hsize_t(n), hsize_t(ncomp)};
+                            H5Sselect_hyperslab(filespace, H5S_SELECT_SET, fstart, nullptr, fcount, nullptr);
+                            hid_t memspace = H5Screate_simple(rank, fcount, nullptr);
+                            herr_t status = H5Dread(dataset, memtype, memspace, filespace, H5P_DEFAULT, data);
+                            H5Sclose(memspace);
+                            H5Sclose(filespace);
+                            H5Dclose(dataset);
+                            if (status < 0)
+                                throw_error("[GadgetHDF5Reader::read_hdf5] Failed to read " + std::string(name) +
+                                            " from " + filename + "\n");
+                            return true;
+                        };
+
+                        // Read in chunks to not use too much memory on the buffer
+                        for (long long start = first; start < last; start += (long long)(nmax_per_read)) {
+                            const long long n = std::min(last - start, (long long)(nmax_per_read));
+                            const size_t index = local.size();
+                            local.resize(index + n);
+
+                            buffer.resize(n * NDIM);
+                            if (read_block("Coordinates", H5T_NATIVE_DOUBLE, buffer.data(), start, n, NDIM)) {
+                                if constexpr (FML::PARTICLE::has_get_pos<T>()) {
+                                    for (long long j = 0; j < n; j++) {
+                                        auto * pos = FML::PARTICLE::GetPos(local[index + j]);
+                                        for (int idim = 0; idim < NDIM; idim++) {
+                                            pos[idim] = buffer[NDIM * j + idim] * pos_norm;
+                                            if (pos[idim] >= 1.0)
+                                                pos[idim] -= 1.0;
+                                            if (pos[idim] < 0.0)
+                                                pos[idim] += 1.0;
+                                        }
+                                    }
+                                }
+                            } else {
+                                throw_error("[GadgetHDF5Reader::read_hdf5] No Coordinates in " + groupname + " in " +
+                                            filename + "\n");
+                            }
+
+                            if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                                if (read_block("Velocities", H5T_NATIVE_DOUBLE, buffer.data(), start, n, NDIM)) {
+                                    for (long long j = 0; j < n; j++) {
+                                        auto * vel = FML::PARTICLE::GetVel(local[index + j]);
+                                        for (int idim = 0; idim < NDIM; idim++)
+                                            vel[idim] = buffer[NDIM * j + idim] * vel_norm;
+                                    }
+                                }
+                            }
+
+                            if constexpr (FML::PARTICLE::has_set_id<T>()) {
+                                id_buffer.resize(n);
+                                if (read_block("ParticleIDs", H5T_NATIVE_LLONG, id_buffer.data(), start, n, 1)) {
+                                    for (long long j = 0; j < n; j++)
+                                        FML::PARTICLE::SetID(local[index + j], id_buffer[j]);
+                                }
+                            }
+
+                            if constexpr (FML::PARTICLE::has_set_family<T>()) {
+                                for (long long j = 0; j < n; j++)
+                                    FML::PARTICLE::SetFamily(local[index + j], type);
+                            }
+                        }
+                        H5Gclose(group);
+                    }
+                    H5Fclose(file);
+                }
+
+                if (not only_keep_part_in_domain) {
+                    part.clear();
+                    part.reserve(nalloc);
+                    part.insert(part.end(), std::make_move_iterator(local.begin()), std::make_move_iterator(local.end()));
+                    return;
+                }
+
+                // Send the particles to the task that owns them
+                FML::PARTICLE::MPIParticles<T> mpipart;
+                mpipart.move_from(std::move(local));
+                mpipart.communicate_particles();
+                const size_t npart_local = mpipart.get_npart();
+                if (verbose_task0)
+                    std::cout << "Read " << mpipart.get_npart_total() << " particles from " << nfiles << " files\n";
+
+                // Copy them over to part (or just move them if the allocators agree)
+                auto & p = mpipart.get_particles();
+                if constexpr (std::is_same<Alloc, typename FML::LargeVector<T>::allocator_type>::value) {
+                    part = std::move(p);
+                    part.resize(npart_local);
+                } else {
+                    part.clear();
+                    part.reserve(std::max(npart_local, nalloc));
+                    part.insert(part.end(),
+                                std::make_move_iterator(p.begin()),
+                                std::make_move_iterator(p.begin() + npart_local));
+                    mpipart.free();
+                }
+            }
+
+            //====================================================================================
+            // GadgetHDF5Writer
+            //====================================================================================
+
+            inline void GadgetHDF5Writer::throw_error(std::string errormessage) const {
+#ifdef USE_MPI
+                std::cout << errormessage << std::flush;
+                MPI_Abort(MPI_COMM_WORLD, 1);
+                abort();
+#else
+                throw std::runtime_error(errormessage);
+#endif
+            }
+
+            inline void GadgetHDF5Writer::set_compression(int level, size_t nparticles_per_chunk) {
+                if (level < 0 or level > 9)
+                    throw_error("[GadgetHDF5Writer::set_compression] Compression level must be in 0,...,9\n");
+                compression_level = level;
+                this->nparticles_per_chunk = std::max(nparticles_per_chunk, size_t(1));
+            }
+
+            template <class T>
+            void GadgetHDF5Writer::write_hdf5(std::string fileprefix,
+                                              T * part,
+                                              size_t NumPart,
+                                              int nfiles,
+                                              double aexp,
+                                              double Boxsize,
+                                              double OmegaM,
+                                              double OmegaLambda,
+                                              double HubbleParam,
+                                              double pos_norm,
+                                              double vel_norm,
+                                              std::vector<double> OmegaFamilyOverOmegaM) {
+
+                const int NDIM = FML::PARTICLE::GetNDIM(T());
+                nfiles = std::max(1, std::min(nfiles, FML::NTasks));
+                const int ifile = int((long long)(FML::ThisTask) * nfiles / FML::NTasks);
+                const std::string filename =
+                    nfiles == 1 ? fileprefix + ".hdf5" : fileprefix + "." + std::to_string(ifile) + ".hdf5";
+
+                // Count how many of each type we have
+                auto family_of = [&](size_t i) -> int {
+                    if constexpr (FML::PARTICLE::has_get_family<T>()) {
+                        const int family = int(FML::PARTICLE::GetFamily(part[i]));
+                        return (family >= 0 and family < 6) ? family : -1;
+                    } else {
+                        (void)i;
+                        return 1;
+                    }
+                };
+                std::array<long long, 6> npart_family{};
+                for (size_t i = 0; i < NumPart; i++) {
+                    const int family = family_of(i);
+                    if (family >= 0)
+                        npart_family[family]++;
+                }
+
+                // The number of each type on all tasks. From this we get the number of each type in the file
+                // and where in the file our particles go
+                auto npart_family_task = FML::GatherFromTasks(&npart_family);
+                std::array<long long, 6> npart_family_tot{};
+                std::array<long long, 6> npart_family_file{};
+                std::array<long long, 6> offset_in_file{};
+                for (int task = 0; task < FML::NTasks; task++) {
+                    const int taskfile = int((long long)(task)*nfiles / FML::NTasks);
+                    for (int type = 0; type < 6; type++) {
+                        npart_family_tot[type] += npart_family_task[task][type];
+                        if (taskfile == ifile) {
+                            if (task < FML::ThisTask)
+                                offset_in_file[type] += npart_family_task[task][type];
+                            npart_family_file[type] += npart_family_task[task][type];
+                        }
+                    }
+                }
+
+                std::array<double, 6> mass_in_1e10_msunh{};
+                for (int i = 0; i < 6; i++) {
+                    mass_in_1e10_msunh[i] = npart_family_tot[i] == 0 ?
+                                                0.0 :
+                                                3.0 * OmegaM * OmegaFamilyOverOmegaM[i] * MplMpl_over_H0Msunh *
+                                                    std::pow(Boxsize / HubbleLengthInMpch, 3) /
+                                                    double(npart_family_tot[1]) / 1e10;
+                }
+
+                // The tasks that share a file
+#ifdef USE_MPI
+                MPI_Comm filecomm;
+                MPI_Comm_split(MPI_COMM_WORLD, ifile, FML::ThisTask, &filecomm);
+                int rank_in_file, ntasks_in_file;
+                MPI_Comm_rank(filecomm, &rank_in_file);
+                MPI_Comm_size(filecomm, &ntasks_in_file);
+#else
+                const int rank_in_file = 0;
+                const int ntasks_in_file = 1;
+#endif
+
+                // The first task in the group creates the file, the header and the datasets
+                if (rank_in_file == 0) {
+                    hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+                    if (file < 0)
+                        throw_error("[GadgetHDF5Writer::write_hdf5] Could not create file " + filename + "\n");
+
+                    hid_t group = H5Gcreate2(file, "Header", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+                    std::array<unsigned int, 6> highword{};
+                    std::array<unsigned int, 6> lowword{};
+                    for (int i = 0; i < 6; i++) {
+                        highword[i] = (unsigned int)(npart_family_tot[i] >> 32);
+                        lowword[i] = (unsigned int)(npart_family_tot[i] & 0xFFFFFFFFLL);
+                    }
+                    const double redshift = 1.0 / aexp - 1.0;
+                    const int flag_double = 0;
+                    hdf5_write_attribute(
+                        group, "NumPart_ThisFile", H5T_STD_I64LE, H5T_NATIVE_LLONG, npart_family_file.data(), 6);
+                    hdf5_write_attribute(
+                        group, "NumPart_Total", H5T_STD_U32LE, H5T_NATIVE_UINT, lowword.data(), 6);
+                    hdf5_write_attribute(
+                        group, "NumPart_Total_HighWord", H5T_STD_U32LE, H5T_NATIVE_UINT, highword.data(), 6);
+                    hdf5_write_attribute(
+                        group, "MassTable", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, mass_in_1e10_msunh.data(), 6);
+                    hdf5_write_attribute(group, "Time", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &aexp, 1);
+                    hdf5_write_attribute(group, "Redshift", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &redshift, 1);
+                    hdf5_write_attribute(group, "BoxSize", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &Boxsize, 1);
+                    hdf5_write_attribute(group, "NumFilesPerSnapshot", H5T_STD_I32LE, H5T_NATIVE_INT, &nfiles, 1);
+                    hdf5_write_attribute(group, "Omega0", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &OmegaM, 1);
+                    hdf5_write_attribute(group, "OmegaLambda", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &OmegaLambda, 1);
+                    hdf5_write_attribute(group, "HubbleParam", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &HubbleParam, 1);
+                    hdf5_write_attribute(
+                        group, "Flag_DoublePrecision", H5T_STD_I32LE, H5T_NATIVE_INT, &flag_double, 1);
+                    H5Gclose(group);
+
+                    for (int type = 0; type < 6; type++) {
+                        if (npart_family_file[type] == 0)
+                            continue;
+                        const std::string groupname = "PartType" + std::to_string(type);
+                        group = H5Gcreate2(file, groupname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+
+                        auto create = [&](const char * name, hid_t filetype, int ncomp) {
+                            hsize_t dims[2] = {hsize_t(npart_family_file[type]), hsize_t(ncomp)};
+                            hsize_t chunk[2] = {hsize_t(std::min(npart_family_file[type], (long long)(nparticles_per_chunk))),
+                                                hsize_t(ncomp)};
+                            const int rank = ncomp == 1 ? 1 : 2;
+                            hid_t space = H5Screate_simple(rank, dims, nullptr);
+                            hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+                            H5Pset_chunk(plist, rank, chunk);
+                            if (compression_level > 0) {
+                                H5Pset_shuffle(plist);
+                                H5Pset_deflate(plist, compression_level);
+                            }
+                            hid_t dataset = H5Dcreate2(group, name, filetype, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+                            if (dataset < 0)
+                                throw_error("[GadgetHDF5Writer::write_hdf5] Could not create dataset " +
+                                            std::string(name) + "\n");
+                            H5Dclose(dataset);
+                            H5Pclose(plist);
+                            H5Sclose(space);
+                        };
+                        if constexpr (FML::PARTICLE::has_get_pos<T>())
+                            create("Coordinates", H5T_IEEE_F32LE, NDIM);
+                        if constexpr (FML::PARTICLE::has_get_vel<T>())
+                            create("Velocities", H5T_IEEE_F32LE, NDIM);
+                        if constexpr (FML::PARTICLE::has_get_id<T>())
+                            create("ParticleIDs", H5T_STD_U64LE, 1);
+                        H5Gclose(group);
+                    }
+                    H5Fclose(file);
+                }
+
+                // The tasks in the group take turn writing their hyperslabs
+                for (int rank = 0; rank < ntasks_in_file; rank++) {
+#ifdef USE_MPI
+                    MPI_Barrier(filecomm);
+#endif
+                    if (rank != rank_in_file or NumPart == 0)
+                        continue;
+
+                    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+                    if (file < 0)
+                        throw_error("[GadgetHDF5Writer::write_hdf5] Could not open file " + filename + "\n");
+
+                    std::vector<float> buffer;
+                    std::vector<unsigned long long> id_buffer;
+                    for (int type = 0; type < 6; type++) {
+                        if (npart_family[type] == 0)
+                            continue;
+                        const std::string groupname = "PartType" + std::to_string(type);
+                        hid_t group = H5Gopen2(file, groupname.c_str(), H5P_DEFAULT);
+
+                        // Write the block [offset_in_file, offset_in_file + n) of a dataset
+                        auto write_block = [&](const char * name, hid_t memtype, const void * data, int ncomp) {
+                            hid_t dataset = H5Dopen2(group, name, H5P_DEFAULT);
+                            hid_t filespace = H5Dget_space(dataset);
+                            const int rank = ncomp == 1 ? 1 : 2;
+                            hsize_t fstart[2] = {hsize_t(offset_in_file[type]), 0};
+                            hsize_t fcount[2] = {hsize_t(npart_family[type]), hsize_t(ncomp)};
+                            H5Sselect_hyperslab(filespace, H5S_SELECT_SET, fstart, nullptr, fcount, nullptr);
+                            hid_t memspace = H5Screate_simple(rank, fcount, nullptr);
+                            herr_t status = H5Dwrite(dataset, memtype, memspace, filespace, H5P_DEFAULT, data);
+                            H5Sclose(memspace);
+                            H5Sclose(filespace);
+                            H5Dclose(dataset);
+                            if (status < 0)
+                                throw_error("[GadgetHDF5Writer::write_hdf5] Failed to write " + std::string(name) +
+                                            " to " + filename + "\n");
+                        };
+
+                        if constexpr (FML::PARTICLE::has_get_pos<T>()) {
+                            buffer.clear();
+                            for (size_t i = 0; i < NumPart; i++) {
+                                if (family_of(i) != type)
+                                    continue;
+                                auto * pos = FML::PARTICLE::GetPos(part[i]);
+                                for (int idim = 0; idim < NDIM; idim++)
+                                    buffer.push_back(float(pos[idim] * pos_norm));
+                            }
+                            write_block("Coordinates", H5T_NATIVE_FLOAT, buffer.data(), NDIM);
+                        }
+                        if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                            buffer.clear();
+                            for (size_t i = 0; i < NumPart; i++) {
+                                if (family_of(i) != type)
+                                    continue;
+                                auto * vel = FML::PARTICLE::GetVel(part[i]);
+                                for (int idim = 0; idim < NDIM; idim++)
+                                    buffer.push_back(float(vel[idim] * vel_norm));
+                            }
+                            write_block("Velocities", H5T_NATIVE_FLOAT, buffer.data(), NDIM);
+                        }
+                        if constexpr (FML::PARTICLE::has_get_id<T>()) {
+                            id_buffer.clear();
+                            for (size_t i = 0; i < NumPart; i++) {
+                                if (family_of(i) != type)
+                                    continue;
+                                id_buffer.push_back((unsigned long long)(FML::PARTICLE::GetID(part[i])));
+                            }
+                            write_block("ParticleIDs", H5T_NATIVE_ULLONG, id_buffer.data(), 1);
+                        }
+                        H5Gclose(group);
+                    }
+                    H5Fclose(file);
+                }
+#ifdef USE_MPI
+                // Make sure all files are complete before we return
+                MPI_Comm_free(&filecomm);
+                MPI_Barrier(MPI_COMM_WORLD);
+#endif
+            }
+
+            template <class T>
+            void GadgetHDF5Writer::create_hdf5_single(std::string filename,
+                                                      size_t NumPart,
+                                                      size_t NumPartTot,
+                                                      int nfiles,
+                                                      double aexp,
+                                                      double Boxsize,
+                                                      double OmegaM,
+                                                      double OmegaLambda,
+                                                      double HubbleParam) {
+                const int NDIM = FML::PARTICLE::GetNDIM(T());
+
+                hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+                if (file < 0)
+                    throw_error("[GadgetHDF5Writer::create_hdf5_single] Could not create file " + filename + "\n");
+
+                std::array<long long, 6> npart_file{0, (long long)(NumPart), 0, 0, 0, 0};
+                std::array<unsigned int, 6> highword{};
+                std::array<unsigned int, 6> lowword{};
+                highword[1] = (unsigned int)((unsigned long long)(NumPartTot) >> 32);
+                lowword[1] = (unsigned int)((unsigned long long)(NumPartTot)&0xFFFFFFFFULL);
+                std::array<double, 6> mass_in_1e10_msunh{};
+                if (NumPartTot > 0)
+                    mass_in_1e10_msunh[1] = 3.0 * OmegaM * MplMpl_over_H0Msunh *
+                                            std::pow(Boxsize / HubbleLengthInMpch, 3) / double(NumPartTot) / 1e10;
+                const double redshift = 1.0 / aexp - 1.0;
+                const int flag_double = 0;
+
+                hid_t group = H5Gcreate2(file, "Header", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+                hdf5_write_attribute(group, "NumPart_ThisFile", H5T_STD_I64LE, H5T_NATIVE_LLONG, npart_file.data(), 6);
+                hdf5_write_attribute(group, "NumPart_Total", H5T_STD_U32LE, H5T_NATIVE_UINT, lowword.data(), 6);
+                hdf5_write_attribute(
+                    group, "NumPart_Total_HighWord", H5T_STD_U32LE, H5T_NATIVE_UINT, highword.data(), 6);
+                hdf5_write_attribute(
+                    group, "MassTable", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, mass_in_1e10_msunh.data(), 6);
+                hdf5_write_attribute(group, "Time", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &aexp, 1);
+                hdf5_write_attribute(group, "Redshift", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &redshift, 1);
+                hdf5_write_attribute(group, "BoxSize", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &Boxsize, 1);
+                hdf5_write_attribute(group, "NumFilesPerSnapshot", H5T_STD_I32LE, H5T_NATIVE_INT, &nfiles, 1);
+                hdf5_write_attribute(group, "Omega0", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &OmegaM, 1);
+                hdf5_write_attribute(group, "OmegaLambda", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &OmegaLambda, 1);
+                hdf5_write_attribute(group, "HubbleParam", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &HubbleParam, 1);
+                hdf5_write_attribute(group, "Flag_DoublePrecision", H5T_STD_I32LE, H5T_NATIVE_INT, &flag_double, 1);
+                H5Gclose(group);
+
+                if (NumPart > 0) {
+                    group = H5Gcreate2(file, "PartType1", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+                    auto create = [&](const char * name, hid_t filetype, int ncomp) {
+                        hsize_t dims[2] = {hsize_t(NumPart), hsize_t(ncomp)};
+                        hsize_t chunk[2] = {hsize_t(std::min(NumPart, nparticles_per_chunk)), hsize_t(ncomp)};
+                        const int rank = ncomp == 1 ? 1 : 2;
+                        hid_t space = H5Screate_simple(rank, dims, nullptr);
+                        hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+                        H5Pset_chunk(plist, rank, chunk);
+                        if (compression_level > 0) {
+                            H5Pset_shuffle(plist);
+                            H5Pset_deflate(plist, compression_level);
+                        }
+                        hid_t dataset = H5Dcreate2(group, name, filetype, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+                        if (dataset < 0)
+                            throw_error("[GadgetHDF5Writer::create_hdf5_single] Could not create dataset " +
+                                        std::string(name) + "\n");
+                        H5Dclose(dataset);
+                        H5Pclose(plist);
+                        H5Sclose(space);
+                    };
+                    if constexpr (FML::PARTICLE::has_get_pos<T>())
+                        create("Coordinates", H5T_IEEE_F32LE, NDIM);
+                    if constexpr (FML::PARTICLE::has_get_vel<T>())
+                        create("Velocities", H5T_IEEE_F32LE, NDIM);
+                    if constexpr (FML::PARTICLE::has_get_id<T>())
+                        create("ParticleIDs", H5T_STD_U64LE, 1);
+                    H5Gclose(group);
+                }
+                H5Fclose(file);
+            }
+
+            template <class T>
+            void GadgetHDF5Writer::write_hdf5_single_block(std::string filename,
+                                                           T * part,
+                                                           size_t NumPart,
+                                                           size_t offset,
+                                                           double pos_norm,
+                                                           double vel_norm) {
+                if (NumPart == 0)
+                    return;
+                const int NDIM = FML::PARTICLE::GetNDIM(T());
+
+                hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+                if (file < 0)
+                    throw_error("[GadgetHDF5Writer::write_hdf5_single_block] Could not open file " + filename + "\n");
+                hid_t group = H5Gopen2(file, "PartType1", H5P_DEFAULT);
+
+                auto write_block = [&](const char * name, hid_t memtype, const void * data, int ncomp) {
+                    hid_t dataset = H5Dopen2(group, name, H5P_DEFAULT);
+                    hid_t filespace = H5Dget_space(dataset);
+                    const int rank = ncomp == 1 ? 1 : 2;
+                    hsize_t fstart[2] = {hsize_t(offset), 0};
+                    hsize_t fcount[2] = {hsize_t(NumPart), hsize_t(ncomp)};
+                    hsize_t dims[2];
+                    H5Sget_simple_extent_dims(filespace, dims, nullptr);
+                    if (offset + NumPart > dims[0])
+                        throw_error("[GadgetHDF5Writer::write_hdf5_single_block] The particles do not fit in " +
+                                    filename + "\n");
+                    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, fstart, nullptr, fcount, nullptr);
+                    hid_t memspace = H5Screate_simple(rank, fcount, nullptr);
+                    herr_t status = H5Dwrite(dataset, memtype, memspace, filespace, H5P_DEFAULT, data);
+                    H5Sclose(memspace);
+                    H5Sclose(filespace);
+                    H5Dclose(dataset);
+                    if (status < 0)
+                        throw_error("[GadgetHDF5Writer::write_hdf5_single_block] Failed to write " +
+                                    std::string(name) + " to " + filename + "\n");
+                };
+
+                std::vector<float> buffer;
+                if constexpr (FML::PARTICLE::has_get_pos<T>()) {
+                    buffer.resize(NumPart * NDIM);
+                    for (size_t i = 0; i < NumPart; i++) {
+                        auto * pos = FML::PARTICLE::GetPos(part[i]);
+                        for (int idim = 0; idim < NDIM; idim++)
+                            buffer[i * NDIM + idim] = float(pos[idim] * pos_norm);
+                    }
+                    write_block("Coordinates", H5T_NATIVE_FLOAT, buffer.data(), NDIM);
+                }
+                if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                    buffer.resize(NumPart * NDIM);
+                    for (size_t i = 0; i < NumPart; i++) {
+                        auto * vel = FML::PARTICLE::GetVel(part[i]);
+                        for (int idim = 0; idim < NDIM; idim++)
+                            buffer[i * NDIM + idim] = float(vel[idim] * vel_norm);
+                    }
+                    write_block("Velocities", H5T_NATIVE_FLOAT, buffer.data(), NDIM);
+                }
+                if constexpr (FML::PARTICLE::has_get_id<T>()) {
+                    std::vector<unsigned long long> id_buffer(NumPart);
+                    for (size_t i = 0; i < NumPart; i++)
+                        id_buffer[i] = (unsigned long long)(FML::PARTICLE::GetID(part[i]));
+                    write_block("ParticleIDs", H5T_NATIVE_ULLONG, id_buffer.data(), 1);
+                }
+                H5Gclose(group);
+                H5Fclose(file);
+            }
+
+        } // namespace GADGET
+    }     // namespace FILEUTILS
+} // namespace FML
+
+#endif
+#endif
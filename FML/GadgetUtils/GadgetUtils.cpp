@@ -56,6 +56,11 @@ namespace FML {
 
             void GadgetReader::set_fields_in_file(std::vector<std::string> fields) { fields_in_file = fields; }
 
+            void GadgetReader::set_use_mmap(bool _use_mmap, bool _use_hugepages) {
+                use_mmap = _use_mmap;
+                use_hugepages = _use_hugepages;
+            }
+
             GadgetReader::GadgetReader(int ndim) : NDIM(ndim) {}
 
             GadgetHeader GadgetReader::get_header() { return header; }
@@ -153,6 +158,75 @@ namespace FML {
 
             GadgetWriter::GadgetWriter(int ndim) : NDIM(ndim) {}
 
+            void GadgetWriter::set_async_write(bool _async_write, size_t nparticles_per_chunk) {
+                async_write = _async_write;
+                async_nparticles_per_chunk = nparticles_per_chunk;
+            }
+
+            //==============================================================================================
+            //==============================================================================================
+
+            DoubleBufferedWriter::DoubleBufferedWriter(std::ofstream & _fp, size_t buffer_bytes) : fp(_fp) {
+                buffers[0].resize(buffer_bytes);
+                buffers[1].resize(buffer_bytes);
+                thread = std::thread(&DoubleBufferedWriter::run, this);
+            }
+
+            DoubleBufferedWriter::~DoubleBufferedWriter() {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return not has_work; });
+                    done = true;
+                }
+                cv.notify_all();
+                thread.join();
+            }
+
+            void DoubleBufferedWriter::run() {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true) {
+                    cv.wait(lock, [this] { return has_work or done; });
+                    if (not has_work)
+                        return;
+                    // The buffer we are to write is the one the caller is not filling
+                    const std::vector<char> & buffer = buffers[1 - current];
+                    const size_t nbytes = nbytes_to_write;
+                    lock.unlock();
+                    fp.write(buffer.data(), nbytes);
+                    lock.lock();
+                    has_work = false;
+                    cv.notify_all();
+                }
+            }
+
+            char * DoubleBufferedWriter::buffer() { return buffers[current].data(); }
+
+            size_t DoubleBufferedWriter::buffer_size() const { return buffers[current].size(); }
+
+            void DoubleBufferedWriter::submit(size_t nbytes) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return not has_work; });
+                    nbytes_to_write = nbytes;
+                    current = 1 - current;
+                    has_work = true;
+                }
+                cv.notify_all();
+            }
+
+            void DoubleBufferedWriter::write(const void * data, size_t nbytes) {
+                flush();
+                fp.write(static_cast<const char *>(data), nbytes);
+            }
+
+            void DoubleBufferedWriter::flush() {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return not has_work; });
+            }
+
+            //==============================================================================================
+            //==============================================================================================
+
             void GadgetWriter::write_section(std::ofstream & fp, std::vector<char> & buffer, int bytes) {
                 if (not fp.is_open()) {
                     std::string errormessage = "[GadgetWriter::write_section] File is not open\n";
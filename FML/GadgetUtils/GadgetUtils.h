@@ -1,18 +1,35 @@
 #ifndef GADGETUTILS_HEADER
 #define GADGETUTILS_HEADER
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <climits>
 #include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #ifdef USE_MPI
 #include <mpi.h>
 #endif
 
+#if defined(__unix__) || defined(__unix) || defined(unix) || (defined(__APPLE__) && defined(__MACH__))
+#define GADGET_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <FML/Global/Global.h>
+#include <FML/MPIParticles/MPIParticles.h>
 #include <FML/ParticleTypes/ReflectOnParticleMethods.h>
 
 //====================================================================================
@@ -22,7 +39,9 @@
 // is set in the particle. If not then we assume all is DM (family = 1)
 //
 // In an MPI setting then we have the option of only storing particles that fall inside the
-// local domain
+// local domain. With read_gadget every task reads every file and throws away what it does not
+// need. With read_gadget_collective each file is read by only one task and the particles are then
+// sent to the task that owns them (much less I/O when we have many tasks)
 //
 // If the files have position units other than Mpc/h then this can be set by gadget_pos_factor
 // which is 1.0 for Mpc/h, 1000.0 for kpc/h and (Mpc/h / POSUNIT) in general.
@@ -46,6 +65,11 @@
 // Errors are handled via throw_error in the class below (with MPI it aborts and otherwise
 // throws a runtime error)
 //
+// With set_use_mmap(true) the files are memory mapped and the fields are converted directly
+// from the mapping into the particles (with OpenMP threads) instead of going through a
+// buffer per block. This is only available on POSIX systems (otherwise we fall back to the
+// standard reader)
+//
 // Compile time defines:
 // GADGET_LONG_INT_IDS  : Use long long int for IDs otherwise use int
 //
@@ -113,8 +137,18 @@ namespace FML {
                 // The fields we assume is in the file
                 std::vector<std::string> fields_in_file = {"POS", "VEL", "ID"};
 
+                // Read files via mmap (and advise the kernel to use hugepages for the mapping)
+                bool use_mmap{false};
+                bool use_hugepages{false};
+
                 void throw_error(std::string errormessage) const;
 
+                template <class T, class Alloc>
+                void read_gadget_single_mmap(std::string filename,
+                                             std::vector<T, Alloc> & part,
+                                             bool only_keep_part_in_domain,
+                                             bool verbose);
+
               public:
                 GadgetReader() = default;
                 GadgetReader(int ndim);
@@ -137,6 +171,16 @@ namespace FML {
                                  bool only_keep_part_in_domain,
                                  bool verbose);
 
+                /// Read all gadget files collectively: file i is read by task i % NTasks only and the particles
+                /// are then communicated to the task whose domain they fall in. The result is the same as
+                /// read_gadget with only_keep_part_in_domain = true (up to the order of the particles), but
+                /// each file is only read once. If buffer_factor is > 1 then we allocate corresponding extra storage
+                template <class T, class Alloc = std::allocator<T>>
+                void read_gadget_collective(std::string fileprefix,
+                                            std::vector<T, Alloc> & part,
+                                            double buffer_factor,
+                                            bool verbose);
+
                 /// Read a section of a gadget file
                 void read_section(std::ifstream & fp, std::vector<char> & buffer);
 
@@ -151,6 +195,49 @@ namespace FML {
 
                 /// If non-standard file, set the fields that are in the file (only POS,VEL,ID implmented)
                 void set_fields_in_file(std::vector<std::string> fields);
+
+                /// Read the files by memory mapping them and converting the fields directly into the particles
+                /// (no intermediate buffers). If use_hugepages we also advise the kernel to back the mapping by
+                /// huge pages (if supported by the filesystem)
+                void set_use_mmap(bool use_mmap, bool use_hugepages = false);
+            };
+
+            /// Write buffers to a stream in a background thread. The caller fills one buffer while the other one
+            /// is being written. Bytes written with write (and the submitted buffers) end up in the stream in the
+            /// order they were given
+            class DoubleBufferedWriter {
+              private:
+                std::ofstream & fp;
+                std::vector<char> buffers[2];
+                size_t nbytes_to_write{0};
+                int current{0};
+
+                std::thread thread;
+                std::mutex mutex;
+                std::condition_variable cv;
+                bool has_work{false};
+                bool done{false};
+
+                void run();
+
+              public:
+                DoubleBufferedWriter(std::ofstream & fp, size_t buffer_bytes);
+                DoubleBufferedWriter(const DoubleBufferedWriter &) = delete;
+                DoubleBufferedWriter & operator=(const DoubleBufferedWriter &) = delete;
+                ~DoubleBufferedWriter();
+
+                /// The buffer to fill (not the one being written)
+                char * buffer();
+                size_t buffer_size() const;
+
+                /// Write the first nbytes of the buffer in the background and switch to the other buffer
+                void submit(size_t nbytes);
+
+                /// Write some bytes right away (after the pending write is done)
+                void write(const void * data, size_t nbytes);
+
+                /// Wait until everything submitted is written
+                void flush();
             };
 
             /// Write files in GADGET format
@@ -160,8 +247,27 @@ namespace FML {
 
                 int NDIM{3};
 
+                // Write with a background I/O thread and double buffering, converting this many particles
+                // at the time
+                bool async_write{false};
+                size_t async_nparticles_per_chunk{1 << 20};
+
                 void throw_error(std::string errormessage) const;
 
+                template <class T>
+                void write_gadget_single_async(std::string filename,
+                                               T * part,
+                                               size_t NumPart,
+                                               int NumberOfFilesToWrite,
+                                               double aexp,
+                                               double Boxsize,
+                                               double OmegaM,
+                                               double OmegaLambda,
+                                               double HubbleParam,
+                                               double pos_norm,
+                                               double vel_norm,
+                                               std::vector<double> OmegaFamilyOverOmegaM);
+
               public:
                 GadgetWriter() = default;
                 GadgetWriter(int ndim);
@@ -187,9 +293,57 @@ namespace FML {
                                          double vel_norm,
                                          std::vector<double> OmegaFamilyOverOmegaM = {0., 1., 0., 0., 0., 0.});
 
+                /// Write nfiles gadget files fileprefix.0, ..., fileprefix.[nfiles-1] with the particles from all
+                /// tasks. Each file is written by the first task in a group of consecutive tasks which gets the
+                /// converted particles from the other tasks in the group (one file per node instead of one per
+                /// task). If in_background then the file is written by a thread that is returned (join it before
+                /// the next write). Otherwise, or if this task writes no file, the returned thread is not joinable.
+                /// The particles are converted before we return so they can be changed right away.
+                template <class T>
+                std::thread write_gadget_grouped(std::string fileprefix,
+                                                 T * part,
+                                                 size_t NumPart,
+                                                 int nfiles,
+                                                 bool in_background,
+                                                 double aexp,
+                                                 double Boxsize,
+                                                 double OmegaM,
+                                                 double OmegaLambda,
+                                                 double HubbleParam,
+                                                 double pos_norm,
+                                                 double vel_norm,
+                                                 std::vector<double> OmegaFamilyOverOmegaM = {0., 1., 0., 0., 0., 0.});
+
+                /// Make a gadget file (DM only) with room for NumPart particles that we fill with
+                /// write_gadget_single_block. This lets us write a file a chunk of particles at the time (e.g. as
+                /// they are generated) so we never need all the particles in memory. Not collective.
+                template <class T>
+                void create_gadget_single(std::string filename,
+                                          size_t NumPart,
+                                          size_t NumPartTot,
+                                          int NumberOfFilesToWrite,
+                                          double aexp,
+                                          double Boxsize,
+                                          double OmegaM,
+                                          double OmegaLambda,
+                                          double HubbleParam);
+
+                /// Write the particles [offset, offset + NumPart) of a file made by create_gadget_single
+                template <class T>
+                void write_gadget_single_block(std::string filename,
+                                               T * part,
+                                               size_t NumPart,
+                                               size_t offset,
+                                               double pos_norm,
+                                               double vel_norm);
+
                 /// Write a gadget section
                 void write_section(std::ofstream & fp, std::vector<char> & buffer, int bytes);
 
+                /// Make write_gadget_single convert the particles in chunks of nparticles_per_chunk while a
+                /// background thread writes the previous chunk to file (double buffering)
+                void set_async_write(bool async_write, size_t nparticles_per_chunk = 1 << 20);
+
                 /// Write the gadget header (DM only)
                 void write_header(std::ofstream & fp,
                                   unsigned int NumPart,
@@ -285,12 +439,87 @@ namespace FML {
                 }
             }
 
+            template <class T, class Alloc>
+            void GadgetReader::read_gadget_collective(std::string fileprefix,
+                                                      std::vector<T, Alloc> & part,
+                                                      double buffer_factor,
+                                                      bool verbose) {
+
+                const bool verbose_task0 = verbose and FML::ThisTask == 0;
+
+                // Read the number of particles and the number of files
+                std::string filename = fileprefix + ".0";
+                std::ifstream fp(filename.c_str(), std::ios::binary);
+                if (not fp.is_open()) {
+                    std::string errormessage =
+                        "[GadgetReader::read_gadget_collective] File " + filename + " is not open\n";
+                    throw_error(errormessage);
+                }
+                read_header(fp);
+                fp.close();
+
+                // Number of files
+                const int nfiles = header.num_files;
+
+#ifdef GADGET_ONLY_DM
+                size_t npartTotal = (size_t(header.npartTotalHighWord[1]) << 32) + size_t(header.npartTotal[1]);
+#else
+                size_t npartTotal = 0;
+                for (int i = 0; i < 6; i++)
+                    npartTotal += (size_t(header.npartTotalHighWord[i]) << 32) + size_t(header.npartTotal[i]);
+#endif
+
+                // The particles we read are stored here before being sent to where they belong. We allocate
+                // what we expect to end up with on average (the storage grows if needed)
+                const size_t nalloc = size_t(double(npartTotal) * std::max(buffer_factor, 1.0)) / FML::NTasks;
+                FML::Vector<T> local;
+                local.reserve(nalloc);
+
+                // Read the files this task is responsible for
+                for (int i = FML::ThisTask; i < nfiles; i += FML::NTasks) {
+                    filename = fileprefix + "." + std::to_string(i);
+                    if (verbose)
+                        std::cout << "Task " << FML::ThisTask << " reading file " << filename << "\n";
+                    read_gadget_single(filename, local, false, verbose_task0 and i == 0);
+                }
+
+                // Send the particles to the task that owns them
+                FML::PARTICLE::MPIParticles<T> mpipart;
+                mpipart.move_from(std::move(local));
+                mpipart.communicate_particles();
+                const size_t npart_local = mpipart.get_npart();
+                if (verbose_task0)
+                    std::cout << "Read " << mpipart.get_npart_total() << " particles from " << nfiles
+                              << " files collectively\n";
+
+                // Copy them over to part (or just move them if the allocators agree)
+                auto & p = mpipart.get_particles();
+                if constexpr (std::is_same<Alloc, typename FML::LargeVector<T>::allocator_type>::value) {
+                    part = std::move(p);
+                    part.resize(npart_local);
+                } else {
+                    part.clear();
+                    part.reserve(std::max(npart_local, nalloc));
+                    part.insert(part.end(),
+                                std::make_move_iterator(p.begin()),
+                                std::make_move_iterator(p.begin() + npart_local));
+                    mpipart.free();
+                }
+            }
+
             template <class T, class Alloc>
             void GadgetReader::read_gadget_single(std::string filename,
                                                   std::vector<T, Alloc> & part,
                                                   bool only_keep_part_in_domain,
                                                   bool verbose) {
 
+#ifdef GADGET_HAVE_MMAP
+                if (use_mmap) {
+                    read_gadget_single_mmap(filename, part, only_keep_part_in_domain, verbose);
+                    return;
+                }
+#endif
+
                 verbose = verbose and FML::ThisTask == 0;
 
                 std::vector<char> buffer;
@@ -526,6 +755,216 @@ namespace FML {
                 }
             }
 
+            template <class T, class Alloc>
+            void GadgetReader::read_gadget_single_mmap(std::string filename,
+                                                       std::vector<T, Alloc> & part,
+                                                       bool only_keep_part_in_domain,
+                                                       bool verbose) {
+#ifndef GADGET_HAVE_MMAP
+                read_gadget_single(filename, part, only_keep_part_in_domain, verbose);
+#else
+                verbose = verbose and FML::ThisTask == 0;
+
+                // Read the header the usual way (this also tells us if we need to swap endian)
+                {
+                    std::ifstream fp(filename.c_str(), std::ios::binary);
+                    if (not fp.is_open()) {
+                        std::string errormessage =
+                            "[GadgetReader::read_gadget_single_mmap] File " + filename + " is not open\n";
+                        throw_error(errormessage);
+                    }
+                    read_header(fp);
+                }
+                if (verbose)
+                    print_header_info(header);
+
+                // Map the file
+                int fd = open(filename.c_str(), O_RDONLY);
+                struct stat st;
+                if (fd < 0 or fstat(fd, &st) != 0) {
+                    std::string errormessage = "[GadgetReader::read_gadget_single_mmap] Could not open " + filename + "\n";
+                    throw_error(errormessage);
+                }
+                const size_t bytes_in_file = size_t(st.st_size);
+                void * mapping = mmap(nullptr, bytes_in_file, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (mapping == MAP_FAILED) {
+                    std::string errormessage = "[GadgetReader::read_gadget_single_mmap] mmap failed for " + filename + "\n";
+                    throw_error(errormessage);
+                }
+                madvise(mapping, bytes_in_file, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+                if (use_hugepages)
+                    madvise(mapping, bytes_in_file, MADV_HUGEPAGE);
+#endif
+                const char * data = static_cast<const char *>(mapping);
+
+                // Positions normalized by the boxsize in the file and velocities normalized to peculiar in km/s
+                const double pos_norm = 1.0 / header.BoxSize;
+                const double vel_norm = sqrt(header.time);
+
+                size_t NumPartFileTot = 0;
+                for (int i = 0; i < 6; i++)
+                    NumPartFileTot += header.npart[i];
+
+#ifndef GADGET_ONLY_DM
+                if constexpr (FML::PARTICLE::has_set_family<T>() == false) {
+                    if (NumPartFileTot != header.npart[1]) {
+                        std::string errormessage = "[GadgetReader::read_gadget_single_mmap] Particle type does not "
+                                                   "have set_family, but Gadget file contains multiple species! Either "
+                                                   "use define GADGET_ONLY_DM or add methods to particle\n";
+                        throw_error(errormessage);
+                    }
+                }
+#endif
+
+                // Get the start of the data of the next block (and check the size of it)
+                size_t offset = sizeof(int) + sizeof(GadgetHeader) + sizeof(int);
+                auto next_block = [&](size_t bytes_per_particle, std::string field) -> const char * {
+                    int bytes_start, bytes_end;
+                    const size_t bytes = bytes_per_particle * NumPartFileTot;
+                    if (offset + 2 * sizeof(int) + bytes > bytes_in_file) {
+                        std::string errormessage =
+                            "[GadgetReader::read_gadget_single_mmap] File is too small to contain " + field + "\n";
+                        throw_error(errormessage);
+                    }
+                    std::memcpy(&bytes_start, data + offset, sizeof(int));
+                    std::memcpy(&bytes_end, data + offset + sizeof(int) + bytes, sizeof(int));
+                    if (endian_swap) {
+                        bytes_start = swap_endian(bytes_start);
+                        bytes_end = swap_endian(bytes_end);
+                    }
+                    if (size_t(bytes_start) != bytes or bytes_start != bytes_end) {
+                        std::string errormessage = "[GadgetReader::read_gadget_single_mmap] Block " + field +
+                                                   " does not have the expected size. Change the ID size in "
+                                                   "GadgetUtils? Otherwise check that fields_in_file is correct!\n";
+                        throw_error(errormessage);
+                    }
+                    const char * block = data + offset + sizeof(int);
+                    offset += bytes + 2 * sizeof(int);
+                    return block;
+                };
+
+                // The values in the file might not be aligned so we copy them out
+                auto get_float = [&](const char * block, size_t i) -> float {
+                    float value;
+                    std::memcpy(&value, block + i * sizeof(float), sizeof(float));
+                    return endian_swap ? swap_endian(value) : value;
+                };
+                auto get_id = [&](const char * block, size_t i) -> gadget_particle_id_type {
+                    gadget_particle_id_type value;
+                    std::memcpy(&value, block + i * sizeof(value), sizeof(value));
+                    return endian_swap ? swap_endian(value) : value;
+                };
+
+                // The particle type of particle i in the file
+                std::array<size_t, 7> type_start{};
+                for (int type = 0; type < 6; type++)
+                    type_start[type + 1] = type_start[type] + header.npart[type];
+                auto type_of = [&](size_t i) -> int {
+                    int type = 0;
+                    while (i >= type_start[type + 1])
+                        type++;
+                    return type;
+                };
+
+                // The particles we keep (if we keep all then this is empty)
+                FML::assert_mpi(fields_in_file[0] == "POS",
+                                "Error: Position has to be first in file for the mmap reader");
+                const char * pos_block = next_block(NDIM * sizeof(float), "POS");
+                std::vector<size_t> selected;
+#ifdef GADGET_ONLY_DM
+                const bool select = true;
+#else
+                const bool select = only_keep_part_in_domain;
+#endif
+                if (select) {
+                    selected.reserve(NumPartFileTot);
+                    for (size_t i = 0; i < NumPartFileTot; i++) {
+#ifdef GADGET_ONLY_DM
+                        if (i < type_start[1] or i >= type_start[2])
+                            continue;
+#endif
+                        if (only_keep_part_in_domain) {
+                            double x = get_float(pos_block, NDIM * i) * pos_norm;
+                            if (x >= 1.0)
+                                x -= 1.0;
+                            if (x < 0.0)
+                                x += 1.0;
+                            if (not(x >= FML::xmin_domain and x < FML::xmax_domain))
+                                continue;
+                        }
+                        selected.push_back(i);
+                    }
+                }
+                const size_t nselected = select ? selected.size() : NumPartFileTot;
+                auto file_index = [&](size_t j) -> size_t { return select ? selected[j] : j; };
+
+                // Add the particles to the back of part
+                const size_t index_start = part.size();
+                part.resize(index_start + nselected);
+                T * p = part.data() + index_start;
+
+                for (auto & field : fields_in_file) {
+                    if (field == "POS") {
+                        if constexpr (FML::PARTICLE::has_get_pos<T>()) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                            for (size_t j = 0; j < nselected; j++) {
+                                const size_t i = file_index(j);
+                                auto * pos = FML::PARTICLE::GetPos(p[j]);
+                                for (int idim = 0; idim < NDIM; idim++) {
+                                    pos[idim] = get_float(pos_block, NDIM * i + idim) * pos_norm;
+                                    if (pos[idim] >= 1.0)
+                                        pos[idim] -= 1.0;
+                                    if (pos[idim] < 0.0)
+                                        pos[idim] += 1.0;
+                                }
+                            }
+                        }
+#ifndef GADGET_ONLY_DM
+                        if constexpr (FML::PARTICLE::has_set_family<T>()) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                            for (size_t j = 0; j < nselected; j++)
+                                FML::PARTICLE::SetFamily(p[j], type_of(file_index(j)));
+                        }
+#endif
+                    } else if (field == "VEL") {
+                        const char * vel_block = next_block(NDIM * sizeof(float), "VEL");
+                        if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                            for (size_t j = 0; j < nselected; j++) {
+                                const size_t i = file_index(j);
+                                auto * vel = FML::PARTICLE::GetVel(p[j]);
+                                for (int idim = 0; idim < NDIM; idim++)
+                                    vel[idim] = get_float(vel_block, NDIM * i + idim) * vel_norm;
+                            }
+                        }
+                    } else if (field == "ID") {
+                        const char * id_block = next_block(sizeof(gadget_particle_id_type), "ID");
+                        if constexpr (FML::PARTICLE::has_set_id<T>()) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                            for (size_t j = 0; j < nselected; j++)
+                                FML::PARTICLE::SetID(p[j], get_id(id_block, file_index(j)));
+                        }
+                    } else {
+                        std::cout << "Warning: unknown field in file [" << field
+                                  << "]. Only POS, VEL and ID are read and implemented\n";
+                        assert(false);
+                    }
+                }
+
+                munmap(mapping, bytes_in_file);
+#endif
+            }
+
             // For multiple species
             template <class T>
             void GadgetWriter::write_gadget_single(std::string filename,
@@ -542,6 +981,22 @@ namespace FML {
                                                    double vel_norm,
                                                    std::vector<double> OmegaFamilyOverOmegaM) {
 
+                if (async_write) {
+                    write_gadget_single_async(filename,
+                                              part,
+                                              NumPart,
+                                              NumberOfFilesToWrite,
+                                              aexp,
+                                              Boxsize,
+                                              OmegaM,
+                                              OmegaLambda,
+                                              HubbleParam,
+                                              pos_norm,
+                                              vel_norm,
+                                              OmegaFamilyOverOmegaM);
+                    return;
+                }
+
                 std::vector<char> buffer;
                 float * float_buffer;
                 gadget_particle_id_type * id_buffer;
@@ -688,6 +1143,423 @@ namespace FML {
                 }
             }
 
+            template <class T>
+            void GadgetWriter::write_gadget_single_async(std::string filename,
+                                                         T * part,
+                                                         size_t NumPart,
+                                                         int NumberOfFilesToWrite,
+                                                         double aexp,
+                                                         double Boxsize,
+                                                         double OmegaM,
+                                                         double OmegaLambda,
+                                                         double HubbleParam,
+                                                         double pos_norm,
+                                                         double vel_norm,
+                                                         std::vector<double> OmegaFamilyOverOmegaM) {
+
+                const int ndim = NDIM;
+                std::ofstream fp(filename.c_str(), std::ios::binary | std::ios::out);
+                if (not fp.is_open()) {
+                    std::string errormessage =
+                        "[GadgetWrite::write_gadget_single_async] File " + filename + " is not open\n";
+                    throw_error(errormessage);
+                }
+
+                // The family of each particle and how many we have of each
+                auto family_of = [&]([[maybe_unused]] size_t i) -> int {
+#ifndef GADGET_ONLY_READ_DM
+                    if constexpr (FML::PARTICLE::has_get_family<T>()) {
+                        auto family = FML::PARTICLE::GetFamily(part[i]);
+                        return (family >= 0 and family < 6) ? int(family) : -1;
+                    }
+#endif
+                    return 1;
+                };
+#ifdef GADGET_ONLY_READ_DM
+                OmegaFamilyOverOmegaM = {0.0, 1.0, 0.0, 0.0, 0.0, 0.0};
+#endif
+                std::vector<size_t> npart_family(6, 0);
+                for (size_t i = 0; i < NumPart; i++) {
+                    const int family = family_of(i);
+                    if (family >= 0)
+                        npart_family[family]++;
+                }
+                std::vector<size_t> npart_family_tot = npart_family;
+                FML::SumArrayOverTasks(npart_family_tot.data(), int(npart_family_tot.size()));
+
+                std::vector<double> mass_in_1e10_msunh(6, 0.0);
+                for (int i = 0; i < 6; i++) {
+                    mass_in_1e10_msunh[i] = npart_family_tot[i] == 0 ?
+                                                0.0 :
+                                                3.0 * OmegaM * OmegaFamilyOverOmegaM[i] * MplMpl_over_H0Msunh *
+                                                    std::pow(Boxsize / HubbleLengthInMpch, 3) /
+                                                    double(npart_family_tot[1]) / 1e10;
+                }
+
+                write_header_general(fp,
+                                     npart_family,
+                                     npart_family_tot,
+                                     mass_in_1e10_msunh,
+                                     NumberOfFilesToWrite,
+                                     aexp,
+                                     Boxsize,
+                                     OmegaM,
+                                     OmegaLambda,
+                                     HubbleParam);
+
+                // The particles in the order we write them (sorted by family). Not needed if all have the same
+                size_t ntowrite = 0;
+                for (auto n : npart_family)
+                    ntowrite += n;
+                std::vector<size_t> order;
+                if (ntowrite != NumPart or ntowrite != npart_family[1]) {
+                    order.reserve(ntowrite);
+                    for (int curfamily = 0; curfamily < 6; curfamily++)
+                        for (size_t i = 0; i < NumPart; i++)
+                            if (family_of(i) == curfamily)
+                                order.push_back(i);
+                }
+                auto particle = [&](size_t j) -> T & { return order.empty() ? part[j] : part[order[j]]; };
+
+                // Write a section where convert(j, dest) converts particle j into dest. The next chunk is
+                // converted while the previous one is written
+                const size_t nchunk = std::max(async_nparticles_per_chunk, size_t(1));
+                auto write_section_async = [&](size_t bytes_per_particle, auto && convert) {
+                    if (ntowrite * bytes_per_particle > size_t(INT_MAX))
+                        throw_error("[GadgetWrite::write_gadget_single_async] Too many particles per file\n");
+                    const int bytes = int(ntowrite * bytes_per_particle);
+                    DoubleBufferedWriter writer(fp, std::min(ntowrite, nchunk) * bytes_per_particle);
+                    writer.write(&bytes, sizeof(bytes));
+                    for (size_t start = 0; start < ntowrite; start += nchunk) {
+                        const size_t n = std::min(nchunk, ntowrite - start);
+                        char * dest = writer.buffer();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                        for (size_t j = 0; j < n; j++)
+                            convert(particle(start + j), dest + j * bytes_per_particle);
+                        writer.submit(n * bytes_per_particle);
+                    }
+                    writer.write(&bytes, sizeof(bytes));
+                };
+
+                if constexpr (FML::PARTICLE::has_get_pos<T>()) {
+                    write_section_async(ndim * sizeof(float), [&](T & p, char * dest) {
+                        auto * pos = FML::PARTICLE::GetPos(p);
+                        float * f = reinterpret_cast<float *>(dest);
+                        for (int idim = 0; idim < ndim; idim++)
+                            f[idim] = float(pos[idim] * pos_norm);
+                    });
+                }
+                if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                    write_section_async(ndim * sizeof(float), [&](T & p, char * dest) {
+                        auto * vel = FML::PARTICLE::GetVel(p);
+                        float * f = reinterpret_cast<float *>(dest);
+                        for (int idim = 0; idim < ndim; idim++)
+                            f[idim] = float(vel[idim] * vel_norm);
+                    });
+                }
+                if constexpr (FML::PARTICLE::has_get_id<T>()) {
+                    write_section_async(sizeof(gadget_particle_id_type), [&](T & p, char * dest) {
+                        const gadget_particle_id_type id = FML::PARTICLE::GetID(p);
+                        std::memcpy(dest, &id, sizeof(id));
+                    });
+                }
+            }
+
+            template <class T>
+            void GadgetWriter::create_gadget_single(std::string filename,
+                                                    size_t NumPart,
+                                                    size_t NumPartTot,
+                                                    int NumberOfFilesToWrite,
+                                                    double aexp,
+                                                    double Boxsize,
+                                                    double OmegaM,
+                                                    double OmegaLambda,
+                                                    double HubbleParam) {
+                std::ofstream fp(filename.c_str(), std::ios::binary | std::ios::out);
+                if (not fp.is_open()) {
+                    std::string errormessage = "[GadgetWrite::create_gadget_single] File " + filename + " is not open\n";
+                    throw_error(errormessage);
+                }
+                write_header(fp, (unsigned int)NumPart, NumPartTot, NumberOfFilesToWrite, aexp, Boxsize, OmegaM,
+                             OmegaLambda, HubbleParam);
+
+                // The blocks (we only write the markers, the data is filled in later)
+                auto write_empty_section = [&](size_t bytes_per_particle) {
+                    if (NumPart * bytes_per_particle > size_t(INT_MAX))
+                        throw_error("[GadgetWrite::create_gadget_single] Too many particles per file\n");
+                    const int bytes = int(NumPart * bytes_per_particle);
+                    fp.write((char *)&bytes, sizeof(bytes));
+                    fp.seekp(bytes, std::ios::cur);
+                    fp.write((char *)&bytes, sizeof(bytes));
+                };
+                if constexpr (FML::PARTICLE::has_get_pos<T>())
+                    write_empty_section(NDIM * sizeof(float));
+                if constexpr (FML::PARTICLE::has_get_vel<T>())
+                    write_empty_section(NDIM * sizeof(float));
+                if constexpr (FML::PARTICLE::has_get_id<T>())
+                    write_empty_section(sizeof(gadget_particle_id_type));
+                if (not fp.good())
+                    throw_error("[GadgetWrite::create_gadget_single] Failed to write " + filename + "\n");
+            }
+
+            template <class T>
+            void GadgetWriter::write_gadget_single_block(std::string filename,
+                                                         T * part,
+                                                         size_t NumPart,
+                                                         size_t offset,
+                                                         double pos_norm,
+                                                         double vel_norm) {
+                std::fstream fp(filename.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+                if (not fp.is_open()) {
+                    std::string errormessage =
+                        "[GadgetWrite::write_gadget_single_block] File " + filename + " is not open\n";
+                    throw_error(errormessage);
+                }
+
+                // The number of particles in the file gives us where the blocks are
+                GadgetHeader file_header;
+                fp.seekg(sizeof(int), std::ios::beg);
+                fp.read((char *)&file_header, sizeof(file_header));
+                const size_t npart_file = file_header.npart[1];
+                if (offset + NumPart > npart_file)
+                    throw_error("[GadgetWrite::write_gadget_single_block] The particles do not fit in the file\n");
+
+                std::streamoff block_start = 2 * sizeof(int) + sizeof(GadgetHeader);
+                std::vector<char> buffer;
+                auto write_block = [&](size_t bytes_per_particle, auto && convert) {
+                    buffer.resize(NumPart * bytes_per_particle);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (size_t i = 0; i < NumPart; i++)
+                        convert(part[i], buffer.data() + i * bytes_per_particle);
+                    fp.seekp(block_start + sizeof(int) + offset * bytes_per_particle, std::ios::beg);
+                    fp.write(buffer.data(), buffer.size());
+                    block_start += 2 * sizeof(int) + npart_file * bytes_per_particle;
+                };
+
+                const int ndim = NDIM;
+                if constexpr (FML::PARTICLE::has_get_pos<T>()) {
+                    write_block(ndim * sizeof(float), [&](T & p, char * dest) {
+                        auto * pos = FML::PARTICLE::GetPos(p);
+                        float * f = reinterpret_cast<float *>(dest);
+                        for (int idim = 0; idim < ndim; idim++)
+                            f[idim] = float(pos[idim] * pos_norm);
+                    });
+                }
+                if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                    write_block(ndim * sizeof(float), [&](T & p, char * dest) {
+                        auto * vel = FML::PARTICLE::GetVel(p);
+                        float * f = reinterpret_cast<float *>(dest);
+                        for (int idim = 0; idim < ndim; idim++)
+                            f[idim] = float(vel[idim] * vel_norm);
+                    });
+                }
+                if constexpr (FML::PARTICLE::has_get_id<T>()) {
+                    write_block(sizeof(gadget_particle_id_type), [&](T & p, char * dest) {
+                        const gadget_particle_id_type id = FML::PARTICLE::GetID(p);
+                        std::memcpy(dest, &id, sizeof(id));
+                    });
+                }
+                if (not fp.good())
+                    throw_error("[GadgetWrite::write_gadget_single_block] Failed to write " + filename + "\n");
+            }
+
+            template <class T>
+            std::thread GadgetWriter::write_gadget_grouped(std::string fileprefix,
+                                                           T * part,
+                                                           size_t NumPart,
+                                                           int nfiles,
+                                                           bool in_background,
+                                                           double aexp,
+                                                           double Boxsize,
+                                                           double OmegaM,
+                                                           double OmegaLambda,
+                                                           double HubbleParam,
+                                                           double pos_norm,
+                                                           double vel_norm,
+                                                           std::vector<double> OmegaFamilyOverOmegaM) {
+
+                nfiles = std::max(1, std::min(nfiles, FML::NTasks));
+                const int ifile = int((long long)FML::ThisTask * nfiles / FML::NTasks);
+                const int ndim = NDIM;
+
+                // The family of each particle and how many we have of each
+                auto family_of = [&]([[maybe_unused]] size_t i) -> int {
+#ifndef GADGET_ONLY_READ_DM
+                    if constexpr (FML::PARTICLE::has_get_family<T>()) {
+                        auto family = FML::PARTICLE::GetFamily(part[i]);
+                        return (family >= 0 and family < 6) ? int(family) : -1;
+                    }
+#endif
+                    return 1;
+                };
+#ifdef GADGET_ONLY_READ_DM
+                OmegaFamilyOverOmegaM = {0.0, 1.0, 0.0, 0.0, 0.0, 0.0};
+#endif
+                std::vector<long long> npart_family(6, 0);
+                for (size_t i = 0; i < NumPart; i++) {
+                    const int family = family_of(i);
+                    if (family >= 0)
+                        npart_family[family]++;
+                }
+                std::vector<long long> npart_family_tot = npart_family;
+                FML::SumArrayOverTasks(npart_family_tot.data(), int(npart_family_tot.size()));
+
+                std::vector<double> mass_in_1e10_msunh(6, 0.0);
+                for (int i = 0; i < 6; i++) {
+                    mass_in_1e10_msunh[i] = npart_family_tot[i] == 0 ?
+                                                0.0 :
+                                                3.0 * OmegaM * OmegaFamilyOverOmegaM[i] * MplMpl_over_H0Msunh *
+                                                    std::pow(Boxsize / HubbleLengthInMpch, 3) /
+                                                    double(npart_family_tot[1]) / 1e10;
+                }
+
+                // Convert the particles to what we write, sorted by family
+                size_t ntowrite = 0;
+                for (auto n : npart_family)
+                    ntowrite += n;
+                std::vector<float> pos_buffer;
+                std::vector<float> vel_buffer;
+                std::vector<gadget_particle_id_type> id_buffer;
+                if constexpr (FML::PARTICLE::has_get_pos<T>())
+                    pos_buffer.reserve(ntowrite * ndim);
+                if constexpr (FML::PARTICLE::has_get_vel<T>())
+                    vel_buffer.reserve(ntowrite * ndim);
+                if constexpr (FML::PARTICLE::has_get_id<T>())
+                    id_buffer.reserve(ntowrite);
+                for (int curfamily = 0; curfamily < 6; curfamily++) {
+                    if (npart_family[curfamily] == 0)
+                        continue;
+                    for (size_t i = 0; i < NumPart; i++) {
+                        if (family_of(i) != curfamily)
+                            continue;
+                        if constexpr (FML::PARTICLE::has_get_pos<T>()) {
+                            auto * pos = FML::PARTICLE::GetPos(part[i]);
+                            for (int idim = 0; idim < ndim; idim++)
+                                pos_buffer.push_back(float(pos[idim]) * pos_norm);
+                        }
+                        if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                            auto * vel = FML::PARTICLE::GetVel(part[i]);
+                            for (int idim = 0; idim < ndim; idim++)
+                                vel_buffer.push_back(float(vel[idim]) * vel_norm);
+                        }
+                        if constexpr (FML::PARTICLE::has_get_id<T>())
+                            id_buffer.push_back(gadget_particle_id_type(FML::PARTICLE::GetID(part[i])));
+                    }
+                }
+
+                // Send it all to the task writing the file (the first task in the group)
+                bool write_file = true;
+#ifdef USE_MPI
+                MPI_Comm comm;
+                MPI_Comm_split(MPI_COMM_WORLD, ifile, FML::ThisTask, &comm);
+                int rank, ntasks;
+                MPI_Comm_rank(comm, &rank);
+                MPI_Comm_size(comm, &ntasks);
+                write_file = rank == 0;
+
+                std::vector<long long> npart_family_all(6 * ntasks);
+                MPI_Gather(npart_family.data(), 6, MPI_LONG_LONG, npart_family_all.data(), 6, MPI_LONG_LONG, 0, comm);
+
+                // Gather a buffer and put it in family order with (family, task) as the outer loops
+                auto gather = [&](auto & buffer, int n_per_particle) {
+                    using BufferType = typename std::decay_t<decltype(buffer)>::value_type;
+                    const int bytes_per_particle = int(sizeof(BufferType)) * n_per_particle;
+                    std::vector<int> bytes(ntasks, 0), offset(ntasks, 0);
+                    size_t total = 0;
+                    for (int t = 0; t < ntasks; t++) {
+                        long long n = 0;
+                        for (int f = 0; f < 6; f++)
+                            n += npart_family_all[6 * t + f];
+                        bytes[t] = int(n * bytes_per_particle);
+                        offset[t] = int(total);
+                        total += size_t(n * bytes_per_particle);
+                    }
+                    // A gadget section cannot be larger than this anyway
+                    if (total > size_t(INT_MAX))
+                        throw_error("[GadgetWrite::write_gadget_grouped] Too many particles per file\n");
+                    std::vector<BufferType> recv(write_file ? total / sizeof(BufferType) : 0);
+                    MPI_Gatherv(buffer.data(),
+                                int(buffer.size() * sizeof(BufferType)),
+                                MPI_CHAR,
+                                recv.data(),
+                                bytes.data(),
+                                offset.data(),
+                                MPI_CHAR,
+                                0,
+                                comm);
+                    if (not write_file)
+                        return std::vector<BufferType>{};
+                    std::vector<BufferType> sorted;
+                    sorted.reserve(recv.size());
+                    for (int f = 0; f < 6; f++) {
+                        for (int t = 0; t < ntasks; t++) {
+                            long long start = offset[t] / bytes_per_particle;
+                            for (int g = 0; g < f; g++)
+                                start += npart_family_all[6 * t + g];
+                            auto first = recv.begin() + start * n_per_particle;
+                            sorted.insert(sorted.end(), first, first + npart_family_all[6 * t + f] * n_per_particle);
+                        }
+                    }
+                    return sorted;
+                };
+                pos_buffer = gather(pos_buffer, ndim);
+                vel_buffer = gather(vel_buffer, ndim);
+                id_buffer = gather(id_buffer, 1);
+                if (write_file) {
+                    std::fill(npart_family.begin(), npart_family.end(), 0);
+                    for (int t = 0; t < ntasks; t++)
+                        for (int f = 0; f < 6; f++)
+                            npart_family[f] += npart_family_all[6 * t + f];
+                }
+                MPI_Comm_free(&comm);
+#endif
+                if (not write_file)
+                    return std::thread();
+
+                // Write the file (no MPI calls in here so it can run in a thread)
+                const std::string filename = fileprefix + "." + std::to_string(ifile);
+                auto write = [=, pos_buffer = std::move(pos_buffer), vel_buffer = std::move(vel_buffer),
+                              id_buffer = std::move(id_buffer)]() {
+                    GadgetWriter gw(ndim);
+                    std::ofstream fp(filename.c_str(), std::ios::binary | std::ios::out);
+                    if (not fp.is_open())
+                        gw.throw_error("[GadgetWrite::write_gadget_grouped] File " + filename + " is not open\n");
+                    gw.write_header_general(fp,
+                                            std::vector<size_t>(npart_family.begin(), npart_family.end()),
+                                            std::vector<size_t>(npart_family_tot.begin(), npart_family_tot.end()),
+                                            mass_in_1e10_msunh,
+                                            nfiles,
+                                            aexp,
+                                            Boxsize,
+                                            OmegaM,
+                                            OmegaLambda,
+                                            HubbleParam);
+                    // Same as write_section, but without copying the buffer
+                    auto write_buffer = [&](auto & buffer) {
+                        using BufferType = typename std::decay_t<decltype(buffer)>::value_type;
+                        const int bytes = int(buffer.size() * sizeof(BufferType));
+                        fp.write((char *)&bytes, sizeof(bytes));
+                        fp.write(reinterpret_cast<const char *>(buffer.data()), bytes);
+                        fp.write((char *)&bytes, sizeof(bytes));
+                    };
+                    if constexpr (FML::PARTICLE::has_get_pos<T>())
+                        write_buffer(pos_buffer);
+                    if constexpr (FML::PARTICLE::has_get_vel<T>())
+                        write_buffer(vel_buffer);
+                    if constexpr (FML::PARTICLE::has_get_id<T>())
+                        write_buffer(id_buffer);
+                };
+
+                if (in_background)
+                    return std::thread(std::move(write));
+                write();
+                return std::thread();
+            }
+
         } // namespace GADGET
     }     // namespace FILEUTILS
 } // namespace FML
@@ -10,6 +10,9 @@
 
 #include "Global.h"
 #include "SystemMemory.h"
+#ifdef USE_FFTW
+#include <FML/FFTWGrid/FFTWPlanCache.h>
+#endif
 
 static std::string processor_name{"NameIsOnlyKnownWithMPI"};
 
@@ -17,6 +20,12 @@ namespace FML {
     
     FML::UTILS::Timings global_timer;
 
+#ifdef USE_MPI
+    // The tasks on the same node as us (defined before the setup below which sets them)
+    MPI_Comm NodeComm = MPI_COMM_NULL;
+    std::vector<int> NodeRankOfTask;
+#endif
+
     // Initialize FML, set the few globals we have and init MPI
     // and FFTW. If no auto setup you must init MPI and FFTW
     // yourself and then call init_fml
@@ -35,6 +44,7 @@ namespace FML {
     int NThreads = 1;
 
     bool FFTWThreadsOK = false;
+    int FFTWNThreads = 1;
     bool MPIThreadsOK = false;
 
     // The local extent of the domain (global domain goes from 0 to 1)
@@ -76,6 +86,21 @@ namespace FML {
         char pname[MPI_MAX_PROCESSOR_NAME];
         MPI_Get_processor_name(pname, &plen);
         processor_name = std::string(pname);
+
+        // Find the tasks on the same node as us. A node is labeled by the task that has rank 0 on it
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, ThisTask, MPI_INFO_NULL, &NodeComm);
+        int node_rank = 0;
+        int node_label = ThisTask;
+        MPI_Comm_rank(NodeComm, &node_rank);
+        MPI_Bcast(&node_label, 1, MPI_INT, 0, NodeComm);
+        std::vector<int> node_rank_of_task(NTasks);
+        std::vector<int> node_label_of_task(NTasks);
+        MPI_Allgather(&node_rank, 1, MPI_INT, node_rank_of_task.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        MPI_Allgather(&node_label, 1, MPI_INT, node_label_of_task.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        NodeRankOfTask.assign(NTasks, -1);
+        for (int i = 0; i < NTasks; i++)
+            if (node_label_of_task[i] == node_label)
+                NodeRankOfTask[i] = node_rank_of_task[i];
 #else
         ThisTask = 0;
         NTasks = 1;
@@ -280,30 +305,37 @@ namespace FML {
     namespace GRID {
 
         void init_fftw([[maybe_unused]] int * argc, [[maybe_unused]] char *** argv) {
-#if defined(USE_FFTW) && defined(USE_FFTW_THREADS)
-            if (FML::MPIThreadsOK) {
-                FML::FFTWThreadsOK = INIT_FFTW_THREADS();
-                if (FML::FFTWThreadsOK) {
-                    SET_FFTW_NTHREADS(FML::NThreads);
-                }
-            }
-#endif
-#if defined(USE_FFTW) && defined(USE_MPI)
-            INIT_FFTW_MPI();
+#ifdef USE_FFTW
+            // Initialize the precision we use by default. If grids with other precisions are
+            // used those libraries are initialized the first time we make a plan for them
+            FML::FFTWNThreads = FML::NThreads;
+            FML::FFTWThreadsOK = FFTWTraits<FloatType>::init();
+            if (not FML::FFTWThreadsOK)
+                FML::FFTWNThreads = 1;
 #endif
         }
 
         void finalize_fftw() {
+#ifdef USE_FFTW
+            // The MPI plans must be destroyed before MPI is finalized
+            FFTWPlanCache::get().clear();
+            for (auto & library : FFTWInitializedLibraries())
+                library.cleanup();
+            FFTWInitializedLibraries().clear();
+#endif
 #if defined(USE_FFTW) && defined(USE_MPI)
-            CLEANUP_FFTW_MPI();
             MPI_Finalize();
 #endif
         }
 
         void set_fftw_nthreads([[maybe_unused]] int nthreads) {
 #if defined(USE_FFTW) && defined(USE_FFTW_THREADS)
-            if (FML::FFTWThreadsOK)
-                SET_FFTW_NTHREADS(nthreads);
+            if (FML::FFTWThreadsOK) {
+                for (auto & library : FFTWInitializedLibraries())
+                    if (library.set_nthreads)
+                        library.set_nthreads(nthreads);
+                FML::FFTWNThreads = nthreads;
+            }
 #endif
         }
     } // namespace GRID
@@ -14,16 +14,37 @@
 // MEMORY_LOGGING        : Log all (big) allocations with the standard container (see MemoryLogging.h)
 //    MIN_BYTES_TO_LOG   : How many bytes to enable logging of allocation
 //    MAX_ALLOCATIONS_IN_MEMORY : Maximum number of allocations to keep (above which we give up)
+// USE_LARGE_PAGES       : Put the particle and grid storage on 2MB (transparent) huge pages
+//    LARGE_PAGE_MIN_BYTES : Smaller allocations just use 64-byte aligned malloc
+//    LARGE_PAGES_NUMA_INTERLEAVE : Interleave the pages over all NUMA nodes (needs -lnuma)
+// NO_MPI_SHARED_MEMORY  : Always use MPI messages in the halo and particle exchange, also between tasks on the
+//                         same node (by default these use an MPI-3 shared memory window, see SharedMemoryWindow)
 //
 //===========================================================================
 
 #include <algorithm>
 #include <cmath>
 #include <complex>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#ifdef LARGE_PAGES_NUMA_INTERLEAVE
+#include <numa.h>
+#endif
+
 #ifdef USE_MPI
 #include <mpi.h>
 #endif
@@ -50,12 +71,21 @@ namespace FML {
     /// If MPI and threads can work together with FFTW
     extern bool MPIThreadsOK;  // Set by init_mpi
     extern bool FFTWThreadsOK; // Set by init_fftw
+    /// The number of threads FFTW currently plans with
+    extern int FFTWNThreads; // Set by init_fftw and set_fftw_nthreads
 
     /// The local extent of the domain (global domain goes from 0 to 1)
     extern double xmin_domain;
     /// The local extent of the domain (global domain goes from 0 to 1)
     extern double xmax_domain;
 
+#ifdef USE_MPI
+    /// The communicator of the tasks on the same (shared memory) node as us
+    extern MPI_Comm NodeComm;
+    /// For each task its rank in NodeComm if it is on the same node as us and -1 otherwise
+    extern std::vector<int> NodeRankOfTask;
+#endif
+
     // Global timer
     extern FML::UTILS::Timings global_timer;
 
@@ -78,6 +108,148 @@ namespace FML {
     template <class T>
     using Vector = std::vector<T, Allocator<T>>;
 
+    //================================================
+    /// Allocator for big arrays (particles, grids). Allocations
+    /// of at least LARGE_PAGE_MIN_BYTES are mmap'ed, aligned to
+    /// 2MB and marked for transparent huge pages (fewer TLB misses)
+    /// and optionally interleaved over the NUMA nodes. The pages
+    /// are not touched here so first-touch placement still works.
+    /// Smaller allocations are 64-byte aligned (SIMD, cachelines).
+    //================================================
+#ifndef LARGE_PAGE_MIN_BYTES
+#define LARGE_PAGE_MIN_BYTES (2 * 1024 * 1024)
+#endif
+    template <class T>
+    struct LargePageAllocator {
+        using value_type = T;
+
+        static constexpr size_t alignment = 64;
+        static constexpr size_t large_page_size = 2 * 1024 * 1024;
+
+        LargePageAllocator() = default;
+        template <class U>
+        LargePageAllocator(const LargePageAllocator<U> &) {}
+
+        T * allocate(std::size_t size) {
+            if (size > (std::numeric_limits<std::size_t>::max() - 2 * large_page_size) / sizeof(T))
+                throw std::bad_alloc();
+            const size_t bytes = size * sizeof(T);
+            void * ptr = nullptr;
+#ifdef __linux__
+            if (bytes >= LARGE_PAGE_MIN_BYTES) {
+                // Map one extra page so that we can trim the region to start on a page boundary
+                const size_t length = round_up(bytes, large_page_size);
+                char * raw = static_cast<char *>(mmap(nullptr,
+                                                      length + large_page_size,
+                                                      PROT_READ | PROT_WRITE,
+                                                      MAP_PRIVATE | MAP_ANONYMOUS,
+                                                      -1,
+                                                      0));
+                if (raw == MAP_FAILED)
+                    throw std::bad_alloc();
+                char * start = reinterpret_cast<char *>(round_up(reinterpret_cast<uintptr_t>(raw), large_page_size));
+                if (start > raw)
+                    munmap(raw, start - raw);
+                if (raw + large_page_size > start)
+                    munmap(start + length, raw + large_page_size - start);
+#ifdef MADV_HUGEPAGE
+                madvise(start, length, MADV_HUGEPAGE);
+#endif
+#ifdef LARGE_PAGES_NUMA_INTERLEAVE
+                if (numa_available() >= 0)
+                    numa_interleave_memory(start, length, numa_all_nodes_ptr);
+#endif
+                ptr = start;
+            } else
+#endif
+                ptr = std::aligned_alloc(alignment, round_up(std::max(bytes, size_t(1)), alignment));
+            if (ptr == nullptr)
+                throw std::bad_alloc();
+#ifdef MEMORY_LOGGING
+            MemoryLog::get()->add(ptr, bytes);
+#endif
+            return static_cast<T *>(ptr);
+        }
+
+        void deallocate(T * ptr, std::size_t size) {
+            const size_t bytes = size * sizeof(T);
+#ifdef MEMORY_LOGGING
+            MemoryLog::get()->remove(ptr, bytes);
+#endif
+#ifdef __linux__
+            if (bytes >= LARGE_PAGE_MIN_BYTES) {
+                munmap(ptr, round_up(bytes, large_page_size));
+                return;
+            }
+#endif
+            std::free(ptr);
+        }
+
+      private:
+        static constexpr size_t round_up(size_t n, size_t multiple) { return (n + multiple - 1) / multiple * multiple; }
+    };
+
+    template <typename T, typename U>
+    inline bool operator==(const LargePageAllocator<T> &, const LargePageAllocator<U> &) {
+        return true;
+    }
+
+    template <typename T, typename U>
+    inline bool operator!=(const LargePageAllocator<T> & a, const LargePageAllocator<U> & b) {
+        return not(a == b);
+    }
+
+    /// The allocator used for the big particle and grid containers
+    template <class T>
+#ifdef USE_LARGE_PAGES
+    using LargeAllocator = LargePageAllocator<T>;
+#else
+    using LargeAllocator = Allocator<T>;
+#endif
+
+    /// Container for big arrays (particles, grids)
+    template <class T>
+    using LargeVector = std::vector<T, LargeAllocator<T>>;
+
+    //================================================
+    /// Allocator adaptor that does not initialize the elements of
+    /// trivially copyable types when a container is resized, e.g. so
+    /// that we can first-touch the memory in parallel (NUMA) instead
+    //================================================
+    template <class T, class A = Allocator<T>>
+    class NoInitAllocator : public A {
+        using traits = std::allocator_traits<A>;
+
+      public:
+        template <class U>
+        struct rebind {
+            using other = NoInitAllocator<U, typename traits::template rebind_alloc<U>>;
+        };
+
+        using A::A;
+        NoInitAllocator() = default;
+        template <class U, class B>
+        NoInitAllocator(const NoInitAllocator<U, B> & rhs) : A(static_cast<const B &>(rhs)) {}
+
+        template <class U>
+        void construct(U * ptr) {
+            if constexpr (not(std::is_trivially_copyable<U>::value and std::is_trivially_destructible<U>::value))
+                ::new (static_cast<void *>(ptr)) U;
+        }
+        template <class U, class... Args>
+        void construct(U * ptr, Args &&... args) {
+            traits::construct(static_cast<A &>(*this), ptr, std::forward<Args>(args)...);
+        }
+    };
+
+    /// Container whose elements are left uninitialized by resize (for trivially copyable types)
+    template <class T>
+    using UninitializedVector = std::vector<T, NoInitAllocator<T>>;
+
+    /// Container for big arrays whose elements are left uninitialized by resize
+    template <class T>
+    using UninitializedLargeVector = std::vector<T, NoInitAllocator<T, LargeAllocator<T>>>;
+
     //================================================
     // Integer type for array indices
     //================================================
@@ -116,55 +288,229 @@ namespace FML {
         return values;
     }
 
-    /// Inplace max over tasks of a single value
+    //================================================
+    /// The result of a non-blocking collective (e.g. SumOverTasksAsync). The values
+    /// are only updated when wait() is called (the destructor waits if this has not
+    /// been done) so the values must stay alive and not be touched until then.
+    /// Everything that follows is collective so all tasks must make the same calls
+    /// in the same order
+    //================================================
+    class CollectiveFuture {
+      public:
+        CollectiveFuture() = default;
+        CollectiveFuture(const CollectiveFuture &) = delete;
+        CollectiveFuture & operator=(const CollectiveFuture &) = delete;
+        CollectiveFuture(CollectiveFuture && rhs) noexcept { *this = std::move(rhs); }
+        CollectiveFuture & operator=(CollectiveFuture && rhs) noexcept {
+            if (this != &rhs) {
+                wait();
+#ifdef USE_MPI
+                request = rhs.request;
+                rhs.request = MPI_REQUEST_NULL;
+#endif
+                sendbuf = std::move(rhs.sendbuf);
+                recvbuf = std::move(rhs.recvbuf);
+                finish = std::move(rhs.finish);
+                rhs.finish = nullptr;
+                callbacks = std::move(rhs.callbacks);
+                rhs.callbacks.clear();
+            }
+            return *this;
+        }
+        ~CollectiveFuture() { wait(); }
+
+        /// Wait for the collective to complete and write the result to the values
+        void wait() {
+#ifdef USE_MPI
+            if (request != MPI_REQUEST_NULL)
+                MPI_Wait(&request, MPI_STATUS_IGNORE);
+#endif
+            if (finish)
+                finish(recvbuf.data());
+            finish = nullptr;
+            for (auto & f : callbacks)
+                f();
+            callbacks.clear();
+        }
+
+        /// Add a function to be called (after the values are set) when we wait
+        void then(std::function<void()> f) { callbacks.push_back(std::move(f)); }
+
+        // Internal: the buffers and how to unpack the result
+#ifdef USE_MPI
+        MPI_Request request{MPI_REQUEST_NULL};
+#endif
+        std::vector<char> sendbuf{};
+        std::vector<char> recvbuf{};
+        std::function<void(const char *)> finish{};
+        std::vector<std::function<void()>> callbacks{};
+    };
+
+#ifdef USE_MPI
+    /// The MPI type of a fundamental type (MPI_DATATYPE_NULL if there is none)
     template <class T>
-    void MaxOverTasks([[maybe_unused]] T * value) {
+    MPI_Datatype get_mpi_datatype() {
+        using U = std::remove_cv_t<T>;
+        if constexpr (std::is_same<U, double>::value)
+            return MPI_DOUBLE;
+        else if constexpr (std::is_same<U, float>::value)
+            return MPI_FLOAT;
+        else if constexpr (std::is_same<U, long double>::value)
+            return MPI_LONG_DOUBLE;
+        else if constexpr (std::is_same<U, char>::value)
+            return MPI_CHAR;
+        else if constexpr (std::is_same<U, int>::value)
+            return MPI_INT;
+        else if constexpr (std::is_same<U, unsigned int>::value)
+            return MPI_UNSIGNED;
+        else if constexpr (std::is_same<U, long>::value)
+            return MPI_LONG;
+        else if constexpr (std::is_same<U, unsigned long>::value)
+            return MPI_UNSIGNED_LONG;
+        else if constexpr (std::is_same<U, long long>::value)
+            return MPI_LONG_LONG;
+        else if constexpr (std::is_same<U, unsigned long long>::value)
+            return MPI_UNSIGNED_LONG_LONG;
+        else
+            return MPI_DATATYPE_NULL;
+    }
+#endif
+
+    /// Non-blocking reduction over tasks of any number of values (of any type) with
+    /// the binary operation op in one collective. The values are gathered from all tasks
+    /// and reduced in task order so all tasks get the same result
+    template <class Op, class... T>
+    CollectiveFuture ReduceOverTasksAsync(Op op, T *... values) {
+        constexpr size_t bytes = (sizeof(T) + ... + 0);
+        CollectiveFuture f;
+        f.sendbuf.resize(bytes);
+        size_t offset = 0;
+        ((std::memcpy(f.sendbuf.data() + offset, values, sizeof(T)), offset += sizeof(T)), ...);
+        const int ntasks = FML::NTasks;
+#ifdef USE_MPI
+        if (ntasks > 1) {
+            f.recvbuf.resize(bytes * ntasks);
+            MPI_Iallgather(f.sendbuf.data(),
+                           int(bytes),
+                           MPI_BYTE,
+                           f.recvbuf.data(),
+                           int(bytes),
+                           MPI_BYTE,
+                           MPI_COMM_WORLD,
+                           &f.request);
+        } else
+#endif
+            f.recvbuf = f.sendbuf;
+        f.finish = [=](const char * buffer) {
+            size_t offset = 0;
+            auto reduce = [&](auto * value) {
+                using V = std::remove_pointer_t<decltype(value)>;
+                V result;
+                std::memcpy(&result, buffer + offset, sizeof(V));
+                for (int i = 1; i < ntasks; i++) {
+                    V v;
+                    std::memcpy(&v, buffer + i * bytes + offset, sizeof(V));
+                    result = op(result, v);
+                }
+                *value = result;
+                offset += sizeof(V);
+            };
+            (reduce(values), ...);
+        };
+        return f;
+    }
+
+    /// Non-blocking inplace sum over tasks of one or more values
+    template <class... T>
+    CollectiveFuture SumOverTasksAsync(T *... values) {
+        return ReduceOverTasksAsync([](const auto & a, const auto & b) { return a + b; }, values...);
+    }
+
+    /// Non-blocking inplace max over tasks of one or more values
+    template <class... T>
+    CollectiveFuture MaxOverTasksAsync(T *... values) {
+        return ReduceOverTasksAsync([](const auto & a, const auto & b) { return a < b ? b : a; }, values...);
+    }
+
+    /// Non-blocking inplace min over tasks of one or more values
+    template <class... T>
+    CollectiveFuture MinOverTasksAsync(T *... values) {
+        return ReduceOverTasksAsync([](const auto & a, const auto & b) { return b < a ? b : a; }, values...);
+    }
+
+    /// Inplace max over tasks of one or more values (in one collective)
+    template <class... T>
+    void MaxOverTasks([[maybe_unused]] T *... values) {
         if (FML::NTasks == 1)
             return;
-        std::vector<T> values = GatherFromTasks(value);
-        T maxvalue = *value;
-        for (auto v : values)
-            if (maxvalue < v)
-                maxvalue = v;
-        *value = maxvalue;
+        MaxOverTasksAsync(values...).wait();
     }
-    
-    /// Inplace min over tasks of a single value
-    template <class T>
-    void MinOverTasks([[maybe_unused]] T * value) {
+
+    /// Inplace min over tasks of one or more values (in one collective)
+    template <class... T>
+    void MinOverTasks([[maybe_unused]] T *... values) {
         if (FML::NTasks == 1)
             return;
-        std::vector<T> values = GatherFromTasks(value);
-        T minvalue = *value;
-        for (auto v : values)
-            if (minvalue > v)
-                minvalue = v;
-        *value = minvalue;
+        MinOverTasksAsync(values...).wait();
     }
-    
-    /// Inplace sum over tasks of a single value
-    template <class T>
-    void SumOverTasks([[maybe_unused]] T * value) {
+
+    /// Inplace sum over tasks of one or more values (in one collective)
+    template <class... T>
+    void SumOverTasks([[maybe_unused]] T *... values) {
         if (FML::NTasks == 1)
             return;
-        std::vector<T> values = GatherFromTasks(value);
-        T sum = 0;
-        for (auto v : values) {
-            sum += v;
+        SumOverTasksAsync(values...).wait();
+    }
+
+    /// Non-blocking inplace sum over tasks of a contigious array of values
+    template <class T>
+    CollectiveFuture SumArrayOverTasksAsync([[maybe_unused]] T * value, [[maybe_unused]] int n) {
+        CollectiveFuture f;
+        if (FML::NTasks == 1 or n == 0)
+            return f;
+#ifdef USE_MPI
+        const MPI_Datatype type = get_mpi_datatype<T>();
+        if (type != MPI_DATATYPE_NULL) {
+            MPI_Iallreduce(MPI_IN_PLACE, value, n, type, MPI_SUM, MPI_COMM_WORLD, &f.request);
+        } else {
+            const size_t bytes = sizeof(T) * n;
+            const int ntasks = FML::NTasks;
+            f.sendbuf.resize(bytes);
+            f.recvbuf.resize(bytes * ntasks);
+            std::memcpy(f.sendbuf.data(), value, bytes);
+            MPI_Iallgather(f.sendbuf.data(),
+                           int(bytes),
+                           MPI_BYTE,
+                           f.recvbuf.data(),
+                           int(bytes),
+                           MPI_BYTE,
+                           MPI_COMM_WORLD,
+                           &f.request);
+            f.finish = [=](const char * buffer) {
+                for (int j = 0; j < n; j++) {
+                    T sum;
+                    std::memcpy(&sum, buffer + j * sizeof(T), sizeof(T));
+                    for (int i = 1; i < ntasks; i++) {
+                        T v;
+                        std::memcpy(&v, buffer + i * bytes + j * sizeof(T), sizeof(T));
+                        sum = sum + v;
+                    }
+                    value[j] = sum;
+                }
+            };
         }
-        *value = sum;
+#endif
+        return f;
     }
-    
-    /// Inplace sum over tasks of a contigious array of values
+
+    /// Inplace sum over tasks of a contigious array of values (in one collective)
     template <class T>
     void SumArrayOverTasks([[maybe_unused]] T * value, int n) {
         if (FML::NTasks == 1)
             return;
-        for(int i = 0; i < n; i++){
-          SumOverTasks(&value[i]);
-        }
+        SumArrayOverTasksAsync(value, n).wait();
     }
-    
+
     //============================================
     /// An assert function that calls MPI_Abort
     /// instead of just abort to avoid deadlock
@@ -285,6 +631,75 @@ namespace FML {
 
 namespace FML {
 
+#if defined(USE_MPI) && !defined(NO_MPI_SHARED_MEMORY)
+    //=============================================================
+    /// A buffer shared by the tasks on the same node (an MPI-3 shared
+    /// memory window) with one part per task. A task writes to its own
+    /// part and after sync() the other tasks on the node read it
+    /// directly, i.e. without going through MPI messages.
+    /// ensure_capacity and sync are collective over the tasks on the node
+    //=============================================================
+    class SharedMemoryWindow {
+      private:
+        MPI_Win win{MPI_WIN_NULL};
+        char * base{nullptr};
+        size_t capacity{0};
+
+        void free() {
+            if (win == MPI_WIN_NULL)
+                return;
+            // Windows that live until exit are freed by MPI_Finalize
+            int finalized = 0;
+            MPI_Finalized(&finalized);
+            if (not finalized) {
+                MPI_Win_unlock_all(win);
+                MPI_Win_free(&win);
+            }
+            win = MPI_WIN_NULL;
+            base = nullptr;
+            capacity = 0;
+        }
+
+      public:
+        SharedMemoryWindow() = default;
+        SharedMemoryWindow(const SharedMemoryWindow &) = delete;
+        SharedMemoryWindow & operator=(const SharedMemoryWindow &) = delete;
+        ~SharedMemoryWindow() { free(); }
+
+        /// Make sure our part (and that of all tasks on the node) has room for at least bytes
+        void ensure_capacity(size_t bytes) {
+            unsigned long long maxbytes = bytes;
+            MPI_Allreduce(MPI_IN_PLACE, &maxbytes, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, NodeComm);
+            if (win != MPI_WIN_NULL and maxbytes <= capacity)
+                return;
+            free();
+            // Some headroom so we don't reallocate every time the size changes a little
+            capacity = std::max(size_t(maxbytes + maxbytes / 4), size_t(64));
+            MPI_Win_allocate_shared(MPI_Aint(capacity), 1, MPI_INFO_NULL, NodeComm, &base, &win);
+            MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+        }
+
+        /// Our part of the window
+        char * local() { return base; }
+
+        /// The part of the window belonging to task (which must be on the same node as us)
+        const char * of_task(int task) const {
+            MPI_Aint size;
+            int disp_unit;
+            char * ptr;
+            MPI_Win_shared_query(win, NodeRankOfTask[task], &size, &disp_unit, &ptr);
+            return ptr;
+        }
+
+        /// Make what we have written visible to the other tasks on the node and wait for them to do the same
+        void sync() {
+            MPI_Win_sync(win);
+            MPI_Barrier(NodeComm);
+            MPI_Win_sync(win);
+        }
+    };
+#endif
+
     //=============================================================
     /// Singleton for initializing and finalizing MPI automatically on
     /// startup and exit
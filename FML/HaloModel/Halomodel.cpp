@@ -179,22 +179,25 @@ namespace FML {
 
         //================================================
         // Compute and spline sigma(R)
+        // Delta(k) is the same for all R so we only evaluate it once
         //================================================
-        DVector logsigma_array;
-        for(const auto R : R_array){
-
-          auto integrand = [&logDelta_of_logk,&window_of_kR](double logk, double R){
-            const double k = std::exp(logk);
-            const double W = window_of_kR(k*R);
-            return std::exp(logDelta_of_logk(logk)) * W * W;
-          };
+        DVector Delta_array(logk_array.size());
+        for(size_t j = 0; j < logk_array.size(); j++)
+          Delta_array[j] = std::exp(logDelta_of_logk(logk_array[j]));
 
+        DVector logsigma_array(R_array.size());
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+        for(size_t i = 0; i < R_array.size(); i++){
+          const double R = R_array[i];
           double integral = 0.0;
-          for(const auto logk : logk_array){
-            integral += integrand(logk, R);
+          for(size_t j = 0; j < k_array.size(); j++){
+            const double W = window_of_kR(k_array[j]*R);
+            integral += Delta_array[j] * W * W;
           }
           integral *= (logk_array[1]-logk_array[0]);
-          logsigma_array.push_back(0.5*std::log(integral));
+          logsigma_array[i] = 0.5*std::log(integral);
         }
         logsigma_of_logR_spline = Spline(logR_array, logsigma_array, "sigma(R)");
       }
@@ -432,16 +435,22 @@ namespace FML {
         const auto logM_array = FML::MATH::linspace(std::log(Mmin),std::log(Mmax),npts_M);
         const double dlogM = logM_array[1]-logM_array[0];
 
-        DVector dndlogM_array(npts_M), n_array(npts_M, 0.0), lognu_array(npts_M,0.0);
-        for(int i = npts_M-1; i >= 0; i--){
+        DVector dndlogM_array(npts_M), n_array(npts_M, 0.0);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+        for(int i = 0; i < npts_M; i++){
           const double logM = logM_array[i];
           const double M = std::exp(logM);
           const double R = RofM(M, OmegaM, x);
           const double logR = std::log(R);
           const double lognu = lognu_of_logR_spline(logR);
-          const double dndlogM = dndlogM_of_lognu(lognu);
-          dndlogM_array[i] = dndlogM;
-          n_array[i] = dndlogM * dlogM;
+          dndlogM_array[i] = dndlogM_of_lognu(lognu);
+        }
+
+        // Cumulative number density n(>M)
+        for(int i = npts_M-1; i >= 0; i--){
+          n_array[i] = dndlogM_array[i] * dlogM;
           if(i < npts_M-1)
             n_array[i] += n_array[i+1];
         }
@@ -485,46 +494,28 @@ namespace FML {
         auto k_array = logk_array;
         for(auto & k : k_array) k = std::exp(k);
 
-        auto integrand_onehalo = [&logR_of_lognu_spline,&y_of_logR_and_logk_spline,&eta_hmcode,&pdf_of_nu](double lognu, double logk){
-          const double nu = std::exp(lognu);
-          const double logR = logR_of_lognu_spline(lognu);
-          const double y = y_of_logR_and_logk_spline(logR, logk + lognu*eta_hmcode);
-          const double f = pdf_of_nu(nu);
-          const double Moverrhomean = 4.0 * M_PI / 3.0 * std::exp(3.0*logR);
-          return Moverrhomean * f * (y*y) * nu;
-        };
-
-        auto integrand_twohalo = [&eta_hmcode,&logR_of_lognu_spline,&y_of_logR_and_logk_spline,&pdf_of_nu,&bias_of_nu](double lognu, double logk){
-          const double nu = std::exp(lognu);
-          const double logR = logR_of_lognu_spline(lognu);
-          const double y = y_of_logR_and_logk_spline(logR, logk + lognu*eta_hmcode);
-          const double f = pdf_of_nu(nu);
-          const double bias = bias_of_nu(nu);
-          return bias * f * y * nu;
-        };
-
-        // This should integrate to 1
-        auto integrand_norm_onehalo = [&pdf_of_nu](double lognu){
-          const double nu = std::exp(lognu);
-          const double f = pdf_of_nu(nu);
-          return f * nu;
-        };
-
-        // This should integrate to 1
-        auto integrand_norm_twohalo = [&pdf_of_nu,&bias_of_nu](double lognu){
-          const double nu = std::exp(lognu);
+        //================================================
+        // Everything in the integrands except y(R,k) only depends on nu
+        // so we tabulate it once: logR(nu), f(nu)nu and b(nu)f(nu)nu
+        //================================================
+        DVector logR_of_nu_array(npts_nu);
+        DVector fnu_array(npts_nu);
+        DVector bfnu_array(npts_nu);
+        for(int i = 0; i < npts_nu; i++){
+          const double nu = std::exp(lognu_array[i]);
           const double f = pdf_of_nu(nu);
-          const double bias = bias_of_nu(nu);
-          return bias * f * nu;
-        };
+          logR_of_nu_array[i] = logR_of_lognu_spline(lognu_array[i]);
+          fnu_array[i] = f * nu;
+          bfnu_array[i] = bias_of_nu(nu) * f * nu;
+        }
 
         // Compute Int fdnu and Int bf dnu
         // Both which should be unity
         double normone = 0.0;
         double normtwo = 0.0;
-        for(const auto lognu : lognu_array){
-          normone += integrand_norm_onehalo(lognu);
-          normtwo += integrand_norm_twohalo(lognu);
+        for(int i = 0; i < npts_nu; i++){
+          normone += fnu_array[i];
+          normtwo += bfnu_array[i];
         }
         normone *= (lognu_array[1]-lognu_array[0]);
         normtwo *= (lognu_array[1]-lognu_array[0]);
@@ -535,19 +526,26 @@ namespace FML {
           std::cout << "Could be that massfunction is not normalized. In that case this should be unity: " << normtwo/normone << "\n";
         }
 
-        DVector logDelta_onehalo_array;
-        DVector logDelta_twohalo_array;
-        DVector logDelta_full_array;
-        for(const auto logk : logk_array){
-          const double k = std::exp(logk);
+        DVector logDelta_onehalo_array(npts_k);
+        DVector logDelta_twohalo_array(npts_k);
+        DVector logDelta_full_array(npts_k);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+        for(int ik = 0; ik < npts_k; ik++){
+          const double logk = logk_array[ik];
+          const double k = k_array[ik];
 
           // Integrate up one and two halo integrals
           double onehalo = 0.0;
           double twohalo = 0.0;
           double full = 0.0;
-          for(const auto lognu : lognu_array){
-            onehalo += integrand_onehalo(lognu, logk);
-            twohalo += integrand_twohalo(lognu, logk);
+          for(int i = 0; i < npts_nu; i++){
+            const double logR = logR_of_nu_array[i];
+            const double y = y_of_logR_and_logk_spline(logR, logk + lognu_array[i]*eta_hmcode);
+            const double Moverrhomean = 4.0 * M_PI / 3.0 * std::exp(3.0*logR);
+            onehalo += Moverrhomean * fnu_array[i] * (y*y);
+            twohalo += bfnu_array[i] * y;
           }
           onehalo *= (lognu_array[1]-lognu_array[0]);
           twohalo *= (lognu_array[1]-lognu_array[0]);
@@ -558,10 +556,9 @@ namespace FML {
           twohalo = twohalo * twohalo * std::exp(logDeltaLin_of_logk(logk));
           full = onehalo + twohalo;
 
-          logDelta_onehalo_array.push_back(std::log(onehalo));
-          logDelta_twohalo_array.push_back(std::log(twohalo));
-          logDelta_full_array.push_back(std::log(full));
-
+          logDelta_onehalo_array[ik] = std::log(onehalo);
+          logDelta_twohalo_array[ik] = std::log(twohalo);
+          logDelta_full_array[ik] = std::log(full);
         }
 
         logDelta_onehalo_of_logk_spline = Spline(logk_array, logDelta_onehalo_array, "logDelta1h(logk)");
@@ -617,13 +614,16 @@ namespace FML {
         const auto logR_array = FML::MATH::linspace(std::log(Rmin), std::log(Rmax), npts_R);
 
         // Compute formation-factor (1+zf(m))/(1+zcollapse) for all radii
-        DVector formationtime_array;
-        DVector logM_array;
-        for(const auto logR : logR_array){
-          const double M = MofR(std::exp(logR), OmegaM, xcollapse);
+        DVector formationtime_array(npts_R);
+        DVector logM_array(npts_R);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+        for(int i = 0; i < npts_R; i++){
+          const double M = MofR(std::exp(logR_array[i]), OmegaM, xcollapse);
           const double xformation = compute_formation_redshift(M);
-          formationtime_array.push_back(std::exp(-xformation)-1.0);
-          logM_array.push_back(std::log(M));
+          formationtime_array[i] = std::exp(-xformation)-1.0;
+          logM_array[i] = std::log(M);
         }
         formationredshift_of_logM_spline = Spline(logM_array, formationtime_array, "zf(logM)");
       }
@@ -744,6 +744,14 @@ namespace FML {
 
       }
 
+      //=====================================================
+      // Throw away the cached sigma(R) so that it is
+      // recomputed in the next call to compute_at_redshift
+      //=====================================================
+      void HaloModel::clear_cache(){
+        sigma_cache_is_set = false;
+      }
+
       //=====================================================
       // Compute everything at a given redshift, i.e.
       // fills all the splines that depend on redshift
@@ -762,32 +770,48 @@ namespace FML {
         // Functions related to the variance of the smoothed
         // density field: smoothing filter and P(k)
         //=====================================================
-        const double pofk_scaling_factor = std::pow(growthfactor_of_x_spline(xcollapse) / growthfactor_of_x_spline(xinput_pofk), 2);
+        const double growth_ratio = growthfactor_of_x_spline(xcollapse) / growthfactor_of_x_spline(xinput_pofk);
+        const double pofk_scaling_factor = growth_ratio * growth_ratio;
         const Func1 logDeltaLin_of_logk = [&](double logk){
           return logDelta_of_logk_spline(logk) + std::log(pofk_scaling_factor);
         };
 
         //=====================================================
         // Density field variance when smoothed: sigma(logR)
+        // We only have scale-independent growth so this is computed
+        // once at the redshift of the input P(k) and then rescaled
         //=====================================================
         timer.StartTiming("sigma");
-        if(verbose){
-          std::cout << "Computing sigmas\n";
+        if(not sigma_cache_is_set){
+          if(verbose){
+            std::cout << "Computing sigmas\n";
+          }
+          const Func1 logDeltaInput_of_logk = [&](double logk){
+            return logDelta_of_logk_spline(logk);
+          };
+          compute_sigma(
+              logDeltaInput_of_logk,
+              fourier_window_function,
+              logsigma_input_of_logR_spline,
+              fiducial_logR_array.get(),
+              fiducial_logk_array.get());
+          sigmav_input    = compute_sigmav(logDeltaInput_of_logk, fourier_window_function, 0.0);
+          sigmav100_input = compute_sigmav(logDeltaInput_of_logk, fourier_window_function, 100.0);
+          sigma_cache_is_set = true;
         }
-        compute_sigma(
-            logDeltaLin_of_logk,
-            fourier_window_function,
-            logsigma_of_logR_spline,
-            fiducial_logR_array.get(),
-            fiducial_logk_array.get());
+        auto logR_array = logsigma_input_of_logR_spline.get_x_data();
+        auto logsigma_array = logsigma_input_of_logR_spline.get_y_data();
+        for(auto & logsigma : logsigma_array)
+          logsigma += std::log(growth_ratio);
+        logsigma_of_logR_spline = Spline(logR_array, logsigma_array, "sigma(R)");
         timer.EndTiming("sigma");
 
         //=====================================================
         // Set OmegaM and sigma8 at current redshift
         //=====================================================
         sigma8    = std::exp(logsigma_of_logR_spline(std::log(8.0)));
-        sigmav    = compute_sigmav(logDeltaLin_of_logk, fourier_window_function, 0.0);
-        sigmav100 = compute_sigmav(logDeltaLin_of_logk, fourier_window_function, 100.0);
+        sigmav    = sigmav_input * growth_ratio;
+        sigmav100 = sigmav100_input * growth_ratio;
 
         //=====================================================
         // Extract deltac and DeltaVir
@@ -1145,7 +1169,7 @@ namespace FML {
         const bool extraverbose = true;
 
         std::cout << "\n#=====================================================\n";
-        std::cout << "# Halomodel info ( z = " << (isnan(xcollapse) ?  " not yet set " : std::to_string(std::exp(-xcollapse)-1.0)) << " )\n";
+        std::cout << "# Halomodel info ( z = " << (std::isnan(xcollapse) ?  " not yet set " : std::to_string(std::exp(-xcollapse)-1.0)) << " )\n";
         std::cout << "#=====================================================\n";
         std::cout << "# OmegaM            : " << OmegaM << "\n";
         std::cout << "# fnu               : " << fnu << "\n";
@@ -1161,7 +1185,7 @@ namespace FML {
         if(hmcode)
           std::cout << "# Running with HMCode settings\n";
 
-        if(isnan(xcollapse)){
+        if(std::isnan(xcollapse)){
           // Compute sigma8 to be able to output it for debug purposes
           const Func1 logDeltaLin_of_logk = [&](double logk){
             return logDelta_of_logk_spline(logk);
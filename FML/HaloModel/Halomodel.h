@@ -8,6 +8,7 @@
 #include <FML/Timing/Timings.h>
 #include <FML/SphericalCollapse/SphericalCollapse.h>
 #include <cmath>
+#include <memory>
 #include <tuple>
 #include <iostream>
 #include <fstream>
@@ -155,6 +156,18 @@ namespace FML {
           double cofM_multiplier = 1.0;
           double deltac_multiplier = 1.0;
 
+          //===========================================
+          // sigma(R), sigmav and sigmav100 at the redshift of
+          // the input P(k). The growth is scale-independent so these
+          // are computed once and rescaled by the growth factor in
+          // compute_at_redshift. Call clear_cache if the input P(k), the
+          // window function or the fiducial arrays are changed
+          //===========================================
+          bool sigma_cache_is_set{false};
+          Spline logsigma_input_of_logR_spline{"logsigma_input"};
+          double sigmav_input{};
+          double sigmav100_input{};
+
           //===========================================
           // Splines we generate as we run
           //===========================================
@@ -210,6 +223,11 @@ namespace FML {
           //=====================================================
           void compute_at_redshift(double zcollapse);
 
+          //=====================================================
+          // Recompute the redshift independent pieces next time
+          //=====================================================
+          void clear_cache();
+
           //=====================================================
           // Output P(k) over whole range computed
           //=====================================================
@@ -34,6 +34,7 @@ class HaloModel:
     self.DeltaVirfac = DeltaVirfac
     self.cofmfac = cofmfac
     self.is_init = False
+    self.pofk_table = None
     self.init()
 
   def init(self):
@@ -85,6 +86,30 @@ class HaloModel:
     hm.get_nofM(self.halomodel, M, dndlogM, n)
     return dndlogM, n
 
+  def tabulate_pofk(self, z):
+    """
+    Run the halomodel once at each redshift in z (increasing, at least 4 values)
+    and keep a spline of P(k,z) so that get_pofk_kz is fast
+    """
+    self.init()
+    if self.pofk_table is not None:
+      hm.free_pofk_table(self.pofk_table)
+    self.pofk_table = hm.tabulate_pofk(self.halomodel, np.asarray(z, dtype=np.float64))
+
+  def get_pofk_kz(self, k, z):
+    """
+    Plin(k,z) and P(k,z) for arrays of k and z from the table made by tabulate_pofk.
+    Returns two arrays of shape (len(z), len(k))
+    """
+    if self.pofk_table is None:
+      raise RuntimeError("Call tabulate_pofk before get_pofk_kz")
+    k = np.asarray(k, dtype=np.float64)
+    z = np.atleast_1d(np.asarray(z, dtype=np.float64))
+    pofk_lin = np.zeros((len(z), len(k)))
+    pofk = np.zeros((len(z), len(k)))
+    hm.get_pofk_table(self.pofk_table, k, z, pofk_lin, pofk)
+    return pofk_lin, pofk
+
   def get_deltac_of_z(self, z):
     self.init()
     deltac = np.zeros_like(z)
@@ -92,4 +117,6 @@ class HaloModel:
     return deltac
 
   def __del__(self):
+    if self.pofk_table is not None:
+      hm.free_pofk_table(self.pofk_table)
     hm.free(self.halomodel)
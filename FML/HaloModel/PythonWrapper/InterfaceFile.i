@@ -30,6 +30,10 @@
  extern void get_DeltaVir(HaloModel **hmp, int nz, double *z, int nDeltaVir, double *DeltaVir);
  extern void get_deltac(HaloModel **hmp, int nz, double *z, int ndeltac, double *deltac);
  extern void get_pofk_1h_2h(HaloModel **hmp, int nk, double * k, int npofk_1h, double * pofk_1h, int npofk_2h, double *pofk_2h);
+ struct PofkTable;
+ extern PofkTable *tabulate_pofk(HaloModel **hmp, int nz, double *z);
+ extern void get_pofk_table(PofkTable *table, int nk, double *k, int nz, double *z, int nzlin, int nklin, double *pofk_lin, int nznl, int nknl, double *pofk);
+ extern void free_pofk_table(PofkTable *table);
 %}
 
 #include <FML/HaloModel/Halomodel.h>
@@ -44,6 +48,7 @@ import_array();
 %apply (int DIM1, double* IN_ARRAY1) {(int nk, double *k), (int npofk_1h, double *pofk_1h), (int npofk_2h, double *pofk_2h)};
 %apply (int DIM1, double* IN_ARRAY1) {(int nz, double *z), (int nDeltaVir, double *DeltaVir)};
 %apply (int DIM1, double* IN_ARRAY1) {(int nz, double *z), (int ndeltac, double *deltac)};
+%apply (int DIM1, int DIM2, double* INPLACE_ARRAY2) {(int nzlin, int nklin, double *pofk_lin), (int nznl, int nknl, double *pofk)};
 
 extern HaloModel **get();
 extern void calc(HaloModel **hm, double z);
@@ -68,3 +73,7 @@ extern void get_nofM(HaloModel **hmp, int nm, double * M, int ndnofm, double *dn
 extern void get_DeltaVir(HaloModel **hmp, int nz, double *z, int nDeltaVir, double *DeltaVir);
 extern void get_deltac(HaloModel **hmp, int nz, double *z, int ndeltac, double *deltac);
 extern void get_pofk_1h_2h(HaloModel **hmp, int nk, double * k, int npofk_1h, double * pofk_1h, int npofk_2h, double *pofk_2h);
+struct PofkTable;
+extern PofkTable *tabulate_pofk(HaloModel **hmp, int nz, double *z);
+extern void get_pofk_table(PofkTable *table, int nk, double *k, int nz, double *z, int nzlin, int nklin, double *pofk_lin, int nznl, int nknl, double *pofk);
+extern void free_pofk_table(PofkTable *table);
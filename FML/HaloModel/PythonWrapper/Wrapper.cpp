@@ -5,7 +5,9 @@ using SphericalCollapseModel = FML::COSMOLOGY::SPHERICALCOLLAPSE::SphericalColla
 using HaloModel = FML::COSMOLOGY::HALOMODEL::HaloModel;
 using Func1 = FML::COSMOLOGY::HALOMODEL::Func1;
 using Spline = FML::INTERPOLATION::SPLINE::Spline;
+using Spline2D = FML::INTERPOLATION::SPLINE::Spline2D;
 using DVector = FML::SOLVERS::ODESOLVER::DVector;
+using DVector2D = FML::INTERPOLATION::SPLINE::DVector2D;
 
 // Allocate memory
 HaloModel **get(){
@@ -70,6 +72,87 @@ void get_nofM(HaloModel **hmp, int nm, double * M, int ndnofm, double *dnofm, in
   }
 }
 
+//================================================
+// The non-linear P(k,z) tabulated on a grid of redshifts
+// so that P(k,z) for arrays of k and z can be evaluated
+// without rerunning the halomodel. The linear P(k,z) is
+// just the input P(k) times the growth factor so we
+// compute that directly
+//================================================
+struct PofkTable {
+  Spline2D logDelta_of_logk_and_z_spline{"logDelta(logk,z)"};
+  HaloModel *hm;
+};
+
+// Run the halomodel at each of the redshifts (at least 4 and increasing) and spline log Delta^2(log k, z)
+PofkTable *tabulate_pofk(HaloModel **hmp, int nz, double *z){
+  HaloModel *hm = *hmp;
+  if(nz < 4)
+    throw std::runtime_error("We need at least 4 redshifts to tabulate P(k,z)\n");
+  for(int i = 1; i < nz; i++)
+    if(z[i] <= z[i-1])
+      throw std::runtime_error("The redshifts to tabulate P(k,z) at must be increasing\n");
+
+  DVector zarr(z, z + nz);
+  DVector logk;
+  DVector2D logDelta;
+  for(int j = 0; j < nz; j++){
+    hm->compute_at_redshift(z[j]);
+
+    // All redshifts use the same k-range so we make the k-array at the first one
+    if(j == 0){
+      const int nk = 500;
+      const auto range = hm->logDeltaHM_full_of_logk_spline.get_xrange();
+      logk = FML::MATH::linspace(range.first, range.second, nk);
+      logDelta = DVector2D(nk, DVector(nz));
+    }
+    for(size_t i = 0; i < logk.size(); i++)
+      logDelta[i][j] = hm->logDeltaHM_full_of_logk_spline(logk[i]);
+  }
+
+  PofkTable *table = new PofkTable;
+  table->logDelta_of_logk_and_z_spline.create(logk, zarr, logDelta, "logDelta(logk,z)");
+  table->hm = hm;
+  return table;
+}
+
+// Fetch Plin(k,z) and P(k,z) for all k and z from the table. The result arrays have shape (nz, nk)
+void get_pofk_table(
+    PofkTable *table,
+    int nk, double *k,
+    int nz, double *z,
+    int nzlin, int nklin, double *pofk_lin,
+    int nznl, int nknl, double *pofk){
+  if(nzlin != nz or nznl != nz or nklin != nk or nknl != nk)
+    throw std::runtime_error("Arrays pofk must have shape (len(z), len(k))\n");
+  HaloModel *hm = table->hm;
+
+  // The parts that only depend on k
+  DVector logk(nk), factor(nk), Delta_lin_input(nk);
+  for(int i = 0; i < nk; i++){
+    logk[i] = std::log(k[i]);
+    factor[i] = (2.0*M_PI*M_PI)/(k[i]*k[i]*k[i]);
+    Delta_lin_input[i] = std::exp(hm->logDelta_of_logk_spline(logk[i]));
+  }
+
+  const double Dinput = hm->growthfactor_of_x_spline(hm->xinput_pofk);
+  for(int j = 0; j < nz; j++){
+    const double D = hm->growthfactor_of_x_spline(std::log(1.0/(1.0+z[j])));
+    const double scaling = (D / Dinput) * (D / Dinput);
+    double *pofk_z = pofk + size_t(j) * nk;
+    double *pofk_lin_z = pofk_lin + size_t(j) * nk;
+    table->logDelta_of_logk_and_z_spline.eval_at_y(z[j], logk.data(), pofk_z, nk);
+    for(int i = 0; i < nk; i++){
+      pofk_z[i] = std::exp(pofk_z[i]) * factor[i];
+      pofk_lin_z[i] = scaling * Delta_lin_input[i] * factor[i];
+    }
+  }
+}
+
+void free_pofk_table(PofkTable *table){
+  delete table;
+}
+
 // Compute P(k,z) 
 void calc(HaloModel **hmp, double z){
   HaloModel *hm = *hmp;
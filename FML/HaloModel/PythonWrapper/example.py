@@ -97,3 +97,11 @@ plt.plot(k,pofk2_2h,label="Non HMCode 2h",ls="dashed")
 plt.legend()
 plt.show()
 
+
+# For many evaluations (e.g. in a likelihood) tabulate P(k,z) once and then
+# evaluate it for arrays of k and z without rerunning the halomodel
+model.tabulate_pofk(np.linspace(0.0, 2.0, 21))
+start = time.time()
+for i in range(1000):
+  pofk_lin_kz, pofk_kz = model.get_pofk_kz(k, [0.0, 0.5, 1.0])
+print("Time per get_pofk_kz call:", (time.time() - start) / 1000.0, "sec")
@@ -2,10 +2,12 @@
 #define PARTICLEGRIDINTERPOLATION_HEADER
 
 #include <array>
+#include <memory>
 #include <functional>
 #include <vector>
 
 #include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/FFTWGrid/FFTWGridPool.h>
 #include <FML/Global/Global.h>
 #include <FML/MPIParticles/MPIParticles.h>
 #include <FML/ParticleTypes/ReflectOnParticleMethods.h>
@@ -40,6 +42,9 @@ namespace FML {
     /// DEBUG_INTERPOL           : Check that the interpolation weights
     ///                            sum to unity for density assignment
     ///
+    /// SERIAL_DENSITY_ASSIGNMENT : Do not use threads (OpenMP) when assigning particles
+    ///                            to the grid in particles_to_grid
+    ///
     /// CELLCENTERSHIFTED        : Shift the position of the cell (located at center of cell
     ///                            vs at the corners). Use with care. Not using this option
     ///                            saves a slice for even order interpoation and using it
@@ -47,6 +52,12 @@ namespace FML {
     ///                            Only relevant if memory is really tight and you need to use
     ///                            TSC or PQS
     ///
+    /// USE_OMP_TARGET           : Do the particles_to_grid and interpolate_grid_to_particle_positions loops
+    ///                            on a GPU with OpenMP target offload (needs a compiler with offloading
+    ///                            support, e.g. -fopenmp -foffload=nvptx-none for GCC). The positions and the
+    ///                            grid are copied to and from the device in every call (see
+    ///                            FML::NBODY::DeviceParticles for keeping the particles on the device)
+    ///
     //============================================================================
 
     namespace INTERPOLATION {
@@ -95,6 +106,198 @@ namespace FML {
                                                       size_t NumPart,
                                                       std::array<std::vector<FloatType>, N> & interpolated_values_vec);
 
+        /// @brief N grids with the same shape (e.g. the force vector) stored interleaved (array of structs), i.e. the N
+        /// values of a cell are next to each other in memory so interpolating all the components of a vector only
+        /// touches one cache line per cell instead of N. This is a copy of all the cells of the grids (also the extra
+        /// slices) so communicate the boundaries of the grids before making it. The grids can be freed afterwards.
+        ///
+        template <int N>
+        class InterleavedGridVector {
+          public:
+            InterleavedGridVector() = default;
+            InterleavedGridVector(const std::array<FFTWGrid<N>, N> & grid_vec) { set(grid_vec); }
+
+            /// Copy the values of the grids
+            void set(const std::array<FFTWGrid<N>, N> & grid_vec) {
+                const auto & grid = grid_vec[0];
+                for (auto & g : grid_vec) {
+                    assert_mpi(g.get_nmesh() == grid.get_nmesh() and
+                                   g.get_n_extra_slices_left() == grid.get_n_extra_slices_left() and
+                                   g.get_n_extra_slices_right() == grid.get_n_extra_slices_right(),
+                               "[InterleavedGridVector::set] All grids has to have the same size!\n");
+                }
+                Nmesh = grid.get_nmesh();
+                Local_nx = grid.get_local_nx();
+                Local_x_start = grid.get_local_x_start();
+                n_extra_x_slices_left = grid.get_n_extra_slices_left();
+                n_extra_x_slices_right = grid.get_n_extra_slices_right();
+                const ptrdiff_t num_cells_slice = grid.get_ntot_real_slice_alloc();
+                const int nslices = int(n_extra_x_slices_left + Local_nx + n_extra_x_slices_right);
+                offset = num_cells_slice * n_extra_x_slices_left;
+
+                values = UninitializedVector<std::array<FloatType, N>>(num_cells_slice * nslices);
+                std::array<const FloatType *, N> grid_left;
+                for (int idim = 0; idim < N; idim++)
+                    grid_left[idim] = grid_vec[idim].get_real_grid() - offset;
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+                for (int islice = 0; islice < nslices; islice++) {
+                    for (ptrdiff_t i = num_cells_slice * islice; i < num_cells_slice * (islice + 1); i++)
+                        for (int idim = 0; idim < N; idim++)
+                            values[i][idim] = grid_left[idim][i];
+                }
+            }
+
+            /// The N values in a cell (same indexing as FFTWGrid::get_real)
+            const std::array<FloatType, N> & get_real(const std::array<int, N> & coord) const {
+                IndexIntType index = coord[0];
+                for (int idim = 1; idim < N - 1; idim++)
+                    index = index * Nmesh + coord[idim];
+                index = index * (2 * (Nmesh / 2 + 1)) + coord[N - 1];
+                return values[offset + index];
+            }
+
+            int get_nmesh() const { return Nmesh; }
+            ptrdiff_t get_local_nx() const { return Local_nx; }
+            ptrdiff_t get_local_x_start() const { return Local_x_start; }
+            int get_n_extra_slices_left() const { return n_extra_x_slices_left; }
+            int get_n_extra_slices_right() const { return n_extra_x_slices_right; }
+
+            void free() {
+                values.clear();
+                values.shrink_to_fit();
+            }
+
+          private:
+            int Nmesh{0};
+            ptrdiff_t Local_nx{0};
+            ptrdiff_t Local_x_start{0};
+            int n_extra_x_slices_left{0};
+            int n_extra_x_slices_right{0};
+            ptrdiff_t offset{0};
+            UninitializedVector<std::array<FloatType, N>> values{};
+        };
+
+        /// @brief The interpolation stencils (the cells and weights) of a set of particles for a given grid size and
+        /// interpolation method. When several grids are interpolated to the same positions (e.g. the force components
+        /// and other fields, or the LPT displacement fields in COLA) we can compute the stencils once and reuse them
+        /// for all the grids. This costs N * ORDER * (sizeof(int) + sizeof(double)) bytes per particle. The stencils
+        /// are only valid as long as the particles don't move or get communicated, so call clear() when they do
+        /// (FML::NBODY::DriftParticles does this if you give it the stencils).
+        ///
+        /// Example use:
+        ///
+        ///   ParticleInterpolationStencils<N> stencils;
+        ///   stencils.compute(grid, part, NumPart, "CIC");
+        ///   interpolate_grid_to_particle_positions(grid, stencils, values);
+        ///   interpolate_grid_to_particle_positions(another_grid, stencils, more_values);
+        ///
+        template <int N>
+        class ParticleInterpolationStencils {
+          public:
+            ParticleInterpolationStencils() = default;
+
+            /// Compute the stencils of the particles for grids with the same shape as grid
+            template <class T>
+            void compute(const FFTWGrid<N> & grid, const T * part, size_t NumPart, std::string interpolation_method);
+
+            /// Are the stencils computed for this grid size, number of particles and interpolation method?
+            bool is_valid_for(const FFTWGrid<N> & grid, size_t NumPart, std::string interpolation_method) const;
+
+            /// Forget the stencils (and free the memory)
+            void clear();
+
+            int get_order() const { return order; }
+            int get_nmesh() const { return Nmesh; }
+            ptrdiff_t get_local_x_start() const { return Local_x_start; }
+            size_t get_npart() const { return NumPart; }
+
+            /// The cell indices and weights in each dimension of particle ipart (N x ORDER arrays)
+            const int * get_index(size_t ipart) const { return index.data() + ipart * N * order; }
+            const double * get_weight(size_t ipart) const { return weight.data() + ipart * N * order; }
+
+          private:
+            template <int ORDER, class T>
+            void compute(const FFTWGrid<N> & grid, const T * part);
+
+            bool valid{false};
+            int order{0};
+            int Nmesh{0};
+            ptrdiff_t Local_x_start{0};
+            size_t NumPart{0};
+            std::vector<int> index{};
+            std::vector<double> weight{};
+        };
+
+        /// @brief Interpolate a grid to the positions of a set of particles using precomputed stencils.
+        ///
+        /// @tparam N The dimension of the grid
+        ///
+        /// @param[in] grid A grid with the same shape as the one the stencils was computed for.
+        /// @param[in] stencils The stencils of the particles.
+        /// @param[out] interpolated_values A vector with the interpolated values, one per particle. Allocated in the
+        /// method.
+        ///
+        template <int N>
+        void interpolate_grid_to_particle_positions(const FFTWGrid<N> & grid,
+                                                    const ParticleInterpolationStencils<N> & stencils,
+                                                    std::vector<FloatType> & interpolated_values);
+
+        /// @brief Interpolate a vector of grids to the positions of a set of particles using precomputed stencils.
+        ///
+        /// @tparam N The dimension of the grid
+        ///
+        /// @param[in] grid_vec A vector of grids with the same shape as the one the stencils was computed for.
+        /// @param[in] stencils The stencils of the particles.
+        /// @param[out] interpolated_values_vec The interpolated values, one per grid per particle. Allocated in the
+        /// method.
+        ///
+        template <int N>
+        void
+        interpolate_grid_vector_to_particle_positions(const std::array<FFTWGrid<N>, N> & grid_vec,
+                                                      const ParticleInterpolationStencils<N> & stencils,
+                                                      std::array<std::vector<FloatType>, N> & interpolated_values_vec);
+
+        /// @brief Interpolate N interleaved grids (e.g. force vector) to a set of positions given by the positions of
+        /// particles. The stencil is computed once per particle and each cell gives all N components.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_pos() method.
+        /// @tparam ORDER The order of the B-spline interpolation (1=NGP, 2=CIC, 3=TSC, 4=PCS, 5=PQS, ...)
+        ///
+        /// @param[in] grid_vec The interleaved grids
+        /// @param[in] part A pointer the first particle.
+        /// @param[in] NumPart How many particles/positions we have that we want to interpolate the grid to.
+        /// @param[out] interpolated_values_vec The interpolated vector, one per particle. Allocated in the method.
+        ///
+        template <int N, int ORDER, class T>
+        void interpolate_grid_vector_to_particle_positions(
+            const InterleavedGridVector<N> & grid_vec,
+            const T * part,
+            size_t NumPart,
+            std::vector<std::array<FloatType, N>> & interpolated_values_vec);
+
+        /// @brief Interpolate N interleaved grids (e.g. force vector) to a set of positions given by the positions of
+        /// particles.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] grid_vec The interleaved grids
+        /// @param[in] part A pointer the first particle.
+        /// @param[in] NumPart How many particles/positions we have that we want to interpolate the grid to.
+        /// @param[out] interpolated_values_vec The interpolated vector, one per particle. Allocated in the method.
+        /// @param[in] interpolation_method The interpolation method: NGP, CIC, TSC, PCS or PQS.
+        ///
+        template <int N, class T>
+        void interpolate_grid_vector_to_particle_positions(
+            const InterleavedGridVector<N> & grid_vec,
+            const T * part,
+            size_t NumPart,
+            std::vector<std::array<FloatType, N>> & interpolated_values_vec,
+            std::string interpolation_method);
+
         /// @brief Interpolate a grid to a set of positions given by the positions of particles.
         ///
         /// @tparam N The dimension of the grid
@@ -169,9 +372,238 @@ namespace FML {
         template <int N, int ORDER, class T>
         void particles_to_grid(const T * part, size_t NumPart, size_t NumPartTot, FFTWGrid<N> & density);
 
+        /// @brief Communicate the particles and assign them to a grid to compute the over density field delta.
+        /// This is the same as part.communicate_particles() followed by particles_to_grid, but we assign the
+        /// particles that stays on the task while the particles that leave/arrive are being sent, see
+        /// MPIParticles::start_communicate_particles.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] part The particles (after they have been moved, but before they are communicated).
+        /// @param[out] density The overdensity field.
+        /// @param[in] density_assignment_method The assignment method: NGP, CIC, TSC, PCS or PQS.
+        ///
+        template <int N, class T>
+        void particles_to_grid_communicate_particles(FML::PARTICLE::MPIParticles<T> & part,
+                                                     FFTWGrid<N> & density,
+                                                     std::string density_assignment_method);
+
+        /// @brief Assign particles to two grids in one pass over the particles: the normal assignment and the
+        /// assignment of the particles shifted by half a grid-cell in all directions (as used for interlacing).
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam ORDER The order of the B-spline interpolation (1=NGP, 2=CIC, 3=TSC, 4=PCS, 5=PQS, ...).
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] part A pointer the first particle.
+        /// @param[in] NumPart How many particles/positions we have that we want to interpolate the grid to.
+        /// @param[in] NumPartTot How many particles/positions we have in total over all tasks.
+        /// @param[out] density The overdensity field.
+        /// @param[out] density_shifted The overdensity field of the shifted particles. Needs one more extra slice on
+        /// the right than density.
+        ///
+        template <int N, int ORDER, class T>
+        void particles_to_grid_interlaced(const T * part,
+                                          size_t NumPart,
+                                          size_t NumPartTot,
+                                          FFTWGrid<N> & density,
+                                          FFTWGrid<N> & density_shifted);
+
+        /// @brief A grid to assign particles to together with the weight of each particle, see particles_to_grids.
+        /// If density_contrast is true the grid gets the density contrast of the weighted particles (the weights are
+        /// normalized by their sum over all particles, so weight = mass gives the same as particles_to_grid).
+        /// Otherwise the grid is just the sum of the weights (e.g. for a momentum field).
+        template <int N, class T>
+        struct GridAndWeight {
+            FFTWGrid<N> * grid{nullptr};
+            std::function<double(const T &)> weight{};
+            bool density_contrast{true};
+        };
+
+        /// @brief Assign the same particles to several grids (e.g. total and per species or weighted by velocity)
+        /// in one pass over the particles. All grids must have the same size and enough extra slices.
+        ///
+        /// Example use:
+        ///
+        ///   std::vector<GridAndWeight<N, T>> grids{
+        ///       {&density, [](const T &) { return 1.0; }},
+        ///       {&density_mass_weighted, [](const T & p) { return p.get_mass(); }},
+        ///       {&momentum_x, [](const T & p) { return p.get_vel()[0]; }, false}};
+        ///   particles_to_grids<N, T>(part, NumPart, grids, "CIC");
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] part A pointer the first particle.
+        /// @param[in] NumPart How many particles/positions we have that we want to interpolate the grid to.
+        /// @param[in,out] grids The grids and the weight functions.
+        /// @param[in] density_assignment_method The assignment method: NGP, CIC, TSC, PCS or PQS.
+        ///
+        template <int N, class T>
+        void particles_to_grids(const T * part,
+                                size_t NumPart,
+                                std::vector<GridAndWeight<N, T>> & grids,
+                                std::string density_assignment_method);
+
+        /// @brief Assign particles to a grid to compute the over density field delta by first summing up the
+        /// particles in each cell and then spreading the cell totals to the grid. Gives the same as particles_to_grid
+        /// (up to round-off), but is faster when there are many particles per cell. Only NGP and CIC are done this way,
+        /// other methods just call particles_to_grid.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_pos() method. If the particle has a get_mass method then this
+        /// is used to weight the particle (we assign the particle with weight mass / mean_mass).
+        ///
+        /// @param[in] part A pointer the first particle.
+        /// @param[in] NumPart How many particles/positions we have that we want to interpolate the grid to.
+        /// @param[in] NumPartTot How many particles/positions we have in total over all tasks.
+        /// @param[out] density The overdensity field.
+        /// @param[in] density_assignment_method The assignment method: NGP, CIC, TSC, PCS or PQS.
+        ///
+        template <int N, class T>
+        void particles_to_grid_two_level(const T * part,
+                                         size_t NumPart,
+                                         size_t NumPartTot,
+                                         FFTWGrid<N> & density,
+                                         std::string density_assignment_method);
+
+        /// @brief The slices of a grid that the particles on the current task need when the particles are not in the
+        /// slab of the grid (e.g. after MPIParticles::rebalance). The particles in [xmin, xmax) touch the global slices
+        /// [ix_start, ix_start + nslices) (plus the extra slices needed by the kernel) and we keep a local copy of
+        /// these (the ghost slices). The ghost slices can be added to the grid on the tasks that own the slices
+        /// (density assignment) or filled with the values of the grid on these tasks (interpolation).
+        ///
+        template <int N>
+        class GhostSlices {
+          public:
+            GhostSlices(const FFTWGrid<N> & grid, double xmin, double xmax, int n_extra_left, int n_extra_right);
+
+            /// The global index of the first slice (can be negative and the slices can extend past Nmesh, i.e. the
+            /// global index is periodic)
+            ptrdiff_t get_x_start() const { return x_start; }
+            /// The number of slices
+            int get_nslices() const { return nslices; }
+            /// A value in the ghost slices. The first coordinate is the local index (the global is x_start + coord[0])
+            FloatType & get_real(const std::array<int, N> & coord) { return values[get_index(coord)]; }
+            FloatType get_real(const std::array<int, N> & coord) const { return values[get_index(coord)]; }
+
+            /// Set all the values to zero
+            void zero() { std::fill(values.begin(), values.end(), FloatType(0.0)); }
+            /// Add the values of the ghost slices to the grid (to the task that owns the slice)
+            void add_to_grid(FFTWGrid<N> & grid) const;
+            /// Set the values of the ghost slices from the main slices of the grid (from the task that owns the slice)
+            void fetch_from_grid(const FFTWGrid<N> & grid);
+
+          private:
+            int Nmesh;
+            ptrdiff_t num_cells_slice;
+            ptrdiff_t x_start;
+            int nslices;
+            std::vector<FloatType> values;
+
+            // The local ghost slices we send to each task (in order) and the local slice in the grid on this task
+            // of the ghost slices we recieve from each task (in order)
+            std::vector<std::vector<int>> ghost_slices_to_task;
+            std::vector<std::vector<int>> grid_slices_from_task;
+
+            IndexIntType get_index(const std::array<int, N> & coord) const {
+                IndexIntType index = coord[0];
+                for (int idim = 1; idim < N - 1; idim++)
+                    index = index * Nmesh + coord[idim];
+                return index * (2 * (Nmesh / 2 + 1)) + coord[N - 1];
+            }
+
+            // Exchange slices: send the slices in send[task] and get the slices in recv[task]. If add then the
+            // recieved slices are added to the destination, otherwise they are copied
+            void exchange(const std::vector<std::vector<int>> & send,
+                          const std::vector<std::vector<int>> & recv,
+                          const FloatType * send_base,
+                          FloatType * recv_base,
+                          bool add) const;
+        };
+
+        /// @brief Assign particles to a grid to compute the over density field delta when the particles are not in
+        /// the slab of the grid on the current task (e.g. after MPIParticles::rebalance). The particles on this task
+        /// must be in [xmin, xmax). We assign them to the ghost slices they touch and add these to the grid on the
+        /// tasks that own them. Gives the same as particles_to_grid (up to round-off) for particles in the slab.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_pos() method. If the particle has a get_mass method then this
+        /// is used to weight the particle (we assign the particle with weight mass / mean_mass).
+        ///
+        /// @param[in] part A pointer the first particle.
+        /// @param[in] NumPart How many particles/positions we have that we want to interpolate the grid to.
+        /// @param[in] NumPartTot How many particles/positions we have in total over all tasks.
+        /// @param[out] density The overdensity field.
+        /// @param[in] density_assignment_method The assignment method: NGP, CIC, TSC, PCS or PQS.
+        /// @param[in] xmin The lower x-boundary of the domain of the particles on this task.
+        /// @param[in] xmax The upper x-boundary of the domain of the particles on this task.
+        ///
+        template <int N, class T>
+        void particles_to_grid_rebalanced(const T * part,
+                                          size_t NumPart,
+                                          size_t NumPartTot,
+                                          FFTWGrid<N> & density,
+                                          std::string density_assignment_method,
+                                          double xmin,
+                                          double xmax);
+
+        /// @brief Interpolate a vector of grids to the positions of particles that are not in the slab of the grid on
+        /// the current task (e.g. after MPIParticles::rebalance). The particles on this task must be in [xmin, xmax).
+        /// The slices the particles needs are fetched from the tasks that own them (so the boundaries of the grids
+        /// don't have to be communicated).
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_pos() method.
+        ///
+        /// @param[in] grid_vec A vector of grids
+        /// @param[in] part A pointer the first particle.
+        /// @param[in] NumPart How many particles/positions we have that we want to interpolate the grid to.
+        /// @param[out] interpolated_values_vec The interpolated values, one per grid per particle. Allocated in the
+        /// method.
+        /// @param[in] interpolation_method The interpolation method: NGP, CIC, TSC, PCS or PQS.
+        /// @param[in] xmin The lower x-boundary of the domain of the particles on this task.
+        /// @param[in] xmax The upper x-boundary of the domain of the particles on this task.
+        ///
+        template <int N, class T>
+        void interpolate_grid_vector_to_particle_positions_rebalanced(
+            const std::array<FFTWGrid<N>, N> & grid_vec,
+            const T * part,
+            size_t NumPart,
+            std::array<std::vector<FloatType>, N> & interpolated_values_vec,
+            std::string interpolation_method,
+            double xmin,
+            double xmax);
+
+        /// @brief Interpolate a vector of grids to the Lagrangian positions of particles that don't store q, but has
+        /// an ID that is the index of the particle in the grid made by MPIParticles::create_particle_grid (see
+        /// FML::PARTICLE::has_lagrangian_position_from_id). The particles don't have to be moved to the task where
+        /// q is: we send the IDs to the tasks that has q in its domain, interpolate there and send the values back.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_lagrangian_id() method.
+        ///
+        /// @param[in] grid_vec A vector of grids (with the boundaries communicated)
+        /// @param[in] part A pointer the first particle.
+        /// @param[in] NumPart How many particles/positions we have that we want to interpolate the grid to.
+        /// @param[in] Npart_1D The number of particles per dimension in the grid the particles was made from.
+        /// @param[out] interpolated_values_vec The interpolated values, one per grid per particle. Allocated in the
+        /// method.
+        /// @param[in] interpolation_method The interpolation method: NGP, CIC, TSC, PCS or PQS.
+        ///
+        template <int N, class T>
+        void interpolate_grid_vector_to_lagrangian_positions(
+            const std::array<FFTWGrid<N>, N> & grid_vec,
+            const T * part,
+            size_t NumPart,
+            int Npart_1D,
+            std::array<std::vector<FloatType>, N> & interpolated_values_vec,
+            std::string interpolation_method);
+
         /// Internal method
         template <int N, class T>
-        void particles_to_fourier_grid_interlacing(T * part,
+        void particles_to_fourier_grid_interlacing(const T * part,
                                                    size_t NumPart,
                                                    size_t NumPartTot,
                                                    FFTWGrid<N> & density_grid_fourier,
@@ -200,6 +632,42 @@ namespace FML {
                                        std::string density_assignment_method,
                                        bool interlacing);
 
+        /// @brief Assign particles to a grid to compute the over density field delta when we cannot have all the
+        /// particles in memory at once (e.g. a large snapshot that we read one file at a time). The particles are read
+        /// in chunks with read_chunk and each chunk is added to the grid right away so we only need memory for the
+        /// grid and one chunk. Gives the same as particles_to_grid with all the particles (up to round-off).
+        ///
+        /// Example use (reading one gadget file at a time):
+        ///
+        ///   int ifile = 0;
+        ///   auto read_chunk = [&](std::vector<T> & chunk) {
+        ///       if (ifile == nfiles)
+        ///           return false;
+        ///       reader.read_gadget_single(fileprefix + "." + std::to_string(ifile++), chunk, true, false);
+        ///       return true;
+        ///   };
+        ///   auto NumPartTot = particles_to_grid_streaming<N, T>(read_chunk, density, "CIC");
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class. Must have a get_pos() method. If the particle has a get_mass method then this
+        /// is used to weight the particle (we assign the particle with weight mass / mean_mass).
+        ///
+        /// @param[in] read_chunk Puts the next chunk of particles in the (empty) vector it gets and returns false when
+        /// there are no more particles. The particles must be in the local domain. The tasks can have different
+        /// numbers of chunks.
+        /// @param[out] density The overdensity field.
+        /// @param[in] density_assignment_method The assignment method: NGP, CIC, TSC, PCS or PQS.
+        /// @param[out] density_shifted Optional: also assign the particles shifted by half a grid-cell in all
+        /// directions to this grid (as used for interlacing). Needs one more extra slice on the right than density.
+        ///
+        /// @return The total number of particles we assigned over all tasks.
+        ///
+        template <int N, class T>
+        size_t particles_to_grid_streaming(const std::function<bool(std::vector<T> &)> & read_chunk,
+                                           FFTWGrid<N> & density,
+                                           std::string density_assignment_method,
+                                           FFTWGrid<N> * density_shifted = nullptr);
+
         /// @brief Convolve a grid with a kernel
         ///
         /// @tparam N The dimension of the grid
@@ -336,6 +804,9 @@ namespace FML {
             return {0, 0};
         }
 
+#ifdef USE_OMP_TARGET
+#pragma omp declare target
+#endif
         /// @brief Internal method. The B-spline interpolation kernels for a given order
         /// \f$ H^{(p)} = H * H * \ldots * H \f$ where H is the tophat \f$ H = [ |dx| < 0.5 ? 1 : 0 ] \f$
         /// and * is a convolution (easily computed with Mathematica)
@@ -376,10 +847,124 @@ namespace FML {
                             ((x < 2.5) ? (5 - 2.0 * x) * (5 - 2.0 * x) * (5 - 2.0 * x) * (5 - 2.0 * x) / 384. : 0.0));
         }
 
+        /// @brief Internal method. The ORDER one dimensional B-spline weights of a point at a distance x in [0,1)
+        /// from the left side of its cell. Returns the offset (relative to the cell) of the first cell the weights
+        /// belong to. Closed form (branch free) polynomials so the compiler can keep them in SIMD registers instead
+        /// of evaluating kernel<ORDER> with its branches ORDER times.
+        ///
+        template <int ORDER>
+        inline int bspline_weights_1d(double x, double * w) {
+#ifdef CELLCENTERSHIFTED
+            int xstart = -ORDER / 2;
+            if (ORDER % 2 == 0 and x > 0.5)
+                xstart += 1;
+            for (int k = 0; k < ORDER; k++)
+                w[k] = kernel<ORDER>(std::fabs(-x + xstart + k + 0.5));
+            return xstart;
+#else
+            if constexpr (ORDER == 1) {
+                w[0] = 1.0;
+                return 0;
+            } else if constexpr (ORDER == 2) {
+                w[0] = 1.0 - x;
+                w[1] = x;
+                return 0;
+            } else if constexpr (ORDER == 3) {
+                const int right = x > 0.5 ? 1 : 0;
+                const double u = x - right;
+                w[0] = 0.5 * (0.5 - u) * (0.5 - u);
+                w[1] = 0.75 - u * u;
+                w[2] = 0.5 * (0.5 + u) * (0.5 + u);
+                return right - 1;
+            } else if constexpr (ORDER == 4) {
+                const double y = 1.0 - x;
+                w[0] = y * y * y / 6.0;
+                w[1] = 2.0 / 3.0 + x * x * (-1.0 + 0.5 * x);
+                w[2] = 2.0 / 3.0 + y * y * (-1.0 + 0.5 * y);
+                w[3] = x * x * x / 6.0;
+                return -1;
+            } else if constexpr (ORDER == 5) {
+                const int right = x > 0.5 ? 1 : 0;
+                const double u = x - right;
+                const double ym = 1.0 + u;
+                const double yp = 1.0 - u;
+                const double um = 1.0 - 2.0 * u;
+                const double up = 1.0 + 2.0 * u;
+                w[0] = um * um * um * um / 384.0;
+                w[1] = (55 + 4 * ym * (5 - 2 * ym * (15 + 2 * (-5 + ym) * ym))) / 96.0;
+                w[2] = 115.0 / 192.0 + 0.25 * u * u * (u * u - 2.5);
+                w[3] = (55 + 4 * yp * (5 - 2 * yp * (15 + 2 * (-5 + yp) * yp))) / 96.0;
+                w[4] = up * up * up * up / 384.0;
+                return right - 2;
+            } else {
+                static_assert(ORDER > 0 and ORDER <= 5, "Error: kernel order is not implemented\n");
+                return 0;
+            }
+#endif
+        }
+#ifdef USE_OMP_TARGET
+#pragma omp end declare target
+#endif
+
+        /// @brief Internal method. The cells and weights of the B-spline kernel of order ORDER around a point. The
+        /// kernel is separable so we compute the ORDER weights and cell indices in each dimension once and then loop
+        /// over the ORDER^N cells (unrolled at compile time) taking the outer product.
+        ///
+        template <int N, int ORDER>
+        struct BSplineStencil {
+            std::array<std::array<int, ORDER>, N> index;
+            std::array<std::array<double, ORDER>, N> weight;
+
+            BSplineStencil() = default;
+
+            /// x is the distance from the left side of cell ix (in units of the cell size). The index in x is local
+            /// so we only wrap it periodically if wrap_x is true (one task and no extra slices used)
+            BSplineStencil(const std::array<double, N> & x, const std::array<int, N> & ix, int Nmesh, bool wrap_x) {
+                for (int idim = 0; idim < N; idim++) {
+                    const int xstart = bspline_weights_1d<ORDER>(x[idim], weight[idim].data());
+                    for (int k = 0; k < ORDER; k++) {
+                        int i = ix[idim] + xstart + k;
+                        if (idim > 0 or wrap_x) {
+                            if (i >= Nmesh)
+                                i -= Nmesh;
+                            if (i < 0)
+                                i += Nmesh;
+                        }
+                        index[idim][k] = i;
+                    }
+                }
+            }
+
+            /// Call func(icoord, w) for all the ORDER^N cells in the stencil
+            template <class Func>
+            void for_each_cell(Func && func) const {
+                std::array<int, N> icoord;
+                for_each_cell<0>(icoord, 1.0, func);
+            }
+
+          private:
+            template <int idim, class Func>
+            void for_each_cell(std::array<int, N> & icoord, double w, Func & func) const {
+                for (int k = 0; k < ORDER; k++) {
+                    icoord[idim] = index[idim][k];
+                    if constexpr (idim == N - 1)
+                        func(icoord, w * weight[idim][k]);
+                    else
+                        for_each_cell<idim + 1>(icoord, w * weight[idim][k], func);
+                }
+            }
+        };
+
         /// @brief Internal method. For communication between tasks needed when adding particles to grid
         template <int N>
         void add_contribution_from_extra_slices(FFTWGrid<N> & density);
 
+        /// @brief Non-blocking version of add_contribution_from_extra_slices. The contributions are added to the grid
+        /// when we wait on the handle so don't touch the boundary slices of the main grid (or the extra slices)
+        /// before that.
+        template <int N>
+        FML::GRID::FFTWGridHaloExchange add_contribution_from_extra_slices_async(FFTWGrid<N> & density);
+
         /// @brief This returns the a function giving the window function for a given density assignement method as
         /// function of the wave-vector in dimensionless units.
         /// @tparam N The dimension of the grid
@@ -414,6 +999,36 @@ namespace FML {
             return window_function;
         }
 
+        /// @brief The 1D window function \f$ {\rm sinc}(\frac{\pi}{2} k / k_{\rm ny})^p \f$ for a given density
+        /// assignement method tabulated for the integer wave-numbers \f$ -N_{\rm grid}/2 \leq i \leq N_{\rm grid}/2 \f$
+        /// (i.e. \f$ k = 2\pi i \f$) stored at index \f$ N_{\rm grid}/2 + i \f$. The window function of a mode is the
+        /// product of this over the dimensions so this is all we need to (de)convolve a grid.
+        /// @param[in] density_assignment_method The density assignment method (NGP, CIC, ...) we used when making the
+        /// density contrast.
+        /// @param[in] Ngrid The grid size (used to set the nyquist frequency)
+        /// @param[in] inverse Tabulate one over the window function instead (for deconvolving)
+        ///
+        inline std::vector<double>
+        get_window_function_table(std::string density_assignment_method, int Ngrid, bool inverse = false) {
+
+            assert_mpi(Ngrid > 0, "[get_window_function_table] Ngrid must be positive\n");
+
+            // The order of the method
+            const int p = interpolation_order_from_name(density_assignment_method);
+
+            // Just sinc to the power = order to the method
+            std::vector<double> table(2 * (Ngrid / 2) + 1, 1.0);
+            for (int i = -Ngrid / 2; i <= Ngrid / 2; i++) {
+                const double koverkny = M_PI / 2. * (2.0 * i / double(Ngrid));
+                const double w = koverkny == 0.0 ? 1.0 : std::sin(koverkny) / (koverkny);
+                double res = 1.0;
+                for (int k = 0; k < p; k++)
+                    res *= w;
+                table[Ngrid / 2 + i] = inverse ? 1.0 / res : res;
+            }
+            return table;
+        }
+
         /// @brief Deconvolves the density assignement kernel in Fourier space. We divide the fourier grid by the
         /// FFT of the density assignment kernels \f$ FFT[ H*H*H*...*H ] = FT[H]^p\f$.
         /// @tparam N The dimension of the grid
@@ -429,200 +1044,782 @@ namespace FML {
 
             assert_mpi(Ngrid > 0, "[deconvolve_window_function_fourier] Ngrid must be positive\n");
 
-            // The order of the method
-            const int p = interpolation_order_from_name(density_assignment_method);
+            // The window function is separable so we only need one over the 1D window function for each integer
+            // wave-number. The factor for the first N-1 dimensions is the same for the whole row
+            const auto inverse_window = get_window_function_table(density_assignment_method, Ngrid, true);
 
-            // Just sinc to the power = order to the method
-            const double knyquist = M_PI * Ngrid;
-            auto window_function = [&](std::array<double, N> & kvec) -> double {
-                double w = 1.0;
-                for (int idim = 0; idim < N; idim++) {
-                    const double koverkny = M_PI / 2. * (kvec[idim] / knyquist);
-                    w *= koverkny == 0.0 ? 1.0 : std::sin(koverkny) / (koverkny);
+            if constexpr (N == 1) {
+                for (auto && fourier_index : fourier_grid.get_fourier_range()) {
+                    auto kvec = fourier_grid.get_fourier_wavevector_from_index(fourier_index);
+                    const int i = int(std::round(kvec[0] / (2.0 * M_PI)));
+                    auto value = fourier_grid.get_fourier_from_index(fourier_index);
+                    fourier_grid.set_fourier_from_index(fourier_index,
+                                                        value * FML::GRID::FloatType(inverse_window[Ngrid / 2 + i]));
                 }
-                // res = pow(w,p);
-                double res = 1;
-                for (int i = 0; i < p; i++)
-                    res *= w;
-                return res;
-            };
-
+            } else {
+                const double * inverse_window_z = inverse_window.data() + Ngrid / 2;
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-            for (int islice = 0; islice < Local_nx; islice++) {
-                for (auto && fourier_index : fourier_grid.get_fourier_range(islice, islice + 1)) {
-                    auto kvec = fourier_grid.get_fourier_wavevector_from_index(fourier_index);
-                    auto w = window_function(kvec);
-                    auto value = fourier_grid.get_fourier_from_index(fourier_index);
-                    fourier_grid.set_fourier_from_index(fourier_index, value / FML::GRID::FloatType(w));
+                for (int islice = 0; islice < Local_nx; islice++) {
+                    auto * cdelta = fourier_grid.get_fourier_grid();
+                    for (auto && row : fourier_grid.get_fourier_row_range(islice, islice + 1)) {
+                        double row_factor = 1.0;
+                        for (int idim = 0; idim < N - 1; idim++)
+                            row_factor *= inverse_window[Ngrid / 2 + row.kint[idim]];
+                        auto * value = cdelta + row.index;
+                        for (int iz = 0; iz < row.n; iz++)
+                            value[iz] *= FML::GRID::FloatType(row_factor * inverse_window_z[iz]);
+                    }
                 }
             }
         }
 
+#ifdef USE_OMP
         //==============================================================================
-        // Bin particles to grid using NGP, CIC, TSC, PCS, PQS, ...
-        // Some of the methods require extra slices, see
-        // get_extra_slices_needed_for_density_assignment
-        //
-        // NumPart: number of particles at the head of part
-        // NumPartTot: total number of particles across tasks
-        // NB: part.size() might not be equal to NumPart as we might have a buffer with
+        // Internal method. Calls assign(i) for all particles using all threads such that two
+        // threads never add to the same cell at the same time (so no atomics or critical
+        // sections are needed). We split the local grid into tiles in x (and y if the x-tiles
+        // are too few to keep all the threads busy) that are at least ORDER+1 cells wide,
+        // sort the particles by tile and do the tiles in 4 colored phases (even/odd tile in x
+        // and y). Tiles of the same color are two tiles apart so the cells their particles
+        // touch never overlaps. The number of tiles in each dimension is even (or 1) so this
+        // also holds with periodic wrapping.
         //
-        // All particles are assumed to have the same mass (can easily be changed, see
-        // comments WEIGHTS below)
+        // If the particles are already in tile order (e.g. after MPIParticles::sort_by_cell and
+        // we only need tiles in x) we skip the sort and stream through the particles directly.
         //==============================================================================
-
-        template <int N, int ORDER, class T>
-        void particles_to_grid(const T * part, size_t NumPart, size_t NumPartTot, FFTWGrid<N> & density) {
-
-            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
-            assert_mpi(density.get_n_extra_slices_left() >= nextra.first and
-                           density.get_n_extra_slices_right() >= nextra.second,
-                       "[particles_to_grid] Too few extra slices\n");
-
-            //==========================================================
-            // This is a generic method. You have to specify the kernel
-            // and the corresponding width = the number of cells
-            // the point gets distrubuted to in each dimension which
-            // also corresponds to the order
-            //==========================================================
-
-            // For the kernel above we need to go kernel_width/2 cells to the left and right
-            constexpr int widthtondim = FML::power(ORDER, N);
-
-            // Info about the grid
-            // const auto Local_nx      = density.get_local_nx();
-            const auto Local_x_start = density.get_local_x_start();
+        template <int N, int ORDER, class T, class Func>
+        void for_each_particle_by_tile(const T * part, size_t NumPart, const FFTWGrid<N> & density, Func && assign) {
+            const int nthreads = omp_get_max_threads();
+            const int Local_nx = int(density.get_local_nx());
+            const int Local_x_start = int(density.get_local_x_start());
             const int Nmesh = density.get_nmesh();
 
-            // Set whole grid (also extra slices) to -1.0
-            density.fill_real_grid(-1.0);
+            // The number of tiles we split n cells into (even or 1) based on how many we want
+            constexpr int min_tile_width = ORDER + 1;
+            auto number_of_tiles = [&](int n, int ntiles_wanted) {
+                int ntiles = std::min(n / min_tile_width, std::max(ntiles_wanted, 1));
+                return ntiles < 2 ? 1 : ntiles - ntiles % 2;
+            };
 
-            // Factor to normalize density to the mean density
-            double norm_fac = std::pow((double)Nmesh, N) / double(NumPartTot);
+            // Aim for ~2 tiles per thread in each of the 4 phases
+            const int ntiles_wanted = 8 * nthreads;
+            const int nx_tiles = number_of_tiles(Local_nx, ntiles_wanted);
+            int ny_tiles = 1;
+            if constexpr (N > 1)
+                if (nx_tiles < ntiles_wanted)
+                    ny_tiles = number_of_tiles(Nmesh, (ntiles_wanted + nx_tiles - 1) / nx_tiles);
+            const int ntiles = nx_tiles * ny_tiles;
+
+            // Not enough work to split it up
+            if (nthreads == 1 or ntiles < 4) {
+                for (size_t i = 0; i < NumPart; i++)
+                    assign(i);
+                return;
+            }
 
-            // Check if particles has a get_mass method and if so
-            // compute the mean mass
-            constexpr bool has_mass = FML::PARTICLE::has_get_mass<T>();
-            if constexpr (has_mass) {
-                double mean_mass = 0.0;
+            auto tile_of_particle = [&](size_t i) {
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[i]);
+                int ix = int(pos[0] * Nmesh) - Local_x_start;
+                ix = std::max(0, std::min(ix, Local_nx - 1));
+                int tile = int((long long int)(ix)*nx_tiles / Local_nx);
+                if constexpr (N > 1) {
+                    int iy = int(pos[1] * Nmesh);
+                    iy = std::max(0, std::min(iy, Nmesh - 1));
+                    tile = tile * ny_tiles + int((long long int)(iy)*ny_tiles / Nmesh);
+                }
+                return tile;
+            };
+
+            // Count the particles in each tile (per thread) and check if they are already sorted by tile
+            std::vector<size_t> thread_offset(size_t(nthreads) * ntiles, 0);
+            int not_sorted = 0;
+#pragma omp parallel reduction(+ : not_sorted)
+            {
+                const size_t id = size_t(omp_get_thread_num()) * ntiles;
+#pragma omp for schedule(static)
                 for (size_t i = 0; i < NumPart; i++) {
-                    mean_mass += FML::PARTICLE::GetMass(part[i]);
+                    const int tile = tile_of_particle(i);
+                    thread_offset[id + tile]++;
+                    if (i > 0 and tile < tile_of_particle(i - 1))
+                        not_sorted++;
+                }
+            }
+            std::vector<size_t> tile_start(ntiles + 1, 0);
+            size_t offset = 0;
+            for (int tile = 0; tile < ntiles; tile++) {
+                tile_start[tile] = offset;
+                for (int id = 0; id < nthreads; id++) {
+                    const size_t count = thread_offset[size_t(id) * ntiles + tile];
+                    thread_offset[size_t(id) * ntiles + tile] = offset;
+                    offset += count;
+                }
+            }
+            tile_start[ntiles] = offset;
+
+            // Presorted: the particles in a tile are already contiguous in memory
+            if (not_sorted == 0) {
+                for (int color = 0; color < 4; color++) {
+#pragma omp parallel for schedule(dynamic)
+                    for (int tile = 0; tile < ntiles; tile++) {
+                        if (((tile / ny_tiles) % 2) * 2 + ((tile % ny_tiles) % 2) != color)
+                            continue;
+                        for (size_t i = tile_start[tile]; i < tile_start[tile + 1]; i++)
+                            assign(i);
+                    }
                 }
-                SumOverTasks(&mean_mass);
-                mean_mass /= double(NumPartTot);
-                norm_fac /= mean_mass;
+                return;
             }
-            double mass = 1.0;
 
-            // Loop over all particles and add them to the grid
-            // OpenMP will not be very good due to critical section needed in add_real
-            for (size_t i = 0; i < NumPart; i++) {
+            // Counting sort of the particles by tile. Each thread puts its particles in its own part of each tile
+            // (both loops use the same static schedule)
+            std::vector<size_t> sorted_index(NumPart);
+#pragma omp parallel
+            {
+                const size_t id = size_t(omp_get_thread_num()) * ntiles;
+#pragma omp for schedule(static)
+                for (size_t i = 0; i < NumPart; i++)
+                    sorted_index[thread_offset[id + tile_of_particle(i)]++] = i;
+            }
+
+            // Assign the particles tile by tile in 4 phases
+            for (int color = 0; color < 4; color++) {
+#pragma omp parallel for schedule(dynamic)
+                for (int tile = 0; tile < ntiles; tile++) {
+                    const int tx = tile / ny_tiles;
+                    const int ty = tile % ny_tiles;
+                    if ((tx % 2) * 2 + (ty % 2) != color)
+                        continue;
+                    for (size_t j = tile_start[tile]; j < tile_start[tile + 1]; j++)
+                        assign(sorted_index[j]);
+                }
+            }
+        }
+#endif
+
+        //==============================================================================
+        // Internal method. The density assignment stencil of a point at pos (in [0,1))
+        //==============================================================================
+        template <int N, int ORDER, class PosType>
+        inline BSplineStencil<N, ORDER>
+        assignment_stencil(const PosType * pos, int Nmesh, ptrdiff_t Local_x_start, bool wrap_x = FML::NTasks == 1) {
+            std::array<double, N> x;
+            std::array<int, N> ix;
+            for (int idim = 0; idim < N; idim++) {
+                // Scale positions to be in [0, Nmesh]
+                x[idim] = pos[idim] * Nmesh;
+                // Grid-index for cell containing particle
+                ix[idim] = (int)x[idim];
+                // Distance relative to cell
+                x[idim] -= ix[idim];
+            }
+
+            // Periodic BC
+            ix[0] -= int(Local_x_start);
+            for (int idim = 1; idim < N; idim++) {
+                if (ix[idim] == Nmesh)
+                    ix[idim] = 0;
+            }
+
+            // If only 1 task then we should wrap in x (otherwise we have extra slices - XXX should assert that its
+            // not too large, but covered by boundscheck in FFTWGrid if this is turned on)!
+            return BSplineStencil<N, ORDER>(x, ix, Nmesh, wrap_x);
+        }
+
+        //==============================================================================
+        // Internal method. The interpolation stencil of a point at pos (in [0,1)). The grid
+        // must have its boundaries communicated so we never wrap in x
+        //==============================================================================
+        template <int N, int ORDER, class PosType>
+        inline BSplineStencil<N, ORDER>
+        interpolation_stencil(const PosType * pos, int Nmesh, ptrdiff_t Local_x_start, ptrdiff_t Local_nx) {
+            // Positions in global grid in units of [Nmesh]
+            std::array<double, N> x;
+            for (int idim = 0; idim < N; idim++)
+                x[idim] = pos[idim] * Nmesh;
+
+            // Nearest grid-node in grid
+            // Also do some santity checks. Probably better to throw here if these tests kick in
+            std::array<int, N> ix;
+            for (int idim = 0; idim < N; idim++) {
+                ix[idim] = int(x[idim]);
+                if (idim == 0) {
+                    if (ix[0] == (Local_x_start + Local_nx))
+                        ix[0] = int(Local_x_start + Local_nx) - 1;
+                    if (ix[0] < Local_x_start)
+                        ix[0] = int(Local_x_start);
+                } else {
+                    if (ix[idim] == Nmesh)
+                        ix[idim] = Nmesh - 1;
+                }
+            }
+
+            // Positions to distance from neareste grid-node
+            for (int idim = 0; idim < N; idim++) {
+                x[idim] -= ix[idim];
+            }
+
+            // From global ix to local ix
+            ix[0] -= int(Local_x_start);
+
+            return BSplineStencil<N, ORDER>(x, ix, Nmesh, false);
+        }
+
+        //==============================================================================
+        // Internal method. Add a point at pos (in [0,1)) with the given weight to the grid
+        // using the B-spline kernel of order ORDER. This is the stencil of particles_to_grid
+        //==============================================================================
+        template <int N, int ORDER, class PosType>
+        inline void add_point_to_grid(const PosType * pos,
+                                      double weight,
+                                      int Nmesh,
+                                      ptrdiff_t Local_x_start,
+                                      FFTWGrid<N> & density) {
+            // Loop over all nbor cells and add particle to grid
+            [[maybe_unused]] double sumweights = 0.0;
+            const auto stencil = assignment_stencil<N, ORDER>(pos, Nmesh, Local_x_start);
+            stencil.for_each_cell([&](const std::array<int, N> & icoord, double w) {
+                density.add_real(icoord, w * weight);
+                sumweights += w;
+            });
+
+#ifdef DEBUG_INTERPOL
+            // Check that the weights sum up to unity
+            assert_mpi(
+                std::fabs(sumweights - 1.0) < 1e-3,
+                "[particles_to_grid] Possible problem with particles to grid: weights does not sum to unity!");
+#endif
+        }
+
+        //==============================================================================
+        // Internal method. Add the particles to the grid with the weight norm_fac (times the mass if the
+        // particles has a mass) without touching what is allready in the grid
+        //==============================================================================
+        template <int N, int ORDER, class T>
+        void add_particles_to_grid(const T * part, size_t NumPart, double norm_fac, FFTWGrid<N> & density) {
+            const auto Local_x_start = density.get_local_x_start();
+            const int Nmesh = density.get_nmesh();
+            constexpr bool has_mass = FML::PARTICLE::has_get_mass<T>();
+
+            // Add particle i to the grid
+            auto assign_particle = [&](size_t ipart) {
 
                 // Particle position
-                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[i]);
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ipart]);
 
                 // Fetch mass if this is availiable
+                double mass = 1.0;
                 if constexpr (has_mass)
-                    mass = FML::PARTICLE::GetMass(part[i]);
+                    mass = FML::PARTICLE::GetMass(part[ipart]);
 
-                std::array<double, N> x;
-                std::array<int, N> ix;
-                [[maybe_unused]] std::array<int, N> ix_nbor;
-                for (int idim = 0; idim < N; idim++) {
-                    // Scale positions to be in [0, Nmesh]
-                    x[idim] = pos[idim] * Nmesh;
-                    // Grid-index for cell containing particle
-                    ix[idim] = (int)x[idim];
-                    // Distance relative to cell
-                    x[idim] -= ix[idim];
-                }
+                add_point_to_grid<N, ORDER>(pos, norm_fac * mass, Nmesh, Local_x_start, density);
+            };
 
-                // Periodic BC
-                ix[0] -= int(Local_x_start);
-                for (int idim = 1; idim < N; idim++) {
-                    if (ix[idim] == Nmesh)
-                        ix[idim] = 0;
+            // Loop over all particles and add them to the grid. With threads we do this tile by tile
+            // such that no two threads add to the same cell at the same time
+#if defined(USE_OMP) && !defined(SERIAL_DENSITY_ASSIGNMENT)
+            for_each_particle_by_tile<N, ORDER>(part, NumPart, density, assign_particle);
+#else
+            for (size_t i = 0; i < NumPart; i++)
+                assign_particle(i);
+#endif
+        }
+
+        //==============================================================================
+        // Internal method. The factor to multiply the weight of a particle with to get the
+        // density in units of the mean density. If the particles has a get_mass method the
+        // weight is the mass so we also divide by the mean mass. The sum over tasks is
+        // non-blocking: norm_fac is only set after wait() has been called on the result
+        //==============================================================================
+        template <int N, class T>
+        CollectiveFuture
+        density_normalization_async(const T * part, size_t NumPart, size_t NumPartTot, int Nmesh, double & norm_fac) {
+            norm_fac = std::pow((double)Nmesh, N) / double(NumPartTot);
+            CollectiveFuture sum;
+            if constexpr (FML::PARTICLE::has_get_mass<T>()) {
+                auto mean_mass = std::make_shared<double>(0.0);
+                double local_mass = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : local_mass)
+#endif
+                for (size_t i = 0; i < NumPart; i++) {
+                    local_mass += FML::PARTICLE::GetMass(part[i]);
                 }
+                *mean_mass = local_mass;
+                sum = SumOverTasksAsync(mean_mass.get());
+                sum.then([mean_mass, NumPartTot, &norm_fac]() { norm_fac /= *mean_mass / double(NumPartTot); });
+            } else {
+                (void)part;
+                (void)NumPart;
+            }
+            return sum;
+        }
 
-                // If we are on the left or right of the cell determines how many cells
-                // we have to go left and right
-                std::array<int, N> xstart;
-                if (ORDER % 2 == 0) {
-                    for (int idim = 0; idim < N; idim++) {
-                        xstart[idim] = -ORDER / 2 + 1;
-#ifdef CELLCENTERSHIFTED
-                        xstart[idim] = -ORDER / 2;
-                        if (x[idim] > 0.5)
-                            xstart[idim] += 1;
+        template <int N, class T>
+        double density_normalization(const T * part, size_t NumPart, size_t NumPartTot, int Nmesh) {
+            double norm_fac;
+            density_normalization_async<N>(part, NumPart, NumPartTot, Nmesh, norm_fac).wait();
+            return norm_fac;
+        }
+
+#ifdef USE_OMP_TARGET
+        //==============================================================================
+        // Internal methods. OpenMP target offload (GPU) versions of the particles_to_grid and
+        // interpolate_grid_to_particle_positions loops. The positions (and weights) are staged in
+        // contiguous arrays of doubles and mapped to the device together with the real grid
+        // (including the extra slices). The host API and the result is the same as for the CPU
+        // version. Without a device (or without an offloading compiler) the kernels run on the host
+        //==============================================================================
+        template <int N, class T>
+        std::vector<double> positions_for_offload(const T * part, size_t NumPart) {
+            std::vector<double> pos(N * NumPart);
+#ifdef USE_OMP
+#pragma omp parallel for
 #endif
+            for (size_t i = 0; i < NumPart; i++) {
+                const auto * p = FML::PARTICLE::GetPos(const_cast<T *>(part)[i]);
+                for (int idim = 0; idim < N; idim++)
+                    pos[N * i + idim] = p[idim];
+            }
+            return pos;
+        }
+
+#pragma omp declare target
+        // Internal method. The device version of the stencil in BSplineStencil (kept POD so it can live
+        // in device registers). For density assignment clamp = false and for interpolation clamp = true
+        template <int N, int ORDER>
+        inline void offload_stencil(const double * pos,
+                                    int Nmesh,
+                                    ptrdiff_t Local_x_start,
+                                    ptrdiff_t Local_nx,
+                                    bool clamp,
+                                    bool wrap_x,
+                                    int index[N][ORDER],
+                                    double weight[N][ORDER]) {
+            for (int idim = 0; idim < N; idim++) {
+                double x = pos[idim] * Nmesh;
+                int ix = int(x);
+                if (clamp) {
+                    if (idim == 0) {
+                        if (ix == Local_x_start + Local_nx)
+                            ix = int(Local_x_start + Local_nx) - 1;
+                        if (ix < Local_x_start)
+                            ix = int(Local_x_start);
+                    } else if (ix == Nmesh) {
+                        ix = Nmesh - 1;
                     }
-                } else {
-#ifndef CELLCENTERSHIFTED
-                    for (int idim = 0; idim < N; idim++) {
-                        xstart[idim] = -ORDER / 2;
-                        if (x[idim] > 0.5)
-                            xstart[idim] += 1;
+                }
+                x -= ix;
+                if (idim == 0)
+                    ix -= int(Local_x_start);
+                else if (ix == Nmesh)
+                    ix = 0;
+
+                const int xstart = bspline_weights_1d<ORDER>(x, weight[idim]);
+                for (int k = 0; k < ORDER; k++) {
+                    int i = ix + xstart + k;
+                    if (idim > 0 or wrap_x) {
+                        if (i >= Nmesh)
+                            i -= Nmesh;
+                        if (i < 0)
+                            i += Nmesh;
                     }
-#endif
+                    index[idim][k] = i;
                 }
+            }
+        }
 
-                // Loop over all nbor cells
-                [[maybe_unused]] double sumweights = 0.0;
-                for (int i = 0; i < widthtondim; i++) {
-                    double w = 1.0;
-                    std::array<int, N> icoord;
-                    if constexpr (ORDER == 1) {
-                        icoord = ix;
-                    } else {
-                        for (int idim = 0, n = 1; idim < N; idim++, n *= ORDER) {
-                            int go_left_right_or_stay = xstart[idim] + (i / n % ORDER);
-                            ix_nbor[idim] = ix[idim] + go_left_right_or_stay;
-#ifdef CELLCENTERSHIFTED
-                            double dx = std::fabs(-x[idim] + go_left_right_or_stay + 0.5);
+        // Internal method. The cell number (in the real grid, see FFTWGrid::get_index_real) and weight of
+        // cell number icell = 0, 1, ..., ORDER^N-1 in the stencil
+        template <int N, int ORDER>
+        inline ptrdiff_t
+        offload_stencil_cell(int icell, int Nmesh, const int index[N][ORDER], const double weight[N][ORDER], double & w) {
+            const ptrdiff_t Nmesh_padded = 2 * (Nmesh / 2 + 1);
+            int k[N];
+            for (int idim = N - 1; idim >= 0; idim--) {
+                k[idim] = icell % ORDER;
+                icell /= ORDER;
+            }
+            w = 1.0;
+            ptrdiff_t ind = index[0][k[0]];
+            w *= weight[0][k[0]];
+            for (int idim = 1; idim < N - 1; idim++) {
+                ind = ind * Nmesh + index[idim][k[idim]];
+                w *= weight[idim][k[idim]];
+            }
+            ind = ind * Nmesh_padded + index[N - 1][k[N - 1]];
+            w *= weight[N - 1][k[N - 1]];
+            return ind;
+        }
+#pragma omp end declare target
+
+        // Internal method. Add the points with the given weights (times weight_scale) to the grid. The grid is
+        // the full real grid (from the left-most extra slice) of size grid_size and offset is the index of cell
+        // (0,0,...,0). If pos and weight are already on the device (target enter data) they are not copied
+        template <int N, int ORDER>
+        void particles_to_grid_offload(const double * pos,
+                                       const double * weight,
+                                       size_t NumPart,
+                                       int Nmesh,
+                                       ptrdiff_t Local_x_start,
+                                       bool wrap_x,
+                                       FloatType * grid,
+                                       ptrdiff_t grid_size,
+                                       ptrdiff_t offset,
+                                       double weight_scale = 1.0) {
+            constexpr int ncells = int(FML::power(ORDER, N));
+#pragma omp target teams distribute parallel for map(to : pos[0 : N * NumPart], weight[0 : NumPart])                 \
+    map(tofrom : grid[0 : grid_size])
+            for (size_t i = 0; i < NumPart; i++) {
+                int index[N][ORDER];
+                double w1d[N][ORDER];
+                offload_stencil<N, ORDER>(&pos[N * i], Nmesh, Local_x_start, 0, false, wrap_x, index, w1d);
+                for (int icell = 0; icell < ncells; icell++) {
+                    double w;
+                    const ptrdiff_t ind = offset + offload_stencil_cell<N, ORDER>(icell, Nmesh, index, w1d, w);
+#pragma omp atomic update
+                    grid[ind] += FloatType(w * weight[i] * weight_scale);
+                }
+            }
+        }
+
+        // Internal method. Interpolate the grid (see particles_to_grid_offload) to the positions
+        template <int N, int ORDER>
+        void interpolate_grid_to_particle_positions_offload(const double * pos,
+                                                            size_t NumPart,
+                                                            int Nmesh,
+                                                            ptrdiff_t Local_x_start,
+                                                            ptrdiff_t Local_nx,
+                                                            const FloatType * grid,
+                                                            ptrdiff_t grid_size,
+                                                            ptrdiff_t offset,
+                                                            FloatType * values) {
+            constexpr int ncells = int(FML::power(ORDER, N));
+#pragma omp target teams distribute parallel for map(to : pos[0 : N * NumPart], grid[0 : grid_size])                 \
+    map(from : values[0 : NumPart])
+            for (size_t i = 0; i < NumPart; i++) {
+                int index[N][ORDER];
+                double w1d[N][ORDER];
+                offload_stencil<N, ORDER>(&pos[N * i], Nmesh, Local_x_start, Local_nx, true, false, index, w1d);
+                double value = 0.0;
+                for (int icell = 0; icell < ncells; icell++) {
+                    double w;
+                    const ptrdiff_t ind = offset + offload_stencil_cell<N, ORDER>(icell, Nmesh, index, w1d, w);
+                    value += grid[ind] * w;
+                }
+                values[i] = FloatType(value);
+            }
+        }
+#endif
+
+        //==============================================================================
+        // Bin particles to grid using NGP, CIC, TSC, PCS, PQS, ...
+        // Some of the methods require extra slices, see
+        // get_extra_slices_needed_for_density_assignment
+        //
+        // NumPart: number of particles at the head of part
+        // NumPartTot: total number of particles across tasks
+        // NB: part.size() might not be equal to NumPart as we might have a buffer with
+        //
+        // All particles are assumed to have the same mass (can easily be changed, see
+        // comments WEIGHTS below)
+        //==============================================================================
+
+        template <int N, int ORDER, class T>
+        void particles_to_grid(const T * part, size_t NumPart, size_t NumPartTot, FFTWGrid<N> & density) {
+            FML_TIMER_REGION("particles_to_grid");
+
+            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(density.get_n_extra_slices_left() >= nextra.first and
+                           density.get_n_extra_slices_right() >= nextra.second,
+                       "[particles_to_grid] Too few extra slices\n");
+
+            //==========================================================
+            // This is a generic method. You have to specify the kernel
+            // and the corresponding width = the number of cells
+            // the point gets distrubuted to in each dimension which
+            // also corresponds to the order
+            //==========================================================
+
+            // Info about the grid
+            [[maybe_unused]] const auto Local_x_start = density.get_local_x_start();
+            const int Nmesh = density.get_nmesh();
+
+            // Factor to normalize density to the mean density. Set whole grid (also extra slices) to -1.0
+            // while we wait for the sum over tasks
+            double norm_fac;
+            auto norm_sum = density_normalization_async<N>(part, NumPart, NumPartTot, Nmesh, norm_fac);
+            density.fill_real_grid(-1.0);
+            norm_sum.wait();
+            [[maybe_unused]] constexpr bool has_mass = FML::PARTICLE::has_get_mass<T>();
+
+#ifdef USE_OMP_TARGET
+            // Do the assignment on the device
+            const auto positions = positions_for_offload<N>(part, NumPart);
+            std::vector<double> weights(NumPart, norm_fac);
+            if constexpr (has_mass) {
+                for (size_t i = 0; i < NumPart; i++)
+                    weights[i] *= FML::PARTICLE::GetMass(part[i]);
+            }
+            const ptrdiff_t offset = density.get_n_extra_slices_left() * density.get_ntot_real_slice_alloc();
+            const ptrdiff_t grid_size =
+                (density.get_n_extra_slices_left() + density.get_local_nx() + density.get_n_extra_slices_right()) *
+                density.get_ntot_real_slice_alloc();
+            particles_to_grid_offload<N, ORDER>(positions.data(),
+                                                weights.data(),
+                                                NumPart,
+                                                Nmesh,
+                                                Local_x_start,
+                                                FML::NTasks == 1,
+                                                density.get_real_grid_left(),
+                                                grid_size,
+                                                offset);
 #else
-                            double dx = std::fabs(-x[idim] + go_left_right_or_stay);
+            add_particles_to_grid<N, ORDER>(part, NumPart, norm_fac, density);
 #endif
-                            w *= kernel<ORDER>(dx);
-                        }
 
-                        // Periodic BC for all but x (we have extra slices - XXX should assert that its not too large,
-                        // but covered by boundscheck in FFTWGrid if this is turned on)!
-                        icoord[0] = ix_nbor[0];
-                        for (int idim = 1; idim < N; idim++) {
-                            icoord[idim] = ix_nbor[idim];
-                            if (icoord[idim] >= Nmesh)
-                                icoord[idim] -= Nmesh;
-                            if (icoord[idim] < 0)
-                                icoord[idim] += Nmesh;
-                        }
+            // Extra slices only relevant if we have more than 1 task
+            if (FML::NTasks > 1)
+                add_contribution_from_extra_slices<N>(density);
+        }
 
-                        // If only 1 task then we should wrap
-                        if (FML::NTasks == 1) {
-                            if (icoord[0] >= Nmesh)
-                                icoord[0] -= Nmesh;
-                            if (icoord[0] < 0)
-                                icoord[0] += Nmesh;
-                        }
-                    }
+        template <int N, int ORDER, class T>
+        void particles_to_grid_communicate_particles(FML::PARTICLE::MPIParticles<T> & part, FFTWGrid<N> & density) {
+
+            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(density.get_n_extra_slices_left() >= nextra.first and
+                           density.get_n_extra_slices_right() >= nextra.second,
+                       "[particles_to_grid_communicate_particles] Too few extra slices\n");
+
+            // Factor to normalize density to the mean density (all particles are on some task before we start).
+            // Set whole grid (also extra slices) to -1.0 while we wait for the sum over tasks
+            double norm_fac;
+            auto norm_sum = density_normalization_async<N>(
+                part.get_particles_ptr(), part.get_npart(), part.get_npart_total(), density.get_nmesh(), norm_fac);
+            density.fill_real_grid(-1.0);
+            norm_sum.wait();
+
+            // Assign the particles that stay while the others are in transit and then the ones we recieved
+            part.start_communicate_particles();
+            const size_t NumPartStaying = part.get_npart();
+            add_particles_to_grid<N, ORDER>(part.get_particles_ptr(), NumPartStaying, norm_fac, density);
+            part.finish_communicate_particles();
+            add_particles_to_grid<N, ORDER>(
+                part.get_particles_ptr() + NumPartStaying, part.get_npart() - NumPartStaying, norm_fac, density);
+
+            // Extra slices only relevant if we have more than 1 task
+            if (FML::NTasks > 1)
+                add_contribution_from_extra_slices<N>(density);
+        }
+
+        template <int N, class T>
+        void particles_to_grid_communicate_particles(FML::PARTICLE::MPIParticles<T> & part,
+                                                     FFTWGrid<N> & density,
+                                                     std::string density_assignment_method) {
+            const int order = interpolation_order_from_name(density_assignment_method);
+            if (order == 1)
+                particles_to_grid_communicate_particles<N, 1, T>(part, density);
+            if (order == 2)
+                particles_to_grid_communicate_particles<N, 2, T>(part, density);
+            if (order == 3)
+                particles_to_grid_communicate_particles<N, 3, T>(part, density);
+            if (order == 4)
+                particles_to_grid_communicate_particles<N, 4, T>(part, density);
+            if (order == 5)
+                particles_to_grid_communicate_particles<N, 5, T>(part, density);
+        }
+
+        //==============================================================================
+        // Bin particles to two grids in one pass over the particles: density gets the
+        // particles at their positions and density_shifted the particles shifted by half a
+        // cell in all directions (as needed for interlacing). The shifted grid needs one more
+        // extra slice on the right. The particles are not modified.
+        //==============================================================================
+
+        template <int N, int ORDER, class T>
+        void particles_to_grid_interlaced(const T * part,
+                                          size_t NumPart,
+                                          size_t NumPartTot,
+                                          FFTWGrid<N> & density,
+                                          FFTWGrid<N> & density_shifted) {
+
+            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(density.get_n_extra_slices_left() >= nextra.first and
+                           density.get_n_extra_slices_right() >= nextra.second and
+                           density_shifted.get_n_extra_slices_left() >= nextra.first and
+                           density_shifted.get_n_extra_slices_right() >= nextra.second + 1,
+                       "[particles_to_grid_interlaced] Too few extra slices\n");
+            assert_mpi(density.get_nmesh() == density_shifted.get_nmesh(),
+                       "[particles_to_grid_interlaced] The two grids must have the same size\n");
+
+            // Info about the grid
+            const auto Local_x_start = density.get_local_x_start();
+            const int Nmesh = density.get_nmesh();
+            const double shift = 1.0 / double(2 * Nmesh);
+
+            // Factor to normalize density to the mean density. Set whole grid (also extra slices) to -1.0
+            // while we wait for the sum over tasks
+            double norm_fac;
+            auto norm_sum = density_normalization_async<N>(part, NumPart, NumPartTot, Nmesh, norm_fac);
+            density.fill_real_grid(-1.0);
+            density_shifted.fill_real_grid(-1.0);
+            norm_sum.wait();
+            constexpr bool has_mass = FML::PARTICLE::has_get_mass<T>();
+
+            // Add particle i to both grids
+            auto assign_particle = [&](size_t ipart) {
+
+                // Particle position
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ipart]);
 
-                    // Add particle to grid
-                    density.add_real(icoord, w * norm_fac * mass);
-                    sumweights += w;
+                // Fetch mass if this is availiable
+                double mass = 1.0;
+                if constexpr (has_mass)
+                    mass = FML::PARTICLE::GetMass(part[ipart]);
+
+                add_point_to_grid<N, ORDER>(pos, norm_fac * mass, Nmesh, Local_x_start, density);
+
+                // The shifted position. No wrapping in x as we have an extra slice on the right
+                std::array<double, N> pos_shifted;
+                pos_shifted[0] = pos[0] + shift;
+                for (int idim = 1; idim < N; idim++) {
+                    pos_shifted[idim] = pos[idim] + shift;
+                    if (pos_shifted[idim] >= 1.0)
+                        pos_shifted[idim] -= 1.0;
                 }
+                add_point_to_grid<N, ORDER>(
+                    pos_shifted.data(), norm_fac * mass, Nmesh, Local_x_start, density_shifted);
+            };
 
-#ifdef DEBUG_INTERPOL
-                // Check that the weights sum up to unity
-                assert_mpi(
-                    std::fabs(sumweights - 1.0) < 1e-3,
-                    "[particles_to_grid] Possible problem with particles to grid: weights does not sum to unity!");
+            // The tiles are ORDER+1 cells wide so the shifted stencil (which reaches one cell further
+            // to the right) still never overlaps with a tile of the same color
+#if defined(USE_OMP) && !defined(SERIAL_DENSITY_ASSIGNMENT)
+            for_each_particle_by_tile<N, ORDER>(part, NumPart, density, assign_particle);
+#else
+            for (size_t i = 0; i < NumPart; i++)
+                assign_particle(i);
+#endif
+
+            // Extra slices only relevant if we have more than 1 task
+            if (FML::NTasks > 1) {
+                auto halo = add_contribution_from_extra_slices_async<N>(density);
+                add_contribution_from_extra_slices<N>(density_shifted);
+                halo.wait();
+            }
+        }
+
+        //==============================================================================
+        // Bin particles to several grids in one pass over the particles. The stencil is
+        // computed once per particle and then added to all the grids with their own weight
+        //==============================================================================
+
+        template <int N, int ORDER, class T>
+        void particles_to_grids(const T * part, size_t NumPart, std::vector<GridAndWeight<N, T>> & grids) {
+
+            if (grids.size() == 0)
+                return;
+            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            for (auto & g : grids) {
+                assert_mpi(g.grid != nullptr and g.weight, "[particles_to_grids] Grid or weight function not set\n");
+                assert_mpi(g.grid->get_nmesh() == grids[0].grid->get_nmesh(),
+                           "[particles_to_grids] All grids must have the same size\n");
+                assert_mpi(g.grid->get_n_extra_slices_left() >= nextra.first and
+                               g.grid->get_n_extra_slices_right() >= nextra.second,
+                           "[particles_to_grids] Too few extra slices\n");
+            }
+
+            // Info about the grid
+            FFTWGrid<N> & density = *grids[0].grid;
+            const auto Local_x_start = density.get_local_x_start();
+            const int Nmesh = density.get_nmesh();
+            const int ngrids = int(grids.size());
+
+            // Factor to normalize each density to its mean (the total weight over all tasks). We start all grids at
+            // -1.0 (as the extra slices are added to the neighbor tasks assuming this) and add 1.0 back at the end if
+            // we just want the sum of the weights. The weights of all the grids are summed over tasks in one go
+            std::vector<double> norm_fac(ngrids, 1.0);
+            std::vector<double> total_weight(ngrids, 0.0);
+            for (int igrid = 0; igrid < ngrids; igrid++) {
+                auto & g = grids[igrid];
+                if (not g.density_contrast)
+                    continue;
+                double weight_sum = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : weight_sum)
 #endif
+                for (size_t i = 0; i < NumPart; i++)
+                    weight_sum += g.weight(part[i]);
+                total_weight[igrid] = weight_sum;
+            }
+            auto weight_sum = SumArrayOverTasksAsync(total_weight.data(), ngrids);
+            for (auto & g : grids)
+                g.grid->fill_real_grid(-1.0);
+            weight_sum.wait();
+            for (int igrid = 0; igrid < ngrids; igrid++) {
+                if (not grids[igrid].density_contrast)
+                    continue;
+                assert_mpi(total_weight[igrid] != 0.0, "[particles_to_grids] The weights sum to zero\n");
+                norm_fac[igrid] = std::pow((double)Nmesh, N) / total_weight[igrid];
             }
 
+            // Add particle i to all the grids
+            auto assign_particle = [&](size_t ipart) {
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ipart]);
+                const auto stencil = assignment_stencil<N, ORDER>(pos, Nmesh, Local_x_start);
+                for (int igrid = 0; igrid < ngrids; igrid++) {
+                    const double weight = norm_fac[igrid] * grids[igrid].weight(part[ipart]);
+                    FFTWGrid<N> & grid = *grids[igrid].grid;
+                    stencil.for_each_cell(
+                        [&](const std::array<int, N> & icoord, double w) { grid.add_real(icoord, w * weight); });
+                }
+            };
+
+#if defined(USE_OMP) && !defined(SERIAL_DENSITY_ASSIGNMENT)
+            for_each_particle_by_tile<N, ORDER>(part, NumPart, density, assign_particle);
+#else
+            for (size_t i = 0; i < NumPart; i++)
+                assign_particle(i);
+#endif
+
             // Extra slices only relevant if we have more than 1 task
-            if (FML::NTasks > 1)
-                add_contribution_from_extra_slices<N>(density);
+            if (FML::NTasks > 1) {
+                std::vector<FML::GRID::FFTWGridHaloExchange> halos;
+                for (auto & g : grids)
+                    halos.push_back(add_contribution_from_extra_slices_async<N>(*g.grid));
+                for (auto & halo : halos)
+                    halo.wait();
+            }
+
+            for (auto & g : grids) {
+                if (g.density_contrast)
+                    continue;
+                auto Local_nx = g.grid->get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int islice = 0; islice < Local_nx; islice++) {
+                    for (auto && real_index : g.grid->get_real_range(islice, islice + 1))
+                        g.grid->set_real_from_index(real_index, g.grid->get_real_from_index(real_index) + 1.0);
+                }
+            }
+        }
+
+        template <int N, class T>
+        void particles_to_grids(const T * part,
+                                size_t NumPart,
+                                std::vector<GridAndWeight<N, T>> & grids,
+                                std::string density_assignment_method) {
+            if (density_assignment_method.compare("NGP") == 0)
+                particles_to_grids<N, 1, T>(part, NumPart, grids);
+            if (density_assignment_method.compare("CIC") == 0)
+                particles_to_grids<N, 2, T>(part, NumPart, grids);
+            if (density_assignment_method.compare("TSC") == 0)
+                particles_to_grids<N, 3, T>(part, NumPart, grids);
+            if (density_assignment_method.compare("PCS") == 0)
+                particles_to_grids<N, 4, T>(part, NumPart, grids);
+            if (density_assignment_method.compare("PQS") == 0)
+                particles_to_grids<N, 5, T>(part, NumPart, grids);
         }
 
         template <int N, int ORDER, class T>
@@ -647,9 +1844,6 @@ namespace FML {
                            "[interpolate_grid_to_particle_positions] Too few extra slices in some of the grids\n");
             }
 
-            // We need to look at width^N cells in total
-            constexpr int widthtondim = FML::power(ORDER, N);
-
             // Fetch grid information
             const auto Local_nx = grid_vec[0].get_local_nx();
             const auto Local_x_start = grid_vec[0].get_local_x_start();
@@ -661,256 +1855,941 @@ namespace FML {
                     i.resize(NumPart);
             }
 
+#ifdef USE_OMP_TARGET
+            // Do the interpolation on the device. The positions stay on the device for all the components
+            const auto positions = positions_for_offload<N>(part, NumPart);
+            const double * pos = positions.data();
+#pragma omp target data map(to : pos[0 : N * NumPart])
+            {
+                for (int idim = 0; idim < N; idim++) {
+                    const auto & grid = grid_vec[idim];
+                    const ptrdiff_t offset = grid.get_n_extra_slices_left() * grid.get_ntot_real_slice_alloc();
+                    const ptrdiff_t grid_size =
+                        (grid.get_n_extra_slices_left() + Local_nx + grid.get_n_extra_slices_right()) *
+                        grid.get_ntot_real_slice_alloc();
+                    interpolate_grid_to_particle_positions_offload<N, ORDER>(pos,
+                                                                             NumPart,
+                                                                             Nmesh,
+                                                                             Local_x_start,
+                                                                             Local_nx,
+                                                                             grid.get_real_grid() - offset,
+                                                                             grid_size,
+                                                                             offset,
+                                                                             interpolated_values_vec[idim].data());
+                }
+            }
+#else
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
             for (size_t ind = 0; ind < NumPart; ind++) {
 
-                // Positions in global grid in units of [Nmesh]
+                // The interpolation stencil around the particle
                 const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ind]);
-                std::array<double, N> x;
-                for (int idim = 0; idim < N; idim++)
-                    x[idim] = pos[idim] * Nmesh;
+                const auto stencil = interpolation_stencil<N, ORDER>(pos, Nmesh, Local_x_start, Local_nx);
 
-                // Nearest grid-node in grid
-                // Also do some santity checks. Probably better to throw here if these tests kick in
-                std::array<int, N> ix, ix_nbor;
-                for (int idim = 0; idim < N; idim++) {
-                    ix[idim] = int(x[idim]);
-                    if (idim == 0) {
-                        if (ix[0] == (Local_x_start + Local_nx))
-                            ix[0] = int(Local_x_start + Local_nx) - 1;
-                        if (ix[0] < Local_x_start)
-                            ix[0] = int(Local_x_start);
-                    } else {
-                        if (ix[idim] == Nmesh)
-                            ix[idim] = Nmesh - 1;
-                    }
-                }
+                // Interpolation
+                std::array<double, N> value;
+                value.fill(0.0);
+                [[maybe_unused]] double sumweight = 0;
+                stencil.for_each_cell([&](const std::array<int, N> & icoord, double w) {
+                    for (int idim = 0; idim < N; idim++)
+                        value[idim] += grid_vec[idim].get_real(icoord) * w;
+                    sumweight += w;
+                });
 
-                // Positions to distance from neareste grid-node
-                for (int idim = 0; idim < N; idim++) {
-                    x[idim] -= ix[idim];
+#ifdef DEBUG_INTERPOL
+                // Check that the weights sum up to unity
+                assert_mpi(std::fabs(sumweight - 1.0) < 1e-3,
+                           "[interpolate_grid_to_particle_positions] Possible problem with interpolation: weights does "
+                           "not sum to unity!");
+#endif
+
+                // Store the interpolated value
+                for (int idim = 0; idim < N; idim++)
+                    interpolated_values_vec[idim][ind] = value[idim];
+            }
+#endif
+        }
+
+        template <int N, class T>
+        void interpolate_grid_vector_to_particle_positions(const std::array<FFTWGrid<N>, N> & grid,
+                                                           const T * part,
+                                                           size_t NumPart,
+                                                           std::array<std::vector<FloatType>, N> & interpolated_values,
+                                                           std::string interpolation_method) {
+            if (interpolation_method.compare("NGP") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 1, T>(grid, part, NumPart, interpolated_values);
+            if (interpolation_method.compare("CIC") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 2, T>(grid, part, NumPart, interpolated_values);
+            if (interpolation_method.compare("TSC") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 3, T>(grid, part, NumPart, interpolated_values);
+            if (interpolation_method.compare("PCS") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 4, T>(grid, part, NumPart, interpolated_values);
+            if (interpolation_method.compare("PQS") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 5, T>(grid, part, NumPart, interpolated_values);
+        }
+
+        //==============================================================================
+        // Two level assignment: sum up the particles in each cell first and then spread the
+        // cell totals to the grid. For NGP we just need the (weighted) number of particles
+        // in the cell. The CIC weights are products of 1-dx and dx over the dimensions so the
+        // sum over particles in a cell only depends on the 2^N moments
+        // M_S = Sum_particles mass * Prod_{d in S} dx_d for all subsets S of the dimensions.
+        // The weight of corner C (the dimensions where we go one cell to the right) is then
+        // Sum_{S containing C} (-1)^{|S|-|C|} M_S.
+        //
+        // We bin the particles by slice and do one slice at a time so the accumulator is just
+        // one slice of moments per thread. A CIC slice also adds to the next slice so we do
+        // the even and the odd slices in separate phases.
+        //==============================================================================
+
+        template <int N, int ORDER, class T>
+        void particles_to_grid_two_level(const T * part, size_t NumPart, size_t NumPartTot, FFTWGrid<N> & density) {
+            static_assert(ORDER == 1 or ORDER == 2, "Two level assignment is only implemented for NGP and CIC");
+
+            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(density.get_n_extra_slices_left() >= nextra.first and
+                           density.get_n_extra_slices_right() >= nextra.second,
+                       "[particles_to_grid_two_level] Too few extra slices\n");
+
+            // Info about the grid
+            const int Local_nx = int(density.get_local_nx());
+            const int Local_x_start = int(density.get_local_x_start());
+            const int Nmesh = density.get_nmesh();
+            const size_t ncells_slice = FML::power(size_t(Nmesh), N - 1);
+            constexpr int nmoments = ORDER == 1 ? 1 : (1 << N);
+            constexpr bool has_mass = FML::PARTICLE::has_get_mass<T>();
+
+            // Factor to normalize density to the mean density. Set whole grid (also extra slices) to -1.0
+            // while we wait for the sum over tasks
+            double norm_fac;
+            auto norm_sum = density_normalization_async<N>(part, NumPart, NumPartTot, Nmesh, norm_fac);
+            density.fill_real_grid(-1.0);
+            norm_sum.wait();
+
+            // The sign of moment S in the weight of corner C (0 if S does not contain C)
+            std::array<std::array<int, nmoments>, nmoments> sign;
+            for (int c = 0; c < nmoments; c++) {
+                for (int S = 0; S < nmoments; S++) {
+                    sign[c][S] = 0;
+                    if ((S & c) != c)
+                        continue;
+                    int n = 0;
+                    for (int idim = 0; idim < N; idim++)
+                        n += ((S ^ c) >> idim) & 1;
+                    sign[c][S] = n % 2 == 0 ? 1 : -1;
                 }
+            }
 
-                // From global ix to local ix
-                ix[0] -= int(Local_x_start);
+            // Sort the particles by the slice they are in (counting sort)
+            auto slice_of_particle = [&](size_t i) {
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[i]);
+                const int ix = int(pos[0] * Nmesh) - Local_x_start;
+                return std::max(0, std::min(ix, Local_nx - 1));
+            };
+            // If the particles are already sorted by slice (e.g. after MPIParticles::sort_by_cell) we skip the sort
+            std::vector<size_t> slice_start(Local_nx + 1, 0);
+            std::vector<size_t> sorted_index;
+            bool sorted = true;
+            for (size_t i = 0, prev = 0; i < NumPart; i++) {
+                const size_t islice = slice_of_particle(i);
+                slice_start[islice + 1]++;
+                sorted = sorted and islice >= prev;
+                prev = islice;
+            }
+            for (int islice = 0; islice < Local_nx; islice++)
+                slice_start[islice + 1] += slice_start[islice];
+            if (not sorted) {
+                sorted_index.resize(NumPart);
+                std::vector<size_t> offset(slice_start.begin(), slice_start.end() - 1);
+                for (size_t i = 0; i < NumPart; i++)
+                    sorted_index[offset[slice_of_particle(i)]++] = i;
+            }
 
-                // If we are on the left or right of the cell determines how many cells
-                // we have to go left and right
-                std::array<int, N> xstart;
-                if (ORDER % 2 == 0) {
-                    for (int idim = 0; idim < N; idim++) {
-                        xstart[idim] = -ORDER / 2 + 1;
-#ifdef CELLCENTERSHIFTED
-                        xstart[idim] = -ORDER / 2;
-                        if (x[idim] > 0.5)
-                            xstart[idim] += 1;
-#endif
+            // Sum up the particles in a slice and spread the cell totals to the grid
+            auto assign_slice = [&](int islice, std::vector<double> & moments) {
+                std::fill(moments.begin(), moments.end(), 0.0);
+                for (size_t j = slice_start[islice]; j < slice_start[islice + 1]; j++) {
+                    const size_t ipart = sorted ? j : sorted_index[j];
+                    const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ipart]);
+
+                    double mass = 1.0;
+                    if constexpr (has_mass)
+                        mass = FML::PARTICLE::GetMass(part[ipart]);
+
+                    // The cell in the slice and the distance from the left side of the cell
+                    size_t cell = 0;
+                    std::array<double, N> dx;
+                    dx[0] = pos[0] * Nmesh - (islice + Local_x_start);
+                    for (int idim = 1; idim < N; idim++) {
+                        const double x = pos[idim] * Nmesh;
+                        int ix = int(x);
+                        dx[idim] = x - ix;
+                        if (ix == Nmesh)
+                            ix = 0;
+                        cell = cell * Nmesh + ix;
                     }
-                } else {
-#ifndef CELLCENTERSHIFTED
-                    for (int idim = 0; idim < N; idim++) {
-                        xstart[idim] = -ORDER / 2;
-                        if (x[idim] > 0.5)
-                            xstart[idim] += 1;
+
+                    double * m = &moments[cell * nmoments];
+                    if constexpr (ORDER == 1) {
+                        m[0] += mass;
+                    } else {
+                        std::array<double, nmoments> prod;
+                        prod[0] = mass;
+                        for (int idim = 0; idim < N; idim++)
+                            for (int S = 0; S < (1 << idim); S++)
+                                prod[S | (1 << idim)] = prod[S] * dx[idim];
+                        for (int S = 0; S < nmoments; S++)
+                            m[S] += prod[S];
                     }
+                }
+
+                std::array<int, N> coord;
+                for (size_t cell = 0; cell < ncells_slice; cell++) {
+                    const double * m = &moments[cell * nmoments];
+                    if (m[0] == 0.0)
+                        continue;
+                    coord[0] = islice;
+                    for (int idim = N - 1, n = int(cell); idim > 0; idim--, n /= Nmesh)
+                        coord[idim] = n % Nmesh;
+
+                    for (int c = 0; c < nmoments; c++) {
+                        double value = 0.0;
+                        for (int S = 0; S < nmoments; S++)
+                            value += sign[c][S] * m[S];
+                        std::array<int, N> icoord;
+                        for (int idim = 0; idim < N; idim++) {
+                            icoord[idim] = coord[idim] + ((c >> idim) & 1);
+                            if (idim > 0 or FML::NTasks == 1)
+                                if (icoord[idim] >= (idim == 0 ? Local_nx : Nmesh))
+                                    icoord[idim] = 0;
+                        }
+                        density.add_real(icoord, value * norm_fac);
+                    }
+                }
+            };
+
+            // The slices in each phase never add to the same slice. With one task and an odd number of slices the last
+            // slice wraps around to the first one so we do it on its own
+            const int nphases = ORDER == 1 ? 1 : 2;
+            const int nslices_phased = (ORDER == 2 and FML::NTasks == 1 and Local_nx % 2 == 1) ? Local_nx - 1 : Local_nx;
+#ifdef USE_OMP
+#pragma omp parallel
 #endif
+            {
+                std::vector<double> moments(ncells_slice * nmoments);
+                for (int phase = 0; phase < nphases; phase++) {
+#ifdef USE_OMP
+#pragma omp for schedule(dynamic)
+#endif
+                    for (int islice = phase; islice < nslices_phased; islice += nphases)
+                        assign_slice(islice, moments);
                 }
+#ifdef USE_OMP
+#pragma omp single
+#endif
+                for (int islice = nslices_phased; islice < Local_nx; islice++)
+                    assign_slice(islice, moments);
+            }
+
+            // Extra slices only relevant if we have more than 1 task
+            if (FML::NTasks > 1)
+                add_contribution_from_extra_slices<N>(density);
+        }
+
+        template <int N, class T>
+        void particles_to_grid_two_level(const T * part,
+                                         size_t NumPart,
+                                         size_t NumPartTot,
+                                         FFTWGrid<N> & density,
+                                         std::string density_assignment_method) {
+            if (density_assignment_method.compare("NGP") == 0)
+                particles_to_grid_two_level<N, 1, T>(part, NumPart, NumPartTot, density);
+            else if (density_assignment_method.compare("CIC") == 0)
+                particles_to_grid_two_level<N, 2, T>(part, NumPart, NumPartTot, density);
+            else
+                particles_to_grid<N, T>(part, NumPart, NumPartTot, density, density_assignment_method);
+        }
+
+        template <int N, int ORDER, class T>
+        void interpolate_grid_vector_to_particle_positions(
+            const InterleavedGridVector<N> & grid_vec,
+            const T * part,
+            size_t NumPart,
+            std::vector<std::array<FloatType, N>> & interpolated_values_vec) {
+
+            auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(grid_vec.get_nmesh() > 0,
+                       "[interpolate_grid_to_particle_positions] Grid has to be already allocated!\n");
+            assert_mpi(grid_vec.get_n_extra_slices_left() >= nextra.first and
+                           grid_vec.get_n_extra_slices_right() >= nextra.second,
+                       "[interpolate_grid_to_particle_positions] Too few extra slices\n");
+
+            // Fetch grid information
+            const auto Local_nx = grid_vec.get_local_nx();
+            const auto Local_x_start = grid_vec.get_local_x_start();
+            const int Nmesh = grid_vec.get_nmesh();
+
+            // Allocate memory needed
+            interpolated_values_vec.resize(NumPart);
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t ind = 0; ind < NumPart; ind++) {
+
+                // The interpolation stencil around the particle
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ind]);
+                const auto stencil = interpolation_stencil<N, ORDER>(pos, Nmesh, Local_x_start, Local_nx);
 
                 // Interpolation
                 std::array<double, N> value;
                 value.fill(0.0);
+                stencil.for_each_cell([&](const std::array<int, N> & icoord, double w) {
+                    const auto & cell = grid_vec.get_real(icoord);
+                    for (int idim = 0; idim < N; idim++)
+                        value[idim] += cell[idim] * w;
+                });
+
+                // Store the interpolated value
+                for (int idim = 0; idim < N; idim++)
+                    interpolated_values_vec[ind][idim] = value[idim];
+            }
+        }
+
+        template <int N, class T>
+        void interpolate_grid_vector_to_particle_positions(
+            const InterleavedGridVector<N> & grid,
+            const T * part,
+            size_t NumPart,
+            std::vector<std::array<FloatType, N>> & interpolated_values,
+            std::string interpolation_method) {
+            if (interpolation_method.compare("NGP") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 1, T>(grid, part, NumPart, interpolated_values);
+            if (interpolation_method.compare("CIC") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 2, T>(grid, part, NumPart, interpolated_values);
+            if (interpolation_method.compare("TSC") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 3, T>(grid, part, NumPart, interpolated_values);
+            if (interpolation_method.compare("PCS") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 4, T>(grid, part, NumPart, interpolated_values);
+            if (interpolation_method.compare("PQS") == 0)
+                interpolate_grid_vector_to_particle_positions<N, 5, T>(grid, part, NumPart, interpolated_values);
+        }
+
+        template <int N, int ORDER, class T>
+        void interpolate_grid_to_particle_positions(const FFTWGrid<N> & grid,
+                                                    const T * part,
+                                                    size_t NumPart,
+                                                    std::vector<FloatType> & interpolated_values) {
+
+            auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(grid.get_nmesh() > 0,
+                       "[interpolate_grid_to_particle_positions] Grid has to be already allocated!\n");
+            assert_mpi(grid.get_n_extra_slices_left() >= nextra.first and
+                           grid.get_n_extra_slices_right() >= nextra.second,
+                       "[interpolate_grid_to_particle_positions] Too few extra slices\n");
+
+            // Fetch grid information
+            const auto Local_nx = grid.get_local_nx();
+            const auto Local_x_start = grid.get_local_x_start();
+            const int Nmesh = grid.get_nmesh();
+
+            // Allocate memory needed
+            interpolated_values.resize(NumPart);
+
+#ifdef USE_OMP_TARGET
+            // Do the interpolation on the device
+            const auto positions = positions_for_offload<N>(part, NumPart);
+            const ptrdiff_t offset = grid.get_n_extra_slices_left() * grid.get_ntot_real_slice_alloc();
+            const ptrdiff_t grid_size =
+                (grid.get_n_extra_slices_left() + Local_nx + grid.get_n_extra_slices_right()) *
+                grid.get_ntot_real_slice_alloc();
+            interpolate_grid_to_particle_positions_offload<N, ORDER>(positions.data(),
+                                                                     NumPart,
+                                                                     Nmesh,
+                                                                     Local_x_start,
+                                                                     Local_nx,
+                                                                     grid.get_real_grid() - offset,
+                                                                     grid_size,
+                                                                     offset,
+                                                                     interpolated_values.data());
+#else
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t ind = 0; ind < NumPart; ind++) {
+
+                // The interpolation stencil around the particle
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ind]);
+                const auto stencil = interpolation_stencil<N, ORDER>(pos, Nmesh, Local_x_start, Local_nx);
+
+                // Interpolation
+                FloatType value = 0;
                 [[maybe_unused]] double sumweight = 0;
-                for (int i = 0; i < widthtondim; i++) {
-                    double w = 1.0;
-                    for (int idim = 0, n = 1; idim < N; idim++, n *= ORDER) {
-                        int go_left_right_or_stay = ORDER == 1 ? 0 : xstart[idim] + (i / n % ORDER);
-                        ix_nbor[idim] = ix[idim] + go_left_right_or_stay;
-#ifdef CELLCENTERSHIFTED
-                        double dx = std::fabs(-x[idim] + go_left_right_or_stay + 0.5);
+                stencil.for_each_cell([&](const std::array<int, N> & icoord, double w) {
+                    value += grid.get_real(icoord) * w;
+                    sumweight += w;
+                });
+
+#ifdef DEBUG_INTERPOL
+                // Check that the weights sum up to unity
+                assert_mpi(std::fabs(sumweight - 1.0) < 1e-3,
+                           "[interpolate_grid_to_particle_positions] Possible problem with interpolation: weights does "
+                           "not sum to unity!");
+#endif
+
+                // Store the interpolated value
+                interpolated_values[ind] = value;
+            }
+#endif
+        }
+
+        //=======================================================================
+        // Precomputed interpolation stencils
+        //=======================================================================
+        template <int N>
+        template <class T>
+        void ParticleInterpolationStencils<N>::compute(const FFTWGrid<N> & grid,
+                                                       const T * part,
+                                                       size_t _NumPart,
+                                                       std::string interpolation_method) {
+            assert_mpi(grid.get_nmesh() > 0, "[ParticleInterpolationStencils::compute] Grid has to be allocated!\n");
+            order = interpolation_order_from_name(interpolation_method);
+            Nmesh = grid.get_nmesh();
+            Local_x_start = grid.get_local_x_start();
+            NumPart = _NumPart;
+            index.resize(NumPart * N * order);
+            weight.resize(NumPart * N * order);
+            if (order == 1)
+                compute<1, T>(grid, part);
+            if (order == 2)
+                compute<2, T>(grid, part);
+            if (order == 3)
+                compute<3, T>(grid, part);
+            if (order == 4)
+                compute<4, T>(grid, part);
+            if (order == 5)
+                compute<5, T>(grid, part);
+            valid = true;
+        }
+
+        template <int N>
+        template <int ORDER, class T>
+        void ParticleInterpolationStencils<N>::compute(const FFTWGrid<N> & grid, const T * part) {
+            const auto Local_nx = grid.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t ind = 0; ind < NumPart; ind++) {
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ind]);
+                const auto stencil = interpolation_stencil<N, ORDER>(pos, Nmesh, Local_x_start, Local_nx);
+                int * ind_ptr = index.data() + ind * N * ORDER;
+                double * w_ptr = weight.data() + ind * N * ORDER;
+                for (int idim = 0; idim < N; idim++) {
+                    for (int k = 0; k < ORDER; k++) {
+                        ind_ptr[idim * ORDER + k] = stencil.index[idim][k];
+                        w_ptr[idim * ORDER + k] = stencil.weight[idim][k];
+                    }
+                }
+            }
+        }
+
+        template <int N>
+        bool ParticleInterpolationStencils<N>::is_valid_for(const FFTWGrid<N> & grid,
+                                                            size_t _NumPart,
+                                                            std::string interpolation_method) const {
+            return valid and NumPart == _NumPart and Nmesh == grid.get_nmesh() and
+                   Local_x_start == grid.get_local_x_start() and
+                   order == interpolation_order_from_name(interpolation_method);
+        }
+
+        template <int N>
+        void ParticleInterpolationStencils<N>::clear() {
+            valid = false;
+            NumPart = 0;
+            index.clear();
+            index.shrink_to_fit();
+            weight.clear();
+            weight.shrink_to_fit();
+        }
+
+        // Internal method. Get the stencil of particle ind from the precomputed stencils
+        template <int N, int ORDER>
+        inline BSplineStencil<N, ORDER> get_precomputed_stencil(const ParticleInterpolationStencils<N> & stencils,
+                                                                size_t ind) {
+            BSplineStencil<N, ORDER> stencil;
+            const int * ind_ptr = stencils.get_index(ind);
+            const double * w_ptr = stencils.get_weight(ind);
+            for (int idim = 0; idim < N; idim++) {
+                for (int k = 0; k < ORDER; k++) {
+                    stencil.index[idim][k] = ind_ptr[idim * ORDER + k];
+                    stencil.weight[idim][k] = w_ptr[idim * ORDER + k];
+                }
+            }
+            return stencil;
+        }
+
+        // Internal method. Check that the stencils can be used for the grid
+        template <int N, int ORDER>
+        void assert_stencils_match_grid(const FFTWGrid<N> & grid, const ParticleInterpolationStencils<N> & stencils) {
+            auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(grid.get_nmesh() == stencils.get_nmesh() and
+                           grid.get_local_x_start() == stencils.get_local_x_start(),
+                       "[interpolate_grid_to_particle_positions] The stencils are not computed for this grid\n");
+            assert_mpi(grid.get_n_extra_slices_left() >= nextra.first and
+                           grid.get_n_extra_slices_right() >= nextra.second,
+                       "[interpolate_grid_to_particle_positions] Too few extra slices\n");
+        }
+
+        template <int N, int ORDER>
+        void interpolate_grid_to_particle_positions(const FFTWGrid<N> & grid,
+                                                    const ParticleInterpolationStencils<N> & stencils,
+                                                    std::vector<FloatType> & interpolated_values) {
+            assert_stencils_match_grid<N, ORDER>(grid, stencils);
+            const size_t NumPart = stencils.get_npart();
+            interpolated_values.resize(NumPart);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t ind = 0; ind < NumPart; ind++) {
+                const auto stencil = get_precomputed_stencil<N, ORDER>(stencils, ind);
+                FloatType value = 0;
+                stencil.for_each_cell(
+                    [&](const std::array<int, N> & icoord, double w) { value += grid.get_real(icoord) * w; });
+                interpolated_values[ind] = value;
+            }
+        }
+
+        template <int N>
+        void interpolate_grid_to_particle_positions(const FFTWGrid<N> & grid,
+                                                    const ParticleInterpolationStencils<N> & stencils,
+                                                    std::vector<FloatType> & interpolated_values) {
+            const int order = stencils.get_order();
+            assert_mpi(order > 0, "[interpolate_grid_to_particle_positions] The stencils are not computed\n");
+            if (order == 1)
+                interpolate_grid_to_particle_positions<N, 1>(grid, stencils, interpolated_values);
+            if (order == 2)
+                interpolate_grid_to_particle_positions<N, 2>(grid, stencils, interpolated_values);
+            if (order == 3)
+                interpolate_grid_to_particle_positions<N, 3>(grid, stencils, interpolated_values);
+            if (order == 4)
+                interpolate_grid_to_particle_positions<N, 4>(grid, stencils, interpolated_values);
+            if (order == 5)
+                interpolate_grid_to_particle_positions<N, 5>(grid, stencils, interpolated_values);
+        }
+
+        template <int N, int ORDER>
+        void
+        interpolate_grid_vector_to_particle_positions(const std::array<FFTWGrid<N>, N> & grid_vec,
+                                                      const ParticleInterpolationStencils<N> & stencils,
+                                                      std::array<std::vector<FloatType>, N> & interpolated_values_vec) {
+            for (auto & g : grid_vec)
+                assert_stencils_match_grid<N, ORDER>(g, stencils);
+            const size_t NumPart = stencils.get_npart();
+            for (auto & i : interpolated_values_vec) {
+                if (i.size() < NumPart)
+                    i.resize(NumPart);
+            }
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t ind = 0; ind < NumPart; ind++) {
+                const auto stencil = get_precomputed_stencil<N, ORDER>(stencils, ind);
+                std::array<double, N> value;
+                value.fill(0.0);
+                stencil.for_each_cell([&](const std::array<int, N> & icoord, double w) {
+                    for (int idim = 0; idim < N; idim++)
+                        value[idim] += grid_vec[idim].get_real(icoord) * w;
+                });
+                for (int idim = 0; idim < N; idim++)
+                    interpolated_values_vec[idim][ind] = value[idim];
+            }
+        }
+
+        template <int N>
+        void
+        interpolate_grid_vector_to_particle_positions(const std::array<FFTWGrid<N>, N> & grid_vec,
+                                                      const ParticleInterpolationStencils<N> & stencils,
+                                                      std::array<std::vector<FloatType>, N> & interpolated_values_vec) {
+            const int order = stencils.get_order();
+            assert_mpi(order > 0, "[interpolate_grid_vector_to_particle_positions] The stencils are not computed\n");
+            if (order == 1)
+                interpolate_grid_vector_to_particle_positions<N, 1>(grid_vec, stencils, interpolated_values_vec);
+            if (order == 2)
+                interpolate_grid_vector_to_particle_positions<N, 2>(grid_vec, stencils, interpolated_values_vec);
+            if (order == 3)
+                interpolate_grid_vector_to_particle_positions<N, 3>(grid_vec, stencils, interpolated_values_vec);
+            if (order == 4)
+                interpolate_grid_vector_to_particle_positions<N, 4>(grid_vec, stencils, interpolated_values_vec);
+            if (order == 5)
+                interpolate_grid_vector_to_particle_positions<N, 5>(grid_vec, stencils, interpolated_values_vec);
+        }
+
+        //=======================================================================
+        // Ghost slices for particles outside the slab of the grid
+        //=======================================================================
+        template <int N>
+        GhostSlices<N>::GhostSlices(
+            const FFTWGrid<N> & grid, double xmin, double xmax, int n_extra_left, int n_extra_right) {
+            Nmesh = grid.get_nmesh();
+            num_cells_slice = grid.get_ntot_real_slice_alloc();
+
+            // One extra slice to the right in case x * Nmesh rounds up to the boundary
+            const int ixmin = int(std::floor(xmin * Nmesh));
+            const int ixmax = int(std::ceil(xmax * Nmesh));
+            x_start = ixmin - n_extra_left;
+            nslices = std::max(ixmax - ixmin, 0) + n_extra_left + n_extra_right + 1;
+            values.resize(nslices * num_cells_slice);
+
+            // The slab layout of the grid
+            ptrdiff_t Local_x_start = grid.get_local_x_start();
+            ptrdiff_t Local_nx = grid.get_local_nx();
+            auto x_start_per_task = FML::GatherFromTasks(&Local_x_start);
+            auto nx_per_task = FML::GatherFromTasks(&Local_nx);
+            std::vector<int> owner_of_slice(Nmesh);
+            for (int task = 0; task < FML::NTasks; task++)
+                for (ptrdiff_t ix = x_start_per_task[task]; ix < x_start_per_task[task] + nx_per_task[task]; ix++)
+                    owner_of_slice[ix] = task;
+
+            // The slices we send to each task: the local ghost slice and the slice in the grid of the owner
+            ghost_slices_to_task.assign(FML::NTasks, {});
+            std::vector<std::vector<int>> grid_slices_to_task(FML::NTasks);
+            for (int i = 0; i < nslices; i++) {
+                const int ix = int(((x_start + i) % Nmesh + Nmesh) % Nmesh);
+                const int task = owner_of_slice[ix];
+                ghost_slices_to_task[task].push_back(i);
+                grid_slices_to_task[task].push_back(int(ix - x_start_per_task[task]));
+            }
+
+            // Tell the owners which of their slices we have
+            grid_slices_from_task.assign(FML::NTasks, {});
+#ifdef USE_MPI
+            std::vector<int> n_to_send(FML::NTasks), n_to_recv(FML::NTasks);
+            for (int task = 0; task < FML::NTasks; task++)
+                n_to_send[task] = int(grid_slices_to_task[task].size());
+            MPI_Alltoall(n_to_send.data(), 1, MPI_INT, n_to_recv.data(), 1, MPI_INT, MPI_COMM_WORLD);
+            std::vector<int> send_offset(FML::NTasks, 0), recv_offset(FML::NTasks, 0);
+            for (int task = 1; task < FML::NTasks; task++) {
+                send_offset[task] = send_offset[task - 1] + n_to_send[task - 1];
+                recv_offset[task] = recv_offset[task - 1] + n_to_recv[task - 1];
+            }
+            std::vector<int> send_list, recv_list(recv_offset[FML::NTasks - 1] + n_to_recv[FML::NTasks - 1]);
+            for (auto & s : grid_slices_to_task)
+                send_list.insert(send_list.end(), s.begin(), s.end());
+            MPI_Alltoallv(send_list.data(),
+                          n_to_send.data(),
+                          send_offset.data(),
+                          MPI_INT,
+                          recv_list.data(),
+                          n_to_recv.data(),
+                          recv_offset.data(),
+                          MPI_INT,
+                          MPI_COMM_WORLD);
+            for (int task = 0; task < FML::NTasks; task++)
+                grid_slices_from_task[task].assign(recv_list.begin() + recv_offset[task],
+                                                   recv_list.begin() + recv_offset[task] + n_to_recv[task]);
+#else
+            grid_slices_from_task = grid_slices_to_task;
+#endif
+        }
+
+        template <int N>
+        void GhostSlices<N>::exchange(const std::vector<std::vector<int>> & send,
+                                      const std::vector<std::vector<int>> & recv,
+                                      const FloatType * send_base,
+                                      FloatType * recv_base,
+                                      bool add) const {
+            // Pack the slices we send in task order
+            std::vector<int> n_to_send(FML::NTasks), n_to_recv(FML::NTasks);
+            std::vector<int> send_offset(FML::NTasks, 0), recv_offset(FML::NTasks, 0);
+            for (int task = 0; task < FML::NTasks; task++) {
+                n_to_send[task] = int(send[task].size() * num_cells_slice * sizeof(FloatType));
+                n_to_recv[task] = int(recv[task].size() * num_cells_slice * sizeof(FloatType));
+                if (task > 0) {
+                    send_offset[task] = send_offset[task - 1] + n_to_send[task - 1];
+                    recv_offset[task] = recv_offset[task - 1] + n_to_recv[task - 1];
+                }
+            }
+            std::vector<FloatType> send_buffer, recv_buffer;
+            for (int task = 0; task < FML::NTasks; task++)
+                for (auto islice : send[task])
+                    send_buffer.insert(send_buffer.end(),
+                                       send_base + islice * num_cells_slice,
+                                       send_base + (islice + 1) * num_cells_slice);
+#ifdef USE_MPI
+            recv_buffer.resize((recv_offset[FML::NTasks - 1] + n_to_recv[FML::NTasks - 1]) / sizeof(FloatType));
+            MPI_Alltoallv(send_buffer.data(),
+                          n_to_send.data(),
+                          send_offset.data(),
+                          MPI_CHAR,
+                          recv_buffer.data(),
+                          n_to_recv.data(),
+                          recv_offset.data(),
+                          MPI_CHAR,
+                          MPI_COMM_WORLD);
 #else
-                        double dx = std::fabs(-x[idim] + go_left_right_or_stay);
+            recv_buffer = std::move(send_buffer);
 #endif
-                        w *= kernel<ORDER>(dx);
-                    }
 
-                    // Periodic BC
-                    std::array<int, N> icoord;
-                    icoord[0] = ix_nbor[0];
-                    for (int idim = 1; idim < N; idim++) {
-                        icoord[idim] = ix_nbor[idim];
-                        if (icoord[idim] >= Nmesh)
-                            icoord[idim] -= Nmesh;
-                        if (icoord[idim] < 0)
-                            icoord[idim] += Nmesh;
+            // Unpack (the same slice can appear several times if the ghost slices wrap around)
+            const FloatType * buffer = recv_buffer.data();
+            for (int task = 0; task < FML::NTasks; task++) {
+                for (auto islice : recv[task]) {
+                    FloatType * dest = recv_base + islice * num_cells_slice;
+                    if (add) {
+                        for (ptrdiff_t i = 0; i < num_cells_slice; i++)
+                            dest[i] += buffer[i];
+                    } else {
+                        std::copy(buffer, buffer + num_cells_slice, dest);
                     }
-
-                    // Add up
-                    for (int idim = 0; idim < N; idim++)
-                        value[idim] += grid_vec[idim].get_real(icoord) * w;
-                    sumweight += w;
+                    buffer += num_cells_slice;
                 }
-
-#ifdef DEBUG_INTERPOL
-                // Check that the weights sum up to unity
-                assert_mpi(std::fabs(sumweight - 1.0) < 1e-3,
-                           "[interpolate_grid_to_particle_positions] Possible problem with interpolation: weights does "
-                           "not sum to unity!");
-#endif
-
-                // Store the interpolated value
-                for (int idim = 0; idim < N; idim++)
-                    interpolated_values_vec[idim][ind] = value[idim];
             }
         }
 
-        template <int N, class T>
-        void interpolate_grid_vector_to_particle_positions(const std::array<FFTWGrid<N>, N> & grid,
-                                                           const T * part,
-                                                           size_t NumPart,
-                                                           std::array<std::vector<FloatType>, N> & interpolated_values,
-                                                           std::string interpolation_method) {
-            if (interpolation_method.compare("NGP") == 0)
-                interpolate_grid_vector_to_particle_positions<N, 1, T>(grid, part, NumPart, interpolated_values);
-            if (interpolation_method.compare("CIC") == 0)
-                interpolate_grid_vector_to_particle_positions<N, 2, T>(grid, part, NumPart, interpolated_values);
-            if (interpolation_method.compare("TSC") == 0)
-                interpolate_grid_vector_to_particle_positions<N, 3, T>(grid, part, NumPart, interpolated_values);
-            if (interpolation_method.compare("PCS") == 0)
-                interpolate_grid_vector_to_particle_positions<N, 4, T>(grid, part, NumPart, interpolated_values);
-            if (interpolation_method.compare("PQS") == 0)
-                interpolate_grid_vector_to_particle_positions<N, 5, T>(grid, part, NumPart, interpolated_values);
+        template <int N>
+        void GhostSlices<N>::add_to_grid(FFTWGrid<N> & grid) const {
+            assert_mpi(grid.get_nmesh() == Nmesh, "[GhostSlices::add_to_grid] Grid has the wrong size\n");
+            exchange(ghost_slices_to_task, grid_slices_from_task, values.data(), grid.get_real_grid(), true);
+        }
+
+        template <int N>
+        void GhostSlices<N>::fetch_from_grid(const FFTWGrid<N> & grid) {
+            assert_mpi(grid.get_nmesh() == Nmesh, "[GhostSlices::fetch_from_grid] Grid has the wrong size\n");
+            exchange(grid_slices_from_task, ghost_slices_to_task, grid.get_real_grid(), values.data(), false);
         }
 
         template <int N, int ORDER, class T>
-        void interpolate_grid_to_particle_positions(const FFTWGrid<N> & grid,
-                                                    const T * part,
-                                                    size_t NumPart,
-                                                    std::vector<FloatType> & interpolated_values) {
+        void particles_to_grid_rebalanced(const T * part,
+                                          size_t NumPart,
+                                          size_t NumPartTot,
+                                          FFTWGrid<N> & density,
+                                          double xmin,
+                                          double xmax) {
+            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            const int Nmesh = density.get_nmesh();
+            GhostSlices<N> ghost(density, xmin, xmax, nextra.first, nextra.second);
+            ghost.zero();
 
-            auto nextra = get_extra_slices_needed_by_order<ORDER>();
-            assert_mpi(grid.get_nmesh() > 0,
-                       "[interpolate_grid_to_particle_positions] Grid has to be already allocated!\n");
-            assert_mpi(grid.get_n_extra_slices_left() >= nextra.first and
-                           grid.get_n_extra_slices_right() >= nextra.second,
-                       "[interpolate_grid_to_particle_positions] Too few extra slices\n");
+            // Assign the particles to the ghost slices
+            const double norm_fac = density_normalization<N>(part, NumPart, NumPartTot, Nmesh);
+            constexpr bool has_mass = FML::PARTICLE::has_get_mass<T>();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t ipart = 0; ipart < NumPart; ipart++) {
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ipart]);
+                double weight = norm_fac;
+                if constexpr (has_mass)
+                    weight *= FML::PARTICLE::GetMass(part[ipart]);
+                const auto stencil = assignment_stencil<N, ORDER>(pos, Nmesh, ghost.get_x_start(), false);
+                stencil.for_each_cell([&](const std::array<int, N> & icoord, double w) {
+                    auto & value = ghost.get_real(icoord);
+#ifdef USE_OMP
+#pragma omp atomic update
+#endif
+                    value += FloatType(w * weight);
+                });
+            }
 
-            // We need to look at width^N cells in total
-            constexpr int widthtondim = FML::power(ORDER, N);
+            // Add them to the grid
+            density.fill_real_grid(-1.0);
+            ghost.add_to_grid(density);
+        }
 
-            // Fetch grid information
-            const auto Local_nx = grid.get_local_nx();
-            const auto Local_x_start = grid.get_local_x_start();
-            const int Nmesh = grid.get_nmesh();
+        template <int N, class T>
+        void particles_to_grid_rebalanced(const T * part,
+                                          size_t NumPart,
+                                          size_t NumPartTot,
+                                          FFTWGrid<N> & density,
+                                          std::string density_assignment_method,
+                                          double xmin,
+                                          double xmax) {
+            const int order = interpolation_order_from_name(density_assignment_method);
+            if (order == 1)
+                particles_to_grid_rebalanced<N, 1, T>(part, NumPart, NumPartTot, density, xmin, xmax);
+            if (order == 2)
+                particles_to_grid_rebalanced<N, 2, T>(part, NumPart, NumPartTot, density, xmin, xmax);
+            if (order == 3)
+                particles_to_grid_rebalanced<N, 3, T>(part, NumPart, NumPartTot, density, xmin, xmax);
+            if (order == 4)
+                particles_to_grid_rebalanced<N, 4, T>(part, NumPart, NumPartTot, density, xmin, xmax);
+            if (order == 5)
+                particles_to_grid_rebalanced<N, 5, T>(part, NumPart, NumPartTot, density, xmin, xmax);
+        }
 
-            // Allocate memory needed
-            interpolated_values.resize(NumPart);
+        template <int N, int ORDER, class T>
+        void interpolate_grid_vector_to_particle_positions_rebalanced(
+            const std::array<FFTWGrid<N>, N> & grid_vec,
+            const T * part,
+            size_t NumPart,
+            std::array<std::vector<FloatType>, N> & interpolated_values_vec,
+            double xmin,
+            double xmax) {
+            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            const int Nmesh = grid_vec[0].get_nmesh();
+            for (auto & i : interpolated_values_vec) {
+                if (i.size() < NumPart)
+                    i.resize(NumPart);
+            }
 
+            GhostSlices<N> ghost(grid_vec[0], xmin, xmax, nextra.first, nextra.second);
+            for (int idim = 0; idim < N; idim++) {
+                assert_mpi(grid_vec[idim].get_nmesh() == Nmesh,
+                           "[interpolate_grid_vector_to_particle_positions_rebalanced] All grids has to have the same "
+                           "size!\n");
+                ghost.fetch_from_grid(grid_vec[idim]);
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-            for (size_t ind = 0; ind < NumPart; ind++) {
-
-                // Positions in global grid in units of [Nmesh]
-                const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ind]);
-                std::array<double, N> x;
-                for (int idim = 0; idim < N; idim++)
-                    x[idim] = pos[idim] * Nmesh;
-
-                // Nearest grid-node in grid
-                // Also do some santity checks. Probably better to throw here if these tests kick in
-                std::array<int, N> ix;
-                [[maybe_unused]] std::array<int, N> ix_nbor;
-                for (int idim = 0; idim < N; idim++) {
-                    ix[idim] = int(x[idim]);
-                    if (idim == 0) {
-                        if (ix[0] == (Local_x_start + Local_nx))
-                            ix[0] = int(Local_x_start + Local_nx) - 1;
-                        if (ix[0] < Local_x_start)
-                            ix[0] = int(Local_x_start);
-                    } else {
-                        if (ix[idim] == Nmesh)
-                            ix[idim] = Nmesh - 1;
-                    }
+                for (size_t ind = 0; ind < NumPart; ind++) {
+                    const auto * pos = FML::PARTICLE::GetPos(const_cast<T *>(part)[ind]);
+                    const auto stencil =
+                        interpolation_stencil<N, ORDER>(pos, Nmesh, ghost.get_x_start(), ghost.get_nslices());
+                    double value = 0.0;
+                    stencil.for_each_cell(
+                        [&](const std::array<int, N> & icoord, double w) { value += ghost.get_real(icoord) * w; });
+                    interpolated_values_vec[idim][ind] = FloatType(value);
                 }
+            }
+        }
 
-                // Positions to distance from neareste grid-node
-                for (int idim = 0; idim < N; idim++) {
-                    x[idim] -= ix[idim];
-                }
+        template <int N, class T>
+        void interpolate_grid_vector_to_particle_positions_rebalanced(
+            const std::array<FFTWGrid<N>, N> & grid_vec,
+            const T * part,
+            size_t NumPart,
+            std::array<std::vector<FloatType>, N> & interpolated_values_vec,
+            std::string interpolation_method,
+            double xmin,
+            double xmax) {
+            const int order = interpolation_order_from_name(interpolation_method);
+            if (order == 1)
+                interpolate_grid_vector_to_particle_positions_rebalanced<N, 1, T>(
+                    grid_vec, part, NumPart, interpolated_values_vec, xmin, xmax);
+            if (order == 2)
+                interpolate_grid_vector_to_particle_positions_rebalanced<N, 2, T>(
+                    grid_vec, part, NumPart, interpolated_values_vec, xmin, xmax);
+            if (order == 3)
+                interpolate_grid_vector_to_particle_positions_rebalanced<N, 3, T>(
+                    grid_vec, part, NumPart, interpolated_values_vec, xmin, xmax);
+            if (order == 4)
+                interpolate_grid_vector_to_particle_positions_rebalanced<N, 4, T>(
+                    grid_vec, part, NumPart, interpolated_values_vec, xmin, xmax);
+            if (order == 5)
+                interpolate_grid_vector_to_particle_positions_rebalanced<N, 5, T>(
+                    grid_vec, part, NumPart, interpolated_values_vec, xmin, xmax);
+        }
+
+        template <int N, class T>
+        void interpolate_grid_vector_to_lagrangian_positions(
+            const std::array<FFTWGrid<N>, N> & grid_vec,
+            const T * part,
+            size_t NumPart,
+            int Npart_1D,
+            std::array<std::vector<FloatType>, N> & interpolated_values_vec,
+            std::string interpolation_method) {
+            assert_mpi(Npart_1D > 0,
+                       "[interpolate_grid_vector_to_lagrangian_positions] Npart_1D must be > 0. The particles must "
+                       "have been made with create_particle_grid\n");
+
+            // A point we interpolate to
+            struct LagrangianPoint {
+                double pos[N];
+                double * get_pos() { return pos; }
+                constexpr int get_ndim() const { return N; }
+            };
 
-                // From global ix to local ix
-                ix[0] -= int(Local_x_start);
+            // Find the task that has the Lagrangian position of each particle in its domain
+            auto x_min_per_task = FML::GatherFromTasks(&FML::xmin_domain);
+            const long long int npart_per_slice = FML::power(Npart_1D, N - 1);
+            std::vector<int> task_of_particle(NumPart);
+            std::vector<int> n_to_send(FML::NTasks, 0);
+            for (size_t i = 0; i < NumPart; i++) {
+                const long long int id = FML::PARTICLE::GetLagrangianID(const_cast<T *>(part)[i]);
+                const double x = (id / npart_per_slice) / double(Npart_1D);
+                const int task =
+                    int(std::upper_bound(x_min_per_task.begin(), x_min_per_task.end(), x) - x_min_per_task.begin()) -
+                    1;
+                task_of_particle[i] = std::max(task, 0);
+                n_to_send[task_of_particle[i]]++;
+            }
 
-                // If we are on the left or right of the cell determines how many cells
-                // we have to go left and right
-                std::array<int, N> xstart;
-                if (ORDER % 2 == 0) {
-                    for (int idim = 0; idim < N; idim++) {
-                        xstart[idim] = -ORDER / 2 + 1;
-#ifdef CELLCENTERSHIFTED
-                        xstart[idim] = -ORDER / 2;
-                        if (x[idim] > 0.5)
-                            xstart[idim] += 1;
-#endif
-                    }
-                } else {
-#ifndef CELLCENTERSHIFTED
-                    for (int idim = 0; idim < N; idim++) {
-                        xstart[idim] = -ORDER / 2;
-                        if (x[idim] > 0.5)
-                            xstart[idim] += 1;
-                    }
-#endif
-                }
+            // Sort the IDs by the task they go to. index_in_send is where particle i is in the send list
+            std::vector<int> send_offset(FML::NTasks, 0);
+            for (int task = 1; task < FML::NTasks; task++)
+                send_offset[task] = send_offset[task - 1] + n_to_send[task - 1];
+            std::vector<long long int> ids_to_send(NumPart);
+            std::vector<size_t> index_in_send(NumPart);
+            std::vector<int> count = send_offset;
+            for (size_t i = 0; i < NumPart; i++) {
+                index_in_send[i] = count[task_of_particle[i]]++;
+                ids_to_send[index_in_send[i]] = FML::PARTICLE::GetLagrangianID(const_cast<T *>(part)[i]);
+            }
 
-                // Interpolation
-                FloatType value = 0;
-                [[maybe_unused]] double sumweight = 0;
-                for (int i = 0; i < widthtondim; i++) {
-                    double w = 1.0;
-                    std::array<int, N> icoord;
-                    if constexpr (ORDER == 1) {
-                        icoord = ix;
-                    } else {
-                        for (int idim = 0, n = 1; idim < N; idim++, n *= ORDER) {
-                            int go_left_right_or_stay = xstart[idim] + (i / n % ORDER);
-                            ix_nbor[idim] = ix[idim] + go_left_right_or_stay;
-#ifdef CELLCENTERSHIFTED
-                            double dx = std::fabs(-x[idim] + go_left_right_or_stay + 0.5);
+            // Send the IDs to the tasks that has q
+            std::vector<int> n_to_recv(FML::NTasks, 0);
+            std::vector<int> recv_offset(FML::NTasks, 0);
+            std::vector<long long int> ids_recv;
+#ifdef USE_MPI
+            MPI_Alltoall(n_to_send.data(), 1, MPI_INT, n_to_recv.data(), 1, MPI_INT, MPI_COMM_WORLD);
+            for (int task = 1; task < FML::NTasks; task++)
+                recv_offset[task] = recv_offset[task - 1] + n_to_recv[task - 1];
+            ids_recv.resize(recv_offset[FML::NTasks - 1] + n_to_recv[FML::NTasks - 1]);
+            MPI_Alltoallv(ids_to_send.data(),
+                          n_to_send.data(),
+                          send_offset.data(),
+                          MPI_LONG_LONG,
+                          ids_recv.data(),
+                          n_to_recv.data(),
+                          recv_offset.data(),
+                          MPI_LONG_LONG,
+                          MPI_COMM_WORLD);
 #else
-                            double dx = std::fabs(-x[idim] + go_left_right_or_stay);
+            n_to_recv = n_to_send;
+            ids_recv = ids_to_send;
 #endif
-                            w *= kernel<ORDER>(dx);
-                        }
-
-                        // Periodic BC
-                        icoord[0] = ix_nbor[0];
-                        for (int idim = 1; idim < N; idim++) {
-                            icoord[idim] = ix_nbor[idim];
-                            if (icoord[idim] >= Nmesh)
-                                icoord[idim] -= Nmesh;
-                            if (icoord[idim] < 0)
-                                icoord[idim] += Nmesh;
-                        }
-                    }
 
-                    // Add up
-                    value += grid.get_real(icoord) * w;
-                    sumweight += w;
-                }
+            // Interpolate to the Lagrangian positions
+            std::vector<LagrangianPoint> points(ids_recv.size());
+            for (size_t i = 0; i < points.size(); i++)
+                FML::PARTICLE::lagrangian_position_from_id<N>(ids_recv[i], Npart_1D, points[i].pos);
+            std::array<std::vector<FloatType>, N> values_recv;
+            interpolate_grid_vector_to_particle_positions<N>(
+                grid_vec, points.data(), points.size(), values_recv, interpolation_method);
+            std::vector<FloatType> values_to_send(N * points.size());
+            for (size_t i = 0; i < points.size(); i++)
+                for (int idim = 0; idim < N; idim++)
+                    values_to_send[N * i + idim] = values_recv[idim][i];
 
-#ifdef DEBUG_INTERPOL
-                // Check that the weights sum up to unity
-                assert_mpi(std::fabs(sumweight - 1.0) < 1e-3,
-                           "[interpolate_grid_to_particle_positions] Possible problem with interpolation: weights does "
-                           "not sum to unity!");
+            // Send the values back
+            std::vector<FloatType> values(N * NumPart);
+#ifdef USE_MPI
+            for (int task = 0; task < FML::NTasks; task++) {
+                n_to_send[task] *= N * sizeof(FloatType);
+                send_offset[task] *= N * sizeof(FloatType);
+                n_to_recv[task] *= N * sizeof(FloatType);
+                recv_offset[task] *= N * sizeof(FloatType);
+            }
+            MPI_Alltoallv(values_to_send.data(),
+                          n_to_recv.data(),
+                          recv_offset.data(),
+                          MPI_CHAR,
+                          values.data(),
+                          n_to_send.data(),
+                          send_offset.data(),
+                          MPI_CHAR,
+                          MPI_COMM_WORLD);
+#else
+            values = std::move(values_to_send);
 #endif
 
-                // Store the interpolated value
-                interpolated_values[ind] = value;
-            }
+            for (auto & v : interpolated_values_vec)
+                v.resize(NumPart);
+            for (size_t i = 0; i < NumPart; i++)
+                for (int idim = 0; idim < N; idim++)
+                    interpolated_values_vec[idim][i] = values[N * index_in_send[i] + idim];
         }
 
         //=======================================================================
@@ -919,82 +2798,101 @@ namespace FML {
         //=======================================================================
         template <int N>
         void add_contribution_from_extra_slices(FFTWGrid<N> & density) {
+            add_contribution_from_extra_slices_async<N>(density).wait();
+        }
+
+        template <int N>
+        FML::GRID::FFTWGridHaloExchange add_contribution_from_extra_slices_async(FFTWGrid<N> & density) {
 
             auto Local_nx = density.get_local_nx();
             auto num_cells_slice = density.get_ntot_real_slice_alloc();
             int n_extra_left = density.get_n_extra_slices_left();
             int n_extra_right = density.get_n_extra_slices_right();
-            ;
 
-            std::vector<FloatType> buffer(num_cells_slice);
+            // One buffer per slice we receive. These are kept alive by the completion action below
+            auto buffers = std::make_shared<std::vector<std::vector<FloatType>>>(
+                n_extra_left + n_extra_right, std::vector<FloatType>(num_cells_slice));
+
+            FML::GRID::FFTWGridHaloExchange handle;
+#ifdef USE_MPI
+            int right_task = (ThisTask + 1) % NTasks;
+            int left_task = (ThisTask - 1 + NTasks) % NTasks;
+#endif
 
             // [1] Send to the right, recieve from left
             for (int i = 0; i < n_extra_right; i++) {
                 FloatType * extra_slice_right = density.get_real_grid_right() + num_cells_slice * i;
-                FloatType * slice_left = density.get_real_grid() + num_cells_slice * i;
-                FloatType * temp = buffer.data();
-
+                FloatType * temp = (*buffers)[i].data();
 #ifdef USE_MPI
-                MPI_Status status;
-
-                int send_to = (ThisTask + 1) % NTasks;
-                int recv_from = (ThisTask - 1 + NTasks) % NTasks;
-
-                MPI_Sendrecv(&(extra_slice_right[0]),
-                             int(sizeof(FloatType) * num_cells_slice),
-                             MPI_CHAR,
-                             send_to,
-                             0,
-                             &(temp[0]),
-                             int(sizeof(FloatType) * num_cells_slice),
-                             MPI_CHAR,
-                             int(recv_from),
-                             0,
-                             MPI_COMM_WORLD,
-                             &status);
+                MPI_Request request;
+                MPI_Irecv(temp,
+                          int(sizeof(FloatType) * num_cells_slice),
+                          MPI_CHAR,
+                          left_task,
+                          0,
+                          MPI_COMM_WORLD,
+                          &request);
+                handle.add_request(request);
+                MPI_Isend(extra_slice_right,
+                          int(sizeof(FloatType) * num_cells_slice),
+                          MPI_CHAR,
+                          right_task,
+                          0,
+                          MPI_COMM_WORLD,
+                          &request);
+                handle.add_request(request);
 #else
-                temp = extra_slice_right;
+                std::copy(extra_slice_right, extra_slice_right + num_cells_slice, temp);
 #endif
-
-                // Copy over data from temp
-                for (int j = 0; j < num_cells_slice; j++) {
-                    slice_left[j] += (temp[j] + 1.0);
-                }
             }
 
             // [2] Send to the left, recieve from right
             for (int i = 1; i <= n_extra_left; i++) {
                 FloatType * extra_slice_left = density.get_real_grid() - i * num_cells_slice;
-                FloatType * slice_right = density.get_real_grid() + num_cells_slice * (Local_nx - i);
-                FloatType * temp = buffer.data();
-
+                FloatType * temp = (*buffers)[n_extra_right + i - 1].data();
 #ifdef USE_MPI
-                MPI_Status status;
-
-                int send_to = (ThisTask - 1 + NTasks) % NTasks;
-                int recv_from = (ThisTask + 1) % NTasks;
-
-                MPI_Sendrecv(&(extra_slice_left[0]),
-                             int(sizeof(FloatType) * num_cells_slice),
-                             MPI_CHAR,
-                             send_to,
-                             0,
-                             &(temp[0]),
-                             int(sizeof(FloatType) * num_cells_slice),
-                             MPI_CHAR,
-                             recv_from,
-                             0,
-                             MPI_COMM_WORLD,
-                             &status);
+                MPI_Request request;
+                MPI_Irecv(temp,
+                          int(sizeof(FloatType) * num_cells_slice),
+                          MPI_CHAR,
+                          right_task,
+                          1,
+                          MPI_COMM_WORLD,
+                          &request);
+                handle.add_request(request);
+                MPI_Isend(extra_slice_left,
+                          int(sizeof(FloatType) * num_cells_slice),
+                          MPI_CHAR,
+                          left_task,
+                          1,
+                          MPI_COMM_WORLD,
+                          &request);
+                handle.add_request(request);
 #else
-                temp = extra_slice_left;
+                std::copy(extra_slice_left, extra_slice_left + num_cells_slice, temp);
 #endif
+            }
 
-                // Copy over data from temp
-                for (int j = 0; j < num_cells_slice; j++) {
-                    slice_right[j] += (temp[j] + 1.0);
+            // When all is recieved add it to the slices it belongs to
+            FloatType * grid = density.get_real_grid();
+            handle.set_on_completion([=]() {
+                for (int i = 0; i < n_extra_right; i++) {
+                    FloatType * slice_left = grid + num_cells_slice * i;
+                    const FloatType * temp = (*buffers)[i].data();
+                    for (int j = 0; j < num_cells_slice; j++) {
+                        slice_left[j] += (temp[j] + 1.0);
+                    }
                 }
-            }
+                for (int i = 1; i <= n_extra_left; i++) {
+                    FloatType * slice_right = grid + num_cells_slice * (Local_nx - i);
+                    const FloatType * temp = (*buffers)[n_extra_right + i - 1].data();
+                    for (int j = 0; j < num_cells_slice; j++) {
+                        slice_right[j] += (temp[j] + 1.0);
+                    }
+                }
+            });
+
+            return handle;
         }
 
         //=========================================================================================
@@ -1094,8 +2992,40 @@ namespace FML {
             }
         }
 
+        //==============================================================================
+        // Internal method. Fourier transform the density grid and the grid of the particles shifted
+        // by half a cell and put the mean of the two (alias cancellation) in the density grid
+        //==============================================================================
+        template <int N>
+        void combine_interlaced_grids(FFTWGrid<N> & density_grid_fourier, FFTWGrid<N> & density_grid_fourier2) {
+
+            // Fourier transform both grids in one go
+            FML::GRID::fftw_r2c_batched(std::vector<FFTWGrid<N> *>{&density_grid_fourier, &density_grid_fourier2});
+            const double shift = 1.0 / double(2 * density_grid_fourier.get_nmesh());
+
+            // The mean of the two grids (alias cancellation)
+            auto Local_nx = density_grid_fourier.get_local_nx();
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                const std::complex<FML::GRID::FloatType> I(0, 1);
+                for (auto && fourier_index : density_grid_fourier.get_fourier_range(islice, islice + 1)) {
+                    auto kvec = density_grid_fourier.get_fourier_wavevector_from_index(fourier_index);
+                    auto ksum = kvec[0];
+                    for (int idim = 1; idim < N; idim++)
+                        ksum += kvec[idim];
+                    auto norm = std::exp(I * FML::GRID::FloatType(ksum * shift));
+                    auto grid1 = density_grid_fourier.get_fourier_from_index(fourier_index);
+                    auto grid2 = density_grid_fourier2.get_fourier_from_index(fourier_index);
+                    density_grid_fourier.set_fourier_from_index(fourier_index, (grid1 + norm * grid2) / FML::GRID::FloatType(2.0));
+                }
+            }
+        }
+
         template <int N, class T>
-        void particles_to_fourier_grid_interlacing(T * part,
+        void particles_to_fourier_grid_interlacing(const T * part,
                                                    size_t NumPart,
                                                    size_t NumPartTot,
                                                    FFTWGrid<N> & density_grid_fourier,
@@ -1117,67 +3047,28 @@ namespace FML {
                     "FFTWGrid::particles_to_grid_interlacing::density_grid_fourier (reallocated)");
             }
 
-            // Bin particles to grid
-            particles_to_grid<N, T>(part, NumPart, NumPartTot, density_grid_fourier, density_assignment_method);
-
-            // Shift particles
-            const double shift = 1.0 / double(2 * Ngrid);
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (size_t i = 0; i < NumPart; i++) {
-                auto * pos = FML::PARTICLE::GetPos(part[i]);
-                pos[0] += shift;
-                for (int idim = 1; idim < N; idim++) {
-                    pos[idim] += shift;
-                    if (pos[idim] >= 1.0)
-                        pos[idim] -= 1.0;
-                }
-            }
-
-            // Bin shifted particles to grid
-            FFTWGrid<N> density_grid_fourier2(Ngrid, nleft, nright);
-            density_grid_fourier2.add_memory_label(
-                "FFTWGrid::particles_to_fourier_grid_interlacing::density_grid_fourier2");
-            particles_to_grid<N, T>(part, NumPart, NumPartTot, density_grid_fourier2, density_assignment_method);
-
-            // Shift particles back as not to ruin anything
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (size_t i = 0; i < NumPart; i++) {
-                auto * pos = FML::PARTICLE::GetPos(part[i]);
-                pos[0] -= shift;
-                for (int idim = 1; idim < N; idim++) {
-                    pos[idim] -= shift;
-                    if (pos[idim] < 0.0)
-                        pos[idim] += 1.0;
-                }
-            }
-
-            // Fourier transform
-            density_grid_fourier.fftw_r2c();
-            density_grid_fourier2.fftw_r2c();
-
-            // The mean of the two grids (alias cancellation)
-            auto Local_nx = density_grid_fourier.get_local_nx();
+            // Bin the particles and the particles shifted by half a cell to the two grids in one pass
+            auto & pool = FML::GRID::FFTWGridPool<N>::get();
+            FFTWGrid<N> density_grid_fourier2 = pool.checkout(
+                Ngrid, nleft, nright, "FFTWGrid::particles_to_fourier_grid_interlacing::density_grid_fourier2");
+            if (density_assignment_method.compare("NGP") == 0)
+                particles_to_grid_interlaced<N, 1, T>(
+                    part, NumPart, NumPartTot, density_grid_fourier, density_grid_fourier2);
+            if (density_assignment_method.compare("CIC") == 0)
+                particles_to_grid_interlaced<N, 2, T>(
+                    part, NumPart, NumPartTot, density_grid_fourier, density_grid_fourier2);
+            if (density_assignment_method.compare("TSC") == 0)
+                particles_to_grid_interlaced<N, 3, T>(
+                    part, NumPart, NumPartTot, density_grid_fourier, density_grid_fourier2);
+            if (density_assignment_method.compare("PCS") == 0)
+                particles_to_grid_interlaced<N, 4, T>(
+                    part, NumPart, NumPartTot, density_grid_fourier, density_grid_fourier2);
+            if (density_assignment_method.compare("PQS") == 0)
+                particles_to_grid_interlaced<N, 5, T>(
+                    part, NumPart, NumPartTot, density_grid_fourier, density_grid_fourier2);
 
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (int islice = 0; islice < Local_nx; islice++) {
-                const std::complex<FML::GRID::FloatType> I(0, 1);
-                for (auto && fourier_index : density_grid_fourier.get_fourier_range(islice, islice + 1)) {
-                    auto kvec = density_grid_fourier.get_fourier_wavevector_from_index(fourier_index);
-                    auto ksum = kvec[0];
-                    for (int idim = 1; idim < N; idim++)
-                        ksum += kvec[idim];
-                    auto norm = std::exp(I * FML::GRID::FloatType(ksum * shift));
-                    auto grid1 = density_grid_fourier.get_fourier_from_index(fourier_index);
-                    auto grid2 = density_grid_fourier2.get_fourier_from_index(fourier_index);
-                    density_grid_fourier.set_fourier_from_index(fourier_index, (grid1 + norm * grid2) / FML::GRID::FloatType(2.0));
-                }
-            }
+            combine_interlaced_grids<N>(density_grid_fourier, density_grid_fourier2);
+            pool.give_back(std::move(density_grid_fourier2));
         }
 
         template <int N, class T>
@@ -1197,6 +3088,119 @@ namespace FML {
             }
         }
 
+        //==============================================================================
+        // Assign the particles chunk by chunk. We add the particles with weight 1 (or the mass) on top of
+        // -1 (as the extra slices are added to the neighbor tasks assuming this) and normalize once we
+        // know the total number of particles (or the total mass)
+        //==============================================================================
+
+        template <int N, int ORDER, class T>
+        size_t particles_to_grid_streaming(const std::function<bool(std::vector<T> &)> & read_chunk,
+                                           FFTWGrid<N> & density,
+                                           FFTWGrid<N> * density_shifted) {
+
+            const auto nextra = get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(density.get_n_extra_slices_left() >= nextra.first and
+                           density.get_n_extra_slices_right() >= nextra.second,
+                       "[particles_to_grid_streaming] Too few extra slices\n");
+            if (density_shifted) {
+                assert_mpi(density_shifted->get_n_extra_slices_left() >= nextra.first and
+                               density_shifted->get_n_extra_slices_right() >= nextra.second + 1,
+                           "[particles_to_grid_streaming] Too few extra slices in the shifted grid\n");
+                assert_mpi(density.get_nmesh() == density_shifted->get_nmesh(),
+                           "[particles_to_grid_streaming] The two grids must have the same size\n");
+            }
+
+            const int Nmesh = density.get_nmesh();
+            const double shift = 1.0 / double(2 * Nmesh);
+
+            // Set whole grid (also extra slices) to -1.0
+            density.fill_real_grid(-1.0);
+            if (density_shifted)
+                density_shifted->fill_real_grid(-1.0);
+
+            // Read and assign the chunks
+            size_t NumPartTot = 0;
+            double total_mass = 0.0;
+            std::vector<T> chunk;
+            while (true) {
+                chunk.clear();
+                if (not read_chunk(chunk))
+                    break;
+                NumPartTot += chunk.size();
+                if constexpr (FML::PARTICLE::has_get_mass<T>()) {
+                    for (auto & p : chunk)
+                        total_mass += FML::PARTICLE::GetMass(p);
+                }
+                add_particles_to_grid<N, ORDER>(chunk.data(), chunk.size(), 1.0, density);
+
+                // Shift the particles in the chunk and add them to the shifted grid. No wrapping in x as we
+                // have an extra slice on the right
+                if (density_shifted) {
+                    for (auto & p : chunk) {
+                        auto * pos = FML::PARTICLE::GetPos(p);
+                        pos[0] += shift;
+                        for (int idim = 1; idim < N; idim++) {
+                            pos[idim] += shift;
+                            if (pos[idim] >= 1.0)
+                                pos[idim] -= 1.0;
+                        }
+                    }
+                    add_particles_to_grid<N, ORDER>(chunk.data(), chunk.size(), 1.0, *density_shifted);
+                }
+            }
+            chunk = std::vector<T>();
+            SumOverTasks(&NumPartTot, &total_mass);
+            assert_mpi(NumPartTot > 0, "[particles_to_grid_streaming] No particles to assign\n");
+            if constexpr (not FML::PARTICLE::has_get_mass<T>())
+                total_mass = double(NumPartTot);
+
+            // Extra slices only relevant if we have more than 1 task
+            std::vector<FFTWGrid<N> *> grids{&density};
+            if (density_shifted)
+                grids.push_back(density_shifted);
+            if (FML::NTasks > 1) {
+                std::vector<FML::GRID::FFTWGridHaloExchange> halos;
+                for (auto * grid : grids)
+                    halos.push_back(add_contribution_from_extra_slices_async<N>(*grid));
+                for (auto & halo : halos)
+                    halo.wait();
+            }
+
+            // Normalize to the mean density: delta = sum of weights / mean - 1
+            const double norm_fac = std::pow(double(Nmesh), N) / total_mass;
+            for (auto * grid : grids) {
+                auto Local_nx = grid->get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int islice = 0; islice < Local_nx; islice++) {
+                    for (auto && real_index : grid->get_real_range(islice, islice + 1)) {
+                        const double sum = grid->get_real_from_index(real_index) + 1.0;
+                        grid->set_real_from_index(real_index, sum * norm_fac - 1.0);
+                    }
+                }
+            }
+            return NumPartTot;
+        }
+
+        template <int N, class T>
+        size_t particles_to_grid_streaming(const std::function<bool(std::vector<T> &)> & read_chunk,
+                                           FFTWGrid<N> & density,
+                                           std::string density_assignment_method,
+                                           FFTWGrid<N> * density_shifted) {
+            const int order = interpolation_order_from_name(density_assignment_method);
+            if (order == 1)
+                return particles_to_grid_streaming<N, 1, T>(read_chunk, density, density_shifted);
+            if (order == 2)
+                return particles_to_grid_streaming<N, 2, T>(read_chunk, density, density_shifted);
+            if (order == 3)
+                return particles_to_grid_streaming<N, 3, T>(read_chunk, density, density_shifted);
+            if (order == 4)
+                return particles_to_grid_streaming<N, 4, T>(read_chunk, density, density_shifted);
+            return particles_to_grid_streaming<N, 5, T>(read_chunk, density, density_shifted);
+        }
+
     } // namespace INTERPOLATION
 } // namespace FML
 #endif
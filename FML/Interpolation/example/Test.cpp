@@ -0,0 +1,74 @@
+#include <FML/ComputePowerSpectra/ComputePowerSpectrum.h>
+#include <FML/Interpolation/ParticleGridInterpolation.h>
+#include <FML/MPIParticles/MPIParticles.h>
+
+//===================================================
+// Test that the methods are working as they should
+//===================================================
+
+template <int N>
+using FFTWGrid = FML::GRID::FFTWGrid<N>;
+
+template <int N>
+struct Particle {
+    double x[N];
+    constexpr int get_ndim() const { return N; }
+    double * get_pos() { return x; }
+};
+
+template <int N>
+void RunInterlacedNGPTests();
+
+int main() {
+
+    // Interlaced NGP assignment of particles in the last half cell in x
+    RunInterlacedNGPTests<2>();
+    RunInterlacedNGPTests<3>();
+    return 0;
+}
+
+template <int N>
+void RunInterlacedNGPTests() {
+
+    if (FML::ThisTask == 0)
+        std::cout << "Running interlaced NGP tests N = " << N << "\n";
+
+    // A regular lattice with one particle per cell at 3/4 of the cell. The interlaced grid shifts the particles
+    // half a cell so the last slab of particles ends up at x >= 1 and must be wrapped around to the first slab
+    // (with one task) or be added to the left neighbour (with several tasks)
+    const int Nmesh = 4 * FML::NTasks;
+    FML::PARTICLE::MPIParticles<Particle<N>> part;
+    part.create_particle_grid(Nmesh, 2.0, FML::xmin_domain, FML::xmax_domain);
+    for (auto & p : part) {
+        for (int idim = 0; idim < N; idim++) {
+            p.x[idim] += 0.75 / double(Nmesh);
+            if (p.x[idim] >= 1.0)
+                p.x[idim] -= 1.0;
+        }
+    }
+    part.communicate_particles();
+
+    // Both grids must be exactly uniform
+    const auto nleftright = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment("NGP");
+    FFTWGrid<N> density(Nmesh, nleftright.first, nleftright.second);
+    FFTWGrid<N> density_shifted(Nmesh, nleftright.first, nleftright.second + 1);
+    FML::INTERPOLATION::particles_to_grid_interlaced<N, 1>(
+        part.get_particles_ptr(), part.get_npart(), part.get_npart_total(), density, density_shifted);
+    for (auto && index : density.get_real_range()) {
+        assert(std::fabs(density.get_real_from_index(index)) < 1e-10);
+        assert(std::fabs(density_shifted.get_real_from_index(index)) < 1e-10);
+    }
+
+#ifdef USE_FFTW
+    // ...and so the interlaced power-spectrum must vanish
+    FML::CORRELATIONFUNCTIONS::PowerSpectrumBinning<N> pofk(Nmesh / 2);
+    pofk.subtract_shotnoise = false;
+    FML::CORRELATIONFUNCTIONS::compute_power_spectrum<N>(
+        Nmesh, part.get_particles_ptr(), part.get_npart(), part.get_npart_total(), pofk, "NGP", true);
+    for (int i = 0; i < pofk.n; i++)
+        assert(std::fabs(pofk.pofk[i]) < 1e-20);
+#endif
+
+    if (FML::ThisTask == 0)
+        std::cout << "Done\n" << std::flush;
+}
@@ -3,13 +3,27 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <iostream>
-#include <iterator>
 #include <limits>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
+#if defined(__unix__) || defined(__unix) || defined(unix) || (defined(__APPLE__) && defined(__MACH__))
+#define KDTREE_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <FML/Global/Global.h>
+#include <FML/MPIParticles/MPIParticles.h>
 #include <FML/ParticleTypes/ReflectOnParticleMethods.h>
 
 namespace FML {
@@ -35,12 +49,19 @@ namespace FML {
         template <typename T, typename U>
         using BinningFunction = std::function<void(int iprofile, T & p1, U & p2)>;
 
+        /// If false (the default) every task has all the tracers and the tasks share the profiles. If true every task
+        /// only has the tracers in its own x-domain [FML::xmin_domain, FML::xmax_domain) (e.g. from MPIParticles) and
+        /// computes the profiles of its own tracer1. Each task then builds a tree of its tracer2 plus the ones on
+        /// the other tasks within rmax of its domain (from FML::PARTICLE::get_particles_with_ghosts)
+        inline bool distributed_particles = false;
+
         //============================================================================
         // Compute profiles (paircounts) of tracer1 around tracer2 using a kdtree to speed it up
         // The binning function takes care of the binning.
         // Assumes position in [0,1], i.e. boxsize = 1.0
         // Uses threads (make sure binning functions do not lead to races)
-        // Uses MPI (each task does a part of the profiles)
+        // Uses MPI (each task does a part of the profiles or with distributed_particles
+        // each task does the profiles of its own tracer1)
         //============================================================================
         template <typename T, typename U>
         void GenericPairBinner(T * tracer1,
@@ -69,60 +90,37 @@ namespace FML {
                                   DVector & rbin_center,
                                   std::vector<DVector> & individual_density_profiles);
 
-        class KDNode {
-          public:
-            using KDNodePtr = std::shared_ptr<KDNode>;
-            size_t index;
-            point_t x;
-            KDNodePtr left;
-            KDNodePtr right;
-
-            // initializer
-            KDNode();
-            KDNode(const point_t &, const size_t &, const KDNodePtr &, const KDNodePtr &);
-            KDNode(const pointIndex &, const KDNodePtr &, const KDNodePtr &);
-            ~KDNode();
-
-            // getter
-            double coord(const size_t &);
-
-            // conversions
-            explicit operator bool();
-            explicit operator point_t();
-            explicit operator size_t();
-            explicit operator pointIndex();
-        };
-
-        using KDNodePtr = std::shared_ptr<KDNode>;
-
-        KDNodePtr NewKDNodePtr();
+        using pointIndexArr = typename std::vector<pointIndex>;
+        using pointVec = std::vector<point_t>;
 
         // Square euclidean distance
         inline double dist2(const point_t &, const point_t &);
-        inline double dist2(const KDNodePtr &, const KDNodePtr &);
 
         // Euclidean distance
         inline double dist(const point_t &, const point_t &);
-        inline double dist(const KDNodePtr &, const KDNodePtr &);
-
-        // Need for sorting
-        class comparer {
-          public:
-            size_t idx;
-            explicit comparer(size_t idx_);
-            inline bool compare_idx(const std::pair<std::vector<double>, size_t> &,
-                                    const std::pair<std::vector<double>, size_t> &);
-        };
-
-        using pointIndexArr = typename std::vector<pointIndex>;
-
-        inline void sort_on_idx(const pointIndexArr::iterator &, const pointIndexArr::iterator &, size_t idx);
-
-        using pointVec = std::vector<point_t>;
 
+        //============================================================================
+        // The tree is stored implicitly in one flat array: the points are reordered
+        // such that the node of the range [begin, end) is the median at
+        // mid = begin + (end - begin) / 2 (along the axis level % ndim) with the left
+        // subtree in [begin, mid) and the right subtree in [mid + 1, end). There are no
+        // node allocations and the coordinates of a subtree are contiguous in memory.
+        // The build uses nth_element and with OpenMP the two subtrees are built as
+        // separate tasks.
+        //
+        // A built tree can be saved with save and read back with load. The file is the
+        // two flat arrays after a small header so load can memory map it read-only: the
+        // tree is then not rebuilt and the processes on a node that load the same file
+        // share its pages. The file uses the byte order of the machine that wrote it.
+        //============================================================================
         class KDTree {
-            KDNodePtr root;
-            KDNodePtr leaf;
+            // The coordinates of the points in tree order (ndim per point) and their index in the input. They point
+            // into storage (the arrays we built or a memory mapped file) which is never changed after the tree is
+            // made so copies of the tree can share it
+            std::shared_ptr<const void> storage;
+            const double * coords{nullptr};
+            const size_t * indices{nullptr};
+            size_t npoints{0};
 
             // Modifications for a periodic box
             double boxsize{0.0};
@@ -130,10 +128,17 @@ namespace FML {
             int ndim{};
             int twotondim{};
 
-            KDNodePtr make_tree(const pointIndexArr::iterator & begin,
-                                const pointIndexArr::iterator & end,
-                                const size_t & length,
-                                const size_t & level);
+            // Subtrees smaller than this are built in the current task
+            static constexpr size_t parallel_build_min_size = 10000;
+
+            void make_tree(
+                const std::vector<double> & input_coords, indexArr & index, size_t begin, size_t end, int level);
+            void build(std::vector<double> input_coords);
+
+            // The coordinates of the point at position i in the tree
+            const double * point(size_t i) const { return &coords[i * ndim]; }
+            double dist2_to(size_t i, const point_t & pt) const;
+            pointIndex point_index(size_t i) const;
 
           public:
             KDTree() = default;
@@ -142,14 +147,15 @@ namespace FML {
             explicit KDTree(T * particles, size_t numpart, double boxsize = 0.0);
 
           private:
-            KDNodePtr nearest_(const KDNodePtr & branch,
-                               const point_t & pt,
-                               const size_t & level,
-                               const KDNodePtr & best,
-                               const double & best_dist);
+            void nearest_(size_t begin,
+                          size_t end,
+                          const point_t & pt,
+                          int level,
+                          size_t & best,
+                          double & best_dist) const;
 
-            // default caller
-            KDNodePtr nearest_(const point_t & pt);
+            // default caller (returns the position in the tree or size() if the tree is empty)
+            size_t nearest_(const point_t & pt) const;
 
           public:
             point_t nearest_point(const point_t & pt);
@@ -157,8 +163,13 @@ namespace FML {
             pointIndex nearest_pointIndex(const point_t & pt);
 
           private:
-            pointIndexArr
-            neighborhood_(const KDNodePtr & branch, const point_t & pt, const double & rad, const size_t & level);
+            template <class Function>
+            void neighborhood_(
+                size_t begin, size_t end, const point_t & pt, double rad2, int level, Function && function) const;
+
+            // Calls function(i) for all the points i within rad of pt (and its periodic images for a periodic box)
+            template <class Function>
+            void periodic_neighborhood_(const point_t & pt, double rad, Function && function) const;
 
           public:
             pointIndexArr neighborhood(const point_t & pt, const double & rad);
@@ -166,36 +177,47 @@ namespace FML {
             pointVec neighborhood_points(const point_t & pt, const double & rad);
 
             indexArr neighborhood_indices(const point_t & pt, const double & rad);
-        };
 
-        KDNode::KDNode() = default;
+            /// Calls function(index) with the index (in the input) of all the points within rad of pt. Like
+            /// neighborhood_indices, but without making a list of the points
+            template <class Function>
+            void for_each_neighbor(const point_t & pt, double rad, Function && function) const;
 
-        KDNode::KDNode(const point_t & pt, const size_t & idx_, const KDNodePtr & left_, const KDNodePtr & right_) {
-            x = pt;
-            index = idx_;
-            left = left_;
-            right = right_;
-        }
+            //============================================================================
+            // Batched queries. The query points are processed in a spatially sorted order
+            // (so consecutive queries visit the same parts of the tree) and in parallel
+            // with OpenMP. The results are in the order of the query points.
+            //============================================================================
 
-        KDNode::KDNode(const pointIndex & pi, const KDNodePtr & left_, const KDNodePtr & right_) {
-            x = pi.first;
-            index = pi.second;
-            left = left_;
-            right = right_;
-        }
+            /// The distances to the k nearest points (sorted, closest first) of all the query points (e.g. for kNN-CDF
+            /// statistics). For a periodic box the k-th distance must be less than boxsize / 2. If the tree has
+            /// fewer than k points we return the distances to all of them
+            std::vector<DVector> knn_distances(const pointVec & query_points, int k) const;
 
-        KDNode::~KDNode() = default;
+            /// The number of points within rad of all the query points
+            std::vector<size_t> neighborhood_counts(const pointVec & query_points, double rad) const;
 
-        double KDNode::coord(const size_t & idx) { return x.at(idx); }
-        KDNode::operator bool() { return (!x.empty()); }
-        KDNode::operator point_t() { return x; }
-        KDNode::operator size_t() { return index; }
-        KDNode::operator pointIndex() { return pointIndex(x, index); }
+            size_t size() const { return npoints; }
 
-        KDNodePtr NewKDNodePtr() {
-            KDNodePtr mynode = std::make_shared<KDNode>();
-            return mynode;
-        }
+            /// Save the tree to file (the flat arrays after a small header)
+            void save(std::string filename) const;
+            /// Load a tree saved with save. With use_mmap the file is memory mapped read-only (if the system
+            /// supports it) instead of read into memory. The file must then not be changed while the tree is in use
+            static KDTree load(std::string filename, bool use_mmap = true);
+
+          private:
+            using DistIndexHeap = std::vector<std::pair<double, size_t>>;
+            void knearest_(
+                size_t begin, size_t end, const point_t & pt, int level, size_t k, DistIndexHeap & heap) const;
+
+            // Loops over the periodic images we must search to find all points within rad of pt
+            template <class Function>
+            void for_each_search_point_(const point_t & pt, double rad, Function && function) const;
+        };
+
+        /// An order of the points that keeps points close in space close in the list (Morton order of the first
+        /// three coordinates on a grid of 2^10 cells per dimension spanning the points)
+        inline indexArr spatial_order(const pointVec & points);
 
         inline double dist2(const point_t & a, const point_t & b) {
             double distc = 0;
@@ -206,8 +228,6 @@ namespace FML {
             return distc;
         }
 
-        inline double dist2(const KDNodePtr & a, const KDNodePtr & b) { return dist2(a->x, b->x); }
-
         inline double dist(const point_t & a, const point_t & b) { return std::sqrt(dist2(a, b)); }
 
         // Distance within a periodic box
@@ -224,66 +244,174 @@ namespace FML {
             return dist;
         }
 
-        inline double dist(const KDNodePtr & a, const KDNodePtr & b) { return std::sqrt(dist2(a, b)); }
-
-        comparer::comparer(size_t idx_) : idx{idx_} {};
-
-        inline bool comparer::compare_idx(const pointIndex & a, const pointIndex & b) {
-            return (a.first.at(idx) < b.first.at(idx));
+        inline double KDTree::dist2_to(size_t i, const point_t & pt) const {
+            const double * x = point(i);
+            double distc = 0.0;
+            for (int idim = 0; idim < ndim; idim++) {
+                double di = x[idim] - pt[idim];
+                distc += di * di;
+            }
+            return distc;
         }
 
-        inline void
-        sort_on_idx(const pointIndexArr::iterator & begin, const pointIndexArr::iterator & end, size_t idx) {
-            comparer comp(idx);
-            comp.idx = idx;
-
-            using std::placeholders::_1;
-            using std::placeholders::_2;
+        inline pointIndex KDTree::point_index(size_t i) const {
+            return pointIndex(point_t(point(i), point(i) + ndim), indices[i]);
+        }
 
-            std::nth_element(
-                begin, begin + std::distance(begin, end) / 2, end, std::bind(&comparer::compare_idx, comp, _1, _2));
+        inline void KDTree::make_tree(
+            const std::vector<double> & input_coords, indexArr & index, size_t begin, size_t end, int level) {
+            const size_t length = end - begin;
+            if (length <= 1)
+                return;
+
+            // Put the median along the current axis in the middle
+            const size_t middle = begin + length / 2;
+            std::nth_element(index.begin() + begin,
+                             index.begin() + middle,
+                             index.begin() + end,
+                             [&](size_t a, size_t b) {
+                                 return input_coords[a * ndim + level] < input_coords[b * ndim + level];
+                             });
+
+            const int next_level = (level + 1) % ndim;
+#ifdef USE_OMP
+            if (length > parallel_build_min_size) {
+#pragma omp task shared(input_coords, index)
+                make_tree(input_coords, index, begin, middle, next_level);
+                make_tree(input_coords, index, middle + 1, end, next_level);
+#pragma omp taskwait
+                return;
+            }
+#endif
+            make_tree(input_coords, index, begin, middle, next_level);
+            make_tree(input_coords, index, middle + 1, end, next_level);
         }
 
-        using pointVec = std::vector<point_t>;
+        // The arrays of a tree we have built or read into memory
+        struct KDTreeArrays {
+            std::vector<double> coords;
+            indexArr indices;
+        };
 
-        KDNodePtr KDTree::make_tree(const pointIndexArr::iterator & begin,
-                                    const pointIndexArr::iterator & end,
-                                    const size_t & length,
-                                    const size_t & level) {
-            if (begin == end) {
-                return NewKDNodePtr(); // empty tree
-            }
+        inline void KDTree::build(std::vector<double> input_coords) {
+            npoints = ndim > 0 ? input_coords.size() / ndim : 0;
+            auto arrays = std::make_shared<KDTreeArrays>();
+            arrays->indices.resize(npoints);
+            for (size_t i = 0; i < npoints; i++)
+                arrays->indices[i] = i;
 
-            size_t dim = begin->first.size();
+#ifdef USE_OMP
+#pragma omp parallel
+#pragma omp single
+#endif
+            make_tree(input_coords, arrays->indices, 0, npoints, 0);
 
-            if (length > 1) {
-                sort_on_idx(begin, end, level);
-            }
+            // Store the coordinates in tree order
+            arrays->coords.resize(input_coords.size());
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < npoints; i++)
+                for (int idim = 0; idim < ndim; idim++)
+                    arrays->coords[i * ndim + idim] = input_coords[arrays->indices[i] * ndim + idim];
 
-            auto middle = begin + (length / 2);
+            coords = arrays->coords.data();
+            indices = arrays->indices.data();
+            storage = std::move(arrays);
+        }
 
-            auto l_begin = begin;
-            auto l_end = middle;
-            auto r_begin = middle + 1;
-            auto r_end = end;
+        // Header of the files made by KDTree::save. The coordinates and then the indices (as 64 bit integers)
+        // follow at the given (64 byte aligned) offsets
+        struct KDTreeFileHeader {
+            char magic[8]{'F', 'M', 'L', 'K', 'D', 'T', 'R', 'E'};
+            int version{1};
+            int ndim{0};
+            double boxsize{0.0};
+            uint64_t npoints{0};
+            uint64_t coords_offset{0};
+            uint64_t indices_offset{0};
+        };
 
-            size_t l_len = length / 2;
-            size_t r_len = length - l_len - 1;
+        inline void KDTree::save(std::string filename) const {
+            static_assert(sizeof(size_t) == sizeof(uint64_t), "KDTree::save assumes 64 bit size_t");
+            auto align = [](uint64_t bytes) { return (bytes + 63) / 64 * 64; };
+            KDTreeFileHeader header;
+            header.ndim = ndim;
+            header.boxsize = periodic ? boxsize : 0.0;
+            header.npoints = npoints;
+            header.coords_offset = align(sizeof(KDTreeFileHeader));
+            header.indices_offset = align(header.coords_offset + sizeof(double) * npoints * ndim);
+
+            std::ofstream fp(filename.c_str(), std::ios::binary);
+            if (not fp.is_open())
+                throw std::runtime_error("[KDTree::save] Could not open " + filename);
+            const char zeros[64]{};
+            fp.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            fp.write(zeros, header.coords_offset - sizeof(header));
+            fp.write(reinterpret_cast<const char *>(coords), sizeof(double) * npoints * ndim);
+            fp.write(zeros, header.indices_offset - header.coords_offset - sizeof(double) * npoints * ndim);
+            fp.write(reinterpret_cast<const char *>(indices), sizeof(size_t) * npoints);
+            if (not fp.good())
+                throw std::runtime_error("[KDTree::save] Failed to write " + filename);
+        }
 
-            KDNodePtr left;
-            if (l_len > 0 && dim > 0) {
-                left = make_tree(l_begin, l_end, l_len, (level + 1) % dim);
-            } else {
-                left = leaf;
-            }
-            KDNodePtr right;
-            if (r_len > 0 && dim > 0) {
-                right = make_tree(r_begin, r_end, r_len, (level + 1) % dim);
-            } else {
-                right = leaf;
+        inline KDTree KDTree::load(std::string filename, bool use_mmap) {
+            std::ifstream fp(filename.c_str(), std::ios::binary);
+            if (not fp.is_open())
+                throw std::runtime_error("[KDTree::load] Could not open " + filename);
+            KDTreeFileHeader header;
+            fp.read(reinterpret_cast<char *>(&header), sizeof(header));
+            fp.seekg(0, std::ios::end);
+            const uint64_t bytes_in_file = uint64_t(fp.tellg());
+            if (not fp.good() or std::memcmp(header.magic, KDTreeFileHeader().magic, sizeof(header.magic)) != 0)
+                throw std::runtime_error("[KDTree::load] " + filename + " is not a KDTree file");
+            if (header.version != KDTreeFileHeader().version or header.ndim <= 0 or
+                header.indices_offset + sizeof(size_t) * header.npoints != bytes_in_file)
+                throw std::runtime_error("[KDTree::load] " + filename + " has the wrong version or size");
+
+            KDTree tree;
+            tree.ndim = header.ndim;
+            tree.twotondim = FML::power(2, tree.ndim);
+            tree.boxsize = header.boxsize;
+            tree.periodic = header.boxsize != 0.0;
+            tree.npoints = header.npoints;
+
+#ifdef KDTREE_HAVE_MMAP
+            if (use_mmap) {
+                fp.close();
+                int fd = open(filename.c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw std::runtime_error("[KDTree::load] Could not open " + filename);
+                void * mapping = mmap(nullptr, bytes_in_file, PROT_READ, MAP_SHARED, fd, 0);
+                close(fd);
+                if (mapping == MAP_FAILED)
+                    throw std::runtime_error("[KDTree::load] mmap failed for " + filename);
+                // The searches jump around in the tree
+                madvise(mapping, bytes_in_file, MADV_RANDOM);
+                const char * data = static_cast<const char *>(mapping);
+                tree.coords = reinterpret_cast<const double *>(data + header.coords_offset);
+                tree.indices = reinterpret_cast<const size_t *>(data + header.indices_offset);
+                tree.storage = std::shared_ptr<const void>(
+                    mapping, [bytes_in_file](const void * ptr) { munmap(const_cast<void *>(ptr), bytes_in_file); });
+                return tree;
             }
+#else
+            (void)use_mmap;
+#endif
 
-            return std::make_shared<KDNode>(*middle, left, right);
+            auto arrays = std::make_shared<KDTreeArrays>();
+            arrays->coords.resize(header.npoints * header.ndim);
+            arrays->indices.resize(header.npoints);
+            fp.seekg(header.coords_offset);
+            fp.read(reinterpret_cast<char *>(arrays->coords.data()), sizeof(double) * arrays->coords.size());
+            fp.seekg(header.indices_offset);
+            fp.read(reinterpret_cast<char *>(arrays->indices.data()), sizeof(size_t) * arrays->indices.size());
+            if (not fp.good())
+                throw std::runtime_error("[KDTree::load] Failed to read " + filename);
+            tree.coords = arrays->coords.data();
+            tree.indices = arrays->indices.data();
+            tree.storage = std::move(arrays);
+            return tree;
         }
 
         inline double periodic_wrap(double x, double boxsize) {
@@ -296,32 +424,23 @@ namespace FML {
         KDTree::KDTree(T * part, size_t numpart, double boxsize) : boxsize(boxsize), periodic(boxsize != 0.0) {
             ndim = FML::PARTICLE::GetNDIM(T());
             twotondim = FML::power(2, ndim);
-            leaf = std::make_shared<KDNode>();
 
-            // iterators
-            pointIndexArr arr;
+            std::vector<double> input_coords(numpart * ndim);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
             for (size_t i = 0; i < numpart; i++) {
                 auto pos = FML::PARTICLE::GetPos(part[i]);
-                point_t pt(ndim);
                 for (int idim = 0; idim < ndim; idim++) {
-                    pt[idim] = pos[idim];
+                    input_coords[i * ndim + idim] = pos[idim];
                     if (periodic)
-                        pt[idim] = periodic_wrap(pt[idim], boxsize);
+                        input_coords[i * ndim + idim] = periodic_wrap(pos[idim], boxsize);
                 }
-                arr.push_back(pointIndex(pt, i));
             }
-
-            auto begin = arr.begin();
-            auto end = arr.end();
-
-            size_t length = arr.size();
-            size_t level = 0; // starting
-
-            root = KDTree::make_tree(begin, end, length, level);
+            build(std::move(input_coords));
         }
 
-        KDTree::KDTree(pointVec point_array, double boxsize) : boxsize(boxsize), periodic(boxsize != 0.0) {
-            leaf = std::make_shared<KDNode>();
+        inline KDTree::KDTree(pointVec point_array, double boxsize) : boxsize(boxsize), periodic(boxsize != 0.0) {
 
             // Store ndim and 2^ndim
             if (point_array.size() > 0) {
@@ -331,99 +450,59 @@ namespace FML {
                     twotondim *= 2;
             }
 
-            // iterators
-            pointIndexArr arr;
+            // Ensure all points are inside the box
+            std::vector<double> input_coords(point_array.size() * ndim);
             for (size_t i = 0; i < point_array.size(); i++) {
-                auto pt = point_array.at(i);
-
-                // Ensure all points are inside the box
-                if (periodic) {
-                    for (auto & xi : pt)
+                for (int idim = 0; idim < ndim; idim++) {
+                    double xi = point_array[i].at(idim);
+                    if (periodic)
                         xi = periodic_wrap(xi, boxsize);
+                    input_coords[i * ndim + idim] = xi;
                 }
-
-                arr.push_back(pointIndex(pt, i));
             }
-
-            auto begin = arr.begin();
-            auto end = arr.end();
-
-            size_t length = arr.size();
-            size_t level = 0; // starting
-
-            root = KDTree::make_tree(begin, end, length, level);
+            build(std::move(input_coords));
         }
 
-        KDNodePtr KDTree::nearest_(const KDNodePtr & branch,
-                                   const point_t & pt,
-                                   const size_t & level,
-                                   const KDNodePtr & best,
-                                   const double & best_dist) {
-            double d, dx, dx2;
-
-            if (!bool(*branch)) {
-                return NewKDNodePtr(); // basically, null
-            }
-
-            point_t branch_pt(*branch);
-            size_t dim = branch_pt.size();
-
-            d = dist2(branch_pt, pt);
-            dx = branch_pt.at(level) - pt.at(level);
-            dx2 = dx * dx;
+        inline void KDTree::nearest_(
+            size_t begin, size_t end, const point_t & pt, int level, size_t & best, double & best_dist) const {
+            if (begin >= end)
+                return;
 
-            KDNodePtr best_l = best;
-            double best_dist_l = best_dist;
+            const size_t middle = begin + (end - begin) / 2;
+            const double d = dist2_to(middle, pt);
+            const double dx = point(middle)[level] - pt[level];
+            const double dx2 = dx * dx;
 
             if (d < best_dist) {
-                best_dist_l = d;
-                best_l = branch;
+                best_dist = d;
+                best = middle;
             }
 
-            size_t next_lv = (level + 1) % dim;
-            KDNodePtr section;
-            KDNodePtr other;
-
             // select which branch makes sense to check
+            const int next_lv = (level + 1) % ndim;
             if (dx > 0) {
-                section = branch->left;
-                other = branch->right;
+                nearest_(begin, middle, pt, next_lv, best, best_dist);
+                // only check the other branch if it makes sense to do so
+                if (dx2 < best_dist)
+                    nearest_(middle + 1, end, pt, next_lv, best, best_dist);
             } else {
-                section = branch->right;
-                other = branch->left;
-            }
-
-            // keep nearest neighbor from further down the tree
-            KDNodePtr further = nearest_(section, pt, next_lv, best_l, best_dist_l);
-            if (!further->x.empty()) {
-                double dl = dist2(further->x, pt);
-                if (dl < best_dist_l) {
-                    best_dist_l = dl;
-                    best_l = further;
-                }
-            }
-            // only check the other branch if it makes sense to do so
-            if (dx2 < best_dist_l) {
-                further = nearest_(other, pt, next_lv, best_l, best_dist_l);
-                if (!further->x.empty()) {
-                    double dl = dist2(further->x, pt);
-                    if (dl < best_dist_l) {
-                        best_dist_l = dl;
-                        best_l = further;
-                    }
-                }
+                nearest_(middle + 1, end, pt, next_lv, best, best_dist);
+                if (dx2 < best_dist)
+                    nearest_(begin, middle, pt, next_lv, best, best_dist);
             }
-
-            return best_l;
-        };
+        }
 
         // default caller
-        KDNodePtr KDTree::nearest_(const point_t & pt) {
-            size_t level = 0;
-
-            // Modifications for a periodic box
+        inline size_t KDTree::nearest_(const point_t & pt) const {
+            const size_t npoints = size();
+            if (npoints == 0)
+                return npoints;
+            const size_t root = npoints / 2;
+
+            // Modifications for a periodic box. The distance to the closest periodic image is the periodic
+            // distance so we search all the images with the best distance found so far
             if (periodic) {
-                KDNodePtr nearest_ptr;
+                size_t nearest = root;
                 double nearest_dist = std::numeric_limits<double>::max();
 
                 // Compute the jump for to the periodic images we will visit
@@ -438,212 +517,251 @@ namespace FML {
                     for (int idim = 0, n = 1; idim < ndim; idim++, n *= 2) {
                         search_pt[idim] += (i / n % 2) * jump[idim];
                     }
-
-                    double branch_dist = dist2(point_t(*root), pt);
-                    auto current_nearest_ptr = nearest_(root,         // beginning of tree
-                                                        search_pt,    // point we are querying
-                                                        level,        // start from level 0
-                                                        root,         // best is the root
-                                                        branch_dist); // best_dist = branch_dist
-
-                    // Check if the minimum distance is the smallest we found so far
-                    point_t current_nearest_pt = point_t(*current_nearest_ptr);
-                    double current_nearest_dist = periodic_dist(current_nearest_pt, pt, boxsize);
-                    if (current_nearest_dist < nearest_dist) {
-                        nearest_dist = current_nearest_dist;
-                        nearest_ptr = current_nearest_ptr;
-                    }
+                    nearest_(0, npoints, search_pt, 0, nearest, nearest_dist);
                 }
-                return nearest_ptr;
+                return nearest;
             }
 
-            // KDNodePtr best = branch;
-            double branch_dist = dist2(point_t(*root), pt);
-            return nearest_(root,         // beginning of tree
-                            pt,           // point we are querying
-                            level,        // start from level 0
-                            root,         // best is the root
-                            branch_dist); // best_dist = branch_dist
-        };
-
-        point_t KDTree::nearest_point(const point_t & pt) { return point_t(*nearest_(pt)); };
-        size_t KDTree::nearest_index(const point_t & pt) { return size_t(*nearest_(pt)); };
-
-        pointIndex KDTree::nearest_pointIndex(const point_t & pt) {
-            KDNodePtr Nearest = nearest_(pt);
-            return pointIndex(point_t(*Nearest), size_t(*Nearest));
+            size_t nearest = root;
+            double branch_dist = dist2_to(root, pt);
+            nearest_(0, npoints, pt, 0, nearest, branch_dist);
+            return nearest;
         }
 
-        pointIndexArr
-        KDTree::neighborhood_(const KDNodePtr & branch, const point_t & pt, const double & rad, const size_t & level) {
-            double d, dx, dx2;
+        inline point_t KDTree::nearest_point(const point_t & pt) {
+            const size_t i = nearest_(pt);
+            return i < size() ? point_index(i).first : point_t();
+        }
 
-            if (!bool(*branch)) {
-                // branch has no point, means it is a leaf,
-                // no points to add
-                return pointIndexArr();
-            }
+        inline size_t KDTree::nearest_index(const point_t & pt) {
+            const size_t i = nearest_(pt);
+            return i < size() ? indices[i] : std::numeric_limits<size_t>::max();
+        }
 
-            size_t dim = pt.size();
+        inline pointIndex KDTree::nearest_pointIndex(const point_t & pt) {
+            const size_t i = nearest_(pt);
+            return i < size() ? point_index(i) : pointIndex(point_t(), std::numeric_limits<size_t>::max());
+        }
 
-            double r2 = rad * rad;
+        template <class Function>
+        void KDTree::neighborhood_(
+            size_t begin, size_t end, const point_t & pt, double rad2, int level, Function && function) const {
+            if (begin >= end)
+                return;
 
-            d = dist2(point_t(*branch), pt);
-            dx = point_t(*branch).at(level) - pt.at(level);
-            dx2 = dx * dx;
+            const size_t middle = begin + (end - begin) / 2;
+            const double d = dist2_to(middle, pt);
+            const double dx = point(middle)[level] - pt[level];
+            const double dx2 = dx * dx;
 
-            pointIndexArr nbh, nbh_s, nbh_o;
-            if (d <= r2) {
-                nbh.push_back(pointIndex(*branch));
-            }
+            if (d <= rad2)
+                function(middle);
 
-            KDNodePtr section;
-            KDNodePtr other;
+            const int next_lv = (level + 1) % ndim;
             if (dx > 0) {
-                section = branch->left;
-                other = branch->right;
+                neighborhood_(begin, middle, pt, rad2, next_lv, function);
+                if (dx2 < rad2)
+                    neighborhood_(middle + 1, end, pt, rad2, next_lv, function);
             } else {
-                section = branch->right;
-                other = branch->left;
-            }
-
-            nbh_s = neighborhood_(section, pt, rad, (level + 1) % dim);
-            nbh.insert(nbh.end(), nbh_s.begin(), nbh_s.end());
-            if (dx2 < r2) {
-                nbh_o = neighborhood_(other, pt, rad, (level + 1) % dim);
-                nbh.insert(nbh.end(), nbh_o.begin(), nbh_o.end());
+                neighborhood_(middle + 1, end, pt, rad2, next_lv, function);
+                if (dx2 < rad2)
+                    neighborhood_(begin, middle, pt, rad2, next_lv, function);
             }
-
-            return nbh;
-        };
-
-        pointIndexArr KDTree::neighborhood(const point_t & pt, const double & rad) {
-            size_t level = 0;
-            return neighborhood_(root, pt, rad, level);
         }
 
-        pointVec KDTree::neighborhood_points(const point_t & pt, const double & rad) {
-            size_t level = 0;
-
-            // Modification for a periodic box
-            if (periodic) {
+        template <class Function>
+        void KDTree::for_each_search_point_(const point_t & pt, double rad, Function && function) const {
+            if (not periodic) {
+                function(pt);
+                return;
+            }
 
-                // To avoid duplicated points we can only search over half the box at max
-                double radius = std::min(rad, boxsize / 2);
+            // Compute the jump for to the periodic images we will visit
+            point_t jump = pt;
+            for (int idim = 0; idim < ndim; idim++) {
+                jump[idim] = pt[idim] > boxsize / 2 ? -boxsize : +boxsize;
 
-                // Compute the jump for to the periodic images we will visit
-                point_t jump = pt;
-                for (int idim = 0; idim < ndim; idim++) {
-                    jump[idim] = pt[idim] > boxsize / 2 ? -boxsize : +boxsize;
+                // If the point is too far away from the boundary we don't
+                // have to search periodic images
+                double dist_from_boundary = pt[idim] < boxsize / 2 ? pt[idim] : boxsize - pt[idim];
+                if (dist_from_boundary > rad)
+                    jump[idim] = 0.0;
+            }
 
+            // Loop over all 2^NDIM possible search points
+            point_t search_pt(ndim);
+            for (int i = 0; i < twotondim; i++) {
+                bool skip = false;
+                for (int idim = 0, n = 1; idim < ndim; idim++, n *= 2) {
                     // If the point is too far away from the boundary we don't
                     // have to search periodic images
-                    double dist_from_boundary = pt[idim] < boxsize / 2 ? pt[idim] : boxsize - pt[idim];
-                    if (dist_from_boundary > radius)
-                        jump[idim] = 0.0;
-                }
-
-                // Loop over all 2^NDIM possible search points
-                std::vector<pointIndexArr> nbh_arr(twotondim);
-                size_t total = 0;
-                for (int i = 0; i < twotondim; i++) {
-                    point_t search_pt = pt;
-                    bool skip = false;
-                    for (int idim = 0, n = 1; idim < ndim; idim++, n *= 2) {
-                        // If the point is too far away from the boundary we don't
-                        // have to search periodic images
-                        int add = (i / n % 2);
-                        if (add == 1 and jump[idim] == 0.0) {
-                            skip = true;
-                            break;
-                        }
-
-                        search_pt[idim] += add * jump[idim];
+                    int add = (i / n % 2);
+                    if (add == 1 and jump[idim] == 0.0) {
+                        skip = true;
+                        break;
                     }
-                    if (skip)
-                        continue;
 
-                    nbh_arr[i] = neighborhood_(root, search_pt, radius, level);
-                    total += nbh_arr[i].size();
+                    search_pt[idim] = pt[idim] + add * jump[idim];
                 }
+                if (skip)
+                    continue;
 
-                pointVec nbhp;
-                nbhp.resize(total);
-                total = 0;
-                for (int i = 0; i < twotondim; i++) {
-                    std::transform(nbh_arr[i].begin(), nbh_arr[i].end(), nbhp.begin() + total, [](pointIndex x) {
-                        return x.first;
-                    });
-                    total += nbh_arr[i].size();
-                }
-                return nbhp;
+                function(search_pt);
             }
+        }
 
-            pointIndexArr nbh = neighborhood_(root, pt, rad, level);
-            pointVec nbhp;
-            nbhp.resize(nbh.size());
-            std::transform(nbh.begin(), nbh.end(), nbhp.begin(), [](pointIndex x) { return x.first; });
-            return nbhp;
+        template <class Function>
+        void KDTree::periodic_neighborhood_(const point_t & pt, double rad, Function && function) const {
+            // To avoid duplicated points we can only search over half the box at max
+            const double radius = periodic ? std::min(rad, boxsize / 2) : rad;
+            for_each_search_point_(pt, radius, [&](const point_t & search_pt) {
+                neighborhood_(0, size(), search_pt, radius * radius, 0, function);
+            });
         }
 
-        indexArr KDTree::neighborhood_indices(const point_t & pt, const double & rad) {
-            size_t level = 0;
+        template <class Function>
+        void KDTree::for_each_neighbor(const point_t & pt, double rad, Function && function) const {
+            periodic_neighborhood_(pt, rad, [&](size_t i) { function(indices[i]); });
+        }
 
-            if (periodic) {
-                // To avoid duplicated points we can only search over half the box at max
-                double radius = std::min(rad, boxsize / 2);
+        inline void KDTree::knearest_(
+            size_t begin, size_t end, const point_t & pt, int level, size_t k, DistIndexHeap & heap) const {
+            if (begin >= end)
+                return;
+
+            const size_t middle = begin + (end - begin) / 2;
+            const double d = dist2_to(middle, pt);
+            const double dx = point(middle)[level] - pt[level];
+            const double dx2 = dx * dx;
+
+            // Keep the k closest in a max-heap
+            if (heap.size() < k) {
+                heap.push_back({d, middle});
+                std::push_heap(heap.begin(), heap.end());
+            } else if (d < heap.front().first) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = {d, middle};
+                std::push_heap(heap.begin(), heap.end());
+            }
 
-                // Compute the jump for to the periodic images we will visit
-                point_t jump = pt;
-                for (int idim = 0; idim < ndim; idim++) {
-                    jump[idim] = pt[idim] > boxsize / 2 ? -boxsize : +boxsize;
+            const int next_lv = (level + 1) % ndim;
+            const size_t section_begin = dx > 0 ? begin : middle + 1;
+            const size_t section_end = dx > 0 ? middle : end;
+            const size_t other_begin = dx > 0 ? middle + 1 : begin;
+            const size_t other_end = dx > 0 ? end : middle;
+            knearest_(section_begin, section_end, pt, next_lv, k, heap);
+            if (heap.size() < k or dx2 < heap.front().first)
+                knearest_(other_begin, other_end, pt, next_lv, k, heap);
+        }
 
-                    // If the point is too far away from the boundary we don't
-                    // have to search periodic images
-                    double dist_from_boundary = pt[idim] < boxsize / 2 ? pt[idim] : boxsize - pt[idim];
-                    if (dist_from_boundary > radius)
-                        jump[idim] = 0.0;
-                }
+        inline std::vector<DVector> KDTree::knn_distances(const pointVec & query_points, int k) const {
+            const size_t nquery = query_points.size();
+            const size_t kmax = std::min(size_t(std::max(k, 0)), size());
+            const auto order = spatial_order(query_points);
 
-                // Loop over all 2^NDIM possible search points
-                std::vector<pointIndexArr> nbh_arr(twotondim);
-                size_t total = 0;
-                for (int i = 0; i < twotondim; i++) {
-                    point_t search_pt = pt;
-                    bool skip = false;
-                    for (int idim = 0, n = 1; idim < ndim; idim++, n *= 2) {
-                        // If the point is too far away from the boundary we don't
-                        // have to search periodic images
-                        int add = (i / n % 2);
-                        if (add == 1 and jump[idim] == 0.0) {
-                            skip = true;
-                            break;
-                        }
-
-                        search_pt[idim] += add * jump[idim];
+            std::vector<DVector> distances(nquery);
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+            {
+                // The heap is reused for all the queries of a thread
+                DistIndexHeap heap;
+                heap.reserve(kmax + 1);
+#ifdef USE_OMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+                for (size_t q = 0; q < nquery; q++) {
+                    const point_t & pt = query_points[order[q]];
+                    heap.clear();
+                    if (kmax > 0) {
+                        // The images of a periodic box share the heap so we only look for closer points in the next
+                        // image. With the k-th distance < boxsize/2 a point can only be close to one image
+                        for_each_search_point_(pt, periodic ? boxsize / 2 : 0.0, [&](const point_t & search_pt) {
+                            knearest_(0, size(), search_pt, 0, kmax, heap);
+                        });
                     }
-                    if (skip)
-                        continue;
+                    std::sort_heap(heap.begin(), heap.end());
+                    DVector & dist = distances[order[q]];
+                    dist.resize(heap.size());
+                    for (size_t i = 0; i < heap.size(); i++)
+                        dist[i] = std::sqrt(heap[i].first);
+                }
+            }
+            return distances;
+        }
 
-                    nbh_arr[i] = neighborhood_(root, search_pt, radius, level);
-                    total += nbh_arr[i].size();
+        inline std::vector<size_t> KDTree::neighborhood_counts(const pointVec & query_points, double rad) const {
+            const size_t nquery = query_points.size();
+            const auto order = spatial_order(query_points);
+
+            std::vector<size_t> counts(nquery, 0);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+            for (size_t q = 0; q < nquery; q++) {
+                size_t count = 0;
+                periodic_neighborhood_(query_points[order[q]], rad, [&](size_t) { count++; });
+                counts[order[q]] = count;
+            }
+            return counts;
+        }
+
+        inline indexArr spatial_order(const pointVec & points) {
+            const size_t npoints = points.size();
+            indexArr order(npoints);
+            for (size_t i = 0; i < npoints; i++)
+                order[i] = i;
+            if (npoints == 0)
+                return order;
+            const int ndim = std::min(int(points[0].size()), 3);
+
+            // The region spanned by the points
+            point_t xmin(ndim, std::numeric_limits<double>::max());
+            point_t xmax(ndim, std::numeric_limits<double>::lowest());
+            for (auto & pt : points) {
+                for (int idim = 0; idim < ndim; idim++) {
+                    xmin[idim] = std::min(xmin[idim], pt[idim]);
+                    xmax[idim] = std::max(xmax[idim], pt[idim]);
                 }
+            }
 
-                indexArr nbhi(total);
-                total = 0;
-                for (int i = 0; i < twotondim; i++) {
-                    std::transform(nbh_arr[i].begin(), nbh_arr[i].end(), nbhi.begin() + total, [](pointIndex x) {
-                        return x.second;
-                    });
-                    total += nbh_arr[i].size();
+            // The Morton key: interleave the bits of the cell coordinates
+            const int nbits = 10;
+            const int ncells = 1 << nbits;
+            std::vector<uint64_t> keys(npoints, 0);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < npoints; i++) {
+                uint64_t key = 0;
+                for (int idim = 0; idim < ndim; idim++) {
+                    const double length = xmax[idim] - xmin[idim];
+                    int icell = length > 0.0 ? int((points[i][idim] - xmin[idim]) / length * ncells) : 0;
+                    icell = std::min(icell, ncells - 1);
+                    for (int bit = 0; bit < nbits; bit++)
+                        key |= uint64_t((icell >> bit) & 1) << (bit * ndim + idim);
                 }
-                return nbhi;
+                keys[i] = key;
             }
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+            return order;
+        }
 
-            pointIndexArr nbh = neighborhood_(root, pt, rad, level);
+        inline pointIndexArr KDTree::neighborhood(const point_t & pt, const double & rad) {
+            pointIndexArr nbh;
+            neighborhood_(0, size(), pt, rad * rad, 0, [&](size_t i) { nbh.push_back(point_index(i)); });
+            return nbh;
+        }
+
+        inline pointVec KDTree::neighborhood_points(const point_t & pt, const double & rad) {
+            pointVec nbhp;
+            periodic_neighborhood_(pt, rad, [&](size_t i) { nbhp.push_back(point_t(point(i), point(i) + ndim)); });
+            return nbhp;
+        }
+
+        inline indexArr KDTree::neighborhood_indices(const point_t & pt, const double & rad) {
             indexArr nbhi;
-            nbhi.resize(nbh.size());
-            std::transform(nbh.begin(), nbh.end(), nbhi.begin(), [](pointIndex x) { return x.second; });
+            periodic_neighborhood_(pt, rad, [&](size_t i) { nbhi.push_back(indices[i]); });
             return nbhi;
         }
 
@@ -660,30 +778,44 @@ namespace FML {
             constexpr int ndim2 = FML::PARTICLE::GetNDIM(U());
             assert(ndim1 == ndim2);
 
+            // In the distributed case we need the tracers2 on the other tasks close to our domain (the ghosts)
+            std::vector<U> tracer2_with_ghosts;
+            if (distributed_particles) {
+                tracer2_with_ghosts = FML::PARTICLE::get_particles_with_ghosts(tracer2, npart2, rmax, periodic);
+                tracer2 = tracer2_with_ghosts.data();
+                npart2 = tracer2_with_ghosts.size();
+            }
+
             // Make kd-tree of tracer2 (galaxies)
             // If boxsize > 0.0 then the tree will be periodic
             double boxsize = periodic ? 1.0 : 0.0;
             const double radius = rmax;
             KDTree tree(tracer2, npart2, boxsize);
 
+            // Go through tracers1 in a spatially sorted order so that consecutive searches visit the same part
+            // of the tree
+            pointVec points1(npart1);
+            for (size_t i = 0; i < npart1; i++) {
+                auto pos1 = FML::PARTICLE::GetPos(tracer1[i]);
+                points1[i] = point_t(pos1, pos1 + ndim1);
+            }
+            const indexArr order = spatial_order(points1);
+
             // Loop over all tracers1
-            // With MPI each task does their part of the full profiles
+            // With MPI each task does their part of the full profiles (or all of their own in the distributed case)
+            const size_t qstart = distributed_particles ? 0 : FML::ThisTask;
+            const size_t qstep = distributed_particles ? 1 : FML::NTasks;
 #ifdef USE_OMP
 #pragma omp parallel for schedule(dynamic, 1)
 #endif
-            for (size_t i = FML::ThisTask; i < npart1; i += FML::NTasks) {
-                auto pos1 = FML::PARTICLE::GetPos(tracer1[i]);
-                point_t pt = point_t(pos1, pos1 + ndim1);
-
-                // Search in tree
-                auto nbor_index = tree.neighborhood_indices(pt, radius);
+            for (size_t q = qstart; q < npart1; q += qstep) {
+                const size_t i = order[q];
 
-                // Loop over all tracers2 we find
-                for (size_t j = 0; j < nbor_index.size(); j++) {
-                    auto index = nbor_index[j];
+                // Search in tree and loop over all tracers2 we find
+                tree.for_each_neighbor(points1[i], radius, [&](size_t index) {
                     // Callback to the function doing the binning
                     binning_function(i, tracer1[i], tracer2[index]);
-                }
+                });
             }
         }
 
@@ -752,8 +884,13 @@ namespace FML {
             // Do the binning
             GenericPairBinner(tracer1, npart1, tracer2, npart2, rmax, periodic, binning_function);
 
+            // The mean density is that of all the tracers2
+            size_t npart2_total = npart2;
+            if (distributed_particles)
+                FML::SumOverTasks(&npart2_total);
+
 #ifdef USE_MPI
-            for (size_t i = 0; i < bincount_individual.size(); i++)
+            for (size_t i = 0; i < bincount_individual.size() and not distributed_particles; i++)
                 MPI_Allreduce(MPI_IN_PLACE,
                               bincount_individual[i].data(),
                               bincount_individual[i].size(),
@@ -767,7 +904,7 @@ namespace FML {
             for (int bin_index = 0; bin_index < nbins; bin_index++) {
                 [[maybe_unused]] double r = rbin_center[bin_index];
 
-                double rho2_average = npart2;
+                double rho2_average = npart2_total;
                 double volume_bin = std::pow(M_PI, ndim2 / 2.0) / std::tgamma(ndim2 / 2.0 + 1.0) *
                                     (std::pow(rbin_edge[bin_index + 1], ndim2) - std::pow(rbin_edge[bin_index], ndim2));
 
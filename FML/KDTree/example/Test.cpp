@@ -1,4 +1,5 @@
 #include <FML/KDTree/KDTree.h>
+#include <cassert>
 #include <iostream>
 #include <vector>
 
@@ -221,6 +222,36 @@ void kdtree_from_points(int ndim) {
     }
 }
 
+// Save a tree and load it back (memory mapped and read into memory) and check that the searches agree
+void save_and_load_kdtree() {
+    const int ndim = 3;
+    const double boxsize = 1.0;
+    pointVec points(10000, point_t(ndim, 0.0));
+    for (auto & pt : points)
+        for (int i = 0; i < ndim; i++)
+            pt[i] = (rand() % RAND_MAX) / double(RAND_MAX);
+
+    KDTree tree(points, boxsize);
+    tree.save("kdtree.bin");
+    KDTree tree_mmap = KDTree::load("kdtree.bin");
+    KDTree tree_read = KDTree::load("kdtree.bin", false);
+
+    pointVec query(100, point_t(ndim, 0.0));
+    for (auto & pt : query)
+        for (int i = 0; i < ndim; i++)
+            pt[i] = (rand() % RAND_MAX) / double(RAND_MAX);
+    auto knn = tree.knn_distances(query, 8);
+    for (auto * loaded : {&tree_mmap, &tree_read}) {
+        assert(loaded->size() == tree.size());
+        assert(loaded->knn_distances(query, 8) == knn);
+        for (auto & pt : query) {
+            assert(loaded->nearest_index(pt) == tree.nearest_index(pt));
+            assert(loaded->neighborhood_indices(pt, 0.05) == tree.neighborhood_indices(pt, 0.05));
+        }
+    }
+    std::cout << "\n# Saved and loaded a kdTree with " << tree.size() << " points\n";
+}
+
 int main() {
 
     // Test the periodic kdTree
@@ -243,6 +274,9 @@ int main() {
     kdtree_from_points(2);
     kdtree_from_points(3);
 
+    // Save a tree and load it back
+    save_and_load_kdtree();
+
     // Minimal example
     minimal_kdtree_example();
 
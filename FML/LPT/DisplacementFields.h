@@ -35,6 +35,12 @@ namespace FML {
                                                            std::array<FFTWGrid<N>, N> & psi_real,
                                                            double DoverDini = 1.0);
 
+            template <int N>
+            void from_LPT_potential_to_displacement_component(const FFTWGrid<N> & phi_fourier,
+                                                              int idim,
+                                                              FFTWGrid<N> & psi_real,
+                                                              double DoverDini = 1.0);
+
             template <int N>
             void compute_1LPT_potential_fourier(const FFTWGrid<N> & delta_fourier, FFTWGrid<N> & phi_1LPT_fourier);
 
@@ -128,8 +134,9 @@ namespace FML {
                         psi[idim].add_memory_label(
                             "FFTWGrid::from_LPT_potential_to_displacement_vector_scaledependent::Psi_" +
                             std::to_string(idim));
-                        psi[idim].set_grid_status_real(false);
                     }
+                    psi[idim].set_grid_status_real(false);
+                    psi[idim].set_fourier_layout_transposed(phi.get_fourier_layout_transposed());
                 }
 
                 // Make a spline of the function (faster) if we have GSL otherwise this is
@@ -164,13 +171,11 @@ namespace FML {
                         psi[idim].set_fourier_from_index(0, 0.0);
 
                 // Fourier transform Psi
-                for (int idim = 0; idim < N; idim++) {
 #ifdef DEBUG_LPT
-                    if (FML::ThisTask == 0)
-                        std::cout << "Fourier transforming Dphi to real space: " << idim + 1 << " / " << N << "\n";
+                if (FML::ThisTask == 0)
+                    std::cout << "Fourier transforming Dphi to real space\n";
 #endif
-                    psi[idim].fftw_c2r();
-                }
+                FML::GRID::fftw_c2r_batched(psi);
             }
 
             //=================================================================================
@@ -214,24 +219,27 @@ namespace FML {
                     }
                 }
 
+                // Loop row by row so that the inner loop is over contiguous memory
+                const auto kz = phi.get_fourier_row_wavenumbers();
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
                 for (int islice = 0; islice < Local_nx; islice++) {
-                    [[maybe_unused]] double kmag;
-                    [[maybe_unused]] std::array<double, N> kvec;
-                    std::complex<FML::GRID::FloatType> I(0, 1);
-                    for (auto && fourier_index : psi[0].get_fourier_range(islice, islice + 1)) {
-                        if (Local_x_start == 0 and fourier_index == 0)
-                            continue; // DC mode (k=0)
-
-                        // Get wavevector and magnitude
-                        phi.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-
-                        // Psi_vec = D Phi => F[Psi_vec] = ik_vec F[Phi]
-                        auto value = phi.get_fourier_from_index(fourier_index) * FML::GRID::FloatType(DoverDini);
-                        for (int idim = 0; idim < N; idim++) {
-                            psi[idim].set_fourier_from_index(fourier_index, I * value * FML::GRID::FloatType(kvec[idim]));
+                    const std::complex<FML::GRID::FloatType> * phi_fourier = phi.get_fourier_grid();
+                    std::array<std::complex<FML::GRID::FloatType> *, N> psi_fourier;
+                    for (int idim = 0; idim < N; idim++)
+                        psi_fourier[idim] = psi[idim].get_fourier_grid();
+
+                    for (auto && row : phi.get_fourier_row_range(islice, islice + 1)) {
+                        for (int iz = 0; iz < row.n; iz++) {
+                            const auto fourier_index = row.index + iz;
+
+                            // Psi_vec = D Phi => F[Psi_vec] = ik_vec F[Phi]
+                            auto value = phi_fourier[fourier_index] * FML::GRID::FloatType(DoverDini);
+                            const std::complex<FML::GRID::FloatType> ivalue(-value.imag(), value.real());
+                            for (int idim = 0; idim < N - 1; idim++)
+                                psi_fourier[idim][fourier_index] = ivalue * FML::GRID::FloatType(row.kvec[idim]);
+                            psi_fourier[N - 1][fourier_index] = ivalue * FML::GRID::FloatType(kz[iz]);
                         }
                     }
                 }
@@ -242,13 +250,77 @@ namespace FML {
                         psi[idim].set_fourier_from_index(0, 0.0);
 
                 // Fourier transform Psi
-                for (int idim = 0; idim < N; idim++) {
 #ifdef DEBUG_LPT
-                    if (FML::ThisTask == 0)
-                        std::cout << "Fourier transforming Dphi to real space: " << idim + 1 << " / " << N << "\n";
+                if (FML::ThisTask == 0)
+                    std::cout << "Fourier transforming Dphi to real space\n";
 #endif
-                    psi[idim].fftw_c2r();
+                FML::GRID::fftw_c2r_batched(psi);
+            }
+
+            //=================================================================================
+            /// Generate a single component \f$ \Psi_i = \partial_i \phi \f$ of the displacement field from the LPT
+            /// potential \f$ \phi \f$. Useful when the components are consumed one at a time (e.g. interpolated to
+            /// particles) as we then only need one grid instead of N. If psi is already allocated (with the same size
+            /// as phi) its memory is reused.
+            ///
+            /// @tparam N The dimension of the grid
+            ///
+            /// @param[in] phi The LPT potential in fourier space
+            /// @param[in] idim The component we want
+            /// @param[out] psi The idim'th component of the displacement vector in real space
+            /// @param[in] DoverDini The growth factor at the time you want the displacement field to the growth factor
+            /// at which phi is at
+            ///
+            //=================================================================================
+            template <int N>
+            void from_LPT_potential_to_displacement_component(const FFTWGrid<N> & phi,
+                                                              int idim,
+                                                              FFTWGrid<N> & psi,
+                                                              double DoverDini) {
+
+                assert_mpi(phi.get_nmesh() > 0,
+                           "[from_LPT_potential_to_displacement_component] Grid has to be already allocated!");
+                assert_mpi(idim >= 0 and idim < N,
+                           "[from_LPT_potential_to_displacement_component] Component out of range");
+
+                auto nleft = phi.get_n_extra_slices_left();
+                auto nright = phi.get_n_extra_slices_right();
+                auto Nmesh = phi.get_nmesh();
+                auto Local_nx = phi.get_local_nx();
+                auto Local_x_start = phi.get_local_x_start();
+
+                // Create the output grid if it doesn't exist already
+                if (psi.get_nmesh() == 0) {
+                    psi = FFTWGrid<N>(Nmesh, nleft, nright);
+                    psi.add_memory_label("FFTWGrid::from_LPT_potential_to_displacement_component::Psi");
                 }
+                psi.set_grid_status_real(false);
+
+                // Loop row by row so that the inner loop is over contiguous memory
+                const auto kz = phi.get_fourier_row_wavenumbers();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int islice = 0; islice < Local_nx; islice++) {
+                    const std::complex<FML::GRID::FloatType> * phi_fourier = phi.get_fourier_grid();
+                    std::complex<FML::GRID::FloatType> * psi_fourier = psi.get_fourier_grid();
+                    for (auto && row : phi.get_fourier_row_range(islice, islice + 1)) {
+                        for (int iz = 0; iz < row.n; iz++) {
+                            const auto fourier_index = row.index + iz;
+                            const double k = idim == N - 1 ? kz[iz] : row.kvec[idim];
+
+                            // Psi_i = D_i Phi => F[Psi_i] = ik_i F[Phi]
+                            auto value = phi_fourier[fourier_index] * FML::GRID::FloatType(DoverDini * k);
+                            psi_fourier[fourier_index] = std::complex<FML::GRID::FloatType>(-value.imag(), value.real());
+                        }
+                    }
+                }
+
+                // Deal with DC mode
+                if (Local_x_start == 0)
+                    psi.set_fourier_from_index(0, 0.0);
+
+                psi.fftw_c2r();
             }
 
             //=================================================================================
@@ -289,22 +361,23 @@ namespace FML {
                 }
 
                 // Divide grid by k^2. Assuming delta was created in fourier-space so no FFTW normalization needed
+                // Loop row by row so that the inner loop is over contiguous memory
+                const auto kz = phi_1LPT_fourier.get_fourier_row_wavenumbers();
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
                 for (int islice = 0; islice < Local_nx; islice++) {
-                    [[maybe_unused]] double kmag2;
-                    [[maybe_unused]] std::array<double, N> kvec;
-                    for (auto && fourier_index : phi_1LPT_fourier.get_fourier_range(islice, islice + 1)) {
-                        if (Local_x_start == 0 and fourier_index == 0)
-                            continue; // DC mode (k=0)
-
-                        // Get wavevector and magnitude
-                        phi_1LPT_fourier.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
-
-                        // D^2 Phi_1LPT = -delta => F[Phi_1LPT] = F[delta] / k^2
-                        auto value = delta_fourier.get_fourier_from_index(fourier_index) / FML::GRID::FloatType(kmag2);
-                        phi_1LPT_fourier.set_fourier_from_index(fourier_index, value);
+                    const std::complex<FML::GRID::FloatType> * delta = delta_fourier.get_fourier_grid();
+                    std::complex<FML::GRID::FloatType> * phi = phi_1LPT_fourier.get_fourier_grid();
+                    for (auto && row : phi_1LPT_fourier.get_fourier_row_range(islice, islice + 1)) {
+                        for (int iz = 0; iz < row.n; iz++) {
+                            const auto fourier_index = row.index + iz;
+                            const double kmag2 = row.kmag2 + kz[iz] * kz[iz];
+
+                            // D^2 Phi_1LPT = -delta => F[Phi_1LPT] = F[delta] / k^2 (the DC mode is set to zero below)
+                            const double kernel = kmag2 > 0.0 ? 1.0 / kmag2 : 0.0;
+                            phi[fourier_index] = delta[fourier_index] * FML::GRID::FloatType(kernel);
+                        }
                     }
                 }
 
@@ -313,10 +386,53 @@ namespace FML {
                     phi_1LPT_fourier.set_fourier_from_index(0, 0.0);
             }
 
+            //=================================================================================
+            /// Set a grid to kernel(kvec, kmag2) * source in fourier space. Used to build the derivatives of the LPT
+            /// potentials (e.g. kernel = kikj/k^2 gives DiDj phi for D^2 phi = -source) one at a time so that we never
+            /// need to hold more of them in memory than we actually use. The DC mode is set to zero. The output grid
+            /// must already be allocated with the same size as the source and is left in fourier space.
+            ///
+            /// @tparam N The dimension of the grid
+            /// @tparam Kernel Callable as double(const std::array<double, N> & kvec, double kmag2)
+            ///
+            /// @param[in] source The grid in fourier space
+            /// @param[out] out The grid to store kernel * source in
+            /// @param[in] kernel The fourier space kernel (only evaluated for k != 0)
+            ///
+            //=================================================================================
+            template <int N, class Kernel>
+            void set_fourier_from_kernel(const FFTWGrid<N> & source, FFTWGrid<N> & out, Kernel && kernel) {
+                const auto Local_nx = source.get_local_nx();
+                const auto kz = source.get_fourier_row_wavenumbers();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int islice = 0; islice < Local_nx; islice++) {
+                    const std::complex<FML::GRID::FloatType> * in = source.get_fourier_grid();
+                    std::complex<FML::GRID::FloatType> * res = out.get_fourier_grid();
+                    for (auto && row : source.get_fourier_row_range(islice, islice + 1)) {
+                        std::array<double, N> kvec = row.kvec;
+                        for (int iz = 0; iz < row.n; iz++) {
+                            const auto fourier_index = row.index + iz;
+                            kvec[N - 1] = kz[iz];
+                            const double kmag2 = row.kmag2 + kz[iz] * kz[iz];
+                            const double value = kmag2 > 0.0 ? kernel(kvec, kmag2) : 0.0;
+                            res[fourier_index] = in[fourier_index] * FML::GRID::FloatType(value);
+                        }
+                    }
+                }
+                out.set_grid_status_real(false);
+            }
+
             //=================================================================================
             /// Generate the 2LPT potential defined as \f$ \Psi^{\rm 2LPT} = \nabla \phi^{\rm 2LPT} \f$ and \f$
             /// \nabla^2 \phi^{\rm 2LPT} = \ldots \f$. Returns the grid in Fourier space.
             ///
+            /// The source \f$ \frac{1}{2}[(\nabla^2\phi)^2 - \sum_{ij} (\phi_{,ij})^2] \f$ is accumulated on the fly:
+            /// the second derivatives of the 1LPT potential are computed one at a time in a single scratch grid and
+            /// squared into the output grid. Peak memory is 2 grids on top of delta (instead of N+1) at the cost of
+            /// one extra FFT (the real space delta, i.e. the laplacian).
+            ///
             /// @tparam N The dimension of the grid
             ///
             /// @param[in] delta The density contrast in fourier space
@@ -335,7 +451,7 @@ namespace FML {
 
 #ifdef DEBUG_LPT
                 if (FML::ThisTask == 0)
-                    std::cout << "Compute 2LPT potential (require N(N-1)/2 = 3 for N = 3 temporary grids)\n";
+                    std::cout << "Compute 2LPT potential (require 1 temporary grid)\n";
 #endif
 
                 auto nleft = delta.get_n_extra_slices_left();
@@ -344,178 +460,66 @@ namespace FML {
                 auto Local_nx = delta.get_local_nx();
                 auto Local_x_start = delta.get_local_x_start();
 
-                // Create grids
-                FFTWGrid<N> phi_1LPT_ii[N];
-                for (int i = 0; i < N; i++) {
-                    phi_1LPT_ii[i] = FFTWGrid<N>(Nmesh, nleft, nright);
-                    phi_1LPT_ii[i].add_memory_label("FFTWGrid::compute_2LPT_potential_fourier::phi_1LPT_ii_" +
-                                                    std::to_string(i));
-                    phi_1LPT_ii[i].set_grid_status_real(false);
-                }
-#ifdef DEBUG_LPT
-                if (FML::ThisTask == 0) {
-                    std::cout << "Compute [DiDi phi_1LPT] in fourier space\n";
-                }
-#endif
-
-                // Compute phi_xx, phi_yy, ...
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    [[maybe_unused]] double kmag2;
-                    [[maybe_unused]] std::array<double, N> kvec;
-                    for (auto && fourier_index : phi_1LPT_ii[0].get_fourier_range(islice, islice + 1)) {
-                        if (Local_x_start == 0 and fourier_index == 0)
-                            continue; // DC mode (k=0)
-
-                        // Get wavevector and magnitude
-                        delta.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
-
-                        // D^2Phi = -delta => F[DiDj Phi] = F[delta] kikj/k^2
-                        auto value = delta.get_fourier_from_index(fourier_index) / FML::GRID::FloatType(kmag2);
-
-                        for (int idim = 0; idim < N; idim++) {
-                            phi_1LPT_ii[idim].set_fourier_from_index(fourier_index, value * FML::GRID::FloatType(kvec[idim] * kvec[idim]));
-                        }
-                    }
-                }
-
-                // Deal with DC mode
-                if (Local_x_start == 0)
-                    for (int idim = 0; idim < N; idim++)
-                        phi_1LPT_ii[idim].set_fourier_from_index(0, 0.0);
-
-                // Fourier transform
-                for (int idim = 0; idim < N; idim++) {
-#ifdef DEBUG_LPT
-                    if (FML::ThisTask == 0)
-                        std::cout << "Fourier transform [DiDi phi_1LPT] to real space: " << idim + 1 << " / " << N
-                                  << "\n";
-#endif
-                    phi_1LPT_ii[idim].fftw_c2r();
-                }
-
-                // Crete output grid
+                // Crete output grid and a scratch grid for the derivatives
                 phi_2LPT = FFTWGrid<N>(Nmesh, nleft, nright);
                 phi_2LPT.add_memory_label("FFTWGrid::compute_2LPT_potential_fourier::phi_2LPT_fourier");
-                phi_2LPT.set_grid_status_real(true);
-
-                // Copy over source
-#ifdef DEBUG_LPT
-                if (FML::ThisTask == 0)
-                    std::cout << "Add 0.5[(D^2 phi_1LPT)^2 - DiDi phi_1LPT^2] to real space grid containing "
-                                 "(D^2phi_2LPT) \n";
-#endif
-
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    for (auto && real_index : phi_2LPT.get_real_range(islice, islice + 1)) {
-                        auto laplacian = 0.0, sum_squared = 0.0;
-                        for (int idim = 0; idim < N; idim++) {
-                            auto curpsi = phi_1LPT_ii[idim].get_real_from_index(real_index);
-                            laplacian += curpsi;
-                            sum_squared += curpsi * curpsi;
-                        }
-                        auto value = 0.5 * (laplacian * laplacian - sum_squared);
-                        phi_2LPT.set_real_from_index(real_index, value);
-                    }
-                }
-
-                // Free memory
-                for (int idim = 0; idim < N; idim++)
-                    phi_1LPT_ii[idim].free();
-
-                // Create grids
-                const int num_pairs = (N * (N - 1)) / 2;
-                FFTWGrid<N> phi_1LPT_ij[num_pairs];
-                for (int i = 0; i < num_pairs; i++) {
-                    phi_1LPT_ij[i] = FFTWGrid<N>(Nmesh, nleft, nright);
-                    phi_1LPT_ij[i].add_memory_label("FFTWGrid::compute_2LPT_potential_fourier::phi_1LPT_ij_" +
-                                                    std::to_string(i));
-                    phi_1LPT_ij[i].set_grid_status_real(false);
-                }
-
-                // Compute phi_xixj for all pairs of i,j
-#ifdef DEBUG_LPT
-                if (FML::ThisTask == 0)
-                    std::cout << "Compute [DiDj phi_1LPT] in fourier space\n";
-#endif
+                FFTWGrid<N> phi_1LPT_ij(Nmesh, nleft, nright);
+                phi_1LPT_ij.add_memory_label("FFTWGrid::compute_2LPT_potential_fourier::phi_1LPT_ij");
 
+                // Add factor * (DiDj phi_1LPT)^2 to the source (or set it if first = true)
+                auto add_squared_to_source = [&](double factor, bool first) {
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    [[maybe_unused]] double kmag2;
-                    [[maybe_unused]] std::array<double, N> kvec;
-                    for (auto && fourier_index : phi_1LPT_ij[0].get_fourier_range(islice, islice + 1)) {
-                        if (Local_x_start == 0 and fourier_index == 0)
-                            continue; // DC mode (k=0)
-
-                        // Get wavevector and magnitude
-                        delta.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
-
-                        auto value = delta.get_fourier_from_index(fourier_index) / FML::GRID::FloatType(kmag2);
-
-                        int pair = 0;
-                        for (int idim1 = 0; idim1 < N; idim1++) {
-                            for (int idim2 = idim1 + 1; idim2 < N; idim2++) {
-                                phi_1LPT_ij[pair++].set_fourier_from_index(fourier_index,
-                                                                           FML::GRID::FloatType(kvec[idim1] * kvec[idim2]) * value);
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        const FML::GRID::FloatType * phi_ij = phi_1LPT_ij.get_real_grid();
+                        FML::GRID::FloatType * source = phi_2LPT.get_real_grid();
+                        for (auto && row_index : phi_2LPT.get_real_row_range(islice, islice + 1)) {
+                            for (int iz = 0; iz < Nmesh; iz++) {
+                                const auto real_index = row_index + iz;
+                                const double value = phi_ij[real_index];
+                                const double term = factor * value * value;
+                                source[real_index] = first ? term : source[real_index] + term;
                             }
                         }
                     }
-                }
-
-                // Deal with DC mode
-                if (Local_x_start == 0)
-                    for (auto & g : phi_1LPT_ij)
-                        g.set_fourier_from_index(0, 0.0);
-
-                // Fourier transform
-                for (int pair = 0; pair < num_pairs; pair++) {
-#ifdef DEBUG_LPT
-                    if (FML::ThisTask == 0)
-                        std::cout << "Fourier transform [DiDj phi_1LPT] to real space: " << pair + 1 << " / "
-                                  << num_pairs << "\n";
-#endif
-                    phi_1LPT_ij[pair].fftw_c2r();
-                }
+                };
 
-                // Copy over source
+                // D^2 phi_1LPT = -delta so the laplacian is just delta in real space
 #ifdef DEBUG_LPT
                 if (FML::ThisTask == 0)
-                    std::cout << "Add [-DiDjphi_1LPT^2] to real space grid containing (D^2phi_2LPT) \n";
+                    std::cout << "Add 0.5(D^2 phi_1LPT)^2 to real space grid containing (D^2phi_2LPT)\n";
 #endif
-
-#ifdef USE_OMP
-#pragma omp parallel for
+                set_fourier_from_kernel(delta, phi_1LPT_ij, [](const std::array<double, N> &, double) { return 1.0; });
+                phi_1LPT_ij.fftw_c2r();
+                add_squared_to_source(0.5, true);
+
+                // Subtract 0.5 (DiDi phi_1LPT)^2 and (DiDj phi_1LPT)^2 for i < j. D^2Phi = -delta => F[DiDj Phi] =
+                // F[delta] kikj/k^2
+                for (int idim1 = 0; idim1 < N; idim1++) {
+                    for (int idim2 = idim1; idim2 < N; idim2++) {
+#ifdef DEBUG_LPT
+                        if (FML::ThisTask == 0)
+                            std::cout << "Add -[DiDj phi_1LPT]^2 for (i,j) = (" << idim1 << "," << idim2
+                                      << ") to real space grid containing (D^2phi_2LPT)\n";
 #endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    for (auto && real_index : phi_2LPT.get_real_range(islice, islice + 1)) {
-                        auto sum_squared = 0.0;
-                        for (int pair = 0; pair < num_pairs; pair++) {
-                            auto curpsi = phi_1LPT_ij[pair].get_real_from_index(real_index);
-                            sum_squared += curpsi * curpsi;
-                        }
-                        auto value = (phi_2LPT.get_real_from_index(real_index) - sum_squared);
-
-                        phi_2LPT.set_real_from_index(real_index, value);
+                        set_fourier_from_kernel(delta, phi_1LPT_ij, [&](const std::array<double, N> & kvec, double kmag2) {
+                            return kvec[idim1] * kvec[idim2] / kmag2;
+                        });
+                        phi_1LPT_ij.fftw_c2r();
+                        add_squared_to_source(idim1 == idim2 ? -0.5 : -1.0, false);
                     }
                 }
 
                 // Free memory
-                for (int pair = 0; pair < num_pairs; pair++) {
-                    phi_1LPT_ij[pair].free();
-                }
+                phi_1LPT_ij.free();
 
                 // Fourier transform source
 #ifdef DEBUG_LPT
                 if (FML::ThisTask == 0)
                     std::cout << "Fourier transform [D^2phi_2LPT] to fourier space\n";
 #endif
+                phi_2LPT.set_grid_status_real(true);
                 phi_2LPT.fftw_r2c();
 
                 // Divide by -k^2 and normalize
@@ -551,10 +555,9 @@ namespace FML {
             }
 
             //===========================================================================================
-            /// In this method we have so far given completely up what we do in the other methods
-            /// and try to be as memory efficient as possible. We can reduce the memory footprint of
-            /// this method with some work. Right now we allocate ~15 grid at the same time. It is possible to
-            /// get that down to ~10. This method is not well tested!
+            /// Compute the displacement field up to 3LPT. The potentials are computed with
+            /// compute_3LPT_potential_fourier (peak 13 grids for N = 3) and we then need 2N more grids for Psi and
+            /// dPsidt while the N+4 potentials are still alive. This method is not well tested!
             /// The units of the dlogDdt term is what sets the units of dPsidt
             /// In this methods the displacement field is assumed to be on the EdS/LCDM form
             /// Psi = D Psi1LPT + D^2 Psi2LPT + D^3 Psi3LPT i.e. each term multiplied with powers of D
@@ -593,7 +596,7 @@ namespace FML {
                 FFTWGrid<N> phi_2LPT_fourier;
                 FFTWGrid<N> phi_3LPT_a_fourier;
                 FFTWGrid<N> phi_3LPT_b_fourier;
-                compute_3LPT_potential_fourier(delta_fourier,
+                compute_3LPT_potential_fourier<N>(delta_fourier,
                                                phi_1LPT_fourier,
                                                phi_2LPT_fourier,
                                                phi_3LPT_a_fourier,
@@ -712,17 +715,23 @@ namespace FML {
                 }
 
                 // Fourier transform to real space and we are done
+                std::vector<FFTWGrid<N> *> grids;
                 for (int idim = 0; idim < N; idim++) {
-                    Psi[idim].fftw_c2r();
-                    dPsidt[idim].fftw_c2r();
+                    grids.push_back(&Psi[idim]);
+                    grids.push_back(&dPsidt[idim]);
                 }
+                FML::GRID::fftw_c2r_batched(grids);
             }
 
             //===========================================================================================
-            /// In this method we have so far given completely up what we do in the other methods
-            /// and try to be as memory efficient as possible. We can reduce the memory footprint of
-            /// this method with some work. Right now we allocate ~15 grid at the same time. It is possible to
-            /// get that down to ~10. This method is not well tested!
+            /// Compute the 1LPT, 2LPT and 3LPT potentials. This is memory-lean: the second derivatives of the
+            /// 2LPT potential are computed one at a time in a single scratch grid and accumulated straight into
+            /// the 3LPT b-term and vector potential sources (which are linear in them) so only the N(N+1)/2
+            /// second derivatives of the 1LPT potential are kept around. The 1LPT potential (a copy of delta) is
+            /// made at the very end. Peak number of grids allocated (on top of delta):
+            ///   N = 3: 13 (10 if ignore_curl_term)
+            ///   N = 2:  8 (7 if ignore_curl_term)
+            /// This method is not well tested!
             /// The potentials we output are normalized such that we can get the displacement field as
             /// Psi = D phi_1LPT + D phi_2LPT + D phi_3LPT_a + D phi_3PT_b + D x A_3LPT
             ///
@@ -766,229 +775,204 @@ namespace FML {
                 auto Local_nx = delta_fourier.get_local_nx();
                 auto Local_x_start = delta_fourier.get_local_x_start();
 
-                // Store -k^2phi_1LPT
-                phi_1LPT_fourier = delta_fourier;
-                phi_1LPT_fourier.add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_1LPT_fourier");
-
-                // Compute all terms phi_1LPT_ij. These are absolutely needed
+                // The pairs (i,j) with i <= j in the order xx, xy, (xz), yy, (yz, zz)
                 const int num_pairs = (N * (N + 1)) / 2;
-                FFTWGrid<N> phi_1LPT_ij[num_pairs];
-                for (int i = 0; i < num_pairs; i++) {
-                    phi_1LPT_ij[i] = FFTWGrid<N>(Nmesh, nleft, nright);
-                    phi_1LPT_ij[i].add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_1LPT_ij_" +
-                                                    std::to_string(i));
-                }
+                std::array<std::pair<int, int>, num_pairs> pairs;
+                for (int idim1 = 0, pair = 0; idim1 < N; idim1++)
+                    for (int idim2 = idim1; idim2 < N; idim2++)
+                        pairs[pair++] = {idim1, idim2};
 
+                // Compute all terms phi_1LPT_ij. These are absolutely needed
+                // D^2 phi_1LPT = -delta => F[DiDj phi_1LPT] = F[delta] kikj/k^2
+                std::array<FFTWGrid<N>, num_pairs> phi_1LPT_ij;
                 if (FML::ThisTask == 0)
                     std::cout << "Computing phi_1LPT_ij for all i,j...\n";
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    [[maybe_unused]] double kmag2;
-                    [[maybe_unused]] std::array<double, N> kvec;
-                    for (auto && fourier_index : phi_1LPT_fourier.get_fourier_range(islice, islice + 1)) {
-                        if (Local_x_start == 0 and fourier_index == 0)
-                            continue; // DC mode (k=0)
-
-                        // Get wavevector and magnitude
-                        phi_1LPT_fourier.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
-
-                        // phi_1LPT_fourier is delta so transform to LPT potential D^2 phi_1LPT = -delta
-                        auto value = -phi_1LPT_fourier.get_fourier_from_index(fourier_index) / FML::GRID::FloatType(kmag2);
-
-                        int pair = 0;
-                        for (int idim1 = 0; idim1 < N; idim1++) {
-                            for (int idim2 = idim1; idim2 < N; idim2++) {
-                                phi_1LPT_ij[pair++].set_fourier_from_index(fourier_index,
-                                                                           -value * FML::GRID::FloatType(kvec[idim1] * kvec[idim2]));
-                            }
-                        }
-                    }
+                for (int pair = 0; pair < num_pairs; pair++) {
+                    const int idim1 = pairs[pair].first;
+                    const int idim2 = pairs[pair].second;
+                    phi_1LPT_ij[pair] = FFTWGrid<N>(Nmesh, nleft, nright);
+                    phi_1LPT_ij[pair].add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_1LPT_ij_" +
+                                                       std::to_string(pair));
+                    set_fourier_from_kernel(
+                        delta_fourier, phi_1LPT_ij[pair], [&](const std::array<double, N> & kvec, double kmag2) {
+                            return kvec[idim1] * kvec[idim2] / kmag2;
+                        });
                 }
 
-                // Deal with DC mode
-                if (Local_x_start == 0)
-                    for (auto & g : phi_1LPT_ij)
-                        g.set_fourier_from_index(0, 0.0);
-
                 // Fourier transform it all to real-space
-                for (int i = 0; i < num_pairs; i++)
-                    phi_1LPT_ij[i].fftw_c2r();
+                FML::GRID::fftw_c2r_batched(phi_1LPT_ij);
 
-                // Compute 2LPT
+                // Compute the 2LPT source and the 3LPT a-term (which only depends on phi_1LPT_ij)
                 phi_2LPT_fourier = FFTWGrid<N>(Nmesh, nleft, nright);
                 phi_2LPT_fourier.add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_2LPT_fourier");
+                phi_3LPT_a_fourier = FFTWGrid<N>(Nmesh, nleft, nright);
+                phi_3LPT_a_fourier.add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_3LPT_a_fourier");
 
                 if (FML::ThisTask == 0)
-                    std::cout << "Computing phi_2LPT...\n";
+                    std::cout << "Computing phi_2LPT and phi_3LPT_a...\n";
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
                 for (int islice = 0; islice < Local_nx; islice++) {
                     for (auto && real_index : phi_2LPT_fourier.get_real_range(islice, islice + 1)) {
+                        std::array<double, num_pairs> psi1;
+                        for (int pair = 0; pair < num_pairs; pair++)
+                            psi1[pair] = phi_1LPT_ij[pair].get_real_from_index(real_index);
+
                         // Compute laplacian and sum of squares to get Sum_i,j Phi_iiPhi_jj Phi_ij^2
                         double laplacian = 0.0;
                         double sum_squared = 0.0;
-                        int pair = 0;
-                        for (int idim1 = 0; idim1 < N; idim1++) {
-                            auto phi_ij = phi_1LPT_ij[pair++].get_real_from_index(real_index);
-                            laplacian += phi_ij;
-                            sum_squared += phi_ij * phi_ij;
-                            for (int idim2 = idim1 + 1; idim2 < N; idim2++) {
-                                phi_ij = phi_1LPT_ij[pair++].get_real_from_index(real_index);
-                                sum_squared += 2.0 * phi_ij * phi_ij;
+                        for (int pair = 0; pair < num_pairs; pair++) {
+                            if (pairs[pair].first == pairs[pair].second) {
+                                laplacian += psi1[pair];
+                                sum_squared += psi1[pair] * psi1[pair];
+                            } else {
+                                sum_squared += 2.0 * psi1[pair] * psi1[pair];
                             }
                         }
                         phi_2LPT_fourier.set_real_from_index(real_index, 0.5 * (laplacian * laplacian - sum_squared));
-                    }
-                }
-
-                // Back to fourier space: We now have -k^2 phi_2LPT in this grid
-                phi_2LPT_fourier.fftw_r2c();
-
-                // Time to compute all the phi_2LPT_ij terms
-                FFTWGrid<N> phi_2LPT_ij[num_pairs];
-                for (int i = 0; i < num_pairs; i++) {
-                    phi_2LPT_ij[i] = FFTWGrid<N>(Nmesh, nleft, nright);
-                    phi_2LPT_ij[i].add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_2LPT_ij" +
-                                                    std::to_string(i));
-                }
-
-                if (FML::ThisTask == 0)
-                    std::cout << "Computing phi_2LPT_ij for all i,j...\n";
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    [[maybe_unused]] double kmag2;
-                    [[maybe_unused]] std::array<double, N> kvec;
-                    for (auto && fourier_index : phi_2LPT_fourier.get_fourier_range(islice, islice + 1)) {
-                        if (Local_x_start == 0 and fourier_index == 0)
-                            continue; // DC mode (k=0)
 
-                        // Get wavevector and magnitude
-                        phi_2LPT_fourier.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
-                        auto value = -phi_2LPT_fourier.get_fourier_from_index(fourier_index) / FML::GRID::FloatType(kmag2);
-
-                        int pair = 0;
-                        for (int idim1 = 0; idim1 < N; idim1++) {
-                            for (int idim2 = idim1; idim2 < N; idim2++) {
-                                phi_2LPT_ij[pair++].set_fourier_from_index(fourier_index,
-                                                                           -value * FML::GRID::FloatType(kvec[idim1] * kvec[idim2]));
-                            }
+                        double value_a;
+                        if constexpr (N == 2) {
+                            const auto psi1_xx = psi1[0], psi1_xy = psi1[1], psi1_yy = psi1[2];
+                            value_a = psi1_xx * psi1_yy - psi1_xy * psi1_xy;
+                        }
+                        if constexpr (N == 3) {
+                            const auto psi1_xx = psi1[0], psi1_xy = psi1[1], psi1_zx = psi1[2];
+                            const auto psi1_yy = psi1[3], psi1_yz = psi1[4], psi1_zz = psi1[5];
+                            value_a = psi1_xx * psi1_yy * psi1_zz;
+                            value_a += 2.0 * psi1_xy * psi1_yz * psi1_zx;
+                            value_a += -psi1_xx * psi1_yz * psi1_yz;
+                            value_a += -psi1_yy * psi1_zx * psi1_zx;
+                            value_a += -psi1_zz * psi1_xy * psi1_xy;
                         }
+                        phi_3LPT_a_fourier.set_real_from_index(real_index, value_a);
                     }
                 }
 
-                // Deal with DC mode
-                if (Local_x_start == 0)
-                    for (auto & g : phi_2LPT_ij)
-                        g.set_fourier_from_index(0, 0.0);
+                // Back to fourier space: We now have -k^2 phi_2LPT in this grid
+                phi_2LPT_fourier.fftw_r2c();
 
-                // Compute phi_3LPT_a
-                phi_3LPT_a_fourier = FFTWGrid<N>(Nmesh, nleft, nright);
-                phi_3LPT_a_fourier.add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_3LPT_a_fourier");
-                // Compute phi_3LPT_b
+                // The b-term and the vector potential are linear in phi_2LPT_ij so we accumulate them
+                // one phi_2LPT_ij at a time
                 phi_3LPT_b_fourier = FFTWGrid<N>(Nmesh, nleft, nright);
                 phi_3LPT_b_fourier.add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_3LPT_b_fourier");
+                phi_3LPT_b_fourier.fill_real_grid(0.0);
                 // And then finally the A-terms (for N=2 we only have 1 component)
-                if (not ignore_curl_term)
-                    for (int idim = 0; idim < N; idim++) {
-                        phi_3LPT_Avec_fourier[idim] = FFTWGrid<N>(Nmesh, nleft, nright);
-                        phi_3LPT_Avec_fourier[idim].add_memory_label(
-                            "FFTWGrid::compute_3LPT_potential_fourier::phi_3LPT_Avec_fourier" + std::to_string(idim));
-                        if constexpr (N == 2)
-                            break;
-                    }
+                const int num_Avec = ignore_curl_term ? 0 : (N == 2 ? 1 : N);
+                for (int idim = 0; idim < num_Avec; idim++) {
+                    phi_3LPT_Avec_fourier[idim] = FFTWGrid<N>(Nmesh, nleft, nright);
+                    phi_3LPT_Avec_fourier[idim].add_memory_label(
+                        "FFTWGrid::compute_3LPT_potential_fourier::phi_3LPT_Avec_fourier" + std::to_string(idim));
+                    phi_3LPT_Avec_fourier[idim].fill_real_grid(0.0);
+                }
+
+                FFTWGrid<N> phi_2LPT_ij(Nmesh, nleft, nright);
+                phi_2LPT_ij.add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_2LPT_ij");
 
                 if (FML::ThisTask == 0)
-                    std::cout << "Computing phi_3LPT...\n";
+                    std::cout << "Computing phi_3LPT_b and phi_3LPT_Avec...\n";
+                for (int pair = 0; pair < num_pairs; pair++) {
+                    const int idim1 = pairs[pair].first;
+                    const int idim2 = pairs[pair].second;
+
+                    // D^2 phi_2LPT = -(-k^2 phi_2LPT) => F[DiDj phi_2LPT] = F[-k^2 phi_2LPT] kikj/k^2
+                    set_fourier_from_kernel(
+                        phi_2LPT_fourier, phi_2LPT_ij, [&](const std::array<double, N> & kvec, double kmag2) {
+                            return kvec[idim1] * kvec[idim2] / kmag2;
+                        });
+                    phi_2LPT_ij.fftw_c2r();
+
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    for (auto && real_index : phi_2LPT_fourier.get_real_range(islice, islice + 1)) {
-
-                        if constexpr (N == 2) {
-                            auto psi1_xx = phi_1LPT_ij[0].get_real_from_index(real_index);
-                            auto psi1_xy = phi_1LPT_ij[1].get_real_from_index(real_index);
-                            auto psi1_yy = phi_1LPT_ij[2].get_real_from_index(real_index);
-                            auto psi2_xx = phi_2LPT_ij[0].get_real_from_index(real_index);
-                            auto psi2_xy = phi_2LPT_ij[1].get_real_from_index(real_index);
-                            auto psi2_yy = phi_2LPT_ij[2].get_real_from_index(real_index);
-
-                            auto value_a = psi1_xx * psi1_yy - psi1_xy * psi1_xy;
-                            auto value_b = psi1_xx * psi2_yy - psi1_xy * psi2_xy;
-
-                            phi_3LPT_a_fourier.set_real_from_index(real_index, value_a);
-                            phi_3LPT_b_fourier.set_real_from_index(real_index, value_b);
-                            if (not ignore_curl_term) {
-                                // Curl is a scalar in 2D (only the 'z' component is nonzero)
-                                auto Az = psi2_xy * (psi1_yy - psi1_xx) - psi1_xy * (psi2_yy - psi2_xx);
-                                phi_3LPT_Avec_fourier[0].set_real_from_index(real_index, Az);
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        for (auto && real_index : phi_2LPT_ij.get_real_range(islice, islice + 1)) {
+                            std::array<double, num_pairs> psi1;
+                            for (int p = 0; p < num_pairs; p++)
+                                psi1[p] = phi_1LPT_ij[p].get_real_from_index(real_index);
+                            const double psi2 = phi_2LPT_ij.get_real_from_index(real_index);
+
+                            // The coefficient of psi2_ij in the b-term and in the components of Avec
+                            double coeff_b = 0.0;
+                            std::array<double, N> coeff_A{};
+                            if constexpr (N == 2) {
+                                // value_b = psi1_xx * psi2_yy - psi1_xy * psi2_xy
+                                // Az = psi2_xy * (psi1_yy - psi1_xx) - psi1_xy * (psi2_yy - psi2_xx)
+                                const auto psi1_xx = psi1[0], psi1_xy = psi1[1], psi1_yy = psi1[2];
+                                switch (pair) {
+                                    case 0: // xx
+                                        coeff_A[0] = psi1_xy;
+                                        break;
+                                    case 1: // xy
+                                        coeff_b = -psi1_xy;
+                                        coeff_A[0] = psi1_yy - psi1_xx;
+                                        break;
+                                    case 2: // yy
+                                        coeff_b = psi1_xx;
+                                        coeff_A[0] = -psi1_xy;
+                                        break;
+                                }
                             }
-                        }
-                        if constexpr (N == 3) {
-                            auto psi1_xx = phi_1LPT_ij[0].get_real_from_index(real_index);
-                            auto psi1_xy = phi_1LPT_ij[1].get_real_from_index(real_index);
-                            auto psi1_zx = phi_1LPT_ij[2].get_real_from_index(real_index);
-                            auto psi1_yy = phi_1LPT_ij[3].get_real_from_index(real_index);
-                            auto psi1_yz = phi_1LPT_ij[4].get_real_from_index(real_index);
-                            auto psi1_zz = phi_1LPT_ij[5].get_real_from_index(real_index);
-
-                            auto psi2_xx = phi_2LPT_ij[0].get_real_from_index(real_index);
-                            auto psi2_xy = phi_2LPT_ij[1].get_real_from_index(real_index);
-                            auto psi2_zx = phi_2LPT_ij[2].get_real_from_index(real_index);
-                            auto psi2_yy = phi_2LPT_ij[3].get_real_from_index(real_index);
-                            auto psi2_yz = phi_2LPT_ij[4].get_real_from_index(real_index);
-                            auto psi2_zz = phi_2LPT_ij[5].get_real_from_index(real_index);
-
-                            auto value_a = psi1_xx * psi1_yy * psi1_zz;
-                            value_a += 2.0 * psi1_xy * psi1_yz * psi1_zx;
-                            value_a += -psi1_xx * psi1_yz * psi1_yz;
-                            value_a += -psi1_yy * psi1_zx * psi1_zx;
-                            value_a += -psi1_zz * psi1_xy * psi1_xy;
-
-                            auto value_b = 0.5 * psi1_xx * (psi2_yy + psi2_zz);
-                            value_b += 0.5 * psi1_yy * (psi2_zz + psi2_xx);
-                            value_b += 0.5 * psi1_zz * (psi2_xx + psi2_yy);
-                            value_b += -psi1_xy * psi2_xy - psi1_yz * psi2_yz - psi1_zx * psi2_zx;
-
-                            phi_3LPT_a_fourier.set_real_from_index(real_index, value_a);
-                            phi_3LPT_b_fourier.set_real_from_index(real_index, value_b);
-                            if (not ignore_curl_term) {
-                                auto value_Avec_x = psi1_zx * psi2_xy - psi2_zx * psi1_xy;
-                                value_Avec_x += psi1_yz * (psi2_yy - psi2_zz) - psi2_yz * (psi1_yy - psi1_zz);
-                                auto value_Avec_y = psi1_xy * psi2_yz - psi2_xy * psi1_yz;
-                                value_Avec_y += psi1_zx * (psi2_zz - psi2_xx) - psi2_zx * (psi1_zz - psi1_xx);
-                                auto value_Avec_z = psi1_yz * psi2_zx - psi2_yz * psi1_zx;
-                                value_Avec_z += psi1_xy * (psi2_xx - psi2_yy) - psi2_xy * (psi1_xx - psi1_yy);
-                                phi_3LPT_Avec_fourier[0].set_real_from_index(real_index, value_Avec_x);
-                                phi_3LPT_Avec_fourier[1].set_real_from_index(real_index, value_Avec_y);
-                                phi_3LPT_Avec_fourier[2].set_real_from_index(real_index, value_Avec_z);
+                            if constexpr (N == 3) {
+                                // value_b = 0.5 psi1_xx (psi2_yy + psi2_zz) + cyclic - psi1_xy psi2_xy - ...
+                                // Ax = psi1_zx psi2_xy - psi2_zx psi1_xy + psi1_yz (psi2_yy - psi2_zz) - psi2_yz (psi1_yy - psi1_zz)
+                                // and cyclic for Ay and Az
+                                const auto psi1_xx = psi1[0], psi1_xy = psi1[1], psi1_zx = psi1[2];
+                                const auto psi1_yy = psi1[3], psi1_yz = psi1[4], psi1_zz = psi1[5];
+                                switch (pair) {
+                                    case 0: // xx
+                                        coeff_b = 0.5 * (psi1_yy + psi1_zz);
+                                        coeff_A = {0.0, -psi1_zx, psi1_xy};
+                                        break;
+                                    case 1: // xy
+                                        coeff_b = -psi1_xy;
+                                        coeff_A = {psi1_zx, -psi1_yz, -(psi1_xx - psi1_yy)};
+                                        break;
+                                    case 2: // zx
+                                        coeff_b = -psi1_zx;
+                                        coeff_A = {-psi1_xy, -(psi1_zz - psi1_xx), psi1_yz};
+                                        break;
+                                    case 3: // yy
+                                        coeff_b = 0.5 * (psi1_xx + psi1_zz);
+                                        coeff_A = {psi1_yz, 0.0, -psi1_xy};
+                                        break;
+                                    case 4: // yz
+                                        coeff_b = -psi1_yz;
+                                        coeff_A = {-(psi1_yy - psi1_zz), psi1_xy, -psi1_zx};
+                                        break;
+                                    case 5: // zz
+                                        coeff_b = 0.5 * (psi1_xx + psi1_yy);
+                                        coeff_A = {-psi1_yz, psi1_zx, 0.0};
+                                        break;
+                                }
                             }
+
+                            phi_3LPT_b_fourier.set_real_from_index(
+                                real_index, phi_3LPT_b_fourier.get_real_from_index(real_index) + coeff_b * psi2);
+                            for (int idim = 0; idim < num_Avec; idim++)
+                                phi_3LPT_Avec_fourier[idim].set_real_from_index(
+                                    real_index,
+                                    phi_3LPT_Avec_fourier[idim].get_real_from_index(real_index) +
+                                        coeff_A[idim] * psi2);
                         }
                     }
                 }
 
                 // Free up memory
-                for (int i = 0; i < num_pairs; i++) {
-                    phi_1LPT_ij[i].free();
-                    phi_2LPT_ij[i].free();
-                }
-
-                // Fourier transform and voila we have -k^2phi_3LPT_a stored in phi_3LPT_a
-                phi_3LPT_a_fourier.fftw_r2c();
+                phi_2LPT_ij.free();
+                for (int pair = 0; pair < num_pairs; pair++)
+                    phi_1LPT_ij[pair].free();
 
-                // Fourier transform and voila we have -k^2phi_3LPT_b stored in phi_3LPT_b
-                phi_3LPT_b_fourier.fftw_r2c();
+                // Fourier transform and voila we have -k^2phi_3LPT_a, -k^2phi_3LPT_b and -k^2phi_3LPT_Avec
+                std::vector<FFTWGrid<N> *> grids{&phi_3LPT_a_fourier, &phi_3LPT_b_fourier};
+                for (int idim = 0; idim < num_Avec; idim++)
+                    grids.push_back(&phi_3LPT_Avec_fourier[idim]);
+                FML::GRID::fftw_r2c_batched(grids);
 
-                // Fourier transform and voila we have -k^2phi_3LPT_Avec stored in phi_3LPT_Avec
-                if (not ignore_curl_term) {
-                    for (int idim = 0; idim < N; idim++)
-                        phi_3LPT_Avec_fourier[idim].fftw_r2c();
-                }
+                // Store -k^2phi_1LPT
+                phi_1LPT_fourier = delta_fourier;
+                phi_1LPT_fourier.add_memory_label("FFTWGrid::compute_3LPT_potential_fourier::phi_1LPT_fourier");
 
                 // Divide by -1/k^2 and multiply by factor to make Psi = Dphi^1LPT + Dphi^2LPT + Dphi^3LPT + D x
                 // Avec^3LPT
@@ -1355,7 +1339,7 @@ namespace FML {
 
                 // Sanity checks
                 assert_mpi(
-                    FML::PARTICLE::has_get_q<T>(),
+                    FML::PARTICLE::has_get_q<T>() or FML::PARTICLE::has_lagrangian_position_from_id<T>(),
                     "[assign_displacement_fields_scaledependent] Particle must have Lagrangian position to use this");
                 if (LPT_potential_order == "1LPT") {
                     LPT_order = _1LPT;
@@ -1388,13 +1372,28 @@ namespace FML {
                 std::array<FFTWGrid<N>, N> psi_LPT_vector;
                 FML::COSMOLOGY::LPT::from_LPT_potential_to_displacement_vector_scaledependent(
                     LPT_potential_fourier, psi_LPT_vector, DoverDini_of_k);
+                std::array<FML::GRID::FFTWGridHaloExchange, N> halo_exchange;
                 for (int idim = 0; idim < N; idim++) {
-                    psi_LPT_vector[idim].communicate_boundaries();
+                    halo_exchange[idim] = psi_LPT_vector[idim].communicate_boundaries_async();
                 }
+                for (auto & h : halo_exchange)
+                    h.wait();
                 // Interpolate to particle positions after which we have Psi(q,t) in displacements
                 std::array<std::vector<FML::GRID::FloatType>, N> displacements;
-                FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions(
-                    psi_LPT_vector, part.get_particles_ptr(), part.get_npart(), displacements, interpolation_method);
+                if constexpr (FML::PARTICLE::has_lagrangian_position_from_id<T>()) {
+                    FML::INTERPOLATION::interpolate_grid_vector_to_lagrangian_positions(psi_LPT_vector,
+                                                                                        part.get_particles_ptr(),
+                                                                                        part.get_npart(),
+                                                                                        part.get_npart_1D(),
+                                                                                        displacements,
+                                                                                        interpolation_method);
+                } else {
+                    FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions(psi_LPT_vector,
+                                                                                      part.get_particles_ptr(),
+                                                                                      part.get_npart(),
+                                                                                      displacements,
+                                                                                      interpolation_method);
+                }
                 for (int idim = 0; idim < N; idim++) {
                     psi_LPT_vector[idim].free();
                 }
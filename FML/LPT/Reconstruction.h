@@ -2,6 +2,7 @@
 #define RECONSTRUCTION_HEADER
 #include <array>
 #include <cassert>
+#include <algorithm>
 #include <climits>
 #include <complex>
 #include <cstdio>
@@ -82,18 +83,20 @@ namespace FML {
 
                 const bool periodic_box = true;
 
-                // Normalize the los_direction to a unit vector
+                // Normalize the los_direction to a unit vector (for a survey it is the observer position)
                 assert_mpi(los_direction.size() == N,
                            "[RSDReconstructionFourierMethod] Line of sight direction has wrong dimension\n");
-                double norm = 0.0;
-                for (int idim = 0; idim < N; idim++) {
-                    norm += los_direction[idim] * los_direction[idim];
-                }
-                norm = 1.0 / std::sqrt(norm);
-                assert_mpi(norm > 0.0,
-                           "[RSDReconstructionFourierMethod] Line of sight vector cannot be the zero vector\n");
-                for (int idim = 0; idim < N; idim++) {
-                    los_direction[idim] *= norm;
+                if (not survey_data) {
+                    double norm = 0.0;
+                    for (int idim = 0; idim < N; idim++) {
+                        norm += los_direction[idim] * los_direction[idim];
+                    }
+                    assert_mpi(norm > 0.0,
+                               "[RSDReconstructionFourierMethod] Line of sight vector cannot be the zero vector\n");
+                    norm = 1.0 / std::sqrt(norm);
+                    for (int idim = 0; idim < N; idim++) {
+                        los_direction[idim] *= norm;
+                    }
                 }
 
                 // Do this iteratively
@@ -149,11 +152,12 @@ namespace FML {
                     // Subtract the RSD component (Psi*r)*r / (1+beta) for each particle
                     // Do periodic wrap and communicate particles in case they have left
                     // the current domain
-                    std::array<double, N> Psi_max;
-                    Psi_max.fill(0.0);
+                    double Psi_max[N];
+                    for (int idim = 0; idim < N; idim++)
+                        Psi_max[idim] = 0.0;
                     auto * p = part.get_particles_ptr();
 #ifdef USE_OMP
-#pragma omp parallel for
+#pragma omp parallel for reduction(max : Psi_max[:N])
 #endif
                     for (size_t i = 0; i < NumPart; i++) {
                         auto * pos = FML::PARTICLE::GetPos(p[i]);
@@ -178,17 +182,13 @@ namespace FML {
                         std::array<FloatType, N> Psi_rsd;
                         FloatType Psidotr = 0.0;
                         for (int idim = 0; idim < N; idim++) {
-                            Psidotr += los_direction[idim] * Psi_particle_positions[idim][i];
+                            Psidotr += r[idim] * Psi_particle_positions[idim][i];
                         }
                         for (int idim = 0; idim < N; idim++) {
-                            Psi_rsd[idim] = Psidotr * los_direction[idim] / (1.0 + beta);
+                            Psi_rsd[idim] = Psidotr * r[idim] / (1.0 + beta);
 
-#ifdef USE_OMP
-#pragma omp critical
-#endif
                             // Maximum shift
-                            if (std::abs(Psi_rsd[idim]) > Psi_max[idim])
-                                Psi_max[idim] = std::abs(Psi_rsd[idim]);
+                            Psi_max[idim] = std::max(Psi_max[idim], double(std::abs(Psi_rsd[idim])));
                         }
 
                         // For survey we need to have a box big enough so that we don't wrap around
@@ -222,6 +222,342 @@ namespace FML {
                     }
                 }
             }
+
+            //============================================================================
+            ///
+            /// Grid based iterative solver for the reconstruction equation
+            ///  \f$ \nabla\cdot\Psi + \beta \nabla\cdot((\Psi\cdot \hat{r})\hat{r}) = -\delta_{\rm tracer} \f$
+            /// (with the bias absorbed into \f$ \Psi \f$) for a fixed line of sight or a radial one (survey).
+            /// Unlike RSDReconstructionFourierMethod the particles are assigned to the grid only once: we iterate
+            /// on the displacement field itself, \f$ \Psi^{n+1} = (1-\omega)\Psi^n + \omega
+            /// \nabla\nabla^{-2}[\delta + \beta\nabla\cdot((\Psi^n\cdot\hat{r})\hat{r})] \f$, and stop when the
+            /// relative rms change in \f$ \Psi \f$ is below the tolerance. The relaxation \f$ \omega = 2/(2+\beta)
+            /// \f$ makes the iteration converge for any \f$ \beta \f$ (for a fixed line of sight the error is reduced
+            /// by at least a factor \f$ \beta/(2+\beta) \f$ per iteration).
+            ///
+            /// The converged \f$ \Psi \f$ can be used both to remove RSD (shift by \f$ \beta(\Psi\cdot\hat{r})\hat{r}
+            /// \f$) and for standard (Zel'dovich) BAO reconstruction (shift by \f$ \Psi \f$). Each iteration costs 1
+            /// r2c (N for a survey) and N c2r and we need N+2 grids.
+            ///
+            /// @tparam N The dimension of the grid
+            ///
+            /// @param[in] density_fourier The (smoothed) tracer density contrast in fourier space
+            /// @param[in] los_direction The fixed line of sight direction or the observer position if survey_data
+            /// @param[in] beta This is beta = f/b the growth-rate over the bias
+            /// @param[in] survey_data Use a radial line of sight from the observer at los_direction
+            /// @param[in] max_iterations Maximum number of iterations
+            /// @param[in] tolerance Stop when the relative rms change in Psi is less than this
+            /// @param[out] Psi The displacement field in real space (with boundaries communicated for CIC
+            /// interpolation)
+            ///
+            /// @return The number of iterations done
+            ///
+            //============================================================================
+            template <int N>
+            int RSDReconstructionSolveDisplacementField(const FFTWGrid<N> & density_fourier,
+                                                        std::vector<double> los_direction,
+                                                        double beta,
+                                                        bool survey_data,
+                                                        int max_iterations,
+                                                        double tolerance,
+                                                        std::array<FFTWGrid<N>, N> & Psi) {
+
+                const auto Nmesh = density_fourier.get_nmesh();
+                const auto Local_nx = density_fourier.get_local_nx();
+                assert_mpi(Nmesh > 0,
+                           "[RSDReconstructionSolveDisplacementField] Density grid has to be already allocated\n");
+                assert_mpi(los_direction.size() == N,
+                           "[RSDReconstructionSolveDisplacementField] Line of sight direction has wrong dimension\n");
+
+                // Normalize the los_direction to a unit vector (if its not the observer position)
+                if (not survey_data) {
+                    double norm = 0.0;
+                    for (int idim = 0; idim < N; idim++)
+                        norm += los_direction[idim] * los_direction[idim];
+                    assert_mpi(norm > 0.0,
+                               "[RSDReconstructionSolveDisplacementField] Line of sight vector cannot be the zero "
+                               "vector\n");
+                    for (int idim = 0; idim < N; idim++)
+                        los_direction[idim] /= std::sqrt(norm);
+                }
+
+                // Make the grids. Psi needs to be able to do CIC interpolation at the end
+                const auto nleftright = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment("CIC");
+                for (int idim = 0; idim < N; idim++) {
+                    Psi[idim] = FFTWGrid<N>(Nmesh, nleftright.first, nleftright.second);
+                    Psi[idim].add_memory_label("FFTWGrid::RSDReconstructionSolveDisplacementField::Psi_" +
+                                               std::to_string(idim));
+                }
+                FFTWGrid<N> source(Nmesh, nleftright.first, nleftright.second);
+                source.add_memory_label("FFTWGrid::RSDReconstructionSolveDisplacementField::source");
+                FFTWGrid<N> scratch(Nmesh, nleftright.first, nleftright.second);
+                scratch.add_memory_label("FFTWGrid::RSDReconstructionSolveDisplacementField::scratch");
+
+                const auto kz = density_fourier.get_fourier_row_wavenumbers();
+                const double omega = 2.0 / (2.0 + beta);
+
+                // Scratch = Psi_idim = D_idim D^-2 [from] in real space
+                auto compute_Psi_component = [&](int idim, const FFTWGrid<N> & from) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        const std::complex<FloatType> * src = from.get_fourier_grid();
+                        std::complex<FloatType> * res = scratch.get_fourier_grid();
+                        for (auto && row : from.get_fourier_row_range(islice, islice + 1)) {
+                            for (int iz = 0; iz < row.n; iz++) {
+                                const auto fourier_index = row.index + iz;
+                                const double kmag2 = row.kmag2 + kz[iz] * kz[iz];
+                                const double k = idim == N - 1 ? kz[iz] : row.kvec[idim];
+                                // D^2 phi = -src, Psi = D phi => F[Psi] = i k F[src] / k^2
+                                const FloatType fac = kmag2 > 0.0 ? k / kmag2 : 0.0;
+                                const auto value = src[fourier_index] * fac;
+                                res[fourier_index] = std::complex<FloatType>(-value.imag(), value.real());
+                            }
+                        }
+                    }
+                    scratch.set_grid_status_real(false);
+                    scratch.fftw_c2r();
+                };
+
+                // The unit line of sight vector at a given position
+                auto unit_los = [&](const std::array<double, N> & pos) {
+                    std::array<double, N> r;
+                    double norm2 = 0.0;
+                    for (int idim = 0; idim < N; idim++) {
+                        r[idim] = pos[idim] - los_direction[idim];
+                        norm2 += r[idim] * r[idim];
+                    }
+                    const double norm = norm2 > 0.0 ? 1.0 / std::sqrt(norm2) : 0.0;
+                    for (int idim = 0; idim < N; idim++)
+                        r[idim] *= norm;
+                    return r;
+                };
+
+                // Scratch = (Psi * r) r_idim in real space (for a fixed line of sight just Psi * r)
+                auto compute_Psi_dot_r = [&](int idim) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        for (auto && real_index : scratch.get_real_range(islice, islice + 1)) {
+                            std::array<double, N> r;
+                            if (survey_data) {
+                                r = unit_los(scratch.get_real_position(scratch.get_coord_from_index(real_index)));
+                            } else {
+                                for (int i = 0; i < N; i++)
+                                    r[i] = los_direction[i];
+                            }
+                            double Psidotr = 0.0;
+                            for (int i = 0; i < N; i++)
+                                Psidotr += Psi[i].get_real_from_index(real_index) * r[i];
+                            scratch.set_real_from_index(real_index, survey_data ? Psidotr * r[idim] : Psidotr);
+                        }
+                    }
+                    scratch.fftw_r2c();
+                };
+
+                // Start with the solution for beta = 0
+                for (int idim = 0; idim < N; idim++) {
+                    compute_Psi_component(idim, density_fourier);
+                    std::swap(Psi[idim], scratch);
+                }
+
+                int iteration = 1;
+                for (; iteration <= max_iterations and beta != 0.0; iteration++) {
+
+                    // Source = delta + beta D((Psi * r) r)
+                    for (int idim = 0; idim < (survey_data ? N : 1); idim++) {
+                        compute_Psi_dot_r(idim);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                        for (int islice = 0; islice < Local_nx; islice++) {
+                            std::complex<FloatType> * src = source.get_fourier_grid();
+                            const std::complex<FloatType> * term = scratch.get_fourier_grid();
+                            const std::complex<FloatType> * base =
+                                idim == 0 ? density_fourier.get_fourier_grid() : src;
+                            for (auto && row : source.get_fourier_row_range(islice, islice + 1)) {
+                                for (int iz = 0; iz < row.n; iz++) {
+                                    const auto fourier_index = row.index + iz;
+                                    std::array<double, N> kvec = row.kvec;
+                                    kvec[N - 1] = kz[iz];
+                                    double k = 0.0;
+                                    if (survey_data) {
+                                        k = kvec[idim];
+                                    } else {
+                                        for (int i = 0; i < N; i++)
+                                            k += kvec[i] * los_direction[i];
+                                    }
+                                    // F[D_i f] = i k_i F[f]
+                                    const auto value = term[fourier_index] * FloatType(beta * k);
+                                    src[fourier_index] =
+                                        base[fourier_index] + std::complex<FloatType>(-value.imag(), value.real());
+                                }
+                            }
+                        }
+                    }
+                    source.set_grid_status_real(false);
+
+                    // Update Psi and compute the relative change
+                    double dPsi2 = 0.0;
+                    double Psi2 = 0.0;
+                    for (int idim = 0; idim < N; idim++) {
+                        compute_Psi_component(idim, source);
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : dPsi2, Psi2)
+#endif
+                        for (int islice = 0; islice < Local_nx; islice++) {
+                            for (auto && real_index : scratch.get_real_range(islice, islice + 1)) {
+                                const double oldvalue = Psi[idim].get_real_from_index(real_index);
+                                const double newvalue =
+                                    (1.0 - omega) * oldvalue + omega * scratch.get_real_from_index(real_index);
+                                Psi[idim].set_real_from_index(real_index, newvalue);
+                                dPsi2 += (newvalue - oldvalue) * (newvalue - oldvalue);
+                                Psi2 += newvalue * newvalue;
+                            }
+                        }
+                    }
+                    FML::SumOverTasks(&dPsi2);
+                    FML::SumOverTasks(&Psi2);
+                    const double relative_change = Psi2 > 0.0 ? std::sqrt(dPsi2 / Psi2) : 0.0;
+
+                    if (FML::ThisTask == 0)
+                        std::cout << "[RSDReconstructionSolveDisplacementField] Iteration: " << iteration
+                                  << " relative change in Psi: " << relative_change << "\n";
+                    if (relative_change < tolerance)
+                        break;
+                }
+
+                for (int idim = 0; idim < N; idim++)
+                    Psi[idim].communicate_boundaries();
+
+                return std::min(iteration, max_iterations);
+            }
+
+            //============================================================================
+            ///
+            /// RSD removal for particles in a periodic box (or a survey) using the grid based iterative solver
+            /// RSDReconstructionSolveDisplacementField. The particles are assigned to the grid once, the
+            /// reconstruction equation is iterated on the grid until the relative change in the displacement field
+            /// is less than tolerance and then the particles are moved by \f$ -\beta(\Psi\cdot\hat{r})\hat{r} \f$.
+            ///
+            /// @tparam N The dimension of the grid
+            /// @tparam T The particle class
+            ///
+            /// @param[out] part MPIParticles. Particles gets updated.
+            /// @param[in] density_assignment_method The density assignment method (NGP, CIC, TSC, PCS, PQS)
+            /// @param[in] los_direction The fixed line of sight direction, e.g. (0,0,1) for the z-axis, or the
+            /// observer position if survey_data
+            /// @param[in] Nmesh The size of the grid we use
+            /// @param[in] max_iterations Maximum number of iterations
+            /// @param[in] tolerance Stop when the relative rms change in Psi is less than this (e.g. 1e-3)
+            /// @param[in] beta This is beta = f/b the growth-rate over the bias
+            /// @param[in] smoothing_options The smoothing filter (gaussian, tophat, sharph) and the smothing scale (in
+            /// units of the boxsize)
+            /// @param[in] survey_data If survey data we don't wrap around the box if the particles move too far. For
+            /// survey data make sure you use padding to prevent any issues..
+            ///
+            //============================================================================
+            template <int N, class T>
+            void RSDReconstructionIterativeGridMethod(MPIParticles<T> & part,
+                                                      std::string density_assignment_method,
+                                                      std::vector<double> los_direction,
+                                                      int Nmesh,
+                                                      int max_iterations,
+                                                      double tolerance,
+                                                      double beta,
+                                                      std::pair<std::string, double> smoothing_options,
+                                                      bool survey_data) {
+
+                static_assert(FML::PARTICLE::has_get_pos<T>(),
+                              "[RSDReconstructionIterativeGridMethod] Particle must have a get_pos method");
+
+                // The density field for the observed galaxies (i.e. with RSD in it)
+                auto nleftright =
+                    FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(density_assignment_method);
+                FFTWGrid<N> density(Nmesh, nleftright.first, nleftright.second);
+                density.add_memory_label("FFTWGrid::RSDReconstructionIterativeGridMethod::density");
+                density.set_grid_status_real(true);
+                FML::INTERPOLATION::particles_to_grid(part.get_particles_ptr(),
+                                                      part.get_npart(),
+                                                      part.get_npart_total(),
+                                                      density,
+                                                      density_assignment_method);
+                density.fftw_r2c();
+                FML::GRID::smoothing_filter_fourier_space(density, smoothing_options.second, smoothing_options.first);
+
+                // Solve for the displacement field
+                std::array<FFTWGrid<N>, N> Psi;
+                RSDReconstructionSolveDisplacementField<N>(
+                    density, los_direction, beta, survey_data, max_iterations, tolerance, Psi);
+                density.free();
+
+                // Interpolate Psi to particle positions
+                std::array<std::vector<FloatType>, N> Psi_particle_positions;
+                FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, T>(
+                    Psi, part.get_particles_ptr(), part.get_npart(), Psi_particle_positions, "CIC");
+                for (int idim = 0; idim < N; idim++)
+                    Psi[idim].free();
+
+                if (not survey_data) {
+                    double norm = 0.0;
+                    for (int idim = 0; idim < N; idim++)
+                        norm += los_direction[idim] * los_direction[idim];
+                    for (int idim = 0; idim < N; idim++)
+                        los_direction[idim] /= std::sqrt(norm);
+                }
+
+                // Subtract the RSD component beta(Psi*r)r for each particle
+                double Psi_max[N];
+                for (int idim = 0; idim < N; idim++)
+                    Psi_max[idim] = 0.0;
+                const size_t NumPart = part.get_npart();
+                auto * p = part.get_particles_ptr();
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : Psi_max[:N])
+#endif
+                for (size_t i = 0; i < NumPart; i++) {
+                    auto * pos = FML::PARTICLE::GetPos(p[i]);
+
+                    std::array<double, N> r;
+                    double norm = 0.0;
+                    for (int idim = 0; idim < N; idim++) {
+                        r[idim] = survey_data ? pos[idim] - los_direction[idim] : los_direction[idim];
+                        norm += r[idim] * r[idim];
+                    }
+                    norm = norm > 0.0 ? 1.0 / std::sqrt(norm) : 0.0;
+
+                    double Psidotr = 0.0;
+                    for (int idim = 0; idim < N; idim++) {
+                        r[idim] *= norm;
+                        Psidotr += r[idim] * Psi_particle_positions[idim][i];
+                    }
+
+                    for (int idim = 0; idim < N; idim++) {
+                        const double Psi_rsd = beta * Psidotr * r[idim];
+                        Psi_max[idim] = std::max(Psi_max[idim], std::abs(Psi_rsd));
+                        pos[idim] -= Psi_rsd;
+                        if (pos[idim] < 0.0)
+                            pos[idim] += 1.0;
+                        if (pos[idim] >= 1.0)
+                            pos[idim] -= 1.0;
+                    }
+                }
+
+                // Particles might have moved out so communicate them
+                part.communicate_particles();
+
+                // Show maximum shift
+                for (int idim = 0; idim < N; idim++)
+                    FML::MaxOverTasks(&Psi_max[idim]);
+                if (FML::ThisTask == 0) {
+                    std::cout << "Maximum shift: ";
+                    for (int idim = 0; idim < N; idim++)
+                        std::cout << Psi_max[idim] << "    ";
+                    std::cout << "\n";
+                }
+            }
         } // namespace LPT
 
         // NAMESPACE FML::COSMOLOGY
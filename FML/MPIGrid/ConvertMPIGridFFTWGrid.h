@@ -5,51 +5,100 @@
 #include <FML/MPIGrid/MPIGrid.h>
 
 //=========================================================================
-// Method to convert data in a MPIGrid to a FFTWGrid for the case where T is
-// float or double.
+// Methods to convert data between a MPIGrid and a FFTWGrid for the case
+// where T is float or double.
 // NB: we only copy the main grid and we assume its a real grid
+//
+// FFTW stores the real grid with the last dimension padded to 2(N/2+1)
+// while MPIGrid is contiguous, but apart from that the layouts are the
+// same so we copy one row (the last dimension) at a time with these two
+// strides. The target grid is only (re)allocated if it does not already
+// have the right size so converting into the same grid every step does
+// not allocate. The Copy* methods also take an op(value) that is applied
+// to the values as we copy to avoid an extra pass over the grid
 //=========================================================================
 
-template <int N, class T>
-void ConvertToFFTWGrid(FML::GRID::MPIGrid<N, T> & from_grid, FML::GRID::FFTWGrid<N> & to_grid) {
+template <int N, class T, class Op>
+void CopyToFFTWGrid(FML::GRID::MPIGrid<N, T> & from_grid, FML::GRID::FFTWGrid<N> & to_grid, Op && op) {
 
     auto Nmesh = from_grid.get_N();
     auto nleft = from_grid.get_n_extra_slices_left();
     auto nright = from_grid.get_n_extra_slices_right();
 
-    to_grid = FML::GRID::FFTWGrid<N>(Nmesh, nleft, nright);
+    if (to_grid.get_nmesh() != Nmesh or to_grid.get_n_extra_slices_left() != nleft or
+        to_grid.get_n_extra_slices_right() != nright)
+        to_grid = FML::GRID::FFTWGrid<N>(Nmesh, nleft, nright);
+    to_grid.set_grid_status_real(true);
+
+    FML::assert_mpi(to_grid.get_local_nx() == from_grid.get_NLocal() and
+                        to_grid.get_local_x_start() == from_grid.get_xStartLocal(),
+                    "[CopyToFFTWGrid] The grids do not have the same slab decomposition\n");
 
     auto Ntot = from_grid.get_NtotLocal();
+    if constexpr (N == 1) {
+        for (long long int index = 0; index < Ntot; index++)
+            to_grid.set_real_from_index(index, op(from_grid.get_y(index)));
+    } else {
+        const long long int nrows = Ntot / Nmesh;
+        const long long int stride = to_grid.get_ntot_real_slice_alloc() / FML::power(Nmesh, N - 2);
+        const T * from = from_grid.get_y();
+        auto * to = to_grid.get_real_grid();
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-    for (long long int index = 0; index < Ntot; index++) {
-        auto coord = from_grid.coord_from_index(index);
-        auto value = from_grid.get_y(index);
-        to_grid.set_real(coord, value);
+        for (long long int row = 0; row < nrows; row++) {
+            const T * from_row = from + row * Nmesh;
+            auto * to_row = to + row * stride;
+            for (int i = 0; i < Nmesh; i++)
+                to_row[i] = op(from_row[i]);
+        }
     }
 }
 
-template <int N, class T>
-void ConvertToMPIGrid(FML::GRID::FFTWGrid<N> & from_grid, FML::GRID::MPIGrid<N, T> & to_grid) {
+template <int N, class T, class Op>
+void CopyToMPIGrid(FML::GRID::FFTWGrid<N> & from_grid, FML::GRID::MPIGrid<N, T> & to_grid, Op && op) {
 
     auto Nmesh = from_grid.get_nmesh();
     auto Local_nx = from_grid.get_local_nx();
     auto nleft = from_grid.get_n_extra_slices_left();
     auto nright = from_grid.get_n_extra_slices_right();
 
-    to_grid = FML::GRID::MPIGrid<N, T>(Nmesh, true, nleft, nright);
+    if (to_grid.get_N() != Nmesh or to_grid.get_NLocal() != Local_nx or
+        to_grid.get_n_extra_slices_left() != nleft or to_grid.get_n_extra_slices_right() != nright)
+        to_grid = FML::GRID::MPIGrid<N, T>(Nmesh, true, nleft, nright);
 
+    FML::assert_mpi(to_grid.get_NLocal() == Local_nx and to_grid.get_xStartLocal() == from_grid.get_local_x_start(),
+                    "[CopyToMPIGrid] The grids do not have the same slab decomposition\n");
+
+    auto Ntot = to_grid.get_NtotLocal();
+    if constexpr (N == 1) {
+        for (long long int index = 0; index < Ntot; index++)
+            to_grid.set_y(index, op(from_grid.get_real_from_index(index)));
+    } else {
+        const long long int nrows = Ntot / Nmesh;
+        const long long int stride = from_grid.get_ntot_real_slice_alloc() / FML::power(Nmesh, N - 2);
+        const auto * from = from_grid.get_real_grid();
+        T * to = to_grid.get_y();
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-    for (int islice = 0; islice < Local_nx; islice++) {
-        for (auto && real_index : from_grid.get_real_range(islice, islice + 1)) {
-            auto coord = from_grid.get_coord_from_index(real_index);
-            auto value = from_grid.get_real_from_index(real_index);
-            to_grid.set_y(coord, value);
+        for (long long int row = 0; row < nrows; row++) {
+            const auto * from_row = from + row * stride;
+            T * to_row = to + row * Nmesh;
+            for (int i = 0; i < Nmesh; i++)
+                to_row[i] = T(op(from_row[i]));
         }
     }
 }
 
+template <int N, class T>
+void ConvertToFFTWGrid(FML::GRID::MPIGrid<N, T> & from_grid, FML::GRID::FFTWGrid<N> & to_grid) {
+    CopyToFFTWGrid(from_grid, to_grid, [](T value) { return value; });
+}
+
+template <int N, class T>
+void ConvertToMPIGrid(FML::GRID::FFTWGrid<N> & from_grid, FML::GRID::MPIGrid<N, T> & to_grid) {
+    CopyToMPIGrid(from_grid, to_grid, [](FML::GRID::FloatType value) { return value; });
+}
+
 #endif
@@ -1,6 +1,7 @@
 #ifndef MPIGRID_HEADER
 #define MPIGRID_HEADER
 
+#include <algorithm>
 #include <array>
 #include <climits>
 #include <complex>
@@ -40,6 +41,10 @@ namespace FML {
         /// Every coord is a local coordinate unless specified otherwise
         /// e.g. (ix, iy, iz, ...) corresponds to (ix + xStartLocal, iy, iz, ...) in the global grid
         ///
+        /// The x-slices are by default distributed over all tasks. With task_stride > 1 only every
+        /// task_stride'th task holds slices (the grid is agglomerated on a subset of the tasks) and the
+        /// others have no cells. This is used for the coarse levels in MPIMultiGrid
+        ///
         /// External methods we rely on:
         ///
         ///   using IndexInt = long long int;
@@ -63,6 +68,7 @@ namespace FML {
             int _RightTask{0};            // The id of the task on the left
             int _n_extra_slices_left{0};  // Extra x-slices to the left
             int _n_extra_slices_right{0}; // Extra x-slices to the right
+            int _task_stride{1};          // Only every _task_stride'th task holds slices
 
             IndexInt _Ntot{0};           // How many cells in main grid in total
             IndexInt _NtotLocalLeft{0};  // Total cells in extra left slices
@@ -74,6 +80,12 @@ namespace FML {
             // std::vector<T> _y;           // The grid data
             Vector<T> _y{}; // The grid data
 
+#ifdef USE_MPI
+            // Pending requests (and a buffer for slices we do not store) for the non-blocking boundary exchange
+            std::vector<MPI_Request> _boundary_requests{};
+            std::vector<T> _boundary_discard{};
+#endif
+
             // Helper functions for bounds-checking
             void assert_index(IndexInt index) const;
             void assert_coord(const std::array<int, NDIM> & coord) const;
@@ -81,10 +93,11 @@ namespace FML {
           public:
             // Constructors
             MPIGrid() = default;
-            MPIGrid(int N, bool periodic, int n_extra_slices_left = 0, int n_extra_slices_right = 0);
+            MPIGrid(int N, bool periodic, int n_extra_slices_left = 0, int n_extra_slices_right = 0, int task_stride = 1);
 
             // Get a pointer to the start of the main grid
             T * get_y();
+            const T * get_y() const;
 
             // Get a reference to the cell at a given index
             T & get_y(IndexInt index);
@@ -129,6 +142,17 @@ namespace FML {
             int get_xStartLocal();
             int get_n_extra_slices_left();
             int get_n_extra_slices_right();
+            int get_task_stride() const;
+
+            // The task that holds a given (global) x-slice
+            int get_task_of_xslice(int ix_global) const;
+
+            // Send x-slices computed on this task to the tasks that hold them in this grid. The slices
+            // are [ix_start, ix_start + nslices) (global x-index) stored one after another in slices.
+            // op(index, value) is called on the task holding the slice for every received cell where
+            // index is the local index of the cell. Must be called by all tasks
+            template <class Op>
+            void send_slices_to_owners(int ix_start, int nslices, const std::vector<T> & slices, Op && op);
 
             // Returns the position of the cell in the global grid
             std::array<double, NDIM> get_pos(IndexInt index);
@@ -143,6 +167,12 @@ namespace FML {
             // Communicate all the extra slices left and right
             void communicate_boundaries();
 
+            // Non-blocking version of communicate_boundaries. The extra slices are only valid after the call
+            // to finish, and the slices that are sent (the n_extra_slices_left rightmost and the
+            // n_extra_slices_right leftmost slices of the main grid) must not be changed in between
+            void communicate_boundaries_start();
+            void communicate_boundaries_finish();
+
             // Send a slice of the grid to the left or right task
             void send_slice_left(int ix, std::vector<T> & recv_slice);
             void send_slice_right(int ix, std::vector<T> & recv_slice);
@@ -189,6 +219,7 @@ namespace FML {
                 std::cout << "# Periodic?            : " << std::boolalpha << _periodic << "\n";
                 std::cout << "# N                    : " << _N << "\n";
                 std::cout << "# NLocal               : " << _NLocal << "\n";
+                std::cout << "# Task stride          : " << _task_stride << "\n";
                 std::cout << "# n_extra_slices_left  : " << _n_extra_slices_left << "\n";
                 std::cout << "# n_extra_slices_right : " << _n_extra_slices_right << "\n";
                 std::cout << "# Cells allocated      : " << _y.size() << " per task\n";
@@ -274,25 +305,33 @@ namespace FML {
 
         // Constructor with intial value
         template <int NDIM, class T>
-        MPIGrid<NDIM, T>::MPIGrid(int N, bool periodic, int n_extra_slices_left, int n_extra_slices_right) {
+        MPIGrid<NDIM, T>::MPIGrid(
+            int N, bool periodic, int n_extra_slices_left, int n_extra_slices_right, int task_stride) {
             assert_mpi(N > 0, "[MPIGrid] We need Ngrid > 0\n");
             assert_mpi(n_extra_slices_left >= 0 and n_extra_slices_right >= 0,
                        "[MPIGrid] Number of extra slices cannot be negative\n");
-            if (N % FML::NTasks != 0 and FML::ThisTask == 0)
+            assert_mpi(task_stride > 0 and FML::NTasks % task_stride == 0,
+                       "[MPIGrid] The task stride must be positive and divide FML::NTasks\n");
+            const int ntasks_used = FML::NTasks / task_stride;
+            if (N % ntasks_used != 0 and FML::ThisTask == 0)
                 std::cout << "[MPIGrid] Warning: FML::NTasks should divide N to be compatible with other MPI methods\n";
 
-            // Compute slices for task
-            std::vector<int> slices_per_task(FML::NTasks, N / FML::NTasks);
-            int nmore = N % FML::NTasks;
+            // Compute slices for task (only every task_stride'th task gets slices)
+            std::vector<int> slices_per_task(FML::NTasks, 0);
+            int nmore = N % ntasks_used;
             int sumslicesbeforethistask = 0;
             for (int task = 0; task < FML::NTasks; task++) {
-                if (task < nmore)
-                    slices_per_task[task] += 1;
+                if (task % task_stride == 0) {
+                    slices_per_task[task] = N / ntasks_used;
+                    if (task / task_stride < nmore)
+                        slices_per_task[task] += 1;
+                }
 
                 if (task < FML::ThisTask)
                     sumslicesbeforethistask += slices_per_task[task];
             }
 
+            _task_stride = task_stride;
             _periodic = periodic;
             _N = N;
             _NLocal = slices_per_task[FML::ThisTask];
@@ -349,6 +388,11 @@ namespace FML {
             return &_y[_NtotLocalLeft];
         }
 
+        template <int NDIM, class T>
+        const T * MPIGrid<NDIM, T>::get_y() const {
+            return &_y[_NtotLocalLeft];
+        }
+
         template <int NDIM, class T>
         T & MPIGrid<NDIM, T>::get_y(IndexInt index) {
 #ifdef BOUNDSCHECK
@@ -549,6 +593,93 @@ namespace FML {
             return _n_extra_slices_right;
         }
 
+        template <int NDIM, class T>
+        int MPIGrid<NDIM, T>::get_task_stride() const {
+            return _task_stride;
+        }
+
+        template <int NDIM, class T>
+        int MPIGrid<NDIM, T>::get_task_of_xslice(int ix_global) const {
+            // Same distribution as in the constructor
+            const int ntasks_used = FML::NTasks / _task_stride;
+            const int nslices = _N / ntasks_used;
+            const int nmore = _N % ntasks_used;
+            int itask_used;
+            if (ix_global < nmore * (nslices + 1))
+                itask_used = ix_global / (nslices + 1);
+            else
+                itask_used = nmore + (ix_global - nmore * (nslices + 1)) / nslices;
+            return itask_used * _task_stride;
+        }
+
+        template <int NDIM, class T>
+        template <class Op>
+        void MPIGrid<NDIM, T>::send_slices_to_owners(int ix_start,
+                                                     int nslices,
+                                                     const std::vector<T> & slices,
+                                                     Op && op) {
+            assert_mpi(slices.size() >= size_t(nslices * _NperSlice),
+                       "[MPIGrid::send_slices_to_owners] Not enough data for the slices\n");
+
+#ifdef USE_MPI
+            // Each slice is sent as its global x-index followed by the cells
+            const size_t bytes_slice = sizeof(int) + _NperSlice * sizeof(T);
+            std::vector<int> n_to_send(FML::NTasks, 0);
+            std::vector<int> n_to_recv(FML::NTasks, 0);
+            for (int i = 0; i < nslices; i++)
+                n_to_send[get_task_of_xslice(ix_start + i)] += bytes_slice;
+            MPI_Alltoall(n_to_send.data(), 1, MPI_INT, n_to_recv.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+            std::vector<int> offset_send(FML::NTasks, 0);
+            std::vector<int> offset_recv(FML::NTasks, 0);
+            for (int i = 1; i < FML::NTasks; i++) {
+                offset_send[i] = offset_send[i - 1] + n_to_send[i - 1];
+                offset_recv[i] = offset_recv[i - 1] + n_to_recv[i - 1];
+            }
+
+            // Pack the slices
+            std::vector<char> send_buffer(offset_send[FML::NTasks - 1] + n_to_send[FML::NTasks - 1]);
+            std::vector<char> recv_buffer(offset_recv[FML::NTasks - 1] + n_to_recv[FML::NTasks - 1]);
+            std::vector<int> position = offset_send;
+            for (int i = 0; i < nslices; i++) {
+                const int ix = ix_start + i;
+                char * buffer = send_buffer.data() + position[get_task_of_xslice(ix)];
+                std::memcpy(buffer, &ix, sizeof(int));
+                std::memcpy(buffer + sizeof(int), slices.data() + i * _NperSlice, _NperSlice * sizeof(T));
+                position[get_task_of_xslice(ix)] += bytes_slice;
+            }
+
+            MPI_Alltoallv(send_buffer.data(),
+                          n_to_send.data(),
+                          offset_send.data(),
+                          MPI_BYTE,
+                          recv_buffer.data(),
+                          n_to_recv.data(),
+                          offset_recv.data(),
+                          MPI_BYTE,
+                          MPI_COMM_WORLD);
+
+            // Unpack and apply op to the received cells
+            std::vector<T> slice(_NperSlice);
+            for (size_t pos = 0; pos < recv_buffer.size(); pos += bytes_slice) {
+                int ix;
+                std::memcpy(&ix, recv_buffer.data() + pos, sizeof(int));
+                // The cells are not aligned in the buffer so we copy the bytes (T is sent as bytes anyway)
+                const char * cells = recv_buffer.data() + pos + sizeof(int);
+                std::copy(cells, cells + _NperSlice * sizeof(T), reinterpret_cast<char *>(slice.data()));
+                const IndexInt index_start = (ix - _xStartLocal) * _NperSlice;
+                for (IndexInt i = 0; i < _NperSlice; i++)
+                    op(index_start + i, slice[i]);
+            }
+#else
+            for (int i = 0; i < nslices; i++) {
+                const IndexInt index_start = (ix_start + i - _xStartLocal) * _NperSlice;
+                for (IndexInt j = 0; j < _NperSlice; j++)
+                    op(index_start + j, slices[i * _NperSlice + j]);
+            }
+#endif
+        }
+
         template <int NDIM, class T>
         void MPIGrid<NDIM, T>::free() {
             _y.clear();
@@ -562,7 +693,7 @@ namespace FML {
 
 #ifdef USE_MPI
             const int bytes_slice = _NperSlice * sizeof(T);
-            recv_slice.resize(bytes_slice);
+            recv_slice.resize(_NperSlice);
 
             T * slice_tosend = _y.data() + _NtotLocalLeft + _NperSlice * ix;
             char * sendbuf = reinterpret_cast<char *>(slice_tosend);
@@ -593,7 +724,7 @@ namespace FML {
 
 #ifdef USE_MPI
             const int bytes_slice = _NperSlice * sizeof(T);
-            recv_slice.resize(bytes_slice);
+            recv_slice.resize(_NperSlice);
 
             T * slice_tosend = _y.data() + _NtotLocalLeft + _NperSlice * ix;
             char * sendbuf = reinterpret_cast<char *>(slice_tosend);
@@ -627,23 +758,103 @@ namespace FML {
 
             // Send rightmost slices right and store in extra left slices
             for (int i = 0; i < nsend_to_right; i++) {
-                const bool do_not_store = not _periodic and FML::ThisTask == 0;
+                const bool do_not_store = not _periodic and _xStartLocal == 0;
                 T * slice_left_torecv = _y.data() + _NperSlice * i;
                 send_slice_right(_NLocal - nsend_to_right + i, recv_array);
                 if (not do_not_store)
-                    std::memcpy(slice_left_torecv, recv_array.data(), _NperSlice * sizeof(T));
+                    std::copy_n(recv_array.data(), _NperSlice, slice_left_torecv);
             }
 
             // Send leftmost slices left and store in extra right slices
             for (int i = 0; i < nsend_to_left; i++) {
-                const bool do_not_store = not _periodic and FML::ThisTask == FML::NTasks - 1;
+                const bool do_not_store = not _periodic and _xStartLocal + _NLocal == _N;
                 T * slice_right_torecv = _y.data() + _NtotLocalLeft + _NtotLocal + _NperSlice * i;
                 send_slice_left(i, recv_array);
                 if (not do_not_store)
-                    std::memcpy(slice_right_torecv, recv_array.data(), _NperSlice * sizeof(T));
+                    std::copy_n(recv_array.data(), _NperSlice, slice_right_torecv);
             }
         }
 
+        template <int NDIM, class T>
+        void MPIGrid<NDIM, T>::communicate_boundaries_start() {
+#ifdef USE_MPI
+            if (FML::NTasks == 1) {
+                communicate_boundaries();
+                return;
+            }
+
+            assert_mpi(_boundary_requests.size() == 0,
+                       "[MPIGrid::communicate_boundaries_start] Previous exchange has not been finished\n");
+
+            const int nsend_to_left = _n_extra_slices_right;
+            const int nsend_to_right = _n_extra_slices_left;
+            const int bytes_slice = _NperSlice * sizeof(T);
+            _boundary_requests.resize(2 * (nsend_to_left + nsend_to_right));
+            _boundary_discard.resize(_NperSlice * std::max(nsend_to_left, nsend_to_right));
+
+            // Post all receives before the sends. Slices moving right have tag 2i and slices moving left 2i+1
+            int nreq = 0;
+            for (int i = 0; i < nsend_to_right; i++) {
+                const bool do_not_store = not _periodic and _xStartLocal == 0;
+                T * slice_left_torecv =
+                    do_not_store ? _boundary_discard.data() + _NperSlice * i : _y.data() + _NperSlice * i;
+                MPI_Irecv(reinterpret_cast<char *>(slice_left_torecv),
+                          bytes_slice,
+                          MPI_CHAR,
+                          _LeftTask,
+                          2 * i,
+                          MPI_COMM_WORLD,
+                          &_boundary_requests[nreq++]);
+            }
+            for (int i = 0; i < nsend_to_left; i++) {
+                const bool do_not_store = not _periodic and _xStartLocal + _NLocal == _N;
+                T * slice_right_torecv = do_not_store ? _boundary_discard.data() + _NperSlice * i :
+                                                        _y.data() + _NtotLocalLeft + _NtotLocal + _NperSlice * i;
+                MPI_Irecv(reinterpret_cast<char *>(slice_right_torecv),
+                          bytes_slice,
+                          MPI_CHAR,
+                          _RightTask,
+                          2 * i + 1,
+                          MPI_COMM_WORLD,
+                          &_boundary_requests[nreq++]);
+            }
+
+            // Send rightmost slices right and leftmost slices left
+            for (int i = 0; i < nsend_to_right; i++) {
+                T * slice_tosend = _y.data() + _NtotLocalLeft + _NperSlice * (_NLocal - nsend_to_right + i);
+                MPI_Isend(reinterpret_cast<char *>(slice_tosend),
+                          bytes_slice,
+                          MPI_CHAR,
+                          _RightTask,
+                          2 * i,
+                          MPI_COMM_WORLD,
+                          &_boundary_requests[nreq++]);
+            }
+            for (int i = 0; i < nsend_to_left; i++) {
+                T * slice_tosend = _y.data() + _NtotLocalLeft + _NperSlice * i;
+                MPI_Isend(reinterpret_cast<char *>(slice_tosend),
+                          bytes_slice,
+                          MPI_CHAR,
+                          _LeftTask,
+                          2 * i + 1,
+                          MPI_COMM_WORLD,
+                          &_boundary_requests[nreq++]);
+            }
+#else
+            communicate_boundaries();
+#endif
+        }
+
+        template <int NDIM, class T>
+        void MPIGrid<NDIM, T>::communicate_boundaries_finish() {
+#ifdef USE_MPI
+            if (_boundary_requests.size() == 0)
+                return;
+            MPI_Waitall(int(_boundary_requests.size()), _boundary_requests.data(), MPI_STATUSES_IGNORE);
+            _boundary_requests.clear();
+#endif
+        }
+
         template <int NDIM, class T>
         double MPIGrid<NDIM, T>::norm() {
             double norm2 = 0.0;
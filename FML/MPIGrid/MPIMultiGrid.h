@@ -19,6 +19,11 @@ namespace FML {
         ///
         /// A stack of _Nlevel MPIGrids with \f$ N^{\rm NDIM} / 2^{\rm Level} \f$ cells in each level
         ///
+        /// Levels with fewer x-slices than there are tasks are agglomerated: the level is held by a subset of
+        /// the tasks (every NTasks/N'th task has one slice, see MPIGrid task_stride) and the others have no cells.
+        /// Restriction onto such a level sends the partial sums to the tasks holding the slices.
+        /// This lets the hierarchy go all the way down to N = 2 also with many tasks
+        ///
         /// Compile time defines:
         ///
         /// BOUNDSCHECK  : Bounds checks
@@ -210,16 +215,11 @@ namespace FML {
             }
 
             //==================================================================================
-            // The smallest level we allow is one where we have one cell per CPU on the coarsest level
-            // just makes the algorithms easier as not all tasks will have cells and right/left tasks
-            // might lie several CPUs apart
+            // The coarsest level we allow has 2 cells per dimension. Levels with fewer slices
+            // than tasks are agglomerated on a subset of the tasks
             //==================================================================================
             if (Nlevel < 0) {
-                if (FML::NTasks > 1) {
-                    Nlevel = intlog2(_N) - intlog2(FML::NTasks) + 1;
-                } else {
-                    Nlevel = intlog2(_N);
-                }
+                Nlevel = intlog2(_N);
             }
             _Nlevel = Nlevel;
             _NinLevel = std::vector<int>(_Nlevel, _N);
@@ -227,14 +227,8 @@ namespace FML {
 
             // Check that _Nlevel is OK
             assert_mpi(_Nlevel > 0, "[MPIMultiGrid] Nlevel must be > 1 (otherwise its no multigrid)\n");
-            if (FML::NTasks > 0) {
-                assert_mpi(_Nlevel <= intlog2(N) - intlog2(FML::NTasks) + 1,
-                           "[MPIMultiGrid] Nlevel is too large. With MPI the smallest level corresponds to each task "
-                           "having jus 2 cell each\n");
-            } else {
-                assert_mpi(_Nlevel <= intlog2(_N),
-                           "[MPIMultiGrid] Nlevel is too large. Coarsest level will have less than 1 cell\n");
-            }
+            assert_mpi(_Nlevel <= intlog2(_N),
+                       "[MPIMultiGrid] Nlevel is too large. Coarsest level will have less than 1 cell\n");
 
             //==================================================================================
             // Make all grids
@@ -247,7 +241,9 @@ namespace FML {
             _NinLevel[0] = _N;
             for (int level = 1; level < _Nlevel; level++) {
                 _NinLevel[level] = _NinLevel[level - 1] / 2;
-                _y[level] = MPIGrid<NDIM, T>(_NinLevel[level], _periodic, _n_extra_slices_left, _n_extra_slices_right);
+                const int task_stride = _NinLevel[level] < FML::NTasks ? FML::NTasks / _NinLevel[level] : 1;
+                _y[level] = MPIGrid<NDIM, T>(
+                    _NinLevel[level], _periodic, _n_extra_slices_left, _n_extra_slices_right, task_stride);
                 _NtotLocalinLevel[level] = _y[level].get_NtotLocal();
             }
         }
@@ -269,23 +265,87 @@ namespace FML {
             auto & TopGrid = _y[from_level];
             auto & BottomGrid = to_grid;
 
-            // Clear bottom array
-            IndexInt NtotLocalBottom = BottomGrid.get_NtotLocal();
-            std::fill_n(&BottomGrid[0], NtotLocalBottom, T(0.0));
-
-            // Loop over top grid
-            IndexInt NtotLocalTop = TopGrid.get_NtotLocal();
-            for (IndexInt index_top = 0; index_top < NtotLocalTop; index_top++) {
+            const int NBottom = BottomGrid.get_N();
+            const int NTop = TopGrid.get_N();
+            const int xStartLocalTop = TopGrid.get_xStartLocal();
+            const int NLocalTop = TopGrid.get_NLocal();
+
+            // We loop over the bottom grid one row (along the last, contiguous, dimension) at a time and gather
+            // the 2^NDIM top cells of each bottom cell so that the loop has no write conflicts and can be
+            // threaded. Offsets (relative to the first child) of the 2^(NDIM-1) children with the same x
+            constexpr int nchildren = FML::power(2, NDIM - 1);
+            const IndexInt nrow = NDIM > 1 ? NBottom : 1;
+            const IndexInt stride = NDIM > 1 ? 2 : 0;
+            std::array<IndexInt, nchildren> offsets;
+            for (int k = 0; k < nchildren; k++) {
+                offsets[k] = 0;
+                IndexInt npow = 1;
+                for (int idim = NDIM - 1; idim >= 1; idim--, npow *= NTop)
+                    offsets[k] += ((k >> (NDIM - 1 - idim)) & 1) * npow;
+            }
 
-                // Convert global coordinate of current cell in top to bottom
-                auto coord = TopGrid.globalcoord_from_index(index_top);
-                for (int idim = 0; idim < NDIM; idim++) {
-                    coord[idim] = coord[idim] / 2;
+            // Restrict the row of bottom cells starting at (global) coord_bottom. Only the top cells that
+            // are on this task are included
+            auto restrict_row = [&](std::array<int, NDIM> coord_bottom, T * bottom_row) {
+                for (IndexInt i = 0; i < nrow; i++)
+                    bottom_row[i] = T(0.0);
+                for (int dx = 0; dx < 2; dx++) {
+                    auto coord_top = coord_bottom;
+                    for (int idim = 0; idim < NDIM; idim++)
+                        coord_top[idim] *= 2;
+                    coord_top[0] += dx;
+                    if (coord_top[0] < xStartLocalTop or coord_top[0] >= xStartLocalTop + NLocalTop)
+                        continue;
+                    const T * top_row = &TopGrid[TopGrid.index_from_globalcoord(coord_top)];
+                    for (IndexInt i = 0; i < nrow; i++) {
+                        T sum = T(0.0);
+                        for (int k = 0; k < nchildren; k++)
+                            sum += top_row[stride * i + offsets[k]];
+                        bottom_row[i] += sum * oneovernumcells;
+                    }
+                }
+            };
+
+            // The bottom level is agglomerated on fewer tasks than the top level so the cells we restrict
+            // are (partly) not on this task. Restrict into the slices we cover and send them to the tasks
+            // that have them
+            if (BottomGrid.get_task_stride() != TopGrid.get_task_stride()) {
+                const IndexInt NperSliceBottom = FML::power(NBottom, NDIM - 1);
+                const int ixstart_bottom = xStartLocalTop / 2;
+                const int nslices_bottom =
+                    NLocalTop > 0 ? (xStartLocalTop + NLocalTop - 1) / 2 - ixstart_bottom + 1 : 0;
+
+                std::vector<T> slices(nslices_bottom * NperSliceBottom);
+                const IndexInt nrows = nslices_bottom * NperSliceBottom / nrow;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (IndexInt row = 0; row < nrows; row++) {
+                    std::array<int, NDIM> coord_bottom;
+                    IndexInt index = row * nrow;
+                    for (int idim = NDIM - 1; idim >= 1; idim--) {
+                        coord_bottom[idim] = index % NBottom;
+                        index /= NBottom;
+                    }
+                    coord_bottom[0] = ixstart_bottom + index;
+                    restrict_row(coord_bottom, &slices[row * nrow]);
                 }
 
-                // Add up to restricted grid
-                IndexInt index_bottom = BottomGrid.index_from_globalcoord(coord);
-                BottomGrid[index_bottom] += TopGrid[index_top] * oneovernumcells;
+                IndexInt NtotLocalBottom = BottomGrid.get_NtotLocal();
+                std::fill_n(&BottomGrid[0], NtotLocalBottom, T(0.0));
+                BottomGrid.send_slices_to_owners(
+                    ixstart_bottom, nslices_bottom, slices, [&](IndexInt index, const T & value) {
+                        BottomGrid[index] += value;
+                    });
+                return;
+            }
+
+            const IndexInt nrows = BottomGrid.get_NtotLocal() / nrow;
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (IndexInt row = 0; row < nrows; row++) {
+                restrict_row(BottomGrid.globalcoord_from_index(row * nrow), &BottomGrid[row * nrow]);
             }
         }
 
@@ -1,12 +1,19 @@
 #ifndef MPIPARTICLES_HEADER
 #define MPIPARTICLES_HEADER
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdio>
 #include <fstream>
 #include <functional>
 #include <ios>
 #include <iostream>
+#include <iterator>
+#include <numeric>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #ifdef USE_MPI
@@ -53,6 +60,9 @@ namespace FML {
         ///
         ///    DEBUG_MPIPARTICLES : Show some info when running
         ///
+        ///    NO_MPI_SHARED_MEMORY : Send particles to tasks on the same node with MPI messages instead of through a
+        ///                           shared memory window
+        ///
         /// External variables/methods we rely on:
         ///
         ///    int ThisTask;
@@ -70,7 +80,7 @@ namespace FML {
           private:
             // Particle container
             // std::vector<T> p;
-            Vector<T> p{};
+            LargeVector<T> p{};
 
             // Info about the particle distribution
             size_t NpartTotal{0};        // Total number of particles across all tasks
@@ -83,6 +93,11 @@ namespace FML {
             // If we create particles from scratch according to a grid
             double buffer_factor{1.0}; // Allocate a factor of this more particles than needed
 
+            // If we recieve more particles than we have room for we grow the storage
+            double buffer_growth_factor{1.25}; // Grow by (at least) this factor. If <= 1 we abort instead
+            size_t max_npart_allocated{0};     // Never allocate more particles than this (0 means no limit)
+            std::string memory_label{};        // The label of the storage in the memory log
+
             // If we created a uniform grid of particles
             int Npart_1D{0};       // Total number of particles slices
             int Local_Npart_1D{0}; // Number of slices in current task
@@ -94,8 +109,46 @@ namespace FML {
             // The byte-size of particle ipart
             size_t get_particle_byte_size(size_t ipart);
 
+            // Make sure we have room for (at least) npart_needed particles
+            void grow_storage(size_t npart_needed);
+
             // For communication
             void copy_over_recieved_data(std::vector<char> & recv_buffer, size_t Npart_recieved);
+            void start_communicate_particles_bitwise(const std::vector<int> & shifts,
+                                                     const std::vector<int> & n_to_send,
+                                                     const std::vector<int> & n_to_recv,
+                                                     const std::vector<long long int> & offset_at_sender);
+            // Do we send to and recieve from task with MPI messages (it is not on the same node as us)?
+            static bool on_other_node([[maybe_unused]] int task) {
+#if defined(USE_MPI) && !defined(NO_MPI_SHARED_MEMORY)
+                return FML::NodeRankOfTask[task] < 0;
+#else
+                return true;
+#endif
+            }
+#if defined(USE_MPI) && !defined(NO_MPI_SHARED_MEMORY)
+            // Particles to and from tasks on the same node go through a shared memory window instead of MPI
+            static FML::SharedMemoryWindow & node_window();
+            static void recieve_from_tasks_on_node(const std::vector<int> & shifts,
+                                                   const std::vector<char *> & recv_by_task,
+                                                   const std::vector<int> & nbytes_to_recv,
+                                                   const std::vector<long long int> & offset_at_sender);
+#endif
+
+#ifdef USE_MPI
+            // A communication started by start_communicate_particles. The particles we send are in
+            // [NpartLocal_in_use, NpartLocal_in_use + ntot_to_send) until it is finished
+            struct PendingCommunication {
+                bool active{false};
+                bool bitwise{false};
+                size_t ntot_to_send{0};
+                size_t ntot_to_recv{0};
+                std::vector<char> send_buffer{};
+                std::vector<char> recv_buffer{};
+                std::vector<MPI_Request> requests{};
+                MPI_Datatype particle_type{};
+            } pending{};
+#endif
 
           public:
             /// Iterator for looping through all the active particles i.e. allow for(auto &&p: mpiparticles)
@@ -142,6 +195,22 @@ namespace FML {
             /// type
             void create(std::vector<T> & part, size_t nallocate, std::function<bool(T &)> selection_function);
 
+            /// Create MPIParticles from particles we get in chunks from a generator (e.g. reading a file or making
+            /// particles slice by slice) so that we never hold more than our own particles plus one chunk. The
+            /// generator is called as generator(buffer, nmax) and must put at most nmax particles in buffer and
+            /// return how many it added (0 when it has no more). Every chunk is communicated to the tasks that own
+            /// the particles before we ask for the next one. Tasks without particles to give can just return 0.
+            /// @param[in] generator The function that gives us the particles
+            /// @param[in] nallocate How many particles to allocate for locally (the storage grows if needed)
+            /// @param[in] nparts_per_chunk The maximum number of particles we ask the generator for at a time
+            /// @param[in] xmin_local The min of the x-range in [0,1] the current task is responsible for
+            /// @param[in] xmax_local The max of the x-range in [0,1] the current task is responsible for
+            void create_from_generator(std::function<size_t(T *, size_t)> generator,
+                                       size_t nallocate,
+                                       size_t nparts_per_chunk,
+                                       double xmin_local,
+                                       double xmax_local);
+
             /// Moves a vector of particles into internal storage (so no copies are being done).
             /// The extra storage (if needed) needs to allready be in part!
             /// Assumes we have distinct particles on different tasks. This saves having to do allocations
@@ -162,7 +231,7 @@ namespace FML {
 
             /// Get reference to particle vector. NB: due to we allow a buffer the size of the vector returned is
             /// not equal to the number of active particles!
-            Vector<T> & get_particles();
+            LargeVector<T> & get_particles();
             /// Get a pointer to the first particle.
             T * get_particles_ptr();
 
@@ -178,28 +247,67 @@ namespace FML {
 
             /// Total number of active particles across all tasks
             size_t get_npart_total() const;
+            /// Number of particles per dimension if we made the particles with create_particle_grid (0 if not)
+            int get_npart_1D() const { return Npart_1D; }
             /// Number of active particles on the local task
             size_t get_npart() const;
 
             /// Communicate particles across CPU boundaries
             void communicate_particles();
 
+            /// Split-phase version of communicate_particles. After start_communicate_particles the particles that
+            /// stays on this task are the get_npart() first particles and the ones that leave are in transit. These
+            /// can be used (e.g. assigned to a grid) while we wait, but don't change the container until
+            /// finish_communicate_particles has been called. After this the recieved particles are the last ones,
+            /// i.e. the particles from index get_npart() (before the call) and up are the new ones
+            void start_communicate_particles();
+            void finish_communicate_particles();
+
+            /// Sort the local particles by the cell they are in on a grid with Nmesh cells per dimension
+            /// (slab-major cell order, i.e. by x then y then ...). Particles close in space are then close in memory
+            /// so density assignment and interpolation access the grid (nearly) in streaming order. The order is
+            /// slowly destroyed as the particles move so call this every few steps
+            void sort_by_cell(int Nmesh);
+
             /// Get a vector of xmin of the domain for each task
             std::vector<double> get_x_min_per_task();
             /// Get a vector of xmax of the domain for each task
             std::vector<double> get_x_max_per_task();
 
+            /// Move the domain boundaries so that all tasks have (close to) the same number of particles and
+            /// communicate the particles. The boundaries are found from a histogram of x with nbins_per_task bins
+            /// per task. NB: the domains are then no longer the slabs of the grids (FML::xmin_domain,
+            /// FML::xmax_domain) so use the *_rebalanced versions of the density assignment and interpolation
+            /// methods in ParticleGridInterpolation.h which exchange the part of the grid the particles need.
+            /// Call this every now and then when the particles cluster (it does not need the particles to be
+            /// communicated first)
+            void rebalance(int nbins_per_task = 64);
+
             /// Free all memory of the stored particles
             void free();
 
             /// For memory logging add a tag to the vector we have allocated
             void add_memory_label(std::string name);
 
+            /// If a task recieves more particles than it has room for in communicate_particles the storage is grown
+            /// by (at least) the factor growth_factor (default 1.25), but never to more than max_npart_allocated
+            /// particles (0 means no limit). Set growth_factor <= 1 to abort instead (the old behaviour)
+            void set_buffer_growth(double growth_factor, size_t max_npart_allocated = 0);
+
             /// Dump data to file (internal format)
             void dump_to_file(std::string fileprefix, size_t max_bytesize_buffer = 100 * 1000 * 1000);
             /// Load data from file (internal format)
             void load_from_file(std::string fileprefix);
 
+            /// Dump data to a single file shared by all tasks (using MPI-IO). The particles are written in chunks
+            /// of at most nparts_per_chunk particles so that they can be read back with any number of tasks
+            void dump_to_shared_file(std::string filename, size_t nparts_per_chunk = 100000);
+            /// Load data from a file written by dump_to_shared_file. This works for any number of tasks: the chunks
+            /// are divided evenly between the tasks and the particles are then communicated to the task whose
+            /// domain (FML::xmin_domain, FML::xmax_domain) they are in. We allocate buffer_factor times the mean
+            /// number of particles per task
+            void load_from_shared_file(std::string filename, double buffer_factor = 1.25);
+
             /// Show some info about the class
             void info();
         };
@@ -212,10 +320,7 @@ namespace FML {
         template <class T>
         void MPIParticles<T>::info() {
             auto NDIM = FML::PARTICLE::GetNDIM(T());
-            double memory_in_mb = 0;
-            for (auto & part : p)
-                memory_in_mb += FML::PARTICLE::GetSize(part);
-            memory_in_mb /= 1e6;
+            double memory_in_mb = FML::PARTICLE::GetRangeSize(p.data(), p.size()) / 1e6;
             double max_memory_in_mb = memory_in_mb;
             double min_memory_in_mb = memory_in_mb;
             double mean_memory_in_mb = memory_in_mb / double(FML::NTasks);
@@ -259,10 +364,84 @@ namespace FML {
         template <class T>
         void MPIParticles<T>::add_memory_label([[maybe_unused]] std::string name) {
 #ifdef MEMORY_LOGGING
+            memory_label = name;
             FML::MemoryLog::get()->add_label(p.data(), p.capacity(), name);
 #endif
         }
 
+        template <class T>
+        void MPIParticles<T>::set_buffer_growth(double growth_factor, size_t max_npart_allocated) {
+            buffer_growth_factor = growth_factor;
+            this->max_npart_allocated = max_npart_allocated;
+        }
+
+        template <class T>
+        void MPIParticles<T>::grow_storage(size_t npart_needed) {
+            if (npart_needed <= p.size())
+                return;
+
+            assert_mpi(buffer_growth_factor > 1.0,
+                       "[MPIParticles::grow_storage] Too many particles recieved! Increase buffer (or allow the "
+                       "storage to grow with set_buffer_growth)\n");
+            assert_mpi(max_npart_allocated == 0 or npart_needed <= max_npart_allocated,
+                       "[MPIParticles::grow_storage] Too many particles recieved! We need more storage than the max "
+                       "allowed by set_buffer_growth\n");
+
+            size_t npart_new = std::max(npart_needed, size_t(double(p.size()) * buffer_growth_factor));
+            if (max_npart_allocated > 0)
+                npart_new = std::min(npart_new, max_npart_allocated);
+
+            std::cout << "# [MPIParticles::grow_storage] Task " << FML::ThisTask << " is out of room for particles. "
+                      << "Growing the storage from " << p.size() << " to " << npart_new << " particles\n";
+            p.resize(npart_new);
+#ifdef MEMORY_LOGGING
+            if (memory_label != "")
+                FML::MemoryLog::get()->add_label(p.data(), p.capacity(), memory_label);
+#endif
+        }
+
+        template <class T>
+        void MPIParticles<T>::sort_by_cell(int Nmesh) {
+            const int NDIM = FML::PARTICLE::GetNDIM(T());
+            const size_t NumPart = NpartLocal_in_use;
+
+            // The cell index of each particle together with where it is now
+            std::vector<std::pair<unsigned long long int, size_t>> cell_index(NumPart);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < NumPart; i++) {
+                auto * pos = FML::PARTICLE::GetPos(p[i]);
+                unsigned long long int index = 0;
+                for (int idim = 0; idim < NDIM; idim++) {
+                    int ix = int(pos[idim] * Nmesh);
+                    ix = std::max(0, std::min(ix, Nmesh - 1));
+                    index = index * Nmesh + ix;
+                }
+                cell_index[i] = {index, i};
+            }
+            std::sort(cell_index.begin(), cell_index.end());
+
+            // Permute the particles in-place (following the cycles of the permutation)
+            // such that the particle at i is the one that was at cell_index[i].second
+            for (size_t i = 0; i < NumPart; i++) {
+                if (cell_index[i].second == i)
+                    continue;
+                T tmp = std::move(p[i]);
+                size_t j = i;
+                while (true) {
+                    size_t k = cell_index[j].second;
+                    cell_index[j].second = j;
+                    if (k == i) {
+                        p[j] = std::move(tmp);
+                        break;
+                    }
+                    p[j] = std::move(p[k]);
+                    j = k;
+                }
+            }
+        }
+
         template <class T>
         void MPIParticles<T>::free() {
             p.clear();
@@ -274,8 +453,16 @@ namespace FML {
             // Set the xmin/xmax
             x_min_per_task = FML::GatherFromTasks(&FML::xmin_domain);
             x_max_per_task = FML::GatherFromTasks(&FML::xmax_domain);
-            // Move data from particles into internal storage
-            p = std::move(part);
+            // Move data from particles into internal storage (if the storage uses a different allocator
+            // we have to copy, keeping the capacity, and then free part)
+            if constexpr (std::is_same<Vector<T>, LargeVector<T>>::value) {
+                p = std::move(part);
+            } else {
+                p = LargeVector<T>();
+                p.reserve(part.capacity());
+                p.assign(std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+                Vector<T>().swap(part);
+            }
             // Set number of particles
             NpartLocal_in_use = p.size();
             NpartTotal = NpartLocal_in_use;
@@ -443,7 +630,7 @@ namespace FML {
         }
 
         template <class T>
-        Vector<T> & MPIParticles<T>::get_particles() {
+        LargeVector<T> & MPIParticles<T>::get_particles() {
             return p;
         }
 
@@ -462,6 +649,49 @@ namespace FML {
             return x_max_per_task;
         }
 
+        template <class T>
+        void MPIParticles<T>::rebalance(int nbins_per_task) {
+            if (FML::NTasks == 1)
+                return;
+            assert_mpi(nbins_per_task > 0, "[MPIParticles::rebalance] Need at least one bin per task\n");
+
+            // Histogram of the x-positions of all the particles
+            const int nbins = nbins_per_task * NTasks;
+            std::vector<long long int> count(nbins, 0);
+            for (size_t i = 0; i < NpartLocal_in_use; i++) {
+                const double x = FML::PARTICLE::GetPos(p[i])[0];
+                const int ibin = std::min(std::max(int(x * nbins), 0), nbins - 1);
+                count[ibin]++;
+            }
+#ifdef USE_MPI
+            MPI_Allreduce(MPI_IN_PLACE, count.data(), nbins, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+#endif
+            long long int ntot = 0;
+            for (auto c : count)
+                ntot += c;
+
+            // The boundaries are the quantiles k/NTasks of the distribution (linear within a bin)
+            std::vector<double> boundaries(NTasks + 1, 1.0);
+            boundaries[0] = 0.0;
+            long long int cumulative = 0;
+            int k = 1;
+            for (int ibin = 0; ibin < nbins and k < NTasks; ibin++) {
+                while (k < NTasks and double(cumulative + count[ibin]) >= double(ntot) * k / double(NTasks)) {
+                    const double target = double(ntot) * k / double(NTasks) - double(cumulative);
+                    const double frac = count[ibin] > 0 ? target / double(count[ibin]) : 0.0;
+                    boundaries[k] = std::max((ibin + frac) / double(nbins), boundaries[k - 1]);
+                    k++;
+                }
+                cumulative += count[ibin];
+            }
+
+            for (int i = 0; i < NTasks; i++) {
+                x_min_per_task[i] = boundaries[i];
+                x_max_per_task[i] = boundaries[i + 1];
+            }
+            communicate_particles();
+        }
+
         template <class T>
         T & MPIParticles<T>::operator[](size_t i) {
             return p[i];
@@ -474,6 +704,47 @@ namespace FML {
             b = tmp;
         }
 
+        template <class T>
+        void MPIParticles<T>::create_from_generator(std::function<size_t(T *, size_t)> generator,
+                                                    size_t nallocate,
+                                                    size_t nparts_per_chunk,
+                                                    double xmin_local,
+                                                    double xmax_local) {
+            assert_mpi(nparts_per_chunk > 0, "[MPIParticles::create_from_generator] nparts_per_chunk must be > 0\n");
+
+            // Set the xmin/xmax
+            x_min_per_task = FML::GatherFromTasks(&xmin_local);
+            x_max_per_task = FML::GatherFromTasks(&xmax_local);
+
+            // Allocate memory
+            p.resize(std::max(nallocate, nparts_per_chunk));
+            add_memory_label("MPIPartices::create_from_generator");
+            NpartLocal_in_use = 0;
+
+            // Get a chunk of particles (put after the ones we have) and send them to where they belong
+            int more_to_process_globally = 1;
+            bool more_to_process_locally = true;
+            while (more_to_process_globally) {
+                size_t nnew = 0;
+                if (more_to_process_locally) {
+                    grow_storage(NpartLocal_in_use + nparts_per_chunk);
+                    nnew = generator(p.data() + NpartLocal_in_use, nparts_per_chunk);
+                    assert_mpi(nnew <= nparts_per_chunk,
+                               "[MPIParticles::create_from_generator] Generator gave us more particles than asked for\n");
+                    more_to_process_locally = nnew > 0;
+                }
+                NpartLocal_in_use += nnew;
+
+                more_to_process_globally = int(more_to_process_locally);
+                FML::MaxOverTasks(&more_to_process_globally);
+                communicate_particles();
+            }
+
+            // Total number of particles
+            NpartTotal = NpartLocal_in_use;
+            FML::SumOverTasks(&NpartTotal);
+        }
+
         template <class T>
         void MPIParticles<T>::create_particle_grid(int Npart_1D,
                                                    double buffer_factor,
@@ -586,18 +857,11 @@ namespace FML {
 
         template <class T>
         void MPIParticles<T>::copy_over_recieved_data(std::vector<char> & recv_buffer, size_t Npart_recv) {
-            assert_mpi(NpartLocal_in_use + Npart_recv <= p.size(),
-                       "[MPIParticles::copy_over_recieved_data] Too many particles recieved! Increase buffer\n");
+            grow_storage(NpartLocal_in_use + Npart_recv);
 
-            char * buffer = recv_buffer.data();
-            size_t bytes_processed = 0;
-            for (size_t i = 0; i < Npart_recv; i++) {
-                FML::PARTICLE::AssignFromBuffer(p[NpartLocal_in_use + i], buffer);
-                auto size = FML::PARTICLE::GetSize(p[NpartLocal_in_use + i]);
-                buffer += size;
-                bytes_processed += size;
-                assert(bytes_processed <= recv_buffer.size());
-            }
+            [[maybe_unused]] auto bytes_processed =
+                FML::PARTICLE::AssignRangeFromBuffer(&p[NpartLocal_in_use], Npart_recv, recv_buffer.data());
+            assert(bytes_processed <= recv_buffer.size());
 
             // Update the total number of particles in use
             NpartLocal_in_use += Npart_recv;
@@ -605,9 +869,18 @@ namespace FML {
 
         template <class T>
         void MPIParticles<T>::communicate_particles() {
+            FML_TIMER_REGION("MPIParticles::communicate_particles");
+            start_communicate_particles();
+            finish_communicate_particles();
+        }
+
+        template <class T>
+        void MPIParticles<T>::start_communicate_particles() {
             if (FML::NTasks == 1)
                 return;
 #ifdef USE_MPI
+            assert_mpi(not pending.active,
+                       "[MPIParticles::start_communicate_particles] A communication is allready in progress\n");
 
             // The number of particles we start with
             size_t NpartLocal_in_use_pre_comm = NpartLocal_in_use;
@@ -623,85 +896,138 @@ namespace FML {
             T tmp{};
             using PosType = std::remove_reference_t<decltype(tmp.get_pos()[0])>;
 
+            // Move the particles to be send to the back of the array and reduce the NumPartLocal_in_use
+            // accordingly. After this is done we have all the particles to be send in location
+            // [NpartLocal_in_use, NpartLocal_in_use_pre_comm). This is done in parallel: we count how many leave,
+            // find the leaving particles in the front and the staying particles in the back (in index order so the
+            // result does not depend on the number of threads) and swap these
+            const size_t NumPart = NpartLocal_in_use;
+            const double xmin_local = x_min_per_task[ThisTask];
+            const double xmax_local = x_max_per_task[ThisTask];
+            auto is_leaving = [&](T & part) {
+                auto & x = FML::PARTICLE::GetPos(part)[0];
+
+                // To fix issues appearing when we are exactly on the boundary
+                if (x == 1.0)
+                    x = std::nextafter(x, PosType(0.0));
+                if (x == 0.0)
+                    x = std::numeric_limits<PosType>::min();
+
+                return x >= xmax_local or x < xmin_local;
+            };
+            size_t nleaving = 0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : nleaving)
+#endif
+            for (size_t i = 0; i < NumPart; i++)
+                if (is_leaving(p[i]))
+                    nleaving++;
+            const size_t nstaying = NumPart - nleaving;
+
+            int nthreads = 1;
+#ifdef USE_OMP
+            nthreads = omp_get_max_threads();
+#endif
+            std::vector<std::vector<size_t>> leaving_in_front(nthreads);
+            std::vector<std::vector<size_t>> staying_in_back(nthreads);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+            for (int ithread = 0; ithread < nthreads; ithread++) {
+                const size_t start = (NumPart * ithread) / nthreads;
+                const size_t end = (NumPart * (ithread + 1)) / nthreads;
+                for (size_t i = start; i < end; i++) {
+                    const auto x = FML::PARTICLE::GetPos(p[i])[0];
+                    const bool leaving = x >= xmax_local or x < xmin_local;
+                    if (i < nstaying and leaving)
+                        leaving_in_front[ithread].push_back(i);
+                    if (i >= nstaying and not leaving)
+                        staying_in_back[ithread].push_back(i);
+                }
+            }
+            std::vector<size_t> front, back;
+            for (int ithread = 0; ithread < nthreads; ithread++) {
+                front.insert(front.end(), leaving_in_front[ithread].begin(), leaving_in_front[ithread].end());
+                back.insert(back.end(), staying_in_back[ithread].begin(), staying_in_back[ithread].end());
+            }
+            assert(front.size() == back.size());
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < front.size(); i++)
+                swap_particles(p[front[i]], p[back[i]]);
+            NpartLocal_in_use = nstaying;
+
             // Count how many particles to send to each task
-            // and move the particles to be send to the back of the array
-            // and reduce the NumPartLocal_in_use if a partice is to be sent
-            // After this is done we have all the particles to be send in
-            // location [NpartLocal_in_use, NpartLocal_in_use_pre_comm)
             std::vector<int> n_to_send(NTasks, 0);
             std::vector<int> n_to_recv(NTasks, 0);
             std::vector<int> nbytes_to_send(NTasks, 0);
             std::vector<int> nbytes_to_recv(NTasks, 0);
-            size_t i = 0;
-            while (i < NpartLocal_in_use) {
-                auto & x = FML::PARTICLE::GetPos(p[i])[0];
-
-                // To fix issues appearing when we are exactly on the boundary
-                if(x == 1.0) x = std::nextafter(x, PosType(0.0));
-                if(x == 0.0) x = std::numeric_limits<PosType>::min();
-
-                if (x >= x_max_per_task[ThisTask]) {
-                    int taskid = ThisTask;
-                    while (1) {
+            const int right_task = (ThisTask + 1) % NTasks;
+            const int left_task = (ThisTask - 1 + NTasks) % NTasks;
+            int far_movers = 0;
+            for (size_t i = nstaying; i < NumPart; i++) {
+                const auto x = FML::PARTICLE::GetPos(p[i])[0];
+                int taskid = ThisTask;
+                if (x >= xmax_local) {
+                    while (x >= x_max_per_task[taskid])
                         ++taskid;
-                        if (x < x_max_per_task[taskid])
-                            break;
-                    }
-
-                    n_to_send[taskid]++;
-                    nbytes_to_send[taskid] += FML::PARTICLE::GetSize(p[i]);
-                    swap_particles(p[i], p[--NpartLocal_in_use]);
-
-                } else if (x < x_min_per_task[ThisTask] or x == 0.0) {
-                    int taskid = ThisTask;
-                    while (1) {
-                        --taskid;
-                        if (x >= x_min_per_task[taskid])
-                            break;
-                    }
-
-                    n_to_send[taskid]++;
-                    nbytes_to_send[taskid] += FML::PARTICLE::GetSize(p[i]);
-                    swap_particles(p[i], p[--NpartLocal_in_use]);
-
                 } else {
-                    i++;
+                    while (x < x_min_per_task[taskid])
+                        --taskid;
                 }
+                n_to_send[taskid]++;
+                nbytes_to_send[taskid] += FML::PARTICLE::GetSize(p[i]);
+                if (taskid != right_task and taskid != left_task)
+                    far_movers = 1;
             }
 
-            // Communicate to get how many to recieve from each task
-            for (int i = 1; i < NTasks; i++) {
-                int send_request_to = (ThisTask + i) % NTasks;
-                int get_request_from = (ThisTask - i + NTasks) % NTasks;
+            // Where the data to each task starts in what we send. The same for the bitwise and the buffered
+            // communication as these agree on the bytes of each particle. Tasks on the same node as us need this
+            // to read it from the shared memory window
+            std::vector<long long int> offset_to_send(NTasks, 0);
+            std::vector<long long int> offset_at_sender(NTasks, 0);
+            for (int i = 1; i < NTasks; i++)
+                offset_to_send[i] = offset_to_send[i - 1] + nbytes_to_send[i - 1];
+
+            // After a normal timestep particles only move to the neighboring tasks. If this is true for all tasks
+            // we only need to talk to the neighbors, otherwise we do a send-recv with every task. The tasks we
+            // exchange with are given as shifts (send to ThisTask + shift and recieve from ThisTask - shift)
+            FML::MaxOverTasks(&far_movers);
+            std::vector<int> shifts;
+            if (far_movers == 0 and NTasks > 3) {
+                shifts = {1, NTasks - 1};
+            } else {
+                for (int i = 1; i < NTasks; i++)
+                    shifts.push_back(i);
+            }
+
+            // Communicate to get how many to recieve from each task (and how many bytes if part can have
+            // variable size)
+            for (auto shift : shifts) {
+                int send_request_to = (ThisTask + shift) % NTasks;
+                int get_request_from = (ThisTask - shift + NTasks) % NTasks;
 
                 // Send to the right, recieve from left
                 MPI_Status status;
-                MPI_Sendrecv(&n_to_send[send_request_to],
-                             1,
-                             MPI_INT,
+                std::array<long long int, 3> send_counts = {
+                    n_to_send[send_request_to], nbytes_to_send[send_request_to], offset_to_send[send_request_to]};
+                std::array<long long int, 3> recv_counts;
+                MPI_Sendrecv(send_counts.data(),
+                             3,
+                             MPI_LONG_LONG,
                              send_request_to,
                              0,
-                             &n_to_recv[get_request_from],
-                             1,
-                             MPI_INT,
-                             get_request_from,
-                             0,
-                             MPI_COMM_WORLD,
-                             &status);
-
-                // If part can have variable size
-                MPI_Sendrecv(&nbytes_to_send[send_request_to],
-                             1,
-                             MPI_INT,
-                             send_request_to,
-                             0,
-                             &nbytes_to_recv[get_request_from],
-                             1,
-                             MPI_INT,
+                             recv_counts.data(),
+                             3,
+                             MPI_LONG_LONG,
                              get_request_from,
                              0,
                              MPI_COMM_WORLD,
                              &status);
+                n_to_recv[get_request_from] = int(recv_counts[0]);
+                nbytes_to_recv[get_request_from] = int(recv_counts[1]);
+                offset_at_sender[get_request_from] = recv_counts[2];
             }
 
 #ifdef DEBUG_MPIPARTICLES
@@ -734,21 +1060,47 @@ namespace FML {
             error += "Possible cause is particles not being wrapped inside [0,1) or not communicated after they have moved across boundaries!\n";
             assert_mpi(NpartLocal_in_use_pre_comm == NpartLocal_in_use + ntot_to_send, error.c_str());
 
+            // Particles that are just bytes are sent directly from the particle array and recieved directly into
+            // it (after the particles we send) so we don't have to pack them into a buffer. This needs room for
+            // both the particles we send and the ones we recieve, if not we fall back to using buffers
+            pending.active = true;
+            pending.bitwise = false;
+            pending.ntot_to_send = ntot_to_send;
+            pending.ntot_to_recv = ntot_to_recv;
+            pending.requests.clear();
+            if constexpr (FML::PARTICLE::is_bitwise_communicable<T>()) {
+                if (NpartLocal_in_use_pre_comm + ntot_to_recv <= p.size()) {
+                    start_communicate_particles_bitwise(shifts, n_to_send, n_to_recv, offset_at_sender);
+                    return;
+                }
+            }
+
             // Allocate send buffer
-            std::vector<char> send_buffer(ntot_bytes_to_send);
-            std::vector<char> recv_buffer(ntot_bytes_to_recv);
+            auto & send_buffer = pending.send_buffer;
+            auto & recv_buffer = pending.recv_buffer;
+            send_buffer.resize(ntot_bytes_to_send);
+            recv_buffer.resize(ntot_bytes_to_recv);
 
             // Pointers to each send-recv place in the send-recv buffer
             std::vector<size_t> offset_in_send_buffer(NTasks, 0);
             std::vector<size_t> offset_in_recv_buffer(NTasks, 0);
-            std::vector<char *> send_buffer_by_task(NTasks, send_buffer.data());
+            std::vector<char *> send_buffer_start(NTasks, send_buffer.data());
             std::vector<char *> recv_buffer_by_task(NTasks, recv_buffer.data());
             for (int i = 1; i < NTasks; i++) {
                 offset_in_send_buffer[i] = offset_in_send_buffer[i - 1] + nbytes_to_send[i - 1];
                 offset_in_recv_buffer[i] = offset_in_recv_buffer[i - 1] + nbytes_to_recv[i - 1];
-                send_buffer_by_task[i] = &send_buffer.data()[offset_in_send_buffer[i]];
+                send_buffer_start[i] = &send_buffer.data()[offset_in_send_buffer[i]];
                 recv_buffer_by_task[i] = &recv_buffer.data()[offset_in_recv_buffer[i]];
             }
+#if defined(USE_MPI) && !defined(NO_MPI_SHARED_MEMORY)
+            // The particles to tasks on the same node are packed directly into the shared memory window
+            auto & window = node_window();
+            window.ensure_capacity(ntot_bytes_to_send);
+            for (int i = 0; i < NTasks; i++)
+                if (FML::NodeRankOfTask[i] >= 0)
+                    send_buffer_start[i] = window.local() + offset_in_send_buffer[i];
+#endif
+            std::vector<char *> send_buffer_by_task = send_buffer_start;
 
             // Gather particle data
             for (size_t i = 0; i < ntot_to_send; i++) {
@@ -786,35 +1138,165 @@ namespace FML {
                 }
             }
 
-            // We changed the send-recv pointers above so reset them
-            for (int i = 0; i < NTasks; i++) {
-                send_buffer_by_task[i] = &send_buffer.data()[offset_in_send_buffer[i]];
-                recv_buffer_by_task[i] = &recv_buffer.data()[offset_in_recv_buffer[i]];
+            // We changed the send pointers above so reset them
+            send_buffer_by_task = send_buffer_start;
+
+#if defined(USE_MPI) && !defined(NO_MPI_SHARED_MEMORY)
+            recieve_from_tasks_on_node(shifts, recv_buffer_by_task, nbytes_to_recv, offset_at_sender);
+#endif
+
+            // Start the communication of the particle data (send to the right, recieve from left)
+            for (auto shift : shifts) {
+                int send_request_to = (ThisTask + shift) % NTasks;
+                int get_request_from = (ThisTask - shift + NTasks) % NTasks;
+                if (on_other_node(get_request_from) and nbytes_to_recv[get_request_from] > 0) {
+                    pending.requests.emplace_back();
+                    MPI_Irecv(recv_buffer_by_task[get_request_from],
+                              nbytes_to_recv[get_request_from],
+                              MPI_CHAR,
+                              get_request_from,
+                              0,
+                              MPI_COMM_WORLD,
+                              &pending.requests.back());
+                }
+                if (on_other_node(send_request_to) and nbytes_to_send[send_request_to] > 0) {
+                    pending.requests.emplace_back();
+                    MPI_Isend(send_buffer_by_task[send_request_to],
+                              nbytes_to_send[send_request_to],
+                              MPI_CHAR,
+                              send_request_to,
+                              0,
+                              MPI_COMM_WORLD,
+                              &pending.requests.back());
+                }
             }
+#endif
+        }
 
-            // Communicate the particle data
+#if defined(USE_MPI) && !defined(NO_MPI_SHARED_MEMORY)
+        template <class T>
+        FML::SharedMemoryWindow & MPIParticles<T>::node_window() {
+            static FML::SharedMemoryWindow window;
+            return window;
+        }
+
+        template <class T>
+        void MPIParticles<T>::recieve_from_tasks_on_node(const std::vector<int> & shifts,
+                                                         const std::vector<char *> & recv_by_task,
+                                                         const std::vector<int> & nbytes_to_recv,
+                                                         const std::vector<long long int> & offset_at_sender) {
+            // Everyone on the node has put what they send in their part of the window. Copy what is ours directly
+            // from there and wait for the others to do the same before the window can be changed again
+            auto & window = node_window();
+            window.sync();
+            for (auto shift : shifts) {
+                int get_request_from = (ThisTask - shift + NTasks) % NTasks;
+                if (FML::NodeRankOfTask[get_request_from] >= 0 and nbytes_to_recv[get_request_from] > 0)
+                    std::memcpy(recv_by_task[get_request_from],
+                                window.of_task(get_request_from) + offset_at_sender[get_request_from],
+                                nbytes_to_recv[get_request_from]);
+            }
+            window.sync();
+        }
+#endif
+
+        template <class T>
+        void MPIParticles<T>::start_communicate_particles_bitwise(
+            [[maybe_unused]] const std::vector<int> & shifts,
+            [[maybe_unused]] const std::vector<int> & n_to_send,
+            [[maybe_unused]] const std::vector<int> & n_to_recv,
+            [[maybe_unused]] const std::vector<long long int> & offset_at_sender) {
+#ifdef USE_MPI
+            // The particles to send are in [NpartLocal_in_use, NpartLocal_in_use + ntot_to_send). The tasks
+            // domains are ordered in x so sorting them by x groups them by the task they go to
+            T * send = p.data() + NpartLocal_in_use;
+            T * recv = send + pending.ntot_to_send;
+            std::sort(send, recv, [](const T & a, const T & b) {
+                return FML::PARTICLE::GetPos(const_cast<T &>(a))[0] < FML::PARTICLE::GetPos(const_cast<T &>(b))[0];
+            });
+
+            // Where the particles to and from each task starts
+            std::vector<size_t> offset_in_send(NTasks, 0);
+            std::vector<size_t> offset_in_recv(NTasks, 0);
             for (int i = 1; i < NTasks; i++) {
-                int send_request_to = (ThisTask + i) % NTasks;
-                int get_request_from = (ThisTask - i + NTasks) % NTasks;
+                offset_in_send[i] = offset_in_send[i - 1] + n_to_send[i - 1];
+                offset_in_recv[i] = offset_in_recv[i - 1] + n_to_recv[i - 1];
+            }
+
+#if defined(USE_MPI) && !defined(NO_MPI_SHARED_MEMORY)
+            // The particles to tasks on the same node go through the shared memory window
+            auto & window = node_window();
+            window.ensure_capacity(pending.ntot_to_send * sizeof(T));
+            for (auto shift : shifts) {
+                int send_request_to = (ThisTask + shift) % NTasks;
+                if (FML::NodeRankOfTask[send_request_to] >= 0 and n_to_send[send_request_to] > 0)
+                    std::memcpy(window.local() + offset_in_send[send_request_to] * sizeof(T),
+                                send + offset_in_send[send_request_to],
+                                n_to_send[send_request_to] * sizeof(T));
+            }
+            std::vector<char *> recv_by_task(NTasks);
+            std::vector<int> nbytes_to_recv(NTasks);
+            for (int i = 0; i < NTasks; i++) {
+                recv_by_task[i] = reinterpret_cast<char *>(recv + offset_in_recv[i]);
+                nbytes_to_recv[i] = int(n_to_recv[i] * sizeof(T));
+            }
+            recieve_from_tasks_on_node(shifts, recv_by_task, nbytes_to_recv, offset_at_sender);
+#endif
+
+            pending.bitwise = true;
+            pending.particle_type = FML::PARTICLE::create_particle_mpi_datatype<T>();
+            for (auto shift : shifts) {
+                int send_request_to = (ThisTask + shift) % NTasks;
+                int get_request_from = (ThisTask - shift + NTasks) % NTasks;
 
                 // Send to the right, recieve from left
-                MPI_Status status;
-                MPI_Sendrecv(send_buffer_by_task[send_request_to],
-                             nbytes_to_send[send_request_to],
-                             MPI_CHAR,
-                             send_request_to,
-                             0,
-                             recv_buffer_by_task[get_request_from],
-                             nbytes_to_recv[get_request_from],
-                             MPI_CHAR,
-                             get_request_from,
-                             0,
-                             MPI_COMM_WORLD,
-                             &status);
+                if (on_other_node(get_request_from) and n_to_recv[get_request_from] > 0) {
+                    pending.requests.emplace_back();
+                    MPI_Irecv(recv + offset_in_recv[get_request_from],
+                              n_to_recv[get_request_from],
+                              pending.particle_type,
+                              get_request_from,
+                              0,
+                              MPI_COMM_WORLD,
+                              &pending.requests.back());
+                }
+                if (on_other_node(send_request_to) and n_to_send[send_request_to] > 0) {
+                    pending.requests.emplace_back();
+                    MPI_Isend(send + offset_in_send[send_request_to],
+                              n_to_send[send_request_to],
+                              pending.particle_type,
+                              send_request_to,
+                              0,
+                              MPI_COMM_WORLD,
+                              &pending.requests.back());
+                }
+            }
+#endif
+        }
+
+        template <class T>
+        void MPIParticles<T>::finish_communicate_particles() {
+#ifdef USE_MPI
+            if (not pending.active)
+                return;
+            MPI_Waitall(int(pending.requests.size()), pending.requests.data(), MPI_STATUSES_IGNORE);
+            pending.requests.clear();
+            pending.active = false;
+
+            if (pending.bitwise) {
+                // Move the recieved particles down in place of the ones we sent
+                T * send = p.data() + NpartLocal_in_use;
+                T * recv = send + pending.ntot_to_send;
+                std::copy(recv, recv + pending.ntot_to_recv, send);
+                NpartLocal_in_use += pending.ntot_to_recv;
+                MPI_Type_free(&pending.particle_type);
+                return;
             }
 
             // Copy over the particle data (this also updates the total number of particles)
-            copy_over_recieved_data(recv_buffer, ntot_to_recv);
+            copy_over_recieved_data(pending.recv_buffer, pending.ntot_to_recv);
+            pending.send_buffer = std::vector<char>();
+            pending.recv_buffer = std::vector<char>();
 #endif
         }
 
@@ -835,10 +1317,8 @@ namespace FML {
 
             int ndim = FML::PARTICLE::GetNDIM(T());
 
-            // Compute total bytes to write
-            size_t total_bytes_to_write = 0;
-            for (auto & part : p)
-                total_bytes_to_write += FML::PARTICLE::GetSize(part);
+            // Compute total bytes to write (checked against what we actually write below)
+            const size_t total_bytes_to_write = FML::PARTICLE::GetRangeSize(p.data(), NpartLocal_in_use);
 
             // Write header data
             size_t NpartLocalAllocated = p.size();
@@ -859,34 +1339,232 @@ namespace FML {
 
             // Write in chunks
             size_t nwritten = 0;
+            size_t nbytes_written = 0;
             while (nwritten < NpartLocal_in_use) {
 
-                size_t n_to_write = NpartLocal_in_use;
-                size_t nbytes_to_write = 0;
+                size_t n_to_write = NpartLocal_in_use - nwritten;
 
                 std::cout << "Writing " << nwritten << std::endl;
 
-                char * buffer = buffer_data.data();
-                for (size_t i = 0; i < n_to_write; i++) {
-                    auto bytes = FML::PARTICLE::GetSize(p[nwritten + i]);
-                    if (nbytes_to_write + bytes > max_bytesize_buffer) {
-                        n_to_write = i;
-                        break;
+                // How many particles fit in the buffer
+                if constexpr (FML::PARTICLE::ParticleLayout<T>::fixed_size) {
+                    n_to_write = std::min(n_to_write, max_bytesize_buffer / sizeof(T));
+                } else {
+                    size_t nbytes = 0;
+                    for (size_t i = 0; i < n_to_write; i++) {
+                        nbytes += FML::PARTICLE::GetSize(p[nwritten + i]);
+                        if (nbytes > max_bytesize_buffer) {
+                            n_to_write = i;
+                            break;
+                        }
                     }
-                    FML::PARTICLE::AppendToBuffer(p[nwritten + i], buffer);
-                    buffer += bytes;
-                    nbytes_to_write += bytes;
                 }
+                size_t nbytes_to_write =
+                    FML::PARTICLE::AppendRangeToBuffer(&p[nwritten], n_to_write, buffer_data.data());
                 myfile.write((char *)&n_to_write, sizeof(n_to_write));
                 myfile.write((char *)&nbytes_to_write, sizeof(nbytes_to_write));
                 myfile.write((char *)buffer_data.data(), nbytes_to_write);
 
                 nwritten += n_to_write;
+                nbytes_written += nbytes_to_write;
             }
+            assert_mpi(nbytes_written == total_bytes_to_write,
+                       "[MPIParticles::dump_to_file] Bytes written does not match the size of the particles\n");
             myfile.close();
             std::ios_base::sync_with_stdio(true);
         }
 
+        // Write/read nbytes at a given offset in a file. With MPI we use MPI-IO with all tasks writing to the
+        // same file, otherwise a normal file. The counts in MPI-IO are int so we do it in pieces
+#ifdef USE_MPI
+        using SharedFileType = MPI_File;
+#else
+        using SharedFileType = std::fstream;
+#endif
+        inline void shared_file_write_at(SharedFileType & file, size_t offset, const char * data, size_t nbytes) {
+#ifdef USE_MPI
+            const size_t max_bytes = 1 << 30;
+            for (size_t n = 0; n < nbytes; n += max_bytes) {
+                MPI_Status status;
+                MPI_File_write_at(file,
+                                  MPI_Offset(offset + n),
+                                  data + n,
+                                  int(std::min(max_bytes, nbytes - n)),
+                                  MPI_CHAR,
+                                  &status);
+            }
+#else
+            file.seekp(offset);
+            file.write(data, nbytes);
+#endif
+        }
+        inline void shared_file_read_at(SharedFileType & file, size_t offset, char * data, size_t nbytes) {
+#ifdef USE_MPI
+            const size_t max_bytes = 1 << 30;
+            for (size_t n = 0; n < nbytes; n += max_bytes) {
+                MPI_Status status;
+                MPI_File_read_at(file,
+                                 MPI_Offset(offset + n),
+                                 data + n,
+                                 int(std::min(max_bytes, nbytes - n)),
+                                 MPI_CHAR,
+                                 &status);
+            }
+#else
+            file.seekg(offset);
+            file.read(data, nbytes);
+#endif
+        }
+
+        // The header of the shared file: an id, the dimension, the total number of particles and the number
+        // of chunks. This is followed by the number of particles and bytes in each chunk and then the data
+        struct SharedFileHeader {
+            int magic{0x464d4c50};
+            int ndim{0};
+            size_t npart_total{0};
+            size_t nchunks{0};
+        };
+
+        template <class T>
+        void MPIParticles<T>::dump_to_shared_file(std::string filename, size_t nparts_per_chunk) {
+            assert_mpi(nparts_per_chunk > 0, "[MPIParticles::dump_to_shared_file] nparts_per_chunk must be > 0\n");
+
+            // Split the local particles into chunks
+            std::vector<size_t> chunk_table;
+            size_t nbytes_local = 0;
+            for (size_t start = 0; start < NpartLocal_in_use; start += nparts_per_chunk) {
+                size_t n = std::min(nparts_per_chunk, NpartLocal_in_use - start);
+                size_t nbytes = FML::PARTICLE::GetRangeSize(&p[start], n);
+                chunk_table.push_back(n);
+                chunk_table.push_back(nbytes);
+                nbytes_local += nbytes;
+            }
+
+            // Where in the file this task writes its chunk table and data
+            size_t nchunks_local = chunk_table.size() / 2;
+            auto nchunks_per_task = FML::GatherFromTasks(&nchunks_local);
+            auto nbytes_per_task = FML::GatherFromTasks(&nbytes_local);
+            SharedFileHeader header;
+            header.ndim = FML::PARTICLE::GetNDIM(T());
+            header.npart_total = NpartTotal;
+            header.nchunks = std::accumulate(nchunks_per_task.begin(), nchunks_per_task.end(), size_t(0));
+            size_t table_offset = sizeof(header);
+            size_t data_offset = sizeof(header) + 2 * sizeof(size_t) * header.nchunks;
+            for (int i = 0; i < FML::ThisTask; i++) {
+                table_offset += 2 * sizeof(size_t) * nchunks_per_task[i];
+                data_offset += nbytes_per_task[i];
+            }
+
+#ifdef USE_MPI
+            MPI_File file;
+            int err = MPI_File_open(
+                MPI_COMM_WORLD, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+            assert_mpi(err == MPI_SUCCESS,
+                       ("[MPIParticles::dump_to_shared_file] Failed to open file " + filename + "\n").c_str());
+            MPI_File_set_size(file, 0);
+#else
+            auto file = std::fstream(filename, std::ios::out | std::ios::binary);
+            assert_mpi(file.good(),
+                       ("[MPIParticles::dump_to_shared_file] Failed to open file " + filename + "\n").c_str());
+#endif
+
+            if (FML::ThisTask == 0)
+                shared_file_write_at(file, 0, (char *)&header, sizeof(header));
+            shared_file_write_at(file, table_offset, (char *)chunk_table.data(), sizeof(size_t) * chunk_table.size());
+
+            // Write the data one chunk at a time
+            std::vector<char> buffer_data;
+            size_t start = 0;
+            for (size_t ichunk = 0; ichunk < nchunks_local; ichunk++) {
+                const size_t n = chunk_table[2 * ichunk];
+                const size_t nbytes = chunk_table[2 * ichunk + 1];
+                buffer_data.resize(nbytes);
+                FML::PARTICLE::AppendRangeToBuffer(&p[start], n, buffer_data.data());
+                shared_file_write_at(file, data_offset, buffer_data.data(), nbytes);
+                data_offset += nbytes;
+                start += n;
+            }
+
+#ifdef USE_MPI
+            MPI_File_close(&file);
+#else
+            file.close();
+#endif
+        }
+
+        template <class T>
+        void MPIParticles<T>::load_from_shared_file(std::string filename, double buffer_factor) {
+#ifdef USE_MPI
+            MPI_File file;
+            int err = MPI_File_open(MPI_COMM_WORLD, filename.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+            assert_mpi(err == MPI_SUCCESS,
+                       ("[MPIParticles::load_from_shared_file] Failed to open file " + filename + "\n").c_str());
+#else
+            auto file = std::fstream(filename, std::ios::in | std::ios::binary);
+            assert_mpi(file.good(),
+                       ("[MPIParticles::load_from_shared_file] Failed to open file " + filename + "\n").c_str());
+#endif
+
+            // Read the header and the chunk table
+            SharedFileHeader header;
+            shared_file_read_at(file, 0, (char *)&header, sizeof(header));
+            assert_mpi(header.magic == SharedFileHeader().magic,
+                       "[MPIParticles::load_from_shared_file] This is not a file written by dump_to_shared_file\n");
+            assert_mpi(header.ndim == FML::PARTICLE::GetNDIM(T()),
+                       "[MPIParticles::load_from_shared_file] Particle dimension do not match the one in the file\n");
+            std::vector<size_t> chunk_table(2 * header.nchunks);
+            shared_file_read_at(file, sizeof(header), (char *)chunk_table.data(), sizeof(size_t) * chunk_table.size());
+
+            // Divide the chunks between the tasks so that each gets about the same number of particles
+            size_t first_chunk = header.nchunks, last_chunk = header.nchunks;
+            size_t data_offset = sizeof(header) + sizeof(size_t) * chunk_table.size();
+            size_t my_data_offset = data_offset;
+            size_t npart_before = 0, npart_local = 0;
+            for (size_t ichunk = 0; ichunk < header.nchunks; ichunk++) {
+                const int task = header.npart_total == 0 ? 0 : int((npart_before * FML::NTasks) / header.npart_total);
+                if (task == FML::ThisTask) {
+                    if (first_chunk == header.nchunks) {
+                        first_chunk = ichunk;
+                        my_data_offset = data_offset;
+                    }
+                    last_chunk = ichunk + 1;
+                    npart_local += chunk_table[2 * ichunk];
+                }
+                npart_before += chunk_table[2 * ichunk];
+                data_offset += chunk_table[2 * ichunk + 1];
+            }
+
+            // Set the domains and allocate memory
+            x_min_per_task = FML::GatherFromTasks(&FML::xmin_domain);
+            x_max_per_task = FML::GatherFromTasks(&FML::xmax_domain);
+            NpartTotal = header.npart_total;
+            size_t nallocate = size_t(buffer_factor * double(NpartTotal) / double(FML::NTasks));
+            p.resize(std::max(nallocate, npart_local));
+            add_memory_label("MPIPartices::load_from_shared_file");
+
+            // Read the chunks
+            std::vector<char> buffer_data;
+            NpartLocal_in_use = 0;
+            for (size_t ichunk = first_chunk; ichunk < last_chunk; ichunk++) {
+                const size_t n = chunk_table[2 * ichunk];
+                const size_t nbytes = chunk_table[2 * ichunk + 1];
+                buffer_data.resize(nbytes);
+                shared_file_read_at(file, my_data_offset, buffer_data.data(), nbytes);
+                FML::PARTICLE::AssignRangeFromBuffer(&p[NpartLocal_in_use], n, buffer_data.data());
+                NpartLocal_in_use += n;
+                my_data_offset += nbytes;
+            }
+
+#ifdef USE_MPI
+            MPI_File_close(&file);
+#else
+            file.close();
+#endif
+
+            // Send the particles to the task they belong to
+            communicate_particles();
+        }
+
         template <class T>
         void MPIParticles<T>::load_from_file(std::string fileprefix) {
             std::ios_base::sync_with_stdio(false);
@@ -938,10 +1616,7 @@ namespace FML {
                 std::cout << "Reading " << n_to_read << " / " << NpartLocal_in_use << " " << nbytes_to_read << " "
                           << buffer_data.size() << std::endl;
                 myfile.read(buffer, nbytes_to_read);
-                for (size_t i = 0; i < n_to_read; i++) {
-                    FML::PARTICLE::AssignFromBuffer(p[nread + i], buffer);
-                    buffer += FML::PARTICLE::GetSize(p[nread + i]);
-                }
+                FML::PARTICLE::AssignRangeFromBuffer(&p[nread], n_to_read, buffer);
 
                 nread += n_to_read;
             }
@@ -949,6 +1624,79 @@ namespace FML {
             std::ios_base::sync_with_stdio(true);
         }
 
+        /// Get the particles on the other tasks that are within a distance rmax (in units of the boxsize) in x of the
+        /// x-domain of the current task (the ghosts) and return them together with the local particles (first). This is
+        /// what we need to do neighbour searches (pair counts, kd-trees, ...) when every task only has the particles in
+        /// its own x-domain [FML::xmin_domain, FML::xmax_domain) like in MPIParticles.
+        template <class T>
+        std::vector<T> get_particles_with_ghosts(const T * part, size_t npart, double rmax, bool periodic_box) {
+            std::vector<T> part_with_ghosts(part, part + npart);
+#ifdef USE_MPI
+            static_assert(std::is_trivially_copyable_v<T>,
+                          "[get_particles_with_ghosts] The particles must be trivially copyable");
+
+            // The x-domains of all the tasks
+            double xmin_local = FML::xmin_domain;
+            double xmax_local = FML::xmax_domain;
+            const auto xmin_per_task = FML::GatherFromTasks(&xmin_local);
+            const auto xmax_per_task = FML::GatherFromTasks(&xmax_local);
+
+            // The distance from x to the domain of a task (with periodic wrapping)
+            auto distance_to_domain = [&](double x, int task) {
+                auto distance = [&](double xx) {
+                    if (xx < xmin_per_task[task])
+                        return xmin_per_task[task] - xx;
+                    if (xx >= xmax_per_task[task])
+                        return xx - xmax_per_task[task];
+                    return 0.0;
+                };
+                if (periodic_box)
+                    return std::min(distance(x), std::min(distance(x - 1.0), distance(x + 1.0)));
+                return distance(x);
+            };
+
+            // Find the particles the other tasks need
+            std::vector<std::vector<T>> send(FML::NTasks);
+            for (size_t i = 0; i < npart; i++) {
+                const auto x = FML::PARTICLE::GetPos(const_cast<T &>(part[i]))[0];
+                for (int task = 0; task < FML::NTasks; task++)
+                    if (task != FML::ThisTask and distance_to_domain(x, task) < rmax)
+                        send[task].push_back(part[i]);
+            }
+
+            // Exchange them
+            std::vector<int> nsend(FML::NTasks), nrecv(FML::NTasks), send_offset(FML::NTasks),
+                recv_offset(FML::NTasks);
+            std::vector<T> send_buffer;
+            for (int task = 0; task < FML::NTasks; task++) {
+                nsend[task] = int(send[task].size() * sizeof(T));
+                send_offset[task] = int(send_buffer.size() * sizeof(T));
+                send_buffer.insert(send_buffer.end(), send[task].begin(), send[task].end());
+                send[task] = std::vector<T>();
+            }
+            MPI_Alltoall(nsend.data(), 1, MPI_INT, nrecv.data(), 1, MPI_INT, MPI_COMM_WORLD);
+            size_t nbytes_recv = 0;
+            for (int task = 0; task < FML::NTasks; task++) {
+                recv_offset[task] = int(nbytes_recv);
+                nbytes_recv += nrecv[task];
+            }
+            part_with_ghosts.resize(npart + nbytes_recv / sizeof(T));
+            MPI_Alltoallv(send_buffer.data(),
+                          nsend.data(),
+                          send_offset.data(),
+                          MPI_BYTE,
+                          reinterpret_cast<char *>(part_with_ghosts.data() + npart),
+                          nrecv.data(),
+                          recv_offset.data(),
+                          MPI_BYTE,
+                          MPI_COMM_WORLD);
+#else
+            (void)rmax;
+            (void)periodic_box;
+#endif
+            return part_with_ghosts;
+        }
+
     } // namespace PARTICLE
 } // namespace FML
 #endif
@@ -0,0 +1,418 @@
+#ifndef MPIPARTICLESSOA_HEADER
+#define MPIPARTICLESSOA_HEADER
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#include <FML/Global/Global.h>
+#include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+
+namespace FML {
+    namespace PARTICLE {
+
+        //===========================================================
+        /// The elements of the position column of MPIParticlesSoA. This is a particle with only a position so the
+        /// column can be given directly to the algorithms that only need positions (e.g. particles_to_grid,
+        /// interpolate_grid_to_particle_positions or the FoF cell binning) and they stream through the positions only.
+        //===========================================================
+        template <int NDIM, class PosType = double>
+        struct SoAPosition {
+            PosType Pos[NDIM];
+            constexpr int get_ndim() const { return NDIM; }
+            PosType * get_pos() { return Pos; }
+        };
+
+        //===========================================================
+        ///
+        /// A structure-of-arrays version of MPIParticles. The positions, velocities, ids and (if WITH_MASS) masses
+        /// are stored in separate columns so loops that only need some of the fields (drift, density assignment,
+        /// ...) only read those. The column of positions is an array of SoAPosition that can be used with all
+        /// the algorithms that take a pointer to particles and only need their positions. The particles can also
+        /// be accessed one at a time (part[i] or for(auto p : part)) as references that have the usual get_pos,
+        /// get_vel, get_id (and get_mass) methods so the reflection helpers GetPos, GetVel, ... work on them.
+        ///
+        /// The columns are std::vectors so we don't need a buffer for particles moving between tasks.
+        /// NB: the position column has no mass, so density assignment from it gives all particles the same weight.
+        ///
+        /// Example use:
+        ///
+        ///   MPIParticlesSoA<NDIM> part;
+        ///   part.create(aos_particles.data(), NumPart, FML::xmin_domain, FML::xmax_domain, true);
+        ///   particles_to_grid<NDIM>(part.get_pos_ptr(), part.get_npart(), part.get_npart_total(), density, "CIC");
+        ///   part.drift(delta_time);
+        ///
+        //===========================================================
+        template <int NDIM, bool WITH_MASS = false, class PosType = double>
+        class MPIParticlesSoA {
+          public:
+            using PositionType = SoAPosition<NDIM, PosType>;
+            using IDType = long long int;
+
+            /// A reference to a particle (so the reflection helpers work on it)
+            class ParticleRefBase {
+              public:
+                ParticleRefBase(MPIParticlesSoA * part, size_t i) : part(part), i(i) {}
+                constexpr int get_ndim() const { return NDIM; }
+                PosType * get_pos() { return part->pos[i].Pos; }
+                PosType * get_vel() { return part->vel[i].data(); }
+                IDType get_id() const { return part->id[i]; }
+                void set_id(IDType _id) { part->id[i] = _id; }
+
+              protected:
+                MPIParticlesSoA * part;
+                size_t i;
+            };
+            class ParticleRefWithMass : public ParticleRefBase {
+              public:
+                using ParticleRefBase::ParticleRefBase;
+                double get_mass() const { return this->part->mass[this->i]; }
+                void set_mass(double _mass) { this->part->mass[this->i] = _mass; }
+            };
+            using ParticleRef = std::conditional_t<WITH_MASS, ParticleRefWithMass, ParticleRefBase>;
+
+            class iterator {
+              public:
+                iterator(MPIParticlesSoA * part, size_t i) : part(part), i(i) {}
+                iterator operator++() {
+                    ++i;
+                    return *this;
+                }
+                bool operator!=(const iterator & other) { return i != other.i; }
+                ParticleRef operator*() { return ParticleRef(part, i); }
+
+              private:
+                MPIParticlesSoA * part;
+                size_t i;
+            };
+
+            MPIParticlesSoA() = default;
+
+            /// Create from a set of (array of structs) particles. We only keep the particles that are in the
+            /// x-range of the task if all_tasks_has_the_same_particles is true, otherwise the particles are
+            /// communicated to the right task. The fields the particles don't have are set to zero (the ids to
+            /// the index of the particle if all tasks have the same particles)
+            template <class T>
+            void create(T * part,
+                        size_t NumParts,
+                        double xmin_local,
+                        double xmax_local,
+                        bool all_tasks_has_the_same_particles);
+
+            /// Copy the particles to a vector of (array of structs) particles. Only the fields T has are set
+            template <class T>
+            void copy_to(std::vector<T> & part);
+
+            /// The column of positions. Can be used as a pointer to particles in algorithms that only use positions
+            PositionType * get_pos_ptr() { return pos.data(); }
+            /// The column of velocities
+            std::array<PosType, NDIM> * get_vel_ptr() { return vel.data(); }
+            /// The column of ids
+            IDType * get_id_ptr() { return id.data(); }
+            /// The column of masses
+            double * get_mass_ptr() {
+                static_assert(WITH_MASS, "[MPIParticlesSoA::get_mass_ptr] We don't store the mass\n");
+                return mass.data();
+            }
+
+            /// Access particles through indexing operator
+            ParticleRef operator[](size_t i) { return ParticleRef(this, i); }
+            /// Iterator: points to the first local particle
+            iterator begin() { return iterator(this, 0); }
+            /// Iterator: points to one past the last local particle
+            iterator end() { return iterator(this, pos.size()); }
+
+            /// Total number of particles across all tasks
+            size_t get_npart_total() const { return NpartTotal; }
+            /// Number of particles on the local task
+            size_t get_npart() const { return pos.size(); }
+
+            /// Move the particles x -> x + v * delta_time and communicate them
+            void drift(double delta_time, bool periodic_box = true);
+
+            /// Communicate particles across CPU boundaries
+            void communicate_particles();
+
+            /// Get a vector of xmin of the domain for each task
+            std::vector<double> get_x_min_per_task() { return x_min_per_task; }
+            /// Get a vector of xmax of the domain for each task
+            std::vector<double> get_x_max_per_task() { return x_max_per_task; }
+
+            /// Free all memory of the stored particles
+            void free();
+
+          private:
+            std::vector<PositionType> pos{};
+            std::vector<std::array<PosType, NDIM>> vel{};
+            std::vector<IDType> id{};
+            std::vector<double> mass{};
+            size_t NpartTotal{0};
+            std::vector<double> x_min_per_task{};
+            std::vector<double> x_max_per_task{};
+
+            // What we send between tasks for each particle
+            struct Record {
+                PositionType pos;
+                std::array<PosType, NDIM> vel;
+                IDType id;
+                double mass;
+            };
+
+            // The task whose domain contains x
+            int task_of_position(PosType x) const;
+            // Add a particle to the end of the columns
+            void push_back(const Record & r);
+            // Remove particle i (by moving the last particle there)
+            void remove(size_t i);
+        };
+
+        template <int NDIM, bool WITH_MASS, class PosType>
+        template <class T>
+        void MPIParticlesSoA<NDIM, WITH_MASS, PosType>::create(T * part,
+                                                               size_t NumParts,
+                                                               double xmin_local,
+                                                               double xmax_local,
+                                                               bool all_tasks_has_the_same_particles) {
+            static_assert(FML::PARTICLE::has_get_pos<T>(),
+                          "[MPIParticlesSoA::create] Particle must have a get_pos method");
+            assert_mpi(FML::PARTICLE::GetNDIM(T()) == NDIM,
+                       "[MPIParticlesSoA::create] NDIM of the particles does not match");
+            if (FML::NTasks == 1)
+                all_tasks_has_the_same_particles = true;
+
+            x_min_per_task = FML::GatherFromTasks(&xmin_local);
+            x_max_per_task = FML::GatherFromTasks(&xmax_local);
+
+            free();
+            for (size_t i = 0; i < NumParts; i++) {
+                Record r{};
+                const auto * p_pos = FML::PARTICLE::GetPos(part[i]);
+                for (int idim = 0; idim < NDIM; idim++)
+                    r.pos.Pos[idim] = p_pos[idim];
+                if (all_tasks_has_the_same_particles and (r.pos.Pos[0] < xmin_local or r.pos.Pos[0] >= xmax_local))
+                    continue;
+                if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                    const auto * p_vel = FML::PARTICLE::GetVel(part[i]);
+                    for (int idim = 0; idim < NDIM; idim++)
+                        r.vel[idim] = p_vel[idim];
+                }
+                if constexpr (FML::PARTICLE::has_get_id<T>())
+                    r.id = FML::PARTICLE::GetID(part[i]);
+                else
+                    r.id = all_tasks_has_the_same_particles ? IDType(i) : IDType(0);
+                if constexpr (FML::PARTICLE::has_get_mass<T>())
+                    r.mass = FML::PARTICLE::GetMass(part[i]);
+                else
+                    r.mass = 1.0;
+                push_back(r);
+            }
+
+            if (not all_tasks_has_the_same_particles)
+                communicate_particles();
+
+            NpartTotal = pos.size();
+            FML::SumOverTasks(&NpartTotal);
+        }
+
+        template <int NDIM, bool WITH_MASS, class PosType>
+        template <class T>
+        void MPIParticlesSoA<NDIM, WITH_MASS, PosType>::copy_to(std::vector<T> & part) {
+            part.resize(get_npart());
+            for (size_t i = 0; i < get_npart(); i++) {
+                auto * p_pos = FML::PARTICLE::GetPos(part[i]);
+                for (int idim = 0; idim < NDIM; idim++)
+                    p_pos[idim] = pos[i].Pos[idim];
+                if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                    auto * p_vel = FML::PARTICLE::GetVel(part[i]);
+                    for (int idim = 0; idim < NDIM; idim++)
+                        p_vel[idim] = vel[i][idim];
+                }
+                if constexpr (FML::PARTICLE::has_set_id<T>())
+                    FML::PARTICLE::SetID(part[i], id[i]);
+                if constexpr (WITH_MASS and FML::PARTICLE::has_set_mass<T>())
+                    FML::PARTICLE::SetMass(part[i], mass[i]);
+            }
+        }
+
+        template <int NDIM, bool WITH_MASS, class PosType>
+        void MPIParticlesSoA<NDIM, WITH_MASS, PosType>::push_back(const Record & r) {
+            pos.push_back(r.pos);
+            vel.push_back(r.vel);
+            id.push_back(r.id);
+            if constexpr (WITH_MASS)
+                mass.push_back(r.mass);
+        }
+
+        template <int NDIM, bool WITH_MASS, class PosType>
+        void MPIParticlesSoA<NDIM, WITH_MASS, PosType>::remove(size_t i) {
+            pos[i] = pos.back();
+            pos.pop_back();
+            vel[i] = vel.back();
+            vel.pop_back();
+            id[i] = id.back();
+            id.pop_back();
+            if constexpr (WITH_MASS) {
+                mass[i] = mass.back();
+                mass.pop_back();
+            }
+        }
+
+        template <int NDIM, bool WITH_MASS, class PosType>
+        int MPIParticlesSoA<NDIM, WITH_MASS, PosType>::task_of_position(PosType x) const {
+            int taskid = FML::ThisTask;
+            while (taskid < FML::NTasks - 1 and x >= x_max_per_task[taskid])
+                ++taskid;
+            while (taskid > 0 and x < x_min_per_task[taskid])
+                --taskid;
+            return taskid;
+        }
+
+        template <int NDIM, bool WITH_MASS, class PosType>
+        void MPIParticlesSoA<NDIM, WITH_MASS, PosType>::drift(double delta_time, bool periodic_box) {
+            const size_t NumPart = get_npart();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < NumPart; i++) {
+                for (int idim = 0; idim < NDIM; idim++) {
+                    auto & x = pos[i].Pos[idim];
+                    x += vel[i][idim] * delta_time;
+                    if (periodic_box)
+                        x = wrap_periodic_branchfree(x);
+                }
+            }
+            communicate_particles();
+        }
+
+        template <int NDIM, bool WITH_MASS, class PosType>
+        void MPIParticlesSoA<NDIM, WITH_MASS, PosType>::communicate_particles() {
+            if (FML::NTasks == 1)
+                return;
+#ifdef USE_MPI
+            const int ThisTask = FML::ThisTask;
+            const int NTasks = FML::NTasks;
+
+            // Take out the particles that have left our domain and sort them by the task they go to
+            std::vector<int> n_to_send(NTasks, 0);
+            std::vector<int> n_to_recv(NTasks, 0);
+            std::vector<std::pair<int, Record>> leaving;
+            int far_movers = 0;
+            size_t i = 0;
+            while (i < pos.size()) {
+                auto & x = pos[i].Pos[0];
+
+                // To fix issues appearing when we are exactly on the boundary
+                if (x == 1.0)
+                    x = std::nextafter(x, PosType(0.0));
+                if (x == 0.0)
+                    x = std::numeric_limits<PosType>::min();
+
+                if (x >= x_min_per_task[ThisTask] and x < x_max_per_task[ThisTask]) {
+                    i++;
+                    continue;
+                }
+                const int taskid = task_of_position(x);
+                if (taskid != (ThisTask + 1) % NTasks and taskid != (ThisTask - 1 + NTasks) % NTasks)
+                    far_movers = 1;
+                Record r{pos[i], vel[i], id[i], 1.0};
+                if constexpr (WITH_MASS)
+                    r.mass = mass[i];
+                leaving.push_back({taskid, r});
+                n_to_send[taskid]++;
+                remove(i);
+            }
+            std::stable_sort(
+                leaving.begin(), leaving.end(), [](const auto & a, const auto & b) { return a.first < b.first; });
+            std::vector<Record> send_buffer(leaving.size());
+            for (size_t j = 0; j < leaving.size(); j++)
+                send_buffer[j] = leaving[j].second;
+            leaving.clear();
+
+            // Same as MPIParticles: only talk to the neighbors if no particles move further than that
+            FML::MaxOverTasks(&far_movers);
+            std::vector<int> shifts;
+            if (far_movers == 0 and NTasks > 3) {
+                shifts = {1, NTasks - 1};
+            } else {
+                for (int shift = 1; shift < NTasks; shift++)
+                    shifts.push_back(shift);
+            }
+
+            // Communicate to get how many to recieve from each task
+            for (auto shift : shifts) {
+                int send_request_to = (ThisTask + shift) % NTasks;
+                int get_request_from = (ThisTask - shift + NTasks) % NTasks;
+                MPI_Status status;
+                MPI_Sendrecv(&n_to_send[send_request_to],
+                             1,
+                             MPI_INT,
+                             send_request_to,
+                             0,
+                             &n_to_recv[get_request_from],
+                             1,
+                             MPI_INT,
+                             get_request_from,
+                             0,
+                             MPI_COMM_WORLD,
+                             &status);
+            }
+
+            std::vector<size_t> offset_in_send(NTasks, 0);
+            std::vector<size_t> offset_in_recv(NTasks, 0);
+            for (int j = 1; j < NTasks; j++) {
+                offset_in_send[j] = offset_in_send[j - 1] + n_to_send[j - 1];
+                offset_in_recv[j] = offset_in_recv[j - 1] + n_to_recv[j - 1];
+            }
+            std::vector<Record> recv_buffer(offset_in_recv[NTasks - 1] + n_to_recv[NTasks - 1]);
+
+            // Communicate the particles
+            MPI_Datatype record_type;
+            MPI_Type_contiguous(sizeof(Record), MPI_BYTE, &record_type);
+            MPI_Type_commit(&record_type);
+            for (auto shift : shifts) {
+                int send_request_to = (ThisTask + shift) % NTasks;
+                int get_request_from = (ThisTask - shift + NTasks) % NTasks;
+                MPI_Status status;
+                MPI_Sendrecv(send_buffer.data() + offset_in_send[send_request_to],
+                             n_to_send[send_request_to],
+                             record_type,
+                             send_request_to,
+                             0,
+                             recv_buffer.data() + offset_in_recv[get_request_from],
+                             n_to_recv[get_request_from],
+                             record_type,
+                             get_request_from,
+                             0,
+                             MPI_COMM_WORLD,
+                             &status);
+            }
+            MPI_Type_free(&record_type);
+
+            for (auto & r : recv_buffer)
+                push_back(r);
+#endif
+        }
+
+        template <int NDIM, bool WITH_MASS, class PosType>
+        void MPIParticlesSoA<NDIM, WITH_MASS, PosType>::free() {
+            pos.clear();
+            pos.shrink_to_fit();
+            vel.clear();
+            vel.shrink_to_fit();
+            id.clear();
+            id.shrink_to_fit();
+            mass.clear();
+            mass.shrink_to_fit();
+        }
+
+    } // namespace PARTICLE
+} // namespace FML
+#endif
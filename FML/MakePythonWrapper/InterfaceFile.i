@@ -1,4 +1,6 @@
-%module MyLibrary
+// threads=1 makes the wrappers release the GIL while the C++ function runs (none of the functions below touch
+// Python objects) so e.g. several power spectra or FoF runs can be done concurrently from Python threads
+%module(threads="1") MyLibrary
 %{
   #define SWIG_FILE_WITH_INIT
 
@@ -12,6 +14,18 @@
   extern void freeData(Data *f);
   extern void getNumpyArray(int nx, double *x, int ny, double *y);
 
+  struct Grid;
+  extern Grid * createGrid(int Nmesh);
+  extern void freeGrid(Grid * g);
+  extern void getRealGridView(Grid * g, double ** view, int * nx, int * ny, int * nz);
+  extern void particlesToGrid(int npart, int ndim, double * pos, Grid * g, const char * density_assignment_method);
+  extern void computePowerSpectrum(int npart, int ndim, double * pos, int Nmesh, const char * density_assignment_method,
+                                   bool interlacing, int nk, double * k, int npofk, double * pofk);
+  struct HaloCatalogue;
+  extern HaloCatalogue * friendsOfFriends(int npart, int ndim, double * pos, double linking_length, int nmin_FoF_group);
+  extern void freeHaloCatalogue(HaloCatalogue * h);
+  extern void getHaloCatalogueView(HaloCatalogue * h, double ** view, int * nhalos, int * ncols);
+
 %}
 
 %include "numpy.i"
@@ -23,6 +37,14 @@ import_array();
 // can with this be called as getNumpyArray(x,y) from python with x,y being 1D numpy arrays
 %apply (int DIM1, double* IN_ARRAY1) {(int nx, double *x), (int ny, double *y)};
 
+// Zero-copy typemaps for FML. INPLACE arrays are used directly (they must be C-contiguous float64 arrays, no
+// conversion is done) and ARGOUTVIEW returns a numpy array that looks at memory owned by a C++ object (keep
+// the object alive as long as you use the view)
+%apply (int DIM1, int DIM2, double* INPLACE_ARRAY2) {(int npart, int ndim, double * pos)};
+%apply (int DIM1, double* INPLACE_ARRAY1) {(int nk, double * k), (int npofk, double * pofk)};
+%apply (double** ARGOUTVIEW_ARRAY3, int* DIM1, int* DIM2, int* DIM3) {(double ** view, int * nx, int * ny, int * nz)};
+%apply (double** ARGOUTVIEW_ARRAY2, int* DIM1, int* DIM2) {(double ** view, int * nhalos, int * ncols)};
+
   
 // The functions and data structures you want availiable in Python (have to be repeated here)
 struct Data {
@@ -34,6 +56,22 @@ extern Data * getData(int n);
 extern void freeData(Data *f);
 extern void getNumpyArray(int nx, double *x, int ny, double *y);
 
+// Grid and HaloCatalogue are opaque in Python. They are freed (through freeGrid / freeHaloCatalogue) when the
+// Python object is garbage collected, so don't use a view after the object it came from is gone
+%nodefaultctor Grid;
+%nodefaultctor HaloCatalogue;
+%newobject createGrid;
+%newobject friendsOfFriends;
+struct Grid {};
+extern Grid * createGrid(int Nmesh);
+extern void getRealGridView(Grid * g, double ** view, int * nx, int * ny, int * nz);
+extern void particlesToGrid(int npart, int ndim, double * pos, Grid * g, const char * density_assignment_method);
+extern void computePowerSpectrum(int npart, int ndim, double * pos, int Nmesh, const char * density_assignment_method,
+                                 bool interlacing, int nk, double * k, int npofk, double * pofk);
+struct HaloCatalogue {};
+extern HaloCatalogue * friendsOfFriends(int npart, int ndim, double * pos, double linking_length, int nmin_FoF_group);
+extern void getHaloCatalogueView(HaloCatalogue * h, double ** view, int * nhalos, int * ncols);
+
 // Here we define how to extract the data from the struct Data in python
 %extend Data{
   int get_n(){
@@ -48,4 +86,13 @@ extern void getNumpyArray(int nx, double *x, int ny, double *y);
     freeData($self);
   }
 }
-
+%extend Grid{
+  ~Grid(){
+    freeGrid($self);
+  }
+}
+%extend HaloCatalogue{
+  ~HaloCatalogue(){
+    freeHaloCatalogue($self);
+  }
+}
@@ -1,4 +1,12 @@
 #include <iostream>
+#include <string>
+#include <vector>
+
+#include <FML/ComputePowerSpectra/ComputePowerSpectrum.h>
+#include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/FriendsOfFriends/FoF.h>
+#include <FML/Global/Global.h>
+#include <FML/Interpolation/ParticleGridInterpolation.h>
 
 struct Data {
     int n;
@@ -32,3 +40,121 @@ void getNumpyArray(int nx, double * x, int ny, double * y) {
     for (int i = 0; i < ny; i++)
         std::cout << "y[" << i << "] = " << y[i] << "\n";
 }
+
+//==================================================================
+// Zero-copy interface to FML. Particles are numpy arrays of shape (NumPart, 3) with positions in [0,1) that
+// we look at in place through the particle type below (a C-contiguous double array has exactly this layout).
+// Grids and halo catalogues live in C++ and are seen from Python as numpy views of their memory (the views are
+// only valid as long as the object is alive). The long running calls release the GIL (see InterfaceFile.i)
+//==================================================================
+
+const int NDIM = 3;
+
+struct PositionParticle {
+    double pos[NDIM];
+    constexpr int get_ndim() const { return NDIM; }
+    double * get_pos() { return pos; }
+};
+static_assert(sizeof(PositionParticle) == NDIM * sizeof(double), "The particles must have the layout of the numpy array");
+static_assert(std::is_same<FML::GRID::FloatType, double>::value, "The grid views assume double precision grids");
+
+// FFTW planning is not thread safe and the calls below can now run concurrently from several Python threads
+static const bool fftw_planner_is_thread_safe = []() {
+    fftw_make_planner_thread_safe();
+    return true;
+}();
+
+// Check that the numpy array has the shape (NumPart, NDIM) and return it as particles
+static PositionParticle * as_particles(int npart, int ndim, double * pos) {
+    FML::assert_mpi(ndim == NDIM, "The particle positions must be a numpy array of shape (NumPart, 3)");
+    (void)npart;
+    return reinterpret_cast<PositionParticle *>(pos);
+}
+
+// A grid that lives in C++
+struct Grid {
+    FML::GRID::FFTWGrid<NDIM> grid;
+};
+
+Grid * createGrid(int Nmesh) {
+    // Enough extra slices for all the density assignment methods
+    const auto nextra = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment("PQS");
+    Grid * g = new Grid;
+    g->grid = FML::GRID::FFTWGrid<NDIM>(Nmesh, nextra.first, nextra.second);
+    return g;
+}
+
+void freeGrid(Grid * g) { delete g; }
+
+// View of the real space grid. The last dimension is padded to 2(Nmesh/2+1) as FFTW wants it, use
+// view[:,:,:Nmesh] in Python to get the grid itself
+void getRealGridView(Grid * g, double ** view, int * nx, int * ny, int * nz) {
+    const int Nmesh = g->grid.get_nmesh();
+    *view = g->grid.get_real_grid();
+    *nx = int(g->grid.get_local_nx());
+    *ny = Nmesh;
+    *nz = 2 * (Nmesh / 2 + 1);
+}
+
+// Assign particles to the grid (in place, the numpy array is not copied)
+void particlesToGrid(int npart, int ndim, double * pos, Grid * g, const char * density_assignment_method) {
+    auto * part = as_particles(npart, ndim, pos);
+    FML::INTERPOLATION::particles_to_grid<NDIM, PositionParticle>(
+        part, size_t(npart), size_t(npart), g->grid, std::string(density_assignment_method));
+}
+
+// Power spectrum of particles (in place, the numpy array is not copied). The result is written into the k and
+// pofk numpy arrays which must have length Nmesh/2. k is in units of the inverse boxsize
+void computePowerSpectrum(int npart,
+                          int ndim,
+                          double * pos,
+                          int Nmesh,
+                          const char * density_assignment_method,
+                          bool interlacing,
+                          int nk,
+                          double * k,
+                          int npofk,
+                          double * pofk) {
+    auto * part = as_particles(npart, ndim, pos);
+    FML::assert_mpi(nk == Nmesh / 2 and npofk == Nmesh / 2, "The k and pofk arrays must have length Nmesh/2");
+    FML::CORRELATIONFUNCTIONS::PowerSpectrumBinning<NDIM> binning(Nmesh / 2);
+    FML::CORRELATIONFUNCTIONS::compute_power_spectrum<NDIM>(
+        Nmesh, part, size_t(npart), size_t(npart), binning, std::string(density_assignment_method), interlacing);
+    for (int i = 0; i < nk; i++) {
+        k[i] = binning.kbin[i];
+        pofk[i] = binning.pofk[i];
+    }
+}
+
+// The halos found by FoF. Each row is [np, x, y, z]
+struct HaloCatalogue {
+    std::vector<double> data;
+};
+
+HaloCatalogue * friendsOfFriends(int npart, int ndim, double * pos, double linking_length, int nmin_FoF_group) {
+    auto * part = as_particles(npart, ndim, pos);
+    using FoFHalo = FML::FOF::FoFHalo<PositionParticle, NDIM>;
+    std::vector<FoFHalo> LocalFoFGroups;
+    const bool periodic_box = true;
+    const double Buffersize_over_Boxsize = 0.0;
+    FML::FOF::FriendsOfFriends<PositionParticle, NDIM>(
+        part, size_t(npart), linking_length, nmin_FoF_group, periodic_box, Buffersize_over_Boxsize, LocalFoFGroups);
+
+    HaloCatalogue * halos = new HaloCatalogue;
+    halos->data.reserve(LocalFoFGroups.size() * (NDIM + 1));
+    for (auto & h : LocalFoFGroups) {
+        halos->data.push_back(double(h.np));
+        for (int idim = 0; idim < NDIM; idim++)
+            halos->data.push_back(h.pos[idim]);
+    }
+    return halos;
+}
+
+void freeHaloCatalogue(HaloCatalogue * h) { delete h; }
+
+// View of the halo catalogue as a numpy array of shape (nhalos, 4)
+void getHaloCatalogueView(HaloCatalogue * h, double ** view, int * nhalos, int * ncols) {
+    *view = h->data.data();
+    *ncols = NDIM + 1;
+    *nhalos = int(h->data.size()) / (NDIM + 1);
+}
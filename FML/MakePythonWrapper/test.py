@@ -19,3 +19,27 @@ x = np.linspace(1,3,3)
 y = np.linspace(1,5,5)
 mylib.getNumpyArray(x,y)
 
+
+# The FML functions work on the numpy arrays in place (no copies). Particles are a
+# (NumPart, 3) float64 array with positions in [0,1)
+pos = np.random.rand(100000, 3)
+Nmesh = 64
+k = np.zeros(Nmesh // 2)
+pofk = np.zeros(Nmesh // 2)
+mylib.computePowerSpectrum(pos, Nmesh, "CIC", False, k, pofk)
+print(k[:4], pofk[:4])
+
+# Grids live in C++ and we get a numpy view of the memory (last dimension is padded)
+grid = mylib.createGrid(Nmesh)
+mylib.particlesToGrid(pos, grid, "CIC")
+delta = mylib.getRealGridView(grid)[:, :, :Nmesh]
+print(delta.shape, delta.mean())
+
+# The GIL is released in the long running calls so they can be run concurrently
+from concurrent.futures import ThreadPoolExecutor
+def run_fof(linking_length):
+  halos = mylib.friendsOfFriends(pos, linking_length, 20)
+  return mylib.getHaloCatalogueView(halos).copy()
+with ThreadPoolExecutor() as pool:
+  for b, halos in zip([0.2, 0.3], pool.map(run_fof, [0.2, 0.3])):
+    print(b, len(halos))
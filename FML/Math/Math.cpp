@@ -211,6 +211,83 @@ namespace FML {
             return res;
         }
 
+        // For many x compute j_ell(x) for the ells we want. Same algorithm as above but for a block of x's at the
+        // time with the ratios j_ell/j_(ell-1) stored as h[ell * block + b] so the inner loops are over the block
+        DVector2D j_ell_array(const std::vector<int> & ells, const DVector & x) {
+            assert(std::is_sorted(ells.begin(), ells.end()) and (ells.empty() or ells[0] >= 0));
+            const int npts = int(x.size());
+            DVector2D res(ells.size(), DVector(npts, 0.0));
+            if (ells.empty() or npts == 0)
+                return res;
+            const int lmax = ells.back();
+            const double lstart_factor = lmax < 10 ? 5.0 : (lmax < 100 ? 1.6 : 1.2);
+
+            constexpr int block = 32;
+            const int nblocks = (npts + block - 1) / block;
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+            {
+                DVector h_block((lmax + 1) * block, 0.0);
+                double xb[block], h[block], jell[block];
+#ifdef USE_OMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+                for (int iblock = 0; iblock < nblocks; iblock++) {
+                    const int i0 = iblock * block;
+                    const int n = std::min(block, npts - i0);
+
+                    // Pad the last block with x = 0 (gives h = 0 and no problems)
+                    double xblockmax = 0.0;
+                    for (int b = 0; b < block; b++) {
+                        xb[b] = b < n ? x[i0 + b] : 0.0;
+                        xblockmax = std::max(xblockmax, xb[b]);
+                        h[b] = 0.0;
+                    }
+
+                    // Start the recursion at a large enough lmax such that j_ell/j_ell-1 ~ 0 for all x in the block
+                    const int lstart = std::max(lmax, int(lstart_factor * xblockmax));
+                    for (int k = lstart; k >= lmax + 1; k--) {
+#ifdef USE_OMP
+#pragma omp simd
+#endif
+                        for (int b = 0; b < block; b++)
+                            h[b] = xb[b] / (2 * k + 1 - xb[b] * h[b]);
+                    }
+
+                    // Recursion relation for j_(n+1) / jn
+                    for (int k = lmax; k >= 1; k--) {
+                        double * hk = &h_block[k * block];
+#ifdef USE_OMP
+#pragma omp simd
+#endif
+                        for (int b = 0; b < block; b++) {
+                            h[b] = xb[b] / (2 * k + 1 - xb[b] * h[b]);
+                            hk[b] = h[b];
+                        }
+                    }
+
+                    // Transform ratios into j_ell and store the ones we want
+                    for (int b = 0; b < block; b++)
+                        jell[b] = xb[b] == 0.0 ? 1.0 : std::sin(xb[b]) / xb[b];
+                    size_t j = 0;
+                    for (int ell = 0; ell <= lmax; ell++) {
+                        if (ell > 0) {
+                            const double * hk = &h_block[ell * block];
+#ifdef USE_OMP
+#pragma omp simd
+#endif
+                            for (int b = 0; b < block; b++)
+                                jell[b] *= hk[b];
+                        }
+                        for (; j < ells.size() and ells[j] == ell; j++)
+                            std::copy(jell, jell + n, res[j].begin() + i0);
+                    }
+                }
+            }
+            return res;
+        }
+
 #ifdef USE_GSL
         // GSL implementation
         double j_ell_gsl(const int ell, const double arg) {
@@ -37,6 +37,7 @@ namespace FML {
         using ODEFunction = FML::SOLVERS::ODESOLVER::ODEFunction;
 #endif
         using DVector = std::vector<double>;
+        using DVector2D = std::vector<DVector>;
 
         /// Python linspace. Generate a lineary spaced array
         DVector linspace(double xmin, double xmax, int num);
@@ -71,6 +72,12 @@ namespace FML {
         /// Spherical bessel functions using recursion formula
         DVector j_ell_array(int lmax, const double x);
 
+        /// Spherical bessel functions for many arguments at once. Returns result[j][i] = \f$ j_{\ell_j}(x_i) \f$
+        /// for the ells (in increasing order) we ask for. Same recursion as j_ell_array, but done for blocks of
+        /// x at the time with the loop over x innermost (so it vectorizes) and the blocks spread over threads.
+        /// Sorted x gives the least work as each block starts the recursion at the highest ell any x in it needs.
+        DVector2D j_ell_array(const std::vector<int> & ells, const DVector & x);
+
         /// Spherical bessel function \f$ j_\ell(x) \f$ from CXX or GSL with fix for very small or large arguments.
         double j_ell(const int ell, const double arg);
 
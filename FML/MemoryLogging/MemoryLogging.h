@@ -1,12 +1,19 @@
 #ifndef MEMORYLOG_HEADER
 #define MEMORYLOG_HEADER
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <set>
+#include <string>
 #include <typeinfo>
+#include <unordered_map>
 #include <vector>
 
 #ifdef USE_MPI
@@ -41,47 +48,112 @@ namespace FML {
     /// Logs all heap allocations in the code that are larger
     /// than min_bytes_to_log. Implemented as a singleton so only
     /// one instance of this object exists. Thread safe.
+    ///
+    /// The allocations are kept in a set of hash-maps (shards)
+    /// picked by the pointer address, each with its own lock, so
+    /// threads allocating at the same time rarely contend. The
+    /// memory in use is tracked per label (category) with atomic
+    /// counters. Call mark_step from the main loop to record the
+    /// peak of each category since the last mark; print gives the
+    /// time-series and the high-water mark of every task.
     //=======================================================
     class MemoryLog {
       private:
         static MemoryLog * instance;
 
-        // Lock
-        std::mutex mymutex{};
+        // Number of shards for the allocation table and max number of labels we keep apart
+        // (further labels are lumped together in the last category)
+        static constexpr int nshards = 64;
+        static constexpr int max_categories = 256;
+
+        struct Allocation {
+            size_t size;
+            int category;
+        };
+
+        struct alignas(64) Shard {
+            std::mutex mymutex{};
+            std::unordered_map<void *, Allocation> allocations{};
+        };
+
+        // Memory in use and the peak (overall and since the last call to mark_step)
+        struct alignas(64) Usage {
+            std::atomic<long long> current{0};
+            std::atomic<long long> peak{0};
+            std::atomic<long long> peak_since_mark{0};
+        };
+
+        // The peak of each category between two calls to mark_step
+        struct Snapshot {
+            double time_sec;
+            std::string label;
+            long long total_peak;
+            std::vector<long long> category_peak;
+        };
 
         // The first allocation
         TimePoint time_start{};
 
         // Containing all current allocations
-        std::map<void *, size_t> allocations{};
+        std::array<Shard, nshards> shards{};
 
-        // For more info, after allocating we can (externally)
-        // call add with the pointer and store a label
-        std::map<void *, std::string> labels{};
+        // Memory in use per category. Category 0 is for allocations without a label
+        std::array<Usage, max_categories> categories{};
+        Usage total{};
 
-        // The total memory as function of time
-        std::map<TimePoint, size_t> memory_vs_time{};
+        // For more info, after allocating we can (externally)
+        // call add_label with the pointer to put it in a category
+        std::mutex category_mutex{};
+        std::vector<std::string> category_names{"(unlabelled)"};
+        std::map<std::string, int> category_index{};
 
-        // Total memory in use at any given time
-        size_t memory_in_use{0};
-        size_t peak_memory_use{0};
+        // The peak memory as function of time (one entry per call to mark_step)
+        std::vector<Snapshot> snapshots{};
 
         // The minimum allocation size in bytes to log
         size_t min_bytes_to_log = MIN_BYTES_TO_LOG;
         size_t max_allocations_to_log = MAX_ALLOCATIONS_IN_MEMORY;
-        size_t nallocation{0};
-        bool stop_logging{false};
+        std::atomic<size_t> nallocation{0};
+        std::atomic<bool> stop_logging{false};
 
         // Private constructor and destructor
-        MemoryLog() {
-            time_start = std::chrono::steady_clock::now();
-            memory_in_use = 0;
-            memory_vs_time[time_start] = 0;
-            nallocation = 0;
-            stop_logging = false;
-        }
+        MemoryLog() { time_start = std::chrono::steady_clock::now(); }
         ~MemoryLog() = default;
 
+        Shard & get_shard(void * ptr) {
+            const auto hash = (uint64_t(reinterpret_cast<uintptr_t>(ptr)) >> 4) * 0x9E3779B97F4A7C15ULL;
+            return shards[hash >> 58];
+        }
+
+        static void update_max(std::atomic<long long> & value, long long newvalue) {
+            long long old = value.load(std::memory_order_relaxed);
+            while (old < newvalue and not value.compare_exchange_weak(old, newvalue, std::memory_order_relaxed))
+                ;
+        }
+
+        static void change_usage(Usage & u, long long bytes) {
+            const long long now = u.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            if (bytes > 0) {
+                update_max(u.peak, now);
+                update_max(u.peak_since_mark, now);
+            }
+        }
+
+        int get_category(const std::string & name) {
+            std::lock_guard<std::mutex> guard(category_mutex);
+            auto it = category_index.find(name);
+            if (it != category_index.end())
+                return it->second;
+            int index = int(category_names.size());
+            if (index < max_categories - 1)
+                category_names.push_back(name);
+            else if (index == max_categories - 1)
+                category_names.push_back("(other labels)");
+            index = std::min(index, max_categories - 1);
+            category_index[name] = index;
+            return index;
+        }
+
       public:
         static MemoryLog * get() {
             if (not instance)
@@ -94,17 +166,23 @@ namespace FML {
         MemoryLog & operator=(const MemoryLog & arg) = delete;
         MemoryLog & operator=(const MemoryLog && arg) = delete;
 
-        // Add a new allocation label
+        // Add a new allocation label (moves the allocation to this category)
         void add_label(void * ptr, std::string name) {
             if (stop_logging)
                 return;
-            if (allocations.find(ptr) == allocations.end()) {
+            const int category = get_category(name);
+            auto & shard = get_shard(ptr);
+            std::lock_guard<std::mutex> guard(shard.mymutex);
+            auto it = shard.allocations.find(ptr);
+            if (it == shard.allocations.end()) {
                 std::cout << "[MemoryLogging] Warning could not find pointer in allocation list to add label " + name +
                                  " to\n";
                 return;
             }
-            std::lock_guard<std::mutex> guard(mymutex);
-            labels[ptr] = name;
+            const long long size = it->second.size;
+            change_usage(categories[it->second.category], -size);
+            change_usage(categories[category], size);
+            it->second.category = category;
         }
         void add_label(void * ptr, size_t size, std::string name) {
             if (stop_logging or size < min_bytes_to_log)
@@ -115,24 +193,25 @@ namespace FML {
         void add(void * ptr, size_t size) {
             if (stop_logging or size < min_bytes_to_log)
                 return;
-            std::lock_guard<std::mutex> guard(mymutex);
-            allocations[ptr] = size;
-
-            memory_in_use += size;
-            if (memory_in_use > peak_memory_use)
-                peak_memory_use = memory_in_use;
-
-            auto time = std::chrono::steady_clock::now();
-            memory_vs_time[time] = memory_in_use;
-            nallocation++;
+            {
+                auto & shard = get_shard(ptr);
+                std::lock_guard<std::mutex> guard(shard.mymutex);
+                shard.allocations[ptr] = {size, 0};
+            }
+            change_usage(categories[0], size);
+            change_usage(total, size);
 
             // If we have saturated then stop logging
-            stop_logging = nallocation >= max_allocations_to_log;
+            if (nallocation.fetch_add(1, std::memory_order_relaxed) + 1 >= max_allocations_to_log)
+                stop_logging = true;
         }
 
         void clear() {
-            allocations.clear();
-            memory_vs_time.clear();
+            for (auto & shard : shards) {
+                std::lock_guard<std::mutex> guard(shard.mymutex);
+                shard.allocations.clear();
+            }
+            snapshots.clear();
         }
 
         // Remove an allocation and log info
@@ -140,22 +219,49 @@ namespace FML {
             if (stop_logging or size < min_bytes_to_log)
                 return;
 
+            Allocation a;
+            {
+                auto & shard = get_shard(ptr);
+                std::lock_guard<std::mutex> guard(shard.mymutex);
+                auto it = shard.allocations.find(ptr);
+                if (it == shard.allocations.end())
+                    return;
+                a = it->second;
+                shard.allocations.erase(it);
+            }
 #ifdef DEBUG_MEMORYLOG
-            std::string name = labels[ptr];
-            if (ThisTask == 0)
-                std::cout << "===> MemoryLog::remove Freeing[" << name << "]" << std::endl;
+            if (ThisTask == 0) {
+                std::lock_guard<std::mutex> guard(category_mutex);
+                std::cout << "===> MemoryLog::remove Freeing[" << category_names[a.category] << "]" << std::endl;
+            }
 #endif
-            std::lock_guard<std::mutex> guard(mymutex);
-            allocations.erase(ptr);
-            labels.erase(ptr);
-
-            memory_in_use -= size;
+            change_usage(categories[a.category], -(long long)(a.size));
+            change_usage(total, -(long long)(a.size));
+            nallocation.fetch_sub(1, std::memory_order_relaxed);
+        }
 
-            auto time = std::chrono::steady_clock::now();
-            memory_vs_time[time] = memory_in_use;
+        /// Record the peak memory use of every category since the last call (e.g. once per time-step)
+        /// together with the time since the log started. Only call this from one thread
+        void mark_step(std::string label) {
+            if (stop_logging)
+                return;
+            Snapshot s;
+            s.time_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
+            s.label = label;
+            s.total_peak = total.peak_since_mark.exchange(total.current, std::memory_order_relaxed);
+            int ncategories;
+            {
+                std::lock_guard<std::mutex> guard(category_mutex);
+                ncategories = int(category_names.size());
+            }
+            s.category_peak.resize(ncategories);
+            for (int i = 0; i < ncategories; i++)
+                s.category_peak[i] =
+                    categories[i].peak_since_mark.exchange(categories[i].current, std::memory_order_relaxed);
+            snapshots.push_back(s);
         }
 
-        // Print the total memory in use
+        // Print the total memory in use. Collective over MPI
         void print() {
             // Check if any task has saturated the allocation limit
             char ok = stop_logging ? 0 : 1;
@@ -212,10 +318,12 @@ namespace FML {
                 std::cout << "container (Vector) and only allocations larger than " << min_bytes_to_log << " bytes\n\n";
             }
 
-            long long int min_memory = memory_in_use;
-            long long int max_memory = memory_in_use;
-            long long int mean_memory = memory_in_use;
-            long long int peak_memory = peak_memory_use;
+            const long long memory_in_use = total.current;
+            const long long peak_memory_use = total.peak;
+            long long min_memory = memory_in_use;
+            long long max_memory = memory_in_use;
+            long long mean_memory = memory_in_use;
+            long long peak_memory = peak_memory_use;
 #ifdef USE_MPI
             MPI_Allreduce(MPI_IN_PLACE, &min_memory, 1, MPI_LONG_LONG, MPI_MIN, MPI_COMM_WORLD);
             MPI_Allreduce(MPI_IN_PLACE, &max_memory, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
@@ -234,41 +342,157 @@ namespace FML {
                 std::cout << "Max over tasks:           " << std::setw(15) << double(peak_memory) / 1.0e6 << " MB\n";
                 std::cout << "\n";
             }
-            if (not allocations.empty()) {
-                if (ThisTask == 0) {
-                    std::cout << "\nWe have the following things allocated on task 0: \n";
-                }
-                for (auto && a : allocations) {
-                    if (ThisTask == 0) {
-                        std::string name = "";
-                        if (labels.find(a.first) != labels.end())
-                            name = labels[a.first];
-                        std::string bytelabel = " (MB)";
-                        double factor = 1e6;
-                        std::cout << "Address: " << a.first << " Size: " << double(a.second) / factor << bytelabel
-                                  << " Label: " << name << "\n";
-                    }
+
+            print_high_water_marks(memory_in_use, peak_memory_use, sysmem.second);
+            print_categories();
+            print_time_series();
+
+            if (ThisTask == 0) {
+                std::cout << "\n#=====================================================\n";
+                std::cout << std::flush;
+            }
+        }
+
+      private:
+        // The tracked high-water mark of every task
+        void print_high_water_marks(long long memory_in_use, long long peak_memory_use, double sys_rss_peak) {
+            std::vector<long long> current(NTasks, memory_in_use), peak(NTasks, peak_memory_use);
+            std::vector<double> rss_peak(NTasks, sys_rss_peak);
+#ifdef USE_MPI
+            MPI_Gather(&memory_in_use, 1, MPI_LONG_LONG, current.data(), 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+            MPI_Gather(&peak_memory_use, 1, MPI_LONG_LONG, peak.data(), 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+            MPI_Gather(&sys_rss_peak, 1, MPI_DOUBLE, rss_peak.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#endif
+            if (ThisTask == 0) {
+                std::cout << "High-water mark per task:\n";
+                std::cout << std::setw(8) << "Task" << std::setw(18) << "Peak (MB)" << std::setw(18) << "In use (MB)"
+                          << std::setw(18) << "Peak RSS (MB)" << "\n";
+                for (int i = 0; i < NTasks; i++)
+                    std::cout << std::setw(8) << i << std::setw(18) << double(peak[i]) / 1.0e6 << std::setw(18)
+                              << double(current[i]) / 1.0e6 << std::setw(18) << rss_peak[i] / 1.0e6 << "\n";
+                std::cout << "\n";
+            }
+        }
+
+        // Gather the union of the category names over all tasks (sorted)
+        std::vector<std::string> get_all_category_names() {
+            std::set<std::string> all_names;
+            {
+                std::lock_guard<std::mutex> guard(category_mutex);
+                all_names.insert(category_names.begin(), category_names.end());
+            }
+#ifdef USE_MPI
+            std::string local_names;
+            for (auto & name : all_names)
+                local_names += name + '\0';
+            int nchars = int(local_names.size());
+            std::vector<int> nchars_task(NTasks), offset_task(NTasks, 0);
+            MPI_Allgather(&nchars, 1, MPI_INT, nchars_task.data(), 1, MPI_INT, MPI_COMM_WORLD);
+            for (int i = 1; i < NTasks; i++)
+                offset_task[i] = offset_task[i - 1] + nchars_task[i - 1];
+            std::vector<char> names_buffer(offset_task[NTasks - 1] + nchars_task[NTasks - 1]);
+            MPI_Allgatherv(local_names.data(),
+                           nchars,
+                           MPI_CHAR,
+                           names_buffer.data(),
+                           nchars_task.data(),
+                           offset_task.data(),
+                           MPI_CHAR,
+                           MPI_COMM_WORLD);
+            for (size_t start = 0, i = 0; i < names_buffer.size(); i++) {
+                if (names_buffer[i] == '\0') {
+                    all_names.insert(std::string(names_buffer.data() + start, i - start));
+                    start = i + 1;
                 }
-                if (ThisTask == 0)
-                    std::cout << "\n";
             }
-            if (not memory_vs_time.empty()) {
-                if (ThisTask == 0)
-                    std::cout << "Total memory as function of time:\n";
-                for (auto && m : memory_vs_time) {
-                    double time_in_sec =
-                        std::chrono::duration_cast<std::chrono::duration<double>>(m.first - time_start).count();
-                    if (ThisTask == 0) {
-                        std::cout << " Time (sec): " << std::setw(13) << time_in_sec;
-                        std::string bytelabel = " (MB)";
-                        double factor = 1e6;
-                        std::cout << " Memory: " << std::setw(13) << double(m.second) / factor << bytelabel << "\n";
-                    }
+#endif
+            return std::vector<std::string>(all_names.begin(), all_names.end());
+        }
+
+        // Local index of each of the global category names (-1 if not present on this task)
+        std::vector<int> get_local_index(const std::vector<std::string> & all_names) {
+            std::lock_guard<std::mutex> guard(category_mutex);
+            std::vector<int> local_index(all_names.size(), -1);
+            for (size_t i = 0; i < all_names.size(); i++) {
+                auto it = std::find(category_names.begin(), category_names.end(), all_names[i]);
+                if (it != category_names.end())
+                    local_index[i] = int(it - category_names.begin());
+            }
+            return local_index;
+        }
+
+        // Memory in use and the peak per category
+        void print_categories() {
+            const auto all_names = get_all_category_names();
+            const auto local_index = get_local_index(all_names);
+            const int ncategories = int(all_names.size());
+            std::vector<long long> current(ncategories, 0), peak(ncategories, 0);
+            for (int i = 0; i < ncategories; i++) {
+                if (local_index[i] < 0)
+                    continue;
+                current[i] = categories[local_index[i]].current;
+                peak[i] = categories[local_index[i]].peak;
+            }
+            std::vector<long long> current_max = current, peak_max = peak;
+#ifdef USE_MPI
+            MPI_Allreduce(MPI_IN_PLACE, current_max.data(), ncategories, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE, peak_max.data(), ncategories, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+#endif
+            if (ThisTask == 0) {
+                std::cout << "Memory per label:\n";
+                std::cout << std::setw(40) << std::left << "Label" << std::right << std::setw(16) << "In use (MB)"
+                          << std::setw(16) << "Peak (MB)" << std::setw(16) << "Max in use" << std::setw(16)
+                          << "Max peak" << "\n";
+                std::cout << std::setw(40) << "" << std::setw(16) << "(Task 0)" << std::setw(16) << "(Task 0)"
+                          << std::setw(16) << "(all tasks)" << std::setw(16) << "(all tasks)" << "\n";
+                for (int i = 0; i < ncategories; i++) {
+                    if (peak_max[i] == 0)
+                        continue;
+                    std::cout << std::setw(40) << std::left << all_names[i] << std::right << std::setw(16)
+                              << double(current[i]) / 1.0e6 << std::setw(16) << double(peak[i]) / 1.0e6
+                              << std::setw(16) << double(current_max[i]) / 1.0e6 << std::setw(16)
+                              << double(peak_max[i]) / 1.0e6 << "\n";
                 }
+                std::cout << "\n";
             }
+        }
+
+        // Peak memory per category between calls to mark_step (max over tasks)
+        void print_time_series() {
+            long long nsnapshots = snapshots.size();
+#ifdef USE_MPI
+            MPI_Allreduce(MPI_IN_PLACE, &nsnapshots, 1, MPI_LONG_LONG, MPI_MIN, MPI_COMM_WORLD);
+#endif
+            if (nsnapshots == 0)
+                return;
+
+            const auto all_names = get_all_category_names();
+            const auto local_index = get_local_index(all_names);
+            const int ncategories = int(all_names.size());
+            const int ncols = ncategories + 1;
+            std::vector<long long> peaks(nsnapshots * ncols, 0);
+            for (long long j = 0; j < nsnapshots; j++) {
+                const auto & s = snapshots[j];
+                peaks[j * ncols] = s.total_peak;
+                for (int i = 0; i < ncategories; i++)
+                    if (local_index[i] >= 0 and local_index[i] < int(s.category_peak.size()))
+                        peaks[j * ncols + 1 + i] = s.category_peak[local_index[i]];
+            }
+#ifdef USE_MPI
+            MPI_Allreduce(MPI_IN_PLACE, peaks.data(), int(peaks.size()), MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+#endif
             if (ThisTask == 0) {
-                std::cout << "\n#=====================================================\n";
-                std::cout << std::flush;
+                std::cout << "Peak memory as function of time (max over tasks, time on task 0):\n";
+                for (long long j = 0; j < nsnapshots; j++) {
+                    const auto & s = snapshots[j];
+                    std::cout << " Time (sec): " << std::setw(13) << s.time_sec << " " << std::setw(20) << std::left
+                              << s.label << std::right << " Peak: " << std::setw(13)
+                              << double(peaks[j * ncols]) / 1.0e6 << " (MB)\n";
+                    for (int i = 0; i < ncategories; i++)
+                        if (peaks[j * ncols + 1 + i] > 0)
+                            std::cout << "   " << std::setw(40) << std::left << all_names[i] << std::right
+                                      << std::setw(13) << double(peaks[j * ncols + 1 + i]) / 1.0e6 << " (MB)\n";
+                }
             }
         }
     };
@@ -142,7 +142,7 @@ class DGPSolverCosmology {
         //======================================================================
         // Implement the equation to be solved
         //======================================================================
-        MultiGridFunction<NDIM, double> Equation =
+        auto Equation =
             [&](MultiGridSolver<NDIM, SolverType> * sol, int level, IndexInt index) {
                 const auto h = sol->get_Gridspacing(level);
 
@@ -8,6 +8,7 @@
 #include <cmath>
 #include <iostream>
 #include <limits>
+#include <string>
 
 // Type aliases used below
 template <int N>
@@ -33,6 +34,10 @@ class FofrSolverCosmology {
     int ngs_coarse{10};
     int ngs_first{40};
 
+    /// The multigrid cycle (V, W or F) and if we use full multigrid to make the initial guess
+    std::string cycle_type{"V"};
+    bool use_fmg{false};
+
     /// Convergence criterion: residual < epsilon
     double epsilon{1e-6};
 
@@ -51,6 +56,16 @@ class FofrSolverCosmology {
     /// The box is periodic?
     bool periodic{true};
 
+    /// Solve on the device (requires USE_OMP_TARGET)
+    bool offload{false};
+
+    /// Optional initial guess: the solution f from an earlier call and the scale factor it was computed at
+    MPIGrid<NDIM, SolverType> * guess{nullptr};
+    double a_guess{0.0};
+
+    /// The solution f of the last call to solve
+    MPIGrid<NDIM, SolverType> solution;
+
   public:
     FofrSolverCosmology(double OmegaM, double nfofr, double fofr0, double H0Box, bool verbose)
         : OmegaM(OmegaM), nfofr(nfofr), fofr0(fofr0), H0Box(H0Box), verbose(verbose) {}
@@ -65,6 +80,26 @@ class FofrSolverCosmology {
     /// Set convergenc criterion
     void set_epsilon(double _epsilon) { epsilon = _epsilon; }
 
+    /// Do the multigrid solve on the device (requires USE_OMP_TARGET)
+    void set_offload(bool _offload) { offload = _offload; }
+
+    /// Set the multigrid cycle (V, W or F) and if we should use full multigrid to make the initial guess
+    void set_cycle(std::string _cycle_type, bool _use_fmg) {
+        cycle_type = _cycle_type;
+        use_fmg = _use_fmg;
+    }
+
+    /// Use the solution from a call to solve at an earlier time a_previous (as returned by get_solution) as the
+    /// initial guess. It is shifted by the change in the background value so this is a good guess if the steps
+    /// are not too big. The grid is modified in place and must stay alive until solve is called
+    void set_initial_guess(MPIGrid<NDIM, SolverType> & previous_solution, double a_previous) {
+        guess = &previous_solution;
+        a_guess = a_previous;
+    }
+
+    /// The solution f (not e^f) from the last call to solve
+    MPIGrid<NDIM, SolverType> & get_solution() { return solution; }
+
     /// The cosmological background value f_R(a)
     double get_fofr_background(double a) {
         const double fac1 = 1.0 + 4.0 * (1.0 - OmegaM) / OmegaM;
@@ -93,27 +128,14 @@ class FofrSolverCosmology {
             std::cout << "# Convergence : residual < " << epsilon << "\n";
             std::cout << "# Ngs_sweeps  : " << ngs_fine << " (fine) , " << ngs_coarse << " (coarse)\n";
             std::cout << "# Ngs_sweeps  : " << ngs_first << " (first step)\n";
+            std::cout << "# Cycle       : " << cycle_type << "-cycle" << (use_fmg ? " with FMG initial guess" : "") << "\n";
             std::cout << "#=====================================================\n";
         }
 
         // Set up multigrid for density
         MPIMultiGrid<NDIM, SolverType> density_multigrid(Nmesh, Nlevels, nleft, nright);
         auto & grid = density_multigrid.get_grid();
-
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-        for (int islice = 0; islice < Local_nx; islice++) {
-            for (auto && real_index : overdensity_real.get_real_range(islice, islice + 1)) {
-                // Fetch the value in the cell
-                auto density_in_cell = overdensity_real.get_real_from_index(real_index);
-                // Fetch the coordinates of the cell (ix,iy,iz) and index
-                auto coord = overdensity_real.get_coord_from_index(real_index);
-                auto density_grid_index = grid.index_from_coord(coord);
-                // Set the value
-                grid.set_y(density_grid_index, density_in_cell);
-            }
-        }
+        ConvertToMPIGrid(overdensity_real, grid);
         density_multigrid.restrict_down_all();
 
         // Factors to define the equation (the first term is GR times 1/3)
@@ -130,9 +152,28 @@ class FofrSolverCosmology {
         g.set_epsilon(epsilon);
         g.set_ngs_sweeps(ngs_fine, ngs_coarse, ngs_first);
         g.set_epsilon(epsilon);
-
-        // Set the initial guess
-        g.set_initial_guess(f0);
+        g.set_cycle_type(cycle_type);
+        g.set_fmg(use_fmg);
+        g.set_offload(offload);
+
+        // Set the initial guess. Either the background value or the previous solution shifted to the current time
+        if (guess and guess->get_N() == Nmesh and guess->get_NtotLocal() == g.get_NtotLocal()) {
+            const double f0_guess =
+                std::log(a_guess * a_guess * get_fofr_background(a_guess) / 2.0 / std::pow(H0Box, 2));
+            SolverType * f = guess->get_y();
+            const auto NtotLocal = guess->get_NtotLocal();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (IndexInt i = 0; i < NtotLocal; i++)
+                f[i] += f0 - f0_guess;
+            g.set_initial_guess(*guess);
+            if (FML::ThisTask == 0 and verbose)
+                std::cout << "# Using the solution at a = " << a_guess << " as the initial guess\n";
+        } else {
+            g.set_initial_guess(f0);
+        }
+        guess = nullptr;
 
         //======================================================================
         // Set the convergence criterion
@@ -143,58 +184,28 @@ class FofrSolverCosmology {
         };
 
         //======================================================================
-        // Implement the equation to be solved
+        // Implement the equation to be solved: D[ e^f Df ] = S(f, delta)
+        // This form does not call back into the solver so it can also be
+        // solved on the device (see set_offload)
         //======================================================================
-        MultiGridFunction<NDIM, double> Equation =
-            [&](MultiGridSolver<NDIM, SolverType> * sol, int level, IndexInt index) {
-                //======================================================================
-                // Get a list of the index of the closest cells needed to compute
-                // gradients and the laplacian
-                //======================================================================
-                auto index_list = sol->get_neighbor_gridindex(level, index);
-
-                //======================================================================
-                // The solution in the current cell
-                //======================================================================
-                const double f = sol->get_Field(level, index);
-
-                //======================================================================
-                // Set the (over) density field from formula
-                //======================================================================
-                auto delta = density_multigrid.get_y(level, index);
-
-                //======================================================================
-                // Calculate the kinetic term: D[ b[f] Df ] with b = exp(x)
-                // (Faster to not use the built in function and code this directly
-                // as we do a lot of double work)
-                //======================================================================
-                std::function<SolverType(int, IndexInt)> b = [&](int lev, IndexInt ind) -> double {
-                    return std::exp(sol->get_Field(lev, ind));
-                };
-                std::function<SolverType(int, IndexInt)> db = [&](int lev, IndexInt ind) -> double {
-                    return std::exp(sol->get_Field(lev, ind));
-                };
-                auto kinetic = sol->get_BLaplacian(level, index_list, b);
-                auto dkinetic = sol->get_derivBLaplacian(level, index_list, b, db);
-
-                //======================================================================
-                // The right hand side source and the derivative of it
-                //======================================================================
-                double source = poisson_norm * delta - prefac * (std::exp((f0 - f) / (1.0 + nfofr)) - 1.0);
-                double dsource = prefac * (std::exp((f0 - f) / (1.0 + nfofr))) / (1.0 + nfofr);
-
-                //======================================================================
-                // Returns the equation and the derivative to the solver
-                //======================================================================
-                return std::pair<SolverType, SolverType>{kinetic - source, dkinetic - dsource};
-            };
+        auto b = [](double f) { return std::pair<double, double>{std::exp(f), std::exp(f)}; };
+        // (captures numbers only, not this, so that it can be copied to the device)
+        const double n = nfofr;
+        auto source = [poisson_norm, prefac, f0, n](double f, double delta) {
+            const double expfac = std::exp((f0 - f) / (1.0 + n));
+            return std::pair<double, double>{poisson_norm * delta - prefac * (expfac - 1.0), prefac * expfac / (1.0 + n)};
+        };
+        auto Equation = make_stencil_equation<NDIM, SolverType>(b, source, &density_multigrid);
 
         // Solve the equation and fetch the solution
         g.solve(Equation, ConvergenceCriterion);
-        auto sol = g.get_grid(0);
-        ConvertToFFTWGrid(sol, fifth_force_potential_real);
+        // (the solver is not used after this so we can take its grid instead of copying it)
+        solution = std::move(g.get_grid(0));
+
+        // Convert to fifth-force potential a^2 f_R / (2 (H0Box)^2) as we copy it over
+        CopyToFFTWGrid(solution, fifth_force_potential_real, [](SolverType value) { return std::exp(value); });
 
-        // Convert to fifth-force potential a^2 f_R / (2 (H0Box)^2)
+        // Some statistics of the fifth-force potential
         FML::GRID::FloatType fmin = std::numeric_limits<FML::GRID::FloatType>::max();
         FML::GRID::FloatType fmax = -std::numeric_limits<FML::GRID::FloatType>::max();
         FML::GRID::FloatType fmean = 0.0;
@@ -204,9 +215,6 @@ class FofrSolverCosmology {
         for (int islice = 0; islice < Local_nx; islice++) {
             for (auto && real_index : fifth_force_potential_real.get_real_range(islice, islice + 1)) {
                 auto value = fifth_force_potential_real.get_real_from_index(real_index);
-                value = std::exp(value);
-                fifth_force_potential_real.set_real_from_index(real_index, value);
-
                 fmean += value;
                 fmax = std::max(fmax, value);
                 fmin = std::min(fmin, value);
@@ -0,0 +1,336 @@
+#ifndef MULTIGRIDREFINEMENT_HEADER
+#define MULTIGRIDREFINEMENT_HEADER
+
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include <FML/Global/Global.h>
+#include <FML/MPIGrid/MPIGrid.h>
+#include <FML/MultigridSolver/MultiGridSolver.h>
+
+namespace FML {
+    namespace SOLVERS {
+        namespace MULTIGRIDSOLVER {
+
+            //=============================================
+            ///
+            /// Refinement patches on top of the domain grid
+            /// of a MultiGridSolver. This is for equations
+            /// that are only nonlinear in small regions
+            /// (screening inside halos) where we want a
+            /// higher resolution without raising the global
+            /// resolution.
+            ///
+            /// The domain grid is split into tiles of
+            /// _TILE_SIZE^NDIM cells and every tile with a
+            /// cell where the density is above a threshold
+            /// is refined (make_patches). A patch is the
+            /// tile plus _NBUFFER cells on each side at
+            /// _REFINEMENT times the resolution. After the
+            /// domain grid is solved each patch is solved
+            /// as an additional fine level (solve): the
+            /// solution on the domain grid is interpolated
+            /// to the patch as the initial guess and is held
+            /// fixed in the outermost domain grid cell of
+            /// the patch (Dirichlet boundary). The solution
+            /// is only used in the tile itself; the buffer
+            /// keeps the boundary away from it. The coupling
+            /// is one-way: the domain grid is not corrected
+            /// with the patch solution.
+            ///
+            /// The equation gets the patch solver and can use
+            /// all the helper functions as for the domain
+            /// grid. get_Coordinate gives the position in the
+            /// box (which can be outside [0,1) for a patch
+            /// that wraps around the periodic box) so the
+            /// source has to be evaluated from the position.
+            ///
+            /// The Dirichlet boundary uses the mask so this
+            /// requires USE_MASK. The patch grid has
+            /// (_TILE_SIZE + 2 _NBUFFER) * _REFINEMENT cells
+            /// per dim which must be a power of two.
+            ///
+            //=============================================
+
+            template <int NDIM, class T>
+            class MultiGridRefinement {
+              private:
+                int _tile_size{8};  // Cells of the domain grid per dim in a tile
+                int _nbuffer{4};    // Cells of the domain grid we add on each side of a tile to get the patch
+                int _refinement{2}; // Cells per dim in a patch per cell in the domain grid
+                bool _verbose{false};
+
+                // The number of cells per dim in the domain grid and in a patch
+                int _N{0};
+                int _Npatch{0};
+
+                // The refined tiles (corner in domain grid cells) and the solution on the patches
+                std::vector<std::array<int, NDIM>> _tile_corner;
+                std::vector<MPIGrid<NDIM, T>> _patch_solution;
+
+                // The solution on the domain grid in the cells a patch covers (plus one for interpolation)
+                std::vector<double> get_domain_block(MPIGrid<NDIM, T> & f, const std::array<int, NDIM> & corner);
+
+              public:
+                MultiGridRefinement(int tile_size, int nbuffer, int refinement, bool verbose);
+                MultiGridRefinement() = default;
+
+                // Flag the tiles where density > threshold somewhere (the density grid is the domain grid)
+                void make_patches(MPIGrid<NDIM, T> & density, double threshold);
+
+                // Solve the equation on all the patches. Uses the settings (sweeps, cycle, epsilon, ...) of
+                // the domain grid solver base which must have been solved
+                template <class EquationType>
+                void solve(MultiGridSolver<NDIM, T> & base,
+                           EquationType && Equation,
+                           MultiGridConvCrit & ConvergenceCriterion);
+
+                // Info about the patches
+                int get_npatches() const;
+                int get_patch_N() const;
+                double get_patch_boxsize() const;
+                std::array<double, NDIM> get_patch_origin(int ipatch) const;
+                std::array<int, NDIM> get_tile_corner(int ipatch) const;
+                // Is the cell in the patch grid in the tile (i.e. the part where we use the patch solution)
+                bool in_tile(const std::array<int, NDIM> & globalcoord) const;
+
+                // The solution on a patch (including the buffer)
+                MPIGrid<NDIM, T> & get_patch_solution(int ipatch);
+
+                // Free up all memory
+                void free();
+            };
+
+            template <int NDIM, class T>
+            MultiGridRefinement<NDIM, T>::MultiGridRefinement(int tile_size,
+                                                              int nbuffer,
+                                                              int refinement,
+                                                              bool verbose)
+                : _tile_size(tile_size), _nbuffer(nbuffer), _refinement(refinement),
+                  _verbose(verbose and FML::ThisTask == 0) {
+                assert_mpi(tile_size > 0 and nbuffer > 0 and refinement > 1,
+                           "[MultiGridRefinement] Need tile_size > 0, nbuffer > 0 and refinement > 1\n");
+                _Npatch = (_tile_size + 2 * _nbuffer) * _refinement;
+                assert_mpi(FML::power(2, int(std::round(std::log2(_Npatch)))) == _Npatch,
+                           "[MultiGridRefinement] (tile_size + 2 nbuffer) * refinement must be a power of two\n");
+                assert_mpi(_Npatch >= FML::NTasks, "[MultiGridRefinement] A patch must have at least one slice per task\n");
+            }
+
+            //================================================
+            // Flag the tiles that have a cell with density
+            // above the threshold. The flags are combined
+            // over tasks so all tasks have the same list
+            //================================================
+
+            template <int NDIM, class T>
+            void MultiGridRefinement<NDIM, T>::make_patches(MPIGrid<NDIM, T> & density, double threshold) {
+                _N = density.get_N();
+                assert_mpi(_N % _tile_size == 0, "[MultiGridRefinement::make_patches] N must be divisible by tile_size\n");
+
+                const int ntiles = _N / _tile_size;
+                std::vector<int> flagged(FML::power(ntiles, NDIM), 0);
+                const IndexInt NtotLocal = density.get_NtotLocal();
+                for (IndexInt i = 0; i < NtotLocal; i++) {
+                    if (double(density[i]) <= threshold)
+                        continue;
+                    auto coord = density.globalcoord_from_index(i);
+                    IndexInt itile = 0;
+                    for (int idim = 0; idim < NDIM; idim++)
+                        itile = itile * ntiles + coord[idim] / _tile_size;
+                    flagged[itile] = 1;
+                }
+#ifdef USE_MPI
+                MPI_Allreduce(MPI_IN_PLACE, flagged.data(), int(flagged.size()), MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+#endif
+
+                _tile_corner.clear();
+                _patch_solution.clear();
+                for (size_t itile = 0; itile < flagged.size(); itile++) {
+                    if (flagged[itile] == 0)
+                        continue;
+                    std::array<int, NDIM> corner;
+                    IndexInt index = itile;
+                    for (int idim = NDIM - 1; idim >= 0; idim--) {
+                        corner[idim] = (index % ntiles) * _tile_size;
+                        index /= ntiles;
+                    }
+                    _tile_corner.push_back(corner);
+                }
+
+                if (_verbose)
+                    std::cout << "[MultiGridRefinement::make_patches] Refining " << _tile_corner.size() << " of "
+                              << flagged.size() << " tiles\n";
+            }
+
+            //================================================
+            // Gather the solution on the domain grid in the
+            // cells [corner - nbuffer, corner + tile + nbuffer]
+            // (periodic wrap) on all tasks. Every task fills
+            // in the cells it has and we sum over tasks
+            //================================================
+
+            template <int NDIM, class T>
+            std::vector<double> MultiGridRefinement<NDIM, T>::get_domain_block(MPIGrid<NDIM, T> & f,
+                                                                               const std::array<int, NDIM> & corner) {
+                const int nblock = _tile_size + 2 * _nbuffer + 1;
+                const int xstart = f.get_xStartLocal();
+                const int nlocal = f.get_NLocal();
+
+                std::vector<double> block(FML::power(nblock, NDIM), 0.0);
+                for (size_t i = 0; i < block.size(); i++) {
+                    std::array<int, NDIM> coord;
+                    IndexInt index = i;
+                    for (int idim = NDIM - 1; idim >= 0; idim--) {
+                        coord[idim] = corner[idim] - _nbuffer + int(index % nblock);
+                        coord[idim] = (coord[idim] % _N + _N) % _N;
+                        index /= nblock;
+                    }
+                    if (coord[0] >= xstart and coord[0] < xstart + nlocal)
+                        block[i] = double(f[f.index_from_globalcoord(coord)]);
+                }
+#ifdef USE_MPI
+                MPI_Allreduce(MPI_IN_PLACE, block.data(), int(block.size()), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+                return block;
+            }
+
+            //================================================
+            // Solve on all the patches
+            //================================================
+
+            template <int NDIM, class T>
+            template <class EquationType>
+            void MultiGridRefinement<NDIM, T>::solve(MultiGridSolver<NDIM, T> & base,
+                                                     EquationType && Equation,
+                                                     MultiGridConvCrit & ConvergenceCriterion) {
+#ifndef USE_MASK
+                assert_mpi(false, "[MultiGridRefinement::solve] The patch boundary requires USE_MASK\n");
+#else
+                assert_mpi(base.get_N() == _N,
+                           "[MultiGridRefinement::solve] The domain grid does not match the one in make_patches\n");
+
+                // The boundary is the outermost domain grid cell of the patch. The mask only survives the
+                // restriction down to the level where a cell is twice the boundary width
+                const int nboundary = _refinement;
+                const int Nlevels = std::min(int(std::round(std::log2(_Npatch))),
+                                             int(std::round(std::log2(nboundary))) + 2);
+
+                const int nblock = _tile_size + 2 * _nbuffer + 1;
+                auto & f = base.get_grid(0);
+                f.communicate_boundaries();
+
+                _patch_solution.clear();
+                for (int ipatch = 0; ipatch < get_npatches(); ipatch++) {
+                    if (_verbose)
+                        std::cout << "[MultiGridRefinement::solve] Solving on patch " << ipatch + 1 << " / "
+                                  << get_npatches() << "\n";
+
+                    MultiGridSolver<NDIM, T> g(_Npatch, Nlevels, base._verbose, false, 1, 1);
+                    g._ngs_fine = base._ngs_fine;
+                    g._ngs_coarse = base._ngs_coarse;
+                    g._ngs_first_step = base._ngs_first_step;
+                    g._maxsteps = base._maxsteps;
+                    g._eps_converge = base._eps_converge;
+                    g._cycle_type = base._cycle_type;
+                    g._use_fmg = base._use_fmg;
+                    g.set_domain(get_patch_origin(ipatch), get_patch_boxsize());
+
+                    // Interpolate the domain grid solution to the patch
+                    const auto block = get_domain_block(f, _tile_corner[ipatch]);
+                    auto & fpatch = g.get_grid(0);
+                    MPIGrid<NDIM, T> mask(_Npatch, false, 1, 1);
+                    const IndexInt NtotLocal = fpatch.get_NtotLocal();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (IndexInt i = 0; i < NtotLocal; i++) {
+                        auto coord = fpatch.globalcoord_from_index(i);
+
+                        // The domain grid cell we are in and the weights for N-linear interpolation
+                        std::array<int, NDIM> icell;
+                        std::array<double, NDIM> frac;
+                        bool boundary = false;
+                        for (int idim = 0; idim < NDIM; idim++) {
+                            icell[idim] = coord[idim] / _refinement;
+                            frac[idim] = (coord[idim] % _refinement) / double(_refinement);
+                            if (coord[idim] < nboundary or coord[idim] >= _Npatch - nboundary)
+                                boundary = true;
+                        }
+                        double value = 0.0;
+                        for (int k = 0; k < FML::power(2, NDIM); k++) {
+                            double weight = 1.0;
+                            IndexInt index = 0;
+                            for (int idim = 0; idim < NDIM; idim++) {
+                                const int bit = (k >> idim) & 1;
+                                weight *= bit ? frac[idim] : 1.0 - frac[idim];
+                                index = index * nblock + icell[idim] + bit;
+                            }
+                            value += weight * block[index];
+                        }
+                        fpatch[i] = T(value);
+                        mask[i] = boundary ? -1.0 : 1.0;
+                    }
+                    g.set_mask(mask);
+
+                    g.solve(Equation, ConvergenceCriterion);
+                    _patch_solution.push_back(g.get_grid(0));
+                }
+#endif
+            }
+
+            template <int NDIM, class T>
+            int MultiGridRefinement<NDIM, T>::get_npatches() const {
+                return int(_tile_corner.size());
+            }
+
+            template <int NDIM, class T>
+            int MultiGridRefinement<NDIM, T>::get_patch_N() const {
+                return _Npatch;
+            }
+
+            template <int NDIM, class T>
+            double MultiGridRefinement<NDIM, T>::get_patch_boxsize() const {
+                return (_tile_size + 2 * _nbuffer) / double(_N);
+            }
+
+            template <int NDIM, class T>
+            std::array<double, NDIM> MultiGridRefinement<NDIM, T>::get_patch_origin(int ipatch) const {
+                std::array<double, NDIM> origin;
+                for (int idim = 0; idim < NDIM; idim++)
+                    origin[idim] = (_tile_corner[ipatch][idim] - _nbuffer) / double(_N);
+                return origin;
+            }
+
+            template <int NDIM, class T>
+            std::array<int, NDIM> MultiGridRefinement<NDIM, T>::get_tile_corner(int ipatch) const {
+                return _tile_corner[ipatch];
+            }
+
+            template <int NDIM, class T>
+            bool MultiGridRefinement<NDIM, T>::in_tile(const std::array<int, NDIM> & globalcoord) const {
+                for (int idim = 0; idim < NDIM; idim++)
+                    if (globalcoord[idim] < _nbuffer * _refinement or
+                        globalcoord[idim] >= (_nbuffer + _tile_size) * _refinement)
+                        return false;
+                return true;
+            }
+
+            template <int NDIM, class T>
+            MPIGrid<NDIM, T> & MultiGridRefinement<NDIM, T>::get_patch_solution(int ipatch) {
+                return _patch_solution[ipatch];
+            }
+
+            template <int NDIM, class T>
+            void MultiGridRefinement<NDIM, T>::free() {
+                _tile_corner.clear();
+                _tile_corner.shrink_to_fit();
+                _patch_solution.clear();
+                _patch_solution.shrink_to_fit();
+            }
+        } // namespace MULTIGRIDSOLVER
+    }     // namespace SOLVERS
+} // namespace FML
+
+#endif
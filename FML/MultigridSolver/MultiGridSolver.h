@@ -1,6 +1,7 @@
 #ifndef MULTIGRIDSOLVER_HEADER
 #define MULTIGRIDSOLVER_HEADER
 
+#include <algorithm>
 #include <bitset>
 #include <cassert>
 #include <climits>
@@ -8,9 +9,13 @@
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <string>
+#include <type_traits>
 #include <vector>
 
+#include <FML/FFTWGrid/FFTWGrid.h>
 #include <FML/Global/Global.h>
+#include <FML/MPIGrid/ConvertMPIGridFFTWGrid.h>
 #include <FML/MPIGrid/MPIGrid.h>
 #include <FML/MPIGrid/MPIMultiGrid.h>
 
@@ -31,9 +36,135 @@ namespace FML {
             template <int NDIM, class T>
             class MultiGridSolver;
             template <int NDIM, class T>
+            class MultiGridRefinement;
+            template <int NDIM, class T>
             using MultiGridFunction = std::function<std::pair<T, T>(MultiGridSolver<NDIM, T> *, int, IndexInt)>;
             using MultiGridConvCrit = std::function<bool(double, double, int)>;
 
+            //=============================================
+            /// What is needed to find the 2NDIM closest
+            /// cells of a cell at a given level without
+            /// access to the solver (e.g. on the device).
+            /// Gives the same cells as get_neighbor_gridindex
+            //=============================================
+            struct MultiGridStencil {
+                IndexInt N{0};          // Cells per dimension
+                double h{1.0};          // Gridspacing
+                bool periodic{true};    // Wrap around in the y, z, ... directions
+                bool periodic_x{false}; // Wrap around in x (only if we have all the slices, i.e. one task)
+            };
+
+            //=============================================
+            ///
+            /// An equation on the form D[ b(f) Df ] = S(f, aux)
+            /// where b(f) and S(f, aux) return the value and
+            /// the derivative wrt f as a pair. aux is an
+            /// optional field on all levels (e.g. the density
+            /// restricted down with restrict_down_all).
+            ///
+            /// It is called like any other equation, but as
+            /// it does not call back into the solver it can
+            /// also be evaluated on the device so with
+            /// USE_OMP_TARGET and set_offload(true) the whole
+            /// solve runs there. b and S must then be
+            /// callables that can be copied to the device
+            /// (e.g. lambdas that capture numbers by value).
+            /// Create with make_stencil_equation
+            ///
+            //=============================================
+            template <int NDIM, class AuxType, class BFunction, class SourceFunction>
+            struct MultiGridStencilEquation {
+                BFunction b;
+                SourceFunction source;
+                MPIMultiGrid<NDIM, AuxType> * aux{nullptr};
+
+                // L and dL/df in cell index. f and aux point to the first cell of the (local) level
+                template <class T>
+                std::pair<T, T>
+                evaluate(const T * f, const AuxType * auxlevel, const MultiGridStencil & s, IndexInt index) const {
+                    // The same as get_neighbor_gridindex + get_BLaplacian and get_derivBLaplacian
+                    IndexInt coord[NDIM];
+                    IndexInt rest = index;
+                    for (int idim = NDIM - 1; idim >= 1; idim--) {
+                        coord[idim] = rest % s.N;
+                        rest /= s.N;
+                    }
+                    coord[0] = rest;
+
+                    const T fcenter = f[index];
+                    const auto bcenter = b(fcenter);
+                    T kinetic{0.0};
+                    T dkinetic{0.0};
+                    IndexInt Npow = 1;
+                    for (int idim = NDIM - 1; idim >= 0; idim--, Npow *= s.N) {
+                        IndexInt index_minus = index - Npow;
+                        IndexInt index_plus = index + Npow;
+                        if (s.periodic and (idim > 0 or s.periodic_x)) {
+                            index_minus = index + ((coord[idim] - 1 + s.N) % s.N - coord[idim]) * Npow;
+                            index_plus = index + ((coord[idim] + 1) % s.N - coord[idim]) * Npow;
+                        }
+                        const T fminus = f[index_minus];
+                        const T fplus = f[index_plus];
+                        const T bminus = 0.5 * (b(fminus).first + bcenter.first);
+                        const T bplus = 0.5 * (b(fplus).first + bcenter.first);
+                        kinetic += (bplus * (fplus - fcenter) - bminus * (fcenter - fminus));
+                        dkinetic += (0.5 * bcenter.second * (fplus + fminus - 2.0 * fcenter) - (bplus + bminus));
+                    }
+                    kinetic /= (s.h * s.h);
+                    dkinetic /= (s.h * s.h);
+
+                    const auto S = source(fcenter, auxlevel ? auxlevel[index] : AuxType(0));
+                    return std::pair<T, T>{kinetic - T(S.first), dkinetic - T(S.second)};
+                }
+
+                template <class T>
+                std::pair<T, T> operator()(MultiGridSolver<NDIM, T> * sol, int level, IndexInt index) const {
+                    const AuxType * auxlevel = aux ? aux->get_y(level) : nullptr;
+                    return evaluate(sol->get_y(level), auxlevel, sol->get_stencil(level), index);
+                }
+            };
+
+            /// Make the equation D[ b(f) Df ] = S(f, aux). b(f) returns {b, db/df} and S(f, aux) returns {S, dS/df}
+            template <int NDIM, class AuxType, class BFunction, class SourceFunction>
+            MultiGridStencilEquation<NDIM, AuxType, BFunction, SourceFunction>
+            make_stencil_equation(BFunction b, SourceFunction source, MPIMultiGrid<NDIM, AuxType> * aux = nullptr) {
+                return {b, source, aux};
+            }
+
+            template <class EquationType>
+            struct is_stencil_equation : std::false_type {};
+            template <int NDIM, class AuxType, class BFunction, class SourceFunction>
+            struct is_stencil_equation<MultiGridStencilEquation<NDIM, AuxType, BFunction, SourceFunction>>
+                : std::true_type {};
+            template <class EquationType>
+            constexpr bool is_stencil_equation_v = is_stencil_equation<std::remove_cv_t<EquationType>>::value;
+
+#ifdef USE_OMP_TARGET
+            // The types we can copy to the device
+            template <class T>
+            constexpr bool device_mappable_v = std::is_trivially_copyable_v<T>;
+
+            // The allocation of a grid (including the extra slices) as we map it to the device and
+            // where the first local cell is in it
+            template <int NDIM, class U>
+            IndexInt device_alloc_offset(MPIGrid<NDIM, U> & grid) {
+                if (grid.get_NtotLocal() == 0)
+                    return 0;
+                return grid.get_n_extra_slices_left() * FML::power(grid.get_N(), NDIM - 1);
+            }
+            template <int NDIM, class U>
+            U * device_alloc_start(MPIGrid<NDIM, U> & grid) {
+                return grid.get_NtotLocal() > 0 ? grid.get_y() - device_alloc_offset(grid) : nullptr;
+            }
+            template <int NDIM, class U>
+            IndexInt device_alloc_size(MPIGrid<NDIM, U> & grid) {
+                if (grid.get_NtotLocal() == 0)
+                    return 0;
+                const int nextra = grid.get_n_extra_slices_left() + grid.get_n_extra_slices_right();
+                return grid.get_NtotLocal() + nextra * FML::power(grid.get_N(), NDIM - 1);
+            }
+#endif
+
             //=============================================
             ///
             /// A general multigrid solver to solve
@@ -90,6 +221,60 @@ namespace FML {
             /// sweep through the grid: sum of int-coord
             /// mod _NGRIDCOLOURS. For 2 we have standard
             /// chess-board ordering
+            ///
+            /// _CYCLE_TYPE is the multigrid cycle used in
+            /// each step: V (fiducial), W or F. Change by
+            /// running [set_cycle_type]
+            ///
+            /// _USE_FMG turns on full multigrid: before the
+            /// first cycle the equation is solved on the
+            /// coarsest grid and the solution prolonged up
+            /// level by level (with one cycle on each level)
+            /// to make the initial guess on the domain grid.
+            /// Change by running [set_fmg]
+            ///
+            /// _MIXED_PRECISION (for T = double) does the
+            /// cycles in a float copy of the solver, which
+            /// halves the memory traffic of the sweeps, until
+            /// the residual stops improving (the float
+            /// precision floor) and then finishes with cycles
+            /// in double where the residual on the domain
+            /// grid decides convergence. This requires an
+            /// equation that can also be called with a
+            /// MultiGridSolver<NDIM, float> (e.g. a generic
+            /// lambda taking auto * sol). Change by running
+            /// [set_mixed_precision]
+            ///
+            /// _FFT_LINEAR_OPERATOR is the Fourier space
+            /// symbol J(k2) of the linearized equation (e.g.
+            /// -k2 - m^2 for D^2f - m^2f) as function of the
+            /// eigenvalue k2 of -D^2 on the domain grid. If
+            /// set then after every cycle the modes with
+            /// |k| < _FFT_KMAX are corrected by solving
+            /// J e = -L(f) with FFTs (periodic box and
+            /// USE_FFTW only). For equations that are linear
+            /// on large scales this solves the long
+            /// wavelength modes the cycles are slow at.
+            /// Change by running [set_fft_correction]
+            ///
+            /// _ORIGIN and _BOXSIZE define the region the
+            /// grid covers (fiducial is the unit box). This is
+            /// used for solving on a sub-volume, e.g. the
+            /// refinement patches in MultiGridRefinement.h.
+            /// The grid spacing and get_Coordinate take this
+            /// into account. Change by running [set_domain]
+            ///
+            /// _OFFLOAD (USE_OMP_TARGET) runs the solve on
+            /// the device for equations made with
+            /// make_stencil_equation: all levels stay in
+            /// device memory and the sweeps, residuals,
+            /// restriction and prolongation are target
+            /// kernels. Only the ghost slices go via the host
+            /// for the MPI communication (and the coarse
+            /// levels that are agglomerated on fewer tasks,
+            /// and the FFT correction, are done on the host).
+            /// Other equations are solved on the host.
+            /// Change by running [set_offload]
             //=============================================
 
             template <int NDIM, class T>
@@ -116,6 +301,23 @@ namespace FML {
                     10;               // Number of NGS sweeps the very first time (in case the guess is not very good)
                 int _maxsteps = 1000; // Maximum number of V-cycles
 
+                // Multigrid cycle parameters
+                std::string _cycle_type{"V"}; // The cycle to do every step (V, W or F)
+                bool _use_fmg{false};         // Use full multigrid to make the initial guess
+                bool _mixed_precision{false}; // Do the bulk of the cycles in float (only for T = double)
+
+                // FFT correction of the long wavelength modes
+                std::function<double(double)> _fft_linear_operator{}; // Symbol J(k2) of the linearized equation
+                double _fft_kmax{0.0}; // Only correct modes with |k| < _fft_kmax (k in units of 1/box)
+
+                // Offload to the device (only for stencil equations, see make_stencil_equation)
+                bool _offload{false};   // Solve on the device if possible
+                bool _on_device{false}; // The levels are in device memory (set while solving)
+
+                // The region the grid covers: [_origin, _origin + _boxsize)
+                std::array<double, NDIM> _origin{};
+                double _boxsize{1.0};
+
                 double _eps_converge = 1e-4; // Fiducial convergence criterion for residual or error
 
                 // Residual information
@@ -127,18 +329,53 @@ namespace FML {
                 int _istep_vcycle = 0; // The number of V-cycles we are currenlty at
 
                 // Internal methods implementing the multigrid algorithm
-                double calculate_residual(int level, MPIGrid<NDIM, T> & res);
+                // The methods that evaluate the equation are templated on its type so that a lambda
+                // (or any callable) passed to solve is called directly in the inner loops
+                template <class EquationType>
+                double calculate_residual(EquationType & Equation, int level, MPIGrid<NDIM, T> & res);
                 void prolonge_up_array(int to_level, MPIGrid<NDIM, T> & BottomGrid, MPIGrid<NDIM, T> & TopGrid);
                 void make_prolongation_array(MPIGrid<NDIM, T> & f, MPIGrid<NDIM, T> & Rf, MPIGrid<NDIM, T> & df);
-                void GaussSeidelSweep(int level, int curcolor, T * f);
-                void solve_current_level(int level);
-                void recursive_go_up(int to_level);
-                void recursive_go_down(int from_level);
-                void make_new_source(int level);
-                void run_solver();
-
-                // The functions defining the equations to be solved
-                MultiGridFunction<NDIM, T> _Equation;
+                template <class EquationType>
+                void GaussSeidelSweep(EquationType & Equation, int level, int curcolor, int ix_start, int ix_end, T * f);
+                template <class EquationType>
+                void solve_current_level(EquationType & Equation, int level);
+                template <class EquationType>
+                void go_up_one_level(EquationType & Equation, int to_level);
+                template <class EquationType>
+                void go_down_one_level(EquationType & Equation, int from_level);
+                template <class EquationType>
+                void multigrid_cycle(EquationType & Equation, int level, const std::string & cycle_type);
+                template <class EquationType>
+                void full_multigrid(EquationType & Equation);
+                template <class EquationType>
+                void fft_correction(EquationType & Equation);
+                template <class EquationType>
+                void make_new_source(EquationType & Equation, int level);
+                template <class EquationType>
+                void run_solver(EquationType & Equation);
+                template <class EquationType>
+                void run_solver_single_precision(EquationType & Equation);
+
+                // Keep the levels in device memory while solving (USE_OMP_TARGET)
+                template <class EquationType>
+                void device_enter(EquationType & Equation);
+                void device_exit();
+                void communicate_boundaries(MPIGrid<NDIM, T> & grid);
+                void restrict_down(MPIMultiGrid<NDIM, T> & multigrid, int from_level, MPIGrid<NDIM, T> & to_grid);
+                void add_to_grid(MPIGrid<NDIM, T> & grid, MPIGrid<NDIM, T> & rhs);
+                void fill_grid(MPIGrid<NDIM, T> & grid, T value);
+                void update_host(MPIGrid<NDIM, T> & grid);
+                void update_device(MPIGrid<NDIM, T> & grid);
+                std::vector<std::pair<char *, size_t>> _device_aux{}; // The aux field we have put on the device
+
+                // The single precision solver used for mixed precision and the solvers for the refinement
+                // patches needs access to our settings
+                template <int, class>
+                friend class MultiGridSolver;
+                template <int, class>
+                friend class MultiGridRefinement;
+
+                // The convergence criterion
                 MultiGridConvCrit _ConvergenceCriterion;
 
               public:
@@ -161,6 +398,13 @@ namespace FML {
                 void set_maxsteps(int maxsteps);
                 void set_ngs_sweeps(int ngs_fine, int ngs_coarse, int ngs_first_step);
                 void set_convergence_criterion_residual(bool use_residual);
+                void set_cycle_type(std::string cycle_type);
+                void set_fmg(bool use_fmg);
+                void set_mixed_precision(bool mixed_precision);
+                void set_fft_correction(std::function<double(double)> linear_operator,
+                                        double kmax_over_knyquist = 1.0);
+                void set_domain(const std::array<double, NDIM> & origin, double boxsize);
+                void set_offload(bool offload);
 
                 // Fetch info about the grids
                 int get_N(int level = 0);
@@ -177,9 +421,15 @@ namespace FML {
 
                 // The method that does all the work. Solve the PDE
                 void solve(MultiGridFunction<NDIM, T> & Equation, MultiGridConvCrit & ConvergenceCriterion) {
-                    _Equation = Equation;
                     _ConvergenceCriterion = ConvergenceCriterion;
-                    run_solver();
+                    run_solver(Equation);
+                }
+                // Same as above, but takes any callable with the signature of MultiGridFunction
+                // (e.g. a lambda stored as auto) and avoids the std::function call per cell
+                template <class EquationType>
+                void solve(EquationType && Equation, MultiGridConvCrit & ConvergenceCriterion) {
+                    _ConvergenceCriterion = ConvergenceCriterion;
+                    run_solver(Equation);
                 }
 
                 // Determine if we are converged and print some info
@@ -192,6 +442,8 @@ namespace FML {
                 // Below nbor_index_list is what get_neighbor_index return which is the closest 2NDIM cells
                 // Gridspacing
                 double get_Gridspacing(int level);
+                // What is needed to evaluate a stencil at a level without the solver
+                MultiGridStencil get_stencil(int level);
                 // The solution in a given cell
                 T get_Field(int level, IndexInt index);
                 // The closest 2NDIM cells (plus the cell itself)
@@ -207,14 +459,14 @@ namespace FML {
                 // The Laplacian operator D^2f
                 T get_Laplacian(int level, const std::array<IndexInt, 2 * NDIM + 1> & nbor_index_list);
                 T get_derivLaplacian(int level, const std::array<IndexInt, 2 * NDIM + 1> & nbor_index_list);
-                // D[ b(f) Df ]
-                T get_BLaplacian(int level,
-                                 const std::array<IndexInt, 2 * NDIM + 1> & nbor_index_list,
-                                 std::function<T(int, IndexInt)> & b);
+                // D[ b(f) Df ] (b and db are callables T(int level, IndexInt index), e.g. std::function or lambdas)
+                template <class BFunction>
+                T get_BLaplacian(int level, const std::array<IndexInt, 2 * NDIM + 1> & nbor_index_list, BFunction && b);
+                template <class BFunction, class dBFunction>
                 T get_derivBLaplacian(int level,
                                       const std::array<IndexInt, 2 * NDIM + 1> & nbor_index_list,
-                                      std::function<T(int, IndexInt)> & b,
-                                      std::function<T(int, IndexInt)> & db);
+                                      BFunction && b,
+                                      dBFunction && db);
                 // Compute df/dx_i and d^2f/dx_i^2 for a given accuracy for a given cell ( O(h^(2order) )
                 // Assumes equal grid-spacing in all directions
                 std::array<T, NDIM> get_Gradient(int level, IndexInt index, int order);
@@ -272,6 +524,13 @@ namespace FML {
                 for (int level = 0; level < _Nlevel; level++) {
                     total_cells += _f.get_grid(level).get_NtotLocal();
                 }
+
+                // Levels that are held by a subset of the tasks
+                int nagglomerated = 0;
+                for (int level = 0; level < _Nlevel; level++)
+                    if (_f.get_grid(level).get_task_stride() > 1)
+                        nagglomerated++;
+
                 // We have 3 grids: _f, _res, _source
                 total_cells *= 3 * sizeof(T);
 
@@ -291,6 +550,7 @@ namespace FML {
                     std::cout << "# Periodic?            : " << std::boolalpha << _periodic << "\n";
                     std::cout << "# N                    : " << _N << "\n";
                     std::cout << "# NLevel               : " << _Nlevel << "\n";
+                    std::cout << "# Agglomerated levels  : " << nagglomerated << " (fewer x-slices than tasks)\n";
                     std::cout << "# Memory allocated     : " << total_cells / 1e6 << " MB per task\n";
                     std::cout << "#\n";
                     std::cout << "#=====================================================\n";
@@ -388,7 +648,8 @@ namespace FML {
             //================================================
 
             template <int NDIM, class T>
-            void MultiGridSolver<NDIM, T>::run_solver() {
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::run_solver(EquationType & Equation) {
                 // Init some variables
                 _istep_vcycle = 0;
                 _rms_res = 0.0;
@@ -413,24 +674,40 @@ namespace FML {
                               << std::endl;
                 }
 
+                // Do the bulk of the cycles in single precision (this includes FMG if that is on)
+                if (_mixed_precision)
+                    run_solver_single_precision(Equation);
+
+                // Move the levels to the device and solve there
+                if constexpr (is_stencil_equation_v<EquationType> and std::is_trivially_copyable_v<T>)
+                    if (_offload)
+                        device_enter(Equation);
+
+                // Make the initial guess by full multigrid
+                if (not _mixed_precision and _use_fmg and _Nlevel > 1)
+                    full_multigrid(Equation);
+
                 // Pre-solve on domaingrid
-                solve_current_level(0);
+                solve_current_level(Equation, 0);
 
-                // Set the initial residual
-                _rms_res_i = _rms_res;
+                // Set the initial residual (unless the single precision cycles already did)
+                if (_rms_res_i == 0.0)
+                    _rms_res_i = _rms_res;
 
-                // Check if we already have convergence
-                if (is_converged())
-                    return;
+                // Correct the long wavelength modes using the linearized equation
+                if (_fft_linear_operator)
+                    fft_correction(Equation);
 
-                // The V-cycle
-                while (1) {
+                // The V-cycle (if we don't already have convergence)
+                bool converged = is_converged();
+                while (not converged) {
                     ++_istep_vcycle;
 
                     if (_verbose) {
                         std::cout << std::endl;
                         std::cout << "===============================================================" << std::endl;
-                        std::cout << "==> Starting V-cycle istep = " << _istep_vcycle << " Res = " << _rms_res
+                        std::cout << "==> Starting " << _cycle_type << "-cycle istep = " << _istep_vcycle
+                                  << " Res = " << _rms_res
                                   << std::endl;
                         std::cout << "===============================================================\n" << std::endl;
                     }
@@ -438,21 +715,24 @@ namespace FML {
                     if (_Nlevel == 1) {
 
                         // If we only have 1 level then just solve and solve...
-                        solve_current_level(0);
+                        solve_current_level(Equation, 0);
 
                     } else {
 
-                        // Go down to the bottom (from finest grid [0] to coarsest grid [_Nlevel-1])
-                        recursive_go_down(0);
-
-                        // Go up to the top
-                        recursive_go_up(_Nlevel - 2);
+                        // Do a cycle going down to the coarsest grid [_Nlevel-1] and back up to the finest grid [0]
+                        multigrid_cycle(Equation, 0, _cycle_type);
                     }
 
+                    // Correct the long wavelength modes using the linearized equation
+                    if (_fft_linear_operator)
+                        fft_correction(Equation);
+
                     // Check for convergence
-                    if (is_converged())
-                        break;
+                    converged = is_converged();
                 }
+
+                // Copy the solution back to the host
+                device_exit();
             }
 
             //================================================
@@ -486,6 +766,55 @@ namespace FML {
                 _ngs_first_step = ngs_first_step;
             }
 
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::set_cycle_type(std::string cycle_type) {
+                assert_mpi(cycle_type == "V" or cycle_type == "W" or cycle_type == "F",
+                           "[MultiGridSolver::set_cycle_type] Unknown cycle type. Options: V, W, F\n");
+                _cycle_type = cycle_type;
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::set_fmg(bool use_fmg) {
+                _use_fmg = use_fmg;
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::set_mixed_precision(bool mixed_precision) {
+                assert_mpi((not mixed_precision or std::is_same_v<T, double>),
+                           "[MultiGridSolver::set_mixed_precision] Mixed precision is only for T = double\n");
+                _mixed_precision = mixed_precision;
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::set_fft_correction(std::function<double(double)> linear_operator,
+                                                              double kmax_over_knyquist) {
+#ifndef USE_FFTW
+                assert_mpi(not linear_operator, "[MultiGridSolver::set_fft_correction] Requires USE_FFTW\n");
+#endif
+                assert_mpi(not linear_operator or _periodic,
+                           "[MultiGridSolver::set_fft_correction] Requires a periodic box\n");
+                _fft_linear_operator = linear_operator;
+                _fft_kmax = kmax_over_knyquist * M_PI * _N;
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::set_domain(const std::array<double, NDIM> & origin, double boxsize) {
+                assert_mpi(boxsize > 0.0, "[MultiGridSolver::set_domain] Boxsize must be positive\n");
+                _origin = origin;
+                _boxsize = boxsize;
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::set_offload(bool offload) {
+#ifndef USE_OMP_TARGET
+                assert_mpi(not offload, "[MultiGridSolver::set_offload] Requires USE_OMP_TARGET\n");
+#endif
+#ifdef USE_MASK
+                assert_mpi(not offload, "[MultiGridSolver::set_offload] Not implemented with USE_MASK\n");
+#endif
+                _offload = offload;
+            }
+
             template <int NDIM, class T>
             int MultiGridSolver<NDIM, T>::get_N(int level) {
                 return _f.get_N(level);
@@ -499,8 +828,8 @@ namespace FML {
 #ifdef USE_MASK
             template <int NDIM, class T>
             void MultiGridSolver<NDIM, T>::set_mask(const MPIGrid<NDIM, T> & mask) {
-                T * m = mask.get_y();
-                T * f = _bmask.get_y(0);
+                const T * m = mask.get_y();
+                double * f = _bmask.get_y(0);
                 std::copy(&m[0], &m[0] + _NtotLocal, &f[0]);
                 _bmask.restrict_down_all();
                 for (int level = 0; level < _Nlevel; level++)
@@ -530,7 +859,7 @@ namespace FML {
             template <int NDIM, class T>
             void MultiGridSolver<NDIM, T>::set_initial_guess(const MPIGrid<NDIM, T> & guessgrid) {
                 T * f = _f.get_y(0);
-                T * guess = guessgrid.get_y();
+                const T * guess = guessgrid.get_y();
                 std::copy(&guess[0], &guess[0] + _NtotLocal, &f[0]);
             }
 
@@ -578,7 +907,7 @@ namespace FML {
                 std::array<T, NDIM> gradient;
                 gradient.fill(0.0);
                 auto coord = _f.get_grid(level).coord_from_index(index);
-                double norm = double(get_N(level));
+                double norm = 1.0 / get_Gridspacing(level);
                 int N = _f.get_grid(level).get_N();
                 const auto weights = derivative_stencil_weights_deriv1(order);
                 for (int idim = NDIM - 1, Npow = 1; idim >= 0; idim--, Npow *= N) {
@@ -612,7 +941,7 @@ namespace FML {
                 std::array<T, NDIM> gradient;
                 gradient.fill(0.0);
                 auto coord = _f.get_grid(level).coord_from_index(index);
-                double norm = double(get_N(level));
+                double norm = 1.0 / get_Gridspacing(level);
                 norm = norm * norm;
                 int N = _f.get_grid(level).get_N();
                 const auto weights = derivative_stencil_weights_deriv2(order);
@@ -771,9 +1100,47 @@ namespace FML {
             //================================================
 
             template <int NDIM, class T>
-            double MultiGridSolver<NDIM, T>::calculate_residual(int level, MPIGrid<NDIM, T> & res) {
+            template <class EquationType>
+            double MultiGridSolver<NDIM, T>::calculate_residual(EquationType & Equation,
+                                                                int level,
+                                                                MPIGrid<NDIM, T> & res) {
                 IndexInt NtotLocal = get_NtotLocal(level);
 
+#ifdef USE_OMP_TARGET
+                if constexpr (is_stencil_equation_v<EquationType> and device_mappable_v<T>) {
+                    if (_on_device) {
+                        using AuxType = std::remove_pointer_t<decltype(Equation.aux->get_y(0))>;
+                        const auto eq = Equation;
+                        const auto stencil = get_stencil(level);
+                        const bool add_source = level > 0;
+                        auto & fgrid = _f.get_grid(level);
+                        auto & sourcegrid = _source.get_grid(level);
+                        T * f = device_alloc_start(fgrid);
+                        T * r = res.get_y();
+                        T * source = sourcegrid.get_y();
+                        AuxType * aux = eq.aux ? device_alloc_start(eq.aux->get_grid(level)) : nullptr;
+                        const IndexInt nf = device_alloc_size(fgrid);
+                        const IndexInt naux = eq.aux ? device_alloc_size(eq.aux->get_grid(level)) : 0;
+                        const IndexInt foffset = device_alloc_offset(fgrid);
+                        const IndexInt auxoffset = eq.aux ? device_alloc_offset(eq.aux->get_grid(level)) : 0;
+
+                        double norm2 = 0.0;
+#pragma omp target teams distribute parallel for map(to : f[0 : nf], aux[0 : naux], source[0 : NtotLocal])         \
+    map(tofrom : r[0 : NtotLocal]) map(to : eq, stencil) reduction(+ : norm2)
+                        for (IndexInt i = 0; i < NtotLocal; i++) {
+                            T value = (eq.evaluate(f + foffset, aux ? aux + auxoffset : nullptr, stencil, i).first) *
+                                      T(-1.0);
+                            if (add_source)
+                                value += source[i];
+                            r[i] = value;
+                            norm2 += double(value) * double(value);
+                        }
+                        FML::SumOverTasks(&norm2);
+                        return std::sqrt(norm2 / double(res.get_Ntot()));
+                    }
+                }
+#endif
+
                 // Calculate and store (minus) the residual in each cell
 #ifdef USE_OMP
 #pragma omp parallel for
@@ -783,7 +1150,7 @@ namespace FML {
                     if (_bmask[level][i] <= 0.0)
                         continue;
 #endif
-                    res[i] = (_Equation(this, level, i).first) * T(-1.0);
+                    res[i] = (Equation(this, level, i).first) * T(-1.0);
                     if (level > 0)
                         res[i] += _source[level][i];
                 }
@@ -844,6 +1211,81 @@ namespace FML {
                 return converged;
             }
 
+            //================================================
+            // The N-linear prolongation of the bottom grid
+            // to the cell in the top grid with global
+            // coordinate coord_top. bottom points to the
+            // first local cell of the bottom grid which
+            // starts at x-slice xstart_bottom. This is also
+            // called on the device
+            //================================================
+
+            template <int NDIM, class T>
+            T prolonged_value(const T * bottom,
+                              const std::array<int, NDIM> & coord_top,
+                              int NBottom,
+                              int xstart_bottom,
+                              bool periodic,
+                              bool periodic_x) {
+                constexpr int twotondim = FML::power(2, NDIM);
+
+                // Compute NTop, Ntop^2, ... , Ntop^{Ndim-1} and similar for Nbottom
+                std::array<IndexInt, NDIM> nBottomPow;
+                nBottomPow[NDIM - 1] = 1;
+                for (int idim = NDIM - 2; idim >= 0; idim--) {
+                    nBottomPow[idim] = nBottomPow[idim + 1] * NBottom;
+                }
+
+                std::array<double, NDIM> fac;
+                std::array<IndexInt, NDIM> iplus;
+
+                //  Global coordinate of bottom cell
+                auto coord_bottom = coord_top;
+                for (int idim = NDIM - 1; idim >= 0; idim--)
+                    coord_bottom[idim] /= 2;
+
+                // Index of bottom cell
+                IndexInt iBottom = (coord_bottom[0] - xstart_bottom) * nBottomPow[0];
+                for (int idim = 1; idim < NDIM; idim++)
+                    iBottom += coord_bottom[idim] * nBottomPow[idim];
+
+                // Compute weights
+                double norm = 1.0;
+                for (int idim = NDIM - 1; idim >= 0; idim--) {
+                    fac[idim] = coord_top[idim] % 2 == 0 ? 0.0 : 1.0;
+                    iplus[idim] = 1;
+                    if (periodic and (idim > 0 or periodic_x)) {
+                        iplus[idim] = (coord_bottom[idim] + 1 < NBottom ? 1 : 1 - NBottom);
+                    }
+                    iplus[idim] *= nBottomPow[idim];
+                    norm *= (1.0 + fac[idim]);
+                }
+                norm = 1.0 / norm;
+
+                //===================================================================================
+                // Do N-linear interpolation
+                // Compute the sum Top[i] = Sum fac_i             * Top[iBottom + d_i]
+                //                        + Sum fac_i fac_j       * Top[iBottom + d_i + d_j]
+                //                        + Sum fac_i fac_j fac_k * Top[iBottom + d_i + d_j + d_k]
+                //                        + ... +
+                //                        + fac_1 ... fac_NDIM * Top[iBottom + d_1 + ... + d_NDIM]
+                //===================================================================================
+
+                // This routine must probably be modified for having a mask
+                T val = bottom[iBottom];
+                for (int k = 1; k < twotondim; k++) {
+                    double termfac = 1.0;
+                    IndexInt iAdd = 0;
+                    for (int j = 0; j < NDIM; j++) {
+                        const int bit = (k >> j) & 1;
+                        iAdd = bit * iplus[j];
+                        termfac *= 1.0 + bit * (fac[j] - 1.0);
+                    }
+                    val += T(termfac) * bottom[iBottom + iAdd];
+                }
+                return val * T(norm);
+            }
+
             //================================================
             // Prolonge up solution phi from course grid
             // to fine grid. Using trilinear prolongation
@@ -853,23 +1295,80 @@ namespace FML {
             void MultiGridSolver<NDIM, T>::prolonge_up_array(int to_level,
                                                              MPIGrid<NDIM, T> & Bottom,
                                                              MPIGrid<NDIM, T> & Top) {
-                constexpr int twotondim = FML::power(2, NDIM);
                 int NTop = get_N(to_level);
                 int NBottom = NTop / 2;
 
                 IndexInt NtotLocalTop = Top.get_NtotLocal();
 
-                // Compute NTop, Ntop^2, ... , Ntop^{Ndim-1} and similar for Nbottom
-                std::array<IndexInt, NDIM> nBottomPow;
-                nBottomPow[NDIM - 1] = 1;
-                for (int idim = NDIM - 2; idim >= 0; idim--) {
-                    nBottomPow[idim] = nBottomPow[idim + 1] * NBottom;
+                // Trilinear prolongation to a cell in the top grid with global coordinate coord_top
+                const bool periodic_x = _periodic and FML::NTasks == 1;
+                auto prolonged_value = [&](const std::array<int, NDIM> & coord_top) {
+                    return MULTIGRIDSOLVER::prolonged_value<NDIM, T>(
+                        Bottom.get_y(), coord_top, NBottom, Bottom.get_xStartLocal(), _periodic, periodic_x);
+                };
+
+                // The bottom level is agglomerated on fewer tasks than the top level. The tasks holding the
+                // bottom slices compute the top slices they cover and send them to the tasks that have them
+                // (on the host as these levels are tiny)
+                if (Bottom.get_task_stride() != Top.get_task_stride()) {
+                    update_host(Bottom);
+                    const IndexInt NperSliceTop = FML::power(NTop, NDIM - 1);
+                    const int ixstart_top = 2 * Bottom.get_xStartLocal();
+                    const int nslices_top = 2 * Bottom.get_NLocal();
+
+                    std::vector<T> slices(nslices_top * NperSliceTop);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (IndexInt i = 0; i < nslices_top * NperSliceTop; i++) {
+                        std::array<int, NDIM> coord_top;
+                        IndexInt index = i;
+                        for (int idim = NDIM - 1; idim >= 1; idim--) {
+                            coord_top[idim] = index % NTop;
+                            index /= NTop;
+                        }
+                        coord_top[0] = ixstart_top + index;
+                        slices[i] = prolonged_value(coord_top);
+                    }
+
+                    Top.send_slices_to_owners(ixstart_top, nslices_top, slices, [&](IndexInt i, const T & value) {
+#ifdef USE_MASK
+                        if (_bmask[to_level][i] <= 0.0)
+                            return;
+#endif
+                        Top[i] = value;
+                    });
+                    update_device(Top);
+                    return;
                 }
 
-                // IndexInt ixStartLocalBottom = Bottom.get_xStartLocal();
-                // IndexInt ixStartLocalTop    = Top.get_xStartLocal();
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (_on_device) {
+                        const int xstart_top = Top.get_xStartLocal();
+                        const int xstart_bottom = Bottom.get_xStartLocal();
+                        const bool periodic = _periodic;
+                        const T * bottom = device_alloc_start(Bottom);
+                        T * top = Top.get_y();
+                        const IndexInt nbottom = device_alloc_size(Bottom);
+                        const IndexInt bottomoffset = device_alloc_offset(Bottom);
+#pragma omp target teams distribute parallel for map(to : bottom[0 : nbottom]) map(tofrom : top[0 : NtotLocalTop])
+                        for (IndexInt i = 0; i < NtotLocalTop; i++) {
+                            std::array<int, NDIM> coord_top;
+                            IndexInt index = i;
+                            for (int idim = NDIM - 1; idim >= 1; idim--) {
+                                coord_top[idim] = int(index % NTop);
+                                index /= NTop;
+                            }
+                            coord_top[0] = xstart_top + int(index);
+                            top[i] = MULTIGRIDSOLVER::prolonged_value<NDIM, T>(
+                                bottom + bottomoffset, coord_top, NBottom, xstart_bottom, periodic, periodic_x);
+                        }
+                        return;
+                    }
+                }
+#endif
 
-                // Trilinear prolongation
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
@@ -878,54 +1377,7 @@ namespace FML {
                     if (_bmask[to_level][i] <= 0.0)
                         continue;
 #endif
-
-                    std::array<double, NDIM> fac;
-                    std::array<int, NDIM> iplus;
-
-                    //  Global coordinate of top and bottom cell
-                    auto coord_top = Top.globalcoord_from_index(i);
-                    auto coord_bottom = coord_top;
-                    for (int idim = NDIM - 1; idim >= 0; idim--)
-                        coord_bottom[idim] /= 2;
-
-                    // Index of bottom cell
-                    IndexInt iBottom = Bottom.index_from_globalcoord(coord_bottom);
-
-                    // Compute weights
-                    double norm = 1.0;
-                    for (int idim = NDIM - 1; idim >= 0; idim--) {
-                        fac[idim] = coord_top[idim] % 2 == 0 ? 0.0 : 1.0;
-                        iplus[idim] = 1;
-                        if (_periodic and not(idim == 0 and FML::NTasks > 1)) {
-                            iplus[idim] = (coord_bottom[idim] + 1 < NBottom ? 1 : 1 - NBottom);
-                        }
-                        iplus[idim] *= nBottomPow[idim];
-                        norm *= (1.0 + fac[idim]);
-                    }
-                    norm = 1.0 / norm;
-
-                    //===================================================================================
-                    // Do N-linear interpolation
-                    // Compute the sum Top[i] = Sum fac_i             * Top[iBottom + d_i]
-                    //                        + Sum fac_i fac_j       * Top[iBottom + d_i + d_j]
-                    //                        + Sum fac_i fac_j fac_k * Top[iBottom + d_i + d_j + d_k]
-                    //                        + ... +
-                    //                        + fac_1 ... fac_NDIM * Top[iBottom + d_1 + ... + d_NDIM]
-                    //===================================================================================
-
-                    // This routine must probably be modified for having a mask
-                    T val = Bottom[iBottom];
-                    for (int k = 1; k < twotondim; k++) {
-                        double termfac = 1.0;
-                        IndexInt iAdd = 0;
-                        std::bitset<NDIM> bits = std::bitset<NDIM>(k);
-                        for (int j = 0; j < NDIM; j++) {
-                            iAdd = bits[j] * iplus[j];
-                            termfac *= 1.0 + bits[j] * (fac[j] - 1.0);
-                        }
-                        val += T(termfac) * Bottom[iBottom + iAdd];
-                    }
-                    Top[i] = val * T(norm);
+                    Top[i] = prolonged_value(Top.globalcoord_from_index(i));
                 }
             }
 
@@ -933,36 +1385,94 @@ namespace FML {
             // The Gauss-Seidel Sweeps with standard chess-
             // board (first black then white) ordering of
             // gridnodes if _ngridcolours = 2
+            // Sweeps the local x-slices [ix_start, ix_end)
+            // and only visits cells of the current color by
+            // striding along the last (contiguous) dimension
             //================================================
 
             template <int NDIM, class T>
-            void MultiGridSolver<NDIM, T>::GaussSeidelSweep(int level, int curcolor, T * f) {
-                IndexInt NtotLocal = get_NtotLocal(level);
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::GaussSeidelSweep(
+                EquationType & Equation, int level, int curcolor, int ix_start, int ix_end, T * f) {
                 auto & grid = _f.get_grid(level);
+                FML_TIMER_REGION("MultiGridSolver::GaussSeidelSweep");
+
+                // Cells along the contiguous dimension and the range of such rows to sweep
+                const IndexInt N = get_N(level);
+                const IndexInt nrow = NDIM > 1 ? N : 1;
+                const IndexInt nperslice = FML::power(N, NDIM - 1);
+                const IndexInt row_start = ix_start * nperslice / nrow;
+                const IndexInt row_end = ix_end * nperslice / nrow;
+
+#ifdef USE_OMP_TARGET
+                if constexpr (is_stencil_equation_v<EquationType> and device_mappable_v<T>) {
+                    if (_on_device) {
+                        using AuxType = std::remove_pointer_t<decltype(Equation.aux->get_y(0))>;
+                        const auto eq = Equation;
+                        const auto stencil = get_stencil(level);
+                        const bool add_source = level > 0;
+                        const int ngridcolours = _ngridcolours;
+                        const int xstart = grid.get_xStartLocal();
+                        const IndexInt NtotLocal = grid.get_NtotLocal();
+                        auto & sourcegrid = _source.get_grid(level);
+                        T * fstart = device_alloc_start(grid);
+                        T * source = sourcegrid.get_y();
+                        AuxType * aux = eq.aux ? device_alloc_start(eq.aux->get_grid(level)) : nullptr;
+                        const IndexInt nf = device_alloc_size(grid);
+                        const IndexInt naux = eq.aux ? device_alloc_size(eq.aux->get_grid(level)) : 0;
+                        const IndexInt foffset = device_alloc_offset(grid);
+                        const IndexInt auxoffset = eq.aux ? device_alloc_offset(eq.aux->get_grid(level)) : 0;
+
+#pragma omp target teams distribute parallel for map(tofrom : fstart[0 : nf])                                        \
+    map(to : aux[0 : naux], source[0 : NtotLocal], eq, stencil)
+                        for (IndexInt row = row_start; row < row_end; row++) {
+                            const IndexInt index_start = row * nrow;
+                            T * fy = fstart + foffset;
+
+                            // Cell-color of the first cell in the row as sum of global coordinates
+                            IndexInt rest = index_start;
+                            int color = xstart;
+                            for (int idim = NDIM - 1; idim >= 1; idim--) {
+                                color += int(rest % N);
+                                rest /= N;
+                            }
+                            color += int(rest);
+
+                            const int offset = ((curcolor - color) % ngridcolours + ngridcolours) % ngridcolours;
+                            for (IndexInt i = index_start + offset; i < index_start + nrow; i += ngridcolours) {
+                                auto LdL = eq.evaluate(fy, aux ? aux + auxoffset : nullptr, stencil, i);
+                                T l = LdL.first - (add_source ? source[i] : T(0));
+                                T dl = LdL.second;
+                                fy[i] -= l / dl;
+                            }
+                        }
+                        return;
+                    }
+                }
+#endif
 
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-                for (IndexInt i = 0; i < NtotLocal; i++) {
-#ifdef USE_MASK
-                    if (_bmask[level][i] <= 0.0)
-                        continue;
-#endif
+                for (IndexInt row = row_start; row < row_end; row++) {
+                    const IndexInt index_start = row * nrow;
 
-                    // Fetch the global coordinate or the current cell
-                    auto coord = grid.globalcoord_from_index(i);
-
-                    // Compute cell-color as sum of coordinates mod _ngridcolours
+                    // Compute cell-color of the first cell in the row as sum of global coordinates
+                    auto coord = grid.globalcoord_from_index(index_start);
                     int color = 0;
                     for (auto & c : coord)
                         color += c;
-                    color = color % _ngridcolours;
 
-                    // Only select cells with right color
-                    if (color == curcolor) {
+                    // The first cell in the row with the right color. After that every _ngridcolours'th cell
+                    const int offset = ((curcolor - color) % _ngridcolours + _ngridcolours) % _ngridcolours;
+                    for (IndexInt i = index_start + offset; i < index_start + nrow; i += _ngridcolours) {
+#ifdef USE_MASK
+                        if (_bmask[level][i] <= 0.0)
+                            continue;
+#endif
 
                         // Update the solution f = f - L / (dL/df)
-                        auto LdL = _Equation(this, level, i);
+                        auto LdL = Equation(this, level, i);
                         T l = LdL.first - (level > 0 ? _source[level][i] : T(0));
                         T dl = LdL.second;
                         f[i] -= l / dl;
@@ -975,7 +1485,8 @@ namespace FML {
             //================================================
 
             template <int NDIM, class T>
-            void MultiGridSolver<NDIM, T>::solve_current_level(int level) {
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::solve_current_level(EquationType & Equation, int level) {
                 if (_verbose)
                     std::cout << "    Performing Newton-Gauss-Seidel sweeps at level " << level << std::endl;
 
@@ -990,7 +1501,14 @@ namespace FML {
                 }
 
                 // Update boundaries
-                _f.get_grid(level).communicate_boundaries();
+                auto & grid = _f.get_grid(level);
+                communicate_boundaries(grid);
+
+                // The slices that are sent to the neighbor tasks. These are swept first so that the communication
+                // is in flight while we sweep the interior and only has to be done before the next color
+                const int NLocal = grid.get_NLocal();
+                const int nslices_left = std::min(NLocal, grid.get_n_extra_slices_right());
+                const int nslices_right = std::min(NLocal - nslices_left, grid.get_n_extra_slices_left());
 
                 // Do N Gauss-Seidel Sweeps
                 for (int i = 0; i < ngs_sweeps; i++) {
@@ -998,16 +1516,26 @@ namespace FML {
                     // Sweep through grid according to sum of coord's mod _ngridcolours
                     // Standard is _ngridcolours = 2 -> chess-board ordering
                     for (int j = 0; j < _ngridcolours; j++) {
-                        GaussSeidelSweep(level, j, _f[level]);
+                        // On the device we sweep all the slices in one kernel and then update the ghost slices
+                        if (_on_device) {
+                            GaussSeidelSweep(Equation, level, j, 0, NLocal, _f[level]);
+                            communicate_boundaries(grid);
+                            continue;
+                        }
+
+                        GaussSeidelSweep(Equation, level, j, 0, nslices_left, _f[level]);
+                        GaussSeidelSweep(Equation, level, j, NLocal - nslices_right, NLocal, _f[level]);
 
-                        // Update boundaries
-                        _f.get_grid(level).communicate_boundaries();
+                        // Update boundaries while sweeping the interior
+                        grid.communicate_boundaries_start();
+                        GaussSeidelSweep(Equation, level, j, nslices_left, NLocal - nslices_right, _f[level]);
+                        grid.communicate_boundaries_finish();
                     }
 
                     // The residual calculation requires comm so do it outside of the print below
                     double residual = 0.0;
                     if ((level > 0 and (i == 1 or i == ngs_sweeps - 1)) or (level == 0)) {
-                        residual = calculate_residual(level, _res.get_grid(level));
+                        residual = calculate_residual(Equation, level, _res.get_grid(level));
                     }
 
                     // Calculate residual and output quite often.
@@ -1025,22 +1553,25 @@ namespace FML {
 
                 // Store domaingrid residual
                 if (level == 0) {
-                    double curres = calculate_residual(level, _res.get_grid(level));
+                    double curres = calculate_residual(Equation, level, _res.get_grid(level));
                     _rms_res_old = _rms_res;
                     _rms_res = curres;
                 }
             }
 
             //================================================
-            // V-cycle go all the way up
+            // Go up one level: correct the solution at
+            // to_level with the coarse grid correction and
+            // solve on to_level
             //================================================
 
             template <int NDIM, class T>
-            void MultiGridSolver<NDIM, T>::recursive_go_up(int to_level) {
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::go_up_one_level(EquationType & Equation, int to_level) {
                 int from_level = to_level + 1;
 
                 // Restrict down R[f] and store in _res (used as temp-array)
-                _f.restrict_down(to_level, _res.get_grid(from_level));
+                restrict_down(_f, to_level, _res.get_grid(from_level));
 
                 // Make prolongation array ready at from_level
                 make_prolongation_array(_f.get_grid(from_level), _res.get_grid(from_level), _res.get_grid(from_level));
@@ -1052,20 +1583,13 @@ namespace FML {
                 prolonge_up_array(to_level, _res.get_grid(from_level), _res.get_grid(to_level));
 
                 // Correct solution at to_level (temp array _res contains the correction P[f-R[f]])
-                _f.get_grid(to_level) += _res.get_grid(to_level);
+                add_to_grid(_f.get_grid(to_level), _res.get_grid(to_level));
 
                 // Calculate new residual
-                calculate_residual(to_level, _res.get_grid(to_level));
+                calculate_residual(Equation, to_level, _res.get_grid(to_level));
 
                 // Solve on the level we just went up to
-                solve_current_level(to_level);
-
-                // Continue going up
-                if (to_level > 0)
-                    recursive_go_up(to_level - 1);
-                else {
-                    return;
-                }
+                solve_current_level(Equation, to_level);
             }
 
             //================================================
@@ -1087,13 +1611,32 @@ namespace FML {
                     N *= 2;
                     level++;
                 }
+
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (_on_device) {
+                        T * fy = f.get_y();
+                        T * Rfy = Rf.get_y();
+                        T * dfy = df.get_y();
+#pragma omp target teams distribute parallel for map(to : fy[0 : NtotLocal], Rfy[0 : NtotLocal])                      \
+    map(tofrom : dfy[0 : NtotLocal])
+                        for (IndexInt i = 0; i < NtotLocal; i++)
+                            dfy[i] = fy[i] - Rfy[i];
+                        return;
+                    }
+                }
+#endif
+
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
                 for (IndexInt i = 0; i < NtotLocal; i++) {
 #ifdef USE_MASK
-                    if (_bmask[level][i] <= 0.0)
+                    // The boundary is held fixed so there is no correction to prolonge up from it
+                    if (_bmask[level][i] <= 0.0) {
+                        df[i] = T(0.0);
                         continue;
+                    }
 #endif
                     df[i] = f[i] - Rf[i];
                 }
@@ -1104,9 +1647,37 @@ namespace FML {
             //================================================
 
             template <int NDIM, class T>
-            void MultiGridSolver<NDIM, T>::make_new_source(int level) {
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::make_new_source(EquationType & Equation, int level) {
                 IndexInt NtotLocal = get_NtotLocal(level);
 
+#ifdef USE_OMP_TARGET
+                if constexpr (is_stencil_equation_v<EquationType> and device_mappable_v<T>) {
+                    if (_on_device) {
+                        using AuxType = std::remove_pointer_t<decltype(Equation.aux->get_y(0))>;
+                        const auto eq = Equation;
+                        const auto stencil = get_stencil(level);
+                        auto & fgrid = _f.get_grid(level);
+                        T * f = device_alloc_start(fgrid);
+                        T * source = _source[level];
+                        T * res = _res[level];
+                        AuxType * aux = eq.aux ? device_alloc_start(eq.aux->get_grid(level)) : nullptr;
+                        const IndexInt nf = device_alloc_size(fgrid);
+                        const IndexInt naux = eq.aux ? device_alloc_size(eq.aux->get_grid(level)) : 0;
+                        const IndexInt foffset = device_alloc_offset(fgrid);
+                        const IndexInt auxoffset = eq.aux ? device_alloc_offset(eq.aux->get_grid(level)) : 0;
+
+#pragma omp target teams distribute parallel for map(to : f[0 : nf], aux[0 : naux], res[0 : NtotLocal])             \
+    map(to : eq, stencil) map(tofrom : source[0 : NtotLocal])
+                        for (IndexInt i = 0; i < NtotLocal; i++) {
+                            const AuxType * auxlevel = aux ? aux + auxoffset : nullptr;
+                            source[i] = res[i] + eq.evaluate(f + foffset, auxlevel, stencil, i).first;
+                        }
+                        return;
+                    }
+                }
+#endif
+
                 // Calculate the new source
 #ifdef USE_OMP
 #pragma omp parallel for
@@ -1116,48 +1687,478 @@ namespace FML {
                     if (_bmask[level][i] <= 0.0)
                         continue;
 #endif
-                    T res = _Equation(this, level, i).first;
+                    T res = Equation(this, level, i).first;
                     _source[level][i] = _res[level][i] + res;
                 }
             }
 
             //================================================
-            // V-cycle go all the way down
+            // Go down one level: restrict the residual and
+            // solution, make the new source and solve on
+            // the level below
             //================================================
 
             template <int NDIM, class T>
-            void MultiGridSolver<NDIM, T>::recursive_go_down(int from_level) {
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::go_down_one_level(EquationType & Equation, int from_level) {
                 int to_level = from_level + 1;
 
+                if (_verbose)
+                    std::cout << "    Going down from level " << from_level << " -> " << to_level << std::endl;
+
+                // Restrict residual and solution
+                restrict_down(_res, from_level, _res.get_grid(from_level + 1));
+                restrict_down(_f, from_level, _f.get_grid(from_level + 1));
+
+                // Update boundaries
+                communicate_boundaries(_f.get_grid(to_level));
+
+                // Make new source
+                make_new_source(Equation, to_level);
+
+                // Solve on current level
+                solve_current_level(Equation, to_level);
+            }
+
+            //================================================
+            // Do a multigrid cycle starting (and ending) at
+            // level. The V-cycle visits the coarser levels
+            // once, the W-cycle does two cycles on each coarser
+            // level and the F-cycle does an F-cycle followed
+            // by a V-cycle on the next level
+            //================================================
+
+            template <int NDIM, class T>
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::multigrid_cycle(EquationType & Equation,
+                                                           int level,
+                                                           const std::string & cycle_type) {
+                int to_level = level + 1;
+
+                // Go down one level
+                go_down_one_level(Equation, level);
+
                 // Check if we are at the bottom
-                if (to_level >= _Nlevel) {
+                if (to_level == _Nlevel - 1) {
                     if (_verbose) {
                         std::cout << "    - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -" << std::endl;
-                        std::cout << "    We have reached the bottom level = " << from_level << " Start going up."
+                        std::cout << "    We have reached the bottom level = " << to_level << " Start going up."
                                   << std::endl;
                         std::cout << "    - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -\n" << std::endl;
                     }
-                    return;
+                } else if (cycle_type == "W") {
+                    multigrid_cycle(Equation, to_level, "W");
+                    multigrid_cycle(Equation, to_level, "W");
+                } else if (cycle_type == "F") {
+                    multigrid_cycle(Equation, to_level, "F");
+                    multigrid_cycle(Equation, to_level, "V");
+                } else {
+                    multigrid_cycle(Equation, to_level, "V");
                 }
 
-                if (_verbose)
-                    std::cout << "    Going down from level " << from_level << " -> " << to_level << std::endl;
+                // Go up one level
+                go_up_one_level(Equation, level);
+            }
 
-                // Restrict residual and solution
-                _res.restrict_down(from_level, _res.get_grid(from_level + 1));
-                _f.restrict_down(from_level, _f.get_grid(from_level + 1));
+            //================================================
+            // Full multigrid: solve the equation on the
+            // coarsest grid and prolonge the solution up
+            // to the next level to use as the initial guess
+            // there. On each level we do one cycle before
+            // going up. This gives us a good initial guess
+            // on the domain grid
+            //================================================
 
-                // Update boundaries
-                _f.get_grid(to_level).communicate_boundaries();
+            template <int NDIM, class T>
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::full_multigrid(EquationType & Equation) {
+                if (_verbose) {
+                    std::cout << "===============================================================" << std::endl;
+                    std::cout << "==> Making initial guess using full multigrid                  " << std::endl;
+                    std::cout << "===============================================================\n" << std::endl;
+                }
 
-                // Make new source
-                make_new_source(to_level);
+                // Restrict down the initial guess to all levels
+                // (on the coarse levels its the boundary values for a masked grid)
+                for (int level = 0; level < _Nlevel - 1; level++)
+                    restrict_down(_f, level, _f.get_grid(level + 1));
 
-                // Solve on current level
-                solve_current_level(to_level);
+                for (int level = _Nlevel - 1; level > 0; level--) {
+
+                    // On the coarse levels we solve the equation itself, not the correction equation
+                    fill_grid(_source.get_grid(level), T(0));
+
+                    // Solve on the current level
+                    solve_current_level(Equation, level);
+                    if (level < _Nlevel - 1)
+                        multigrid_cycle(Equation, level, _cycle_type);
+
+                    // Prolonge up the solution to the next level as its initial guess
+                    if (_verbose)
+                        std::cout << "    Prolonge full solution from level: " << level << " -> " << level - 1
+                                  << std::endl;
+                    communicate_boundaries(_f.get_grid(level));
+                    prolonge_up_array(level - 1, _f.get_grid(level), _f.get_grid(level - 1));
+                }
+                communicate_boundaries(_f.get_grid(0));
+            }
+
+            //================================================
+            // Mixed precision: do the cycles with a float
+            // copy of the solver (same levels and settings)
+            // and copy the solution back. The float solver
+            // stops when a cycle no longer halves the
+            // residual (the float precision floor for a
+            // nonlinear equation is eps_float * |f| / h^2)
+            // and the rest of the cycles are done in double
+            //================================================
+
+            template <int NDIM, class T>
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::run_solver_single_precision(EquationType & Equation) {
+                using Tsingle = float;
+                if constexpr (std::is_same_v<T, double> and
+                              std::is_invocable_v<EquationType &, MultiGridSolver<NDIM, Tsingle> *, int, IndexInt>) {
+                    if (_verbose) {
+                        std::cout << "===============================================================" << std::endl;
+                        std::cout << "==> Doing the cycles in single precision                       " << std::endl;
+                        std::cout << "===============================================================\n" << std::endl;
+                    }
+
+                    auto & f = _f.get_grid(0);
+                    MultiGridSolver<NDIM, Tsingle> g(_N,
+                                                     _Nlevel,
+                                                     _verbose,
+                                                     _periodic,
+                                                     f.get_n_extra_slices_left(),
+                                                     f.get_n_extra_slices_right());
+                    g._ngs_fine = _ngs_fine;
+                    g._ngs_coarse = _ngs_coarse;
+                    g._ngs_first_step = _ngs_first_step;
+                    g._maxsteps = _maxsteps;
+                    g._cycle_type = _cycle_type;
+                    g._use_fmg = _use_fmg;
+                    g._fft_linear_operator = _fft_linear_operator;
+                    g._fft_kmax = _fft_kmax;
+                    g._offload = _offload;
+#ifdef USE_MASK
+                    g._bmask = _bmask;
+#endif
+
+                    // Copy over the initial guess
+                    auto & fsingle = g.get_grid(0);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (IndexInt i = 0; i < _NtotLocal; i++)
+                        fsingle[i] = Tsingle(f[i]);
+
+                    // Stop when the users criterion is met or when the residual stalls
+                    double rms_res_old = 0.0;
+                    MultiGridConvCrit ConvergenceCriterion = [&](double rms_residual,
+                                                                 double rms_residual_ini,
+                                                                 int step_number) {
+                        bool stalled = step_number > 0 and rms_residual > 0.5 * rms_res_old;
+                        rms_res_old = rms_residual;
+                        return stalled or _ConvergenceCriterion(rms_residual, rms_residual_ini, step_number);
+                    };
+                    g.solve(Equation, ConvergenceCriterion);
+
+                    // Copy back the solution
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (IndexInt i = 0; i < _NtotLocal; i++)
+                        f[i] = T(fsingle[i]);
+
+                    // The float solver used the first-step sweeps so we don't need them again
+                    _rms_res = g._rms_res;
+                    _rms_res_i = g._rms_res_i;
+                    _istep_vcycle = g._istep_vcycle;
+                } else {
+                    assert_mpi(false,
+                               "[MultiGridSolver::run_solver_single_precision] Mixed precision requires T = double and "
+                               "an equation that can be called with a MultiGridSolver<NDIM, float> *\n");
+                }
+            }
+
+            //================================================
+            // FFT correction: solve J e = -L(f) for the
+            // modes with |k| < _fft_kmax where J is the
+            // user provided symbol of the linearized
+            // equation, add e to the solution and smooth
+            // on the domain grid (which also updates the
+            // residual). For a linear equation this is a
+            // direct solve of these modes
+            //================================================
+
+            template <int NDIM, class T>
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::fft_correction(EquationType & Equation) {
+                if constexpr (std::is_floating_point_v<T>) {
+                    if (_verbose)
+                        std::cout << "    Correcting modes with k < " << _fft_kmax << " using FFT" << std::endl;
+
+                    // The residual -L(f) on the domain grid is in _res after solving on the domain grid
+                    update_host(_res.get_grid(0));
+                    update_host(_f.get_grid(0));
+                    FML::GRID::FFTWGrid<NDIM> grid;
+                    ConvertToFFTWGrid(_res.get_grid(0), grid);
+                    grid.fftw_r2c();
+
+                    // e(k) = -L(k) / J(k2) with k2 the eigenvalue of -D^2 on the grid so that D^2 is inverted
+                    // exactly. Modes with J = 0 (e.g. the DC mode for D^2) are left alone
+                    const double kmax2 = _fft_kmax * _fft_kmax;
+                    const auto Local_nx = grid.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        double kmag2;
+                        std::array<double, NDIM> kvec;
+                        for (auto && fourier_index : grid.get_fourier_range(islice, islice + 1)) {
+                            grid.get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
+                            double k2 = 0.0;
+                            for (int idim = 0; idim < NDIM; idim++) {
+                                const double k = 2.0 * _N / _boxsize * std::sin(kvec[idim] / (2.0 * _N));
+                                k2 += k * k;
+                            }
+                            const double J = kmag2 < kmax2 ? _fft_linear_operator(k2) : 0.0;
+                            auto value = grid.get_fourier_from_index(fourier_index);
+                            grid.set_fourier_from_index(fourier_index,
+                                                        J != 0.0 ? value / FML::GRID::FloatType(J) : decltype(value)(0));
+                        }
+                    }
+                    grid.fftw_c2r();
+
+                    // Add the correction to the solution
+                    auto & f = _f.get_grid(0);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        for (auto && real_index : grid.get_real_range(islice, islice + 1)) {
+                            auto coord = grid.get_coord_from_index(real_index);
+                            f[f.index_from_coord(coord)] += T(grid.get_real_from_index(real_index));
+                        }
+                    }
+                    update_device(f);
+
+                    // Smooth out the high frequency errors the correction might have introduced
+                    solve_current_level(Equation, 0);
+                } else {
+                    assert_mpi(false, "[MultiGridSolver::fft_correction] Requires a real solution type T\n");
+                }
+            }
+
+            //================================================
+            // Offload: while solving a stencil equation the
+            // levels of _f, _res and _source (and the aux
+            // field of the equation) are kept in device
+            // memory. Only the ghost slices are copied to
+            // and from the host for the MPI communication,
+            // the rest of the transfers are for the coarse
+            // levels that are agglomerated on fewer tasks
+            // and for the FFT correction. Without a device
+            // this runs on the host
+            //================================================
+
+            template <int NDIM, class T>
+            template <class EquationType>
+            void MultiGridSolver<NDIM, T>::device_enter([[maybe_unused]] EquationType & Equation) {
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    for (int level = 0; level < _Nlevel; level++) {
+                        for (auto * multigrid : {&_f, &_res, &_source}) {
+                            T * y = device_alloc_start(multigrid->get_grid(level));
+                            const IndexInt n = device_alloc_size(multigrid->get_grid(level));
+#pragma omp target enter data map(to : y[0 : n])
+                        }
+                        if (Equation.aux) {
+                            auto & auxgrid = Equation.aux->get_grid(level);
+                            char * y = reinterpret_cast<char *>(device_alloc_start(auxgrid));
+                            const size_t bytes = device_alloc_size(auxgrid) * sizeof(*auxgrid.get_y());
+#pragma omp target enter data map(to : y[0 : bytes])
+                            _device_aux.push_back({y, bytes});
+                        }
+                    }
+                    _on_device = true;
+                }
+#endif
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::device_exit() {
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (not _on_device)
+                        return;
+                    for (int level = 0; level < _Nlevel; level++) {
+                        T * f = device_alloc_start(_f.get_grid(level));
+                        const IndexInt nf = device_alloc_size(_f.get_grid(level));
+#pragma omp target exit data map(from : f[0 : nf])
+                        for (auto * multigrid : {&_res, &_source}) {
+                            T * y = device_alloc_start(multigrid->get_grid(level));
+                            const IndexInt n = device_alloc_size(multigrid->get_grid(level));
+#pragma omp target exit data map(release : y[0 : n])
+                        }
+                    }
+                    for (auto & aux : _device_aux) {
+                        char * y = aux.first;
+                        const size_t bytes = aux.second;
+#pragma omp target exit data map(release : y[0 : bytes])
+                    }
+                    _device_aux.clear();
+                    _on_device = false;
+                }
+#endif
+            }
 
-                // Recursive call
-                recursive_go_down(to_level);
+            // Copy the whole grid (with the extra slices) from the device to the host or the other way
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::update_host([[maybe_unused]] MPIGrid<NDIM, T> & grid) {
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (not _on_device)
+                        return;
+                    T * y = device_alloc_start(grid);
+                    const IndexInt n = device_alloc_size(grid);
+#pragma omp target update from(y[0 : n])
+                }
+#endif
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::update_device([[maybe_unused]] MPIGrid<NDIM, T> & grid) {
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (not _on_device)
+                        return;
+                    T * y = device_alloc_start(grid);
+                    const IndexInt n = device_alloc_size(grid);
+#pragma omp target update to(y[0 : n])
+                }
+#endif
+            }
+
+            // Update the extra slices. On the device we copy the slices we send to the host, communicate,
+            // and copy the received slices back
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::communicate_boundaries(MPIGrid<NDIM, T> & grid) {
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (_on_device) {
+                        // With one task and a periodic box the neighbors are found by wrapping around instead
+                        if (FML::NTasks == 1 and _periodic)
+                            return;
+                        const IndexInt nperslice = FML::power(grid.get_N(), NDIM - 1);
+                        const IndexInt nleft = grid.get_n_extra_slices_left() * nperslice;
+                        const IndexInt nright = grid.get_n_extra_slices_right() * nperslice;
+                        const IndexInt NtotLocal = grid.get_NtotLocal();
+                        const IndexInt nsend_left = std::min(nright, NtotLocal);
+                        const IndexInt nsend_right = std::min(nleft, NtotLocal);
+                        T * y = device_alloc_start(grid);
+                        T * send_left = y + nleft;
+                        T * send_right = y + nleft + NtotLocal - nsend_right;
+                        T * recv_left = y;
+                        T * recv_right = y + nleft + NtotLocal;
+#pragma omp target update from(send_left[0 : nsend_left], send_right[0 : nsend_right])
+                        grid.communicate_boundaries();
+#pragma omp target update to(recv_left[0 : nleft], recv_right[0 : nright])
+                        return;
+                    }
+                }
+#endif
+                grid.communicate_boundaries();
+            }
+
+            // Restrict down from_level of multigrid to to_grid. If the level below is agglomerated on fewer tasks
+            // this is done on the host as it needs communication (these levels are tiny)
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::restrict_down(MPIMultiGrid<NDIM, T> & multigrid,
+                                                         int from_level,
+                                                         MPIGrid<NDIM, T> & to_grid) {
+                auto & TopGrid = multigrid.get_grid(from_level);
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (_on_device and TopGrid.get_task_stride() == to_grid.get_task_stride()) {
+                        // Gather the 2^NDIM top cells of each bottom cell in the same order as MPIMultiGrid
+                        constexpr int nchildren = FML::power(2, NDIM - 1);
+                        const IndexInt NBottom = to_grid.get_N();
+                        const IndexInt NTop = TopGrid.get_N();
+                        const IndexInt nperslice_top = FML::power(NTop, NDIM - 1);
+                        const IndexInt NtotLocalTop = TopGrid.get_NtotLocal();
+                        const IndexInt NtotLocalBottom = to_grid.get_NtotLocal();
+                        const T oneovernumcells = T(1.0 / double(FML::power(2, NDIM)));
+                        const T * top = TopGrid.get_y();
+                        T * bottom = to_grid.get_y();
+#pragma omp target teams distribute parallel for map(to : top[0 : NtotLocalTop])                                   \
+    map(tofrom : bottom[0 : NtotLocalBottom])
+                        for (IndexInt i = 0; i < NtotLocalBottom; i++) {
+                            // Index of the first child (both levels start at the same x as the strides are equal)
+                            IndexInt rest = i;
+                            IndexInt itop = 0;
+                            IndexInt npow = 1;
+                            for (int idim = NDIM - 1; idim >= 0; idim--, npow *= NTop) {
+                                itop += 2 * (rest % NBottom) * npow;
+                                rest /= NBottom;
+                            }
+                            T value = T(0.0);
+                            for (int dx = 0; dx < 2; dx++) {
+                                T sum = T(0.0);
+                                for (int k = 0; k < nchildren; k++) {
+                                    IndexInt offset = 0;
+                                    IndexInt kpow = 1;
+                                    for (int idim = NDIM - 1; idim >= 1; idim--, kpow *= NTop)
+                                        offset += ((k >> (NDIM - 1 - idim)) & 1) * kpow;
+                                    sum += top[itop + dx * nperslice_top + offset];
+                                }
+                                value += sum * oneovernumcells;
+                            }
+                            bottom[i] = value;
+                        }
+                        return;
+                    }
+                }
+#endif
+                update_host(TopGrid);
+                multigrid.restrict_down(from_level, to_grid);
+                update_device(to_grid);
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::add_to_grid(MPIGrid<NDIM, T> & grid, MPIGrid<NDIM, T> & rhs) {
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (_on_device) {
+                        const IndexInt NtotLocal = grid.get_NtotLocal();
+                        T * y = grid.get_y();
+                        const T * x = rhs.get_y();
+#pragma omp target teams distribute parallel for map(tofrom : y[0 : NtotLocal]) map(to : x[0 : NtotLocal])
+                        for (IndexInt i = 0; i < NtotLocal; i++)
+                            y[i] += x[i];
+                        return;
+                    }
+                }
+#endif
+                grid += rhs;
+            }
+
+            template <int NDIM, class T>
+            void MultiGridSolver<NDIM, T>::fill_grid(MPIGrid<NDIM, T> & grid, T value) {
+                const IndexInt NtotLocal = grid.get_NtotLocal();
+                T * y = grid.get_y();
+#ifdef USE_OMP_TARGET
+                if constexpr (device_mappable_v<T>) {
+                    if (_on_device) {
+#pragma omp target teams distribute parallel for map(tofrom : y[0 : NtotLocal])
+                        for (IndexInt i = 0; i < NtotLocal; i++)
+                            y[i] = value;
+                        return;
+                    }
+                }
+#endif
+                std::fill(y, y + NtotLocal, value);
             }
 
             template <int NDIM, class T>
@@ -1185,7 +2186,7 @@ namespace FML {
                                                       const std::array<IndexInt, 2 * NDIM + 1> & index_list) {
                 T f = _f[level][index_list[0]];
                 T laplacian{0.0};
-                const double h = 1.0 / double(get_N(level));
+                const double h = get_Gridspacing(level);
                 for (int idim = 0; idim < NDIM; idim++) {
                     laplacian += (_f[level][index_list[2 * idim + 1]] + _f[level][index_list[2 * idim + 2]] - f - f);
                 }
@@ -1195,14 +2196,15 @@ namespace FML {
             // The "B-Laplacian": D[ b D f ]
             // Assumed: index_list is the same as produced by get_neighbor_gridindex
             template <int NDIM, class T>
+            template <class BFunction>
             T MultiGridSolver<NDIM, T>::get_BLaplacian(int level,
                                                        const std::array<IndexInt, 2 * NDIM + 1> & index_list,
-                                                       std::function<T(int, IndexInt)> & b) {
+                                                       BFunction && b) {
 
                 T f = _f[level][index_list[0]];
                 T result{0.0};
                 T bcenter = b(level, index_list[0]);
-                const double h = 1.0 / double(get_N(level));
+                const double h = get_Gridspacing(level);
                 for (int idim = 0; idim < NDIM; idim++) {
                     T fminus = _f[level][index_list[2 * idim + 1]];
                     T fplus = _f[level][index_list[2 * idim + 2]];
@@ -1216,16 +2218,17 @@ namespace FML {
             // Derivative of the "B-Laplacian" D[ b D f ]
             // Assumed: index_list is the same as produced by get_neighbor_gridindex
             template <int NDIM, class T>
+            template <class BFunction, class dBFunction>
             T MultiGridSolver<NDIM, T>::get_derivBLaplacian(int level,
                                                             const std::array<IndexInt, 2 * NDIM + 1> & index_list,
-                                                            std::function<T(int, IndexInt)> & b,
-                                                            std::function<T(int, IndexInt)> & db) {
+                                                            BFunction && b,
+                                                            dBFunction && db) {
 
                 T f = _f[level][index_list[0]];
                 T result{0.0};
                 T bcenter = b(level, index_list[0]);
                 T dbcenter = db(level, index_list[0]);
-                const double h = 1.0 / double(get_N(level));
+                const double h = get_Gridspacing(level);
                 for (int idim = 0; idim < NDIM; idim++) {
                     T fminus = _f[level][index_list[2 * idim + 1]];
                     T fplus = _f[level][index_list[2 * idim + 2]];
@@ -1242,7 +2245,7 @@ namespace FML {
             T MultiGridSolver<NDIM, T>::get_derivLaplacian(
                 int level,
                 [[maybe_unused]] const std::array<IndexInt, 2 * NDIM + 1> & index_list) {
-                const double h = 1.0 / double(get_N(level));
+                const double h = get_Gridspacing(level);
                 return -2.0 * NDIM / (h * h);
             }
 
@@ -1252,7 +2255,7 @@ namespace FML {
             inline std::array<T, NDIM>
             MultiGridSolver<NDIM, T>::get_Gradient(int level, const std::array<IndexInt, 2 * NDIM + 1> & index_list) {
                 std::array<T, NDIM> gradient;
-                const double h = 1.0 / double(get_N(level));
+                const double h = get_Gridspacing(level);
                 for (int idim = 0; idim < NDIM; idim++) {
                     gradient[idim] =
                         (_f[level][index_list[2 * idim + 2]] - _f[level][index_list[2 * idim + 1]]) / (2 * h);
@@ -1280,13 +2283,26 @@ namespace FML {
             // Gridspacing in direction idim at a given level
             template <int NDIM, class T>
             inline double MultiGridSolver<NDIM, T>::get_Gridspacing(int level) {
-                return 1.0 / double(get_N(level));
+                return _boxsize / double(get_N(level));
+            }
+
+            template <int NDIM, class T>
+            inline MultiGridStencil MultiGridSolver<NDIM, T>::get_stencil(int level) {
+                MultiGridStencil stencil;
+                stencil.N = get_N(level);
+                stencil.h = get_Gridspacing(level);
+                stencil.periodic = _periodic;
+                stencil.periodic_x = _periodic and FML::NTasks == 1;
+                return stencil;
             }
 
             // (Global) position of a cell in the box
             template <int NDIM, class T>
             inline std::array<double, NDIM> MultiGridSolver<NDIM, T>::get_Coordinate(int level, IndexInt index) {
-                return _f.get_grid(level).get_pos(index);
+                auto pos = _f.get_grid(level).get_pos(index);
+                for (int idim = 0; idim < NDIM; idim++)
+                    pos[idim] = _origin[idim] + _boxsize * pos[idim];
+                return pos;
             }
         } // namespace MULTIGRIDSOLVER
     }     // namespace SOLVERS
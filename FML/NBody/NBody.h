@@ -11,11 +11,15 @@
 
 #include <FML/FFTWGrid/FFTWGrid.h>
 #include <FML/Global/Global.h>
+#include <FML/Interpolation/ParticleGridInterpolation.h>
 #include <FML/MPIParticles/MPIParticles.h>
+#include <FML/MPIParticles/MPIParticlesSoA.h>
 #include <FML/ODESolver/ODESolver.h>
 #include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+#include <FML/ParticlesInBoxes/ParticlesInBoxes.h>
 #include <FML/RandomFields/GaussianRandomField.h>
 #include <FML/RandomFields/NonLocalGaussianRandomField.h>
+#include <FML/Smoothing/SmoothingFourier.h>
 #include <FML/Timing/Timings.h>
 
 namespace FML {
@@ -36,6 +40,28 @@ namespace FML {
         template <int N, class T>
         void DriftParticles(T * p, size_t NumPart, double delta_time, bool periodic_box = true);
 
+        template <int N, class PosType, class VelType>
+        double drift_block(PosType * pos,
+                           size_t pos_stride,
+                           const VelType * vel,
+                           size_t vel_stride,
+                           size_t NumPart,
+                           double delta_time,
+                           bool periodic_box);
+
+        template <int N, class VelType, class ForceType>
+        double kick_block(VelType * vel,
+                          size_t vel_stride,
+                          const std::array<const ForceType *, N> & force,
+                          size_t NumPart,
+                          double delta_time);
+
+        template <int N, class T>
+        void DriftParticles(FML::PARTICLE::MPIParticles<T> & part,
+                            double delta_time,
+                            FML::INTERPOLATION::ParticleInterpolationStencils<N> & stencils,
+                            bool periodic_box = true);
+
         template <int N, class T>
         void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
                            MPIParticles<T> & part,
@@ -49,6 +75,63 @@ namespace FML {
                            double delta_time,
                            std::string interpolation_method);
 
+        template <int N, class T>
+        void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
+                           MPIParticles<T> & part,
+                           double delta_time,
+                           std::string interpolation_method,
+                           FML::INTERPOLATION::ParticleInterpolationStencils<N> & stencils);
+
+        template <int N, class T>
+        void kick_particles(std::array<FFTWGrid<N>, N> & force_grid,
+                            T * p,
+                            size_t NumPart,
+                            double delta_time,
+                            std::string interpolation_method,
+                            FML::INTERPOLATION::ParticleInterpolationStencils<N> * stencils);
+
+        template <int N, bool WITH_MASS, class PosType>
+        void DriftParticles(FML::PARTICLE::MPIParticlesSoA<N, WITH_MASS, PosType> & part,
+                            double delta_time,
+                            bool periodic_box = true);
+
+        template <int N, bool WITH_MASS, class PosType>
+        void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
+                           FML::PARTICLE::MPIParticlesSoA<N, WITH_MASS, PosType> & part,
+                           double delta_time,
+                           std::string interpolation_method);
+
+        template <int N, class T>
+        void KickParticlesShortRange(MPIParticles<T> & part,
+                                     int Nmesh,
+                                     double delta_time,
+                                     double norm_poisson_equation);
+
+        template <int N, class T>
+        void compute_short_range_force(const T * p,
+                                       size_t NumPart,
+                                       size_t NumPartTotal,
+                                       int Nmesh,
+                                       double norm_poisson_equation,
+                                       std::array<std::vector<FML::GRID::FloatType>, N> & force,
+                                       const std::vector<char> * active = nullptr);
+
+        template <int N, class T>
+        void KickParticlesZoom(const FFTWGrid<N> & density_grid_fourier,
+                               MPIParticles<T> & part,
+                               double delta_time,
+                               std::string density_assignment_method,
+                               double norm_poisson_equation);
+
+        template <int N, class T>
+        void KickDriftKickHierarchicalNBodyStep(int Nmesh,
+                                                MPIParticles<T> & part,
+                                                double delta_time,
+                                                std::string density_assignment_method,
+                                                double norm_poisson_equation,
+                                                int max_level,
+                                                double eta = 0.025);
+
         template <int N>
         void compute_force_from_density_real(const FFTWGrid<N> & density_grid_real,
                                              std::array<FFTWGrid<N>, N> & force_real,
@@ -59,7 +142,8 @@ namespace FML {
         void compute_force_from_density_fourier(const FFTWGrid<N> & density_grid_fourier,
                                                 std::array<FFTWGrid<N>, N> & force_real,
                                                 std::string density_assignment_method_used,
-                                                double norm_poisson_equation);
+                                                double norm_poisson_equation,
+                                                const std::function<double(double)> & filter_of_kmag2 = {});
         
         /// Enum listing options we have for what fourier space kernel to use for 1/D^2
         enum GreensFunctionLaplaceOperatorKernels {
@@ -88,9 +172,35 @@ namespace FML {
         int FIDUCIAL_GRADIENT_KERNEL = GradientKernels::CONTINUOUS_GRADIENT;
         /// The choice of deconvolving the density assignement and interpolation when computing the force is set by this global.
         bool FIDUCIAL_DECONVOLVE_FORCE = false;
-        
+        /// The scale r_s (in units of the PM grid cell) that splits the force in a long range part (the PM force is
+        /// multiplied by exp(-k^2 r_s^2)) and a short range part we compute by direct summation (P3M). 0 means pure PM.
+        double FIDUCIAL_SHORT_RANGE_FORCE_SPLIT = 0.0;
+        /// The distance (in units of r_s) beyond which we ignore the short range force.
+        double FIDUCIAL_SHORT_RANGE_FORCE_CUTOFF = 4.5;
+        /// The zoom region [corner, corner + size)^N (in units of the box) where the short range part of the force
+        /// is computed on a second finer PM grid (see set_fiducial_zoom_region and KickParticlesZoom). No corner
+        /// means no zoom.
+        std::vector<double> FIDUCIAL_ZOOM_REGION_CORNER{};
+        double FIDUCIAL_ZOOM_REGION_SIZE = 0.0;
+        /// The gridsize of the zoom grid (it covers the zoom region plus the cutoff on each side)
+        int FIDUCIAL_ZOOM_NMESH = 0;
+        /// The scale r_s (in units of the global PM grid cell) splitting the global and the zoom force and the
+        /// distance (in units of r_s) beyond which the zoom force is ignored
+        double FIDUCIAL_ZOOM_FORCE_SPLIT = 1.25;
+        double FIDUCIAL_ZOOM_FORCE_CUTOFF = 4.5;
+        /// The number of particles per block in drift_block and kick_block (the unit of work for the threads; the
+        /// inner loops over one block are vectorized)
+        constexpr size_t drift_kick_block_size = 1024;
+
         double gradient_kernel_fourier(double k_j, int Nmesh, int KERNEL);
         void set_fiducial_gradient_kernel(std::string kernel);
+        void set_fiducial_short_range_force(double split_in_cells, double cutoff_over_split = 4.5);
+        void set_fiducial_zoom_region(std::vector<double> corner,
+                                      double size,
+                                      int Nmesh_zoom,
+                                      double split_in_cells = 1.25,
+                                      double cutoff_over_split = 4.5);
+        double short_range_force_factor(double r_over_split, int ndim);
 
         template <int NDIM>
         double greens_function_laplace_operator_fourier(double kmag2, std::array<double, NDIM> & kvec, int Nmesh, int KERNEL);
@@ -119,7 +229,8 @@ namespace FML {
         /// v\Delta t\f$ gives rise to a shift in [0,1). For cosmological N-body norm_poisson_equation depends on a and
         /// it should be set at the correct time. If one does simple sims with fixed time-step then the last kick of the
         /// previous step can be combined with the first kick of the current step to save one force evaluation per step
-        /// (so basically two times as fast).
+        /// (so basically two times as fast). If FIDUCIAL_SHORT_RANGE_FORCE_SPLIT is set (see
+        /// set_fiducial_short_range_force) we also add the short range (P3M) part of the force.
         ///
         /// @tparam N The dimension of the grid.
         /// @tparam T The particle class.
@@ -154,11 +265,12 @@ namespace FML {
 
             // Density field -> force
             std::array<FFTWGrid<N>, N> force_real;
-            compute_force_from_density_real(
+            compute_force_from_density_real<N>(
                 density_grid_real, force_real, density_assignment_method, norm_poisson_equation);
 
             // Update velocity of particles
-            KickParticles(force_real, part, delta_time * 0.5, density_assignment_method);
+            KickParticles<N, T>(force_real, part, delta_time * 0.5, density_assignment_method);
+            KickParticlesShortRange<N, T>(part, Nmesh, delta_time * 0.5, norm_poisson_equation);
 
             // Move particles (this does communication)
             DriftParticles<N, T>(part, delta_time, periodic_box);
@@ -171,11 +283,12 @@ namespace FML {
                                                         density_assignment_method);
 
             // Density field -> force
-            compute_force_from_density_real(
+            compute_force_from_density_real<N>(
                 density_grid_real, force_real, density_assignment_method, norm_poisson_equation);
 
             // Update velocity of particles
-            KickParticles(force_real, part, delta_time * 0.5, density_assignment_method);
+            KickParticles<N, T>(force_real, part, delta_time * 0.5, density_assignment_method);
+            KickParticlesShortRange<N, T>(part, Nmesh, delta_time * 0.5, norm_poisson_equation);
         }
 
         //===================================================================================
@@ -233,10 +346,12 @@ namespace FML {
                                                             density_assignment_method);
                 // Density field -> force
                 std::array<FFTWGrid<N>, N> force_real;
-                compute_force_from_density_real(density_grid_real, force_real, density_assignment_method, norm_poisson);
+                compute_force_from_density_real<N>(
+                    density_grid_real, force_real, density_assignment_method, norm_poisson);
 
                 // Update velocity of particles
-                KickParticles(force_real, part, delta_time_vel, density_assignment_method);
+                KickParticles<N, T>(force_real, part, delta_time_vel, density_assignment_method);
+                KickParticlesShortRange<N, T>(part, Nmesh, delta_time_vel, norm_poisson);
             };
 
             // The norm_poisson_equation in a cosmo sim depends on [aexp] so this should be changed
@@ -272,9 +387,13 @@ namespace FML {
             FFTWGrid<N> density_grid_fourier = density_grid_real;
             density_grid_fourier.add_memory_label("FFTWGrid::compute_force_from_density_real::density_grid_fourier");
             density_grid_fourier.set_grid_status_real(true);
+            // We only do pointwise operations in k-space so we can skip the transpose back (and forth)
+            density_grid_fourier.set_fourier_layout_transposed(true);
             density_grid_fourier.fftw_r2c();
-            compute_force_from_density_fourier(
+            compute_force_from_density_fourier<N>(
                 density_grid_fourier, force_real, density_assignment_method_used, norm_poisson_equation);
+            for (auto & g : force_real)
+                g.set_fourier_layout_transposed(false);
         }
 
         //===================================================================================
@@ -283,6 +402,8 @@ namespace FML {
         /// Different choices for what kernel to use for \f$ \nabla / \nabla^2\f$ are availiable and set by the globals
         /// FIDUCIAL_LAPLACE_KERNEL and FIDUCIAL_GRADIENT_KERNEL. Fiducial choice is the continuous greens function \f$ D^2 =-k^2\f$, and gradient \f$ D = i\vec{k}\f$.
         /// We can also choose to deconvole the density assignment and force interpolation (ala Gadget). This is set by the global FIDUCIAL_DECONVOLVE_FORCE.
+        /// If FIDUCIAL_SHORT_RANGE_FORCE_SPLIT > 0 we only compute the long range part of the force (the rest is
+        /// added by KickParticlesShortRange).
         ///
         /// @tparam N The dimension of the grid
         ///
@@ -290,13 +411,16 @@ namespace FML {
         /// @param[out] force_real The force in real space.
         /// @param[in] density_assignment_method_used The density assignement we used to compute the density field.
         /// @param[in] norm_poisson_equation The prefactor (norm) to the Poisson equation.
+        /// @param[in] filter_of_kmag2 Optional filter W(k^2) (k in units of 1/Box) applied to the density in the same
+        /// loop (e.g. the PGD high-/low-pass filter) so the density grid can be used as is.
         ///
         //===================================================================================
         template <int N>
         void compute_force_from_density_fourier(const FFTWGrid<N> & density_grid_fourier,
                                                 std::array<FFTWGrid<N>, N> & force_real,
                                                 std::string density_assignment_method_used,
-                                                double norm_poisson_equation) {
+                                                double norm_poisson_equation,
+                                                const std::function<double(double)> & filter_of_kmag2) {
 
             const int LAPLACE_KERNEL = FIDUCIAL_LAPLACE_KERNEL;
             const int GRADIENT_KERNEL = FIDUCIAL_GRADIENT_KERNEL;
@@ -309,20 +433,15 @@ namespace FML {
             // We set this to false as standard
             // If we do so we need the window function for the density assignment
             const bool DECONVOLVE = FIDUCIAL_DECONVOLVE_FORCE;
-            const int order = FML::INTERPOLATION::interpolation_order_from_name(density_assignment_method_used);
-            const double knyquist = M_PI * Nmesh;
-            [[maybe_unused]] auto window_function = [&](std::array<double, N> & kvec) -> double {
-                double w = 1.0;
-                for (int idim = 0; idim < N; idim++) {
-                    const double koverkny = M_PI / 2. * (kvec[idim] / knyquist);
-                    w *= koverkny == 0.0 ? 1.0 : std::sin(koverkny) / (koverkny);
-                }
-                // res = pow(w,p);
-                double res = 1;
-                for (int i = 0; i < order; i++)
-                    res *= w;
-                return res;
-            };
+            // The window function is separable so we only need it for the integer wave-numbers in 1D
+            const auto window_table =
+                FML::INTERPOLATION::get_window_function_table(density_assignment_method_used, Nmesh);
+
+            // If we add a short range force we only want the long range part exp(-k^2 r_s^2) here
+            const double split = FIDUCIAL_SHORT_RANGE_FORCE_SPLIT / double(Nmesh);
+            const double split2 = split * split;
+
+            const bool use_filter = bool(filter_of_kmag2);
 
             // Make the force-kernel (D/i)_j = k_j for the continuous case)
             std::vector<double> gradient_kernel(2*(Nmesh/2+1), 0.0);
@@ -331,64 +450,87 @@ namespace FML {
                 gradient_kernel[Nmesh/2 + i] = gradient_kernel_fourier(k_j, Nmesh, GRADIENT_KERNEL);
             }
 
-            // Allocate grid (just copy it over)
+            // Allocate the force grids unless we are given grids of the right shape from a previous call
+            // (e.g. a workspace kept between timesteps) in which case we just reuse them
+            const auto nleft = density_grid_fourier.get_n_extra_slices_left();
+            const auto nright = density_grid_fourier.get_n_extra_slices_right();
             for (int idim = 0; idim < N; idim++) {
-                force_real[idim] = density_grid_fourier;
-                force_real[idim].add_memory_label("FFTWGrid::compute_force_from_density_fourier::force_real_" +
-                                                  std::to_string(idim));
-                force_real[idim].set_grid_status_real(idim == 0);
+                auto & grid = force_real[idim];
+                if (grid.get_nmesh() != Nmesh or grid.get_n_extra_slices_left() != nleft or
+                    grid.get_n_extra_slices_right() != nright) {
+                    grid = FFTWGrid<N>(Nmesh, nleft, nright);
+                    grid.add_memory_label("FFTWGrid::compute_force_from_density_fourier::force_real_" +
+                                          std::to_string(idim));
+                }
+                grid.set_grid_status_real(false);
+                grid.set_fourier_layout_transposed(density_grid_fourier.get_fourier_layout_transposed());
             }
 
-            // Loop over all local fourier grid cells
+            // Loop over all local fourier grid cells row by row. The inner loop over the last dimension is over
+            // contiguous memory
+            const auto kz = force_real[0].get_fourier_row_wavenumbers();
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
             for (int islice = 0; islice < Local_nx; islice++) {
-                std::array<double, N> kvec;
-                std::complex<FML::GRID::FloatType> I(0, 1);
-                for (auto && fourier_index : force_real[0].get_fourier_range(islice, islice + 1)) {
-                    if (Local_x_start == 0 and fourier_index == 0) {
-                        for (int idim = 0; idim < N; idim++)
-                            force_real[idim].set_fourier_from_index(0, 0.0);
-                        continue; // DC mode (k=0)
-                    }
+                const auto * delta_fourier = density_grid_fourier.get_fourier_grid();
+                std::array<std::complex<FML::GRID::FloatType> *, N> force_fourier;
+                for (int idim = 0; idim < N; idim++)
+                    force_fourier[idim] = force_real[idim].get_fourier_grid();
+
+                for (auto && row : force_real[0].get_fourier_row_range(islice, islice + 1)) {
+                    std::array<double, N> kvec = row.kvec;
+                    std::array<double, N> gradient_row;
+                    for (int idim = 0; idim < N - 1; idim++)
+                        gradient_row[idim] = gradient_kernel[Nmesh / 2 + row.kint[idim]] * norm_poisson_equation;
+                    double window_row = 1.0;
+                    for (int idim = 0; idim < N - 1; idim++)
+                        window_row *= window_table[Nmesh / 2 + row.kint[idim]];
+
+                    for (int iz = 0; iz < row.n; iz++) {
+                        const auto fourier_index = row.index + iz;
+                        kvec[N - 1] = kz[iz];
+                        const double kmag2 = row.kmag2 + kz[iz] * kz[iz];
+                        auto value = delta_fourier[fourier_index];
+
+                        // Apply kernel 1/D^2 (the DC mode is set to zero below)
+                        if (LAPLACE_KERNEL == CONTINUOUS_GREENS_FUNCTION) {
+                            value *= kmag2 > 0.0 ? -1.0 / kmag2 : 0.0;
+                        } else {
+                            value *= greens_function_laplace_operator_fourier<N>(kmag2, kvec, Nmesh, LAPLACE_KERNEL);
+                        }
 
-                    // Fetch value, k_vec_integer, k_vec and |k_vec|
-                    auto k_vec_integer = force_real[0].get_fourier_integer_wavevector_from_index(fourier_index);
-                    double kmag2 = 0.0;
-                    for(int idim = 0; idim < N; idim++) {
-                        kvec[idim] = k_vec_integer[idim] * 2.0 * M_PI;
-                        kmag2 += kvec[idim] * kvec[idim];
-                    }
-                    auto value = force_real[0].get_fourier_from_index(fourier_index);
-                
-                    force_real[0].get_fourier_wavevector_and_norm2_by_index(fourier_index, kvec, kmag2);
+                        // Deconvolve the density assigment?
+                        if (DECONVOLVE) {
+                            const double W = window_row * window_table[Nmesh / 2 + iz];
+                            value /= (W * W);
+                        }
 
-                    // Apply kernel 1/D^2
-                    if (LAPLACE_KERNEL == CONTINUOUS_GREENS_FUNCTION){
-                        value *= -1.0 / kmag2;
-                    } else {
-                        value *= greens_function_laplace_operator_fourier<N>(kmag2, kvec, Nmesh, LAPLACE_KERNEL);
-                    }
+                        // Long range part of the force
+                        if (split2 > 0.0)
+                            value *= std::exp(-kmag2 * split2);
 
-                    // Deconvolve the density assigment? 
-                    if (DECONVOLVE) {
-                        double W = window_function(kvec);
-                        value /= (W * W);
-                    }
+                        if (use_filter)
+                            value *= filter_of_kmag2(kmag2);
 
-                    // Apply kernel for D to get force so in the end we have
-                    // -ik/k^2 delta(k) for continuous kernels
-                    for (int idim = 0; idim < N; idim++) {
-                        force_real[idim].set_fourier_from_index(
-                            fourier_index, I * value * FML::GRID::FloatType(gradient_kernel[Nmesh/2 + k_vec_integer[idim]] * norm_poisson_equation));
+                        // Apply kernel for D to get force so in the end we have
+                        // -ik/k^2 delta(k) for continuous kernels
+                        const std::complex<FML::GRID::FloatType> ivalue(-value.imag(), value.real());
+                        for (int idim = 0; idim < N - 1; idim++)
+                            force_fourier[idim][fourier_index] = ivalue * FML::GRID::FloatType(gradient_row[idim]);
+                        force_fourier[N - 1][fourier_index] =
+                            ivalue * FML::GRID::FloatType(gradient_kernel[Nmesh / 2 + iz] * norm_poisson_equation);
                     }
                 }
             }
 
-            // Fourier transform back to real space
-            for (int idim = 0; idim < N; idim++)
-                force_real[idim].fftw_c2r();
+            // Deal with DC mode
+            if (Local_x_start == 0)
+                for (int idim = 0; idim < N; idim++)
+                    force_real[idim].set_fourier_from_index(0, 0.0);
+
+            // Fourier transform back to real space (all components in one go)
+            FML::GRID::fftw_c2r_batched(force_real);
         }
 
         //===================================================================================
@@ -421,156 +563,1544 @@ namespace FML {
         }
 
         //===================================================================================
-        /// @brief This moves the particles according to \f$ x_{\rm new} = x + v \Delta t \f$. Note that we assume the
-        /// velocities are in such units that \f$ v \Delta t\f$ is a dimensionless shift in [0,1). NB: after this
-        /// methods is done the particles might have left the current task and must be communicated (this is done
-        /// automatically if you use the MPIParticles version of this method).
+        /// @brief This moves the particles according to \f$ x_{\rm new} = x + v \Delta t \f$ (see the method above)
+        /// and clears the interpolation stencils of the particles as they are no longer valid.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class
+        ///
+        /// @param[out] part MPIParticles containing the particles.
+        /// @param[in] delta_time The size of the timestep.
+        /// @param[out] stencils The interpolation stencils of the particles (see KickParticles).
+        /// @param[in] periodic_box Is the box periodic?
+        ///
+        //===================================================================================
+        template <int N, class T>
+        void DriftParticles(MPIParticles<T> & part,
+                            double delta_time,
+                            FML::INTERPOLATION::ParticleInterpolationStencils<N> & stencils,
+                            bool periodic_box) {
+            if (delta_time == 0.0)
+                return;
+            stencils.clear();
+            DriftParticles<N, T>(part, delta_time, periodic_box);
+        }
+
+        //===================================================================================
+        /// @brief Drift a contiguous block of particles \f$ x_{\rm new} = x + v \Delta t \f$ where component idim
+        /// of the position (velocity) of particle i is pos[i * pos_stride + idim] (vel[i * vel_stride + idim]). This
+        /// covers both the columns of MPIParticlesSoA (stride N) and array-of-structs particles that store the
+        /// position and velocity inside the particle (stride sizeof(T) / sizeof(PosType)). The inner loops have no
+        /// branches (see wrap_periodic_branchfree) so the compiler can vectorize them, and the arithmetic is done in
+        /// the precision of the fields so float particles get twice the SIMD width of double particles.
+        ///
+        /// @tparam N The dimension of the particles
+        /// @tparam PosType The type of the positions (float or double)
+        /// @tparam VelType The type of the velocities (float or double)
+        ///
+        /// @param[out] pos Pointer to the first position component of the first particle.
+        /// @param[in] pos_stride The number of PosType between two particles.
+        /// @param[in] vel Pointer to the first velocity component of the first particle.
+        /// @param[in] vel_stride The number of VelType between two particles.
+        /// @param[in] NumPart The number of particles.
+        /// @param[in] delta_time The size of the timestep.
+        /// @param[in] periodic_box Is the box periodic?
+        ///
+        /// @return The maximum displacement \f$ |v \Delta t| \f$ on the local task.
+        ///
+        //===================================================================================
+        template <int N, class PosType, class VelType>
+        double drift_block(PosType * pos,
+                           size_t pos_stride,
+                           const VelType * vel,
+                           size_t vel_stride,
+                           size_t NumPart,
+                           double delta_time,
+                           bool periodic_box) {
+            using Real = std::common_type_t<PosType, VelType>;
+            const Real dt = Real(delta_time);
+
+            double max_disp = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_disp)
+#endif
+            for (size_t start = 0; start < NumPart; start += drift_kick_block_size) {
+                const size_t end = std::min(start + drift_kick_block_size, NumPart);
+                Real max_disp_block = 0.0;
+                for (int idim = 0; idim < N; idim++) {
+                    PosType * x = pos + idim;
+                    const VelType * v = vel + idim;
+                    if (periodic_box) {
+#ifdef USE_OMP
+#pragma omp simd reduction(max : max_disp_block)
+#endif
+                        for (size_t i = start; i < end; i++) {
+                            const Real disp = Real(v[i * vel_stride]) * dt;
+                            max_disp_block = std::max(max_disp_block, std::abs(disp));
+                            x[i * pos_stride] =
+                                FML::PARTICLE::wrap_periodic_branchfree(PosType(x[i * pos_stride] + disp));
+                        }
+                    } else {
+#ifdef USE_OMP
+#pragma omp simd reduction(max : max_disp_block)
+#endif
+                        for (size_t i = start; i < end; i++) {
+                            const Real disp = Real(v[i * vel_stride]) * dt;
+                            max_disp_block = std::max(max_disp_block, std::abs(disp));
+                            x[i * pos_stride] = PosType(x[i * pos_stride] + disp);
+                        }
+                    }
+                }
+                max_disp = std::max(max_disp, double(max_disp_block));
+            }
+            return max_disp;
+        }
+
+        //===================================================================================
+        /// @brief Kick a contiguous block of particles \f$ v_{\rm new} = v - F \Delta t \f$ where component idim of
+        /// the velocity of particle i is vel[i * vel_stride + idim] and \f$ F = \nabla \Phi \f$ is given as one
+        /// contiguous array per component (as returned by interpolate_grid_vector_to_particle_positions). See
+        /// drift_block for the layouts this covers.
+        ///
+        /// @tparam N The dimension of the particles
+        /// @tparam VelType The type of the velocities (float or double)
+        /// @tparam ForceType The type of the force (float or double)
+        ///
+        /// @param[out] vel Pointer to the first velocity component of the first particle.
+        /// @param[in] vel_stride The number of VelType between two particles.
+        /// @param[in] force Pointers to the N components of the force at the particles.
+        /// @param[in] NumPart The number of particles.
+        /// @param[in] delta_time The size of the timestep.
+        ///
+        /// @return The maximum change in velocity \f$ |F \Delta t| \f$ on the local task.
+        ///
+        //===================================================================================
+        template <int N, class VelType, class ForceType>
+        double kick_block(VelType * vel,
+                          size_t vel_stride,
+                          const std::array<const ForceType *, N> & force,
+                          size_t NumPart,
+                          double delta_time) {
+            using Real = std::common_type_t<VelType, ForceType>;
+            const Real dt = Real(delta_time);
+
+            double max_dvel = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_dvel)
+#endif
+            for (size_t start = 0; start < NumPart; start += drift_kick_block_size) {
+                const size_t end = std::min(start + drift_kick_block_size, NumPart);
+                Real max_dvel_block = 0.0;
+                for (int idim = 0; idim < N; idim++) {
+                    VelType * v = vel + idim;
+                    const ForceType * f = force[idim];
+#ifdef USE_OMP
+#pragma omp simd reduction(max : max_dvel_block)
+#endif
+                    for (size_t i = start; i < end; i++) {
+                        const Real dvel = -Real(f[i]) * dt;
+                        max_dvel_block = std::max(max_dvel_block, std::abs(dvel));
+                        v[i * vel_stride] = VelType(v[i * vel_stride] + dvel);
+                    }
+                }
+                max_dvel = std::max(max_dvel, double(max_dvel_block));
+            }
+            return max_dvel;
+        }
+
+        // Internal method. Pointer to the first component of an array field (Pos, Vel, ...) of the first particle
+        // and the stride (in components) between particles if the particles store the field inside them, otherwise
+        // a nullptr (and the field has to be accessed per particle through the getter)
+        template <FML::PARTICLE::ParticleFieldKind kind, class T>
+        auto get_strided_field(T * p, size_t & stride) {
+            using Layout = FML::PARTICLE::ParticleLayout<T>;
+            using FieldType = std::remove_pointer_t<decltype(FML::PARTICLE::get_field<kind>(*p))>;
+            stride = sizeof(T) / sizeof(FieldType);
+            if constexpr (sizeof(T) % sizeof(FieldType) == 0 and Layout::has(kind)) {
+                const std::ptrdiff_t offset = Layout::offsets()[Layout::index_of(kind)];
+                if (offset >= 0 and offset % std::ptrdiff_t(sizeof(FieldType)) == 0)
+                    return reinterpret_cast<FieldType *>(reinterpret_cast<char *>(p) + offset);
+            }
+            return static_cast<FieldType *>(nullptr);
+        }
+
+        //===================================================================================
+        /// @brief This moves the particles according to \f$ x_{\rm new} = x + v \Delta t \f$. Note that we assume the
+        /// velocities are in such units that \f$ v \Delta t\f$ is a dimensionless shift in [0,1). NB: after this
+        /// methods is done the particles might have left the current task and must be communicated (this is done
+        /// automatically if you use the MPIParticles version of this method).
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class
+        ///
+        /// @param[out] p Pointer to the first particle.
+        /// @param[in] NumPart The number of local particles.
+        /// @param[in] delta_time The size of the timestep.
+        /// @param[in] periodic_box Is the box periodic?
+        ///
+        //===================================================================================
+        template <int N, class T>
+        void DriftParticles(T * p, size_t NumPart, double delta_time, bool periodic_box) {
+            if (NumPart == 0)
+                return;
+            if (delta_time == 0.0)
+                return;
+
+            // Sanity check on particle
+            assert_mpi(FML::PARTICLE::GetNDIM(T()) == N,
+                       "[DriftParticles] NDIM of particles and of grid does not match");
+            static_assert(FML::PARTICLE::has_get_pos<T>(),
+                          "[DriftParticles] Particle class must have a get_pos method to use this method");
+            static_assert(FML::PARTICLE::has_get_vel<T>(),
+                          "[DriftParticles] Particle class must have a get_vel method to use this method");
+
+            // If the particles store the position and velocity inside them we can drift them as strided arrays
+            size_t pos_stride = 0;
+            size_t vel_stride = 0;
+            auto * pos_block = get_strided_field<FML::PARTICLE::ParticleFieldKind::Pos>(p, pos_stride);
+            auto * vel_block = get_strided_field<FML::PARTICLE::ParticleFieldKind::Vel>(p, vel_stride);
+
+            double max_disp = 0.0;
+            if (pos_block and vel_block) {
+                max_disp =
+                    drift_block<N>(pos_block, pos_stride, vel_block, vel_stride, NumPart, delta_time, periodic_box);
+            } else {
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_disp)
+#endif
+                for (size_t i = 0; i < NumPart; i++) {
+                    auto * pos = FML::PARTICLE::GetPos(p[i]);
+                    auto * vel = FML::PARTICLE::GetVel(p[i]);
+                    for (int idim = 0; idim < N; idim++) {
+                        double disp = vel[idim] * delta_time;
+                        pos[idim] += disp;
+                        max_disp = std::max(max_disp, std::abs(disp));
+
+                        // Periodic wrap
+                        if (periodic_box)
+                            FML::PARTICLE::wrap_periodic(pos[idim]);
+                    }
+                }
+            }
+            FML::MaxOverTasks(&max_disp);
+
+            if (FML::ThisTask == 0)
+                std::cout << "[Drift] Max displacement: " << max_disp << "\n";
+        }
+
+        //===================================================================================
+        /// @brief This moves the particle velocities according to \f$ v_{\rm new} = v + F \Delta t \f$. This method
+        /// assumes the force is normalized such that \f$ F \Delta t \f$ has the same units as your v.
+        /// If the flag free_force_grids is set in the source then we free up memory of the force grids after we have
+        /// used them. The defalt is false.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class
+        ///
+        /// @param[in] force_grid Grid containing the force.
+        /// @param[out] part MPIParticles containing the particles.
+        /// @param[in] delta_time The size of the timestep.
+        /// @param[in] interpolation_method The interpolation method for interpolating the force to the particle
+        /// positions.
+        ///
+        //===================================================================================
+        template <int N, class T>
+        void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
+                           MPIParticles<T> & part,
+                           double delta_time,
+                           std::string interpolation_method) {
+            if (delta_time == 0.0)
+                return;
+            KickParticles<N, T>(
+                force_grid, part.get_particles_ptr(), part.get_npart(), delta_time, interpolation_method);
+        }
+
+        //===================================================================================
+        /// @brief This moves the particle velocities according to \f$ v_{\rm new} = v + F \Delta t \f$. This method
+        /// assumes the force is normalized such that \f$ F \Delta t \f$ has the same units as your v.
+        /// If the flag free_force_grids is set in the source then we free up memory of the force grids after we have
+        /// used them. The defalt is false.
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class
+        ///
+        /// @param[in] force_grid The force \f$ \nabla \Phi \f$.
+        /// @param[out] p Pointer to the first particle.
+        /// @param[in] NumPart The number of local particles.
+        /// @param[in] delta_time The size of the timestep.
+        /// @param[in] interpolation_method The interpolation method for interpolating the force to the particle
+        /// positions.
+        ///
+        //===================================================================================
+        template <int N, class T>
+        void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
+                           T * p,
+                           size_t NumPart,
+                           double delta_time,
+                           std::string interpolation_method) {
+            kick_particles<N, T>(force_grid, p, NumPart, delta_time, interpolation_method, nullptr);
+        }
+
+        //===================================================================================
+        /// @brief This moves the particle velocities according to \f$ v_{\rm new} = v - F \Delta t \f$ (see the
+        /// method above) using precomputed interpolation stencils. If the stencils are not valid for the particles
+        /// and this grid they are computed and can then be reused for interpolating other grids to the same
+        /// positions until the particles are moved (pass the stencils to DriftParticles to have them cleared).
+        ///
+        /// @tparam N The dimension of the grid
+        /// @tparam T The particle class
+        ///
+        /// @param[in] force_grid Grid containing the force.
+        /// @param[out] part MPIParticles containing the particles.
+        /// @param[in] delta_time The size of the timestep.
+        /// @param[in] interpolation_method The interpolation method for interpolating the force to the particle
+        /// positions.
+        /// @param[out] stencils The interpolation stencils of the particles.
+        ///
+        //===================================================================================
+        template <int N, class T>
+        void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
+                           MPIParticles<T> & part,
+                           double delta_time,
+                           std::string interpolation_method,
+                           FML::INTERPOLATION::ParticleInterpolationStencils<N> & stencils) {
+            if (delta_time == 0.0)
+                return;
+            kick_particles<N, T>(
+                force_grid, part.get_particles_ptr(), part.get_npart(), delta_time, interpolation_method, &stencils);
+        }
+
+        // Internal method. The kick with (if stencils is not a nullptr) or without precomputed stencils
+        template <int N, class T>
+        void kick_particles(std::array<FFTWGrid<N>, N> & force_grid,
+                            T * p,
+                            size_t NumPart,
+                            double delta_time,
+                            std::string interpolation_method,
+                            FML::INTERPOLATION::ParticleInterpolationStencils<N> * stencils) {
+
+            // Nothing to do if delta_time = 0.0
+            if (delta_time == 0.0)
+                return;
+
+            // Sanity check on particle
+            assert_mpi(FML::PARTICLE::GetNDIM(T()) == N, "[KickParticles] Dimension of particle and grid do not match");
+            static_assert(FML::PARTICLE::has_get_vel<T>(),
+                          "[KickParticles] Particle must have velocity to use this method");
+
+            // Deallocate the force grids (after interpolating to the particles we don't need it here and probably
+            // not elsewhere so lets save some memory)
+            constexpr bool free_force_grids = false;
+
+            // Interpolate force to particle positions (communicate the boundaries of all the grids at once)
+            std::array<FML::GRID::FFTWGridHaloExchange, N> halo_exchange;
+            for (int idim = 0; idim < N; idim++) {
+                halo_exchange[idim] = force_grid[idim].communicate_boundaries_async();
+            }
+            for (auto & h : halo_exchange)
+                h.wait();
+            std::array<std::vector<FML::GRID::FloatType>, N> force;
+            if (stencils) {
+                if (not stencils->is_valid_for(force_grid[0], NumPart, interpolation_method))
+                    stencils->compute(force_grid[0], p, NumPart, interpolation_method);
+                FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N>(force_grid, *stencils, force);
+            } else {
+                FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, T>(
+                    force_grid, p, NumPart, force, interpolation_method);
+            }
+            if (free_force_grids) {
+                for (int idim = 0; idim < N; idim++) {
+                    force_grid[idim].free();
+                }
+            }
+
+            // If the particles store the velocity inside them we can kick them as a strided array
+            size_t vel_stride = 0;
+            auto * vel_block = get_strided_field<FML::PARTICLE::ParticleFieldKind::Vel>(p, vel_stride);
+
+            double max_dvel = 0.0;
+            if (vel_block) {
+                std::array<const FML::GRID::FloatType *, N> force_ptr;
+                for (int idim = 0; idim < N; idim++)
+                    force_ptr[idim] = force[idim].data();
+                max_dvel = kick_block<N>(vel_block, vel_stride, force_ptr, NumPart, delta_time);
+            } else {
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_dvel)
+#endif
+                for (size_t i = 0; i < NumPart; i++) {
+                    auto * vel = FML::PARTICLE::GetVel(p[i]);
+                    for (int idim = 0; idim < N; idim++) {
+                        double dvel = -force[idim][i] * delta_time;
+                        max_dvel = std::max(max_dvel, std::abs(dvel));
+                        vel[idim] += dvel;
+                    }
+                }
+            }
+
+            FML::MaxOverTasks(&max_dvel);
+
+            if (FML::ThisTask == 0)
+                std::cout << "[Kick] Max delta_vel * delta_time : " << max_dvel * delta_time << "\n";
+        }
+
+        //===================================================================================
+        /// @brief Drift particles stored as columns (MPIParticlesSoA) \f$ x_{\rm new} = x + v \Delta t \f$ with
+        /// drift_block and communicate them. See DriftParticles above for the units.
+        ///
+        /// @tparam N The dimension of the particles
+        /// @tparam WITH_MASS If the particles store a mass
+        /// @tparam PosType The type of the positions and velocities (float or double)
+        ///
+        /// @param[out] part MPIParticlesSoA containing the particles.
+        /// @param[in] delta_time The size of the timestep.
+        /// @param[in] periodic_box Is the box periodic?
+        ///
+        //===================================================================================
+        template <int N, bool WITH_MASS, class PosType>
+        void DriftParticles(FML::PARTICLE::MPIParticlesSoA<N, WITH_MASS, PosType> & part,
+                            double delta_time,
+                            bool periodic_box) {
+            if (delta_time == 0.0)
+                return;
+
+            double max_disp = 0.0;
+            if (part.get_npart() > 0)
+                max_disp = drift_block<N>(part.get_pos_ptr()->Pos,
+                                          sizeof(*part.get_pos_ptr()) / sizeof(PosType),
+                                          part.get_vel_ptr()->data(),
+                                          sizeof(*part.get_vel_ptr()) / sizeof(PosType),
+                                          part.get_npart(),
+                                          delta_time,
+                                          periodic_box);
+            FML::MaxOverTasks(&max_disp);
+
+            if (FML::ThisTask == 0)
+                std::cout << "[Drift] Max displacement: " << max_disp << "\n";
+
+            // Particles might have left the current task
+            part.communicate_particles();
+        }
+
+        //===================================================================================
+        /// @brief Kick particles stored as columns (MPIParticlesSoA) \f$ v_{\rm new} = v - F \Delta t \f$ with
+        /// kick_block. See KickParticles above for the units. The force is interpolated from the column of
+        /// positions.
+        ///
+        /// @tparam N The dimension of the particles
+        /// @tparam WITH_MASS If the particles store a mass
+        /// @tparam PosType The type of the positions and velocities (float or double)
+        ///
+        /// @param[in] force_grid Grid containing the force.
+        /// @param[out] part MPIParticlesSoA containing the particles.
+        /// @param[in] delta_time The size of the timestep.
+        /// @param[in] interpolation_method The interpolation method for interpolating the force to the particle
+        /// positions.
+        ///
+        //===================================================================================
+        template <int N, bool WITH_MASS, class PosType>
+        void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
+                           FML::PARTICLE::MPIParticlesSoA<N, WITH_MASS, PosType> & part,
+                           double delta_time,
+                           std::string interpolation_method) {
+            if (delta_time == 0.0)
+                return;
+            using PositionType = typename FML::PARTICLE::MPIParticlesSoA<N, WITH_MASS, PosType>::PositionType;
+
+            std::array<FML::GRID::FFTWGridHaloExchange, N> halo_exchange;
+            for (int idim = 0; idim < N; idim++) {
+                halo_exchange[idim] = force_grid[idim].communicate_boundaries_async();
+            }
+            for (auto & h : halo_exchange)
+                h.wait();
+            std::array<std::vector<FML::GRID::FloatType>, N> force;
+            FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, PositionType>(
+                force_grid, part.get_pos_ptr(), part.get_npart(), force, interpolation_method);
+
+            double max_dvel = 0.0;
+            if (part.get_npart() > 0) {
+                std::array<const FML::GRID::FloatType *, N> force_ptr;
+                for (int idim = 0; idim < N; idim++)
+                    force_ptr[idim] = force[idim].data();
+                max_dvel = kick_block<N>(part.get_vel_ptr()->data(),
+                                         sizeof(*part.get_vel_ptr()) / sizeof(PosType),
+                                         force_ptr,
+                                         part.get_npart(),
+                                         delta_time);
+            }
+            FML::MaxOverTasks(&max_dvel);
+
+            if (FML::ThisTask == 0)
+                std::cout << "[Kick] Max delta_vel * delta_time : " << max_dvel * delta_time << "\n";
+        }
+
+#ifdef USE_OMP_TARGET
+        //===================================================================================
+        /// @brief The particles (positions, velocities, masses and the COLA displacement fields) kept on the
+        /// device (OpenMP target offload, see USE_OMP_TARGET in ParticleGridInterpolation.h) over a whole
+        /// kick-drift-kick step. Density assignment, the kick, the COLA kick-drift and the drift then run
+        /// there without copying the particles back and forth. The Fourier transforms and the force computation
+        /// are done on the host (FFTW) so the grids are copied in each step.
+        ///
+        /// Upload after the particles have been communicated and download (which also frees the device memory)
+        /// before the particles are needed on the host again (communication, output, ...). Without a device
+        /// the kernels run on the host.
+        ///
+        /// @tparam N The dimension of the particles
+        ///
+        //===================================================================================
+        template <int N>
+        class DeviceParticles {
+          public:
+            DeviceParticles() = default;
+            DeviceParticles(const DeviceParticles &) = delete;
+            DeviceParticles & operator=(const DeviceParticles &) = delete;
+            ~DeviceParticles() { free(); }
+
+            /// Copy the particles to the device. The first lpt_order orders of COLA displacement fields
+            /// (D1, D2, D3a and D3b) are also copied if lpt_order > 0. Collective (all tasks must call it).
+            template <class T>
+            void upload(const T * p, size_t NumPart, size_t NumPartTot, int lpt_order = 0);
+
+            /// Copy the positions and velocities back to the particles and free the device memory
+            /// (does nothing if the particles are not on the device)
+            template <class T>
+            void download(T * p, size_t NumPart);
+
+            /// Are the particles on the device?
+            bool is_resident() const { return resident; }
+
+            /// Free the device memory (without copying back)
+            void free();
+
+            /// Density assignment (same result as FML::INTERPOLATION::particles_to_grid)
+            void particles_to_grid(FFTWGrid<N> & density, std::string density_assignment_method);
+
+            /// Kick \f$ v_{\rm new} = v - F \Delta t \f$ (same as KickParticles)
+            void kick(std::array<FFTWGrid<N>, N> & force_grid, double delta_time, std::string interpolation_method);
+
+            /// Drift \f$ x_{\rm new} = x + v \Delta t \f$ (same as DriftParticles)
+            void drift(double delta_time, bool periodic_box = true);
+
+            /// Scaleindependent COLA kick and drift: \f$ x \to x + \sum_n D_n f_{\rm pos,n} \f$ and
+            /// \f$ v \to v + \sum_n D_n f_{\rm vel,n} \f$ for the uploaded displacement fields (D1, D2, D3a, D3b)
+            void cola_kick_drift(const std::array<double, 4> & fac_pos, const std::array<double, 4> & fac_vel);
+
+          private:
+            template <int ORDER>
+            void particles_to_grid(FFTWGrid<N> & density);
+            template <int ORDER>
+            double kick(std::array<FFTWGrid<N>, N> & force_grid, double delta_time);
+            void wrap_positions();
+
+            bool resident{false};
+            bool periodic{true};
+            size_t npart{0};
+            size_t npart_total{0};
+            int nlpt{0};
+            std::vector<double> pos;
+            std::vector<double> vel;
+            std::vector<double> weight;
+            std::vector<double> lpt;
+        };
+
+        template <int N>
+        template <class T>
+        void DeviceParticles<N>::upload(const T * p, size_t NumPart, size_t NumPartTot, int lpt_order) {
+            static_assert(FML::PARTICLE::has_get_pos<T>() and FML::PARTICLE::has_get_vel<T>(),
+                          "[DeviceParticles] Particle class must have positions and velocities");
+            free();
+            periodic = true;
+            npart = NumPart;
+            npart_total = NumPartTot;
+            nlpt = lpt_order >= 3 ? 4 : lpt_order;
+            if constexpr (not FML::PARTICLE::has_get_D_1LPT<T>())
+                assert_mpi(nlpt == 0, "[DeviceParticles::upload] Particles do not have the 1LPT displacement field");
+            if constexpr (not FML::PARTICLE::has_get_D_2LPT<T>())
+                assert_mpi(nlpt <= 1, "[DeviceParticles::upload] Particles do not have the 2LPT displacement field");
+            if constexpr (not FML::PARTICLE::has_get_D_3LPTa<T>() or not FML::PARTICLE::has_get_D_3LPTb<T>())
+                assert_mpi(nlpt <= 2, "[DeviceParticles::upload] Particles do not have the 3LPT displacement fields");
+
+            // The weight is the mass over the mean mass (the normalization of the density is done in the kernel)
+            double total_mass = double(NumPartTot);
+            if constexpr (FML::PARTICLE::has_get_mass<T>()) {
+                total_mass = 0.0;
+                for (size_t i = 0; i < NumPart; i++)
+                    total_mass += FML::PARTICLE::GetMass(p[i]);
+                FML::SumOverTasks(&total_mass);
+            }
+
+            pos.resize(N * NumPart);
+            vel.resize(N * NumPart);
+            weight.resize(NumPart);
+            lpt.resize(nlpt * N * NumPart);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < NumPart; i++) {
+                auto & part = const_cast<T &>(p[i]);
+                const auto * x = FML::PARTICLE::GetPos(part);
+                const auto * v = FML::PARTICLE::GetVel(part);
+                for (int idim = 0; idim < N; idim++) {
+                    pos[N * i + idim] = x[idim];
+                    vel[N * i + idim] = v[idim];
+                }
+                weight[i] = 1.0;
+                if constexpr (FML::PARTICLE::has_get_mass<T>())
+                    weight[i] = FML::PARTICLE::GetMass(part) * double(NumPartTot) / total_mass;
+
+                auto copy_lpt = [&](int ilpt, const auto * D) {
+                    for (int idim = 0; idim < N; idim++)
+                        lpt[(ilpt * NumPart + i) * N + idim] = D[idim];
+                };
+                if constexpr (FML::PARTICLE::has_get_D_1LPT<T>())
+                    if (nlpt >= 1)
+                        copy_lpt(0, FML::PARTICLE::GetD_1LPT(part));
+                if constexpr (FML::PARTICLE::has_get_D_2LPT<T>())
+                    if (nlpt >= 2)
+                        copy_lpt(1, FML::PARTICLE::GetD_2LPT(part));
+                if constexpr (FML::PARTICLE::has_get_D_3LPTa<T>() and FML::PARTICLE::has_get_D_3LPTb<T>())
+                    if (nlpt >= 4) {
+                        copy_lpt(2, FML::PARTICLE::GetD_3LPTa(part));
+                        copy_lpt(3, FML::PARTICLE::GetD_3LPTb(part));
+                    }
+            }
+
+            double * pos_ptr = pos.data();
+            double * vel_ptr = vel.data();
+            double * weight_ptr = weight.data();
+            double * lpt_ptr = lpt.data();
+            const size_t nlpt_values = lpt.size();
+#pragma omp target enter data map(to : pos_ptr[0 : N * NumPart], vel_ptr[0 : N * NumPart], weight_ptr[0 : NumPart])  \
+    map(to : lpt_ptr[0 : nlpt_values])
+            resident = true;
+        }
+
+        template <int N>
+        template <class T>
+        void DeviceParticles<N>::download(T * p, size_t NumPart) {
+            if (not resident)
+                return;
+            assert_mpi(NumPart == npart, "[DeviceParticles::download] The number of particles has changed");
+
+            double * pos_ptr = pos.data();
+            double * vel_ptr = vel.data();
+#pragma omp target update from(pos_ptr[0 : N * npart], vel_ptr[0 : N * npart])
+            free();
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < NumPart; i++) {
+                auto * x = FML::PARTICLE::GetPos(p[i]);
+                auto * v = FML::PARTICLE::GetVel(p[i]);
+                using PosType = std::remove_reference_t<decltype(x[0])>;
+                using VelType = std::remove_reference_t<decltype(v[0])>;
+                for (int idim = 0; idim < N; idim++) {
+                    x[idim] = PosType(pos[N * i + idim]);
+                    v[idim] = VelType(vel[N * i + idim]);
+                    if (periodic)
+                        FML::PARTICLE::wrap_periodic(x[idim]);
+                }
+            }
+        }
+
+        template <int N>
+        void DeviceParticles<N>::free() {
+            if (not resident)
+                return;
+            double * pos_ptr = pos.data();
+            double * vel_ptr = vel.data();
+            double * weight_ptr = weight.data();
+            double * lpt_ptr = lpt.data();
+            const size_t nlpt_values = lpt.size();
+#pragma omp target exit data map(release : pos_ptr[0 : N * npart], vel_ptr[0 : N * npart], weight_ptr[0 : npart])   \
+    map(release : lpt_ptr[0 : nlpt_values])
+            resident = false;
+        }
+
+        template <int N>
+        template <int ORDER>
+        void DeviceParticles<N>::particles_to_grid(FFTWGrid<N> & density) {
+            const auto nextra = FML::INTERPOLATION::get_extra_slices_needed_by_order<ORDER>();
+            assert_mpi(density.get_n_extra_slices_left() >= nextra.first and
+                           density.get_n_extra_slices_right() >= nextra.second,
+                       "[DeviceParticles::particles_to_grid] Too few extra slices\n");
+
+            const int Nmesh = density.get_nmesh();
+            const double norm_fac = std::pow(double(Nmesh), N) / double(npart_total);
+            density.fill_real_grid(-1.0);
+            const ptrdiff_t offset = density.get_n_extra_slices_left() * density.get_ntot_real_slice_alloc();
+            const ptrdiff_t grid_size =
+                (density.get_n_extra_slices_left() + density.get_local_nx() + density.get_n_extra_slices_right()) *
+                density.get_ntot_real_slice_alloc();
+            FML::INTERPOLATION::particles_to_grid_offload<N, ORDER>(pos.data(),
+                                                                    weight.data(),
+                                                                    npart,
+                                                                    Nmesh,
+                                                                    density.get_local_x_start(),
+                                                                    FML::NTasks == 1,
+                                                                    density.get_real_grid_left(),
+                                                                    grid_size,
+                                                                    offset,
+                                                                    norm_fac);
+            if (FML::NTasks > 1)
+                FML::INTERPOLATION::add_contribution_from_extra_slices<N>(density);
+        }
+
+        template <int N>
+        void DeviceParticles<N>::particles_to_grid(FFTWGrid<N> & density, std::string density_assignment_method) {
+            assert_mpi(resident, "[DeviceParticles::particles_to_grid] The particles are not on the device");
+            const int order = FML::INTERPOLATION::interpolation_order_from_name(density_assignment_method);
+            if (order == 1)
+                particles_to_grid<1>(density);
+            if (order == 2)
+                particles_to_grid<2>(density);
+            if (order == 3)
+                particles_to_grid<3>(density);
+            if (order == 4)
+                particles_to_grid<4>(density);
+            if (order == 5)
+                particles_to_grid<5>(density);
+        }
+
+        // Internal method. The force is interpolated to the particles and added to the velocities in the same
+        // kernel (one component at the time) so the force at the particles never leaves the device
+        template <int N>
+        template <int ORDER>
+        double DeviceParticles<N>::kick(std::array<FFTWGrid<N>, N> & force_grid, double delta_time) {
+            constexpr int ncells = int(FML::power(ORDER, N));
+            const auto Local_nx = force_grid[0].get_local_nx();
+            const auto Local_x_start = force_grid[0].get_local_x_start();
+            const int Nmesh = force_grid[0].get_nmesh();
+            const size_t NumPart = npart;
+            const double * pos_ptr = pos.data();
+            double * vel_ptr = vel.data();
+
+            double max_dvel = 0.0;
+            for (int idim = 0; idim < N; idim++) {
+                const auto & grid = force_grid[idim];
+                const ptrdiff_t offset = grid.get_n_extra_slices_left() * grid.get_ntot_real_slice_alloc();
+                const ptrdiff_t grid_size =
+                    (grid.get_n_extra_slices_left() + Local_nx + grid.get_n_extra_slices_right()) *
+                    grid.get_ntot_real_slice_alloc();
+                const FML::GRID::FloatType * g = grid.get_real_grid() - offset;
+#pragma omp target teams distribute parallel for map(to : g[0 : grid_size], pos_ptr[0 : N * NumPart])               \
+    map(tofrom : vel_ptr[0 : N * NumPart]) reduction(max : max_dvel)
+                for (size_t i = 0; i < NumPart; i++) {
+                    int index[N][ORDER];
+                    double w1d[N][ORDER];
+                    FML::INTERPOLATION::offload_stencil<N, ORDER>(
+                        &pos_ptr[N * i], Nmesh, Local_x_start, Local_nx, true, false, index, w1d);
+                    double value = 0.0;
+                    for (int icell = 0; icell < ncells; icell++) {
+                        double w;
+                        const ptrdiff_t ind =
+                            offset + FML::INTERPOLATION::offload_stencil_cell<N, ORDER>(icell, Nmesh, index, w1d, w);
+                        value += g[ind] * w;
+                    }
+                    const double dvel = -double(FML::GRID::FloatType(value)) * delta_time;
+                    vel_ptr[N * i + idim] += dvel;
+                    max_dvel = std::max(max_dvel, std::abs(dvel));
+                }
+            }
+            return max_dvel;
+        }
+
+        template <int N>
+        void DeviceParticles<N>::kick(std::array<FFTWGrid<N>, N> & force_grid,
+                                      double delta_time,
+                                      std::string interpolation_method) {
+            if (delta_time == 0.0)
+                return;
+            assert_mpi(resident, "[DeviceParticles::kick] The particles are not on the device");
+            const auto nextra = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(interpolation_method);
+            for (auto & grid : force_grid)
+                assert_mpi(grid.get_n_extra_slices_left() >= nextra.first and
+                               grid.get_n_extra_slices_right() >= nextra.second,
+                           "[DeviceParticles::kick] Too few extra slices in some of the grids\n");
+
+            // Communicate the boundaries of all the grids at once
+            std::array<FML::GRID::FFTWGridHaloExchange, N> halo_exchange;
+            for (int idim = 0; idim < N; idim++)
+                halo_exchange[idim] = force_grid[idim].communicate_boundaries_async();
+            for (auto & h : halo_exchange)
+                h.wait();
+
+            double max_dvel = 0.0;
+            const int order = FML::INTERPOLATION::interpolation_order_from_name(interpolation_method);
+            if (order == 1)
+                max_dvel = kick<1>(force_grid, delta_time);
+            if (order == 2)
+                max_dvel = kick<2>(force_grid, delta_time);
+            if (order == 3)
+                max_dvel = kick<3>(force_grid, delta_time);
+            if (order == 4)
+                max_dvel = kick<4>(force_grid, delta_time);
+            if (order == 5)
+                max_dvel = kick<5>(force_grid, delta_time);
+            FML::MaxOverTasks(&max_dvel);
+
+            if (FML::ThisTask == 0)
+                std::cout << "[Kick] Max delta_vel * delta_time : " << max_dvel * delta_time << "\n";
+        }
+
+        template <int N>
+        void DeviceParticles<N>::drift(double delta_time, bool periodic_box) {
+            if (delta_time == 0.0)
+                return;
+            assert_mpi(resident, "[DeviceParticles::drift] The particles are not on the device");
+            const size_t NumPart = npart;
+            double * pos_ptr = pos.data();
+            const double * vel_ptr = vel.data();
+
+            double max_disp = 0.0;
+#pragma omp target teams distribute parallel for map(tofrom : pos_ptr[0 : N * NumPart])                              \
+    map(to : vel_ptr[0 : N * NumPart]) reduction(max : max_disp)
+            for (size_t i = 0; i < NumPart; i++) {
+                for (int idim = 0; idim < N; idim++) {
+                    const double disp = vel_ptr[N * i + idim] * delta_time;
+                    pos_ptr[N * i + idim] += disp;
+                    max_disp = std::max(max_disp, std::abs(disp));
+                }
+            }
+            periodic = periodic_box;
+            if (periodic)
+                wrap_positions();
+            FML::MaxOverTasks(&max_disp);
+
+            if (FML::ThisTask == 0)
+                std::cout << "[Drift] Max displacement: " << max_disp << "\n";
+        }
+
+        template <int N>
+        void DeviceParticles<N>::cola_kick_drift(const std::array<double, 4> & fac_pos,
+                                                 const std::array<double, 4> & fac_vel) {
+            assert_mpi(resident, "[DeviceParticles::cola_kick_drift] The particles are not on the device");
+            const size_t NumPart = npart;
+            const int nfields = nlpt;
+            double * pos_ptr = pos.data();
+            double * vel_ptr = vel.data();
+            const double * lpt_ptr = lpt.data();
+            const size_t nlpt_values = lpt.size();
+            const double fp0 = fac_pos[0], fp1 = fac_pos[1], fp2 = fac_pos[2], fp3 = fac_pos[3];
+            const double fv0 = fac_vel[0], fv1 = fac_vel[1], fv2 = fac_vel[2], fv3 = fac_vel[3];
+
+#pragma omp target teams distribute parallel for map(tofrom : pos_ptr[0 : N * NumPart], vel_ptr[0 : N * NumPart])    \
+    map(to : lpt_ptr[0 : nlpt_values])
+            for (size_t i = 0; i < NumPart; i++) {
+                for (int ilpt = 0; ilpt < nfields; ilpt++) {
+                    const double fpos = ilpt == 0 ? fp0 : (ilpt == 1 ? fp1 : (ilpt == 2 ? fp2 : fp3));
+                    const double fvel = ilpt == 0 ? fv0 : (ilpt == 1 ? fv1 : (ilpt == 2 ? fv2 : fv3));
+                    const double * D = &lpt_ptr[(ilpt * NumPart + i) * N];
+                    for (int idim = 0; idim < N; idim++) {
+                        pos_ptr[N * i + idim] += D[idim] * fpos;
+                        vel_ptr[N * i + idim] += D[idim] * fvel;
+                    }
+                }
+            }
+            wrap_positions();
+        }
+
+        // Internal method. Periodic wrap into [0,1) as wrap_periodic_branchfree (positions stored in single
+        // precision are wrapped again when we download them as they might round up to 1)
+        template <int N>
+        void DeviceParticles<N>::wrap_positions() {
+            const size_t NumPart = npart;
+            double * pos_ptr = pos.data();
+            const double largest_below_one = 1.0 - std::numeric_limits<double>::epsilon() / 2.0;
+#pragma omp target teams distribute parallel for map(tofrom : pos_ptr[0 : N * NumPart])
+            for (size_t i = 0; i < N * NumPart; i++) {
+                const double x = pos_ptr[i] - std::floor(pos_ptr[i]);
+                pos_ptr[i] = x < largest_below_one ? x : largest_below_one;
+            }
+        }
+#endif
+
+        //===================================================================================
+        /// @brief The short range (P3M) part of the force. With the split kernel exp(-k^2 r_s^2) applied to the PM
+        /// force the rest of the force from a particle at distance r is the Newtonian force times
+        /// Q(N/2, r^2/4r_s^2) (the regularized upper incomplete gamma function), i.e. for N = 3 the usual
+        /// erfc(r/2r_s) + r/(r_s sqrt(pi)) exp(-r^2/4r_s^2). This function returns this factor for N = 1, 2, 3.
+        ///
+        /// @param[in] r_over_split The distance in units of r_s.
+        /// @param[in] ndim The dimension.
+        ///
+        //===================================================================================
+        double short_range_force_factor(double r_over_split, int ndim) {
+            const double u = 0.5 * r_over_split;
+            switch (ndim) {
+                case 1:
+                    return std::erfc(u);
+                case 2:
+                    return std::exp(-u * u);
+                case 3:
+                    return std::erfc(u) + 2.0 * u / std::sqrt(M_PI) * std::exp(-u * u);
+                default:
+                    FML::assert_mpi(false, "short_range_force_factor only implemented for ndim = 1, 2, 3");
+                    return 0.0;
+            }
+        }
+
+        //===================================================================================
+        /// @brief This function sets the split of the force in a long range PM part and a short range part we
+        /// compute by direct summation over the nearby particles (P3M). Setting the split to 0 gives pure PM (the
+        /// fiducial choice). A split of 1-1.5 grid cells and a cutoff of 4.5 r_s (Gadget choices) is a good start.
+        ///
+        /// @param[in] split_in_cells The scale r_s in units of the PM grid cell.
+        /// @param[in] cutoff_over_split Ignore the short range force from particles further away than this times r_s.
+        ///
+        //===================================================================================
+        void set_fiducial_short_range_force(double split_in_cells, double cutoff_over_split) {
+            FML::assert_mpi(split_in_cells >= 0.0 and cutoff_over_split > 0.0,
+                            "Error in set_fiducial_short_range_force. The split and cutoff must be positive");
+            FIDUCIAL_SHORT_RANGE_FORCE_SPLIT = split_in_cells;
+            FIDUCIAL_SHORT_RANGE_FORCE_CUTOFF = cutoff_over_split;
+        }
+
+        //===================================================================================
+        /// @brief This function sets up a zoom region where the short range part of the force is computed on a
+        /// second, finer PM grid (see KickParticlesZoom). The global PM force is split as \f$ F = F_{\rm long} +
+        /// F_{\rm short} \f$ with the long range part multiplied by exp(-k^2 r_s^2) and for the particles in the zoom
+        /// region the short range part is computed on the zoom grid instead of the global grid. The zoom grid covers
+        /// the zoom region plus cutoff_over_split * r_s on each side so its periodic images do not contribute. An
+        /// empty corner turns the zoom off (the fiducial choice).
+        ///
+        /// @param[in] corner The lower corner of the zoom region (in units of the box, one value per dimension).
+        /// @param[in] size The size of the zoom region (in units of the box).
+        /// @param[in] Nmesh_zoom The gridsize of the zoom grid.
+        /// @param[in] split_in_cells The scale r_s in units of the global PM grid cell.
+        /// @param[in] cutoff_over_split Ignore the zoom force from particles further away than this times r_s.
+        ///
+        //===================================================================================
+        void set_fiducial_zoom_region(std::vector<double> corner,
+                                      double size,
+                                      int Nmesh_zoom,
+                                      double split_in_cells,
+                                      double cutoff_over_split) {
+            FML::assert_mpi(corner.empty() or (size > 0.0 and size < 1.0 and Nmesh_zoom > 0),
+                            "Error in set_fiducial_zoom_region. The size must be in (0,1) and Nmesh_zoom > 0");
+            FML::assert_mpi(split_in_cells > 0.0 and cutoff_over_split > 0.0,
+                            "Error in set_fiducial_zoom_region. The split and cutoff must be positive");
+            FIDUCIAL_ZOOM_REGION_CORNER = corner;
+            FIDUCIAL_ZOOM_REGION_SIZE = corner.empty() ? 0.0 : size;
+            FIDUCIAL_ZOOM_NMESH = Nmesh_zoom;
+            FIDUCIAL_ZOOM_FORCE_SPLIT = split_in_cells;
+            FIDUCIAL_ZOOM_FORCE_CUTOFF = cutoff_over_split;
+        }
+
+        // Internal type used for the neighbour search in compute_short_range_force
+        template <int N>
+        struct ShortRangeForcePoint {
+            double pos[N];
+            size_t index; // The index of a local particle (or SIZE_MAX if its a particle from another task)
+            double * get_pos() { return pos; }
+            constexpr int get_ndim() const { return N; }
+        };
+
+        //===================================================================================
+        /// @brief Compute the short range part of the force \f$ \nabla \Phi \f$ (see set_fiducial_short_range_force)
+        /// on the particles by direct summation over all particles within the cutoff. The force is normalized the same
+        /// way as in compute_force_from_density_fourier so that the sum of the two is the full force. We get the
+        /// particles close to the boundary from the neighbor tasks and use ParticlesInBoxes with cells of size
+        /// the cutoff for the neighbour search. All particles are assumed to have the same mass. The particles are
+        /// allowed to have moved a bit out of the local domain since the last communication.
+        ///
+        /// @tparam N The dimension of the particles
+        /// @tparam T The particle class
+        ///
+        /// @param[in] p Pointer to the first particle (all particles must be in the local domain).
+        /// @param[in] NumPart The number of local particles.
+        /// @param[in] NumPartTotal The total number of particles on all tasks.
+        /// @param[in] Nmesh The gridsize used for the PM force.
+        /// @param[in] norm_poisson_equation The prefactor (norm) to the Poisson equation.
+        /// @param[out] force The short range force for each particle.
+        /// @param[in] active If not a nullptr we only compute the force for the particles with active[i] != 0 (the
+        /// rest gets zero force).
+        ///
+        //===================================================================================
+        template <int N, class T>
+        void compute_short_range_force(const T * p,
+                                       size_t NumPart,
+                                       size_t NumPartTotal,
+                                       int Nmesh,
+                                       double norm_poisson_equation,
+                                       std::array<std::vector<FML::GRID::FloatType>, N> & force,
+                                       const std::vector<char> * active) {
+            using Point = ShortRangeForcePoint<N>;
+
+            const double split = FIDUCIAL_SHORT_RANGE_FORCE_SPLIT / double(Nmesh);
+            const double rcut = FIDUCIAL_SHORT_RANGE_FORCE_CUTOFF * split;
+            const double rcut2 = rcut * rcut;
+            const int ngrid = int(1.0 / rcut);
+            FML::assert_mpi(split > 0.0, "[compute_short_range_force] The short range force is not turned on");
+            FML::assert_mpi(ngrid >= 3, "[compute_short_range_force] The cutoff is too large (> boxsize / 3)");
+            // We only get particles from the neighbor tasks (and with two tasks they cannot both send us a particle)
+            const double min_domain = FML::NTasks == 1 ? 0.0 : (FML::NTasks == 2 ? 2.0 * rcut : rcut);
+            FML::assert_mpi(FML::xmax_domain - FML::xmin_domain >= min_domain,
+                            "[compute_short_range_force] The cutoff is too large compared to the local domain");
+
+            // The points: first the local particles then the ones close to the boundary from the neighbor tasks
+            std::vector<Point> points(NumPart);
+            for (size_t i = 0; i < NumPart; i++) {
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T &>(p[i]));
+                for (int idim = 0; idim < N; idim++)
+                    points[i].pos[idim] = pos[idim];
+                points[i].index = i;
+            }
+
+#ifdef USE_MPI
+            if (FML::NTasks > 1) {
+                // The (periodic) distance to the left and right boundary. Negative if we are outside the domain
+                auto wrap = [](double dx) { return dx >= 0.5 ? dx - 1.0 : (dx < -0.5 ? dx + 1.0 : dx); };
+                std::vector<Point> send_left, send_right;
+                // With two tasks the left and right neighbor is the same task so we only send a point once
+                for (auto & point : points) {
+                    const bool left = wrap(point.pos[0] - FML::xmin_domain) < rcut;
+                    const bool right = wrap(FML::xmax_domain - point.pos[0]) <= rcut;
+                    if (left)
+                        send_left.push_back(point);
+                    if (right and not (left and FML::NTasks == 2))
+                        send_right.push_back(point);
+                }
+
+                const int RightTask = (FML::ThisTask + 1) % FML::NTasks;
+                const int LeftTask = (FML::ThisTask - 1 + FML::NTasks) % FML::NTasks;
+                auto sendrecv = [&](std::vector<Point> & send, int send_task, int recv_task) {
+                    MPI_Status status;
+                    size_t n_send = send.size();
+                    size_t n_recv = 0;
+                    MPI_Sendrecv(&n_send,
+                                 sizeof(n_send),
+                                 MPI_BYTE,
+                                 send_task,
+                                 0,
+                                 &n_recv,
+                                 sizeof(n_recv),
+                                 MPI_BYTE,
+                                 recv_task,
+                                 0,
+                                 MPI_COMM_WORLD,
+                                 &status);
+                    const size_t n_old = points.size();
+                    points.resize(n_old + n_recv);
+                    MPI_Sendrecv(send.data(),
+                                 int(n_send * sizeof(Point)),
+                                 MPI_BYTE,
+                                 send_task,
+                                 0,
+                                 points.data() + n_old,
+                                 int(n_recv * sizeof(Point)),
+                                 MPI_BYTE,
+                                 recv_task,
+                                 0,
+                                 MPI_COMM_WORLD,
+                                 &status);
+                    for (size_t i = n_old; i < points.size(); i++)
+                        points[i].index = SIZE_MAX;
+                };
+                sendrecv(send_left, LeftTask, RightTask);
+                sendrecv(send_right, RightTask, LeftTask);
+            }
+#endif
+
+            // Bin the points to cells of size >= rcut
+            FML::PARTICLE::ParticlesInBoxes<Point> grid;
+            grid.create(points.data(), points.size(), ngrid);
+            points.clear();
+            points.shrink_to_fit();
+
+            for (int idim = 0; idim < N; idim++) {
+                force[idim].assign(NumPart, 0.0);
+            }
+
+            // The normalization: the solution of D^2 Phi = norm * delta for one particle
+            // (with delta = sum delta_D / NumPartTotal - 1) is D Phi = norm / (S_N NumPartTotal) * r_vec / r^N
+            const double surface_unit_sphere = N == 1 ? 2.0 : (N == 2 ? 2.0 * M_PI : 4.0 * M_PI);
+            const double norm = norm_poisson_equation / (surface_unit_sphere * double(NumPartTotal));
+
+            // The cells to search around a cell
+            int nnbor = 1;
+            for (int idim = 0; idim < N; idim++)
+                nnbor *= 3;
+
+            // Loop over all cells and for every local particle add the force from all particles in the cells around
+            const size_t ncells = grid.get_ncells();
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+            for (size_t icell = 0; icell < ncells; icell++) {
+                auto cell = grid.get_cell(icell);
+                if (cell.get_np() == 0)
+                    continue;
+
+                std::array<int, N> coord;
+                for (int idim = N - 1, index = int(icell); idim >= 0; idim--, index /= ngrid)
+                    coord[idim] = index % ngrid;
+
+                for (int inbor = 0; inbor < nnbor; inbor++) {
+                    size_t index_nbor = 0;
+                    for (int idim = 0, j = inbor; idim < N; idim++, j /= 3) {
+                        int c = coord[idim] + (j % 3) - 1;
+                        c = c < 0 ? c + ngrid : (c >= ngrid ? c - ngrid : c);
+                        index_nbor = index_nbor * ngrid + c;
+                    }
+                    auto cell_nbor = grid.get_cell(index_nbor);
+
+                    for (auto & p1 : cell) {
+                        if (p1.index == SIZE_MAX or (active and (*active)[p1.index] == 0))
+                            continue;
+                        std::array<double, N> f{};
+                        for (auto & p2 : cell_nbor) {
+                            std::array<double, N> dx;
+                            double r2 = 0.0;
+                            for (int idim = 0; idim < N; idim++) {
+                                dx[idim] = p1.pos[idim] - p2.pos[idim];
+                                if (dx[idim] > 0.5)
+                                    dx[idim] -= 1.0;
+                                if (dx[idim] < -0.5)
+                                    dx[idim] += 1.0;
+                                r2 += dx[idim] * dx[idim];
+                            }
+                            if (r2 >= rcut2 or r2 == 0.0)
+                                continue;
+                            const double r = std::sqrt(r2);
+                            double rN = r;
+                            for (int idim = 1; idim < N; idim++)
+                                rN *= r;
+                            const double fac = norm * short_range_force_factor(r / split, N) / rN;
+                            for (int idim = 0; idim < N; idim++)
+                                f[idim] += fac * dx[idim];
+                        }
+                        for (int idim = 0; idim < N; idim++)
+                            force[idim][p1.index] += f[idim];
+                    }
+                }
+            }
+        }
+
+        //===================================================================================
+        /// @brief Add the short range (P3M) part of the force to the velocities \f$ v_{\rm new} = v - F \Delta t \f$
+        /// (the same as KickParticles does for the PM force). Does nothing if the short range force is not turned
+        /// on (see set_fiducial_short_range_force).
         ///
-        /// @tparam N The dimension of the grid
+        /// @tparam N The dimension of the particles
         /// @tparam T The particle class
         ///
-        /// @param[out] p Pointer to the first particle.
-        /// @param[in] NumPart The number of local particles.
+        /// @param[out] part MPIParticles containing the particles.
+        /// @param[in] Nmesh The gridsize used for the PM force.
         /// @param[in] delta_time The size of the timestep.
-        /// @param[in] periodic_box Is the box periodic?
+        /// @param[in] norm_poisson_equation The prefactor (norm) to the Poisson equation.
         ///
         //===================================================================================
         template <int N, class T>
-        void DriftParticles(T * p, size_t NumPart, double delta_time, bool periodic_box) {
-            if (NumPart == 0)
-                return;
-            if (delta_time == 0.0)
+        void KickParticlesShortRange(MPIParticles<T> & part,
+                                     int Nmesh,
+                                     double delta_time,
+                                     double norm_poisson_equation) {
+            if (FIDUCIAL_SHORT_RANGE_FORCE_SPLIT == 0.0 or delta_time == 0.0)
                 return;
-
-            // Sanity check on particle
-            assert_mpi(FML::PARTICLE::GetNDIM(T()) == N,
-                       "[DriftParticles] NDIM of particles and of grid does not match");
-            static_assert(FML::PARTICLE::has_get_pos<T>(),
-                          "[DriftParticles] Particle class must have a get_pos method to use this method");
             static_assert(FML::PARTICLE::has_get_vel<T>(),
-                          "[DriftParticles] Particle class must have a get_vel method to use this method");
+                          "[KickParticlesShortRange] Particle must have velocity to use this method");
 
-            double max_disp = 0.0;
+            std::array<std::vector<FML::GRID::FloatType>, N> force;
+            compute_short_range_force<N, T>(part.get_particles_ptr(),
+                                            part.get_npart(),
+                                            part.get_npart_total(),
+                                            Nmesh,
+                                            norm_poisson_equation,
+                                            force);
+
+            auto * p = part.get_particles_ptr();
+            const size_t NumPart = part.get_npart();
+            // If the particles store the velocity inside them we can kick them as a strided array
+            size_t vel_stride = 0;
+            auto * vel_block = get_strided_field<FML::PARTICLE::ParticleFieldKind::Vel>(p, vel_stride);
+
+            double max_dvel = 0.0;
+            if (vel_block) {
+                std::array<const FML::GRID::FloatType *, N> force_ptr;
+                for (int idim = 0; idim < N; idim++)
+                    force_ptr[idim] = force[idim].data();
+                max_dvel = kick_block<N>(vel_block, vel_stride, force_ptr, NumPart, delta_time);
+            } else {
 #ifdef USE_OMP
-#pragma omp parallel for reduction(max : max_disp)
+#pragma omp parallel for reduction(max : max_dvel)
 #endif
-            for (size_t i = 0; i < NumPart; i++) {
-                auto * pos = FML::PARTICLE::GetPos(p[i]);
-                auto * vel = FML::PARTICLE::GetVel(p[i]);
-                for (int idim = 0; idim < N; idim++) {
-                    double disp = vel[idim] * delta_time;
-                    pos[idim] += disp;
-                    max_disp = std::max(max_disp, std::abs(disp));
-
-                    // Periodic wrap
-                    if (periodic_box) {
-                        if (pos[idim] >= 1.0)
-                            pos[idim] -= 1.0;
-                        if (pos[idim] < 0.0)
-                            pos[idim] += 1.0;
+                for (size_t i = 0; i < NumPart; i++) {
+                    auto * vel = FML::PARTICLE::GetVel(p[i]);
+                    for (int idim = 0; idim < N; idim++) {
+                        double dvel = -force[idim][i] * delta_time;
+                        max_dvel = std::max(max_dvel, std::abs(dvel));
+                        vel[idim] += dvel;
                     }
                 }
             }
-            FML::MaxOverTasks(&max_disp);
+
+            FML::MaxOverTasks(&max_dvel);
 
             if (FML::ThisTask == 0)
-                std::cout << "[Drift] Max displacement: " << max_disp << "\n";
+                std::cout << "[KickShortRange] Max delta_vel * delta_time : " << max_dvel * delta_time << "\n";
         }
 
+        // Internal type used for the particles on the zoom grid in KickParticlesZoom
+        template <int N>
+        struct ZoomGridParticle {
+            double pos[N]; // The position in units of the zoom grid
+            int task;      // The task the particle belongs to
+            size_t index;  // The index in the list of zoom particles on that task (SIZE_MAX if only a source)
+            double * get_pos() { return pos; }
+            constexpr int get_ndim() const { return N; }
+        };
+
         //===================================================================================
-        /// @brief This moves the particle velocities according to \f$ v_{\rm new} = v + F \Delta t \f$. This method
-        /// assumes the force is normalized such that \f$ F \Delta t \f$ has the same units as your v.
-        /// If the flag free_force_grids is set in the source then we free up memory of the force grids after we have
-        /// used them. The defalt is false.
+        /// @brief Replace the short range part of the PM force by the one from a finer zoom grid for the particles
+        /// in the zoom region (see set_fiducial_zoom_region) by adding \f$ v_{\rm new} = v - (F^{\rm zoom}_{\rm short}
+        /// - F^{\rm global}_{\rm short})\Delta t \f$ to the normal PM kick. The short range part is the force with the
+        /// filter 1 - exp(-k^2 r_s^2) on both grids. The particles within the cutoff of the zoom region are moved to
+        /// the tasks that has their slice of the zoom grid and the force is sent back to the tasks that has the
+        /// particles. The zoom grid has the period of the zoom region plus twice the cutoff so the force from the
+        /// periodic images is negligible. Does nothing if no zoom region is set. Cannot be combined with the P3M
+        /// short range force.
         ///
-        /// @tparam N The dimension of the grid
+        /// @tparam N The dimension of the particles
         /// @tparam T The particle class
         ///
-        /// @param[in] force_grid Grid containing the force.
+        /// @param[in] density_grid_fourier The density contrast in fourier space (the one used for the PM force).
         /// @param[out] part MPIParticles containing the particles.
         /// @param[in] delta_time The size of the timestep.
-        /// @param[in] interpolation_method The interpolation method for interpolating the force to the particle
-        /// positions.
+        /// @param[in] density_assignment_method The density assignment and interpolation method.
+        /// @param[in] norm_poisson_equation The prefactor (norm) to the Poisson equation.
         ///
         //===================================================================================
         template <int N, class T>
-        void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
-                           MPIParticles<T> & part,
-                           double delta_time,
-                           std::string interpolation_method) {
-            if (delta_time == 0.0)
+        void KickParticlesZoom(const FFTWGrid<N> & density_grid_fourier,
+                               MPIParticles<T> & part,
+                               double delta_time,
+                               std::string density_assignment_method,
+                               double norm_poisson_equation) {
+            if (FIDUCIAL_ZOOM_REGION_CORNER.empty() or delta_time == 0.0)
                 return;
-            KickParticles<N, T>(
-                force_grid, part.get_particles_ptr(), part.get_npart(), delta_time, interpolation_method);
+            static_assert(FML::PARTICLE::has_get_vel<T>(),
+                          "[KickParticlesZoom] Particle must have velocity to use this method");
+            FML::assert_mpi(FIDUCIAL_ZOOM_REGION_CORNER.size() == size_t(N),
+                            "[KickParticlesZoom] The zoom region corner must have one value per dimension");
+            FML::assert_mpi(FIDUCIAL_SHORT_RANGE_FORCE_SPLIT == 0.0,
+                            "[KickParticlesZoom] The zoom force cannot be combined with the short range (P3M) force");
+            using Point = ZoomGridParticle<N>;
+
+            // The split and cutoff in units of the box and the period of the zoom grid
+            const int Nmesh = density_grid_fourier.get_nmesh();
+            const int Nmesh_zoom = FIDUCIAL_ZOOM_NMESH;
+            const double split = FIDUCIAL_ZOOM_FORCE_SPLIT / double(Nmesh);
+            const double pad = FIDUCIAL_ZOOM_FORCE_CUTOFF * split;
+            const double size = FIDUCIAL_ZOOM_REGION_SIZE;
+            const double period = size + 2.0 * pad;
+            FML::assert_mpi(period < 1.0, "[KickParticlesZoom] The zoom region plus the cutoff is larger than the box");
+            FML::assert_mpi(Nmesh_zoom > period * Nmesh,
+                            "[KickParticlesZoom] The zoom grid is not finer than the global grid");
+
+            // Find the particles within the cutoff of the zoom region (the sources) and those inside it (the targets)
+            auto * p = part.get_particles_ptr();
+            const size_t NumPart = part.get_npart();
+            std::vector<Point> sources;
+            std::vector<Point> targets;
+            std::vector<size_t> target_index;
+            for (size_t i = 0; i < NumPart; i++) {
+                const auto * pos = FML::PARTICLE::GetPos(p[i]);
+                Point point;
+                bool is_source = true;
+                bool is_target = true;
+                for (int idim = 0; idim < N; idim++) {
+                    double u = pos[idim] - FIDUCIAL_ZOOM_REGION_CORNER[idim] + pad;
+                    u -= std::floor(u);
+                    is_source = is_source and u < period;
+                    is_target = is_target and u >= pad and u < pad + size;
+                    point.pos[idim] = u / period;
+                }
+                if (not is_source)
+                    continue;
+                point.task = FML::ThisTask;
+                point.index = is_target ? targets.size() : SIZE_MAX;
+                sources.push_back(point);
+                if (is_target) {
+                    Point target;
+                    for (int idim = 0; idim < N; idim++)
+                        target.pos[idim] = pos[idim];
+                    targets.push_back(target);
+                    target_index.push_back(i);
+                }
+            }
+
+            // The global short range force at the targets
+            const double split2 = split * split;
+            std::array<FFTWGrid<N>, N> force_grid;
+            compute_force_from_density_fourier<N>(
+                density_grid_fourier, force_grid, density_assignment_method, norm_poisson_equation, [=](double kmag2) {
+                    return 1.0 - std::exp(-kmag2 * split2);
+                });
+            for (auto & g : force_grid)
+                g.set_fourier_layout_transposed(false);
+            std::array<std::vector<FML::GRID::FloatType>, N> force_global;
+            FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, Point>(
+                force_grid, targets.data(), targets.size(), force_global, density_assignment_method);
+            for (auto & g : force_grid)
+                g.free();
+
+            // Move the sources to the tasks that has their slice of the zoom grid
+            auto nleftright = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(density_assignment_method);
+            FFTWGrid<N> density_zoom(Nmesh_zoom, nleftright.first, nleftright.second);
+            density_zoom.add_memory_label("FFTWGrid::KickParticlesZoom::density_zoom");
+            size_t nmax = sources.size();
+            FML::MaxOverTasks(&nmax);
+            MPIParticles<Point> zoom_part;
+            zoom_part.create(sources.data(),
+                             sources.size(),
+                             size_t(1.25 * double(nmax)) + 1,
+                             density_zoom.get_local_x_start() / double(Nmesh_zoom),
+                             (density_zoom.get_local_x_start() + density_zoom.get_local_nx()) / double(Nmesh_zoom),
+                             false);
+            std::vector<Point>().swap(sources);
+
+            // The zoom grid has the volume period^N of the box. We assign with the total number of particles in the
+            // box so the density contrast is off by a factor period^N (and a constant which the filter removes)
+            density_zoom.set_grid_status_real(true);
+            FML::INTERPOLATION::particles_to_grid<N, Point>(zoom_part.get_particles_ptr(),
+                                                            zoom_part.get_npart(),
+                                                            part.get_npart_total(),
+                                                            density_zoom,
+                                                            density_assignment_method);
+            density_zoom.set_fourier_layout_transposed(true);
+            density_zoom.fftw_r2c();
+
+            // Lengths are period times smaller in units of the zoom grid so the force in units of the box is the
+            // force on the zoom grid with the norm multiplied by period / period^N
+            const double split_zoom2 = split2 / (period * period);
+            compute_force_from_density_fourier<N>(
+                density_zoom,
+                force_grid,
+                density_assignment_method,
+                norm_poisson_equation * period / std::pow(period, N),
+                [=](double kmag2) { return 1.0 - std::exp(-kmag2 * split_zoom2); });
+            density_zoom.free();
+            for (auto & g : force_grid)
+                g.set_fourier_layout_transposed(false);
+            std::array<std::vector<FML::GRID::FloatType>, N> force_zoom_part;
+            FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, Point>(
+                force_grid, zoom_part.get_particles_ptr(), zoom_part.get_npart(), force_zoom_part, density_assignment_method);
+            for (auto & g : force_grid)
+                g.free();
+
+            // Send the zoom force at the targets back to the tasks they came from as (index, force) pairs
+            const int nsend_per_target = N + 1;
+            std::vector<std::vector<double>> to_task(FML::NTasks);
+            for (size_t i = 0; i < zoom_part.get_npart(); i++) {
+                auto & point = zoom_part[i];
+                if (point.index == SIZE_MAX)
+                    continue;
+                auto & buffer = to_task[point.task];
+                buffer.push_back(double(point.index));
+                for (int idim = 0; idim < N; idim++)
+                    buffer.push_back(force_zoom_part[idim][i]);
+            }
+            zoom_part.free();
+            std::vector<double> send_buffer, recv_buffer;
+            for (auto & buffer : to_task)
+                send_buffer.insert(send_buffer.end(), buffer.begin(), buffer.end());
+#ifdef USE_MPI
+            std::vector<int> n_to_send(FML::NTasks), n_to_recv(FML::NTasks);
+            for (int task = 0; task < FML::NTasks; task++)
+                n_to_send[task] = int(to_task[task].size());
+            MPI_Alltoall(n_to_send.data(), 1, MPI_INT, n_to_recv.data(), 1, MPI_INT, MPI_COMM_WORLD);
+            std::vector<int> send_offset(FML::NTasks, 0), recv_offset(FML::NTasks, 0);
+            for (int task = 1; task < FML::NTasks; task++) {
+                send_offset[task] = send_offset[task - 1] + n_to_send[task - 1];
+                recv_offset[task] = recv_offset[task - 1] + n_to_recv[task - 1];
+            }
+            recv_buffer.resize(recv_offset[FML::NTasks - 1] + n_to_recv[FML::NTasks - 1]);
+            MPI_Alltoallv(send_buffer.data(),
+                          n_to_send.data(),
+                          send_offset.data(),
+                          MPI_DOUBLE,
+                          recv_buffer.data(),
+                          n_to_recv.data(),
+                          recv_offset.data(),
+                          MPI_DOUBLE,
+                          MPI_COMM_WORLD);
+#else
+            recv_buffer = std::move(send_buffer);
+#endif
+            FML::assert_mpi(recv_buffer.size() == targets.size() * nsend_per_target,
+                            "[KickParticlesZoom] Did not get the zoom force for all the particles in the zoom region");
+
+            // Kick the targets with the difference between the zoom and the global short range force
+            double max_dvel = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_dvel)
+#endif
+            for (size_t j = 0; j < targets.size(); j++) {
+                const double * recv = recv_buffer.data() + j * nsend_per_target;
+                const size_t itarget = size_t(recv[0]);
+                auto * vel = FML::PARTICLE::GetVel(p[target_index[itarget]]);
+                for (int idim = 0; idim < N; idim++) {
+                    double dvel = -(recv[idim + 1] - force_global[idim][itarget]) * delta_time;
+                    max_dvel = std::max(max_dvel, std::abs(dvel));
+                    vel[idim] += dvel;
+                }
+            }
+
+            FML::MaxOverTasks(&max_dvel);
+            size_t ntargets = targets.size();
+            FML::SumOverTasks(&ntargets);
+
+            if (FML::ThisTask == 0)
+                std::cout << "[KickZoom] Particles in zoom region: " << ntargets
+                          << " Max delta_vel * delta_time : " << max_dvel * delta_time << "\n";
         }
 
         //===================================================================================
-        /// @brief This moves the particle velocities according to \f$ v_{\rm new} = v + F \Delta t \f$. This method
-        /// assumes the force is normalized such that \f$ F \Delta t \f$ has the same units as your v.
-        /// If the flag free_force_grids is set in the source then we free up memory of the force grids after we have
-        /// used them. The defalt is false.
+        /// @brief Take a N-body step with a Kick-Drift-Kick method with hierarchical (block) time-steps for the
+        /// short range force (see set_fiducial_short_range_force). The PM force is only computed at the start and
+        /// the end of the step (as in KickDriftKickNBodyStep) while the particles are binned by their short range
+        /// acceleration into levels L = 0, 1, ..., max_level with time-step delta_time / 2^L and only the particles
+        /// on a level that is active gets a new short range force. All particles are drifted every sub-step
+        /// (delta_time / 2^max_level). The time-step criterion is \f$ \Delta t_i = \sqrt{2\eta r_s / |a_i|} \f$
+        /// with \f$ a_i \f$ the short range acceleration at the start of the step.
         ///
-        /// @tparam N The dimension of the grid
-        /// @tparam T The particle class
+        /// The particles are only communicated at the end of the step so they should not move further than the
+        /// short range cutoff out of the local domain during one step.
         ///
-        /// @param[in] force_grid The force \f$ \nabla \Phi \f$.
-        /// @param[out] p Pointer to the first particle.
-        /// @param[in] NumPart The number of local particles.
-        /// @param[in] delta_time The size of the timestep.
-        /// @param[in] interpolation_method The interpolation method for interpolating the force to the particle
-        /// positions.
+        /// @tparam N The dimension of the grid.
+        /// @tparam T The particle class.
+        ///
+        /// @param[in] Nmesh The gridsize to use for computing the density and force.
+        /// @param[out] part The particles
+        /// @param[in] delta_time The time \f$ \Delta t \f$ we move forward.
+        /// @param[in] density_assignment_method The density assignement method (NGP, CIC, TSC, PCS or PQS).
+        /// @param[in] norm_poisson_equation A possible prefactor to the Poisson equation
+        /// @param[in] max_level The maximum level, i.e. the smallest time-step is delta_time / 2^max_level.
+        /// @param[in] eta The accuracy parameter in the time-step criterion.
         ///
         //===================================================================================
         template <int N, class T>
-        void KickParticles(std::array<FFTWGrid<N>, N> & force_grid,
-                           T * p,
-                           size_t NumPart,
-                           double delta_time,
-                           std::string interpolation_method) {
-
-            // Nothing to do if delta_time = 0.0
-            if (delta_time == 0.0)
-                return;
-
-            // Sanity check on particle
-            assert_mpi(FML::PARTICLE::GetNDIM(T()) == N, "[KickParticles] Dimension of particle and grid do not match");
-            static_assert(FML::PARTICLE::has_get_vel<T>(),
-                          "[KickParticles] Particle must have velocity to use this method");
+        void KickDriftKickHierarchicalNBodyStep(int Nmesh,
+                                                MPIParticles<T> & part,
+                                                double delta_time,
+                                                std::string density_assignment_method,
+                                                double norm_poisson_equation,
+                                                int max_level,
+                                                double eta) {
+
+            FML::assert_mpi(FIDUCIAL_SHORT_RANGE_FORCE_SPLIT > 0.0,
+                            "[KickDriftKickHierarchicalNBodyStep] The short range force is not turned on");
+            FML::assert_mpi(max_level >= 0 and max_level < 30,
+                            "[KickDriftKickHierarchicalNBodyStep] max_level must be in [0, 30)");
+            const bool periodic_box = true;
 
-            // Deallocate the force grids (after interpolating to the particles we don't need it here and probably
-            // not elsewhere so lets save some memory)
-            constexpr bool free_force_grids = false;
+            // The PM (long range) kick of all particles
+            auto nleftright =
+                FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(density_assignment_method);
+            FFTWGrid<N> density_grid_real(Nmesh, nleftright.first, nleftright.second);
+            density_grid_real.add_memory_label("FFTWGrid::KickDriftKickHierarchicalNBodyStep::density_grid_real");
+            auto kick_long_range = [&](double delta_time_kick) {
+                density_grid_real.set_grid_status_real(true);
+                FML::INTERPOLATION::particles_to_grid<N, T>(part.get_particles_ptr(),
+                                                            part.get_npart(),
+                                                            part.get_npart_total(),
+                                                            density_grid_real,
+                                                            density_assignment_method);
+                std::array<FFTWGrid<N>, N> force_real;
+                compute_force_from_density_real<N>(
+                    density_grid_real, force_real, density_assignment_method, norm_poisson_equation);
+                KickParticles<N, T>(force_real, part, delta_time_kick, density_assignment_method);
+            };
 
-            // Interpolate force to particle positions
-            for (int idim = 0; idim < N; idim++) {
-                force_grid[idim].communicate_boundaries();
-            }
+            // The short range kick of the particles that are active
             std::array<std::vector<FML::GRID::FloatType>, N> force;
-            FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, T>(
-                force_grid, p, NumPart, force, interpolation_method);
-            if (free_force_grids) {
-                for (int idim = 0; idim < N; idim++) {
-                    force_grid[idim].free();
+            auto kick_short_range = [&](const std::vector<double> & delta_time_kick) {
+                auto * p = part.get_particles_ptr();
+                const size_t NumPart = part.get_npart();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < NumPart; i++) {
+                    auto * vel = FML::PARTICLE::GetVel(p[i]);
+                    for (int idim = 0; idim < N; idim++)
+                        vel[idim] -= force[idim][i] * delta_time_kick[i];
                 }
-            }
+            };
 
-            double max_dvel = 0.0;
+            kick_long_range(delta_time * 0.5);
+
+            //=============================================================
+            // Assign the particles to levels from the short range acceleration
+            //=============================================================
+            const size_t NumPart = part.get_npart();
+            const double split = FIDUCIAL_SHORT_RANGE_FORCE_SPLIT / double(Nmesh);
+            compute_short_range_force<N, T>(
+                part.get_particles_ptr(), NumPart, part.get_npart_total(), Nmesh, norm_poisson_equation, force);
+            std::vector<int> level(NumPart);
 #ifdef USE_OMP
-#pragma omp parallel for reduction(max : max_dvel)
+#pragma omp parallel for
 #endif
             for (size_t i = 0; i < NumPart; i++) {
-                auto * vel = FML::PARTICLE::GetVel(p[i]);
-                for (int idim = 0; idim < N; idim++) {
-                    double dvel = -force[idim][i] * delta_time;
-                    max_dvel = std::max(max_dvel, std::abs(dvel));
-                    vel[idim] += dvel;
-                }
+                double acc2 = 0.0;
+                for (int idim = 0; idim < N; idim++)
+                    acc2 += force[idim][i] * force[idim][i];
+                const double dt = acc2 > 0.0 ? std::sqrt(2.0 * eta * split / std::sqrt(acc2)) : delta_time;
+                const int L = dt >= delta_time ? 0 : int(std::ceil(std::log2(delta_time / dt)));
+                level[i] = std::min(L, max_level);
             }
 
-            FML::MaxOverTasks(&max_dvel);
+            std::vector<long long> nlevel(max_level + 1, 0);
+            for (auto L : level)
+                nlevel[L]++;
+            FML::SumArrayOverTasks(nlevel.data(), max_level + 1);
+            int max_level_used = 0;
+            for (int L = 0; L <= max_level; L++)
+                if (nlevel[L] > 0)
+                    max_level_used = L;
+            if (FML::ThisTask == 0) {
+                std::cout << "[KickDriftKickHierarchicalNBodyStep] Particles per level:";
+                for (int L = 0; L <= max_level_used; L++)
+                    std::cout << " " << nlevel[L];
+                std::cout << "\n";
+            }
 
-            if (FML::ThisTask == 0)
-                std::cout << "[Kick] Max delta_vel * delta_time : " << max_dvel * delta_time << "\n";
+            //=============================================================
+            // Take the sub-steps. A particle on level L gets a kick every 2^(max_level_used - L) sub-steps
+            //=============================================================
+            const int nsub = 1 << max_level_used;
+            const double delta_time_sub = delta_time / double(nsub);
+            std::vector<double> delta_time_kick(NumPart);
+            std::vector<char> active(NumPart);
+            for (size_t i = 0; i < NumPart; i++)
+                delta_time_kick[i] = 0.5 * delta_time / double(1 << level[i]);
+            kick_short_range(delta_time_kick);
+
+            for (int isub = 1; isub <= nsub; isub++) {
+                DriftParticles<N, T>(part.get_particles_ptr(), NumPart, delta_time_sub, periodic_box);
+
+                // The last kick of a step and the first of the next step are combined
+                for (size_t i = 0; i < NumPart; i++) {
+                    const int stride = 1 << (max_level_used - level[i]);
+                    active[i] = isub % stride == 0;
+                    const double delta_time_level = delta_time / double(1 << level[i]);
+                    delta_time_kick[i] = active[i] ? (isub == nsub ? 0.5 : 1.0) * delta_time_level : 0.0;
+                }
+                compute_short_range_force<N, T>(part.get_particles_ptr(),
+                                                NumPart,
+                                                part.get_npart_total(),
+                                                Nmesh,
+                                                norm_poisson_equation,
+                                                force,
+                                                &active);
+                kick_short_range(delta_time_kick);
+            }
+
+            // Move the particles to the right tasks and do the final PM kick
+            part.communicate_particles();
+            kick_long_range(delta_time * 0.5);
         }
 
         template <int N, class T>
@@ -819,25 +2349,29 @@ namespace FML {
 
             //================================================================
             // Function to compute the displacement from a LPT potential
+            // We do one component at a time reusing the same grid so we only
+            // need one grid on top of phi_nLPT instead of N
             // Frees the memory of phi_nLPT after its used
             //================================================================
             auto comp_displacement = [&]([[maybe_unused]] int nLPT,
                                          FFTWGrid<N> & phi_nLPT,
                                          std::array<std::vector<FML::GRID::FloatType>, N> & displacements_nLPT) {
-                // Generate Psi from phi
-                std::array<FFTWGrid<N>, N> Psi_nLPT_vector;
-                FML::COSMOLOGY::LPT::from_LPT_potential_to_displacement_vector<N>(phi_nLPT, Psi_nLPT_vector);
+                FFTWGrid<N> Psi_nLPT;
                 for (int idim = 0; idim < N; idim++) {
-                    Psi_nLPT_vector[idim].communicate_boundaries();
+                    // Generate Psi_i from phi
+                    FML::COSMOLOGY::LPT::from_LPT_potential_to_displacement_component<N>(phi_nLPT, idim, Psi_nLPT);
+                    auto halo_exchange = Psi_nLPT.communicate_boundaries_async();
+                    if (idim == N - 1)
+                        phi_nLPT.free();
+                    halo_exchange.wait();
+
+                    // Interpolate it to particle Lagrangian positions
+                    FML::INTERPOLATION::interpolate_grid_to_particle_positions<N, T>(Psi_nLPT,
+                                                                                     part.get_particles_ptr(),
+                                                                                     part.get_npart(),
+                                                                                     displacements_nLPT[idim],
+                                                                                     interpolation_method);
                 }
-                phi_nLPT.free();
-
-                // Interpolate it to particle Lagrangian positions
-                FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, T>(Psi_nLPT_vector,
-                                                                                        part.get_particles_ptr(),
-                                                                                        part.get_npart(),
-                                                                                        displacements_nLPT,
-                                                                                        interpolation_method);
             };
 
             auto add_displacement = [&]([[maybe_unused]] int nLPT,
@@ -869,10 +2403,7 @@ namespace FML {
                         pos[idim] += dpos_nLPT;
 
                         // Periodic BC
-                        if (pos[idim] >= 1.0)
-                            pos[idim] -= 1.0;
-                        if (pos[idim] < 0.0)
-                            pos[idim] += 1.0;
+                        FML::PARTICLE::wrap_periodic(pos[idim]);
 
                         // Compute maximum displacement
                         if (std::fabs(dpos_nLPT) > max_disp_nLPT)
@@ -1065,6 +2596,213 @@ namespace FML {
             part.communicate_particles();
         }
 
+        //=====================================================================
+        /// @brief Generate initial conditions with Lagrangian perturbation theory without ever having all the
+        /// particles in memory (e.g. to write IC files larger than what we can hold). The LPT potentials are
+        /// combined into the potential of the displacement and of the velocity (in fourier space) and we make the
+        /// N grids of each. The Lagrangian lattice slices of the current task (the ones create_particle_grid gives)
+        /// are then gone through in nchunks chunks: we make the particles of the chunk at q, move them to q + Psi(q),
+        /// set the velocity and hand them to output_chunk. The particles are not communicated so every chunk
+        /// has the particles of the lattice slices of the task (i.e. close to the local domain). We only set the
+        /// position, velocity, ID (the index in the lattice) and mass (1.0) of the particles.
+        ///
+        /// Only the particles are streamed, the grids are not. Memory: while the potentials are made we hold one
+        /// grid per LPT potential (plus the temporaries of compute_2LPT/3LPT_potential_fourier) and then the N
+        /// displacement grids and (if the particles have a velocity) the N velocity grids stay allocated while we
+        /// go through the chunks. After the potentials are made the peak is 2N + 1 grids (N + 1 without velocities)
+        /// on top of delta_fourier and one chunk of particles. Compared to NBodyInitialConditions we save the memory
+        /// of all but one chunk of the particles, not that of the grids.
+        ///
+        /// @tparam N The dimension we are working in.
+        /// @tparam T The particle class. Must have a get_pos method.
+        ///
+        /// @param[in] Npart_1D Number of particles per dimension (i.e. total is \f$ {\rm Npart}_{\rm 1D}^N \f$)
+        /// @param[in] delta_fourier The initial density field \f$ \delta(k,z_{\rm ini})\f$ in fourier space
+        /// @param[in] LPT_order The LPT order (1, 2 or 3)
+        /// @param[in] velocity_norms The factors we need to multiply the nLPT displacement fields by to get
+        /// velocities (see NBodyInitialConditions). The order is: 1LPT, 2LPT, 3LPTa, 3LPTb
+        /// @param[in] nchunks The number of chunks of the lattice to go through (the same on all tasks).
+        /// @param[in] output_chunk Called as output_chunk(part, NumPart, NumPartLocal) for every chunk with the
+        /// NumPart particles in the chunk. NumPartLocal is the number of particles the task gets in total.
+        ///
+        //=====================================================================
+        template <int N, class T>
+        void NBodyInitialConditionsStreamed(int Npart_1D,
+                                            const FFTWGrid<N> & delta_fourier,
+                                            int LPT_order,
+                                            std::vector<double> velocity_norms,
+                                            int nchunks,
+                                            std::function<void(T *, size_t, size_t)> output_chunk) {
+
+            // Sanity checks
+            const auto Nmesh = delta_fourier.get_nmesh();
+            assert_mpi(Nmesh > 0, "[NBodyInitialConditionsStreamed] delta_fourier has to be already allocated");
+            assert_mpi(LPT_order == 1 or LPT_order == 2 or LPT_order == 3,
+                       "[NBodyInitialConditionsStreamed] Only 1LPT, 2LPT and 3LPT implemented");
+            assert_mpi(int(velocity_norms.size()) >= (LPT_order == 3 ? 4 : LPT_order),
+                       "[NBodyInitialConditionsStreamed] We need a velocity norm for every LPT potential");
+            assert_mpi(nchunks >= 1, "[NBodyInitialConditionsStreamed] We need nchunks >= 1");
+            const std::string interpolation_method = "CIC";
+            const auto nextra_cic =
+                FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(interpolation_method);
+            assert_mpi(delta_fourier.get_n_extra_slices_left() >= nextra_cic.first and
+                           delta_fourier.get_n_extra_slices_right() >= nextra_cic.second,
+                       "[NBodyInitialConditionsStreamed] We use CIC interpolation in this routine so the grid needs to "
+                       "have atleast one extra slice on the right");
+            assert_mpi(FML::PARTICLE::GetNDIM(T()) == N,
+                       "[NBodyInitialConditionsStreamed] NDIM of particles and of grid does not match");
+            static_assert(FML::PARTICLE::has_get_pos<T>(),
+                          "[NBodyInitialConditionsStreamed] Particle class must have a get_pos method");
+            constexpr bool has_vel = FML::PARTICLE::has_get_vel<T>();
+
+            // The LPT potentials
+            FFTWGrid<N> phi_1LPT;
+            FFTWGrid<N> phi_2LPT;
+            FFTWGrid<N> phi_3LPTa;
+            FFTWGrid<N> phi_3LPTb;
+            if (LPT_order == 1) {
+                FML::COSMOLOGY::LPT::compute_1LPT_potential_fourier(delta_fourier, phi_1LPT);
+            } else if (LPT_order == 2) {
+                FML::COSMOLOGY::LPT::compute_1LPT_potential_fourier(delta_fourier, phi_1LPT);
+                FML::COSMOLOGY::LPT::compute_2LPT_potential_fourier(delta_fourier, phi_2LPT);
+            } else if (LPT_order == 3) {
+                // We ignore the curl term as in NBodyInitialConditions
+                const bool ignore_3LPT_curl_term = true;
+                std::array<FFTWGrid<N>, N> phi_3LPT_Avec_fourier;
+                FML::COSMOLOGY::LPT::compute_3LPT_potential_fourier<N>(delta_fourier,
+                                                                       phi_1LPT,
+                                                                       phi_2LPT,
+                                                                       phi_3LPTa,
+                                                                       phi_3LPTb,
+                                                                       phi_3LPT_Avec_fourier,
+                                                                       ignore_3LPT_curl_term);
+            }
+
+            // Combine them into the potential of the displacement (in phi_1LPT) and of the velocity
+            std::vector<std::pair<FFTWGrid<N> *, double>> potentials{{&phi_1LPT, velocity_norms[0]}};
+            if (LPT_order >= 2)
+                potentials.push_back({&phi_2LPT, velocity_norms[1]});
+            if (LPT_order >= 3) {
+                potentials.push_back({&phi_3LPTa, velocity_norms[2]});
+                potentials.push_back({&phi_3LPTb, velocity_norms[3]});
+            }
+            FFTWGrid<N> phi_vel;
+            if (has_vel) {
+                phi_vel = phi_1LPT;
+                phi_vel.add_memory_label("FFTWGrid::NBodyInitialConditionsStreamed::phi_vel");
+            }
+            const auto Local_nx = phi_1LPT.get_local_nx();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                for (auto && fourier_index : phi_1LPT.get_fourier_range(islice, islice + 1)) {
+                    auto disp = phi_1LPT.get_fourier_from_index(fourier_index);
+                    auto vel = disp * FML::GRID::FloatType(potentials[0].second);
+                    for (size_t i = 1; i < potentials.size(); i++) {
+                        const auto value = potentials[i].first->get_fourier_from_index(fourier_index);
+                        disp += value;
+                        vel += value * FML::GRID::FloatType(potentials[i].second);
+                    }
+                    phi_1LPT.set_fourier_from_index(fourier_index, disp);
+                    if (has_vel)
+                        phi_vel.set_fourier_from_index(fourier_index, vel);
+                }
+            }
+            for (size_t i = 1; i < potentials.size(); i++)
+                potentials[i].first->free();
+
+            // The displacement and velocity fields (with the boundaries for the interpolation)
+            auto grids_from_potential = [&](FFTWGrid<N> & phi, std::array<FFTWGrid<N>, N> & grids) {
+                for (int idim = 0; idim < N; idim++) {
+                    FML::COSMOLOGY::LPT::from_LPT_potential_to_displacement_component<N>(phi, idim, grids[idim]);
+                    grids[idim].communicate_boundaries();
+                }
+                phi.free();
+            };
+            std::array<FFTWGrid<N>, N> Psi;
+            std::array<FFTWGrid<N>, N> Vel;
+            grids_from_potential(phi_1LPT, Psi);
+            if (has_vel)
+                grids_from_potential(phi_vel, Vel);
+
+            // The lattice slices on this task (the ones create_particle_grid gives us)
+            int imin = 0;
+            while (imin / double(Npart_1D) < FML::xmin_domain)
+                imin++;
+            int imax = imin;
+            while (imax / double(Npart_1D) < FML::xmax_domain)
+                imax++;
+            const size_t npart_per_slice = size_t(FML::power(Npart_1D, N - 1));
+            const size_t npart_local = (imax - imin) * npart_per_slice;
+
+            double max_disp = 0.0;
+            double max_vel = 0.0;
+            for (int ichunk = 0; ichunk < nchunks; ichunk++) {
+                const int ix_start = imin + (imax - imin) * ichunk / nchunks;
+                const int ix_end = imin + (imax - imin) * (ichunk + 1) / nchunks;
+                const size_t npart_chunk = (ix_end - ix_start) * npart_per_slice;
+
+                // The particles at q
+                std::vector<T> chunk(npart_chunk);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < npart_chunk; i++) {
+                    const size_t id = ix_start * npart_per_slice + i;
+                    auto * pos = FML::PARTICLE::GetPos(chunk[i]);
+                    FML::PARTICLE::lagrangian_position_from_id<N>(id, Npart_1D, pos);
+                    if constexpr (FML::PARTICLE::has_set_id<T>())
+                        FML::PARTICLE::SetID(chunk[i], id);
+                    if constexpr (FML::PARTICLE::has_set_mass<T>())
+                        FML::PARTICLE::SetMass(chunk[i], 1.0);
+                }
+
+                // Set the velocity and move them to x = q + Psi(q)
+                std::array<std::vector<FML::GRID::FloatType>, N> values;
+                if constexpr (has_vel) {
+                    FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, T>(
+                        Vel, chunk.data(), npart_chunk, values, interpolation_method);
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_vel)
+#endif
+                    for (size_t i = 0; i < npart_chunk; i++) {
+                        auto * vel = FML::PARTICLE::GetVel(chunk[i]);
+                        for (int idim = 0; idim < N; idim++) {
+                            vel[idim] = values[idim][i];
+                            max_vel = std::max(max_vel, std::fabs(double(values[idim][i])));
+                        }
+                    }
+                }
+                FML::INTERPOLATION::interpolate_grid_vector_to_particle_positions<N, T>(
+                    Psi, chunk.data(), npart_chunk, values, interpolation_method);
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_disp)
+#endif
+                for (size_t i = 0; i < npart_chunk; i++) {
+                    auto * pos = FML::PARTICLE::GetPos(chunk[i]);
+                    for (int idim = 0; idim < N; idim++) {
+                        pos[idim] += values[idim][i];
+                        FML::PARTICLE::wrap_periodic(pos[idim]);
+                        max_disp = std::max(max_disp, std::fabs(double(values[idim][i])));
+                    }
+                }
+                for (auto & v : values) {
+                    v.clear();
+                    v.shrink_to_fit();
+                }
+
+                output_chunk(chunk.data(), npart_chunk, npart_local);
+            }
+
+            // Output the maximum displacment and velocity (in units of the box)
+            FML::MaxOverTasks(&max_disp);
+            FML::MaxOverTasks(&max_vel);
+            if (FML::ThisTask == 0)
+                std::cout << "[NBodyInitialConditionsStreamed] Maximum displacement: " << max_disp
+                          << " Maximum velocity: " << max_vel << " (code units)\n";
+        }
+
         //===================================================================================
         /// @brief This method computes the fifth-force potential for modified gravity models using the linear
         /// approximation This computes \f$ \delta_{\rm MG}(k) \f$ where the total force in fourier space is
@@ -1128,6 +2866,10 @@ namespace FML {
         /// \f$ [0,1] \f$ and go to 1 for \f$ \Phi_N \to 0 \f$ and 0 for very large \f$ \Phi_N \f$
         /// @param[in] poisson_norm The factor \f$ C \f$ in \f$ \nabla^2\Phi = C\delta \f$ to get the potential in the
         /// metric (not the code-potential) so \f$ C = \frac{3}{2}\Omega_M a \frac{(H_0B)^2}{a^2} \f$
+        /// @param[in] smoothing_scale Optional smoothing radius (in units of the boxsize) of the Newtonian potential
+        /// used in the screening factor. Removes the grid-scale noise in \f$ \Phi_N \f$ that otherwise leaks into
+        /// the screening of the smallest resolved objects.
+        /// @param[in] smoothing_method The k-space smoothing filter (gaussian, tophat, sharpk).
         ///
         //===================================================================================
         template <int N>
@@ -1136,7 +2878,9 @@ namespace FML {
             FFTWGrid<N> & density_mg_fourier,
             std::function<double(double)> coupling_factor_of_kBox,
             std::function<double(double)> screening_factor_of_newtonian_potential,
-            double poisson_norm) {
+            double poisson_norm,
+            double smoothing_scale = 0.0,
+            std::string smoothing_method = "gaussian") {
 
             const auto Local_nx = density_fourier.get_local_nx();
             const auto Local_x_start = density_fourier.get_local_x_start();
@@ -1165,6 +2909,10 @@ namespace FML {
             if (Local_x_start == 0)
                 density_mg_fourier.set_fourier_from_index(0, 0.0);
 
+            // Smooth the potential
+            if (smoothing_scale > 0.0)
+                FML::GRID::smoothing_filter_fourier_space(density_mg_fourier, smoothing_scale, smoothing_method);
+
             // Take another copy of the density field as we need it in real space
             auto delta_real = density_fourier;
 
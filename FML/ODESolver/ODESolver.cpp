@@ -55,6 +55,15 @@ namespace FML {
             ODESolver::ODESolver(double hstart, double abserr, double relerr)
                 : hstart(hstart), abserr(abserr), relerr(relerr) {}
 
+            ODESolver::~ODESolver() { free_driver(); }
+
+            void ODESolver::free_driver() {
+                if (ode_driver)
+                    gsl_odeiv2_driver_free(ode_driver);
+                ode_driver = nullptr;
+                driver_stepper = nullptr;
+            }
+
             void ODESolver::solve(ODEFunction & ode_equation,
                                   DVector & xarr,
                                   DVector & yinitial,
@@ -89,10 +98,22 @@ namespace FML {
                 // Are we integrating forward or backward?
                 double sign = xarr[1] > xarr[0] ? 1.0 : -1.0;
 
-                // Set up the ODE system
-                gsl_odeiv2_system ode_system = {ode_equation, jacobian, size_t(yinitial.size()), parameters};
-                gsl_odeiv2_driver * ode_driver =
-                    gsl_odeiv2_driver_alloc_y_new(&ode_system, stepper, std::abs(hstart) * sign, abserr, relerr);
+                // Set up the ODE system. The driver only keeps a pointer to ode_system so if we
+                // already have a driver of the right type we just reset it and reuse the workspace
+                const bool reuse_driver = ode_driver != nullptr and driver_stepper == stepper and
+                                          ode_system.dimension == size_t(nequations) and driver_abserr == abserr and
+                                          driver_relerr == relerr;
+                ode_system = {ode_equation, jacobian, size_t(nequations), parameters};
+                if (reuse_driver) {
+                    gsl_odeiv2_driver_reset_hstart(ode_driver, std::abs(hstart) * sign);
+                } else {
+                    free_driver();
+                    ode_driver =
+                        gsl_odeiv2_driver_alloc_y_new(&ode_system, stepper, std::abs(hstart) * sign, abserr, relerr);
+                    driver_stepper = stepper;
+                    driver_abserr = abserr;
+                    driver_relerr = relerr;
+                }
 
                 // Initialize with the initial condition
                 double x = xarr[0];
@@ -146,7 +167,43 @@ namespace FML {
                     data[i] = y;
                     derivative_data[i] = dydx;
                 }
-                gsl_odeiv2_driver_free(ode_driver);
+            }
+
+            std::vector<DVector2D> ODESolver::solve_many(const ODEFunctionBatch & ode_equation,
+                                                         int nsystems,
+                                                         DVector & xarr,
+                                                         std::vector<DVector> & yinitial,
+                                                         const gsl_odeiv2_step_type * stepper,
+                                                         std::vector<DVector2D> * derivative_data) const {
+                if (int(yinitial.size()) != nsystems) {
+                    std::string errormessage = "[ODESolver::solve_many] We need one yinitial per system\n";
+                    throw_error(errormessage);
+                }
+
+                std::vector<DVector2D> result(nsystems);
+                if (derivative_data)
+                    *derivative_data = std::vector<DVector2D>(nsystems);
+
+#ifdef USE_OMP
+#pragma omp parallel
+#endif
+                {
+                    // One solver (and GSL workspace) per thread
+                    ODESolver ode(hstart, abserr, relerr);
+#ifdef USE_OMP
+#pragma omp for schedule(dynamic, 1)
+#endif
+                    for (int isystem = 0; isystem < nsystems; isystem++) {
+                        ODEFunction deriv = [&](double x, const double * y, double * dydx) {
+                            return ode_equation(isystem, x, y, dydx);
+                        };
+                        ode.solve(deriv, xarr, yinitial[isystem], stepper);
+                        result[isystem] = std::move(ode.data);
+                        if (derivative_data)
+                            (*derivative_data)[isystem] = std::move(ode.derivative_data);
+                    }
+                }
+                return result;
             }
 
             void ODESolver::set_verbose(bool onoff) { verbose = onoff; }
@@ -13,6 +13,10 @@
 #include <mpi.h>
 #endif
 
+#ifdef USE_OMP
+#include <omp.h>
+#endif
+
 namespace FML {
 
     /// This nanespace contains various solvers
@@ -32,6 +36,7 @@ namespace FML {
             using ODEFunctionPointerJacobian = int (*)(double, const double[], double[], double[], void *);
             using ODEFunction = std::function<int(double, const double *, double *)>;
             using ODEFunctionJacobian = std::function<int(double, const double *, double *, double *)>;
+            using ODEFunctionBatch = std::function<int(int, double, const double *, double *)>;
 
             extern ODEFunctionJacobian * no_jacobian_ptr;
 
@@ -63,6 +68,12 @@ namespace FML {
             /// auto solution = ode.get_data();
             ///---------------------------------------------------
             ///
+            /// The GSL driver (stepper, step-size control and evolve workspace)
+            /// is kept between calls to solve, so reusing the same object for
+            /// many systems of the same size avoids reallocating it each time.
+            /// For many independent systems use solve_many which integrates them
+            /// in parallel with one such workspace per thread.
+            ///
             /// Choices of steppers (fiducial one set below):
             /// gsl_odeiv2_step_rk2;
             /// gsl_odeiv2_step_rk4;
@@ -99,6 +110,15 @@ namespace FML {
                 std::vector<DVector> data{};
                 std::vector<DVector> derivative_data{};
 
+                // The GSL driver is reused between calls to solve as long as the
+                // stepper, the accuracy and the number of equations is unchanged
+                gsl_odeiv2_system ode_system{};
+                gsl_odeiv2_driver * ode_driver{nullptr};
+                const gsl_odeiv2_step_type * driver_stepper{nullptr};
+                double driver_abserr{0.0};
+                double driver_relerr{0.0};
+
+                void free_driver();
                 void throw_error(std::string errormessage) const;
 
               public:
@@ -106,6 +126,7 @@ namespace FML {
                 ODESolver(double hstart, double abserr, double relerr);
                 ODESolver(const ODESolver & rhs) = delete;
                 ODESolver & operator=(const ODESolver & rhs) = delete;
+                ~ODESolver();
 
                 void solve(ODEFunctionPointer ode_equation,
                            void * parameters,
@@ -123,6 +144,19 @@ namespace FML {
                            const gsl_odeiv2_step_type * stepper = ODESOLVER_FIDUCIAL_STEPPER,
                            ODEFunctionJacobian & jacobian = *no_jacobian_ptr);
 
+                /// Solve nsystems independent ODEs with the same right hand side (up to the index isystem of the
+                /// system which can be used to look up its parameters) on the same xarr. The initial value for system
+                /// isystem is yinitial[isystem]. The systems are distributed over OpenMP threads with one solver (and
+                /// GSL workspace) per thread using the accuracy settings of this object. Returns the solution for
+                /// each system in the same format as get_data(). If derivative_data is not a nullptr we also store
+                /// the derivatives in the same format as get_derivative_data()
+                std::vector<DVector2D> solve_many(const ODEFunctionBatch & ode_equation,
+                                                  int nsystems,
+                                                  DVector & xarr,
+                                                  std::vector<DVector> & yinitial,
+                                                  const gsl_odeiv2_step_type * stepper = ODESOLVER_FIDUCIAL_STEPPER,
+                                                  std::vector<DVector2D> * derivative_data = nullptr) const;
+
                 /// Show info while solving or not
                 void set_verbose(bool onoff);
                 /// Set the accuracy parameters (first guess for the step-size, the absolute and relative error)
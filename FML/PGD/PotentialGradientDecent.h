@@ -25,75 +25,70 @@ namespace FML {
     using MPIParticles = FML::PARTICLE::MPIParticles<T1>;
 
     //=================================================================================
-    /// Applies the potential gradient decent method (1804.00671) to a set of particles
+    /// The PGD filter (1804.00671) \f$ \exp(-(k/k_s)^4 - (k_l/k)^2) \f$ as function of k^2 (k in box units)
+    ///
+    /// @param[in] k_lowpass Wavenumber in boxunits (k*Boxsize) for the lowpass filter we apply
+    /// @param[in] k_highpass Wavenumber in boxunits (k*Boxsize) for the highpass filter we apply
+    ///
+    //=================================================================================
+    inline std::function<double(double)> pgd_filter_of_kmag2(double k_lowpass, double k_highpass) {
+      const double kl2 = k_lowpass * k_lowpass;
+      const double ks2 = k_highpass * k_highpass;
+      return [=](double k2) -> double {
+        double k_over_ks_squared = k2 / ks2 < 10.0 ? k2 / ks2 : 10.0;
+        double kl_over_k_squared = k2 / kl2 < 0.01 ? 100.0 : kl2 / k2;
+        double factor = std::exp(-k_over_ks_squared*k_over_ks_squared - kl_over_k_squared);
+        return factor;
+      };
+    }
+
+    //=================================================================================
+    /// Applies the potential gradient decent method (1804.00671) to a set of particles using a density field
+    /// we already have in fourier space (e.g. the one computed for the force in the current step of a PM/COLA
+    /// simulation). The filters, the Green's function and the gradient are applied in a single loop over the
+    /// density grid (which is not modified) so the cost is N c2r (done in one batch) and the interpolation.
     ///
     /// @tparam N The dimension of the grid
     /// @tparam T The type of the particles
     ///
+    /// @param[in] density_fourier The density contrast in fourier space
     /// @param[in] p Pointer to particles
     /// @param[in] NumPart Number of particles
     /// @param[in] k_lowpass Wavenumber in boxunits (k*Boxsize) for the lowpass filter we apply
     /// @param[in] k_highpass Wavenumber in boxunits (k*Boxsize) for the highpass filter we apply
     /// @param[in] displacement_factor The strength of the displacement (alpha in the linked paper)
     /// @param[in] norm_poisson_equation The prefactor to the Poisson equation (1.5*OmegaM0*a for cosmological sims)
-    /// @param[in] Ngrid Size of the grid we do the calculations on
-    /// @param[in] density_assignment_method The density assignement method we use for assigning particles to grid
-    //             and doing interpolation when computing things.
+    /// @param[in] density_assignment_method_used The density assignement method used to make density_fourier
+    /// @param[in] interpolation_method The method we use to interpolate the displacement to the particles. The
+    /// density grid must have the extra slices this method needs.
     ///
     //=================================================================================
     template <int N, class T>
-      void potential_gradient_decent_method(T * p,
+      void potential_gradient_decent_method(const FFTWGrid<N> & density_fourier,
+          T * p,
           size_t NumPart,
           double k_lowpass,
           double k_highpass,
           double displacement_factor,
-          double norm_poisson_equation, 
-          int Ngrid,
-          std::string density_assignment_method) {
-
-        const std::complex<FML::GRID::FloatType> I(0, 1);
+          double norm_poisson_equation,
+          std::string density_assignment_method_used,
+          std::string interpolation_method) {
 
         // Sanity checks
-        assert_mpi(NumPart > 0, "[potential_gradient_decent_method] NumPart is zero");
         assert_mpi(k_lowpass > 0.0, "[potential_gradient_decent_method] k_lowpass has to be nonzero");
         assert_mpi(k_highpass > 0.0, "[potential_gradient_decent_method] k_highpass has to be nonzero");
+        const auto nleftright = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(interpolation_method);
+        assert_mpi(density_fourier.get_n_extra_slices_left() >= nleftright.first and
+                       density_fourier.get_n_extra_slices_right() >= nleftright.second,
+                   "[potential_gradient_decent_method] Density grid has too few extra slices for the interpolation");
 
-        // For interpolating the grid to the particle positions
-        std::string interpolation_method = density_assignment_method;
-        auto NumPartTotal = NumPart;
-        FML::SumOverTasks(&NumPartTotal);
-
-        // Bin particles to grid and fourier transform
-        const auto nleftright = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(density_assignment_method);
-        FFTWGrid<N> density_k(Ngrid, nleftright.first, nleftright.second);
-        const bool interlacing = false;
-        FML::INTERPOLATION::particles_to_fourier_grid(p,
-            NumPart,
-            NumPartTotal,
-            density_k,
-            density_assignment_method,
-            interlacing);
-
-        // Apply high- and low-pass filter
-        double kl2 = k_lowpass * k_lowpass;
-        double ks2 = k_highpass * k_highpass;
-        std::function<double(double)> filter = [=](double k2) -> double {
-          double k_over_ks_squared = k2 / ks2 < 10.0 ? k2 / ks2 : 10.0;
-          double kl_over_k_squared = k2 / kl2 < 0.01 ? 100.0 : kl2 / k2;
-          double factor = std::exp(-k_over_ks_squared*k_over_ks_squared - kl_over_k_squared);
-          return factor;
-        };
-        FML::GRID::custom_smoothing_filter_fourier_space(density_k, filter);
-
-        // Density field -> force
+        // Density field -> filtered force
         std::array<FFTWGrid<N>, N> force_real;
-        FML::NBODY::compute_force_from_density_fourier<N>(density_k, 
-            force_real, 
-            density_assignment_method, 
-            norm_poisson_equation);
-
-        // Free memory
-        density_k.free();
+        FML::NBODY::compute_force_from_density_fourier<N>(density_fourier,
+            force_real,
+            density_assignment_method_used,
+            norm_poisson_equation,
+            pgd_filter_of_kmag2(k_lowpass, k_highpass));
 
         // Interpolate force to particle positions
         for (int idim = 0; idim < N; idim++)
@@ -130,7 +125,63 @@ namespace FML {
         FML::MaxOverTasks(&max_disp);
         if (FML::ThisTask == 0)
           std::cout << "[potential_gradient_decent_method] Maximum displacement : " 
-            << max_disp << " = " << max_disp * Ngrid << " grid-cells\n";
+            << max_disp << " = " << max_disp * density_fourier.get_nmesh() << " grid-cells\n";
+      }
+
+    //=================================================================================
+    /// Applies the potential gradient decent method (1804.00671) to a set of particles
+    ///
+    /// @tparam N The dimension of the grid
+    /// @tparam T The type of the particles
+    ///
+    /// @param[in] p Pointer to particles
+    /// @param[in] NumPart Number of particles
+    /// @param[in] k_lowpass Wavenumber in boxunits (k*Boxsize) for the lowpass filter we apply
+    /// @param[in] k_highpass Wavenumber in boxunits (k*Boxsize) for the highpass filter we apply
+    /// @param[in] displacement_factor The strength of the displacement (alpha in the linked paper)
+    /// @param[in] norm_poisson_equation The prefactor to the Poisson equation (1.5*OmegaM0*a for cosmological sims)
+    /// @param[in] Ngrid Size of the grid we do the calculations on
+    /// @param[in] density_assignment_method The density assignement method we use for assigning particles to grid
+    //             and doing interpolation when computing things.
+    ///
+    //=================================================================================
+    template <int N, class T>
+      void potential_gradient_decent_method(T * p,
+          size_t NumPart,
+          double k_lowpass,
+          double k_highpass,
+          double displacement_factor,
+          double norm_poisson_equation, 
+          int Ngrid,
+          std::string density_assignment_method) {
+
+        // Sanity checks
+        assert_mpi(NumPart > 0, "[potential_gradient_decent_method] NumPart is zero");
+
+        auto NumPartTotal = NumPart;
+        FML::SumOverTasks(&NumPartTotal);
+
+        // Bin particles to grid and fourier transform
+        const auto nleftright = FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(density_assignment_method);
+        FFTWGrid<N> density_k(Ngrid, nleftright.first, nleftright.second);
+        const bool interlacing = false;
+        FML::INTERPOLATION::particles_to_fourier_grid(p,
+            NumPart,
+            NumPartTotal,
+            density_k,
+            density_assignment_method,
+            interlacing);
+
+        // For interpolating the grid to the particle positions we use the same method
+        potential_gradient_decent_method<N, T>(density_k,
+            p,
+            NumPart,
+            k_lowpass,
+            k_highpass,
+            displacement_factor,
+            norm_poisson_equation,
+            density_assignment_method,
+            density_assignment_method);
       }
 
     /// Fitting formula for the displacment factor needed in the PGD method
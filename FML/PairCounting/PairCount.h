@@ -1,10 +1,13 @@
 #ifndef PAIRCOUNT_HEADER
 #define PAIRCOUNT_HEADER
 
+#include <array>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <functional>
 #include <iomanip>
+#include <type_traits>
 #include <vector>
 
 #ifdef USE_OMP
@@ -19,8 +22,13 @@
 #include <FML/Spline/Spline.h>
 #endif
 
+#ifdef USE_FFTW
+#include <FML/ComputePowerSpectra/ComputePowerSpectrum.h>
+#endif
+
 #include <FML/Global/Global.h>
 #include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+#include <FML/MPIParticles/MPIParticles.h>
 #include <FML/ParticlesInBoxes/ParticlesInBoxes.h>
 
 namespace FML {
@@ -39,7 +47,10 @@ namespace FML {
         /// providing a function that does this (e.g. v12 = v1-v2).
         ///
         /// Parallelized with both OpenMP and MPI. For MPI its assumed that all tasks have *all* the particles
-        /// and each task is then reponsible for a certain part of the pairs we want to count.
+        /// and each task is then reponsible for a certain part of the pairs we want to count. If the catalogues are
+        /// too large for this set distributed_particles = true: then every task only has the particles in its own
+        /// x-domain [FML::xmin_domain, FML::xmax_domain) (e.g. the particles of MPIParticles), we get the particles
+        /// within rmax of the domain from the other tasks and the pair counts are summed over the tasks.
         ///
         /// Particles are assumed to reside in [0,1)^n
         /// rmax is the maximum pair separation (in [0,1)) that we are interested in
@@ -91,6 +102,20 @@ namespace FML {
             /// For binning particles to cells. The minimum grid-size.
             int ngrid_min_size = 10;
 
+            /// If true then every task only has the particles in its own x-domain [FML::xmin_domain,
+            /// FML::xmax_domain) instead of all the particles. The first catalogue in a pair count is then the local
+            /// particles and the second the local particles plus the ones within rmax of the domain on the other
+            /// tasks. Auto pairs are counted as cross pairs of the two (so every pair is found on the tasks of both
+            /// particles) and divided by two which is twice the work of the usual auto pair count.
+            bool distributed_particles = false;
+
+            /// For the distributed mode: the total number of particles over all tasks
+            inline size_t get_npart_total(size_t npart) {
+                if (distributed_particles)
+                    FML::SumOverTasks(&npart);
+                return npart;
+            }
+
             /// This is the general algorithm for computing pair counts.
             /// It finds all pairs within a separation rmax and calls the binning_function
             /// for all pairs from which you can take care of everything.
@@ -102,7 +127,8 @@ namespace FML {
                                     bool auto_pair_binning,
                                     double rmax,
                                     bool periodic_box,
-                                    bool verbose = false);
+                                    bool verbose = false,
+                                    bool split_work_over_tasks = true);
 
             /// Estimates the correlation function from the paircounts. Most common estimators are included.
             /// NB: assumes normalized paircounts here, e.g. pairs / total_number_of_pairs.
@@ -174,22 +200,25 @@ namespace FML {
             }
 
             //====================================================
-            /// Cross pair counts using grid to speed it up
-            /// Cross seems to be faster if we loop over the coarsest
-            /// grid first
+            /// Loops over all pairs of cells (of grid1 and grid2) that can have
+            /// particles within rmax of each other and calls
+            /// cell_pair_function(thread_id, index_cell1, index_cell2).
+            /// For auto pairs every pair of cells is only visited once
+            /// (the same cell included). Cross seems to be faster if we loop
+            /// over the coarsest grid first
             //====================================================
-            template <class T, class U>
-            void GeneralPairCounter(FML::PARTICLE::ParticlesInBoxes<T> & grid1,
-                                    FML::PARTICLE::ParticlesInBoxes<U> & grid2,
-                                    std::function<void(int, double *, T &, U &)> & binning_function,
-                                    bool auto_pair_binning,
-                                    double rmax,
-                                    bool periodic_box,
-                                    bool verbose) {
+            template <class T, class U, class CellPairFunction>
+            void ForEachCellPair(FML::PARTICLE::ParticlesInBoxes<T> & grid1,
+                                 FML::PARTICLE::ParticlesInBoxes<U> & grid2,
+                                 CellPairFunction && cell_pair_function,
+                                 bool auto_pair_binning,
+                                 double rmax,
+                                 bool periodic_box,
+                                 bool verbose,
+                                 bool split_work_over_tasks) {
 
                 // Initialize OpenMP
                 const int nthreads = FML::NThreads;
-                int id = 0;
 
                 // Initialize MPI
                 [[maybe_unused]] int mpi_rank = 0;
@@ -205,14 +234,12 @@ namespace FML {
                 assert(ndim == FML::PARTICLE::GetNDIM(U()));
 
                 // Fetch data from the grid
-                auto & cells = grid1.get_cells();
                 const int ngrid1 = grid1.get_ngrid();
                 int max_ix = ngrid1 - 1;
                 int max_iy = ngrid1 - 1;
                 int max_iz = ngrid1 - 1;
 
                 // Fetch data from the grid2
-                auto & cells2 = grid2.get_cells();
                 const int ngrid2 = grid2.get_ngrid();
                 int max_ix2 = ngrid2 - 1;
                 int max_iy2 = ngrid2 - 1;
@@ -238,7 +265,7 @@ namespace FML {
                                 if (ndim == 3) {
                                     index = (ix * ngrid1 + iy) * ngrid1 + iz;
                                 }
-                                bool nonempty = cells[index].get_np() > 0;
+                                bool nonempty = grid1.get_cell(index).get_np() > 0;
                                 if (nonempty) {
                                     max_ix = std::max(ix, max_ix);
                                     max_iy = std::max(iy, max_iy);
@@ -263,7 +290,7 @@ namespace FML {
                                 if (ndim == 3) {
                                     index = (ix * ngrid2 + iy) * ngrid2 + iz;
                                 }
-                                bool nonempty = cells2[index].get_np() > 0;
+                                bool nonempty = grid2.get_cell(index).get_np() > 0;
                                 if (nonempty) {
                                     max_ix2 = std::max(ix, max_ix2);
                                     max_iy2 = std::max(iy, max_iy2);
@@ -326,41 +353,118 @@ namespace FML {
                 }
 
                 //==========================================================
-                // Loop over all the cells in grid1
-                // The loops only go up to max_ix etc. since we wan to skip
-                // looping over cells that we know are empty
+                // Calls function(index_neighbor_cell) for all the cells in grid2
+                // we must correlate with the cell (ix0,iy0,iz0) in grid1
                 //==========================================================
+                auto for_each_neighbor_cell = [&](int ix0, int iy0, int iz0, auto && function) {
+                    //========================================
+                    // Now we find the index of the second grid
+                    // this grid corresponds to
+                    //========================================
+                    int ix_grid2 = (int)(ix0 * (double)ngrid2 / (double)ngrid1);
+                    int iy_grid2 = (int)(iy0 * (double)ngrid2 / (double)ngrid1);
+                    int iz_grid2 = (int)(iz0 * (double)ngrid2 / (double)ngrid1);
+
+                    // We now want to loop over nearby cells by looking at cube of cells around current cell
+                    int ix2_left, iy2_left, iz2_left, ix2_right, iy2_right, iz2_right;
+                    if (periodic_box) {
+                        ix2_left = -delta_ncells2_low, ix2_right = delta_ncells2_high;
+                        iy2_left = -delta_ncells2_low, iy2_right = delta_ncells2_high;
+                        iz2_left = -delta_ncells2_low, iz2_right = delta_ncells2_high;
+                    } else {
+                        ix2_right = ix_grid2 + delta_ncells2_high <= max_ix2 ?
+                                        ix_grid2 + delta_ncells2_high :
+                                        max_ix2;
+                        iy2_right = iy_grid2 + delta_ncells2_high <= max_iy2 ?
+                                        iy_grid2 + delta_ncells2_high :
+                                        max_iy2;
+                        iz2_right = iz_grid2 + delta_ncells2_high <= max_iz2 ?
+                                        iz_grid2 + delta_ncells2_high :
+                                        max_iz2;
+                        ix2_left = ix_grid2 - delta_ncells2_low >= 0 ? ix_grid2 - delta_ncells2_low : 0;
+                        iy2_left = iy_grid2 - delta_ncells2_low >= 0 ? iy_grid2 - delta_ncells2_low : 0;
+                        iz2_left = iz_grid2 - delta_ncells2_low >= 0 ? iz_grid2 - delta_ncells2_low : 0;
+                    }
+                    if (ndim == 1)
+                        iy2_left = iy2_right = iz2_left = iz2_right = 0;
+                    if (ndim == 2)
+                        iz2_left = iz2_right = 0;
+
+                    // Loop over neightbor cells
+                    for (int delta_ix2 = ix2_left; delta_ix2 <= ix2_right; delta_ix2++) {
+                        int ix2 = delta_ix2;
+                        if (periodic_box) {
+                            ix2 = ix_grid2 + delta_ix2;
+                            while (ix2 >= ngrid2)
+                                ix2 -= ngrid2;
+                            while (ix2 < 0)
+                                ix2 += ngrid2;
+                        }
+                        // Avoid double counting so we skip cells that have been correlated with this one
+                        // before
+                        if (auto_pair_binning and ix2 < ix0)
+                            continue;
+
+                        for (int delta_iy2 = iy2_left; delta_iy2 <= iy2_right; delta_iy2++) {
+                            int iy2 = delta_iy2;
+                            if (periodic_box) {
+                                iy2 = iy_grid2 + delta_iy2;
+                                while (iy2 >= ngrid2)
+                                    iy2 -= ngrid2;
+                                while (iy2 < 0)
+                                    iy2 += ngrid2;
+                            }
+                            // Avoid double counting so we skip cells that have been correlated with this
+                            // one before
+                            if (auto_pair_binning and ix2 == ix0 and iy2 < iy0)
+                                continue;
 
-                int ix0 = 0;
-                [[maybe_unused]] int num_processed = 0;
-                int istart = 0, iend = max_ix + 1;
-#if defined(USE_OMP) && !defined(USE_MPI)
-#pragma omp parallel for private(id) schedule(dynamic, 1)
-#elif defined(USE_MPI)
-                int i_per_task = (max_ix + 1) / mpi_size;
-                istart = i_per_task * mpi_rank;
-                iend = i_per_task * (mpi_rank + 1);
-                if (mpi_rank == mpi_size - 1)
-                    iend = max_ix + 1;
-#endif
-                for (ix0 = istart; ix0 < iend; ix0++) {
-#if defined(USE_OMP)
-                    id = omp_get_thread_num();
-#else
-                    id = 0;
-#endif
+                            for (int delta_iz2 = iz2_left; delta_iz2 <= iz2_right; delta_iz2++) {
+                                int iz2 = delta_iz2;
+                                if (periodic_box) {
+                                    iz2 = iz_grid2 + delta_iz2;
+                                    while (iz2 >= ngrid2)
+                                        iz2 -= ngrid2;
+                                    while (iz2 < 0)
+                                        iz2 += ngrid2;
+                                }
+                                // Avoid double counting so we skip cells that have been correlated with
+                                // this one before
+                                if (auto_pair_binning and ix2 == ix0 and iy2 == iy0 and iz2 < iz0)
+                                    continue;
 
-                    // If both OpenMP and MPI then OpenMP loop along y axis
-#if defined(USE_OMP) && defined(USE_MPI)
-#pragma omp parallel for private(id) schedule(dynamic, 1)
-#endif
+                                // Index of neighboring cell
+                                int index_neighbor_cell{};
+                                if (ndim == 1)
+                                    index_neighbor_cell = ix2;
+                                if (ndim == 2)
+                                    index_neighbor_cell = (ix2 * ngrid2 + iy2);
+                                if (ndim == 3)
+                                    index_neighbor_cell = (ix2 * ngrid2 + iy2) * ngrid2 + iz2;
+
+                                function(index_neighbor_cell);
+                            }
+                        }
+                    }
+                };
+
+                //==========================================================
+                // The work to do: all the non-empty cells in grid1 (only up to
+                // max_ix etc. since we know the rest are empty) with an estimate
+                // of the cost (the number of pairs to check). Clustered data
+                // has wildly different occupancy so we do the most expensive
+                // cells first and let the threads grab cells dynamically so that
+                // we don't end up waiting for a few cells in big clusters
+                //==========================================================
+                struct CellWork {
+                    int index;
+                    int ix, iy, iz;
+                    double cost;
+                };
+                std::vector<CellWork> work;
+                for (int ix0 = 0; ix0 <= max_ix; ix0++) {
                     for (int iy0 = 0; iy0 <= max_iy; iy0++) {
-#if defined(USE_OMP) && defined(USE_MPI)
-                        id = omp_get_thread_num();
-#endif
                         for (int iz0 = 0; iz0 <= max_iz; iz0++) {
-
-                            // Index of current cell
                             int index{};
                             if (ndim == 1)
                                 index = ix0;
@@ -368,181 +472,149 @@ namespace FML {
                                 index = ix0 * ngrid1 + iy0;
                             if (ndim == 3)
                                 index = (ix0 * ngrid1 + iy0) * ngrid1 + iz0;
-
-                            // Pointer to current cell
-                            FML::PARTICLE::Cell<T> & curcell = cells[index];
-
-                            // Number of galaxies in current cell
-                            int np_cell = curcell.get_np();
-
-                            // Loop over all galaxies in current cell
-                            for (int ipart_cell = 0; ipart_cell < np_cell; ipart_cell++) {
-
-                                // Current particle
-                                T & curpart_cell = curcell.get_part(ipart_cell);
-
-                                //========================================
-                                // Now we find the index of the second grid
-                                // this grid corresponds to
-                                //========================================
-                                int ix_grid2 = (int)(ix0 * (double)ngrid2 / (double)ngrid1);
-                                int iy_grid2 = (int)(iy0 * (double)ngrid2 / (double)ngrid1);
-                                int iz_grid2 = (int)(iz0 * (double)ngrid2 / (double)ngrid1);
-
-                                // We now want to loop over nearby cells by looking at cube of cells around current cell
-                                int ix2_left, iy2_left, iz2_left, ix2_right, iy2_right, iz2_right;
-                                if (periodic_box) {
-                                    ix2_left = -delta_ncells2_low, ix2_right = delta_ncells2_high;
-                                    iy2_left = -delta_ncells2_low, iy2_right = delta_ncells2_high;
-                                    iz2_left = -delta_ncells2_low, iz2_right = delta_ncells2_high;
-                                } else {
-                                    ix2_right = ix_grid2 + delta_ncells2_high <= max_ix2 ?
-                                                    ix_grid2 + delta_ncells2_high :
-                                                    max_ix2;
-                                    iy2_right = iy_grid2 + delta_ncells2_high <= max_iy2 ?
-                                                    iy_grid2 + delta_ncells2_high :
-                                                    max_iy2;
-                                    iz2_right = iz_grid2 + delta_ncells2_high <= max_iz2 ?
-                                                    iz_grid2 + delta_ncells2_high :
-                                                    max_iz2;
-                                    ix2_left = ix_grid2 - delta_ncells2_low >= 0 ? ix_grid2 - delta_ncells2_low : 0;
-                                    iy2_left = iy_grid2 - delta_ncells2_low >= 0 ? iy_grid2 - delta_ncells2_low : 0;
-                                    iz2_left = iz_grid2 - delta_ncells2_low >= 0 ? iz_grid2 - delta_ncells2_low : 0;
-                                }
-                                if (ndim == 1)
-                                    iy2_left = iy2_right = iz2_left = iz2_right = 0;
-                                if (ndim == 2)
-                                    iz2_left = iz2_right = 0;
-
-                                // Loop over neightbor cells
-                                for (int delta_ix2 = ix2_left; delta_ix2 <= ix2_right; delta_ix2++) {
-                                    int ix2 = delta_ix2;
-                                    if (periodic_box) {
-                                        ix2 = ix_grid2 + delta_ix2;
-                                        while (ix2 >= ngrid2)
-                                            ix2 -= ngrid2;
-                                        while (ix2 < 0)
-                                            ix2 += ngrid2;
-                                    }
-                                    // Avoid double counting so we skip cells that have been correlated with this one
-                                    // before
-                                    if (auto_pair_binning and ix2 < ix0)
-                                        continue;
-
-                                    for (int delta_iy2 = iy2_left; delta_iy2 <= iy2_right; delta_iy2++) {
-                                        int iy2 = delta_iy2;
-                                        if (periodic_box) {
-                                            iy2 = iy_grid2 + delta_iy2;
-                                            while (iy2 >= ngrid2)
-                                                iy2 -= ngrid2;
-                                            while (iy2 < 0)
-                                                iy2 += ngrid2;
-                                        }
-                                        // Avoid double counting so we skip cells that have been correlated with this
-                                        // one before
-                                        if (auto_pair_binning and ix2 == ix0 and iy2 < iy0)
-                                            continue;
-
-                                        for (int delta_iz2 = iz2_left; delta_iz2 <= iz2_right; delta_iz2++) {
-                                            int iz2 = delta_iz2;
-                                            if (periodic_box) {
-                                                iz2 = iz_grid2 + delta_iz2;
-                                                while (iz2 >= ngrid2)
-                                                    iz2 -= ngrid2;
-                                                while (iz2 < 0)
-                                                    iz2 += ngrid2;
-                                            }
-                                            // Avoid double counting so we skip cells that have been correlated with
-                                            // this one before
-                                            if (auto_pair_binning and ix2 == ix0 and iy2 == iy0 and iz2 < iz0)
-                                                continue;
-
-                                            // Index of neighboring cell
-                                            int index_neighbor_cell{};
-                                            if (ndim == 1)
-                                                index_neighbor_cell = ix2;
-                                            if (ndim == 2)
-                                                index_neighbor_cell = (ix2 * ngrid2 + iy2);
-                                            if (ndim == 3)
-                                                index_neighbor_cell = (ix2 * ngrid2 + iy2) * ngrid2 + iz2;
-
-                                            // Pointer to neighboring cell
-                                            FML::PARTICLE::Cell<U> & neighborcell = cells2[index_neighbor_cell];
-
-                                            // Number of galaxies in neighboring cell
-                                            int npart_neighbor_cell = neighborcell.get_np();
-
-                                            // Careful: if the nbor cell is the same as the current cell then
-                                            // we will overcount if we do all particles so only correlate with
-                                            // partices we haven't touched yet
-                                            int istart_nbor_cell = 0;
-                                            if (auto_pair_binning and index == index_neighbor_cell)
-                                                istart_nbor_cell = ipart_cell + 1;
-
-                                            // Loop over galaxies in neighbor cells
-                                            for (int ipart_neighbor_cell = istart_nbor_cell;
-                                                 ipart_neighbor_cell < npart_neighbor_cell;
-                                                 ipart_neighbor_cell++) {
-
-                                                // Galaxy in neighboring cell
-                                                U & curpart_neighbor_cell = neighborcell.get_part(ipart_neighbor_cell);
-
-                                                // ==================================================================
-                                                // We now count up the pair [curpart_cell] x [curpart_neighbor_cell]
-                                                // ==================================================================
-                                                auto pos = FML::PARTICLE::GetPos(curpart_cell);
-                                                auto pos_nbor = FML::PARTICLE::GetPos(curpart_neighbor_cell);
-                                                double dist[ndim];
-                                                if (periodic_box) {
-                                                    for (int idim = 0; idim < ndim; idim++) {
-                                                        dist[idim] = (pos[idim] - pos_nbor[idim]);
-                                                        if (dist[idim] > 0.5)
-                                                            dist[idim] -= 1.0;
-                                                        if (dist[idim] < -0.5)
-                                                            dist[idim] += 1.0;
-                                                    }
-                                                } else {
-                                                    for (int idim = 0; idim < ndim; idim++)
-                                                        dist[idim] = (pos[idim] - pos_nbor[idim]);
-                                                }
-
-                                                // Add to bin
-                                                binning_function(id, dist, curpart_cell, curpart_neighbor_cell);
-                                            }
-                                        }
-                                    }
-                                }
-                            }
+                            if (grid1.get_cell(index).get_np() > 0)
+                                work.push_back({index, ix0, iy0, iz0, 0.0});
                         }
                     }
-                    // Show progress...
+                }
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+                for (size_t i = 0; i < work.size(); i++) {
+                    double np_neighbors = 0.0;
+                    for_each_neighbor_cell(work[i].ix, work[i].iy, work[i].iz, [&](int index_neighbor_cell) {
+                        np_neighbors += grid2.get_cell(index_neighbor_cell).get_np();
+                    });
+                    // The +1 accounts for the overhead of a cell with no pairs
+                    work[i].cost = grid1.get_cell(work[i].index).get_np() * np_neighbors + 1.0;
+                }
+                std::stable_sort(
+                    work.begin(), work.end(), [](const CellWork & a, const CellWork & b) { return a.cost > b.cost; });
+
+                // Split the work over tasks: the next most expensive cell goes to the task with the least
+                // work so far. All tasks have the same list so this requires no communication
+                if (split_work_over_tasks and mpi_size > 1) {
+                    std::vector<CellWork> work_this_task;
+                    std::vector<double> cost_tasks(mpi_size, 0.0);
+                    for (auto & w : work) {
+                        const auto least_loaded = std::min_element(cost_tasks.begin(), cost_tasks.end());
+                        const int rank = int(least_loaded - cost_tasks.begin());
+                        cost_tasks[rank] += w.cost;
+                        if (rank == mpi_rank)
+                            work_this_task.push_back(w);
+                    }
+                    work = std::move(work_this_task);
+                }
+
+                //==========================================================
+                // Loop over all the cells in our part of the work. The pair
+                // counts go into the per-thread storage of the cell_pair_function
+                // (indexed by thread id) which is summed up at the end
+                //==========================================================
+                [[maybe_unused]] size_t num_processed = 0;
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+                for (size_t i = 0; i < work.size(); i++) {
 #if defined(USE_OMP)
-                    int num_max = max_ix;
-#if defined(USE_MPI)
-                    num_max = max_iy;
+                    const int id = omp_get_thread_num();
+#else
+                    const int id = 0;
 #endif
+                    const int index = work[i].index;
+                    for_each_neighbor_cell(work[i].ix, work[i].iy, work[i].iz, [&](int index_neighbor_cell) {
+                        cell_pair_function(id, index, index_neighbor_cell);
+                    });
+
+                    // Show progress...
+#ifdef USE_OMP
 #pragma omp critical
+#endif
                     {
                         if (verbose) {
                             // Progress bar
-                            int ntot = num_max / mpi_size;
-                            if (ntot > 0) {
-                                if ((10 * num_processed) / ntot != (10 * num_processed + 10) / ntot or
-                                    num_processed == 0) {
-                                    std::cout << (100 * num_processed + 100) / ntot << "% " << std::flush;
-                                    if (num_processed == ntot - 1) {
-                                        std::cout << "\nFinished on first task, waiting for the rest to finish\n"
-                                                  << std::endl;
-                                    }
+                            const size_t ntot = work.size();
+                            if ((10 * num_processed) / ntot != (10 * num_processed + 10) / ntot or
+                                num_processed == 0) {
+                                std::cout << (100 * num_processed + 100) / ntot << "% " << std::flush;
+                                if (num_processed == ntot - 1) {
+                                    std::cout << "\nFinished on first task, waiting for the rest to finish\n"
+                                              << std::endl;
                                 }
                             }
                         }
                         num_processed++;
                     }
-#endif
                 }
             }
 
+            template <class T, class U>
+            void GeneralPairCounter(FML::PARTICLE::ParticlesInBoxes<T> & grid1,
+                                    FML::PARTICLE::ParticlesInBoxes<U> & grid2,
+                                    std::function<void(int, double *, T &, U &)> & binning_function,
+                                    bool auto_pair_binning,
+                                    double rmax,
+                                    bool periodic_box,
+                                    bool verbose,
+                                    bool split_work_over_tasks) {
+
+                constexpr int ndim = FML::PARTICLE::GetNDIM(T());
+
+                auto cell_pair_function = [&](int id, int index, int index_neighbor_cell) {
+                    // The two cells (views of their particles)
+                    FML::PARTICLE::Cell<T> curcell = grid1.get_cell(index);
+                    FML::PARTICLE::Cell<U> neighborcell = grid2.get_cell(index_neighbor_cell);
+                    const int np_cell = curcell.get_np();
+                    const int npart_neighbor_cell = neighborcell.get_np();
+
+                    // Loop over all galaxies in current cell
+                    for (int ipart_cell = 0; ipart_cell < np_cell; ipart_cell++) {
+                        T & curpart_cell = curcell.get_part(ipart_cell);
+                        auto pos = FML::PARTICLE::GetPos(curpart_cell);
+
+                        // Careful: if the nbor cell is the same as the current cell then
+                        // we will overcount if we do all particles so only correlate with
+                        // partices we haven't touched yet
+                        int istart_nbor_cell = 0;
+                        if (auto_pair_binning and index == index_neighbor_cell)
+                            istart_nbor_cell = ipart_cell + 1;
+
+                        // Loop over galaxies in neighbor cells
+                        for (int ipart_neighbor_cell = istart_nbor_cell; ipart_neighbor_cell < npart_neighbor_cell;
+                             ipart_neighbor_cell++) {
+                            U & curpart_neighbor_cell = neighborcell.get_part(ipart_neighbor_cell);
+                            auto pos_nbor = FML::PARTICLE::GetPos(curpart_neighbor_cell);
+
+                            // ==================================================================
+                            // We now count up the pair [curpart_cell] x [curpart_neighbor_cell]
+                            // ==================================================================
+                            double dist[ndim];
+                            for (int idim = 0; idim < ndim; idim++) {
+                                dist[idim] = (pos[idim] - pos_nbor[idim]);
+                                if (periodic_box) {
+                                    if (dist[idim] > 0.5)
+                                        dist[idim] -= 1.0;
+                                    if (dist[idim] < -0.5)
+                                        dist[idim] += 1.0;
+                                }
+                            }
+
+                            // Add to bin
+                            binning_function(id, dist, curpart_cell, curpart_neighbor_cell);
+                        }
+                    }
+                };
+
+                ForEachCellPair(grid1,
+                                grid2,
+                                cell_pair_function,
+                                auto_pair_binning,
+                                rmax,
+                                periodic_box,
+                                verbose,
+                                split_work_over_tasks);
+            }
+
             template <typename T1, typename T2>
             void AngularCorrelationFunctionBox(const T1 * part1,
                                                size_t npart1,
@@ -573,10 +645,13 @@ namespace FML {
                 const double rmin2 = rmin * rmin;
                 const double rmax2 = rmax * rmax;
 
-                // Sanity checks
-                if (npart1 == 0 or npart2 == 0)
+                // Sanity checks (in the distributed mode a task can have no particles)
+                const size_t npart1_total = get_npart_total(npart1);
+                const size_t npart2_total = get_npart_total(npart2);
+                if (npart1_total == 0 or npart2_total == 0)
                     return;
-                assert_mpi(part1 != nullptr, "AngularCorrelationFunctionBox :: Got nullptr for part1\n");
+                assert_mpi(part1 != nullptr or distributed_particles,
+                           "AngularCorrelationFunctionBox :: Got nullptr for part1\n");
                 assert_mpi(rmax > rmin, "AngularCorrelationFunctionBox :: Error rmax < rmin\n");
                 assert_mpi(mumax > mumin, "AngularCorrelationFunctionBox :: Error mumax < mumin\n");
                 assert_mpi(nrbins > 0, "AngularCorrelationFunctionBox :: Error nrbins <= 0\n");
@@ -598,8 +673,6 @@ namespace FML {
                 // We set the second catalogue equal to the first as this will
                 // set cross_pair_counting = false below
                 if (part2 == nullptr) {
-                    if (npart2 == 0)
-                        return;
                     part2 = part1;
                     npart2 = npart1;
                 }
@@ -747,9 +820,9 @@ namespace FML {
                     };
 
                 // Add particles to a grid
-                const int ngrid1 =
-                    std::max(ngrid_min_size,
-                             std::min(int(ncells_to_rmax / rmax), int(std::pow(npart1 / 2.0, 1. / double(NDIM)))));
+                const int ngrid1 = std::max(
+                    ngrid_min_size,
+                    std::min(int(ncells_to_rmax / rmax), int(std::pow(npart1_total / 2.0, 1. / double(NDIM)))));
                 FML::PARTICLE::ParticlesInBoxes<T1> grid1;
                 FML::PARTICLE::ParticlesInBoxes<T2> grid2;
                 grid1.create(part1, npart1, ngrid1);
@@ -768,15 +841,23 @@ namespace FML {
                         sum1_weights_squared += w * w;
                     }
                 }
+                if (distributed_particles) {
+                    FML::SumOverTasks(&sum1_weights);
+                    FML::SumOverTasks(&sum1_weights_squared);
+                }
 
                 double sum2_weights{};
                 if (cross_pair_counting) {
-                    int ngrid2 =
-                        std::max(ngrid_min_size,
-                                 std::min(int(ncells_to_rmax / rmax), int(std::pow(npart2 / 2.0, 1. / double(NDIM)))));
+                    int ngrid2 = std::max(
+                        ngrid_min_size,
+                        std::min(int(ncells_to_rmax / rmax), int(std::pow(npart2_total / 2.0, 1. / double(NDIM)))));
 
                     // Add particles to a grid
-                    grid2.create(part2, npart2, ngrid2);
+                    if (distributed_particles)
+                        grid2.create(FML::PARTICLE::get_particles_with_ghosts(part2, npart2, rmax, periodic_box),
+                                     ngrid2);
+                    else
+                        grid2.create(part2, npart2, ngrid2);
                     if (verbose)
                         grid2.info();
 
@@ -787,17 +868,182 @@ namespace FML {
                         for (size_t i = 0; i < npart2; i++)
                             sum2_weights += FML::PARTICLE::GetWeight(part2[i]);
                     }
+                    if (distributed_particles)
+                        FML::SumOverTasks(&sum2_weights);
                 }
 
+                //===============================================================
+                // The fast path for the standard binning (no extra quantities to bin up). We store the
+                // positions and weights of the particles as separate arrays (in the order of the cells) so
+                // the distances from a particle to all the particles in a cell is a loop the compiler can
+                // vectorize. The r-bin is found from r^2 with a lookup table (corrected with the squared
+                // bin edges) so we never take the sqrt unless we need mu
+                //===============================================================
+                struct PositionsAndWeights {
+                    std::array<std::vector<double>, NDIM> x;
+                    std::vector<double> w;
+                };
+                auto get_positions_and_weights = [](auto & grid) {
+                    auto & particles = grid.get_particles();
+                    using T = typename std::decay_t<decltype(particles)>::value_type;
+                    PositionsAndWeights soa;
+                    for (auto & x : soa.x)
+                        x.resize(particles.size());
+                    soa.w.resize(particles.size(), 1.0);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (size_t i = 0; i < particles.size(); i++) {
+                        auto pos = FML::PARTICLE::GetPos(particles[i]);
+                        for (int idim = 0; idim < NDIM; idim++)
+                            soa.x[idim][i] = pos[idim];
+                        if constexpr (FML::PARTICLE::has_get_weight<T>())
+                            soa.w[i] = FML::PARTICLE::GetWeight(particles[i]);
+                    }
+                    return soa;
+                };
+
+                // The lookup table r^2 -> ir and the squared bin edges
+                const int nlut = 64 * nrbins;
+                const double inv_dlut = nlut / rmax2;
+                std::vector<int> ir_lut(nlut + 1);
+                for (int i = 0; i <= nlut; i++)
+                    ir_lut[i] = std::min(std::max(ir_index_of_r(std::sqrt(i / inv_dlut)), 0), nrbins - 1);
+                DVector r2_edge_array(nrbins + 1);
+                for (int i = 0; i <= nrbins; i++)
+                    r2_edge_array[i] = r_edge_array[i] * r_edge_array[i];
+
+                const bool compute_mu = nmubins > 1 or mumax < 1.0 or mumin > -1.0;
+                DVector2D r2_threads(nthreads);
+                auto fast_pair_counter = [&](auto & grid_a, auto & grid_b, bool auto_pair_binning, bool split_work) {
+                    const auto soa_a = get_positions_and_weights(grid_a);
+                    const auto soa_b = get_positions_and_weights(grid_b);
+                    const auto & offsets_a = grid_a.get_offsets();
+                    const auto & offsets_b = grid_b.get_offsets();
+
+                    auto cell_pair_function = [&](int thread_id, int index, int index_neighbor_cell) {
+                        const size_t start_b = offsets_b[index_neighbor_cell];
+                        const int np_b = int(offsets_b[index_neighbor_cell + 1] - start_b);
+                        if (np_b == 0)
+                            return;
+                        DVector & r2 = r2_threads[thread_id];
+                        if (r2.size() < size_t(np_b))
+                            r2.resize(np_b);
+                        double * count = count_threads[thread_id].data();
+
+                        for (size_t i = offsets_a[index]; i < offsets_a[index + 1]; i++) {
+                            // For the same cell in auto pair counting only correlate with the particles after it
+                            int jstart = 0;
+                            if (auto_pair_binning and index == index_neighbor_cell)
+                                jstart = int(i - offsets_a[index]) + 1;
+
+                            // The squared distances to all the particles in the neighbor cell (with the same
+                            // periodic wrap as in GeneralPairCounter, just without branches)
+                            for (int idim = 0; idim < NDIM; idim++) {
+                                const double xi = soa_a.x[idim][i];
+                                const double * xb = soa_b.x[idim].data() + start_b;
+                                double * r2j = r2.data();
+#ifdef USE_OMP
+#pragma omp simd
+#endif
+                                for (int j = jstart; j < np_b; j++) {
+                                    double d = xi - xb[j];
+                                    if (periodic_box)
+                                        d += (d < -0.5 ? 1.0 : 0.0) - (d > 0.5 ? 1.0 : 0.0);
+                                    r2j[j] = (idim == 0 ? 0.0 : r2j[j]) + d * d;
+                                }
+                            }
+
+                            // Bin up the pairs in range
+                            for (int j = jstart; j < np_b; j++) {
+                                const double r2j = r2[j];
+                                if (r2j < rmin2 or r2j >= rmax2 or r2j == 0.0)
+                                    continue;
+                                int ir = ir_lut[int(r2j * inv_dlut)];
+                                while (ir + 1 < nrbins and r2j >= r2_edge_array[ir + 1])
+                                    ir++;
+                                while (ir > 0 and r2j < r2_edge_array[ir])
+                                    ir--;
+
+                                // Compute mu exactly as in the binning function above
+                                int imu = 0;
+                                if (compute_mu) {
+                                    std::array<double, NDIM> dist;
+                                    std::array<double, NDIM> los_direction_local;
+                                    double norm2 = 0.0;
+                                    for (int idim = 0; idim < NDIM; idim++) {
+                                        const double x1 = soa_a.x[idim][i];
+                                        const double x2 = soa_b.x[idim][start_b + j];
+                                        dist[idim] = x1 - x2;
+                                        double dx = (x1 + x2) / 2.0 - observer_position[idim];
+                                        if (periodic_box) {
+                                            if (dist[idim] > 0.5)
+                                                dist[idim] -= 1.0;
+                                            if (dist[idim] < -0.5)
+                                                dist[idim] += 1.0;
+                                            if (dx < -0.5)
+                                                dx += 1.0;
+                                            if (dx > 0.5)
+                                                dx -= 1.0;
+                                        }
+                                        los_direction_local[idim] = dx;
+                                        norm2 += dx * dx;
+                                    }
+                                    norm2 = std::sqrt(norm2);
+                                    double dotproduct = 0.0;
+                                    for (int idim = 0; idim < NDIM; idim++)
+                                        dotproduct += dist[idim] * (los_direction_local[idim] / norm2);
+                                    const double mu = dotproduct / std::sqrt(r2j);
+                                    if (mu < mumin or mu >= mumax)
+                                        continue;
+                                    imu = imu_of_mu(mu);
+                                }
+
+                                count[nquantities * (ir + imu * nrbins)] += soa_a.w[i] * soa_b.w[start_b + j];
+                            }
+                        }
+                    };
+
+                    ForEachCellPair(grid_a,
+                                    grid_b,
+                                    cell_pair_function,
+                                    auto_pair_binning,
+                                    rmax,
+                                    periodic_box,
+                                    verbose,
+                                    split_work);
+                };
+
+                // Count the pairs with the fast path if we can
+                auto pair_counter = [&](auto & grid_a, auto & grid_b, bool auto_pair_binning, bool split_work) {
+                    if (nextratobin == 0)
+                        fast_pair_counter(grid_a, grid_b, auto_pair_binning, split_work);
+                    else
+                        GeneralPairCounter(grid_a,
+                                           grid_b,
+                                           binning_function,
+                                           auto_pair_binning,
+                                           rmax,
+                                           periodic_box,
+                                           verbose,
+                                           split_work);
+                };
+
                 // Do the pair counts
+                const bool split_work_over_tasks = not distributed_particles;
                 double numpairs{};
                 if (cross_pair_counting) {
-                    GeneralPairCounter<T1, T2>(
-                        grid1, grid2, binning_function, not cross_pair_counting, rmax, periodic_box, verbose);
+                    pair_counter(grid1, grid2, false, split_work_over_tasks);
                     numpairs = sum1_weights * sum2_weights;
+                } else if (distributed_particles) {
+                    // The local particles with all the particles around them as cross pairs. Every pair is then
+                    // counted twice (once by the task of each particle) and the pair of a particle with itself has
+                    // r = 0 so its not binned
+                    grid2.create(FML::PARTICLE::get_particles_with_ghosts(part2, npart2, rmax, periodic_box), ngrid1);
+                    pair_counter(grid1, grid2, false, split_work_over_tasks);
+                    numpairs = (sum1_weights * sum1_weights - sum1_weights_squared) / 2.0;
                 } else {
-                    GeneralPairCounter<T1, T2>(
-                        grid1, grid1, binning_function, not cross_pair_counting, rmax, periodic_box, verbose);
+                    pair_counter(grid1, grid1, true, split_work_over_tasks);
                     numpairs = (sum1_weights * sum1_weights - sum1_weights_squared) / 2.0;
                 }
 
@@ -809,6 +1055,9 @@ namespace FML {
 
                 // Sum over MPI tasks
                 FML::SumArrayOverTasks(count.data(), count.size());
+                if (distributed_particles and not cross_pair_counting)
+                    for (auto & c : count)
+                        c /= 2.0;
 
                 // Normalize to get the correlation function
                 paircounts_array = DVector2D(nmubins, DVector(nrbins, 0.0));
@@ -1245,6 +1494,683 @@ namespace FML {
                 }
             }
 
+            //===========================================================================
+            /// Particles binned to pixels on the sky as seen from an observer, for angular pair counts where a
+            /// grid in the box is badly balanced (thin shells, wide surveys). The pixelization is iso-latitude in
+            /// the spirit of HEALPix: nrings rings of equal height in theta and ring i is split into
+            /// nphi_i ~ 2 nrings sin(theta_i) pixels so all pixels are roughly square with about the same area.
+            /// We only keep the unit vector to each particle and its weight, sorted by pixel.
+            //===========================================================================
+            class ParticlesInAngularPixels {
+              public:
+                template <class T>
+                void create(const T * part, size_t npart, const DVector & observer_position, int _nrings) {
+                    create_pixelization(_nrings);
+                    const int npix = get_npix();
+
+                    // Direction to the particles and the pixel they are in
+                    constexpr int NDIM = FML::PARTICLE::GetNDIM(T());
+                    static_assert(NDIM == 3, "ParticlesInAngularPixels :: Only implemented for 3D particles");
+                    std::vector<int> pixel_of_particle(npart);
+                    std::array<DVector, 3> n;
+                    for (auto & x : n)
+                        x.resize(npart);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (size_t i = 0; i < npart; i++) {
+                        auto pos = FML::PARTICLE::GetPos(const_cast<T &>(part[i]));
+                        double dir[3], norm2 = 0.0;
+                        for (int idim = 0; idim < 3; idim++) {
+                            dir[idim] = pos[idim] - observer_position[idim];
+                            norm2 += dir[idim] * dir[idim];
+                        }
+                        const double norm = norm2 > 0.0 ? std::sqrt(norm2) : 1.0;
+                        for (int idim = 0; idim < 3; idim++)
+                            n[idim][i] = dir[idim] / norm;
+                        const double nvec[3] = {n[0][i], n[1][i], n[2][i]};
+                        pixel_of_particle[i] = get_pixel(nvec);
+                    }
+
+                    // Sort by pixel (counting sort)
+                    offsets.assign(npix + 1, 0);
+                    for (size_t i = 0; i < npart; i++)
+                        offsets[pixel_of_particle[i] + 1]++;
+                    for (int ipix = 0; ipix < npix; ipix++)
+                        offsets[ipix + 1] += offsets[ipix];
+                    auto next = offsets;
+                    for (auto & x : dirs)
+                        x.resize(npart);
+                    weights.resize(npart);
+                    for (size_t i = 0; i < npart; i++) {
+                        const size_t j = next[pixel_of_particle[i]]++;
+                        for (int idim = 0; idim < 3; idim++)
+                            dirs[idim][j] = n[idim][i];
+                        weights[j] = 1.0;
+                        if constexpr (FML::PARTICLE::has_get_weight<T>())
+                            weights[j] = FML::PARTICLE::GetWeight(const_cast<T &>(part[i]));
+                    }
+                }
+
+                int get_nrings() const { return nrings; }
+                int get_npix() const { return ring_offset.back(); }
+                /// The particles in pixel ipix are [offsets[ipix], offsets[ipix+1])
+                const std::vector<size_t> & get_offsets() const { return offsets; }
+                const std::array<DVector, 3> & get_directions() const { return dirs; }
+                const DVector & get_weights() const { return weights; }
+
+                /// The pixel of a direction (unit vector)
+                int get_pixel(const double * n) const {
+                    const double theta = std::acos(std::min(std::max(n[2], -1.0), 1.0));
+                    const int iring = std::min(int(theta / M_PI * nrings), nrings - 1);
+                    double phi = std::atan2(n[1], n[0]);
+                    if (phi < 0.0)
+                        phi += 2.0 * M_PI;
+                    const int iphi = std::min(int(phi / (2.0 * M_PI) * nphi[iring]), nphi[iring] - 1);
+                    return ring_offset[iring] + iphi;
+                }
+
+                /// Calls function(jpix) for all the pixels that can have a point within theta_max of a point in
+                /// pixel ipix. The rings and the range in phi to look at follow from the distance between the
+                /// pixel centers and every candidate is then checked using the size of the two pixels
+                template <class Function>
+                void for_each_pixel_within(int ipix, double theta_max, Function && function) const {
+                    const int iring =
+                        int(std::upper_bound(ring_offset.begin(), ring_offset.end(), ipix) - ring_offset.begin()) - 1;
+                    const double theta = ring_theta(iring);
+                    const double phi = 2.0 * M_PI * (ipix - ring_offset[iring] + 0.5) / nphi[iring];
+                    const double * c1 = &centers[3 * ipix];
+
+                    // The largest separation of the centers of two pixels we need to look at
+                    const double alpha = theta_max + ring_radius[iring] + max_ring_radius;
+
+                    // If the cap of radius alpha does not contain a pole the pixel centers are within this of phi
+                    const bool all_phi = alpha >= theta or alpha >= M_PI - theta;
+                    const double dphi = all_phi ? M_PI : std::asin(std::min(std::sin(alpha) / std::sin(theta), 1.0));
+
+                    const int iring_min = std::max(int(std::floor((theta - alpha) / M_PI * nrings - 0.5)), 0);
+                    const int iring_max = std::min(int(std::ceil((theta + alpha) / M_PI * nrings - 0.5)), nrings - 1);
+                    for (int jring = iring_min; jring <= iring_max; jring++) {
+                        if (std::fabs(ring_theta(jring) - theta) > alpha)
+                            continue;
+                        const double sep = theta_max + ring_radius[iring] + ring_radius[jring];
+                        const double cos_sep = sep >= M_PI ? -2.0 : std::cos(sep);
+
+                        auto test_pixel = [&](int jphi) {
+                            const int jpix = ring_offset[jring] + jphi;
+                            const double * c2 = &centers[3 * jpix];
+                            if (c1[0] * c2[0] + c1[1] * c2[1] + c1[2] * c2[2] >= cos_sep)
+                                function(jpix);
+                        };
+
+                        const int n = nphi[jring];
+                        const double dphi_pixel = 2.0 * M_PI / n;
+                        const int jphi_min = int(std::floor((phi - dphi) / dphi_pixel - 0.5)) - 1;
+                        const int jphi_max = int(std::ceil((phi + dphi) / dphi_pixel - 0.5)) + 1;
+                        if (all_phi or jphi_max - jphi_min + 1 >= n) {
+                            for (int jphi = 0; jphi < n; jphi++)
+                                test_pixel(jphi);
+                        } else {
+                            for (int j = jphi_min; j <= jphi_max; j++)
+                                test_pixel(((j % n) + n) % n);
+                        }
+                    }
+                }
+
+              private:
+                int nrings{};
+                std::vector<int> nphi;
+                std::vector<int> ring_offset; // The first pixel in each ring (and the total number at the end)
+                DVector ring_radius;          // The largest angle from the center of a pixel to any point in it
+                double max_ring_radius{};
+                DVector centers; // The unit vectors to the pixel centers (3 per pixel)
+
+                std::vector<size_t> offsets;
+                std::array<DVector, 3> dirs;
+                DVector weights;
+
+                double ring_theta(int iring) const { return M_PI * (iring + 0.5) / nrings; }
+
+                void create_pixelization(int _nrings) {
+                    nrings = _nrings;
+                    nphi.resize(nrings);
+                    ring_offset.assign(nrings + 1, 0);
+                    ring_radius.resize(nrings);
+                    for (int iring = 0; iring < nrings; iring++) {
+                        const double theta = ring_theta(iring);
+                        nphi[iring] = std::max(1, int(std::lround(2.0 * nrings * std::sin(theta))));
+                        ring_offset[iring + 1] = ring_offset[iring] + nphi[iring];
+
+                        // The pixel is a rectangle in (theta, phi) so the point furthest from the center is a corner
+                        const double half_dphi = M_PI / nphi[iring];
+                        double radius = 0.0;
+                        for (double theta_edge : {M_PI * iring / nrings, M_PI * (iring + 1) / nrings}) {
+                            const double cosangle = std::cos(theta) * std::cos(theta_edge) +
+                                                    std::sin(theta) * std::sin(theta_edge) * std::cos(half_dphi);
+                            radius = std::max(radius, std::acos(std::min(std::max(cosangle, -1.0), 1.0)));
+                        }
+                        ring_radius[iring] = radius * (1.0 + 1e-10) + 1e-12;
+                    }
+                    max_ring_radius = *std::max_element(ring_radius.begin(), ring_radius.end());
+
+                    centers.resize(3 * size_t(ring_offset.back()));
+                    for (int iring = 0; iring < nrings; iring++) {
+                        const double theta = ring_theta(iring);
+                        for (int iphi = 0; iphi < nphi[iring]; iphi++) {
+                            const double phi = 2.0 * M_PI * (iphi + 0.5) / nphi[iring];
+                            double * c = &centers[3 * size_t(ring_offset[iring] + iphi)];
+                            c[0] = std::sin(theta) * std::cos(phi);
+                            c[1] = std::sin(theta) * std::sin(phi);
+                            c[2] = std::cos(theta);
+                        }
+                    }
+                }
+            };
+
+            /// For binning particles to angular pixels: the largest number of rings
+            int nrings_max_size = 4096;
+
+            //===========================================================================
+            /// Pair counts as function of the angular separation theta (in radians, linear bins in [thetamin,
+            /// thetamax)) as seen from the observer. Only the direction to the particles matter. The particles are
+            /// binned to pixels on the sky (ParticlesInAngularPixels) and we only look at pairs of pixels that can
+            /// have pairs closer than thetamax. The pair counts are normalized by the total number of pairs.
+            /// If part1 == part2 (or part2 == nullptr) we do auto pairs. With MPI every task must have all the
+            /// particles and the pixels are split over tasks (distributed_particles is not supported).
+            //===========================================================================
+            template <typename T1, typename T2 = T1>
+            void AngularSeparationPairCounts(const T1 * part1,
+                                             size_t npart1,
+                                             const T2 * part2,
+                                             size_t npart2,
+                                             double thetamin,
+                                             double thetamax,
+                                             int nthetabins,
+                                             DVector & theta_array,
+                                             DVector & paircounts_array,
+                                             DVector observer_position,
+                                             bool verbose) {
+
+                const int nthreads = FML::NThreads;
+                assert_mpi(not distributed_particles,
+                           "AngularSeparationPairCounts :: distributed_particles is not supported\n");
+                assert_mpi(thetamax > thetamin and thetamin >= 0.0 and thetamax <= M_PI,
+                           "AngularSeparationPairCounts :: Error we need 0 <= thetamin < thetamax <= pi\n");
+                assert_mpi(nthetabins > 0, "AngularSeparationPairCounts :: Error nthetabins <= 0\n");
+                assert_mpi(observer_position.size() >= 3,
+                           "AngularSeparationPairCounts :: Error observer position has not enough coordinates\n");
+
+                [[maybe_unused]] int mpi_rank = 0;
+                [[maybe_unused]] int mpi_size = 1;
+#if defined(USE_MPI)
+                MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+                MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+                verbose = verbose and mpi_rank == 0;
+#endif
+
+                if (part2 == nullptr) {
+                    part2 = part1;
+                    npart2 = npart1;
+                }
+                const bool cross_pair_counting = (part1 != part2);
+
+                // The theta array
+                theta_array = DVector(nthetabins);
+                DVector chord2_edge_array(nthetabins + 1);
+                for (int i = 0; i < nthetabins; i++)
+                    theta_array[i] = thetamin + (thetamax - thetamin) * (i + 0.5) / double(nthetabins);
+                for (int i = 0; i <= nthetabins; i++) {
+                    const double theta = thetamin + (thetamax - thetamin) * i / double(nthetabins);
+                    chord2_edge_array[i] = 4.0 * std::sin(theta / 2.0) * std::sin(theta / 2.0);
+                }
+                paircounts_array = DVector(nthetabins, 0.0);
+                if (npart1 == 0 or npart2 == 0)
+                    return;
+
+                // The squared chord |n1 - n2|^2 = 4 sin^2(theta/2) of a pair gives theta without cancellation for
+                // small angles. The bin is found with a lookup table corrected with the squared bin edges
+                const double chord2min = chord2_edge_array[0];
+                const double chord2max = chord2_edge_array[nthetabins];
+                const int nlut = 64 * nthetabins;
+                const double inv_dlut = nlut / chord2max;
+                std::vector<int> ibin_lut(nlut + 1);
+                for (int i = 0; i <= nlut; i++) {
+                    const double theta = 2.0 * std::asin(std::min(std::sqrt(i / inv_dlut) / 2.0, 1.0));
+                    ibin_lut[i] = std::min(
+                        std::max(int((theta - thetamin) / (thetamax - thetamin) * nthetabins), 0), nthetabins - 1);
+                }
+
+                // Pixels of about thetamax / ncells_to_rmax, but not much smaller than the mean separation
+                const double npart_max = double(std::max(npart1, npart2));
+                const int nrings_wanted =
+                    std::min(int(ncells_to_rmax * M_PI / thetamax), int(std::sqrt(npart_max / 2.0)));
+                const int nrings = std::max(ngrid_min_size, std::min(nrings_wanted, nrings_max_size));
+                ParticlesInAngularPixels grid1;
+                ParticlesInAngularPixels grid2;
+                grid1.create(part1, npart1, observer_position, nrings);
+                if (cross_pair_counting)
+                    grid2.create(part2, npart2, observer_position, nrings);
+                const auto & grid_b = cross_pair_counting ? grid2 : grid1;
+                const auto & offsets_a = grid1.get_offsets();
+                const auto & offsets_b = grid_b.get_offsets();
+
+                // The work: the non-empty pixels with the estimated cost, most expensive first
+                struct PixelWork {
+                    int ipix;
+                    double cost;
+                };
+                std::vector<PixelWork> work;
+                for (int ipix = 0; ipix < grid1.get_npix(); ipix++)
+                    if (offsets_a[ipix + 1] > offsets_a[ipix])
+                        work.push_back({ipix, 0.0});
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+                for (size_t i = 0; i < work.size(); i++) {
+                    double np_neighbors = 0.0;
+                    grid1.for_each_pixel_within(work[i].ipix, thetamax, [&](int jpix) {
+                        np_neighbors += double(offsets_b[jpix + 1] - offsets_b[jpix]);
+                    });
+                    work[i].cost = double(offsets_a[work[i].ipix + 1] - offsets_a[work[i].ipix]) * np_neighbors + 1.0;
+                }
+                std::stable_sort(
+                    work.begin(), work.end(), [](const PixelWork & a, const PixelWork & b) { return a.cost > b.cost; });
+                if (mpi_size > 1) {
+                    std::vector<PixelWork> work_this_task;
+                    std::vector<double> cost_tasks(mpi_size, 0.0);
+                    for (auto & w : work) {
+                        const auto least_loaded = std::min_element(cost_tasks.begin(), cost_tasks.end());
+                        const int rank = int(least_loaded - cost_tasks.begin());
+                        cost_tasks[rank] += w.cost;
+                        if (rank == mpi_rank)
+                            work_this_task.push_back(w);
+                    }
+                    work = std::move(work_this_task);
+                }
+
+                if (verbose) {
+                    std::cout << "\n#=====================================================\n";
+                    std::cout << "# Angular pair counting with particles binned to pixels on the sky\n";
+                    std::cout << "# We are binning [" << (cross_pair_counting ? "crosspairs" : "autopairs") << "]\n";
+                    std::cout << "# Nrings: " << nrings << " Npixels: " << grid1.get_npix()
+                              << " Non-empty pixels: " << work.size() << "\n";
+                    std::cout << "# Using " << nthreads << " threads and " << mpi_size << " MPI tasks\n";
+                    std::cout << "#=====================================================\n";
+                }
+
+                // Count the pairs
+                const auto & na = grid1.get_directions();
+                const auto & nb = grid_b.get_directions();
+                const auto & wa = grid1.get_weights();
+                const auto & wb = grid_b.get_weights();
+                DVector2D count_threads(nthreads, DVector(nthetabins, 0.0));
+                DVector2D chord2_threads(nthreads);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+                for (size_t iwork = 0; iwork < work.size(); iwork++) {
+#if defined(USE_OMP)
+                    const int id = omp_get_thread_num();
+#else
+                    const int id = 0;
+#endif
+                    const int ipix = work[iwork].ipix;
+                    double * count = count_threads[id].data();
+                    DVector & chord2 = chord2_threads[id];
+                    grid1.for_each_pixel_within(ipix, thetamax, [&](int jpix) {
+                        // For auto pairs every pair of pixels is only visited once
+                        if (not cross_pair_counting and jpix < ipix)
+                            return;
+                        const size_t start_b = offsets_b[jpix];
+                        const int np_b = int(offsets_b[jpix + 1] - start_b);
+                        if (np_b == 0)
+                            return;
+                        if (chord2.size() < size_t(np_b))
+                            chord2.resize(np_b);
+
+                        for (size_t i = offsets_a[ipix]; i < offsets_a[ipix + 1]; i++) {
+                            int jstart = 0;
+                            if (not cross_pair_counting and ipix == jpix)
+                                jstart = int(i - offsets_a[ipix]) + 1;
+
+                            for (int idim = 0; idim < 3; idim++) {
+                                const double xi = na[idim][i];
+                                const double * xb = nb[idim].data() + start_b;
+                                double * c2 = chord2.data();
+#ifdef USE_OMP
+#pragma omp simd
+#endif
+                                for (int j = jstart; j < np_b; j++) {
+                                    const double d = xi - xb[j];
+                                    c2[j] = (idim == 0 ? 0.0 : c2[j]) + d * d;
+                                }
+                            }
+
+                            for (int j = jstart; j < np_b; j++) {
+                                const double c2 = chord2[j];
+                                if (c2 < chord2min or c2 >= chord2max or c2 == 0.0)
+                                    continue;
+                                int ibin = ibin_lut[int(c2 * inv_dlut)];
+                                while (ibin + 1 < nthetabins and c2 >= chord2_edge_array[ibin + 1])
+                                    ibin++;
+                                while (ibin > 0 and c2 < chord2_edge_array[ibin])
+                                    ibin--;
+                                count[ibin] += wa[i] * wb[start_b + j];
+                            }
+                        }
+                    });
+                }
+
+                // Sum over threads and tasks
+                for (int i = 0; i < nthreads; i++)
+                    for (int j = 0; j < nthetabins; j++)
+                        paircounts_array[j] += count_threads[i][j];
+                FML::SumArrayOverTasks(paircounts_array.data(), nthetabins);
+
+                // Normalize by the total number of pairs
+                double sum1_weights = 0.0, sum1_weights_squared = 0.0, sum2_weights = 0.0;
+                for (auto w : grid1.get_weights()) {
+                    sum1_weights += w;
+                    sum1_weights_squared += w * w;
+                }
+                for (auto w : grid_b.get_weights())
+                    sum2_weights += w;
+                double numpairs = sum1_weights * sum2_weights;
+                if (not cross_pair_counting)
+                    numpairs = (sum1_weights * sum1_weights - sum1_weights_squared) / 2.0;
+                for (auto & p : paircounts_array)
+                    p /= numpairs;
+            }
+
+            //===========================================================================
+            /// The angular correlation function w(theta) of a survey (with randoms) from the angular separation of
+            /// the pairs as seen from the observer (see AngularSeparationPairCounts). Theta is in radians and we use
+            /// the Landy-Szalay estimator. For an auto correlation pass the same pointers for part1/part2 and
+            /// rand1/rand2.
+            //===========================================================================
+            template <typename T1, typename T2 = T1, typename R1 = T1, typename R2 = T2>
+            void AngularSeparationCorrelationFunctionSurvey(const T1 * part1,
+                                                            size_t npart1,
+                                                            const R1 * rand1,
+                                                            size_t nrand1,
+                                                            const T2 * part2,
+                                                            size_t npart2,
+                                                            const R2 * rand2,
+                                                            size_t nrand2,
+                                                            double thetamin,
+                                                            double thetamax,
+                                                            int nthetabins,
+                                                            DVector & theta_array,
+                                                            DVector & paircounts_D1D2_array,
+                                                            DVector & paircounts_D1R2_array,
+                                                            DVector & paircounts_R1D2_array,
+                                                            DVector & paircounts_R1R2_array,
+                                                            DVector & corr_func_array,
+                                                            DVector observer_position,
+                                                            bool verbose) {
+
+                const bool cross_correlation = (part1 != part2);
+
+                AngularSeparationPairCounts<T1, T2>(part1,
+                                                    npart1,
+                                                    part2,
+                                                    npart2,
+                                                    thetamin,
+                                                    thetamax,
+                                                    nthetabins,
+                                                    theta_array,
+                                                    paircounts_D1D2_array,
+                                                    observer_position,
+                                                    verbose);
+                AngularSeparationPairCounts<T1, R2>(part1,
+                                                    npart1,
+                                                    rand2,
+                                                    nrand2,
+                                                    thetamin,
+                                                    thetamax,
+                                                    nthetabins,
+                                                    theta_array,
+                                                    paircounts_D1R2_array,
+                                                    observer_position,
+                                                    verbose);
+                if (not cross_correlation) {
+                    paircounts_R1D2_array = paircounts_D1R2_array;
+                } else {
+                    AngularSeparationPairCounts<T2, R1>(part2,
+                                                        npart2,
+                                                        rand1,
+                                                        nrand1,
+                                                        thetamin,
+                                                        thetamax,
+                                                        nthetabins,
+                                                        theta_array,
+                                                        paircounts_R1D2_array,
+                                                        observer_position,
+                                                        verbose);
+                }
+                AngularSeparationPairCounts<R1, R2>(rand1,
+                                                    nrand1,
+                                                    rand2,
+                                                    nrand2,
+                                                    thetamin,
+                                                    thetamax,
+                                                    nthetabins,
+                                                    theta_array,
+                                                    paircounts_R1R2_array,
+                                                    observer_position,
+                                                    verbose);
+
+                corr_func_array = DVector(nthetabins, 0.0);
+                for (int i = 0; i < nthetabins; i++)
+                    corr_func_array[i] = CorrelationFunctionEstimator(paircounts_D1D2_array[i],
+                                                                      paircounts_D1R2_array[i],
+                                                                      paircounts_R1D2_array[i],
+                                                                      paircounts_R1R2_array[i],
+                                                                      "LZ");
+            }
+
+            //===========================================================================
+            /// The pair counts of a survey split into nregions subsamples (regions) of the sky/volume. This is what
+            /// we need for jackknife or bootstrap errors: we get the correlation function for any resampling of the
+            /// regions without counting pairs again.
+            /// DD and RR are the counts of pairs with one particle in region a and one in region b (a <= b) and DR the
+            /// counts of pairs with the data particle in region a and the random in region b. All are stored as
+            /// paircounts[ir][a * nregions + b] and are not normalized.
+            //===========================================================================
+            struct SubsamplePairCounts {
+                int nregions{};
+                DVector r_array;
+                DVector2D DD;
+                DVector2D DR;
+                DVector2D RR;
+
+                // The sum of the weights (and the weights squared) of the data and the randoms in each region
+                DVector sum_weights_data;
+                DVector sum_weights_squared_data;
+                DVector sum_weights_rand;
+                DVector sum_weights_squared_rand;
+
+                /// The (Landy-Szalay) correlation function when region a is included region_weights[a] times. All ones
+                /// gives the full correlation function, a bootstrap sample is the number of times a region is drawn
+                DVector correlation_function(const DVector & region_weights) const {
+                    assert_mpi(int(region_weights.size()) == nregions,
+                               "SubsamplePairCounts::correlation_function :: Wrong number of region weights\n");
+
+                    // The normalization (the total number of pairs) of the resampled catalogue
+                    double wd = 0.0, wd2 = 0.0, wr = 0.0, wr2 = 0.0;
+                    for (int a = 0; a < nregions; a++) {
+                        const double w = region_weights[a];
+                        wd += w * sum_weights_data[a];
+                        wd2 += w * w * sum_weights_squared_data[a];
+                        wr += w * sum_weights_rand[a];
+                        wr2 += w * w * sum_weights_squared_rand[a];
+                    }
+                    const double norm_DD = (wd * wd - wd2) / 2.0;
+                    const double norm_DR = wd * wr;
+                    const double norm_RR = (wr * wr - wr2) / 2.0;
+
+                    DVector corr_func(r_array.size(), 0.0);
+                    for (size_t ir = 0; ir < r_array.size(); ir++) {
+                        double dd = 0.0, dr = 0.0, rr = 0.0;
+                        for (int a = 0; a < nregions; a++) {
+                            for (int b = 0; b < nregions; b++) {
+                                const double w = region_weights[a] * region_weights[b];
+                                dd += w * DD[ir][a * nregions + b];
+                                dr += w * DR[ir][a * nregions + b];
+                                rr += w * RR[ir][a * nregions + b];
+                            }
+                        }
+                        if (norm_DD > 0.0 and norm_DR > 0.0 and norm_RR > 0.0) {
+                            dd /= norm_DD;
+                            dr /= norm_DR;
+                            rr /= norm_RR;
+                            corr_func[ir] = CorrelationFunctionEstimator(dd, dr, dr, rr, "LZ");
+                        }
+                    }
+                    return corr_func;
+                }
+
+                /// The correlation function with region k removed
+                DVector jackknife_correlation_function(int k) const {
+                    DVector region_weights(nregions, 1.0);
+                    region_weights[k] = 0.0;
+                    return correlation_function(region_weights);
+                }
+
+                /// The jackknife estimate of the covariance of the correlation function
+                /// C_ij = (N-1)/N Sum_k (xi_k(r_i) - <xi>(r_i)) (xi_k(r_j) - <xi>(r_j))
+                DVector2D jackknife_covariance() const {
+                    const int nr = int(r_array.size());
+                    DVector2D corr_func_jackknife(nregions);
+                    DVector mean(nr, 0.0);
+                    for (int k = 0; k < nregions; k++) {
+                        corr_func_jackknife[k] = jackknife_correlation_function(k);
+                        for (int i = 0; i < nr; i++)
+                            mean[i] += corr_func_jackknife[k][i] / nregions;
+                    }
+                    DVector2D covariance(nr, DVector(nr, 0.0));
+                    for (int k = 0; k < nregions; k++)
+                        for (int i = 0; i < nr; i++)
+                            for (int j = 0; j < nr; j++)
+                                covariance[i][j] += (nregions - 1.0) / nregions *
+                                                    (corr_func_jackknife[k][i] - mean[i]) *
+                                                    (corr_func_jackknife[k][j] - mean[j]);
+                    return covariance;
+                }
+            };
+
+            /// The function that gives the region (in [0, nregions)) a particle belongs to
+            template <typename T>
+            using SubsampleRegionFunction = std::function<int(const T &)>;
+
+            /// Radial auto correlation of a survey (with randoms) where every particle is tagged with a
+            /// region by region_of_particle (and region_of_random). All the subsample pair counts are binned up in
+            /// the same pass as the usual pair counts, so jackknife or bootstrap errors cost roughly the same as one
+            /// correlation function. Use the methods of SubsamplePairCounts to get the correlation function of a
+            /// resampling. The memory needed per thread is ~ nrbins * nregions^2 doubles.
+            template <typename T, typename R = T>
+            void RadialCorrelationFunctionSurveySubsamples(const T * part,
+                                                           size_t npart,
+                                                           const R * rand,
+                                                           size_t nrand,
+                                                           double rmin,
+                                                           double rmax,
+                                                           int nrbins,
+                                                           int nregions,
+                                                           SubsampleRegionFunction<T> region_of_particle,
+                                                           SubsampleRegionFunction<R> region_of_random,
+                                                           SubsamplePairCounts & subsample_paircounts,
+                                                           bool periodic_box,
+                                                           bool verbose) {
+
+                assert_mpi(nregions > 0, "RadialCorrelationFunctionSurveySubsamples :: Error nregions <= 0\n");
+                const int nregionpairs = nregions * nregions;
+
+                // The sum of weights in each region
+                auto sum_weights_in_regions = [&](auto * p, size_t n, auto & region_of, DVector & sum, DVector & sum2) {
+                    sum = DVector(nregions, 0.0);
+                    sum2 = DVector(nregions, 0.0);
+                    for (size_t i = 0; i < n; i++) {
+                        const int region = region_of(p[i]);
+                        assert_mpi(region >= 0 and region < nregions,
+                                   "RadialCorrelationFunctionSurveySubsamples :: Region out of bounds\n");
+                        const double w = FML::PARTICLE::GetWeight(p[i]);
+                        sum[region] += w;
+                        sum2[region] += w * w;
+                    }
+                    if (distributed_particles) {
+                        FML::SumArrayOverTasks(sum.data(), nregions);
+                        FML::SumArrayOverTasks(sum2.data(), nregions);
+                    }
+                };
+                subsample_paircounts.nregions = nregions;
+                sum_weights_in_regions(part,
+                                       npart,
+                                       region_of_particle,
+                                       subsample_paircounts.sum_weights_data,
+                                       subsample_paircounts.sum_weights_squared_data);
+                sum_weights_in_regions(rand,
+                                       nrand,
+                                       region_of_random,
+                                       subsample_paircounts.sum_weights_rand,
+                                       subsample_paircounts.sum_weights_squared_rand);
+
+                // Bin up the pairs in each pair of regions as extra quantities in the usual pair count
+                auto subsample_counts = [&](auto * p1, size_t n1, auto * p2, size_t n2, auto & region1, auto & region2)
+                    -> DVector2D {
+                    using T1 = std::decay_t<decltype(*p1)>;
+                    using T2 = std::decay_t<decltype(*p2)>;
+                    ExtraQuantitiesToBinFunction<T1, T2> extra_quantities_to_bin =
+                        [&](const double *, double, double, const T1 & q1, const T2 & q2, double * storage) {
+                            const double w = FML::PARTICLE::GetWeight(q1) * FML::PARTICLE::GetWeight(q2);
+                            storage[region1(q1) * nregions + region2(q2)] += w;
+                        };
+                    DVector mu_array;
+                    DVector2D paircounts_array;
+                    DVector2D corr_func_array;
+                    DVector3D extra_quantities_array;
+                    AngularCorrelationFunctionBox<T1, T2>(p1,
+                                                          n1,
+                                                          p2,
+                                                          n2,
+                                                          rmin,
+                                                          rmax,
+                                                          nrbins,
+                                                          -1.0,
+                                                          1.0,
+                                                          1,
+                                                          subsample_paircounts.r_array,
+                                                          mu_array,
+                                                          paircounts_array,
+                                                          false,
+                                                          corr_func_array,
+                                                          {},
+                                                          periodic_box,
+                                                          verbose,
+                                                          nregionpairs,
+                                                          extra_quantities_array,
+                                                          extra_quantities_to_bin);
+                    return extra_quantities_array[0];
+                };
+                auto & region_of_data = region_of_particle;
+                auto & region_of_rand = region_of_random;
+                subsample_paircounts.DD = subsample_counts(part, npart, part, npart, region_of_data, region_of_data);
+                subsample_paircounts.DR = subsample_counts(part, npart, rand, nrand, region_of_data, region_of_rand);
+                subsample_paircounts.RR = subsample_counts(rand, nrand, rand, nrand, region_of_rand, region_of_rand);
+
+                // For the auto pairs the order of the two regions is arbitrary so we fold them to a <= b
+                for (auto * paircounts : {&subsample_paircounts.DD, &subsample_paircounts.RR}) {
+                    for (auto & counts : *paircounts) {
+                        for (int a = 0; a < nregions; a++) {
+                            for (int b = a + 1; b < nregions; b++) {
+                                counts[a * nregions + b] += counts[b * nregions + a];
+                                counts[b * nregions + a] = 0.0;
+                            }
+                        }
+                    }
+                }
+            }
+
 #ifdef USE_GSL
             /// Compute multipoles xi_ell(r) from a spline xi(mu,r)
             /// xiell(r) = (2ell+1) Int Pell(mu)xi(r,mu)dmu / Int dmu
@@ -1291,6 +2217,85 @@ namespace FML {
             }
 #endif
 
+#ifdef USE_FFTW
+            /// The radial correlation function of particles in a periodic box from pair counts on small scales and
+            /// from a grid on large scales (where pair counting is wasteful). The bins with r < r_switch come from
+            /// exact pair counts and the rest is the inverse fourier transform of |delta(k)|^2 (shotnoise subtracted
+            /// and window function deconvolved) of the density field on a grid with Ngrid cells per dimension. The
+            /// grid result is only accurate when r_switch is at least a few cells (~ 4 / Ngrid).
+            /// As for the power-spectrum methods every task has the particles in its own x-domain (we count the
+            /// pairs with distributed_particles = true). Lengths are in units of the boxsize.
+            template <typename T>
+            void RadialCorrelationFunctionBoxHybrid(const T * part,
+                                                    size_t npart,
+                                                    size_t npart_total,
+                                                    double rmin,
+                                                    double rmax,
+                                                    int nrbins,
+                                                    double r_switch,
+                                                    int Ngrid,
+                                                    std::string density_assignment_method,
+                                                    DVector & r_array,
+                                                    DVector & corr_func_array,
+                                                    bool verbose = false) {
+
+                assert_mpi(rmax > rmin and nrbins > 0,
+                           "RadialCorrelationFunctionBoxHybrid :: Binning has inconsistent parameters\n");
+                assert_mpi(rmax <= 0.5, "RadialCorrelationFunctionBoxHybrid :: rmax must be <= 0.5\n");
+
+                // The bins [0, nrbins_pairs) come from pair counts. We round r_switch up to a bin edge
+                const double dr = (rmax - rmin) / nrbins;
+                const int nrbins_pairs = std::min(std::max(int(std::ceil((r_switch - rmin) / dr)), 0), nrbins);
+                const double r_edge = rmin + nrbins_pairs * dr;
+
+                r_array = DVector(nrbins);
+                corr_func_array = DVector(nrbins, 0.0);
+                for (int i = 0; i < nrbins; i++)
+                    r_array[i] = rmin + (i + 0.5) * dr;
+
+                // Small scales: pair counts
+                if (nrbins_pairs > 0) {
+                    DVector r_pairs, paircounts, corr_func_pairs;
+                    const bool distributed_particles_orig = distributed_particles;
+                    distributed_particles = FML::NTasks > 1;
+                    RadialCorrelationFunctionBox<T>(part,
+                                                    npart,
+                                                    rmin,
+                                                    r_edge,
+                                                    nrbins_pairs,
+                                                    r_pairs,
+                                                    paircounts,
+                                                    false,
+                                                    corr_func_pairs,
+                                                    true,
+                                                    verbose);
+                    distributed_particles = distributed_particles_orig;
+                    for (int i = 0; i < nrbins_pairs; i++)
+                        corr_func_array[i] = corr_func_pairs[i];
+                }
+
+                // Large scales: the grid
+                if (nrbins_pairs < nrbins) {
+                    const auto nleftright =
+                        FML::INTERPOLATION::get_extra_slices_needed_for_density_assignment(density_assignment_method);
+                    FML::GRID::FFTWGrid<FML::PARTICLE::GetNDIM(T())> density_k(
+                        Ngrid, nleftright.first, nleftright.second);
+                    density_k.add_memory_label("RadialCorrelationFunctionBoxHybrid::density_k");
+                    FML::INTERPOLATION::particles_to_grid(
+                        part, npart, npart_total, density_k, density_assignment_method);
+                    density_k.fftw_r2c();
+                    FML::INTERPOLATION::deconvolve_window_function_fourier(density_k, density_assignment_method);
+
+                    DVector r_grid, corr_func_grid;
+                    const double shotnoise = 1.0 / double(npart_total);
+                    FML::CORRELATIONFUNCTIONS::compute_correlation_function_fourier(
+                        density_k, r_edge, rmax, nrbins - nrbins_pairs, r_grid, corr_func_grid, shotnoise);
+                    for (int i = nrbins_pairs; i < nrbins; i++)
+                        corr_func_array[i] = corr_func_grid[i - nrbins_pairs];
+                }
+            }
+#endif
+
         } // namespace PAIRCOUNTS
     }     // namespace CORRELATIONFUNCTIONS
 } // namespace FML
@@ -1,11 +1,17 @@
 #ifndef PARTICLEREFLECTION_HEADER
 #define PARTICLEREFLECTION_HEADER
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 
 #include <FML/Global/Global.h>
 
@@ -217,6 +223,15 @@ namespace FML {
             std::memcpy(&t, get_NthArgOf<0>(args...), GetSize(t));
         };
 
+        /// Can the particle be communicated by just copying its bytes? True if it is trivially copyable and does not
+        /// provide its own communication methods. MPIParticles then sends and recieves the particles directly
+        /// from and into the particle array instead of going through a buffer one particle at a time
+        template <class T>
+        constexpr bool is_bitwise_communicable() {
+            return std::is_trivially_copyable<T>::value and not has_get_particle_byte_size<T>() and
+                   not has_append_to_buffer<T>() and not has_assign_from_buffer<T>();
+        }
+
         //=====================================================================
         // Lagrangian perturbation theory (Displacement fields and Lagrangian coord)
         // Returns (non-const) pointer to first element so no set method needed
@@ -228,6 +243,7 @@ namespace FML {
         SFINAE_TEST_GET(GetdDdloga_1LPT, get_dDdloga_1LPT)
         SFINAE_TEST_GET(GetdDdloga_2LPT, get_dDdloga_2LPT)
         SFINAE_TEST_GET(GetLagrangianPos, get_q)
+        SFINAE_TEST_GET(GetLagrangianID, get_lagrangian_id)
         constexpr double * GetD_1LPT(...) {
             assert_mpi(false, "Trying to get D_1LPT from a particle that has no get_D_1LPT method");
             return nullptr;
@@ -256,6 +272,47 @@ namespace FML {
             assert_mpi(false, "Trying to get the Lagrangian coordinate q from a particle that has no get_q method");
             return nullptr;
         };
+        constexpr long long int GetLagrangianID(...) {
+            assert_mpi(false, "Trying to get the Lagrangian ID from a particle that has no get_lagrangian_id method");
+            return -1;
+        };
+
+        /// Particles that don't store the Lagrangian position q, but has an ID that is the index of the particle in
+        /// the grid made by MPIParticles::create_particle_grid so that we can compute q from it (when needed)
+        template <class T>
+        constexpr bool has_lagrangian_position_from_id() {
+            return not has_get_q<T>() and has_get_lagrangian_id<T>();
+        }
+
+        /// The Lagrangian position q of the particle with the index id in a grid with Npart_1D particles per dimension
+        /// made by MPIParticles::create_particle_grid (the last coordinate is the one that varies the fastest)
+        template <int N, class IDType, class PosType>
+        void lagrangian_position_from_id(IDType id, int Npart_1D, PosType * q) {
+            for (int idim = N - 1; idim >= 0; idim--) {
+                q[idim] = PosType((id % Npart_1D) / double(Npart_1D));
+                id /= Npart_1D;
+            }
+        }
+
+        /// Periodic wrap of a coordinate into [0,1). For positions stored in single precision x + 1 rounds to exactly
+        /// 1 for tiny negative x so we clamp to the largest value below 1 to keep the particle inside the box
+        template <class PosType>
+        void wrap_periodic(PosType & x) {
+            if (x >= PosType(1))
+                x -= PosType(1);
+            if (x < PosType(0))
+                x += PosType(1);
+            if (x >= PosType(1))
+                x = std::nextafter(PosType(1), PosType(0));
+        }
+
+        /// Branch-free version of wrap_periodic (for use in loops we want the compiler to vectorize). Wraps any x
+        /// (not only those within one box length of [0,1)) and clamps to the largest value below 1 as above
+        template <class PosType>
+        inline PosType wrap_periodic_branchfree(PosType x) {
+            constexpr PosType largest_below_one = PosType(1) - std::numeric_limits<PosType>::epsilon() / PosType(2);
+            return std::min(x - std::floor(x), largest_below_one);
+        }
 
         //=====================================================================
         // Halo finding
@@ -310,6 +367,8 @@ namespace FML {
         SFINAE_TEST_SET(SetRedshift, set_z)
         SFINAE_TEST_GET(GetWeight, get_weight)
         SFINAE_TEST_SET(SetWeight, set_weight)
+        SFINAE_TEST_GET(GetNbar, get_nbar)
+        SFINAE_TEST_SET(SetNbar, set_nbar)
         constexpr double GetRA(...) {
             assert_mpi(false, "Trying to get RA from a particle that has no get_RA method");
             return 0.0;
@@ -343,6 +402,224 @@ namespace FML {
         constexpr void SetWeight(...) {
             assert_mpi(false, "Trying to set weight from a particle that has no set_weight method");
         }
+        constexpr double GetNbar(...) {
+            assert_mpi(false, "Trying to get nbar from a particle that has no get_nbar method");
+            return 0.0;
+        }
+        constexpr void SetNbar(...) {
+            assert_mpi(false, "Trying to set nbar from a particle that has no set_nbar method");
+        }
+
+        //=====================================================================
+        // Compile time description of the layout of a particle type: which of the fields above it has, the size
+        // of each field and if the particle has a fixed size (no custom get_particle_byte_size). Serializers,
+        // writers and converters can loop over ParticleLayout<T>::fields or use get_field<kind> and
+        // AppendRangeToBuffer / AssignRangeFromBuffer instead of testing and calling the methods per particle.
+        //
+        //    Example:
+        //    using Layout = FML::PARTICLE::ParticleLayout<Particle>;
+        //    static_assert(Layout::fixed_size and Layout::has(ParticleFieldKind::Pos));
+        //    for (auto & f : Layout::fields)
+        //        std::cout << f.name << " " << f.ncomponents << " x " << f.component_bytes << " bytes\n";
+        //=====================================================================
+
+        // Field name, getter method, accessor and if the getter returns a pointer to an array of NDIM values
+#define FML_PARTICLE_FIELDS(X)                                                                                         \
+    X(Pos, get_pos, GetPos, true)                                                                                      \
+    X(Vel, get_vel, GetVel, true)                                                                                      \
+    X(ID, get_id, GetID, false)                                                                                        \
+    X(Mass, get_mass, GetMass, false)                                                                                  \
+    X(Volume, get_volume, GetVolume, false)                                                                            \
+    X(FoFID, get_fofid, GetFoFID, false)                                                                               \
+    X(Family, get_family, GetFamily, false)                                                                            \
+    X(Tag, get_tag, GetTag, false)                                                                                     \
+    X(Level, get_level, GetLevel, false)                                                                               \
+    X(RA, get_RA, GetRA, false)                                                                                        \
+    X(DEC, get_DEC, GetDEC, false)                                                                                     \
+    X(Redshift, get_z, GetRedshift, false)                                                                             \
+    X(Weight, get_weight, GetWeight, false)                                                                            \
+    X(Nbar, get_nbar, GetNbar, false)                                                                                  \
+    X(D_1LPT, get_D_1LPT, GetD_1LPT, true)                                                                             \
+    X(D_2LPT, get_D_2LPT, GetD_2LPT, true)                                                                             \
+    X(D_3LPTa, get_D_3LPTa, GetD_3LPTa, true)                                                                          \
+    X(D_3LPTb, get_D_3LPTb, GetD_3LPTb, true)                                                                          \
+    X(dDdloga_1LPT, get_dDdloga_1LPT, GetdDdloga_1LPT, true)                                                           \
+    X(dDdloga_2LPT, get_dDdloga_2LPT, GetdDdloga_2LPT, true)                                                           \
+    X(LagrangianPos, get_q, GetLagrangianPos, true)                                                                    \
+    X(LagrangianID, get_lagrangian_id, GetLagrangianID, false)
+
+#define FML_FIELD_KIND(name, getmethod, accessor, is_array) name,
+        enum class ParticleFieldKind { FML_PARTICLE_FIELDS(FML_FIELD_KIND) };
+#undef FML_FIELD_KIND
+
+        /// Description of a field of a particle
+        struct ParticleField {
+            ParticleFieldKind kind;
+            const char * name;
+            /// NDIM for the arrays (Pos, Vel, ...) and 1 otherwise
+            int ncomponents;
+            /// The size of one component
+            int component_bytes;
+            /// The getter returns a pointer into the particle (so the field has an offset in the particle)
+            bool is_array;
+        };
+
+        /// Get a field of a particle (the value or the pointer to the first component for arrays)
+        template <ParticleFieldKind kind, class T>
+        auto get_field(T & p) {
+#define FML_GET_FIELD(name, getmethod, accessor, is_array)                                                             \
+    if constexpr (kind == ParticleFieldKind::name)                                                                     \
+        return accessor(p);                                                                                            \
+    else
+            FML_PARTICLE_FIELDS(FML_GET_FIELD)
+            static_assert(sizeof(T) < 0, "Unknown particle field");
+#undef FML_GET_FIELD
+        }
+
+        template <class T>
+        class ParticleLayout {
+          private:
+            static inline const T particle{};
+
+            template <ParticleFieldKind kind, bool is_array>
+            static constexpr int component_bytes() {
+                using FieldType = decltype(get_field<kind>(std::declval<T &>()));
+                if constexpr (is_array)
+                    return int(sizeof(std::remove_pointer_t<FieldType>));
+                else
+                    return int(sizeof(FieldType));
+            }
+
+            static constexpr auto make_fields();
+
+          public:
+            /// The dimension of the particle
+            static constexpr int ndim = GetNDIM(particle);
+            /// The particle has a fixed size of sizeof(T) bytes when communicated or written
+            static constexpr bool fixed_size = not has_get_particle_byte_size<T>();
+            /// The particle can be communicated and written by just copying its bytes
+            static constexpr bool bitwise = is_bitwise_communicable<T>();
+            /// The number of fields the particle has
+#define FML_COUNT_FIELD(name, getmethod, accessor, is_array) +int(has_##getmethod<T>())
+            static constexpr int nfields = 0 FML_PARTICLE_FIELDS(FML_COUNT_FIELD);
+#undef FML_COUNT_FIELD
+
+            /// Does the particle have the field
+            static constexpr bool has(ParticleFieldKind kind) { return index_of(kind) >= 0; }
+
+            /// The index of the field in fields (-1 if the particle does not have it)
+            static constexpr int index_of(ParticleFieldKind kind) {
+                for (int i = 0; i < nfields; i++)
+                    if (fields[i].kind == kind)
+                        return i;
+                return -1;
+            }
+
+            /// The byte offset of each field in the particle (-1 if the field is not an array inside the particle).
+            /// Found once from a default constructed particle as the getters can't be evaluated at compile time
+            static const std::array<std::ptrdiff_t, nfields> & offsets() {
+                static const std::array<std::ptrdiff_t, nfields> offset = []() {
+                    std::array<std::ptrdiff_t, nfields> result{};
+                    T p{};
+                    const char * begin = reinterpret_cast<const char *>(&p);
+                    int i = 0;
+#define FML_FIELD_OFFSET(name, getmethod, accessor, is_array)                                                          \
+    if constexpr (has_##getmethod<T>()) {                                                                              \
+        result[i] = -1;                                                                                                \
+        if constexpr (is_array) {                                                                                      \
+            const char * ptr = reinterpret_cast<const char *>(accessor(p));                                           \
+            if (ptr >= begin and ptr + fields[i].ncomponents * fields[i].component_bytes <= begin + sizeof(T))         \
+                result[i] = ptr - begin;                                                                               \
+        }                                                                                                              \
+        i++;                                                                                                           \
+    }
+                    FML_PARTICLE_FIELDS(FML_FIELD_OFFSET)
+#undef FML_FIELD_OFFSET
+                    return result;
+                }();
+                return offset;
+            }
+
+            /// The fields the particle has (in the order of FML_PARTICLE_FIELDS)
+            static constexpr std::array<ParticleField, nfields> fields = make_fields();
+        };
+
+        template <class T>
+        constexpr auto ParticleLayout<T>::make_fields() {
+            std::array<ParticleField, nfields> result{};
+            int i = 0;
+#define FML_MAKE_FIELD(name, getmethod, accessor, is_array)                                                            \
+    if constexpr (has_##getmethod<T>())                                                                                \
+        result[i++] = ParticleField{ParticleFieldKind::name,                                                           \
+                                    #name,                                                                             \
+                                    is_array ? ndim : 1,                                                               \
+                                    component_bytes<ParticleFieldKind::name, is_array>(),                              \
+                                    is_array};
+            FML_PARTICLE_FIELDS(FML_MAKE_FIELD)
+#undef FML_MAKE_FIELD
+            return result;
+        }
+
+        /// The number of bytes needed to communicate or write n particles
+        template <class T>
+        size_t GetRangeSize(T * part, size_t n) {
+            if constexpr (ParticleLayout<T>::fixed_size) {
+                (void)part;
+                return n * sizeof(T);
+            } else {
+                size_t bytes = 0;
+                for (size_t i = 0; i < n; i++)
+                    bytes += GetSize(part[i]);
+                return bytes;
+            }
+        }
+
+        /// Serialize n particles into the buffer (one copy for particles that are bitwise communicable).
+        /// Returns the number of bytes written
+        template <class T>
+        size_t AppendRangeToBuffer(T * part, size_t n, char * buffer) {
+            if constexpr (ParticleLayout<T>::bitwise) {
+                std::memcpy(buffer, part, n * sizeof(T));
+                return n * sizeof(T);
+            } else {
+                char * start = buffer;
+                for (size_t i = 0; i < n; i++) {
+                    AppendToBuffer(part[i], buffer);
+                    buffer += GetSize(part[i]);
+                }
+                return size_t(buffer - start);
+            }
+        }
+
+        /// Assign n particles from the buffer (one copy for particles that are bitwise communicable).
+        /// Returns the number of bytes read
+        template <class T>
+        size_t AssignRangeFromBuffer(T * part, size_t n, char * buffer) {
+            if constexpr (ParticleLayout<T>::bitwise) {
+                std::memcpy(part, buffer, n * sizeof(T));
+                return n * sizeof(T);
+            } else {
+                char * start = buffer;
+                for (size_t i = 0; i < n; i++) {
+                    AssignFromBuffer(part[i], buffer);
+                    buffer += GetSize(part[i]);
+                }
+                return size_t(buffer - start);
+            }
+        }
+
+#ifdef USE_MPI
+        /// MPI type for sending whole particles (only for bitwise communicable particles)
+        template <class T>
+        MPI_Datatype create_particle_mpi_datatype() {
+            static_assert(ParticleLayout<T>::bitwise,
+                          "Particle must be bitwise communicable to be sent with a MPI datatype");
+            MPI_Datatype type;
+            MPI_Type_contiguous(sizeof(T), MPI_BYTE, &type);
+            MPI_Type_commit(&type);
+            return type;
+        }
+#endif
 
         template <class T>
         void info() {
@@ -383,11 +660,11 @@ namespace FML {
                 std::cout << "# Dimension is " << N << "\n";
 
                 if constexpr (FML::PARTICLE::has_get_pos<T>())
-                    std::cout << "# Particle has [Position] (" << sizeof(FML::PARTICLE::GetVel(tmp)[0]) * N
+                    std::cout << "# Particle has [Position] (" << sizeof(FML::PARTICLE::GetPos(tmp)[0]) * N
                               << " bytes)\n";
 
                 if constexpr (FML::PARTICLE::has_get_vel<T>())
-                    std::cout << "# Particle has [Velocity] (" << sizeof(FML::PARTICLE::GetPos(tmp)[0]) * N
+                    std::cout << "# Particle has [Velocity] (" << sizeof(FML::PARTICLE::GetVel(tmp)[0]) * N
                               << " bytes)\n";
 
                 if constexpr (FML::PARTICLE::has_set_mass<T>())
@@ -417,6 +694,8 @@ namespace FML {
                               << " bytes)\n";
                 if constexpr (FML::PARTICLE::has_set_weight<T>())
                     std::cout << "# Particle has [Weight] (" << sizeof(FML::PARTICLE::GetWeight(tmp)) << " bytes)\n";
+                if constexpr (FML::PARTICLE::has_set_nbar<T>())
+                    std::cout << "# Particle has [Nbar] (" << sizeof(FML::PARTICLE::GetNbar(tmp)) << " bytes)\n";
 
                 // LPT specific things
                 if constexpr (FML::PARTICLE::has_get_D_1LPT<T>())
@@ -440,6 +719,9 @@ namespace FML {
                 if constexpr (FML::PARTICLE::has_get_q<T>())
                     std::cout << "# Particle has [Lagrangian position] ("
                               << sizeof(FML::PARTICLE::GetLagrangianPos(tmp)[0]) * N << " bytes)\n";
+                if constexpr (FML::PARTICLE::has_lagrangian_position_from_id<T>())
+                    std::cout << "# Particle has [Lagrangian position from ID] ("
+                              << sizeof(FML::PARTICLE::GetLagrangianID(tmp)) << " bytes)\n";
                 if constexpr (FML::PARTICLE::has_get_D_1LPT<T>() and FML::PARTICLE::has_get_D_2LPT<T>() and
                               FML::PARTICLE::has_get_D_3LPTa<T>() and FML::PARTICLE::has_get_D_3LPTb<T>()) {
                     std::cout << "# Particle compatible with 3LPT COLA\n";
@@ -451,10 +733,12 @@ namespace FML {
                 } else {
                     std::cout << "# Particle is not compatible with COLA\n";
                 }
-                if constexpr (FML::PARTICLE::has_get_q<T>() and FML::PARTICLE::has_get_D_1LPT<T>() and
+                constexpr bool has_q =
+                    FML::PARTICLE::has_get_q<T>() or FML::PARTICLE::has_lagrangian_position_from_id<T>();
+                if constexpr (has_q and FML::PARTICLE::has_get_D_1LPT<T>() and
                               FML::PARTICLE::has_get_dDdloga_1LPT<T>()) {
                     std::cout << "# Particle compatible with 1LPT scaledependent COLA\n";
-                } else if constexpr (FML::PARTICLE::has_get_q<T>() and FML::PARTICLE::has_get_D_1LPT<T>() and
+                } else if constexpr (has_q and FML::PARTICLE::has_get_D_1LPT<T>() and
                               FML::PARTICLE::has_get_D_2LPT<T>()) {
                     std::cout << "# Particle compatible with 2+ LPT scaledependent COLA\n";
                 } else {
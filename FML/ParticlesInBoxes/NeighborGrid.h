@@ -0,0 +1,329 @@
+#ifndef NEIGHBORGRID_HEADER
+#define NEIGHBORGRID_HEADER
+
+#include <FML/Global/Global.h>
+#include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace FML {
+    namespace PARTICLE {
+
+        //======================================================================
+        ///
+        /// A cell-linked-list (chaining mesh) for fast neighbor searches. We only store the indices of the
+        /// particles sorted by cell (a counting sort) and the offsets of the cells: the particles in cell i are
+        /// indices[offsets[i]], ..., indices[offsets[i+1]-1] and within a cell they are in the order they were given
+        /// to us. The particles themselves are not copied so the same grid can be used for several analyses of
+        /// the same particles (as long as they don't move). With OpenMP the grid is made using all the threads.
+        ///
+        /// The grid has cells of size 1/Ngrid. In the x-direction it covers [xmin, xmax) which by default is the
+        /// whole box, but with MPI it can be the local domain plus the ghost particles close to it (with unwrapped
+        /// positions, i.e. x < 0 for the ghosts to the left on task 0). In that case we never wrap in the
+        /// x-direction as the ghosts are already there.
+        ///
+        /// The index of a cell is [iz + iy * N + ix*N^2 + ...], i.e. last coord varies first (like
+        /// ParticlesInBoxes which is built on this grid).
+        ///
+        /// Used by ParticlesInBoxes (and through it the pair counting) and by the Friend of Friend linking.
+        ///
+        //======================================================================
+
+        template <int NDIM>
+        class NeighborGrid {
+          private:
+            std::vector<size_t> indices{};
+            std::vector<size_t> offsets{};
+            int Ngrid{0};
+            int Local_nx{0};
+            double xmin_grid{0.0};
+            bool periodic{false};
+            bool wrap_x{false};
+
+          public:
+            /// Create the grid. get_pos_of_particle(i) returns a pointer to the position of particle i
+            template <class PositionFunction>
+            void create(size_t npart,
+                        PositionFunction && get_pos_of_particle,
+                        int ngrid,
+                        bool periodic_box,
+                        double xmin = 0.0,
+                        double xmax = 1.0);
+
+            /// Create the grid from particles with a get_pos method
+            template <class T>
+            void create(const T * part,
+                        size_t npart,
+                        int ngrid,
+                        bool periodic_box,
+                        double xmin = 0.0,
+                        double xmax = 1.0);
+
+            // Get the raw data
+            const std::vector<size_t> & get_indices() const;
+            const std::vector<size_t> & get_offsets() const;
+            size_t get_ncells() const;
+            size_t get_npart() const;
+            int get_ngrid() const;
+            int get_local_nx() const;
+            double get_xmin() const;
+            bool is_periodic() const;
+
+            /// The particles in a cell as a range of indices
+            const size_t * cell_begin(size_t index) const;
+            const size_t * cell_end(size_t index) const;
+            size_t get_np(size_t index) const;
+
+            /// The coordinate of the cell a position is in
+            template <class PositionType>
+            std::array<int, NDIM> get_cell_coord(const PositionType * pos) const;
+
+            /// Index of the cell with coordinate coord. The coordinate is wrapped if the box is periodic (and
+            /// the grid covers the box). Returns false if the cell does not exist
+            bool get_cell_index(std::array<int, NDIM> coord, size_t & index) const;
+
+            /// Calls function(index) for all the (distinct) cells at distance <= 1 cell from coord (itself included)
+            template <class CellFunction>
+            void for_each_neighbor_cell(const std::array<int, NDIM> & coord, CellFunction && function) const;
+
+            /// Calls function(index) for all the (distinct) cells at distance <= ncells cells from coord
+            template <class CellFunction>
+            void for_each_cell_in_range(const std::array<int, NDIM> & coord,
+                                        int ncells,
+                                        CellFunction && function) const;
+
+            // Free up the memory
+            void clear();
+        };
+
+        template <int NDIM>
+        template <class PositionFunction>
+        void NeighborGrid<NDIM>::create(size_t npart,
+                                        PositionFunction && get_pos_of_particle,
+                                        int ngrid,
+                                        bool periodic_box,
+                                        double xmin,
+                                        double xmax) {
+            Ngrid = ngrid;
+            Local_nx = int(std::ceil((xmax - xmin) * ngrid));
+            xmin_grid = xmin;
+            periodic = periodic_box;
+            wrap_x = periodic and xmin == 0.0 and Local_nx == Ngrid;
+
+            const size_t ncells = size_t(Local_nx) * FML::power(Ngrid, NDIM - 1);
+
+            // Index of the cell every particle belong to and the number of particles in each cell
+            std::vector<size_t> cell_index(npart);
+            offsets.assign(ncells + 1, 0);
+            bool positions_ok = true;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(&& : positions_ok)
+#endif
+            for (size_t i = 0; i < npart; i++) {
+                const auto * pos = get_pos_of_particle(i);
+                size_t index = 0;
+                for (int idim = 0; idim < NDIM; idim++) {
+                    const int n = idim == 0 ? Local_nx : Ngrid;
+                    int ix = int((pos[idim] - (idim == 0 ? xmin_grid : 0.0)) * Ngrid);
+                    if (ix >= n or ix < 0) {
+                        positions_ok = false;
+                        ix = 0;
+                    }
+                    index = index * Ngrid + ix;
+                }
+                cell_index[i] = index;
+#ifdef USE_OMP
+#pragma omp atomic
+#endif
+                offsets[index + 1]++;
+            }
+            if (not positions_ok)
+                throw std::runtime_error("NeighborGrid positions has to be inside the grid\n");
+
+            // The first particle in each cell
+            for (size_t i = 0; i < ncells; i++)
+                offsets[i + 1] += offsets[i];
+
+            // Where each particle goes in the sorted array (the order of the particles within a cell
+            // must not depend on the threads so we sort them by their index afterwards)
+            indices.resize(npart);
+            {
+                std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < npart; i++) {
+                    size_t j;
+#ifdef USE_OMP
+#pragma omp atomic capture
+#endif
+                    j = next[cell_index[i]]++;
+                    indices[j] = i;
+                }
+            }
+#ifdef USE_OMP
+            cell_index.clear();
+            cell_index.shrink_to_fit();
+#pragma omp parallel for schedule(dynamic, 1024)
+            for (size_t i = 0; i < ncells; i++)
+                std::sort(indices.begin() + offsets[i], indices.begin() + offsets[i + 1]);
+#endif
+        }
+
+        template <int NDIM>
+        template <class T>
+        void NeighborGrid<NDIM>::create(const T * part,
+                                        size_t npart,
+                                        int ngrid,
+                                        bool periodic_box,
+                                        double xmin,
+                                        double xmax) {
+            assert_mpi(FML::PARTICLE::has_get_pos<T>(),
+                       "[NeighborGrid] Particle class must have positions via a get_pos method");
+            create(
+                npart,
+                [&](size_t i) { return FML::PARTICLE::GetPos(const_cast<T &>(part[i])); },
+                ngrid,
+                periodic_box,
+                xmin,
+                xmax);
+        }
+
+        template <int NDIM>
+        const std::vector<size_t> & NeighborGrid<NDIM>::get_indices() const {
+            return indices;
+        }
+
+        template <int NDIM>
+        const std::vector<size_t> & NeighborGrid<NDIM>::get_offsets() const {
+            return offsets;
+        }
+
+        template <int NDIM>
+        size_t NeighborGrid<NDIM>::get_ncells() const {
+            return offsets.size() > 0 ? offsets.size() - 1 : 0;
+        }
+
+        template <int NDIM>
+        size_t NeighborGrid<NDIM>::get_npart() const {
+            return indices.size();
+        }
+
+        template <int NDIM>
+        int NeighborGrid<NDIM>::get_ngrid() const {
+            return Ngrid;
+        }
+
+        template <int NDIM>
+        int NeighborGrid<NDIM>::get_local_nx() const {
+            return Local_nx;
+        }
+
+        template <int NDIM>
+        double NeighborGrid<NDIM>::get_xmin() const {
+            return xmin_grid;
+        }
+
+        template <int NDIM>
+        bool NeighborGrid<NDIM>::is_periodic() const {
+            return periodic;
+        }
+
+        template <int NDIM>
+        const size_t * NeighborGrid<NDIM>::cell_begin(size_t index) const {
+            return indices.data() + offsets[index];
+        }
+
+        template <int NDIM>
+        const size_t * NeighborGrid<NDIM>::cell_end(size_t index) const {
+            return indices.data() + offsets[index + 1];
+        }
+
+        template <int NDIM>
+        size_t NeighborGrid<NDIM>::get_np(size_t index) const {
+            return offsets[index + 1] - offsets[index];
+        }
+
+        template <int NDIM>
+        template <class PositionType>
+        std::array<int, NDIM> NeighborGrid<NDIM>::get_cell_coord(const PositionType * pos) const {
+            std::array<int, NDIM> coord;
+            for (int idim = 0; idim < NDIM; idim++)
+                coord[idim] = int((pos[idim] - (idim == 0 ? xmin_grid : 0.0)) * Ngrid);
+            return coord;
+        }
+
+        template <int NDIM>
+        bool NeighborGrid<NDIM>::get_cell_index(std::array<int, NDIM> coord, size_t & index) const {
+            index = 0;
+            for (int idim = 0; idim < NDIM; idim++) {
+                const int n = idim == 0 ? Local_nx : Ngrid;
+                if (periodic and (idim > 0 or wrap_x)) {
+                    coord[idim] = coord[idim] % n;
+                    if (coord[idim] < 0)
+                        coord[idim] += n;
+                } else if (coord[idim] < 0 or coord[idim] >= n) {
+                    return false;
+                }
+                index = index * Ngrid + coord[idim];
+            }
+            return true;
+        }
+
+        template <int NDIM>
+        template <class CellFunction>
+        void NeighborGrid<NDIM>::for_each_neighbor_cell(const std::array<int, NDIM> & coord,
+                                                        CellFunction && function) const {
+            for_each_cell_in_range(coord, 1, function);
+        }
+
+        template <int NDIM>
+        template <class CellFunction>
+        void NeighborGrid<NDIM>::for_each_cell_in_range(const std::array<int, NDIM> & coord,
+                                                        int ncells,
+                                                        CellFunction && function) const {
+            // If we wrap around a grid with less than 2*ncells+1 cells the cells at the two ends of
+            // the range are the same so we limit the range to avoid visiting a cell twice
+            std::array<int, NDIM> ileft, iright;
+            for (int idim = 0; idim < NDIM; idim++) {
+                const int n = idim == 0 ? Local_nx : Ngrid;
+                const bool wrap = periodic and (idim > 0 or wrap_x);
+                ileft[idim] = -ncells;
+                iright[idim] = wrap and n < 2 * ncells + 1 ? n - 1 - ncells : ncells;
+            }
+
+            std::array<int, NDIM> delta = ileft;
+            std::array<int, NDIM> icoord;
+            for (;;) {
+                for (int idim = 0; idim < NDIM; idim++)
+                    icoord[idim] = coord[idim] + delta[idim];
+                size_t index;
+                if (get_cell_index(icoord, index))
+                    function(index);
+
+                // Go to the next cell (last coord varies first)
+                int idim = NDIM - 1;
+                while (idim >= 0 and delta[idim] == iright[idim]) {
+                    delta[idim] = ileft[idim];
+                    idim--;
+                }
+                if (idim < 0)
+                    break;
+                delta[idim]++;
+            }
+        }
+
+        template <int NDIM>
+        void NeighborGrid<NDIM>::clear() {
+            indices.clear();
+            indices.shrink_to_fit();
+            offsets.clear();
+            offsets.shrink_to_fit();
+        }
+    } // namespace PARTICLE
+} // namespace FML
+
+#endif
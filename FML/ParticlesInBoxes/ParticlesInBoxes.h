@@ -2,40 +2,33 @@
 #define PARTICLEGRID_HEADER
 
 #include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+#include <FML/ParticlesInBoxes/NeighborGrid.h>
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 namespace FML {
     namespace PARTICLE {
 
         //======================================================================
-        /// Class for binning objects into cells. Useful for speeding up algorithms.
+        /// A cell in ParticlesInBoxes. This is just a view of the particles of the cell in the (contiguous) array
+        /// of all the particles sorted by cell so its cheap to copy around and only valid as long as the grid is.
         //======================================================================
         template <class T>
         struct Cell {
+            T * ps{nullptr};
             size_t np{0};
-            std::vector<T> ps{};
-
-            // Increase np by 1. For counting particles
-            void operator++();
 
             // Get the raw data
-            std::vector<T> & get_part();
-            T & get_part(int i);
+            T & get_part(size_t i);
             size_t get_np() const;
 
-            // Initialize cell. np = 0 and clear ps if its not already empty
-            void init();
-
-            // Reserve memory for n partices
-            void allocate(int n);
-
-            // Add a particle to its corresponding cell in the grid
-            void add(const T & p);
-
-            // Free up memory
-            void clear();
+            // For range based for-loops over the particles in the cell
+            T * begin();
+            T * end();
         };
 
         //======================================================================
@@ -45,27 +38,43 @@ namespace FML {
         /// auto *get_pos() : Pointer to first element in position
         /// int *get_ndim() : Number of dimensions in position
         ///
-        /// NB: This is not parallelized in any way!
+        /// The particles are stored in one contiguous array sorted by cell (a counting sort) with the particles of
+        /// cell i being particles[offsets[i]], ..., particles[offsets[i+1]-1]. Within a cell the particles are in
+        /// the order they were given to us. With OpenMP the grid is made using all the threads. The sorting is done
+        /// by a NeighborGrid and if we already have one for the particles we can give it to create to reuse it.
+        ///
+        /// If the particles have only moved a little since the grid was made (analyses at nearby epochs in a
+        /// simulation) then update is much cheaper than a new create: only the particles that changed cell
+        /// are sorted and the rest are copied over in order. The result is the same as create would give.
         ///
         /// Its mainly used for paircounting and for that the way we parallelize it is
         /// that all tasks make their own grid and does work only on their parts of the grid
         /// This can be improved
         ///
         /// The index of a cell is [iz + iy * N + ix*N^2 + ...], i.e. last coord varies first
-        /// We use a variant of this in Friend of Friend which should really be merged with this
         ///
         //======================================================================
 
         template <class T>
         class ParticlesInBoxes {
           private:
-            std::vector<Cell<T>> cells{};
+            std::vector<T> particles{};
+            std::vector<size_t> offsets{};
+            std::vector<size_t> order{};      // The index in the input of every particle in the sorted array
+            std::vector<size_t> cell_index{}; // The cell of every particle in the input (as of the last update)
+
+            // Work space kept between calls to update
+            std::vector<T> particles_buffer{};
+            std::vector<size_t> order_buffer{};
             int Ngrid{0};
             size_t Npart{0};
 
           public:
             // Get the raw data
-            std::vector<Cell<T>> & get_cells();
+            Cell<T> get_cell(size_t index);
+            size_t get_ncells() const;
+            std::vector<T> & get_particles();
+            const std::vector<size_t> & get_offsets() const;
             size_t get_npart() const;
             int get_ngrid() const;
 
@@ -73,8 +82,17 @@ namespace FML {
             void info() const;
 
             // Create the grid
-            void create(const std::vector<T> & particles, int ngrid);
-            void create(const T * particles, size_t nparticles, int ngrid);
+            void create(const std::vector<T> & part, int ngrid);
+            void create(const T * part, size_t nparticles, int ngrid);
+            void create(const T * part,
+                        size_t nparticles,
+                        const NeighborGrid<FML::PARTICLE::GetNDIM(T())> & neighbor_grid);
+
+            // Update the grid with the same particles (same number and order as in the last create) after
+            // they have moved. Returns the number of particles that changed cell. If it throws (positions
+            // outside the box) the grid must be made again with create
+            size_t update(const std::vector<T> & part);
+            size_t update(const T * part, size_t nparticles);
 
             // Free up the memory
             void clear();
@@ -84,57 +102,50 @@ namespace FML {
         // Cell methods
         //======================================================================
 
-        template <class T>
-        void Cell<T>::operator++() {
-            ++np;
-        }
-
         template <class T>
         size_t Cell<T>::get_np() const {
             return np;
         }
 
         template <class T>
-        T & Cell<T>::get_part(int i) {
+        T & Cell<T>::get_part(size_t i) {
             return ps[i];
         }
 
         template <class T>
-        std::vector<T> & Cell<T>::get_part() {
+        T * Cell<T>::begin() {
             return ps;
         }
 
         template <class T>
-        void Cell<T>::init() {
-            ps.clear();
-            np = 0;
+        T * Cell<T>::end() {
+            return ps + np;
         }
 
+        //======================================================================
+        // ParticlesInBoxes methods
+        //======================================================================
+
         template <class T>
-        void Cell<T>::allocate(int n) {
-            ps.reserve(n);
+        Cell<T> ParticlesInBoxes<T>::get_cell(size_t index) {
+            return {particles.data() + offsets[index], offsets[index + 1] - offsets[index]};
         }
 
         template <class T>
-        void Cell<T>::add(const T & p) {
-            ps.push_back(p);
+        size_t ParticlesInBoxes<T>::get_ncells() const {
+            return offsets.size() > 0 ? offsets.size() - 1 : 0;
         }
 
         template <class T>
-        void Cell<T>::clear() {
-            ps.clear();
-            ps.shrink_to_fit();
+        std::vector<T> & ParticlesInBoxes<T>::get_particles() {
+            return particles;
         }
 
         template <class T>
-        std::vector<Cell<T>> & ParticlesInBoxes<T>::get_cells() {
-            return cells;
+        const std::vector<size_t> & ParticlesInBoxes<T>::get_offsets() const {
+            return offsets;
         }
 
-        //======================================================================
-        // ParticlesInBoxes methods
-        //======================================================================
-
         template <class T>
         size_t ParticlesInBoxes<T>::get_npart() const {
             return Npart;
@@ -148,13 +159,13 @@ namespace FML {
         template <class T>
         void ParticlesInBoxes<T>::info() const {
             size_t nempty = 0;
-            size_t ntot = 0;
-            for (auto & cell : cells) {
-                if (cell.np == 0)
+            const size_t ncells = get_ncells();
+            for (size_t i = 0; i < ncells; i++) {
+                if (offsets[i + 1] == offsets[i])
                     nempty++;
-                ntot += cell.np;
             }
-            double fraction_empty = nempty / double(ntot);
+            const size_t ntot = particles.size();
+            double fraction_empty = nempty / double(ncells);
             
             if (FML::ThisTask == 0) {
                 constexpr int Ndim = FML::PARTICLE::GetNDIM(T());
@@ -170,75 +181,201 @@ namespace FML {
         }
 
         template <class T>
-        void ParticlesInBoxes<T>::create(const std::vector<T> & particles, int ngrid) {
-            create(particles.data(), particles.size(), ngrid);
+        void ParticlesInBoxes<T>::create(const std::vector<T> & part, int ngrid) {
+            create(part.data(), part.size(), ngrid);
         }
 
         template <class T>
-        void ParticlesInBoxes<T>::create(const T * particles, size_t nparticles, int ngrid) {
+        void ParticlesInBoxes<T>::create(const T * part, size_t nparticles, int ngrid) {
             if (nparticles == 0)
                 return;
 
             assert_mpi(FML::PARTICLE::has_get_pos<T>(),
                        "[ParticlesInBoxes] Particle class must have positions via a get_pos method");
 
-            // Set class data
+            // Sort the particles by cell
             constexpr int Ndim = FML::PARTICLE::GetNDIM(T());
-            Ngrid = ngrid;
+            NeighborGrid<Ndim> neighbor_grid;
+            try {
+                neighbor_grid.create(part, nparticles, ngrid, false);
+            } catch (const std::runtime_error &) {
+                throw std::runtime_error("ParticlesInBoxes positions has to be in [0,1)\n");
+            }
+            create(part, nparticles, neighbor_grid);
+        }
+
+        template <class T>
+        void ParticlesInBoxes<T>::create(const T * part,
+                                         size_t nparticles,
+                                         const NeighborGrid<FML::PARTICLE::GetNDIM(T())> & neighbor_grid) {
+            assert_mpi(neighbor_grid.get_npart() == nparticles and neighbor_grid.get_xmin() == 0.0 and
+                           neighbor_grid.get_local_nx() == neighbor_grid.get_ngrid(),
+                       "[ParticlesInBoxes] The NeighborGrid must be of these particles and cover the whole box");
+
+            // Set class data
+            Ngrid = neighbor_grid.get_ngrid();
             Npart = nparticles;
+            offsets = neighbor_grid.get_offsets();
+
+            // Copy over the particles
+            order = neighbor_grid.get_indices();
+            particles.resize(nparticles);
+            cell_index.resize(nparticles);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+            for (size_t icell = 0; icell < get_ncells(); icell++) {
+                for (size_t j = offsets[icell]; j < offsets[icell + 1]; j++) {
+                    particles[j] = part[order[j]];
+                    cell_index[order[j]] = icell;
+                }
+            }
+        }
+
+        template <class T>
+        size_t ParticlesInBoxes<T>::update(const std::vector<T> & part) {
+            return update(part.data(), part.size());
+        }
 
-            // Allocate cells
-            size_t ncells = 1;
-            for (int i = 0; i < Ndim; i++)
-                ncells *= ngrid;
-            cells.resize(ncells);
-            for (auto & cell : cells)
-                cell.init();
+        template <class T>
+        size_t ParticlesInBoxes<T>::update(const T * part, size_t nparticles) {
+            assert_mpi(nparticles == Npart and order.size() == Npart,
+                       "[ParticlesInBoxes] update needs the same particles (in the same order) as the last create");
+            if (nparticles == 0)
+                return 0;
 
-            // Count number of particles in each cell
+            constexpr int Ndim = FML::PARTICLE::GetNDIM(T());
+            const size_t ncells = get_ncells();
+
+            // Find the particles that have changed cell
+            struct Move {
+                size_t cell;
+                size_t index;
+            };
+            std::vector<size_t> nleaving(ncells, 0);
+            std::vector<size_t> narriving(ncells, 0);
+            std::vector<std::vector<Move>> moves_threads(FML::NThreads);
+            bool positions_ok = true;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(&& : positions_ok)
+#endif
             for (size_t i = 0; i < nparticles; i++) {
-                const auto * Pos = FML::PARTICLE::GetPos(const_cast<T&>(particles[i]));
-
-                // Index of cell particle belong to
+                const auto * pos = FML::PARTICLE::GetPos(const_cast<T &>(part[i]));
                 size_t index = 0;
-                for (int j = 0; j < Ndim; j++) {
-                    int ix = (int)(Pos[j] * ngrid);
-                    index = index * ngrid + ix;
-                    if (ix >= ngrid)
-                        throw std::runtime_error(
-                            "ParticlesInBoxes positions has to be in [0,1). pos = " + std::to_string(Pos[j]) + "\n");
+                for (int idim = 0; idim < Ndim; idim++) {
+                    int ix = int(pos[idim] * Ngrid);
+                    if (ix >= Ngrid or ix < 0) {
+                        positions_ok = false;
+                        ix = 0;
+                    }
+                    index = index * Ngrid + ix;
                 }
-                assert(index < ncells);
-
-                // Increase count in cell
-                ++cells[index];
+                if (index == cell_index[i])
+                    continue;
+#ifdef USE_OMP
+                moves_threads[omp_get_thread_num()].push_back({index, i});
+#pragma omp atomic
+                nleaving[cell_index[i]]++;
+#pragma omp atomic
+                narriving[index]++;
+#else
+                moves_threads[0].push_back({index, i});
+                nleaving[cell_index[i]]++;
+                narriving[index]++;
+#endif
+                cell_index[i] = index;
             }
+            if (not positions_ok)
+                throw std::runtime_error("ParticlesInBoxes positions has to be in [0,1)\n");
 
-            // Allocate memory
-            for (auto & cell : cells)
-                cell.allocate(cell.np);
+            size_t nmoved = 0;
+            for (auto & m : moves_threads)
+                nmoved += m.size();
 
-            // Add particles to cell
-            for (size_t i = 0; i < nparticles; i++) {
-                const auto * Pos = FML::PARTICLE::GetPos(const_cast<T&>(particles[i]));
-                //const auto * Pos = FML::PARTICLE::GetPos(particles[i]);
+            // No particle changed cell so we only need the new particle data
+            if (nmoved == 0) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t j = 0; j < nparticles; j++)
+                    particles[j] = part[order[j]];
+                return 0;
+            }
 
-                // Index of cell particle belong to
-                size_t index = 0;
-                for (int j = 0; j < Ndim; j++) {
-                    int ix = (int)(Pos[j] * ngrid);
-                    index = index * ngrid + ix;
+            // Sort the moving particles by the cell they go to and then by index so that the particles in a
+            // cell are in the order they were given to us (like in create)
+            std::vector<size_t> new_offsets(ncells + 1, 0);
+            std::vector<size_t> moves_offsets(ncells + 1, 0);
+            for (size_t icell = 0; icell < ncells; icell++) {
+                new_offsets[icell + 1] =
+                    new_offsets[icell] + (offsets[icell + 1] - offsets[icell]) - nleaving[icell] + narriving[icell];
+                moves_offsets[icell + 1] = moves_offsets[icell] + narriving[icell];
+            }
+            std::vector<size_t> moved_index(nmoved);
+            {
+                std::vector<size_t> next(moves_offsets.begin(), moves_offsets.end() - 1);
+                for (auto & m : moves_threads)
+                    for (auto & move : m)
+                        moved_index[next[move.cell]++] = move.index;
+                moves_threads.clear();
+            }
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+            for (size_t icell = 0; icell < ncells; icell++)
+                if (narriving[icell] > 1)
+                    std::sort(moved_index.begin() + moves_offsets[icell],
+                              moved_index.begin() + moves_offsets[icell + 1]);
+
+            // Merge the particles that stayed in a cell with the ones that arrived (both sorted by index)
+            auto & new_particles = particles_buffer;
+            auto & new_order = order_buffer;
+            new_particles.resize(nparticles);
+            new_order.resize(nparticles);
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+            for (size_t icell = 0; icell < ncells; icell++) {
+                size_t j = offsets[icell];
+                size_t k = moves_offsets[icell];
+                size_t inew = new_offsets[icell];
+                for (;;) {
+                    while (j < offsets[icell + 1] and cell_index[order[j]] != icell)
+                        j++;
+                    const bool have_old = j < offsets[icell + 1];
+                    const bool have_new = k < moves_offsets[icell + 1];
+                    if (not have_old and not have_new)
+                        break;
+                    size_t index;
+                    if (have_old and (not have_new or order[j] < moved_index[k]))
+                        index = order[j++];
+                    else
+                        index = moved_index[k++];
+                    new_order[inew] = index;
+                    new_particles[inew] = part[index];
+                    inew++;
                 }
-
-                // Add particles
-                cells[index].add(particles[i]);
             }
+            particles.swap(new_particles);
+            order.swap(new_order);
+            offsets.swap(new_offsets);
+            return nmoved;
         }
 
         template <class T>
         void ParticlesInBoxes<T>::clear() {
-            cells.clear();
-            cells.shrink_to_fit();
+            particles.clear();
+            particles.shrink_to_fit();
+            offsets.clear();
+            offsets.shrink_to_fit();
+            order.clear();
+            order.shrink_to_fit();
+            cell_index.clear();
+            cell_index.shrink_to_fit();
+            particles_buffer.clear();
+            particles_buffer.shrink_to_fit();
+            order_buffer.clear();
+            order_buffer.shrink_to_fit();
         }
     } // namespace PARTICLE
 } // namespace FML
@@ -1,18 +1,21 @@
 #ifndef READWRITERAMSES_HEADER
 #define READWRITERAMSES_HEADER
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <regex>
 #include <sstream>
 #include <stdlib.h>
 #include <vector>
 
 #include <FML/Global/Global.h>
+#include <FML/MPIParticles/MPIParticles.h>
 #include <FML/ParticleTypes/ReflectOnParticleMethods.h>
 
 namespace FML {
@@ -183,7 +186,8 @@ namespace FML {
                     entries_in_file = what_is_in_file;
                 }
 
-                /// Read a single ramses file and store the data in p
+                /// Read a single ramses file and store the data in p (p is resized to the number of particles we
+                /// stored). Together with get_nfiles this can be used to read a snapshot one file at a time
                 ///
                 /// @param[out] ifile The number of the file to read (the i in part_0000X.out0000i)
                 /// @param[out] p Container for storing the particles we read
@@ -214,6 +218,7 @@ namespace FML {
 
                     // Read the data
                     read_particle_file(ifile, p);
+                    p.resize(npart_read);
                 }
 
                 /// Read all ramses files and store the data in p
@@ -228,6 +233,7 @@ namespace FML {
                         p.resize(npart_in_domain);
                     } else {
                         p.reserve(npart * buffer_factor);
+                        p.resize(npart);
                     }
 
                     std::vector<long long int> npart_task(FML::NTasks);
@@ -251,9 +257,11 @@ namespace FML {
                                 std::cout << "On task " << i << " we will store " << npart_task[i] << " particles\n";
                     }
 
-                    // Loop and read all particle files
+                    // Loop and read all particle files. Files with no particles in the local domain are skipped
                     npart_read = 0;
                     for (int i = 0; i < ncpu; i++) {
+                        if (keep_only_particles_in_domain and npart_in_domain_in_file[i] == 0)
+                            continue;
                         read_particle_file(i, p);
                     }
 
@@ -263,6 +271,73 @@ namespace FML {
                     }
                 }
 
+                /// Read all ramses files collectively and store the data in p. Each file is read by one task only
+                /// (file i by task i % NTasks) and the particles are then sent to the task whose domain they fall
+                /// in. The result is the same as read_ramses with keep_only_particles_in_domain (up to the order of
+                /// the particles), but without every task reading every file.
+                /// @param[out] p Container for storing the particles we read
+                ///
+                template <class T, class Alloc = std::allocator<T>>
+                void read_ramses_collective(std::vector<T, Alloc> & p) {
+
+                    // The particles in the files we are responsible for
+                    size_t npart_local = 0;
+                    for (int i = FML::ThisTask; i < ncpu; i += FML::NTasks)
+                        npart_local += size_t(npart_in_file[i]);
+                    const size_t nallocate = size_t(double(npart) * std::max(buffer_factor, 1.0)) / FML::NTasks;
+
+                    if (verbose) {
+                        std::cout << "\n";
+                        std::cout << "=================================="
+                                  << "\n";
+                        std::cout << "Read Ramses Particle files (collectively):\n";
+                        std::cout << "=================================="
+                                  << "\n";
+                        std::cout << "Snapshot folder: " << snapdir << "\n";
+                        std::cout << "Npart total " << npart << " particles in " << ncpu << " files\n";
+                    }
+
+                    // Read the files without any domain cut
+                    FML::Vector<T> local;
+                    local.reserve(std::max(npart_local, nallocate));
+                    local.resize(npart_local);
+                    const bool keep_only_particles_in_domain_orig = keep_only_particles_in_domain;
+                    keep_only_particles_in_domain = false;
+                    npart_read = 0;
+                    for (int i = FML::ThisTask; i < ncpu; i += FML::NTasks) {
+                        read_particle_file(i, local);
+                    }
+                    keep_only_particles_in_domain = keep_only_particles_in_domain_orig;
+
+                    // Send the particles to the task that owns them
+                    FML::PARTICLE::MPIParticles<T> mpipart;
+                    mpipart.move_from(std::move(local));
+                    mpipart.communicate_particles();
+                    const size_t npart_after = mpipart.get_npart();
+                    assert_mpi(npart_after == npart_in_domain,
+                               "[RamsesReader::read_ramses_collective] Number of particles we got does not match the "
+                               "number in the local domain\n");
+
+                    // Copy them over to p (or just move them if the allocators agree)
+                    auto & part = mpipart.get_particles();
+                    if constexpr (std::is_same<Alloc, typename FML::LargeVector<T>::allocator_type>::value) {
+                        p = std::move(part);
+                        p.resize(npart_after);
+                    } else {
+                        p.clear();
+                        p.reserve(std::max(npart_after, size_t(double(npart_after) * buffer_factor)));
+                        p.insert(p.end(),
+                                 std::make_move_iterator(part.begin()),
+                                 std::make_move_iterator(part.begin() + npart_after));
+                        mpipart.free();
+                    }
+
+                    if (verbose) {
+                        std::cout << "Done reading particles\n";
+                        std::cout << "==================================\n\n";
+                    }
+                }
+
                 double get_boxsize() { return boxlen; }
                 double get_omega_m() { return omega_m; }
                 double get_omega_l() { return omega_l; }
@@ -270,6 +345,7 @@ namespace FML {
                 double get_aexp() { return aexp; }
                 double get_h() { return h0/100.; }
                 int get_npart() { return npart; }
+                int get_nfiles() { return ncpu; }
                 int get_levelmin() { return levelmin; }
                 int get_levelmax() { return levelmax; }
 
@@ -423,12 +499,18 @@ namespace FML {
                     }
                 }
 
-                // Count how many particles are in each file and how many fall into the local domain
+                // Count how many particles are in each file and how many fall into the local domain.
+                // Each file is only opened by one task which counts for the domains of all tasks
                 void count_particles_in_files() {
-                    npart_in_file.resize(ncpu);
-                    npart_in_domain_in_file.resize(ncpu);
+                    npart_in_file.assign(ncpu, 0);
+                    npart_in_domain_in_file.assign(ncpu, 0);
 
-                    for (int i = 0; i < ncpu; i++) {
+                    // The domains of all the tasks (in increasing order)
+                    const std::vector<double> xmin_task = FML::GatherFromTasks(&FML::xmin_domain);
+                    const std::vector<double> xmax_task = FML::GatherFromTasks(&FML::xmax_domain);
+                    std::vector<int> npart_in_file_per_task(size_t(ncpu) * FML::NTasks, 0);
+
+                    for (int i = FML::ThisTask; i < ncpu; i += FML::NTasks) {
                         FILE * fp;
                         std::string numberfile = int_to_ramses_string(i + 1);
                         std::string partfile = snapdir + "part_" + snapnum + ".out" + numberfile;
@@ -446,18 +528,33 @@ namespace FML {
                         std::vector<char> buffer(header.npart * 8);
                         read_section(fp, buffer.data(), header.npart);
 
-                        // Count how many positions fall into the local domain
+                        // Count how many positions fall into the domain of each task
                         RamsesPosType * pos = (RamsesPosType *)buffer.data();
-                        int nindomain = 0;
+                        int * count = &npart_in_file_per_task[size_t(i) * FML::NTasks];
                         for (int j = 0; j < header.npart; j++) {
-                            if (pos[j] >= FML::xmin_domain and pos[j] < FML::xmax_domain)
-                                nindomain++;
+                            const int task =
+                                int(std::upper_bound(xmin_task.begin(), xmin_task.end(), double(pos[j])) -
+                                    xmin_task.begin()) -
+                                1;
+                            if (task >= 0 and pos[j] < xmax_task[task])
+                                count[task]++;
                         }
-                        npart_in_domain_in_file[i] = nindomain;
                         npart_in_file[i] = header.npart;
 
                         fclose(fp);
                     }
+
+#ifdef USE_MPI
+                    MPI_Allreduce(MPI_IN_PLACE, npart_in_file.data(), ncpu, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+                    MPI_Allreduce(MPI_IN_PLACE,
+                                  npart_in_file_per_task.data(),
+                                  int(npart_in_file_per_task.size()),
+                                  MPI_INT,
+                                  MPI_SUM,
+                                  MPI_COMM_WORLD);
+#endif
+                    for (int i = 0; i < ncpu; i++)
+                        npart_in_domain_in_file[i] = npart_in_file_per_task[size_t(i) * FML::NTasks + FML::ThisTask];
                 }
 
                 ParticleFileHeader read_particle_header(FILE * fp) {
@@ -601,8 +698,8 @@ namespace FML {
                 //====================================================
                 // Read a single particle file
                 //====================================================
-                template <class T>
-                void read_particle_file(const int i, std::vector<T> & p) {
+                template <class T, class Alloc>
+                void read_particle_file(const int i, std::vector<T, Alloc> & p) {
                     std::string numberfile = int_to_ramses_string(i + 1);
                     std::string partfile = snapdir + "part_" + snapnum + ".out" + numberfile;
                     FILE * fp;
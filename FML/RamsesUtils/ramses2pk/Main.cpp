@@ -1,7 +1,6 @@
 #include <FML/RamsesUtils/RamsesUtils.h>
 #include <FML/ComputePowerSpectra/ComputePowerSpectrum.h>
 #include <FML/ComputePowerSpectra/PowerSpectrumBinning.h>
-#include <FML/MPIParticles/MPIParticles.h>
 
 // Simple particle type that only stores positions
 template <int NDIM>
@@ -10,7 +9,7 @@ class RamsesParticle {
     double x[NDIM];
 
   public:
-    int get_ndim() { return NDIM; }
+    constexpr int get_ndim() const { return NDIM; }
     double * get_pos() { return x; } // only store positions
 };
 
@@ -29,12 +28,6 @@ void compute_power_spectrum(std::string snapdir, int level=-1, std::vector<std::
         reader.set_file_format(format); // default: POS, VEL, MASS, ID, LEVEL, FAMILY, TAG
     }
 
-    // Read particles into MPI-able container
-    std::vector<RamsesParticle<NDIM>> parts;
-    reader.read_ramses(parts);
-    FML::PARTICLE::MPIParticles<RamsesParticle<NDIM>> mpiparts;
-    mpiparts.move_from(std::move(parts));
-
     if (level == -1) {
         level = reader.get_levelmin(); // default to minimum level (as in a non-AMR simulation)
     }
@@ -48,10 +41,20 @@ void compute_power_spectrum(std::string snapdir, int level=-1, std::vector<std::
                   << (subtract_shotnoise ? "with" : "without") << " subtracting shot noise\n";
     }
 
-    // Compute power spectrum
+    // Compute power spectrum. We read one particle file at a time and assign it to the grid right away
+    // so we never have all the particles in memory
+    using Particle = RamsesParticle<NDIM>;
+    int ifile = 0;
+    std::function<bool(std::vector<Particle> &)> read_chunk = [&](std::vector<Particle> & chunk) {
+        if (ifile == reader.get_nfiles())
+            return false;
+        reader.read_ramses_single(ifile++, chunk);
+        return true;
+    };
     FML::CORRELATIONFUNCTIONS::PowerSpectrumBinning<NDIM> pofk(Nbins);
     pofk.subtract_shotnoise = subtract_shotnoise;
-    FML::CORRELATIONFUNCTIONS::compute_power_spectrum<NDIM>(Nmesh, mpiparts.get_particles_ptr(), mpiparts.get_npart(), mpiparts.get_npart_total(), pofk, density_assignment, true);
+    FML::CORRELATIONFUNCTIONS::compute_power_spectrum_streaming<NDIM, Particle>(
+        Nmesh, read_chunk, pofk, density_assignment, true);
     pofk.scale(reader.get_boxsize()); // scale to box
 
     // Output to file
@@ -1,10 +1,13 @@
 #ifndef GAUSSIANRANDOMFIELD_HEADER
 #define GAUSSIANRANDOMFIELD_HEADER
+#include <array>
 #include <cassert>
 #include <climits>
 #include <complex>
+#include <cstdint>
 #include <cstdio>
 #include <functional>
+#include <memory>
 #include <numeric>
 #include <vector>
 
@@ -128,6 +131,32 @@ namespace FML {
                                                         std::function<double(double)> Pofk_of_kBox_over_volume,
                                                         bool fix_amplitude);
 
+            //=================================================================================
+            ///
+            /// Mode-indexed version: the random numbers for each mode are a pure function of the seed and the
+            /// integer wave-vector \f$ (n_x, n_y, \ldots) \f$ of the mode (using the counter based Philox
+            /// generator). The field is the same for any number of tasks and threads, and grids with different
+            /// Nmesh share the same phases (and amplitudes) for the modes they have in common which is useful for
+            /// resolution studies and zoom initial conditions. NB: this gives a different field than the method
+            /// above for the same seed.
+            ///
+            /// @tparam N The dimension we are it (N <= 4)
+            ///
+            /// @param[out] grid The fourier grid we generate.
+            /// @param[in] seed The random seed.
+            /// @param[in] Pofk_of_kBox_over_volume This is \f$ P(kB) / V \f$ where \f$ kB \f$ is the dimesnionless
+            /// wavenumber where \f$ B \f$ is the boxsize and \f$ V = B^{\rm N} \f$ is the volume of the box.
+            /// @param[in] fix_amplitude If true then we only draw phases and set \f$ |\delta(k)| \f$ directly from the
+            /// input power-spectrum.
+            ///
+            //=================================================================================
+            template <int N>
+            void generate_gaussian_random_field_fourier_mode_indexed(
+                FFTWGrid<N> & grid,
+                uint64_t seed,
+                std::function<double(double)> Pofk_of_kBox_over_volume,
+                bool fix_amplitude);
+
             //=================================================================================
 
             template <int N>
@@ -164,11 +193,9 @@ namespace FML {
                 auto Local_x_start = grid.get_local_x_start();
                 auto * cdelta = grid.get_fourier_grid();
 
-                const IndexIntType NmeshTotTotal = FML::power(Nmesh, N - 1) * (Nmesh / 2 + 1);
-                const IndexIntType factor = NmeshTotTotal / Nmesh;
-
                 // Set up seeds for the random number generator
                 // and ensure that all tasks use the same seed
+                // There is one seed for every row (fixed coord[0], ..., coord[N-2]) in the last direction
                 IndexIntType num_seeds = FML::power(Nmesh, N - 1);
                 std::vector<unsigned int> seedtable(num_seeds, 0);
                 if (FML::ThisTask == 0) {
@@ -180,42 +207,60 @@ namespace FML {
                 MPI_Allreduce(MPI_IN_PLACE, seedtable.data(), num_seeds, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
 #endif
 
+                // One random generator per thread. Every row is seeded from the table so the result
+                // does not depend on how the rows are distributed over tasks and threads
+                std::vector<std::shared_ptr<RandomGenerator>> rngs(FML::NThreads);
+                for (auto & r : rngs)
+                    r = rng->clone();
+
                 // Generate gaussian random field in k-space
-                std::vector<int> coord(N, 0), mirrorcoord(N, 0);
                 const auto imin_local = Local_x_start;
                 const auto imax_local = Local_x_start + Local_nx;
-                std::array<double, N> kvec;
-                double kmag;
-
-                // We loop over all cells in the global grid. We can cut this down
-                // with some work by adjusting only to cells where coord or mirrorcoord
-                // is in bounds
-                for (IndexIntType ind = 0; ind < NmeshTotTotal; ind++) {
-                    coord[0] = ind / factor;
+                const IndexIntType rows_per_slice = num_seeds / Nmesh;
+
+                // We only visit the rows that are in the local slab and the rows whose k = 0 mode sets the
+                // mirror mode (coord[0] > Nmesh/2) of a mode in the local slab. For the latter we only
+                // need to draw the first mode in the row. Every mode is set by only one row so the rows can
+                // be done in parallel
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+                for (IndexIntType row = 0; row < num_seeds; row++) {
+                    std::array<int, N> coord, mirrorcoord;
+                    std::array<double, N> kvec;
+                    double kmag;
+
+                    coord[0] = row / rows_per_slice;
                     mirrorcoord[0] = coord[0] == 0 ? 0 : Nmesh - coord[0];
+                    const bool is_local = coord[0] >= imin_local and coord[0] < imax_local;
+                    const bool mirror_is_local = mirrorcoord[0] >= imin_local and mirrorcoord[0] < imax_local;
+                    if (not is_local and not(mirror_is_local and coord[0] > Nmesh / 2))
+                        continue;
+                    const int kmax = is_local ? Nmesh / 2 + 1 : 1;
+
+                    // Compute the rest of the coords
+                    IndexIntType n = 1;
+                    for (int idim = N - 2; idim >= 1; idim--, n *= Nmesh) {
+                        coord[idim] = (row / n) % Nmesh;
+                        mirrorcoord[idim] = coord[idim] == 0 ? 0 : Nmesh - coord[idim];
+                    }
 
-                    // Only modes that are on current CPU
-                    if ((coord[0] >= imin_local and coord[0] < imax_local) or
-                        (mirrorcoord[0] >= imin_local and mirrorcoord[0] < imax_local)) {
-
-                        // Compute the rest of the coords
-                        coord[N - 1] = ind % (Nmesh / 2 + 1);
-                        mirrorcoord[N - 1] = coord[N - 1] == 0 ? 0 : Nmesh - coord[N - 1];
-                        IndexIntType n = Nmesh / 2 + 1;
-                        for (int idim = N - 2; idim >= 1; idim--, n *= Nmesh) {
-                            coord[idim] = (ind / n) % Nmesh;
-                            mirrorcoord[idim] = coord[idim] == 0 ? 0 : Nmesh - coord[idim];
-                        }
+#ifdef USE_OMP
+                    auto & _rng = rngs[omp_get_thread_num()];
+#else
+                    auto & _rng = rngs[0];
+#endif
+                    _rng->set_seed(seedtable[row]);
 
-                        // Set seed for every new slice in the last direction
-                        if (coord[N - 1] == 0)
-                            rng->set_seed(seedtable[ind / (Nmesh / 2 + 1)]);
+                    for (int k = 0; k < kmax; k++) {
+                        coord[N - 1] = k;
+                        mirrorcoord[N - 1] = k == 0 ? 0 : Nmesh - k;
 
                         // Gaussian random number
-                        double phase = rng->generate_uniform() * 2 * M_PI;
+                        double phase = _rng->generate_uniform() * 2 * M_PI;
                         double norm = 1.0;
                         if (not fix_amplitude) {
-                            norm = rng->generate_uniform();
+                            norm = _rng->generate_uniform();
                             norm = norm > 0.0 ? -std::log(norm) : 1.0;
                         }
 
@@ -223,21 +268,29 @@ namespace FML {
                         // 1) When all coord are 0 (the DC mode)
                         // 2) When the mode and mirror mode is the same
                         // 3) Skip the mirror modes so we don't assign them twice
-                        if (ind == 0)
+                        if (row == 0 and k == 0)
                             continue;
 
+                        bool skip = false;
                         for (int idim = 0; idim < N; idim++) {
                             if (coord[idim] == Nmesh / 2)
-                                goto endloop;
+                                skip = true;
                         }
 
-                        if (coord[0] == 0 and coord[N - 1] == 0) {
+                        if (coord[0] == 0 and k == 0) {
                             for (int idim = 1; idim < N - 1; idim++) {
                                 if (coord[idim] >= Nmesh / 2)
-                                    goto endloop;
+                                    skip = true;
                             }
                         }
 
+                        // The k = 0 modes with 0 < coord[0] < Nmesh/2 are set as the mirror of coord[0] > Nmesh/2
+                        if (coord[0] > 0 and coord[0] < Nmesh / 2 and k == 0)
+                            skip = true;
+
+                        if (skip)
+                            continue;
+
                         // Compute local index of mode
                         IndexIntType index = coord[0] - imin_local;
                         for (int idim = 1; idim < N - 1; idim++) {
@@ -245,8 +298,16 @@ namespace FML {
                         }
                         index = index * (Nmesh / 2 + 1) + coord[N - 1];
 
+                        // Compute local mirror index
+                        IndexIntType mirrorindex = mirrorcoord[0] - imin_local;
+                        for (int idim = 1; idim < N - 1; idim++) {
+                            mirrorindex = mirrorindex * Nmesh + mirrorcoord[idim];
+                        }
+                        mirrorindex = mirrorindex * (Nmesh / 2 + 1) + mirrorcoord[N - 1];
+
                         // The wave-vector and norm of current mode (norm in units of 1/Box)
-                        grid.get_fourier_wavevector_and_norm_by_index(index, kvec, kmag);
+                        // (the mirror mode has the same norm)
+                        grid.get_fourier_wavevector_and_norm_by_index(is_local ? index : mirrorindex, kvec, kmag);
 
                         // Assign the field. Note kmag is dimensionless here. Units taken care of in Powerspectrum
                         double delta_norm = std::sqrt(norm * Pofk_of_kBox_over_volume(kmag));
@@ -254,18 +315,10 @@ namespace FML {
                         std::complex<double> delta_conj = std::conj(delta);
 
                         // The case [0 < k < Nmesh/2] for all the local model
-                        if (coord[N - 1] > 0 and imin_local <= coord[0] and coord[0] < imax_local) {
+                        if (k > 0) {
                             cdelta[index] = delta;
                             continue;
-                        } else if (coord[N - 1] > 0)
-                            continue;
-
-                        // Compute local mirror index
-                        IndexIntType mirrorindex = mirrorcoord[0] - imin_local;
-                        for (int idim = 1; idim < N - 1; idim++) {
-                            mirrorindex = mirrorindex * Nmesh + mirrorcoord[idim];
                         }
-                        mirrorindex = mirrorindex * (Nmesh / 2 + 1) + mirrorcoord[N - 1];
 
                         // The case [iglobal = 0] and [k = 0]
                         if (coord[0] == 0) {
@@ -276,17 +329,92 @@ namespace FML {
                             continue;
                         }
 
-                        // The case [0 < i < Nmesh/2], [0 < j < Nmesh] and [k = 0]
-                        if (imin_local <= coord[0] and coord[0] < imax_local) {
+                        // The case [Nmesh/2 < i < Nmesh], [0 <= j < Nmesh] and [k = 0]
+                        if (is_local) {
                             cdelta[index] = delta;
                         }
 
                         // The mirror mode
-                        if (imin_local <= mirrorcoord[0] and mirrorcoord[0] < imax_local) {
+                        if (mirror_is_local) {
                             cdelta[mirrorindex] = delta_conj;
                         }
                     }
-                endloop:;
+                }
+            }
+
+            template <int N>
+            void generate_gaussian_random_field_fourier_mode_indexed(
+                FFTWGrid<N> & grid,
+                uint64_t seed,
+                std::function<double(double)> Pofk_of_kBox_over_volume,
+                bool fix_amplitude) {
+
+                // The wave-vector is the counter of the generator so we can have at most 4 dimensions
+                static_assert(N <= 4, "The mode-indexed random field is only implemented for N <= 4");
+
+                // We require an allocated grid and a power-spectrum to run
+                assert_mpi(grid.get_nmesh() > 0,
+                           "[generate_gaussian_random_field_fourier_mode_indexed] Grid is not allocated\n");
+                assert_mpi(Pofk_of_kBox_over_volume.operator bool(),
+                           "[generate_gaussian_random_field_fourier_mode_indexed] PowerSpectrum not callable\n");
+
+                const int Nmesh = grid.get_nmesh();
+                const auto Local_nx = grid.get_local_nx();
+                const auto key = PHILOX::key_from_seed(seed);
+                grid.set_grid_status_real(false);
+                auto * cdelta = grid.get_fourier_grid();
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int islice = 0; islice < Local_nx; islice++) {
+                    std::array<double, N> kvec;
+                    double kmag;
+                    for (auto && fourier_index : grid.get_fourier_range(islice, islice + 1)) {
+                        grid.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
+
+                        // The integer wave-vector of the mode. Modes that are zero or fixed by symmetry: the DC mode
+                        // and the Nyquist modes (the mode and the mirror mode is the same)
+                        std::array<int, N> n;
+                        bool skip = true;
+                        for (int idim = 0; idim < N; idim++) {
+                            n[idim] = int(std::lround(kvec[idim] / (2.0 * M_PI)));
+                            if (n[idim] != 0)
+                                skip = false;
+                        }
+                        for (int idim = 0; idim < N; idim++)
+                            if (std::abs(n[idim]) == Nmesh / 2)
+                                skip = true;
+                        if (skip) {
+                            cdelta[fourier_index] = 0.0;
+                            continue;
+                        }
+
+                        // The random numbers are drawn for one of the modes k and -k (the one with the last non-zero
+                        // component positive) and the other is the complex conjugate
+                        bool mirror = false;
+                        for (int idim = N - 1; idim >= 0; idim--) {
+                            if (n[idim] != 0) {
+                                mirror = n[idim] < 0;
+                                break;
+                            }
+                        }
+                        PHILOX::Counter counter{0, 0, 0, 0};
+                        for (int idim = 0; idim < N; idim++)
+                            counter[idim] = uint32_t(mirror ? -n[idim] : n[idim]);
+                        auto u = PHILOX::uniform_pair(counter, key);
+
+                        // Gaussian random number
+                        double phase = u[0] * 2 * M_PI;
+                        double norm = 1.0;
+                        if (not fix_amplitude)
+                            norm = u[1] > 0.0 ? -std::log(u[1]) : 1.0;
+
+                        // Assign the field. Note kmag is dimensionless here. Units taken care of in Powerspectrum
+                        double delta_norm = std::sqrt(norm * Pofk_of_kBox_over_volume(kmag));
+                        std::complex<double> delta = delta_norm * std::exp(std::complex<double>(0, 1) * phase);
+                        cdelta[fourier_index] = mirror ? std::conj(delta) : delta;
+                    }
                 }
             }
 
@@ -350,86 +478,104 @@ namespace FML {
                 // of the function itself
                 auto Pofk_of_kBox_over_volume_spline = grid.make_fourier_spline(Pofk_of_kBox_over_volume, "P(k)/V");
 
+                // One random generator per thread. Every row (i,j) is seeded from the table so the result
+                // does not depend on how the rows are distributed over tasks and threads
+                std::vector<std::shared_ptr<RandomGenerator>> rngs(FML::NThreads);
+                for (auto & r : rngs)
+                    r = rng->clone();
+
                 // Generate gaussian random field in k-space
-                std::array<double, 3> kvec;
-                for (int i = 0; i < Nmesh; i++) {
-                    int ii = i == 0 ? 0 : Nmesh - i;
+                // We only visit the rows (i,j) in the local slab and the rows whose k = 0 mode sets the mirror
+                // mode (i < Nmesh/2) of a mode in the local slab. For the latter we only need to draw the first
+                // mode in the row. Every mode is set by only one row so the rows can be done in parallel
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+                for (int row = 0; row < Nmesh * Nmesh; row++) {
+                    const int i = row / Nmesh;
+                    const int j = row % Nmesh;
+                    const int ii = i == 0 ? 0 : Nmesh - i;
+                    const int jj = j == 0 ? 0 : Nmesh - j;
+                    const bool is_local = i >= imin_local and i < imax_local;
+                    const bool mirror_is_local = ii >= imin_local and ii < imax_local;
 
                     // Only create modes that belong to current task
-                    if ((i >= imin_local and i < imax_local) or (ii >= imin_local and ii < imax_local)) {
-
-                        for (int j = 0; j < Nmesh; j++) {
-                            int jj = j == 0 ? 0 : Nmesh - j;
-                            rng->set_seed(seedtable[i * Nmesh + j]);
-
-                            for (int k = 0; k < Nmesh / 2 + 1; k++) {
-                                size_t coord;
-
-                                // Gaussian random number
-                                double phase = rng->generate_uniform() * 2 * M_PI;
-                                double norm = 1.0;
-                                if (not fix_amplitude) {
-                                    norm = rng->generate_uniform();
-                                    norm = norm > 0.0 ? -std::log(norm) : 1.0;
-                                }
-
-                                // Skip modes that are zero or otherwise fixed by symmetry
-                                if (i == Nmesh / 2 or j == Nmesh / 2 or k == Nmesh / 2)
-                                    continue;
-                                if (i == 0 and j >= Nmesh / 2 and k == 0)
-                                    continue;
-                                if (i == 0 and j == 0 and k == 0)
-                                    continue;
-                                if (i >= Nmesh / 2 and k == 0)
-                                    continue;
-
-                                // The wave-vector and norm of current mode (norm in units of 1/Box)
-                                kvec[0] = i <= Nmesh / 2 ? i : i - Nmesh;
-                                kvec[1] = j <= Nmesh / 2 ? j : j - Nmesh;
-                                kvec[2] = k <= Nmesh / 2 ? k : k - Nmesh;
-                                double kmag =
-                                    std::sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]) * 2.0 * M_PI;
-
-                                // Assign the field. Note kmag is dimensionless here. Units taken care of in
-                                // Powerspectrum
-                                double delta_norm = std::sqrt(norm * Pofk_of_kBox_over_volume_spline(kmag));
-
-                                std::complex<double> delta = delta_norm * std::exp(std::complex<double>(0, 1) * phase);
-                                std::complex<double> delta_conj = std::conj(delta);
-
-                                // The case [0 < k < Nmesh/2] for all the local model
-                                if (k > 0 and imin_local <= i and i < imax_local) {
-                                    coord = ((i - imin_local) * Nmesh + j) * (Nmesh / 2 + 1) + k;
-                                    cdelta[coord] = delta;
-                                    continue;
-                                } else if (k > 0)
-                                    continue;
-
-                                // The case [iglobal = 0], [0 < j < Nmesh/2] and [k = 0]
-                                if (i == 0) {
-                                    if (imin_local == 0) {
-                                        coord = ((i - imin_local) * Nmesh + j) * (Nmesh / 2 + 1) + k;
-                                        cdelta[coord] = delta;
-
-                                        // The mirror mode
-                                        coord = ((i - imin_local) * Nmesh + jj) * (Nmesh / 2 + 1) + k;
-                                        cdelta[coord] = delta_conj;
-                                    }
-                                    continue;
-                                }
-
-                                // The case [0 < i < Nmesh/2], [0 < j < Nmesh] and [k = 0]
-                                if (imin_local <= i and i < imax_local) {
-                                    coord = ((i - imin_local) * Nmesh + j) * (Nmesh / 2 + 1) + k;
-                                    cdelta[coord] = delta;
-                                }
+                    if (not is_local and not(mirror_is_local and i < Nmesh / 2))
+                        continue;
+                    const int kmax = is_local ? Nmesh / 2 + 1 : 1;
+
+#ifdef USE_OMP
+                    auto & _rng = rngs[omp_get_thread_num()];
+#else
+                    auto & _rng = rngs[0];
+#endif
+                    _rng->set_seed(seedtable[i * Nmesh + j]);
+
+                    std::array<double, 3> kvec;
+                    for (int k = 0; k < kmax; k++) {
+                        size_t coord;
+
+                        // Gaussian random number
+                        double phase = _rng->generate_uniform() * 2 * M_PI;
+                        double norm = 1.0;
+                        if (not fix_amplitude) {
+                            norm = _rng->generate_uniform();
+                            norm = norm > 0.0 ? -std::log(norm) : 1.0;
+                        }
+
+                        // Skip modes that are zero or otherwise fixed by symmetry
+                        if (i == Nmesh / 2 or j == Nmesh / 2 or k == Nmesh / 2)
+                            continue;
+                        if (i == 0 and j >= Nmesh / 2 and k == 0)
+                            continue;
+                        if (i == 0 and j == 0 and k == 0)
+                            continue;
+                        if (i >= Nmesh / 2 and k == 0)
+                            continue;
+
+                        // The wave-vector and norm of current mode (norm in units of 1/Box)
+                        kvec[0] = i <= Nmesh / 2 ? i : i - Nmesh;
+                        kvec[1] = j <= Nmesh / 2 ? j : j - Nmesh;
+                        kvec[2] = k <= Nmesh / 2 ? k : k - Nmesh;
+                        double kmag = std::sqrt(kvec[0] * kvec[0] + kvec[1] * kvec[1] + kvec[2] * kvec[2]) * 2.0 * M_PI;
+
+                        // Assign the field. Note kmag is dimensionless here. Units taken care of in
+                        // Powerspectrum
+                        double delta_norm = std::sqrt(norm * Pofk_of_kBox_over_volume_spline(kmag));
+
+                        std::complex<double> delta = delta_norm * std::exp(std::complex<double>(0, 1) * phase);
+                        std::complex<double> delta_conj = std::conj(delta);
+
+                        // The case [0 < k < Nmesh/2] for all the local model
+                        if (k > 0) {
+                            coord = ((i - imin_local) * Nmesh + j) * (Nmesh / 2 + 1) + k;
+                            cdelta[coord] = delta;
+                            continue;
+                        }
+
+                        // The case [iglobal = 0], [0 < j < Nmesh/2] and [k = 0]
+                        if (i == 0) {
+                            if (imin_local == 0) {
+                                coord = ((i - imin_local) * Nmesh + j) * (Nmesh / 2 + 1) + k;
+                                cdelta[coord] = delta;
 
                                 // The mirror mode
-                                if (imin_local <= ii and ii < imax_local) {
-                                    coord = ((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k;
-                                    cdelta[coord] = delta_conj;
-                                }
+                                coord = ((i - imin_local) * Nmesh + jj) * (Nmesh / 2 + 1) + k;
+                                cdelta[coord] = delta_conj;
                             }
+                            continue;
+                        }
+
+                        // The case [0 < i < Nmesh/2], [0 < j < Nmesh] and [k = 0]
+                        if (is_local) {
+                            coord = ((i - imin_local) * Nmesh + j) * (Nmesh / 2 + 1) + k;
+                            cdelta[coord] = delta;
+                        }
+
+                        // The mirror mode
+                        if (mirror_is_local) {
+                            coord = ((ii - Local_x_start) * Nmesh + jj) * (Nmesh / 2 + 1) + k;
+                            cdelta[coord] = delta_conj;
                         }
                     }
                 }
@@ -39,8 +39,9 @@ namespace FML {
             /// gaussian},\phi_{\rm gaussian}) \f$ where the kernel is some quadratic form which in its simples form
             /// (local) is just \f$ \phi_{\rm gaussian}^2 \f$.
             ///
-            /// This requires in general 6 grids to be allocated at the same time
-            /// and up to 8 fourier transforms
+            /// This requires at most 4 grids to be allocated at the same time (3 for u = 0 and 1 for local) and
+            /// one batched c2r and one batched r2c (of 4, 3 and 1 grids respectively). The filters are applied
+            /// in a single pass over the fourier grid on each side
             ///
             /// NB: for generating IC for cosmological simulations see the related method
             /// and see 1108.5512 for more info about the algorithmm.
@@ -123,15 +124,76 @@ namespace FML {
                 if (fNL == 0.0)
                     return;
 
-                // Get phi in real space
-                FFTWGrid<N> phi_real = phi_fourier;
-                phi_real.add_memory_label("FFTWGrid::generate_nonlocal_gaussian_random_field_fourier::phi_real");
-                phi_real.set_grid_status_real(false);
-                phi_real.fftw_c2r();
+                // The non-local terms P13[ phi Pm13 ], P23[ phi Pm23 - Pm13^2 ] and P1[ phi Pm1 - Pm23 Pm13 ].
+                // We only compute the ones we need (the last one vanishes for u = 0)
+                const bool need_m13 = kernel_values[1] != 0.0 or kernel_values[2] != 0.0 or kernel_values[3] != 0.0;
+                const bool need_m23 = kernel_values[2] != 0.0 or kernel_values[3] != 0.0;
+                const bool need_m33 = kernel_values[3] != 0.0;
 
-                // Compute phi^2 - <phi>^2 in real space and store in source
-                FFTWGrid<N> source(Nmesh, nleft, nright);
-                source.add_memory_label("FFTWGrid::generate_nonlocal_gaussian_random_field_fourier::source");
+                // If we use GSL make a spline (std::function can be slow) otherwise this is just a copy
+                // of the function itself
+                auto Pofk_of_kBox_over_volume_spline =
+                    phi_fourier.make_fourier_spline(Pofk_of_kBox_over_volume, "P(k)/V");
+                const auto kz = phi_fourier.get_fourier_row_wavenumbers();
+
+                // Compute the filtered fields F[phi] P^(-n/3) for the terms we need in one pass. The grids are
+                // later reused in real space to hold the products and in fourier space to hold their transforms
+                // so we need at most 4 grids (phi + 3 temporary) and one batched c2r and r2c
+                FFTWGrid<N> phi_m13, phi_m23, phi_m33;
+                std::vector<FFTWGrid<N> *> grids{&phi_fourier};
+                if (need_m13) {
+                    phi_m13 = FFTWGrid<N>(Nmesh, nleft, nright);
+                    phi_m13.add_memory_label("FFTWGrid::generate_nonlocal_gaussian_random_field_fourier::phi_m13");
+                    grids.push_back(&phi_m13);
+                }
+                if (need_m23) {
+                    phi_m23 = FFTWGrid<N>(Nmesh, nleft, nright);
+                    phi_m23.add_memory_label("FFTWGrid::generate_nonlocal_gaussian_random_field_fourier::phi_m23");
+                    grids.push_back(&phi_m23);
+                }
+                if (need_m33) {
+                    phi_m33 = FFTWGrid<N>(Nmesh, nleft, nright);
+                    phi_m33.add_memory_label("FFTWGrid::generate_nonlocal_gaussian_random_field_fourier::phi_m33");
+                    grids.push_back(&phi_m33);
+                }
+
+                if (need_m13) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        const std::complex<FML::GRID::FloatType> * phi = phi_fourier.get_fourier_grid();
+                        std::complex<FML::GRID::FloatType> * m13 = phi_m13.get_fourier_grid();
+                        std::complex<FML::GRID::FloatType> * m23 = need_m23 ? phi_m23.get_fourier_grid() : nullptr;
+                        std::complex<FML::GRID::FloatType> * m33 = need_m33 ? phi_m33.get_fourier_grid() : nullptr;
+                        for (auto && row : phi_fourier.get_fourier_row_range(islice, islice + 1)) {
+                            for (int iz = 0; iz < row.n; iz++) {
+                                const auto fourier_index = row.index + iz;
+                                const double kmag2 = row.kmag2 + kz[iz] * kz[iz];
+
+                                // The DC mode is zero
+                                FML::GRID::FloatType pofk_m13 = 0.0;
+                                if (kmag2 > 0.0)
+                                    pofk_m13 = std::pow(Pofk_of_kBox_over_volume_spline(std::sqrt(kmag2)), -1.0 / 3.0);
+                                const FML::GRID::FloatType pofk_m23 = pofk_m13 * pofk_m13;
+
+                                m13[fourier_index] = phi[fourier_index] * pofk_m13;
+                                if (need_m23)
+                                    m23[fourier_index] = phi[fourier_index] * pofk_m23;
+                                if (need_m33)
+                                    m33[fourier_index] = phi[fourier_index] * (pofk_m23 * pofk_m13);
+                            }
+                        }
+                    }
+                }
+
+                // Get phi (and the filtered fields) in real space
+                for (auto * g : grids)
+                    g->set_grid_status_real(false);
+                FML::GRID::fftw_c2r_batched(grids);
+                FFTWGrid<N> & phi_real = phi_fourier;
+
+                // Compute <phi^2> and <phi>
                 double phi_squared_mean = 0.0;
                 double phi_mean = 0.0;
                 long long int ncells = 0;
@@ -141,9 +203,7 @@ namespace FML {
                 for (int islice = 0; islice < Local_nx; islice++) {
                     for (auto && real_index : phi_real.get_real_range(islice, islice + 1)) {
                         auto phi = phi_real.get_real_from_index(real_index);
-                        auto value = phi * phi;
-                        source.set_real_from_index(real_index, value);
-                        phi_squared_mean += value;
+                        phi_squared_mean += phi * phi;
                         phi_mean += phi;
                         ncells += 1;
                     }
@@ -162,147 +222,74 @@ namespace FML {
                     std::cout << "[generate_nonlocal_gaussian_random_field_fourier] <Phi^2>: " << phi_squared_mean
                               << " <Phi>: " << phi_mean << "\n";
 
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-                // Subtract <phi^2>
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    for (auto && real_index : source.get_real_range(islice, islice + 1)) {
-                        auto phi2 = source.get_real_from_index(real_index);
-                        auto phi = phi_real.get_real_from_index(real_index);
-                        auto value =
-                            (phi - phi_mean) + FML::GRID::FloatType(kernel_values[0]) * (phi2 - phi_squared_mean);
-                        source.set_real_from_index(real_index, value);
-                    }
-                }
-
-                // Back to fourier space. We now have F[phi] + const * F[phi^2 - <phi^2>] in source
-                source.fftw_r2c();
-
-                // Set DC mode to zero
-                if (FML::ThisTask == 0)
-                    source.set_fourier_from_index(0, 0.0);
-
-                // If we only want standard local phi + fNL[phi^2 - <phi^2>] then we can return now
-                if (kernel_values[1] == 0.0 and kernel_values[2] == 0.0 and kernel_values[3] == 0.0) {
-                    phi_fourier = source;
-                    return;
-                }
-
-                // If we use GSL make a spline (std::function can be slow) otherwise this is just a copy
-                // of the function itself
-                auto Pofk_of_kBox_over_volume_spline =
-                    phi_fourier.make_fourier_spline(Pofk_of_kBox_over_volume, "P(k)/V");
-
-                // Compute the kernel terms
-                FFTWGrid<N> phi_m13(Nmesh);
-                FFTWGrid<N> phi_m23(Nmesh);
-                FFTWGrid<N> phi_m33(Nmesh); // XXX Not needed when u=0
-                phi_m13.add_memory_label("FFTWGrid::generate_nonlocal_gaussian_random_field_fourier::phi_m13");
-                phi_m23.add_memory_label("FFTWGrid::generate_nonlocal_gaussian_random_field_fourier::phi_m23");
-                phi_m33.add_memory_label("FFTWGrid::generate_nonlocal_gaussian_random_field_fourier::phi_m33");
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    [[maybe_unused]] double kmag;
-                    [[maybe_unused]] std::array<double, N> kvec;
-                    for (auto && fourier_index : phi_fourier.get_fourier_range(islice, islice + 1)) {
-                        phi_fourier.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-
-                        FML::GRID::FloatType pofk_m13 = std::pow(Pofk_of_kBox_over_volume_spline(kmag), -1.0 / 3.0);
-                        FML::GRID::FloatType pofk_m23 = pofk_m13 * pofk_m13;
-                        FML::GRID::FloatType pofk_m33 = pofk_m23 * pofk_m13; // XXX Not needed when u=0
-
-                        auto phi = phi_fourier.get_fourier_from_index(fourier_index);
-                        auto value1 = phi * pofk_m13;
-                        auto value2 = phi * pofk_m23;
-                        auto value3 = phi * pofk_m33; // XXX Not needed when u=0
-
-                        phi_m13.set_fourier_from_index(fourier_index, value1);
-                        phi_m23.set_fourier_from_index(fourier_index, value2);
-                        phi_m33.set_fourier_from_index(fourier_index, value3); // XXX Not needed when u=0
-                    }
-                }
-
-                // Set DC mode to 0
-                if (FML::ThisTask == 0) {
-                    phi_m13.set_fourier_from_index(0, 0.0);
-                    phi_m23.set_fourier_from_index(0, 0.0);
-                    phi_m33.set_fourier_from_index(0, 0.0); // XXX Not needed when u=0
-                }
-                phi_m13.fftw_c2r();
-                phi_m23.fftw_c2r();
-                phi_m33.fftw_c2r(); // XXX Not needed when u=0
-
-                // We use the grids already allocated as temporary grids
-                // We must make sure we do things in the right order below
-                FFTWGrid<N> & temp1 = phi_m13;
-                FFTWGrid<N> & temp2 = phi_m23;
-                FFTWGrid<N> & temp3 = phi_m33;
-
-                // Compute the square of some quantities in real space
+                // Compute all the products in real space in one pass (in place):
+                // phi -> phi + K0 (phi^2 - <phi^2>), pm13 -> phi pm13, pm23 -> phi pm23 - pm13^2 and
+                // pm33 -> phi pm33 - pm13 pm23
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
                 for (int islice = 0; islice < Local_nx; islice++) {
-                    for (auto && real_index : temp1.get_real_range(islice, islice + 1)) {
-                        auto pm13 = phi_m13.get_real_from_index(real_index);
-                        auto pm23 = phi_m23.get_real_from_index(real_index);
-                        auto pm33 = phi_m33.get_real_from_index(real_index); // XXX Not needed when u=0
+                    for (auto && real_index : phi_real.get_real_range(islice, islice + 1)) {
                         auto phi = phi_real.get_real_from_index(real_index);
-
-                        auto value1 = phi * pm13;
-                        auto value2 = phi * pm23 - pm13 * pm13;
-                        auto value3 = phi * pm33 - pm13 * pm23; // XXX Not needed when u=0
-                        temp1.set_real_from_index(real_index, value1);
-                        temp2.set_real_from_index(real_index, value2);
-                        temp3.set_real_from_index(real_index, value3); // XXX Not needed when u=0
+                        auto pm13 = need_m13 ? phi_m13.get_real_from_index(real_index) : 0.0;
+                        auto pm23 = need_m23 ? phi_m23.get_real_from_index(real_index) : 0.0;
+                        auto pm33 = need_m33 ? phi_m33.get_real_from_index(real_index) : 0.0;
+
+                        auto value0 =
+                            (phi - phi_mean) + FML::GRID::FloatType(kernel_values[0]) * (phi * phi - phi_squared_mean);
+                        phi_real.set_real_from_index(real_index, value0);
+                        if (need_m13)
+                            phi_m13.set_real_from_index(real_index, phi * pm13);
+                        if (need_m23)
+                            phi_m23.set_real_from_index(real_index, phi * pm23 - pm13 * pm13);
+                        if (need_m33)
+                            phi_m33.set_real_from_index(real_index, phi * pm33 - pm13 * pm23);
                     }
                 }
 
-                // Transform these back to fourier space
-                temp1.fftw_r2c();
-                temp2.fftw_r2c();
-                temp3.fftw_r2c(); // XXX Not needed when u=0
-                if (FML::ThisTask == 0) {
-                    temp1.set_fourier_from_index(0, 0.0);
-                    temp2.set_fourier_from_index(0, 0.0);
-                    temp3.set_fourier_from_index(0, 0.0); // XXX Not needed when u=0
-                }
+                // Back to fourier space. We now have F[phi] + K0 * F[phi^2 - <phi^2>] in phi_fourier
+                FML::GRID::fftw_r2c_batched(grids);
 
                 // Add up to get phi + fNL K(phi,phi) in fourier space
+                if (need_m13) {
 #ifdef USE_OMP
 #pragma omp parallel for
 #endif
-                for (int islice = 0; islice < Local_nx; islice++) {
-                    [[maybe_unused]] double kmag;
-                    [[maybe_unused]] std::array<double, N> kvec;
-                    for (auto && fourier_index : source.get_fourier_range(islice, islice + 1)) {
-                        source.get_fourier_wavevector_and_norm_by_index(fourier_index, kvec, kmag);
-
-                        FML::GRID::FloatType pofk_p13 = std::pow(Pofk_of_kBox_over_volume_spline(kmag), 1.0 / 3.0);
-                        FML::GRID::FloatType pofk_p23 = pofk_p13 * pofk_p13;
-                        FML::GRID::FloatType pofk_p33 = pofk_p23 * pofk_p13;
-
-                        auto term1 = temp1.get_fourier_from_index(fourier_index) * pofk_p13;
-                        auto term2 = temp2.get_fourier_from_index(fourier_index) * pofk_p23;
-                        auto term3 = temp3.get_fourier_from_index(fourier_index) * pofk_p33; // XXX Not needed when u=0
-
-                        auto s = source.get_fourier_from_index(fourier_index);
-                        s += term1 * FML::GRID::FloatType(kernel_values[1]) +
-                             term2 * FML::GRID::FloatType(kernel_values[2]) +
-                             term3 * FML::GRID::FloatType(kernel_values[3]);
-                        source.set_fourier_from_index(fourier_index, s);
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        std::complex<FML::GRID::FloatType> * phi = phi_fourier.get_fourier_grid();
+                        const std::complex<FML::GRID::FloatType> * term1 = phi_m13.get_fourier_grid();
+                        const std::complex<FML::GRID::FloatType> * term2 =
+                            need_m23 ? phi_m23.get_fourier_grid() : nullptr;
+                        const std::complex<FML::GRID::FloatType> * term3 =
+                            need_m33 ? phi_m33.get_fourier_grid() : nullptr;
+                        for (auto && row : phi_fourier.get_fourier_row_range(islice, islice + 1)) {
+                            for (int iz = 0; iz < row.n; iz++) {
+                                const auto fourier_index = row.index + iz;
+                                const double kmag2 = row.kmag2 + kz[iz] * kz[iz];
+
+                                if (kmag2 == 0.0)
+                                    continue; // DC mode (k=0)
+
+                                const FML::GRID::FloatType pofk_p13 =
+                                    std::pow(Pofk_of_kBox_over_volume_spline(std::sqrt(kmag2)), 1.0 / 3.0);
+                                const FML::GRID::FloatType pofk_p23 = pofk_p13 * pofk_p13;
+
+                                auto s = phi[fourier_index];
+                                s += term1[fourier_index] * (pofk_p13 * FML::GRID::FloatType(kernel_values[1]));
+                                if (need_m23)
+                                    s += term2[fourier_index] * (pofk_p23 * FML::GRID::FloatType(kernel_values[2]));
+                                if (need_m33)
+                                    s += term3[fourier_index] *
+                                         (pofk_p23 * pofk_p13 * FML::GRID::FloatType(kernel_values[3]));
+                                phi[fourier_index] = s;
+                            }
+                        }
                     }
                 }
 
-                // Set DC mode to 0
+                // Set DC mode to zero
                 if (FML::ThisTask == 0)
-                    source.set_fourier_from_index(0, 0.0);
-
-                // Copy over result
-                phi_fourier = source;
+                    phi_fourier.set_fourier_from_index(0, 0.0);
 
                 // Ensure that <phi> = 0
                 if (subtract_mean) {
@@ -392,6 +379,9 @@ namespace FML {
                 const auto Local_nx = phi_fourier.get_local_nx();
 
                 // Transform to delta by multiplying by sqrt(P(k) / Pprimodial(k))
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
                 for (int islice = 0; islice < Local_nx; islice++) {
                     [[maybe_unused]] double kmag;
                     [[maybe_unused]] std::array<double, N> kvec;
@@ -1,7 +1,10 @@
 #ifndef RANDOMGENERATOR_HEADER
 #define RANDOMGENERATOR_HEADER
 
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <memory>
@@ -23,6 +26,9 @@ namespace FML {
 #define STDRANDOM_NAME "mt19937"
 #define STDRANDOM_SEEDSIZE 624
 
+        // Counter-based generator
+#define PHILOXRANDOM_NAME "philox4x32-10"
+
         // Gsl defines
 #define GSLRANDOM_NAME "gsl_rng_ranlxd1"
 #ifndef gsl_random_generator_type
@@ -79,6 +85,107 @@ namespace FML {
         //=======================================================================
         //=======================================================================
 
+        /// The Philox4x32-10 counter-based random number generator (Salmon et al. 2011). The output is a pure
+        /// function of a 128 bit counter and a 64 bit key so random numbers can be assigned to e.g. grid cells or
+        /// Fourier modes directly (counter = position, key = seed) independent of how the work is distributed
+        /// over tasks and threads.
+        namespace PHILOX {
+
+            using Counter = std::array<uint32_t, 4>;
+            using Key = std::array<uint32_t, 2>;
+
+            /// Compute the 4 random 32 bit numbers corresponding to a given counter and key
+            inline Counter philox4x32(Counter ctr, Key key) {
+                constexpr uint32_t M0 = 0xD2511F53;
+                constexpr uint32_t M1 = 0xCD9E8D57;
+                constexpr uint32_t W0 = 0x9E3779B9;
+                constexpr uint32_t W1 = 0xBB67AE85;
+                for (int round = 0; round < 10; round++) {
+                    const uint64_t p0 = uint64_t(M0) * ctr[0];
+                    const uint64_t p1 = uint64_t(M1) * ctr[2];
+                    ctr = {uint32_t(p1 >> 32) ^ ctr[1] ^ key[0],
+                           uint32_t(p1),
+                           uint32_t(p0 >> 32) ^ ctr[3] ^ key[1],
+                           uint32_t(p0)};
+                    key[0] += W0;
+                    key[1] += W1;
+                }
+                return ctr;
+            }
+
+            /// Make a double uniformly distributed in [0,1) (53 bits) from two 32 bit random numbers
+            inline double to_uniform(uint32_t a, uint32_t b) {
+                return ((a >> 5) * 67108864.0 + (b >> 6)) * (1.0 / 9007199254740992.0);
+            }
+
+            /// Two uniform random numbers in [0,1) for a given counter and key
+            inline std::array<double, 2> uniform_pair(const Counter & ctr, const Key & key) {
+                auto r = philox4x32(ctr, key);
+                return {to_uniform(r[0], r[1]), to_uniform(r[2], r[3])};
+            }
+
+            /// The key corresponding to a given seed
+            inline Key key_from_seed(uint64_t seed) { return {uint32_t(seed), uint32_t(seed >> 32)}; }
+        } // namespace PHILOX
+
+        /// The Philox4x32-10 generator as a stream of random numbers. The seed sets the key and the
+        /// counter starts at zero and is incremented for every block of 4 32 bit numbers (2 doubles)
+        class PhiloxRandomGenerator : public RandomGenerator {
+          private:
+            PHILOX::Key key{0, 0};
+            PHILOX::Counter counter{0, 0, 0, 0};
+            std::array<double, 2> buffer{0.0, 0.0};
+            int nbuffer{0};
+
+          public:
+            PhiloxRandomGenerator() : RandomGenerator() { name = PHILOXRANDOM_NAME; }
+
+            PhiloxRandomGenerator(unsigned int seed) : PhiloxRandomGenerator() { set_seed_philox({seed}); }
+
+            PhiloxRandomGenerator(std::vector<unsigned int> seed) : PhiloxRandomGenerator() { set_seed_philox(seed); }
+
+            virtual std::unique_ptr<RandomGenerator> clone() const override {
+                return std::make_unique<PhiloxRandomGenerator>(*this);
+            }
+
+            // To avoid calling a virtual function in the constructor
+            // and be sure the right method is called
+            void set_seed_philox(std::vector<unsigned int> seed) {
+                assert(seed.size() > 0);
+                Seed = seed;
+                key = {seed[0], seed.size() > 1 ? seed[1] : 0u};
+                counter = {0, 0, 0, 0};
+                nbuffer = 0;
+            }
+
+            virtual void set_seed(unsigned int seed) override { set_seed_philox({seed}); }
+
+            virtual void set_seed(std::vector<unsigned int> seed) override { set_seed_philox(seed); }
+
+            virtual double generate_uniform() override {
+                if (nbuffer == 0) {
+                    buffer = PHILOX::uniform_pair(counter, key);
+                    nbuffer = 2;
+                    // 128 bit increment of the counter
+                    for (auto & c : counter)
+                        if (++c != 0)
+                            break;
+                }
+                return buffer[2 - nbuffer--];
+            }
+
+            virtual double generate_normal() override {
+                // Box-Muller (we only use one of the two numbers so there is no hidden state)
+                double u1 = generate_uniform();
+                double u2 = generate_uniform();
+                u1 = u1 > 0.0 ? u1 : 1.0;
+                return normal_dist.stddev() * std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+            }
+        };
+
+        //=======================================================================
+        //=======================================================================
+
 #ifdef USE_GSL
 
         // A wrapper for holding the GSL data and making sure when we clone the object the state gets copied
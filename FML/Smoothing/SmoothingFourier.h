@@ -62,19 +62,19 @@ namespace FML {
         }
 
         //===================================================================================
-        /// Low-pass filters (tophat, gaussian, sharpk)
+        /// Get the low-pass filter (tophat, gaussian, sharpk) as a function of \f$ k^2 \f$ (k in units of 1/Box)
         ///
         /// @tparam N The dimension of the grid
         ///
-        /// @param[out] fourier_grid The fourier grid we do the smoothing of
         /// @param[in] smoothing_scale The smoothing radius of the filter (in units of the boxsize)
         /// @param[in] smoothing_method The smoothing filter (tophat, gaussian, sharpk)
         ///
+        /// @return The filter W(k^2)
+        ///
         //===================================================================================
         template <int N>
-        void smoothing_filter_fourier_space(FFTWGrid<N> & fourier_grid,
-                                            double smoothing_scale,
-                                            std::string smoothing_method) {
+        std::function<double(double)> get_smoothing_filter_fourier_space(double smoothing_scale,
+                                                                         std::string smoothing_method) {
 
             // Sharp cut off kR = 1
             std::function<double(double)> filter_sharpk = [=](double k2) -> double {
@@ -120,6 +120,27 @@ namespace FML {
             } else {
                 throw std::runtime_error("Unknown filter " + smoothing_method + " Options: sharpk, gaussian, tophat");
             }
+            return filter;
+        }
+
+        //===================================================================================
+        /// Low-pass filters (tophat, gaussian, sharpk)
+        ///
+        /// @tparam N The dimension of the grid
+        ///
+        /// @param[out] fourier_grid The fourier grid we do the smoothing of
+        /// @param[in] smoothing_scale The smoothing radius of the filter (in units of the boxsize)
+        /// @param[in] smoothing_method The smoothing filter (tophat, gaussian, sharpk)
+        ///
+        //===================================================================================
+        template <int N>
+        void smoothing_filter_fourier_space(FFTWGrid<N> & fourier_grid,
+                                            double smoothing_scale,
+                                            std::string smoothing_method) {
+
+            // Select the filter
+            std::function<double(double)> filter =
+                get_smoothing_filter_fourier_space<N>(smoothing_scale, smoothing_method);
 
             // Do the smoothing
             auto Local_nx = fourier_grid.get_local_nx();
@@ -138,6 +159,64 @@ namespace FML {
             }
         }
 
+        //===================================================================================
+        /// Smooth a fourier grid with the same filter for a list of smoothing radii and process the real space
+        /// result for each radius, e.g. compute moments or the PDF (compute_grid_moments, compute_grid_PDF). The
+        /// input grid is left untouched so the forward transform is only done once, and only one output grid is
+        /// allocated (and reused) so we never store the smoothed field for all radii at the same time. Each radius
+        /// costs one pass over the grid (copy and filter fused) and one c2r.
+        ///
+        /// @tparam N The dimension of the grid
+        ///
+        /// @param[in] fourier_grid The fourier grid we do the smoothing of
+        /// @param[in] smoothing_scales The smoothing radii of the filter (in units of the boxsize)
+        /// @param[in] smoothing_method The smoothing filter (tophat, gaussian, sharpk)
+        /// @param[in] process Function called as process(iscale, real_grid) with the smoothed field in real space
+        /// for each radius smoothing_scales[iscale]. The grid is overwritten on the next call.
+        ///
+        //===================================================================================
+        template <int N>
+        void smoothing_filter_fourier_space_multiscale(
+            const FFTWGrid<N> & fourier_grid,
+            const std::vector<double> & smoothing_scales,
+            std::string smoothing_method,
+            std::function<void(int iscale, FFTWGrid<N> & real_grid)> process) {
+
+            if (smoothing_scales.size() == 0)
+                return;
+
+            FFTWGrid<N> smoothed_grid(fourier_grid.get_nmesh(),
+                                      fourier_grid.get_n_extra_slices_left(),
+                                      fourier_grid.get_n_extra_slices_right());
+            smoothed_grid.add_memory_label("FFTWGrid::smoothing_filter_fourier_space_multiscale::smoothed_grid");
+
+            const auto Local_nx = fourier_grid.get_local_nx();
+            const auto kz = fourier_grid.get_fourier_row_wavenumbers();
+            for (size_t iscale = 0; iscale < smoothing_scales.size(); iscale++) {
+                std::function<double(double)> filter =
+                    get_smoothing_filter_fourier_space<N>(smoothing_scales[iscale], smoothing_method);
+
+                // Filtered copy of the input
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int islice = 0; islice < Local_nx; islice++) {
+                    const auto * in = fourier_grid.get_fourier_grid();
+                    auto * out = smoothed_grid.get_fourier_grid();
+                    for (auto && row : fourier_grid.get_fourier_row_range(islice, islice + 1)) {
+                        for (int iz = 0; iz < row.n; iz++) {
+                            const double kmag2 = row.kmag2 + kz[iz] * kz[iz];
+                            out[row.index + iz] = in[row.index + iz] * FloatType(filter(kmag2));
+                        }
+                    }
+                }
+                smoothed_grid.set_grid_status_real(false);
+                smoothed_grid.fftw_c2r();
+
+                process(int(iscale), smoothed_grid);
+            }
+        }
+
         //===================================================================================
         /// @brief From two fourier grids, f and g, compute the convolution
         /// \f$ f(k) * g(k) = \int d^{\rm N}q f(q) g(k-q) \f$ This is done via multuplication in reals-space. We
@@ -247,6 +326,74 @@ namespace FML {
             real_grid_result.fftw_c2r();
         }
 
+        //===================================================================================
+        /// This computes the mean and the central moments \f$ \left<(x - \bar{x})^n\right> \f$ for n = 2, 3, ...
+        /// nmoments of whatever quantity is in the grid (e.g. the density if its a density grid)
+        ///
+        /// @tparam N The dimension of the grid
+        ///
+        /// @param[in] real_grid
+        /// @param[in] nmoments The highest moment to compute
+        ///
+        /// @return The moments. Element 0 is the mean, element n-1 for n >= 2 is the n'th central moment
+        ///
+        //===================================================================================
+        template <int N>
+        std::vector<double> compute_grid_moments(const FFTWGrid<N> & real_grid, int nmoments) {
+            assert_mpi(nmoments >= 1, "[compute_grid_moments] Need nmoments >= 1\n");
+
+            auto Local_nx = real_grid.get_local_nx();
+            const double ncells = double(FML::power(real_grid.get_nmesh(), N));
+
+            // The mean
+            double mean = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : mean)
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                for (auto && real_index : real_grid.get_real_range(islice, islice + 1)) {
+                    mean += real_grid.get_real_from_index(real_index);
+                }
+            }
+            FML::SumOverTasks(&mean);
+            mean /= ncells;
+
+            // The central moments (summed over threads as for the PDF)
+            std::vector<std::vector<double>> momentsthreads(FML::NThreads, std::vector<double>(nmoments, 0.0));
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                int id = 0;
+#ifdef USE_OMP
+                id = omp_get_thread_num();
+#endif
+                auto & moments = momentsthreads[id];
+                for (auto && real_index : real_grid.get_real_range(islice, islice + 1)) {
+                    const double dx = real_grid.get_real_from_index(real_index) - mean;
+                    double dxn = dx;
+                    for (int n = 2; n <= nmoments; n++) {
+                        dxn *= dx;
+                        moments[n - 1] += dxn;
+                    }
+                }
+            }
+
+            std::vector<double> moments(nmoments, 0.0);
+            for (int i = 0; i < FML::NThreads; i++) {
+                for (int n = 0; n < nmoments; n++) {
+                    moments[n] += momentsthreads[i][n];
+                }
+            }
+#ifdef USE_MPI
+            MPI_Allreduce(MPI_IN_PLACE, moments.data(), nmoments, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+            for (auto & m : moments)
+                m /= ncells;
+            moments[0] = mean;
+            return moments;
+        }
+
         //===================================================================================
         /// This computes the PDF of whatever quantity is in the grid (e.g. the density if its a density grid)
         /// The binning is set to be linear. The range is set by the values we find in the grid
@@ -285,7 +432,7 @@ namespace FML {
 
             // Set up binning
             x.resize(nbins);
-            pdf.resize(nbins, 0.0);
+            pdf.assign(nbins, 0.0);
             for (int i = 0; i < nbins; i++) {
                 x[i] = grid_min + (grid_max - grid_min) / double(nbins) * (i + 0.5);
             }
@@ -1,4 +1,8 @@
 #include "SphericalCollapse.h"
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
 
 namespace FML {
 
@@ -319,6 +323,80 @@ namespace FML {
         delta_ini_of_x_spline = Spline(xcollapse_array, delta_ini_array, "delta_ini(loga_collapse)");
       }
 
+      //================================================
+      // Cache of spherical collapse tables. The key is
+      // the model functions sampled on a grid in x
+      // (we cannot compare std::function's) plus the
+      // accuracy settings
+      //================================================
+      namespace {
+        std::mutex sphericalcollapse_table_mutex;
+        bool sphericalcollapse_table_caching{true};
+        std::map<std::string, std::shared_ptr<const SphericalCollapseTable>> sphericalcollapse_table_cache;
+
+        // Don't let the cache grow without bounds when scanning over parameters
+        const size_t sphericalcollapse_table_max_cached = 256;
+
+        std::string sphericalcollapse_model_key(const SphericalCollapseModel & model, double xini, int npts) {
+          const int nsamples = 64;
+          std::vector<double> values{model.OmegaM, xini, double(npts)};
+          for(int i = 0; i < nsamples; i++){
+            const double x = xini * (1.0 - i / double(nsamples - 1));
+            values.push_back(model.Eofx(x));
+            values.push_back(model.OmegaMofx(x));
+            values.push_back(model.logEprimeofx(x));
+            values.push_back(model.muofx(x));
+            values.push_back(model.wofx(x));
+          }
+          std::string key(values.size() * sizeof(double), '\0');
+          std::memcpy(key.data(), values.data(), key.size());
+          return key;
+        }
+      }
+
+      std::shared_ptr<const SphericalCollapseTable> get_sphericalcollapse_table(
+          const SphericalCollapseModel & model,
+          const double xini,
+          const int npts,
+          bool verbose){
+
+        // We hold the lock while solving so that several threads asking for the same model solve it once
+        std::lock_guard<std::mutex> guard(sphericalcollapse_table_mutex);
+        const std::string key = sphericalcollapse_model_key(model, xini, npts);
+        if(sphericalcollapse_table_caching){
+          auto cached = sphericalcollapse_table_cache.find(key);
+          if(cached != sphericalcollapse_table_cache.end())
+            return cached->second;
+        }
+
+        auto table = std::make_shared<SphericalCollapseTable>();
+        compute_sphericalcollapse_splines(
+            model,
+            table->deltac_of_x_spline,
+            table->DeltaVir_of_x_spline,
+            table->xnl_of_x_spline,
+            table->xta_of_x_spline,
+            table->xvir_of_x_spline,
+            table->delta_ini_of_x_spline,
+            xini,
+            npts,
+            verbose);
+
+        if(sphericalcollapse_table_caching){
+          if(sphericalcollapse_table_cache.size() >= sphericalcollapse_table_max_cached)
+            sphericalcollapse_table_cache.clear();
+          sphericalcollapse_table_cache[key] = table;
+        }
+        return table;
+      }
+
+      void set_sphericalcollapse_table_caching(bool cache){
+        std::lock_guard<std::mutex> guard(sphericalcollapse_table_mutex);
+        sphericalcollapse_table_caching = cache;
+        if(not cache)
+          sphericalcollapse_table_cache.clear();
+      }
+
     }
   }
 }
@@ -10,6 +10,7 @@
 #include <tuple>
 #include <iostream>
 #include <fstream>
+#include <memory>
 
 namespace FML {
 
@@ -104,6 +105,34 @@ namespace FML {
           const int npts = 1000,
           bool verbose = false);
 
+      //===================================================================================
+      /// @brief The results of compute_sphericalcollapse_splines for one model: \f$\delta_c\f$,
+      /// \f$\Delta_{\rm vir}\f$, the non-linear, turnaround and virialization times and the initial
+      /// overdensity as function of the collapse time \f$x=\log a\f$ (lookups are spline interpolations).
+      /// The model functions only depend on \f$x\f$ so there is no mass dependence to tabulate.
+      //===================================================================================
+      struct SphericalCollapseTable {
+        Spline deltac_of_x_spline{"deltac(loga_collapse)"};
+        Spline DeltaVir_of_x_spline{"DeltaVir(loga_collapse)"};
+        Spline xnl_of_x_spline{"loga_nonlinear(loga_collapse)"};
+        Spline xta_of_x_spline{"loga_turnaround(loga_collapse)"};
+        Spline xvir_of_x_spline{"loga_virialization(loga_collapse)"};
+        Spline delta_ini_of_x_spline{"delta_ini(loga_collapse)"};
+      };
+
+      /// @brief Get the spherical collapse table for a model. The first call solves the collapse at all
+      /// redshifts (in parallel over redshifts) and the table is cached so later calls with the same model
+      /// (e.g. new HaloModel's with the same cosmology but a different \f$P(k)\f$) do not solve the ODEs again.
+      /// A model is identified by OmegaM and its functions sampled on a grid in \f$x\f$ together with xini and npts.
+      std::shared_ptr<const SphericalCollapseTable> get_sphericalcollapse_table(
+          const SphericalCollapseModel & model,
+          const double xini = std::log(1e-3),
+          const int npts = 1000,
+          bool verbose = false);
+
+      /// Turn caching of the spherical collapse tables on (the fiducial) or off (this also frees the tables we have)
+      void set_sphericalcollapse_table_caching(bool cache);
+
       //===================================================================================
       /// Class for doing general spherical collapse calculations, i.e. evolve
       /// the collapse and then turn the initial conditions such that collapse happens
@@ -213,17 +242,17 @@ namespace FML {
               Spline & delta_ini_of_x_spline,
               Spline & growthfactor_of_x_spline,
               Spline & growthrate_of_x_spline){
-            compute_sphericalcollapse_splines(
+            const auto table = get_sphericalcollapse_table(
                 spc, 
-                deltac_of_x_spline, 
-                DeltaVir_of_x_spline, 
-                xnl_of_x_spline,
-                xta_of_x_spline,
-                xvir_of_x_spline,
-                delta_ini_of_x_spline,
                 xini_spherical_collapse, 
                 npts_spherical_collapse,
                 verbose);
+            deltac_of_x_spline = table->deltac_of_x_spline;
+            DeltaVir_of_x_spline = table->DeltaVir_of_x_spline;
+            xnl_of_x_spline = table->xnl_of_x_spline;
+            xta_of_x_spline = table->xta_of_x_spline;
+            xvir_of_x_spline = table->xvir_of_x_spline;
+            delta_ini_of_x_spline = table->delta_ini_of_x_spline;
 
             compute_growthfactor(
                 spc,
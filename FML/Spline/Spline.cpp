@@ -8,6 +8,94 @@ namespace FML {
             const int nmax_threads = omp_get_max_threads();
 #endif
 
+            std::atomic<int> splines_without_accelerators{0};
+
+            //====================================================
+            // Natural cubic spline on a (log-)uniform grid. The
+            // coefficients are computed as in GSL's cspline
+            //====================================================
+            bool UniformGridSpline::set_grid(const double * x, int nx) {
+                free();
+                if (nx < 3 or x[nx - 1] <= x[0])
+                    return false;
+
+                // Check if the grid is uniform in x or in log(x)
+                auto is_uniform = [&](auto && t) {
+                    const double step = (t(x[nx - 1]) - t(x[0])) / (nx - 1);
+                    const double tol = 1e-10 * std::fabs(t(x[nx - 1]) - t(x[0]));
+                    for (int i = 1; i < nx - 1; i++)
+                        if (std::fabs(t(x[i]) - t(x[0]) - i * step) > tol)
+                            return false;
+                    return true;
+                };
+                if (is_uniform([](double xx) { return xx; })) {
+                    log_grid = false;
+                    tmin = x[0];
+                    inv_step = (nx - 1) / (x[nx - 1] - x[0]);
+                } else if (x[0] > 0.0 and is_uniform([](double xx) { return std::log(xx); })) {
+                    log_grid = true;
+                    tmin = std::log(x[0]);
+                    inv_step = (nx - 1) / (std::log(x[nx - 1]) - std::log(x[0]));
+                } else {
+                    return false;
+                }
+                return true;
+            }
+
+            bool UniformGridSpline::create(const double * x, const double * y, int nx) {
+                if (not set_grid(x, nx))
+                    return false;
+
+                // Solve the tridiagonal system for c = y''/2 with c = 0 at the end-points
+                DVector c(nx, 0.0);
+                DVector diag(nx, 0.0);
+                for (int i = 1; i < nx - 1; i++) {
+                    const double h_lo = x[i] - x[i - 1];
+                    const double h_hi = x[i + 1] - x[i];
+                    const double rhs = 3.0 * ((y[i + 1] - y[i]) / h_hi - (y[i] - y[i - 1]) / h_lo);
+                    diag[i] = 2.0 * (h_lo + h_hi);
+                    c[i] = rhs;
+                    if (i > 1) {
+                        const double w = h_lo / diag[i - 1];
+                        diag[i] -= w * h_lo;
+                        c[i] -= w * c[i - 1];
+                    }
+                }
+                for (int i = nx - 2; i >= 1; i--)
+                    c[i] = (c[i] - (x[i + 1] - x[i]) * c[i + 1]) / diag[i];
+
+                coeffs.resize(5 * size_t(nx - 1));
+                for (int i = 0; i < nx - 1; i++) {
+                    const double h = x[i + 1] - x[i];
+                    double * coeff = &coeffs[5 * i];
+                    coeff[0] = x[i];
+                    coeff[1] = y[i];
+                    coeff[2] = (y[i + 1] - y[i]) / h - h * (c[i + 1] + 2.0 * c[i]) / 3.0;
+                    coeff[3] = c[i];
+                    coeff[4] = (c[i + 1] - c[i]) / (3.0 * h);
+                }
+                size_x = nx;
+                return true;
+            }
+
+            bool UniformGridSpline::create_hermite(const double * x, const double * y, const double * dydx, int nx) {
+                if (not set_grid(x, nx))
+                    return false;
+                coeffs.resize(5 * size_t(nx - 1));
+                for (int i = 0; i < nx - 1; i++) {
+                    const double h = x[i + 1] - x[i];
+                    const double slope = (y[i + 1] - y[i]) / h;
+                    double * coeff = &coeffs[5 * i];
+                    coeff[0] = x[i];
+                    coeff[1] = y[i];
+                    coeff[2] = dydx[i];
+                    coeff[3] = (3.0 * slope - 2.0 * dydx[i] - dydx[i + 1]) / h;
+                    coeff[4] = (dydx[i] + dydx[i + 1] - 2.0 * slope) / (h * h);
+                }
+                size_x = nx;
+                return true;
+            }
+
             // How to handle an error
             void GSLSpline::throw_error(std::string errormessage) const {
 #ifdef USE_MPI
@@ -133,6 +221,10 @@ namespace FML {
                 spline = gsl_spline_alloc(interpoltype, nx);
                 gsl_spline_init(spline, x, y, nx);
 
+                // On a (log-)uniform grid we evaluate the cubic spline ourselves
+                if (SPLINE_USE_UNIFORM_GRID_SPLINE and interpoltype == gsl_interp_cspline)
+                    uniform_spline.create(x, y, nx);
+
                 // Make accelerators (one per thread if OpenMP)
                 // If nthreads = 1 we are likely trying to create a spline 
                 // inside a OMP region. In that case allocate as many as we have
@@ -191,15 +283,41 @@ namespace FML {
                 x = std::max(x, xmin);
                 x = std::min(x, xmax);
 
+                if (uniform_spline)
+                    return uniform_spline.eval(x);
+
                 // Return f, f' or f'' depending on value of deriv
 #ifdef USE_OMP
-                gsl_interp_accel * xacc_thread = xaccs[omp_get_thread_num()];
+                gsl_interp_accel * xacc_thread =
+                    splines_without_accelerators > 0 ? nullptr : xaccs[omp_get_thread_num()];
 #else
-                gsl_interp_accel * xacc_thread = xacc;
+                gsl_interp_accel * xacc_thread = splines_without_accelerators > 0 ? nullptr : xacc;
 #endif
                 return gsl_spline_eval(spline, x, xacc_thread);
             }
 
+            void GSLSpline::eval(const double * x, double * result, size_t npts) const {
+                if (spline == nullptr) {
+                    std::string errormessage = "[GSLSpline::eval] Spline " + name + " has not been created!\n";
+                    throw_error(errormessage);
+                }
+                if (uniform_spline) {
+                    for (size_t i = 0; i < npts; i++) {
+                        out_of_bounds_check(x[i]);
+                        result[i] = uniform_spline.eval(std::min(std::max(x[i], xmin), xmax));
+                    }
+                } else {
+                    for (size_t i = 0; i < npts; i++)
+                        result[i] = eval(x[i]);
+                }
+            }
+
+            DVector GSLSpline::eval(const DVector & x) const {
+                DVector result(x.size());
+                eval(x.data(), result.data(), x.size());
+                return result;
+            }
+
             double GSLSpline::eval_deriv(double x, int deriv) const {
                 if (spline == nullptr) {
                     std::string errormessage = "[GSLSpline::eval_deriv] Spline " + name + " has not been created!\n";
@@ -216,11 +334,15 @@ namespace FML {
                 x = std::max(x, xmin);
                 x = std::min(x, xmax);
 
+                if (uniform_spline)
+                    return uniform_spline.eval_deriv(x, deriv);
+
                 // Return f, f' or f'' depending on value of deriv
 #ifdef USE_OMP
-                gsl_interp_accel * xacc_thread = xaccs[omp_get_thread_num()];
+                gsl_interp_accel * xacc_thread =
+                    splines_without_accelerators > 0 ? nullptr : xaccs[omp_get_thread_num()];
 #else
-                gsl_interp_accel * xacc_thread = xacc;
+                gsl_interp_accel * xacc_thread = splines_without_accelerators > 0 ? nullptr : xacc;
 #endif
 
                 double dydx = 0.0;
@@ -247,6 +369,7 @@ namespace FML {
                     // Free the spline
                     gsl_spline_free(spline);
                     spline = nullptr;
+                    uniform_spline.free();
 
                     // Free accelerators
 #ifdef USE_OMP
@@ -487,11 +610,13 @@ namespace FML {
                 y = std::min(ymax, y);
 
 #ifdef USE_OMP
-                gsl_interp_accel * xacc_thread = xaccs[omp_get_thread_num()];
-                gsl_interp_accel * yacc_thread = yaccs[omp_get_thread_num()];
+                gsl_interp_accel * xacc_thread =
+                    splines_without_accelerators > 0 ? nullptr : xaccs[omp_get_thread_num()];
+                gsl_interp_accel * yacc_thread =
+                    splines_without_accelerators > 0 ? nullptr : yaccs[omp_get_thread_num()];
 #else
-                gsl_interp_accel * xacc_thread = xacc;
-                gsl_interp_accel * yacc_thread = yacc;
+                gsl_interp_accel * xacc_thread = splines_without_accelerators > 0 ? nullptr : xacc;
+                gsl_interp_accel * yacc_thread = splines_without_accelerators > 0 ? nullptr : yacc;
 #endif
                 return gsl_spline2d_eval(spline, x, y, xacc_thread, yacc_thread);
             }
@@ -521,11 +646,13 @@ namespace FML {
                 y = std::min(ymax, y);
 
 #ifdef USE_OMP
-                gsl_interp_accel * xacc_thread = xaccs[omp_get_thread_num()];
-                gsl_interp_accel * yacc_thread = yaccs[omp_get_thread_num()];
+                gsl_interp_accel * xacc_thread =
+                    splines_without_accelerators > 0 ? nullptr : xaccs[omp_get_thread_num()];
+                gsl_interp_accel * yacc_thread =
+                    splines_without_accelerators > 0 ? nullptr : yaccs[omp_get_thread_num()];
 #else
-                gsl_interp_accel * xacc_thread = xacc;
-                gsl_interp_accel * yacc_thread = yacc;
+                gsl_interp_accel * xacc_thread = splines_without_accelerators > 0 ? nullptr : xacc;
+                gsl_interp_accel * yacc_thread = splines_without_accelerators > 0 ? nullptr : yacc;
 #endif
 
                 return derivfunc[n](spline, x, y, xacc_thread, yacc_thread);
@@ -590,6 +717,41 @@ namespace FML {
             double GSLSpline2D::deriv_x(double x, double y) const { return eval_deriv(x, y, 1, 0); }
             double GSLSpline2D::deriv_xx(double x, double y) const { return eval_deriv(x, y, 2, 0); }
             double GSLSpline2D::deriv_y(double x, double y) const { return eval_deriv(x, y, 0, 1); }
+
+            UniformGridSpline GSLSpline2D::get_x_slice(double y, int derivy) const {
+                UniformGridSpline slice;
+                if (spline == nullptr) {
+                    std::string errormessage = "[GSLSpline2D::get_x_slice] Spline " + name + " has not been created!\n";
+                    throw_error(errormessage);
+                }
+                if (interpoltype_used != gsl_interp2d_bicubic or derivy < 0 or derivy > 1)
+                    return slice;
+
+                // The values and the x-derivatives at the x-knots
+                DVector value(size_x), dvaluedx(size_x);
+                for (int i = 0; i < size_x; i++) {
+                    value[i] = eval_deriv(spline->xarr[i], y, 0, derivy);
+                    dvaluedx[i] = eval_deriv(spline->xarr[i], y, 1, derivy);
+                }
+                slice.create_hermite(spline->xarr, value.data(), dvaluedx.data(), size_x);
+                return slice;
+            }
+
+            void GSLSpline2D::eval_at_y(double y, const double * x, double * result, size_t npts, int derivy) const {
+                // Making the slice costs 2 * size_x evaluations so only worth it for more points than that
+                UniformGridSpline slice;
+                if (npts > size_t(2 * size_x))
+                    slice = get_x_slice(y, derivy);
+                if (slice) {
+                    for (size_t i = 0; i < npts; i++) {
+                        out_of_bounds_check(x[i], y);
+                        result[i] = slice.eval(std::min(std::max(x[i], xmin), xmax));
+                    }
+                } else {
+                    for (size_t i = 0; i < npts; i++)
+                        result[i] = eval_deriv(x[i], y, 0, derivy);
+                }
+            }
             double GSLSpline2D::deriv_yy(double x, double y) const { return eval_deriv(x, y, 0, 2); }
             double GSLSpline2D::deriv_xy(double x, double y) const { return eval_deriv(x, y, 1, 1); }
             std::pair<double, double> GSLSpline2D::get_xrange() const { return {xmin, xmax}; }
@@ -1,5 +1,7 @@
 #ifndef SPLINE_HEADER
 #define SPLINE_HEADER
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <gsl/gsl_errno.h>
@@ -22,6 +24,7 @@ namespace FML {
         namespace SPLINE {
 
             // Type aliases
+            class UniformGridSpline;
             class GSLSpline;
             class GSLSpline2D;
             using Spline = GSLSpline;
@@ -29,6 +32,19 @@ namespace FML {
             using DVector = std::vector<double>;
             using DVector2D = std::vector<DVector>;
 
+            /// While this is > 0 all splines are evaluated without the (per OpenMP thread) accelerators. This makes
+            /// it safe to evaluate the same splines from threads that are not in the same OpenMP team, e.g. from a
+            /// std::thread doing analysis in the background. Use SplineAcceleratorsOff to change it
+            extern std::atomic<int> splines_without_accelerators;
+
+            /// Turn off the spline accelerators (for all threads) as long as this object lives
+            struct SplineAcceleratorsOff {
+                SplineAcceleratorsOff() { splines_without_accelerators++; }
+                ~SplineAcceleratorsOff() { splines_without_accelerators--; }
+                SplineAcceleratorsOff(const SplineAcceleratorsOff &) = delete;
+                SplineAcceleratorsOff & operator=(const SplineAcceleratorsOff &) = delete;
+            };
+
 #ifndef SPLINE_FIDUCIAL_INTERPOL_TYPE
 #define SPLINE_FIDUCIAL_INTERPOL_TYPE gsl_interp_cspline
 #endif
@@ -37,8 +53,91 @@ namespace FML {
 #endif
 #ifndef SPLINE_FIDUCIAL_SPLINE_WARNING
 #define SPLINE_FIDUCIAL_SPLINE_WARNING false
+#endif
+#ifndef SPLINE_USE_UNIFORM_GRID_SPLINE
+#define SPLINE_USE_UNIFORM_GRID_SPLINE true
 #endif
 
+            //====================================================
+            ///
+            /// Natural cubic spline (the same as gsl_interp_cspline)
+            /// on a uniform or logarithmically uniform grid. The
+            /// interval x is in is computed directly (no search and
+            /// no accelerators so it is thread safe) and the knot and
+            /// the coefficients of each interval are stored together.
+            ///
+            /// GSLSpline uses this automatically for cubic splines on
+            /// such grids (unless SPLINE_USE_UNIFORM_GRID_SPLINE is false)
+            ///
+            //====================================================
+
+            class UniformGridSpline {
+              private:
+                // For each interval [x_lo, y_lo, b, c, d] with y = y_lo + b dx + c dx^2 + d dx^3 and dx = x - x_lo
+                std::vector<double> coeffs{};
+                int size_x{0};
+                bool log_grid{false};
+                double tmin{};
+                double inv_step{};
+
+                // The interval x is in
+                int index(double x) const {
+                    const double t = log_grid ? std::log(x) : x;
+                    int i = int((t - tmin) * inv_step);
+                    i = std::max(0, std::min(i, size_x - 2));
+                    // Correct for roundoff when x is at a knot
+                    if (i > 0 and x < coeffs[5 * i])
+                        i--;
+                    else if (i < size_x - 2 and x >= coeffs[5 * (i + 1)])
+                        i++;
+                    return i;
+                }
+
+                // Set up the lookup if x is (log-)uniform
+                bool set_grid(const double * x, int nx);
+
+              public:
+                /// Create the spline if x (increasing with nx >= 3 elements) is uniform or logarithmically uniform.
+                /// Returns false (and does nothing) if not
+                bool create(const double * x, const double * y, int nx);
+
+                /// As create, but a cubic Hermite spline with the given derivatives dydx at the knots
+                bool create_hermite(const double * x, const double * y, const double * dydx, int nx);
+
+                /// Is the spline created or not?
+                explicit operator bool() const { return size_x > 0; }
+
+                /// Get the value of the spline. x must be in the range of the spline
+                double eval(double x) const {
+                    const double * c = &coeffs[5 * index(x)];
+                    const double dx = x - c[0];
+                    return c[1] + dx * (c[2] + dx * (c[3] + dx * c[4]));
+                }
+
+                /// Get the value of the spline (deriv = 0), the first (1) or the second (2) derivative
+                double eval_deriv(double x, int deriv) const {
+                    const double * c = &coeffs[5 * index(x)];
+                    const double dx = x - c[0];
+                    if (deriv == 1)
+                        return c[2] + dx * (2.0 * c[3] + 3.0 * dx * c[4]);
+                    if (deriv == 2)
+                        return 2.0 * c[3] + 6.0 * dx * c[4];
+                    return c[1] + dx * (c[2] + dx * (c[3] + dx * c[4]));
+                }
+
+                /// Evaluate the spline at npts points x (in the range of the spline)
+                void eval(const double * x, double * result, size_t npts) const {
+                    for (size_t i = 0; i < npts; i++)
+                        result[i] = eval(x[i]);
+                }
+
+                /// Free up memory associated with the spline
+                void free() {
+                    std::vector<double>().swap(coeffs);
+                    size_x = 0;
+                }
+            };
+
             //====================================================
             ///
             /// This is a wrapper class for easy use of GSL splines
@@ -91,6 +190,9 @@ namespace FML {
 
                 const gsl_interp_type * interpoltype_used = SPLINE_FIDUCIAL_INTERPOL_TYPE;
 
+                // Used instead of the GSL spline for evaluation if the grid is (log-)uniform
+                UniformGridSpline uniform_spline{};
+
                 // Info about the spline
                 int size_x{};
                 double xmin{};
@@ -148,6 +250,12 @@ namespace FML {
                 /// Get the value of the spline (if out of bounds we use the closest value)
                 double eval(double x) const;
                 double eval_deriv(double x, int deriv) const;
+                /// Evaluate the spline at npts points x and store it in result
+                void eval(const double * x, double * result, size_t npts) const;
+                /// Evaluate the spline at all the points in x
+                DVector eval(const DVector & x) const;
+                /// Is the spline evaluated with the direct lookup for (log-)uniform grids?
+                bool is_uniform_grid() const { return bool(uniform_spline); }
                 /// Get the value of the first derivative of the spline
                 double deriv_x(double x) const;
                 /// Get the value of the second derivative of the spline
@@ -283,6 +391,15 @@ namespace FML {
                 double deriv_xy(double x, double y) const;
                 /// Get the value of the y-derivative of the spline
                 double deriv_y(double x, double y) const;
+
+                /// The spline (or its derivy'th y-derivative) at a fixed y as a function of x. For a bicubic spline
+                /// this is exact as the cubic in x in each cell is given by the values and x-derivatives at the
+                /// x-knots. Only possible for bicubic splines on a (log-)uniform x-grid; if not the returned spline
+                /// is not created (check with operator bool)
+                UniformGridSpline get_x_slice(double y, int derivy = 0) const;
+                /// Evaluate the spline (or its derivy'th y-derivative) at a fixed y for npts values of x. If possible
+                /// we make the slice above once so each x is a 1D lookup
+                void eval_at_y(double y, const double * x, double * result, size_t npts, int derivy = 0) const;
                 /// Get the value of the second y-derivative of the spline
                 double deriv_yy(double x, double y) const;
 
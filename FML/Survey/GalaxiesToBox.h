@@ -1,6 +1,7 @@
 #ifndef GALAXIES_TO_BOX_HEADER
 #define GALAXIES_TO_BOX_HEADER
 
+#include <algorithm>
 #include <cmath>
 #include <functional>
 #include <iostream>
@@ -14,11 +15,10 @@
 #include <mpi.h>
 #endif
 
-// We need these for the r(z) spline
+// We need these for the r(z) table
 #include <FML/Global/Global.h>
 #include <FML/ODESolver/ODESolver.h>
 #include <FML/ParticleTypes/ReflectOnParticleMethods.h>
-#include <FML/Spline/Spline.h>
 
 //==============================================================================
 //
@@ -58,11 +58,156 @@ namespace FML {
     /// equitorial to cartesian coordinates.
     namespace SURVEY {
 
+        //==============================================================================
+        /// Tabulated comoving distance \f$ r(z) = \int_0^z dz / (H(z)/c) \f$ on a uniform grid in z. The table is
+        /// made once (one ODE solve) and can be shared between calls and catalogs (galaxies, randoms, chunks of
+        /// randoms). Lookup is cubic Hermite interpolation using the exact derivative \f$ dr/dz = c/H(z) \f$ at
+        /// the nodes. There are no branches or binary searches so the conversion loops can be vectorized.
+        /// Redshifts outside [0, z_max] are extrapolated from the first/last interval.
+        ///
+        //==============================================================================
+        class ComovingDistanceTable {
+          private:
+            double zmax{0.0};
+            double dz{0.0};
+            double dz_inv{0.0};
+            int nz{0};
+            std::vector<double> r;
+            std::vector<double> drdz_times_dz;
+
+          public:
+            ComovingDistanceTable() = default;
+
+            /// @param[in] hubble_over_c_of_z This is the function \f$ H(z)/c \f$
+            /// @param[in] z_max The maximum redshift we need the distance for
+            /// @param[in] n_z_points Number of points in the table
+            ComovingDistanceTable(std::function<double(double)> & hubble_over_c_of_z,
+                                  double z_max,
+                                  int n_z_points = 10000)
+                : zmax(z_max), nz(n_z_points) {
+                assert_mpi(nz >= 2, "[ComovingDistanceTable] Need at least 2 points\n");
+                assert_mpi(zmax > 0.0, "[ComovingDistanceTable] z_max must be positive\n");
+                dz = zmax / double(nz - 1);
+                dz_inv = 1.0 / dz;
+
+                std::vector<double> z_arr(nz);
+                for (int i = 0; i < nz; i++)
+                    z_arr[i] = i * dz;
+
+                // Solve the ODE for the co-moving distance
+                using ODESolver = FML::SOLVERS::ODESOLVER::ODESolver;
+                using ODEFunction = FML::SOLVERS::ODESOLVER::ODEFunction;
+                using DVector = FML::SOLVERS::ODESOLVER::DVector;
+                ODEFunction deriv = [&](double z, [[maybe_unused]] const double * y, double * dydx) {
+                    dydx[0] = 1.0 / hubble_over_c_of_z(z);
+                    return GSL_SUCCESS;
+                };
+                DVector r_ini{0.0};
+                ODESolver r_ode(1e-3, 1e-10, 1e-10);
+                r_ode.solve(deriv, z_arr, r_ini);
+                r = r_ode.get_data_by_component(0);
+
+                drdz_times_dz.resize(nz);
+                for (int i = 0; i < nz; i++)
+                    drdz_times_dz[i] = dz / hubble_over_c_of_z(z_arr[i]);
+            }
+
+            /// The comoving distance at redshift z
+            double operator()(double z) const {
+                const double t = z * dz_inv;
+                const int i = std::min(std::max(int(t), 0), nz - 2);
+                const double u = t - i;
+                const double um1 = 1.0 - u;
+                const double h00 = (1.0 + 2.0 * u) * um1 * um1;
+                const double h10 = u * um1 * um1;
+                const double h01 = u * u * (3.0 - 2.0 * u);
+                const double h11 = -u * u * um1;
+                return h00 * r[i] + h10 * drdz_times_dz[i] + h01 * r[i + 1] + h11 * drdz_times_dz[i + 1];
+            }
+
+            /// The derivative \f$ dr/dz = c/H(z) \f$ (derivative of the interpolant above)
+            double dr_dz(double z) const {
+                const double t = z * dz_inv;
+                const int i = std::min(std::max(int(t), 0), nz - 2);
+                const double u = t - i;
+                const double um1 = 1.0 - u;
+                const double dh00 = -6.0 * u * um1;
+                const double dh10 = um1 * (1.0 - 3.0 * u);
+                const double dh01 = 6.0 * u * um1;
+                const double dh11 = u * (3.0 * u - 2.0);
+                return (dh00 * r[i] + dh10 * drdz_times_dz[i] + dh01 * r[i + 1] + dh11 * drdz_times_dz[i + 1]) *
+                       dz_inv;
+            }
+
+            /// The maximum redshift in the table
+            double get_zmax() const { return zmax; }
+        };
+
+        //==============================================================================
+        /// Convert (RA,DEC,z) given as separate arrays (structure of arrays) to cartesian coordinates (x,y,z)
+        /// also given as separate arrays. With no particle accessors in the loop this vectorizes (omp simd).
+        ///
+        /// @param[in] RA Right ascension in degrees
+        /// @param[in] DEC Declination in degrees
+        /// @param[in] redshift Redshift
+        /// @param[in] n Number of objects
+        /// @param[out] x The x-positions (allocated by the caller)
+        /// @param[out] y The y-positions (allocated by the caller)
+        /// @param[out] z The z-positions (allocated by the caller)
+        /// @param[in] r_of_z The comoving distance table (must cover the redshifts)
+        /// @param[out] min_max_x The min/max values of x-postions
+        /// @param[out] min_max_y The min/max values of y-postions
+        /// @param[out] min_max_z The min/max values of z-postions
+        ///
+        //==============================================================================
+        inline void EquitorialToCartesianCoordinates(const double * RA,
+                                                     const double * DEC,
+                                                     const double * redshift,
+                                                     size_t n,
+                                                     double * x,
+                                                     double * y,
+                                                     double * z,
+                                                     const ComovingDistanceTable & r_of_z,
+                                                     std::pair<double, double> & min_max_x,
+                                                     std::pair<double, double> & min_max_y,
+                                                     std::pair<double, double> & min_max_z) {
+            double max_x = -1e100;
+            double max_y = -1e100;
+            double max_z = -1e100;
+            double min_x = +1e100;
+            double min_y = +1e100;
+            double min_z = +1e100;
+
+            const double degrees_to_radial = 2.0 * M_PI / 360.0;
+#ifdef USE_OMP
+#pragma omp parallel for simd reduction(max : max_x, max_y, max_z) reduction(min : min_x, min_y, min_z)
+#endif
+            for (size_t i = 0; i < n; i++) {
+                const double r = r_of_z(redshift[i]);
+                const double theta = (90.0 - DEC[i]) * degrees_to_radial;
+                const double phi = RA[i] * degrees_to_radial;
+                const double rsinTheta = r * std::sin(theta);
+                x[i] = rsinTheta * std::cos(phi);
+                y[i] = rsinTheta * std::sin(phi);
+                z[i] = r * std::cos(theta);
+
+                max_x = std::max(x[i], max_x);
+                max_y = std::max(y[i], max_y);
+                max_z = std::max(z[i], max_z);
+                min_x = std::min(x[i], min_x);
+                min_y = std::min(y[i], min_y);
+                min_z = std::min(z[i], min_z);
+            }
+
+            min_max_x = {min_x, max_x};
+            min_max_y = {min_y, max_y};
+            min_max_z = {min_z, max_z};
+        }
+
         //==============================================================================
         /// Take a set of galaxies galaxies_ra_dec_z with (RA,DEC,z) and convert them to
-        /// cartesian coordinates (x,y,z) stored in particles_xyz
+        /// cartesian coordinates (x,y,z) stored in particles_xyz using a precomputed r(z) table
         ///
-        /// The positions will be in the same units as the 1.0/hubble_over_c_of_z
         /// Gives back the min/max of the positions (useful for boxing the catalog)
         ///
         /// @tparam T Particle class for the galaxies
@@ -71,19 +216,17 @@ namespace FML {
         /// @param[in] galaxies_ra_dec_z Particles with RA, DEC and Z.
         /// @param[in] ngalaxies Number of galaxies
         /// @param[out] particles_xyz Vector with galaxies as particles with cartesian coordinates.
-        /// @param[in] hubble_over_c_of_z This is the function \f$ H(z)/c \f$ used to compute the redshift-comobing
-        /// distance relationship. Postions units is the same as those of \f$ c/H(z) \f$ (so e.g. if you want Mpc/h then
-        /// we need H0 = 100, if you want kpc/s then use H0 = 10^5 and so on.
+        /// @param[in] r_of_z The comoving distance table (must cover the redshifts of the galaxies)
         /// @param[out] min_max_x The min/max values of x-postions
         /// @param[out] min_max_y The min/max values of x-postions
         /// @param[out] min_max_z The min/max values of x-postions
         ///
         //==============================================================================
         template <class T, class U>
-        void EquitorialToCartesianCoordinates(T * galaxies_ra_dec_z,
+        void EquitorialToCartesianCoordinates(const T * galaxies_ra_dec_z,
                                               size_t ngalaxies,
                                               std::vector<U> & particles_xyz,
-                                              std::function<double(double)> & hubble_over_c_of_z,
+                                              const ComovingDistanceTable & r_of_z,
                                               std::pair<double, double> & min_max_x,
                                               std::pair<double, double> & min_max_y,
                                               std::pair<double, double> & min_max_z) {
@@ -93,47 +236,12 @@ namespace FML {
             static_assert(FML::PARTICLE::has_get_DEC<T>());
             static_assert(FML::PARTICLE::has_get_z<T>());
 
-            // Find maximum redshift
-            double z_max = 0.0;
-#ifdef USE_OMP
-#pragma omp parallel for
-#endif
-            for (size_t i = 0; i < ngalaxies; i++) {
-                const double z = FML::PARTICLE::GetRedshift(galaxies_ra_dec_z[i]);
-                z_max = std::max(z, z_max);
-            }
-
-            // Make a z-array
-            const int nz = 10000;
-            std::vector<double> z_arr(nz);
-            std::vector<double> r_arr(nz);
-            for (int i = 0; i < nz; i++) {
-                z_arr[i] = 1.1 * z_max * i / double(nz - 1);
-            }
-
-            // Solve the ODE for the co-moving distance
-            using ODESolver = FML::SOLVERS::ODESOLVER::ODESolver;
-            using ODEFunction = FML::SOLVERS::ODESOLVER::ODEFunction;
-            using DVector = FML::SOLVERS::ODESOLVER::DVector;
-            ODEFunction deriv = [&](double z, [[maybe_unused]] const double * y, double * dydx) {
-                dydx[0] = 1.0 / hubble_over_c_of_z(z);
-                return GSL_SUCCESS;
-            };
-
-            DVector r_ini{0.0};
-            ODESolver r_ode(1e-3, 1e-10, 1e-10);
-            r_ode.solve(deriv, z_arr, r_ini);
-            r_arr = r_ode.get_data_by_component(0);
-
-            // Make a spline of r(z)
-            FML::INTERPOLATION::SPLINE::Spline r_of_z_spline(z_arr, r_arr, "r_of_z_spline");
-
             // Fetch ndim from particles and check that we have the right dimensions
             assert_mpi(FML::PARTICLE::GetNDIM(U()) == 3,
                        "[EquitorialToCartesianCoordinates] Particles must have ndim = 3");
 
             // Make particles and convert to cartesian coordinates
-            particles_xyz = std::vector<U>(ngalaxies);
+            particles_xyz.assign(ngalaxies, U());
             double max_x = -1e100;
             double max_y = -1e100;
             double max_z = -1e100;
@@ -141,16 +249,19 @@ namespace FML {
             double min_y = +1e100;
             double min_z = +1e100;
 
+            double max_redshift = 0.0;
+
             const double degrees_to_radial = 2.0 * M_PI / 360.0;
 #ifdef USE_OMP
-#pragma omp parallel for reduction(max : max_x, max_y, max_z) reduction(min : min_x, min_y, min_z)
+#pragma omp parallel for reduction(max : max_x, max_y, max_z, max_redshift) reduction(min : min_x, min_y, min_z)
 #endif
             for (size_t i = 0; i < ngalaxies; i++) {
                 auto * Pos = FML::PARTICLE::GetPos(particles_xyz[i]);
                 const double RA = FML::PARTICLE::GetRA(galaxies_ra_dec_z[i]);
                 const double DEC = FML::PARTICLE::GetDEC(galaxies_ra_dec_z[i]);
                 const double redshift = FML::PARTICLE::GetRedshift(galaxies_ra_dec_z[i]);
-                const double r = r_of_z_spline(redshift);
+                const double r = r_of_z(redshift);
+                max_redshift = std::max(max_redshift, redshift);
 
                 const double cosTheta = std::cos((90.0 - DEC) * degrees_to_radial);
                 const double sinTheta = std::sin((90.0 - DEC) * degrees_to_radial);
@@ -172,13 +283,74 @@ namespace FML {
                 Pos[0] = x;
                 Pos[1] = y;
                 Pos[2] = z;
+
+                // Copy over the weight and the mean number density (if we have it)
+                if constexpr (FML::PARTICLE::has_get_weight<T>() and FML::PARTICLE::has_set_weight<U>())
+                    FML::PARTICLE::SetWeight(particles_xyz[i], FML::PARTICLE::GetWeight(galaxies_ra_dec_z[i]));
+                if constexpr (FML::PARTICLE::has_get_nbar<T>() and FML::PARTICLE::has_set_nbar<U>())
+                    FML::PARTICLE::SetNbar(particles_xyz[i], FML::PARTICLE::GetNbar(galaxies_ra_dec_z[i]));
             }
+            assert_mpi(max_redshift <= r_of_z.get_zmax(),
+                       "[EquitorialToCartesianCoordinates] Redshift is outside the range of the r(z) table\n");
 
             min_max_x = {min_x, max_x};
             min_max_y = {min_y, max_y};
             min_max_z = {min_z, max_z};
         }
 
+        /// The maximum redshift in a set of galaxies
+        template <class T>
+        double MaximumRedshift(const T * galaxies_ra_dec_z, size_t ngalaxies) {
+            static_assert(FML::PARTICLE::has_get_z<T>());
+            double z_max = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : z_max)
+#endif
+            for (size_t i = 0; i < ngalaxies; i++) {
+                const double z = FML::PARTICLE::GetRedshift(galaxies_ra_dec_z[i]);
+                z_max = std::max(z, z_max);
+            }
+            return z_max;
+        }
+
+        //==============================================================================
+        /// Take a set of galaxies galaxies_ra_dec_z with (RA,DEC,z) and convert them to
+        /// cartesian coordinates (x,y,z) stored in particles_xyz
+        ///
+        /// The positions will be in the same units as the 1.0/hubble_over_c_of_z
+        /// Gives back the min/max of the positions (useful for boxing the catalog)
+        ///
+        /// This makes a new r(z) table every call. If you do this for several catalogs make a
+        /// ComovingDistanceTable once and use the method above.
+        ///
+        /// @tparam T Particle class for the galaxies
+        /// @tparam U Particle class for the particles we make from the galaxies
+        ///
+        /// @param[in] galaxies_ra_dec_z Particles with RA, DEC and Z.
+        /// @param[in] ngalaxies Number of galaxies
+        /// @param[out] particles_xyz Vector with galaxies as particles with cartesian coordinates.
+        /// @param[in] hubble_over_c_of_z This is the function \f$ H(z)/c \f$ used to compute the redshift-comobing
+        /// distance relationship. Postions units is the same as those of \f$ c/H(z) \f$ (so e.g. if you want Mpc/h then
+        /// we need H0 = 100, if you want kpc/s then use H0 = 10^5 and so on.
+        /// @param[out] min_max_x The min/max values of x-postions
+        /// @param[out] min_max_y The min/max values of x-postions
+        /// @param[out] min_max_z The min/max values of x-postions
+        ///
+        //==============================================================================
+        template <class T, class U>
+        void EquitorialToCartesianCoordinates(const T * galaxies_ra_dec_z,
+                                              size_t ngalaxies,
+                                              std::vector<U> & particles_xyz,
+                                              std::function<double(double)> & hubble_over_c_of_z,
+                                              std::pair<double, double> & min_max_x,
+                                              std::pair<double, double> & min_max_y,
+                                              std::pair<double, double> & min_max_z) {
+            const double z_max = MaximumRedshift(galaxies_ra_dec_z, ngalaxies);
+            const ComovingDistanceTable r_of_z(hubble_over_c_of_z, 1.1 * z_max + 1e-3);
+            EquitorialToCartesianCoordinates(
+                galaxies_ra_dec_z, ngalaxies, particles_xyz, r_of_z, min_max_x, min_max_y, min_max_z);
+        }
+
         //==============================================================================
         /// @brief Transform galaxies with positions defined by RA,DEC,Z and transform these to
         /// cartesian positions in [0,1).
@@ -208,6 +380,30 @@ namespace FML {
                            bool shiftPositions,
                            bool scalePositions,
                            bool verbose) {
+            const double z_max = MaximumRedshift(galaxies_ra_dec_z, ngalaxies);
+            const ComovingDistanceTable r_of_z(hubble_over_c_of_z, 1.1 * z_max + 1e-3);
+            GalaxiesToBox(galaxies_ra_dec_z,
+                          ngalaxies,
+                          particles_xyz,
+                          r_of_z,
+                          boxsize,
+                          observer_position,
+                          shiftPositions,
+                          scalePositions,
+                          verbose);
+        }
+
+        /// As above, but using a precomputed r(z) table (that can be shared between catalogs)
+        template <class T, class U>
+        void GalaxiesToBox(const T * galaxies_ra_dec_z,
+                           size_t ngalaxies,
+                           std::vector<U> & particles_xyz,
+                           const ComovingDistanceTable & r_of_z,
+                           double & boxsize,
+                           std::vector<double> & observer_position,
+                           bool shiftPositions,
+                           bool scalePositions,
+                           bool verbose) {
 
             observer_position = {0.,0.,0.};
 
@@ -232,7 +428,7 @@ namespace FML {
             // To cartesian coordinates
             std::pair<double, double> min_max_x, min_max_y, min_max_z;
             EquitorialToCartesianCoordinates(
-                galaxies_ra_dec_z, ngalaxies, particles_xyz, hubble_over_c_of_z, min_max_x, min_max_y, min_max_z);
+                galaxies_ra_dec_z, ngalaxies, particles_xyz, r_of_z, min_max_x, min_max_y, min_max_z);
 
             double min_x = min_max_x.first;
             double min_y = min_max_y.first;
@@ -265,20 +461,26 @@ namespace FML {
                     Pos[0] -= min_x;
                     Pos[1] -= min_y;
                     Pos[2] -= min_z;
-                    observer_position[0] -= min_x;
-                    observer_position[1] -= min_y;
-                    observer_position[2] -= min_z;
                 }
 
                 if (scalePositions) {
                     Pos[0] /= boxsize;
                     Pos[1] /= boxsize;
                     Pos[2] /= boxsize;
-                    observer_position[0] /= boxsize;
-                    observer_position[1] /= boxsize;
-                    observer_position[2] /= boxsize;
                 }
             }
+
+            // The observer is at the origin before we shift and scale
+            if (shiftPositions) {
+                observer_position[0] -= min_x;
+                observer_position[1] -= min_y;
+                observer_position[2] -= min_z;
+            }
+            if (scalePositions) {
+                observer_position[0] /= boxsize;
+                observer_position[1] /= boxsize;
+                observer_position[2] /= boxsize;
+            }
         }
 
         //==============================================================================
@@ -323,9 +525,14 @@ namespace FML {
             verbose = verbose and FML::ThisTask == 0;
             double boxsize1, boxsize2;
 
+            // One r(z) table for both catalogs
+            const double z_max = std::max(MaximumRedshift(galaxies_ra_dec_z, ngalaxies),
+                                          MaximumRedshift(randoms_ra_dec_z, nrandoms));
+            const ComovingDistanceTable r_of_z(hubble_over_c_of_z, 1.1 * z_max + 1e-3);
+
             GalaxiesToBox(
-                galaxies_ra_dec_z, ngalaxies, galaxies_xyz, hubble_over_c_of_z, boxsize1, observer_position, false, false, verbose);
-            GalaxiesToBox(randoms_ra_dec_z, nrandoms, randoms_xyz, hubble_over_c_of_z, boxsize2, observer_position, false, false, verbose);
+                galaxies_ra_dec_z, ngalaxies, galaxies_xyz, r_of_z, boxsize1, observer_position, false, false, verbose);
+            GalaxiesToBox(randoms_ra_dec_z, nrandoms, randoms_xyz, r_of_z, boxsize2, observer_position, false, false, verbose);
             
             // Set observer position to be at origin
             observer_position = std::vector<double>(3,0.0);
@@ -367,19 +574,19 @@ namespace FML {
             if (shiftPositions) {
                 for (auto & p : galaxies_xyz) {
                     auto * Pos = FML::PARTICLE::GetPos(p);
-                    Pos[0] += min_x;
-                    Pos[1] += min_y;
-                    Pos[2] += min_z;
+                    Pos[0] -= min_x;
+                    Pos[1] -= min_y;
+                    Pos[2] -= min_z;
                 }
                 for (auto & p : randoms_xyz) {
                     auto * Pos = FML::PARTICLE::GetPos(p);
-                    Pos[0] += min_x;
-                    Pos[1] += min_y;
-                    Pos[2] += min_z;
+                    Pos[0] -= min_x;
+                    Pos[1] -= min_y;
+                    Pos[2] -= min_z;
                 }
-                observer_position[0] += min_x;
-                observer_position[1] += min_y;
-                observer_position[2] += min_z;
+                observer_position[0] -= min_x;
+                observer_position[1] -= min_y;
+                observer_position[2] -= min_z;
             }
 
             if (scalePositions) {
@@ -405,6 +612,95 @@ namespace FML {
                 std::cout << "Observer at ( " << observer_position[0] << " , " << observer_position[1] << " , " << observer_position[2] << ") in code units\n";
             }
         }
+
+        //==============================================================================
+        /// @brief First pass for catalogs too big to hold in memory (e.g. 10^9 randoms): read the catalog in
+        /// chunks and compute the min/max of the cartesian positions. Combine this with the bounds of the galaxies
+        /// to get the box (see GalaxiesRandomsToBox) and then convert the catalog with RandomsToBoxStreaming.
+        ///
+        /// @tparam T Particle class for the randoms
+        /// @tparam U Particle class for the particles we make from the randoms
+        ///
+        /// @param[in] read_chunk Function read_chunk(buffer, nmax) that fills buffer with up to nmax objects and
+        /// returns how many it read (0 when we are done). Same signature as for MPIParticles::create_from_generator.
+        /// @param[in] nparts_per_chunk The chunk size (this is all we keep in memory)
+        /// @param[in] r_of_z The comoving distance table (must cover the redshifts)
+        /// @param[out] min_max_x The min/max values of x-postions
+        /// @param[out] min_max_y The min/max values of y-postions
+        /// @param[out] min_max_z The min/max values of z-postions
+        ///
+        //==============================================================================
+        template <class T, class U>
+        void ComputeCartesianBoundsStreaming(std::function<size_t(T *, size_t)> read_chunk,
+                                             size_t nparts_per_chunk,
+                                             const ComovingDistanceTable & r_of_z,
+                                             std::pair<double, double> & min_max_x,
+                                             std::pair<double, double> & min_max_y,
+                                             std::pair<double, double> & min_max_z) {
+            assert_mpi(nparts_per_chunk > 0, "[ComputeCartesianBoundsStreaming] nparts_per_chunk must be > 0\n");
+            min_max_x = min_max_y = min_max_z = {+1e100, -1e100};
+
+            std::vector<T> buffer(nparts_per_chunk);
+            std::vector<U> particles_xyz;
+            size_t nread;
+            while ((nread = read_chunk(buffer.data(), nparts_per_chunk)) > 0) {
+                std::pair<double, double> chunk_x, chunk_y, chunk_z;
+                EquitorialToCartesianCoordinates(buffer.data(), nread, particles_xyz, r_of_z, chunk_x, chunk_y, chunk_z);
+                min_max_x = {std::min(min_max_x.first, chunk_x.first), std::max(min_max_x.second, chunk_x.second)};
+                min_max_y = {std::min(min_max_y.first, chunk_y.first), std::max(min_max_y.second, chunk_y.second)};
+                min_max_z = {std::min(min_max_z.first, chunk_z.first), std::max(min_max_z.second, chunk_z.second)};
+            }
+        }
+
+        //==============================================================================
+        /// @brief Convert a catalog (e.g. randoms) read in chunks to cartesian positions in a given box and hand
+        /// each chunk to a function (e.g. density assignment) so that the full catalog is never in memory. The
+        /// positions are computed as (x - min_position) / boxsize, i.e. with min_position = (0,0,0) and boxsize = 1
+        /// we get the raw cartesian positions. Use ComputeCartesianBoundsStreaming to find the box first.
+        ///
+        /// @tparam T Particle class for the randoms
+        /// @tparam U Particle class for the particles we make from the randoms
+        ///
+        /// @param[in] read_chunk Function read_chunk(buffer, nmax) that fills buffer with up to nmax objects and
+        /// returns how many it read (0 when we are done).
+        /// @param[in] nparts_per_chunk The chunk size (this is all we keep in memory)
+        /// @param[in] r_of_z The comoving distance table (must cover the redshifts)
+        /// @param[in] min_position The position we shift to the origin
+        /// @param[in] boxsize The size we scale positions by
+        /// @param[in] process Function process(particles, n) called for each chunk of converted particles
+        ///
+        //==============================================================================
+        template <class T, class U>
+        void RandomsToBoxStreaming(std::function<size_t(T *, size_t)> read_chunk,
+                                   size_t nparts_per_chunk,
+                                   const ComovingDistanceTable & r_of_z,
+                                   const std::vector<double> & min_position,
+                                   double boxsize,
+                                   std::function<void(U *, size_t)> process) {
+            assert_mpi(nparts_per_chunk > 0, "[RandomsToBoxStreaming] nparts_per_chunk must be > 0\n");
+            assert_mpi(min_position.size() == 3, "[RandomsToBoxStreaming] min_position must have 3 components\n");
+            assert_mpi(boxsize > 0.0, "[RandomsToBoxStreaming] boxsize must be positive\n");
+
+            std::vector<T> buffer(nparts_per_chunk);
+            std::vector<U> particles_xyz;
+            size_t nread;
+            while ((nread = read_chunk(buffer.data(), nparts_per_chunk)) > 0) {
+                std::pair<double, double> min_max_x, min_max_y, min_max_z;
+                EquitorialToCartesianCoordinates(
+                    buffer.data(), nread, particles_xyz, r_of_z, min_max_x, min_max_y, min_max_z);
+
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < nread; i++) {
+                    auto * Pos = FML::PARTICLE::GetPos(particles_xyz[i]);
+                    for (int idim = 0; idim < 3; idim++)
+                        Pos[idim] = (Pos[idim] - min_position[idim]) / boxsize;
+                }
+
+                process(particles_xyz.data(), nread);
+            }
+        }
     } // namespace SURVEY
 } // namespace FML
 
@@ -0,0 +1,468 @@
+#ifndef SURVEY_RANDOMS_HEADER
+#define SURVEY_RANDOMS_HEADER
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#ifdef USE_OMP
+#include <omp.h>
+#endif
+
+#include <FML/Global/Global.h>
+#include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+#include <FML/RandomGenerator/RandomGenerator.h>
+#include <FML/Survey/GalaxiesToBox.h>
+
+//==============================================================================
+//
+// Generate a random catalog for a survey (the randoms used for the window
+// function, FKP power spectra, correlation functions etc.) from an angular
+// mask and a redshift distribution n(z) instead of reading it from file.
+//
+// The angular mask is a lookup table of the completeness on pixels of equal
+// area (uniform in sin(DEC) and RA). We pick a pixel with completeness > 0,
+// a uniform point in it and accept it with probability completeness / max.
+// Redshifts are drawn from n(z) by inverting the tabulated CDF.
+//
+// Random number i is a pure function of (seed, i) (Philox counter-based RNG)
+// so the catalog is the same for any number of tasks and threads and any
+// part of it can be (re)generated on its own. This is used to make the
+// randoms in chunks and hand them directly to the boxing (e.g. density
+// assignment) without the full catalog ever being in memory or on disk.
+//
+// OpenMP parallelized and safe to run with MPI (every task makes its own
+// part of the catalog)
+//
+//==============================================================================
+
+namespace FML {
+    namespace SURVEY {
+
+        //==============================================================================
+        /// The completeness of a survey on the sky as a lookup table. The pixels are a (sin(DEC), RA) grid with
+        /// n_dec rings and n_ra pixels per ring so all pixels have the same area and a point drawn uniformly in
+        /// (sin(DEC), RA) within a pixel is uniform on the sphere. Completeness is in [0,1] with 0 meaning
+        /// outside the survey. RA and DEC are in degrees.
+        ///
+        //==============================================================================
+        class AngularMask {
+          private:
+            int n_dec{0};
+            int n_ra{0};
+            std::vector<double> completeness;
+            std::vector<int> active_pixels;
+            double max_completeness{0.0};
+
+            void init() {
+                assert_mpi(n_dec > 0 and n_ra > 0, "[AngularMask] n_dec and n_ra must be positive\n");
+                assert_mpi(completeness.size() == size_t(n_dec) * size_t(n_ra),
+                           "[AngularMask] The completeness must have n_dec * n_ra values\n");
+                active_pixels.clear();
+                max_completeness = 0.0;
+                for (int ipix = 0; ipix < get_npix(); ipix++) {
+                    assert_mpi(completeness[ipix] >= 0.0, "[AngularMask] Negative completeness\n");
+                    if (completeness[ipix] > 0.0)
+                        active_pixels.push_back(ipix);
+                    max_completeness = std::max(max_completeness, completeness[ipix]);
+                }
+                assert_mpi(active_pixels.size() > 0, "[AngularMask] The mask is empty\n");
+            }
+
+          public:
+            AngularMask() = default;
+
+            /// @param[in] _n_dec Number of rings in sin(DEC)
+            /// @param[in] _n_ra Number of pixels in RA in each ring
+            /// @param[in] _completeness The completeness in pixel ipix = idec * n_ra + ira
+            AngularMask(int _n_dec, int _n_ra, std::vector<double> _completeness)
+                : n_dec(_n_dec), n_ra(_n_ra), completeness(std::move(_completeness)) {
+                init();
+            }
+
+            /// @param[in] _n_dec Number of rings in sin(DEC)
+            /// @param[in] _n_ra Number of pixels in RA in each ring
+            /// @param[in] completeness_of_ra_dec Function (RA, DEC) -> completeness. Evaluated (in parallel) on a
+            /// nsub x nsub grid within each pixel and averaged, so pixels cut by the survey edge get a fractional
+            /// completeness.
+            /// @param[in] nsub Number of evaluations per pixel in each direction
+            AngularMask(int _n_dec,
+                        int _n_ra,
+                        std::function<double(double, double)> completeness_of_ra_dec,
+                        int nsub = 2)
+                : n_dec(_n_dec), n_ra(_n_ra) {
+                assert_mpi(nsub > 0, "[AngularMask] nsub must be positive\n");
+                completeness.resize(size_t(n_dec) * size_t(n_ra));
+                const double rad_to_deg = 360.0 / (2.0 * M_PI);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (int idec = 0; idec < n_dec; idec++) {
+                    for (int ira = 0; ira < n_ra; ira++) {
+                        double sum = 0.0;
+                        for (int i = 0; i < nsub; i++) {
+                            const double sin_dec = -1.0 + 2.0 * (idec + (i + 0.5) / nsub) / n_dec;
+                            const double DEC = std::asin(sin_dec) * rad_to_deg;
+                            for (int j = 0; j < nsub; j++) {
+                                const double RA = 360.0 * (ira + (j + 0.5) / nsub) / n_ra;
+                                sum += completeness_of_ra_dec(RA, DEC);
+                            }
+                        }
+                        completeness[idec * size_t(n_ra) + ira] = sum / double(nsub * nsub);
+                    }
+                }
+                init();
+            }
+
+            int get_n_dec() const { return n_dec; }
+            int get_n_ra() const { return n_ra; }
+            int get_npix() const { return n_dec * n_ra; }
+
+            /// The pixel a point on the sky is in
+            int get_pixel(double RA, double DEC) const {
+                const double sin_dec = std::sin(DEC * (2.0 * M_PI / 360.0));
+                const int idec = std::min(std::max(int((sin_dec + 1.0) * 0.5 * n_dec), 0), n_dec - 1);
+                const double ra = RA - 360.0 * std::floor(RA / 360.0);
+                const int ira = std::min(std::max(int(ra / 360.0 * n_ra), 0), n_ra - 1);
+                return idec * n_ra + ira;
+            }
+
+            /// The completeness at a point on the sky
+            double operator()(double RA, double DEC) const { return completeness[get_pixel(RA, DEC)]; }
+
+            /// The completeness weighted fraction of the sky covered by the survey
+            double get_sky_fraction() const {
+                double sum = 0.0;
+                for (auto c : completeness)
+                    sum += c;
+                return sum / double(get_npix());
+            }
+
+            /// Draw a point from four uniform random numbers in [0,1). Returns false if it was rejected,
+            /// otherwise RA in degrees and sin(DEC).
+            bool sample(const std::array<double, 4> & u, double & RA, double & sin_dec) const {
+                const int nactive = int(active_pixels.size());
+                const int ipix = active_pixels[std::min(int(u[0] * nactive), nactive - 1)];
+                if (u[3] * max_completeness >= completeness[ipix])
+                    return false;
+                const int idec = ipix / n_ra;
+                const int ira = ipix - idec * n_ra;
+                sin_dec = -1.0 + 2.0 * (idec + u[1]) / n_dec;
+                RA = 360.0 * (ira + u[2]) / n_ra;
+                return true;
+            }
+        };
+
+        //==============================================================================
+        /// Draw redshifts from a distribution n(z) in [z_min, z_max] by inverting the tabulated CDF (piecewise
+        /// linear n(z) between the nodes). n(z) is either the redshift distribution dN/dz itself or the comoving
+        /// number density nbar(z) in which case we sample \f$ dN/dz \propto \bar{n}(z) r^2(z) dr/dz \f$ using the
+        /// r(z) table.
+        ///
+        //==============================================================================
+        class RedshiftDistributionTable {
+          private:
+            double zmin{0.0};
+            double dz{0.0};
+            std::vector<double> cdf;
+
+          public:
+            RedshiftDistributionTable() = default;
+
+            /// @param[in] n_of_z The function n(z)
+            /// @param[in] z_min Smallest redshift
+            /// @param[in] z_max Largest redshift
+            /// @param[in] r_of_z The comoving distance table (must cover z_max)
+            /// @param[in] n_is_comoving_density n(z) is the comoving number density (true) or dN/dz (false)
+            /// @param[in] n_z_points Number of points in the table
+            RedshiftDistributionTable(std::function<double(double)> n_of_z,
+                                      double z_min,
+                                      double z_max,
+                                      const ComovingDistanceTable & r_of_z,
+                                      bool n_is_comoving_density,
+                                      int n_z_points = 10000)
+                : zmin(z_min) {
+                assert_mpi(n_z_points >= 2, "[RedshiftDistributionTable] Need at least 2 points\n");
+                assert_mpi(z_min >= 0.0 and z_max > z_min, "[RedshiftDistributionTable] Need 0 <= z_min < z_max\n");
+                assert_mpi(z_max <= r_of_z.get_zmax(),
+                           "[RedshiftDistributionTable] z_max is outside the range of the r(z) table\n");
+                dz = (z_max - z_min) / double(n_z_points - 1);
+
+                std::vector<double> dNdz(n_z_points);
+                for (int i = 0; i < n_z_points; i++) {
+                    const double z = z_min + i * dz;
+                    dNdz[i] = n_of_z(z);
+                    if (n_is_comoving_density) {
+                        const double r = r_of_z(z);
+                        dNdz[i] *= r * r * r_of_z.dr_dz(z);
+                    }
+                    assert_mpi(dNdz[i] >= 0.0, "[RedshiftDistributionTable] n(z) is negative\n");
+                }
+
+                cdf.resize(n_z_points);
+                cdf[0] = 0.0;
+                for (int i = 1; i < n_z_points; i++)
+                    cdf[i] = cdf[i - 1] + 0.5 * (dNdz[i - 1] + dNdz[i]) * dz;
+                assert_mpi(cdf.back() > 0.0, "[RedshiftDistributionTable] n(z) is zero everywhere\n");
+                const double norm = 1.0 / cdf.back();
+                for (auto & c : cdf)
+                    c *= norm;
+            }
+
+            /// The redshift corresponding to a uniform random number in [0,1)
+            double operator()(double u) const {
+                const int n = int(cdf.size());
+                const int i = std::min(int(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()), n - 1) - 1;
+                const double dcdf = cdf[i + 1] - cdf[i];
+                const double t = dcdf > 0.0 ? (u - cdf[i]) / dcdf : 0.0;
+                return zmin + (i + t) * dz;
+            }
+        };
+
+        //==============================================================================
+        /// A random catalog of nrandoms objects drawn from an angular mask and a redshift distribution. Random
+        /// number i only depends on (seed, i) so the catalog does not depend on how we split it over tasks and
+        /// threads and we can generate any range of it on its own. The mask, n(z) and r(z) tables are not copied
+        /// and must outlive this object. The cartesian positions have the observer at the origin and are in the
+        /// units of the r(z) table with the same convention as EquitorialToCartesianCoordinates.
+        ///
+        //==============================================================================
+        class SurveyRandomsGenerator {
+          private:
+            const AngularMask & mask;
+            const RedshiftDistributionTable & n_of_z;
+            const ComovingDistanceTable & r_of_z;
+            size_t nrandoms;
+            FML::RANDOM::PHILOX::Key key;
+
+          public:
+            /// @param[in] _mask The angular mask
+            /// @param[in] _n_of_z The redshift distribution
+            /// @param[in] _r_of_z The comoving distance table (must cover the redshifts)
+            /// @param[in] _nrandoms Total number of randoms (over all tasks)
+            /// @param[in] seed The seed
+            SurveyRandomsGenerator(const AngularMask & _mask,
+                                   const RedshiftDistributionTable & _n_of_z,
+                                   const ComovingDistanceTable & _r_of_z,
+                                   size_t _nrandoms,
+                                   uint64_t seed)
+                : mask(_mask), n_of_z(_n_of_z), r_of_z(_r_of_z), nrandoms(_nrandoms),
+                  key(FML::RANDOM::PHILOX::key_from_seed(seed)) {}
+
+            size_t get_nrandoms() const { return nrandoms; }
+            const ComovingDistanceTable & get_r_of_z() const { return r_of_z; }
+
+            /// The range [first, last) of randoms this task is responsible for
+            std::pair<size_t, size_t> get_local_range() const {
+                const size_t first = nrandoms * size_t(FML::ThisTask) / size_t(FML::NTasks);
+                const size_t last = nrandoms * size_t(FML::ThisTask + 1) / size_t(FML::NTasks);
+                return {first, last};
+            }
+
+            /// Random number i: RA in degrees, sin(DEC) and the redshift
+            void sample(size_t i, double & RA, double & sin_dec, double & z) const {
+                using namespace FML::RANDOM::PHILOX;
+                const uint32_t ilo = uint32_t(i);
+                const uint32_t ihi = uint32_t(uint64_t(i) >> 32);
+                for (uint32_t attempt = 0;; attempt++) {
+                    const auto u01 = uniform_pair({ilo, ihi, attempt, 0}, key);
+                    const auto u23 = uniform_pair({ilo, ihi, attempt, 1}, key);
+                    if (mask.sample({u01[0], u01[1], u23[0], u23[1]}, RA, sin_dec))
+                        break;
+                }
+                z = n_of_z(uniform_pair({ilo, ihi, 0, 2}, key)[0]);
+            }
+
+            //==============================================================================
+            /// Generate randoms [first, first + n) in cartesian coordinates
+            ///
+            /// @tparam U Particle class for the randoms (must have ndim = 3)
+            ///
+            /// @param[in] first The index of the first random
+            /// @param[in] n Number of randoms
+            /// @param[out] randoms_xyz The randoms (allocated by the caller)
+            /// @param[out] min_max_x The min/max values of x-postions
+            /// @param[out] min_max_y The min/max values of y-postions
+            /// @param[out] min_max_z The min/max values of z-postions
+            ///
+            //==============================================================================
+            template <class U>
+            void generate(size_t first,
+                          size_t n,
+                          U * randoms_xyz,
+                          std::pair<double, double> & min_max_x,
+                          std::pair<double, double> & min_max_y,
+                          std::pair<double, double> & min_max_z) const {
+                assert_mpi(FML::PARTICLE::GetNDIM(U()) == 3, "[SurveyRandomsGenerator] Particles must have ndim = 3");
+                double max_x = -1e100, max_y = -1e100, max_z = -1e100;
+                double min_x = +1e100, min_y = +1e100, min_z = +1e100;
+                const double degrees_to_radial = 2.0 * M_PI / 360.0;
+#ifdef USE_OMP
+#pragma omp parallel for reduction(max : max_x, max_y, max_z) reduction(min : min_x, min_y, min_z)
+#endif
+                for (size_t i = 0; i < n; i++) {
+                    double RA, sin_dec, redshift;
+                    sample(first + i, RA, sin_dec, redshift);
+                    const double r = r_of_z(redshift);
+                    const double rcos_dec = r * std::sqrt(std::max(1.0 - sin_dec * sin_dec, 0.0));
+                    const double phi = RA * degrees_to_radial;
+
+                    auto * Pos = FML::PARTICLE::GetPos(randoms_xyz[i]);
+                    Pos[0] = rcos_dec * std::cos(phi);
+                    Pos[1] = rcos_dec * std::sin(phi);
+                    Pos[2] = r * sin_dec;
+
+                    max_x = std::max(Pos[0], max_x);
+                    max_y = std::max(Pos[1], max_y);
+                    max_z = std::max(Pos[2], max_z);
+                    min_x = std::min(Pos[0], min_x);
+                    min_y = std::min(Pos[1], min_y);
+                    min_z = std::min(Pos[2], min_z);
+                }
+                min_max_x = {min_x, max_x};
+                min_max_y = {min_y, max_y};
+                min_max_z = {min_z, max_z};
+            }
+
+            /// Generate randoms [first, first + n) with RA, DEC (degrees) and z. T must have set_RA, set_DEC, set_z
+            template <class T>
+            void generate_ra_dec_z(size_t first, size_t n, T * randoms_ra_dec_z) const {
+                static_assert(FML::PARTICLE::has_set_RA<T>());
+                static_assert(FML::PARTICLE::has_set_DEC<T>());
+                static_assert(FML::PARTICLE::has_set_z<T>());
+                const double rad_to_deg = 360.0 / (2.0 * M_PI);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < n; i++) {
+                    double RA, sin_dec, redshift;
+                    sample(first + i, RA, sin_dec, redshift);
+                    FML::PARTICLE::SetRA(randoms_ra_dec_z[i], RA);
+                    FML::PARTICLE::SetDEC(randoms_ra_dec_z[i], std::asin(sin_dec) * rad_to_deg);
+                    FML::PARTICLE::SetRedshift(randoms_ra_dec_z[i], redshift);
+                }
+            }
+
+            /// A function read_chunk(buffer, nmax) that gives the randoms of this task with RA, DEC and z chunk
+            /// by chunk, i.e. it can be used in place of reading them from file for ComputeCartesianBoundsStreaming,
+            /// RandomsToBoxStreaming or MPIParticles::create_from_generator. Every call to this method starts over.
+            template <class T>
+            std::function<size_t(T *, size_t)> make_chunk_reader() const {
+                auto range = get_local_range();
+                size_t next = range.first;
+                const size_t last = range.second;
+                return [this, next, last](T * buffer, size_t nmax) mutable -> size_t {
+                    const size_t n = std::min(nmax, last - next);
+                    generate_ra_dec_z(next, n, buffer);
+                    next += n;
+                    return n;
+                };
+            }
+        };
+
+        //==============================================================================
+        /// @brief As GalaxiesRandomsToBox, but the randoms are generated on the fly (see SurveyRandomsGenerator)
+        /// in chunks and each chunk (shifted/scaled like the galaxies) is handed to process_randoms, e.g. density
+        /// assignment, so the random catalog is never stored. The randoms are generated twice: once to find the
+        /// box and once to process them (it is the same catalog both times). With MPI every task generates its
+        /// part of the randoms and the box is the same on all tasks.
+        ///
+        /// @tparam T Particle class for the galaxies
+        /// @tparam U Particle class for the particles we make from the galaxies/randoms
+        ///
+        /// @param[in] galaxies_ra_dec_z Galaxies with RA, DEC and Z.
+        /// @param[in] ngalaxies Number of galaxies
+        /// @param[in] randoms The random generator. Its r(z) table is also used for the galaxies.
+        /// @param[in] nparts_per_chunk Number of randoms we have in memory at the time
+        /// @param[out] galaxies_xyz Vector with galaxies as particles with cartesian coordinates.
+        /// @param[in] process_randoms Function process(particles, n) called for each chunk of randoms
+        /// @param[out] boxsize The boxsize we need to place the galaxies and randoms in a cubic box.
+        /// @param[in] shiftPositions Shift the positions such that all are >=0
+        /// @param[in] scalePositions Scale positions so that all are in [0,1). This requires also shifting positions.
+        /// @param[out] observer_position The position of the observer after shifting and scaling the box.
+        /// @param[in] verbose Print info while doing this.
+        ///
+        //==============================================================================
+        template <class T, class U>
+        void GalaxiesRandomsToBox(const T * galaxies_ra_dec_z,
+                                  size_t ngalaxies,
+                                  const SurveyRandomsGenerator & randoms,
+                                  size_t nparts_per_chunk,
+                                  std::vector<U> & galaxies_xyz,
+                                  std::function<void(U *, size_t)> process_randoms,
+                                  double & boxsize,
+                                  bool shiftPositions,
+                                  bool scalePositions,
+                                  std::vector<double> & observer_position,
+                                  bool verbose) {
+            assert_mpi(nparts_per_chunk > 0, "[GalaxiesRandomsToBox] nparts_per_chunk must be > 0\n");
+            if (scalePositions)
+                assert(shiftPositions);
+            verbose = verbose and FML::ThisTask == 0;
+
+            std::pair<double, double> min_max_x, min_max_y, min_max_z;
+            EquitorialToCartesianCoordinates(
+                galaxies_ra_dec_z, ngalaxies, galaxies_xyz, randoms.get_r_of_z(), min_max_x, min_max_y, min_max_z);
+            double min_x = min_max_x.first, min_y = min_max_y.first, min_z = min_max_z.first;
+            double max_x = min_max_x.second, max_y = min_max_y.second, max_z = min_max_z.second;
+
+            // First pass over the randoms: find the bounds
+            const auto range = randoms.get_local_range();
+            std::vector<U> buffer(std::min(nparts_per_chunk, range.second - range.first));
+            for (size_t first = range.first; first < range.second; first += nparts_per_chunk) {
+                const size_t n = std::min(nparts_per_chunk, range.second - first);
+                randoms.generate(first, n, buffer.data(), min_max_x, min_max_y, min_max_z);
+                min_x = std::min(min_x, min_max_x.first);
+                min_y = std::min(min_y, min_max_y.first);
+                min_z = std::min(min_z, min_max_z.first);
+                max_x = std::max(max_x, min_max_x.second);
+                max_y = std::max(max_y, min_max_y.second);
+                max_z = std::max(max_z, min_max_z.second);
+            }
+            FML::MinOverTasks(&min_x, &min_y, &min_z);
+            FML::MaxOverTasks(&max_x, &max_y, &max_z);
+
+            // Same box as GalaxiesRandomsToBox
+            boxsize = 1.05 * std::max(std::max(max_x - min_x, max_y - min_y), max_z - min_z);
+            const double shift[3] = {shiftPositions ? min_x : 0.0, shiftPositions ? min_y : 0.0,
+                                     shiftPositions ? min_z : 0.0};
+            const double scale = scalePositions ? 1.0 / boxsize : 1.0;
+
+            auto to_box = [&](U * part, size_t n) {
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < n; i++) {
+                    auto * Pos = FML::PARTICLE::GetPos(part[i]);
+                    for (int idim = 0; idim < 3; idim++)
+                        Pos[idim] = (Pos[idim] - shift[idim]) * scale;
+                }
+            };
+            to_box(galaxies_xyz.data(), galaxies_xyz.size());
+            observer_position = std::vector<double>(3, 0.0);
+            for (int idim = 0; idim < 3; idim++)
+                observer_position[idim] = (observer_position[idim] - shift[idim]) * scale;
+
+            // Second pass: the same randoms in the box
+            for (size_t first = range.first; first < range.second; first += nparts_per_chunk) {
+                const size_t n = std::min(nparts_per_chunk, range.second - first);
+                randoms.generate(first, n, buffer.data(), min_max_x, min_max_y, min_max_z);
+                to_box(buffer.data(), n);
+                process_randoms(buffer.data(), n);
+            }
+
+            if (verbose) {
+                std::cout << "Boxsize for boxing galaxies and " << randoms.get_nrandoms() << " randoms: " << boxsize
+                          << "\n";
+                std::cout << "Observer at ( " << observer_position[0] << " , " << observer_position[1] << " , "
+                          << observer_position[2] << ") in code units\n";
+            }
+        }
+    } // namespace SURVEY
+} // namespace FML
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef HESSIAN_HEADER
 #define HESSIAN_HEADER
 
+#include <algorithm>
+#include <array>
+#include <functional>
 #include <vector>
 
 #include <gsl/gsl_eigen.h>
@@ -86,7 +89,7 @@ namespace FML {
             f_fourier.fftw_r2c();
 
             // Allocate grids
-            hessian_real.resize(N * (N - 1));
+            hessian_real.resize((N * (N + 1)) / 2);
 
             // Compute hessian matrix
             int count = 0;
@@ -101,7 +104,7 @@ namespace FML {
 
         //=================================================================================
         /// For each point in the grid compute eigenvectors and eigenvalues of the tensor
-        /// \f$ H_{ij} \f$ where tensor_real contains the \f$ N(N-1)/2 \f$ grids [ 00,01,02,..,11,12,...,NN ]
+        /// \f$ H_{ij} \f$ where tensor_real contains the \f$ N(N+1)/2 \f$ grids [ 00,01,02,..,11,12,...,NN ]
         ///
         /// Eigenvalues are ordered in descending order
         ///
@@ -137,13 +140,6 @@ namespace FML {
                     eigenvectors[i] = tensor_real[0];
             }
 
-            // Set up the GSL stuff we need
-            gsl_matrix * matrix = gsl_matrix_alloc(N, N);
-            gsl_matrix * evec = gsl_matrix_alloc(N, N);
-            gsl_vector * eval = gsl_vector_alloc(N);
-            gsl_eigen_symm_workspace * workspace = gsl_eigen_symm_alloc(N);
-            gsl_eigen_symmv_workspace * workspacev = gsl_eigen_symmv_alloc(N);
-
             // Solves the full eigensystem
             auto SolveEigensystem = [&](gsl_matrix * _matrix,
                                         gsl_vector * _eval,
@@ -167,52 +163,315 @@ namespace FML {
             // Loop over all cells
             auto Local_nx = tensor_real[0].get_local_nx();
 #ifdef USE_OMP
-#pragma omp parallel for
+#pragma omp parallel
 #endif
-            for (int islice = 0; islice < Local_nx; islice++) {
-                for (auto && real_index : tensor_real[0].get_real_range(islice,islice+1)) {
+            {
+                // Set up the GSL stuff we need (one set per thread)
+                gsl_matrix * matrix = gsl_matrix_alloc(N, N);
+                gsl_matrix * evec = gsl_matrix_alloc(N, N);
+                gsl_vector * eval = gsl_vector_alloc(N);
+                gsl_eigen_symm_workspace * workspace = gsl_eigen_symm_alloc(N);
+                gsl_eigen_symmv_workspace * workspacev = gsl_eigen_symmv_alloc(N);
 
-                    // Set the matrix
-                    int count = 0;
-                    for (int idim = 0; idim < N; idim++) {
-                        auto value = tensor_real[count].get_real_from_index(real_index);
-                        gsl_matrix_set(matrix, idim, idim, value);
-                        count++;
-                        for (int idim2 = idim + 1; idim2 < N; idim2++) {
-                            value = tensor_real[count].get_real_from_index(real_index);
-                            gsl_matrix_set(matrix, idim, idim2, value);
-                            gsl_matrix_set(matrix, idim2, idim, value);
+#ifdef USE_OMP
+#pragma omp for
+#endif
+                for (int islice = 0; islice < Local_nx; islice++) {
+                    for (auto && real_index : tensor_real[0].get_real_range(islice,islice+1)) {
+
+                        // Set the matrix
+                        int count = 0;
+                        for (int idim = 0; idim < N; idim++) {
+                            auto value = tensor_real[count].get_real_from_index(real_index);
+                            gsl_matrix_set(matrix, idim, idim, value);
                             count++;
+                            for (int idim2 = idim + 1; idim2 < N; idim2++) {
+                                value = tensor_real[count].get_real_from_index(real_index);
+                                gsl_matrix_set(matrix, idim, idim2, value);
+                                gsl_matrix_set(matrix, idim2, idim, value);
+                                count++;
+                            }
                         }
-                    }
 
-                    // Compute eigenvectors+eigenvalues or just eigenvalues
-                    // In the latter case we sort the eigenvalues
-                    if (compute_eigenvectors) {
-                        SolveEigensystem(matrix, eval, evec, workspacev);
+                        // Compute eigenvectors+eigenvalues or just eigenvalues
+                        // In the latter case we sort the eigenvalues
+                        if (compute_eigenvectors) {
+                            SolveEigensystem(matrix, eval, evec, workspacev);
 
-                        // Set eigenvectors
-                        for (int i = 0; i < N * N; i++) {
-                            eigenvectors[i].set_real_from_index(real_index, evec->data[i]);
-                            // For column major order: gsl_matrix_get(evec, i / N, i % N);
+                            // Set eigenvectors
+                            for (int i = 0; i < N * N; i++) {
+                                eigenvectors[i].set_real_from_index(real_index, evec->data[i]);
+                                // For column major order: gsl_matrix_get(evec, i / N, i % N);
+                            }
+
+                        } else {
+                            SolveEigenvalues(matrix, eval, workspace);
                         }
 
+                        // Store the eigenvalues
+                        for (int idim = 0; idim < N; idim++)
+                            eigenvalues[idim].set_real_from_index(real_index, eval->data[idim]);
+                    }
+                }
+
+                // Free up GSL allocations
+                gsl_matrix_free(matrix);
+                gsl_matrix_free(evec);
+                gsl_vector_free(eval);
+                gsl_eigen_symm_free(workspace);
+                gsl_eigen_symmv_free(workspacev);
+            }
+        }
+
+        //=================================================================================
+        /// Eigenvalues (in descending order) of a symmetric NxN matrix given by its upper triangle in the same
+        /// order as the Hessian grids [00,01,02,..,11,12,...,NN]. Closed form for N = 2 and N = 3 (no workspace is
+        /// needed so this is thread-safe) and GSL otherwise.
+        ///
+        /// @tparam N The dimension of the matrix
+        ///
+        /// @param[in] h The upper triangle of the matrix
+        ///
+        /// @return The eigenvalues in descending order
+        ///
+        //=================================================================================
+        template <int N>
+        std::array<double, N> SymmetricMatrixEigenvalues(const std::array<double, (N * (N + 1)) / 2> & h) {
+            std::array<double, N> eval;
+            if constexpr (N == 1) {
+                eval[0] = h[0];
+            } else if constexpr (N == 2) {
+                // [a b; b d]
+                const double mean = 0.5 * (h[0] + h[2]);
+                const double halfdiff = 0.5 * (h[0] - h[2]);
+                const double r = std::sqrt(halfdiff * halfdiff + h[1] * h[1]);
+                eval[0] = mean + r;
+                eval[1] = mean - r;
+            } else if constexpr (N == 3) {
+                // [a b c; b d e; c e f] using the trigonometric solution of the characteristic equation
+                const double a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5];
+                const double p1 = b * b + c * c + e * e;
+                const double q = (a + d + f) / 3.0;
+                const double p2 = (a - q) * (a - q) + (d - q) * (d - q) + (f - q) * (f - q) + 2.0 * p1;
+                if (p2 == 0.0) {
+                    eval.fill(q);
+                } else {
+                    const double p = std::sqrt(p2 / 6.0);
+                    // r = det((A - qI)/p) / 2
+                    const double aq = (a - q) / p, dq = (d - q) / p, fq = (f - q) / p;
+                    const double bp = b / p, cp = c / p, ep = e / p;
+                    double r = 0.5 * (aq * (dq * fq - ep * ep) - bp * (bp * fq - ep * cp) + cp * (bp * ep - dq * cp));
+                    r = std::min(1.0, std::max(-1.0, r));
+                    const double phi = std::acos(r) / 3.0;
+                    eval[0] = q + 2.0 * p * std::cos(phi);
+                    eval[2] = q + 2.0 * p * std::cos(phi + 2.0 * M_PI / 3.0);
+                    eval[1] = 3.0 * q - eval[0] - eval[2];
+                }
+            } else {
+                gsl_matrix * matrix = gsl_matrix_alloc(N, N);
+                gsl_vector * gsl_eval = gsl_vector_alloc(N);
+                gsl_eigen_symm_workspace * workspace = gsl_eigen_symm_alloc(N);
+                int count = 0;
+                for (int idim = 0; idim < N; idim++) {
+                    for (int idim2 = idim; idim2 < N; idim2++) {
+                        gsl_matrix_set(matrix, idim, idim2, h[count]);
+                        gsl_matrix_set(matrix, idim2, idim, h[count]);
+                        count++;
+                    }
+                }
+                gsl_eigen_symm(matrix, gsl_eval, workspace);
+                for (int idim = 0; idim < N; idim++)
+                    eval[idim] = gsl_vector_get(gsl_eval, idim);
+                gsl_matrix_free(matrix);
+                gsl_vector_free(gsl_eval);
+                gsl_eigen_symm_free(workspace);
+                std::sort(eval.begin(), eval.end(), std::greater<double>());
+            }
+            return eval;
+        }
+
+        //=================================================================================
+        /// Memory-lean computation of the Hessian (see ComputeHessianWithFT) followed by a function of its
+        /// eigenvalues in each cell. The N(N+1)/2 components are computed one at a time from a single fourier copy
+        /// of f, the last one in place in that copy, and the eigenvalues are then computed slice by slice. Peak
+        /// memory is N(N+1)/2 grids (6 in 3D) instead of the 1 + N(N+1)/2 + N grids of ComputeHessianWithFT
+        /// followed by SymmetricTensorEigensystem. The component grids are returned so that the caller can reuse
+        /// them for output.
+        ///
+        /// @tparam N The dimension we are working in
+        ///
+        /// @param[in] f_real The grid we are to compute the hessian of
+        /// @param[in] norm A number to scale the grid by if needed
+        /// @param[in] hessian_of_potential_of_f Compute the hessian of the potential of the grid
+        /// @param[in] process Called as process(components, real_index, cell_index, eigenvalues) for every cell
+        /// where cell_index is the index of the cell in an unpadded local grid. This is done after all
+        /// the components have been read for the cell so it can overwrite them.
+        ///
+        /// @return The Hessian component grids
+        ///
+        //=================================================================================
+        template <int N, class Function>
+        std::vector<FFTWGrid<N>> ComputeHessianEigenvaluesLeanWithFT(const FFTWGrid<N> & f_real,
+                                                                     double norm,
+                                                                     bool hessian_of_potential_of_f,
+                                                                     Function && process) {
+
+            static_assert(N >= 2, "[ComputeHessianEigenvaluesLeanWithFT] Requires N >= 2");
+            assert_mpi(f_real.get_nmesh() > 0, "[ComputeHessianEigenvaluesLeanWithFT] f_real grid is not allocated\n");
+            constexpr int ncomponents = (N * (N + 1)) / 2;
+
+            // Take a copy and Fourier transform it
+            FFTWGrid<N> f_fourier = f_real;
+            f_fourier.add_memory_label("FFTWGrid::ComputeHessianEigenvaluesLeanWithFT::f_fourier");
+            f_fourier.fftw_r2c();
+
+            const auto Local_nx = f_fourier.get_local_nx();
+            const auto kz = f_fourier.get_fourier_row_wavenumbers();
+
+            // Compute the components one by one. The last one is done in place in f_fourier
+            std::vector<FFTWGrid<N>> components(ncomponents);
+            int count = 0;
+            for (int idim = 0; idim < N; idim++) {
+                for (int idim2 = idim; idim2 < N; idim2++) {
+                    if (FML::ThisTask == 0)
+                        std::cout << "[ComputeHessianEigenvaluesLeanWithFT] Computing phi_" << idim << "," << idim2
+                                  << "\n";
+
+                    FFTWGrid<N> & grid = components[count];
+                    if (count == ncomponents - 1) {
+                        grid = std::move(f_fourier);
                     } else {
-                        SolveEigenvalues(matrix, eval, workspace);
+                        grid = FFTWGrid<N>(f_fourier.get_nmesh(),
+                                           f_fourier.get_n_extra_slices_left(),
+                                           f_fourier.get_n_extra_slices_right());
+                        grid.add_memory_label("FFTWGrid::ComputeHessianEigenvaluesLeanWithFT::component_" +
+                                              std::to_string(count));
                     }
 
-                    // Store the eigenvalues
-                    for (int idim = 0; idim < N; idim++)
-                        eigenvalues[idim].set_real_from_index(real_index, eval->data[idim]);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (int islice = 0; islice < Local_nx; islice++) {
+                        const auto * in =
+                            count == ncomponents - 1 ? grid.get_fourier_grid() : f_fourier.get_fourier_grid();
+                        auto * out = grid.get_fourier_grid();
+                        for (auto && row : grid.get_fourier_row_range(islice, islice + 1)) {
+                            for (int iz = 0; iz < row.n; iz++) {
+                                const double kmag2 = row.kmag2 + kz[iz] * kz[iz];
+                                const double k1 = idim == N - 1 ? kz[iz] : row.kvec[idim];
+                                const double k2 = idim2 == N - 1 ? kz[iz] : row.kvec[idim2];
+
+                                // From f(k) -> -ika ikb f(k) / k^2 = (ka kb / k^2) f(k)
+                                double factor = -norm * k1 * k2;
+                                if (hessian_of_potential_of_f)
+                                    factor *= kmag2 > 0.0 ? -1.0 / kmag2 : 0.0;
+                                out[row.index + iz] = in[row.index + iz] * FML::GRID::FloatType(factor);
+                            }
+                        }
+                    }
+
+                    // Deal with the DC mode
+                    if (FML::ThisTask == 0)
+                        grid.set_fourier_from_index(0, 0.0);
+
+                    grid.set_grid_status_real(false);
+                    grid.fftw_c2r();
+                    count++;
                 }
             }
 
-            // Free up GSL allocations
-            gsl_matrix_free(matrix);
-            gsl_matrix_free(evec);
-            gsl_vector_free(eval);
-            gsl_eigen_symm_free(workspace);
-            gsl_eigen_symmv_free(workspacev);
+            // Compute the eigenvalues in each cell
+            const int Nmesh = components[0].get_nmesh();
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (int islice = 0; islice < Local_nx; islice++) {
+                for (auto && row_index : components[0].get_real_row_range(islice, islice + 1)) {
+                    const IndexIntType cell_row = row_index / (2 * (Nmesh / 2 + 1)) * IndexIntType(Nmesh);
+                    for (int iz = 0; iz < Nmesh; iz++) {
+                        const auto real_index = row_index + iz;
+                        std::array<double, ncomponents> h;
+                        for (int i = 0; i < ncomponents; i++)
+                            h[i] = components[i].get_real_from_index(real_index);
+                        const auto eigenvalues = SymmetricMatrixEigenvalues<N>(h);
+                        process(components, real_index, cell_row + iz, eigenvalues);
+                    }
+                }
+            }
+
+            return components;
+        }
+
+        //=================================================================================
+        /// Memory-lean version of ComputeHessianWithFT followed by SymmetricTensorEigensystem when only the
+        /// eigenvalues are needed. The eigenvalues are written into the storage of the first N Hessian components
+        /// so peak memory is N(N+1)/2 grids (6 in 3D) instead of 1 + N(N+1)/2 + N.
+        ///
+        /// @tparam N The dimension we are working in
+        ///
+        /// @param[in] f_real The grid we are to compute the hessian of
+        /// @param[out] eigenvalues The N eigenvalues of the Hessian in descending order
+        /// @param[in] norm A number to scale the grid by if needed (default is 1.0)
+        /// @param[in] hessian_of_potential_of_f Compute the hessian of the potential of the grid (default is false)
+        ///
+        //=================================================================================
+        template <int N>
+        void ComputeHessianEigenvaluesWithFT(const FFTWGrid<N> & f_real,
+                                             std::vector<FFTWGrid<N>> & eigenvalues,
+                                             double norm = 1.0,
+                                             bool hessian_of_potential_of_f = false) {
+            auto components = ComputeHessianEigenvaluesLeanWithFT<N>(
+                f_real,
+                norm,
+                hessian_of_potential_of_f,
+                [](std::vector<FFTWGrid<N>> & grids,
+                   IndexIntType real_index,
+                   [[maybe_unused]] IndexIntType cell_index,
+                   const std::array<double, N> & eval) {
+                    for (int idim = 0; idim < N; idim++)
+                        grids[idim].set_real_from_index(real_index, eval[idim]);
+                });
+            eigenvalues.resize(N);
+            for (int idim = 0; idim < N; idim++)
+                eigenvalues[idim] = std::move(components[idim]);
+        }
+
+        //=================================================================================
+        /// Cosmic web classification (T-web) from the Hessian of a grid: for each cell we count the number of
+        /// eigenvalues above a threshold (0 = void, 1 = sheet, 2 = filament, 3 = knot in 3D). The result is stored
+        /// as one byte per cell and the eigenvalue grids are never stored. Peak memory is N(N+1)/2 grids (as for
+        /// ComputeHessianEigenvaluesWithFT) and the grids are freed on exit.
+        ///
+        /// @tparam N The dimension we are working in
+        ///
+        /// @param[in] f_real The grid we are to compute the hessian of (e.g. the density contrast)
+        /// @param[out] web_type The classification of the local cells. The cell with coordinate (ix,iy,...,iz) in
+        /// the local grid is at index ((ix - local_x_start) * Nmesh + iy) * Nmesh ... + iz
+        /// @param[in] eigenvalue_threshold The threshold for the eigenvalues
+        /// @param[in] norm A number to scale the grid by if needed (default is 1.0)
+        /// @param[in] hessian_of_potential_of_f Compute the hessian of the potential of the grid (default is true)
+        ///
+        //=================================================================================
+        template <int N>
+        void ComputeCosmicWebClassificationWithFT(const FFTWGrid<N> & f_real,
+                                                  std::vector<unsigned char> & web_type,
+                                                  double eigenvalue_threshold,
+                                                  double norm = 1.0,
+                                                  bool hessian_of_potential_of_f = true) {
+            web_type.resize(f_real.get_local_nx() * FML::power(f_real.get_nmesh(), N - 1));
+            ComputeHessianEigenvaluesLeanWithFT<N>(
+                f_real,
+                norm,
+                hessian_of_potential_of_f,
+                [&]([[maybe_unused]] std::vector<FFTWGrid<N>> & grids,
+                    [[maybe_unused]] IndexIntType real_index,
+                    IndexIntType cell_index,
+                    const std::array<double, N> & eval) {
+                    unsigned char n = 0;
+                    for (int idim = 0; idim < N; idim++)
+                        n += eval[idim] > eigenvalue_threshold ? 1 : 0;
+                    web_type[cell_index] = n;
+                });
         }
 
     } // namespace HESSIAN
@@ -1,16 +1,31 @@
 #ifndef TIMINGS_HEADER
 #define TIMINGS_HEADER
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
 #ifdef USE_MPI
 #include <mpi.h>
 #endif
 
+#ifdef USE_PERF_EVENTS
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace FML {
 
     /// This namespace contains useful things that don't fit anywhere else
@@ -126,6 +141,15 @@ namespace FML {
                 return time_sec;
             }
 
+            /// The total elapsed time for a given label (0 if it has not been timed)
+            /// @param[in] name The label to get the time of
+            ///
+            double GetTotalTime(std::string name) {
+                std::lock_guard<std::mutex> guard(timings_mutex);
+                auto it = elapsed_time_sec.find(name);
+                return it == elapsed_time_sec.end() ? 0.0 : it->second;
+            }
+
             /// Print to screen total time for a given label
             /// @param[in] name The label to print the time of
             ///
@@ -142,6 +166,376 @@ namespace FML {
                 }
             }
         };
+
+        //==========================================================================================
+        /// Low overhead nested timers for use on hot paths. Put FML_TIMER_REGION("name") in a scope to time
+        /// it from that point until the end of the scope. The name is turned into an integer id once per call
+        /// site and the times are accumulated in thread-local storage, so entering and leaving a region takes
+        /// no locks (two clock reads and a short search among the children of the current region).
+        /// Regions nest and are reported with their full path, e.g. "step/FFTWGrid::fftw_r2c". The time of a
+        /// region is summed over the threads of a task. Regions opened by OpenMP worker threads start at the
+        /// top level as the threads do not see the regions of the master thread.
+        ///
+        /// PrintTimerRegions shows the number of calls and the min/mean/max time over the tasks for all
+        /// regions. It is collective over MPI. Call it and ResetTimerRegions outside of parallel regions.
+        ///
+        /// With USE_PERF_EVENTS we also record hardware counters (cycles, instructions, last level cache
+        /// references and misses) for each region using Linux perf events, and show them together with an
+        /// estimate of the memory traffic (64 bytes per cache miss) to tell bandwidth and latency bound
+        /// code apart. The counters only count the thread that opens the region, so for a region that
+        /// contains an OpenMP parallel loop they show the share of the master thread (run with one thread
+        /// to get the full picture). This costs a read system call on entry and exit so only use it for
+        /// regions that are not too small. If the counters cannot be opened (e.g. perf_event_paranoid is
+        /// too strict) they are reported as missing.
+        ///
+        /// Compile time defines:
+        ///
+        /// NO_TIMER_REGIONS : FML_TIMER_REGION does nothing
+        ///
+        /// USE_PERF_EVENTS  : Record hardware counters per region (Linux only)
+        ///
+        //==========================================================================================
+        namespace TIMERREGIONS {
+
+#ifdef USE_PERF_EVENTS
+            constexpr int ncounters = 4;
+            constexpr const char * counter_names[ncounters] = {"cycles", "instructions", "LLC refs", "LLC misses"};
+            constexpr double bytes_per_cache_miss = 64.0;
+#else
+            constexpr int ncounters = 0;
+#endif
+            using Counters = std::array<double, ncounters>;
+
+#ifdef USE_PERF_EVENTS
+            // The hardware counters of a thread read together as one group
+            class PerfCounters {
+              private:
+                int fds[ncounters];
+
+              public:
+                PerfCounters() {
+                    // Mark all as closed so that close_all only closes the ones we managed to open
+                    std::fill(fds, fds + ncounters, -1);
+                    const unsigned long long configs[ncounters] = {PERF_COUNT_HW_CPU_CYCLES,
+                                                                   PERF_COUNT_HW_INSTRUCTIONS,
+                                                                   PERF_COUNT_HW_CACHE_REFERENCES,
+                                                                   PERF_COUNT_HW_CACHE_MISSES};
+                    for (int i = 0; i < ncounters; i++) {
+                        struct perf_event_attr attr;
+                        std::memset(&attr, 0, sizeof(attr));
+                        attr.type = PERF_TYPE_HARDWARE;
+                        attr.size = sizeof(attr);
+                        attr.config = configs[i];
+                        attr.disabled = (i == 0);
+                        attr.exclude_kernel = 1;
+                        attr.exclude_hv = 1;
+                        attr.read_format = PERF_FORMAT_GROUP;
+                        fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0));
+                        if (fds[i] < 0) {
+                            close_all();
+                            return;
+                        }
+                    }
+                    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+                }
+                PerfCounters(const PerfCounters &) = delete;
+                PerfCounters & operator=(const PerfCounters &) = delete;
+                ~PerfCounters() { close_all(); }
+
+                void close_all() {
+                    for (int i = 0; i < ncounters; i++) {
+                        if (fds[i] >= 0)
+                            close(fds[i]);
+                        fds[i] = -1;
+                    }
+                }
+
+                bool is_open() const { return fds[0] >= 0; }
+
+                // Read the current values of all counters. Returns false if not available
+                bool read_all(Counters & values) const {
+                    if (not is_open())
+                        return false;
+                    unsigned long long buffer[1 + ncounters];
+                    if (read(fds[0], buffer, sizeof(buffer)) != ssize_t(sizeof(buffer)))
+                        return false;
+                    for (int i = 0; i < ncounters; i++)
+                        values[i] = double(buffer[1 + i]);
+                    return true;
+                }
+            };
+#endif
+
+            // A region in the call tree of a thread
+            struct Node {
+                int region;
+                int parent;
+                int depth;
+                double time_sec{0.0};
+                long long ncalls{0};
+                Counters counters{};
+                std::vector<std::pair<int, int>> children{};
+            };
+
+            // The call tree of a thread. Node 0 is the root
+            struct ThreadData {
+                std::vector<Node> nodes{Node{-1, -1, -1}};
+                int current{0};
+#ifdef USE_PERF_EVENTS
+                PerfCounters perf;
+#endif
+            };
+
+            // Only used when registering names and threads and when reporting
+            inline std::mutex registry_mutex;
+            inline std::vector<std::string> region_names;
+            inline std::vector<std::shared_ptr<ThreadData>> all_thread_data;
+
+            /// Get the id of a region name (registering it if new)
+            inline int intern(const std::string & name) {
+                std::lock_guard<std::mutex> guard(registry_mutex);
+                for (size_t i = 0; i < region_names.size(); i++)
+                    if (region_names[i] == name)
+                        return int(i);
+                region_names.push_back(name);
+                return int(region_names.size()) - 1;
+            }
+
+            inline ThreadData & get_thread_data() {
+                thread_local std::shared_ptr<ThreadData> data = []() {
+                    auto d = std::make_shared<ThreadData>();
+                    std::lock_guard<std::mutex> guard(registry_mutex);
+                    all_thread_data.push_back(d);
+                    return d;
+                }();
+                return *data;
+            }
+
+            /// Times a region from construction to destruction
+            class ScopedRegion {
+              private:
+                ThreadData & data;
+                int node{-1};
+                TimePoint start_time;
+#ifdef USE_PERF_EVENTS
+                Counters start_counters;
+                bool have_counters{false};
+#endif
+
+              public:
+                explicit ScopedRegion(int region) : data(get_thread_data()) {
+                    for (auto & child : data.nodes[data.current].children) {
+                        if (child.first == region) {
+                            node = child.second;
+                            break;
+                        }
+                    }
+                    if (node < 0) {
+                        node = int(data.nodes.size());
+                        data.nodes.push_back(Node{region, data.current, data.nodes[data.current].depth + 1});
+                        data.nodes[data.current].children.push_back({region, node});
+                    }
+                    data.current = node;
+#ifdef USE_PERF_EVENTS
+                    have_counters = data.perf.read_all(start_counters);
+#endif
+                    start_time = std::chrono::steady_clock::now();
+                }
+                ScopedRegion(const ScopedRegion &) = delete;
+                ScopedRegion & operator=(const ScopedRegion &) = delete;
+                ~ScopedRegion() {
+                    auto end_time = std::chrono::steady_clock::now();
+                    Node & n = data.nodes[node];
+#ifdef USE_PERF_EVENTS
+                    Counters end_counters;
+                    if (have_counters and data.perf.read_all(end_counters))
+                        for (int i = 0; i < ncounters; i++)
+                            n.counters[i] += end_counters[i] - start_counters[i];
+#endif
+                    n.time_sec += std::chrono::duration<double>(end_time - start_time).count();
+                    n.ncalls++;
+                    data.current = n.parent;
+                }
+            };
+
+            // The paths are joined with this character internally so that sorting them puts
+            // children right after their parent
+            inline const char path_separator = '\x01';
+
+            struct RegionTotals {
+                double time_sec{0.0};
+                long long ncalls{0};
+                Counters counters{};
+            };
+
+            /// The totals for all regions of this task (summed over threads) keyed on the path
+            inline std::map<std::string, RegionTotals> get_local_totals() {
+                std::lock_guard<std::mutex> guard(registry_mutex);
+                std::map<std::string, RegionTotals> totals;
+                for (auto & d : all_thread_data) {
+                    std::vector<std::string> paths(d->nodes.size());
+                    for (size_t i = 1; i < d->nodes.size(); i++) {
+                        const Node & n = d->nodes[i];
+                        paths[i] = (n.parent > 0 ? paths[n.parent] + path_separator : "") + region_names[n.region];
+                        auto & t = totals[paths[i]];
+                        t.time_sec += n.time_sec;
+                        t.ncalls += n.ncalls;
+                        for (int j = 0; j < ncounters; j++)
+                            t.counters[j] += n.counters[j];
+                    }
+                }
+                return totals;
+            }
+        } // namespace TIMERREGIONS
+
+        /// Set the time and number of calls of all timer regions to zero
+        inline void ResetTimerRegions() {
+            std::lock_guard<std::mutex> guard(TIMERREGIONS::registry_mutex);
+            for (auto & d : TIMERREGIONS::all_thread_data) {
+                for (auto & n : d->nodes) {
+                    n.time_sec = 0.0;
+                    n.ncalls = 0;
+                    n.counters = TIMERREGIONS::Counters{};
+                }
+            }
+        }
+
+        /// Show the time spent in all the timer regions (min/mean/max over tasks). Collective over MPI
+        inline void PrintTimerRegions() {
+            auto totals = TIMERREGIONS::get_local_totals();
+
+            int ThisTask = 0;
+            int NTasks = 1;
+#ifdef USE_MPI
+            MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+            MPI_Comm_size(MPI_COMM_WORLD, &NTasks);
+#endif
+
+            // Make the union of the paths over all tasks
+            std::set<std::string> all_paths;
+            for (auto & t : totals)
+                all_paths.insert(t.first);
+#ifdef USE_MPI
+            std::string local_paths;
+            for (auto & t : totals)
+                local_paths += t.first + '\0';
+            int nchars = int(local_paths.size());
+            std::vector<int> nchars_task(NTasks), offset_task(NTasks, 0);
+            MPI_Allgather(&nchars, 1, MPI_INT, nchars_task.data(), 1, MPI_INT, MPI_COMM_WORLD);
+            for (int i = 1; i < NTasks; i++)
+                offset_task[i] = offset_task[i - 1] + nchars_task[i - 1];
+            std::vector<char> paths_buffer(offset_task[NTasks - 1] + nchars_task[NTasks - 1]);
+            MPI_Allgatherv(local_paths.data(),
+                           nchars,
+                           MPI_CHAR,
+                           paths_buffer.data(),
+                           nchars_task.data(),
+                           offset_task.data(),
+                           MPI_CHAR,
+                           MPI_COMM_WORLD);
+            for (size_t start = 0, i = 0; i < paths_buffer.size(); i++) {
+                if (paths_buffer[i] == '\0') {
+                    all_paths.insert(std::string(paths_buffer.data() + start, i - start));
+                    start = i + 1;
+                }
+            }
+#endif
+
+            // Get min/mean/max over tasks
+            const int npaths = int(all_paths.size());
+            std::vector<double> time_min(npaths), time_max(npaths), time_sum(npaths);
+            std::vector<long long> ncalls(npaths);
+            std::vector<double> counters_sum(npaths * TIMERREGIONS::ncounters, 0.0);
+            int i = 0;
+            for (auto & path : all_paths) {
+                auto it = totals.find(path);
+                const TIMERREGIONS::RegionTotals t = (it == totals.end() ? TIMERREGIONS::RegionTotals{} : it->second);
+                time_min[i] = time_max[i] = time_sum[i] = t.time_sec;
+                ncalls[i] = t.ncalls;
+                for (int j = 0; j < TIMERREGIONS::ncounters; j++)
+                    counters_sum[i * TIMERREGIONS::ncounters + j] = t.counters[j];
+                i++;
+            }
+#ifdef USE_MPI
+            MPI_Allreduce(MPI_IN_PLACE, time_min.data(), npaths, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE, time_max.data(), npaths, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE, time_sum.data(), npaths, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE, ncalls.data(), npaths, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE,
+                          counters_sum.data(),
+                          int(counters_sum.size()),
+                          MPI_DOUBLE,
+                          MPI_SUM,
+                          MPI_COMM_WORLD);
+#endif
+
+            if (ThisTask > 0)
+                return;
+            std::cout << "\n";
+            std::cout << "============================================\n";
+            std::cout << "Timer regions (over " << NTasks << " tasks):\n";
+            std::cout << "============================================\n";
+            std::cout << std::setw(45) << std::left << "Region" << std::right << std::setw(12) << "Calls/task"
+                      << std::setw(12) << "Min [s]" << std::setw(12) << "Mean [s]" << std::setw(12) << "Max [s]"
+                      << "\n";
+            i = 0;
+            for (auto & path : all_paths) {
+                const auto pos = path.rfind(TIMERREGIONS::path_separator);
+                const auto depth = std::count(path.begin(), path.end(), TIMERREGIONS::path_separator);
+                const std::string label =
+                    std::string(2 * depth, ' ') + (pos == std::string::npos ? path : path.substr(pos + 1));
+                std::cout << std::setw(45) << std::left << label << std::right << std::setw(12)
+                          << ncalls[i] / NTasks << std::setw(12) << time_min[i] << std::setw(12)
+                          << time_sum[i] / NTasks << std::setw(12) << time_max[i] << "\n";
+                i++;
+            }
+            std::cout << "============================================\n";
+
+#ifdef USE_PERF_EVENTS
+            // Hardware counters (mean over tasks). GB is the estimated memory traffic from the LLC misses
+            std::cout << "Hardware counters (mean over tasks):\n";
+            std::cout << "============================================\n";
+            std::cout << std::setw(45) << std::left << "Region" << std::right << std::setw(12) << "Gcycles"
+                      << std::setw(8) << "IPC" << std::setw(12) << "LLC miss %" << std::setw(10) << "GB"
+                      << std::setw(10) << "GB/s"
+                      << "\n";
+            i = 0;
+            for (auto & path : all_paths) {
+                const auto pos = path.rfind(TIMERREGIONS::path_separator);
+                const auto depth = std::count(path.begin(), path.end(), TIMERREGIONS::path_separator);
+                const std::string label =
+                    std::string(2 * depth, ' ') + (pos == std::string::npos ? path : path.substr(pos + 1));
+                const double * c = &counters_sum[i * TIMERREGIONS::ncounters];
+                std::cout << std::setw(45) << std::left << label << std::right;
+                if (c[0] > 0.0) {
+                    const double GB = c[3] * TIMERREGIONS::bytes_per_cache_miss / 1e9 / NTasks;
+                    const double time_mean = time_sum[i] / NTasks;
+                    std::cout << std::setw(12) << c[0] / 1e9 / NTasks << std::setw(8) << c[1] / c[0] << std::setw(12)
+                              << (c[2] > 0.0 ? 100.0 * c[3] / c[2] : 0.0) << std::setw(10) << GB << std::setw(10)
+                              << (time_mean > 0.0 ? GB / time_mean : 0.0) << "\n";
+                } else {
+                    std::cout << std::setw(12) << "n/a"
+                              << "\n";
+                }
+                i++;
+            }
+            std::cout << "============================================\n";
+#endif
+            std::cout << "\n";
+        }
     } // namespace UTILS
 } // namespace FML
+
+#ifdef NO_TIMER_REGIONS
+#define FML_TIMER_REGION(name)
+#else
+#define FML_TIMER_REGION_CONCAT_(a, b) a##b
+#define FML_TIMER_REGION_CONCAT(a, b) FML_TIMER_REGION_CONCAT_(a, b)
+/// Time the rest of the current scope as the region name (see FML::UTILS::TIMERREGIONS)
+#define FML_TIMER_REGION(name)                                                                                         \
+    static const int FML_TIMER_REGION_CONCAT(fml_region_id_, __LINE__) = FML::UTILS::TIMERREGIONS::intern(name);       \
+    FML::UTILS::TIMERREGIONS::ScopedRegion FML_TIMER_REGION_CONCAT(fml_region_, __LINE__)(                             \
+        FML_TIMER_REGION_CONCAT(fml_region_id_, __LINE__))
+#endif
 #endif
@@ -0,0 +1,308 @@
+#ifndef DTFE_HEADER
+#define DTFE_HEADER
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include <FML/FFTWGrid/FFTWGrid.h>
+#include <FML/Global/Global.h>
+#include <FML/ParticleTypes/ReflectOnParticleMethods.h>
+#include <FML/Triangulation/PeriodicDelaunay.h>
+
+namespace FML {
+    namespace TRIANGULATION {
+
+#if CGAL_NDIM == 3
+
+        /// The vertex base for the CGAL tesselation needed for the DTFE interpolation
+        typedef struct {
+            double mass{0.0};
+            double density{0.0};
+            double vel[3]{0.0, 0.0, 0.0};
+            bool is_particle{false};
+        } VertexDataDTFE;
+
+        //===============================================================================
+        /// Delaunay Tesselation Field Estimator (DTFE): interpolate the density (and the divergence of the
+        /// velocity) of the particles onto a grid using an (already created) tesselation.
+        /// The density at a vertex is 4 m / (the volume of all the tetrahedra that has the vertex) and the
+        /// fields are linearly interpolated inside each tetrahedron (so the velocity divergence is constant in
+        /// each tetrahedron). We bin the tetrahedra by the slices of the grid they overlap on this task and then
+        /// do the slices in parallel: for each cell in the slice we find the tetrahedron it is in and evaluate
+        /// the field there. The local slices of the grid should be inside the domain of this task plus the buffer
+        /// used when making the tesselation (this is the case with the usual FFTW slabs and domain).
+        ///
+        /// The density is given as the density contrast delta = rho/rhomean - 1 (the same as for the particle
+        /// to grid assignment). The velocity divergence is in the units of the velocity of the particles
+        /// divided by the boxsize (positions are in [0,1)).
+        ///
+        /// @tparam T The particle class
+        ///
+        /// @param[in] D MPIPeriodicDelaunay tesselation (already created) with VertexDataDTFE vertex info
+        /// (see DTFEDensityField for the assignment function).
+        /// @param[in] NumPart Number of local particles.
+        /// @param[out] density Grid with the density contrast (the grid must be allocated).
+        /// @param[out] velocity_divergence Optional. Pointer to a grid with the divergence of the velocity (the
+        /// grid must be allocated with the same size as density). Not computed if nullptr.
+        ///
+        //===============================================================================
+        template <class T>
+        void DTFEInterpolateToGrid(MPIPeriodicDelaunay<T, VertexDataDTFE> & D,
+                                   size_t NumPart,
+                                   FFTWGrid<3> & density,
+                                   FFTWGrid<3> * velocity_divergence = nullptr) {
+
+            auto & dt = D.get_delaunay_triangulation();
+            using Triangulation = std::remove_reference_t<decltype(dt)>;
+            using Vertex_handle = typename Triangulation::Vertex_handle;
+            using Cell_handle = typename Triangulation::Cell_handle;
+            using Point = typename Triangulation::Point;
+
+            const int Nmesh = density.get_nmesh();
+            const int Local_nx = int(density.get_local_nx());
+            const int Local_x_start = int(density.get_local_x_start());
+            assert_mpi(Nmesh > 0, "[DTFEInterpolateToGrid] The density grid is not allocated");
+            if (velocity_divergence) {
+                assert_mpi(velocity_divergence->get_nmesh() == Nmesh and
+                               velocity_divergence->get_local_x_start() == Local_x_start,
+                           "[DTFEInterpolateToGrid] The velocity divergence grid does not match the density grid");
+            }
+#ifdef CELLCENTERSHIFTED
+            const constexpr double shift = 0.5;
+#else
+            const constexpr double shift = 0.0;
+#endif
+
+            if (FML::ThisTask == 0)
+                std::cout << "[DTFEInterpolateToGrid] Interpolating the DTFE density"
+                          << (velocity_divergence ? " and velocity divergence" : "") << " to a grid with Nmesh "
+                          << Nmesh << "\n";
+
+            // Check that the grid is inside the region we have tesselated
+            const double dx_buffer = D.get_dx_buffer();
+            const double xmin_grid = (Local_x_start + shift) / double(Nmesh);
+            const double xmax_grid = (Local_x_start + Local_nx - 1 + shift) / double(Nmesh);
+            if (FML::NTasks > 1 and Local_nx > 0 and
+                (xmin_grid < FML::xmin_domain - dx_buffer or xmax_grid > FML::xmax_domain + dx_buffer)) {
+                std::cout << "[DTFEInterpolateToGrid] Warning task " << FML::ThisTask
+                          << " the grid slices are not inside the domain plus buffer we have tesselated\n";
+            }
+
+            // The DTFE density at the vertices
+            double mass_total = 0.0;
+            auto compute_density = [&](Vertex_handle v) {
+                std::vector<Cell_handle> cells;
+                dt.incident_cells(v, std::back_inserter(cells));
+                double volume = 0.0;
+                for (auto & c : cells) {
+                    volume += std::fabs(CGAL::volume(dt.point(c, 0), dt.point(c, 1), dt.point(c, 2), dt.point(c, 3)));
+                }
+                v->info().density = volume > 0.0 ? 4.0 * v->info().mass / volume : 0.0;
+            };
+            auto & vs = D.get_vertex_handles_regular();
+            auto & vs_boundary = D.get_vertex_handles_boundary();
+            assert(vs.size() == NumPart);
+#ifdef USE_OMP
+#pragma omp parallel for reduction(+ : mass_total)
+#endif
+            for (size_t i = 0; i < vs.size(); i++) {
+                compute_density(vs[i]);
+                mass_total += vs[i]->info().mass;
+            }
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+            for (size_t i = 0; i < vs_boundary.size(); i++) {
+                compute_density(vs_boundary[i]);
+            }
+            FML::SumOverTasks(&mass_total);
+            assert_mpi(mass_total > 0.0, "[DTFEInterpolateToGrid] No mass in the box");
+            const double mean_density = mass_total;
+
+            // Bin the tetrahedra (the ones that only have particles as vertices) by the slices they overlap
+            // together with the periodic shift needed to bring the slice to the tetrahedron
+            struct CellInSlice {
+                Cell_handle c;
+                double xshift;
+            };
+            std::vector<std::vector<CellInSlice>> cells_in_slice(Local_nx);
+            for (auto cit = dt.cells_begin(); cit != dt.cells_end(); ++cit) {
+                Cell_handle c = cit;
+                bool only_particles = true;
+                double xmin = 1e100, xmax = -1e100;
+                for (int k = 0; k < 4; k++) {
+                    only_particles = only_particles and c->vertex(k)->info().is_particle;
+                    double x = dt.point(c, k)[0];
+                    xmin = std::min(xmin, x);
+                    xmax = std::max(xmax, x);
+                }
+                if (not only_particles)
+                    continue;
+                const int i0 = int(std::ceil(xmin * Nmesh - shift));
+                const int i1 = int(std::floor(xmax * Nmesh - shift));
+                for (int i = i0; i <= i1; i++) {
+                    const int iglobal = ((i % Nmesh) + Nmesh) % Nmesh;
+                    const int ix = iglobal - Local_x_start;
+                    if (ix >= 0 and ix < Local_nx)
+                        cells_in_slice[ix].push_back({c, double(i - iglobal) / double(Nmesh)});
+                }
+            }
+
+            // Interpolate to the grid one slice at the time. In each tetrahedron the point x has barycentric
+            // coordinates lambda = M^-1 (x - x0) where the columns of M are x1-x0, x2-x0, x3-x0
+            long long int nmissing = 0;
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : nmissing)
+#endif
+            for (int ix = 0; ix < Local_nx; ix++) {
+                std::vector<char> assigned(size_t(Nmesh) * Nmesh, 0);
+                const double xslice = (Local_x_start + ix + shift) / double(Nmesh);
+                for (auto & cs : cells_in_slice[ix]) {
+                    auto c = cs.c;
+
+                    std::array<Point, 4> pts;
+                    for (int k = 0; k < 4; k++)
+                        pts[k] = dt.point(c, k);
+                    double M[3][3];
+                    for (int idim = 0; idim < 3; idim++)
+                        for (int k = 0; k < 3; k++)
+                            M[idim][k] = pts[k + 1][idim] - pts[0][idim];
+                    const double det = M[0][0] * (M[1][1] * M[2][2] - M[1][2] * M[2][1]) -
+                                       M[0][1] * (M[1][0] * M[2][2] - M[1][2] * M[2][0]) +
+                                       M[0][2] * (M[1][0] * M[2][1] - M[1][1] * M[2][0]);
+                    if (det == 0.0)
+                        continue;
+                    double Minv[3][3];
+                    Minv[0][0] = (M[1][1] * M[2][2] - M[1][2] * M[2][1]) / det;
+                    Minv[0][1] = (M[0][2] * M[2][1] - M[0][1] * M[2][2]) / det;
+                    Minv[0][2] = (M[0][1] * M[1][2] - M[0][2] * M[1][1]) / det;
+                    Minv[1][0] = (M[1][2] * M[2][0] - M[1][0] * M[2][2]) / det;
+                    Minv[1][1] = (M[0][0] * M[2][2] - M[0][2] * M[2][0]) / det;
+                    Minv[1][2] = (M[0][2] * M[1][0] - M[0][0] * M[1][2]) / det;
+                    Minv[2][0] = (M[1][0] * M[2][1] - M[1][1] * M[2][0]) / det;
+                    Minv[2][1] = (M[0][1] * M[2][0] - M[0][0] * M[2][1]) / det;
+                    Minv[2][2] = (M[0][0] * M[1][1] - M[0][1] * M[1][0]) / det;
+
+                    // The values at the vertices and the (constant) velocity divergence
+                    double f[4];
+                    for (int k = 0; k < 4; k++)
+                        f[k] = c->vertex(k)->info().density;
+                    double divv = 0.0;
+                    if (velocity_divergence) {
+                        for (int idim = 0; idim < 3; idim++)
+                            for (int k = 0; k < 3; k++)
+                                divv += Minv[k][idim] *
+                                        (c->vertex(k + 1)->info().vel[idim] - c->vertex(0)->info().vel[idim]);
+                    }
+
+                    // The cells in the slice inside the bounding box of the tetrahedron
+                    const double x = xslice + cs.xshift;
+                    double ymin = 1e100, ymax = -1e100, zmin = 1e100, zmax = -1e100;
+                    for (int k = 0; k < 4; k++) {
+                        ymin = std::min(ymin, pts[k][1]);
+                        ymax = std::max(ymax, pts[k][1]);
+                        zmin = std::min(zmin, pts[k][2]);
+                        zmax = std::max(zmax, pts[k][2]);
+                    }
+                    const int j0 = int(std::ceil(ymin * Nmesh - shift));
+                    const int j1 = int(std::floor(ymax * Nmesh - shift));
+                    const int k0 = int(std::ceil(zmin * Nmesh - shift));
+                    const int k1 = int(std::floor(zmax * Nmesh - shift));
+                    for (int j = j0; j <= j1; j++) {
+                        const int iy = ((j % Nmesh) + Nmesh) % Nmesh;
+                        const double y = (j + shift) / double(Nmesh);
+                        for (int k = k0; k <= k1; k++) {
+                            const int iz = ((k % Nmesh) + Nmesh) % Nmesh;
+                            if (assigned[size_t(iy) * Nmesh + iz])
+                                continue;
+                            const double z = (k + shift) / double(Nmesh);
+                            const double dr[3] = {x - pts[0][0], y - pts[0][1], z - pts[0][2]};
+                            double lambda[4];
+                            lambda[0] = 1.0;
+                            bool inside = true;
+                            for (int l = 0; l < 3; l++) {
+                                lambda[l + 1] = Minv[l][0] * dr[0] + Minv[l][1] * dr[1] + Minv[l][2] * dr[2];
+                                lambda[0] -= lambda[l + 1];
+                                inside = inside and lambda[l + 1] >= -1e-10;
+                            }
+                            if (not inside or lambda[0] < -1e-10)
+                                continue;
+
+                            double value = 0.0;
+                            for (int l = 0; l < 4; l++)
+                                value += lambda[l] * f[l];
+                            density.set_real({ix, iy, iz}, value / mean_density - 1.0);
+                            if (velocity_divergence)
+                                velocity_divergence->set_real({ix, iy, iz}, divv);
+                            assigned[size_t(iy) * Nmesh + iz] = 1;
+                        }
+                    }
+                }
+                for (auto a : assigned)
+                    nmissing += (a == 0);
+            }
+
+            FML::SumOverTasks(&nmissing);
+            if (FML::ThisTask == 0 and nmissing > 0)
+                std::cout << "[DTFEInterpolateToGrid] Warning " << nmissing
+                          << " grid cells are not inside any tetrahedron. Increase buffer\n";
+        }
+
+        //===============================================================================
+        /// Make a tesselation of the particles and interpolate the DTFE density contrast onto a grid.
+        /// See DTFEInterpolateToGrid.
+        ///
+        /// @tparam T The particle class
+        ///
+        /// @param[in] p Pointer to the particles.
+        /// @param[in] NumPart Number of local particles.
+        /// @param[out] density Grid with the density contrast (the grid must be allocated).
+        /// @param[out] velocity_divergence Optional. Pointer to a grid with the divergence of the velocity
+        /// (the particles must have a velocity). Not computed if nullptr.
+        /// @param[in] buffer_fraction Optional. How big part of the neighbor domain do we include as the buffer.
+        /// @param[in] random_fraction Optional. How many (as fraction of the normal particles) random particles do we
+        /// add (this is to help speed up the tesslation).
+        ///
+        //===============================================================================
+        template <class T>
+        void DTFEDensityField(T * p,
+                              size_t NumPart,
+                              FFTWGrid<3> & density,
+                              FFTWGrid<3> * velocity_divergence = nullptr,
+                              double buffer_fraction = 0.25,
+                              double random_fraction = 0.3) {
+
+            if constexpr (not FML::PARTICLE::has_get_vel<T>()) {
+                assert_mpi(velocity_divergence == nullptr,
+                           "[DTFEDensityField] The particles need a velocity to compute the velocity divergence");
+            }
+
+            // Vertex assignement function
+            std::function<void(VertexDataDTFE *, T *)> vertex_assignment_function = [](VertexDataDTFE * v, T * p) {
+                v->is_particle = (p != nullptr);
+                if (not p)
+                    return;
+                v->mass = 1.0;
+                if constexpr (FML::PARTICLE::has_get_mass<T>())
+                    v->mass = FML::PARTICLE::GetMass(*p);
+                if constexpr (FML::PARTICLE::has_get_vel<T>()) {
+                    auto * vel = FML::PARTICLE::GetVel(*p);
+                    for (int idim = 0; idim < 3; idim++)
+                        v->vel[idim] = vel[idim];
+                }
+            };
+
+            // Create tesselation
+            MPIPeriodicDelaunay<T, VertexDataDTFE> D;
+            D.create(p, NumPart, buffer_fraction, random_fraction, vertex_assignment_function);
+
+            DTFEInterpolateToGrid(D, NumPart, density, velocity_divergence);
+        }
+
+#endif
+
+    } // namespace TRIANGULATION
+} // namespace FML
+
+#endif
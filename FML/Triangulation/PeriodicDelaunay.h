@@ -2,6 +2,9 @@
 #define MPIPERIODICDEANAY_HEADER
 
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
 #include <random>
 #include <vector>
 
@@ -21,14 +24,18 @@
 #pragma GCC diagnostic ignored "-Wconversion"
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Kernel/global_functions.h>
+#include <CGAL/property_map.h>
+#include <CGAL/spatial_sort.h>
 #if CGAL_NDIM == 3
 #include <CGAL/Delaunay_triangulation_cell_base_with_circumcenter_3.h>
 #include <CGAL/Periodic_3_Delaunay_triangulation_3.h>
 #include <CGAL/Periodic_3_Delaunay_triangulation_traits_3.h>
+#include <CGAL/Spatial_sort_traits_adapter_3.h>
 #include <CGAL/Triangulation_vertex_base_with_info_3.h>
 #elif CGAL_NDIM == 2
 #include <CGAL/Periodic_2_Delaunay_triangulation_2.h>
 #include <CGAL/Periodic_2_Delaunay_triangulation_traits_2.h>
+#include <CGAL/Spatial_sort_traits_adapter_2.h>
 #include <CGAL/Triangulation_vertex_base_with_info_2.h>
 #else
 "Error CGAL_NDIM has to be 2 or 3"
@@ -61,6 +68,8 @@ namespace FML {
         template <class T>
         using PeriodicDelaunayWithInfo = CGAL::Periodic_3_Delaunay_triangulation_3<Gt, TDS<T>>;
         using VD_FIDUCIAL = CGAL::Periodic_3_triangulation_ds_vertex_base_3<>;
+        template <class PointPropertyMap>
+        using SpatialSortTraits = CGAL::Spatial_sort_traits_adapter_3<K, PointPropertyMap>;
 #elif CGAL_NDIM == 2
         typedef CGAL::Periodic_2_Delaunay_triangulation_traits_2<K> Gt;
         using Vb = CGAL::Triangulation_vertex_base_2<Gt>;
@@ -72,6 +81,8 @@ namespace FML {
         template <class T>
         using PeriodicDelaunayWithInfo = CGAL::Periodic_2_Delaunay_triangulation_2<Gt, TDS<T>>;
         using VD_FIDUCIAL = CGAL::Periodic_2_triangulation_vertex_base_2<Gt>;
+        template <class PointPropertyMap>
+        using SpatialSortTraits = CGAL::Spatial_sort_traits_adapter_2<K, PointPropertyMap>;
 #endif
         //========================================================================================
 
@@ -115,10 +126,25 @@ namespace FML {
             using Periodic_point = typename PeriodicDelaunay::Periodic_point;
             using Vertex_handle = typename PeriodicDelaunay::Vertex_handle;
             using Vertex_iterator = typename PeriodicDelaunay::Vertex_iterator;
+#if CGAL_NDIM == 3
+            using Hint_handle = typename PeriodicDelaunay::Cell_handle;
+#elif CGAL_NDIM == 2
+            using Hint_handle = typename PeriodicDelaunay::Face_handle;
+#endif
 
             // Random shuffle the particles before tesselating (always a good idea)
             const bool tesselation_random_shuffle{true};
 
+            // Sort the points along a space-filling curve (CGAL::spatial_sort) before tesselating and insert
+            // each point starting the location from the cell of the previously inserted point. This replaces the
+            // random shuffle and makes the point location (most of the time spent in the insertion) close to O(1)
+            bool tesselation_spatial_sort{true};
+
+            // If > 0 the buffer is this many mean particle separations (estimated from the number of particles
+            // on this task and its neighbors) and the guard points are put on a lattice of this spacing just
+            // outside the buffer (plus a coarse lattice in the rest of the box) instead of randomly in the volume
+            double adaptive_buffer_nseparations{0.0};
+
             // The CGAL tesselation structure
             PeriodicDelaunay dt;
 
@@ -147,6 +173,23 @@ namespace FML {
 
             MPIPeriodicDelaunay() = default;
 
+            /// Choose if we sort the points spatially (true, the default) or do a random shuffle (false) before
+            /// inserting them into the tesselation. The resulting tesselation is the same.
+            void set_spatial_sort(bool spatial_sort) { tesselation_spatial_sort = spatial_sort; }
+
+            /// Make the buffer nseparations mean particle separations wide instead of a fraction of the domain
+            /// and place the guard points on the surface of the buffer instead of in the volume outside it. The
+            /// number of guard points then scales with the area of the domain boundary, and for sparse tracers
+            /// (e.g. galaxies) we communicate and tesselate much fewer points. With this set create ignores
+            /// buffer_fraction and random_fraction. Set to 0 (the default) to turn it off.
+            void set_adaptive_buffer(double nseparations) { adaptive_buffer_nseparations = nseparations; }
+
+            /// The mean particle separation on this task
+            double mean_particle_separation(size_t NumPart) const {
+                const double volume = FML::xmax_domain - FML::xmin_domain;
+                return std::pow(volume / double(std::max(NumPart, size_t(1))), 1.0 / double(CGAL_NDIM));
+            }
+
             /// Free all memory associated with this class
             void free() {
                 dt.clear();
@@ -158,6 +201,48 @@ namespace FML {
                 p_boundary.shrink_to_fit();
             }
 
+            // Find the index of the particles that are within dx_buffer of the left and right edge of the domain.
+            // The indices are in increasing order (WatershedGeneral relies on the boundary particles being sent in
+            // the order they are stored)
+            void select_boundary_particles(T * p,
+                                           size_t NumPart,
+                                           std::vector<size_t> & index_left,
+                                           std::vector<size_t> & index_right) {
+                index_left.clear();
+                index_right.clear();
+#ifdef USE_OMP
+                std::vector<std::vector<size_t>> index_left_thread(FML::NThreads);
+                std::vector<std::vector<size_t>> index_right_thread(FML::NThreads);
+#pragma omp parallel num_threads(FML::NThreads)
+                {
+                    const int id = omp_get_thread_num();
+                    auto & left = index_left_thread[id];
+                    auto & right = index_right_thread[id];
+#pragma omp for schedule(static)
+                    for (size_t i = 0; i < NumPart; i++) {
+                        auto * pos = FML::PARTICLE::GetPos(p[i]);
+                        if (pos[0] < FML::xmin_domain + dx_buffer)
+                            left.push_back(i);
+                        if (pos[0] > FML::xmax_domain - dx_buffer)
+                            right.push_back(i);
+                    }
+                }
+                // With a static schedule thread i has the i'th chunk of the particles
+                for (int i = 0; i < FML::NThreads; i++) {
+                    index_left.insert(index_left.end(), index_left_thread[i].begin(), index_left_thread[i].end());
+                    index_right.insert(index_right.end(), index_right_thread[i].begin(), index_right_thread[i].end());
+                }
+#else
+                for (size_t i = 0; i < NumPart; i++) {
+                    auto * pos = FML::PARTICLE::GetPos(p[i]);
+                    if (pos[0] < FML::xmin_domain + dx_buffer)
+                        index_left.push_back(i);
+                    if (pos[0] > FML::xmax_domain - dx_buffer)
+                        index_right.push_back(i);
+                }
+#endif
+            }
+
             // Communicate the full particle data
             void communicate_boundary_particles(T * p, size_t NumPart, std::vector<T> & p_to_recv) {
 #ifdef USE_MPI
@@ -171,47 +256,40 @@ namespace FML {
                 int LeftTask = (FML::ThisTask - 1 + FML::NTasks) % FML::NTasks;
                 int RightTask = (FML::ThisTask + 1) % FML::NTasks;
 
-                // Count how many particles we have on the left and right
-                size_t count_left = 0;
-                size_t count_right = 0;
-                size_t bytes_to_send_left = 0;
-                size_t bytes_to_send_right = 0;
-                for (size_t i = 0; i < NumPart; i++) {
-                    auto * pos = FML::PARTICLE::GetPos(p[i]);
-                    if (pos[0] < FML::xmin_domain + dx_buffer) {
-                        count_left++;
-                        bytes_to_send_left += FML::PARTICLE::GetSize(p[i]);
-                    }
-                    if (pos[0] > FML::xmax_domain - dx_buffer) {
-                        count_right++;
-                        bytes_to_send_right += FML::PARTICLE::GetSize(p[i]);
-                    }
-                }
+                // Find the particles to send left and right (in the order they are stored)
+                std::vector<size_t> index_left;
+                std::vector<size_t> index_right;
+                select_boundary_particles(p, NumPart, index_left, index_right);
+                size_t count_left = index_left.size();
+                size_t count_right = index_right.size();
 #ifdef DEBUG_TESSELATION
                 std::cout << "Task " << FML::ThisTask << " will send " << count_left << " + " << count_right
                           << " boundary particles\n";
 #endif
 
-                // Gather positions to send
+                // Offsets of the particles in the send buffers
+                std::vector<size_t> offset_left(count_left + 1, 0);
+                std::vector<size_t> offset_right(count_right + 1, 0);
+                for (size_t i = 0; i < count_left; i++)
+                    offset_left[i + 1] = offset_left[i] + FML::PARTICLE::GetSize(p[index_left[i]]);
+                for (size_t i = 0; i < count_right; i++)
+                    offset_right[i + 1] = offset_right[i] + FML::PARTICLE::GetSize(p[index_right[i]]);
+                size_t bytes_to_send_left = offset_left[count_left];
+                size_t bytes_to_send_right = offset_right[count_right];
+
+                // Gather particles to send
                 std::vector<char> p_to_send_left(bytes_to_send_left);
                 std::vector<char> p_to_send_right(bytes_to_send_right);
-                char * left_buffer = p_to_send_left.data();
-                char * right_buffer = p_to_send_right.data();
-                count_left = 0;
-                count_right = 0;
-                for (size_t i = 0; i < NumPart; i++) {
-                    auto * pos = FML::PARTICLE::GetPos(p[i]);
-                    if (pos[0] < FML::xmin_domain + dx_buffer) {
-                        FML::PARTICLE::AppendToBuffer(p[i], left_buffer);
-                        left_buffer += FML::PARTICLE::GetSize(p[i]);
-                        count_left++;
-                    }
-                    if (pos[0] > FML::xmax_domain - dx_buffer) {
-                        FML::PARTICLE::AppendToBuffer(p[i], right_buffer);
-                        right_buffer += FML::PARTICLE::GetSize(p[i]);
-                        count_right++;
-                    }
-                }
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < count_left; i++)
+                    FML::PARTICLE::AppendToBuffer(p[index_left[i]], p_to_send_left.data() + offset_left[i]);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                for (size_t i = 0; i < count_right; i++)
+                    FML::PARTICLE::AppendToBuffer(p[index_right[i]], p_to_send_right.data() + offset_right[i]);
 
                 // Communicate how many to send
                 size_t recv_left;
@@ -309,12 +387,12 @@ namespace FML {
 
                 // Assign particles
                 p_to_recv.resize(nboundary);
-                left_buffer = p_to_recv_left.data();
+                char * left_buffer = p_to_recv_left.data();
                 for (size_t i = 0; i < recv_left; i++) {
                     FML::PARTICLE::AssignFromBuffer(p_to_recv[i], left_buffer);
                     left_buffer += FML::PARTICLE::GetSize(p_to_recv[i]);
                 }
-                right_buffer = p_to_recv_right.data();
+                char * right_buffer = p_to_recv_right.data();
                 for (size_t i = 0; i < recv_right; i++) {
                     FML::PARTICLE::AssignFromBuffer(p_to_recv[i + recv_left], right_buffer);
                     right_buffer += FML::PARTICLE::GetSize(p_to_recv[i + recv_left]);
@@ -328,64 +406,44 @@ namespace FML {
             void make_random_points_outside_domain(size_t nrandom, std::vector<float> & positions_random) {
                 if (FML::NTasks == 1)
                     return;
+                make_random_points_outside_region(
+                    FML::xmin_domain, FML::xmax_domain, dx_buffer, nrandom, positions_random);
+            }
+
+            // Generate random (guard) positions outside of the region [xmin-dx, xmax+dx] (periodic in x, we
+            // assume xmin, xmax is in [0,1]). A fraction of the points are put on a regular grid on the two planes
+            // just outside the region. Don't need to be "good" random numbers, just something that fills the space
+            static void make_random_points_outside_region(
+                double xmin, double xmax, double dx, size_t nrandom, std::vector<float> & positions_random) {
                 if (nrandom == 0)
                     return;
 
-                // Uniform random number in [0,1). Don't need to be "good" random
-                // numbers so we just use rand here
-                auto uniform_rand = []() -> double { return (std::rand() % RAND_MAX) / double(RAND_MAX); };
-                std::srand(1);
+                // The domain for generating random points: [x1, x1 + length) (to be wrapped around)
+                double length = 1.0 - (xmax - xmin) - 2.0 * dx;
+                if (length <= 0.0)
+                    return;
+                double x1 = xmax + dx;
 
-                // Domain for generating random points
-                double xleft1, xleft2, xright1, xright2;
-                if (FML::ThisTask == 0) {
-                    xleft1 = xright1 = FML::xmax_domain + dx_buffer;
-                    xleft2 = xright2 = 1.0 - dx_buffer;
-                } else if (FML::ThisTask == FML::NTasks - 1) {
-                    xleft1 = xright1 = dx_buffer;
-                    xleft2 = xright2 = FML::xmin_domain - dx_buffer;
-                } else {
-                    xleft1 = 0.0;
-                    xleft2 = FML::xmin_domain - dx_buffer;
-                    xright1 = FML::xmax_domain + dx_buffer;
-                    xright2 = 1.0;
-                }
-                assert(xleft2 >= xleft1);
-                assert(xright2 >= xright1);
+                // Uniform random number in [0,1)
+                std::mt19937 rng(1);
+                std::uniform_real_distribution<double> dist(0.0, 1.0);
+                auto uniform_rand = [&]() -> double { return dist(rng); };
 
-                // Allocate random points 10% of the points is put on the borders
-                size_t nrandom_left = nrandom * (xleft2 - xleft1) / (xright2 - xright1 + xleft2 - xleft1);
-                size_t nrandom_right = nrandom - nrandom_left;
-                assert(nrandom_left <= nrandom and nrandom_right <= nrandom);
+                // 10% of the points is put on the borders
                 int nborder = int(std::pow(nrandom / 10.0, 1.0 / (CGAL_NDIM - 1.0)));
                 size_t nrandom_border = CGAL_NDIM == 2 ? nborder : nborder * nborder;
-                if (nrandom_left < nrandom_border) {
-                    nrandom_right -= 2 * nrandom_border;
-                } else if (nrandom_right < nrandom_border)
-                    nrandom_left -= 2 * nrandom_border;
-                else {
-                    nrandom_left -= nrandom_border;
-                    nrandom_right -= nrandom_border;
-                }
-                assert(nrandom_left + nrandom_right + 2 * nrandom_border == nrandom);
+                size_t nrandom_inside = nrandom - 2 * nrandom_border;
                 positions_random.resize(nrandom * CGAL_NDIM);
 
 #ifdef DEBUG_TESSELATION
-                std::cout << "Making random points on task " << FML::ThisTask << " npts: " << nrandom_left << " "
-                          << nrandom_right << " " << nrandom_border << " " << nborder << " " << xleft2 << " " << xright1
-                          << "\n";
+                std::cout << "Making random points on task " << FML::ThisTask << " npts: " << nrandom_inside << " "
+                          << nrandom_border << " " << nborder << " " << x1 << " " << length << "\n";
 #endif
-                // Random points on left and right
+                // Random points in the region outside
                 auto * pos = positions_random.data();
-                for (size_t i = 0; i < nrandom_left; i++) {
-                    pos[0] = xleft1 + (xleft2 - xleft1) * uniform_rand();
-                    for (int idim = 1; idim < CGAL_NDIM; idim++) {
-                        pos[idim] = uniform_rand();
-                    }
-                    pos += CGAL_NDIM;
-                }
-                for (size_t i = 0; i < nrandom_right; i++) {
-                    pos[0] = xright1 + (xright2 - xright1) * uniform_rand();
+                for (size_t i = 0; i < nrandom_inside; i++) {
+                    double x = x1 + length * uniform_rand();
+                    pos[0] = x >= 1.0 ? x - 1.0 : x;
                     for (int idim = 1; idim < CGAL_NDIM; idim++) {
                         pos[idim] = uniform_rand();
                     }
@@ -394,26 +452,85 @@ namespace FML {
 
                 // Add extra guards around the border
                 double one = 1.0 - 1e-10;
-                double xborder1 = FML::xmax_domain + one * dx_buffer;
-                if (xborder1 > 1.0)
-                    xborder1 = one * dx_buffer;
-                double xborder2 = FML::xmin_domain - one * dx_buffer;
+                double xborder1 = xmax + one * dx;
+                if (xborder1 >= 1.0)
+                    xborder1 -= 1.0;
+                double xborder2 = xmin - one * dx;
                 if (xborder2 < 0.0)
-                    xborder2 = 1.0 - one * dx_buffer;
+                    xborder2 += 1.0;
                 for (int iy = 0; iy < nborder; iy++)
-                    for (int iz = 0; iz < nborder; iz++) {
+                    for (int iz = 0; iz < (CGAL_NDIM == 3 ? nborder : 1); iz++) {
                         pos[0] = xborder1;
                         pos[1] = iy / double(nborder);
-                        pos[2] = iz / double(nborder);
+                        if (CGAL_NDIM == 3)
+                            pos[CGAL_NDIM - 1] = iz / double(nborder);
                         pos += CGAL_NDIM;
                         pos[0] = xborder2;
                         pos[1] = iy / double(nborder);
-                        pos[2] = iz / double(nborder);
+                        if (CGAL_NDIM == 3)
+                            pos[CGAL_NDIM - 1] = iz / double(nborder);
                         pos += CGAL_NDIM;
                     }
 #ifdef DEBUG_TESSELATION
                 std::cout << "Adding guards on " << FML::ThisTask << " x1: " << xborder1 << " x2: " << xborder2
-                          << " Domain: " << FML::xmin_domain << " -> " << FML::xmax_domain << "\n";
+                          << " Region: " << xmin << " -> " << xmax << "\n";
+#endif
+            }
+
+            // Generate guard points outside of the region [xmin-dx, xmax+dx] (periodic in x, we assume xmin, xmax
+            // is in [0,1]) for when the buffer is a few particle separations. We put a layer of points with the given
+            // spacing on the two planes just outside the region, so the number of points scales with the surface,
+            // and fill in the rest of the box with a coarse lattice (spacing ~1/8 of the box) so that the
+            // tesselation is not too far from a regular point set
+            static void make_guard_points_outside_region(
+                double xmin, double xmax, double dx, double spacing, std::vector<float> & positions_guard) {
+                double length = 1.0 - (xmax - xmin) - 2.0 * dx;
+                if (length <= 0.0)
+                    return;
+                assert(spacing > 0.0);
+
+                // Guards on the two planes
+                const double one = 1.0 - 1e-10;
+                double xborder1 = xmax + one * dx;
+                if (xborder1 >= 1.0)
+                    xborder1 -= 1.0;
+                double xborder2 = xmin - one * dx;
+                if (xborder2 < 0.0)
+                    xborder2 += 1.0;
+                const int nborder = std::max(int(std::ceil(1.0 / spacing)), 1);
+                const int nborder_z = CGAL_NDIM == 3 ? nborder : 1;
+                for (int iy = 0; iy < nborder; iy++) {
+                    for (int iz = 0; iz < nborder_z; iz++) {
+                        for (double x : {xborder1, xborder2}) {
+                            positions_guard.push_back(float(x));
+                            positions_guard.push_back(float(iy / double(nborder)));
+                            if (CGAL_NDIM == 3)
+                                positions_guard.push_back(float(iz / double(nborder)));
+                        }
+                    }
+                }
+
+                // A coarse lattice in between (if there is room)
+                const int ncoarse = 8;
+                const int ncoarse_x = int(length * ncoarse);
+                const int ncoarse_z = CGAL_NDIM == 3 ? ncoarse : 1;
+                const double dx_coarse = length / double(ncoarse_x + 1);
+                for (int ix = 1; ix <= ncoarse_x; ix++) {
+                    double x = xmax + dx + ix * dx_coarse;
+                    if (x >= 1.0)
+                        x -= 1.0;
+                    for (int iy = 0; iy < ncoarse; iy++) {
+                        for (int iz = 0; iz < ncoarse_z; iz++) {
+                            positions_guard.push_back(float(x));
+                            positions_guard.push_back(float((iy + 0.5) / double(ncoarse)));
+                            if (CGAL_NDIM == 3)
+                                positions_guard.push_back(float((iz + 0.5) / double(ncoarse)));
+                        }
+                    }
+                }
+#ifdef DEBUG_TESSELATION
+                std::cout << "Adding " << positions_guard.size() / CGAL_NDIM << " guards on " << FML::ThisTask
+                          << " x1: " << xborder1 << " x2: " << xborder2 << " spacing: " << spacing << "\n";
 #endif
             }
 
@@ -428,60 +545,97 @@ namespace FML {
                                         std::vector<float> & positions_random,
                                         std::vector<Point> & points,
                                         std::vector<long long int> & id) {
-                size_t nrandom = positions_random.size() / CGAL_NDIM;
-                size_t npoints = NumPart + nboundary + nrandom;
-                points.reserve(npoints);
+                const size_t nrandom = positions_random.size() / CGAL_NDIM;
+                const size_t npoints = NumPart + nboundary + nrandom;
+                points.resize(npoints);
 
                 // Regular points: index in parts, other: negative
-                id.reserve(npoints);
+                id.resize(npoints);
 
                 // Add random points
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
                 for (size_t i = 0; i < nrandom; i++) {
 #if CGAL_NDIM == 2
-                    Point pt(positions_random[CGAL_NDIM * i + 0], positions_random[CGAL_NDIM * i + 1]);
+                    points[i] = Point(positions_random[CGAL_NDIM * i + 0], positions_random[CGAL_NDIM * i + 1]);
 #elif CGAL_NDIM == 3
-                    Point pt(positions_random[CGAL_NDIM * i + 0],
-                             positions_random[CGAL_NDIM * i + 1],
-                             positions_random[CGAL_NDIM * i + 2]);
+                    points[i] = Point(positions_random[CGAL_NDIM * i + 0],
+                                      positions_random[CGAL_NDIM * i + 1],
+                                      positions_random[CGAL_NDIM * i + 2]);
 #endif
-                    points.push_back(pt);
-                    id.push_back(LLONG_MIN);
+                    id[i] = LLONG_MIN;
                 }
 
                 // Add boundary points
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
                 for (size_t i = 0; i < nboundary; i++) {
                     auto * pos = FML::PARTICLE::GetPos(pboundary[i]);
 #if CGAL_NDIM == 2
-                    Point pt(pos[0], pos[1]);
+                    points[nrandom + i] = Point(pos[0], pos[1]);
 #elif CGAL_NDIM == 3
-                    Point pt(pos[0], pos[1], pos[2]);
+                    points[nrandom + i] = Point(pos[0], pos[1], pos[2]);
 #endif
-                    points.push_back(pt);
-                    id.push_back(-i - 1);
+                    id[nrandom + i] = -(long long int)(i + 1);
                 }
 
                 // Add regular points
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
                 for (size_t i = 0; i < NumPart; i++) {
                     auto * pos = FML::PARTICLE::GetPos(p[i]);
 #if CGAL_NDIM == 2
-                    Point pt(pos[0], pos[1]);
+                    points[nrandom + nboundary + i] = Point(pos[0], pos[1]);
 #elif CGAL_NDIM == 3
-                    Point pt(pos[0], pos[1], pos[2]);
+                    points[nrandom + nboundary + i] = Point(pos[0], pos[1], pos[2]);
 #endif
-                    points.push_back(pt);
-                    id.push_back(i);
+                    id[nrandom + nboundary + i] = i;
                 }
-                assert(points.size() == npoints);
+
+                if (FML::ThisTask == 0) {
+                    if (tesselation_spatial_sort)
+                        std::cout << "[MPIPeriodicDelaunay::create_total_point_set] Spatial sort of points\n";
+                    else if (tesselation_random_shuffle)
+                        std::cout << "[MPIPeriodicDelaunay::create_total_point_set] Random shuffle of points\n";
+                }
+                order_points(points, id);
+            }
+
+            // Put the points (and the ids) in the order we want to insert them in the tesselation
+            void order_points(std::vector<Point> & points, std::vector<long long int> & id) {
+                const size_t npoints = points.size();
                 assert(id.size() == npoints);
 
-                // Random shuffle of positions (to speed up tesselation)
-                if (tesselation_random_shuffle) {
+                if (tesselation_spatial_sort) {
+                    // Sort the points along a space filling curve (CGAL does a BRIO, i.e. a random shuffle of
+                    // rounds of increasing size that are then sorted, so this is also random enough)
+                    std::vector<size_t> order(npoints);
+                    std::iota(order.begin(), order.end(), 0);
+                    using PointPropertyMap = typename CGAL::Pointer_property_map<Point>::type;
+                    SpatialSortTraits<PointPropertyMap> traits(CGAL::make_property_map(points));
+                    CGAL::spatial_sort(order.begin(), order.end(), traits);
+
+                    // Put the points (and ids) in this order
+                    std::vector<Point> points_sorted(npoints);
+                    std::vector<long long int> id_sorted(npoints);
+#ifdef USE_OMP
+#pragma omp parallel for
+#endif
+                    for (size_t i = 0; i < npoints; i++) {
+                        points_sorted[i] = points[order[i]];
+                        id_sorted[i] = id[order[i]];
+                    }
+                    points.swap(points_sorted);
+                    id.swap(id_sorted);
+
+                } else if (tesselation_random_shuffle) {
+                    // Random shuffle of positions (to speed up tesselation)
                     std::random_device rd;
                     unsigned int seed = rd();
 
-                    if (FML::ThisTask == 0)
-                        std::cout << "[MPIPeriodicDelaunay::create_total_point_set] Random shuffle of points\n";
-
                     std::mt19937 rng(seed);
                     std::shuffle(points.begin(), points.end(), rng);
 
@@ -511,6 +665,49 @@ namespace FML {
                     return;
                 assert(buffer_fraction >= 0.0);
                 assert(random_fraction >= 0.0);
+                // The separation of the particles here and on the neighbor tasks for the adaptive buffer
+                const bool adaptive_buffer = adaptive_buffer_nseparations > 0.0;
+                double separation = mean_particle_separation(NumPart);
+#ifdef USE_MPI
+                if (adaptive_buffer and FML::NTasks > 1) {
+                    int LeftTask = (FML::ThisTask - 1 + FML::NTasks) % FML::NTasks;
+                    int RightTask = (FML::ThisTask + 1) % FML::NTasks;
+                    double separation_left = 0.0;
+                    double separation_right = 0.0;
+                    MPI_Status status;
+                    MPI_Sendrecv(&separation,
+                                 1,
+                                 MPI_DOUBLE,
+                                 RightTask,
+                                 0,
+                                 &separation_left,
+                                 1,
+                                 MPI_DOUBLE,
+                                 LeftTask,
+                                 0,
+                                 MPI_COMM_WORLD,
+                                 &status);
+                    MPI_Sendrecv(&separation,
+                                 1,
+                                 MPI_DOUBLE,
+                                 LeftTask,
+                                 0,
+                                 &separation_right,
+                                 1,
+                                 MPI_DOUBLE,
+                                 RightTask,
+                                 0,
+                                 MPI_COMM_WORLD,
+                                 &status);
+                    separation = std::max(separation, std::max(separation_left, separation_right));
+                }
+#endif
+                if (adaptive_buffer) {
+                    buffer_fraction =
+                        adaptive_buffer_nseparations * separation / (FML::xmax_domain - FML::xmin_domain);
+                    random_fraction = 0.0;
+                }
+
                 if (FML::NTasks == 1)
                     random_fraction = buffer_fraction = 0.0;
                 if (buffer_fraction >= 0.5 and FML::NTasks == 2) {
@@ -536,7 +733,11 @@ namespace FML {
                     std::cout << "#\n";
                     std::cout << "# Creating periodic Delaunay tesselation on " << NumPart << " parts\n";
                     std::cout << "# Buffer fraction: " << buffer_fraction << "\n";
-                    std::cout << "# Random fraction: " << random_fraction << "\n";
+                    if (adaptive_buffer)
+                        std::cout << "# Buffer is " << adaptive_buffer_nseparations
+                                  << " particle separations. Guards on the buffer surface\n";
+                    else
+                        std::cout << "# Random fraction: " << random_fraction << "\n";
                     std::cout << "#\n";
                     std::cout << "#=====================================================\n";
                     std::cout << "\n";
@@ -547,8 +748,14 @@ namespace FML {
 
                 // Create random particles
                 std::vector<float> positions_random;
-                const size_t nrandom = size_t(NumPart * random_fraction);
-                make_random_points_outside_domain(nrandom, positions_random);
+                if (adaptive_buffer) {
+                    if (FML::NTasks > 1)
+                        make_guard_points_outside_region(
+                            FML::xmin_domain, FML::xmax_domain, dx_buffer, separation, positions_random);
+                } else {
+                    make_random_points_outside_domain(size_t(NumPart * random_fraction), positions_random);
+                }
+                [[maybe_unused]] const size_t nrandom = positions_random.size() / CGAL_NDIM;
 
                 // Boundary particles
                 communicate_boundary_particles(p, NumPart, p_boundary);
@@ -577,10 +784,19 @@ namespace FML {
                 vs.resize(NumPart);
                 vs_boundary.resize(nboundary);
 
+                // With spatially sorted points we start the point location from the last point we inserted
+                Hint_handle hint = Hint_handle();
                 for (size_t i = 0; i < npoints; i++) {
                     if (FML::ThisTask == 0 and ((i * 10) / npoints != ((i + 1) * 10) / npoints))
                         std::cout << int(10.0 * (10 * (i + 1)) / npoints) << "% " << std::flush;
-                    Vertex_handle v = dt.insert(points[i]);
+                    Vertex_handle v = dt.insert(points[i], hint);
+                    if (tesselation_spatial_sort) {
+#if CGAL_NDIM == 3
+                        hint = v->cell();
+#elif CGAL_NDIM == 2
+                        hint = v->face();
+#endif
+                    }
                     if (id[i] >= 0) {
                         vs[id[i]] = v;
                         assignment_function(&(v->info()), &p[id[i]]);
@@ -612,6 +828,43 @@ namespace FML {
                 id.shrink_to_fit();
             }
 
+            /// The volume (area in 2D) of the voronoi cell of the vertex v in the tesselation dt. In 2D CGAL has no
+            /// such function so we go around v and sum up the polygon made by the circumcenters of the faces around it
+            /// (shifting them by the periodic offset of v in the face so that the polygon is not split by the box).
+            ///
+            /// @param[in] dt The tesselation
+            /// @param[in] v The vertex
+            ///
+            static double voronoi_cell_volume(PeriodicDelaunay & dt, Vertex_handle v) {
+#if CGAL_NDIM == 3
+                return dt.dual_volume(v);
+#elif CGAL_NDIM == 2
+                const auto & domain = dt.domain();
+                const double box_x = domain.xmax() - domain.xmin();
+                const double box_y = domain.ymax() - domain.ymin();
+
+                std::vector<std::array<double, 2>> corners;
+                auto face = dt.incident_faces(v), face_end = face;
+                do {
+                    const auto triangle_periodic = dt.periodic_triangle(face);
+                    const auto triangle = dt.triangle(triangle_periodic);
+                    const auto center = CGAL::circumcenter(triangle[0], triangle[1], triangle[2]);
+                    const auto & offset = triangle_periodic[face->index(v)].second;
+                    corners.push_back({CGAL::to_double(center.x()) - offset.x() * box_x,
+                                       CGAL::to_double(center.y()) - offset.y() * box_y});
+                } while (++face != face_end);
+
+                // The faces are ordered counterclockwise around v so this is the area of the polygon
+                double area = 0.0;
+                for (size_t i = 0; i < corners.size(); i++) {
+                    const auto & a = corners[i];
+                    const auto & b = corners[(i + 1) % corners.size()];
+                    area += a[0] * b[1] - b[0] * a[1];
+                }
+                return 0.5 * std::fabs(area);
+#endif
+            }
+
             /// Computes the voronoi volumes for the regular points which we have stored vertex handles for
             ///
             /// @param[out] volumes List of volumes. The ith entry corresponds to the ith particle used to create the
@@ -621,7 +874,6 @@ namespace FML {
                 size_t npts = vs.size();
                 volumes.resize(npts);
                 assert(npts > 0);
-                assert(CGAL_NDIM == 3);
 
                 // Compute volumes of regular particles
                 double totvol = 0.0;
@@ -629,12 +881,7 @@ namespace FML {
 #pragma omp parallel for reduction(+ : totvol)
 #endif
                 for (size_t i = 0; i < npts; i++) {
-#if CGAL_NDIM == 2
-                    // 2D: no built-in area function... fix this!
-                    auto vol = 0.0;
-#elif CGAL_NDIM == 3
-                    auto vol = dt.dual_volume(vs[i]);
-#endif
+                    const double vol = voronoi_cell_volume(dt, vs[i]);
                     volumes[i] = vol;
                     totvol += vol;
                 }
@@ -647,6 +894,154 @@ namespace FML {
                               << (totvol - 1) * 100 << " %\n";
             }
 
+            /// Computes the voronoi volumes of the particles without keeping the whole tesselation in memory. The
+            /// local domain is split into nblocks slabs in x and for each slab we tesselate the particles in the slab
+            /// plus a ghost zone on each side (and random guard points outside of this), compute the volumes of the
+            /// particles in the slab and throw away the tesselation. We only keep one tesselation per thread so
+            /// the peak memory is ~1/nblocks of that of create + VoronoiVolume. With OpenMP the slabs are done in
+            /// parallel so use nblocks larger than the number of threads. The ghost zone must be large enough for
+            /// the cells of the particles in the slab to be complete (a few mean particle separations), the
+            /// volume missing in the box that we print in the end tells us if this is the case.
+            ///
+            /// @param[in] p Pointer to the particles
+            /// @param[in] NumPart Number of local particles
+            /// @param[out] volumes List of volumes. The ith entry corresponds to the ith particle.
+            /// @param[in] nblocks Optional: the number of slabs we split the local domain into.
+            /// @param[in] buffer_fraction Optional: the size of the ghost zone in units of the slab width.
+            /// @param[in] random_fraction Optional: the number of random guard points as a fraction of the number
+            /// of particles in the slab (just to speed up the calculation)
+            ///
+            void VoronoiVolumeStreaming(T * p,
+                                        size_t NumPart,
+                                        std::vector<double> & volumes,
+                                        int nblocks = 8,
+                                        double buffer_fraction = 0.5,
+                                        double random_fraction = 0.3) {
+                assert_mpi(nblocks > 0, "[MPIPeriodicDelaunay::VoronoiVolumeStreaming] nblocks must be positive");
+                assert_mpi(FML::PARTICLE::GetNDIM(T()) == CGAL_NDIM, "Dimensions do not match");
+                assert(buffer_fraction >= 0.0);
+                assert(random_fraction >= 0.0);
+                volumes.assign(NumPart, 0.0);
+
+                // With one slab covering the whole box we just tesselate all the particles. With several tasks
+                // the ghost zone can at most be the size of the neighbor domain as that is what we communicate
+                const double block_width = (FML::xmax_domain - FML::xmin_domain) / double(nblocks);
+                double dx_ghost = buffer_fraction * block_width;
+                const bool whole_box = FML::NTasks == 1 and nblocks == 1;
+                if (whole_box)
+                    dx_ghost = 0.0;
+                if (FML::NTasks > 1)
+                    dx_ghost = std::min(dx_ghost, (1.0 - 1e-10) * (FML::xmax_domain - FML::xmin_domain));
+
+                if (FML::ThisTask == 0)
+                    std::cout << "[MPIPeriodicDelaunay::VoronoiVolumeStreaming] Computing volumes in " << nblocks
+                              << " slabs per task with a ghost zone of " << dx_ghost << " on each side\n";
+
+                // Boundary particles
+                dx_buffer = dx_ghost;
+                if (NumPart > 0)
+                    communicate_boundary_particles(p, NumPart, p_boundary);
+
+                // If x is in [xmin, xmax) (periodic)
+                auto in_region = [](double x, double xmin, double xmax) {
+                    double dx = x - xmin;
+                    if (dx < 0.0)
+                        dx += 1.0;
+                    if (dx >= 1.0)
+                        dx -= 1.0;
+                    return dx < xmax - xmin;
+                };
+
+                double totvol = 0.0;
+#ifdef USE_OMP
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : totvol)
+#endif
+                for (int iblock = 0; iblock < nblocks; iblock++) {
+                    const double x0 = FML::xmin_domain + iblock * block_width;
+                    const double x1 = iblock == nblocks - 1 ? FML::xmax_domain : x0 + block_width;
+
+                    // The particles in the slab (id is the index in p) and in the ghost zone (id < 0)
+                    std::vector<Point> points;
+                    std::vector<long long int> id;
+                    auto add_point = [&](const double * pos, long long int index) {
+#if CGAL_NDIM == 2
+                        points.push_back(Point(pos[0], pos[1]));
+#elif CGAL_NDIM == 3
+                        points.push_back(Point(pos[0], pos[1], pos[2]));
+#endif
+                        id.push_back(index);
+                    };
+                    size_t nregular = 0;
+                    for (size_t i = 0; i < NumPart; i++) {
+                        auto * pos = FML::PARTICLE::GetPos(p[i]);
+                        if (pos[0] >= x0 and pos[0] < x1) {
+                            add_point(pos, (long long int)(i));
+                            nregular++;
+                        } else if (not whole_box and in_region(pos[0], x0 - dx_ghost, x1 + dx_ghost)) {
+                            add_point(pos, LLONG_MIN);
+                        }
+                    }
+                    for (auto & part : p_boundary) {
+                        auto * pos = FML::PARTICLE::GetPos(part);
+                        if (in_region(pos[0], x0 - dx_ghost, x1 + dx_ghost))
+                            add_point(pos, LLONG_MIN);
+                    }
+                    if (nregular == 0)
+                        continue;
+
+                    // Random guard points outside the slab plus ghost zone
+                    if (not whole_box) {
+                        std::vector<float> positions_random;
+                        make_random_points_outside_region(
+                            x0, x1, dx_ghost, size_t(nregular * random_fraction), positions_random);
+                        for (size_t i = 0; i < positions_random.size() / CGAL_NDIM; i++) {
+                            double pos[CGAL_NDIM];
+                            for (int idim = 0; idim < CGAL_NDIM; idim++)
+                                pos[idim] = positions_random[CGAL_NDIM * i + idim];
+                            add_point(pos, LLONG_MIN);
+                        }
+                    }
+                    order_points(points, id);
+
+                    // Tesselate and compute the volumes of the particles in the slab
+                    PeriodicDelaunay dt_block;
+                    std::vector<std::pair<Vertex_handle, size_t>> vs_block;
+                    vs_block.reserve(nregular);
+                    Hint_handle hint = Hint_handle();
+                    for (size_t i = 0; i < points.size(); i++) {
+                        Vertex_handle v = dt_block.insert(points[i], hint);
+                        if (tesselation_spatial_sort) {
+#if CGAL_NDIM == 3
+                            hint = v->cell();
+#elif CGAL_NDIM == 2
+                            hint = v->face();
+#endif
+                        }
+                        if (id[i] >= 0)
+                            vs_block.push_back({v, size_t(id[i])});
+                    }
+                    points = std::vector<Point>();
+                    id = std::vector<long long int>();
+
+                    for (auto & vi : vs_block) {
+                        const double vol = voronoi_cell_volume(dt_block, vi.first);
+                        volumes[vi.second] = vol;
+                        totvol += vol;
+                    }
+                }
+
+                // Free up memory
+                p_boundary.clear();
+                p_boundary.shrink_to_fit();
+
+                // Communicate over tasks
+                FML::SumOverTasks(&totvol);
+
+                if (FML::ThisTask == 0)
+                    std::cout << "[MPIPeriodicDelaunay::VoronoiVolumeStreaming] Volume missing in the box: "
+                              << (totvol - 1) * 100 << " %\n";
+            }
+
             // Check that the tesselation is OK
             int num_bad_cells() {
                 int nbadcells = 0;
@@ -712,6 +1107,16 @@ namespace FML {
         /// Quantity is a vector of size NumPart. When quantity is the density or inverse
         /// density of the particle then we get a Void or Cluster finder
         ///
+        /// Each particle belongs to the basin of its neighbor with the smallest quantity (steepest descent).
+        /// For ties the basin with the smallest WatershedID wins so the result does not depend on the
+        /// order we walk the tesselation in. The basins are merged over tasks by exchanging the WatershedID of
+        /// the particles in the buffer with the neighbor tasks (both ways) until nothing changes.
+        ///
+        /// The basins are distributed over the tasks: a task has the basins whose minimum is one of its
+        /// particles, i.e. watershed_groups[i] is the basin with WatershedID = i + (number of basins on the
+        /// tasks before this one). The contributions from the particles on other tasks are sent to the task
+        /// that has the basin.
+        ///
         /// If the buffer is too small the results will not be perfect, we give warnings
         /// when this is the case (instead of just throwing) as some times this is fine.
         /// To be sure of the result its a good idea to try with a smaller number of CPUs
@@ -725,7 +1130,7 @@ namespace FML {
         /// @param[in] NumPart Number of local particles.
         /// @param[in] quantity Vector with the quantity to watershed on (e.g. the density of the particles).
         /// quantity[i] corresponds to the quantity for particle i.
-        /// @param[out] watershed_groups The result of the watershed: a list of watershed groups.
+        /// @param[out] watershed_groups The result of the watershed: the list of watershed groups on this task.
         ///
         //===============================================================================
 
@@ -737,124 +1142,110 @@ namespace FML {
                               std::vector<U> & watershed_groups) {
 
             assert(quantity.size() == NumPart);
-            [[maybe_unused]] const double dx_buffer = D.get_dx_buffer();
 
             // Fetch tesselation
-            auto dt = D.get_delaunay_triangulation();
-            using Vertex_handle = typename decltype(dt)::Vertex_handle;
-
-            // For boundaries and communication
-            [[maybe_unused]] size_t count_left = 0;
-            [[maybe_unused]] size_t count_right = 0;
-            [[maybe_unused]] size_t recv_left = 0;
-            [[maybe_unused]] size_t recv_right = 0;
-            [[maybe_unused]] size_t nboundary = 0;
+            auto & dt = D.get_delaunay_triangulation();
+            using Vertex_handle = typename std::remove_reference_t<decltype(dt)>::Vertex_handle;
 
             // Assign quantity to particles
             // Here we fetch the vertex handles from the tesselation
-            auto vs = D.get_vertex_handles_regular();
+            auto & vs = D.get_vertex_handles_regular();
+            [[maybe_unused]] auto & vs_boundary = D.get_vertex_handles_boundary();
             assert(vs.size() == NumPart);
             for (size_t i = 0; i < NumPart; i++) {
                 vs[i]->info().quantity = quantity[i];
                 vs[i]->info().point_type = REGULAR_POINT;
             }
 
-            // Deal with the boundary
+            // The particles we sent to the left and right task and the boundary particles we got from them
+            // (the first recv_left of the boundary particles came from the left task)
+            std::vector<size_t> index_left;
+            std::vector<size_t> index_right;
+            [[maybe_unused]] size_t recv_left = 0;
+            [[maybe_unused]] size_t recv_right = 0;
+
 #ifdef USE_MPI
             int LeftTask = (FML::ThisTask - 1 + FML::NTasks) % FML::NTasks;
             int RightTask = (FML::ThisTask + 1) % FML::NTasks;
-            if (FML::NTasks > 1) {
 
-                // Count how many particles we have on the left and right
-                // NB: this relies on we do exactly the same thing in MPIPeriodicDelaunay
-                // A more roboust way is to communicate index we want, gather, send etc.
-                count_left = 0;
-                count_right = 0;
-                for (size_t i = 0; i < NumPart; i++) {
-                    auto * pos = FML::PARTICLE::GetPos(p[i]);
-                    if (pos[0] < FML::xmin_domain + dx_buffer)
-                        count_left++;
-                    if (pos[0] > FML::xmax_domain - dx_buffer)
-                        count_right++;
-                }
-
-                // Comunicate how many to send
+            // Send values for the particles we sent to the left and right task when making the tesselation
+            // and receive the values for the boundary particles (or the other way around)
+            auto sendrecv_left_right = [&](auto & to_left, auto & to_right, auto & from_left, auto & from_right) {
+                using V = typename std::remove_reference_t<decltype(to_left)>::value_type;
                 MPI_Status status;
-                MPI_Sendrecv(&count_left,
-                             sizeof(count_left),
+                MPI_Sendrecv(to_left.data(),
+                             int(sizeof(V) * to_left.size()),
                              MPI_CHAR,
                              LeftTask,
                              0,
-                             &recv_right,
-                             sizeof(recv_right),
+                             from_right.data(),
+                             int(sizeof(V) * from_right.size()),
                              MPI_CHAR,
                              RightTask,
                              0,
                              MPI_COMM_WORLD,
                              &status);
-                MPI_Sendrecv(&count_right,
-                             sizeof(count_right),
+                MPI_Sendrecv(to_right.data(),
+                             int(sizeof(V) * to_right.size()),
                              MPI_CHAR,
                              RightTask,
                              0,
-                             &recv_left,
-                             sizeof(recv_left),
+                             from_left.data(),
+                             int(sizeof(V) * from_left.size()),
                              MPI_CHAR,
                              LeftTask,
                              0,
                              MPI_COMM_WORLD,
                              &status);
+            };
 
-                // Gather quantity
-                std::vector<QuantityType> quantity_to_send_left(count_left);
-                std::vector<QuantityType> quantity_to_send_right(count_right);
-                std::vector<QuantityType> quantity_to_recv_left(recv_left);
-                std::vector<QuantityType> quantity_to_recv_right(recv_right);
-                count_left = 0;
-                count_right = 0;
-                for (size_t i = 0; i < NumPart; i++) {
-                    auto * pos = FML::PARTICLE::GetPos(p[i]);
-                    if (pos[0] < FML::xmin_domain + dx_buffer) {
-                        quantity_to_send_left[count_left] = quantity[i];
-                        count_left++;
-                    }
-                    if (pos[0] > FML::xmax_domain - dx_buffer) {
-                        quantity_to_send_right[count_right] = quantity[i];
-                        count_right++;
-                    }
-                }
+            if (FML::NTasks > 1) {
+                // This is exactly the selection done in MPIPeriodicDelaunay
+                D.select_boundary_particles(p, NumPart, index_left, index_right);
+                size_t count_left = index_left.size();
+                size_t count_right = index_right.size();
 
-                // Send quantity
-                MPI_Sendrecv(quantity_to_send_left.data(),
-                             sizeof(QuantityType) * count_left,
+                // Comunicate how many to send
+                MPI_Status status;
+                MPI_Sendrecv(&count_left,
+                             sizeof(count_left),
                              MPI_CHAR,
                              LeftTask,
                              0,
-                             quantity_to_recv_right.data(),
-                             sizeof(QuantityType) * recv_right,
+                             &recv_right,
+                             sizeof(recv_right),
                              MPI_CHAR,
                              RightTask,
                              0,
                              MPI_COMM_WORLD,
                              &status);
-                MPI_Sendrecv(quantity_to_send_right.data(),
-                             sizeof(QuantityType) * count_right,
+                MPI_Sendrecv(&count_right,
+                             sizeof(count_right),
                              MPI_CHAR,
                              RightTask,
                              0,
-                             quantity_to_recv_left.data(),
-                             sizeof(QuantityType) * recv_left,
+                             &recv_left,
+                             sizeof(recv_left),
                              MPI_CHAR,
                              LeftTask,
                              0,
                              MPI_COMM_WORLD,
                              &status);
+                assert(vs_boundary.size() == recv_left + recv_right);
 
-                // Assign quantity to particles
-                // Here we fetch the vertex handles from the tesselation
-                auto vs_boundary = D.get_vertex_handles_boundary();
-                nboundary = recv_left + recv_right;
-                assert(vs_boundary.size() == nboundary);
+                // Send quantity
+                std::vector<QuantityType> quantity_to_send_left(count_left);
+                std::vector<QuantityType> quantity_to_send_right(count_right);
+                std::vector<QuantityType> quantity_to_recv_left(recv_left);
+                std::vector<QuantityType> quantity_to_recv_right(recv_right);
+                for (size_t i = 0; i < count_left; i++)
+                    quantity_to_send_left[i] = quantity[index_left[i]];
+                for (size_t i = 0; i < count_right; i++)
+                    quantity_to_send_right[i] = quantity[index_right[i]];
+                sendrecv_left_right(
+                    quantity_to_send_left, quantity_to_send_right, quantity_to_recv_left, quantity_to_recv_right);
+
+                // Assign quantity to boundary particles
                 for (size_t i = 0; i < recv_left; i++) {
                     vs_boundary[i]->info().quantity = quantity_to_recv_left[i];
                     vs_boundary[i]->info().point_type = BOUNDARY_POINT;
@@ -863,25 +1254,6 @@ namespace FML {
                     vs_boundary[i + recv_left]->info().quantity = quantity_to_recv_right[i];
                     vs_boundary[i + recv_left]->info().point_type = BOUNDARY_POINT;
                 }
-
-                // Assign minimum neighbor
-                for (size_t i = 0; i < nboundary; i++) {
-                    auto v = vs_boundary[i];
-                    std::vector<Vertex_handle> vertices;
-                    dt.adjacent_vertices(v, std::back_inserter(vertices));
-                    auto min_quantity = Infinity;
-                    for (auto & vnew : vertices) {
-                        if (vnew->info().point_type == GUARD_POINT)
-                            continue;
-                        if (vnew->info().quantity < min_quantity)
-                            min_quantity = vnew->info().quantity;
-                    }
-                    v->info().min_quantity_nbor = min_quantity;
-                    if (v->info().min_quantity_nbor == Infinity) {
-                        std::cout << "[WatershedGeneral] Warning boundary particle has no normal nbors " << v->point()
-                                  << " " << FML::ThisTask << "\n";
-                    }
-                }
             }
 #endif
 
@@ -910,31 +1282,27 @@ namespace FML {
                 }
             }
 
-            // Ensure unique task id
+            // Ensure unique task id. The basins on task i have WatershedID in [id_start_task[i], id_start_task[i+1])
             std::vector<int> nminima_per_task(FML::NTasks, 0);
             nminima_per_task[FML::ThisTask] = nminima;
 #ifdef USE_MPI
             MPI_Allreduce(MPI_IN_PLACE, nminima_per_task.data(), FML::NTasks, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
 #endif
-            int id_start = 0;
-            for (int i = 0; i < FML::ThisTask; i++)
-                id_start += nminima_per_task[i];
-            size_t ntotal_minima = 0;
+            std::vector<IDType> id_start_task(FML::NTasks + 1, 0);
             for (int i = 0; i < FML::NTasks; i++)
-                ntotal_minima += size_t(nminima_per_task[i]);
+                id_start_task[i + 1] = id_start_task[i] + nminima_per_task[i];
+            const IDType id_start = id_start_task[FML::ThisTask];
+            const size_t ntotal_minima = size_t(id_start_task[FML::NTasks]);
 
             if (FML::ThisTask == 0)
                 std::cout << "[WatershedGeneral] We found " << ntotal_minima << " minimum points\n";
 
-            // Assign unique wathershed ID - this ID is unique across tasks
-            // Gather vertex handles to all the minimas
-            decltype(vs) vminima(nminima);
+            // Gather vertex handles to all the minimas. The minimum vminima[i] has WatershedID id_start + i
+            std::vector<Vertex_handle> vminima(nminima);
             nminima = 0;
             for (size_t i = 0; i < NumPart; i++) {
                 if (is_minimum[i]) {
-                    auto v = vs[i];
-                    vminima[nminima] = v;
-                    v->info().WatershedID = id_start + nminima;
+                    vminima[nminima] = vs[i];
                     nminima++;
                 }
             }
@@ -946,7 +1314,6 @@ namespace FML {
                 auto v = vs[i];
                 std::vector<Vertex_handle> vertices;
                 dt.adjacent_vertices(v, std::back_inserter(vertices));
-                // auto quantity = v->info().quantity;
                 auto min_quantity = Infinity;
                 for (auto & vnew : vertices) {
                     if (vnew->info().point_type == GUARD_POINT)
@@ -958,147 +1325,130 @@ namespace FML {
                 v->info().min_quantity_nbor = min_quantity;
             }
 
-            // Recursive call to find the watershed basins we set all neighbors with higher values of quantity as
-            // part of the basin and then do a recursive call with each of these neighbors as the starting point
-            std::function<int(Vertex_handle, IDType)> recursive_through_vertices = [&](Vertex_handle v, IDType id) {
-                if (v->info().point_type == GUARD_POINT)
+            // The boundary particles get this from the task they belong to as we don't have all their nbors
+#ifdef USE_MPI
+            if (FML::NTasks > 1) {
+                std::vector<QuantityType> min_quantity_to_send_left(index_left.size());
+                std::vector<QuantityType> min_quantity_to_send_right(index_right.size());
+                std::vector<QuantityType> min_quantity_to_recv_left(recv_left);
+                std::vector<QuantityType> min_quantity_to_recv_right(recv_right);
+                for (size_t i = 0; i < index_left.size(); i++)
+                    min_quantity_to_send_left[i] = vs[index_left[i]]->info().min_quantity_nbor;
+                for (size_t i = 0; i < index_right.size(); i++)
+                    min_quantity_to_send_right[i] = vs[index_right[i]]->info().min_quantity_nbor;
+                sendrecv_left_right(min_quantity_to_send_left,
+                                    min_quantity_to_send_right,
+                                    min_quantity_to_recv_left,
+                                    min_quantity_to_recv_right);
+                for (size_t i = 0; i < recv_left; i++)
+                    vs_boundary[i]->info().min_quantity_nbor = min_quantity_to_recv_left[i];
+                for (size_t i = 0; i < recv_right; i++)
+                    vs_boundary[i + recv_left]->info().min_quantity_nbor = min_quantity_to_recv_right[i];
+            }
+#endif
+
+            // Assign the vertex v and all the vertices that flow down to it to the basin id. We set all neighbors
+            // with higher values of quantity that has v as its lowest neighbor as part of the basin and continue
+            // from these. Vertices already in a basin with a lower id are left as they are. We use a stack instead
+            // of recursion as the basins can be very large. Returns the number of vertices that changed basin
+            std::vector<Vertex_handle> stack;
+            std::vector<Vertex_handle> vertices;
+            auto assign_basin = [&](Vertex_handle v0, IDType id) -> size_t {
+                if (v0->info().point_type == GUARD_POINT or v0->info().WatershedID <= id)
                     return 0;
 
-                // Assign current vertex
-                int count = 0;
-                v->info().WatershedID = id;
-                if (v->info().point_type == REGULAR_POINT)
+                size_t count = 0;
+                v0->info().WatershedID = id;
+                stack.push_back(v0);
+                while (not stack.empty()) {
+                    auto v = stack.back();
+                    stack.pop_back();
                     count++;
 
-                // Loop over neighbors
-                std::vector<Vertex_handle> vertices;
-                dt.adjacent_vertices(v, std::back_inserter(vertices));
-                auto quantity = v->info().quantity;
-                for (auto & vnew : vertices) {
-                    if (vnew == v)
-                        continue;
-                    if (vnew->info().WatershedID == id)
-                        continue;
-                    if (vnew->info().point_type == GUARD_POINT)
-                        continue;
-                    if (quantity > vnew->info().min_quantity_nbor)
-                        continue;
-                    if (vnew->info().quantity > quantity) {
-                        if (vnew->info().point_type == REGULAR_POINT) {
-                            count++;
+                    // Loop over neighbors
+                    vertices.clear();
+                    dt.adjacent_vertices(v, std::back_inserter(vertices));
+                    auto quantity = v->info().quantity;
+                    for (auto & vnew : vertices) {
+                        if (vnew == v)
+                            continue;
+                        if (vnew->info().point_type == GUARD_POINT)
+                            continue;
+                        if (vnew->info().WatershedID <= id)
+                            continue;
+                        if (quantity > vnew->info().min_quantity_nbor)
+                            continue;
+                        if (vnew->info().quantity > quantity) {
+                            vnew->info().WatershedID = id;
+                            stack.push_back(vnew);
                         }
-                        vnew->info().WatershedID = id;
-                        count += recursive_through_vertices(vnew, id);
                     }
                 }
                 return count;
             };
 
-            // We can now do this step with OpenMP if we want as no two basins should be able to overlap
-            size_t ntot = 0;
+            [[maybe_unused]] size_t ntot = 0;
             for (size_t i = 0; i < nminima; i++) {
-                auto v = vminima[i];
-                auto id = v->info().WatershedID;
-                ntot += recursive_through_vertices(v, id);
+                ntot += assign_basin(vminima[i], IDType(id_start + i));
             }
 #ifdef DEBUG_TESSELATION
-            std::cout << "We have " << nminima << " minima with " << ntot << " of " << NumPart
-                      << " particles tied up on task " << FML::ThisTask << "\n";
+            std::cout << "We have " << nminima << " minima with " << ntot << " vertices tied up on task "
+                      << FML::ThisTask << "\n";
 #endif
 
-            // Now we need to merge across tasks
-            // We communicate boundary particles and their WatershedID to the left and right and do the merging
-            // If some of the particles have id > 0 then they will be merged
-            // We should really do this thing one by one (i,i+1) to ensure structures that span many tasks gets
-            // assigned correctly. This is rarely an issue unless we have extremely few particles and many tasks
+            // Now we need to merge across tasks. We send the WatershedID of the particles in the buffer to the
+            // tasks that have them as boundary particles and continue the walk from there. The boundary particles
+            // can also have gotten a (lower) id from our basins so we send these back to the task they belong to
+            // and do the same there. The ids only decrease so this ends. A basin spanning n tasks needs ~n rounds
 #ifdef USE_MPI
             if (FML::NTasks > 1) {
-
-                std::vector<IDType> watershed_id_to_send_left(count_left);
-                std::vector<IDType> watershed_id_to_send_right(count_right);
+                std::vector<IDType> watershed_id_to_send_left(index_left.size());
+                std::vector<IDType> watershed_id_to_send_right(index_right.size());
                 std::vector<IDType> watershed_id_to_recv_left(recv_left);
                 std::vector<IDType> watershed_id_to_recv_right(recv_right);
 
-                // We merge back and forth until we are done
-                // or maximum 3 times
-                for (int s = 0; s < 3; s++) {
-                    auto vs = D.get_vertex_handles_regular();
-                    assert(vs.size() == NumPart);
-                    count_left = 0;
-                    count_right = 0;
-                    for (size_t i = 0; i < NumPart; i++) {
-                        auto id = vs[i]->info().WatershedID;
-                        auto * pos = FML::PARTICLE::GetPos(p[i]);
-                        if (pos[0] < FML::xmin_domain + dx_buffer) {
-                            watershed_id_to_send_left[count_left] = id;
-                            count_left++;
-                        }
-                        if (pos[0] > FML::xmax_domain - dx_buffer) {
-                            watershed_id_to_send_right[count_right] = id;
-                            count_right++;
-                        }
-                    }
-                    assert(watershed_id_to_send_left.size() == count_left);
-                    assert(watershed_id_to_send_right.size() == count_right);
+                for (int s = 0;; s++) {
+                    long long int nchanged = 0;
+
+                    // From the particles to their boundary copies
+                    for (size_t i = 0; i < index_left.size(); i++)
+                        watershed_id_to_send_left[i] = vs[index_left[i]]->info().WatershedID;
+                    for (size_t i = 0; i < index_right.size(); i++)
+                        watershed_id_to_send_right[i] = vs[index_right[i]]->info().WatershedID;
+                    sendrecv_left_right(watershed_id_to_send_left,
+                                        watershed_id_to_send_right,
+                                        watershed_id_to_recv_left,
+                                        watershed_id_to_recv_right);
+                    for (size_t i = 0; i < recv_left; i++)
+                        nchanged += assign_basin(vs_boundary[i], watershed_id_to_recv_left[i]);
+                    for (size_t i = 0; i < recv_right; i++)
+                        nchanged += assign_basin(vs_boundary[i + recv_left], watershed_id_to_recv_right[i]);
+
+                    // From the boundary copies back to the particles
+                    for (size_t i = 0; i < recv_left; i++)
+                        watershed_id_to_recv_left[i] = vs_boundary[i]->info().WatershedID;
+                    for (size_t i = 0; i < recv_right; i++)
+                        watershed_id_to_recv_right[i] = vs_boundary[i + recv_left]->info().WatershedID;
+                    sendrecv_left_right(watershed_id_to_recv_left,
+                                        watershed_id_to_recv_right,
+                                        watershed_id_to_send_left,
+                                        watershed_id_to_send_right);
+                    for (size_t i = 0; i < index_left.size(); i++)
+                        nchanged += assign_basin(vs[index_left[i]], watershed_id_to_send_left[i]);
+                    for (size_t i = 0; i < index_right.size(); i++)
+                        nchanged += assign_basin(vs[index_right[i]], watershed_id_to_send_right[i]);
 
-                    MPI_Status status;
-                    MPI_Sendrecv(watershed_id_to_send_left.data(),
-                                 sizeof(IDType) * count_left,
-                                 MPI_CHAR,
-                                 LeftTask,
-                                 0,
-                                 watershed_id_to_recv_right.data(),
-                                 sizeof(IDType) * recv_right,
-                                 MPI_CHAR,
-                                 RightTask,
-                                 0,
-                                 MPI_COMM_WORLD,
-                                 &status);
-                    MPI_Sendrecv(watershed_id_to_send_right.data(),
-                                 sizeof(IDType) * count_right,
-                                 MPI_CHAR,
-                                 RightTask,
-                                 0,
-                                 watershed_id_to_recv_left.data(),
-                                 sizeof(IDType) * recv_left,
-                                 MPI_CHAR,
-                                 LeftTask,
-                                 0,
-                                 MPI_COMM_WORLD,
-                                 &status);
-
-                    // Update Watershed IDs
-                    auto vs_boundary = D.get_vertex_handles_boundary();
-                    for (size_t i = 0; i < recv_left; i++) {
-                        auto v = vs_boundary[i];
-                        auto id = watershed_id_to_recv_left[i];
-                        v->info().WatershedID = id;
-                    }
-                    for (size_t i = 0; i < recv_right; i++) {
-                        auto v = vs_boundary[i + recv_left];
-                        auto id = watershed_id_to_recv_right[i];
-                        v->info().WatershedID = id;
-                    }
-
-                    // Assign IDs to vertices recursively
-                    int ntot = 0;
-                    for (size_t i = 0; i < nboundary; i++) {
-                        auto v = vs_boundary[i];
-                        auto id = v->info().WatershedID;
-                        if (id == NoWatershedID)
-                            continue;
-                        ntot += recursive_through_vertices(v, id);
-                    }
 #ifdef DEBUG_TESSELATION
-                    std::cout << "In merging on " << FML::ThisTask << " we assigned " << ntot << "\n";
+                    std::cout << "In merging round " << s << " on " << FML::ThisTask << " we changed " << nchanged
+                              << "\n";
 #endif
-                    // If no more particles gets assigned we stop
-                    FML::SumOverTasks(&ntot);
-                    if (ntot == 0)
+                    // If no more particles changes basin we are done
+                    FML::SumOverTasks(&nchanged);
+                    if (nchanged == 0) {
+                        if (FML::ThisTask == 0)
+                            std::cout << "[WatershedGeneral] Merging over tasks done after " << s + 1 << " rounds\n";
                         break;
-                    if (s == 2 and FML::ThisTask == 0)
-                        std::cout << "[WatershedGeneral] Warning we merged 3 times and still not done, buffer should "
-                                     "be larger, cannot guarantee the results are perfect\n";
+                    }
                 }
             }
 #endif
@@ -1129,98 +1479,129 @@ namespace FML {
                 }
             }
 
-            // Compute how many particles there are per group and communicate this
-            std::vector<int> n_per_group(ntotal_minima, 0);
-            for (size_t i = 0; i < NumPart; i++) {
-                if (vs[i]->info().WatershedID != NoWatershedID) {
-                    n_per_group[vs[i]->info().WatershedID]++;
-                }
-            }
-#ifdef USE_MPI
-            MPI_Allreduce(MPI_IN_PLACE, n_per_group.data(), ntotal_minima, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-#endif
-
-            // Compute the minimum position and make sure all tasks have this
-            std::vector<double> x_minima(ntotal_minima, 0.0);
-            std::vector<double> y_minima(ntotal_minima, 0.0);
-            std::vector<double> z_minima(ntotal_minima, 0.0);
+            // Time to compile up the results. We have the basins of our minima
+            auto position_of_minimum = [&](Vertex_handle v, double * pos) {
+                auto point = v->point();
+                for (int idim = 0; idim < CGAL_NDIM; idim++)
+                    pos[idim] = point[idim];
+            };
+            watershed_groups.resize(nminima);
             for (size_t i = 0; i < nminima; i++) {
-                auto v = vminima[i];
-
-                // Get points in dual polyhedra, i.e. voronoi cell
-                // std::vector< decltype(p) > pts;
-                // auto tetra = dt.dual(v, std::back_inserter(pts));
-                // std::cout << "Dual polyhedra: " << pts.size() << "\n";
-
-                // XXX Add compute circumcenter of core particle and 3 closest low density region
-
-                // Minimum density particle
-                auto pos = v->point();
-                x_minima[v->info().WatershedID] = pos[0];
-                y_minima[v->info().WatershedID] = pos[1];
-#if CGAL_NDIM == 3
-                z_minima[v->info().WatershedID] = pos[2];
-#endif
-            }
-#ifdef USE_MPI
-            MPI_Allreduce(MPI_IN_PLACE, x_minima.data(), ntotal_minima, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            MPI_Allreduce(MPI_IN_PLACE, y_minima.data(), ntotal_minima, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-            MPI_Allreduce(MPI_IN_PLACE, z_minima.data(), ntotal_minima, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-#endif
-
-            // Time to compile up the results. Make the result array
-            watershed_groups.resize(ntotal_minima);
-
-            // Initialize groups on all tasks
-            for (size_t i = 0; i < ntotal_minima; i++) {
-#if CGAL_NDIM == 2
-                double pos[] = {x_minima[i], y_minima[i]};
-#elif CGAL_NDIM == 3
-                double pos[] = {x_minima[i], y_minima[i], z_minima[i]};
-#endif
+                double pos[CGAL_NDIM];
+                position_of_minimum(vminima[i], pos);
                 watershed_groups[i].init(pos);
             }
 
-            // Loop through all particles and assign data to groups
+            // Loop through all particles and assign data to groups. The particles in basins on other tasks
+            // we collect up and deal with below
+            std::vector<size_t> index_other_task;
             for (size_t i = 0; i < NumPart; i++) {
                 auto v = vs[i];
                 auto id = v->info().WatershedID;
-                if (id != NoWatershedID) {
-                    watershed_groups[id].add_particle((T *)v->info().part_ptr, v->info().quantity);
+                if (id == NoWatershedID)
+                    continue;
+                if (id >= id_start and id < IDType(id_start + nminima)) {
+                    watershed_groups[id - id_start].add_particle((T *)v->info().part_ptr, v->info().quantity);
+                } else {
+                    index_other_task.push_back(i);
                 }
             }
 
-            // Communicate stuff so that task 0 has all the data
+            // Bin up the particles in basins on other tasks and send this to the task the basin belongs to.
+            // We first need to get the position of the minimum from that task
             // NB: assumes watershed_groups is a simple type so that sizeof works, i.e. no dynamic allocated
             // objects in the class
 #ifdef USE_MPI
-            for (int i = 1; i < FML::NTasks; i++) {
-                size_t bytes = sizeof(U) * ntotal_minima;
-                if (FML::ThisTask == 0) {
-                    std::vector<U> watershed_groups_from_other_task(ntotal_minima);
-                    MPI_Status status;
-                    MPI_Recv(watershed_groups_from_other_task.data(), bytes, MPI_BYTE, i, 0, MPI_COMM_WORLD, &status);
-
-                    // Merge in the groups
-                    for (size_t j = 0; j < ntotal_minima; j++) {
-                        watershed_groups[j].merge(watershed_groups_from_other_task[j]);
+            if (FML::NTasks > 1) {
+                auto task_of_id = [&](IDType id) {
+                    return int(std::upper_bound(id_start_task.begin(), id_start_task.end(), id) -
+                               id_start_task.begin()) -
+                           1;
+                };
+
+                // Send count elements of the given size to each of the tasks
+                auto alltoallv = [&](const void * sendbuf,
+                                     const std::vector<int> & nsend,
+                                     void * recvbuf,
+                                     const std::vector<int> & nrecv,
+                                     size_t bytes_per_element) {
+                    std::vector<int> nbytes_send(FML::NTasks), nbytes_recv(FML::NTasks),
+                        offset_send(FML::NTasks, 0), offset_recv(FML::NTasks, 0);
+                    for (int task = 0; task < FML::NTasks; task++) {
+                        nbytes_send[task] = int(nsend[task] * bytes_per_element);
+                        nbytes_recv[task] = int(nrecv[task] * bytes_per_element);
+                        if (task > 0) {
+                            offset_send[task] = offset_send[task - 1] + nbytes_send[task - 1];
+                            offset_recv[task] = offset_recv[task - 1] + nbytes_recv[task - 1];
+                        }
                     }
-                } else if (FML::ThisTask == i) {
-                    MPI_Send(watershed_groups.data(), bytes, MPI_BYTE, 0, 0, MPI_COMM_WORLD);
+                    MPI_Alltoallv(sendbuf,
+                                  nbytes_send.data(),
+                                  offset_send.data(),
+                                  MPI_BYTE,
+                                  recvbuf,
+                                  nbytes_recv.data(),
+                                  offset_recv.data(),
+                                  MPI_BYTE,
+                                  MPI_COMM_WORLD);
+                };
+
+                // The basins on other tasks we have particles in. Sorted by id so also sorted by task
+                std::vector<IDType> ids_other_task;
+                for (auto i : index_other_task)
+                    ids_other_task.push_back(vs[i]->info().WatershedID);
+                std::sort(ids_other_task.begin(), ids_other_task.end());
+                ids_other_task.erase(std::unique(ids_other_task.begin(), ids_other_task.end()),
+                                     ids_other_task.end());
+
+                std::vector<int> nsend(FML::NTasks, 0);
+                std::vector<int> nrecv(FML::NTasks, 0);
+                for (auto id : ids_other_task)
+                    nsend[task_of_id(id)]++;
+                MPI_Alltoall(nsend.data(), 1, MPI_INT, nrecv.data(), 1, MPI_INT, MPI_COMM_WORLD);
+                size_t nrecv_total = 0;
+                for (int task = 0; task < FML::NTasks; task++)
+                    nrecv_total += nrecv[task];
+
+                // Ask for the position of the minimum of these basins
+                std::vector<IDType> ids_requested(nrecv_total);
+                alltoallv(ids_other_task.data(), nsend, ids_requested.data(), nrecv, sizeof(IDType));
+                std::vector<double> pos_requested(nrecv_total * CGAL_NDIM);
+                for (size_t k = 0; k < nrecv_total; k++) {
+                    assert(ids_requested[k] >= id_start and ids_requested[k] < IDType(id_start + nminima));
+                    position_of_minimum(vminima[ids_requested[k] - id_start], &pos_requested[k * CGAL_NDIM]);
+                }
+                std::vector<double> pos_other_task(ids_other_task.size() * CGAL_NDIM);
+                alltoallv(pos_requested.data(), nrecv, pos_other_task.data(), nsend, CGAL_NDIM * sizeof(double));
+                pos_requested = std::vector<double>();
+
+                // Bin up our particles in these basins
+                std::vector<U> watershed_groups_other_task(ids_other_task.size());
+                for (size_t k = 0; k < ids_other_task.size(); k++)
+                    watershed_groups_other_task[k].init(&pos_other_task[k * CGAL_NDIM]);
+                for (auto i : index_other_task) {
+                    auto v = vs[i];
+                    auto id = v->info().WatershedID;
+                    size_t k = std::lower_bound(ids_other_task.begin(), ids_other_task.end(), id) -
+                               ids_other_task.begin();
+                    watershed_groups_other_task[k].add_particle((T *)v->info().part_ptr, v->info().quantity);
                 }
-                MPI_Barrier(MPI_COMM_WORLD);
+
+                // Send them to the task that has the basin and merge them in
+                std::vector<U> watershed_groups_from_other_task(nrecv_total);
+                alltoallv(watershed_groups_other_task.data(),
+                          nsend,
+                          watershed_groups_from_other_task.data(),
+                          nrecv,
+                          sizeof(U));
+                for (size_t k = 0; k < nrecv_total; k++)
+                    watershed_groups[ids_requested[k] - id_start].merge(watershed_groups_from_other_task[k]);
             }
 #endif
 
             // Finalize the binning
-            if (FML::ThisTask == 0) {
-                for (size_t i = 0; i < ntotal_minima; i++) {
-                    watershed_groups[i].finalize();
-                }
-            } else {
-                // We only keep the data on task 0 so clear the rest to avoid any confusion
-                watershed_groups.clear();
-                watershed_groups.shrink_to_fit();
+            for (size_t i = 0; i < nminima; i++) {
+                watershed_groups[i].finalize();
             }
 
             // XXX The stuff below should be in WatershedDensity or we should store quantity_min above!
@@ -1230,7 +1611,6 @@ namespace FML {
             // i.density_min > j.density_min; } );
 
             /*
-            // NB: only task 0 has groups
             // Second watershed merging. Compile up list of links between groups and send it all to task 0
             std::vector< std::set<IDType> > set_of_group_links(ntotal_minima);
             for(size_t i = 0; i < NumPart; i++){
@@ -1292,7 +1672,8 @@ namespace FML {
         ///
         /// @param[in] p Pointer to the particles
         /// @param[in] NumPart Number of local particles.
-        /// @param[out] watershed_groups The result of the watershed: a list of watershed groups.
+        /// @param[out] watershed_groups The result of the watershed: the watershed groups on this task (see
+        /// WatershedGeneral).
         /// @param[in] buffer_fraction Optional. How big part of the neighbor domain do we include as the buffer.
         /// @param[in] random_fraction Optional. How many (as fraction of the normal particles) random particles do we
         /// add (this is to help speed up the tesslation).
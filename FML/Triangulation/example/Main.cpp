@@ -45,7 +45,8 @@ int main() {
     //=======================================================================================
     // Do a Delaunay tesselation, compute voronoi volumes, locate density minima (or maximima, see h-file)
     // Assign particles to the local density minima using the Delaunay links and bin up data
-    // according to what is defined in the class WatershedBasins. In the end all the info about the groups are on task 0
+    // according to what is defined in the class WatershedBasins. In the end each task has the groups whose
+    // density minimum is on that task
     // This only works in 3D currently, the missing piece is to compute voronoi volumes (i.e. area)
     // from the tesselation in 2D
     //
@@ -62,31 +63,36 @@ int main() {
         part.get_particles_ptr(), part.get_npart(), watershed_groups, buffer_fraction, random_fraction);
 
     // Output the resulting (what is here basically a zobov void) catalogue
-    if (FML::ThisTask == 0) {
-        std::ofstream fp("groups.txt");
-        for (size_t i = 0; i < watershed_groups.size(); i++) {
-            double mean_density = double(partvec.size());
-            double mass = watershed_groups[i].mass;
-            double volume = watershed_groups[i].volume;
-            // double volume_min = watershed_groups[i].volume_min;
-            double density_avg = mass / volume;
-            double density_min = watershed_groups[i].density_min;
-            double delta_avg = density_avg / mean_density - 1.0;
-            double delta_min = density_min / mean_density - 1.0;
-            double radius = std::pow(3.0 * volume / (4.0 * M_PI), 0.33333) * boxsize;
-            fp << std::setw(6)  << i << " ";
-            fp << std::setw(10) << boxsize * watershed_groups[i].pos_barycenter[0] << " ";
-            fp << std::setw(10) << boxsize * watershed_groups[i].pos_barycenter[1] << " ";
-            fp << std::setw(10) << boxsize * watershed_groups[i].pos_barycenter[2] << " ";
-            fp << std::setw(10) << boxsize * watershed_groups[i].pos_min[0] << " ";
-            fp << std::setw(10) << boxsize * watershed_groups[i].pos_min[1] << " ";
-            fp << std::setw(10) << boxsize * watershed_groups[i].pos_min[2] << " ";
-            fp << std::setw(15) << volume << " ";
-            fp << std::setw(10) << radius << " ";
-            fp << std::setw(15) << delta_avg << " ";
-            fp << std::setw(15) << delta_min << " ";
-            fp << std::setw(10) << watershed_groups[i].ningroup << "\n";
+    for (int task = 0; task < FML::NTasks; task++) {
+        if (FML::ThisTask == task) {
+            std::ofstream fp("groups.txt", task == 0 ? std::ios::out : std::ios::app);
+            for (size_t i = 0; i < watershed_groups.size(); i++) {
+                double mean_density = double(partvec.size());
+                double mass = watershed_groups[i].mass;
+                double volume = watershed_groups[i].volume;
+                // double volume_min = watershed_groups[i].volume_min;
+                double density_avg = mass / volume;
+                double density_min = watershed_groups[i].density_min;
+                double delta_avg = density_avg / mean_density - 1.0;
+                double delta_min = density_min / mean_density - 1.0;
+                double radius = std::pow(3.0 * volume / (4.0 * M_PI), 0.33333) * boxsize;
+                fp << std::setw(6)  << i << " ";
+                fp << std::setw(10) << boxsize * watershed_groups[i].pos_barycenter[0] << " ";
+                fp << std::setw(10) << boxsize * watershed_groups[i].pos_barycenter[1] << " ";
+                fp << std::setw(10) << boxsize * watershed_groups[i].pos_barycenter[2] << " ";
+                fp << std::setw(10) << boxsize * watershed_groups[i].pos_min[0] << " ";
+                fp << std::setw(10) << boxsize * watershed_groups[i].pos_min[1] << " ";
+                fp << std::setw(10) << boxsize * watershed_groups[i].pos_min[2] << " ";
+                fp << std::setw(15) << volume << " ";
+                fp << std::setw(10) << radius << " ";
+                fp << std::setw(15) << delta_avg << " ";
+                fp << std::setw(15) << delta_min << " ";
+                fp << std::setw(10) << watershed_groups[i].ningroup << "\n";
+            }
         }
+#ifdef USE_MPI
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
     }
 
     // Other examples:
@@ -104,6 +110,22 @@ int main() {
     // for(auto & p : part) p.set_volume(volumes.pop_front());
     //=======================================================================================
 
+    //=======================================================================================
+    // If we only want the volumes we don't need to keep the whole tesselation in memory.
+    // This tesselates nblocks slabs of the domain (plus a ghost zone) one at the time:
+    // FML::TRIANGULATION::MPIPeriodicDelaunay<Particle> d;
+    // const int nblocks = 16;
+    // std::vector<double> volumes;
+    // d.VoronoiVolumeStreaming(part.get_particles_ptr(), part.get_npart(), volumes, nblocks);
+    //=======================================================================================
+
+    //=======================================================================================
+    // DTFE density contrast (and velocity divergence if the particles have velocities) on a grid
+    // (include FML/Triangulation/DTFE.h):
+    // FML::FFTWGrid<3> density(Nmesh), divergence(Nmesh);
+    // FML::TRIANGULATION::DTFEDensityField(part.get_particles_ptr(), part.get_npart(), density, &divergence);
+    //=======================================================================================
+
     //=======================================================================================
     // More general: assign data to the vertices when doing the tesselation.
     // Define a vertex data struct and give the function the assigns the data.